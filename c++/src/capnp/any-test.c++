@@ -434,6 +434,41 @@ KJ_TEST("Truncating non-null pointer fields does not preserve equality") {
             message1.getRoot<AnyPointer>().equals(message2.getRoot<AnyPointer>()));
 }
 
+KJ_TEST("Pointer-free struct lists compare in bulk") {
+  MallocMessageBuilder builder1;
+  MallocMessageBuilder builder2;
+  auto list1 = builder1.initRoot<test::TestLists>().initList32(100);
+  auto list2 = builder2.initRoot<test::TestLists>().initList32(100);
+  for (auto i: kj::indices(list1)) {
+    list1[i].setF(i * 7);
+    list2[i].setF(i * 7);
+  }
+
+  auto any1 = builder1.getRoot<AnyPointer>();
+  auto any2 = builder2.getRoot<AnyPointer>();
+  KJ_EXPECT(any1.asReader().equals(any2.asReader()) == Equality::EQUAL);
+  KJ_EXPECT(any1.asReader().equals(any1.asReader()) == Equality::EQUAL);
+
+  list2[99].setF(1);
+  KJ_EXPECT(any1.asReader().equals(any2.asReader()) == Equality::NOT_EQUAL);
+  list2[99].setF(99 * 7);
+  KJ_EXPECT(any1.asReader().equals(any2.asReader()) == Equality::EQUAL);
+
+  // A list of wider structs with the same values, padded with zeros, is still equal.
+  MallocMessageBuilder builder3;
+  auto wide = builder3.getRoot<AnyPointer>().initAsListOfAnyStruct(2, 0, 100);
+  for (auto i: kj::indices(wide)) {
+    kj::ArrayPtr<byte> data = wide[i].getDataSection();
+    data[0] = (i * 7) & 0xff;
+    data[1] = (i * 7) >> 8;
+  }
+  AnyList::Reader narrowList = list1.asReader();
+  auto wideList = builder3.getRoot<AnyList>().asReader();
+  KJ_EXPECT(narrowList.equals(wideList) == Equality::EQUAL);
+  wide[50].getDataSection()[8] = 1;
+  KJ_EXPECT(narrowList.equals(wideList) == Equality::NOT_EQUAL);
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
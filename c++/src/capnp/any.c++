@@ -79,24 +79,35 @@ kj::Own<ClientHook> AnyPointer::Pipeline::asCap() {
 
 #endif  // !CAPNP_LITE
 
+static size_t trimTrailingZeros(kj::ArrayPtr<const byte> data) {
+  // Returns the size of `data` with trailing zero bytes removed. Whole words are skipped first,
+  // since data sections are word-sized and their unused tail is usually zero.
+
+  size_t size = data.size();
+  while (size >= sizeof(uint64_t)) {
+    uint64_t tail;
+    memcpy(&tail, data.begin() + size - sizeof(tail), sizeof(tail));
+    if (tail != 0) break;
+    size -= sizeof(tail);
+  }
+  while (size > 0 && data[size - 1] == 0) {
+    -- size;
+  }
+  return size;
+}
+
 Equality AnyStruct::Reader::equals(AnyStruct::Reader right) const {
   auto dataL = getDataSection();
-  size_t dataSizeL = dataL.size();
-  while(dataSizeL > 0 && dataL[dataSizeL - 1] == 0) {
-    -- dataSizeL;
-  }
+  size_t dataSizeL = trimTrailingZeros(dataL);
 
   auto dataR = right.getDataSection();
-  size_t dataSizeR = dataR.size();
-  while(dataSizeR > 0 && dataR[dataSizeR - 1] == 0) {
-    -- dataSizeR;
-  }
+  size_t dataSizeR = trimTrailingZeros(dataR);
 
   if(dataSizeL != dataSizeR) {
     return Equality::NOT_EQUAL;
   }
 
-  if(0 != memcmp(dataL.begin(), dataR.begin(), dataSizeL)) {
+  if(dataL.begin() != dataR.begin() && 0 != memcmp(dataL.begin(), dataR.begin(), dataSizeL)) {
     return Equality::NOT_EQUAL;
   }
 
@@ -190,6 +201,26 @@ Equality AnyList::Reader::equals(AnyList::Reader right) const {
     case ElementSize::INLINE_COMPOSITE: {
       auto llist = as<List<AnyStruct>>();
       auto rlist = right.as<List<AnyStruct>>();
+
+      if (size() > 0) {
+        auto l0 = llist[0];
+        auto r0 = rlist[0];
+        if (l0.getPointerSection().size() == 0 && r0.getPointerSection().size() == 0 &&
+            l0.getDataSection().size() == r0.getDataSection().size()) {
+          // Pointer-free structs with the same layout are packed back-to-back, so the whole list
+          // can be compared in one go.
+          auto bytesL = getRawBytes();
+          auto bytesR = right.getRawBytes();
+          KJ_ASSERT(bytesL.size() == bytesR.size());
+          if (bytesL.begin() == bytesR.begin() ||
+              memcmp(bytesL.begin(), bytesR.begin(), bytesL.size()) == 0) {
+            return Equality::EQUAL;
+          } else {
+            return Equality::NOT_EQUAL;
+          }
+        }
+      }
+
       for(size_t i = 0; i < size(); i++) {
         switch(llist[i].equals(rlist[i])) {
           case Equality::EQUAL:
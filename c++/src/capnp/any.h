@@ -476,6 +476,9 @@ public:
   kj::Array<word> canonicalize() {
     return _reader.canonicalize();
   }
+  void canonicalHash(kj::FunctionParam<void(kj::ArrayPtr<const word>)> update) {
+    _reader.canonicalHash(kj::mv(update));
+  }
 
   Equality equals(AnyStruct::Reader right) const;
   bool operator==(AnyStruct::Reader right) const;
@@ -599,6 +602,8 @@ private:
   template <typename U, Kind K>
   friend struct List;
   friend class Orphanage;
+  template <typename U>
+  friend class ColumnReader;
   template <typename U, Kind K>
   friend struct ToDynamic_;
 };
@@ -33,12 +33,63 @@
 #include "capability.h"
 #endif  // !CAPNP_LITE
 
+#if _MSC_VER && !defined(__clang__)
+#include <intrin.h>
+#endif
+
 namespace capnp {
 namespace _ {  // private
 
 Arena::~Arena() noexcept(false) {}
 
+namespace {
+
+inline bool compareAndSwapLimit(volatile uint64_t* limit, uint64_t& expected, uint64_t desired) {
+  // On failure, updates `expected` to the current value.
+#if _MSC_VER && !defined(__clang__)
+  uint64_t old = _InterlockedCompareExchange64(
+      reinterpret_cast<volatile __int64*>(limit), desired, expected);
+  bool success = old == expected;
+  expected = old;
+  return success;
+#else
+  return __atomic_compare_exchange_n(limit, &expected, desired, true,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+}
+
+}  // namespace
+
+bool ReadLimiter::canReadThreadSafe(uint64_t amount, Arena* arena) {
+  uint64_t current = readLimit();
+  for (;;) {
+    if (KJ_UNLIKELY(amount > current)) {
+      arena->reportReadLimitReached();
+      return false;
+    }
+    if (compareAndSwapLimit(&limit, current, current - amount)) {
+      return true;
+    }
+  }
+}
+
+void ReadLimiter::unreadThreadSafe(uint64_t amount) {
+  uint64_t current = readLimit();
+  for (;;) {
+    uint64_t newValue = current + amount;
+    if (newValue < current) newValue = kj::maxValue;
+    if (compareAndSwapLimit(&limit, current, newValue)) {
+      return;
+    }
+  }
+}
+
 void ReadLimiter::unread(WordCount64 amount) {
+  if (threadSafe) {
+    unreadThreadSafe(unbound(amount / WORDS));
+    return;
+  }
+
   // Be careful not to overflow here.  Since ReadLimiter has no thread-safety, it's possible that
   // the limit value was not updated correctly for one or more reads, and therefore unread() could
   // overflow it even if it is only unreading bytes that were actually read.
@@ -90,7 +141,8 @@ static SegmentWordCount verifySegment(kj::ArrayPtr<const word> segment) {
 inline ReaderArena::ReaderArena(MessageReader* message, const word* firstSegment,
                                 SegmentWordCount firstSegmentSize)
     : message(message),
-      readLimiter(bounded(message->getOptions().traversalLimitInWords) * WORDS),
+      readLimiter(bounded(message->getOptions().traversalLimitInWords) * WORDS,
+                  message->getOptions().threadSafeTraversalLimit),
       segment0(this, SegmentId(0), firstSegment, firstSegmentSize, &readLimiter) {}
 
 inline ReaderArena::ReaderArena(MessageReader* message, kj::ArrayPtr<const word> firstSegment)
@@ -111,6 +163,17 @@ size_t ReaderArena::sizeInWords() {
   }
 }
 
+void ReaderArena::setTrusted() {
+  segment0.setTrusted();
+
+  auto lock = moreSegments.lockExclusive();
+  KJ_IF_MAYBE(s, *lock) {
+    for (auto& entry: *s) {
+      entry.value->setTrusted();
+    }
+  }
+}
+
 SegmentReader* ReaderArena::tryGetSegment(SegmentId id) {
   if (id == SegmentId(0)) {
     if (segment0.getArray() == nullptr) {
@@ -144,6 +207,10 @@ SegmentReader* ReaderArena::tryGetSegment(SegmentId id) {
 
   auto segment = kj::heap<SegmentReader>(
       this, id, newSegment.begin(), newSegmentSize, &readLimiter);
+  if (segment0.isTrusted()) {
+    // Segments loaded after the message was trusted inherit that.
+    segment->setTrusted();
+  }
   SegmentReader* result = segment;
   segments->insert(id.value, kj::mv(segment));
   return result;
@@ -182,7 +249,7 @@ BuilderArena::BuilderArena(MessageBuilder* message,
     segmentWithSpace = builders.back();
 
     this->moreSegments = kj::heap<MultiSegmentState>(
-        MultiSegmentState { kj::mv(builders), kj::mv(forOutput) });
+        MultiSegmentState { kj::mv(builders), kj::mv(forOutput), {} });
 
   } else {
     segmentWithSpace = &segment0;
@@ -263,7 +330,18 @@ BuilderArena::AllocateResult BuilderArena::allocate(SegmentWordCount amount) {
 }
 
 SegmentBuilder* BuilderArena::addExternalSegment(kj::ArrayPtr<const word> content) {
-  return addSegmentInternal(content);
+  KJ_IF_MAYBE(s, moreSegments) {
+    KJ_IF_MAYBE(existing, s->get()->externalSegments.find(content.begin())) {
+      if ((*existing)->getArray().size() == content.size()) {
+        return *existing;
+      }
+    }
+  }
+
+  SegmentBuilder* result = addSegmentInternal(content);
+  KJ_ASSERT_NONNULL(moreSegments)->externalSegments.upsert(content.begin(), result,
+      [](SegmentBuilder*& existing, SegmentBuilder* replacement) { existing = replacement; });
+  return result;
 }
 
 template <typename T>
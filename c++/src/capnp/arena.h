@@ -75,11 +75,14 @@ class ReadLimiter {
   //
   // This class is "safe" to use from multiple threads for its intended use case.  Threads may
   // overwrite each others' changes to the counter, but this is OK because it only means that the
-  // limit is enforced a bit less strictly -- it will still kick in eventually.
+  // limit is enforced a bit less strictly -- it will still kick in eventually.  If the limit must
+  // be enforced exactly even when many threads read the same message at once, construct the
+  // limiter with `threadSafe = true`, which updates the counter with compare-and-swap instead.
 
 public:
   inline explicit ReadLimiter();                     // No limit.
-  inline explicit ReadLimiter(WordCount64 limit);    // Limit to the given number of words.
+  inline explicit ReadLimiter(WordCount64 limit, bool threadSafe = false);
+  // Limit to the given number of words.
 
   inline void reset(WordCount64 limit);
 
@@ -99,8 +102,14 @@ private:
   // alignas(8) is the default on 64-bit systems, but needed on 32-bit to avoid an expensive
   // unaligned atomic operation.
 
+  bool threadSafe;
+  // Whether to update `limit` with compare-and-swap, so that concurrent updates are never lost.
+
   KJ_DISALLOW_COPY(ReadLimiter);
 
+  bool canReadThreadSafe(uint64_t amount, Arena* arena);
+  void unreadThreadSafe(uint64_t amount);
+
   KJ_ALWAYS_INLINE(void setLimit(uint64_t newLimit)) {
 #if defined(__GNUC__) || defined(__clang__)
     __atomic_store_n(&limit, newLimit, __ATOMIC_RELAXED);
@@ -168,11 +177,18 @@ public:
   inline void unread(WordCount64 amount);
   // Add back some words to the ReadLimiter.
 
+  inline bool isTrusted();
+  inline void setTrusted();
+  // A trusted segment belongs to a message that has already been validated as a whole (or that is
+  // known to be valid), so checkOffset(), checkObject(), and amplifiedRead() skip their checks and
+  // stop charging the ReadLimiter. See MessageReader::validateAndTrust().
+
 private:
   Arena* arena;
   SegmentId id;
   kj::ArrayPtr<const word> ptr;  // size guaranteed to fit in SEGMENT_WORD_COUNT_BITS bits
   ReadLimiter* readLimiter;
+  bool trusted = false;
 
   KJ_DISALLOW_COPY(SegmentReader);
 
@@ -250,6 +266,10 @@ public:
 
   size_t sizeInWords();
 
+  void setTrusted();
+  // Mark every segment of the message trusted, including ones not loaded yet. See
+  // SegmentReader::setTrusted().
+
   // implements Arena ------------------------------------------------
   SegmentReader* tryGetSegment(SegmentId id) override;
   void reportReadLimitReached() override;
@@ -338,6 +358,9 @@ public:
   // large mmap'd file into a message as `Data` without forcing that data to actually be read in
   // from disk (until the message itself is written out).  `Orphanage` provides the public API for
   // this feature.
+  //
+  // Adding the same region again returns the segment added before, so that referencing many
+  // objects in one external region doesn't grow the segment table.
 
   // implements Arena ------------------------------------------------
   SegmentReader* tryGetSegment(SegmentId id) override;
@@ -367,6 +390,8 @@ private:
   struct MultiSegmentState {
     kj::Vector<kj::Own<SegmentBuilder>> builders;
     kj::Vector<kj::ArrayPtr<const word>> forOutput;
+    kj::HashMap<const word*, SegmentBuilder*> externalSegments;
+    // External segments, by start address, for addExternalSegment() to reuse.
   };
   kj::Maybe<kj::Own<MultiSegmentState>> moreSegments;
 
@@ -382,15 +407,20 @@ private:
 // =======================================================================================
 
 inline ReadLimiter::ReadLimiter()
-    : limit(kj::maxValue) {}
+    : limit(kj::maxValue), threadSafe(false) {}
 
-inline ReadLimiter::ReadLimiter(WordCount64 limit): limit(unbound(limit / WORDS)) {}
+inline ReadLimiter::ReadLimiter(WordCount64 limit, bool threadSafe)
+    : limit(unbound(limit / WORDS)), threadSafe(threadSafe) {}
 
 inline void ReadLimiter::reset(WordCount64 limit) {
   setLimit(unbound(limit / WORDS));
 }
 
 inline bool ReadLimiter::canRead(WordCount64 amount, Arena* arena) {
+  if (KJ_UNLIKELY(threadSafe)) {
+    return canReadThreadSafe(unbound(amount / WORDS), arena);
+  }
+
   // Be careful not to store an underflowed value into `limit`, even if multiple threads are
   // decrementing it.
   uint64_t current = readLimit();
@@ -411,6 +441,8 @@ inline SegmentReader::SegmentReader(Arena* arena, SegmentId id, const word* ptr,
       readLimiter(readLimiter) {}
 
 inline const word* SegmentReader::checkOffset(const word* from, ptrdiff_t offset) {
+  if (trusted) return from + offset;
+
   ptrdiff_t min = ptr.begin() - from;
   ptrdiff_t max = ptr.end() - from;
   if (offset >= min && offset <= max) {
@@ -421,6 +453,8 @@ inline const word* SegmentReader::checkOffset(const word* from, ptrdiff_t offset
 }
 
 inline bool SegmentReader::checkObject(const word* start, WordCountN<31> size) {
+  if (trusted) return true;
+
   auto startOffset = intervalLength(ptr.begin(), start, MAX_SEGMENT_WORDS);
 #ifdef KJ_DEBUG
   if (startOffset > bounded(ptr.size()) * WORDS) {
@@ -432,7 +466,7 @@ inline bool SegmentReader::checkObject(const word* start, WordCountN<31> size) {
 }
 
 inline bool SegmentReader::amplifiedRead(WordCount virtualAmount) {
-  return readLimiter->canRead(virtualAmount, arena);
+  return trusted || readLimiter->canRead(virtualAmount, arena);
 }
 
 inline Arena* SegmentReader::getArena() { return arena; }
@@ -447,6 +481,8 @@ inline SegmentWordCount SegmentReader::getSize() {
 }
 inline kj::ArrayPtr<const word> SegmentReader::getArray() { return ptr; }
 inline void SegmentReader::unread(WordCount64 amount) { readLimiter->unread(amount); }
+inline bool SegmentReader::isTrusted() { return trusted; }
+inline void SegmentReader::setTrusted() { trusted = true; }
 
 // -------------------------------------------------------------------
 
@@ -64,5 +64,118 @@ const ::capnp::_::RawSchema s_f264a779fef191ce = {
   0, 0, nullptr, nullptr, nullptr, { &s_f264a779fef191ce, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<20> b_8a38c5bbce0d7a20 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+     32, 122,  13, 206, 187, 197,  56, 138,
+     16,   0,   0,   0,   5,   0,  16,   0,
+    129,  78,  48, 184, 123, 125, 248, 189,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 194,   0,   0,   0,
+     29,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     24,   0,   0,   0,   3,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47,  99,  43,
+     43,  46,  99,  97, 112, 110, 112,  58,
+     99, 111, 108, 117, 109, 110, 115,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_8a38c5bbce0d7a20 = b_8a38c5bbce0d7a20.words;
+#if !CAPNP_LITE
+const ::capnp::_::RawSchema s_8a38c5bbce0d7a20 = {
+  0x8a38c5bbce0d7a20, b_8a38c5bbce0d7a20.words, 20, nullptr, nullptr,
+  0, 0, nullptr, nullptr, nullptr, { &s_8a38c5bbce0d7a20, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<21> b_ff884b790b7e3876 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    118,  56, 126,  11, 121,  75, 136, 255,
+     16,   0,   0,   0,   5,   0,   0,   2,
+    129,  78,  48, 184, 123, 125, 248, 189,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 210,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     28,   0,   0,   0,   3,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47,  99,  43,
+     43,  46,  99,  97, 112, 110, 112,  58,
+     99,  97,  99, 104, 101,  97,  98, 108,
+    101,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_ff884b790b7e3876 = b_ff884b790b7e3876.words;
+#if !CAPNP_LITE
+const ::capnp::_::RawSchema s_ff884b790b7e3876 = {
+  0xff884b790b7e3876, b_ff884b790b7e3876.words, 21, nullptr, nullptr,
+  0, 0, nullptr, nullptr, nullptr, { &s_ff884b790b7e3876, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<21> b_90b60d444ea2578c = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    140,  87, 162,  78,  68,  13, 182, 144,
+     16,   0,   0,   0,   5,   0,   1,   0,
+    129,  78,  48, 184, 123, 125, 248, 189,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 210,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     28,   0,   0,   0,   3,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47,  99,  43,
+     43,  46,  99,  97, 112, 110, 112,  58,
+    111, 117, 116,  79, 102,  76, 105, 110,
+    101,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_90b60d444ea2578c = b_90b60d444ea2578c.words;
+#if !CAPNP_LITE
+const ::capnp::_::RawSchema s_90b60d444ea2578c = {
+  0x90b60d444ea2578c, b_90b60d444ea2578c.words, 21, nullptr, nullptr,
+  0, 0, nullptr, nullptr, nullptr, { &s_90b60d444ea2578c, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_bdf87d7bb8304e81[] = {
+  nullptr,
+  nullptr,
+  &s_90b60d444ea2578c,
+  &s_f264a779fef191ce,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_b9c6f99ebf805f2c,
+  nullptr,
+  &s_8a38c5bbce0d7a20,
+  nullptr,
+  &s_ff884b790b7e3876,
+  nullptr,
+  nullptr,
+};
+static const uint32_t xh_bdf87d7bb8304e81[] = {1, 1, 2, 1};
+const ::capnp::_::RawSchemaIndex x_bdf87d7bb8304e81 = {
+  xs_bdf87d7bb8304e81, xh_bdf87d7bb8304e81, 16, 4, 5
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
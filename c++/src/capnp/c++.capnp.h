@@ -18,6 +18,10 @@ namespace schemas {
 
 CAPNP_DECLARE_SCHEMA(b9c6f99ebf805f2c);
 CAPNP_DECLARE_SCHEMA(f264a779fef191ce);
+CAPNP_DECLARE_SCHEMA(8a38c5bbce0d7a20);
+CAPNP_DECLARE_SCHEMA(ff884b790b7e3876);
+CAPNP_DECLARE_SCHEMA(90b60d444ea2578c);
+CAPNP_DECLARE_SCHEMA_INDEX(bdf87d7bb8304e81);
 
 }  // namespace schemas
 }  // namespace capnp
@@ -0,0 +1,228 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "cache.h"
+#include "test-util.h"
+#include "rpc-twoparty.h"
+#include <kj/debug.h>
+#include <kj/map.h>
+#include <kj/test.h>
+
+namespace capnp {
+namespace _ {
+namespace {
+
+class TestCacheableImpl final: public test::TestCacheable::Server {
+public:
+  kj::HashMap<kj::String, kj::String> values;
+  uint calls = 0;
+  int fooCalls = 0;
+
+  kj::Promise<void> lookup(LookupContext context) override {
+    ++calls;
+    auto key = context.getParams().getKey();
+    context.getResults().setValue(values.find(key).map([](kj::String& value) -> kj::StringPtr {
+      return value;
+    }).orDefault(""));
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> lookupFresh(LookupFreshContext context) override {
+    ++calls;
+    context.getResults().setValue(kj::str(context.getParams().getKey(), '#', calls));
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> update(UpdateContext context) override {
+    ++calls;
+    auto params = context.getParams();
+    values.upsert(kj::str(params.getKey()), kj::str(params.getValue()),
+        [](kj::String& existing, kj::String&& replacement) { existing = kj::mv(replacement); });
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> lookupCap(LookupCapContext context) override {
+    ++calls;
+    context.getResults().setCap(kj::heap<TestInterfaceImpl>(fooCalls));
+    return kj::READY_NOW;
+  }
+};
+
+class FakeClock final: public kj::MonotonicClock {
+public:
+  kj::TimePoint time = kj::origin<kj::TimePoint>();
+  kj::TimePoint now() const override { return time; }
+};
+
+kj::Promise<kj::String> lookup(test::TestCacheable::Client& cap, kj::StringPtr key) {
+  auto request = cap.lookupRequest();
+  request.setKey(key);
+  return request.send().then([](auto&& response) { return kj::str(response.getValue()); });
+}
+
+void update(test::TestCacheable::Client& cap, kj::StringPtr key, kj::StringPtr value,
+            kj::WaitScope& waitScope) {
+  auto request = cap.updateRequest();
+  request.setKey(key);
+  request.setValue(value);
+  request.send().wait(waitScope);
+}
+
+KJ_TEST("ResultCache answers repeated lookups from the cache") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto ownServer = kj::heap<TestCacheableImpl>();
+  auto& server = *ownServer;
+  auto cache = kj::refcounted<ResultCache>();
+  auto cap = cache->wrap(test::TestCacheable::Client(kj::mv(ownServer)));
+
+  update(cap, "a", "1", waitScope);
+  KJ_EXPECT(server.calls == 1);
+
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "1");
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "1");
+  KJ_EXPECT(server.calls == 2);
+  KJ_EXPECT(lookup(cap, "b").wait(waitScope) == "");
+  KJ_EXPECT(server.calls == 3);
+
+  auto stats = cache->getStats();
+  KJ_EXPECT(stats.hits == 1);
+  KJ_EXPECT(stats.misses == 2);
+  KJ_EXPECT(stats.entryCount == 2);
+  KJ_EXPECT(stats.bytes > 0);
+
+  // Writes pass through, but the server must invalidate what they affect.
+  update(cap, "a", "2", waitScope);
+  KJ_EXPECT(server.calls == 4);
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "1");
+  cache->invalidate(typeId<test::TestCacheable>(), 0);
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "2");
+  KJ_EXPECT(server.calls == 5);
+
+  // A lookup in flight during an invalidation isn't cached.
+  auto promise = lookup(cap, "c");
+  cache->invalidate();
+  KJ_EXPECT(promise.wait(waitScope) == "");
+  KJ_EXPECT(cache->getStats().entryCount == 0);
+  KJ_EXPECT(lookup(cap, "c").wait(waitScope) == "");
+  KJ_EXPECT(server.calls == 7);
+
+  // Each wrapped capability has its own entries.
+  auto ownOther = kj::heap<TestCacheableImpl>();
+  auto& other = *ownOther;
+  auto otherCap = cache->wrap(test::TestCacheable::Client(kj::mv(ownOther)));
+  KJ_EXPECT(lookup(otherCap, "c").wait(waitScope) == "");
+  KJ_EXPECT(other.calls == 1);
+}
+
+KJ_TEST("ResultCache expires and evicts entries") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  FakeClock clock;
+  auto ownServer = kj::heap<TestCacheableImpl>();
+  auto& server = *ownServer;
+  auto cache = kj::refcounted<ResultCache>(16u << 20, clock);
+  auto cap = cache->wrap(test::TestCacheable::Client(kj::mv(ownServer)));
+
+  auto lookupFresh = [&](kj::StringPtr key) {
+    auto request = cap.lookupFreshRequest();
+    request.setKey(key);
+    return kj::str(request.send().wait(waitScope).getValue());
+  };
+
+  KJ_EXPECT(lookupFresh("a") == "a#1");
+  clock.time += 99 * kj::MILLISECONDS;
+  KJ_EXPECT(lookupFresh("a") == "a#1");
+  clock.time += 1 * kj::MILLISECONDS;
+  KJ_EXPECT(lookupFresh("a") == "a#2");
+  KJ_EXPECT(server.calls == 2);
+
+  // Lookups on capabilities aren't cached, nor are results containing capabilities.
+  auto lookupCap = [&]() {
+    auto request = cap.lookupCapRequest();
+    request.setKey("a");
+    return request.send().wait(waitScope).getCap();
+  };
+  lookupCap();
+  lookupCap();
+  KJ_EXPECT(server.calls == 4);
+
+  // setCacheable() opts in methods that aren't annotated.
+  cache->setCacheable(typeId<test::TestCacheable>(), 2);
+  update(cap, "a", "1", waitScope);
+  update(cap, "a", "1", waitScope);
+  KJ_EXPECT(server.calls == 5);
+
+  // Evict down to the size limit, least-recently-used first.
+  auto small = kj::refcounted<ResultCache>(1);
+  auto smallCap = small->wrap(test::TestCacheable::Client(kj::heap<TestCacheableImpl>()));
+  KJ_EXPECT(lookup(smallCap, "a").wait(waitScope) == "");
+  KJ_EXPECT(small->getStats().entryCount == 0);
+
+  auto probe = kj::refcounted<ResultCache>();
+  auto probeCap = probe->wrap(test::TestCacheable::Client(kj::heap<TestCacheableImpl>()));
+  lookup(probeCap, "x").wait(waitScope);
+  size_t entrySize = probe->getStats().bytes;
+
+  auto bounded = kj::refcounted<ResultCache>(entrySize * 2);
+  auto ownBoundedServer = kj::heap<TestCacheableImpl>();
+  auto& boundedServer = *ownBoundedServer;
+  auto boundedCap = bounded->wrap(test::TestCacheable::Client(kj::mv(ownBoundedServer)));
+  lookup(boundedCap, "a").wait(waitScope);
+  lookup(boundedCap, "b").wait(waitScope);
+  lookup(boundedCap, "a").wait(waitScope);
+  lookup(boundedCap, "c").wait(waitScope);
+  KJ_EXPECT(bounded->getStats().entryCount == 2);
+  KJ_EXPECT(boundedServer.calls == 3);
+  lookup(boundedCap, "a").wait(waitScope);
+  KJ_EXPECT(boundedServer.calls == 3);
+  lookup(boundedCap, "b").wait(waitScope);
+  KJ_EXPECT(boundedServer.calls == 4);
+}
+
+KJ_TEST("ResultCache over RPC") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  auto ownServer = kj::heap<TestCacheableImpl>();
+  auto& server = *ownServer;
+  auto cache = kj::refcounted<ResultCache>();
+
+  TwoPartyClient tpClient(*pipe.ends[0]);
+  TwoPartyClient tpServer(*pipe.ends[1],
+      cache->wrap(test::TestCacheable::Client(kj::mv(ownServer))),
+      rpc::twoparty::Side::SERVER);
+
+  auto cap = tpClient.bootstrap().castAs<test::TestCacheable>();
+
+  update(cap, "a", "1", waitScope);
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "1");
+  KJ_EXPECT(lookup(cap, "a").wait(waitScope) == "1");
+  KJ_EXPECT(server.calls == 2);
+  KJ_EXPECT(cache->getStats().hits == 1);
+}
+
+}  // namespace
+}  // namespace _
+}  // namespace capnp
@@ -0,0 +1,390 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "cache.h"
+#include "message.h"
+#include <kj/debug.h>
+#include <kj/list.h>
+#include <kj/map.h>
+
+namespace capnp {
+
+namespace {
+
+static constexpr uint64_t CACHEABLE_ANNOTATION_ID = 0xff884b790b7e3876ull;
+// $Cxx.cacheable, from c++.capnp.
+
+kj::Maybe<kj::Array<word>> canonicalizeStruct(AnyPointer::Reader value) {
+  // Returns null if the value can't be canonicalized, which happens if it contains capabilities.
+
+  kj::Maybe<kj::Array<word>> result;
+  kj::runCatchingExceptions([&]() {
+    result = value.getAs<AnyStruct>().canonicalize();
+  });
+  return result;
+}
+
+struct MethodKey {
+  uint64_t interfaceId;
+  uint16_t methodId;
+
+  inline bool operator==(const MethodKey& other) const {
+    return interfaceId == other.interfaceId && methodId == other.methodId;
+  }
+  inline uint hashCode() const {
+    return kj::hashCode(interfaceId, methodId);
+  }
+};
+
+struct EntryKey {
+  uint64_t target;
+  // Identifies the wrapped capability.
+
+  MethodKey method;
+
+  kj::ArrayPtr<const word> params;
+  // Canonical params. Points into the Entry, or at the lookup's own copy.
+
+  inline bool operator==(const EntryKey& other) const {
+    return target == other.target && method == other.method &&
+           params.asBytes() == other.params.asBytes();
+  }
+  inline uint hashCode() const {
+    return kj::hashCode(target, method.interfaceId, method.methodId, params.asBytes());
+  }
+};
+
+class Entry final: public ResponseHook, public kj::Refcounted {
+  // Cached results. Refcounted so that callers on this thread can keep using the results after
+  // the entry is evicted.
+
+public:
+  Entry(uint64_t target, MethodKey method, kj::Array<word> params, kj::Array<word> results,
+        kj::Maybe<kj::TimePoint> expires)
+      : target(target), method(method), params(kj::mv(params)), results(kj::mv(results)),
+        expires(expires) {}
+
+  EntryKey getKey() const { return { target, method, params }; }
+
+  AnyPointer::Reader getResults() const {
+    return readMessageUnchecked<AnyPointer>(results.begin());
+  }
+
+  size_t getSize() const {
+    return (params.size() + results.size()) * sizeof(word) + sizeof(Entry);
+  }
+
+  uint64_t target;
+  MethodKey method;
+  kj::Array<word> params;
+  kj::Array<word> results;
+  kj::Maybe<kj::TimePoint> expires;
+  kj::ListLink<Entry> link;
+};
+
+}  // namespace
+
+struct ResultCache::Impl {
+  Impl(size_t maxBytes, const kj::MonotonicClock& clock): maxBytes(maxBytes), clock(clock) {}
+
+  ~Impl() noexcept(false) {
+    clear();
+  }
+
+  size_t maxBytes;
+  const kj::MonotonicClock& clock;
+
+  kj::HashMap<MethodKey, kj::Duration> cacheable;
+  // Cacheable methods and their TTLs (zero for none).
+
+  kj::HashMap<EntryKey, kj::Own<Entry>> entries;
+  kj::List<Entry, &Entry::link> lru;
+  // Least recently used first.
+
+  uint64_t nextTarget = 0;
+  uint64_t generation = 0;
+  // Bumped on every invalidation, so that results of calls which were in flight at the time
+  // aren't cached.
+
+  size_t bytes = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  kj::Maybe<kj::Duration> getTtl(MethodKey method) {
+    return cacheable.find(method).map([](kj::Duration& ttl) { return ttl; });
+  }
+
+  kj::Maybe<kj::Own<Entry>> lookup(uint64_t target, MethodKey method,
+                                   kj::ArrayPtr<const word> params) {
+    KJ_IF_MAYBE(entry, entries.find(EntryKey { target, method, params })) {
+      auto& e = **entry;
+      KJ_IF_MAYBE(expires, e.expires) {
+        if (*expires <= clock.now()) {
+          erase(e);
+          ++misses;
+          return nullptr;
+        }
+      }
+
+      lru.remove(e);
+      lru.add(e);
+      ++hits;
+      return kj::addRef(e);
+    } else {
+      ++misses;
+      return nullptr;
+    }
+  }
+
+  void store(uint64_t target, MethodKey method, kj::Array<word> params,
+             AnyPointer::Reader results, uint64_t generationAtCall, kj::Duration ttl) {
+    if (generation != generationAtCall) return;
+
+    KJ_IF_MAYBE(canonical, canonicalizeStruct(results)) {
+      kj::Maybe<kj::TimePoint> expires;
+      if (ttl > 0 * kj::SECONDS) expires = clock.now() + ttl;
+
+      auto entry = kj::refcounted<Entry>(target, method, kj::mv(params), kj::mv(*canonical),
+                                         expires);
+      size_t size = entry->getSize();
+      if (size > maxBytes) return;
+
+      // An identical call may have completed while this one was in flight.
+      KJ_IF_MAYBE(existing, entries.find(entry->getKey())) {
+        erase(**existing);
+      }
+
+      while (bytes + size > maxBytes) {
+        erase(lru.front());
+      }
+
+      bytes += size;
+      lru.add(*entry);
+      auto key = entry->getKey();
+      entries.insert(key, kj::mv(entry));
+    }
+  }
+
+  void erase(Entry& entry) {
+    bytes -= entry.getSize();
+    lru.remove(entry);
+    entries.erase(entry.getKey());
+  }
+
+  void clear() {
+    while (!lru.empty()) {
+      erase(lru.front());
+    }
+  }
+};
+
+class ResultCache::CachingHook final: public ClientHook, public kj::Refcounted {
+public:
+  CachingHook(kj::Own<ResultCache> cache, kj::Own<ClientHook> inner)
+      : cache(kj::mv(cache)), inner(kj::mv(inner)), target(this->cache->impl->nextTarget++) {}
+
+  Request<AnyPointer, AnyPointer> newCall(
+      uint64_t interfaceId, uint16_t methodId, kj::Maybe<MessageSize> sizeHint) override {
+    auto result = inner->newCall(interfaceId, methodId, sizeHint);
+    MethodKey method { interfaceId, methodId };
+    KJ_IF_MAYBE(ttl, cache->impl->getTtl(method)) {
+      AnyPointer::Builder builder = result;
+      auto hook = kj::heap<RequestImpl>(kj::addRef(*this), method, *ttl, builder,
+                                        RequestHook::from(kj::mv(result)));
+      return { builder, kj::mv(hook) };
+    } else {
+      return result;
+    }
+  }
+
+  VoidPromiseAndPipeline call(uint64_t interfaceId, uint16_t methodId,
+                              kj::Own<CallContextHook>&& context) override {
+    MethodKey method { interfaceId, methodId };
+    auto& impl = *cache->impl;
+    KJ_IF_MAYBE(ttl, impl.getTtl(method)) {
+      auto params = context->getParams();
+      KJ_IF_MAYBE(canonical, canonicalizeStruct(params)) {
+        KJ_IF_MAYBE(entry, impl.lookup(target, method, *canonical)) {
+          context->releaseParams();
+          AnyPointer::Reader results = (*entry)->getResults();
+          context->getResults(results.targetSize()).set(results);
+          return { kj::READY_NOW, noCapabilities() };
+        }
+
+        auto request = inner->newCall(interfaceId, methodId, params.targetSize());
+        request.set(params);
+        context->releaseParams();
+
+        auto promise = request.send();
+        auto pipeline = PipelineHook::from(kj::mv(promise));
+        auto done = kj::Promise<Response<AnyPointer>>(kj::mv(promise))
+            .then([self = kj::addRef(*this), method, ttl = *ttl, params = kj::mv(*canonical),
+                   generation = impl.generation, context = kj::mv(context)]
+                  (Response<AnyPointer>&& response) mutable {
+          AnyPointer::Reader results = response;
+          context->getResults(results.targetSize()).set(results);
+          self->cache->impl->store(self->target, method, kj::mv(params), results, generation, ttl);
+        });
+        return { kj::mv(done), kj::mv(pipeline) };
+      }
+    }
+
+    return inner->call(interfaceId, methodId, kj::mv(context));
+  }
+
+  kj::Maybe<ClientHook&> getResolved() override {
+    // Resolving to `inner` would let callers bypass the cache.
+    return nullptr;
+  }
+
+  kj::Maybe<kj::Promise<kj::Own<ClientHook>>> whenMoreResolved() override {
+    return nullptr;
+  }
+
+  kj::Own<ClientHook> addRef() override {
+    return kj::addRef(*this);
+  }
+
+  const void* getBrand() override {
+    return nullptr;
+  }
+
+  kj::Maybe<int> getFd() override {
+    return inner->getFd();
+  }
+
+private:
+  kj::Own<ResultCache> cache;
+  kj::Own<ClientHook> inner;
+  uint64_t target;
+
+  static kj::Own<PipelineHook> noCapabilities() {
+    // Cached results never contain capabilities, so there's nothing to pipeline on.
+    return newBrokenPipeline(KJ_EXCEPTION(FAILED, "cached results contain no capabilities"));
+  }
+
+  class RequestImpl final: public RequestHook {
+  public:
+    RequestImpl(kj::Own<CachingHook> parent, MethodKey method, kj::Duration ttl,
+                AnyPointer::Builder params, kj::Own<RequestHook> inner)
+        : parent(kj::mv(parent)), method(method), ttl(ttl), params(params),
+          inner(kj::mv(inner)) {}
+
+    RemotePromise<AnyPointer> send() override {
+      KJ_IF_MAYBE(canonical, canonicalizeStruct(params.asReader())) {
+        auto& impl = *parent->cache->impl;
+        KJ_IF_MAYBE(entry, impl.lookup(parent->target, method, *canonical)) {
+          // Hand out the cached message itself. Our own request is never sent.
+          AnyPointer::Reader results = (*entry)->getResults();
+          return RemotePromise<AnyPointer>(
+              kj::Promise<Response<AnyPointer>>(Response<AnyPointer>(results, kj::mv(*entry))),
+              AnyPointer::Pipeline(noCapabilities()));
+        }
+
+        auto promise = inner->send();
+        auto pipeline = PipelineHook::from(kj::mv(promise));
+        auto done = kj::Promise<Response<AnyPointer>>(kj::mv(promise))
+            .then([parent = kj::addRef(*parent), method = method, ttl = ttl,
+                   params = kj::mv(*canonical), generation = impl.generation]
+                  (Response<AnyPointer>&& response) mutable {
+          parent->cache->impl->store(parent->target, method, kj::mv(params), response,
+                                     generation, ttl);
+          return kj::mv(response);
+        });
+        return RemotePromise<AnyPointer>(kj::mv(done), AnyPointer::Pipeline(kj::mv(pipeline)));
+      } else {
+        return inner->send();
+      }
+    }
+
+    kj::Promise<void> sendStreaming() override {
+      return inner->sendStreaming();
+    }
+
+    const void* getBrand() override {
+      return nullptr;
+    }
+
+    void setDeadline(kj::TimePoint deadline) override {
+      inner->setDeadline(deadline);
+    }
+
+  private:
+    kj::Own<CachingHook> parent;
+    MethodKey method;
+    kj::Duration ttl;
+    AnyPointer::Builder params;
+    kj::Own<RequestHook> inner;
+  };
+};
+
+ResultCache::ResultCache(size_t maxBytes, const kj::MonotonicClock& clock)
+    : impl(kj::heap<Impl>(maxBytes, clock)) {}
+
+ResultCache::~ResultCache() noexcept(false) {}
+
+Capability::Client ResultCache::wrap(Capability::Client inner, InterfaceSchema schema) {
+  auto addAnnotated = [this](InterfaceSchema schema, auto& addAnnotated) -> void {
+    uint64_t interfaceId = schema.getProto().getId();
+    for (auto method: schema.getMethods()) {
+      for (auto annotation: method.getProto().getAnnotations()) {
+        if (annotation.getId() == CACHEABLE_ANNOTATION_ID) {
+          setCacheable(interfaceId, method.getIndex(),
+                       annotation.getValue().getUint32() * kj::MILLISECONDS);
+        }
+      }
+    }
+    for (auto superclass: schema.getSuperclasses()) {
+      addAnnotated(superclass, addAnnotated);
+    }
+  };
+  addAnnotated(schema, addAnnotated);
+
+  return Capability::Client(kj::refcounted<CachingHook>(
+      kj::addRef(*this), ClientHook::from(kj::mv(inner))));
+}
+
+void ResultCache::setCacheable(uint64_t interfaceId, uint16_t methodId, kj::Duration ttl) {
+  impl->cacheable.upsert(MethodKey { interfaceId, methodId }, ttl,
+      [](kj::Duration& existing, kj::Duration&& replacement) { existing = replacement; });
+}
+
+void ResultCache::invalidate() {
+  ++impl->generation;
+  impl->clear();
+}
+
+void ResultCache::invalidate(uint64_t interfaceId, uint16_t methodId) {
+  ++impl->generation;
+  MethodKey method { interfaceId, methodId };
+  for (auto iter = impl->lru.begin(); iter != impl->lru.end();) {
+    auto& entry = *iter++;
+    if (entry.method == method) {
+      impl->erase(entry);
+    }
+  }
+}
+
+ResultCache::Stats ResultCache::getStats() const {
+  return { impl->hits, impl->misses, impl->entries.size(), impl->bytes };
+}
+
+}  // namespace capnp
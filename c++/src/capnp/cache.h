@@ -0,0 +1,111 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "capability.h"
+#include "schema.h"
+#include <kj/refcount.h>
+#include <kj/time.h>
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+class ResultCache final: public kj::Refcounted {
+  // Caches the results of methods which are pure lookups, so that repeated calls with the same
+  // params are answered without calling the server again.
+  //
+  // Wrap capabilities with `wrap()`. Methods opt in with the `$Cxx.cacheable` annotation (see
+  // /capnp/c++.capnp) on their declaration, or with `setCacheable()`. Calls to other methods pass
+  // straight through, as do calls whose params contain capabilities. Results which contain
+  // capabilities are never cached.
+  //
+  // A call's results are reused for a later call to the same capability (as wrapped) and method
+  // with params that are equal once canonicalized (see `AnyStruct::Reader::canonicalize()`).
+  // Results are kept in canonical form, so an entry costs about the size of its params plus its
+  // results; once the total would exceed `maxBytes`, the least-recently-used entries are evicted.
+  // When the data behind a lookup changes, call `invalidate()`.
+  //
+  // Calls from the same thread get the cached message itself, without copying. Calls arriving
+  // over RPC get a copy of it in their results.
+  //
+  // Example:
+  //
+  //     auto cache = kj::refcounted<ResultCache>();
+  //     Directory::Client dir = cache->wrap(Directory::Client(kj::heap<DirectoryImpl>()));
+  //
+  // A server whose writes affect its lookups can hold a reference to the cache (from
+  // `kj::addRef()`) in order to invalidate them.
+
+public:
+  explicit ResultCache(size_t maxBytes = 16u << 20,
+                       const kj::MonotonicClock& clock = kj::systemCoarseMonotonicClock());
+  ~ResultCache() noexcept(false);
+  KJ_DISALLOW_COPY(ResultCache);
+
+  Capability::Client wrap(Capability::Client inner, InterfaceSchema schema);
+  template <typename ClientType>
+  ClientType wrap(ClientType inner);
+  // Returns a capability which forwards calls to `inner`, answering calls to cacheable methods
+  // from the cache when possible. Methods of `schema` (or its superclasses) annotated with
+  // `$Cxx.cacheable` become cacheable, for all capabilities wrapped by this cache.
+
+  void setCacheable(uint64_t interfaceId, uint16_t methodId,
+                    kj::Duration ttl = 0 * kj::SECONDS);
+  // Makes a method cacheable, as if annotated. Results stay fresh for `ttl`, or if it's zero, until
+  // they're evicted or invalidated. Only affects calls made after this.
+
+  void invalidate();
+  void invalidate(uint64_t interfaceId, uint16_t methodId);
+  // Drops all entries, or those of one method. Results of calls still in flight won't be cached
+  // either.
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    // Calls to cacheable methods that were, or weren't, answered from the cache.
+
+    size_t entryCount;
+    size_t bytes;
+  };
+
+  Stats getStats() const;
+
+private:
+  struct Impl;
+  kj::Own<Impl> impl;
+
+  class CachingHook;
+};
+
+// =======================================================================================
+// inline implementation details
+
+template <typename ClientType>
+ClientType ResultCache::wrap(ClientType inner) {
+  return wrap(Capability::Client(kj::mv(inner)), Schema::from<typename ClientType::Calls>())
+      .template castAs<typename ClientType::Calls>();
+}
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
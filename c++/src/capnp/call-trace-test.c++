@@ -0,0 +1,196 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "call-trace.h"
+#include "test-util.h"
+#include "rpc-twoparty.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+
+namespace capnp {
+namespace _ {
+namespace {
+
+KJ_TEST("LatencyHistogram") {
+  LatencyHistogram histogram;
+  KJ_EXPECT(histogram.getCount() == 0);
+  KJ_EXPECT(histogram.getPercentile(0.5) == 0 * kj::SECONDS);
+
+  histogram.record(0 * kj::SECONDS);
+  histogram.record(500 * kj::NANOSECONDS);
+  histogram.record(1 * kj::MICROSECONDS);
+  histogram.record(3 * kj::MICROSECONDS);
+  for (auto i KJ_UNUSED: kj::zeroTo(96)) {
+    histogram.record(5 * kj::MILLISECONDS);
+  }
+  histogram.record(24 * 3600 * kj::SECONDS);
+
+  KJ_EXPECT(histogram.getCount() == 101);
+  KJ_EXPECT(histogram.getBucket(0) == 2);
+  KJ_EXPECT(histogram.getBucket(1) == 1);
+  KJ_EXPECT(histogram.getBucket(2) == 1);
+  KJ_EXPECT(histogram.getBucket(LatencyHistogram::BUCKET_COUNT - 1) == 1);
+
+  // 5ms lands in [4096us, 8192us).
+  KJ_EXPECT(histogram.getBucket(13) == 96);
+  KJ_EXPECT(histogram.getPercentile(0.5) == 8192 * kj::MICROSECONDS);
+  KJ_EXPECT(histogram.getPercentile(0.99) == 8192 * kj::MICROSECONDS);
+  KJ_EXPECT(histogram.getPercentile(1.0) ==
+            LatencyHistogram::getBucketLimit(LatencyHistogram::BUCKET_COUNT - 1));
+  KJ_EXPECT(histogram.getPercentile(0.01) == 1 * kj::MICROSECONDS);
+}
+
+class TraceRecordingImpl final: public test::TestInterface::Server {
+  // Records the trace ID each call to foo() is dispatched with, optionally forwarding the call
+  // to `next`.
+
+public:
+  TraceRecordingImpl(kj::Vector<uint64_t>& traceIds,
+                     kj::Maybe<test::TestInterface::Client> next = nullptr)
+      : traceIds(traceIds), next(kj::mv(next)) {}
+
+  kj::Promise<void> foo(FooContext context) override {
+    traceIds.add(CallTracer::currentTraceId().orDefault(0));
+
+    KJ_IF_MAYBE(n, next) {
+      return n->fooRequest().send().then([context](auto&& response) mutable {
+        context.getResults().setX(response.getX());
+      });
+    } else {
+      context.getResults().setX("foo");
+      return kj::READY_NOW;
+    }
+  }
+
+private:
+  kj::Vector<uint64_t>& traceIds;
+  kj::Maybe<test::TestInterface::Client> next;
+};
+
+struct TracerInstallation {
+  CallTracer tracer;
+
+  explicit TracerInstallation(uint sampleInterval): tracer(sampleInterval) {
+    CallTracer::install(tracer);
+  }
+  ~TracerInstallation() noexcept(false) {
+    CallTracer::install(nullptr);
+  }
+};
+
+KJ_TEST("CallTracer records local calls") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  kj::Vector<uint64_t> traceIds;
+  test::TestInterface::Client cap = kj::heap<TraceRecordingImpl>(traceIds);
+
+  // Not installed: nothing is traced.
+  {
+    CallTracer tracer(1);
+    cap.fooRequest().send().wait(waitScope);
+    KJ_EXPECT(tracer.getStats().size() == 0);
+    KJ_EXPECT(traceIds.back() == 0);
+  }
+
+  {
+    TracerInstallation installation(1);
+    auto& tracer = installation.tracer;
+
+    for (auto i KJ_UNUSED: kj::zeroTo(5)) {
+      cap.fooRequest().send().wait(waitScope);
+    }
+
+    auto& stats = KJ_ASSERT_NONNULL(tracer.findStats(typeId<test::TestInterface>(), 0));
+    KJ_EXPECT(stats.queue.getCount() == 5);
+    KJ_EXPECT(stats.dispatch.getCount() == 5);
+    KJ_EXPECT(stats.roundTrip.getCount() == 0);
+    KJ_EXPECT(tracer.getStats().size() == 1);
+    KJ_EXPECT(tracer.findStats(typeId<test::TestInterface>(), 1) == nullptr);
+
+    // Each call was the root of its own trace.
+    for (auto i: kj::range(1u, 6u)) {
+      KJ_EXPECT(traceIds[i] != 0);
+      KJ_EXPECT(traceIds[i] != traceIds[i - 1]);
+    }
+    KJ_EXPECT(CallTracer::currentTraceId() == nullptr);
+  }
+
+  {
+    TracerInstallation installation(3);
+    for (auto i KJ_UNUSED: kj::zeroTo(9)) {
+      cap.fooRequest().send().wait(waitScope);
+    }
+    auto& stats = KJ_ASSERT_NONNULL(
+        installation.tracer.findStats(typeId<test::TestInterface>(), 0));
+    KJ_EXPECT(stats.dispatch.getCount() == 3);
+  }
+}
+
+KJ_TEST("CallTracer propagates traces over RPC") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  kj::Vector<uint64_t> backendTraceIds;
+  kj::Vector<uint64_t> frontendTraceIds;
+
+  TwoPartyClient tpClient(*pipe.ends[0]);
+  TwoPartyClient tpServer(*pipe.ends[1], kj::heap<TraceRecordingImpl>(backendTraceIds),
+                          rpc::twoparty::Side::SERVER);
+
+  auto backend = tpClient.bootstrap().castAs<test::TestInterface>();
+  backend.whenResolved().wait(waitScope);
+  test::TestInterface::Client frontend =
+      kj::heap<TraceRecordingImpl>(frontendTraceIds, backend);
+
+  // The tracer is shared by both vats, since they're in the same process. With sampling
+  // disabled, only calls which arrive already traced are recorded.
+  TracerInstallation installation(0);
+  auto& tracer = installation.tracer;
+
+  KJ_EXPECT(frontend.fooRequest().send().wait(waitScope).getX() == "foo");
+  KJ_EXPECT(frontendTraceIds.back() == 0);
+  KJ_EXPECT(backendTraceIds.back() == 0);
+  KJ_EXPECT(tracer.getStats().size() == 0);
+
+  // Start a trace by hand: the frontend call, the RPC it makes, and the backend's handling of
+  // that RPC all join it.
+  {
+    CallTracer::TraceScope scope(1234);
+    auto promise = frontend.fooRequest().send();
+    KJ_EXPECT(promise.wait(waitScope).getX() == "foo");
+  }
+  KJ_EXPECT(frontendTraceIds.back() == 1234);
+  KJ_EXPECT(backendTraceIds.back() == 1234);
+
+  auto& stats = KJ_ASSERT_NONNULL(tracer.findStats(typeId<test::TestInterface>(), 0));
+  // Local dispatch of the frontend and backend calls.
+  KJ_EXPECT(stats.dispatch.getCount() == 2);
+  KJ_EXPECT(stats.queue.getCount() == 2);
+  // The RPC from frontend to backend.
+  KJ_EXPECT(stats.roundTrip.getCount() == 1);
+}
+
+}  // namespace
+}  // namespace _
+}  // namespace capnp
@@ -0,0 +1,200 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "call-trace.h"
+#include <kj/debug.h>
+
+namespace capnp {
+
+// =======================================================================================
+// LatencyHistogram
+
+void LatencyHistogram::record(kj::Duration duration) {
+  uint64_t micros = duration / kj::MICROSECONDS;
+  uint i = 0;
+  while (micros > 0 && i < BUCKET_COUNT - 1) {
+    micros >>= 1;
+    ++i;
+  }
+  buckets[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+  uint64_t total = 0;
+  for (auto& bucket: buckets) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint64_t LatencyHistogram::getBucket(uint i) const {
+  KJ_REQUIRE(i < BUCKET_COUNT, "histogram bucket out of range");
+  return buckets[i].load(std::memory_order_relaxed);
+}
+
+kj::Duration LatencyHistogram::getBucketLimit(uint i) {
+  KJ_REQUIRE(i < BUCKET_COUNT, "histogram bucket out of range");
+  return (uint64_t(1) << i) * kj::MICROSECONDS;
+}
+
+kj::Duration LatencyHistogram::getPercentile(double fraction) const {
+  uint64_t counts[BUCKET_COUNT];
+  uint64_t total = 0;
+  for (auto i: kj::zeroTo(BUCKET_COUNT)) {
+    counts[i] = buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return 0 * kj::SECONDS;
+
+  // The first bucket at which the running count reaches `fraction` of the total.
+  double target = fraction * total;
+  uint64_t seen = 0;
+  for (auto i: kj::zeroTo(BUCKET_COUNT)) {
+    seen += counts[i];
+    if (seen > 0 && seen >= target) {
+      return getBucketLimit(i);
+    }
+  }
+  return getBucketLimit(BUCKET_COUNT - 1);
+}
+
+// =======================================================================================
+// CallTracer
+
+namespace {
+
+std::atomic<CallTracer*> installedTracer(nullptr);
+
+thread_local uint64_t threadTraceId = 0;
+// Trace ID of the call this thread is dispatching, or zero.
+
+thread_local uint threadSampleCounter = 0;
+
+}  // namespace
+
+CallTracer::CallTracer(uint sampleInterval, const kj::MonotonicClock& clock)
+    : sampleInterval(sampleInterval), clock(clock),
+      // Seed the IDs so that separate processes (or tracers) are unlikely to produce the same
+      // sequence.
+      traceCounter((clock.now() - kj::origin<kj::TimePoint>()) / kj::NANOSECONDS ^
+                   reinterpret_cast<uintptr_t>(this)) {}
+
+CallTracer::~CallTracer() noexcept(false) {
+  CallTracer* self = this;
+  installedTracer.compare_exchange_strong(self, nullptr);
+}
+
+void CallTracer::install(kj::Maybe<CallTracer&> tracer) {
+  CallTracer* ptr = nullptr;
+  KJ_IF_MAYBE(t, tracer) {
+    ptr = t;
+  }
+  installedTracer.store(ptr, std::memory_order_release);
+}
+
+kj::Maybe<CallTracer&> CallTracer::getInstalled() {
+  CallTracer* ptr = installedTracer.load(std::memory_order_acquire);
+  if (ptr == nullptr) {
+    return nullptr;
+  } else {
+    return *ptr;
+  }
+}
+
+kj::Maybe<uint64_t> CallTracer::currentTraceId() {
+  if (threadTraceId == 0) {
+    return nullptr;
+  } else {
+    return threadTraceId;
+  }
+}
+
+kj::Array<const CallTracer::MethodStats*> CallTracer::getStats() const {
+  auto lock = methods.lockShared();
+  auto builder = kj::heapArrayBuilder<const MethodStats*>(lock->size());
+  for (auto& entry: *lock) {
+    builder.add(entry.value.get());
+  }
+  return builder.finish();
+}
+
+kj::Maybe<const CallTracer::MethodStats&> CallTracer::findStats(
+    uint64_t interfaceId, uint16_t methodId) const {
+  auto lock = methods.lockShared();
+  return lock->find(MethodKey { interfaceId, methodId })
+      .map([](const kj::Own<MethodStats>& stats) -> const MethodStats& { return *stats; });
+}
+
+kj::Maybe<CallTracer::Span> CallTracer::sample(uint64_t interfaceId, uint16_t methodId) {
+  uint64_t traceId = threadTraceId;
+  if (traceId == 0) {
+    if (sampleInterval == 0 || ++threadSampleCounter < sampleInterval) {
+      return nullptr;
+    }
+    threadSampleCounter = 0;
+    traceId = newTraceId();
+  }
+
+  return Span(*this, getMethod(interfaceId, methodId), traceId);
+}
+
+CallTracer::MethodStats& CallTracer::getMethod(uint64_t interfaceId, uint16_t methodId) {
+  MethodKey key { interfaceId, methodId };
+
+  {
+    auto lock = methods.lockShared();
+    KJ_IF_MAYBE(stats, lock->find(key)) {
+      // The lock only guards the table. The stats themselves are updated atomically.
+      return const_cast<MethodStats&>(**stats);
+    }
+  }
+
+  auto lock = methods.lockExclusive();
+  return *lock->findOrCreate(key, [&]() -> kj::HashMap<MethodKey, kj::Own<MethodStats>>::Entry {
+    auto stats = kj::heap<MethodStats>();
+    stats->interfaceId = interfaceId;
+    stats->methodId = methodId;
+    return { key, kj::mv(stats) };
+  });
+}
+
+uint64_t CallTracer::newTraceId() {
+  // splitmix64 over a counter: cheap, and consecutive IDs look unrelated.
+  uint64_t id;
+  do {
+    uint64_t z = traceCounter.fetch_add(0x9e3779b97f4a7c15ull, std::memory_order_relaxed);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    id = z ^ (z >> 31);
+  } while (id == 0);
+  return id;
+}
+
+CallTracer::TraceScope::TraceScope(uint64_t traceId): previous(threadTraceId) {
+  threadTraceId = traceId;
+}
+
+CallTracer::TraceScope::~TraceScope() noexcept(false) {
+  threadTraceId = previous;
+}
+
+}  // namespace capnp
@@ -0,0 +1,192 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#include "capability.h"
+#include <kj/map.h>
+#include <kj/mutex.h>
+#include <kj/time.h>
+#include <atomic>
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+class LatencyHistogram {
+  // A histogram of durations with power-of-two buckets. Recording is a single relaxed atomic
+  // increment, so a histogram can be updated from any number of threads at once without locking.
+  // Reads are not synchronized with writes, so a snapshot taken while calls are in flight may be
+  // off by the handful of calls recorded during the read.
+
+public:
+  static constexpr uint BUCKET_COUNT = 32;
+  // Bucket 0 counts durations under 1us. Bucket i, for i > 0, counts durations in
+  // [2^(i-1), 2^i) microseconds. The last bucket also counts everything longer than that (about
+  // 18 minutes).
+
+  void record(kj::Duration duration);
+
+  uint64_t getCount() const;
+  // Total number of durations recorded.
+
+  uint64_t getBucket(uint i) const;
+
+  static kj::Duration getBucketLimit(uint i);
+  // The exclusive upper bound of bucket `i`.
+
+  kj::Duration getPercentile(double fraction) const;
+  // Returns the upper bound of the bucket containing the given fraction of recorded durations,
+  // e.g. `getPercentile(0.99)` for the p99. Returns zero if nothing has been recorded.
+
+private:
+  std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+};
+
+class CallTracer {
+  // Samples calls to capabilities and records their latency in per-method histograms. Calls made
+  // while handling a sampled call are sampled too, and share its trace ID, including across RPC
+  // connections (the ID travels in `rpc::Call.traceId`). So, a slow request can be followed
+  // through every method it touched, while the tracer itself only looks at a small fraction of
+  // calls.
+  //
+  // Nothing is traced until a tracer is installed with `CallTracer::install()`. With no tracer
+  // installed, the cost per call is one atomic load.
+  //
+  // Two places observe calls:
+  // - Local capabilities (i.e. `Capability::Server` implementations) record the time the call
+  //   spent queued before `dispatchCall()` -- waiting for the event loop, or behind a streaming
+  //   call -- and the time from `dispatchCall()` until the call completed.
+  // - The RPC system records the round trip time of calls it sends to a remote vat, from `send()`
+  //   until the `Return` arrives.
+  //
+  // The trace ID of the call currently being dispatched is available from `currentTraceId()`.
+  // It's only set during the synchronous part of `dispatchCall()`, so calls the server makes
+  // after waiting on a promise start new traces (or aren't sampled).
+
+public:
+  explicit CallTracer(uint sampleInterval,
+                      const kj::MonotonicClock& clock = kj::systemPreciseMonotonicClock());
+  // Samples one in every `sampleInterval` calls (counted per thread) which aren't already part
+  // of a trace. 1 samples every call. 0 never starts a trace, but still records calls that
+  // arrive with a trace ID from another vat.
+
+  ~CallTracer() noexcept(false);
+  // Uninstalls the tracer if it is installed. The tracer must outlive any calls it sampled.
+
+  KJ_DISALLOW_COPY(CallTracer);
+
+  static void install(kj::Maybe<CallTracer&> tracer);
+  // Installs `tracer` for the whole process, replacing any previously-installed tracer. Pass
+  // null to stop tracing.
+
+  static kj::Maybe<CallTracer&> getInstalled();
+
+  static kj::Maybe<uint64_t> currentTraceId();
+  // If the calling thread is currently dispatching a sampled call, returns its trace ID.
+
+  struct MethodStats {
+    uint64_t interfaceId;
+    uint16_t methodId;
+
+    LatencyHistogram queue;
+    // Time between the call being delivered to a local capability and the start of dispatch.
+
+    LatencyHistogram dispatch;
+    // Time from the start of `dispatchCall()` until the call completed.
+
+    LatencyHistogram roundTrip;
+    // Time from sending the call to a remote vat until its response arrived.
+  };
+
+  kj::Array<const MethodStats*> getStats() const;
+  // Returns stats for every method that has had a call sampled so far. The pointers remain valid
+  // for the lifetime of the tracer, and continue to be updated.
+
+  kj::Maybe<const MethodStats&> findStats(uint64_t interfaceId, uint16_t methodId) const;
+
+  // ---------------------------------------------------------------------------
+  // Used by the capability and RPC implementations.
+
+  class Span {
+    // A sampled call in progress, timing the stage it's currently in.
+
+  public:
+    Span(CallTracer& tracer, MethodStats& stats, uint64_t traceId)
+        : tracer(tracer), stats(stats), traceId(traceId), start(tracer.clock.now()) {}
+
+    uint64_t getTraceId() const { return traceId; }
+
+    void record(LatencyHistogram MethodStats::*histogram) {
+      // Records the time since the span was created (or since the last record()) in the given
+      // histogram, and starts timing the next stage.
+      auto now = tracer.clock.now();
+      (stats.*histogram).record(now - start);
+      start = now;
+    }
+
+  private:
+    CallTracer& tracer;
+    MethodStats& stats;
+    uint64_t traceId;
+    kj::TimePoint start;
+  };
+
+  kj::Maybe<Span> sample(uint64_t interfaceId, uint16_t methodId);
+  // Decides whether to sample a call that is just starting. Calls made from within a sampled call
+  // are always sampled.
+
+  class TraceScope {
+    // Sets `currentTraceId()` for the duration of the scope.
+
+  public:
+    explicit TraceScope(uint64_t traceId);
+    ~TraceScope() noexcept(false);
+    KJ_DISALLOW_COPY(TraceScope);
+
+  private:
+    uint64_t previous;
+  };
+
+private:
+  struct MethodKey {
+    uint64_t interfaceId;
+    uint16_t methodId;
+
+    inline bool operator==(const MethodKey& other) const {
+      return interfaceId == other.interfaceId && methodId == other.methodId;
+    }
+    inline uint hashCode() const { return kj::hashCode(interfaceId, methodId); }
+  };
+
+  uint sampleInterval;
+  const kj::MonotonicClock& clock;
+  std::atomic<uint64_t> traceCounter;
+  kj::MutexGuarded<kj::HashMap<MethodKey, kj::Own<MethodStats>>> methods;
+
+  MethodStats& getMethod(uint64_t interfaceId, uint16_t methodId);
+  uint64_t newTraceId();
+};
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
@@ -30,6 +30,16 @@ namespace _ {  // private
 using test::TestLists;
 namespace {
 
+template <typename Reader>
+void expectCanonicalHashMatches(Reader&& reader) {
+  kj::Vector<byte> hashed;
+  canonicalHash(reader, [&](kj::ArrayPtr<const word> words) {
+    KJ_EXPECT(words.size() > 0);
+    hashed.addAll(words.asBytes());
+  });
+  auto canonicalWords = canonicalize(reader);
+  KJ_EXPECT(hashed.asPtr() == canonicalWords.asBytes());
+}
 
 KJ_TEST("canonicalize yields canonical message") {
   MallocMessageBuilder builder;
@@ -47,6 +57,41 @@ KJ_TEST("canonicalize yields canonical message") {
             AnyStruct::Reader(canonicalReader.getRoot<TestAllTypes>()));
 }
 
+KJ_TEST("canonicalHash matches canonicalize") {
+  {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    expectCanonicalHashMatches(builder.getRoot<TestAllTypes>().asReader());
+  }
+
+  {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestListDefaults>());
+    expectCanonicalHashMatches(builder.getRoot<TestListDefaults>().asReader());
+  }
+
+  {
+    MallocMessageBuilder builder;
+    expectCanonicalHashMatches(builder.initRoot<TestAllTypes>().asReader());
+  }
+
+  {
+    // Tiny segments force far pointers, and the large blob and long text list run past the
+    // hasher's buffer.
+    MallocMessageBuilder builder(4, AllocationStrategy::FIXED_SIZE);
+    auto root = builder.initRoot<TestAllTypes>();
+    root.setUInt8Field(7);
+    auto data = root.initDataField(1001);
+    for (auto i: kj::indices(data)) data[i] = i * 7;
+    auto texts = root.initTextList(300);
+    for (auto i: kj::indices(texts)) texts.set(i, kj::str("text ", i));
+    auto structs = root.initStructList(3);
+    structs[0].setInt64Field(1);
+    structs[2].initStructField().setTextField("deep");
+    expectCanonicalHashMatches(root.asReader());
+  }
+}
+
 KJ_TEST("canonicalize succeeds on empty struct") {
   MallocMessageBuilder builder;
   auto root = builder.initRoot<TestAllTypes>();
@@ -308,6 +353,7 @@ KJ_TEST("upgraded lists can be canonicalized") {
 
   auto root = upgraded.getRoot<TestLists>();
   canonicalize(root);
+  expectCanonicalHashMatches(root);
 }
 
 KJ_TEST("isCanonical requires truncation of 0-valued struct fields in all list members") {
@@ -350,6 +396,7 @@ KJ_TEST("primitive list with nonzero padding") {
   KJ_ASSERT(!message.isCanonical());
 
   auto canonicalWords = canonicalize(message.getRoot<test::TestAnyPointer>());
+  expectCanonicalHashMatches(message.getRoot<test::TestAnyPointer>());
 
   AlignedData<3> canonicalSegment = {{
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
@@ -377,6 +424,7 @@ KJ_TEST("bit list with nonzero padding") {
   KJ_ASSERT(!message.isCanonical());
 
   auto canonicalWords = canonicalize(message.getRoot<test::TestAnyPointer>());
+  expectCanonicalHashMatches(message.getRoot<test::TestAnyPointer>());
 
   AlignedData<3> canonicalSegment = {{
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
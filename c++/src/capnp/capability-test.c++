@@ -245,6 +245,109 @@ KJ_TEST("context.setPipeline") {
   KJ_EXPECT(!promise.poll(waitScope));
 }
 
+class InPlaceServer final: public test::TestInterface::Server {
+public:
+  const void* params = nullptr;
+  const void* results = nullptr;
+
+  kj::Promise<void> foo(FooContext context) override {
+    params = AnyStruct::Reader(context.getParams()).getDataSection().begin();
+    auto x = context.getResults().initX(3);
+    memcpy(x.begin(), "foo", 3);
+    results = x.begin();
+    return kj::READY_NOW;
+  }
+};
+
+KJ_TEST("local calls build params and results in place") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto server = kj::heap<InPlaceServer>();
+  auto& serverRef = *server;
+  test::TestInterface::Client client(kj::mv(server));
+
+  auto request = client.fooRequest();
+  request.setI(123);
+  test::TestInterface::FooParams::Builder paramsBuilder = request;
+  const void* params = AnyStruct::Builder(kj::mv(paramsBuilder)).getDataSection().begin();
+  auto response = request.send().wait(waitScope);
+
+  // The server saw the caller's own message, and the caller sees the server's.
+  KJ_EXPECT(serverRef.params == params);
+  KJ_EXPECT(response.getX().begin() == serverRef.results);
+  KJ_EXPECT(response.getX() == "foo");
+}
+
+class DeadlineServer final: public test::TestInterface::Server {
+public:
+  DeadlineServer(kj::Maybe<test::TestInterface::Client> next = nullptr): next(kj::mv(next)) {}
+
+  uint callCount = 0;
+  kj::Maybe<kj::TimePoint> deadline;
+
+  kj::Promise<void> foo(FooContext context) override {
+    ++callCount;
+    deadline = context.getDeadline();
+    KJ_IF_MAYBE(n, next) {
+      return context.tailCall(n->fooRequest());
+    } else {
+      return kj::READY_NOW;
+    }
+  }
+
+private:
+  kj::Maybe<test::TestInterface::Client> next;
+};
+
+KJ_TEST("call deadlines reach the server and are inherited by nested calls") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto inner = kj::heap<DeadlineServer>();
+  auto& innerRef = *inner;
+  auto outer = kj::heap<DeadlineServer>(test::TestInterface::Client(kj::mv(inner)));
+  auto& outerRef = *outer;
+  test::TestInterface::Client client(kj::mv(outer));
+
+  client.fooRequest().send().wait(waitScope);
+  KJ_EXPECT(outerRef.deadline == nullptr);
+  KJ_EXPECT(innerRef.deadline == nullptr);
+
+  auto deadline = kj::systemPreciseMonotonicClock().now() + 1 * kj::HOURS;
+  auto request = client.fooRequest();
+  request.setDeadline(deadline);
+  request.send().wait(waitScope);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(outerRef.deadline) == deadline);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(innerRef.deadline) == deadline);
+}
+
+KJ_TEST("calls whose deadline has passed are shed before dispatch") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto server = kj::heap<DeadlineServer>();
+  auto& serverRef = *server;
+  test::TestInterface::Client client(kj::mv(server));
+
+  auto request = client.fooRequest();
+  request.setTimeout(0 * kj::SECONDS);
+  auto promise = request.send();
+
+  KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() { promise.wait(waitScope); })) {
+    KJ_EXPECT(e->getType() == kj::Exception::Type::OVERLOADED);
+  } else {
+    KJ_FAIL_EXPECT("expected call to be shed");
+  }
+  KJ_EXPECT(serverRef.callCount == 0);
+
+  // A deadline in the future doesn't get in the way.
+  request = client.fooRequest();
+  request.setTimeout(1 * kj::HOURS);
+  request.send().wait(waitScope);
+  KJ_EXPECT(serverRef.callCount == 1);
+}
+
 TEST(Capability, TailCall) {
   kj::EventLoop loop;
   kj::WaitScope waitScope(loop);
@@ -859,6 +962,21 @@ TEST(Capability, AnyPointersAndOrphans) {
   verifyClient(dynamicOrphan2.getReader(), callCount2, waitScope);
 }
 
+KJ_TEST("MallocMessageBuilder::compact() keeps capabilities") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  int callCount = 0;
+
+  MallocMessageBuilder builder;
+  auto box = builder.initRoot<test::TestPipeline::Box>();
+  box.setCap(test::TestInterface::Client(kj::heap<TestInterfaceImpl>(callCount)));
+  box.setCap(test::TestInterface::Client(kj::heap<TestInterfaceImpl>(callCount)));
+
+  builder.compact();
+  verifyClient(builder.getRoot<test::TestPipeline::Box>().getCap(), callCount, waitScope);
+}
+
 TEST(Capability, Lists) {
   kj::EventLoop loop;
   kj::WaitScope waitScope(loop);
@@ -22,6 +22,7 @@
 #define CAPNP_PRIVATE
 
 #include "capability.h"
+#include "call-trace.h"
 #include "message.h"
 #include "arena.h"
 #include "kj/refcount.h"
@@ -135,24 +136,33 @@ static inline uint firstSegmentSize(kj::Maybe<MessageSize> sizeHint) {
   }
 }
 
-class LocalResponse final: public ResponseHook {
+class LocalCallContext final: public CallContextHook, public ResponseHook, public kj::Refcounted {
+  // The params and results of a local call are both built directly in messages owned by this
+  // object, which the server reads and writes in place. Once the call completes, the same object
+  // serves as the caller's ResponseHook, so neither side is ever copied.
+
 public:
-  LocalResponse(kj::Maybe<MessageSize> sizeHint)
-      : message(firstSegmentSize(sizeHint)) {}
+  LocalCallContext(kj::Maybe<MessageSize> sizeHint, kj::Own<ClientHook> clientRef)
+      : clientRef(kj::mv(clientRef)), deadline(_::currentDeadline()) {
+    request.emplace(firstSegmentSize(sizeHint));
+  }
 
-  MallocMessageBuilder message;
-};
+  AnyPointer::Builder getParamsBuilder() {
+    return KJ_ASSERT_NONNULL(request).getRoot<AnyPointer>();
+  }
 
-class LocalCallContext final: public CallContextHook, public ResponseHook, public kj::Refcounted {
-public:
-  LocalCallContext(kj::Own<MallocMessageBuilder>&& request, kj::Own<ClientHook> clientRef,
-                   kj::Own<kj::PromiseFulfiller<void>> cancelAllowedFulfiller)
-      : request(kj::mv(request)), clientRef(kj::mv(clientRef)),
-        cancelAllowedFulfiller(kj::mv(cancelAllowedFulfiller)) {}
+  AnyPointer::Reader getResponse() {
+    // Called once the call is done.
+    KJ_IF_MAYBE(r, tailResponse) {
+      return *r;
+    } else {
+      return getResults(MessageSize { 0, 0 }).asReader();
+    }
+  }
 
   AnyPointer::Reader getParams() override {
     KJ_IF_MAYBE(r, request) {
-      return r->get()->getRoot<AnyPointer>();
+      return r->getRoot<AnyPointer>();
     } else {
       KJ_FAIL_REQUIRE("Can't call getParams() after releaseParams().");
     }
@@ -161,10 +171,8 @@ public:
     request = nullptr;
   }
   AnyPointer::Builder getResults(kj::Maybe<MessageSize> sizeHint) override {
-    if (response == nullptr) {
-      auto localResponse = kj::heap<LocalResponse>(sizeHint);
-      responseBuilder = localResponse->message.getRoot<AnyPointer>();
-      response = Response<AnyPointer>(responseBuilder.asReader(), kj::mv(localResponse));
+    if (responseMessage == nullptr) {
+      responseBuilder = responseMessage.emplace(firstSegmentSize(sizeHint)).getRoot<AnyPointer>();
     }
     return responseBuilder;
   }
@@ -181,12 +189,13 @@ public:
     return kj::mv(result.promise);
   }
   ClientHook::VoidPromiseAndPipeline directTailCall(kj::Own<RequestHook>&& request) override {
-    KJ_REQUIRE(response == nullptr, "Can't call tailCall() after initializing the results struct.");
+    KJ_REQUIRE(responseMessage == nullptr,
+               "Can't call tailCall() after initializing the results struct.");
 
     auto promise = request->send();
 
-    auto voidPromise = promise.then([this](Response<AnyPointer>&& tailResponse) {
-      response = kj::mv(tailResponse);
+    auto voidPromise = promise.then([this](Response<AnyPointer>&& response) {
+      tailResponse = kj::mv(response);
     });
 
     return { kj::mv(voidPromise), PipelineHook::from(kj::mv(promise)) };
@@ -202,30 +211,39 @@ public:
   kj::Own<CallContextHook> addRef() override {
     return kj::addRef(*this);
   }
+  kj::Maybe<kj::TimePoint> getDeadline() override {
+    return deadline;
+  }
 
-  kj::Maybe<kj::Own<MallocMessageBuilder>> request;
-  kj::Maybe<Response<AnyPointer>> response;
-  AnyPointer::Builder responseBuilder = nullptr;  // only valid if `response` is non-null
+  kj::Maybe<MallocMessageBuilder> request;
+  kj::Maybe<MallocMessageBuilder> responseMessage;
+  AnyPointer::Builder responseBuilder = nullptr;  // only valid if `responseMessage` is non-null
+  kj::Maybe<Response<AnyPointer>> tailResponse;
   kj::Own<ClientHook> clientRef;
   kj::Maybe<kj::Own<kj::PromiseFulfiller<AnyPointer::Pipeline>>> tailCallPipelineFulfiller;
   kj::Own<kj::PromiseFulfiller<void>> cancelAllowedFulfiller;
+  kj::Maybe<kj::TimePoint> deadline;
 };
 
 class LocalRequest final: public RequestHook {
 public:
   inline LocalRequest(uint64_t interfaceId, uint16_t methodId,
                       kj::Maybe<MessageSize> sizeHint, kj::Own<ClientHook> client)
-      : message(kj::heap<MallocMessageBuilder>(firstSegmentSize(sizeHint))),
-        interfaceId(interfaceId), methodId(methodId), client(kj::mv(client)) {}
+      : context(kj::refcounted<LocalCallContext>(sizeHint, kj::mv(client))),
+        interfaceId(interfaceId), methodId(methodId) {}
+
+  AnyPointer::Builder getParams() {
+    return context->getParamsBuilder();
+  }
 
   RemotePromise<AnyPointer> send() override {
-    KJ_REQUIRE(message.get() != nullptr, "Already called send() on this request.");
+    KJ_REQUIRE(context.get() != nullptr, "Already called send() on this request.");
 
     auto cancelPaf = kj::newPromiseAndFulfiller<void>();
 
-    auto context = kj::refcounted<LocalCallContext>(
-        kj::mv(message), client->addRef(), kj::mv(cancelPaf.fulfiller));
-    auto promiseAndPipeline = client->call(interfaceId, methodId, kj::addRef(*context));
+    auto context = kj::mv(this->context);
+    context->cancelAllowedFulfiller = kj::mv(cancelPaf.fulfiller);
+    auto promiseAndPipeline = context->clientRef->call(interfaceId, methodId, kj::addRef(*context));
 
     // We have to make sure the call is not canceled unless permitted.  We need to fork the promise
     // so that if the client drops their copy, the promise isn't necessarily canceled.
@@ -239,26 +257,12 @@ public:
         .detach([](kj::Exception&&) {});  // ignore exceptions
 
     // Now the other branch returns the response from the context.
-    auto promise = forked.addBranch().then(kj::mvCapture(context,
-        [](kj::Own<LocalCallContext>&& context) {
-      // force response allocation
-      auto reader = context->getResults(MessageSize { 0, 0 }).asReader();
-
-      if (context->isShared()) {
-        // We can't just move away context->response as `context` itself is still referenced by
-        // something -- probably a Pipeline object. As a bit of a hack, LocalCallContext itself
-        // implements ResponseHook so that we can just return a ref on it.
-        //
-        // TODO(cleanup): Maybe ResponseHook should be refcounted? Note that context->response
-        //   might not necessarily contain a LocalResponse if it was resolved by a tail call, so
-        //   we'd have to add refcounting to all ResponseHook implementations.
-        context->releaseParams();      // The call is done so params can definitely be dropped.
-        context->clientRef = nullptr;  // Definitely not using the client cap anymore either.
-        return Response<AnyPointer>(reader, kj::mv(context));
-      } else {
-        return kj::mv(KJ_ASSERT_NONNULL(context->response));
-      }
-    }));
+    auto promise = forked.addBranch().then([context = kj::mv(context)]() mutable {
+      context->releaseParams();      // The call is done so params can definitely be dropped.
+      context->clientRef = nullptr;  // Definitely not using the client cap anymore either.
+      auto reader = context->getResponse();
+      return Response<AnyPointer>(reader, kj::mv(context));
+    });
 
     // We return the other branch.
     return RemotePromise<AnyPointer>(
@@ -275,12 +279,15 @@ public:
     return nullptr;
   }
 
-  kj::Own<MallocMessageBuilder> message;
+  void setDeadline(kj::TimePoint deadline) override {
+    KJ_REQUIRE(context.get() != nullptr, "Already called send() on this request.");
+    context->deadline = deadline;
+  }
 
 private:
+  kj::Own<LocalCallContext> context;
   uint64_t interfaceId;
   uint16_t methodId;
-  kj::Own<ClientHook> client;
 };
 
 // =======================================================================================
@@ -388,7 +395,7 @@ public:
       uint64_t interfaceId, uint16_t methodId, kj::Maybe<MessageSize> sizeHint) override {
     auto hook = kj::heap<LocalRequest>(
         interfaceId, methodId, sizeHint, kj::addRef(*this));
-    auto root = hook->message->getRoot<AnyPointer>();
+    auto root = hook->getParams();
     return Request<AnyPointer, AnyPointer>(root, kj::mv(hook));
   }
 
@@ -570,7 +577,7 @@ public:
 
     auto hook = kj::heap<LocalRequest>(
         interfaceId, methodId, sizeHint, kj::addRef(*this));
-    auto root = hook->message->getRoot<AnyPointer>();
+    auto root = hook->getParams();
     return Request<AnyPointer, AnyPointer>(root, kj::mv(hook));
   }
 
@@ -586,6 +593,11 @@ public:
 
     auto contextPtr = context.get();
 
+    kj::Maybe<CallTracer::Span> span;
+    KJ_IF_MAYBE(tracer, CallTracer::getInstalled()) {
+      span = tracer->sample(interfaceId, methodId);
+    }
+
     // We don't want to actually dispatch the call synchronously, because we don't want the callee
     // to have any side effects before the promise is returned to the caller.  This helps avoid
     // race conditions.
@@ -594,12 +606,13 @@ public:
     //
     // Note also that QueuedClient depends on this evalLater() to ensure that pipelined calls don't
     // complete before 'whenMoreResolved()' promises resolve.
-    auto promise = kj::evalLater([this,interfaceId,methodId,contextPtr]() {
+    auto promise = kj::evalLater(
+        [this,interfaceId,methodId,contextPtr,span = kj::mv(span)]() mutable {
       if (blocked) {
         return kj::newAdaptedPromise<kj::Promise<void>, BlockedCall>(
-            *this, interfaceId, methodId, *contextPtr);
+            *this, interfaceId, methodId, *contextPtr, kj::mv(span));
       } else {
-        return callInternal(interfaceId, methodId, *contextPtr);
+        return callInternal(interfaceId, methodId, *contextPtr, kj::mv(span));
       }
     }).attach(kj::addRef(*this));
 
@@ -721,9 +734,10 @@ private:
   class BlockedCall {
   public:
     BlockedCall(kj::PromiseFulfiller<kj::Promise<void>>& fulfiller, LocalClient& client,
-                uint64_t interfaceId, uint16_t methodId, CallContextHook& context)
+                uint64_t interfaceId, uint16_t methodId, CallContextHook& context,
+                kj::Maybe<CallTracer::Span> span)
         : fulfiller(fulfiller), client(client),
-          interfaceId(interfaceId), methodId(methodId), context(context),
+          interfaceId(interfaceId), methodId(methodId), context(context), span(kj::mv(span)),
           prev(client.blockedCallsEnd) {
       *prev = *this;
       client.blockedCallsEnd = &next;
@@ -743,7 +757,7 @@ private:
       unlink();
       KJ_IF_MAYBE(c, context) {
         fulfiller.fulfill(kj::evalNow([&]() {
-          return client.callInternal(interfaceId, methodId, *c);
+          return client.callInternal(interfaceId, methodId, *c, kj::mv(span));
         }));
       } else {
         // This is just a barrier.
@@ -757,6 +771,7 @@ private:
     uint64_t interfaceId;
     uint16_t methodId;
     kj::Maybe<CallContextHook&> context;
+    kj::Maybe<CallTracer::Span> span;
 
     kj::Maybe<BlockedCall&> next;
     kj::Maybe<BlockedCall&>* prev;
@@ -808,7 +823,8 @@ private:
   }
 
   kj::Promise<void> callInternal(uint64_t interfaceId, uint16_t methodId,
-                                 CallContextHook& context) {
+                                 CallContextHook& context,
+                                 kj::Maybe<CallTracer::Span> span = nullptr) {
     KJ_ASSERT(!blocked);
 
     KJ_IF_MAYBE(e, brokenException) {
@@ -816,8 +832,37 @@ private:
       return kj::cp(*e);
     }
 
+    auto deadline = context.getDeadline();
+    KJ_IF_MAYBE(d, deadline) {
+      if (*d <= kj::systemPreciseMonotonicClock().now()) {
+        // The caller has given up on this call by now, so don't spend any more work on it.
+        return KJ_EXCEPTION(OVERLOADED, "call's deadline passed before it could be dispatched");
+      }
+    }
+
+    kj::Maybe<CallTracer::TraceScope> traceScope;
+    KJ_IF_MAYBE(s, span) {
+      s->record(&CallTracer::MethodStats::queue);
+
+      // Calls the server makes from within dispatchCall() join this call's trace.
+      traceScope.emplace(s->getTraceId());
+    }
+
+    kj::Maybe<_::DeadlineScope> deadlineScope;
+    deadlineScope.emplace(deadline);  // ... and inherit its deadline.
+
     auto result = server->dispatchCall(interfaceId, methodId,
                                        CallContext<AnyPointer, AnyPointer>(context));
+    deadlineScope = nullptr;
+    traceScope = nullptr;
+
+    KJ_IF_MAYBE(s, span) {
+      // The call's promise is dropped as soon as it completes, since call() forks it.
+      result.promise = result.promise.attach(kj::defer([s = kj::mv(*s)]() mutable {
+        s.record(&CallTracer::MethodStats::dispatch);
+      }));
+    }
+
     if (result.isStreaming) {
       return result.promise
           .catch_([this](kj::Exception&& e) {
@@ -993,6 +1038,25 @@ Request<AnyPointer, AnyPointer> newBrokenRequest(
   return Request<AnyPointer, AnyPointer>(root, kj::mv(hook));
 }
 
+namespace _ {  // private
+
+static thread_local kj::Maybe<kj::TimePoint> threadDeadline;
+
+kj::Maybe<kj::TimePoint> currentDeadline() {
+  return threadDeadline;
+}
+
+DeadlineScope::DeadlineScope(kj::Maybe<kj::TimePoint> deadline)
+    : saved(threadDeadline) {
+  threadDeadline = deadline;
+}
+
+DeadlineScope::~DeadlineScope() noexcept(false) {
+  threadDeadline = saved;
+}
+
+}  // namespace _ (private)
+
 // =======================================================================================
 
 ReaderCapabilityTable::ReaderCapabilityTable(
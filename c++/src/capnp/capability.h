@@ -26,6 +26,7 @@
 #endif
 
 #include "kj/async.h"
+#include "kj/time.h"
 #include "kj/vector.h"
 #include "raw-schema.h"
 #include "any.h"
@@ -119,6 +120,20 @@ public:
   RemotePromise<Results> send() KJ_WARN_UNUSED_RESULT;
   // Send the call and return a promise for the results.
 
+  void setDeadline(kj::TimePoint deadline);
+  void setTimeout(kj::Duration timeout);
+  // Sets the time by which the caller expects the call to be complete, as measured on
+  // `kj::systemPreciseMonotonicClock()` (`setTimeout()` is relative to now). The deadline
+  // travels with the call, including over RPC, and appears as `CallContext::getDeadline()` on
+  // the receiving end. A local server's call that is still queued when its deadline passes is
+  // failed with an OVERLOADED exception rather than dispatched.
+  //
+  // This does not cancel the call when the deadline passes -- the caller should do that itself
+  // (e.g. with `kj::Timer::timeoutAfter()`), for which the server's shedding is a complement.
+  //
+  // A request created while a server is dispatching a call (in the synchronous part of the
+  // method implementation) inherits that call's deadline by default.
+
 private:
   kj::Own<RequestHook> hook;
 
@@ -140,6 +155,10 @@ public:
 
   kj::Promise<void> send() KJ_WARN_UNUSED_RESULT;
 
+  void setDeadline(kj::TimePoint deadline);
+  void setTimeout(kj::Duration timeout);
+  // See Request::setDeadline().
+
 private:
   kj::Own<RequestHook> hook;
 
@@ -380,6 +399,12 @@ public:
   // In general, this should be the last thing a method implementation calls, and the promise
   // returned from `tailCall()` should then be returned by the method implementation.
 
+  kj::Maybe<kj::TimePoint> getDeadline();
+  // Returns the caller's deadline for this call, if it set one (see `Request::setDeadline()`),
+  // measured on `kj::systemPreciseMonotonicClock()`. Requests made during the synchronous part
+  // of the method implementation inherit this deadline automatically; requests made later (after
+  // waiting on a promise) must be given it explicitly if desired.
+
   void allowCancellation();
   // Indicate that it is OK for the RPC system to discard its Promise for this call's result if
   // the caller cancels the call, thereby transitively canceling any asynchronous operations the
@@ -425,6 +450,7 @@ public:
   // - It wouldn't be particularly useful since streaming calls don't return anything, and they
   //   already compensate for latency.
 
+  kj::Maybe<kj::TimePoint> getDeadline();
   void allowCancellation();
 
 private:
@@ -658,6 +684,10 @@ public:
   // discover when tail call is going to be sent over its own connection and therefore can be
   // optimized into a remote tail call.
 
+  virtual void setDeadline(kj::TimePoint deadline) {}
+  // See Request::setDeadline(). Wrappers should pass this on. The default implementation ignores
+  // the deadline.
+
   template <typename T, typename U>
   inline static kj::Own<RequestHook> from(Request<T, U>&& request) {
     return kj::mv(request.hook);
@@ -777,6 +807,16 @@ public:
 
   virtual kj::Own<CallContextHook> addRef() = 0;
 
+  virtual kj::Maybe<kj::TimePoint> getDeadline() { return nullptr; }
+  // See CallContext::getDeadline().
+
+  virtual kj::Own<void> releaseParamsMessage() { return kj::Own<void>(); }
+  // Like `releaseParams()`, but rather than freeing the params, hands over whatever keeps them in
+  // memory. A Reader obtained from `getParams()` beforehand stays valid as long as the returned
+  // object (and this context) does. Returns null, releasing nothing, if the params aren't held by
+  // an object that can be handed over. The RPC system uses this to forward params without
+  // copying them.
+
   template <typename Params, typename Results>
   static CallContextHook& from(CallContext<Params, Results>& context) { return *context.hook; }
   template <typename Params>
@@ -803,6 +843,27 @@ Request<AnyPointer, AnyPointer> newBrokenRequest(
     kj::Exception&& reason, kj::Maybe<MessageSize> sizeHint);
 // Helper function that creates a Request object that simply throws exceptions when sent.
 
+namespace _ {  // private
+
+kj::Maybe<kj::TimePoint> currentDeadline();
+// Returns the deadline of the call whose dispatch is currently executing on this thread, if any.
+// Request hooks use this as the initial deadline of new requests.
+
+class DeadlineScope {
+  // While in scope, sets the value returned by currentDeadline(). Used by ClientHook
+  // implementations around the synchronous part of a call's dispatch.
+
+public:
+  explicit DeadlineScope(kj::Maybe<kj::TimePoint> deadline);
+  ~DeadlineScope() noexcept(false);
+  KJ_DISALLOW_COPY(DeadlineScope);
+
+private:
+  kj::Maybe<kj::TimePoint> saved;
+};
+
+}  // namespace _ (private)
+
 // =======================================================================================
 // Extend PointerHelpers for interfaces
 
@@ -978,6 +1039,23 @@ kj::Promise<void> StreamingRequest<Params>::send() {
   return promise;
 }
 
+template <typename Params, typename Results>
+inline void Request<Params, Results>::setDeadline(kj::TimePoint deadline) {
+  hook->setDeadline(deadline);
+}
+template <typename Params, typename Results>
+inline void Request<Params, Results>::setTimeout(kj::Duration timeout) {
+  hook->setDeadline(kj::systemPreciseMonotonicClock().now() + timeout);
+}
+template <typename Params>
+inline void StreamingRequest<Params>::setDeadline(kj::TimePoint deadline) {
+  hook->setDeadline(deadline);
+}
+template <typename Params>
+inline void StreamingRequest<Params>::setTimeout(kj::Duration timeout) {
+  hook->setDeadline(kj::systemPreciseMonotonicClock().now() + timeout);
+}
+
 inline Capability::Client::Client(kj::Own<ClientHook>&& hook): hook(kj::mv(hook)) {}
 template <typename T, typename>
 inline Capability::Client::Client(kj::Own<T>&& server)
@@ -1079,6 +1157,14 @@ template <typename Params>
 inline void StreamingCallContext<Params>::allowCancellation() {
   hook->allowCancellation();
 }
+template <typename Params, typename Results>
+inline kj::Maybe<kj::TimePoint> CallContext<Params, Results>::getDeadline() {
+  return hook->getDeadline();
+}
+template <typename Params>
+inline kj::Maybe<kj::TimePoint> StreamingCallContext<Params>::getDeadline() {
+  return hook->getDeadline();
+}
 
 template <typename Params, typename Results>
 CallContext<Params, Results> Capability::Server::internalGetTypedContext(
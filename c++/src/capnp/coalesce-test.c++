@@ -0,0 +1,176 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "coalesce.h"
+#include "test-util.h"
+#include "rpc-twoparty.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+
+namespace capnp {
+namespace _ {
+namespace {
+
+class GatedInterfaceImpl final: public test::TestInterface::Server {
+  // foo() doesn't return until the test opens its gate.
+
+public:
+  uint calls = 0;
+  uint done = 0;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> gates;
+
+  void openGates() {
+    for (auto& gate: gates) {
+      gate->fulfill();
+    }
+    gates.clear();
+  }
+
+  kj::Promise<void> foo(FooContext context) override {
+    context.allowCancellation();
+    uint n = ++calls;
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    gates.add(kj::mv(paf.fulfiller));
+    return paf.promise.then([context, n]() mutable {
+      context.getResults().setX(kj::str(context.getParams().getI(), '#', n));
+    }).attach(kj::defer([this]() { ++done; }));
+  }
+
+  kj::Promise<void> baz(BazContext context) override {
+    ++calls;
+    return kj::READY_NOW;
+  }
+};
+
+bool coalesceFoo(uint64_t interfaceId, uint16_t methodId) {
+  return interfaceId == typeId<test::TestInterface>() && methodId == 0;
+}
+
+KJ_TEST("coalesceCalls() shares identical calls in flight") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto ownServer = kj::heap<GatedInterfaceImpl>();
+  auto& server = *ownServer;
+  auto cap = coalesceCalls(test::TestInterface::Client(kj::mv(ownServer)), coalesceFoo);
+
+  auto foo = [&](uint i) {
+    auto request = cap.fooRequest();
+    request.setI(i);
+    return request.send();
+  };
+
+  auto a1 = foo(1);
+  auto a2 = foo(1);
+  auto b = foo(2);
+  auto a3 = foo(1);
+  waitScope.poll();
+  KJ_EXPECT(server.calls == 2);
+
+  server.openGates();
+  auto r1 = a1.wait(waitScope);
+  auto r2 = a2.wait(waitScope);
+  auto r3 = a3.wait(waitScope);
+  KJ_EXPECT(r1.getX() == "1#1");
+  KJ_EXPECT(r2.getX() == "1#1");
+  KJ_EXPECT(r3.getX() == "1#1");
+  KJ_EXPECT(b.wait(waitScope).getX() == "2#2");
+
+  // All the waiters share the one response message.
+  KJ_EXPECT(r1.getX().begin() == r2.getX().begin());
+
+  // Once the call has returned, the next one goes to the server again.
+  auto a4 = foo(1);
+  waitScope.poll();
+  KJ_EXPECT(server.calls == 3);
+  server.openGates();
+  KJ_EXPECT(a4.wait(waitScope).getX() == "1#3");
+
+  // Other methods are passed straight through.
+  cap.bazRequest().send().wait(waitScope);
+  cap.bazRequest().send().wait(waitScope);
+  KJ_EXPECT(server.calls == 5);
+}
+
+KJ_TEST("coalesceCalls() cancels a shared call only when all callers cancel") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto ownServer = kj::heap<GatedInterfaceImpl>();
+  auto& server = *ownServer;
+  auto cap = coalesceCalls(test::TestInterface::Client(kj::mv(ownServer)), coalesceFoo);
+
+  auto first = kj::heap(cap.fooRequest().send());
+  auto second = kj::heap(cap.fooRequest().send());
+  waitScope.poll();
+  KJ_EXPECT(server.calls == 1);
+
+  first = nullptr;
+  waitScope.poll();
+  KJ_EXPECT(server.done == 0);
+
+  second = nullptr;
+  waitScope.poll();
+  KJ_EXPECT(server.done == 1);
+  KJ_EXPECT(server.gates.size() == 1);
+
+  // The canceled call is no longer joinable.
+  auto third = cap.fooRequest().send();
+  waitScope.poll();
+  KJ_EXPECT(server.calls == 2);
+  server.openGates();
+  KJ_EXPECT(third.wait(waitScope).getX() == "0#2");
+}
+
+KJ_TEST("coalesceCalls() over RPC") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  auto ownServer = kj::heap<GatedInterfaceImpl>();
+  auto& server = *ownServer;
+
+  TwoPartyClient tpClient(*pipe.ends[0]);
+  TwoPartyClient tpServer(*pipe.ends[1],
+      coalesceCalls(test::TestInterface::Client(kj::mv(ownServer)), coalesceFoo),
+      rpc::twoparty::Side::SERVER);
+
+  auto cap = tpClient.bootstrap().castAs<test::TestInterface>();
+
+  kj::Vector<RemotePromise<test::TestInterface::FooResults>> promises;
+  for (auto i KJ_UNUSED: kj::zeroTo(5)) {
+    auto request = cap.fooRequest();
+    request.setI(7);
+    promises.add(request.send());
+  }
+  waitScope.poll();
+  KJ_EXPECT(server.calls == 1);
+
+  server.openGates();
+  for (auto& promise: promises) {
+    KJ_EXPECT(promise.wait(waitScope).getX() == "7#1");
+  }
+}
+
+}  // namespace
+}  // namespace _
+}  // namespace capnp
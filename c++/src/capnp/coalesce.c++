@@ -0,0 +1,256 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "coalesce.h"
+#include <kj/debug.h>
+#include <kj/map.h>
+
+namespace capnp {
+
+namespace {
+
+kj::Maybe<kj::Array<word>> canonicalizeParams(AnyPointer::Reader params) {
+  // Returns null if the params can't be canonicalized, which happens if they contain
+  // capabilities.
+
+  kj::Maybe<kj::Array<word>> result;
+  kj::runCatchingExceptions([&]() {
+    result = params.getAs<AnyStruct>().canonicalize();
+  });
+  return result;
+}
+
+class CoalescingHook final: public ClientHook, public kj::Refcounted {
+public:
+  CoalescingHook(kj::Own<ClientHook> inner,
+                 kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce)
+      : inner(kj::mv(inner)), shouldCoalesce(kj::mv(shouldCoalesce)) {}
+
+  Request<AnyPointer, AnyPointer> newCall(
+      uint64_t interfaceId, uint16_t methodId, kj::Maybe<MessageSize> sizeHint) override {
+    auto result = inner->newCall(interfaceId, methodId, sizeHint);
+    if (!shouldCoalesce(interfaceId, methodId)) {
+      return result;
+    }
+
+    AnyPointer::Builder builder = result;
+    auto hook = kj::heap<RequestImpl>(kj::addRef(*this), interfaceId, methodId, builder,
+                                      RequestHook::from(kj::mv(result)));
+    return { builder, kj::mv(hook) };
+  }
+
+  VoidPromiseAndPipeline call(uint64_t interfaceId, uint16_t methodId,
+                              kj::Own<CallContextHook>&& context) override {
+    if (!shouldCoalesce(interfaceId, methodId)) {
+      return inner->call(interfaceId, methodId, kj::mv(context));
+    }
+
+    auto params = context->getParams();
+    KJ_IF_MAYBE(canonical, canonicalizeParams(params)) {
+      kj::Own<Flight> flight;
+      KJ_IF_MAYBE(f, findFlight(interfaceId, methodId, *canonical)) {
+        flight = kj::addRef(*f);
+      } else {
+        auto request = inner->newCall(interfaceId, methodId, params.targetSize());
+        request.set(params);
+        flight = startFlight(interfaceId, methodId, kj::mv(*canonical), request.send());
+      }
+      context->releaseParams();
+
+      auto pipeline = flight->pipeline->addRef();
+      auto promise = flight->response.addBranch()
+          .then([context = kj::mv(context)](kj::Own<SharedResponse>&& shared) mutable {
+        AnyPointer::Reader results = shared->response;
+        context->getResults(results.targetSize()).set(results);
+      }).attach(kj::mv(flight));
+      return { kj::mv(promise), kj::mv(pipeline) };
+    } else {
+      return inner->call(interfaceId, methodId, kj::mv(context));
+    }
+  }
+
+  kj::Maybe<ClientHook&> getResolved() override {
+    // Resolving to `inner` would let callers bypass coalescing.
+    return nullptr;
+  }
+
+  kj::Maybe<kj::Promise<kj::Own<ClientHook>>> whenMoreResolved() override {
+    return nullptr;
+  }
+
+  kj::Own<ClientHook> addRef() override {
+    return kj::addRef(*this);
+  }
+
+  const void* getBrand() override {
+    return nullptr;
+  }
+
+  kj::Maybe<int> getFd() override {
+    return inner->getFd();
+  }
+
+private:
+  kj::Own<ClientHook> inner;
+  kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce;
+
+  struct FlightKey {
+    uint64_t interfaceId;
+    uint16_t methodId;
+    kj::ArrayPtr<const word> params;
+    // Canonical params. Points into the Flight, or at the lookup's own copy.
+
+    inline bool operator==(const FlightKey& other) const {
+      return interfaceId == other.interfaceId && methodId == other.methodId &&
+             params.asBytes() == other.params.asBytes();
+    }
+    inline uint hashCode() const {
+      return kj::hashCode(interfaceId, methodId, params.asBytes());
+    }
+  };
+
+  class SharedResponse final: public ResponseHook, public kj::Refcounted {
+  public:
+    explicit SharedResponse(Response<AnyPointer>&& response): response(kj::mv(response)) {}
+    kj::Own<SharedResponse> addRef() { return kj::addRef(*this); }
+    Response<AnyPointer> response;
+  };
+
+  class Flight final: public kj::Refcounted {
+    // A call to `inner` that other identical calls can wait on. Each waiter holds a reference;
+    // when the last one goes away, so does the call.
+
+  public:
+    Flight(CoalescingHook& parent, uint64_t interfaceId, uint16_t methodId,
+           kj::Array<word> params, RemotePromise<AnyPointer>&& promise)
+        : parent(kj::addRef(parent)), interfaceId(interfaceId), methodId(methodId),
+          params(kj::mv(params)),
+          pipeline(PipelineHook::from(kj::mv(promise))),
+          response(kj::Promise<Response<AnyPointer>>(kj::mv(promise))
+              .then([](Response<AnyPointer>&& response) {
+                return kj::refcounted<SharedResponse>(kj::mv(response));
+              })
+              // The fork evaluates this eagerly, dropping it as soon as the call completes, after
+              // which new calls should no longer join this one.
+              .attach(kj::defer([this]() { forget(); }))
+              .fork()) {}
+
+    ~Flight() noexcept(false) {
+      forget();
+    }
+
+    FlightKey getKey() const { return { interfaceId, methodId, params }; }
+
+    void forget() {
+      if (inTable) {
+        inTable = false;
+        parent->flights.erase(getKey());
+      }
+    }
+
+    kj::Own<CoalescingHook> parent;
+    uint64_t interfaceId;
+    uint16_t methodId;
+    kj::Array<word> params;
+    bool inTable = true;
+    kj::Own<PipelineHook> pipeline;
+    kj::ForkedPromise<kj::Own<SharedResponse>> response;
+  };
+
+  kj::HashMap<FlightKey, Flight*> flights;
+  // Calls in flight which new calls can still join.
+
+  kj::Maybe<Flight&> findFlight(uint64_t interfaceId, uint16_t methodId,
+                                kj::ArrayPtr<const word> params) {
+    return flights.find(FlightKey { interfaceId, methodId, params })
+        .map([](Flight* flight) -> Flight& { return *flight; });
+  }
+
+  kj::Own<Flight> startFlight(uint64_t interfaceId, uint16_t methodId,
+                              kj::Array<word> params, RemotePromise<AnyPointer>&& promise) {
+    auto flight = kj::refcounted<Flight>(*this, interfaceId, methodId, kj::mv(params),
+                                         kj::mv(promise));
+    flights.insert(flight->getKey(), flight.get());
+    return flight;
+  }
+
+  class RequestImpl final: public RequestHook {
+  public:
+    RequestImpl(kj::Own<CoalescingHook> parent, uint64_t interfaceId, uint16_t methodId,
+                AnyPointer::Builder params, kj::Own<RequestHook> inner)
+        : parent(kj::mv(parent)), interfaceId(interfaceId), methodId(methodId),
+          params(params), inner(kj::mv(inner)) {}
+
+    RemotePromise<AnyPointer> send() override {
+      KJ_IF_MAYBE(canonical, canonicalizeParams(params.asReader())) {
+        kj::Own<Flight> flight;
+        KJ_IF_MAYBE(f, parent->findFlight(interfaceId, methodId, *canonical)) {
+          // Join the call already in flight. Our own request is never sent.
+          flight = kj::addRef(*f);
+        } else {
+          flight = parent->startFlight(interfaceId, methodId, kj::mv(*canonical), inner->send());
+        }
+
+        auto pipeline = flight->pipeline->addRef();
+        auto promise = flight->response.addBranch()
+            .then([](kj::Own<SharedResponse>&& shared) {
+          AnyPointer::Reader results = shared->response;
+          return Response<AnyPointer>(results, kj::mv(shared));
+        }).attach(kj::mv(flight));
+        return RemotePromise<AnyPointer>(kj::mv(promise), AnyPointer::Pipeline(kj::mv(pipeline)));
+      } else {
+        return inner->send();
+      }
+    }
+
+    kj::Promise<void> sendStreaming() override {
+      return inner->sendStreaming();
+    }
+
+    const void* getBrand() override {
+      return nullptr;
+    }
+
+    void setDeadline(kj::TimePoint deadline) override {
+      // A call that joins an existing flight doesn't change that flight's deadline.
+      inner->setDeadline(deadline);
+    }
+
+  private:
+    kj::Own<CoalescingHook> parent;
+    uint64_t interfaceId;
+    uint16_t methodId;
+    AnyPointer::Builder params;
+    kj::Own<RequestHook> inner;
+  };
+};
+
+}  // namespace
+
+Capability::Client coalesceCalls(
+    Capability::Client inner,
+    kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce) {
+  return Capability::Client(kj::refcounted<CoalescingHook>(
+      ClientHook::from(kj::mv(inner)), kj::mv(shouldCoalesce)));
+}
+
+}  // namespace capnp
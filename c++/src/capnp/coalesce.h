@@ -0,0 +1,76 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#include "capability.h"
+#include <kj/function.h>
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+Capability::Client coalesceCalls(
+    Capability::Client inner,
+    kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce);
+template <typename ClientType>
+ClientType coalesceCalls(
+    ClientType inner,
+    kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce);
+// Returns a capability that forwards calls to `inner`, except that a call made while an identical
+// call is still in flight waits for that one instead of making its own. All of the waiters then
+// share the one response message. This can spare a backend a thundering herd, e.g. hundreds of
+// requests for the same cache key arriving at once.
+//
+// Calls are identical if they're to the same method and their params are equal once
+// canonicalized (see `AnyStruct::Reader::canonicalize()`). Calls whose params contain
+// capabilities are never coalesced. Coalescing only applies while a call is in flight: once it
+// returns, the next call goes to `inner` again. (This is not a cache.)
+//
+// `shouldCoalesce` selects the methods that may be coalesced. Only select methods which don't
+// have side effects that callers depend on, since a coalesced call is only delivered once.
+// Calls to other methods (and streaming calls) are passed straight through.
+//
+// A shared call is canceled once all of its callers have canceled. Callers that were coalesced
+// into a call also share its exception, if it throws one.
+//
+// Example:
+//
+//     auto cache = coalesceCalls(Cache::Client(kj::heap<CacheImpl>()),
+//         [](uint64_t interfaceId, uint16_t methodId) {
+//       return interfaceId == typeId<Cache>() && methodId == 0;  // get()
+//     });
+
+// =======================================================================================
+// inline implementation details
+
+template <typename ClientType>
+ClientType coalesceCalls(
+    ClientType inner,
+    kj::Function<bool(uint64_t interfaceId, uint16_t methodId)> shouldCoalesce) {
+  return coalesceCalls(Capability::Client(kj::mv(inner)), kj::mv(shouldCoalesce))
+      .castAs<typename ClientType::Calls>();
+}
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
@@ -0,0 +1,345 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "arrow.h"
+#include "capnp/test-util.h"
+#include "kj/debug.h"
+#include "kj/test.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+ArrowSchema& schemaChild(ArrowSchema& schema, kj::StringPtr name) {
+  for (auto i: kj::zeroTo(schema.n_children)) {
+    if (name == schema.children[i]->name) return *schema.children[i];
+  }
+  KJ_FAIL_ASSERT("no such child", name);
+}
+
+ArrowArray& arrayChild(ArrowSchema& schema, ArrowArray& array, kj::StringPtr name) {
+  KJ_ASSERT(schema.n_children == array.n_children);
+  for (auto i: kj::zeroTo(schema.n_children)) {
+    if (name == schema.children[i]->name) return *array.children[i];
+  }
+  KJ_FAIL_ASSERT("no such child", name);
+}
+
+template <typename T>
+T value(ArrowArray& array, size_t index) {
+  return reinterpret_cast<const T*>(array.buffers[1])[index];
+}
+
+bool bit(const void* bitmap, size_t index) {
+  return (reinterpret_cast<const byte*>(bitmap)[index / 8] >> (index % 8)) & 1;
+}
+
+bool isValid(ArrowArray& array, size_t index) {
+  return array.buffers[0] == nullptr || bit(array.buffers[0], index);
+}
+
+kj::String stringAt(ArrowArray& array, size_t index) {
+  auto offsets = reinterpret_cast<const int32_t*>(array.buffers[1]);
+  auto chars = reinterpret_cast<const char*>(array.buffers[2]);
+  return kj::heapString(chars + offsets[index], offsets[index + 1] - offsets[index]);
+}
+
+KJ_TEST("Arrow schema of a struct") {
+  ArrowSchema schema;
+  exportArrowSchema(Schema::from<TestAllTypes>(), schema);
+  KJ_DEFER(schema.release(&schema));
+
+  KJ_EXPECT(schema.format == kj::StringPtr("+s"));
+  KJ_EXPECT(schema.flags == 0);
+
+  KJ_EXPECT(schemaChild(schema, "voidField").format == kj::StringPtr("n"));
+  KJ_EXPECT(schemaChild(schema, "boolField").format == kj::StringPtr("b"));
+  KJ_EXPECT(schemaChild(schema, "int32Field").format == kj::StringPtr("i"));
+  KJ_EXPECT(schemaChild(schema, "int32Field").flags == 0);
+  KJ_EXPECT(schemaChild(schema, "uInt64Field").format == kj::StringPtr("L"));
+  KJ_EXPECT(schemaChild(schema, "float64Field").format == kj::StringPtr("g"));
+  KJ_EXPECT(schemaChild(schema, "enumField").format == kj::StringPtr("S"));
+  KJ_EXPECT(schemaChild(schema, "textField").format == kj::StringPtr("u"));
+  KJ_EXPECT(schemaChild(schema, "textField").flags == ARROW_FLAG_NULLABLE);
+  KJ_EXPECT(schemaChild(schema, "dataField").format == kj::StringPtr("z"));
+
+  // Recursive fields are left out, as are interfaces.
+  for (auto i: kj::zeroTo(schema.n_children)) {
+    KJ_EXPECT(schema.children[i]->name != kj::StringPtr("structField"));
+    KJ_EXPECT(schema.children[i]->name != kj::StringPtr("structList"));
+  }
+
+  auto& textList = schemaChild(schema, "textList");
+  KJ_EXPECT(textList.format == kj::StringPtr("+l"));
+  KJ_ASSERT(textList.n_children == 1);
+  KJ_EXPECT(textList.children[0]->format == kj::StringPtr("u"));
+
+  // Consumers may move children out and release them separately.
+  ArrowSchema moved = *schema.children[0];
+  schema.children[0]->release = nullptr;
+  moved.release(&moved);
+  KJ_EXPECT(moved.release == nullptr);
+
+  ArrowSchema unionSchema;
+  exportArrowSchema(Schema::from<test::TestUnnamedUnion>(), unionSchema);
+  KJ_DEFER(unionSchema.release(&unionSchema));
+  KJ_EXPECT(schemaChild(unionSchema, "foo").flags == ARROW_FLAG_NULLABLE);
+  KJ_EXPECT(schemaChild(unionSchema, "middle").flags == 0);
+
+  ArrowSchema structSchema;
+  exportArrowSchema(Schema::from<test::TestStructUnion>(), structSchema);
+  KJ_DEFER(structSchema.release(&structSchema));
+  auto& un = schemaChild(structSchema, "un");
+  KJ_EXPECT(un.format == kj::StringPtr("+s"));
+  KJ_EXPECT(un.flags == 0);
+  auto& structField = schemaChild(un, "struct");
+  KJ_EXPECT(structField.format == kj::StringPtr("+s"));
+  KJ_EXPECT(structField.flags == ARROW_FLAG_NULLABLE);
+  KJ_EXPECT(schemaChild(structField, "someText").flags == ARROW_FLAG_NULLABLE);
+}
+
+KJ_TEST("Arrow export of a struct list") {
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<TestAllTypes>().initStructList(3);
+
+  list[0].setBoolField(true);
+  list[0].setInt32Field(-123);
+  list[0].setFloat32Field(1.5);
+  list[0].setTextField("foo");
+  list[0].setEnumField(TestEnum::QUX);
+  {
+    auto ints = list[0].initInt32List(2);
+    ints.set(0, 1);
+    ints.set(1, 2);
+  }
+  list[1].setInt32Field(456);
+  list[1].setTextField("");
+  {
+    auto texts = list[1].initTextList(2);
+    texts.set(0, "a");
+    texts.set(1, "bc");
+  }
+  list[2].setBoolField(true);
+  list[2].setInt32Field(789);
+  list[2].initInt32List(1).set(0, 3);
+
+  bool released = false;
+  auto owner = kj::defer([&]() { released = true; });
+
+  ArrowSchema schema;
+  exportArrowSchema(Schema::from<TestAllTypes>(), schema);
+  KJ_DEFER(schema.release(&schema));
+  ArrowArray array;
+  exportArrowArray(toDynamic(list.asReader()), array,
+                   kj::heap<decltype(owner)>(kj::mv(owner)));
+
+  KJ_EXPECT(array.length == 3);
+  KJ_EXPECT(array.null_count == 0);
+  KJ_EXPECT(array.n_buffers == 1);
+
+  auto& voids = arrayChild(schema, array, "voidField");
+  KJ_EXPECT(voids.n_buffers == 0);
+  KJ_EXPECT(voids.null_count == 3);
+
+  auto& bools = arrayChild(schema, array, "boolField");
+  KJ_EXPECT(bit(bools.buffers[1], 0));
+  KJ_EXPECT(!bit(bools.buffers[1], 1));
+  KJ_EXPECT(bit(bools.buffers[1], 2));
+
+  auto& ints = arrayChild(schema, array, "int32Field");
+  KJ_EXPECT(ints.null_count == 0);
+  KJ_EXPECT(value<int32_t>(ints, 0) == -123);
+  KJ_EXPECT(value<int32_t>(ints, 1) == 456);
+  KJ_EXPECT(value<int32_t>(ints, 2) == 789);
+
+  KJ_EXPECT(value<float>(arrayChild(schema, array, "float32Field"), 0) == 1.5);
+  KJ_EXPECT(value<uint16_t>(arrayChild(schema, array, "enumField"), 0) ==
+            uint16_t(TestEnum::QUX));
+
+  auto& texts = arrayChild(schema, array, "textField");
+  KJ_EXPECT(texts.null_count == 1);
+  KJ_EXPECT(stringAt(texts, 0) == "foo");
+  KJ_EXPECT(isValid(texts, 1));
+  KJ_EXPECT(stringAt(texts, 1) == "");
+  KJ_EXPECT(!isValid(texts, 2));
+
+  auto& intLists = arrayChild(schema, array, "int32List");
+  KJ_EXPECT(intLists.null_count == 1);
+  auto intOffsets = reinterpret_cast<const int32_t*>(intLists.buffers[1]);
+  KJ_EXPECT(intOffsets[0] == 0);
+  KJ_EXPECT(intOffsets[1] == 2);
+  KJ_EXPECT(intOffsets[2] == 2);
+  KJ_EXPECT(intOffsets[3] == 3);
+  KJ_ASSERT(intLists.n_children == 1);
+  KJ_EXPECT(intLists.children[0]->length == 3);
+  KJ_EXPECT(value<int32_t>(*intLists.children[0], 0) == 1);
+  KJ_EXPECT(value<int32_t>(*intLists.children[0], 1) == 2);
+  KJ_EXPECT(value<int32_t>(*intLists.children[0], 2) == 3);
+
+  auto& textLists = arrayChild(schema, array, "textList");
+  KJ_ASSERT(textLists.n_children == 1);
+  KJ_EXPECT(textLists.children[0]->length == 2);
+  KJ_EXPECT(stringAt(*textLists.children[0], 1) == "bc");
+
+  // The owner is released along with the last array, even one moved out of its parent.
+  ArrowArray moved = *array.children[0];
+  array.children[0]->release = nullptr;
+  array.release(&array);
+  KJ_EXPECT(!released);
+  moved.release(&moved);
+  KJ_EXPECT(released);
+}
+
+KJ_TEST("Arrow export of unions") {
+  MallocMessageBuilder unionBuilder;
+  auto unions = unionBuilder.initRoot<test::TestAnyPointer>().getAnyPointerField()
+      .initAs<List<test::TestUnnamedUnion>>(2);
+  unions[0].setFoo(12);
+  unions[0].setMiddle(3);
+  unions[1].setBar(34);
+  unions[1].setMiddle(4);
+
+  ArrowSchema schema;
+  exportArrowSchema(Schema::from<test::TestUnnamedUnion>(), schema);
+  KJ_DEFER(schema.release(&schema));
+  ArrowArray array;
+  exportArrowArray(toDynamic(unions.asReader()), array);
+  KJ_DEFER(array.release(&array));
+
+  auto& foo = arrayChild(schema, array, "foo");
+  KJ_EXPECT(foo.null_count == 1);
+  KJ_EXPECT(isValid(foo, 0));
+  KJ_EXPECT(value<uint16_t>(foo, 0) == 12);
+  KJ_EXPECT(!isValid(foo, 1));
+  auto& bar = arrayChild(schema, array, "bar");
+  KJ_EXPECT(!isValid(bar, 0));
+  KJ_EXPECT(value<uint32_t>(bar, 1) == 34);
+  auto& middle = arrayChild(schema, array, "middle");
+  KJ_EXPECT(middle.null_count == 0);
+  KJ_EXPECT(value<uint16_t>(middle, 1) == 4);
+
+  // Unions of groups and structs.
+  MallocMessageBuilder structBuilder;
+  auto structs = structBuilder.initRoot<test::TestAnyPointer>().getAnyPointerField()
+      .initAs<List<test::TestStructUnion>>(3);
+  structs[0].getUn().initStruct().setSomeText("foo");
+  structs[1].getUn().initObject();
+  structs[2].getUn().initStruct();
+
+  ArrowSchema structSchema;
+  exportArrowSchema(Schema::from<test::TestStructUnion>(), structSchema);
+  KJ_DEFER(structSchema.release(&structSchema));
+  ArrowArray structArray;
+  exportArrowArray(toDynamic(structs.asReader()), structArray);
+  KJ_DEFER(structArray.release(&structArray));
+
+  auto& unSchema = schemaChild(structSchema, "un");
+  auto& un = arrayChild(structSchema, structArray, "un");
+  KJ_EXPECT(un.null_count == 0);
+  auto& structField = arrayChild(unSchema, un, "struct");
+  KJ_EXPECT(structField.null_count == 1);
+  KJ_EXPECT(isValid(structField, 0));
+  KJ_EXPECT(!isValid(structField, 1));
+  KJ_EXPECT(isValid(structField, 2));
+  auto& someText = arrayChild(schemaChild(unSchema, "struct"), structField, "someText");
+  KJ_EXPECT(stringAt(someText, 0) == "foo");
+  KJ_EXPECT(!isValid(someText, 1));
+  KJ_EXPECT(!isValid(someText, 2));
+}
+
+KJ_TEST("Arrow export of default values") {
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<test::TestAnyPointer>().getAnyPointerField()
+      .initAs<List<TestDefaults>>(2);
+  list[1].setInt32Field(5);
+  list[1].setBoolField(false);
+
+  ArrowSchema schema;
+  exportArrowSchema(Schema::from<TestDefaults>(), schema);
+  KJ_DEFER(schema.release(&schema));
+  ArrowArray array;
+  exportArrowArray(toDynamic(list.asReader()), array);
+  KJ_DEFER(array.release(&array));
+
+  auto& ints = arrayChild(schema, array, "int32Field");
+  KJ_EXPECT(value<int32_t>(ints, 0) == -12345678);
+  KJ_EXPECT(value<int32_t>(ints, 1) == 5);
+  KJ_EXPECT(value<uint32_t>(arrayChild(schema, array, "uInt32Field"), 0) == 3456789012u);
+  KJ_EXPECT(value<float>(arrayChild(schema, array, "float32Field"), 0) == 1234.5);
+  auto& bools = arrayChild(schema, array, "boolField");
+  KJ_EXPECT(bit(bools.buffers[1], 0));
+  KJ_EXPECT(!bit(bools.buffers[1], 1));
+}
+
+KJ_TEST("Arrow export without copying") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  auto ints = root.initUInt32List(3);
+  ints.set(0, 1);
+  ints.set(1, 2);
+  ints.set(2, 3);
+  auto bools = root.initBoolList(10);
+  bools.set(9, true);
+
+  {
+    ArrowArray array;
+    exportArrowArray(toDynamic(ints.asReader()), array);
+    KJ_DEFER(array.release(&array));
+    KJ_EXPECT(array.length == 3);
+    KJ_EXPECT(array.buffers[1] == AnyList::Reader(ints.asReader()).getRawBytes().begin());
+    KJ_EXPECT(value<uint32_t>(array, 2) == 3);
+  }
+
+  {
+    ArrowArray array;
+    exportArrowArray(toDynamic(bools.asReader()), array);
+    KJ_DEFER(array.release(&array));
+    KJ_EXPECT(array.buffers[1] == AnyList::Reader(bools.asReader()).getRawBytes().begin());
+    KJ_EXPECT(!bit(array.buffers[1], 8));
+    KJ_EXPECT(bit(array.buffers[1], 9));
+  }
+
+  // Data values written one after another, each a whole number of words, are contiguous.
+  auto records = builder.getOrphanage().newOrphan<List<TestAllTypes>>(3);
+  auto recordList = records.get();
+  byte bytes[24] = {};
+  for (auto i: kj::zeroTo(3)) {
+    bytes[0] = i;
+    recordList[i].setDataField(kj::arrayPtr(bytes, 8 * (i + 1)));
+  }
+
+  ArrowSchema schema;
+  exportArrowSchema(Schema::from<TestAllTypes>(), schema);
+  KJ_DEFER(schema.release(&schema));
+  ArrowArray array;
+  exportArrowArray(toDynamic(recordList.asReader()), array);
+  KJ_DEFER(array.release(&array));
+
+  auto& data = arrayChild(schema, array, "dataField");
+  KJ_EXPECT(data.buffers[2] == recordList[0].getDataField().begin());
+  auto offsets = reinterpret_cast<const int32_t*>(data.buffers[1]);
+  KJ_EXPECT(offsets[3] == 48);
+  KJ_EXPECT(reinterpret_cast<const byte*>(data.buffers[2])[offsets[2]] == 2);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,840 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "arrow.h"
+#include <capnp/any.h>
+#include <kj/debug.h>
+#include <kj/refcount.h>
+#include <kj/vector.h>
+#include <string.h>
+
+namespace capnp {
+
+namespace {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == CAPNP_WIRE_BYTE_ORDER && \
+    !CAPNP_DISABLE_ENDIAN_DETECTION
+constexpr bool WIRE_ORDER_IS_NATIVE = true;
+#else
+constexpr bool WIRE_ORDER_IS_NATIVE = false;
+#endif
+// Whether primitive data in a message can be handed to Arrow as is.
+
+struct Enclosing {
+  // The chain of structs (and groups) that a value is nested in, innermost first.
+
+  uint64_t id;
+  const Enclosing* outer;
+
+  bool contains(uint64_t structId) const {
+    for (auto e = this; e != nullptr; e = e->outer) {
+      if (e->id == structId) return true;
+    }
+    return false;
+  }
+};
+
+bool isExported(Type type, const Enclosing* enclosing) {
+  // Arrow schemas can't be recursive, so a struct nested within itself is left out.
+
+  switch (type.which()) {
+    case schema::Type::INTERFACE:
+    case schema::Type::ANY_POINTER:
+      return false;
+    case schema::Type::LIST:
+      return isExported(type.asList().getElementType(), enclosing);
+    case schema::Type::STRUCT:
+      return enclosing == nullptr || !enclosing->contains(type.asStruct().getProto().getId());
+    default:
+      return true;
+  }
+}
+
+bool isNullablePointer(Type type) {
+  // Can values of this type be null when they're elements of a list? (Fields of struct type can
+  // be too, but elements of struct lists can't.)
+
+  switch (type.which()) {
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint elementBytes(Type type) {
+  // Size of a primitive value, except Bool and Void.
+
+  switch (type.which()) {
+    case schema::Type::INT8:
+    case schema::Type::UINT8:
+      return 1;
+    case schema::Type::INT16:
+    case schema::Type::UINT16:
+    case schema::Type::ENUM:
+      return 2;
+    case schema::Type::INT32:
+    case schema::Type::UINT32:
+    case schema::Type::FLOAT32:
+      return 4;
+    case schema::Type::INT64:
+    case schema::Type::UINT64:
+    case schema::Type::FLOAT64:
+      return 8;
+    default:
+      KJ_UNREACHABLE;
+  }
+}
+
+ElementSize elementSizeOf(uint bytes) {
+  switch (bytes) {
+    case 1: return ElementSize::BYTE;
+    case 2: return ElementSize::TWO_BYTES;
+    case 4: return ElementSize::FOUR_BYTES;
+    case 8: return ElementSize::EIGHT_BYTES;
+    default: KJ_UNREACHABLE;
+  }
+}
+
+// =======================================================================================
+// Schemas
+
+struct SchemaData {
+  kj::Own<SchemaData> self;
+  // Each node owns itself until released, since consumers may move children out of their parents.
+
+  const char* format = nullptr;
+  kj::String name;
+  int64_t flags = 0;
+
+  kj::Vector<kj::Own<SchemaData>> pendingChildren;
+  kj::Array<ArrowSchema> children;
+  kj::Array<ArrowSchema*> childPointers;
+};
+
+void releaseSchema(ArrowSchema* schema) {
+  auto& data = *reinterpret_cast<SchemaData*>(schema->private_data);
+  for (auto& child: data.children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+  schema->release = nullptr;
+  auto self = kj::mv(data.self);
+}
+
+kj::Own<SchemaData> exportSchema(Type type, kj::StringPtr name, bool nullable,
+                                 bool isUnionMember, const Enclosing* enclosing) {
+  auto data = kj::heap<SchemaData>();
+  data->name = kj::heapString(name);
+  data->flags = nullable ? ARROW_FLAG_NULLABLE : 0;
+
+  switch (type.which()) {
+    case schema::Type::VOID: data->format = isUnionMember ? "b" : "n"; break;
+    case schema::Type::BOOL: data->format = "b"; break;
+    case schema::Type::INT8: data->format = "c"; break;
+    case schema::Type::INT16: data->format = "s"; break;
+    case schema::Type::INT32: data->format = "i"; break;
+    case schema::Type::INT64: data->format = "l"; break;
+    case schema::Type::UINT8: data->format = "C"; break;
+    case schema::Type::UINT16: data->format = "S"; break;
+    case schema::Type::UINT32: data->format = "I"; break;
+    case schema::Type::UINT64: data->format = "L"; break;
+    case schema::Type::FLOAT32: data->format = "f"; break;
+    case schema::Type::FLOAT64: data->format = "g"; break;
+    case schema::Type::TEXT: data->format = "u"; break;
+    case schema::Type::DATA: data->format = "z"; break;
+    case schema::Type::ENUM: data->format = "S"; break;
+
+    case schema::Type::LIST: {
+      data->format = "+l";
+      auto elementType = type.asList().getElementType();
+      data->pendingChildren.add(
+          exportSchema(elementType, "item", isNullablePointer(elementType), false, enclosing));
+      break;
+    }
+
+    case schema::Type::STRUCT: {
+      data->format = "+s";
+      auto structSchema = type.asStruct();
+      Enclosing inner { structSchema.getProto().getId(), enclosing };
+      for (auto field: structSchema.getFields()) {
+        auto fieldType = field.getType();
+        if (!isExported(fieldType, &inner)) continue;
+
+        auto proto = field.getProto();
+        bool isMember = proto.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
+        bool isPointer = !proto.isGroup() &&
+            (isNullablePointer(fieldType) || fieldType.isStruct());
+        data->pendingChildren.add(exportSchema(
+            fieldType, proto.getName(), nullable || isMember || isPointer, isMember, &inner));
+      }
+      break;
+    }
+
+    case schema::Type::INTERFACE:
+    case schema::Type::ANY_POINTER:
+      KJ_UNREACHABLE;
+  }
+
+  return data;
+}
+
+void publish(kj::Own<SchemaData> data, ArrowSchema& out) {
+  auto& d = *data;
+  d.children = kj::heapArray<ArrowSchema>(d.pendingChildren.size());
+  d.childPointers = kj::heapArray<ArrowSchema*>(d.children.size());
+  for (auto i: kj::indices(d.children)) {
+    publish(kj::mv(d.pendingChildren[i]), d.children[i]);
+    d.childPointers[i] = &d.children[i];
+  }
+
+  out.format = d.format;
+  out.name = d.name.cStr();
+  out.metadata = nullptr;
+  out.flags = d.flags;
+  out.n_children = d.children.size();
+  out.children = d.childPointers.begin();
+  out.dictionary = nullptr;
+  out.release = releaseSchema;
+  out.private_data = &d;
+  d.self = kj::mv(data);
+}
+
+// =======================================================================================
+// Arrays
+
+class Owner final: public kj::AtomicRefcounted {
+  // Keeps the message alive for as long as any exported array is.
+
+public:
+  explicit Owner(kj::Own<void> inner): inner(kj::mv(inner)) {}
+
+private:
+  kj::Own<void> inner;
+};
+
+struct ArrayData {
+  explicit ArrayData(size_t length): length(length) {}
+
+  kj::Own<ArrayData> self;
+  // Each node owns itself until released, since consumers may move children out of their parents.
+
+  kj::Own<const Owner> owner;
+
+  int64_t length;
+  int64_t nullCount = 0;
+  kj::Vector<kj::Array<byte>> storage;
+  kj::Vector<const void*> buffers;
+
+  kj::Vector<kj::Own<ArrayData>> pendingChildren;
+  kj::Array<ArrowArray> children;
+  kj::Array<ArrowArray*> childPointers;
+
+  template <typename T>
+  kj::ArrayPtr<T> allocate(size_t count) {
+    // Allocates a buffer owned by this array.
+    auto bytes = kj::heapArray<byte>(count * sizeof(T));
+    auto result = kj::arrayPtr(reinterpret_cast<T*>(bytes.begin()), count);
+    storage.add(kj::mv(bytes));
+    return result;
+  }
+
+  template <typename Func>
+  const byte* packBits(size_t count, Func&& getBit) {
+    auto bits = allocate<byte>((count + 7) / 8);
+    memset(bits.begin(), 0, bits.size());
+    for (size_t i = 0; i < count; i++) {
+      if (getBit(i)) bits[i / 8] |= 1u << (i % 8);
+    }
+    return bits.begin();
+  }
+
+  void addValidity(kj::ArrayPtr<const bool> valid) {
+    // Adds the validity bitmap, which is left out if all values are valid.
+
+    nullCount = 0;
+    for (bool b: valid) {
+      if (!b) ++nullCount;
+    }
+    if (nullCount == 0) {
+      buffers.add(nullptr);
+    } else {
+      buffers.add(packBits(valid.size(), [&](size_t i) { return valid[i]; }));
+    }
+  }
+};
+
+void releaseArray(ArrowArray* array) {
+  auto& data = *reinterpret_cast<ArrayData*>(array->private_data);
+  for (auto& child: data.children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+  array->release = nullptr;
+  auto self = kj::mv(data.self);
+}
+
+void publish(kj::Own<ArrayData> data, const Owner& owner, ArrowArray& out) {
+  auto& d = *data;
+  d.owner = kj::atomicAddRef(owner);
+  d.children = kj::heapArray<ArrowArray>(d.pendingChildren.size());
+  d.childPointers = kj::heapArray<ArrowArray*>(d.children.size());
+  for (auto i: kj::indices(d.children)) {
+    publish(kj::mv(d.pendingChildren[i]), owner, d.children[i]);
+    d.childPointers[i] = &d.children[i];
+  }
+
+  out.length = d.length;
+  out.null_count = d.nullCount;
+  out.offset = 0;
+  out.n_buffers = d.buffers.size();
+  out.n_children = d.children.size();
+  out.buffers = d.buffers.begin();
+  out.children = d.childPointers.begin();
+  out.dictionary = nullptr;
+  out.release = releaseArray;
+  out.private_data = &d;
+  d.self = kj::mv(data);
+}
+
+kj::Array<bool> allValid(size_t count) {
+  auto result = kj::heapArray<bool>(count);
+  for (auto& b: result) b = true;
+  return result;
+}
+
+int32_t checkOffset(size_t offset) {
+  KJ_REQUIRE(offset <= size_t(int32_t(kj::maxValue)),
+             "list too big for Arrow's 32-bit offsets", offset);
+  return offset;
+}
+
+class ValueBuffer {
+  // Concatenates byte ranges into a buffer. If each range directly follows the previous one in the
+  // message, as often happens when they were written in order, the buffer is simply that part of
+  // the message.
+
+public:
+  void add(kj::ArrayPtr<const byte> bytes) {
+    if (bytes.size() == 0) return;
+    if (pieces.size() > 0 && bytes.begin() != pieces.back().end()) contiguous = false;
+    pieces.add(bytes);
+    total += bytes.size();
+  }
+
+  size_t size() const { return total; }
+
+  const void* finish(ArrayData& data) {
+    if (pieces.size() == 0) return nullptr;
+    if (contiguous && WIRE_ORDER_IS_NATIVE) return pieces.front().begin();
+
+    auto result = data.allocate<byte>(total);
+    byte* pos = result.begin();
+    for (auto piece: pieces) {
+      memcpy(pos, piece.begin(), piece.size());
+      pos += piece.size();
+    }
+    return result.begin();
+  }
+
+private:
+  kj::Vector<kj::ArrayPtr<const byte>> pieces;
+  size_t total = 0;
+  bool contiguous = true;
+};
+
+AnyPointer::Reader getPointer(AnyStruct::Reader reader, uint index) {
+  auto pointers = reader.getPointerSection();
+  return index < pointers.size() ? pointers[index] : AnyPointer::Reader();
+}
+
+class ListRows {
+  // The elements of a List(Struct), read a column at a time.
+
+public:
+  explicit ListRows(List<AnyStruct>::Reader list): list(list) {}
+
+  size_t size() const { return list.size(); }
+
+  template <typename T>
+  void readColumn(uint32_t offset, T mask, T* out) const {
+    // Reads the data field at `offset` (in units of T, as in the schema), XORed with `mask`.
+    ColumnReader<T> column(list, assumeDataOffset(offset), mask);
+    for (uint i = 0; i < column.size(); i++) {
+      out[i] = column[i];
+    }
+  }
+
+  AnyPointer::Reader getPointer(size_t row, uint index) const {
+    return capnp::getPointer(list[row], index);
+  }
+
+private:
+  List<AnyStruct>::Reader list;
+};
+
+class GatheredRows {
+  // Structs from all over the message, e.g. the values of a struct field.
+
+public:
+  explicit GatheredRows(kj::Array<AnyStruct::Reader> rows): rows(kj::mv(rows)) {}
+
+  size_t size() const { return rows.size(); }
+
+  template <typename T>
+  void readColumn(uint32_t offset, T mask, T* out) const {
+    for (auto i: kj::indices(rows)) {
+      auto data = rows[i].getDataSection();
+      if ((size_t(offset) + 1) * sizeof(T) <= data.size()) {
+        out[i] = reinterpret_cast<const _::WireValue<T>*>(data.begin())[offset].get() ^ mask;
+      } else {
+        out[i] = mask;
+      }
+    }
+  }
+
+  AnyPointer::Reader getPointer(size_t row, uint index) const {
+    return capnp::getPointer(rows[row], index);
+  }
+
+private:
+  kj::Array<AnyStruct::Reader> rows;
+};
+
+kj::Own<ArrayData> exportNulls(size_t count) {
+  auto data = kj::heap<ArrayData>(count);
+  data->nullCount = count;
+  return data;
+}
+
+template <typename Func>
+kj::Own<ArrayData> exportBools(kj::ArrayPtr<const bool> valid, Func&& getBit) {
+  auto data = kj::heap<ArrayData>(valid.size());
+  data->addValidity(valid);
+  data->buffers.add(data->packBits(valid.size(), getBit));
+  return data;
+}
+
+template <typename T, typename Rows>
+kj::Own<ArrayData> exportColumn(const Rows& rows, uint32_t offset, T mask,
+                                kj::ArrayPtr<const bool> valid) {
+  kj::Own<ArrayData> data = kj::heap<ArrayData>(rows.size());
+  data->addValidity(valid);
+  auto values = data->allocate<T>(rows.size());
+  rows.readColumn(offset, mask, values.begin());
+  data->buffers.add(values.begin());
+  return data;
+}
+
+template <typename Func>
+kj::Own<ArrayData> exportBinary(kj::ArrayPtr<const AnyPointer::Reader> pointers,
+                                kj::ArrayPtr<const bool> valid, Func&& getBytes) {
+  auto data = kj::heap<ArrayData>(pointers.size());
+  data->addValidity(valid);
+  auto offsets = data->allocate<int32_t>(pointers.size() + 1);
+  ValueBuffer values;
+  offsets[0] = 0;
+  for (auto i: kj::indices(pointers)) {
+    if (valid[i]) values.add(getBytes(pointers[i]));
+    offsets[i + 1] = checkOffset(values.size());
+  }
+  data->buffers.add(offsets.begin());
+  data->buffers.add(values.finish(*data));
+  return data;
+}
+
+template <typename Rows>
+kj::Own<ArrayData> exportStruct(StructSchema schema, const Rows& rows,
+                                kj::ArrayPtr<const bool> valid, const Enclosing* enclosing);
+
+kj::Own<ArrayData> exportPointers(Type type, kj::ArrayPtr<const AnyPointer::Reader> pointers,
+                                  kj::ArrayPtr<const bool> parentValid,
+                                  const Enclosing* enclosing);
+
+void writePrimitive(DynamicValue::Reader value, Type type, byte* out) {
+  switch (type.which()) {
+#define HANDLE_TYPE(name, type) \
+    case schema::Type::name: { \
+      type v = value.as<type>(); \
+      memcpy(out, &v, sizeof(v)); \
+      return; \
+    }
+    HANDLE_TYPE(INT8, int8_t)
+    HANDLE_TYPE(INT16, int16_t)
+    HANDLE_TYPE(INT32, int32_t)
+    HANDLE_TYPE(INT64, int64_t)
+    HANDLE_TYPE(UINT8, uint8_t)
+    HANDLE_TYPE(UINT16, uint16_t)
+    HANDLE_TYPE(UINT32, uint32_t)
+    HANDLE_TYPE(UINT64, uint64_t)
+    HANDLE_TYPE(FLOAT32, float)
+    HANDLE_TYPE(FLOAT64, double)
+#undef HANDLE_TYPE
+    case schema::Type::ENUM: {
+      uint16_t v = value.as<DynamicEnum>().getRaw();
+      memcpy(out, &v, sizeof(v));
+      return;
+    }
+    default:
+      KJ_UNREACHABLE;
+  }
+}
+
+kj::ArrayPtr<const byte> primitiveBytes(ArrayData& data, AnyPointer::Reader pointer,
+                                        ListSchema schema) {
+  // The values of a list of primitives, in Arrow's layout. This is the list's own memory unless
+  // the list was written with a different element size, as happens when its type was upgraded.
+
+  auto elementType = schema.getElementType();
+  uint bytes = elementBytes(elementType);
+  auto list = pointer.getAs<AnyList>();
+  if (WIRE_ORDER_IS_NATIVE && list.getElementSize() == elementSizeOf(bytes)) {
+    return list.getRawBytes();
+  }
+
+  auto dynamicList = pointer.getAs<DynamicList>(schema);
+  auto result = data.allocate<byte>(dynamicList.size() * bytes);
+  for (uint i = 0; i < dynamicList.size(); i++) {
+    writePrimitive(dynamicList[i], elementType, result.begin() + i * bytes);
+  }
+  return result;
+}
+
+List<AnyStruct>::Reader asStructList(AnyList::Reader list) {
+  KJ_REQUIRE(list.getElementSize() != ElementSize::BIT,
+             "Found bit list where struct list was expected.") {
+    return List<AnyStruct>::Reader();
+  }
+  return list.as<List<AnyStruct>>();
+}
+
+void gatherPointers(AnyPointer::Reader pointer, kj::Vector<AnyPointer::Reader>& out) {
+  auto list = pointer.getAs<AnyList>();
+  if (list.getElementSize() == ElementSize::POINTER) {
+    for (auto element: list.as<List<AnyPointer>>()) out.add(element);
+  } else {
+    // The list's type was upgraded to a list of structs, whose first pointers are the elements.
+    for (auto element: asStructList(list)) out.add(getPointer(element, 0));
+  }
+}
+
+void gatherStructs(AnyPointer::Reader pointer, kj::Vector<AnyStruct::Reader>& out) {
+  for (auto element: asStructList(pointer.getAs<AnyList>())) out.add(element);
+}
+
+kj::Own<ArrayData> exportList(ListSchema schema, kj::ArrayPtr<const AnyPointer::Reader> pointers,
+                              kj::ArrayPtr<const bool> valid, const Enclosing* enclosing) {
+  auto elementType = schema.getElementType();
+  auto data = kj::heap<ArrayData>(pointers.size());
+  data->addValidity(valid);
+  auto offsets = data->allocate<int32_t>(pointers.size() + 1);
+  offsets[0] = 0;
+  size_t total = 0;
+
+  switch (elementType.which()) {
+    case schema::Type::VOID:
+      for (auto i: kj::indices(pointers)) {
+        if (valid[i]) total += pointers[i].getAs<AnyList>().size();
+        offsets[i + 1] = checkOffset(total);
+      }
+      data->pendingChildren.add(exportNulls(total));
+      break;
+
+    case schema::Type::BOOL: {
+      kj::Vector<bool> values;
+      for (auto i: kj::indices(pointers)) {
+        if (valid[i]) {
+          for (auto value: pointers[i].getAs<List<bool>>()) values.add(value);
+        }
+        offsets[i + 1] = checkOffset(values.size());
+      }
+      auto childValid = allValid(values.size());
+      data->pendingChildren.add(exportBools(childValid, [&](size_t i) { return values[i]; }));
+      break;
+    }
+
+    case schema::Type::INT8:
+    case schema::Type::INT16:
+    case schema::Type::INT32:
+    case schema::Type::INT64:
+    case schema::Type::UINT8:
+    case schema::Type::UINT16:
+    case schema::Type::UINT32:
+    case schema::Type::UINT64:
+    case schema::Type::FLOAT32:
+    case schema::Type::FLOAT64:
+    case schema::Type::ENUM: {
+      auto child = kj::heap<ArrayData>(0);
+      child->buffers.add(nullptr);
+      ValueBuffer values;
+      uint bytes = elementBytes(elementType);
+      for (auto i: kj::indices(pointers)) {
+        if (valid[i]) values.add(primitiveBytes(*child, pointers[i], schema));
+        offsets[i + 1] = checkOffset(values.size() / bytes);
+      }
+      child->length = values.size() / bytes;
+      child->buffers.add(values.finish(*child));
+      data->pendingChildren.add(kj::mv(child));
+      break;
+    }
+
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST: {
+      kj::Vector<AnyPointer::Reader> elements;
+      for (auto i: kj::indices(pointers)) {
+        if (valid[i]) gatherPointers(pointers[i], elements);
+        offsets[i + 1] = checkOffset(elements.size());
+      }
+      auto childValid = allValid(elements.size());
+      data->pendingChildren.add(exportPointers(elementType, elements, childValid, enclosing));
+      break;
+    }
+
+    case schema::Type::STRUCT: {
+      kj::Vector<AnyStruct::Reader> elements;
+      for (auto i: kj::indices(pointers)) {
+        if (valid[i]) gatherStructs(pointers[i], elements);
+        offsets[i + 1] = checkOffset(elements.size());
+      }
+      auto childValid = allValid(elements.size());
+      data->pendingChildren.add(exportStruct(elementType.asStruct(),
+          GatheredRows(elements.releaseAsArray()), childValid, enclosing));
+      break;
+    }
+
+    case schema::Type::INTERFACE:
+    case schema::Type::ANY_POINTER:
+      KJ_UNREACHABLE;
+  }
+
+  data->buffers.add(offsets.begin());
+  return data;
+}
+
+kj::Own<ArrayData> exportPointers(Type type, kj::ArrayPtr<const AnyPointer::Reader> pointers,
+                                  kj::ArrayPtr<const bool> parentValid,
+                                  const Enclosing* enclosing) {
+  auto valid = KJ_MAP(i, kj::indices(pointers)) -> bool {
+    return parentValid[i] && !pointers[i].isNull();
+  };
+
+  switch (type.which()) {
+    case schema::Type::TEXT:
+      return exportBinary(pointers, valid, [](AnyPointer::Reader pointer) {
+        return pointer.getAs<Text>().asBytes();
+      });
+    case schema::Type::DATA:
+      return exportBinary(pointers, valid, [](AnyPointer::Reader pointer) {
+        return pointer.getAs<Data>();
+      });
+    case schema::Type::LIST:
+      return exportList(type.asList(), pointers, valid, enclosing);
+    case schema::Type::STRUCT: {
+      auto rows = KJ_MAP(i, kj::indices(pointers)) {
+        return valid[i] ? pointers[i].getAs<AnyStruct>() : AnyStruct::Reader();
+      };
+      return exportStruct(type.asStruct(), GatheredRows(kj::mv(rows)), valid, enclosing);
+    }
+    default:
+      KJ_UNREACHABLE;
+  }
+}
+
+template <typename Rows>
+kj::Own<ArrayData> exportStruct(StructSchema schema, const Rows& rows,
+                                kj::ArrayPtr<const bool> valid, const Enclosing* enclosing) {
+  size_t count = rows.size();
+  kj::Own<ArrayData> data = kj::heap<ArrayData>(count);
+  data->addValidity(valid);
+
+  auto structProto = schema.getProto().getStruct();
+  auto discriminants = kj::heapArray<uint16_t>(
+      structProto.getDiscriminantCount() > 0 ? count : 0);
+  if (discriminants.size() > 0) {
+    rows.readColumn(structProto.getDiscriminantOffset(), uint16_t(0), discriminants.begin());
+  }
+
+  Enclosing inner { schema.getProto().getId(), enclosing };
+  for (auto field: schema.getFields()) {
+    auto type = field.getType();
+    if (!isExported(type, &inner)) continue;
+
+    auto proto = field.getProto();
+    bool isMember = proto.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
+    auto fieldValid = KJ_MAP(i, kj::zeroTo(count)) -> bool {
+      return valid[i] && (!isMember || discriminants[i] == proto.getDiscriminantValue());
+    };
+
+    if (proto.isGroup()) {
+      data->pendingChildren.add(exportStruct(type.asStruct(), rows, fieldValid, &inner));
+      continue;
+    }
+
+    auto slot = proto.getSlot();
+    uint32_t offset = slot.getOffset();
+    auto defaultValue = slot.getDefaultValue();
+    kj::Own<ArrayData> child;
+
+    switch (type.which()) {
+      case schema::Type::VOID:
+        if (isMember) {
+          child = exportBools(allValid(count), [&](size_t i) { return fieldValid[i]; });
+        } else {
+          child = exportNulls(count);
+        }
+        break;
+
+      case schema::Type::BOOL: {
+        auto bytes = kj::heapArray<uint8_t>(count);
+        rows.readColumn(offset / 8, uint8_t(0), bytes.begin());
+        bool defaultBit = defaultValue.getBool();
+        child = exportBools(fieldValid, [&](size_t i) {
+          return ((bytes[i] >> (offset % 8)) & 1) != defaultBit;
+        });
+        break;
+      }
+
+#define HANDLE_TYPE(name, getter, type) \
+      case schema::Type::name: \
+        child = exportColumn<type>(rows, offset, \
+            _::mask(defaultValue.getter(), 0), fieldValid); \
+        break;
+      HANDLE_TYPE(INT8, getInt8, uint8_t)
+      HANDLE_TYPE(INT16, getInt16, uint16_t)
+      HANDLE_TYPE(INT32, getInt32, uint32_t)
+      HANDLE_TYPE(INT64, getInt64, uint64_t)
+      HANDLE_TYPE(UINT8, getUint8, uint8_t)
+      HANDLE_TYPE(UINT16, getUint16, uint16_t)
+      HANDLE_TYPE(UINT32, getUint32, uint32_t)
+      HANDLE_TYPE(UINT64, getUint64, uint64_t)
+      HANDLE_TYPE(FLOAT32, getFloat32, uint32_t)
+      HANDLE_TYPE(FLOAT64, getFloat64, uint64_t)
+      HANDLE_TYPE(ENUM, getEnum, uint16_t)
+#undef HANDLE_TYPE
+
+      case schema::Type::TEXT:
+      case schema::Type::DATA:
+      case schema::Type::LIST:
+      case schema::Type::STRUCT: {
+        auto pointers = KJ_MAP(i, kj::zeroTo(count)) {
+          return fieldValid[i] ? rows.getPointer(i, offset) : AnyPointer::Reader();
+        };
+        child = exportPointers(type, pointers, fieldValid, &inner);
+        break;
+      }
+
+      case schema::Type::INTERFACE:
+      case schema::Type::ANY_POINTER:
+        KJ_UNREACHABLE;
+    }
+
+    data->pendingChildren.add(kj::mv(child));
+  }
+
+  return data;
+}
+
+}  // namespace
+
+void exportArrowSchema(Type elementType, ArrowSchema& out) {
+  KJ_REQUIRE(isExported(elementType, nullptr),
+             "Arrow export doesn't support interfaces or AnyPointer.");
+
+  publish(exportSchema(elementType, "", isNullablePointer(elementType), false, nullptr), out);
+}
+
+void exportArrowArray(DynamicList::Reader list, ArrowArray& out, kj::Own<void> owner) {
+  auto schema = list.getSchema();
+  auto elementType = schema.getElementType();
+  KJ_REQUIRE(isExported(elementType, nullptr),
+             "Arrow export doesn't support interfaces or AnyPointer.");
+
+  AnyList::Reader anyList = list;
+  size_t count = list.size();
+  auto valid = allValid(count);
+  kj::Own<ArrayData> data;
+
+  switch (elementType.which()) {
+    case schema::Type::VOID:
+      data = exportNulls(count);
+      break;
+
+    case schema::Type::BOOL:
+      data = kj::heap<ArrayData>(count);
+      data->buffers.add(nullptr);
+      if (anyList.getElementSize() == ElementSize::BIT) {
+        // Bits are numbered from the least significant, as in Arrow.
+        data->buffers.add(anyList.getRawBytes().begin());
+      } else {
+        data->buffers.add(data->packBits(count, [&](size_t i) { return list[i].as<bool>(); }));
+      }
+      break;
+
+    case schema::Type::INT8:
+    case schema::Type::INT16:
+    case schema::Type::INT32:
+    case schema::Type::INT64:
+    case schema::Type::UINT8:
+    case schema::Type::UINT16:
+    case schema::Type::UINT32:
+    case schema::Type::UINT64:
+    case schema::Type::FLOAT32:
+    case schema::Type::FLOAT64:
+    case schema::Type::ENUM: {
+      data = kj::heap<ArrayData>(count);
+      data->buffers.add(nullptr);
+      uint bytes = elementBytes(elementType);
+      if (WIRE_ORDER_IS_NATIVE && anyList.getElementSize() == elementSizeOf(bytes)) {
+        data->buffers.add(anyList.getRawBytes().begin());
+      } else {
+        auto values = data->allocate<byte>(count * bytes);
+        for (uint i = 0; i < count; i++) {
+          writePrimitive(list[i], elementType, values.begin() + i * bytes);
+        }
+        data->buffers.add(values.begin());
+      }
+      break;
+    }
+
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST: {
+      auto pointers = KJ_MAP(pointer, anyList.as<List<AnyPointer>>()) { return pointer; };
+      data = exportPointers(elementType, pointers, valid, nullptr);
+      break;
+    }
+
+    case schema::Type::STRUCT:
+      data = exportStruct(elementType.asStruct(),
+                          ListRows(anyList.as<List<AnyStruct>>()), valid, nullptr);
+      break;
+
+    case schema::Type::INTERFACE:
+    case schema::Type::ANY_POINTER:
+      KJ_UNREACHABLE;
+  }
+
+  auto ownerRef = kj::atomicRefcounted<Owner>(kj::mv(owner));
+  publish(kj::mv(data), *ownerRef, out);
+}
+
+}  // namespace capnp
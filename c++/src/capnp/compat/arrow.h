@@ -0,0 +1,121 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <capnp/dynamic.h>
+#include <stdint.h>
+
+CAPNP_BEGIN_HEADER
+
+// =======================================================================================
+// Arrow C data interface
+//
+// These are the structs of Apache Arrow's C data interface, a stable ABI which Arrow's libraries
+// (and pyarrow, polars, DuckDB, ...) can import from without copying. See:
+//     https://arrow.apache.org/docs/format/CDataInterface.html
+// The guard macro is the one the specification asks for, so this header can be included alongside
+// Arrow's own.
+
+extern "C" {
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+}  // extern "C"
+
+namespace capnp {
+
+// =======================================================================================
+// Export to Arrow
+//
+// Converts lists of Cap'n Proto values -- typically the records of a log -- to Arrow arrays, driven
+// by the schema rather than by walking each value with the dynamic API. A list of structs becomes
+// an Arrow struct array with one child column per field, and each primitive column is filled by a
+// strided pass over the list's data sections. Where Arrow's layout matches Cap'n Proto's, buffers
+// point into the message instead of being copied: lists of primitives (Bool included) as a whole,
+// and the values of Data or primitive list columns whose elements lie back to back in the message.
+//
+// Types map to Arrow as follows:
+// - Bool, integers and floats: their Arrow equivalents. Default values are applied.
+// - Enums: uint16, holding the enumerant's ordinal.
+// - Text: utf8. Data: binary. Null pointers are null.
+// - Structs and groups: struct arrays. A null struct pointer is null.
+// - Lists: list arrays, with 32-bit offsets. A null list pointer is null.
+// - Void: the null type, except that Void members of unions are bools telling whether the member
+//   is set.
+// - Unions: each member is a nullable column, non-null only in the rows where it is set.
+// - Interfaces and AnyPointer fields, and lists of them, are left out. So are fields of a struct
+//   type (or lists of it) within a value of that same type, since Arrow schemas can't be recursive.
+//
+// The consumer takes ownership of the exported structs, and must call their `release` callbacks
+// once done with them, as the interface specifies. Schemas may be released from any thread, and so
+// may arrays, provided their `owner` may be destroyed from any thread.
+
+void exportArrowSchema(Type elementType, ArrowSchema& out);
+// Fills `out` with the Arrow schema of the arrays `exportArrowArray()` returns for lists with
+// elements of type `elementType`, e.g. `exportArrowSchema(Schema::from<MyRecord>(), schema)`.
+
+void exportArrowArray(DynamicList::Reader list, ArrowArray& out,
+                      kj::Own<void> owner = kj::Own<void>());
+// Fills `out` with the Arrow array holding the elements of `list`. As the array may refer to the
+// message's memory, the message must outlive it. Pass whatever keeps the message alive as `owner`
+// to have it released when the array (and any of its children moved out of it) is.
+//
+// Throws if the list is too big for Arrow's 32-bit offsets, i.e. if a Text, Data or List column
+// adds up to 2^31 or more bytes or elements.
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
@@ -22,6 +22,7 @@
 #include "byte-stream.h"
 #include "kj/test.h"
 #include "capnp/rpc-twoparty.h"
+#include "kj/vector.h"
 #include <stdlib.h>
 
 namespace capnp {
@@ -705,6 +706,113 @@ KJ_TEST("KJ -> ByteStream RPC -> KJ promise stream -> ByteStream -> KJ") {
   waitScope.cancelAllDetached();
 }
 
+class RecordingByteStream final: public capnp::ByteStream::Server {
+  // Records each write() call it receives.
+
+public:
+  kj::Vector<kj::String> writes;
+  bool ended = false;
+
+  kj::Promise<void> write(WriteContext context) override {
+    writes.add(kj::heapString(context.getParams().getBytes().asChars()));
+    return kj::READY_NOW;
+  }
+  kj::Promise<void> end(EndContext context) override {
+    ended = true;
+    return kj::READY_NOW;
+  }
+
+  void expectWrites(kj::ArrayPtr<const kj::StringPtr> expected) {
+    auto actual = KJ_MAP(w, writes) -> kj::StringPtr { return w; };
+    KJ_EXPECT(actual == expected, kj::strArray(actual, ","));
+    writes.clear();
+  }
+};
+
+KJ_TEST("KJ -> ByteStream coalesces small writes") {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope(eventLoop);
+
+  ByteStreamFactory::Options options;
+  options.coalesceBytes = 16;
+  ByteStreamFactory factory(options);
+
+  auto server = kj::heap<RecordingByteStream>();
+  auto& recorder = *server;
+  capnp::ByteStream::Client client(kj::mv(server));
+  auto wrapped = factory.capnpToKj(client);
+
+  // Small writes complete immediately and go out together once the loop is idle.
+  KJ_EXPECT(wrapped->write("foo", 3).poll(waitScope));
+  KJ_EXPECT(wrapped->write("bar", 3).poll(waitScope));
+  waitScope.poll();
+  recorder.expectWrites({"foobar"});
+
+  // Filling the buffer sends it right away; a large write flushes the buffer first.
+  wrapped->write("0123456789", 10).wait(waitScope);
+  wrapped->write("abcdef", 6).wait(waitScope);
+  wrapped->write("qux", 3).wait(waitScope);
+  wrapped->write("this is too big to buffer", 25).wait(waitScope);
+  recorder.expectWrites({"0123456789abcdef", "qux", "this is too big to buffer"});
+
+  // Buffered bytes are sent before end() when the stream is dropped.
+  wrapped->write("baz", 3).wait(waitScope);
+  wrapped = nullptr;
+  waitScope.poll();
+  recorder.expectWrites({"baz"});
+  KJ_EXPECT(recorder.ended);
+}
+
+KJ_TEST("KJ -> ByteStream coalescing respects timer delay") {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope(eventLoop);
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+
+  ByteStreamFactory::Options options;
+  options.coalesceBytes = 16;
+  options.timer = timer;
+  options.coalesceDelay = 10 * kj::MILLISECONDS;
+  ByteStreamFactory factory(options);
+
+  auto server = kj::heap<RecordingByteStream>();
+  auto& recorder = *server;
+  capnp::ByteStream::Client client(kj::mv(server));
+  auto wrapped = factory.capnpToKj(client);
+
+  wrapped->write("foo", 3).wait(waitScope);
+  waitScope.poll();
+  recorder.expectWrites({});
+
+  timer.advanceTo(timer.now() + 10 * kj::MILLISECONDS);
+  waitScope.poll();
+  recorder.expectWrites({"foo"});
+}
+
+KJ_TEST("KJ -> ByteStream splits large writes") {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope(eventLoop);
+
+  ByteStreamFactory::Options options;
+  options.maxBytesPerWrite = 4;
+  options.maxBytesInFlight = 8;
+  ByteStreamFactory factory(options);
+
+  auto server = kj::heap<RecordingByteStream>();
+  auto& recorder = *server;
+  capnp::ByteStream::Client client(kj::mv(server));
+  auto wrapped = factory.capnpToKj(client);
+
+  wrapped->write("0123456789", 10).wait(waitScope);
+  recorder.expectWrites({"0123", "4567", "89"});
+
+  kj::ArrayPtr<const byte> pieces[] = {
+    kj::StringPtr("ab").asBytes(), kj::StringPtr("cdefg").asBytes(),
+    kj::StringPtr("").asBytes(), kj::StringPtr("hijklm").asBytes()
+  };
+  wrapped->write(pieces).wait(waitScope);
+  recorder.expectWrites({"abcd", "efgh", "ijkl", "m"});
+}
+
 // TODO:
 // - Parallel writes (requires streaming)
 // - Write to KJ -> capnp -> RPC -> capnp -> KJ loopback without shortening, verify we can write
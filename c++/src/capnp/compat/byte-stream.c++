@@ -22,11 +22,10 @@
 #include "byte-stream.h"
 #include "kj/one-of.h"
 #include "kj/debug.h"
+#include "kj/vector.h"
 
 namespace capnp {
 
-const uint MAX_BYTES_PER_WRITE = 1 << 16;
-
 class ByteStreamFactory::StreamServerBase: public capnp::ByteStream::Server {
 public:
   virtual void returnStream(uint64_t written) = 0;
@@ -702,7 +701,15 @@ public:
     //   use a detached promise for now, which is probably OK since capabilities are refcounted and
     //   asynchronously destroyed anyway.
     // TODO(cleanup): Fix this when KJ streads add an explicit end() method.
-    KJ_IF_MAYBE(o, optimized) {
+    flushTimer = nullptr;
+    if (pending.size() > 0) {
+      // We already told the caller these bytes were written. Send them over RPC even if we've
+      // since found a shorter path, so that they are delivered ahead of the end() call.
+      auto req = inner.writeRequest(MessageSize { 8 + pending.size() / sizeof(word), 0 });
+      req.setBytes(pending.asPtr());
+      req.send().detach([](kj::Exception&&){});
+      inner.endRequest(MessageSize {2, 0}).send().detach([](kj::Exception&&){});
+    } else KJ_IF_MAYBE(o, optimized) {
       o->directEnd();
     } else {
       inner.endRequest(MessageSize {2, 0}).send().detach([](kj::Exception&&){});
@@ -710,110 +717,49 @@ public:
   }
 
   kj::Promise<void> write(const void* buffer, size_t size) override {
-    KJ_SWITCH_ONEOF(getShortestPath()) {
-      KJ_CASE_ONEOF(promise, kj::Promise<void>) {
-        return promise.then([this,buffer,size]() {
-          return write(buffer, size);
-        });
-      }
-      KJ_CASE_ONEOF(kjStream, StreamServerBase::BorrowedStream) {
-        auto limit = kj::min(kjStream.limit, MAX_BYTES_PER_WRITE);
-        if (size <= limit) {
-          auto promise = kjStream.stream.write(buffer, size);
-          return promise.then([kjStream,size]() mutable {
-            kjStream.lender.returnStream(size);
-          });
-        } else {
-          auto promise = kjStream.stream.write(buffer, limit);
-          return promise.then([this,kjStream,buffer,size,limit]() mutable {
-            kjStream.lender.returnStream(limit);
-            return write(reinterpret_cast<const byte*>(buffer) + limit,
-                         size - limit);
-          });
-        }
-      }
-      KJ_CASE_ONEOF(capnpStream, capnp::ByteStream::Client*) {
-        if (size <= MAX_BYTES_PER_WRITE) {
-          auto req = capnpStream->writeRequest(MessageSize { 8 + size / sizeof(word), 0 });
-          req.setBytes(kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size));
-          return req.send();
-        } else {
-          auto req = capnpStream->writeRequest(
-              MessageSize { 8 + MAX_BYTES_PER_WRITE / sizeof(word), 0 });
-          req.setBytes(kj::arrayPtr(reinterpret_cast<const byte*>(buffer), MAX_BYTES_PER_WRITE));
-          return req.send().then([this,buffer,size]() mutable {
-            return write(reinterpret_cast<const byte*>(buffer) + MAX_BYTES_PER_WRITE,
-                         size - MAX_BYTES_PER_WRITE);
-          });
-        }
-      }
+    KJ_IF_MAYBE(e, deferredError) {
+      return kj::cp(*e);
+    }
+
+    if (shouldCoalesce(size)) {
+      auto piece = kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size);
+      return coalesce(kj::arrayPtr(&piece, 1), size);
+    } else if (needsFlush()) {
+      return flush().then([this,buffer,size]() {
+        return writeDirect(buffer, size);
+      });
+    } else {
+      return writeDirect(buffer, size);
     }
-    KJ_UNREACHABLE;
   }
 
   kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
-    KJ_SWITCH_ONEOF(getShortestPath()) {
-      KJ_CASE_ONEOF(promise, kj::Promise<void>) {
-        return promise.then([this,pieces]() {
-          return write(pieces);
-        });
-      }
-      KJ_CASE_ONEOF(kjStream, StreamServerBase::BorrowedStream) {
-        size_t size = 0;
-        for (auto& piece: pieces) { size += piece.size(); }
-        auto limit = kj::min(kjStream.limit, MAX_BYTES_PER_WRITE);
-        if (size <= limit) {
-          auto promise = kjStream.stream.write(pieces);
-          return promise.then([kjStream,size]() mutable {
-            kjStream.lender.returnStream(size);
-          });
-        } else {
-          // ughhhhhhhhhh, we need to split the pieces.
-          return splitAndWrite(pieces, kjStream.limit,
-              [kjStream,limit](kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) mutable {
-            return kjStream.stream.write(pieces).then([kjStream,limit]() mutable {
-              kjStream.lender.returnStream(limit);
-            });
-          });
-        }
-      }
-      KJ_CASE_ONEOF(capnpStream, capnp::ByteStream::Client*) {
-        auto writePieces = [capnpStream](kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) {
-          size_t size = 0;
-          for (auto& piece: pieces) size += piece.size();
-          auto req = capnpStream->writeRequest(MessageSize { 8 + size / sizeof(word), 0 });
-          auto out = req.initBytes(size);
-          byte* ptr = out.begin();
-          for (auto& piece: pieces) {
-            memcpy(ptr, piece.begin(), piece.size());
-            ptr += piece.size();
-          }
-          KJ_ASSERT(ptr == out.end());
-          return req.send();
-        };
+    KJ_IF_MAYBE(e, deferredError) {
+      return kj::cp(*e);
+    }
 
-        size_t size = 0;
-        for (auto& piece: pieces) size += piece.size();
-        if (size <= MAX_BYTES_PER_WRITE) {
-          return writePieces(pieces);
-        } else {
-          // ughhhhhhhhhh, we need to split the pieces.
-          return splitAndWrite(pieces, MAX_BYTES_PER_WRITE, writePieces);
-        }
-      }
+    size_t size = 0;
+    for (auto& piece: pieces) size += piece.size();
+
+    if (shouldCoalesce(size)) {
+      return coalesce(pieces, size);
+    } else if (needsFlush()) {
+      return flush().then([this,pieces]() {
+        return writeDirect(pieces);
+      });
+    } else {
+      return writeDirect(pieces);
     }
-    KJ_UNREACHABLE;
   }
 
   kj::Maybe<kj::Promise<uint64_t>> tryPumpFrom(
       kj::AsyncInputStream& input, uint64_t amount = kj::maxValue) override {
-    KJ_IF_MAYBE(rpc, kj::dynamicDowncastIfAvailable<CapnpToKjStreamAdapter::PathProber>(input)) {
-      // Oh interesting, it turns we're hosting an incoming ByteStream which is pumping to this
-      // outgoing ByteStream. We can let the Cap'n Proto RPC layer know that it can shorten the
-      // path from one to the other.
-      return rpc->pumpToShorterPath(inner, amount);
+    if (needsFlush()) {
+      return flush().then([this,&input,amount]() {
+        return pumpFrom(input, amount);
+      });
     } else {
-      return pumpLoop(input, 0, amount);
+      return pumpFrom(input, amount);
     }
   }
 
@@ -903,6 +849,227 @@ private:
     }
   }
 
+  kj::Promise<uint64_t> pumpFrom(kj::AsyncInputStream& input, uint64_t amount) {
+    KJ_IF_MAYBE(rpc, kj::dynamicDowncastIfAvailable<CapnpToKjStreamAdapter::PathProber>(input)) {
+      // Oh interesting, it turns we're hosting an incoming ByteStream which is pumping to this
+      // outgoing ByteStream. We can let the Cap'n Proto RPC layer know that it can shorten the
+      // path from one to the other.
+      return rpc->pumpToShorterPath(inner, amount);
+    } else {
+      return pumpLoop(input, 0, amount);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // Write coalescing
+
+  kj::Vector<byte> pending;
+  // Bytes from small writes which have been reported as written but not yet sent.
+
+  kj::Maybe<kj::Promise<void>> backgroundFlush;
+  // Flow-control wait for the last timer-triggered flush. Foreground writes wait on it.
+
+  kj::Maybe<kj::Exception> deferredError;
+  // Failure of a timer-triggered flush, reported to the next write.
+
+  kj::Promise<void> flushTimer = nullptr;
+  bool flushScheduled = false;
+
+  size_t coalesceLimit() {
+    return kj::min(factory.options.coalesceBytes, factory.options.maxBytesPerWrite);
+  }
+
+  bool shouldCoalesce(size_t size) {
+    // Coalescing is only worthwhile when writes become RPCs. Once we've found a shorter path to
+    // a local stream, writes go straight through.
+    return size < coalesceLimit() && optimized == nullptr;
+  }
+
+  bool needsFlush() {
+    return pending.size() > 0 || backgroundFlush != nullptr;
+  }
+
+  kj::Promise<void> coalesce(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces, size_t size) {
+    auto limit = coalesceLimit();
+    kj::Promise<void> result = kj::READY_NOW;
+
+    if (pending.size() + size > limit) {
+      // No room; send what we have first. sendPending() sends synchronously on the RPC path, so
+      // the new bytes are still ordered after it.
+      result = flush();
+    }
+
+    if (pending.capacity() == 0) pending.reserve(limit);
+    for (auto& piece: pieces) {
+      pending.addAll(piece);
+    }
+
+    if (pending.size() == limit) {
+      return flush();
+    } else {
+      scheduleFlush();
+      return result;
+    }
+  }
+
+  void scheduleFlush() {
+    if (flushScheduled) return;
+    flushScheduled = true;
+
+    KJ_IF_MAYBE(t, factory.options.timer) {
+      flushTimer = t->afterDelay(factory.options.coalesceDelay);
+    } else {
+      flushTimer = kj::evalLast([]() {});
+    }
+
+    flushTimer = flushTimer.then([this]() {
+      flushScheduled = false;
+      if (optimized != nullptr) {
+        // The path changed under us. Leave the bytes for the next foreground write (or the
+        // destructor) so that they can't be reordered against it.
+        return;
+      }
+      backgroundFlush = sendPending().eagerlyEvaluate([this](kj::Exception&& e) {
+        if (deferredError == nullptr) deferredError = kj::mv(e);
+      });
+    }).eagerlyEvaluate(nullptr);
+  }
+
+  kj::Promise<void> flush() {
+    flushTimer = nullptr;
+    flushScheduled = false;
+    return sendPending();
+  }
+
+  kj::Promise<void> sendPending() {
+    kj::Promise<void> result = kj::READY_NOW;
+    KJ_IF_MAYBE(b, backgroundFlush) {
+      result = kj::mv(*b);
+      backgroundFlush = nullptr;
+    }
+
+    if (pending.size() > 0) {
+      auto data = pending.releaseAsArray();
+      auto promise = writeDirect(data.begin(), data.size()).attach(kj::mv(data));
+      result = result.then([promise = kj::mv(promise)]() mutable {
+        return kj::mv(promise);
+      });
+    }
+
+    return result;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  kj::Promise<void> writeDirect(const void* buffer, size_t size) {
+    KJ_SWITCH_ONEOF(getShortestPath()) {
+      KJ_CASE_ONEOF(promise, kj::Promise<void>) {
+        return promise.then([this,buffer,size]() {
+          return writeDirect(buffer, size);
+        });
+      }
+      KJ_CASE_ONEOF(kjStream, StreamServerBase::BorrowedStream) {
+        auto limit = kj::min(kjStream.limit, factory.options.maxBytesPerWrite);
+        if (size <= limit) {
+          auto promise = kjStream.stream.write(buffer, size);
+          return promise.then([kjStream,size]() mutable {
+            kjStream.lender.returnStream(size);
+          });
+        } else {
+          auto promise = kjStream.stream.write(buffer, limit);
+          return promise.then([this,kjStream,buffer,size,limit]() mutable {
+            kjStream.lender.returnStream(limit);
+            return writeDirect(reinterpret_cast<const byte*>(buffer) + limit,
+                               size - limit);
+          });
+        }
+      }
+      KJ_CASE_ONEOF(capnpStream, capnp::ByteStream::Client*) {
+        auto piece = kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size);
+        return writeRpc(*capnpStream, kj::arrayPtr(&piece, 1));
+      }
+    }
+    KJ_UNREACHABLE;
+  }
+
+  kj::Promise<void> writeDirect(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) {
+    KJ_SWITCH_ONEOF(getShortestPath()) {
+      KJ_CASE_ONEOF(promise, kj::Promise<void>) {
+        return promise.then([this,pieces]() {
+          return writeDirect(pieces);
+        });
+      }
+      KJ_CASE_ONEOF(kjStream, StreamServerBase::BorrowedStream) {
+        size_t size = 0;
+        for (auto& piece: pieces) { size += piece.size(); }
+        auto limit = kj::min(kjStream.limit, factory.options.maxBytesPerWrite);
+        if (size <= limit) {
+          auto promise = kjStream.stream.write(pieces);
+          return promise.then([kjStream,size]() mutable {
+            kjStream.lender.returnStream(size);
+          });
+        } else {
+          // ughhhhhhhhhh, we need to split the pieces.
+          return splitAndWrite(pieces, kjStream.limit,
+              [kjStream,limit](kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) mutable {
+            return kjStream.stream.write(pieces).then([kjStream,limit]() mutable {
+              kjStream.lender.returnStream(limit);
+            });
+          });
+        }
+      }
+      KJ_CASE_ONEOF(capnpStream, capnp::ByteStream::Client*) {
+        return writeRpc(*capnpStream, pieces);
+      }
+    }
+    KJ_UNREACHABLE;
+  }
+
+  kj::Promise<void> writeRpc(capnp::ByteStream::Client& client,
+                             kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) {
+    // Packs `pieces` into write() calls of at most maxBytesPerWrite bytes each. Calls are sent
+    // back-to-back -- streaming calls are delivered in order -- and we only wait on the
+    // flow-control window every maxBytesInFlight bytes, rather than after every call.
+
+    auto& options = factory.options;
+    size_t remaining = 0;
+    for (auto& piece: pieces) remaining += piece.size();
+
+    size_t offset = 0;  // consumed prefix of pieces[0]
+    size_t sent = 0;
+    for (;;) {
+      size_t size = kj::min(remaining, options.maxBytesPerWrite);
+      auto req = client.writeRequest(MessageSize { 8 + size / sizeof(word), 0 });
+      auto out = req.initBytes(size);
+      byte* ptr = out.begin();
+      while (ptr < out.end()) {
+        auto& piece = pieces.front();
+        size_t n = kj::min(piece.size() - offset, size_t(out.end() - ptr));
+        memcpy(ptr, piece.begin() + offset, n);
+        ptr += n;
+        offset += n;
+        if (offset == piece.size()) {
+          pieces = pieces.slice(1, pieces.size());
+          offset = 0;
+        }
+      }
+      auto promise = req.send();
+
+      remaining -= size;
+      sent += size;
+      if (remaining == 0) {
+        return kj::mv(promise);
+      } else if (sent >= options.maxBytesInFlight) {
+        // Let the window drain before sending more. The first piece may be partially sent.
+        auto rest = kj::heapArray(pieces);
+        rest.front() = rest.front().slice(offset, rest.front().size());
+        return promise.then([this,rest=kj::mv(rest)]() mutable {
+          return writeDirect(rest).attach(kj::mv(rest));
+        });
+      }
+    }
+  }
+
   kj::Promise<uint64_t> pumpLoop(kj::AsyncInputStream& input,
                                  uint64_t completed, uint64_t remaining) {
     if (remaining == 0) return completed;
@@ -993,7 +1160,7 @@ private:
       auto rest = pieces.slice(splitPiece, pieces.size());
       return writeFirstPieces(pieces.slice(0, splitPiece))
           .then([this,rest]() mutable {
-        return write(rest);
+        return writeDirect(rest);
       });
     } else {
       // FUUUUUUUU---- we need to split one of the pieces in two.
@@ -1010,7 +1177,7 @@ private:
 
       return writeFirstPieces(left).attach(kj::mv(left))
           .then([this,right=kj::mv(right)]() mutable {
-        return write(right).attach(kj::mv(right));
+        return writeDirect(right).attach(kj::mv(right));
       });
     }
   }
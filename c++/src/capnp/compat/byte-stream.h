@@ -32,10 +32,34 @@ class ByteStreamFactory {
   // between RPC ByteStreams and KJ streams.
 
 public:
+  struct Options {
+    size_t maxBytesPerWrite = 1 << 16;
+    // Largest payload carried by a single `write()` RPC. Larger writes are split.
+
+    size_t maxBytesInFlight = 1 << 20;
+    // When splitting a large write, up to this many bytes worth of `write()` RPCs are sent
+    // back-to-back before waiting on the RPC flow-control window, rather than waiting after
+    // every message.
+
+    size_t coalesceBytes = 0;
+    // Writes smaller than this (which travel over RPC) are copied into a buffer of this size and
+    // sent as one `write()` call once it fills, rather than one RPC per write. The write()
+    // promise then resolves as soon as the bytes are buffered. Zero disables coalescing.
+
+    kj::Maybe<kj::Timer&> timer;
+    kj::Duration coalesceDelay = 0 * kj::MILLISECONDS;
+    // Upper bound on how long coalesced bytes may sit in the buffer before being sent. Without a
+    // timer, buffered bytes are sent once the event loop runs out of other work.
+  };
+
+  ByteStreamFactory() = default;
+  explicit ByteStreamFactory(Options options): options(options) {}
+
   capnp::ByteStream::Client kjToCapnp(kj::Own<kj::AsyncOutputStream> kjStream);
   kj::Own<kj::AsyncOutputStream> capnpToKj(capnp::ByteStream::Client capnpStream);
 
 private:
+  Options options;
   CapabilityServerSet<capnp::ByteStream> streamSet;
 
   class StreamServerBase;
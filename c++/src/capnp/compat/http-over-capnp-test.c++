@@ -21,6 +21,7 @@
 
 #include "http-over-capnp.h"
 #include "kj/test.h"
+#include "kj/vector.h"
 
 namespace capnp {
 namespace {
@@ -644,5 +645,135 @@ KJ_TEST("HttpService isn't destroyed while call outstanding") {
   KJ_EXPECT(!destroyed);
 }
 
+// -----------------------------------------------------------------------------
+
+class RecordingHttpService final: public capnp::HttpService::Server {
+  // Forwards to another HttpService, recording how request headers and bodies were encoded.
+
+public:
+  RecordingHttpService(capnp::HttpService::Client inner, kj::Vector<kj::String>& log)
+      : inner(kj::mv(inner)), log(log) {}
+
+  kj::Promise<void> startRequest(StartRequestContext context) override {
+    auto params = context.getParams();
+    auto request = params.getRequest();
+    for (auto header: request.getHeaders()) {
+      switch (header.which()) {
+        case capnp::HttpHeader::COMMON:
+          break;
+        case capnp::HttpHeader::UNCOMMON:
+          log.add(kj::str("uncommon:", header.getUncommon().getName()));
+          break;
+        case capnp::HttpHeader::REGISTERED:
+          log.add(kj::str("registered:", header.getRegistered().getId()));
+          break;
+      }
+    }
+    if (request.hasInlineBody()) {
+      log.add(kj::str("inline:", request.getInlineBody().asChars()));
+    }
+
+    auto req = inner.startRequestRequest();
+    req.setRequest(request);
+    req.setContext(params.getContext());
+    return context.tailCall(kj::mv(req));
+  }
+
+  kj::Promise<void> negotiateHeaderTable(NegotiateHeaderTableContext context) override {
+    auto req = inner.negotiateHeaderTableRequest();
+    req.setNames(context.getParams().getNames());
+    return req.send().then([this,context](auto&& response) mutable {
+      auto results = context.getResults();
+      results.setNames(response.getNames());
+      results.setService(kj::heap<RecordingHttpService>(response.getService(), log));
+    });
+  }
+
+private:
+  capnp::HttpService::Client inner;
+  kj::Vector<kj::String>& log;
+};
+
+class EchoHeaderService final: public kj::HttpService {
+  // Responds with `reply` set to the request's `custom` header followed by the request body.
+
+public:
+  EchoHeaderService(const kj::HttpHeaderTable& table,
+                    kj::HttpHeaderId custom, kj::HttpHeaderId reply)
+      : table(table), custom(custom), reply(reply) {}
+
+  kj::Promise<void> request(
+      kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    auto value = kj::str(headers.get(custom).orDefault("(none)"));
+    return requestBody.readAllText()
+        .then([this,value=kj::mv(value),&response](kj::String body) {
+      kj::HttpHeaders responseHeaders(table);
+      responseHeaders.set(reply, kj::str(value, ":", body));
+      response.send(200, "OK", responseHeaders, uint64_t(0));
+    });
+  }
+
+private:
+  const kj::HttpHeaderTable& table;
+  kj::HttpHeaderId custom;
+  kj::HttpHeaderId reply;
+};
+
+KJ_TEST("HTTP-over-Cap'n-Proto negotiated header IDs and inline bodies") {
+  kj::EventLoop eventLoop;
+  kj::WaitScope waitScope(eventLoop);
+
+  // The two sides register the same headers in different orders (and spellings), so their IDs
+  // differ.
+  kj::HttpHeaderTable::Builder clientBuilder;
+  auto clientCustom = clientBuilder.add("X-Custom");
+  auto clientReply = clientBuilder.add("X-Reply");
+  kj::HttpHeaderTable::Builder serverBuilder;
+  serverBuilder.add("X-Unrelated");
+  auto serverReply = serverBuilder.add("X-Reply");
+  auto serverCustom = serverBuilder.add("x-custom");
+
+  ByteStreamFactory clientStreamFactory;
+  ByteStreamFactory serverStreamFactory;
+  HttpOverCapnpFactory::Options options;
+  options.maxInlineBodySize = 16;
+  HttpOverCapnpFactory clientFactory(clientStreamFactory, clientBuilder, options);
+  HttpOverCapnpFactory serverFactory(serverStreamFactory, serverBuilder);
+  auto clientTable = clientBuilder.build();
+  auto serverTable = serverBuilder.build();
+  KJ_ASSERT(clientCustom.hashCode() != serverCustom.hashCode());
+
+  kj::Vector<kj::String> log;
+  capnp::HttpService::Client recorder = kj::heap<RecordingHttpService>(
+      serverFactory.kjToCapnp(kj::heap<EchoHeaderService>(*serverTable, serverCustom, serverReply)),
+      log);
+  auto front = clientFactory.capnpToKj(recorder);
+  auto client = kj::newHttpClient(*front);
+
+  auto doRequest = [&](kj::StringPtr body) {
+    kj::HttpHeaders headers(*clientTable);
+    headers.set(clientCustom, "foo");
+    auto req = client->request(kj::HttpMethod::POST, "/", headers, uint64_t(body.size()));
+    req.body->write(body.begin(), body.size()).wait(waitScope);
+    req.body = nullptr;
+    auto response = req.response.wait(waitScope);
+    return kj::str(response.headers->get(clientReply).orDefault("(none)"));
+  };
+
+  // The first request goes out before the header tables have been exchanged.
+  KJ_EXPECT(doRequest("small") == "foo:small");
+  KJ_EXPECT(log.size() == 2);
+  KJ_EXPECT(log[0] == "uncommon:X-Custom", log[0]);
+  KJ_EXPECT(log[1] == "inline:small", log[1]);
+  log.clear();
+
+  // Now the client knows the server's IDs. (Responses similarly use the client's IDs, which the
+  // echoed value above and below demonstrates works either way.)
+  KJ_EXPECT(doRequest("this is too big to inline") == "foo:this is too big to inline");
+  KJ_EXPECT(log.size() == 1);
+  KJ_EXPECT(log[0] == kj::str("registered:", serverCustom.hashCode()), log[0]);
+}
+
 }  // namespace
 }  // namespace capnp
@@ -330,17 +330,68 @@ public:
   kj::Promise<void> request(
       kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
       kj::AsyncInputStream& requestBody, kj::HttpService::Response& kjResponse) override {
+    if (negotiation == nullptr) {
+      // First request. Learn the server's header table in the background; until that completes
+      // we send header names as text.
+      negotiation = negotiateHeaderTable();
+    }
+
+    KJ_IF_MAYBE(s, requestBody.tryGetLength()) {
+      if (*s > 0 && *s <= factory.options.maxInlineBodySize) {
+        // Small body of known size: read it now and send it in the request message itself, rather
+        // than setting up a ByteStream for it.
+        auto buffer = kj::heapArray<byte>(*s);
+        auto promise = requestBody.tryRead(buffer.begin(), buffer.size(), buffer.size());
+        return promise.then([this,method,url,&headers,&requestBody,&kjResponse,
+                             buffer = kj::mv(buffer)](size_t actual) mutable {
+          KJ_REQUIRE(actual == buffer.size(), "request body was shorter than its declared length");
+          return startRequest(method, url, headers, requestBody, kjResponse, kj::mv(buffer));
+        });
+      }
+    }
+
+    return startRequest(method, url, headers, requestBody, kjResponse, nullptr);
+  }
+
+private:
+  HttpOverCapnpFactory& factory;
+  capnp::HttpService::Client inner;
+
+  kj::Maybe<kj::Promise<void>> negotiation;
+  kj::Array<uint> peerIds;
+  // Result of negotiateHeaderTable(), once it completes.
+
+  kj::Promise<void> negotiateHeaderTable() {
+    auto req = inner.negotiateHeaderTableRequest();
+    factory.headerNamesToCapnp(req.initNames(factory.headerTable.idCount()));
+    return req.send().then([this](auto&& response) {
+      peerIds = factory.mapPeerHeaderTable(response.getNames());
+      inner = response.getService();
+    }, [](kj::Exception&& e) {
+      // Probably the server predates negotiateHeaderTable(). If it's actually broken, requests
+      // will find out on their own. Either way, keep sending header names.
+    }).eagerlyEvaluate(nullptr);
+  }
+
+  kj::Promise<void> startRequest(
+      kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, kj::HttpService::Response& kjResponse,
+      kj::Maybe<kj::Array<byte>> inlineBody) {
     auto rpcRequest = inner.startRequestRequest();
 
     auto metadata = rpcRequest.initRequest();
     metadata.setMethod(static_cast<capnp::HttpMethod>(method));
     metadata.setUrl(url);
     metadata.adoptHeaders(factory.headersToCapnp(
-        headers, Orphanage::getForMessageContaining(metadata)));
+        headers, Orphanage::getForMessageContaining(metadata), peerIds));
 
     kj::Maybe<kj::AsyncInputStream&> maybeRequestBody;
 
-    KJ_IF_MAYBE(s, requestBody.tryGetLength()) {
+    KJ_IF_MAYBE(b, inlineBody) {
+      metadata.getBodySize().setFixed(b->size());
+      metadata.setInlineBody(*b);
+      maybeRequestBody = nullptr;
+    } else KJ_IF_MAYBE(s, requestBody.tryGetLength()) {
       metadata.getBodySize().setFixed(*s);
       if (*s == 0) {
         maybeRequestBody = nullptr;
@@ -395,10 +446,6 @@ public:
         .then([state = kj::mv(state)]() mutable { return state->finishTasks(); })
         .attach(kj::mv(deferredCancel));
   }
-
-private:
-  HttpOverCapnpFactory& factory;
-  capnp::HttpService::Client inner;
 };
 
 kj::Own<kj::HttpService> HttpOverCapnpFactory::capnpToKj(capnp::HttpService::Client rpcService) {
@@ -427,6 +474,36 @@ public:
   }
 };
 
+class InlineInputStream final: public kj::AsyncInputStream {
+  // Request body which arrived in HttpRequest.inlineBody.
+
+public:
+  InlineInputStream(kj::Array<byte> bytesParam)
+      : bytes(kj::mv(bytesParam)), remaining(bytes) {}
+
+  kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    size_t n = kj::min(maxBytes, remaining.size());
+    memcpy(buffer, remaining.begin(), n);
+    remaining = remaining.slice(n, remaining.size());
+    return n;
+  }
+
+  kj::Maybe<uint64_t> tryGetLength() override {
+    return uint64_t(remaining.size());
+  }
+
+  kj::Promise<uint64_t> pumpTo(kj::AsyncOutputStream& output, uint64_t amount) override {
+    size_t n = kj::min(amount, remaining.size());
+    auto piece = remaining.slice(0, n);
+    remaining = remaining.slice(n, remaining.size());
+    return output.write(piece.begin(), piece.size()).then([n]() -> uint64_t { return n; });
+  }
+
+private:
+  kj::Array<byte> bytes;
+  kj::ArrayPtr<const byte> remaining;
+};
+
 class NullOutputStream final: public kj::AsyncOutputStream {
   // TODO(cleanup): This class has been replicated in a bunch of places now, make it public
   //   somewhere.
@@ -461,8 +538,9 @@ public:
                            capnp::HttpRequest::Reader request,
                            capnp::HttpService::ClientRequestContext::Client clientContext,
                            kj::Own<kj::AsyncInputStream> requestBodyIn,
-                           kj::HttpService& kjService)
-      : factory(factory), serviceCap(kj::mv(serviceCap)),
+                           kj::HttpService& kjService,
+                           kj::ArrayPtr<const uint> peerIds)
+      : factory(factory), serviceCap(kj::mv(serviceCap)), peerIds(peerIds),
         method(validateMethod(request.getMethod())),
         url(kj::str(request.getUrl())),
         headers(factory.headersToKj(request.getHeaders()).clone()),
@@ -501,7 +579,7 @@ public:
     rpcResponse.setStatusCode(statusCode);
     rpcResponse.setStatusText(statusText);
     rpcResponse.adoptHeaders(factory.headersToCapnp(
-        headers, Orphanage::getForMessageContaining(rpcResponse)));
+        headers, Orphanage::getForMessageContaining(rpcResponse), peerIds));
     bool hasBody = true;
     KJ_IF_MAYBE(s, expectedBodySize) {
       rpcResponse.getBodySize().setFixed(*s);
@@ -536,7 +614,8 @@ public:
 
     req.adoptHeaders(factory.headersToCapnp(
         headers, Orphanage::getForMessageContaining(
-            capnp::HttpService::ClientRequestContext::StartWebSocketParams::Builder(req))));
+            capnp::HttpService::ClientRequestContext::StartWebSocketParams::Builder(req)),
+        peerIds));
 
     auto pipe = kj::newWebSocketPipe();
     auto shorteningPaf = kj::newPromiseAndFulfiller<kj::Promise<Capability::Client>>();
@@ -569,6 +648,7 @@ public:
 private:
   HttpOverCapnpFactory& factory;
   HttpService::Client serviceCap;  // ensures the inner kj::HttpService isn't destroyed
+  kj::ArrayPtr<const uint> peerIds;  // owned by the service behind `serviceCap`
   kj::HttpMethod method;
   kj::String url;
   kj::HttpHeaders headers;
@@ -584,8 +664,13 @@ private:
 
 class HttpOverCapnpFactory::CapnpToKjHttpServiceAdapter final: public capnp::HttpService::Server {
 public:
-  CapnpToKjHttpServiceAdapter(HttpOverCapnpFactory& factory, kj::Own<kj::HttpService> inner)
-      : factory(factory), inner(kj::mv(inner)) {}
+  CapnpToKjHttpServiceAdapter(HttpOverCapnpFactory& factory, kj::Own<kj::HttpService> innerParam)
+      : factory(factory), ownInner(kj::mv(innerParam)), inner(*ownInner) {}
+
+  CapnpToKjHttpServiceAdapter(HttpOverCapnpFactory& factory, kj::HttpService& inner,
+                              capnp::HttpService::Client parent, kj::Array<uint> peerIds)
+      : factory(factory), inner(inner), parent(kj::mv(parent)), peerIds(kj::mv(peerIds)) {}
+  // Service returned by negotiateHeaderTable(). `parent` keeps `inner` alive.
 
   kj::Promise<void> startRequest(StartRequestContext context) override {
     auto params = context.getParams();
@@ -602,7 +687,12 @@ public:
 
     auto results = context.getResults(MessageSize {8, 2});
     kj::Own<kj::AsyncInputStream> requestBody;
-    if (hasBody) {
+    if (metadata.hasInlineBody()) {
+      auto body = metadata.getInlineBody();
+      KJ_REQUIRE(bodySize.isFixed() && bodySize.getFixed() == body.size(),
+          "inline request body doesn't match bodySize");
+      requestBody = kj::heap<InlineInputStream>(kj::heapArray(body));
+    } else if (hasBody) {
       auto pipe = kj::newOneWayPipe(expectedSize);
       results.setRequestBody(factory.streamFactory.kjToCapnp(kj::mv(pipe.out)));
       requestBody = kj::mv(pipe.in);
@@ -610,14 +700,30 @@ public:
       requestBody = kj::heap<NullInputStream>();
     }
     results.setContext(kj::heap<ServerRequestContextImpl>(
-        factory, thisCap(), metadata, params.getContext(), kj::mv(requestBody), *inner));
+        factory, thisCap(), metadata, params.getContext(), kj::mv(requestBody), inner,
+        peerIds));
+
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> negotiateHeaderTable(NegotiateHeaderTableContext context) override {
+    auto peerIds = factory.mapPeerHeaderTable(context.getParams().getNames());
+    context.releaseParams();
 
+    auto results = context.getResults();
+    factory.headerNamesToCapnp(results.initNames(factory.headerTable.idCount()));
+    results.setService(kj::heap<CapnpToKjHttpServiceAdapter>(
+        factory, inner, thisCap(), kj::mv(peerIds)));
     return kj::READY_NOW;
   }
 
 private:
   HttpOverCapnpFactory& factory;
-  kj::Own<kj::HttpService> inner;
+  kj::Own<kj::HttpService> ownInner;
+  kj::HttpService& inner;
+  kj::Maybe<capnp::HttpService::Client> parent;
+  kj::Array<uint> peerIds;
+  // Client's header table, if this service was returned by negotiateHeaderTable().
 };
 
 capnp::HttpService::Client HttpOverCapnpFactory::kjToCapnp(kj::Own<kj::HttpService> service) {
@@ -659,7 +765,11 @@ HttpOverCapnpFactory::HeaderIdBundle HttpOverCapnpFactory::HeaderIdBundle::clone
 
 HttpOverCapnpFactory::HttpOverCapnpFactory(ByteStreamFactory& streamFactory,
                                            HeaderIdBundle headerIds)
-    : streamFactory(streamFactory), headerTable(headerIds.table),
+    : HttpOverCapnpFactory(streamFactory, kj::mv(headerIds), Options()) {}
+
+HttpOverCapnpFactory::HttpOverCapnpFactory(ByteStreamFactory& streamFactory,
+                                           HeaderIdBundle headerIds, Options options)
+    : streamFactory(streamFactory), headerTable(headerIds.table), options(options),
       nameCapnpToKj(kj::mv(headerIds.nameCapnpToKj)) {
   auto commonHeaderNames = Schema::from<capnp::CommonHeaderName>().getEnumerants();
   nameKjToCapnp = kj::heapArray<capnp::CommonHeaderName>(headerIds.maxHeaderId + 1);
@@ -688,7 +798,7 @@ HttpOverCapnpFactory::HttpOverCapnpFactory(ByteStreamFactory& streamFactory,
 }
 
 Orphan<List<capnp::HttpHeader>> HttpOverCapnpFactory::headersToCapnp(
-    const kj::HttpHeaders& headers, Orphanage orphanage) {
+    const kj::HttpHeaders& headers, Orphanage orphanage, kj::ArrayPtr<const uint> peerIds) {
   auto result = orphanage.newOrphan<List<capnp::HttpHeader>>(headers.size());
   auto rpcHeaders = result.get();
   uint i = 0;
@@ -696,14 +806,19 @@ Orphan<List<capnp::HttpHeader>> HttpOverCapnpFactory::headersToCapnp(
     auto capnpName = id.hashCode() < nameKjToCapnp.size()
         ? nameKjToCapnp[id.hashCode()]
         : capnp::CommonHeaderName::INVALID;
-    if (capnpName == capnp::CommonHeaderName::INVALID) {
-      auto header = rpcHeaders[i++].initUncommon();
-      header.setName(id.toString());
-      header.setValue(value);
-    } else {
+    auto peerId = id.hashCode() < peerIds.size() ? peerIds[id.hashCode()] : 0;
+    if (capnpName != capnp::CommonHeaderName::INVALID) {
       auto header = rpcHeaders[i++].initCommon();
       header.setName(capnpName);
       header.setValue(value);
+    } else if (peerId != 0) {
+      auto header = rpcHeaders[i++].initRegistered();
+      header.setId(peerId - 1);
+      header.setValue(value);
+    } else {
+      auto header = rpcHeaders[i++].initUncommon();
+      header.setName(id.toString());
+      header.setValue(value);
     }
   }, [&](kj::StringPtr name, kj::StringPtr value) {
     auto header = rpcHeaders[i++].initUncommon();
@@ -718,6 +833,17 @@ kj::HttpHeaders HttpOverCapnpFactory::headersToKj(
     List<capnp::HttpHeader>::Reader capnpHeaders) const {
   kj::HttpHeaders result(headerTable);
 
+  auto setOrAdd = [&](kj::HttpHeaderId headerId, kj::StringPtr value) {
+    if (result.get(headerId) == nullptr) {
+      result.set(headerId, value);
+    } else {
+      // Unusual: This is a duplicate header, so fall back to add(), which may trigger
+      //   comma-concatenation, except in certain cases where comma-concatentaion would
+      //   be problematic.
+      result.add(headerId.toString(), value);
+    }
+  };
+
   for (auto header: capnpHeaders) {
     switch (header.which()) {
       case capnp::HttpHeader::COMMON: {
@@ -734,20 +860,18 @@ kj::HttpHeaders HttpOverCapnpFactory::headersToKj(
             break;
           }
           case capnp::HttpHeader::Common::VALUE: {
-            auto headerId = nameCapnpToKj[nameInt];
-            if (result.get(headerId) == nullptr) {
-              result.set(headerId, nv.getValue());
-            } else {
-              // Unusual: This is a duplicate header, so fall back to add(), which may trigger
-              //   comma-concatenation, except in certain cases where comma-concatentaion would
-              //   be problematic.
-              result.add(headerId.toString(), nv.getValue());
-            }
+            setOrAdd(nameCapnpToKj[nameInt], nv.getValue());
             break;
           }
         }
         break;
       }
+      case capnp::HttpHeader::REGISTERED: {
+        auto nv = header.getRegistered();
+        KJ_REQUIRE(nv.getId() < headerTable.idCount(), "unknown registered header ID", nv.getId());
+        setOrAdd(headerTable.idAt(nv.getId()), nv.getValue());
+        break;
+      }
       case capnp::HttpHeader::UNCOMMON: {
         auto nv = header.getUncommon();
         result.add(nv.getName(), nv.getValue());
@@ -758,4 +882,23 @@ kj::HttpHeaders HttpOverCapnpFactory::headersToKj(
   return result;
 }
 
+void HttpOverCapnpFactory::headerNamesToCapnp(List<capnp::Text>::Builder names) const {
+  for (auto i: kj::indices(names)) {
+    names.set(i, headerTable.idAt(i).toString());
+  }
+}
+
+kj::Array<uint> HttpOverCapnpFactory::mapPeerHeaderTable(
+    List<capnp::Text>::Reader peerNames) const {
+  auto result = kj::heapArray<uint>(headerTable.idCount());
+  for (auto& slot: result) slot = 0;
+
+  for (auto i: kj::indices(peerNames)) {
+    KJ_IF_MAYBE(id, headerTable.stringToId(peerNames[i])) {
+      result[id->hashCode()] = i + 1;
+    }
+  }
+  return result;
+}
+
 }  // namespace capnp
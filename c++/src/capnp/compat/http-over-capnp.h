@@ -50,7 +50,18 @@ public:
     friend class HttpOverCapnpFactory;
   };
 
+  struct Options {
+    size_t maxInlineBodySize = 0;
+    // Request bodies of known length up to this size are read in full and sent within the
+    // startRequest() call, saving the ByteStream round trips. Note that this means the request
+    // isn't forwarded until its whole body has arrived, which breaks services that respond before
+    // reading the body and expect the client to see that response while still sending. Hence,
+    // this is off by default.
+  };
+
   HttpOverCapnpFactory(ByteStreamFactory& streamFactory, HeaderIdBundle headerIds);
+  HttpOverCapnpFactory(ByteStreamFactory& streamFactory, HeaderIdBundle headerIds,
+                       Options options);
 
   kj::Own<kj::HttpService> capnpToKj(capnp::HttpService::Client rpcService);
   capnp::HttpService::Client kjToCapnp(kj::Own<kj::HttpService> service);
@@ -58,6 +69,7 @@ public:
 private:
   ByteStreamFactory& streamFactory;
   const kj::HttpHeaderTable& headerTable;
+  Options options;
   kj::Array<capnp::CommonHeaderName> nameKjToCapnp;
   kj::Array<kj::HttpHeaderId> nameCapnpToKj;
   kj::Array<kj::StringPtr> valueCapnpToKj;
@@ -78,7 +90,17 @@ private:
   // Returned headers may alias into `capnpHeaders`.
 
   capnp::Orphan<capnp::List<capnp::HttpHeader>> headersToCapnp(
-      const kj::HttpHeaders& headers, capnp::Orphanage orphanage);
+      const kj::HttpHeaders& headers, capnp::Orphanage orphanage,
+      kj::ArrayPtr<const uint> peerIds = nullptr);
+  // `peerIds` is the result of mapPeerHeaderTable() for the receiving side, if known.
+
+  void headerNamesToCapnp(capnp::List<capnp::Text>::Builder names) const;
+  // Fills in our header table for negotiateHeaderTable(). `names` must have size
+  // headerTable.idCount().
+
+  kj::Array<uint> mapPeerHeaderTable(capnp::List<capnp::Text>::Reader peerNames) const;
+  // Given the peer's header table, returns an array indexed by our HttpHeaderId::hashCode() whose
+  // values are the peer's ID for the same header plus one, or zero if the peer lacks it.
 };
 
 }  // namespace capnp
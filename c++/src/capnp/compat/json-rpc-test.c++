@@ -95,6 +95,127 @@ KJ_TEST("json-rpc multiple calls") {
   KJ_EXPECT(callCount == 2);
 }
 
+KJ_TEST("json-rpc batch request") {
+  auto io = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+
+  JsonRpc::ContentLengthTransport clientTransport(*pipe.ends[0]);
+  JsonRpc::ContentLengthTransport serverTransport(*pipe.ends[1]);
+
+  int callCount = 0;
+
+  JsonRpc server(serverTransport, toDynamic(kj::heap<TestInterfaceImpl>(callCount)));
+
+  clientTransport.send(
+      "[{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"foo\",\"params\":{\"i\":123,\"j\":true}},"
+      "{\"jsonrpc\":\"2.0\",\"method\":\"foo\",\"params\":{\"i\":123,\"j\":true}},"
+      "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"nope\",\"params\":{}}]")
+      .wait(io.waitScope);
+  KJ_EXPECT(clientTransport.receive().wait(io.waitScope) ==
+      "[{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":{\"x\":\"foo\"}},"
+      "{\"jsonrpc\":\"2.0\",\"id\":2,"
+          "\"error\":{\"code\":-32601,\"message\":\"Method not found\"}}]");
+  KJ_EXPECT(callCount == 2);
+
+  clientTransport.send("[]").wait(io.waitScope);
+  auto error = clientTransport.receive().wait(io.waitScope);
+  KJ_EXPECT(error.startsWith("{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":-32600,"), error);
+}
+
+class CountingTransport final: public JsonRpc::Transport {
+public:
+  CountingTransport(JsonRpc::Transport& inner): inner(inner) {}
+
+  kj::Vector<kj::String> sent;
+
+  kj::Promise<void> send(kj::StringPtr text) override {
+    sent.add(kj::str(text));
+    return inner.send(text);
+  }
+  kj::Promise<kj::String> receive() override {
+    return inner.receive();
+  }
+
+private:
+  JsonRpc::Transport& inner;
+};
+
+KJ_TEST("json-rpc batched calls") {
+  auto io = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+
+  JsonRpc::ContentLengthTransport clientTransport(*pipe.ends[0]);
+  JsonRpc::ContentLengthTransport serverTransport(*pipe.ends[1]);
+  CountingTransport countingTransport(clientTransport);
+
+  int callCount = 0;
+
+  JsonRpc::Options options;
+  options.batchCalls = true;
+  JsonRpc client(countingTransport, {}, options);
+  JsonRpc server(serverTransport, toDynamic(kj::heap<TestInterfaceImpl>(callCount)));
+
+  auto cap = client.getPeer<test::TestInterface>();
+  auto req1 = cap.fooRequest();
+  req1.setI(123);
+  req1.setJ(true);
+  auto promise1 = req1.send();
+
+  auto req2 = cap.bazRequest();
+  initTestMessage(req2.initS());
+  auto promise2 = req2.send();
+
+  auto req3 = cap.barRequest();
+  auto promise3 = req3.send();
+
+  auto resp1 = promise1.wait(io.waitScope);
+  KJ_EXPECT(resp1.getX() == "foo");
+  promise2.wait(io.waitScope);
+  KJ_EXPECT_THROW_MESSAGE("Method not implemented", promise3.wait(io.waitScope));
+
+  KJ_EXPECT(callCount == 2);
+
+  // All three calls went out in a single batch.
+  KJ_ASSERT(countingTransport.sent.size() == 1);
+  KJ_EXPECT(countingTransport.sent[0].startsWith("[{"));
+
+  // A lone call is not wrapped in an array.
+  auto req4 = cap.fooRequest();
+  req4.setI(123);
+  req4.setJ(true);
+  KJ_EXPECT(req4.send().wait(io.waitScope).getX() == "foo");
+  KJ_ASSERT(countingTransport.sent.size() == 2);
+  KJ_EXPECT(countingTransport.sent[1].startsWith("{"));
+}
+
+KJ_TEST("json-rpc queued messages are sent together") {
+  auto io = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+
+  JsonRpc::ContentLengthTransport clientTransport(*pipe.ends[0]);
+  JsonRpc::ContentLengthTransport serverTransport(*pipe.ends[1]);
+
+  int callCount = 0;
+
+  JsonRpc client(clientTransport);
+  JsonRpc server(serverTransport, toDynamic(kj::heap<TestInterfaceImpl>(callCount)));
+
+  auto cap = client.getPeer<test::TestInterface>();
+  kj::Vector<RemotePromise<test::TestInterface::FooResults>> promises;
+  for (auto i KJ_UNUSED: kj::zeroTo(10)) {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    promises.add(req.send());
+  }
+
+  for (auto& promise: promises) {
+    KJ_EXPECT(promise.wait(io.waitScope).getX() == "foo");
+  }
+
+  KJ_EXPECT(callCount == 10);
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
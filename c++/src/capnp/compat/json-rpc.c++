@@ -75,7 +75,7 @@ public:
     params.setName("params");
     parent.codec.encode(context.getParams(), params.initValue());
 
-    auto writePromise = parent.queueWrite(parent.codec.encode(value));
+    auto writePromise = parent.queueCall(parent.codec.encode(value));
 
     if (isNotification) {
       auto sproto = context.getResultsType().getProto().getStruct();
@@ -98,11 +98,14 @@ private:
 };
 
 JsonRpc::JsonRpc(Transport& transport, DynamicCapability::Client interface)
-    : JsonRpc(transport, kj::mv(interface), kj::newPromiseAndFulfiller<void>()) {}
+    : JsonRpc(transport, kj::mv(interface), Options()) {}
+JsonRpc::JsonRpc(Transport& transport, DynamicCapability::Client interface, Options options)
+    : JsonRpc(transport, kj::mv(interface), options, kj::newPromiseAndFulfiller<void>()) {}
 JsonRpc::JsonRpc(Transport& transport, DynamicCapability::Client interfaceParam,
-                 kj::PromiseFulfillerPair<void> paf)
+                 Options options, kj::PromiseFulfillerPair<void> paf)
     : transport(transport),
       interface(kj::mv(interfaceParam)),
+      options(options),
       errorPromise(paf.promise.fork()),
       errorFulfiller(kj::mv(paf.fulfiller)),
       readTask(readLoop().eagerlyEvaluate([this](kj::Exception&& e) {
@@ -131,23 +134,61 @@ DynamicCapability::Client JsonRpc::getPeer(InterfaceSchema schema) {
   return kj::heap<CapabilityImpl>(*this, schema);
 }
 
+kj::Promise<void> JsonRpc::Transport::sendAll(kj::ArrayPtr<const kj::StringPtr> texts) {
+  if (texts.size() == 0) return kj::READY_NOW;
+  return send(texts[0]).then([this, texts]() {
+    return sendAll(texts.slice(1, texts.size()));
+  });
+}
+
 static kj::HttpHeaderTable& staticHeaderTable() {
   static kj::HttpHeaderTable HEADER_TABLE;
   return HEADER_TABLE;
 }
 
 kj::Promise<void> JsonRpc::queueWrite(kj::String text) {
-  auto fork = writeQueue.then([this, text = kj::mv(text)]() mutable {
-    auto promise = transport.send(text);
-    return promise.attach(kj::mv(text));
-  }).eagerlyEvaluate([this](kj::Exception&& e) {
-    errorFulfiller->reject(kj::mv(e));
-  }).fork();
-  writeQueue = fork.addBranch();
-  return fork.addBranch();
+  // Messages queued while the previous write is still in progress are collected and handed to
+  // the transport together once it completes, so that a burst of responses doesn't pay for one
+  // round through the transport per message.
+  if (queuedWrites.empty()) {
+    auto fork = writeQueue.then([this]() {
+      auto texts = kj::mv(queuedWrites);
+      auto ptrs = KJ_MAP(text, texts) -> kj::StringPtr { return text; };
+      auto promise = ptrs.size() == 1 ? transport.send(ptrs[0]) : transport.sendAll(ptrs);
+      return promise.attach(kj::mv(texts), kj::mv(ptrs));
+    }).eagerlyEvaluate([this](kj::Exception&& e) {
+      errorFulfiller->reject(kj::mv(e));
+    }).fork();
+    writeQueue = fork.addBranch();
+    queuedWritesSent = kj::mv(fork);
+  }
+  queuedWrites.add(kj::mv(text));
+  return KJ_ASSERT_NONNULL(queuedWritesSent).addBranch();
 }
 
-void JsonRpc::queueError(kj::Maybe<json::Value::Reader> id, int code, kj::StringPtr message) {
+kj::Promise<void> JsonRpc::queueCall(kj::String text) {
+  if (!options.batchCalls) {
+    return queueWrite(kj::mv(text));
+  }
+
+  if (queuedCalls.empty()) {
+    // Wait until everything else queued this turn has run, so that all calls made in response
+    // to the same event end up in the same batch.
+    queuedCallsSent = kj::evalLast([this]() {
+      auto calls = kj::mv(queuedCalls);
+      if (calls.size() == 1) {
+        return queueWrite(kj::mv(calls[0]));
+      } else {
+        return queueWrite(kj::str('[', kj::strArray(calls, ","), ']'));
+      }
+    }).eagerlyEvaluate(nullptr).fork();
+  }
+  queuedCalls.add(kj::mv(text));
+  return KJ_ASSERT_NONNULL(queuedCallsSent).addBranch();
+}
+
+kj::String JsonRpc::makeError(
+    kj::Maybe<json::Value::Reader> id, int code, kj::StringPtr message) {
   MallocMessageBuilder capnpMessage;
   auto jsonResponse = capnpMessage.getRoot<json::RpcMessage>();
   jsonResponse.setJsonrpc("2.0");
@@ -159,157 +200,236 @@ void JsonRpc::queueError(kj::Maybe<json::Value::Reader> id, int code, kj::String
   auto error = jsonResponse.initError();
   error.setCode(code);
   error.setMessage(message);
+  return codec.encode(jsonResponse);
+}
 
+void JsonRpc::queueError(kj::Maybe<json::Value::Reader> id, int code, kj::StringPtr message) {
   // OK to discard result of queueWrite() since it's just one branch of a fork.
-  queueWrite(codec.encode(jsonResponse));
+  queueWrite(makeError(id, code, message));
+}
+
+static bool isBatch(kj::StringPtr text) {
+  for (char c: text) {
+    switch (c) {
+      case ' ': case '\t': case '\r': case '\n':
+        continue;
+      default:
+        return c == '[';
+    }
+  }
+  return false;
 }
 
 kj::Promise<void> JsonRpc::readLoop() {
   return transport.receive().then([this](kj::String message) -> kj::Promise<void> {
+    KJ_CONTEXT("decoding JSON-RPC message", message);
+
+    if (isBatch(message)) {
+      handleBatch(message);
+      return readLoop();
+    }
+
     MallocMessageBuilder capnpMessage;
-    auto rpcMessageBuilder = capnpMessage.getRoot<json::RpcMessage>();
+    auto value = capnpMessage.getRoot<json::Value>();
 
     KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
-      codec.decode(message, rpcMessageBuilder);
+      codec.decodeRaw(message, value);
     })) {
       queueError(nullptr, -32700, kj::str("Parse error: ", exception->getDescription()));
       return readLoop();
     }
 
-    KJ_CONTEXT("decoding JSON-RPC message", message);
+    KJ_IF_MAYBE(reply, handleMessage(value.asReader(), false)) {
+      tasks.add(reply->then([this](kj::String text) {
+        return queueWrite(kj::mv(text));
+      }));
+    }
+
+    return readLoop();
+  });
+}
 
-    auto rpcMessage = rpcMessageBuilder.asReader();
+void JsonRpc::handleBatch(kj::StringPtr text) {
+  MallocMessageBuilder capnpMessage;
+  auto value = capnpMessage.getRoot<json::Value>();
 
-    if (!rpcMessage.hasJsonrpc()) {
-      queueError(nullptr, -32700, kj::str("Missing 'jsonrpc' field."));
-      return readLoop();
-    } else if (rpcMessage.getJsonrpc() != "2.0") {
-      queueError(nullptr, -32700,
-          kj::str("Unknown JSON-RPC version. This peer implements version '2.0'."));
-      return readLoop();
+  KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+    codec.decodeRaw(text, value);
+  })) {
+    queueError(nullptr, -32700, kj::str("Parse error: ", exception->getDescription()));
+    return;
+  }
+
+  auto elements = value.asReader().getArray();
+  if (elements.size() == 0) {
+    queueError(nullptr, -32600, "Invalid Request: empty batch");
+    return;
+  }
+
+  kj::Vector<kj::Promise<kj::String>> replies(elements.size());
+  for (auto element: elements) {
+    KJ_IF_MAYBE(reply, handleMessage(element, true)) {
+      replies.add(kj::mv(*reply));
     }
+  }
 
-    switch (rpcMessage.which()) {
-      case json::RpcMessage::NONE:
-        queueError(nullptr, -32700, kj::str("message has none of params, result, or error"));
-        break;
-
-      case json::RpcMessage::PARAMS: {
-        // a call
-        KJ_IF_MAYBE(method, methodMap.find(rpcMessage.getMethod())) {
-          auto req = interface.newRequest(*method);
-          KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
-            codec.decode(rpcMessage.getParams(), req);
-          })) {
-            kj::Maybe<JsonValue::Reader> id;
-            if (rpcMessage.hasId()) id = rpcMessage.getId();
-            queueError(id, -32602,
-                kj::str("Type error in method params: ", exception->getDescription()));
-            break;
-          }
-
-          if (rpcMessage.hasId()) {
-            auto id = rpcMessage.getId();
-            auto idCopy = kj::heapArray<word>(id.totalSize().wordCount + 1);
-            memset(idCopy.begin(), 0, idCopy.asBytes().size());
-            copyToUnchecked(id, idCopy);
-            auto idPtr = readMessageUnchecked<json::Value>(idCopy.begin());
-
-            auto promise = req.send()
-                .then([this,idPtr](Response<DynamicStruct> response) mutable {
-              MallocMessageBuilder capnpMessage;
-              auto jsonResponse = capnpMessage.getRoot<json::RpcMessage>();
-              jsonResponse.setJsonrpc("2.0");
-              jsonResponse.setId(idPtr);
-              codec.encode(DynamicStruct::Reader(response), jsonResponse.initResult());
-              return queueWrite(codec.encode(jsonResponse));
-            }, [this,idPtr](kj::Exception&& e) {
-              MallocMessageBuilder capnpMessage;
-              auto jsonResponse = capnpMessage.getRoot<json::RpcMessage>();
-              jsonResponse.setJsonrpc("2.0");
-              jsonResponse.setId(idPtr);
-              auto error = jsonResponse.initError();
-              switch (e.getType()) {
-                case kj::Exception::Type::FAILED:
-                  error.setCode(-32000);
-                  break;
-                case kj::Exception::Type::DISCONNECTED:
-                  error.setCode(-32001);
-                  break;
-                case kj::Exception::Type::OVERLOADED:
-                  error.setCode(-32002);
-                  break;
-                case kj::Exception::Type::UNIMPLEMENTED:
-                  error.setCode(-32601);  // method not found
-                  break;
-              }
-              error.setMessage(e.getDescription());
-              return queueWrite(codec.encode(jsonResponse));
-            });
-            tasks.add(promise.attach(kj::mv(idCopy)));
-          } else {
-            // No 'id', so this is a notification.
-            tasks.add(req.send().ignoreResult().catch_([](kj::Exception&& exception) {
-              if (exception.getType() != kj::Exception::Type::UNIMPLEMENTED) {
-                KJ_LOG(ERROR, "JSON-RPC notification threw exception into the abyss", exception);
-              }
-            }));
-          }
-        } else {
-          if (rpcMessage.hasId()) {
-            queueError(rpcMessage.getId(), -32601, "Method not found");
-          } else {
-            // Ignore notification for unknown method.
-          }
+  // The responses to a batch are sent back together as one array, once all of them are ready.
+  // A batch consisting only of notifications gets no response at all.
+  if (replies.size() > 0) {
+    tasks.add(kj::joinPromises(replies.releaseAsArray())
+        .then([this](kj::Array<kj::String> texts) {
+      return queueWrite(kj::str('[', kj::strArray(texts, ","), ']'));
+    }));
+  }
+}
+
+kj::Maybe<kj::Promise<kj::String>> JsonRpc::handleMessage(
+    json::Value::Reader value, bool inBatch) {
+  MallocMessageBuilder capnpMessage;
+  auto rpcMessageBuilder = capnpMessage.getRoot<json::RpcMessage>();
+
+  KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+    codec.decode(value, rpcMessageBuilder);
+  })) {
+    if (inBatch) {
+      return kj::Promise<kj::String>(makeError(nullptr, -32600,
+          kj::str("Invalid Request: ", exception->getDescription())));
+    } else {
+      return kj::Promise<kj::String>(makeError(nullptr, -32700,
+          kj::str("Parse error: ", exception->getDescription())));
+    }
+  }
+
+  auto rpcMessage = rpcMessageBuilder.asReader();
+
+  if (!rpcMessage.hasJsonrpc()) {
+    return kj::Promise<kj::String>(makeError(nullptr, -32700,
+        kj::str("Missing 'jsonrpc' field.")));
+  } else if (rpcMessage.getJsonrpc() != "2.0") {
+    return kj::Promise<kj::String>(makeError(nullptr, -32700,
+        kj::str("Unknown JSON-RPC version. This peer implements version '2.0'.")));
+  }
+
+  switch (rpcMessage.which()) {
+    case json::RpcMessage::NONE:
+      return kj::Promise<kj::String>(makeError(nullptr, -32700,
+          kj::str("message has none of params, result, or error")));
+
+    case json::RpcMessage::PARAMS: {
+      // a call
+      KJ_IF_MAYBE(method, methodMap.find(rpcMessage.getMethod())) {
+        auto req = interface.newRequest(*method);
+        KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+          codec.decode(rpcMessage.getParams(), req);
+        })) {
+          kj::Maybe<JsonValue::Reader> id;
+          if (rpcMessage.hasId()) id = rpcMessage.getId();
+          return kj::Promise<kj::String>(makeError(id, -32602,
+              kj::str("Type error in method params: ", exception->getDescription())));
         }
-        break;
-      }
 
-      case json::RpcMessage::RESULT: {
-        auto id = rpcMessage.getId();
-        if (!id.isNumber()) {
-          // JSON-RPC doesn't define what to do if receiving a response with an invalid id.
-          KJ_LOG(ERROR, "JSON-RPC response has invalid ID");
-        } else KJ_IF_MAYBE(awaited, awaitedResponses.find((uint)id.getNumber())) {
-          KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
-            codec.decode(rpcMessage.getResult(), awaited->context.getResults());
-            awaited->fulfiller->fulfill();
-          })) {
-            // Errors always propagate from callee to caller, so we don't want to throw this error
-            // back to the server.
-            awaited->fulfiller->reject(kj::mv(*exception));
-          }
+        if (rpcMessage.hasId()) {
+          auto id = rpcMessage.getId();
+          auto idCopy = kj::heapArray<word>(id.totalSize().wordCount + 1);
+          memset(idCopy.begin(), 0, idCopy.asBytes().size());
+          copyToUnchecked(id, idCopy);
+          auto idPtr = readMessageUnchecked<json::Value>(idCopy.begin());
+
+          auto promise = req.send()
+              .then([this,idPtr](Response<DynamicStruct> response) mutable {
+            MallocMessageBuilder capnpMessage;
+            auto jsonResponse = capnpMessage.getRoot<json::RpcMessage>();
+            jsonResponse.setJsonrpc("2.0");
+            jsonResponse.setId(idPtr);
+            codec.encode(DynamicStruct::Reader(response), jsonResponse.initResult());
+            return codec.encode(jsonResponse);
+          }, [this,idPtr](kj::Exception&& e) {
+            MallocMessageBuilder capnpMessage;
+            auto jsonResponse = capnpMessage.getRoot<json::RpcMessage>();
+            jsonResponse.setJsonrpc("2.0");
+            jsonResponse.setId(idPtr);
+            auto error = jsonResponse.initError();
+            switch (e.getType()) {
+              case kj::Exception::Type::FAILED:
+                error.setCode(-32000);
+                break;
+              case kj::Exception::Type::DISCONNECTED:
+                error.setCode(-32001);
+                break;
+              case kj::Exception::Type::OVERLOADED:
+                error.setCode(-32002);
+                break;
+              case kj::Exception::Type::UNIMPLEMENTED:
+                error.setCode(-32601);  // method not found
+                break;
+            }
+            error.setMessage(e.getDescription());
+            return codec.encode(jsonResponse);
+          });
+          return promise.attach(kj::mv(idCopy));
+        } else {
+          // No 'id', so this is a notification.
+          tasks.add(req.send().ignoreResult().catch_([](kj::Exception&& exception) {
+            if (exception.getType() != kj::Exception::Type::UNIMPLEMENTED) {
+              KJ_LOG(ERROR, "JSON-RPC notification threw exception into the abyss", exception);
+            }
+          }));
+        }
+      } else {
+        if (rpcMessage.hasId()) {
+          return kj::Promise<kj::String>(
+              makeError(rpcMessage.getId(), -32601, "Method not found"));
         } else {
-          // Probably, this is the response to a call that was canceled.
+          // Ignore notification for unknown method.
         }
-        break;
       }
+      break;
+    }
 
-      case json::RpcMessage::ERROR: {
-        auto id = rpcMessage.getId();
-        if (id.isNull()) {
-          // Error message will be logged by KJ_CONTEXT, above.
-          KJ_LOG(ERROR, "peer reports JSON-RPC protocol error");
-        } else if (!id.isNumber()) {
-          // JSON-RPC doesn't define what to do if receiving a response with an invalid id.
-          KJ_LOG(ERROR, "JSON-RPC response has invalid ID");
-        } else KJ_IF_MAYBE(awaited, awaitedResponses.find((uint)id.getNumber())) {
-          auto error = rpcMessage.getError();
-          auto code = error.getCode();
-          kj::Exception::Type type =
-              code == -32601 ? kj::Exception::Type::UNIMPLEMENTED
-                             : kj::Exception::Type::FAILED;
-          awaited->fulfiller->reject(kj::Exception(
-              type, __FILE__, __LINE__, kj::str(error.getMessage())));
-        } else {
-          // Probably, this is the response to a call that was canceled.
+    case json::RpcMessage::RESULT: {
+      auto id = rpcMessage.getId();
+      if (!id.isNumber()) {
+        // JSON-RPC doesn't define what to do if receiving a response with an invalid id.
+        KJ_LOG(ERROR, "JSON-RPC response has invalid ID");
+      } else KJ_IF_MAYBE(awaited, awaitedResponses.find((uint)id.getNumber())) {
+        KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+          codec.decode(rpcMessage.getResult(), awaited->context.getResults());
+          awaited->fulfiller->fulfill();
+        })) {
+          // Errors always propagate from callee to caller, so we don't want to throw this error
+          // back to the server.
+          awaited->fulfiller->reject(kj::mv(*exception));
         }
-        break;
+      } else {
+        // Probably, this is the response to a call that was canceled.
       }
+      break;
     }
 
-    return readLoop();
-  });
+    case json::RpcMessage::ERROR: {
+      auto id = rpcMessage.getId();
+      if (id.isNull()) {
+        // Error message will be logged by KJ_CONTEXT, above.
+        KJ_LOG(ERROR, "peer reports JSON-RPC protocol error");
+      } else if (!id.isNumber()) {
+        // JSON-RPC doesn't define what to do if receiving a response with an invalid id.
+        KJ_LOG(ERROR, "JSON-RPC response has invalid ID");
+      } else KJ_IF_MAYBE(awaited, awaitedResponses.find((uint)id.getNumber())) {
+        auto error = rpcMessage.getError();
+        auto code = error.getCode();
+        kj::Exception::Type type =
+            code == -32601 ? kj::Exception::Type::UNIMPLEMENTED
+                           : kj::Exception::Type::FAILED;
+        awaited->fulfiller->reject(kj::Exception(
+            type, __FILE__, __LINE__, kj::str(error.getMessage())));
+      } else {
+        // Probably, this is the response to a call that was canceled.
+      }
+      break;
+    }
+  }
+
+  return nullptr;
 }
 
 void JsonRpc::taskFailed(kj::Exception&& exception) {
@@ -329,6 +449,22 @@ kj::Promise<void> JsonRpc::ContentLengthTransport::send(kj::StringPtr text) {
   return stream.write(parts).attach(kj::mv(headers));
 }
 
+kj::Promise<void> JsonRpc::ContentLengthTransport::sendAll(
+    kj::ArrayPtr<const kj::StringPtr> texts) {
+  // Gather every message and its header into a single write.
+  auto headers = KJ_MAP(text, texts) {
+    return kj::str("Content-Length: ", text.size(), "\r\n\r\n");
+  };
+  auto pieces = kj::heapArrayBuilder<kj::ArrayPtr<const byte>>(texts.size() * 2);
+  for (auto i: kj::indices(texts)) {
+    pieces.add(headers[i].asBytes());
+    pieces.add(texts[i].asBytes());
+  }
+  auto piecesArray = pieces.finish();
+  auto promise = stream.write(piecesArray);
+  return promise.attach(kj::mv(headers), kj::mv(piecesArray));
+}
+
 kj::Promise<kj::String> JsonRpc::ContentLengthTransport::receive() {
   return input->readMessage()
       .then([](kj::HttpInputStream::Message&& message) {
@@ -25,6 +25,7 @@
 #include "kj/async-io.h"
 #include "capnp/capability.h"
 #include "kj/map.h"
+#include "kj/vector.h"
 
 namespace kj { class HttpInputStream; }
 
@@ -41,7 +42,15 @@ public:
   class Transport;
   class ContentLengthTransport;
 
+  struct Options {
+    bool batchCalls = false;
+    // If true, calls made on the peer during the same event loop turn are sent together as one
+    // JSON-RPC batch (a JSON array), which the peer answers with one array of responses. Only
+    // enable this if the peer supports batches.
+  };
+
   JsonRpc(Transport& transport, DynamicCapability::Client interface = {});
+  JsonRpc(Transport& transport, DynamicCapability::Client interface, Options options);
   KJ_DISALLOW_COPY(JsonRpc);
 
   DynamicCapability::Client getPeer(InterfaceSchema schema);
@@ -57,9 +66,19 @@ private:
   JsonCodec codec;
   Transport& transport;
   DynamicCapability::Client interface;
+  Options options;
   kj::HashMap<kj::StringPtr, InterfaceSchema::Method> methodMap;
   uint callCount = 0;
   kj::Promise<void> writeQueue = kj::READY_NOW;
+
+  kj::Vector<kj::String> queuedWrites;
+  kj::Maybe<kj::ForkedPromise<void>> queuedWritesSent;
+  // Messages waiting for the previous transport write to finish, to be sent together.
+
+  kj::Vector<kj::String> queuedCalls;
+  kj::Maybe<kj::ForkedPromise<void>> queuedCallsSent;
+  // Calls made this turn, to be sent as one batch when `options.batchCalls` is set.
+
   kj::ForkedPromise<void> errorPromise;
   kj::Own<kj::PromiseFulfiller<void>> errorFulfiller;
   kj::Promise<void> readTask;
@@ -75,13 +94,18 @@ private:
   class CapabilityImpl;
 
   kj::Promise<void> queueWrite(kj::String text);
+  kj::Promise<void> queueCall(kj::String text);
   void queueError(kj::Maybe<json::Value::Reader> id, int code, kj::StringPtr message);
+  kj::String makeError(kj::Maybe<json::Value::Reader> id, int code, kj::StringPtr message);
 
   kj::Promise<void> readLoop();
+  void handleBatch(kj::StringPtr text);
+  kj::Maybe<kj::Promise<kj::String>> handleMessage(json::Value::Reader value, bool inBatch);
+  // Handles one incoming message. Returns the reply to send, if any.
 
   void taskFailed(kj::Exception&& exception) override;
 
-  JsonRpc(Transport& transport, DynamicCapability::Client interface,
+  JsonRpc(Transport& transport, DynamicCapability::Client interface, Options options,
           kj::PromiseFulfillerPair<void> paf);
 };
 
@@ -89,6 +113,11 @@ class JsonRpc::Transport {
 public:
   virtual kj::Promise<void> send(kj::StringPtr text) = 0;
   virtual kj::Promise<kj::String> receive() = 0;
+
+  virtual kj::Promise<void> sendAll(kj::ArrayPtr<const kj::StringPtr> texts);
+  // Send several messages in order. JsonRpc uses this for messages that queued up while an
+  // earlier send was in progress. The default implementation calls send() for each in turn;
+  // transports should override it if they can write several messages at once.
 };
 
 class JsonRpc::ContentLengthTransport: public Transport {
@@ -101,6 +130,7 @@ public:
   KJ_DISALLOW_COPY(ContentLengthTransport);
 
   kj::Promise<void> send(kj::StringPtr text) override;
+  kj::Promise<void> sendAll(kj::ArrayPtr<const kj::StringPtr> texts) override;
   kj::Promise<kj::String> receive() override;
 
 private:
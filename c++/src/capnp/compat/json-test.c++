@@ -26,6 +26,7 @@
 #include "kj/debug.h"
 #include "kj/string.h"
 #include "kj/test.h"
+#include "kj/async-io.h"
 
 namespace capnp {
 namespace _ {  // private
@@ -109,7 +110,7 @@ const char ALL_TYPES_JSON[] =
     "    \"uInt16List\": [1234, 5678, 0, 65535],\n"
     "    \"uInt32List\": [12345678, 90123456, 0, 4294967295],\n"
     "    \"uInt64List\": [\"123456789012345\", \"678901234567890\", \"0\", \"18446744073709551615\"],\n"
-    "    \"float32List\": [0, 1234567, 9.9999999338158125e36, -9.9999999338158125e36, 9.99999991097579e-38, -9.99999991097579e-38],\n"
+    "    \"float32List\": [0, 1234567, 9.999999933815813e36, -9.999999933815813e36, 9.99999991097579e-38, -9.99999991097579e-38],\n"
     "    \"float64List\": [0, 123456789012345, 1e306, -1e306, 1e-306, -1e-306],\n"
     "    \"textList\": [\"quux\", \"corge\", \"grault\"],\n"
     "    \"dataList\": [[103, 97, 114, 112, 108, 121], [119, 97, 108, 100, 111], [102, 114, 101, 100]],\n"
@@ -357,6 +358,77 @@ KJ_TEST("decode test message") {
   KJ_EXPECT(root.toString().flatten() == decodedRoot.toString().flatten());
 }
 
+KJ_TEST("decoding directly matches decoding via JsonValue") {
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  JsonCodec json;
+  json.setPrettyPrint(true);
+  auto encoded = json.encode(root);
+
+  MallocMessageBuilder directMessage;
+  auto direct = directMessage.initRoot<TestAllTypes>();
+  json.decode(encoded, direct);
+
+  MallocMessageBuilder rawMessage;
+  auto raw = rawMessage.initRoot<JsonValue>();
+  json.decodeRaw(encoded, raw);
+  MallocMessageBuilder viaValueMessage;
+  auto viaValue = viaValueMessage.initRoot<TestAllTypes>();
+  json.decode(raw, viaValue);
+
+  KJ_EXPECT(direct.toString().flatten() == viaValue.toString().flatten());
+  KJ_EXPECT(direct.toString().flatten() == root.toString().flatten());
+
+  MallocMessageBuilder listMessage;
+  auto list = json.decode<List<TestAllTypes>>(
+      R"([{"int32List": [1, 2, 3]}, {}, {"textField": "x", "structList": [{}, {}]}])"_kj,
+      listMessage.getOrphanage());
+  KJ_ASSERT(list.getReader().size() == 3);
+  KJ_EXPECT(list.getReader()[0].getInt32List().size() == 3);
+  KJ_EXPECT(list.getReader()[0].getInt32List()[2] == 3);
+  KJ_EXPECT(list.getReader()[2].getTextField() == "x");
+  KJ_EXPECT(list.getReader()[2].getStructList().size() == 2);
+}
+
+KJ_TEST("decoding directly handles strings, skipped values, and nesting") {
+  JsonCodec json;
+  MallocMessageBuilder message;
+  auto root = message.initRoot<TestAllTypes>();
+
+  // Escapes and quotes on either side of eight-byte boundaries.
+  json.decode(R"({"textList": ["", "0123456\"", "01234567\"xy", "\u00410123456789abcdef",
+                               "0123456789abcdef0123456789abcdef"]})", root);
+  auto texts = root.asReader().getTextList();
+  KJ_ASSERT(texts.size() == 5);
+  KJ_EXPECT(texts[0] == "");
+  KJ_EXPECT(texts[1] == "0123456\"");
+  KJ_EXPECT(texts[2] == "01234567\"xy");
+  KJ_EXPECT(texts[3] == "A0123456789abcdef");
+  KJ_EXPECT(texts[4] == "0123456789abcdef0123456789abcdef");
+
+  // Brackets and commas inside strings don't confuse element counting.
+  json.decode(R"({"textList": ["a,b", "]", "[\",", " }"], "int8List": [ ]})", root);
+  KJ_EXPECT(root.getTextList().size() == 4);
+  KJ_EXPECT(root.asReader().getTextList()[2] == "[\",");
+  KJ_EXPECT(root.getInt8List().size() == 0);
+
+  json.decode(R"({"unknown": [{"a": [1, "]"]}, null], "int8Field": 3})", root);
+  KJ_EXPECT(root.getInt8Field() == 3);
+
+  KJ_EXPECT_THROW_MESSAGE("Unexpected input",
+      json.decode(R"({"unknown": [1,, 2], "int8Field": 3})", root));
+  KJ_EXPECT_THROW_MESSAGE("Expected integer", json.decode(R"({"int8List": [1, 2,]})", root));
+  KJ_EXPECT_THROW_MESSAGE("ends prematurely", json.decode(R"({"textField": "abc)", root));
+  KJ_EXPECT_THROW_MESSAGE("Input remains", json.decode(R"({} {})", root));
+
+  json.setMaxNestingDepth(2);
+  json.decode(R"({"structField": {"int8Field": 1}})", root);
+  KJ_EXPECT_THROW_MESSAGE("nest", json.decode(R"({"structField": {"int8List": []}})", root));
+  KJ_EXPECT_THROW_MESSAGE("nest", json.decode(R"({"unknown": {"a": []}})", root));
+}
+
 KJ_TEST("basic json decoding") {
   // TODO(cleanup): this test is a mess!
   JsonCodec json;
@@ -821,6 +893,30 @@ KJ_TEST("register field handler") {
   }
 }
 
+KJ_TEST("handlers registered after use still apply") {
+  // Per-type plans are cached on first use, so registering a handler must invalidate them.
+
+  JsonCodec json;
+  MallocMessageBuilder message;
+  auto root = message.getRoot<test::TestOldVersion>();
+  root.setOld1(123);
+  root.initOld3().setOld2("bar");
+
+  KJ_EXPECT(json.encode(root) == R"({"old1":"123","old3":{"old1":"0","old2":"bar"}})",
+            json.encode(root));
+
+  TestStructHandler handler;
+  json.addFieldHandler(StructSchema::from<test::TestOldVersion>().getFieldByName("old3"),
+                       handler);
+  KJ_EXPECT(json.encode(root) == R"({"old1":"123","old3":["0","bar",null]})", json.encode(root));
+
+  MallocMessageBuilder decodedMessage;
+  auto decoded = decodedMessage.getRoot<test::TestOldVersion>();
+  json.decode(R"({"old3":["7","baz",null]})", decoded);
+  KJ_EXPECT(decoded.getOld3().getOld1() == 7);
+  KJ_EXPECT("baz" == decoded.getOld3().getOld2());
+}
+
 class TestCapabilityHandler: public JsonCodec::Handler<test::TestInterface> {
 public:
   void encode(const JsonCodec& codec, test::TestInterface::Client input,
@@ -1007,6 +1103,104 @@ KJ_TEST("base64 union encoded correctly") {
   KJ_EXPECT(json.encode(root) == "{\"foo\": \"AAAAAAA=\"}", json.encode(root));
 }
 
+class ChunkRecordingStream final: public kj::AsyncOutputStream {
+public:
+  kj::Vector<char> text;
+  size_t chunkCount = 0;
+  size_t maxChunkSize = 0;
+
+  kj::Promise<void> write(const void* buffer, size_t size) override {
+    text.addAll(kj::arrayPtr(reinterpret_cast<const char*>(buffer), size));
+    ++chunkCount;
+    maxChunkSize = kj::max(maxChunkSize, size);
+    return kj::evalLater([]() {});
+  }
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
+    KJ_UNIMPLEMENTED("not used");
+  }
+  kj::Promise<void> whenWriteDisconnected() override { return kj::NEVER_DONE; }
+
+  kj::StringPtr getText() {
+    text.add('\0');
+    return kj::StringPtr(text.begin(), text.size() - 1);
+  }
+};
+
+void expectSameText(kj::ArrayPtr<const char> actual, kj::StringPtr expected) {
+  // Reports only the neighborhood of the first difference, as the texts are large.
+  size_t i = 0;
+  while (i < actual.size() && i < expected.size() && actual[i] == expected[i]) ++i;
+  if (i < actual.size() || i < expected.size()) {
+    size_t start = i < 40 ? 0 : i - 40;
+    KJ_FAIL_EXPECT("texts differ", i, actual.size(), expected.size(),
+        actual.slice(start, kj::min(actual.size(), i + 40)),
+        expected.slice(start, kj::min(expected.size(), i + 40)));
+  }
+}
+
+KJ_TEST("streaming encoder") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  MallocMessageBuilder message;
+  auto root = message.getRoot<TestAllTypes>();
+  initTestMessage(root);
+  root.setTextField(kj::str(kj::repeat('x', 10000), "\n\"", kj::repeat('y', 10000)));
+  auto structs = root.initStructList(1000);
+  for (auto i: kj::indices(structs)) {
+    structs[i].setInt32Field(i);
+    structs[i].setTextField("element");
+  }
+
+  JsonCodec json;
+  auto expected = json.encode(root.asReader());
+
+  {
+    kj::VectorOutputStream output;
+    json.encode(root.asReader(), output);
+    expectSameText(output.getArray().asChars(), expected);
+  }
+
+  {
+    ChunkRecordingStream output;
+    json.encode(root.asReader(), output).wait(waitScope);
+    expectSameText(output.getText(), expected);
+    KJ_EXPECT(output.chunkCount > 1);
+    KJ_EXPECT(output.maxChunkSize < 16384, output.maxChunkSize);
+  }
+
+  {
+    // Pretty-printing doesn't apply when streaming.
+    json.setPrettyPrint(true);
+    kj::VectorOutputStream output;
+    json.encode(root.asReader(), output);
+    expectSameText(output.getArray().asChars(), expected);
+    json.setPrettyPrint(false);
+  }
+
+  {
+    // Handler output is streamed too.
+    TestCallHandler handler;
+    json.addTypeHandler(handler);
+    auto expectedWithHandler = json.encode(root.asReader());
+    KJ_EXPECT(expectedWithHandler.startsWith("{\"voidField\":null,\"boolField\":true,"));
+
+    ChunkRecordingStream output;
+    json.encode(root.asReader(), output).wait(waitScope);
+    expectSameText(output.getText(), expectedWithHandler);
+  }
+
+  {
+    // Errors are reported through the promise.
+    MallocMessageBuilder anyMessage;
+    auto anyRoot = anyMessage.getRoot<test::TestAnyPointer>();
+    anyRoot.getAnyPointerField().setAs<Text>("foo");
+    ChunkRecordingStream output;
+    auto promise = json.encode(anyRoot.asReader(), output);
+    KJ_EXPECT_THROW_MESSAGE("AnyPointer", promise.wait(waitScope));
+  }
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
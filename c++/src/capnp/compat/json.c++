@@ -27,9 +27,74 @@
 #include "kj/one-of.h"
 #include "kj/encoding.h"
 #include "kj/map.h"
+#include "kj/mutex.h"
+#include "kj/io.h"
+#include "kj/async-io.h"
+#include <string.h>
 
 namespace capnp {
 
+namespace {
+
+void escapeJsonChars(kj::ArrayPtr<const char> chars, kj::Vector<char>& escaped) {
+  // Appends `chars` to `escaped` as the body of a JSON string, without the surrounding quotes.
+
+  static const char HEXDIGITS[] = "0123456789abcdef";
+
+  for (char c: chars) {
+    switch (c) {
+      case '\"': escaped.addAll(kj::StringPtr("\\\"")); break;
+      case '\\': escaped.addAll(kj::StringPtr("\\\\")); break;
+      case '\b': escaped.addAll(kj::StringPtr("\\b")); break;
+      case '\f': escaped.addAll(kj::StringPtr("\\f")); break;
+      case '\n': escaped.addAll(kj::StringPtr("\\n")); break;
+      case '\r': escaped.addAll(kj::StringPtr("\\r")); break;
+      case '\t': escaped.addAll(kj::StringPtr("\\t")); break;
+      default:
+        if (static_cast<uint8_t>(c) < 0x20) {
+          escaped.addAll(kj::StringPtr("\\u00"));
+          uint8_t c2 = c;
+          escaped.add(HEXDIGITS[c2 / 16]);
+          escaped.add(HEXDIGITS[c2 % 16]);
+        } else {
+          escaped.add(c);
+        }
+        break;
+    }
+  }
+}
+
+}  // namespace
+
+struct JsonCodec::StructPlan {
+  // What encoding or decoding a struct type involves apart from the value itself: its fields, with
+  // their names and handlers already looked up. Built once per type and cached in the Impl.
+
+  struct Field {
+    StructSchema::Field schema;
+    Type type;
+    uint index;
+
+    kj::StringPtr name;
+    kj::String quotedName;
+    // `name` as a JSON string, for the streaming encoder.
+
+    HandlerBase* handler;
+    // The field's handler, or else its type's handler, or null.
+
+    HandlerBase* elementHandler;
+    // For a list without a handler, the handler for its element type, or null.
+
+    const StructPlan* structPlan;
+    // For a struct without a handler, or a list of them, the plan for the struct type.
+  };
+
+  kj::Array<Field> fields;
+  // Indexed by field index.
+
+  kj::Array<const Field*> nonUnionFields;
+};
+
 struct JsonCodec::Impl {
   bool prettyPrint = false;
   HasMode hasMode = HasMode::NON_NULL;
@@ -41,6 +106,67 @@ struct JsonCodec::Impl {
   kj::HashMap<Type, kj::Maybe<kj::Own<AnnotatedHandler>>> annotatedHandlers;
   kj::HashMap<Type, kj::Own<AnnotatedEnumHandler>> annotatedEnumHandlers;
 
+  typedef kj::HashMap<Type, kj::Own<StructPlan>> PlanMap;
+  kj::MutexGuarded<PlanMap> plans;
+  // Filled in lazily. Registering a handler clears it, though handlers are normally all
+  // registered before the codec is used.
+
+  const StructPlan& getPlan(PlanMap& plans, StructSchema schema) const {
+    KJ_IF_MAYBE(existing, plans.find(Type(schema))) {
+      return **existing;
+    }
+
+    // Insert before filling in the fields, so that recursive types find it.
+    auto& plan = *plans.insert(Type(schema), kj::heap<StructPlan>()).value;
+
+    auto schemaFields = schema.getFields();
+    auto fields = kj::heapArrayBuilder<StructPlan::Field>(schemaFields.size());
+    for (auto field: schemaFields) {
+      auto type = field.getType();
+      auto name = field.getProto().getName();
+
+      HandlerBase* handler = nullptr;
+      KJ_IF_MAYBE(h, fieldHandlers.find(field)) {
+        handler = *h;
+      } else KJ_IF_MAYBE(h, typeHandlers.find(type)) {
+        handler = *h;
+      }
+
+      HandlerBase* elementHandler = nullptr;
+      const StructPlan* structPlan = nullptr;
+      if (handler == nullptr) {
+        if (type.isStruct()) {
+          structPlan = &getPlan(plans, type.asStruct());
+        } else if (type.isList()) {
+          auto elementType = type.asList().getElementType();
+          KJ_IF_MAYBE(h, typeHandlers.find(elementType)) {
+            elementHandler = *h;
+          } else if (elementType.isStruct()) {
+            structPlan = &getPlan(plans, elementType.asStruct());
+          }
+        }
+      }
+
+      kj::Vector<char> quotedName(name.size() + 2);
+      quotedName.add('"');
+      escapeJsonChars(name, quotedName);
+      quotedName.add('"');
+      quotedName.add('\0');
+
+      fields.add(StructPlan::Field {
+        field, type, field.getIndex(), name, kj::String(quotedName.releaseAsArray()),
+        handler, elementHandler, structPlan
+      });
+    }
+    plan.fields = fields.finish();
+
+    plan.nonUnionFields = KJ_MAP(field, schema.getNonUnionFields()) {
+      return const_cast<const StructPlan::Field*>(&plan.fields[field.getIndex()]);
+    };
+
+    return plan;
+  }
+
   kj::StringTree encodeRaw(JsonValue::Reader value, uint indent, bool& multiline,
                            bool hasPrefix) const {
     switch (value.which()) {
@@ -99,31 +225,10 @@ struct JsonCodec::Impl {
   }
 
   kj::String encodeString(kj::StringPtr chars) const {
-    static const char HEXDIGITS[] = "0123456789abcdef";
     kj::Vector<char> escaped(chars.size() + 3);
 
     escaped.add('"');
-    for (char c: chars) {
-      switch (c) {
-        case '\"': escaped.addAll(kj::StringPtr("\\\"")); break;
-        case '\\': escaped.addAll(kj::StringPtr("\\\\")); break;
-        case '\b': escaped.addAll(kj::StringPtr("\\b")); break;
-        case '\f': escaped.addAll(kj::StringPtr("\\f")); break;
-        case '\n': escaped.addAll(kj::StringPtr("\\n")); break;
-        case '\r': escaped.addAll(kj::StringPtr("\\r")); break;
-        case '\t': escaped.addAll(kj::StringPtr("\\t")); break;
-        default:
-          if (static_cast<uint8_t>(c) < 0x20) {
-            escaped.addAll(kj::StringPtr("\\u00"));
-            uint8_t c2 = c;
-            escaped.add(HEXDIGITS[c2 / 16]);
-            escaped.add(HEXDIGITS[c2 % 16]);
-          } else {
-            escaped.add(c);
-          }
-          break;
-      }
-    }
+    escapeJsonChars(chars, escaped);
     escaped.add('"');
     escaped.add('\0');
 
@@ -185,6 +290,13 @@ void JsonCodec::setHasMode(HasMode mode) { impl->hasMode = mode; }
 
 void JsonCodec::setRejectUnknownFields(bool enabled) { impl->rejectUnknownFields = enabled; }
 
+const JsonCodec::StructPlan& JsonCodec::getStructPlan(StructSchema type) const {
+  auto lock = impl->plans.lockExclusive();
+  // A failure part-way could leave plans pointing at a half-built one.
+  KJ_ON_SCOPE_FAILURE(lock->clear());
+  return impl->getPlan(*lock, type);
+}
+
 kj::String JsonCodec::encode(DynamicValue::Reader value, Type type) const {
   MallocMessageBuilder message;
   auto json = message.getRoot<JsonValue>();
@@ -192,21 +304,6 @@ kj::String JsonCodec::encode(DynamicValue::Reader value, Type type) const {
   return encodeRaw(json);
 }
 
-void JsonCodec::decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const {
-  MallocMessageBuilder message;
-  auto json = message.getRoot<JsonValue>();
-  decodeRaw(input, json);
-  decode(json, output);
-}
-
-Orphan<DynamicValue> JsonCodec::decode(
-    kj::ArrayPtr<const char> input, Type type, Orphanage orphanage) const {
-  MallocMessageBuilder message;
-  auto json = message.getRoot<JsonValue>();
-  decodeRaw(input, json);
-  return decode(json, type, orphanage);
-}
-
 kj::String JsonCodec::encodeRaw(JsonValue::Reader value) const {
   bool multiline = false;
   return impl->encodeRaw(value, 0, multiline, false).flatten();
@@ -221,6 +318,13 @@ void JsonCodec::encode(DynamicValue::Reader input, Type type, JsonValue::Builder
     return;
   }
 
+  encodeValue(input, type, output);
+}
+
+void JsonCodec::encodeValue(DynamicValue::Reader input, Type type,
+                            JsonValue::Builder output) const {
+  // Like encode(), but for when we already know there's no handler for `type`.
+
   switch (type.which()) {
     case schema::Type::VOID:
       output.setNull();
@@ -271,15 +375,9 @@ void JsonCodec::encode(DynamicValue::Reader input, Type type, JsonValue::Builder
       }
       break;
     }
-    case schema::Type::LIST: {
-      auto list = input.as<DynamicList>();
-      auto elementType = type.asList().getElementType();
-      auto array = output.initArray(list.size());
-      for (auto i: kj::indices(list)) {
-        encode(list[i], elementType, array[i]);
-      }
+    case schema::Type::LIST:
+      encodeList(input.as<DynamicList>(), output);
       break;
-    }
     case schema::Type::ENUM: {
       auto e = input.as<DynamicEnum>();
       KJ_IF_MAYBE(symbol, e.getEnumerant()) {
@@ -289,86 +387,538 @@ void JsonCodec::encode(DynamicValue::Reader input, Type type, JsonValue::Builder
       }
       break;
     }
-    case schema::Type::STRUCT: {
-      auto structValue = input.as<capnp::DynamicStruct>();
-      auto nonUnionFields = structValue.getSchema().getNonUnionFields();
+    case schema::Type::STRUCT:
+      encodeStruct(getStructPlan(type.asStruct()), input.as<DynamicStruct>(), output);
+      break;
+    case schema::Type::INTERFACE:
+      KJ_FAIL_REQUIRE("don't know how to JSON-encode capabilities; "
+                      "please register a JsonCodec::Handler for this");
+    case schema::Type::ANY_POINTER:
+      KJ_FAIL_REQUIRE("don't know how to JSON-encode AnyPointer; "
+                      "please register a JsonCodec::Handler for this");
+  }
+}
+
+void JsonCodec::encodeField(StructSchema::Field field, DynamicValue::Reader input,
+                            JsonValue::Builder output) const {
+  KJ_IF_MAYBE(handler, impl->fieldHandlers.find(field)) {
+    (*handler)->encodeBase(*this, input, output);
+    return;
+  }
+
+  encode(input, field.getType(), output);
+}
+
+void JsonCodec::encodeList(DynamicList::Reader input, JsonValue::Builder output) const {
+  auto elementType = input.getSchema().getElementType();
+  HandlerBase* elementHandler = nullptr;
+  KJ_IF_MAYBE(handler, impl->typeHandlers.find(elementType)) {
+    elementHandler = *handler;
+  }
+  encodeList(input, elementHandler,
+      elementHandler == nullptr && elementType.isStruct()
+          ? &getStructPlan(elementType.asStruct()) : nullptr,
+      output);
+}
+
+void JsonCodec::encodeList(DynamicList::Reader input, HandlerBase* elementHandler,
+                           const StructPlan* elementPlan, JsonValue::Builder output) const {
+  auto elementType = input.getSchema().getElementType();
+  auto array = output.initArray(input.size());
+  for (auto i: kj::indices(input)) {
+    if (elementHandler != nullptr) {
+      elementHandler->encodeBase(*this, input[i], array[i]);
+    } else if (elementPlan != nullptr) {
+      encodeStruct(*elementPlan, input[i].as<DynamicStruct>(), array[i]);
+    } else {
+      encodeValue(input[i], elementType, array[i]);
+    }
+  }
+}
+
+void JsonCodec::encodeStruct(const StructPlan& plan, DynamicStruct::Reader structValue,
+                             JsonValue::Builder output) const {
+  auto& nonUnionFields = plan.nonUnionFields;
+
+  KJ_STACK_ARRAY(bool, hasField, nonUnionFields.size(), 32, 128);
+
+  uint fieldCount = 0;
+  for (auto i: kj::indices(nonUnionFields)) {
+    fieldCount += (hasField[i] = structValue.has(nonUnionFields[i]->schema, impl->hasMode));
+  }
+
+  // We try to write the union field, if any, in proper order with the rest.
+  const StructPlan::Field* which = nullptr;
+  bool unionFieldIsNull = false;
+
+  KJ_IF_MAYBE(field, structValue.which()) {
+    // Even if the union field is null, if it is not the default field of the union then we
+    // have to print it anyway.
+    which = &plan.fields[field->getIndex()];
+    unionFieldIsNull = !structValue.has(*field, impl->hasMode);
+    if (field->getProto().getDiscriminantValue() != 0 || !unionFieldIsNull) {
+      ++fieldCount;
+    } else {
+      which = nullptr;
+    }
+  }
 
-      KJ_STACK_ARRAY(bool, hasField, nonUnionFields.size(), 32, 128);
+  auto object = output.initObject(fieldCount);
 
-      uint fieldCount = 0;
-      for (auto i: kj::indices(nonUnionFields)) {
-        fieldCount += (hasField[i] = structValue.has(nonUnionFields[i], impl->hasMode));
+  auto encodeField = [&](const StructPlan::Field& field, JsonValue::Builder output) {
+    auto value = structValue.get(field.schema);
+    if (field.handler != nullptr) {
+      field.handler->encodeBase(*this, value, output);
+    } else if (field.type.isList()) {
+      encodeList(value.as<DynamicList>(), field.elementHandler, field.structPlan, output);
+    } else if (field.structPlan != nullptr) {
+      encodeStruct(*field.structPlan, value.as<DynamicStruct>(), output);
+    } else {
+      encodeValue(value, field.type, output);
+    }
+  };
+
+  size_t pos = 0;
+  for (auto i: kj::indices(nonUnionFields)) {
+    auto& field = *nonUnionFields[i];
+    if (which != nullptr && which->index < field.index) {
+      auto outField = object[pos++];
+      outField.setName(which->name);
+      if (unionFieldIsNull) {
+        outField.initValue().setNull();
+      } else {
+        encodeField(*which, outField.initValue());
       }
+      which = nullptr;
+    }
+    if (hasField[i]) {
+      auto outField = object[pos++];
+      outField.setName(field.name);
+      encodeField(field, outField.initValue());
+    }
+  }
+  if (which != nullptr) {
+    // Union field not printed yet; must be last.
+    auto outField = object[pos++];
+    outField.setName(which->name);
+    if (unionFieldIsNull) {
+      outField.initValue().setNull();
+    } else {
+      encodeField(*which, outField.initValue());
+    }
+  }
+  KJ_ASSERT(pos == fieldCount);
+}
 
-      // We try to write the union field, if any, in proper order with the rest.
-      auto which = structValue.which();
-      bool unionFieldIsNull = false;
+// -----------------------------------------------------------------------------
+
+class JsonCodec::StreamingEncoder {
+  // Produces the same text as encode() does with pretty-printing disabled, one chunk at a time.
+  // Only the path from the root to the value currently being written is kept, as a stack of
+  // frames, plus a chunk of output.
+  //
+  // Values that have a registered handler are converted to a JsonValue one at a time, since
+  // that's what handlers produce; the JsonValue is then streamed like everything else. Struct
+  // types are described by the codec's cached StructPlans.
 
-      KJ_IF_MAYBE(field, which) {
-        // Even if the union field is null, if it is not the default field of the union then we
-        // have to print it anyway.
-        unionFieldIsNull = !structValue.has(*field, impl->hasMode);
-        if (field->getProto().getDiscriminantValue() != 0 || !unionFieldIsNull) {
-          ++fieldCount;
+public:
+  StreamingEncoder(const JsonCodec& codec, DynamicValue::Reader value, Type type)
+      : codec(codec) {
+    buffer.reserve(CHUNK_SIZE + 64);
+    stack.add(RootFrame { value, type });
+  }
+
+  void writeTo(kj::OutputStream& output) {
+    for (;;) {
+      auto chunk = nextChunk();
+      if (chunk.size() == 0) return;
+      output.write(chunk.begin(), chunk.size());
+    }
+  }
+
+  kj::Promise<void> writeTo(kj::AsyncOutputStream& output) {
+    auto chunk = nextChunk();
+    if (chunk.size() == 0) return kj::READY_NOW;
+    return output.write(chunk.begin(), chunk.size()).then([this, &output]() {
+      return writeTo(output);
+    });
+  }
+
+private:
+  static constexpr size_t CHUNK_SIZE = 8192;
+  // Chunks are usually this size. Long strings are split across chunks, but other tokens are
+  // not, so a chunk may run over by one field name or number.
+
+  struct RootFrame {
+    DynamicValue::Reader value;
+    Type type;
+  };
+  struct StructFrame {
+    const StructPlan* plan;
+    DynamicStruct::Reader value;
+    uint index;  // into plan->nonUnionFields
+    const StructPlan::Field* unionField;  // if still to be written
+    bool unionFieldIsNull;
+    bool first;
+  };
+  struct ListFrame {
+    DynamicList::Reader value;
+    Type elementType;
+    HandlerBase* elementHandler;
+    const StructPlan* elementPlan;
+    uint index;
+  };
+  struct DataFrame {
+    Data::Reader value;
+    uint index;
+  };
+  struct TextFrame {
+    kj::ArrayPtr<const char> remaining;
+  };
+  struct JsonArrayFrame {
+    List<JsonValue>::Reader value;
+    uint index;
+    char close;  // ']', or ')' for call parameters
+  };
+  struct JsonObjectFrame {
+    List<JsonValue::Field>::Reader value;
+    uint index;
+  };
+  struct MessageFrame {
+    kj::Own<MallocMessageBuilder> message;
+    // Keeps a handler's JsonValue alive while the frames above it are written.
+  };
+  typedef kj::OneOf<RootFrame, StructFrame, ListFrame, DataFrame, TextFrame,
+                    JsonArrayFrame, JsonObjectFrame, MessageFrame> Frame;
+
+  const JsonCodec& codec;
+  kj::Vector<Frame> stack;
+  kj::Vector<char> buffer;
+
+  kj::ArrayPtr<const byte> nextChunk() {
+    // Returns the next chunk of output, which is only valid until the next call, or an empty
+    // array when done.
+
+    buffer.clear();
+    while (buffer.size() < CHUNK_SIZE && !stack.empty()) {
+      step();
+    }
+    return buffer.asPtr().asBytes();
+  }
+
+  template <typename T>
+  void writeToken(T&& value) {
+    buffer.addAll(kj::toCharSequence(kj::fwd<T>(value)));
+  }
+
+  void writeString(kj::ArrayPtr<const char> chars) {
+    buffer.add('"');
+    escapeJsonChars(chars, buffer);
+    buffer.add('"');
+  }
+
+  void pushText(kj::ArrayPtr<const char> chars) {
+    buffer.add('"');
+    stack.add(TextFrame { chars });
+  }
+
+  // The push*() functions write a value, or start writing it and push a frame to write the rest.
+  // Any frame reference the caller holds is invalid afterwards.
+
+  void pushValue(DynamicValue::Reader value, Type type) {
+    KJ_IF_MAYBE(handler, codec.impl->typeHandlers.find(type)) {
+      pushHandled(**handler, value);
+    } else {
+      pushPlain(value, type);
+    }
+  }
+
+  void pushField(const StructPlan::Field& field, DynamicValue::Reader value) {
+    if (field.handler != nullptr) {
+      pushHandled(*field.handler, value);
+    } else if (field.type.isList()) {
+      pushList(value.as<DynamicList>(), field.elementHandler, field.structPlan);
+    } else if (field.structPlan != nullptr) {
+      pushStruct(*field.structPlan, value.as<DynamicStruct>());
+    } else {
+      pushPlain(value, field.type);
+    }
+  }
+
+  void pushHandled(HandlerBase& handler, DynamicValue::Reader value) {
+    auto message = kj::heap<MallocMessageBuilder>();
+    auto json = message->getRoot<JsonValue>();
+    handler.encodeBase(codec, value, json);
+    stack.add(MessageFrame { kj::mv(message) });
+    pushJson(json.asReader());
+  }
+
+  void pushList(DynamicList::Reader value, HandlerBase* elementHandler,
+                const StructPlan* elementPlan) {
+    buffer.add('[');
+    stack.add(ListFrame {
+      value, value.getSchema().getElementType(), elementHandler, elementPlan, 0
+    });
+  }
+
+  void pushStruct(const StructPlan& plan, DynamicStruct::Reader value) {
+    // As in encode(), the union field is written in order with the rest, and omitted only if
+    // it's the default member and null.
+    const StructPlan::Field* unionField = nullptr;
+    bool unionFieldIsNull = false;
+    KJ_IF_MAYBE(f, value.which()) {
+      unionFieldIsNull = !value.has(*f, codec.impl->hasMode);
+      if (f->getProto().getDiscriminantValue() != 0 || !unionFieldIsNull) {
+        unionField = &plan.fields[f->getIndex()];
+      }
+    }
+
+    buffer.add('{');
+    stack.add(StructFrame { &plan, value, 0, unionField, unionFieldIsNull, true });
+  }
+
+  void pushPlain(DynamicValue::Reader value, Type type) {
+    // Like pushValue(), but for when we already know there's no handler for `type`.
+
+    switch (type.which()) {
+      case schema::Type::VOID:
+        buffer.addAll(kj::StringPtr("null"));
+        break;
+      case schema::Type::BOOL:
+        writeToken(value.as<bool>());
+        break;
+      case schema::Type::INT8:
+      case schema::Type::INT16:
+      case schema::Type::INT32:
+      case schema::Type::UINT8:
+      case schema::Type::UINT16:
+      case schema::Type::UINT32:
+        writeToken(value.as<double>());
+        break;
+      case schema::Type::FLOAT32:
+      case schema::Type::FLOAT64: {
+        double number = value.as<double>();
+        // Inf, -inf and NaN are not allowed in the JSON spec. Storing into string.
+        if (kj::inf() == number) {
+          writeString(kj::StringPtr("Infinity"));
+        } else if (-kj::inf() == number) {
+          writeString(kj::StringPtr("-Infinity"));
+        } else if (kj::isNaN(number)) {
+          writeString(kj::StringPtr("NaN"));
+        } else {
+          writeToken(number);
+        }
+        break;
+      }
+      case schema::Type::INT64:
+        buffer.add('"');
+        writeToken(value.as<int64_t>());
+        buffer.add('"');
+        break;
+      case schema::Type::UINT64:
+        buffer.add('"');
+        writeToken(value.as<uint64_t>());
+        buffer.add('"');
+        break;
+      case schema::Type::TEXT:
+        pushText(value.as<Text>());
+        break;
+      case schema::Type::DATA:
+        buffer.add('[');
+        stack.add(DataFrame { value.as<Data>(), 0 });
+        break;
+      case schema::Type::LIST: {
+        auto elementType = type.asList().getElementType();
+        HandlerBase* elementHandler = nullptr;
+        KJ_IF_MAYBE(handler, codec.impl->typeHandlers.find(elementType)) {
+          elementHandler = *handler;
+        }
+        pushList(value.as<DynamicList>(), elementHandler,
+            elementHandler == nullptr && elementType.isStruct()
+                ? &codec.getStructPlan(elementType.asStruct()) : nullptr);
+        break;
+      }
+      case schema::Type::ENUM: {
+        auto e = value.as<DynamicEnum>();
+        KJ_IF_MAYBE(symbol, e.getEnumerant()) {
+          writeString(symbol->getProto().getName());
         } else {
-          which = nullptr;
+          writeToken(double(e.getRaw()));
         }
+        break;
       }
+      case schema::Type::STRUCT:
+        pushStruct(codec.getStructPlan(type.asStruct()), value.as<DynamicStruct>());
+        break;
+      case schema::Type::INTERFACE:
+        KJ_FAIL_REQUIRE("don't know how to JSON-encode capabilities; "
+                        "please register a JsonCodec::Handler for this");
+      case schema::Type::ANY_POINTER:
+        KJ_FAIL_REQUIRE("don't know how to JSON-encode AnyPointer; "
+                        "please register a JsonCodec::Handler for this");
+    }
+  }
 
-      auto object = output.initObject(fieldCount);
-
-      size_t pos = 0;
-      for (auto i: kj::indices(nonUnionFields)) {
-        auto field = nonUnionFields[i];
-        KJ_IF_MAYBE(unionField, which) {
-          if (unionField->getIndex() < field.getIndex()) {
-            auto outField = object[pos++];
-            outField.setName(unionField->getProto().getName());
-            if (unionFieldIsNull) {
-              outField.initValue().setNull();
-            } else {
-              encodeField(*unionField, structValue.get(*unionField), outField.initValue());
-            }
-            which = nullptr;
+  void pushJson(JsonValue::Reader value) {
+    switch (value.which()) {
+      case JsonValue::NULL_:
+        buffer.addAll(kj::StringPtr("null"));
+        break;
+      case JsonValue::BOOLEAN:
+        writeToken(value.getBoolean());
+        break;
+      case JsonValue::NUMBER:
+        writeToken(value.getNumber());
+        break;
+      case JsonValue::STRING:
+        pushText(value.getString());
+        break;
+      case JsonValue::ARRAY:
+        buffer.add('[');
+        stack.add(JsonArrayFrame { value.getArray(), 0, ']' });
+        break;
+      case JsonValue::OBJECT:
+        buffer.add('{');
+        stack.add(JsonObjectFrame { value.getObject(), 0 });
+        break;
+      case JsonValue::CALL: {
+        auto call = value.getCall();
+        buffer.addAll(call.getFunction());
+        buffer.add('(');
+        stack.add(JsonArrayFrame { call.getParams(), 0, ')' });
+        break;
+      }
+      default:
+        KJ_FAIL_ASSERT("unknown JsonValue type", static_cast<uint>(value.which()));
+    }
+  }
+
+  void step() {
+    // Writes the next piece of the value on top of the stack. Each case must finish with its
+    // frame before pushing another, since that may move the stack.
+
+    KJ_SWITCH_ONEOF(stack.back()) {
+      KJ_CASE_ONEOF(frame, RootFrame) {
+        auto value = frame.value;
+        auto type = frame.type;
+        stack.removeLast();
+        pushValue(value, type);
+        return;
+      }
+      KJ_CASE_ONEOF(frame, StructFrame) {
+        auto& fields = frame.plan->nonUnionFields;
+        for (;;) {
+          const StructPlan::Field* next = nullptr;
+          bool isUnionField = false;
+          if (frame.unionField != nullptr &&
+              (frame.index == fields.size() || frame.unionField->index < fields[frame.index]->index)) {
+            next = frame.unionField;
+            isUnionField = true;
+            frame.unionField = nullptr;
+          } else if (frame.index == fields.size()) {
+            buffer.add('}');
+            stack.removeLast();
+            return;
+          } else {
+            next = fields[frame.index++];
+            if (!frame.value.has(next->schema, codec.impl->hasMode)) continue;
           }
-        }
-        if (hasField[i]) {
-          auto outField = object[pos++];
-          outField.setName(field.getProto().getName());
-          encodeField(field, structValue.get(field), outField.initValue());
+
+          if (!frame.first) buffer.add(',');
+          frame.first = false;
+          buffer.addAll(next->quotedName);
+          buffer.add(':');
+          if (isUnionField && frame.unionFieldIsNull) {
+            buffer.addAll(kj::StringPtr("null"));
+          } else {
+            pushField(*next, frame.value.get(next->schema));
+          }
+          return;
         }
       }
-      if (which != nullptr) {
-        // Union field not printed yet; must be last.
-        auto unionField = KJ_ASSERT_NONNULL(which);
-        auto outField = object[pos++];
-        outField.setName(unionField.getProto().getName());
-        if (unionFieldIsNull) {
-          outField.initValue().setNull();
+      KJ_CASE_ONEOF(frame, ListFrame) {
+        if (frame.index == frame.value.size()) {
+          buffer.add(']');
+          stack.removeLast();
+          return;
+        }
+        if (frame.index > 0) buffer.add(',');
+        auto element = frame.value[frame.index++];
+        if (frame.elementHandler != nullptr) {
+          pushHandled(*frame.elementHandler, element);
+        } else if (frame.elementPlan != nullptr) {
+          pushStruct(*frame.elementPlan, element.as<DynamicStruct>());
         } else {
-          encodeField(unionField, structValue.get(unionField), outField.initValue());
+          pushPlain(element, frame.elementType);
         }
+        return;
+      }
+      KJ_CASE_ONEOF(frame, DataFrame) {
+        // Bytes are written as an array of numbers, several per step.
+        auto end = kj::min(frame.value.size(), frame.index + 64);
+        for (; frame.index < end; ++frame.index) {
+          if (frame.index > 0) buffer.add(',');
+          writeToken(double(frame.value[frame.index]));
+        }
+        if (frame.index == frame.value.size()) {
+          buffer.add(']');
+          stack.removeLast();
+        }
+        return;
+      }
+      KJ_CASE_ONEOF(frame, TextFrame) {
+        auto n = kj::min(frame.remaining.size(), CHUNK_SIZE - kj::min(buffer.size(), CHUNK_SIZE));
+        escapeJsonChars(frame.remaining.slice(0, n), buffer);
+        frame.remaining = frame.remaining.slice(n, frame.remaining.size());
+        if (frame.remaining.size() == 0) {
+          buffer.add('"');
+          stack.removeLast();
+        }
+        return;
+      }
+      KJ_CASE_ONEOF(frame, JsonArrayFrame) {
+        if (frame.index == frame.value.size()) {
+          buffer.add(frame.close);
+          stack.removeLast();
+          return;
+        }
+        if (frame.index > 0) buffer.add(',');
+        auto element = frame.value[frame.index++];
+        pushJson(element);
+        return;
+      }
+      KJ_CASE_ONEOF(frame, JsonObjectFrame) {
+        if (frame.index == frame.value.size()) {
+          buffer.add('}');
+          stack.removeLast();
+          return;
+        }
+        if (frame.index > 0) buffer.add(',');
+        auto field = frame.value[frame.index++];
+        writeString(field.getName());
+        buffer.add(':');
+        pushJson(field.getValue());
+        return;
+      }
+      KJ_CASE_ONEOF(frame, MessageFrame) {
+        stack.removeLast();
+        return;
       }
-      KJ_ASSERT(pos == fieldCount);
-      break;
     }
-    case schema::Type::INTERFACE:
-      KJ_FAIL_REQUIRE("don't know how to JSON-encode capabilities; "
-                      "please register a JsonCodec::Handler for this");
-    case schema::Type::ANY_POINTER:
-      KJ_FAIL_REQUIRE("don't know how to JSON-encode AnyPointer; "
-                      "please register a JsonCodec::Handler for this");
   }
-}
+};
 
-void JsonCodec::encodeField(StructSchema::Field field, DynamicValue::Reader input,
-                            JsonValue::Builder output) const {
-  KJ_IF_MAYBE(handler, impl->fieldHandlers.find(field)) {
-    (*handler)->encodeBase(*this, input, output);
-    return;
-  }
+void JsonCodec::encode(DynamicValue::Reader value, Type type, kj::OutputStream& output) const {
+  StreamingEncoder(*this, value, type).writeTo(output);
+}
 
-  encode(input, field.getType(), output);
+kj::Promise<void> JsonCodec::encode(
+    DynamicValue::Reader value, Type type, kj::AsyncOutputStream& output) const {
+  return kj::evalNow([&]() {
+    auto encoder = kj::heap<StreamingEncoder>(*this, value, type);
+    auto promise = encoder->writeTo(output);
+    return promise.attach(kj::mv(encoder));
+  });
 }
 
 Orphan<DynamicList> JsonCodec::decodeArray(List<JsonValue>::Reader input, ListSchema type, Orphanage orphanage) const {
@@ -526,6 +1076,28 @@ Orphan<DynamicValue> JsonCodec::decode(
 
 namespace {
 
+const char* findStringSpecial(const char* pos, const char* end) {
+  // Returns the first quote, backslash, or NUL at or after `pos`, or `end` if there is none.
+  // String bodies make up most of the bytes in typical JSON, so we test eight bytes at a time
+  // and only fall back to a bytewise scan for the word containing the match.
+
+  constexpr uint64_t ONES = 0x0101010101010101ull;
+  constexpr uint64_t HIGHS = 0x8080808080808080ull;
+  auto hasZeroByte = [](uint64_t x) { return (x - ONES) & ~x & HIGHS; };
+
+  while (end - pos >= 8) {
+    uint64_t word;
+    memcpy(&word, pos, sizeof(word));
+    if (hasZeroByte(word) | hasZeroByte(word ^ (ONES * '"')) | hasZeroByte(word ^ (ONES * '\\'))) {
+      break;
+    }
+    pos += 8;
+  }
+
+  while (pos < end && *pos != '"' && *pos != '\\' && *pos != '\0') ++pos;
+  return pos;
+}
+
 class Input {
 public:
   Input(kj::ArrayPtr<const char> input) : wrapped(input) {}
@@ -606,16 +1178,69 @@ public:
   }
 
   void consumeWhitespace() {
-    consumeWhile([](char chr) {
-      return (
-        chr == ' '  ||
-        chr == '\n' ||
-        chr == '\r' ||
-        chr == '\t'
-      );
-    });
+    auto pos = wrapped.begin();
+    while (pos < wrapped.end() && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+      ++pos;
+    }
+    wrapped = kj::arrayPtr(pos, wrapped.end());
+  }
+
+  kj::ArrayPtr<const char> consumeStringRun() {
+    // Consumes string content up to the next quote, backslash, or end of input.
+    auto originalPos = wrapped.begin();
+    wrapped = kj::arrayPtr(findStringSpecial(wrapped.begin(), wrapped.end()), wrapped.end());
+
+    return kj::arrayPtr(originalPos, wrapped.begin());
   }
 
+  size_t countArrayElements() {
+    // Counts the elements of the array that starts at the current position, without consuming
+    // anything. Only structural characters are examined; the input is validated when the
+    // elements are actually parsed, which also makes the count exact whenever that parse
+    // succeeds.
+
+    KJ_REQUIRE(nextChar() == '[', "Unexpected input in JSON message.");
+
+    size_t depth = 0;
+    size_t commas = 0;
+    bool empty = true;
+    auto pos = wrapped.begin() + 1;
+    auto end = wrapped.end();
+
+    while (pos < end) {
+      switch (*pos++) {
+        case ' ': case '\n': case '\r': case '\t':
+          break;
+        case '"':
+          empty = false;
+          for (;;) {
+            pos = findStringSpecial(pos, end);
+            if (pos == end || *pos == '\0') return commas + 1;  // unterminated; parse will fail.
+            if (*pos++ == '"') break;
+            if (pos < end) ++pos;  // skip escaped character
+          }
+          break;
+        case '[': case '{':
+          empty = false;
+          ++depth;
+          break;
+        case ']': case '}':
+          if (depth == 0) return empty ? 0 : commas + 1;
+          --depth;
+          break;
+        case ',':
+          if (depth == 0) ++commas;
+          break;
+        case '\0':
+          return commas + 1;
+        default:
+          empty = false;
+          break;
+      }
+    }
+
+    return commas + 1;
+  }
 
 private:
   kj::ArrayPtr<const char> wrapped;
@@ -647,12 +1272,34 @@ public:
     }
   }
 
+  void skipValue() {
+    // Like parseValue(), but discards the value after validating it.
+
+    input.consumeWhitespace();
+    KJ_DEFER(input.consumeWhitespace());
+
+    KJ_REQUIRE(!input.exhausted(), "JSON message ends prematurely.");
+
+    switch (input.nextChar()) {
+      case 'n': input.consume(kj::StringPtr("null"));  break;
+      case 'f': input.consume(kj::StringPtr("false")); break;
+      case 't': input.consume(kj::StringPtr("true"));  break;
+      case '"': consumeString(); break;
+      case '[': parseArrayElements([this]() { skipValue(); }); break;
+      case '{': parseObjectFields([this](kj::StringPtr) { skipValue(); }); break;
+      case '-': case '0': case '1': case '2': case '3':
+      case '4': case '5': case '6': case '7': case '8':
+      case '9': consumeNumber(); break;
+      default: KJ_FAIL_REQUIRE("Unexpected input in JSON message.");
+    }
+  }
+
   void parseNumber(JsonValue::Builder& output) {
     output.setNumber(consumeNumber().parseAs<double>());
   }
 
   void parseString(JsonValue::Builder& output) {
-    output.setString(consumeQuotedString());
+    output.setString(consumeString());
   }
 
   void parseArray(JsonValue::Builder& output) {
@@ -661,6 +1308,49 @@ public:
     // Cap'n Proto message.  This also applies to parseObject below.
     kj::Vector<Orphan<JsonValue>> values;
     auto orphanage = Orphanage::getForMessageContaining(output);
+
+    parseArrayElements([&]() {
+      auto orphan = orphanage.newOrphan<JsonValue>();
+      auto builder = orphan.get();
+      parseValue(builder);
+      values.add(kj::mv(orphan));
+    });
+
+    output.initArray(values.size());
+    auto array = output.getArray();
+
+    for (auto i : kj::indices(values)) {
+      array.adoptWithCaveats(i, kj::mv(values[i]));
+    }
+  }
+
+  void parseObject(JsonValue::Builder& output) {
+    kj::Vector<Orphan<JsonValue::Field>> fields;
+    auto orphanage = Orphanage::getForMessageContaining(output);
+
+    parseObjectFields([&](kj::StringPtr name) {
+      auto orphan = orphanage.newOrphan<JsonValue::Field>();
+      auto builder = orphan.get();
+      builder.setName(name);
+
+      auto valueBuilder = builder.getValue();
+      parseValue(valueBuilder);
+
+      fields.add(kj::mv(orphan));
+    });
+
+    output.initObject(fields.size());
+    auto object = output.getObject();
+
+    for (auto i : kj::indices(fields)) {
+      object.adoptWithCaveats(i, kj::mv(fields[i]));
+    }
+  }
+
+  template <typename Func>  // Function<void()>
+  void parseArrayElements(Func&& func) {
+    // Parses the array at the current position, calling `func` to consume each element.
+
     bool expectComma = false;
 
     input.consume('[');
@@ -668,34 +1358,24 @@ public:
     KJ_DEFER(--nestingDepth);
 
     while (input.consumeWhitespace(), input.nextChar() != ']') {
-      auto orphan = orphanage.newOrphan<JsonValue>();
-      auto builder = orphan.get();
-
       if (expectComma) {
-        input.consumeWhitespace();
         input.consume(',');
         input.consumeWhitespace();
       }
 
-      parseValue(builder);
-      values.add(kj::mv(orphan));
+      func();
 
       expectComma = true;
     }
 
-    output.initArray(values.size());
-    auto array = output.getArray();
-
-    for (auto i : kj::indices(values)) {
-      array.adoptWithCaveats(i, kj::mv(values[i]));
-    }
-
     input.consume(']');
   }
 
-  void parseObject(JsonValue::Builder& output) {
-    kj::Vector<Orphan<JsonValue::Field>> fields;
-    auto orphanage = Orphanage::getForMessageContaining(output);
+  template <typename Func>  // Function<void(kj::StringPtr name)>
+  void parseObjectFields(Func&& func) {
+    // Parses the object at the current position, calling `func` to consume each field's value.
+    // `name` is only valid until `func` consumes the value.
+
     bool expectComma = false;
 
     input.consume('{');
@@ -703,84 +1383,80 @@ public:
     KJ_DEFER(--nestingDepth);
 
     while (input.consumeWhitespace(), input.nextChar() != '}') {
-      auto orphan = orphanage.newOrphan<JsonValue::Field>();
-      auto builder = orphan.get();
-
       if (expectComma) {
-        input.consumeWhitespace();
         input.consume(',');
         input.consumeWhitespace();
       }
 
-      builder.setName(consumeQuotedString());
+      auto name = consumeString();
 
       input.consumeWhitespace();
       input.consume(':');
       input.consumeWhitespace();
 
-      auto valueBuilder = builder.getValue();
-      parseValue(valueBuilder);
-
-      fields.add(kj::mv(orphan));
+      func(name);
 
       expectComma = true;
     }
 
-    output.initObject(fields.size());
-    auto object = output.getObject();
-
-    for (auto i : kj::indices(fields)) {
-      object.adoptWithCaveats(i, kj::mv(fields[i]));
-    }
-
     input.consume('}');
   }
 
-  bool inputExhausted() { return input.exhausted(); }
+  char peek() {
+    // Returns the first character of the next value, skipping whitespace.
+    input.consumeWhitespace();
+    return input.nextChar();
+  }
 
-private:
-  kj::String consumeQuotedString() {
-    input.consume('"');
-    // TODO(perf): Avoid copy / alloc if no escapes encountered.
-    // TODO(perf): Get statistics on string size and preallocate?
-    kj::Vector<char> decoded;
+  void consumeLiteral(kj::StringPtr literal) {
+    input.consumeWhitespace();
+    input.consume(literal);
+  }
 
-    do {
-      auto stringValue = input.consumeWhile([](const char chr) {
-          return chr != '"' && chr != '\\';
-      });
+  size_t countArrayElements() {
+    input.consumeWhitespace();
+    return input.countArrayElements();
+  }
 
-      decoded.addAll(stringValue);
-
-      if (input.nextChar() == '\\') {  // handle escapes.
-        input.advance();
-        switch(input.nextChar()) {
-          case '"' : decoded.add('"' ); input.advance(); break;
-          case '\\': decoded.add('\\'); input.advance(); break;
-          case '/' : decoded.add('/' ); input.advance(); break;
-          case 'b' : decoded.add('\b'); input.advance(); break;
-          case 'f' : decoded.add('\f'); input.advance(); break;
-          case 'n' : decoded.add('\n'); input.advance(); break;
-          case 'r' : decoded.add('\r'); input.advance(); break;
-          case 't' : decoded.add('\t'); input.advance(); break;
-          case 'u' :
-            input.consume('u');
-            unescapeAndAppend(input.consume(size_t(4)), decoded);
-            break;
-          default: KJ_FAIL_REQUIRE("Invalid escape in JSON string."); break;
-        }
-      }
+  kj::StringPtr consumeString() {
+    // Consumes a quoted string and returns its unescaped content. The result points into a
+    // scratch buffer, so it's only valid until the next string or number is consumed.
 
-    } while(input.nextChar() != '"');
+    input.consume('"');
+    scratch.clear();
+
+    for (;;) {
+      scratch.addAll(input.consumeStringRun());
+
+      if (input.nextChar() == '"') break;
+
+      input.advance();  // backslash
+      switch(input.nextChar()) {
+        case '"' : scratch.add('"' ); input.advance(); break;
+        case '\\': scratch.add('\\'); input.advance(); break;
+        case '/' : scratch.add('/' ); input.advance(); break;
+        case 'b' : scratch.add('\b'); input.advance(); break;
+        case 'f' : scratch.add('\f'); input.advance(); break;
+        case 'n' : scratch.add('\n'); input.advance(); break;
+        case 'r' : scratch.add('\r'); input.advance(); break;
+        case 't' : scratch.add('\t'); input.advance(); break;
+        case 'u' :
+          input.consume('u');
+          unescapeAndAppend(input.consume(size_t(4)), scratch);
+          break;
+        default: KJ_FAIL_REQUIRE("Invalid escape in JSON string."); break;
+      }
+    }
 
     input.consume('"');
-    decoded.add('\0');
+    scratch.add('\0');
 
-    // TODO(perf): This copy can be eliminated, but I can't find the kj::wayToDoIt();
-    return kj::String(decoded.releaseAsArray());
+    return kj::StringPtr(scratch.begin(), scratch.size() - 1);
   }
 
-  kj::String consumeNumber() {
+  kj::StringPtr consumeNumber() {
+    // Like consumeString(), the result is only valid until the next string or number.
+
     auto numArrayPtr = input.consumeCustom([](Input& input) {
       input.tryConsume('-');
       if (!input.tryConsume('0')) {
@@ -800,13 +1476,21 @@ private:
 
     KJ_REQUIRE(numArrayPtr.size() > 0, "Expected number in JSON input.");
 
-    kj::Vector<char> number;
-    number.addAll(numArrayPtr);
-    number.add('\0');
+    scratch.clear();
+    scratch.addAll(numArrayPtr);
+    scratch.add('\0');
+
+    return kj::StringPtr(scratch.begin(), scratch.size() - 1);
+  }
 
-    return kj::String(number.releaseAsArray());
+  void finish() {
+    input.consumeWhitespace();
+    KJ_REQUIRE(input.exhausted(), "Input remains after parsing JSON.");
   }
 
+  bool inputExhausted() { return input.exhausted(); }
+
+private:
   // TODO(someday): This "interface" is ugly, and won't work if/when surrogates are handled.
   void unescapeAndAppend(kj::ArrayPtr<const char> hex, kj::Vector<char>& target) {
     KJ_REQUIRE(hex.size() == 4);
@@ -840,11 +1524,302 @@ private:
   Input input;
   size_t nestingDepth;
 
+  kj::Vector<char> scratch;
+  // Holds the most recently consumed string or number, so that consuming one doesn't allocate.
 
 };  // class Parser
 
 }  // namespace
 
+class JsonCodec::DirectDecoder {
+  // Decodes JSON text straight into Cap'n Proto builders, without first building a JsonValue
+  // tree. Values which have a registered handler, or whose type has no default decoding, are
+  // still parsed into a JsonValue, since that's what handlers consume; the result is then decoded
+  // exactly as decode(JsonValue::Reader, ...) would.
+
+public:
+  DirectDecoder(const JsonCodec& codec, kj::ArrayPtr<const char> input)
+      : codec(codec), parser(codec.impl->maxNestingDepth, input) {}
+
+  void decodeRoot(DynamicStruct::Builder output) {
+    decodeObject(codec.getStructPlan(output.getSchema()), output);
+    parser.finish();
+  }
+
+  Orphan<DynamicValue> decodeRoot(Type type, Orphanage orphanage) {
+    if (!needsJsonValue(type)) {
+      switch (type.which()) {
+        case schema::Type::STRUCT: {
+          auto orphan = orphanage.newOrphan(type.asStruct());
+          decodeObject(codec.getStructPlan(type.asStruct()), orphan.get());
+          parser.finish();
+          return kj::mv(orphan);
+        }
+        case schema::Type::LIST:
+          if (parser.peek() == '[') {
+            auto orphan = orphanage.newOrphan(type.asList(), parser.countArrayElements());
+            decodeElements(orphan.get());
+            parser.finish();
+            return kj::mv(orphan);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    MallocMessageBuilder message;
+    auto json = message.getRoot<JsonValue>();
+    parser.parseValue(json);
+    parser.finish();
+    return codec.decode(json, type, orphanage);
+  }
+
+private:
+  const JsonCodec& codec;
+  Parser parser;
+
+  bool needsJsonValue(Type type) {
+    return codec.impl->typeHandlers.find(type) != nullptr || !hasDefaultDecoding(type);
+  }
+
+  static bool hasDefaultDecoding(Type type) {
+    switch (type.which()) {
+      case schema::Type::INTERFACE:
+      case schema::Type::ANY_POINTER:
+        // Let decode() report the error.
+        return false;
+      default:
+        return true;
+    }
+  }
+
+  void decodeObject(const StructPlan& plan, DynamicStruct::Builder output) {
+    if (parser.peek() != '{') {
+      KJ_FAIL_REQUIRE("Expected object value") { parser.skipValue(); return; }
+    }
+
+    auto type = output.getSchema();
+    parser.parseObjectFields([&](kj::StringPtr name) {
+      KJ_IF_MAYBE(fieldSchema, type.findFieldByName(name)) {
+        decodeField(plan.fields[fieldSchema->getIndex()], output);
+      } else {
+        KJ_REQUIRE(!codec.impl->rejectUnknownFields, "Unknown field", name);
+        parser.skipValue();
+      }
+    });
+  }
+
+  void decodeField(const StructPlan::Field& plan, DynamicStruct::Builder output) {
+    auto field = plan.schema;
+    auto type = plan.type;
+
+    if (plan.handler != nullptr || !hasDefaultDecoding(type)) {
+      MallocMessageBuilder message;
+      auto json = message.getRoot<JsonValue>();
+      parser.parseValue(json);
+      codec.decodeField(field, json, Orphanage::getForMessageContaining(output), output);
+      return;
+    }
+
+    switch (type.which()) {
+      case schema::Type::STRUCT:
+        decodeObject(*plan.structPlan, output.init(field).as<DynamicStruct>());
+        break;
+      case schema::Type::LIST:
+        if (parser.peek() != '[') {
+          KJ_FAIL_REQUIRE("Expected list value") { break; }
+          parser.skipValue();
+          output.init(field, 0);
+          break;
+        }
+        decodeElements(output.init(field, parser.countArrayElements()).as<DynamicList>(),
+                       plan.elementHandler, plan.structPlan);
+        break;
+      case schema::Type::DATA:
+        KJ_REQUIRE(parser.peek() == '[', "Expected data value");
+        decodeBytes(output.init(field, parser.countArrayElements()).as<Data>());
+        break;
+      default:
+        output.set(field, decodeScalar(type));
+        break;
+    }
+  }
+
+  void decodeElements(DynamicList::Builder output) {
+    auto elementType = output.getSchema().getElementType();
+    HandlerBase* elementHandler = nullptr;
+    KJ_IF_MAYBE(handler, codec.impl->typeHandlers.find(elementType)) {
+      elementHandler = *handler;
+    }
+    decodeElements(output, elementHandler,
+        elementHandler == nullptr && elementType.isStruct()
+            ? &codec.getStructPlan(elementType.asStruct()) : nullptr);
+  }
+
+  void decodeElements(DynamicList::Builder output, HandlerBase* elementHandler,
+                      const StructPlan* elementPlan) {
+    auto elementType = output.getSchema().getElementType();
+    bool viaJsonValue = elementHandler != nullptr || !hasDefaultDecoding(elementType);
+    uint i = 0;
+
+    parser.parseArrayElements([&]() {
+      KJ_ASSERT(i < output.size());
+
+      if (viaJsonValue) {
+        MallocMessageBuilder message;
+        auto json = message.getRoot<JsonValue>();
+        parser.parseValue(json);
+        output.adopt(i, codec.decode(
+            json, elementType, Orphanage::getForMessageContaining(output)));
+      } else {
+        switch (elementType.which()) {
+          case schema::Type::STRUCT:
+            decodeObject(*elementPlan, output[i].as<DynamicStruct>());
+            break;
+          case schema::Type::LIST:
+            if (parser.peek() != '[') {
+              KJ_FAIL_REQUIRE("Expected list value") { break; }
+              parser.skipValue();
+              break;
+            }
+            decodeElements(output.init(i, parser.countArrayElements()).as<DynamicList>());
+            break;
+          case schema::Type::DATA:
+            KJ_REQUIRE(parser.peek() == '[', "Expected data value");
+            decodeBytes(output.init(i, parser.countArrayElements()).as<Data>());
+            break;
+          default:
+            output.set(i, decodeScalar(elementType));
+            break;
+        }
+      }
+
+      ++i;
+    });
+
+    KJ_ASSERT(i == output.size());
+  }
+
+  void decodeBytes(Data::Builder output) {
+    uint i = 0;
+
+    parser.parseArrayElements([&]() {
+      KJ_ASSERT(i < output.size());
+      auto x = decodeNumber();
+      KJ_REQUIRE(byte(x) == x, "Number in byte array is not an integer in [0, 255]");
+      output[i++] = x;
+    });
+
+    KJ_ASSERT(i == output.size());
+  }
+
+  double decodeNumber() {
+    switch (parser.peek()) {
+      case '-': case '0': case '1': case '2': case '3':
+      case '4': case '5': case '6': case '7': case '8':
+      case '9':
+        return parser.consumeNumber().parseAs<double>();
+      default:
+        KJ_FAIL_REQUIRE("Expected number value");
+    }
+
+    KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
+  }
+
+  DynamicValue::Reader decodeScalar(Type type) {
+    // Decodes any non-pointer type, or Text. Follows decode(JsonValue::Reader, Type, Orphanage).
+    // A returned Text points into the parser's scratch space and must be used immediately.
+
+    switch (type.which()) {
+      case schema::Type::VOID:
+        parser.skipValue();
+        return capnp::VOID;
+      case schema::Type::BOOL:
+        switch (parser.peek()) {
+          case 't': parser.consumeLiteral("true"); return true;
+          case 'f': parser.consumeLiteral("false"); return false;
+          default:
+            KJ_FAIL_REQUIRE("Expected boolean value");
+        }
+      case schema::Type::INT8:
+      case schema::Type::INT16:
+      case schema::Type::INT32:
+      case schema::Type::INT64:
+        // Relies on range check in DynamicValue::Reader::as<IntType>
+        switch (parser.peek()) {
+          case '"':
+            return parser.consumeString().parseAs<int64_t>();
+          case '-': case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7': case '8':
+          case '9':
+            return parser.consumeNumber().parseAs<double>();
+          default:
+            KJ_FAIL_REQUIRE("Expected integer value");
+        }
+      case schema::Type::UINT8:
+      case schema::Type::UINT16:
+      case schema::Type::UINT32:
+      case schema::Type::UINT64:
+        // Relies on range check in DynamicValue::Reader::as<IntType>
+        switch (parser.peek()) {
+          case '"':
+            return parser.consumeString().parseAs<uint64_t>();
+          case '-': case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7': case '8':
+          case '9':
+            return parser.consumeNumber().parseAs<double>();
+          default:
+            KJ_FAIL_REQUIRE("Expected integer value");
+        }
+      case schema::Type::FLOAT32:
+      case schema::Type::FLOAT64:
+        switch (parser.peek()) {
+          case 'n':
+            parser.consumeLiteral("null");
+            return kj::nan();
+          case '"':
+            return parser.consumeString().parseAs<double>();
+          case '-': case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7': case '8':
+          case '9':
+            return parser.consumeNumber().parseAs<double>();
+          default:
+            KJ_FAIL_REQUIRE("Expected float value");
+        }
+      case schema::Type::TEXT:
+        KJ_REQUIRE(parser.peek() == '"', "Expected text value");
+        return Text::Reader(parser.consumeString());
+      case schema::Type::ENUM:
+        if (parser.peek() != '"') {
+          KJ_FAIL_REQUIRE("Expected enum value") { break; }
+          parser.skipValue();
+          return DynamicEnum(type.asEnum(), 0);
+        }
+        return DynamicEnum(type.asEnum().getEnumerantByName(parser.consumeString()));
+      default:
+        break;
+    }
+
+    KJ_FAIL_ASSERT("not a scalar type", type.which());
+  }
+};
+
+void JsonCodec::decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const {
+  if (impl->typeHandlers.find(output.getSchema()) != nullptr) {
+    MallocMessageBuilder message;
+    auto json = message.getRoot<JsonValue>();
+    decodeRaw(input, json);
+    decode(json, output);
+  } else {
+    DirectDecoder(*this, input).decodeRoot(output);
+  }
+}
+
+Orphan<DynamicValue> JsonCodec::decode(
+    kj::ArrayPtr<const char> input, Type type, Orphanage orphanage) const {
+  return DirectDecoder(*this, input).decodeRoot(type, orphanage);
+}
 
 void JsonCodec::decodeRaw(kj::ArrayPtr<const char> input, JsonValue::Builder output) const {
   Parser parser(impl->maxNestingDepth, input);
@@ -865,6 +1840,7 @@ void JsonCodec::HandlerBase::decodeStructBase(
 }
 
 void JsonCodec::addTypeHandlerImpl(Type type, HandlerBase& handler) {
+  impl->plans.getWithoutLock().clear();
   impl->typeHandlers.upsert(type, &handler, [](HandlerBase*& existing, HandlerBase* replacement) {
     KJ_REQUIRE(existing == replacement, "type already has a different registered handler");
   });
@@ -873,6 +1849,7 @@ void JsonCodec::addTypeHandlerImpl(Type type, HandlerBase& handler) {
 void JsonCodec::addFieldHandlerImpl(StructSchema::Field field, Type type, HandlerBase& handler) {
   KJ_REQUIRE(type == field.getType(),
       "handler type did not match field type for addFieldHandler()");
+  impl->plans.getWithoutLock().clear();
   impl->fieldHandlers.upsert(field, &handler, [](HandlerBase*& existing, HandlerBase* replacement) {
     KJ_REQUIRE(existing == replacement, "field already has a different registered handler");
   });
@@ -579,6 +579,46 @@ const ::capnp::_::RawSchema s_a0a054dea32fd98c = {
   0, 0, nullptr, nullptr, nullptr, { &s_a0a054dea32fd98c, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_8ef99297a43a5e34[] = {
+  nullptr,
+  &s_f061e22f0ae5c7b5,
+  &s_c4df13257bc2ea61,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_c2f8c20c293e5319,
+  nullptr,
+  &s_fa5b1fd61c2e7c3d,
+  &s_82d3e852af0336bf,
+  nullptr,
+  nullptr,
+  &s_e31026e735d69ddf,
+  &s_a0a054dea32fd98c,
+  nullptr,
+  nullptr,
+  &s_d7d879450a253e4b,
+  nullptr,
+  &s_a0d9f6eca1c93d48,
+  &s_a3fa7845f919dd83,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_cfa794e8d19a0162,
+};
+static const uint32_t xh_8ef99297a43a5e34[] = {0, 1, 1, 1, 1, 1, 2, 1};
+const ::capnp::_::RawSchemaIndex x_8ef99297a43a5e34 = {
+  xs_8ef99297a43a5e34, xh_8ef99297a43a5e34, 32, 8, 11
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
@@ -30,6 +30,7 @@ CAPNP_DECLARE_SCHEMA(c2f8c20c293e5319);
 CAPNP_DECLARE_SCHEMA(d7d879450a253e4b);
 CAPNP_DECLARE_SCHEMA(f061e22f0ae5c7b5);
 CAPNP_DECLARE_SCHEMA(a0a054dea32fd98c);
+CAPNP_DECLARE_SCHEMA_INDEX(8ef99297a43a5e34);
 
 }  // namespace schemas
 }  // namespace capnp
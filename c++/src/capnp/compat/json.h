@@ -25,6 +25,8 @@
 #include "capnp/dynamic.h"
 #include "capnp/compat/json.capnp.h"
 
+namespace kj { class OutputStream; class AsyncOutputStream; }
+
 namespace capnp {
 
 typedef json::Value JsonValue;
@@ -98,6 +100,21 @@ public:
   // not distinguish between e.g. int32 and int64, which in JSON are handled differently. Most
   // of the time, though, you can use the single-argument templated version of `encode()` instead.
 
+  template <typename T>
+  void encode(T&& value, kj::OutputStream& output) const;
+  template <typename T>
+  kj::Promise<void> encode(T&& value, kj::AsyncOutputStream& output) const;
+  void encode(DynamicValue::Reader value, Type type, kj::OutputStream& output) const;
+  kj::Promise<void> encode(
+      DynamicValue::Reader value, Type type, kj::AsyncOutputStream& output) const;
+  // Encode to JSON incrementally, writing the text to `output` in chunks of a few kilobytes
+  // rather than building it all in memory first. Memory use is proportional to the nesting depth
+  // of the value, not its size. For the async version, `value` (and its message) must remain
+  // valid until the returned promise resolves.
+  //
+  // The output is the same as encode() produces with pretty-printing disabled. Pretty-printing
+  // is ignored here, since laying out a list requires seeing all of its elements first.
+
   void decode(kj::ArrayPtr<const char> input, DynamicStruct::Builder output) const;
   // Decode JSON text directly into a struct builder. This only works for structs since lists
   // need to be allocated with the correct size in advance.
@@ -237,12 +254,23 @@ private:
   class Base64Handler;
   class HexHandler;
   class JsonValueHandler;
+  class DirectDecoder;
+  class StreamingEncoder;
   struct Impl;
 
   kj::Own<Impl> impl;
 
+  struct StructPlan;
+  const StructPlan& getStructPlan(StructSchema type) const;
+
+  void encodeValue(DynamicValue::Reader input, Type type, JsonValue::Builder output) const;
   void encodeField(StructSchema::Field field, DynamicValue::Reader input,
                    JsonValue::Builder output) const;
+  void encodeList(DynamicList::Reader input, JsonValue::Builder output) const;
+  void encodeList(DynamicList::Reader input, HandlerBase* elementHandler,
+                  const StructPlan* elementPlan, JsonValue::Builder output) const;
+  void encodeStruct(const StructPlan& plan, DynamicStruct::Reader input,
+                    JsonValue::Builder output) const;
   Orphan<DynamicList> decodeArray(List<JsonValue>::Reader input, ListSchema type, Orphanage orphanage) const;
   void decodeObject(JsonValue::Reader input, StructSchema type, Orphanage orphanage, DynamicStruct::Builder output) const;
   void decodeField(StructSchema::Field fieldSchema, JsonValue::Reader fieldValue,
@@ -270,6 +298,20 @@ kj::String JsonCodec::encode(T&& value) const {
   return encode(DynamicValue::Reader(ReaderFor<Base>(kj::fwd<T>(value))), type);
 }
 
+template <typename T>
+void JsonCodec::encode(T&& value, kj::OutputStream& output) const {
+  Type type = Type::from(value);
+  typedef FromAny<kj::Decay<T>> Base;
+  encode(DynamicValue::Reader(ReaderFor<Base>(kj::fwd<T>(value))), type, output);
+}
+
+template <typename T>
+kj::Promise<void> JsonCodec::encode(T&& value, kj::AsyncOutputStream& output) const {
+  Type type = Type::from(value);
+  typedef FromAny<kj::Decay<T>> Base;
+  return encode(DynamicValue::Reader(ReaderFor<Base>(kj::fwd<T>(value))), type, output);
+}
+
 template <typename T>
 inline Orphan<T> JsonCodec::decode(kj::ArrayPtr<const char> input, Orphanage orphanage) const {
   return decode(input, Type::from<T>(), orphanage).template releaseAs<T>();
@@ -23,6 +23,7 @@
 #include "kj/test.h"
 
 #include "capnp/test.capnp.h"
+#include "capnp/serialize.h"
 
 KJ_TEST("WebSocketMessageStream") {
   kj::EventLoop loop;
@@ -111,3 +112,83 @@ KJ_TEST("WebSocketMessageStreamByteCount") {
   KJ_EXPECT(pipe2.ends[0]->sentByteCount() == 2585);
   KJ_EXPECT(pipe2.ends[1]->receivedByteCount() == 2585);
 }
+
+KJ_TEST("WebSocketMessageStream packs a batch into one frame") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto pipe = kj::newWebSocketPipe();
+
+  capnp::WebSocketMessageStream::Options options;
+  options.packMessages = true;
+  auto msgStreamA = capnp::WebSocketMessageStream(*pipe.ends[0], options);
+
+  capnp::MallocMessageBuilder msg1;
+  msg1.initRoot<capnproto_test::capnp::test::TestAllTypes>().setInt64Field(1);
+  capnp::MallocMessageBuilder msg2;
+  msg2.initRoot<capnproto_test::capnp::test::TestAllTypes>().setTextField("two");
+
+  kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> batch[] = {
+    msg1.getSegmentsForOutput(), msg2.getSegmentsForOutput()
+  };
+  auto writePromise = msgStreamA.writeMessages(batch);
+
+  auto frame = pipe.ends[1]->receive().wait(waitScope);
+  KJ_ASSERT(frame.is<kj::Array<kj::byte>>());
+  KJ_EXPECT(frame.get<kj::Array<kj::byte>>().size() ==
+      (capnp::computeSerializedSizeInWords(msg1) + capnp::computeSerializedSizeInWords(msg2)) *
+      sizeof(capnp::word));
+  writePromise.wait(waitScope);
+}
+
+KJ_TEST("WebSocketMessageStream reads packed and split messages") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto pipe = kj::newWebSocketPipe();
+
+  capnp::WebSocketMessageStream::Options options;
+  options.packMessages = true;
+  options.maxFrameSize = 100;
+  auto msgStreamA = capnp::WebSocketMessageStream(*pipe.ends[0], options);
+  auto msgStreamB = capnp::WebSocketMessageStream(*pipe.ends[1]);
+
+  capnp::MallocMessageBuilder msg1;
+  msg1.initRoot<capnproto_test::capnp::test::TestAllTypes>().setInt64Field(1);
+  capnp::MallocMessageBuilder msg2;
+  auto data = msg2.initRoot<capnproto_test::capnp::test::TestAllTypes>().initDataField(1000);
+  for (auto i: kj::indices(data)) data[i] = i % 251;
+  capnp::MallocMessageBuilder msg3;
+  msg3.initRoot<capnproto_test::capnp::test::TestAllTypes>().setTextField("three");
+
+  kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> batch[] = {
+    msg1.getSegmentsForOutput(), msg2.getSegmentsForOutput(), msg3.getSegmentsForOutput()
+  };
+  auto writePromise = msgStreamA.writeMessages(batch);
+
+  auto readRoot = [&]() {
+    auto result = KJ_ASSERT_NONNULL(msgStreamB.tryReadMessage(nullptr).wait(waitScope));
+    return kj::mv(result.reader);
+  };
+
+  auto reader1 = readRoot();
+  KJ_EXPECT(reader1->getRoot<capnproto_test::capnp::test::TestAllTypes>().getInt64Field() == 1);
+  auto reader2 = readRoot();
+  KJ_EXPECT(reader2->getRoot<capnproto_test::capnp::test::TestAllTypes>().getDataField() ==
+            data.asReader());
+  auto reader3 = readRoot();
+  KJ_EXPECT(reader3->getRoot<capnproto_test::capnp::test::TestAllTypes>().getTextField() ==
+            "three");
+  writePromise.wait(waitScope);
+
+  // A single message larger than a frame is split as well.
+  auto writePromise2 = msgStreamA.writeMessage(nullptr, msg2.getSegmentsForOutput());
+  auto reader4 = readRoot();
+  KJ_EXPECT(reader4->getRoot<capnproto_test::capnp::test::TestAllTypes>().getDataField() ==
+            data.asReader());
+  writePromise2.wait(waitScope);
+
+  auto endPromise = msgStreamA.end();
+  KJ_EXPECT(msgStreamB.tryReadMessage(nullptr).wait(waitScope) == nullptr);
+  endPromise.wait(waitScope);
+}
@@ -25,17 +25,62 @@
 
 namespace capnp {
 
+class WebSocketMessageStream::ReadBuffer final: public kj::Refcounted {
+  // Received bytes, word-aligned. Readers for the messages within hold references.
+
+  kj::Array<byte> frame;
+  kj::Array<word> words;
+  // Storage; only one is used.
+
+public:
+  explicit ReadBuffer(kj::Array<byte> frameParam)
+      : frame(kj::mv(frameParam)), bytes(frame) {}
+  // Adopt a frame which is already aligned.
+
+  explicit ReadBuffer(size_t capacityInWords)
+      : words(kj::heapArray<word>(capacityInWords)), bytes(words.asBytes().slice(0, 0)) {}
+  // Start an empty buffer to be filled with append().
+
+  kj::ArrayPtr<const byte> bytes;
+
+  bool append(kj::ArrayPtr<const byte> more) {
+    // Append `more` after `bytes` in place, if there's room. Existing bytes don't move, so any
+    // readers already pointing into the buffer are unaffected.
+    auto space = words.asBytes();
+    if (bytes.size() + more.size() > space.size()) return false;
+    memcpy(space.begin() + bytes.size(), more.begin(), more.size());
+    bytes = space.slice(0, bytes.size() + more.size());
+    return true;
+  }
+};
+
 WebSocketMessageStream::WebSocketMessageStream(kj::WebSocket& socket)
   : socket(socket)
   {};
 
+WebSocketMessageStream::WebSocketMessageStream(kj::WebSocket& socket, Options options)
+  : socket(socket), options(options)
+  {};
+
+WebSocketMessageStream::WebSocketMessageStream(WebSocketMessageStream&&) = default;
+WebSocketMessageStream::~WebSocketMessageStream() noexcept(false) {}
+
 kj::Promise<kj::Maybe<MessageReaderAndFds>> WebSocketMessageStream::tryReadMessage(
     kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
     ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  KJ_IF_MAYBE(reader, tryTakeBufferedMessage(options)) {
+    return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds {
+      kj::mv(*reader),
+      nullptr
+    });
+  }
+
   return socket.receive(options.traversalLimitInWords * sizeof(word))
-      .then([options](auto msg) -> kj::Promise<kj::Maybe<MessageReaderAndFds>> {
+      .then([this,options](auto msg) -> kj::Promise<kj::Maybe<MessageReaderAndFds>> {
     KJ_SWITCH_ONEOF(msg) {
         KJ_CASE_ONEOF(closeMsg, kj::WebSocket::Close) {
+          KJ_REQUIRE(getUnreadBytes().size() == 0,
+              "WebSocket closed in the middle of a message");
           return kj::Maybe<MessageReaderAndFds>();
         }
         KJ_CASE_ONEOF(str, kj::String) {
@@ -44,36 +89,75 @@ kj::Promise<kj::Maybe<MessageReaderAndFds>> WebSocketMessageStream::tryReadMessa
           break;
         }
         KJ_CASE_ONEOF(bytes, kj::Array<byte>) {
-          kj::Own<capnp::MessageReader> reader;
-          size_t sizeInWords = bytes.size() / sizeof(word);
-          if (reinterpret_cast<uintptr_t>(bytes.begin()) % alignof(word) == 0) {
-            reader = kj::heap<FlatArrayMessageReader>(
-                kj::arrayPtr(
-                  reinterpret_cast<word *>(bytes.begin()),
-                  sizeInWords
-                ),
-                options).attach(kj::mv(bytes));
-          } else {
-            // The array is misaligned, so we need to copy it.
-            auto words = kj::heapArray<word>(sizeInWords);
-
-            // Note: can't just use bytes.size(), since the the target buffer may
-            // be shorter due to integer division.
-            memcpy(words.begin(), bytes.begin(), sizeInWords * sizeof(word));
-            reader = kj::heap<FlatArrayMessageReader>(
-                kj::arrayPtr(words.begin(), sizeInWords),
-                options).attach(kj::mv(words));
-          }
-          return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds {
-            kj::mv(reader),
-            nullptr
-          });
+          addFrame(kj::mv(bytes), options);
+          return tryReadMessage(nullptr, options);
         }
       }
       KJ_UNREACHABLE;
     });
 }
 
+kj::ArrayPtr<const byte> WebSocketMessageStream::getUnreadBytes() {
+  KJ_IF_MAYBE(b, readBuffer) {
+    return (*b)->bytes.slice(readOffset, (*b)->bytes.size());
+  } else {
+    return nullptr;
+  }
+}
+
+kj::Maybe<kj::Own<MessageReader>> WebSocketMessageStream::tryTakeBufferedMessage(
+    ReaderOptions options) {
+  auto unread = getUnreadBytes();
+  auto words = kj::arrayPtr(reinterpret_cast<const word*>(unread.begin()),
+                            unread.size() / sizeof(word));
+  if (words.size() == 0) return nullptr;
+
+  size_t expected = expectedSizeInWordsFromPrefix(words);
+  if (expected > words.size()) {
+    // The rest of the message is in later frames.
+    return nullptr;
+  }
+
+  readOffset += expected * sizeof(word);
+  return kj::Own<MessageReader>(kj::heap<FlatArrayMessageReader>(words.slice(0, expected), options)
+      .attach(kj::addRef(*KJ_ASSERT_NONNULL(readBuffer))));
+}
+
+void WebSocketMessageStream::addFrame(kj::Array<byte> frame, ReaderOptions options) {
+  auto unread = getUnreadBytes();
+
+  if (unread.size() == 0) {
+    if (reinterpret_cast<uintptr_t>(frame.begin()) % alignof(word) == 0) {
+      // Common case: the frame starts with a message, and we can parse in place.
+      readBuffer = kj::refcounted<ReadBuffer>(kj::mv(frame));
+      readOffset = 0;
+      return;
+    }
+  } else KJ_IF_MAYBE(b, readBuffer) {
+    // This frame continues a message from a previous one. If we already made room for the whole
+    // message, just copy in the new bytes.
+    if ((*b)->append(frame)) return;
+  }
+
+  // Copy into a fresh, aligned buffer. When continuing a message, size it for the whole message
+  // if we can tell how big that is, so later frames can be appended without reallocating.
+  size_t totalWords = (unread.size() + frame.size() + sizeof(word) - 1) / sizeof(word);
+  size_t capacity = totalWords;
+  if (unread.size() >= sizeof(word)) {
+    size_t expected = expectedSizeInWordsFromPrefix(kj::arrayPtr(
+        reinterpret_cast<const word*>(unread.begin()), unread.size() / sizeof(word)));
+    KJ_REQUIRE(expected <= options.traversalLimitInWords,
+        "incoming message exceeds traversal limit");
+    capacity = kj::max(capacity, expected);
+  }
+
+  auto buffer = kj::refcounted<ReadBuffer>(capacity);
+  KJ_ASSERT(buffer->append(unread));
+  KJ_ASSERT(buffer->append(frame));
+  readBuffer = kj::mv(buffer);
+  readOffset = 0;
+}
+
 kj::Promise<void> WebSocketMessageStream::writeMessage(
     kj::ArrayPtr<const int> fds,
     kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
@@ -88,11 +172,29 @@ kj::Promise<void> WebSocketMessageStream::writeMessage(
       computeSerializedSizeInWords(segments) * sizeof(word));
   capnp::writeMessage(*stream, segments);
   auto arrayPtr = stream->getArray();
+  if (options.packMessages) {
+    return sendFrames(arrayPtr).attach(kj::mv(stream));
+  }
   return socket.send(arrayPtr).attach(kj::mv(stream));
 }
 
 kj::Promise<void> WebSocketMessageStream::writeMessages(
     kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> messages) {
+  if (options.packMessages) {
+    size_t totalWords = 0;
+    for (auto& message: messages) {
+      totalWords += computeSerializedSizeInWords(message);
+    }
+    if (totalWords == 0) return kj::READY_NOW;
+
+    auto stream = kj::heap<kj::VectorOutputStream>(totalWords * sizeof(word));
+    for (auto& message: messages) {
+      capnp::writeMessage(*stream, message);
+    }
+    auto arrayPtr = stream->getArray();
+    return sendFrames(arrayPtr).attach(kj::mv(stream));
+  }
+
   // TODO(perf): Extend WebSocket interface with a way to write multiple messages at once.
 
   if(messages.size() == 0) {
@@ -104,6 +206,17 @@ kj::Promise<void> WebSocketMessageStream::writeMessages(
   });
 }
 
+kj::Promise<void> WebSocketMessageStream::sendFrames(kj::ArrayPtr<const byte> bytes) {
+  if (bytes.size() <= options.maxFrameSize) {
+    return socket.send(bytes);
+  }
+
+  auto rest = bytes.slice(options.maxFrameSize, bytes.size());
+  return socket.send(bytes.slice(0, options.maxFrameSize)).then([this, rest]() {
+    return sendFrames(rest);
+  });
+}
+
 kj::Maybe<int> WebSocketMessageStream::getSendBufferSize() {
   return nullptr;
 }
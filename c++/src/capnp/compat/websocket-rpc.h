@@ -29,9 +29,30 @@ namespace capnp {
 class WebSocketMessageStream final : public MessageStream {
   // An implementation of MessageStream that sends messages over a websocket.
   //
-  // Each capnproto message is sent in a single binary websocket frame.
+  // By default, each capnproto message is sent in a single binary websocket frame. When reading,
+  // a frame may also contain several messages, or a message may be split across several frames,
+  // as produced by `Options::packMessages`.
 public:
+  struct Options {
+    bool packMessages = false;
+    // If true, all messages passed to one writeMessages() call -- typically everything the RPC
+    // system queued during one event loop turn -- are sent together in one frame, and any run of
+    // bytes larger than `maxFrameSize` is split across several frames. This saves per-frame
+    // overhead for many small pipelined calls, and keeps a huge message from occupying the
+    // socket in a single send.
+    //
+    // Older versions of WebSocketMessageStream expect exactly one message per frame, so only
+    // enable this when the peer is known to support it, e.g. by negotiating a WebSocket
+    // subprotocol during the handshake.
+
+    size_t maxFrameSize = 1 << 16;
+    // Largest frame sent when `packMessages` is true.
+  };
+
   WebSocketMessageStream(kj::WebSocket& socket);
+  WebSocketMessageStream(kj::WebSocket& socket, Options options);
+  WebSocketMessageStream(WebSocketMessageStream&&);
+  ~WebSocketMessageStream() noexcept(false);
 
   // Implements MessageStream
   kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
@@ -48,6 +69,17 @@ public:
   kj::Promise<void> end() override;
 private:
   kj::WebSocket& socket;
+  Options options;
+
+  class ReadBuffer;
+  kj::Maybe<kj::Own<ReadBuffer>> readBuffer;
+  size_t readOffset = 0;
+  // Bytes received but not yet returned as messages start at `readOffset` in `readBuffer`.
+
+  kj::Maybe<kj::Own<MessageReader>> tryTakeBufferedMessage(ReaderOptions options);
+  void addFrame(kj::Array<byte> frame, ReaderOptions options);
+  kj::ArrayPtr<const byte> getUnreadBytes();
+  kj::Promise<void> sendFrames(kj::ArrayPtr<const byte> bytes);
 };
 
 }  // namespace capnp
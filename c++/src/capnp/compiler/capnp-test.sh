@@ -84,6 +84,19 @@ $CAPNP convert binary:json $JSON_SCHEMA TestJsonAnnotations -I"$SRCDIR" < $TESTD
 [ "$(echo '(foo = (text = "abc"))' | $CAPNP convert text:text "$SRCDIR/capnp/test.capnp" 'TestGenerics(BoxedText, Text)')" = '(foo = (text = "abc"), uv = void)' ]  || fail branded alias
 [ "$(echo '(baz = (text = "abc"))' | $CAPNP convert text:text "$SRCDIR/capnp/test.capnp" 'TestGenerics(TestAllTypes, List(Int32)).Inner2(BoxedText)')" = '(baz = (text = "abc"))' ]  || fail branded alias
 
+[ "$(cat $TESTDATA/binary $TESTDATA/segmented $TESTDATA/binary | $CAPNP convert -j4 binary:json $SCHEMA TestAllTypes)" = \
+  "$(cat $TESTDATA/binary $TESTDATA/segmented $TESTDATA/binary | $CAPNP convert binary:json $SCHEMA TestAllTypes)" ] || fail pipelined binary to json
+[ "$(cat $TESTDATA/packed $TESTDATA/segmented-packed | $CAPNP convert -j4 packed:text $SCHEMA TestAllTypes)" = \
+  "$(cat $TESTDATA/pretty.txt $TESTDATA/pretty.txt)" ] || fail pipelined packed to text
+[ "$(cat $TESTDATA/short.txt $TESTDATA/pretty.txt | $CAPNP convert -j4 text:binary $SCHEMA TestAllTypes | od -c)" = \
+  "$(cat $TESTDATA/binary $TESTDATA/binary | od -c)" ] || fail pipelined text to binary
+
+# ========================================================================================
+# bench
+
+$CAPNP bench -n 1 binary $SCHEMA TestAllTypes < $TESTDATA/binary | grep -q '^canonical .* MB/s' || fail bench
+$CAPNP bench -n 1 json $SCHEMA TestAllTypes < $TESTDATA/pretty.json | grep -q '^json .* MB/s' || fail bench json
+
 # ========================================================================================
 # DEPRECATED encode/decode
 
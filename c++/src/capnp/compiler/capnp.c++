@@ -50,7 +50,12 @@
 #include "capnp/compat/json.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <thread>
 #include "kj/map.h"
+#include "kj/time.h"
+#include "kj/thread.h"
+#include "kj/mutex.h"
+#include <stdio.h>
 
 #if _WIN32
 #include <process.h>
@@ -103,7 +108,9 @@ public:
              .addSubCommand("encode", KJ_BIND_METHOD(*this, getEncodeMain),
                             "DEPRECATED (use `convert`)")
              .addSubCommand("eval", KJ_BIND_METHOD(*this, getEvalMain),
-                            "Evaluate a const from a schema file.");
+                            "Evaluate a const from a schema file.")
+             .addSubCommand("bench", KJ_BIND_METHOD(*this, getBenchMain),
+                            "Measure encoding and decoding speed for a schema.");
       addGlobalOptions(builder);
       return builder.build();
     }
@@ -132,6 +139,9 @@ public:
     // Drop annotations since we don't need them.  This avoids importing files like c++.capnp.
     annotationFlag = Compiler::DROP_ANNOTATIONS;
 
+    // Unlike "compile", convert on a single thread unless asked otherwise.
+    jobs = 1;
+
     kj::MainBuilder builder(context, VERSION_STRING,
           "Converts messages between formats. Reads a stream of messages from stdin in format "
           "<from> and writes them to stdout in format <to>. Valid formats are:\n"
@@ -159,6 +169,11 @@ public:
                "Do not print warning messages about the input being in the wrong format.  "
                "Use this if you find the warnings are wrong (but also let us know so "
                "we can improve them).")
+           .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+               "Convert up to <n> messages in parallel, while still writing them in input "
+               "order.  Worthwhile for long streams converted to or from text or JSON.  Has no "
+               "effect when <from> is a single-message format (flat, flat-packed or canonical).  "
+               "Defaults to 1.")
            .expectArg("<from>:<to>", KJ_BIND_METHOD(*this, setConversion))
            .expectOptionalArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
            .expectOptionalArg("<type>", KJ_BIND_METHOD(*this, setRootType))
@@ -284,6 +299,39 @@ public:
     return builder.build();
   }
 
+  kj::MainFunc getBenchMain() {
+    // Only parse the schemas we actually need.
+    compileEagerness = Compiler::NODE;
+
+    // Note that we keep annotations, since the JSON stage needs them.
+
+    kj::MainBuilder builder(context, VERSION_STRING,
+          "Benchmarks messages of type <type> defined in <schema-file>. Reads a stream of sample "
+          "messages from stdin in format <format> (see `capnp help convert` for a list of "
+          "formats), then repeatedly puts every sample through each of the following stages:\n"
+          "    build       copy into a new MessageBuilder and serialize it\n"
+          "    read        traverse every field using the dynamic API\n"
+          "    packed      pack, then read back from the packed bytes\n"
+          "    json        encode as JSON, then decode into a new MessageBuilder\n"
+          "    canonical   canonicalize\n"
+          "For each stage, prints throughput (relative to the samples' unpacked size), time per "
+          "message, and the number of message segments allocated per message.",
+
+          "By default, each stage is repeated over all samples for about one second. Stages "
+          "which fail for the given type (for instance, JSON cannot encode capabilities) report "
+          "the error and are skipped.");
+    addGlobalOptions(builder);
+    builder.addOptionWithArg({'n', "iterations"}, KJ_BIND_METHOD(*this, setBenchIterations),
+                             "<n>", "Run each stage over all samples exactly <n> times.")
+           .addOption({"quiet"}, KJ_BIND_METHOD(*this, setQuiet),
+               "Do not print warning messages about the input being in the wrong format.")
+           .expectArg("<format>", KJ_BIND_METHOD(*this, setBenchFormat))
+           .expectArg("<schema-file>", KJ_BIND_METHOD(*this, addSource))
+           .expectArg("<type>", KJ_BIND_METHOD(*this, setRootType))
+           .callAfterParsing(KJ_BIND_METHOD(*this, bench));
+    return builder.build();
+  }
+
   void addGlobalOptions(kj::MainBuilder& builder) {
     builder.addOptionWithArg({'I', "import-path"}, KJ_BIND_METHOD(*this, addImportPath), "<dir>",
                              "Add <dir> to the list of directories searched for non-relative "
@@ -309,7 +357,14 @@ public:
                              "For example, the following command:\n"
                              "    capnp compile --src-prefix=foo/bar -oc++:corge foo/bar/baz/qux.capnp\n"
                              "would generate the files corge/baz/qux.capnp.{h,c++}.")
-           .expectOneOrMoreArgs("<source>", KJ_BIND_METHOD(*this, addSource))
+           .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+                             "Parse up to <n> source files in parallel.  Defaults to the number "
+                             "of CPUs.  The output does not depend on this setting.")
+           .addOptionWithArg({"cache-dir"}, KJ_BIND_METHOD(*this, setCacheDir), "<dir>",
+                             "Cache parsed source files in <dir>, so that unchanged files "
+                             "need not be parsed again by later runs.  The directory is created "
+                             "if it doesn't exist, and may be shared by concurrent runs.")
+           .expectOneOrMoreArgs("<source>", KJ_BIND_METHOD(*this, addCompileSource))
            .callAfterParsing(KJ_BIND_METHOD(*this, generateOutput));
   }
 
@@ -331,6 +386,15 @@ public:
   }
 
   kj::MainBuilder::Validity addSource(kj::StringPtr file) {
+    KJ_IF_MAYBE(module, loadSource(file)) {
+      addModule(*module);
+      return true;
+    } else {
+      return "no such file";
+    }
+  }
+
+  kj::Maybe<Module&> loadSource(kj::StringPtr file) {
     if (!compilerConstructed) {
       compiler = compilerSpace.construct(annotationFlag);
       compilerConstructed = true;
@@ -356,15 +420,13 @@ public:
     }
 
     auto dirPathPair = interpretSourceFile(file);
-    KJ_IF_MAYBE(module, loader.loadModule(dirPathPair.dir, dirPathPair.path)) {
-      auto compiled = compiler->add(*module);
-      compiler->eagerlyCompile(compiled.getId(), compileEagerness);
-      sourceFiles.add(SourceFile { compiled.getId(), compiled, module->getSourceName(), &*module });
-    } else {
-      return "no such file";
-    }
+    return loader.loadModule(dirPathPair.dir, dirPathPair.path);
+  }
 
-    return true;
+  void addModule(Module& module) {
+    auto compiled = compiler->add(module);
+    compiler->eagerlyCompile(compiled.getId(), compileEagerness);
+    sourceFiles.add(SourceFile { compiled.getId(), compiled, module.getSourceName(), &module });
   }
 
 public:
@@ -454,7 +516,53 @@ public:
     }
   }
 
+  kj::MainBuilder::Validity setJobs(kj::StringPtr arg) {
+    char* end;
+    long n = strtol(arg.cStr(), &end, 10);
+    if (arg.size() == 0 || *end != '\0' || n < 1) {
+      return "must be a positive integer";
+    }
+    jobs = n;
+    return true;
+  }
+
+  kj::MainBuilder::Validity setCacheDir(kj::StringPtr pathStr) {
+    auto path = disk->getCurrentPath().evalNative(pathStr);
+    KJ_IF_MAYBE(dir, disk->getRoot().tryOpenSubdir(path,
+        kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT)) {
+      cacheDir = kj::mv(*dir);
+      loader.setCacheDirectory(*cacheDir);
+      return true;
+    } else {
+      return "could not open or create directory";
+    }
+  }
+
+  kj::MainBuilder::Validity addCompileSource(kj::StringPtr file) {
+    // Unlike addSource(), defers compilation until all sources are known, so that they can be
+    // parsed in parallel first.
+
+    KJ_IF_MAYBE(module, loadSource(file)) {
+      pendingSources.add(module);
+      return true;
+    } else {
+      return "no such file";
+    }
+  }
+
+  void compilePendingSources() {
+    loader.preload(pendingSources, jobs);
+
+    // Compile in command-line order, so that output is the same as if we'd parsed serially.
+    for (auto module: pendingSources) {
+      addModule(*module);
+    }
+    pendingSources.clear();
+  }
+
   kj::MainBuilder::Validity generateOutput() {
+    compilePendingSources();
+
     if (hadErrors()) {
       // Skip output if we had any errors.
       return true;
@@ -761,8 +869,23 @@ public:
       }
     }
 
-    while (input.tryGetReadBuffer().size() > 0) {
-      readOneAndConvert(input, output);
+    switch (convertFrom) {
+      case Format::BINARY:
+      case Format::PACKED:
+      case Format::TEXT:
+      case Format::JSON:
+        if (jobs > 1) {
+          convertPipelined(input, output);
+          break;
+        }
+        KJ_FALLTHROUGH;
+      case Format::FLAT:
+      case Format::FLAT_PACKED:
+      case Format::CANONICAL:
+        while (input.tryGetReadBuffer().size() > 0) {
+          readOneAndConvert(input, output);
+        }
+        break;
     }
 
     context.exit();
@@ -968,17 +1091,29 @@ private:
     ~ParseErrorCatcher() noexcept(false) {
       if (!unwindDetector.isUnwinding()) {
         KJ_IF_MAYBE(e, exception) {
-          context.error(kj::str(
-              "*** ERROR CONVERTING PREVIOUS MESSAGE ***\n"
-              "The following error occurred while converting the message above.\n"
-              "This probably means the input data is invalid/corrupted.\n",
-              "Exception description: ", e->getDescription(), "\n"
-              "Code location: ", e->getFile(), ":", e->getLine(), "\n"
-              "*** END ERROR ***"));
+          report(context, *e);
         }
       }
     }
 
+    kj::Maybe<kj::Exception> releaseException() {
+      // Take the captured exception, so that the caller can report() it later rather than having
+      // the destructor report it now.
+      auto result = kj::mv(exception);
+      exception = nullptr;
+      return result;
+    }
+
+    static void report(kj::ProcessContext& context, const kj::Exception& e) {
+      context.error(kj::str(
+          "*** ERROR CONVERTING PREVIOUS MESSAGE ***\n"
+          "The following error occurred while converting the message above.\n"
+          "This probably means the input data is invalid/corrupted.\n",
+          "Exception description: ", e.getDescription(), "\n"
+          "Code location: ", e.getFile(), ":", e.getLine(), "\n"
+          "*** END ERROR ***"));
+    }
+
     void onRecoverableException(kj::Exception&& e) {
       // Only capture the first exception, on the assumption that later exceptions are probably
       // just cascading problems.
@@ -993,23 +1128,37 @@ private:
     kj::UnwindDetector unwindDetector;
   };
 
-  void readOneAndConvert(kj::BufferedInputStreamWrapper& input, kj::OutputStream& output) {
+  static ReaderOptions unlimitedReaderOptions() {
     // Since this is a debug tool, lift the usual security limits.  Worse case is the process
     // crashes or has to be killed.
     ReaderOptions options;
     options.nestingLimit = kj::maxValue;
     options.traversalLimitInWords = kj::maxValue;
+    return options;
+  }
+
+  void readOneAndConvert(kj::BufferedInputStreamWrapper& input, kj::OutputStream& output) {
+    readOne(input, [&](AnyStruct::Reader reader) {
+      writeConversion(reader, output);
+    });
+  }
+
+  void readOne(kj::BufferedInputStreamWrapper& input,
+               kj::FunctionParam<void(AnyStruct::Reader)> func) {
+    // Reads one message in format `convertFrom` and passes its root to `func`.
+
+    auto options = unlimitedReaderOptions();
 
     ParseErrorCatcher parseErrorCatcher(context);
 
     switch (convertFrom) {
       case Format::BINARY: {
         capnp::InputStreamMessageReader message(input, options);
-        return writeConversion(message.getRoot<AnyStruct>(), output);
+        return func(message.getRoot<AnyStruct>());
       }
       case Format::PACKED: {
         capnp::PackedMessageReader message(input, options);
-        return writeConversion(message.getRoot<AnyStruct>(), output);
+        return func(message.getRoot<AnyStruct>());
       }
       case Format::FLAT:
       case Format::CANONICAL: {
@@ -1027,7 +1176,7 @@ private:
         if (convertFrom == Format::CANONICAL) {
           KJ_REQUIRE(message.isCanonical());
         }
-        return writeConversion(message.getRoot<AnyStruct>(), output);
+        return func(message.getRoot<AnyStruct>());
       }
       case Format::FLAT_PACKED: {
         auto allBytes = readAll(input);
@@ -1041,32 +1190,36 @@ private:
 
         kj::ArrayPtr<const word> segments[1] = { words };
         SegmentArrayMessageReader message(segments, options);
-        return writeConversion(message.getRoot<AnyStruct>(), output);
-      }
-      case Format::TEXT: {
-        auto text = readOneText(input);
-        MallocMessageBuilder message;
-        TextCodec codec;
-        codec.setPrettyPrint(pretty);
-        auto root = message.initRoot<DynamicStruct>(rootType);
-        codec.decode(text, root);
-        return writeConversion(root.asReader(), output);
-      }
-      case Format::JSON: {
-        auto text = readOneJson(input);
-        MallocMessageBuilder message;
-        JsonCodec codec;
-        codec.setPrettyPrint(pretty);
-        codec.handleByAnnotation(rootType);
-        auto root = message.initRoot<DynamicStruct>(rootType);
-        codec.decode(text, root);
-        return writeConversion(root.asReader(), output);
+        return func(message.getRoot<AnyStruct>());
       }
+      case Format::TEXT:
+        return decodeText(readOneText(input), func);
+      case Format::JSON:
+        return decodeText(readOneJson(input), func);
     }
 
     KJ_UNREACHABLE;
   }
 
+  void decodeText(kj::StringPtr text, kj::FunctionParam<void(AnyStruct::Reader)> func) {
+    // Parses one message in format `convertFrom`, which must be TEXT or JSON, and passes its root
+    // to `func`.
+
+    MallocMessageBuilder message;
+    auto root = message.initRoot<DynamicStruct>(rootType);
+    if (convertFrom == Format::TEXT) {
+      TextCodec codec;
+      codec.setPrettyPrint(pretty);
+      codec.decode(text, root);
+    } else {
+      JsonCodec codec;
+      codec.setPrettyPrint(pretty);
+      codec.handleByAnnotation(rootType);
+      codec.decode(text, root);
+    }
+    func(root.asReader());
+  }
+
   void writeConversion(AnyStruct::Reader reader, kj::OutputStream& output) {
     switch (convertTo) {
       case Format::BINARY: {
@@ -1126,6 +1279,175 @@ private:
     KJ_UNREACHABLE;
   }
 
+  struct ConvertJob {
+    kj::Array<word> message;
+    // For binary input formats, the raw message, including its segment table.
+
+    kj::String text;
+    // For text input formats, the message's text.
+
+    bool done = false;
+    kj::Array<byte> output;
+    kj::Maybe<kj::Exception> error;
+    bool fatal = false;
+    // Set by the worker when the job has been converted. `error`, if any, should be reported
+    // after writing `output`; if `fatal`, conversion must stop there instead.
+  };
+
+  struct ConvertPipeline {
+    kj::Array<ConvertJob> jobs;
+    // Ring buffer of jobs in flight, indexed by sequence number modulo size.
+
+    uint64_t readCount = 0;
+    uint64_t claimCount = 0;
+    uint64_t writeCount = 0;
+    // Number of jobs framed by the reader, claimed by workers, and written, respectively.
+
+    bool eof = false;
+  };
+
+  kj::Array<word> readOneFramed(kj::InputStream& input) {
+    // Reads one message in standard serialization format, without parsing it.
+
+    auto words = kj::heapArray<word>(1);
+    size_t size = 0;
+    while (size < words.size()) {
+      input.read(words.begin() + size, (words.size() - size) * sizeof(word));
+      size = words.size();
+
+      size_t expected = expectedSizeInWordsFromPrefix(words);
+      if (expected > size) {
+        auto bigger = kj::heapArray<word>(expected);
+        memcpy(bigger.begin(), words.begin(), words.asBytes().size());
+        words = kj::mv(bigger);
+      }
+    }
+    return words;
+  }
+
+  void convertPipelined(kj::BufferedInputStreamWrapper& input, kj::OutputStream& output) {
+    // Like calling readOneAndConvert() until EOF, but converts up to `jobs` messages at once.
+    // This thread writes the output, in order, while one thread splits the input into messages
+    // and `jobs` threads convert them.
+
+    kj::MutexGuarded<ConvertPipeline> pipeline;
+    size_t capacity = jobs * 4;
+    pipeline.getWithoutLock().jobs = kj::heapArray<ConvertJob>(capacity);
+
+    auto addJob = [&](ConvertJob&& job) {
+      auto lock = pipeline.lockExclusive();
+      lock.wait([&](const ConvertPipeline& p) { return p.readCount - p.writeCount < capacity; });
+      lock->jobs[lock->readCount++ % capacity] = kj::mv(job);
+    };
+
+    auto reader = [&]() {
+      KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+        while (input.tryGetReadBuffer().size() > 0) {
+          ConvertJob job;
+          switch (convertFrom) {
+            case Format::BINARY:
+              job.message = readOneFramed(input);
+              break;
+            case Format::PACKED: {
+              capnp::_::PackedInputStream unpacker(input);
+              job.message = readOneFramed(unpacker);
+              break;
+            }
+            case Format::TEXT:
+              job.text = readOneText(input);
+              break;
+            case Format::JSON:
+              job.text = readOneJson(input);
+              break;
+            default:
+              KJ_UNREACHABLE;
+          }
+          addJob(kj::mv(job));
+        }
+      })) {
+        // Queue the error behind the messages read so far, so they are still written first.
+        ConvertJob job;
+        job.done = true;
+        job.error = kj::mv(*exception);
+        job.fatal = true;
+        addJob(kj::mv(job));
+      }
+
+      pipeline.lockExclusive()->eof = true;
+    };
+
+    auto worker = [&]() {
+      for (;;) {
+        ConvertJob* job;
+        {
+          auto lock = pipeline.lockExclusive();
+          lock.wait([](const ConvertPipeline& p) { return p.eof || p.claimCount < p.readCount; });
+          if (lock->claimCount == lock->readCount) return;
+          job = &lock->jobs[lock->claimCount++ % capacity];
+          if (job->done) continue;  // Read error queued by the reader.
+        }
+
+        // Until we mark it done, nobody else touches the job.
+        kj::VectorOutputStream converted;
+        kj::Maybe<kj::Exception> error;
+        KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+          ParseErrorCatcher parseErrorCatcher(context);
+          auto convert = [&](AnyStruct::Reader reader) {
+            writeConversion(reader, converted);
+          };
+          if (convertFrom == Format::TEXT || convertFrom == Format::JSON) {
+            decodeText(job->text, convert);
+          } else {
+            FlatArrayMessageReader message(job->message, unlimitedReaderOptions());
+            convert(message.getRoot<AnyStruct>());
+          }
+          error = parseErrorCatcher.releaseException();
+        })) {
+          error = kj::mv(*exception);
+          job->fatal = true;
+        }
+
+        auto lock = pipeline.lockExclusive();
+        job->message = nullptr;
+        job->text = nullptr;
+        job->output = kj::heapArray<byte>(converted.getArray());
+        job->error = kj::mv(error);
+        job->done = true;
+      }
+    };
+
+    kj::Thread readerThread(reader);
+    auto workerThreads = kj::heapArrayBuilder<kj::Own<kj::Thread>>(jobs);
+    for (uint i = 0; i < jobs; i++) {
+      workerThreads.add(kj::heap<kj::Thread>(worker));
+    }
+
+    for (;;) {
+      ConvertJob job;
+      {
+        auto lock = pipeline.lockExclusive();
+        lock.wait([](const ConvertPipeline& p) {
+          return (p.eof && p.writeCount == p.readCount) ||
+                 (p.writeCount < p.readCount && p.jobs[p.writeCount % p.jobs.size()].done);
+        });
+        if (lock->writeCount == lock->readCount) break;
+        auto& slot = lock->jobs[lock->writeCount++ % capacity];
+        job = kj::mv(slot);
+        slot = ConvertJob();
+      }
+
+      output.write(job.output.begin(), job.output.size());
+      KJ_IF_MAYBE(e, job.error) {
+        if (job.fatal) {
+          // Exit right away, as the serial path would, rather than waiting for the other
+          // threads. The reader may be blocked on input.
+          context.exitError(kj::str("*** Uncaught exception ***\n", *e));
+        }
+        ParseErrorCatcher::report(context, *e);
+      }
+    }
+  }
+
 public:
 
   // =====================================================================================
@@ -1646,6 +1968,18 @@ public:
     }
   }
 
+  KJ_NORETURN(void exitWithText(kj::StringTree text)) {
+    // Like context.exitInfo(text.flatten()), but writes the tree's pieces in one gather-write
+    // instead of copying a potentially large value into a flat string first.
+    auto pieces = text.pieces();
+    auto builder = kj::heapArrayBuilder<kj::ArrayPtr<const byte>>(pieces.size() + 1);
+    builder.addAll(pieces);
+    builder.add(kj::StringPtr("\n").asBytes());
+    kj::FdOutputStream(STDOUT_FILENO).write(builder.finish());
+    context.exit();
+    KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
+  }
+
   kj::MainBuilder::Validity evalConst(kj::StringPtr name) {
     convertTo = formatFromDeprecatedFlags(convertTo);
 
@@ -1781,9 +2115,9 @@ public:
       context.exit();
     } else {
       if (pretty && value.getType() == DynamicValue::STRUCT) {
-        context.exitInfo(prettyPrint(value.as<DynamicStruct>()).flatten());
+        exitWithText(prettyPrint(value.as<DynamicStruct>()));
       } else if (pretty && value.getType() == DynamicValue::LIST) {
-        context.exitInfo(prettyPrint(value.as<DynamicList>()).flatten());
+        exitWithText(prettyPrint(value.as<DynamicList>()));
       } else {
         context.exitInfo(kj::str(value));
       }
@@ -1792,6 +2126,206 @@ public:
     KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
   }
 
+public:
+  // =====================================================================================
+  // "bench" command
+
+  kj::MainBuilder::Validity setBenchIterations(kj::StringPtr arg) {
+    char* end;
+    benchIterations = strtoul(arg.cStr(), &end, 0);
+    if (arg.size() == 0 || *end != '\0' || benchIterations == 0) {
+      return "must be a positive integer";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setBenchFormat(kj::StringPtr format) {
+    KJ_IF_MAYBE(f, parseFormatName(format)) {
+      convertFrom = *f;
+      return true;
+    } else {
+      return kj::str("unknown format: ", format);
+    }
+  }
+
+  kj::MainBuilder::Validity bench() {
+    kj::FdInputStream rawInput(STDIN_FILENO);
+    kj::BufferedInputStreamWrapper input(rawInput);
+
+    if (input.tryGetReadBuffer().size() == 0) {
+      return "no sample messages on stdin";
+    }
+
+    if (!quiet) {
+      auto result = checkPlausibility(convertFrom, input.getReadBuffer());
+      if (result.getError() != nullptr) {
+        return kj::mv(result);
+      }
+    }
+
+    // Store each sample canonicalized, so that every stage starts from the same compact,
+    // single-segment encoding regardless of the input format.
+    kj::Vector<kj::Array<word>> samples;
+    size_t sampleBytes = 0;
+    while (input.tryGetReadBuffer().size() > 0) {
+      readOne(input, [&](AnyStruct::Reader reader) {
+        auto words = reader.canonicalize();
+        sampleBytes += words.asBytes().size();
+        samples.add(kj::mv(words));
+      });
+    }
+
+    kj::FdOutputStream output(STDOUT_FILENO);
+    auto header = kj::str(samples.size(), " sample message(s), ", sampleBytes, " bytes total\n");
+    output.write(header.begin(), header.size());
+
+    runBenchStage(output, "build", samples, sampleBytes,
+        [&](AnyStruct::Reader reader, uint64_t& segmentCount) -> uint64_t {
+      BenchMessageBuilder message(segmentCount);
+      message.setRoot(reader);
+      return messageToFlatArray(message).size();
+    });
+
+    runBenchStage(output, "read", samples, sampleBytes,
+        [&](AnyStruct::Reader reader, uint64_t& segmentCount) -> uint64_t {
+      return benchTraverse(reader.as<DynamicStruct>(rootType));
+    });
+
+    runBenchStage(output, "packed", samples, sampleBytes,
+        [&](AnyStruct::Reader reader, uint64_t& segmentCount) -> uint64_t {
+      BenchMessageBuilder message(segmentCount);
+      message.setRoot(reader);
+      kj::VectorOutputStream packed;
+      writePackedMessage(packed, message);
+
+      kj::ArrayInputStream packedInput(packed.getArray());
+      PackedMessageReader unpacked(packedInput, unlimitedReaderOptions());
+      return unpacked.getRoot<AnyStruct>().getDataSection().size();
+    });
+
+    {
+      JsonCodec codec;
+      codec.handleByAnnotation(rootType);
+      runBenchStage(output, "json", samples, sampleBytes,
+          [&](AnyStruct::Reader reader, uint64_t& segmentCount) -> uint64_t {
+        auto text = codec.encode(reader.as<DynamicStruct>(rootType));
+        BenchMessageBuilder message(segmentCount);
+        codec.decode(text, message.initRoot<DynamicStruct>(rootType));
+        return text.size();
+      });
+    }
+
+    runBenchStage(output, "canonical", samples, sampleBytes,
+        [&](AnyStruct::Reader reader, uint64_t& segmentCount) -> uint64_t {
+      return reader.canonicalize().size();
+    });
+
+    context.exit();
+    KJ_CLANG_KNOWS_THIS_IS_UNREACHABLE_BUT_GCC_DOESNT;
+  }
+
+private:
+  class BenchMessageBuilder final: public MallocMessageBuilder {
+    // A MallocMessageBuilder which counts the segments it allocates.
+
+  public:
+    explicit BenchMessageBuilder(uint64_t& segmentCount): segmentCount(segmentCount) {}
+
+    kj::ArrayPtr<word> allocateSegment(uint minimumSize) override {
+      ++segmentCount;
+      return MallocMessageBuilder::allocateSegment(minimumSize);
+    }
+
+  private:
+    uint64_t& segmentCount;
+  };
+
+  static uint64_t benchTraverse(DynamicValue::Reader value) {
+    // Visits every field reachable from `value`, returning a checksum so that the compiler can't
+    // optimize the reads away.
+
+    switch (value.getType()) {
+      case DynamicValue::UNKNOWN:
+      case DynamicValue::VOID:
+      case DynamicValue::CAPABILITY:
+      case DynamicValue::ANY_POINTER:
+        return 0;
+      case DynamicValue::BOOL:
+        return value.as<bool>();
+      case DynamicValue::INT:
+        return value.as<int64_t>();
+      case DynamicValue::UINT:
+        return value.as<uint64_t>();
+      case DynamicValue::FLOAT:
+        return value.as<double>() != 0;
+      case DynamicValue::TEXT:
+        return value.as<Text>().size();
+      case DynamicValue::DATA:
+        return value.as<Data>().size();
+      case DynamicValue::ENUM:
+        return value.as<DynamicEnum>().getRaw();
+      case DynamicValue::LIST: {
+        uint64_t result = 0;
+        for (auto element: value.as<DynamicList>()) {
+          result += benchTraverse(element);
+        }
+        return result;
+      }
+      case DynamicValue::STRUCT: {
+        auto structValue = value.as<DynamicStruct>();
+        uint64_t result = 0;
+        KJ_IF_MAYBE(field, structValue.which()) {
+          result += benchTraverse(structValue.get(*field));
+        }
+        for (auto field: structValue.getSchema().getNonUnionFields()) {
+          if (structValue.has(field)) {
+            result += benchTraverse(structValue.get(field));
+          }
+        }
+        return result;
+      }
+    }
+
+    KJ_UNREACHABLE;
+  }
+
+  void runBenchStage(kj::OutputStream& output, kj::StringPtr name,
+                     kj::ArrayPtr<const kj::Array<word>> samples, size_t sampleBytes,
+                     kj::FunctionParam<uint64_t(AnyStruct::Reader, uint64_t&)> func) {
+    // Runs `func` on every sample repeatedly, then prints one line of results.
+
+    auto& clock = kj::systemPreciseMonotonicClock();
+    uint64_t passes = 0;
+    uint64_t segmentCount = 0;
+    kj::Duration elapsed = 0 * kj::NANOSECONDS;
+
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      auto start = clock.now();
+      do {
+        for (auto& sample: samples) {
+          kj::ArrayPtr<const word> segments[1] = { sample };
+          SegmentArrayMessageReader message(segments, unlimitedReaderOptions());
+          benchChecksum += func(message.getRoot<AnyStruct>(), segmentCount);
+        }
+        ++passes;
+        elapsed = clock.now() - start;
+      } while (benchIterations == 0 ? elapsed < 1 * kj::SECONDS : passes < benchIterations);
+    })) {
+      auto text = kj::str(name, ": failed: ", exception->getDescription(), "\n");
+      output.write(text.begin(), text.size());
+      return;
+    }
+
+    double seconds = double(elapsed / kj::NANOSECONDS) / 1e9;
+    double messages = double(passes) * samples.size();
+
+    char line[128];
+    snprintf(line, sizeof(line), "%-10s %10.1f MB/s %12.0f ns/msg %8.2f segments/msg\n",
+             name.cStr(), double(passes) * sampleBytes / seconds / 1e6,
+             seconds * 1e9 / messages, segmentCount / messages);
+    output.write(line, strlen(line));
+  }
+
 public:
   // =====================================================================================
 
@@ -1870,6 +2404,12 @@ private:
   StructSchema rootType;
   // For the "decode" and "encode" commands.
 
+  uint64_t benchIterations = 0;
+  // For the "bench" command. Zero means to run each stage for about a second.
+
+  uint64_t benchChecksum = 0;
+  // Accumulates results of the "bench" stages, so that their work can't be optimized away.
+
   struct SourceFile {
     uint64_t id;
     Compiler::ModuleScope compiled;
@@ -1879,6 +2419,15 @@ private:
 
   kj::Vector<SourceFile> sourceFiles;
 
+  kj::Vector<Module*> pendingSources;
+  // For the "compile" command, sources which haven't been passed to the compiler yet.
+
+  uint jobs = kj::max(std::thread::hardware_concurrency(), 1u);
+  // Number of threads to parse with, for "compile", or to convert with, for "convert".
+
+  kj::Own<const kj::Directory> cacheDir;
+  // For --cache-dir.
+
   struct OutputDirective {
     kj::ArrayPtr<const char> name;
     kj::Maybe<kj::Path> dir;
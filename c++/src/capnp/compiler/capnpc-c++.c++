@@ -64,6 +64,8 @@ namespace {
 
 static constexpr uint64_t NAMESPACE_ANNOTATION_ID = 0xb9c6f99ebf805f2cull;
 static constexpr uint64_t NAME_ANNOTATION_ID = 0xf264a779fef191ceull;
+static constexpr uint64_t COLUMNS_ANNOTATION_ID = 0x8a38c5bbce0d7a20ull;
+static constexpr uint64_t OUT_OF_LINE_ANNOTATION_ID = 0x90b60d444ea2578cull;
 
 bool hasDiscriminantValue(const schema::Field::Reader& reader) {
   return reader.getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
@@ -368,6 +370,10 @@ private:
   SchemaLoader schemaLoader;
   std::unordered_set<uint64_t> usedImports;
   bool hasInterfaces = false;
+  kj::Vector<uint64_t> fileSchemaIds;
+  // IDs of all RawSchemas defined by the file currently being generated.
+  bool outOfLine = false;
+  // Whether the file currently being generated has the `$Cxx.outOfLine` annotation.
 
   CppTypeName cppFullName(Schema schema, kj::Maybe<InterfaceSchema::Method> method) {
     return cppFullName(schema, schema, method);
@@ -1173,6 +1179,7 @@ private:
     kj::StringTree builderMethodDecls;
     kj::StringTree pipelineMethodDecls;
     kj::StringTree inlineMethodDefs;
+    kj::StringTree sourceMethodDefs;
   };
 
   enum class FieldKind {
@@ -1258,7 +1265,9 @@ private:
                   KJ_UNREACHABLE;
                 },
                 "  return typename ", scope, titleCase, "::Builder(_builder);\n"
-                "}\n")
+                "}\n"),
+
+            kj::strTree()
           };
       }
     }
@@ -1427,7 +1436,9 @@ private:
             "  _builder.setDataField<", type, ">(\n"
             "      ::capnp::bounded<", offset, ">() * ::capnp::ELEMENTS, value", defaultMaskParam, ");\n",
             "}\n"
-            "\n")
+            "\n"),
+
+        kj::strTree()
       };
 
     } else if (kind == FieldKind::INTERFACE) {
@@ -1517,7 +1528,9 @@ private:
             "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
             "}\n"
             "#endif  // !CAPNP_LITE\n"
-            "\n")
+            "\n"),
+
+        kj::strTree()
       };
 
     } else if (kind == FieldKind::ANY_POINTER) {
@@ -1571,7 +1584,9 @@ private:
             "  result.clear();\n"
             "  return result;\n"
             "}\n"
-            "\n")
+            "\n"),
+
+        kj::strTree()
       };
 
     } else {
@@ -1668,12 +1683,145 @@ private:
 
       #define COND(cond, ...) ((cond) ? kj::strTree(__VA_ARGS__) : kj::strTree())
 
+      // Under `$Cxx.outOfLine`, the accessors which go through PointerHelpers are defined in the
+      // source file. `has*()`, the pipeline getter, and template members stay inline.
+      bool defineInSource = outOfLine && !templateContext.isGeneric();
+      kj::StringPtr accessorInline = defineInSource ? "" : "inline ";
+
+      kj::StringTree headerDefs = kj::strTree(
+          kj::mv(unionDiscrim.isDefs),
+          templateContext.allDecls(),
+          "inline bool ", scope, "Reader::has", titleCase, "() const {\n",
+          unionDiscrim.has,
+          "  return !_reader.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS).isNull();\n"
+          "}\n",
+          templateContext.allDecls(),
+          "inline bool ", scope, "Builder::has", titleCase, "() {\n",
+          unionDiscrim.has,
+          "  return !_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS).isNull();\n"
+          "}\n");
+      kj::StringTree sourceDefs;
+
+      auto addDefs = [&](bool isAccessor, kj::StringTree&& defs) {
+        kj::StringTree& target = isAccessor && defineInSource ? sourceDefs : headerDefs;
+        target = kj::strTree(kj::mv(target), kj::mv(defs));
+      };
+      auto addLiteGuard = [&](kj::StringPtr guard) {
+        if (shouldExcludeInLiteMode) {
+          addDefs(false, kj::strTree(guard));
+          if (defineInSource) addDefs(true, kj::strTree(guard));
+        }
+      };
+
+      addLiteGuard("#if !CAPNP_LITE\n");
+      addDefs(true, kj::strTree(
+          templateContext.allDecls(),
+          accessorInline, readerType, " ", scope, "Reader::get", titleCase, "() const {\n",
+          unionDiscrim.check,
+          "  return ::capnp::_::PointerHelpers<", type, ">::get(_reader.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS)", defaultParam, ");\n"
+          "}\n",
+          templateContext.allDecls(),
+          accessorInline, builderType, " ", scope, "Builder::get", titleCase, "() {\n",
+          unionDiscrim.check,
+          "  return ::capnp::_::PointerHelpers<", type, ">::get(_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS)", defaultParam, ");\n"
+          "}\n"));
+      addDefs(false, COND(shouldIncludePipelineGetter,
+          "#if !CAPNP_LITE\n",
+          templateContext.allDecls(),
+          "inline ", pipelineType, " ", scope, "Pipeline::get", titleCase, "() {\n",
+          "  return ", pipelineType, "(_typeless.getPointerField(", offset, "));\n"
+          "}\n"
+          "#endif  // !CAPNP_LITE\n"));
+      addDefs(true, kj::strTree(
+          templateContext.allDecls(),
+          accessorInline, "void ", scope, "Builder::set", titleCase, "(", readerType, " value) {\n",
+          unionDiscrim.set,
+          "  ::capnp::_::PointerHelpers<", type, ">::set(_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), value);\n"
+          "}\n",
+          COND(shouldIncludeArrayInitializer,
+            templateContext.allDecls(),
+            accessorInline, "void ", scope, "Builder::set", titleCase, "(::kj::ArrayPtr<const ", elementReaderType, "> value) {\n",
+            unionDiscrim.set,
+            "  ::capnp::_::PointerHelpers<", type, ">::set(_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), value);\n"
+            "}\n")));
+      if (shouldIncludeStructInit) {
+        if (shouldTemplatizeInit) {
+          addDefs(false, kj::strTree(
+              templateContext.allDecls(),
+              "template <typename T_>\n"
+              "inline ::capnp::BuilderFor<T_> ", scope, "Builder::init", titleCase, "As() {\n",
+              "  static_assert(::capnp::kind<T_>() == ::capnp::Kind::STRUCT,\n"
+              "                \"", proto.getName(), " must be a struct\");\n",
+              unionDiscrim.set,
+              "  return ::capnp::_::PointerHelpers<T_>::init(_builder.getPointerField(\n"
+              "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
+              "}\n"));
+        } else {
+          addDefs(true, kj::strTree(
+              templateContext.allDecls(),
+              accessorInline, builderType, " ", scope, "Builder::init", titleCase, "() {\n",
+              unionDiscrim.set,
+              "  return ::capnp::_::PointerHelpers<", type, ">::init(_builder.getPointerField(\n"
+              "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
+              "}\n"));
+        }
+      }
+      if (shouldIncludeSizedInit) {
+        if (shouldTemplatizeInit) {
+          addDefs(false, kj::strTree(
+              templateContext.allDecls(),
+              "template <typename T_>\n"
+              "inline ::capnp::BuilderFor<T_> ", scope, "Builder::init", titleCase, "As(unsigned int size) {\n",
+              "  static_assert(::capnp::kind<T_>() == ::capnp::Kind::LIST,\n"
+              "                \"", proto.getName(), " must be a list\");\n",
+              unionDiscrim.set,
+              "  return ::capnp::_::PointerHelpers<T_>::init(_builder.getPointerField(\n"
+              "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), size);\n"
+              "}\n"));
+        } else {
+          addDefs(true, kj::strTree(
+              templateContext.allDecls(),
+              accessorInline, builderType, " ", scope, "Builder::init", titleCase, "(unsigned int size) {\n",
+              unionDiscrim.set,
+              "  return ::capnp::_::PointerHelpers<", type, ">::init(_builder.getPointerField(\n"
+              "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), size);\n"
+              "}\n"));
+        }
+      }
+      addDefs(true, kj::strTree(
+          templateContext.allDecls(),
+          accessorInline, "void ", scope, "Builder::adopt", titleCase, "(\n"
+          "    ::capnp::Orphan<", type, ">&& value) {\n",
+          unionDiscrim.set,
+          "  ::capnp::_::PointerHelpers<", type, ">::adopt(_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), kj::mv(value));\n"
+          "}\n",
+          COND(type.hasDisambiguatedTemplate(),
+              "#if !defined(_MSC_VER) || defined(__clang__)\n"
+              "// Excluded under MSVC because bugs may make it unable to compile this method.\n"),
+          templateContext.allDecls(),
+          accessorInline, "::capnp::Orphan<", type, "> ", scope, "Builder::disown", titleCase, "() {\n",
+          unionDiscrim.check,
+          "  return ::capnp::_::PointerHelpers<", type, ">::disown(_builder.getPointerField(\n"
+          "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
+          "}\n",
+          COND(type.hasDisambiguatedTemplate(), "#endif  // !_MSC_VER || __clang__\n")));
+      addLiteGuard("#endif  // !CAPNP_LITE\n");
+      addDefs(false, kj::strTree("\n"));
+      if (defineInSource) addDefs(true, kj::strTree("\n"));
+
       return FieldText {
         kj::strTree(
             kj::mv(unionDiscrim.readerIsDecl),
             "  inline bool has", titleCase, "() const;\n",
             COND(shouldExcludeInLiteMode, "#if !CAPNP_LITE\n"),
-            "  inline ", readerType, " get", titleCase, "() const;\n",
+            "  ", accessorInline, readerType, " get", titleCase, "() const;\n",
             COND(shouldExcludeInLiteMode, "#endif  // !CAPNP_LITE\n"),
             "\n"),
 
@@ -1681,24 +1829,24 @@ private:
             kj::mv(unionDiscrim.builderIsDecl),
             "  inline bool has", titleCase, "();\n",
             COND(shouldExcludeInLiteMode, "#if !CAPNP_LITE\n"),
-            "  inline ", builderType, " get", titleCase, "();\n"
-            "  inline void set", titleCase, "(", readerType, " value);\n",
+            "  ", accessorInline, builderType, " get", titleCase, "();\n"
+            "  ", accessorInline, "void set", titleCase, "(", readerType, " value);\n",
             COND(shouldIncludeArrayInitializer,
-              "  inline void set", titleCase, "(::kj::ArrayPtr<const ", elementReaderType, "> value);\n"),
+              "  ", accessorInline, "void set", titleCase, "(::kj::ArrayPtr<const ", elementReaderType, "> value);\n"),
             COND(shouldIncludeStructInit,
               COND(shouldTemplatizeInit,
                 "  template <typename T_>\n"
                 "  inline ::capnp::BuilderFor<T_> init", titleCase, "As();\n"),
               COND(!shouldTemplatizeInit,
-                "  inline ", builderType, " init", titleCase, "();\n")),
+                "  ", accessorInline, builderType, " init", titleCase, "();\n")),
             COND(shouldIncludeSizedInit,
               COND(shouldTemplatizeInit,
                 "  template <typename T_>\n"
                 "  inline ::capnp::BuilderFor<T_> init", titleCase, "As(unsigned int size);\n"),
               COND(!shouldTemplatizeInit,
-                "  inline ", builderType, " init", titleCase, "(unsigned int size);\n")),
-            "  inline void adopt", titleCase, "(::capnp::Orphan<", type, ">&& value);\n"
-            "  inline ::capnp::Orphan<", type, "> disown", titleCase, "();\n",
+                "  ", accessorInline, builderType, " init", titleCase, "(unsigned int size);\n")),
+            "  ", accessorInline, "void adopt", titleCase, "(::capnp::Orphan<", type, ">&& value);\n"
+            "  ", accessorInline, "::capnp::Orphan<", type, "> disown", titleCase, "();\n",
             COND(shouldExcludeInLiteMode, "#endif  // !CAPNP_LITE\n"),
             "\n"),
 
@@ -1706,108 +1854,8 @@ private:
             COND(shouldIncludePipelineGetter,
               "  inline ", pipelineType, " get", titleCase, "();\n")),
 
-        kj::strTree(
-            kj::mv(unionDiscrim.isDefs),
-            templateContext.allDecls(),
-            "inline bool ", scope, "Reader::has", titleCase, "() const {\n",
-            unionDiscrim.has,
-            "  return !_reader.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS).isNull();\n"
-            "}\n",
-            templateContext.allDecls(),
-            "inline bool ", scope, "Builder::has", titleCase, "() {\n",
-            unionDiscrim.has,
-            "  return !_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS).isNull();\n"
-            "}\n",
-            COND(shouldExcludeInLiteMode, "#if !CAPNP_LITE\n"),
-            templateContext.allDecls(),
-            "inline ", readerType, " ", scope, "Reader::get", titleCase, "() const {\n",
-            unionDiscrim.check,
-            "  return ::capnp::_::PointerHelpers<", type, ">::get(_reader.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS)", defaultParam, ");\n"
-            "}\n",
-            templateContext.allDecls(),
-            "inline ", builderType, " ", scope, "Builder::get", titleCase, "() {\n",
-            unionDiscrim.check,
-            "  return ::capnp::_::PointerHelpers<", type, ">::get(_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS)", defaultParam, ");\n"
-            "}\n",
-            COND(shouldIncludePipelineGetter,
-              "#if !CAPNP_LITE\n",
-              templateContext.allDecls(),
-              "inline ", pipelineType, " ", scope, "Pipeline::get", titleCase, "() {\n",
-              "  return ", pipelineType, "(_typeless.getPointerField(", offset, "));\n"
-              "}\n"
-              "#endif  // !CAPNP_LITE\n"),
-            templateContext.allDecls(),
-            "inline void ", scope, "Builder::set", titleCase, "(", readerType, " value) {\n",
-            unionDiscrim.set,
-            "  ::capnp::_::PointerHelpers<", type, ">::set(_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), value);\n"
-            "}\n",
-            COND(shouldIncludeArrayInitializer,
-              templateContext.allDecls(),
-              "inline void ", scope, "Builder::set", titleCase, "(::kj::ArrayPtr<const ", elementReaderType, "> value) {\n",
-              unionDiscrim.set,
-              "  ::capnp::_::PointerHelpers<", type, ">::set(_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), value);\n"
-              "}\n"),
-            COND(shouldIncludeStructInit,
-              COND(shouldTemplatizeInit,
-                templateContext.allDecls(),
-                "template <typename T_>\n"
-                "inline ::capnp::BuilderFor<T_> ", scope, "Builder::init", titleCase, "As() {\n",
-                "  static_assert(::capnp::kind<T_>() == ::capnp::Kind::STRUCT,\n"
-                "                \"", proto.getName(), " must be a struct\");\n",
-                unionDiscrim.set,
-                "  return ::capnp::_::PointerHelpers<T_>::init(_builder.getPointerField(\n"
-                "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
-                "}\n"),
-              COND(!shouldTemplatizeInit,
-                templateContext.allDecls(),
-                "inline ", builderType, " ", scope, "Builder::init", titleCase, "() {\n",
-                unionDiscrim.set,
-                "  return ::capnp::_::PointerHelpers<", type, ">::init(_builder.getPointerField(\n"
-                "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
-                "}\n")),
-            COND(shouldIncludeSizedInit,
-              COND(shouldTemplatizeInit,
-                templateContext.allDecls(),
-                "template <typename T_>\n"
-                "inline ::capnp::BuilderFor<T_> ", scope, "Builder::init", titleCase, "As(unsigned int size) {\n",
-                "  static_assert(::capnp::kind<T_>() == ::capnp::Kind::LIST,\n"
-                "                \"", proto.getName(), " must be a list\");\n",
-                unionDiscrim.set,
-                "  return ::capnp::_::PointerHelpers<T_>::init(_builder.getPointerField(\n"
-                "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), size);\n"
-                "}\n"),
-              COND(!shouldTemplatizeInit,
-                templateContext.allDecls(),
-                "inline ", builderType, " ", scope, "Builder::init", titleCase, "(unsigned int size) {\n",
-                unionDiscrim.set,
-                "  return ::capnp::_::PointerHelpers<", type, ">::init(_builder.getPointerField(\n"
-                "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), size);\n"
-                "}\n")),
-            templateContext.allDecls(),
-            "inline void ", scope, "Builder::adopt", titleCase, "(\n"
-            "    ::capnp::Orphan<", type, ">&& value) {\n",
-            unionDiscrim.set,
-            "  ::capnp::_::PointerHelpers<", type, ">::adopt(_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS), kj::mv(value));\n"
-            "}\n",
-            COND(type.hasDisambiguatedTemplate(),
-                "#if !defined(_MSC_VER) || defined(__clang__)\n"
-                "// Excluded under MSVC because bugs may make it unable to compile this method.\n"),
-            templateContext.allDecls(),
-            "inline ::capnp::Orphan<", type, "> ", scope, "Builder::disown", titleCase, "() {\n",
-            unionDiscrim.check,
-            "  return ::capnp::_::PointerHelpers<", type, ">::disown(_builder.getPointerField(\n"
-            "      ::capnp::bounded<", offset, ">() * ::capnp::POINTERS));\n"
-            "}\n",
-            COND(type.hasDisambiguatedTemplate(), "#endif  // !_MSC_VER || __clang__\n"),
-            COND(shouldExcludeInLiteMode, "#endif  // !CAPNP_LITE\n"),
-            "\n")
+        kj::mv(headerDefs),
+        kj::mv(sourceDefs)
       };
 
       #undef COND
@@ -1973,6 +2021,101 @@ private:
         "\n");
   }
 
+  struct ColumnText {
+    kj::StringTree decl;
+    kj::StringTree inlineDef;
+  };
+
+  kj::Maybe<ColumnText> makeColumnText(kj::StringPtr scope, StructSchema::Field field,
+                                       const TemplateContext& templateContext) {
+    // Columns are generated only for primitive fields present in every element, i.e. not union
+    // members or group fields.  Bools are bit-packed, so they don't fit ColumnReader's strided
+    // loads and are skipped too.
+
+    auto proto = field.getProto();
+    if (hasDiscriminantValue(proto) || proto.which() != schema::Field::SLOT) {
+      return nullptr;
+    }
+
+    auto defaultBody = proto.getSlot().getDefaultValue();
+    kj::String defaultMask;
+    switch (field.getType().which()) {
+#define HANDLE_PRIMITIVE(discrim, defaultName, suffix) \
+      case schema::Type::discrim: \
+        if (defaultBody.get##defaultName() != 0) { \
+          defaultMask = kj::str(defaultBody.get##defaultName(), #suffix); \
+        } \
+        break;
+
+      HANDLE_PRIMITIVE(INT8 , Int8 , );
+      HANDLE_PRIMITIVE(INT16, Int16, );
+      HANDLE_PRIMITIVE(INT32, Int32, );
+      HANDLE_PRIMITIVE(INT64, Int64, ll);
+      HANDLE_PRIMITIVE(UINT8 , Uint8 , u);
+      HANDLE_PRIMITIVE(UINT16, Uint16, u);
+      HANDLE_PRIMITIVE(UINT32, Uint32, u);
+      HANDLE_PRIMITIVE(UINT64, Uint64, ull);
+      HANDLE_PRIMITIVE(ENUM, Enum, u);
+#undef HANDLE_PRIMITIVE
+
+      case schema::Type::FLOAT32:
+        if (defaultBody.getFloat32() != 0) {
+          uint32_t mask;
+          float value = defaultBody.getFloat32();
+          memcpy(&mask, &value, sizeof(mask));
+          defaultMask = kj::str(mask, "u");
+        }
+        break;
+
+      case schema::Type::FLOAT64:
+        if (defaultBody.getFloat64() != 0) {
+          uint64_t mask;
+          double value = defaultBody.getFloat64();
+          memcpy(&mask, &value, sizeof(mask));
+          defaultMask = kj::str(mask, "ull");
+        }
+        break;
+
+      default:
+        return nullptr;
+    }
+
+    auto titleCase = toTitleCase(protoName(proto));
+    auto columnType = kj::str("::capnp::ColumnReader<", typeName(field.getType(), nullptr), ">");
+
+    return ColumnText {
+      kj::strTree("  inline ", columnType, " get", titleCase, "() const;\n"),
+      kj::strTree(
+          templateContext.allDecls(),
+          "inline ", columnType, " ", scope, "Columns::get", titleCase, "() const {\n"
+          "  return ", columnType, "(_list,\n"
+          "      ::capnp::bounded<", proto.getSlot().getOffset(), ">() * ::capnp::ELEMENTS",
+          defaultMask.size() == 0 ? kj::strTree() : kj::strTree(", ", defaultMask), ");\n"
+          "}\n"
+          "\n")
+    };
+  }
+
+  kj::StringTree makeColumnsDef(kj::StringPtr fullName, const TemplateContext& templateContext,
+                                kj::Array<kj::StringTree>&& methodDecls) {
+    auto listType = kj::str(templateContext.isGeneric() ? "typename " : "",
+        "::capnp::List<", fullName, ", ::capnp::Kind::STRUCT>::Reader");
+    return kj::strTree(
+        templateContext.allDecls(),
+        "class ", fullName, "::Columns {\n"
+        "public:\n"
+        "  inline explicit Columns(", listType, " list): _list(list) {}\n"
+        "\n"
+        "  inline ::capnp::uint size() const { return _list.size(); }\n"
+        "\n",
+        kj::mv(methodDecls),
+        "\n"
+        "private:\n"
+        "  ", listType, " _list;\n"
+        "};\n"
+        "\n");
+  }
+
   kj::StringTree makeGenericDeclarations(const TemplateContext& templateContext,
                                          bool hasBrandDependencies) {
     // Returns the declarations for the private members of a generic struct/interface;
@@ -2031,6 +2174,16 @@ private:
       return makeFieldText(subScope, f, templateContext);
     };
 
+    bool hasColumns = annotationValue(proto, COLUMNS_ANNOTATION_ID) != nullptr;
+    kj::Vector<ColumnText> columnTexts;
+    if (hasColumns) {
+      for (auto f: schema.getFields()) {
+        KJ_IF_MAYBE(column, makeColumnText(subScope, f, templateContext)) {
+          columnTexts.add(kj::mv(*column));
+        }
+      }
+    }
+
     auto structNode = proto.getStruct();
     uint discrimOffset = structNode.getDiscriminantOffset();
     auto hexId = kj::hex(proto.getId());
@@ -2094,6 +2247,7 @@ private:
           "  class Reader;\n"
           "  class Builder;\n"
           "  class Pipeline;\n",
+          hasColumns ? "  class Columns;\n" : "",
           structNode.getDiscriminantCount() == 0 ? kj::strTree() : kj::strTree(
               "  enum Which: uint16_t {\n",
               KJ_MAP(f, structNode.getFields()) {
@@ -2116,7 +2270,10 @@ private:
           makeBuilderDef(fullName, name, templateContext, structNode.getDiscriminantCount() != 0,
                          KJ_MAP(f, fieldTexts) { return kj::mv(f.builderMethodDecls); }),
           makePipelineDef(fullName, name, templateContext, structNode.getDiscriminantCount() != 0,
-                          KJ_MAP(f, fieldTexts) { return kj::mv(f.pipelineMethodDecls); })),
+                          KJ_MAP(f, fieldTexts) { return kj::mv(f.pipelineMethodDecls); }),
+          hasColumns ? makeColumnsDef(fullName, templateContext,
+                                      KJ_MAP(c, columnTexts) { return kj::mv(c.decl); })
+                     : kj::strTree()),
 
       kj::strTree(
           structNode.getDiscriminantCount() == 0 ? kj::strTree() : kj::strTree(
@@ -2131,9 +2288,12 @@ private:
               "      ::capnp::bounded<", discrimOffset, ">() * ::capnp::ELEMENTS);\n"
               "}\n"
               "\n"),
-          KJ_MAP(f, fieldTexts) { return kj::mv(f.inlineMethodDefs); }),
+          KJ_MAP(f, fieldTexts) { return kj::mv(f.inlineMethodDefs); },
+          KJ_MAP(c, columnTexts) { return kj::mv(c.inlineDef); }),
 
-      kj::mv(defineText)
+      kj::strTree(
+          kj::mv(defineText),
+          KJ_MAP(f, fieldTexts) { return kj::mv(f.sourceMethodDefs); })
     };
   }
 
@@ -2771,6 +2931,8 @@ private:
     auto brandDeps = makeBrandDepInitializers(
         makeBrandDepMap(templateContext, schema.getGeneric()));
 
+    fileSchemaIds.add(proto.getId());
+
     auto schemaDef = kj::strTree(
         "static const ::capnp::_::AlignedData<", rawSchema.size(), "> b_", hexId, " = {\n"
         "  {", kj::mv(schemaLiteral), " }\n"
@@ -2974,11 +3136,106 @@ private:
   struct FileText {
     kj::StringTree header;
     kj::StringTree source;
+    kj::Maybe<kj::StringTree> forwardHeader;
   };
 
+  kj::StringTree makeSchemaIndex(uint64_t fileId) {
+    // Generate the RawSchemaIndex for the file, a perfect hash table over fileSchemaIds. We use
+    // "hash and displace": IDs are first hashed into small buckets, then for each bucket (largest
+    // first) we search for a seed which sends all of the bucket's IDs to free slots.
+
+    auto hexId = kj::hex(fileId);
+
+    if (fileSchemaIds.size() == 0) {
+      return kj::strTree(
+          "const ::capnp::_::RawSchemaIndex x_", hexId, " = { nullptr, nullptr, 0, 0, 0 };\n");
+    }
+
+    static constexpr uint32_t MAX_SEED = 1u << 16;
+
+    uint32_t slotCount = 1;
+    while (slotCount < fileSchemaIds.size() * 2) slotCount <<= 1;
+
+    kj::Array<uint64_t> slots;
+    kj::Array<uint32_t> seeds;
+    for (;; slotCount <<= 1) {
+      uint32_t bucketCount = kj::max(slotCount / 4, 1u);
+      auto buckets = kj::heapArray<kj::Vector<uint64_t>>(bucketCount);
+      for (auto id: fileSchemaIds) {
+        buckets[_::RawSchemaIndex::hash(id, 0) & (bucketCount - 1)].add(id);
+      }
+      auto order = KJ_MAP(i, kj::indices(buckets)) { return i; };
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+      });
+
+      slots = kj::heapArray<uint64_t>(slotCount);
+      auto used = kj::heapArray<bool>(slotCount);
+      seeds = kj::heapArray<uint32_t>(bucketCount);
+      for (auto i: kj::indices(used)) {
+        slots[i] = 0;
+        used[i] = false;
+      }
+      for (auto& seed: seeds) seed = 0;
+
+      bool success = true;
+      for (auto b: order) {
+        auto& bucket = buckets[b];
+        if (bucket.size() == 0) break;
+
+        bool placed = false;
+        for (uint32_t seed = 1; seed < MAX_SEED && !placed; seed++) {
+          placed = true;
+          for (auto i: kj::indices(bucket)) {
+            uint32_t slot = _::RawSchemaIndex::hash(bucket[i], seed) & (slotCount - 1);
+            bool collides = used[slot];
+            for (auto j: kj::zeroTo(i)) {
+              collides = collides ||
+                  (_::RawSchemaIndex::hash(bucket[j], seed) & (slotCount - 1)) == slot;
+            }
+            if (collides) {
+              placed = false;
+              break;
+            }
+          }
+          if (placed) {
+            seeds[b] = seed;
+            for (auto id: bucket) {
+              uint32_t slot = _::RawSchemaIndex::hash(id, seed) & (slotCount - 1);
+              used[slot] = true;
+              slots[slot] = id;
+            }
+          }
+        }
+
+        if (!placed) {
+          success = false;
+          break;
+        }
+      }
+
+      if (success) break;
+    }
+
+    return kj::strTree(
+        "static const ::capnp::_::RawSchema* const xs_", hexId, "[] = {\n",
+        KJ_MAP(id, slots) {
+          return id == 0 ? kj::strTree("  nullptr,\n") : kj::strTree("  &s_", kj::hex(id), ",\n");
+        },
+        "};\n"
+        "static const uint32_t xh_", hexId, "[] = {",
+        kj::StringTree(KJ_MAP(seed, seeds) { return kj::strTree(seed); }, ", "),
+        "};\n"
+        "const ::capnp::_::RawSchemaIndex x_", hexId, " = {\n"
+        "  xs_", hexId, ", xh_", hexId, ", ", slots.size(), ", ", seeds.size(), ", ",
+        fileSchemaIds.size(), "\n"
+        "};\n");
+  }
+
   FileText makeFileText(Schema schema,
                         schema::CodeGeneratorRequest::RequestedFile::Reader request) {
     usedImports.clear();
+    fileSchemaIds.clear();
 
     auto node = schema.getProto();
     auto displayName = node.getDisplayName();
@@ -3010,6 +3267,8 @@ private:
       }
     }
 
+    outOfLine = annotationValue(node, OUT_OF_LINE_ANNOTATION_ID) != nullptr;
+
     auto nodeTexts = KJ_MAP(nested, node.getNestedNodes()) {
       return makeNodeText(namespacePrefix, "", nested.getName(),
                           schemaLoader.getUnbound(nested.getId()), TemplateContext());
@@ -3061,6 +3320,7 @@ private:
           "namespace schemas {\n"
           "\n",
           KJ_MAP(n, nodeTexts) { return kj::mv(n.capnpSchemaDecls); },
+          "CAPNP_DECLARE_SCHEMA_INDEX(", kj::hex(node.getId()), ");\n"
           "\n"
           "}  // namespace schemas\n"
           "}  // namespace capnp\n"
@@ -3086,16 +3346,86 @@ private:
           "namespace capnp {\n"
           "namespace schemas {\n",
           KJ_MAP(n, nodeTexts) { return kj::mv(n.capnpSchemaDefs); },
+          "#if !CAPNP_LITE\n",
+          makeSchemaIndex(node.getId()),
+          "#endif  // !CAPNP_LITE\n"
           "}  // namespace schemas\n"
           "}  // namespace capnp\n",
           sourceDefs.size() == 0 ? kj::strTree() : kj::strTree(
               "\n", separator, "\n",
               KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n",
               kj::mv(sourceDefs), "\n",
-              KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n"))
+              KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); }, "\n")),
+
+      outOfLine ? kj::Maybe<kj::StringTree>(makeForwardHeader(node, namespaceParts)) : nullptr
     };
   }
 
+  kj::StringTree makeForwardHeader(schema::Node::Reader fileNode,
+                                   kj::ArrayPtr<const kj::ArrayPtr<const char>> namespaceParts) {
+    // Declares the file's top-level structs, interfaces and enums without defining them. Nested
+    // types can't be declared outside of their parents, so they aren't included.
+
+    kj::Vector<kj::StringTree> enumDecls;
+    kj::Vector<kj::StringTree> typeDecls;
+
+    for (auto nested: fileNode.getNestedNodes()) {
+      auto proto = schemaLoader.getUnbound(nested.getId()).getProto();
+      kj::StringPtr name = nested.getName();
+      KJ_IF_MAYBE(annotatedName, annotationValue(proto, NAME_ANNOTATION_ID)) {
+        name = annotatedName->getText();
+      }
+
+      switch (proto.which()) {
+        case schema::Node::STRUCT:
+        case schema::Node::INTERFACE: {
+          auto params = proto.getParameters();
+          typeDecls.add(kj::strTree(
+              params.size() == 0 ? kj::strTree() : kj::strTree(
+                  "template <", kj::StringTree(KJ_MAP(p, params) {
+                    return kj::strTree("typename ", p.getName());
+                  }, ", "), ">\n"),
+              "struct ", name, ";\n"));
+          break;
+        }
+        case schema::Node::ENUM: {
+          auto hexId = kj::hex(proto.getId());
+          enumDecls.add(kj::strTree("enum class ", name, "_", hexId, ": uint16_t;\n"));
+          typeDecls.add(kj::strTree(
+              "typedef ::capnp::schemas::", name, "_", hexId, " ", name, ";\n"));
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    auto displayName = fileNode.getDisplayName();
+    return kj::strTree(
+        "// Generated by Cap'n Proto compiler, DO NOT EDIT\n"
+        "// source: ", baseName(displayName), "\n"
+        "//\n"
+        "// Forward declarations of the top-level types defined in ", baseName(displayName), ".h.\n"
+        "\n"
+        "#pragma once\n"
+        "\n"
+        "#include <stdint.h>\n"
+        "\n",
+        enumDecls.size() == 0 ? kj::strTree() : kj::strTree(
+            "namespace capnp {\n"
+            "namespace schemas {\n"
+            "\n",
+            enumDecls.releaseAsArray(),
+            "\n"
+            "}  // namespace schemas\n"
+            "}  // namespace capnp\n"
+            "\n"),
+        KJ_MAP(n, namespaceParts) { return kj::strTree("namespace ", n, " {\n"); }, "\n",
+        typeDecls.releaseAsArray(),
+        "\n",
+        KJ_MAP(n, namespaceParts) { return kj::strTree("}  // namespace\n"); });
+  }
+
   // -----------------------------------------------------------------
 
   kj::Own<kj::Filesystem> fs = kj::newDiskFilesystem();
@@ -3158,6 +3488,9 @@ private:
 
       writeFile(kj::str(schema.getProto().getDisplayName(), ".h"), fileText.header);
       writeFile(kj::str(schema.getProto().getDisplayName(), ".c++"), fileText.source);
+      KJ_IF_MAYBE(forwardHeader, fileText.forwardHeader) {
+        writeFile(kj::str(schema.getProto().getDisplayName(), "-fwd.h"), *forwardHeader);
+      }
     }
 
     return true;
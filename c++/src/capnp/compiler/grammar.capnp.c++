@@ -2775,6 +2775,78 @@ const ::capnp::_::RawSchema s_84e4f3f5a807605c = {
   1, 1, i_84e4f3f5a807605c, nullptr, nullptr, { &s_84e4f3f5a807605c, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_c56be168dcbbc3c6[] = {
+  &s_aa28e1400d793359,
+  &s_c90246b71adedbaa,
+  &s_fffe08a9a697d2a5,
+  &s_94099c3f9eb32d6b,
+  nullptr,
+  &s_e5104515fd88ea47,
+  nullptr,
+  nullptr,
+  &s_89f0c973c103ae96,
+  &s_eb971847d617c0b9,
+  &s_9cb9e86e3198037f,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_992a90eaf30235d3,
+  &s_90f2a60678fd2367,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_fb5aeed95cdf6af9,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_b348322a8dcf0d0c,
+  &s_8e207d4dfe54d0de,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_8f2622208fb358c8,
+  nullptr,
+  &s_c6238c7d62d65173,
+  nullptr,
+  nullptr,
+  &s_e93164a80bfe2ccf,
+  nullptr,
+  &s_b3f66e7a79d81bcd,
+  &s_aee8397040b0df7a,
+  &s_d0d1a21de617951f,
+  nullptr,
+  &s_84e4f3f5a807605c,
+  nullptr,
+  &s_96efe787c17e83bb,
+  nullptr,
+  &s_d00489d473826290,
+  &s_e75816b56529d464,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_991c7a3693d62cf2,
+  &s_d5e71144af1ce175,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+};
+static const uint32_t xh_c56be168dcbbc3c6[] = {0, 2, 1, 1, 0, 1, 3, 1, 2, 3, 4, 1, 2, 1, 0, 1};
+const ::capnp::_::RawSchemaIndex x_c56be168dcbbc3c6 = {
+  xs_c56be168dcbbc3c6, xh_c56be168dcbbc3c6, 64, 16, 25
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
@@ -41,6 +41,7 @@ CAPNP_DECLARE_SCHEMA(eb971847d617c0b9);
 CAPNP_DECLARE_SCHEMA(c6238c7d62d65173);
 CAPNP_DECLARE_SCHEMA(9cb9e86e3198037f);
 CAPNP_DECLARE_SCHEMA(84e4f3f5a807605c);
+CAPNP_DECLARE_SCHEMA_INDEX(c56be168dcbbc3c6);
 
 }  // namespace schemas
 }  // namespace capnp
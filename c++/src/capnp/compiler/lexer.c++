@@ -173,32 +173,34 @@ Lexer::Lexer(Orphanage orphanageParam, ErrorReporter& errorReporter)
         }
       }));
 
+  // Most alternatives are guarded by the characters they can start with, so that each token only
+  // tries to parse as the kinds of token it could actually be.
   auto& token = arena.copy(p::oneOf(
-      p::transformWithLocation(p::identifier,
+      p::transformWithLocation(p::guard(p::nameStart, p::identifier),
           [this](Location loc, kj::String name) -> Orphan<Token> {
             auto t = orphanage.newOrphan<Token>();
             initTok(t, loc).setIdentifier(name);
             return t;
           }),
-      p::transformWithLocation(p::doubleQuotedString,
+      p::transformWithLocation(p::guard(p::anyOfChars("\""), p::doubleQuotedString),
           [this](Location loc, kj::String text) -> Orphan<Token> {
             auto t = orphanage.newOrphan<Token>();
             initTok(t, loc).setStringLiteral(text);
             return t;
           }),
-      p::transformWithLocation(p::doubleQuotedHexBinary,
+      p::transformWithLocation(p::guard(p::anyOfChars("0"), p::doubleQuotedHexBinary),
           [this](Location loc, kj::Array<byte> data) -> Orphan<Token> {
             auto t = orphanage.newOrphan<Token>();
             initTok(t, loc).setBinaryLiteral(data);
             return t;
           }),
-      p::transformWithLocation(p::integer,
+      p::transformWithLocation(p::guard(p::digit, p::integer),
           [this](Location loc, uint64_t i) -> Orphan<Token> {
             auto t = orphanage.newOrphan<Token>();
             initTok(t, loc).setIntegerLiteral(i);
             return t;
           }),
-      p::transformWithLocation(p::number,
+      p::transformWithLocation(p::guard(p::digit, p::number),
           [this](Location loc, double x) -> Orphan<Token> {
             auto t = orphanage.newOrphan<Token>();
             initTok(t, loc).setFloatLiteral(x);
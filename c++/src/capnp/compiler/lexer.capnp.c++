@@ -454,6 +454,22 @@ const ::capnp::_::RawSchema s_a11f97b9d6c73dd4 = {
   1, 1, i_a11f97b9d6c73dd4, nullptr, nullptr, { &s_a11f97b9d6c73dd4, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_a73956d2621fc3ee[] = {
+  &s_a11f97b9d6c73dd4,
+  &s_9e69a92512b19d18,
+  nullptr,
+  nullptr,
+  &s_91cc55cd57de5419,
+  nullptr,
+  nullptr,
+  &s_c6725e678d60fa37,
+};
+static const uint32_t xh_a73956d2621fc3ee[] = {2, 1};
+const ::capnp::_::RawSchemaIndex x_a73956d2621fc3ee = {
+  xs_a73956d2621fc3ee, xh_a73956d2621fc3ee, 8, 2, 4
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
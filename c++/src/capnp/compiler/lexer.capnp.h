@@ -20,6 +20,7 @@ CAPNP_DECLARE_SCHEMA(91cc55cd57de5419);
 CAPNP_DECLARE_SCHEMA(c6725e678d60fa37);
 CAPNP_DECLARE_SCHEMA(9e69a92512b19d18);
 CAPNP_DECLARE_SCHEMA(a11f97b9d6c73dd4);
+CAPNP_DECLARE_SCHEMA_INDEX(a73956d2621fc3ee);
 
 }  // namespace schemas
 }  // namespace capnp
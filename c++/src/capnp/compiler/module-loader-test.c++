@@ -0,0 +1,204 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "module-loader.h"
+#include "compiler.h"
+#include "capnp/message.h"
+#include "kj/filesystem.h"
+#include "kj/test.h"
+
+namespace capnp {
+namespace compiler {
+namespace {
+
+class TestClock final: public kj::Clock {
+public:
+  void tick() { time += 1 * kj::SECONDS; }
+  kj::Date now() const override { return time; }
+
+private:
+  kj::Date time = kj::UNIX_EPOCH + 1 * kj::SECONDS;
+};
+
+class TestErrorReporter final: public GlobalErrorReporter {
+public:
+  void addError(const kj::ReadableDirectory& directory, kj::PathPtr path,
+                SourcePos start, SourcePos end, kj::StringPtr message) override {
+    errors.add(kj::str(path.toString(), ':', start.line + 1, ':', start.column + 1, ": ", message));
+  }
+
+  bool hadErrors() override { return errors.size() > 0; }
+
+  kj::Vector<kj::String> errors;
+};
+
+struct TestSources {
+  // An in-memory source tree and parse cache.
+
+  TestClock clock;
+  kj::Own<const kj::Directory> src = kj::newInMemoryDirectory(clock);
+  kj::Own<const kj::Directory> cache = kj::newInMemoryDirectory(clock);
+
+  void write(kj::StringPtr name, kj::StringPtr text) {
+    src->openFile(kj::Path(name), kj::WriteMode::CREATE | kj::WriteMode::MODIFY)->writeAll(text);
+  }
+
+  kj::Path cacheSubdir() { return kj::Path(kj::str("capnp-parse-", CAPNP_VERSION)); }
+
+  kj::Array<kj::String> cacheEntries() {
+    KJ_IF_MAYBE(dir, cache->tryOpenSubdir(cacheSubdir())) {
+      return dir->get()->listNames();
+    } else {
+      return nullptr;
+    }
+  }
+
+  kj::String parse(kj::StringPtr name, TestErrorReporter& errors) {
+    // Parses `name` with a fresh ModuleLoader using the cache, returning the stringified
+    // ParsedFile.
+
+    ModuleLoader loader(errors);
+    loader.setCacheDirectory(*cache);
+    auto& module = KJ_ASSERT_NONNULL(loader.loadModule(*src, kj::Path(name)));
+    MallocMessageBuilder message;
+    return kj::str(module.loadContent(message.getOrphanage()).getReader());
+  }
+
+  kj::String parse(kj::StringPtr name) {
+    TestErrorReporter errors;
+    auto result = parse(name, errors);
+    KJ_EXPECT(errors.errors.size() == 0, kj::strArray(errors.errors, "\n"));
+    return result;
+  }
+};
+
+KJ_TEST("ModuleLoader parse cache") {
+  TestSources sources;
+  sources.write("foo.capnp", "@0xbf5147cbbecf40c1;\nstruct Foo { x @0 :UInt32; }\n");
+
+  auto expected = sources.parse("foo.capnp");
+  auto entries = sources.cacheEntries();
+  KJ_ASSERT(entries.size() == 1);
+  auto entry = sources.cache->openFile(sources.cacheSubdir().append(entries[0]));
+  KJ_EXPECT(entry->stat().lastModified == sources.clock.now());
+  sources.clock.tick();
+
+  // Hit: same result, and the entry isn't written again.
+  KJ_EXPECT(sources.parse("foo.capnp") == expected);
+  KJ_EXPECT(entry->stat().lastModified != sources.clock.now());
+
+  // A corrupt entry is treated as a miss, and rewritten.
+  sources.cache->openFile(sources.cacheSubdir().append(entries[0]), kj::WriteMode::MODIFY)
+      ->writeAll("not a cache entry");
+  KJ_EXPECT(sources.parse("foo.capnp") == expected);
+  entry = sources.cache->openFile(sources.cacheSubdir().append(entries[0]));
+  KJ_EXPECT(entry->stat().lastModified == sources.clock.now());
+  sources.clock.tick();
+  KJ_EXPECT(sources.parse("foo.capnp") == expected);
+  KJ_EXPECT(entry->stat().lastModified != sources.clock.now());
+
+  // Changed content misses, and gets an entry of its own.
+  sources.write("foo.capnp", "@0xbf5147cbbecf40c1;\nstruct Foo { x @0 :UInt32; y @1 :Text; }\n");
+  auto changed = sources.parse("foo.capnp");
+  KJ_EXPECT(changed != expected);
+  KJ_EXPECT(sources.cacheEntries().size() == 2);
+  KJ_EXPECT(sources.parse("foo.capnp") == changed);
+
+  // A file with errors isn't cached, so its errors are reported every time.
+  sources.write("bad.capnp", "@0xbf5147cbbecf40c1;\nstruct Bad { x @0 :UInt32 }\n");
+  for (auto i KJ_UNUSED: kj::zeroTo(2)) {
+    TestErrorReporter errors;
+    sources.parse("bad.capnp", errors);
+    KJ_EXPECT(errors.errors.size() > 0);
+    KJ_EXPECT(sources.cacheEntries().size() == 2);
+  }
+}
+
+KJ_TEST("ModuleLoader::preload() matches parsing one module at a time") {
+  TestSources sources;
+  kj::StringPtr names[] = { "a.capnp", "bad1.capnp", "b.capnp", "bad2.capnp", "c.capnp" };
+  sources.write("a.capnp", "@0xbf5147cbbecf40c1;\nstruct A { x @0 :UInt32; }\n");
+  sources.write("bad1.capnp", "@0xd7f9a5a4e5c2b3a1;\nstruct Bad1 { x @0 :UInt32 }\n");
+  sources.write("b.capnp", "@0xe1c8f9b6a3d2c4b5;\nenum B { x @0; y @1; }\n");
+  sources.write("bad2.capnp", "@0xf3a2b1c4d5e6f7a8;\n\nstruct Bad2 { x @0 :UInt32; ");
+  sources.write("c.capnp", "@0xc2b3a4d5e6f7a8b9;\nconst c :Text = \"c\";\n");
+
+  struct Result {
+    kj::String parsed;
+    kj::Vector<kj::String> errors;
+  };
+
+  auto run = [&](uint threadCount) {
+    // Loads all the modules, preloads them, then asks for each module's content in order as the
+    // compiler would, collecting the errors reported for each one.
+
+    TestErrorReporter errors;
+    ModuleLoader loader(errors);
+    kj::Vector<Module*> modules;
+    for (auto name: names) {
+      modules.add(&KJ_ASSERT_NONNULL(loader.loadModule(*sources.src, kj::Path(name))));
+    }
+
+    loader.preload(modules, threadCount);
+    KJ_EXPECT(errors.errors.size() == 0, "errors must be held back until loadContent()");
+
+    kj::Vector<Result> results;
+    size_t reported = 0;
+    for (auto module: modules) {
+      MallocMessageBuilder message;
+      auto& result = results.add();
+      result.parsed = kj::str(module->loadContent(message.getOrphanage()).getReader());
+      for (; reported < errors.errors.size(); reported++) {
+        result.errors.add(kj::mv(errors.errors[reported]));
+      }
+    }
+    return results.releaseAsArray();
+  };
+
+  auto sequential = run(1);
+  for (auto i: kj::indices(names)) {
+    if (names[i].startsWith("bad")) {
+      KJ_EXPECT(sequential[i].errors.size() > 0, names[i]);
+    } else {
+      KJ_EXPECT(sequential[i].errors.size() == 0, names[i]);
+    }
+    for (auto& error: sequential[i].errors) {
+      KJ_EXPECT(error.startsWith(kj::str(names[i], ':')), error);
+    }
+  }
+
+  for (auto attempt KJ_UNUSED: kj::zeroTo(10)) {
+    // Scheduling varies between runs, so try a few times.
+    auto parallel = run(4);
+    for (auto i: kj::indices(names)) {
+      if (!names[i].startsWith("bad")) {
+        // (Files that fail to parse get a random ID, so their results differ from run to run.)
+        KJ_EXPECT(parallel[i].parsed == sequential[i].parsed, names[i]);
+      }
+      KJ_EXPECT(kj::strArray(parallel[i].errors, "\n") == kj::strArray(sequential[i].errors, "\n"),
+                names[i]);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace compiler
+}  // namespace capnp
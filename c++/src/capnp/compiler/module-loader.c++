@@ -26,7 +26,9 @@
 #include "kj/mutex.h"
 #include "kj/debug.h"
 #include "kj/io.h"
+#include "kj/thread.h"
 #include "capnp/message.h"
+#include "capnp/serialize.h"
 #include <unordered_map>
 
 namespace capnp {
@@ -131,6 +133,13 @@ public:
     searchPath.add(&dir);
   }
 
+  void setCacheDirectory(const kj::Directory& dir) {
+    cacheDir = dir;
+  }
+
+  kj::Maybe<Orphan<ParsedFile>> readCache(kj::ArrayPtr<const char> content, Orphanage orphanage);
+  void writeCache(kj::ArrayPtr<const char> content, ParsedFile::Reader parsed);
+
   kj::Maybe<Module&> loadModule(const kj::ReadableDirectory& dir, kj::PathPtr path);
   kj::Maybe<Module&> loadModuleFromSearchPath(kj::PathPtr path);
   kj::Maybe<kj::Array<const byte>> readEmbed(const kj::ReadableDirectory& dir, kj::PathPtr path);
@@ -141,6 +150,7 @@ private:
   GlobalErrorReporter& errorReporter;
   kj::Vector<const kj::ReadableDirectory*> searchPath;
   std::unordered_map<FileKey, kj::Own<Module>, FileKeyHash> modules;
+  kj::Maybe<const kj::Directory&> cacheDir;
 };
 
 class ModuleLoader::ModuleImpl final: public Module {
@@ -161,18 +171,33 @@ public:
   }
 
   Orphan<ParsedFile> loadContent(Orphanage orphanage) override {
+    KJ_IF_MAYBE(p, preloaded) {
+      auto parsed = orphanage.newOrphanCopy(p->get()->message.getRoot<ParsedFile>().asReader());
+      auto errors = kj::mv(p->get()->errors);
+      preloaded = nullptr;  // In case loadContent() is called multiple times.
+      for (auto& error: errors) {
+        addError(error.startByte, error.endByte, error.message);
+      }
+      return parsed;
+    }
+
     kj::Array<const char> content = file->mmap(0, file->stat().size).releaseAsChars();
+    return parse(content, orphanage);
+  }
 
-    lineBreaks = nullptr;  // In case loadContent() is called multiple times.
-    lineBreaks = lineBreaksSpace.construct(content);
+  void preload() {
+    // Does the work of loadContent() ahead of time, possibly on another thread. Must not touch
+    // anything shared with other modules.
 
-    MallocMessageBuilder lexedBuilder;
-    auto statements = lexedBuilder.initRoot<LexedStatements>();
-    lex(content, statements, *this);
+    if (preloaded != nullptr) return;
 
-    auto parsed = orphanage.newOrphan<ParsedFile>();
-    parseFile(statements.getStatements(), parsed.get(), *this);
-    return parsed;
+    auto result = kj::heap<Preloaded>();
+    bufferedErrors = &result->errors;
+    KJ_DEFER(bufferedErrors = nullptr);
+
+    kj::Array<const char> content = file->mmap(0, file->stat().size).releaseAsChars();
+    result->message.adoptRoot(parse(content, result->message.getOrphanage()));
+    preloaded = kj::mv(result);
   }
 
   kj::Maybe<Module&> importRelative(kj::StringPtr importPath) override {
@@ -192,6 +217,11 @@ public:
   }
 
   void addError(uint32_t startByte, uint32_t endByte, kj::StringPtr message) override {
+    KJ_IF_MAYBE(errors, bufferedErrors) {
+      errors->add(BufferedError { startByte, endByte, kj::str(message) });
+      return;
+    }
+
     auto& lines = *KJ_REQUIRE_NONNULL(lineBreaks,
         "Can't report errors until loadContent() is called.");
 
@@ -200,6 +230,10 @@ public:
   }
 
   bool hadErrors() override {
+    KJ_IF_MAYBE(errors, bufferedErrors) {
+      // Other modules may be parsing concurrently, so we only know about our own errors.
+      return errors->size() > 0;
+    }
     return loader.getErrorReporter().hadErrors();
   }
 
@@ -212,6 +246,47 @@ private:
 
   kj::SpaceFor<LineBreakTable> lineBreaksSpace;
   kj::Maybe<kj::Own<LineBreakTable>> lineBreaks;
+
+  Orphan<ParsedFile> parse(kj::ArrayPtr<const char> content, Orphanage orphanage) {
+    lineBreaks = nullptr;  // In case loadContent() is called multiple times.
+    lineBreaks = lineBreaksSpace.construct(content);
+
+    KJ_IF_MAYBE(cached, loader.readCache(content, orphanage)) {
+      return kj::mv(*cached);
+    }
+
+    MallocMessageBuilder lexedBuilder;
+    auto statements = lexedBuilder.initRoot<LexedStatements>();
+    lex(content, statements, *this);
+
+    auto parsed = orphanage.newOrphan<ParsedFile>();
+    parseFile(statements.getStatements(), parsed.get(), *this);
+
+    if (!hadErrors()) {
+      // Files with errors aren't cached, so that the errors are reported again next time. (When
+      // not preloading, hadErrors() also covers other files, so we may skip caching needlessly,
+      // but it's the only way to be sure that e.g. a missing file ID was reported.)
+      loader.writeCache(content, parsed.getReader());
+    }
+    return parsed;
+  }
+
+  struct BufferedError {
+    uint32_t startByte;
+    uint32_t endByte;
+    kj::String message;
+  };
+
+  struct Preloaded {
+    MallocMessageBuilder message;
+    kj::Vector<BufferedError> errors;
+  };
+
+  kj::Maybe<kj::Own<Preloaded>> preloaded;
+  // Set by preload(), consumed by the next loadContent().
+
+  kj::Maybe<kj::Vector<BufferedError>&> bufferedErrors;
+  // Non-null while preload() is running.
 };
 
 // =======================================================================================
@@ -251,6 +326,77 @@ kj::Maybe<Module&> ModuleLoader::Impl::loadModuleFromSearchPath(kj::PathPtr path
   return nullptr;
 }
 
+// -------------------------------------------------------------------
+// Parse cache
+//
+// Each entry is named after a hash of the source file's content, and consists of two flat
+// messages: the complete source content, which we compare against to rule out hash collisions,
+// followed by the ParsedFile.
+
+static kj::Path cachePath(kj::ArrayPtr<const char> content) {
+  // FNV-1a. We don't need a cryptographic hash since entries are verified anyway.
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c: content) {
+    hash = (hash ^ static_cast<byte>(c)) * 0x100000001b3ull;
+  }
+
+  // The version is part of the path so that a new compiler never sees stale entries.
+  return kj::Path({
+    kj::str("capnp-parse-", CAPNP_VERSION),
+    kj::str(kj::hex(hash), '-', content.size())
+  });
+}
+
+kj::Maybe<Orphan<ParsedFile>> ModuleLoader::Impl::readCache(
+    kj::ArrayPtr<const char> content, Orphanage orphanage) {
+  KJ_IF_MAYBE(dir, cacheDir) {
+    KJ_IF_MAYBE(file, dir->tryOpenFile(cachePath(content))) {
+      auto bytes = file->get()->readAllBytes();
+      auto words = kj::heapArray<word>(bytes.size() / sizeof(word));
+      memcpy(words.begin(), bytes.begin(), words.asBytes().size());
+
+      kj::Maybe<Orphan<ParsedFile>> result;
+      kj::runCatchingExceptions([&]() {
+        // A corrupt entry throws, and is treated like a miss.
+        FlatArrayMessageReader sourceReader(words);
+        if (sourceReader.getRoot<AnyPointer>().getAs<Data>() == content.asBytes()) {
+          FlatArrayMessageReader parsedReader(
+              kj::arrayPtr(sourceReader.getEnd(), words.asPtr().asConst().end()));
+          result = orphanage.newOrphanCopy(parsedReader.getRoot<ParsedFile>());
+        }
+      });
+      return kj::mv(result);
+    }
+  }
+  return nullptr;
+}
+
+void ModuleLoader::Impl::writeCache(kj::ArrayPtr<const char> content, ParsedFile::Reader parsed) {
+  KJ_IF_MAYBE(dir, cacheDir) {
+    kj::runCatchingExceptions([&]() {
+      // Failing to write the cache is not an error; we just don't get the speedup next time.
+
+      MallocMessageBuilder sourceMessage;
+      sourceMessage.getRoot<AnyPointer>().setAs<Data>(content.asBytes());
+      auto sourceWords = messageToFlatArray(sourceMessage);
+
+      MallocMessageBuilder parsedMessage;
+      parsedMessage.setRoot(parsed);
+      auto parsedWords = messageToFlatArray(parsedMessage);
+
+      // Write atomically, since concurrent compiler invocations may share a cache directory.
+      auto replacer = dir->replaceFile(cachePath(content),
+          kj::WriteMode::CREATE | kj::WriteMode::MODIFY | kj::WriteMode::CREATE_PARENT);
+      auto& file = replacer->get();
+      file.write(0, sourceWords.asBytes());
+      file.write(sourceWords.asBytes().size(), parsedWords.asBytes());
+      replacer->commit();
+    });
+  }
+}
+
+// -------------------------------------------------------------------
+
 kj::Maybe<kj::Array<const byte>> ModuleLoader::Impl::readEmbed(
     const kj::ReadableDirectory& dir, kj::PathPtr path) {
   KJ_IF_MAYBE(file, dir.tryOpenFile(path)) {
@@ -278,9 +424,41 @@ void ModuleLoader::addImportPath(const kj::ReadableDirectory& dir) {
   impl->addImportPath(dir);
 }
 
+void ModuleLoader::setCacheDirectory(const kj::Directory& dir) {
+  impl->setCacheDirectory(dir);
+}
+
 kj::Maybe<Module&> ModuleLoader::loadModule(const kj::ReadableDirectory& dir, kj::PathPtr path) {
   return impl->loadModule(dir, path);
 }
 
+void ModuleLoader::preload(kj::ArrayPtr<Module* const> modules, uint threadCount) {
+  // All modules returned by loadModule() are ModuleImpls.
+  auto work = KJ_MAP(module, modules) { return static_cast<ModuleImpl*>(module); };
+
+  threadCount = kj::min(threadCount, work.size());
+  if (threadCount <= 1) {
+    // Nothing to gain; let loadContent() parse as usual.
+    return;
+  }
+
+  // Each thread claims the next unparsed module until none are left. A module that fails to
+  // preload is simply parsed again, normally, when the compiler asks for it.
+  kj::MutexGuarded<size_t> next(0);
+  auto worker = [&]() {
+    for (;;) {
+      size_t i = (*next.lockExclusive())++;
+      if (i >= work.size()) break;
+      kj::runCatchingExceptions([&]() { work[i]->preload(); });
+    }
+  };
+
+  auto threads = kj::heapArrayBuilder<kj::Own<kj::Thread>>(threadCount - 1);
+  for (uint i = 1; i < threadCount; i++) {
+    threads.add(kj::heap<kj::Thread>(worker));
+  }
+  worker();
+}
+
 }  // namespace compiler
 }  // namespace capnp
@@ -45,10 +45,22 @@ public:
   void addImportPath(const kj::ReadableDirectory& dir);
   // Add a directory to the list of paths that is searched for imports that start with a '/'.
 
+  void setCacheDirectory(const kj::Directory& dir);
+  // Cache parsed files in the given directory, keyed by their content, so that unchanged files
+  // don't need to be lexed and parsed again by later runs. The directory may be shared between
+  // concurrent runs.
+
   kj::Maybe<Module&> loadModule(const kj::ReadableDirectory& dir, kj::PathPtr path);
   // Tries to load a module with the given path inside the given directory. Returns nullptr if the
   // file doesn't exist.
 
+  void preload(kj::ArrayPtr<Module* const> modules, uint threadCount);
+  // Lex and parse the given modules -- which must have been returned by this loader -- using up
+  // to `threadCount` threads, so that the compiler's later calls to loadContent() only need to
+  // copy the result. Errors found while parsing are held back and reported when loadContent() is
+  // called, so their order doesn't depend on thread scheduling. Does nothing if `threadCount` is
+  // 1.
+
 private:
   class Impl;
   kj::Own<Impl> impl;
@@ -0,0 +1,223 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "cross-thread.h"
+#include "test-util.h"
+#include <kj/debug.h>
+#include <kj/mutex.h>
+#include <kj/thread.h>
+#include <kj/test.h>
+
+namespace capnp {
+namespace _ {
+namespace {
+
+void runOnOtherThread(kj::WaitScope& waitScope, kj::Function<void(kj::WaitScope&)> func) {
+  // Runs `func` on a new thread with an event loop of its own, while this thread's loop keeps
+  // running to serve calls.
+
+  auto paf = kj::newPromiseAndCrossThreadFulfiller<void>();
+  kj::Thread thread([&]() noexcept {
+    kj::EventLoop loop;
+    kj::WaitScope threadWaitScope(loop);
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() { func(threadWaitScope); })) {
+      paf.fulfiller->reject(kj::mv(*exception));
+    } else {
+      paf.fulfiller->fulfill();
+    }
+  });
+  paf.promise.wait(waitScope);
+}
+
+class ParamsRecorder final: public test::TestInterface::Server {
+public:
+  const byte* params = nullptr;
+
+  kj::Promise<void> foo(FooContext context) override {
+    params = AnyStruct::Reader(context.getParams()).getDataSection().begin();
+    context.getResults().setX("foo");
+    return kj::READY_NOW;
+  }
+};
+
+class CapRecorder final: public test::TestMoreStuff::Server {
+public:
+  ClientHook* cap = nullptr;
+
+  kj::Promise<void> hold(HoldContext context) override {
+    held = context.getParams().getCap();
+    cap = ClientHook::from(kj::cp(held)).get();
+    return kj::READY_NOW;
+  }
+
+private:
+  test::TestInterface::Client held = nullptr;
+};
+
+KJ_TEST("cross-thread calls, with capabilities passed both ways") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  int callCount = 0;
+  int handleCount = 0;
+  CrossThreadCapability handle(
+      test::TestMoreStuff::Client(kj::heap<TestMoreStuffImpl>(callCount, handleCount)));
+
+  runOnOtherThread(waitScope, [&](kj::WaitScope& waitScope) {
+    int chainedCallCount = 0;
+    auto client = handle.getClient<test::TestMoreStuff>();
+
+    // The server calls back to a capability belonging to this thread.
+    auto request = client.callFooRequest();
+    request.setCap(kj::heap<TestInterfaceImpl>(chainedCallCount));
+    auto response = request.send().wait(waitScope);
+    KJ_EXPECT(response.getS() == "bar");
+    KJ_EXPECT(chainedCallCount == 1);
+
+    // A capability returned to this thread calls back to the server's thread.
+    auto cap = client.getHandleRequest().send().wait(waitScope).getHandle();
+    KJ_EXPECT(handleCount == 1);
+    cap = nullptr;
+  });
+
+  KJ_EXPECT(callCount == 1);
+
+  // The handle dropped on the other thread is released here.
+  waitScope.poll();
+  KJ_EXPECT(handleCount == 0);
+}
+
+KJ_TEST("cross-thread calls arrive in E-order") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  CrossThreadCapability handle(test::TestCallOrder::Client(kj::heap<TestCallOrderImpl>()));
+
+  runOnOtherThread(waitScope, [&](kj::WaitScope& waitScope) {
+    auto client = handle.getClient<test::TestCallOrder>();
+
+    kj::Vector<RemotePromise<test::TestCallOrder::GetCallSequenceResults>> promises;
+    for (uint i = 0; i < 100; i++) {
+      auto request = client.getCallSequenceRequest();
+      request.setExpected(i);
+      promises.add(request.send());
+    }
+    for (uint i = 0; i < promises.size(); i++) {
+      KJ_EXPECT(promises[i].wait(waitScope).getN() == i);
+    }
+  });
+}
+
+KJ_TEST("cross-thread promise pipelining") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  int callCount = 0;
+  CrossThreadCapability handle(test::TestPipeline::Client(kj::heap<TestPipelineImpl>(callCount)));
+
+  runOnOtherThread(waitScope, [&](kj::WaitScope& waitScope) {
+    int chainedCallCount = 0;
+    auto client = handle.getClient<test::TestPipeline>();
+
+    auto request = client.getCapRequest();
+    request.setN(234);
+    request.setInCap(test::TestInterface::Client(kj::heap<TestInterfaceImpl>(chainedCallCount)));
+
+    auto promise = request.send();
+
+    auto pipelineRequest = promise.getOutBox().getCap().fooRequest();
+    pipelineRequest.setI(321);
+    auto pipelinePromise = pipelineRequest.send();
+
+    auto pipelineRequest2 = promise.getOutBox().getCap().castAs<test::TestExtends>().graultRequest();
+    auto pipelinePromise2 = pipelineRequest2.send();
+
+    promise = nullptr;  // Just to be annoying, drop the original promise.
+
+    auto response = pipelinePromise.wait(waitScope);
+    KJ_EXPECT(response.getX() == "bar");
+
+    auto response2 = pipelinePromise2.wait(waitScope);
+    checkTestMessage(response2);
+
+    KJ_EXPECT(chainedCallCount == 1);
+  });
+
+  KJ_EXPECT(callCount == 3);
+}
+
+KJ_TEST("cross-thread calls hand over the params message") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  auto recorder = kj::heap<ParamsRecorder>();
+  auto& recorderRef = *recorder;
+  CrossThreadCapability handle(test::TestInterface::Client(kj::mv(recorder)));
+
+  auto capRecorder = kj::heap<CapRecorder>();
+  auto& capRecorderRef = *capRecorder;
+  CrossThreadCapability capRecorderHandle(test::TestMoreStuff::Client(kj::mv(capRecorder)));
+
+  const byte* built = nullptr;
+  runOnOtherThread(waitScope, [&](kj::WaitScope& waitScope) {
+    auto client = handle.getClient<test::TestInterface>();
+
+    auto request = client.fooRequest();
+    request.setI(123);
+    built = AnyStruct::Builder(test::TestInterface::FooParams::Builder(request))
+        .getDataSection().begin();
+    KJ_EXPECT(request.send().wait(waitScope).getX() == "foo");
+
+    // Passing the capability back to its own thread gives the original.
+    auto holdRequest = capRecorderHandle.getClient<test::TestMoreStuff>().holdRequest();
+    holdRequest.setCap(client);
+    holdRequest.send().wait(waitScope);
+  });
+
+  KJ_EXPECT(recorderRef.params == built);
+  KJ_EXPECT(capRecorderRef.cap == ClientHook::from(handle.getClient()).get());
+}
+
+KJ_TEST("cross-thread calls fail once the owner's event loop is gone") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  kj::MutexGuarded<kj::Maybe<CrossThreadCapability>> handle;
+  {
+    kj::Thread thread([&]() noexcept {
+      kj::EventLoop loop;
+      kj::WaitScope waitScope(loop);
+      int callCount = 0;
+      *handle.lockExclusive() =
+          CrossThreadCapability(test::TestInterface::Client(kj::heap<TestInterfaceImpl>(callCount)));
+    });
+  }
+
+  auto client = KJ_ASSERT_NONNULL(*handle.lockExclusive()).getClient<test::TestInterface>();
+  auto request = client.fooRequest();
+  request.setI(123);
+  request.setJ(true);
+  KJ_EXPECT_THROW(DISCONNECTED, request.send().wait(waitScope));
+}
+
+}  // namespace
+}  // namespace _
+}  // namespace capnp
@@ -0,0 +1,540 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "cross-thread.h"
+#include "message.h"
+#include <kj/debug.h>
+
+namespace capnp {
+
+namespace {
+
+static inline uint firstSegmentSize(kj::Maybe<MessageSize> sizeHint) {
+  KJ_IF_MAYBE(s, sizeHint) {
+    return s->wordCount;
+  } else {
+    return SUGGESTED_FIRST_SEGMENT_WORDS;
+  }
+}
+
+kj::Own<kj::PromiseFulfiller<void>> keepOnThisThread(kj::Own<void> object) {
+  // Keeps `object` alive until the returned fulfiller is fulfilled or destroyed, which may happen
+  // on any thread, and then destroys it on this one. If this thread's event loop exits first, the
+  // object is destroyed along with it.
+
+  auto paf = kj::newPromiseAndCrossThreadFulfiller<void>();
+  paf.promise.attach(kj::mv(object)).detach([](kj::Exception&&) {});
+  return kj::mv(paf.fulfiller);
+}
+
+static const char CROSS_THREAD_BRAND = 0;
+// Returned by CrossThreadClient::getBrand().
+
+}  // namespace
+
+namespace _ {  // private
+
+class CrossThreadPipeline;
+class CrossThreadClient;
+
+struct CrossThreadMessage {
+  // A message on its way to another thread, along with the capabilities its cap table refers to.
+
+  kj::Own<MallocMessageBuilder> message;
+  kj::Array<kj::Maybe<kj::Own<const CrossThreadTarget>>> caps;
+};
+
+struct CrossThreadCall {
+  uint64_t interfaceId;
+  uint16_t methodId;
+  CrossThreadMessage params;
+  kj::Maybe<kj::TimePoint> deadline;
+  kj::Own<const CrossThreadPipeline> pipeline;
+};
+
+kj::Array<kj::Maybe<kj::Own<const CrossThreadTarget>>> exportCaps(
+    kj::ArrayPtr<kj::Maybe<kj::Own<ClientHook>>> table);
+// Prepares the capabilities of a message built on this thread to be handed to another.
+
+kj::Array<kj::Maybe<kj::Own<ClientHook>>> importCaps(
+    kj::ArrayPtr<kj::Maybe<kj::Own<const CrossThreadTarget>>> caps);
+// Turns the capabilities of a message handed over from another thread into clients usable here.
+
+// =======================================================================================
+// Shared between threads
+
+class CrossThreadPipeline final: public kj::AtomicRefcounted {
+  // The pipeline of a call made across threads, shared by the caller's thread, which hands out
+  // pipelined capabilities, and the owner thread, which has the actual PipelineHook.
+
+public:
+  explicit CrossThreadPipeline(const kj::Executor& executor): executor(executor.addRef()) {}
+
+  const kj::Executor& getExecutor() const { return *executor; }
+
+  void setHook(kj::Own<PipelineHook> hook) const {
+    // Called on the owner thread when the call is delivered.
+
+    auto& state = getState();
+    KJ_IF_MAYBE(f, state.fulfiller) {
+      f->get()->fulfill(kj::mv(hook));
+    } else {
+      state.hook = kj::mv(hook);
+    }
+  }
+
+  PipelineHook& getHook() const {
+    // Called on the owner thread. A pipelined call made from a thread other than the caller's can
+    // arrive before the call itself, in which case it's queued until then.
+
+    auto& state = getState();
+    if (state.hook.get() == nullptr) {
+      auto paf = kj::newPromiseAndFulfiller<kj::Own<PipelineHook>>();
+      state.hook = newLocalPromisePipeline(kj::mv(paf.promise));
+      state.fulfiller = kj::mv(paf.fulfiller);
+    }
+    return *state.hook;
+  }
+
+private:
+  struct State {
+    kj::Own<PipelineHook> hook;
+    kj::Maybe<kj::Own<kj::PromiseFulfiller<kj::Own<PipelineHook>>>> fulfiller;
+  };
+
+  kj::Own<const kj::Executor> executor;
+
+  mutable State* state = nullptr;
+  mutable kj::Own<kj::PromiseFulfiller<void>> release;
+  // `state` belongs to the owner thread, which creates it on first use and destroys it once this
+  // object is gone.
+
+  State& getState() const {
+    if (state == nullptr) {
+      auto owned = kj::heap<State>();
+      state = owned.get();
+      release = keepOnThisThread(kj::mv(owned));
+    }
+    return *state;
+  }
+};
+
+class CrossThreadTarget final: public kj::AtomicRefcounted {
+  // What a cross-thread client calls: a capability belonging to the thread running `executor`, or
+  // a capability-to-be in the results of a call made to that thread.
+
+public:
+  explicit CrossThreadTarget(kj::Own<ClientHook> hook)
+      : executor(kj::getCurrentThreadExecutor().addRef()),
+        hook(hook.get()), release(keepOnThisThread(kj::mv(hook))) {}
+  CrossThreadTarget(kj::Own<const CrossThreadPipeline> pipeline, kj::Array<PipelineOp> ops)
+      : executor(pipeline->getExecutor().addRef()), pipeline(kj::mv(pipeline)), ops(kj::mv(ops)) {}
+
+  const kj::Executor& getExecutor() const { return *executor; }
+
+  bool isOwnedByThisThread() const {
+    return &kj::getCurrentThreadExecutor() == executor.get();
+  }
+
+  ClientHook& getHook() const {
+    // Called on the owner thread.
+
+    if (hook == nullptr) {
+      // A pipelined capability, used for the first time.
+      auto owned = pipeline->getHook().getPipelinedCap(ops);
+      hook = owned.get();
+      release = keepOnThisThread(kj::mv(owned));
+    }
+    return *hook;
+  }
+
+  kj::Promise<kj::Own<CrossThreadMessage>> deliver(CrossThreadCall& call) const;
+  // Called on the owner thread to start a call. Resolves to the results.
+
+private:
+  kj::Own<const kj::Executor> executor;
+
+  kj::Own<const CrossThreadPipeline> pipeline;
+  kj::Array<PipelineOp> ops;
+  // Set if this is a pipelined capability.
+
+  mutable ClientHook* hook = nullptr;
+  mutable kj::Own<kj::PromiseFulfiller<void>> release;
+  // `hook` belongs to the owner thread, and is destroyed there once this object is gone.
+};
+
+// =======================================================================================
+// Owner thread side
+
+class CrossThreadCallContext final: public CallContextHook, public kj::Refcounted {
+  // The server reads the params in the message the caller built, and writes the results into a
+  // message which is then handed back whole.
+
+public:
+  CrossThreadCallContext(CrossThreadMessage&& params, kj::Maybe<kj::TimePoint> deadline)
+      : params(kj::heap<Params>(kj::mv(params))), deadline(deadline) {}
+
+  kj::Own<CrossThreadMessage> takeResults() {
+    // Called once the call is done.
+
+    auto result = kj::heap<CrossThreadMessage>();
+    KJ_IF_MAYBE(r, tailResponse) {
+      // The results of a tail call are in that call's response, which belongs to this thread, so
+      // this is the one case where they're copied.
+      BuilderCapabilityTable caps;
+      result->message = kj::heap<MallocMessageBuilder>(r->targetSize().wordCount + 1);
+      caps.imbue(result->message->getRoot<AnyPointer>()).set(*r);
+      result->caps = exportCaps(caps.getTable());
+    } else {
+      getResults(MessageSize { 0, 0 });
+      result->message = kj::mv(responseMessage);
+      result->caps = exportCaps(responseCaps.getTable());
+    }
+    return result;
+  }
+
+  AnyPointer::Reader getParams() override {
+    KJ_REQUIRE(params.get() != nullptr, "Can't call getParams() after releaseParams().");
+    return params->caps.imbue(params->message->getRoot<AnyPointer>().asReader());
+  }
+  void releaseParams() override {
+    params = nullptr;
+  }
+  kj::Own<void> releaseParamsMessage() override {
+    return kj::mv(params);
+  }
+  AnyPointer::Builder getResults(kj::Maybe<MessageSize> sizeHint) override {
+    if (responseMessage.get() == nullptr) {
+      responseMessage = kj::heap<MallocMessageBuilder>(firstSegmentSize(sizeHint));
+      responseBuilder = responseCaps.imbue(responseMessage->getRoot<AnyPointer>());
+    }
+    return responseBuilder;
+  }
+  void setPipeline(kj::Own<PipelineHook>&& pipeline) override {
+    KJ_IF_MAYBE(f, tailCallPipelineFulfiller) {
+      f->get()->fulfill(AnyPointer::Pipeline(kj::mv(pipeline)));
+    }
+  }
+  kj::Promise<void> tailCall(kj::Own<RequestHook>&& request) override {
+    auto result = directTailCall(kj::mv(request));
+    KJ_IF_MAYBE(f, tailCallPipelineFulfiller) {
+      f->get()->fulfill(AnyPointer::Pipeline(kj::mv(result.pipeline)));
+    }
+    return kj::mv(result.promise);
+  }
+  ClientHook::VoidPromiseAndPipeline directTailCall(kj::Own<RequestHook>&& request) override {
+    KJ_REQUIRE(responseMessage.get() == nullptr,
+               "Can't call tailCall() after initializing the results struct.");
+
+    auto promise = request->send();
+
+    auto voidPromise = promise.then([this](Response<AnyPointer>&& response) {
+      tailResponse = kj::mv(response);
+    });
+
+    return { kj::mv(voidPromise), PipelineHook::from(kj::mv(promise)) };
+  }
+  kj::Promise<AnyPointer::Pipeline> onTailCall() override {
+    auto paf = kj::newPromiseAndFulfiller<AnyPointer::Pipeline>();
+    tailCallPipelineFulfiller = kj::mv(paf.fulfiller);
+    return kj::mv(paf.promise);
+  }
+  void allowCancellation() override {
+    cancelAllowedFulfiller->fulfill();
+  }
+  kj::Own<CallContextHook> addRef() override {
+    return kj::addRef(*this);
+  }
+  kj::Maybe<kj::TimePoint> getDeadline() override {
+    return deadline;
+  }
+
+  kj::Own<kj::PromiseFulfiller<void>> cancelAllowedFulfiller;
+
+private:
+  struct Params {
+    kj::Own<MallocMessageBuilder> message;
+    ReaderCapabilityTable caps;
+
+    explicit Params(CrossThreadMessage&& params)
+        : message(kj::mv(params.message)), caps(importCaps(params.caps)) {}
+  };
+
+  kj::Own<Params> params;
+  kj::Own<MallocMessageBuilder> responseMessage;
+  BuilderCapabilityTable responseCaps;
+  AnyPointer::Builder responseBuilder = nullptr;  // only valid if `responseMessage` is non-null
+  kj::Maybe<Response<AnyPointer>> tailResponse;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<AnyPointer::Pipeline>>> tailCallPipelineFulfiller;
+  kj::Maybe<kj::TimePoint> deadline;
+};
+
+kj::Promise<kj::Own<CrossThreadMessage>> CrossThreadTarget::deliver(CrossThreadCall& call) const {
+  auto context = kj::refcounted<CrossThreadCallContext>(kj::mv(call.params), call.deadline);
+  auto cancelPaf = kj::newPromiseAndFulfiller<void>();
+  context->cancelAllowedFulfiller = kj::mv(cancelPaf.fulfiller);
+
+  auto promiseAndPipeline = getHook().call(call.interfaceId, call.methodId, kj::addRef(*context));
+  call.pipeline->setHook(kj::mv(promiseAndPipeline.pipeline));
+
+  // As with a call made on this thread, the call isn't canceled if the caller gives up on it,
+  // unless the server allows it.
+  auto forked = promiseAndPipeline.promise.fork();
+  forked.addBranch()
+      .attach(kj::addRef(*context))
+      .exclusiveJoin(kj::mv(cancelPaf.promise))
+      .detach([](kj::Exception&&) {});  // ignore exceptions
+
+  return forked.addBranch().then([context = kj::mv(context)]() mutable {
+    return context->takeResults();
+  });
+}
+
+// =======================================================================================
+// Caller side
+
+class CrossThreadResponse final: public ResponseHook {
+public:
+  explicit CrossThreadResponse(CrossThreadMessage&& results)
+      : message(kj::mv(results.message)), caps(importCaps(results.caps)) {}
+
+  AnyPointer::Reader get() {
+    return caps.imbue(message->getRoot<AnyPointer>().asReader());
+  }
+
+private:
+  kj::Own<MallocMessageBuilder> message;
+  ReaderCapabilityTable caps;
+};
+
+class CrossThreadRequest final: public RequestHook {
+  // The params are built in a message of their own, which is handed to the owner thread on send().
+
+public:
+  CrossThreadRequest(kj::Own<const CrossThreadTarget> target, uint64_t interfaceId,
+                     uint16_t methodId, kj::Maybe<MessageSize> sizeHint)
+      : target(kj::mv(target)), interfaceId(interfaceId), methodId(methodId),
+        message(kj::heap<MallocMessageBuilder>(firstSegmentSize(sizeHint))),
+        deadline(currentDeadline()) {}
+
+  AnyPointer::Builder getParams() {
+    return caps.imbue(message->getRoot<AnyPointer>());
+  }
+
+  RemotePromise<AnyPointer> send() override;
+
+  kj::Promise<void> sendStreaming() override {
+    // Calls are delivered in order regardless, and there's no network latency to hide, so
+    // streaming calls need no special handling.
+    return send().ignoreResult();
+  }
+
+  const void* getBrand() override {
+    return nullptr;
+  }
+
+  void setDeadline(kj::TimePoint deadline) override {
+    KJ_REQUIRE(message.get() != nullptr, "Already called send() on this request.");
+    this->deadline = deadline;
+  }
+
+private:
+  kj::Own<const CrossThreadTarget> target;
+  uint64_t interfaceId;
+  uint16_t methodId;
+  kj::Own<MallocMessageBuilder> message;
+  BuilderCapabilityTable caps;
+  kj::Maybe<kj::TimePoint> deadline;
+};
+
+class CrossThreadClient final: public ClientHook, public kj::Refcounted {
+  // A client, on one thread, of a capability belonging to another.
+
+public:
+  explicit CrossThreadClient(kj::Own<const CrossThreadTarget> target): target(kj::mv(target)) {}
+
+  static kj::Own<const CrossThreadTarget> getTarget(ClientHook& hook) {
+    // Returns the target through which other threads can call `hook`, which belongs to this one.
+
+    if (hook.getBrand() == &CROSS_THREAD_BRAND) {
+      return kj::atomicAddRef(*kj::downcast<CrossThreadClient>(hook).target);
+    } else {
+      return kj::atomicRefcounted<CrossThreadTarget>(hook.addRef());
+    }
+  }
+
+  static kj::Own<ClientHook> wrap(kj::Own<const CrossThreadTarget> target) {
+    // Returns a client through which this thread can call `target`.
+
+    if (target->isOwnedByThisThread()) {
+      return target->getHook().addRef();
+    } else {
+      return kj::refcounted<CrossThreadClient>(kj::mv(target));
+    }
+  }
+
+  Request<AnyPointer, AnyPointer> newCall(
+      uint64_t interfaceId, uint16_t methodId, kj::Maybe<MessageSize> sizeHint) override {
+    auto hook = kj::heap<CrossThreadRequest>(
+        kj::atomicAddRef(*target), interfaceId, methodId, sizeHint);
+    auto root = hook->getParams();
+    return Request<AnyPointer, AnyPointer>(root, kj::mv(hook));
+  }
+
+  VoidPromiseAndPipeline call(uint64_t interfaceId, uint16_t methodId,
+                              kj::Own<CallContextHook>&& context) override {
+    // A call being forwarded, e.g. one that came in over RPC. Its params belong to this thread, so
+    // copy them into a request of our own.
+
+    auto params = context->getParams();
+    auto request = newCall(interfaceId, methodId, params.targetSize());
+    request.set(params);
+    context->releaseParams();
+
+    // We can and should propagate cancellation, and the deadline.
+    context->allowCancellation();
+    KJ_IF_MAYBE(d, context->getDeadline()) {
+      request.setDeadline(*d);
+    }
+
+    return context->directTailCall(RequestHook::from(kj::mv(request)));
+  }
+
+  kj::Maybe<ClientHook&> getResolved() override {
+    return nullptr;
+  }
+  kj::Maybe<kj::Promise<kj::Own<ClientHook>>> whenMoreResolved() override {
+    // Promises resolve on the owner thread, where calls follow them.
+    return nullptr;
+  }
+  kj::Own<ClientHook> addRef() override {
+    return kj::addRef(*this);
+  }
+  const void* getBrand() override {
+    return &CROSS_THREAD_BRAND;
+  }
+  kj::Maybe<int> getFd() override {
+    return nullptr;
+  }
+
+private:
+  kj::Own<const CrossThreadTarget> target;
+};
+
+class CrossThreadPipelineHook final: public PipelineHook, public kj::Refcounted {
+public:
+  explicit CrossThreadPipelineHook(kj::Own<const CrossThreadPipeline> pipeline)
+      : pipeline(kj::mv(pipeline)) {}
+
+  kj::Own<PipelineHook> addRef() override {
+    return kj::addRef(*this);
+  }
+
+  kj::Own<ClientHook> getPipelinedCap(kj::ArrayPtr<const PipelineOp> ops) override {
+    return getPipelinedCap(kj::heapArray(ops));
+  }
+
+  kj::Own<ClientHook> getPipelinedCap(kj::Array<PipelineOp>&& ops) override {
+    // Calls from this thread reach the owner thread in order, and the call itself gets there
+    // first, so unlike QueuedPipeline we needn't return the same client for the same `ops`.
+    return kj::refcounted<CrossThreadClient>(
+        kj::atomicRefcounted<CrossThreadTarget>(kj::atomicAddRef(*pipeline), kj::mv(ops)));
+  }
+
+private:
+  kj::Own<const CrossThreadPipeline> pipeline;
+};
+
+RemotePromise<AnyPointer> CrossThreadRequest::send() {
+  KJ_REQUIRE(message.get() != nullptr, "Already called send() on this request.");
+
+  auto& executor = target->getExecutor();
+  auto pipeline = kj::atomicRefcounted<CrossThreadPipeline>(executor);
+
+  auto call = kj::heap<CrossThreadCall>();
+  call->interfaceId = interfaceId;
+  call->methodId = methodId;
+  call->params.message = kj::mv(message);
+  call->params.caps = exportCaps(caps.getTable());
+  call->deadline = deadline;
+  call->pipeline = kj::atomicAddRef(*pipeline);
+
+  // Calls from this thread are delivered in the order they were sent (see
+  // `kj::Executor::executeAsync()`), so this one sets up its pipeline before any call on the
+  // pipeline from this thread arrives.
+  auto promise = executor.executeAsync(
+      [target = kj::mv(target), call = kj::mv(call)]() mutable {
+    return target->deliver(*call);
+  }).then([](kj::Own<CrossThreadMessage>&& results) {
+    auto response = kj::heap<CrossThreadResponse>(kj::mv(*results));
+    auto reader = response->get();
+    return Response<AnyPointer>(reader, kj::mv(response));
+  });
+
+  return RemotePromise<AnyPointer>(kj::mv(promise),
+      AnyPointer::Pipeline(kj::refcounted<CrossThreadPipelineHook>(kj::mv(pipeline))));
+}
+
+kj::Array<kj::Maybe<kj::Own<const CrossThreadTarget>>> exportCaps(
+    kj::ArrayPtr<kj::Maybe<kj::Own<ClientHook>>> table) {
+  return KJ_MAP(entry, table) -> kj::Maybe<kj::Own<const CrossThreadTarget>> {
+    KJ_IF_MAYBE(hook, entry) {
+      return CrossThreadClient::getTarget(**hook);
+    } else {
+      return nullptr;
+    }
+  };
+}
+
+kj::Array<kj::Maybe<kj::Own<ClientHook>>> importCaps(
+    kj::ArrayPtr<kj::Maybe<kj::Own<const CrossThreadTarget>>> caps) {
+  return KJ_MAP(entry, caps) -> kj::Maybe<kj::Own<ClientHook>> {
+    KJ_IF_MAYBE(target, entry) {
+      return CrossThreadClient::wrap(kj::mv(*target));
+    } else {
+      return nullptr;
+    }
+  };
+}
+
+}  // namespace _ (private)
+
+// =======================================================================================
+
+CrossThreadCapability::CrossThreadCapability(Capability::Client cap)
+    : target(_::CrossThreadClient::getTarget(*ClientHook::from(kj::mv(cap)))) {}
+
+CrossThreadCapability::CrossThreadCapability(kj::Own<const _::CrossThreadTarget> target)
+    : target(kj::mv(target)) {}
+
+CrossThreadCapability::CrossThreadCapability(CrossThreadCapability&& other) noexcept = default;
+CrossThreadCapability& CrossThreadCapability::operator=(CrossThreadCapability&& other) = default;
+CrossThreadCapability::~CrossThreadCapability() noexcept(false) {}
+
+CrossThreadCapability CrossThreadCapability::addRef() const {
+  return CrossThreadCapability(kj::atomicAddRef(*target));
+}
+
+Capability::Client CrossThreadCapability::getClient() const {
+  return Capability::Client(_::CrossThreadClient::wrap(kj::atomicAddRef(*target)));
+}
+
+}  // namespace capnp
@@ -0,0 +1,92 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "capability.h"
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+namespace _ { class CrossThreadTarget; }
+
+class CrossThreadCapability {
+  // A handle through which other threads in the process can call a capability that belongs to
+  // some thread's event loop, without setting up an RPC connection between them.
+  //
+  // Calls are delivered to the owner thread over `kj::Executor`, and the params message the caller
+  // built is handed to the server as is, rather than being serialized and parsed again. The results
+  // are handed back the same way. Calls made from one thread arrive in the order they were made
+  // (E-order), and calls on capabilities in a call's results may be made before the call returns
+  // (promise pipelining).
+  //
+  // Capabilities passed in params or results cross the same way: they arrive as proxies that call
+  // back to the thread they belong to, except that a capability passed back to its own thread
+  // arrives as the original.
+  //
+  // Example:
+  //
+  //     // On the thread running the server's event loop:
+  //     CrossThreadCapability handle(Foo::Client(kj::heap<FooImpl>()));
+  //
+  //     // On any other thread with an event loop, given the handle (or a reference to it):
+  //     auto foo = handle.getClient<Foo>();
+  //     auto response = foo.barRequest().send().wait(waitScope);
+  //
+  // The handle may be used, copied (by `addRef()`) and destroyed on any thread. Clients obtained
+  // from it belong to the thread that called `getClient()`, like any other client. If the owner
+  // thread's event loop exits, calls fail with DISCONNECTED exceptions.
+
+public:
+  explicit CrossThreadCapability(Capability::Client cap);
+  // Wraps `cap`, which must belong to the calling thread's event loop.
+
+  CrossThreadCapability(CrossThreadCapability&& other) noexcept;
+  CrossThreadCapability& operator=(CrossThreadCapability&& other);
+  ~CrossThreadCapability() noexcept(false);
+  KJ_DISALLOW_COPY(CrossThreadCapability);
+
+  CrossThreadCapability addRef() const;
+
+  Capability::Client getClient() const;
+  template <typename T>
+  typename T::Client getClient() const;
+  // Returns a client for use on the calling thread, which must have an event loop. On the owner
+  // thread itself, this is the wrapped capability.
+
+private:
+  kj::Own<const _::CrossThreadTarget> target;
+
+  explicit CrossThreadCapability(kj::Own<const _::CrossThreadTarget> target);
+};
+
+// =======================================================================================
+// inline implementation details
+
+template <typename T>
+typename T::Client CrossThreadCapability::getClient() const {
+  return getClient().castAs<T>();
+}
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
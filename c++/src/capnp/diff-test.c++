@@ -0,0 +1,240 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "diff.h"
+#include "message.h"
+#include "test-util.h"
+#include <kj/test.h>
+#include <math.h>
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+template <typename T>
+void expectPatchWorks(typename T::Reader from, typename T::Reader to) {
+  // Diffs `from` and `to`, and checks that the patch turns a copy of `from` into `to`, even after
+  // being serialized.
+
+  MallocMessageBuilder patchMessage;
+  diffStruct(from, to, patchMessage.initRoot<diff::StructPatch>());
+  auto patch = patchMessage.getRoot<diff::StructPatch>().asReader();
+
+  MallocMessageBuilder target;
+  target.setRoot(from);
+  applyPatch(target.getRoot<T>(), patch);
+  KJ_EXPECT(AnyStruct::Reader(target.getRoot<T>().asReader()).equals(to) == Equality::EQUAL,
+            target.getRoot<T>(), to);
+
+  // The reverse works too.
+  MallocMessageBuilder reverseMessage;
+  diffStruct(to, from, reverseMessage.initRoot<diff::StructPatch>());
+  applyPatch(target.getRoot<T>(), reverseMessage.getRoot<diff::StructPatch>().asReader());
+  KJ_EXPECT(AnyStruct::Reader(target.getRoot<T>().asReader()).equals(from) == Equality::EQUAL,
+            target.getRoot<T>(), from);
+}
+
+size_t patchWords(DynamicStruct::Reader from, DynamicStruct::Reader to) {
+  MallocMessageBuilder patchMessage;
+  diffStruct(from, to, patchMessage.initRoot<diff::StructPatch>());
+  return patchMessage.getRoot<diff::StructPatch>().totalSize().wordCount;
+}
+
+KJ_TEST("diff of equal values is empty") {
+  MallocMessageBuilder a, b;
+  initTestMessage(a.initRoot<TestAllTypes>());
+  initTestMessage(b.initRoot<TestAllTypes>());
+
+  MallocMessageBuilder patchMessage;
+  auto patch = patchMessage.initRoot<diff::StructPatch>();
+  diffStruct(a.getRoot<TestAllTypes>().asReader(), b.getRoot<TestAllTypes>().asReader(), patch);
+  KJ_EXPECT(patch.getFields().size() == 0);
+}
+
+KJ_TEST("diff and patch of primitive, pointer and nested fields") {
+  MallocMessageBuilder a, b;
+  initTestMessage(a.initRoot<TestAllTypes>());
+  initTestMessage(b.initRoot<TestAllTypes>());
+  auto from = a.getRoot<TestAllTypes>().asReader();
+  auto to = b.getRoot<TestAllTypes>();
+
+  to.setInt32Field(4321);
+  to.setFloat64Field(nan(""));
+  to.setTextField("changed");
+  to.setEnumField(test::TestEnum::GRAULT);
+  to.getStructField().setUInt8Field(7);
+  to.getStructField().getStructField().setTextField("nested change");
+  to.disownDataField();
+
+  MallocMessageBuilder patchMessage;
+  auto patch = patchMessage.initRoot<diff::StructPatch>();
+  diffStruct(from, to.asReader(), patch);
+
+  // Only the changed fields are in the patch, and the struct field is patched rather than copied.
+  auto schema = Schema::from<TestAllTypes>();
+  kj::Vector<kj::StringPtr> names;
+  for (auto field: patch.getFields()) {
+    names.add(schema.getFields()[field.getIndex()].getProto().getName());
+  }
+  KJ_EXPECT(kj::strArray(names, ",") ==
+            "int32Field,float64Field,textField,dataField,structField,enumField");
+  KJ_EXPECT(patch.getFields()[4].isStruct());
+
+  expectPatchWorks<TestAllTypes>(from, to.asReader());
+
+  // NaN is equal to itself, so there's no change the other way round.
+  MallocMessageBuilder c;
+  c.setRoot(to.asReader());
+  KJ_EXPECT(patchWords(to.asReader(), c.getRoot<TestAllTypes>().asReader()) <= 1);
+}
+
+KJ_TEST("diff and patch of lists") {
+  MallocMessageBuilder a;
+  initTestMessage(a.initRoot<TestAllTypes>());
+  auto from = a.getRoot<TestAllTypes>().asReader();
+
+  {
+    // Append, insert and remove elements of primitive and pointer lists.
+    MallocMessageBuilder b;
+    b.setRoot(from);
+    auto to = b.getRoot<TestAllTypes>();
+    auto oldInts = from.getInt32List();
+    auto ints = to.initInt32List(oldInts.size() + 1);
+    for (uint i = 0; i < oldInts.size(); i++) ints.set(i, oldInts[i]);
+    ints.set(oldInts.size(), 999);
+
+    auto oldTexts = from.getTextList();
+    auto texts = to.initTextList(oldTexts.size() + 1);
+    texts.set(0, oldTexts[0]);
+    texts.set(1, "inserted");
+    for (uint i = 1; i < oldTexts.size(); i++) texts.set(i + 1, oldTexts[i]);
+
+    auto oldBools = from.getBoolList();
+    auto bools = to.initBoolList(oldBools.size() - 1);
+    for (uint i = 0; i < bools.size(); i++) bools.set(i, oldBools[i + 1]);
+
+    expectPatchWorks<TestAllTypes>(from, to.asReader());
+  }
+
+  {
+    // Struct list elements modified in place are patched rather than copied.
+    MallocMessageBuilder b;
+    b.setRoot(from);
+    auto to = b.getRoot<TestAllTypes>();
+    to.getStructList()[1].setTextField("modified");
+
+    MallocMessageBuilder patchMessage;
+    auto patch = patchMessage.initRoot<diff::StructPatch>();
+    diffStruct(from, to.asReader(), patch);
+    KJ_ASSERT(patch.getFields().size() == 1);
+    auto listPatch = patch.getFields()[0].getList();
+    KJ_EXPECT(listPatch.getSplices().size() == 0);
+    KJ_ASSERT(listPatch.getElements().size() == 1);
+    KJ_EXPECT(listPatch.getElements()[0].getIndex() == 1);
+
+    expectPatchWorks<TestAllTypes>(from, to.asReader());
+  }
+
+  {
+    // A list of structs grows while one of its elements changes.
+    MallocMessageBuilder b;
+    b.setRoot(from);
+    auto to = b.getRoot<TestAllTypes>();
+    auto oldStructs = from.getStructList();
+    auto structs = to.initStructList(oldStructs.size() + 2);
+    for (uint i = 0; i < oldStructs.size(); i++) structs.setWithCaveats(i, oldStructs[i]);
+    structs[0].setInt64Field(-5);
+    structs[oldStructs.size()].setTextField("new");
+    structs[oldStructs.size() + 1].setTextField("newer");
+
+    expectPatchWorks<TestAllTypes>(from, to.asReader());
+  }
+}
+
+KJ_TEST("diff and patch of null and non-null pointers") {
+  MallocMessageBuilder a, b;
+  initTestMessage(a.initRoot<TestAllTypes>());
+  auto from = a.getRoot<TestAllTypes>().asReader();
+  auto to = b.initRoot<TestAllTypes>();
+  to.initStructField().setTextField("only this");
+  to.initFloat32List(2).set(1, 1.5);
+
+  expectPatchWorks<TestAllTypes>(from, to.asReader());
+}
+
+KJ_TEST("diff and patch of unions and groups") {
+  MallocMessageBuilder a, b, c;
+  auto foo = a.initRoot<test::TestGroups>().initGroups().initFoo();
+  foo.setCorge(1);
+  foo.setGrault(2);
+  foo.setGarply("foo");
+
+  auto bar = b.initRoot<test::TestGroups>().initGroups().initBar();
+  bar.setCorge(3);
+  bar.setGrault("bar");
+
+  // An active union member which is entirely default still becomes active.
+  c.initRoot<test::TestGroups>().initGroups().initBaz();
+
+  auto readerA = a.getRoot<test::TestGroups>().asReader();
+  auto readerB = b.getRoot<test::TestGroups>().asReader();
+  auto readerC = c.getRoot<test::TestGroups>().asReader();
+  expectPatchWorks<test::TestGroups>(readerA, readerB);
+  expectPatchWorks<test::TestGroups>(readerA, readerC);
+  expectPatchWorks<test::TestGroups>(readerB, readerC);
+
+  // Changes within the active member.
+  MallocMessageBuilder d;
+  d.setRoot(readerA);
+  d.getRoot<test::TestGroups>().getGroups().getFoo().setGrault(123);
+  expectPatchWorks<test::TestGroups>(readerA, d.getRoot<test::TestGroups>().asReader());
+
+  MallocMessageBuilder e, f;
+  e.initRoot<test::TestUnion>().getUnion0().setU0f0s32(5);
+  f.initRoot<test::TestUnion>().getUnion0().setU0f0sp("text");
+  expectPatchWorks<test::TestUnion>(e.getRoot<test::TestUnion>().asReader(),
+                                    f.getRoot<test::TestUnion>().asReader());
+}
+
+KJ_TEST("patches are small for small changes") {
+  MallocMessageBuilder a;
+  auto root = a.initRoot<TestAllTypes>();
+  auto list = root.initStructList(200);
+  for (auto element: list) {
+    initTestMessage(element);
+  }
+  auto from = root.asReader();
+
+  MallocMessageBuilder b;
+  b.setRoot(from);
+  auto to = b.getRoot<TestAllTypes>();
+  to.getStructList()[100].setInt32Field(1);
+
+  size_t words = patchWords(from, to.asReader());
+  KJ_EXPECT(words < 20, words);
+  KJ_EXPECT(from.totalSize().wordCount > 20000);
+
+  expectPatchWorks<TestAllTypes>(from, to.asReader());
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
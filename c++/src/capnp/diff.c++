@@ -0,0 +1,475 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "diff.h"
+#include "orphan.h"
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <string.h>
+
+namespace capnp {
+
+namespace {
+
+bool isCapability(Type type) {
+  // Capabilities can't be put in a patch, so fields of these types are left out.
+  while (type.isList()) type = type.asList().getElementType();
+  return type.isInterface();
+}
+
+bool isPointer(Type type) {
+  switch (type.which()) {
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST:
+    case schema::Type::STRUCT:
+    case schema::Type::ANY_POINTER:
+    case schema::Type::INTERFACE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool primitivesEqual(DynamicValue::Reader a, DynamicValue::Reader b) {
+  switch (a.getType()) {
+    case DynamicValue::VOID:
+      return true;
+    case DynamicValue::BOOL:
+      return a.as<bool>() == b.as<bool>();
+    case DynamicValue::INT:
+      return a.as<int64_t>() == b.as<int64_t>();
+    case DynamicValue::UINT:
+      return a.as<uint64_t>() == b.as<uint64_t>();
+    case DynamicValue::FLOAT: {
+      // Compare representations, so that a NaN is equal to itself and 0 differs from -0.
+      double x = a.as<double>(), y = b.as<double>();
+      return memcmp(&x, &y, sizeof(x)) == 0;
+    }
+    case DynamicValue::ENUM:
+      return a.as<DynamicEnum>().getRaw() == b.as<DynamicEnum>().getRaw();
+    default:
+      KJ_FAIL_ASSERT("not a primitive value", a.getType());
+  }
+}
+
+void setPrimitive(schema::Value::Builder out, Type type, DynamicValue::Reader value) {
+  switch (type.which()) {
+    case schema::Type::VOID: out.setVoid(); return;
+    case schema::Type::BOOL: out.setBool(value.as<bool>()); return;
+    case schema::Type::INT8: out.setInt8(value.as<int8_t>()); return;
+    case schema::Type::INT16: out.setInt16(value.as<int16_t>()); return;
+    case schema::Type::INT32: out.setInt32(value.as<int32_t>()); return;
+    case schema::Type::INT64: out.setInt64(value.as<int64_t>()); return;
+    case schema::Type::UINT8: out.setUint8(value.as<uint8_t>()); return;
+    case schema::Type::UINT16: out.setUint16(value.as<uint16_t>()); return;
+    case schema::Type::UINT32: out.setUint32(value.as<uint32_t>()); return;
+    case schema::Type::UINT64: out.setUint64(value.as<uint64_t>()); return;
+    case schema::Type::FLOAT32: out.setFloat32(value.as<float>()); return;
+    case schema::Type::FLOAT64: out.setFloat64(value.as<double>()); return;
+    case schema::Type::ENUM: out.setEnum(value.as<DynamicEnum>().getRaw()); return;
+    default: KJ_FAIL_ASSERT("not a primitive type", (uint)type.which());
+  }
+}
+
+DynamicValue::Reader getPrimitive(schema::Value::Reader value, Type type) {
+  switch (value.which()) {
+    case schema::Value::VOID: return VOID;
+    case schema::Value::BOOL: return value.getBool();
+    case schema::Value::INT8: return value.getInt8();
+    case schema::Value::INT16: return value.getInt16();
+    case schema::Value::INT32: return value.getInt32();
+    case schema::Value::INT64: return value.getInt64();
+    case schema::Value::UINT8: return value.getUint8();
+    case schema::Value::UINT16: return value.getUint16();
+    case schema::Value::UINT32: return value.getUint32();
+    case schema::Value::UINT64: return value.getUint64();
+    case schema::Value::FLOAT32: return value.getFloat32();
+    case schema::Value::FLOAT64: return value.getFloat64();
+    case schema::Value::ENUM:
+      KJ_REQUIRE(type.isEnum(), "Patch value doesn't match the field's type.");
+      return DynamicEnum(type.asEnum(), value.getEnum());
+    default:
+      KJ_FAIL_REQUIRE("Patch value isn't a primitive.", (uint)value.which());
+  }
+}
+
+AnyPointer::Reader getPointerField(DynamicStruct::Reader value, StructSchema::Field field) {
+  // Returns the raw pointer of a pointer field, or null if the struct was written with an older
+  // version of its schema, without the field.
+  auto pointers = AnyStruct::Reader(value).getPointerSection();
+  uint offset = field.getProto().getSlot().getOffset();
+  return offset < pointers.size() ? pointers[offset] : AnyPointer::Reader();
+}
+
+AnyPointer::Builder getPointerField(DynamicStruct::Builder value, StructSchema::Field field) {
+  // Builders obtained through the dynamic API are always upgraded to the full size of their
+  // schema, so the field is there.
+  auto pointers = AnyStruct::Builder(value).getPointerSection();
+  uint offset = field.getProto().getSlot().getOffset();
+  KJ_ASSERT(offset < pointers.size());
+  return pointers[offset];
+}
+
+bool elementsEqual(Type elementType, DynamicList::Reader a, uint i, DynamicList::Reader b, uint j) {
+  if (elementType.isStruct()) {
+    return AnyList::Reader(a).as<List<AnyStruct>>()[i].equals(
+        AnyList::Reader(b).as<List<AnyStruct>>()[j]) == Equality::EQUAL;
+  } else if (isPointer(elementType)) {
+    return AnyList::Reader(a).as<List<AnyPointer>>()[i].equals(
+        AnyList::Reader(b).as<List<AnyPointer>>()[j]) == Equality::EQUAL;
+  } else {
+    return primitivesEqual(a[i], b[j]);
+  }
+}
+
+void copyElements(DynamicList::Reader from, uint start, DynamicList::Builder to, uint toStart,
+                  uint count) {
+  auto elementType = to.getSchema().getElementType();
+  if (isPointer(elementType) && !elementType.isStruct()) {
+    // Copy pointers as they are. (DynamicList doesn't support List(AnyPointer).)
+    auto src = AnyList::Reader(from).as<List<AnyPointer>>();
+    auto dst = AnyList::Builder(to).as<List<AnyPointer>>();
+    for (uint i = 0; i < count; i++) {
+      dst[toStart + i].set(src[start + i]);
+    }
+  } else {
+    for (uint i = 0; i < count; i++) {
+      to.set(toStart + i, from[start + i]);
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// Diff
+
+bool diffStructImpl(Orphanage orphanage, DynamicStruct::Reader from, DynamicStruct::Reader to,
+                    diff::StructPatch::Builder patch);
+
+bool diffListImpl(Orphanage orphanage, DynamicList::Reader from, DynamicList::Reader to,
+                  diff::ListPatch::Builder patch) {
+  auto schema = to.getSchema();
+  auto elementType = schema.getElementType();
+  uint fromSize = from.size();
+  uint toSize = to.size();
+
+  uint prefix = 0;
+  while (prefix < fromSize && prefix < toSize &&
+         elementsEqual(elementType, from, prefix, to, prefix)) {
+    ++prefix;
+  }
+  uint suffix = 0;
+  while (suffix < fromSize - prefix && suffix < toSize - prefix &&
+         elementsEqual(elementType, from, fromSize - 1 - suffix, to, toSize - 1 - suffix)) {
+    ++suffix;
+  }
+
+  // Within the changed range, struct elements which are paired up with one at the same position
+  // are patched in place, and the rest are spliced.
+  uint paired = elementType.isStruct()
+      ? kj::min(fromSize - prefix - suffix, toSize - prefix - suffix) : 0;
+
+  kj::Vector<kj::Tuple<uint, Orphan<diff::StructPatch>>> elementPatches;
+  for (uint i = prefix; i < prefix + paired; i++) {
+    if (i != prefix && elementsEqual(elementType, from, i, to, i)) continue;
+    auto elementPatch = orphanage.newOrphan<diff::StructPatch>();
+    if (diffStructImpl(orphanage, from[i].as<DynamicStruct>(), to[i].as<DynamicStruct>(),
+                       elementPatch.get())) {
+      elementPatches.add(kj::tuple(i, kj::mv(elementPatch)));
+    }
+  }
+
+  uint spliceStart = prefix + paired;
+  uint removeCount = fromSize - suffix - spliceStart;
+  uint insertCount = toSize - suffix - spliceStart;
+  bool spliced = removeCount > 0 || insertCount > 0;
+
+  if (!spliced && elementPatches.empty()) return false;
+
+  if (spliced) {
+    auto splice = patch.initSplices(1)[0];
+    splice.setIndex(spliceStart);
+    splice.setRemoveCount(removeCount);
+    if (insertCount > 0) {
+      auto insert = splice.getInsert().initAs<DynamicList>(schema, insertCount);
+      copyElements(to, spliceStart, insert, 0, insertCount);
+    }
+  }
+
+  if (!elementPatches.empty()) {
+    auto elements = patch.initElements(elementPatches.size());
+    for (uint i = 0; i < elementPatches.size(); i++) {
+      elements[i].setIndex(kj::get<0>(elementPatches[i]));
+      elements[i].adoptPatch(kj::mv(kj::get<1>(elementPatches[i])));
+    }
+  }
+
+  return true;
+}
+
+struct FieldChange {
+  StructSchema::Field field;
+  diff::FieldPatch::Which kind;
+  Orphan<diff::StructPatch> structPatch;  // GROUP or STRUCT
+  Orphan<diff::ListPatch> listPatch;      // LIST
+};
+
+void diffField(Orphanage orphanage, DynamicStruct::Reader from, DynamicStruct::Reader to,
+               StructSchema::Field field, bool activated, kj::Vector<FieldChange>& changes) {
+  // Adds the change to `field`, if any, to `changes`. `activated` means the field is a union
+  // member which is active in `to` but not in `from`, so its value in `from` is meaningless. It
+  // must then be set regardless, to make it the active one.
+
+  if (field.getProto().isGroup()) {
+    auto toGroup = to.get(field).as<DynamicStruct>();
+    auto fromGroup = activated
+        ? AnyStruct::Reader().as<DynamicStruct>(toGroup.getSchema())  // cleared by applyPatch()
+        : from.get(field).as<DynamicStruct>();
+    auto groupPatch = orphanage.newOrphan<diff::StructPatch>();
+    if (diffStructImpl(orphanage, fromGroup, toGroup, groupPatch.get()) || activated) {
+      changes.add(FieldChange { field, diff::FieldPatch::GROUP, kj::mv(groupPatch), {} });
+    }
+    return;
+  }
+
+  auto type = field.getType();
+  if (isCapability(type)) {
+    if (activated) {
+      changes.add(FieldChange { field, diff::FieldPatch::POINTER, {}, {} });
+    }
+    return;
+  }
+
+  if (!isPointer(type)) {
+    if (activated || !primitivesEqual(from.get(field), to.get(field))) {
+      changes.add(FieldChange { field, diff::FieldPatch::VALUE, {}, {} });
+    }
+    return;
+  }
+
+  auto toPointer = getPointerField(to, field);
+  if (!activated) {
+    auto fromPointer = getPointerField(from, field);
+    if (fromPointer.equals(toPointer) == Equality::EQUAL) return;
+
+    // Patch values that were and remain non-null in place.
+    if (!fromPointer.isNull() && !toPointer.isNull()) {
+      if (type.isStruct()) {
+        auto structPatch = orphanage.newOrphan<diff::StructPatch>();
+        if (diffStructImpl(orphanage, from.get(field).as<DynamicStruct>(),
+                           to.get(field).as<DynamicStruct>(), structPatch.get())) {
+          changes.add(FieldChange { field, diff::FieldPatch::STRUCT, kj::mv(structPatch), {} });
+        }
+        return;
+      } else if (type.isList()) {
+        auto listPatch = orphanage.newOrphan<diff::ListPatch>();
+        if (diffListImpl(orphanage, from.get(field).as<DynamicList>(),
+                         to.get(field).as<DynamicList>(), listPatch.get())) {
+          changes.add(FieldChange { field, diff::FieldPatch::LIST, {}, kj::mv(listPatch) });
+        }
+        return;
+      }
+    }
+  }
+
+  changes.add(FieldChange { field, diff::FieldPatch::POINTER, {}, {} });
+}
+
+bool diffStructImpl(Orphanage orphanage, DynamicStruct::Reader from, DynamicStruct::Reader to,
+                    diff::StructPatch::Builder patch) {
+  // Fills `patch`, returning false if there are no changes.
+
+  KJ_REQUIRE(from.getSchema() == to.getSchema(), "Can't diff values of different types.");
+
+  kj::Vector<FieldChange> changes;
+  for (auto field: to.getSchema().getNonUnionFields()) {
+    diffField(orphanage, from, to, field, false, changes);
+  }
+  KJ_IF_MAYBE(toField, to.which()) {
+    bool activated = true;
+    KJ_IF_MAYBE(fromField, from.which()) {
+      activated = *fromField != *toField;
+    }
+    diffField(orphanage, from, to, *toField, activated, changes);
+  }
+
+  if (changes.empty()) return false;
+
+  auto fields = patch.initFields(changes.size());
+  for (uint i = 0; i < changes.size(); i++) {
+    auto& change = changes[i];
+    auto fieldPatch = fields[i];
+    fieldPatch.setIndex(change.field.getIndex());
+    switch (change.kind) {
+      case diff::FieldPatch::VALUE:
+        setPrimitive(fieldPatch.initValue(), change.field.getType(), to.get(change.field));
+        break;
+      case diff::FieldPatch::POINTER:
+        if (isCapability(change.field.getType())) {
+          fieldPatch.initPointer();
+        } else {
+          fieldPatch.initPointer().set(getPointerField(to, change.field));
+        }
+        break;
+      case diff::FieldPatch::GROUP:
+        fieldPatch.adoptGroup(kj::mv(change.structPatch));
+        break;
+      case diff::FieldPatch::STRUCT:
+        fieldPatch.adoptStruct(kj::mv(change.structPatch));
+        break;
+      case diff::FieldPatch::LIST:
+        fieldPatch.adoptList(kj::mv(change.listPatch));
+        break;
+    }
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------------------
+// Patch
+
+bool isUnionMember(StructSchema::Field field) {
+  return field.getProto().getDiscriminantValue() != schema::Field::NO_DISCRIMINANT;
+}
+
+void activate(DynamicStruct::Builder target, StructSchema::Field field) {
+  // Makes `field` the active member of its union, if it isn't already. The previously active
+  // member is cleared first, so that what's left of it doesn't linger in the message, where it
+  // would make the result compare unequal to a freshly built value.
+
+  KJ_IF_MAYBE(active, target.which()) {
+    if (*active == field) return;
+    target.clear(*active);
+  }
+  target.clear(field);
+}
+
+Orphan<DynamicList> spliceList(Orphanage orphanage, DynamicList::Reader list,
+                               List<diff::ListPatch::Splice>::Reader splices) {
+  auto schema = list.getSchema();
+
+  uint size = list.size();
+  uint end = 0;
+  for (auto splice: splices) {
+    KJ_REQUIRE(splice.getIndex() >= end && splice.getIndex() <= list.size() &&
+               splice.getRemoveCount() <= list.size() - splice.getIndex(),
+               "Patch doesn't match the list it's applied to.");
+    end = splice.getIndex() + splice.getRemoveCount();
+    size = size - splice.getRemoveCount() +
+        splice.getInsert().getAs<DynamicList>(schema).size();
+  }
+
+  auto result = orphanage.newOrphan(schema, size);
+  auto builder = result.get();
+  uint from = 0;
+  uint to = 0;
+  for (auto splice: splices) {
+    uint keep = splice.getIndex() - from;
+    copyElements(list, from, builder, to, keep);
+    to += keep;
+    auto insert = splice.getInsert().getAs<DynamicList>(schema);
+    copyElements(insert, 0, builder, to, insert.size());
+    to += insert.size();
+    from = splice.getIndex() + splice.getRemoveCount();
+  }
+  copyElements(list, from, builder, to, list.size() - from);
+
+  return result;
+}
+
+void applyListPatch(DynamicList::Builder list, diff::ListPatch::Reader patch) {
+  auto elements = patch.getElements();
+  if (elements.size() == 0) return;
+
+  KJ_REQUIRE(list.getSchema().getElementType().isStruct(),
+             "Patch doesn't match the list it's applied to.");
+  for (auto element: elements) {
+    KJ_REQUIRE(element.getIndex() < list.size(), "Patch doesn't match the list it's applied to.");
+    applyPatch(list[element.getIndex()].as<DynamicStruct>(), element.getPatch());
+  }
+}
+
+}  // namespace
+
+void diffStruct(DynamicStruct::Reader from, DynamicStruct::Reader to,
+                diff::StructPatch::Builder patch) {
+  diffStructImpl(Orphanage::getForMessageContaining(patch), from, to, patch);
+}
+
+void applyPatch(DynamicStruct::Builder target, diff::StructPatch::Reader patch) {
+  auto schema = target.getSchema();
+  auto fields = schema.getFields();
+
+  for (auto fieldPatch: patch.getFields()) {
+    if (fieldPatch.getIndex() >= fields.size()) {
+      // A field added in a newer version of the schema than ours.
+      continue;
+    }
+    auto field = fields[fieldPatch.getIndex()];
+
+    switch (fieldPatch.which()) {
+      case diff::FieldPatch::VALUE:
+        if (isUnionMember(field)) activate(target, field);
+        target.set(field, getPrimitive(fieldPatch.getValue(), field.getType()));
+        break;
+
+      case diff::FieldPatch::POINTER: {
+        KJ_REQUIRE(field.getProto().isSlot() && isPointer(field.getType()),
+                   "Patch doesn't match the struct it's applied to.");
+        if (isUnionMember(field)) activate(target, field);
+        target.clear(field);
+        if (!isCapability(field.getType())) {
+          getPointerField(target, field).set(fieldPatch.getPointer());
+        }
+        break;
+      }
+
+      case diff::FieldPatch::GROUP: {
+        KJ_REQUIRE(field.getProto().isGroup(), "Patch doesn't match the struct it's applied to.");
+        if (isUnionMember(field)) activate(target, field);
+        applyPatch(target.get(field).as<DynamicStruct>(), fieldPatch.getGroup());
+        break;
+      }
+
+      case diff::FieldPatch::STRUCT:
+        KJ_REQUIRE(field.getProto().isSlot() && field.getType().isStruct(),
+                   "Patch doesn't match the struct it's applied to.");
+        applyPatch(target.get(field).as<DynamicStruct>(), fieldPatch.getStruct());
+        break;
+
+      case diff::FieldPatch::LIST: {
+        KJ_REQUIRE(field.getProto().isSlot() && field.getType().isList(),
+                   "Patch doesn't match the struct it's applied to.");
+        auto listPatch = fieldPatch.getList();
+        auto list = target.get(field).as<DynamicList>();
+        if (listPatch.getSplices().size() > 0) {
+          target.adopt(field, spliceList(Orphanage::getForMessageContaining(target),
+                                         list.asReader(), listPatch.getSplices()));
+          list = target.get(field).as<DynamicList>();
+        }
+        applyListPatch(list, listPatch);
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace capnp
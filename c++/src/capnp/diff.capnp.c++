@@ -0,0 +1,476 @@
+// Generated by Cap'n Proto compiler, DO NOT EDIT
+// source: diff.capnp
+
+#include "diff.capnp.h"
+
+namespace capnp {
+namespace schemas {
+static const ::capnp::_::AlignedData<37> b_921968c3bb7039ab = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    171,  57, 112, 187, 195, 104,  25, 146,
+     17,   0,   0,   0,   1,   0,   0,   0,
+    216, 156,  93, 117, 109, 225, 211, 220,
+      1,   0,   7,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 234,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     29,   0,   0,   0,  63,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 100, 105,
+    102, 102,  46,  99,  97, 112, 110, 112,
+     58,  83, 116, 114, 117,  99, 116,  80,
+     97, 116,  99, 104,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      4,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     13,   0,   0,   0,  58,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   3,   0,   1,   0,
+     36,   0,   0,   0,   2,   0,   1,   0,
+    102, 105, 101, 108, 100, 115,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   3,   0,   1,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    131, 177, 206, 225,  81,   9, 121, 225,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_921968c3bb7039ab = b_921968c3bb7039ab.words;
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const d_921968c3bb7039ab[] = {
+  &s_e1790951e1ceb183,
+};
+static const uint16_t m_921968c3bb7039ab[] = {0};
+static const uint16_t i_921968c3bb7039ab[] = {0};
+const ::capnp::_::RawSchema s_921968c3bb7039ab = {
+  0x921968c3bb7039ab, b_921968c3bb7039ab.words, 37, d_921968c3bb7039ab, m_921968c3bb7039ab,
+  1, 1, i_921968c3bb7039ab, nullptr, nullptr, { &s_921968c3bb7039ab, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<108> b_e1790951e1ceb183 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    131, 177, 206, 225,  81,   9, 121, 225,
+     17,   0,   0,   0,   1,   0,   1,   0,
+    216, 156,  93, 117, 109, 225, 211, 220,
+      1,   0,   7,   0,   0,   0,   5,   0,
+      1,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 226,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     29,   0,   0,   0,  87,   1,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 100, 105,
+    102, 102,  46,  99,  97, 112, 110, 112,
+     58,  70, 105, 101, 108, 100,  80,  97,
+    116,  99, 104,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+     24,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    153,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    148,   0,   0,   0,   3,   0,   1,   0,
+    160,   0,   0,   0,   2,   0,   1,   0,
+      1,   0, 255, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    157,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    152,   0,   0,   0,   3,   0,   1,   0,
+    164,   0,   0,   0,   2,   0,   1,   0,
+      2,   0, 254, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,   2,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    161,   0,   0,   0,  66,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    156,   0,   0,   0,   3,   0,   1,   0,
+    168,   0,   0,   0,   2,   0,   1,   0,
+      3,   0, 253, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,   3,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    165,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    160,   0,   0,   0,   3,   0,   1,   0,
+    172,   0,   0,   0,   2,   0,   1,   0,
+      4,   0, 252, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,   4,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    169,   0,   0,   0,  58,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    164,   0,   0,   0,   3,   0,   1,   0,
+    176,   0,   0,   0,   2,   0,   1,   0,
+      5,   0, 251, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,   5,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    173,   0,   0,   0,  42,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    168,   0,   0,   0,   3,   0,   1,   0,
+    180,   0,   0,   0,   2,   0,   1,   0,
+    105, 110, 100, 101, 120,   0,   0,   0,
+      7,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      7,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    118,  97, 108, 117, 101,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    155,  12, 176, 215, 210, 220,  35, 206,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    112, 111, 105, 110, 116, 101, 114,   0,
+     18,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     18,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    103, 114, 111, 117, 112,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    171,  57, 112, 187, 195, 104,  25, 146,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    115, 116, 114, 117,  99, 116,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    171,  57, 112, 187, 195, 104,  25, 146,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    108, 105, 115, 116,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    133, 197,  61, 189, 191, 141,   9, 141,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_e1790951e1ceb183 = b_e1790951e1ceb183.words;
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const d_e1790951e1ceb183[] = {
+  &s_8d098dbfbd3dc585,
+  &s_921968c3bb7039ab,
+  &s_ce23dcd2d7b00c9b,
+};
+static const uint16_t m_e1790951e1ceb183[] = {3, 0, 5, 2, 4, 1};
+static const uint16_t i_e1790951e1ceb183[] = {1, 2, 3, 4, 5, 0};
+const ::capnp::_::RawSchema s_e1790951e1ceb183 = {
+  0xe1790951e1ceb183, b_e1790951e1ceb183.words, 108, d_e1790951e1ceb183, m_e1790951e1ceb183,
+  3, 6, i_e1790951e1ceb183, nullptr, nullptr, { &s_e1790951e1ceb183, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<64> b_8d098dbfbd3dc585 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+    133, 197,  61, 189, 191, 141,   9, 141,
+     17,   0,   0,   0,   1,   0,   0,   0,
+    216, 156,  93, 117, 109, 225, 211, 220,
+      2,   0,   7,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 218,   0,   0,   0,
+     33,   0,   0,   0,  39,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     57,   0,   0,   0, 119,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 100, 105,
+    102, 102,  46,  99,  97, 112, 110, 112,
+     58,  76, 105, 115, 116,  80,  97, 116,
+     99, 104,   0,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   1,   0,   1,   0,
+      8, 132, 134, 223, 107,  46, 158, 218,
+      9,   0,   0,   0,  58,   0,   0,   0,
+     97, 206,  32, 123,  18,  89, 124, 168,
+      5,   0,   0,   0, 106,   0,   0,   0,
+     83, 112, 108, 105,  99, 101,   0,   0,
+     69, 108, 101, 109, 101, 110, 116,  80,
+     97, 116,  99, 104,   0,   0,   0,   0,
+      8,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     41,   0,   0,   0,  66,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     36,   0,   0,   0,   3,   0,   1,   0,
+     64,   0,   0,   0,   2,   0,   1,   0,
+      1,   0,   0,   0,   1,   0,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     61,   0,   0,   0,  74,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     60,   0,   0,   0,   3,   0,   1,   0,
+     88,   0,   0,   0,   2,   0,   1,   0,
+    115, 112, 108, 105,  99, 101, 115,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   3,   0,   1,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      8, 132, 134, 223, 107,  46, 158, 218,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    101, 108, 101, 109, 101, 110, 116, 115,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   3,   0,   1,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+     97, 206,  32, 123,  18,  89, 124, 168,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_8d098dbfbd3dc585 = b_8d098dbfbd3dc585.words;
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const d_8d098dbfbd3dc585[] = {
+  &s_a87c59127b20ce61,
+  &s_da9e2e6bdf868408,
+};
+static const uint16_t m_8d098dbfbd3dc585[] = {1, 0};
+static const uint16_t i_8d098dbfbd3dc585[] = {0, 1};
+const ::capnp::_::RawSchema s_8d098dbfbd3dc585 = {
+  0x8d098dbfbd3dc585, b_8d098dbfbd3dc585.words, 64, d_8d098dbfbd3dc585, m_8d098dbfbd3dc585,
+  2, 2, i_8d098dbfbd3dc585, nullptr, nullptr, { &s_8d098dbfbd3dc585, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<65> b_da9e2e6bdf868408 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+      8, 132, 134, 223, 107,  46, 158, 218,
+     27,   0,   0,   0,   1,   0,   1,   0,
+    133, 197,  61, 189, 191, 141,   9, 141,
+      1,   0,   7,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0,  18,   1,   0,   0,
+     37,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     33,   0,   0,   0, 175,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 100, 105,
+    102, 102,  46,  99,  97, 112, 110, 112,
+     58,  76, 105, 115, 116,  80,  97, 116,
+     99, 104,  46,  83, 112, 108, 105,  99,
+    101,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+     12,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     69,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     64,   0,   0,   0,   3,   0,   1,   0,
+     76,   0,   0,   0,   2,   0,   1,   0,
+      1,   0,   0,   0,   1,   0,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     73,   0,   0,   0,  98,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     72,   0,   0,   0,   3,   0,   1,   0,
+     84,   0,   0,   0,   2,   0,   1,   0,
+      2,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   2,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     81,   0,   0,   0,  58,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     76,   0,   0,   0,   3,   0,   1,   0,
+     88,   0,   0,   0,   2,   0,   1,   0,
+    105, 110, 100, 101, 120,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    114, 101, 109, 111, 118, 101,  67, 111,
+    117, 110, 116,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    105, 110, 115, 101, 114, 116,   0,   0,
+     18,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     18,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_da9e2e6bdf868408 = b_da9e2e6bdf868408.words;
+#if !CAPNP_LITE
+static const uint16_t m_da9e2e6bdf868408[] = {0, 2, 1};
+static const uint16_t i_da9e2e6bdf868408[] = {0, 1, 2};
+const ::capnp::_::RawSchema s_da9e2e6bdf868408 = {
+  0xda9e2e6bdf868408, b_da9e2e6bdf868408.words, 65, nullptr, m_da9e2e6bdf868408,
+  0, 3, i_da9e2e6bdf868408, nullptr, nullptr, { &s_da9e2e6bdf868408, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<49> b_a87c59127b20ce61 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+     97, 206,  32, 123,  18,  89, 124, 168,
+     27,   0,   0,   0,   1,   0,   1,   0,
+    133, 197,  61, 189, 191, 141,   9, 141,
+      1,   0,   7,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0,  66,   1,   0,   0,
+     37,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     33,   0,   0,   0, 119,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 100, 105,
+    102, 102,  46,  99,  97, 112, 110, 112,
+     58,  76, 105, 115, 116,  80,  97, 116,
+     99, 104,  46,  69, 108, 101, 109, 101,
+    110, 116,  80,  97, 116,  99, 104,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      8,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     41,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     36,   0,   0,   0,   3,   0,   1,   0,
+     48,   0,   0,   0,   2,   0,   1,   0,
+      1,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     45,   0,   0,   0,  50,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     40,   0,   0,   0,   3,   0,   1,   0,
+     52,   0,   0,   0,   2,   0,   1,   0,
+    105, 110, 100, 101, 120,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    112,  97, 116,  99, 104,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    171,  57, 112, 187, 195, 104,  25, 146,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_a87c59127b20ce61 = b_a87c59127b20ce61.words;
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const d_a87c59127b20ce61[] = {
+  &s_921968c3bb7039ab,
+};
+static const uint16_t m_a87c59127b20ce61[] = {0, 1};
+static const uint16_t i_a87c59127b20ce61[] = {0, 1};
+const ::capnp::_::RawSchema s_a87c59127b20ce61 = {
+  0xa87c59127b20ce61, b_a87c59127b20ce61.words, 49, d_a87c59127b20ce61, m_a87c59127b20ce61,
+  1, 2, i_a87c59127b20ce61, nullptr, nullptr, { &s_a87c59127b20ce61, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_dcd3e16d755d9cd8[] = {
+  &s_8d098dbfbd3dc585,
+  nullptr,
+  &s_da9e2e6bdf868408,
+  nullptr,
+  nullptr,
+  &s_a87c59127b20ce61,
+  nullptr,
+  nullptr,
+  &s_e1790951e1ceb183,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_921968c3bb7039ab,
+  nullptr,
+};
+static const uint32_t xh_dcd3e16d755d9cd8[] = {1, 1, 1, 0};
+const ::capnp::_::RawSchemaIndex x_dcd3e16d755d9cd8 = {
+  xs_dcd3e16d755d9cd8, xh_dcd3e16d755d9cd8, 16, 4, 5
+};
+#endif  // !CAPNP_LITE
+}  // namespace schemas
+}  // namespace capnp
+
+// =======================================================================================
+
+namespace capnp {
+namespace diff {
+
+// StructPatch
+constexpr uint16_t StructPatch::_capnpPrivate::dataWordSize;
+constexpr uint16_t StructPatch::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind StructPatch::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* StructPatch::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
+// FieldPatch
+constexpr uint16_t FieldPatch::_capnpPrivate::dataWordSize;
+constexpr uint16_t FieldPatch::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind FieldPatch::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* FieldPatch::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
+// ListPatch
+constexpr uint16_t ListPatch::_capnpPrivate::dataWordSize;
+constexpr uint16_t ListPatch::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind ListPatch::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* ListPatch::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
+// ListPatch::Splice
+constexpr uint16_t ListPatch::Splice::_capnpPrivate::dataWordSize;
+constexpr uint16_t ListPatch::Splice::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind ListPatch::Splice::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* ListPatch::Splice::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
+// ListPatch::ElementPatch
+constexpr uint16_t ListPatch::ElementPatch::_capnpPrivate::dataWordSize;
+constexpr uint16_t ListPatch::ElementPatch::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind ListPatch::ElementPatch::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* ListPatch::ElementPatch::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
+
+}  // namespace
+}  // namespace
+
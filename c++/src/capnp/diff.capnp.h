@@ -0,0 +1,1089 @@
+// Generated by Cap'n Proto compiler, DO NOT EDIT
+// source: diff.capnp
+
+#pragma once
+
+#include "capnp/generated-header-support.h"
+#include "kj/windows-sanity.h"
+
+#if CAPNP_VERSION != 10000
+#error "Version mismatch between generated code and library headers.  You must use the same version of the Cap'n Proto compiler and library."
+#endif
+
+#include <capnp/schema.capnp.h>
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+namespace schemas {
+
+CAPNP_DECLARE_SCHEMA(921968c3bb7039ab);
+CAPNP_DECLARE_SCHEMA(e1790951e1ceb183);
+CAPNP_DECLARE_SCHEMA(8d098dbfbd3dc585);
+CAPNP_DECLARE_SCHEMA(da9e2e6bdf868408);
+CAPNP_DECLARE_SCHEMA(a87c59127b20ce61);
+CAPNP_DECLARE_SCHEMA_INDEX(dcd3e16d755d9cd8);
+
+}  // namespace schemas
+}  // namespace capnp
+
+namespace capnp {
+namespace diff {
+
+struct StructPatch {
+  StructPatch() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(921968c3bb7039ab, 0, 1)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
+struct FieldPatch {
+  FieldPatch() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+  enum Which: uint16_t {
+    VALUE,
+    POINTER,
+    GROUP,
+    STRUCT,
+    LIST,
+  };
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(e1790951e1ceb183, 1, 1)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
+struct ListPatch {
+  ListPatch() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+  struct Splice;
+  struct ElementPatch;
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(8d098dbfbd3dc585, 0, 2)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
+struct ListPatch::Splice {
+  Splice() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(da9e2e6bdf868408, 1, 1)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
+struct ListPatch::ElementPatch {
+  ElementPatch() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(a87c59127b20ce61, 1, 1)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
+// =======================================================================================
+
+class StructPatch::Reader {
+public:
+  typedef StructPatch Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline bool hasFields() const;
+  inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Reader getFields() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class StructPatch::Builder {
+public:
+  typedef StructPatch Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline bool hasFields();
+  inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Builder getFields();
+  inline void setFields( ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Reader value);
+  inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Builder initFields(unsigned int size);
+  inline void adoptFields(::capnp::Orphan< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>&& value);
+  inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>> disownFields();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class StructPatch::Pipeline {
+public:
+  typedef StructPatch Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
+class FieldPatch::Reader {
+public:
+  typedef FieldPatch Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline Which which() const;
+  inline  ::uint16_t getIndex() const;
+
+  inline bool isValue() const;
+  inline bool hasValue() const;
+  inline  ::capnp::schema::Value::Reader getValue() const;
+
+  inline bool isPointer() const;
+  inline bool hasPointer() const;
+  inline ::capnp::AnyPointer::Reader getPointer() const;
+
+  inline bool isGroup() const;
+  inline bool hasGroup() const;
+  inline  ::capnp::diff::StructPatch::Reader getGroup() const;
+
+  inline bool isStruct() const;
+  inline bool hasStruct() const;
+  inline  ::capnp::diff::StructPatch::Reader getStruct() const;
+
+  inline bool isList() const;
+  inline bool hasList() const;
+  inline  ::capnp::diff::ListPatch::Reader getList() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class FieldPatch::Builder {
+public:
+  typedef FieldPatch Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline Which which();
+  inline  ::uint16_t getIndex();
+  inline void setIndex( ::uint16_t value);
+
+  inline bool isValue();
+  inline bool hasValue();
+  inline  ::capnp::schema::Value::Builder getValue();
+  inline void setValue( ::capnp::schema::Value::Reader value);
+  inline  ::capnp::schema::Value::Builder initValue();
+  inline void adoptValue(::capnp::Orphan< ::capnp::schema::Value>&& value);
+  inline ::capnp::Orphan< ::capnp::schema::Value> disownValue();
+
+  inline bool isPointer();
+  inline bool hasPointer();
+  inline ::capnp::AnyPointer::Builder getPointer();
+  inline ::capnp::AnyPointer::Builder initPointer();
+
+  inline bool isGroup();
+  inline bool hasGroup();
+  inline  ::capnp::diff::StructPatch::Builder getGroup();
+  inline void setGroup( ::capnp::diff::StructPatch::Reader value);
+  inline  ::capnp::diff::StructPatch::Builder initGroup();
+  inline void adoptGroup(::capnp::Orphan< ::capnp::diff::StructPatch>&& value);
+  inline ::capnp::Orphan< ::capnp::diff::StructPatch> disownGroup();
+
+  inline bool isStruct();
+  inline bool hasStruct();
+  inline  ::capnp::diff::StructPatch::Builder getStruct();
+  inline void setStruct( ::capnp::diff::StructPatch::Reader value);
+  inline  ::capnp::diff::StructPatch::Builder initStruct();
+  inline void adoptStruct(::capnp::Orphan< ::capnp::diff::StructPatch>&& value);
+  inline ::capnp::Orphan< ::capnp::diff::StructPatch> disownStruct();
+
+  inline bool isList();
+  inline bool hasList();
+  inline  ::capnp::diff::ListPatch::Builder getList();
+  inline void setList( ::capnp::diff::ListPatch::Reader value);
+  inline  ::capnp::diff::ListPatch::Builder initList();
+  inline void adoptList(::capnp::Orphan< ::capnp::diff::ListPatch>&& value);
+  inline ::capnp::Orphan< ::capnp::diff::ListPatch> disownList();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class FieldPatch::Pipeline {
+public:
+  typedef FieldPatch Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
+class ListPatch::Reader {
+public:
+  typedef ListPatch Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline bool hasSplices() const;
+  inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Reader getSplices() const;
+
+  inline bool hasElements() const;
+  inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Reader getElements() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class ListPatch::Builder {
+public:
+  typedef ListPatch Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline bool hasSplices();
+  inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Builder getSplices();
+  inline void setSplices( ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Reader value);
+  inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Builder initSplices(unsigned int size);
+  inline void adoptSplices(::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>&& value);
+  inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>> disownSplices();
+
+  inline bool hasElements();
+  inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Builder getElements();
+  inline void setElements( ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Reader value);
+  inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Builder initElements(unsigned int size);
+  inline void adoptElements(::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>&& value);
+  inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>> disownElements();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class ListPatch::Pipeline {
+public:
+  typedef ListPatch Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
+class ListPatch::Splice::Reader {
+public:
+  typedef Splice Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline  ::uint32_t getIndex() const;
+
+  inline  ::uint32_t getRemoveCount() const;
+
+  inline bool hasInsert() const;
+  inline ::capnp::AnyPointer::Reader getInsert() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class ListPatch::Splice::Builder {
+public:
+  typedef Splice Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline  ::uint32_t getIndex();
+  inline void setIndex( ::uint32_t value);
+
+  inline  ::uint32_t getRemoveCount();
+  inline void setRemoveCount( ::uint32_t value);
+
+  inline bool hasInsert();
+  inline ::capnp::AnyPointer::Builder getInsert();
+  inline ::capnp::AnyPointer::Builder initInsert();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class ListPatch::Splice::Pipeline {
+public:
+  typedef Splice Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
+class ListPatch::ElementPatch::Reader {
+public:
+  typedef ElementPatch Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline  ::uint32_t getIndex() const;
+
+  inline bool hasPatch() const;
+  inline  ::capnp::diff::StructPatch::Reader getPatch() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class ListPatch::ElementPatch::Builder {
+public:
+  typedef ElementPatch Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline  ::uint32_t getIndex();
+  inline void setIndex( ::uint32_t value);
+
+  inline bool hasPatch();
+  inline  ::capnp::diff::StructPatch::Builder getPatch();
+  inline void setPatch( ::capnp::diff::StructPatch::Reader value);
+  inline  ::capnp::diff::StructPatch::Builder initPatch();
+  inline void adoptPatch(::capnp::Orphan< ::capnp::diff::StructPatch>&& value);
+  inline ::capnp::Orphan< ::capnp::diff::StructPatch> disownPatch();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class ListPatch::ElementPatch::Pipeline {
+public:
+  typedef ElementPatch Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+  inline  ::capnp::diff::StructPatch::Pipeline getPatch();
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
+// =======================================================================================
+
+inline bool StructPatch::Reader::hasFields() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool StructPatch::Builder::hasFields() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Reader StructPatch::Reader::getFields() const {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Builder StructPatch::Builder::getFields() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void StructPatch::Builder::setFields( ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>::Builder StructPatch::Builder::initFields(unsigned int size) {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), size);
+}
+inline void StructPatch::Builder::adoptFields(
+    ::capnp::Orphan< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>> StructPatch::Builder::disownFields() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::FieldPatch,  ::capnp::Kind::STRUCT>>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline  ::capnp::diff::FieldPatch::Which FieldPatch::Reader::which() const {
+  return _reader.getDataField<Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS);
+}
+inline  ::capnp::diff::FieldPatch::Which FieldPatch::Builder::which() {
+  return _builder.getDataField<Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint16_t FieldPatch::Reader::getIndex() const {
+  return _reader.getDataField< ::uint16_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint16_t FieldPatch::Builder::getIndex() {
+  return _builder.getDataField< ::uint16_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+inline void FieldPatch::Builder::setIndex( ::uint16_t value) {
+  _builder.setDataField< ::uint16_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, value);
+}
+
+inline bool FieldPatch::Reader::isValue() const {
+  return which() == FieldPatch::VALUE;
+}
+inline bool FieldPatch::Builder::isValue() {
+  return which() == FieldPatch::VALUE;
+}
+inline bool FieldPatch::Reader::hasValue() const {
+  if (which() != FieldPatch::VALUE) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool FieldPatch::Builder::hasValue() {
+  if (which() != FieldPatch::VALUE) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::schema::Value::Reader FieldPatch::Reader::getValue() const {
+  KJ_IREQUIRE((which() == FieldPatch::VALUE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::schema::Value>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::schema::Value::Builder FieldPatch::Builder::getValue() {
+  KJ_IREQUIRE((which() == FieldPatch::VALUE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::schema::Value>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::setValue( ::capnp::schema::Value::Reader value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::VALUE);
+  ::capnp::_::PointerHelpers< ::capnp::schema::Value>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::schema::Value::Builder FieldPatch::Builder::initValue() {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::VALUE);
+  return ::capnp::_::PointerHelpers< ::capnp::schema::Value>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::adoptValue(
+    ::capnp::Orphan< ::capnp::schema::Value>&& value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::VALUE);
+  ::capnp::_::PointerHelpers< ::capnp::schema::Value>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::schema::Value> FieldPatch::Builder::disownValue() {
+  KJ_IREQUIRE((which() == FieldPatch::VALUE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::schema::Value>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool FieldPatch::Reader::isPointer() const {
+  return which() == FieldPatch::POINTER;
+}
+inline bool FieldPatch::Builder::isPointer() {
+  return which() == FieldPatch::POINTER;
+}
+inline bool FieldPatch::Reader::hasPointer() const {
+  if (which() != FieldPatch::POINTER) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool FieldPatch::Builder::hasPointer() {
+  if (which() != FieldPatch::POINTER) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline ::capnp::AnyPointer::Reader FieldPatch::Reader::getPointer() const {
+  KJ_IREQUIRE((which() == FieldPatch::POINTER),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::AnyPointer::Reader(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline ::capnp::AnyPointer::Builder FieldPatch::Builder::getPointer() {
+  KJ_IREQUIRE((which() == FieldPatch::POINTER),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::AnyPointer::Builder(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline ::capnp::AnyPointer::Builder FieldPatch::Builder::initPointer() {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::POINTER);
+  auto result = ::capnp::AnyPointer::Builder(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+  result.clear();
+  return result;
+}
+
+inline bool FieldPatch::Reader::isGroup() const {
+  return which() == FieldPatch::GROUP;
+}
+inline bool FieldPatch::Builder::isGroup() {
+  return which() == FieldPatch::GROUP;
+}
+inline bool FieldPatch::Reader::hasGroup() const {
+  if (which() != FieldPatch::GROUP) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool FieldPatch::Builder::hasGroup() {
+  if (which() != FieldPatch::GROUP) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::diff::StructPatch::Reader FieldPatch::Reader::getGroup() const {
+  KJ_IREQUIRE((which() == FieldPatch::GROUP),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::diff::StructPatch::Builder FieldPatch::Builder::getGroup() {
+  KJ_IREQUIRE((which() == FieldPatch::GROUP),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::setGroup( ::capnp::diff::StructPatch::Reader value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::GROUP);
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::diff::StructPatch::Builder FieldPatch::Builder::initGroup() {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::GROUP);
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::adoptGroup(
+    ::capnp::Orphan< ::capnp::diff::StructPatch>&& value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::GROUP);
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::diff::StructPatch> FieldPatch::Builder::disownGroup() {
+  KJ_IREQUIRE((which() == FieldPatch::GROUP),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool FieldPatch::Reader::isStruct() const {
+  return which() == FieldPatch::STRUCT;
+}
+inline bool FieldPatch::Builder::isStruct() {
+  return which() == FieldPatch::STRUCT;
+}
+inline bool FieldPatch::Reader::hasStruct() const {
+  if (which() != FieldPatch::STRUCT) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool FieldPatch::Builder::hasStruct() {
+  if (which() != FieldPatch::STRUCT) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::diff::StructPatch::Reader FieldPatch::Reader::getStruct() const {
+  KJ_IREQUIRE((which() == FieldPatch::STRUCT),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::diff::StructPatch::Builder FieldPatch::Builder::getStruct() {
+  KJ_IREQUIRE((which() == FieldPatch::STRUCT),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::setStruct( ::capnp::diff::StructPatch::Reader value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::STRUCT);
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::diff::StructPatch::Builder FieldPatch::Builder::initStruct() {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::STRUCT);
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::adoptStruct(
+    ::capnp::Orphan< ::capnp::diff::StructPatch>&& value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::STRUCT);
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::diff::StructPatch> FieldPatch::Builder::disownStruct() {
+  KJ_IREQUIRE((which() == FieldPatch::STRUCT),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool FieldPatch::Reader::isList() const {
+  return which() == FieldPatch::LIST;
+}
+inline bool FieldPatch::Builder::isList() {
+  return which() == FieldPatch::LIST;
+}
+inline bool FieldPatch::Reader::hasList() const {
+  if (which() != FieldPatch::LIST) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool FieldPatch::Builder::hasList() {
+  if (which() != FieldPatch::LIST) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::diff::ListPatch::Reader FieldPatch::Reader::getList() const {
+  KJ_IREQUIRE((which() == FieldPatch::LIST),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::diff::ListPatch::Builder FieldPatch::Builder::getList() {
+  KJ_IREQUIRE((which() == FieldPatch::LIST),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::setList( ::capnp::diff::ListPatch::Reader value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::LIST);
+  ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::diff::ListPatch::Builder FieldPatch::Builder::initList() {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::LIST);
+  return ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void FieldPatch::Builder::adoptList(
+    ::capnp::Orphan< ::capnp::diff::ListPatch>&& value) {
+  _builder.setDataField<FieldPatch::Which>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, FieldPatch::LIST);
+  ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::diff::ListPatch> FieldPatch::Builder::disownList() {
+  KJ_IREQUIRE((which() == FieldPatch::LIST),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::diff::ListPatch>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool ListPatch::Reader::hasSplices() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool ListPatch::Builder::hasSplices() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Reader ListPatch::Reader::getSplices() const {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Builder ListPatch::Builder::getSplices() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void ListPatch::Builder::setSplices( ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>::Builder ListPatch::Builder::initSplices(unsigned int size) {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), size);
+}
+inline void ListPatch::Builder::adoptSplices(
+    ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>> ListPatch::Builder::disownSplices() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::Splice,  ::capnp::Kind::STRUCT>>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool ListPatch::Reader::hasElements() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS).isNull();
+}
+inline bool ListPatch::Builder::hasElements() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Reader ListPatch::Reader::getElements() const {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::get(_reader.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Builder ListPatch::Builder::getElements() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::get(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+inline void ListPatch::Builder::setElements( ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::set(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>::Builder ListPatch::Builder::initElements(unsigned int size) {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::init(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), size);
+}
+inline void ListPatch::Builder::adoptElements(
+    ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::adopt(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>> ListPatch::Builder::disownElements() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::diff::ListPatch::ElementPatch,  ::capnp::Kind::STRUCT>>::disown(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+
+inline  ::uint32_t ListPatch::Splice::Reader::getIndex() const {
+  return _reader.getDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint32_t ListPatch::Splice::Builder::getIndex() {
+  return _builder.getDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+inline void ListPatch::Splice::Builder::setIndex( ::uint32_t value) {
+  _builder.setDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, value);
+}
+
+inline  ::uint32_t ListPatch::Splice::Reader::getRemoveCount() const {
+  return _reader.getDataField< ::uint32_t>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint32_t ListPatch::Splice::Builder::getRemoveCount() {
+  return _builder.getDataField< ::uint32_t>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS);
+}
+inline void ListPatch::Splice::Builder::setRemoveCount( ::uint32_t value) {
+  _builder.setDataField< ::uint32_t>(
+      ::capnp::bounded<1>() * ::capnp::ELEMENTS, value);
+}
+
+inline bool ListPatch::Splice::Reader::hasInsert() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool ListPatch::Splice::Builder::hasInsert() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline ::capnp::AnyPointer::Reader ListPatch::Splice::Reader::getInsert() const {
+  return ::capnp::AnyPointer::Reader(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline ::capnp::AnyPointer::Builder ListPatch::Splice::Builder::getInsert() {
+  return ::capnp::AnyPointer::Builder(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline ::capnp::AnyPointer::Builder ListPatch::Splice::Builder::initInsert() {
+  auto result = ::capnp::AnyPointer::Builder(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+  result.clear();
+  return result;
+}
+
+inline  ::uint32_t ListPatch::ElementPatch::Reader::getIndex() const {
+  return _reader.getDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint32_t ListPatch::ElementPatch::Builder::getIndex() {
+  return _builder.getDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS);
+}
+inline void ListPatch::ElementPatch::Builder::setIndex( ::uint32_t value) {
+  _builder.setDataField< ::uint32_t>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, value);
+}
+
+inline bool ListPatch::ElementPatch::Reader::hasPatch() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool ListPatch::ElementPatch::Builder::hasPatch() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::diff::StructPatch::Reader ListPatch::ElementPatch::Reader::getPatch() const {
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::diff::StructPatch::Builder ListPatch::ElementPatch::Builder::getPatch() {
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+#if !CAPNP_LITE
+inline  ::capnp::diff::StructPatch::Pipeline ListPatch::ElementPatch::Pipeline::getPatch() {
+  return  ::capnp::diff::StructPatch::Pipeline(_typeless.getPointerField(0));
+}
+#endif  // !CAPNP_LITE
+inline void ListPatch::ElementPatch::Builder::setPatch( ::capnp::diff::StructPatch::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::diff::StructPatch::Builder ListPatch::ElementPatch::Builder::initPatch() {
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void ListPatch::ElementPatch::Builder::adoptPatch(
+    ::capnp::Orphan< ::capnp::diff::StructPatch>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::diff::StructPatch> ListPatch::ElementPatch::Builder::disownPatch() {
+  return ::capnp::_::PointerHelpers< ::capnp::diff::StructPatch>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+}  // namespace
+}  // namespace
+
+CAPNP_END_HEADER
+
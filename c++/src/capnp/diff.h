@@ -0,0 +1,67 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "dynamic.h"
+#include "diff.capnp.h"
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+// =======================================================================================
+// Diff and patch
+//
+// Computes the differences between two versions of a struct value as a patch -- itself a
+// Cap'n Proto message, defined in diff.capnp -- which turns the first version into the second when
+// applied to it. Replicating a large value by sending patches, rather than the whole value on
+// every change, makes the cost of an update proportional to the size of the change.
+//
+// The diff is driven by the schema. Subtrees which didn't change are recognized by comparing them
+// with AnyStruct / AnyPointer equality, without being walked field by field; structs that did
+// change are compared field by field, recursively; and lists are compared element by element,
+// with the changed range between their common prefix and suffix becoming a splice. Elements of
+// struct lists that are modified in place become patches of their own, as long as the list's
+// length is unchanged in that range.
+//
+// Interface fields are left out: capabilities can't be carried by patches. Nor can capabilities
+// in AnyPointer fields, or in structs or lists that are copied into a patch whole (say, a struct
+// field that was null).
+
+void diffStruct(DynamicStruct::Reader from, DynamicStruct::Reader to,
+                diff::StructPatch::Builder patch);
+// Fills `patch` with the changes that turn `from` into `to`, which must be of the same type. If
+// the values are equal, the patch has no fields.
+//
+// As with other dynamic API functions, any generated struct reader can be passed, e.g.
+// `diffStruct(oldState.asReader(), newState.asReader(), message.initRoot<diff::StructPatch>())`.
+
+void applyPatch(DynamicStruct::Builder target, diff::StructPatch::Reader patch);
+// Applies a patch computed by `diffStruct()` to `target`, which must hold the `from` value that
+// the patch was computed from (or an equal one). Afterwards, `target` is equal to `to`.
+//
+// Lists which are spliced are replaced by new lists, so the space taken by the old ones remains
+// allocated in the target's message until it's copied into a new message.
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
@@ -492,6 +492,94 @@ TEST(DynamicApi, BuilderAssign) {
   listValue.set(0, 123);
 }
 
+TEST(DynamicApi, FieldAccessors) {
+  MallocMessageBuilder srcBuilder;
+  auto src = srcBuilder.initRoot<TestAllTypes>();
+  initTestMessage(src);
+  DynamicStruct::Reader srcReader = toDynamic(src.asReader());
+
+  StructSchema schema = Schema::from<TestAllTypes>();
+  auto accessors = KJ_MAP(field, schema.getFields()) { return DynamicFieldAccessor(field); };
+
+  MallocMessageBuilder dstBuilder;
+  auto dst = dstBuilder.initRoot<DynamicStruct>(schema);
+  for (auto& accessor: accessors) {
+    auto field = accessor.getField();
+    EXPECT_EQ(kj::str(srcReader.get(field)), kj::str(accessor.get(srcReader)));
+    EXPECT_EQ(srcReader.has(field, HasMode::NON_DEFAULT),
+              accessor.has(srcReader, HasMode::NON_DEFAULT));
+    accessor.set(dst, accessor.get(srcReader));
+  }
+  checkTestMessage(dst.asReader().as<TestAllTypes>());
+
+  for (auto& accessor: accessors) {
+    EXPECT_EQ(kj::str(dst.get(accessor.getField())), kj::str(accessor.get(dst)));
+  }
+
+  DynamicFieldAccessor byName(schema, "int32Field");
+  EXPECT_EQ(schema.getFieldByName("int32Field"), byName.getField());
+  EXPECT_ANY_THROW(DynamicFieldAccessor(schema, "noSuchField"));
+
+  // An accessor only works on its own struct type.
+  MallocMessageBuilder otherBuilder;
+  auto other = otherBuilder.initRoot<DynamicStruct>(Schema::from<TestDefaults>());
+  EXPECT_ANY_THROW(byName.get(other.asReader()));
+  EXPECT_ANY_THROW(byName.set(other, 123));
+}
+
+TEST(DynamicApi, FieldAccessorDefaults) {
+  StructSchema schema = Schema::from<TestDefaults>();
+  auto accessors = KJ_MAP(field, schema.getFields()) { return DynamicFieldAccessor(field); };
+
+  AlignedData<1> nullRoot = {{0, 0, 0, 0, 0, 0, 0, 0}};
+  kj::ArrayPtr<const word> segments[1] = {kj::arrayPtr(nullRoot.words, 1)};
+  SegmentArrayMessageReader reader(kj::arrayPtr(segments, 1));
+  auto root = reader.getRoot<DynamicStruct>(schema);
+  for (auto& accessor: accessors) {
+    EXPECT_EQ(kj::str(root.get(accessor.getField())), kj::str(accessor.get(root)));
+  }
+
+  // Getting pointer fields from a builder fills them in with copies of the defaults, just as
+  // DynamicStruct::Builder::get() does.
+  MallocMessageBuilder builder;
+  auto builderRoot = builder.initRoot<DynamicStruct>(schema);
+  MallocMessageBuilder expectedBuilder;
+  auto expectedRoot = expectedBuilder.initRoot<DynamicStruct>(schema);
+  for (auto& accessor: accessors) {
+    accessor.get(builderRoot);
+    expectedRoot.get(accessor.getField());
+    EXPECT_EQ(expectedRoot.has(accessor.getField()), accessor.has(builderRoot.asReader()));
+  }
+  checkTestMessage(builderRoot.asReader().as<TestDefaults>());
+  EXPECT_EQ(expectedRoot.totalSize().wordCount, builderRoot.totalSize().wordCount);
+}
+
+TEST(DynamicApi, FieldAccessorUnions) {
+  MallocMessageBuilder builder;
+  StructSchema schema = Schema::from<test::TestUnnamedUnion>();
+  auto root = builder.initRoot<DynamicStruct>(schema);
+
+  DynamicFieldAccessor foo(schema, "foo");
+  DynamicFieldAccessor bar(schema, "bar");
+
+  bar.set(root, 321);
+  EXPECT_EQ(schema.getFieldByName("bar"), KJ_ASSERT_NONNULL(root.which()));
+  EXPECT_EQ(321u, bar.get(root.asReader()).as<uint>());
+  EXPECT_TRUE(bar.has(root.asReader()));
+  EXPECT_FALSE(foo.has(root.asReader()));
+  EXPECT_ANY_THROW(foo.get(root));
+  EXPECT_ANY_THROW(foo.get(root.asReader()));
+
+  foo.set(root, 123);
+  EXPECT_EQ(schema.getFieldByName("foo"), KJ_ASSERT_NONNULL(root.which()));
+  EXPECT_EQ(123u, foo.get(root).as<uint>());
+  EXPECT_ANY_THROW(bar.get(root.asReader()));
+
+  // A value of the wrong type leaves the union alone.
+  EXPECT_ANY_THROW(bar.set(root, "text"));
+  EXPECT_EQ(schema.getFieldByName("foo"), KJ_ASSERT_NONNULL(root.which()));
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -1036,6 +1036,365 @@ void DynamicStruct::Builder::clear(kj::StringPtr name) {
 
 // =======================================================================================
 
+DynamicFieldAccessor::DynamicFieldAccessor(StructSchema schema, kj::StringPtr fieldName)
+    : DynamicFieldAccessor(schema.getFieldByName(fieldName)) {}
+
+DynamicFieldAccessor::DynamicFieldAccessor(StructSchema::Field field)
+    : field(field), type(field.getType()) {
+  auto proto = field.getProto();
+  isGroup = proto.isGroup();
+  isUnionMember = hasDiscriminantValue(proto);
+  discriminantValue = proto.getDiscriminantValue();
+  discriminantOffset = field.getContainingStruct().getProto().getStruct().getDiscriminantOffset();
+
+  if (isGroup) {
+    offset = 0;
+    groupSchema = type.asStruct();
+    return;
+  }
+
+  auto slot = proto.getSlot();
+  offset = slot.getOffset();
+
+  // Note that the default value might be "anyPointer" even if the type is some pointer type
+  // *other than* anyPointer; see DynamicStruct::Reader::get().
+  auto dval = slot.getDefaultValue();
+
+  switch (type.which()) {
+    case schema::Type::VOID:
+      break;
+
+#define HANDLE_TYPE(discrim, titleCase, type) \
+    case schema::Type::discrim: \
+      defaultBits = static_cast<uint64_t>(bitCast<_::Mask<type>>(dval.get##titleCase())); \
+      break;
+
+    HANDLE_TYPE(BOOL, Bool, bool)
+    HANDLE_TYPE(INT8, Int8, int8_t)
+    HANDLE_TYPE(INT16, Int16, int16_t)
+    HANDLE_TYPE(INT32, Int32, int32_t)
+    HANDLE_TYPE(INT64, Int64, int64_t)
+    HANDLE_TYPE(UINT8, Uint8, uint8_t)
+    HANDLE_TYPE(UINT16, Uint16, uint16_t)
+    HANDLE_TYPE(UINT32, Uint32, uint32_t)
+    HANDLE_TYPE(UINT64, Uint64, uint64_t)
+    HANDLE_TYPE(FLOAT32, Float32, float)
+    HANDLE_TYPE(FLOAT64, Float64, double)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::ENUM:
+      defaultBits = dval.getEnum();
+      break;
+
+    case schema::Type::TEXT: {
+      Text::Reader typedDval = dval.isAnyPointer() ? Text::Reader() : dval.getText();
+      defaultPointer = typedDval.begin();
+      defaultBlobSize = typedDval.size();
+      break;
+    }
+
+    case schema::Type::DATA: {
+      Data::Reader typedDval = dval.isAnyPointer() ? Data::Reader() : dval.getData();
+      defaultPointer = typedDval.begin();
+      defaultBlobSize = typedDval.size();
+      break;
+    }
+
+    case schema::Type::LIST: {
+      auto listType = type.asList();
+      if (listType.whichElementType() == schema::Type::STRUCT) {
+        structSize = structSizeFromSchema(listType.getStructElementType());
+        elementSize = ElementSize::INLINE_COMPOSITE;
+      } else {
+        elementSize = elementSizeFor(listType.whichElementType());
+      }
+      if (!dval.isAnyPointer()) {
+        defaultPointer = dval.getList().getAs<_::UncheckedMessage>();
+      }
+      break;
+    }
+
+    case schema::Type::STRUCT:
+      structSize = structSizeFromSchema(type.asStruct());
+      if (!dval.isAnyPointer()) {
+        defaultPointer = dval.getStruct().getAs<_::UncheckedMessage>();
+      }
+      break;
+
+    case schema::Type::ANY_POINTER:
+    case schema::Type::INTERFACE:
+      break;
+  }
+}
+
+inline void DynamicFieldAccessor::requireSchema(StructSchema schema) const {
+  KJ_REQUIRE(field.getContainingStruct() == schema, "`field` is not a field of this struct.");
+}
+
+inline bool DynamicFieldAccessor::isSetInUnion(const _::StructReader& reader) const {
+  return !isUnionMember ||
+      reader.getDataField<uint16_t>(assumeDataOffset(discriminantOffset)) == discriminantValue;
+}
+
+inline void DynamicFieldAccessor::setInUnion(_::StructBuilder& builder) const {
+  if (isUnionMember) {
+    builder.setDataField<uint16_t>(assumeDataOffset(discriminantOffset), discriminantValue);
+  }
+}
+
+DynamicValue::Reader DynamicFieldAccessor::get(DynamicStruct::Reader reader) const {
+  requireSchema(reader.schema);
+  auto& raw = reader.reader;
+  KJ_REQUIRE(isSetInUnion(raw),
+      "Tried to get() a union member which is not currently initialized.",
+      field.getProto().getName(), reader.schema.getProto().getDisplayName());
+
+  if (isGroup) {
+    return DynamicStruct::Reader(groupSchema, raw);
+  }
+
+  switch (type.which()) {
+    case schema::Type::VOID:
+      return raw.getDataField<Void>(assumeDataOffset(offset));
+
+#define HANDLE_TYPE(discrim, type) \
+    case schema::Type::discrim: \
+      return raw.getDataField<type>(assumeDataOffset(offset), \
+                                    static_cast<_::Mask<type>>(defaultBits));
+
+    HANDLE_TYPE(BOOL, bool)
+    HANDLE_TYPE(INT8, int8_t)
+    HANDLE_TYPE(INT16, int16_t)
+    HANDLE_TYPE(INT32, int32_t)
+    HANDLE_TYPE(INT64, int64_t)
+    HANDLE_TYPE(UINT8, uint8_t)
+    HANDLE_TYPE(UINT16, uint16_t)
+    HANDLE_TYPE(UINT32, uint32_t)
+    HANDLE_TYPE(UINT64, uint64_t)
+    HANDLE_TYPE(FLOAT32, float)
+    HANDLE_TYPE(FLOAT64, double)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::ENUM:
+      return DynamicEnum(type.asEnum(), raw.getDataField<uint16_t>(
+          assumeDataOffset(offset), static_cast<uint16_t>(defaultBits)));
+
+    case schema::Type::TEXT:
+      return raw.getPointerField(assumePointerOffset(offset))
+          .getBlob<Text>(defaultPointer, assumeMax<MAX_TEXT_SIZE>(defaultBlobSize) * BYTES);
+
+    case schema::Type::DATA:
+      return raw.getPointerField(assumePointerOffset(offset))
+          .getBlob<Data>(defaultPointer, assumeBits<BLOB_SIZE_BITS>(defaultBlobSize) * BYTES);
+
+    case schema::Type::LIST:
+      return DynamicList::Reader(type.asList(),
+          raw.getPointerField(assumePointerOffset(offset))
+             .getList(elementSize, reinterpret_cast<const word*>(defaultPointer)));
+
+    case schema::Type::STRUCT:
+      return DynamicStruct::Reader(type.asStruct(),
+          raw.getPointerField(assumePointerOffset(offset))
+             .getStruct(reinterpret_cast<const word*>(defaultPointer)));
+
+    case schema::Type::ANY_POINTER:
+      return AnyPointer::Reader(raw.getPointerField(assumePointerOffset(offset)));
+
+    case schema::Type::INTERFACE:
+      return DynamicCapability::Client(type.asInterface(),
+          raw.getPointerField(assumePointerOffset(offset)).getCapability());
+  }
+
+  KJ_UNREACHABLE;
+}
+
+DynamicValue::Builder DynamicFieldAccessor::get(DynamicStruct::Builder builder) const {
+  requireSchema(builder.schema);
+  auto& raw = builder.builder;
+  KJ_REQUIRE(isSetInUnion(raw.asReader()),
+      "Tried to get() a union member which is not currently initialized.",
+      field.getProto().getName(), builder.schema.getProto().getDisplayName());
+
+  if (isGroup) {
+    return DynamicStruct::Builder(groupSchema, raw);
+  }
+
+  switch (type.which()) {
+    case schema::Type::VOID:
+      return raw.getDataField<Void>(assumeDataOffset(offset));
+
+#define HANDLE_TYPE(discrim, type) \
+    case schema::Type::discrim: \
+      return raw.getDataField<type>(assumeDataOffset(offset), \
+                                    static_cast<_::Mask<type>>(defaultBits));
+
+    HANDLE_TYPE(BOOL, bool)
+    HANDLE_TYPE(INT8, int8_t)
+    HANDLE_TYPE(INT16, int16_t)
+    HANDLE_TYPE(INT32, int32_t)
+    HANDLE_TYPE(INT64, int64_t)
+    HANDLE_TYPE(UINT8, uint8_t)
+    HANDLE_TYPE(UINT16, uint16_t)
+    HANDLE_TYPE(UINT32, uint32_t)
+    HANDLE_TYPE(UINT64, uint64_t)
+    HANDLE_TYPE(FLOAT32, float)
+    HANDLE_TYPE(FLOAT64, double)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::ENUM:
+      return DynamicEnum(type.asEnum(), raw.getDataField<uint16_t>(
+          assumeDataOffset(offset), static_cast<uint16_t>(defaultBits)));
+
+    case schema::Type::TEXT:
+      return raw.getPointerField(assumePointerOffset(offset))
+          .getBlob<Text>(defaultPointer, assumeMax<MAX_TEXT_SIZE>(defaultBlobSize) * BYTES);
+
+    case schema::Type::DATA:
+      return raw.getPointerField(assumePointerOffset(offset))
+          .getBlob<Data>(defaultPointer, assumeBits<BLOB_SIZE_BITS>(defaultBlobSize) * BYTES);
+
+    case schema::Type::LIST: {
+      auto pointer = raw.getPointerField(assumePointerOffset(offset));
+      auto defaultValue = reinterpret_cast<const word*>(defaultPointer);
+      if (elementSize == ElementSize::INLINE_COMPOSITE) {
+        return DynamicList::Builder(type.asList(), pointer.getStructList(structSize, defaultValue));
+      } else {
+        return DynamicList::Builder(type.asList(), pointer.getList(elementSize, defaultValue));
+      }
+    }
+
+    case schema::Type::STRUCT:
+      return DynamicStruct::Builder(type.asStruct(),
+          raw.getPointerField(assumePointerOffset(offset))
+             .getStruct(structSize, reinterpret_cast<const word*>(defaultPointer)));
+
+    case schema::Type::ANY_POINTER:
+      return AnyPointer::Builder(raw.getPointerField(assumePointerOffset(offset)));
+
+    case schema::Type::INTERFACE:
+      return DynamicCapability::Client(type.asInterface(),
+          raw.getPointerField(assumePointerOffset(offset)).getCapability());
+  }
+
+  KJ_UNREACHABLE;
+}
+
+bool DynamicFieldAccessor::has(DynamicStruct::Reader reader, HasMode mode) const {
+  requireSchema(reader.schema);
+  auto& raw = reader.reader;
+  if (!isSetInUnion(raw)) {
+    // Field is not active in the union.
+    return false;
+  }
+
+  if (isGroup) {
+    return true;
+  }
+
+  switch (type.which()) {
+    case schema::Type::VOID:
+      // Void is always equal to the default.
+      return mode == HasMode::NON_NULL;
+
+    case schema::Type::BOOL:
+      return mode == HasMode::NON_NULL ||
+          raw.getDataField<bool>(assumeDataOffset(offset), 0) != 0;
+
+    case schema::Type::INT8:
+    case schema::Type::UINT8:
+      return mode == HasMode::NON_NULL ||
+          raw.getDataField<uint8_t>(assumeDataOffset(offset), 0) != 0;
+
+    case schema::Type::INT16:
+    case schema::Type::UINT16:
+    case schema::Type::ENUM:
+      return mode == HasMode::NON_NULL ||
+          raw.getDataField<uint16_t>(assumeDataOffset(offset), 0) != 0;
+
+    case schema::Type::INT32:
+    case schema::Type::UINT32:
+    case schema::Type::FLOAT32:
+      return mode == HasMode::NON_NULL ||
+          raw.getDataField<uint32_t>(assumeDataOffset(offset), 0) != 0;
+
+    case schema::Type::INT64:
+    case schema::Type::UINT64:
+    case schema::Type::FLOAT64:
+      return mode == HasMode::NON_NULL ||
+          raw.getDataField<uint64_t>(assumeDataOffset(offset), 0) != 0;
+
+    case schema::Type::TEXT:
+    case schema::Type::DATA:
+    case schema::Type::LIST:
+    case schema::Type::STRUCT:
+    case schema::Type::ANY_POINTER:
+    case schema::Type::INTERFACE:
+      return !raw.getPointerField(assumePointerOffset(offset)).isNull();
+  }
+
+  // Unknown type.  As far as we know, it isn't set.
+  return false;
+}
+
+void DynamicFieldAccessor::set(DynamicStruct::Builder builder,
+                               const DynamicValue::Reader& value) const {
+  requireSchema(builder.schema);
+  auto& raw = builder.builder;
+
+  if (!isGroup) {
+    switch (type.which()) {
+#define HANDLE_TYPE(discrim, type) \
+      case schema::Type::discrim: { \
+        auto typedValue = value.as<type>(); \
+        setInUnion(raw); \
+        raw.setDataField<type>(assumeDataOffset(offset), typedValue, \
+                               static_cast<_::Mask<type>>(defaultBits)); \
+        return; \
+      }
+
+      HANDLE_TYPE(BOOL, bool)
+      HANDLE_TYPE(INT8, int8_t)
+      HANDLE_TYPE(INT16, int16_t)
+      HANDLE_TYPE(INT32, int32_t)
+      HANDLE_TYPE(INT64, int64_t)
+      HANDLE_TYPE(UINT8, uint8_t)
+      HANDLE_TYPE(UINT16, uint16_t)
+      HANDLE_TYPE(UINT32, uint32_t)
+      HANDLE_TYPE(UINT64, uint64_t)
+      HANDLE_TYPE(FLOAT32, float)
+      HANDLE_TYPE(FLOAT64, double)
+
+#undef HANDLE_TYPE
+
+      case schema::Type::TEXT: {
+        auto typedValue = value.as<Text>();
+        setInUnion(raw);
+        raw.getPointerField(assumePointerOffset(offset)).setBlob<Text>(typedValue);
+        return;
+      }
+
+      case schema::Type::DATA: {
+        auto typedValue = value.as<Data>();
+        setInUnion(raw);
+        raw.getPointerField(assumePointerOffset(offset)).setBlob<Data>(typedValue);
+        return;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  // Other kinds of fields need conversions or type checks which dominate the cost of the schema
+  // lookups anyway, so leave them to the general implementation.
+  builder.set(field, value);
+}
+
+// =======================================================================================
+
 DynamicValue::Reader DynamicList::Reader::operator[](uint index) const {
   KJ_REQUIRE(index < size(), "List index out-of-bounds.");
 
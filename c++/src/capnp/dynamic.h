@@ -248,6 +248,7 @@ private:
   friend class Orphan<DynamicValue>;
   friend class Orphan<AnyPointer>;
   friend class AnyStruct::Reader;
+  friend class DynamicFieldAccessor;
 };
 
 class DynamicStruct::Builder {
@@ -339,6 +340,7 @@ private:
   friend class Orphan<DynamicValue>;
   friend class Orphan<AnyPointer>;
   friend class AnyStruct::Builder;
+  friend class DynamicFieldAccessor;
 };
 
 class DynamicStruct::Pipeline {
@@ -369,6 +371,62 @@ private:
   friend class Request<DynamicStruct, DynamicStruct>;
 };
 
+class DynamicFieldAccessor {
+  // Accesses one field of a dynamic struct, the way generated code would. Everything about the
+  // field that DynamicStruct::Reader::get(field) and friends would otherwise look up in the
+  // schema on each call -- the field's type, offset, union discriminant, and default value -- is
+  // resolved once, when the accessor is constructed. Build one accessor per field of interest
+  // and reuse it for every struct you process.
+  //
+  // The accessor refers to schema data, so it must not outlive the schema (e.g. the
+  // SchemaLoader) it came from.
+
+public:
+  explicit DynamicFieldAccessor(StructSchema::Field field);
+  DynamicFieldAccessor(StructSchema schema, kj::StringPtr fieldName);
+  // The second form looks up the field by name, throwing if it doesn't exist.
+
+  inline StructSchema::Field getField() const { return field; }
+
+  DynamicValue::Reader get(DynamicStruct::Reader reader) const;
+  DynamicValue::Builder get(DynamicStruct::Builder builder) const;
+  bool has(DynamicStruct::Reader reader, HasMode mode = HasMode::NON_NULL) const;
+  void set(DynamicStruct::Builder builder, const DynamicValue::Reader& value) const;
+  // Equivalent to calling the same method on `reader` or `builder` with the accessor's field.
+  // The struct must be of the field's containing type.
+
+private:
+  StructSchema::Field field;
+  Type type;
+  bool isGroup;
+  bool isUnionMember;
+  uint16_t discriminantValue;
+  uint32_t discriminantOffset;
+  uint32_t offset;
+  // For a slot, its offset, in multiples of the field's size.
+
+  uint64_t defaultBits = 0;
+  // For primitive and enum fields, the default value's bits (the XOR mask applied on the wire).
+
+  const void* defaultPointer = nullptr;
+  uint defaultBlobSize = 0;
+  // For pointer fields, the encoded default value, if any. For Text and Data, `defaultPointer`
+  // points at the bytes instead, with size `defaultBlobSize`.
+
+  _::StructSize structSize;
+  // For struct fields and lists of structs, the size of the struct.
+
+  ElementSize elementSize = ElementSize::VOID;
+  // For non-struct lists, the element size.
+
+  StructSchema groupSchema;
+  // For groups, the group's schema.
+
+  bool isSetInUnion(const _::StructReader& reader) const;
+  void setInUnion(_::StructBuilder& builder) const;
+  void requireSchema(StructSchema schema) const;
+};
+
 // -------------------------------------------------------------------
 
 class DynamicList::Reader {
@@ -407,6 +465,7 @@ private:
   friend struct _::PointerHelpers;
   friend struct DynamicStruct;
   friend class DynamicList::Builder;
+  friend class DynamicFieldAccessor;
   template <typename T, ::capnp::Kind k>
   friend struct ::capnp::ToDynamic_;
   friend class Orphanage;
@@ -459,6 +518,7 @@ private:
   template <typename T, Kind k>
   friend struct _::PointerHelpers;
   friend struct DynamicStruct;
+  friend class DynamicFieldAccessor;
   template <typename T, ::capnp::Kind k>
   friend struct ::capnp::ToDynamic_;
   friend class Orphanage;
@@ -512,6 +572,7 @@ private:
   friend struct Capability;
   friend struct DynamicStruct;
   friend struct DynamicList;
+  friend class DynamicFieldAccessor;
   friend struct DynamicValue;
   friend class Orphan<DynamicCapability>;
   friend class Orphan<DynamicValue>;
@@ -554,6 +615,10 @@ public:
   // Use when the caller is aware that the response type is StreamResult and wants to invoke
   // streaming behavior. It is an error to call this if the response type is not StreamResult.
 
+  void setDeadline(kj::TimePoint deadline);
+  void setTimeout(kj::Duration timeout);
+  // See Request<T, U>::setDeadline().
+
 private:
   kj::Own<RequestHook> hook;
   StructSchema resultSchema;
@@ -585,6 +650,7 @@ public:
   template <typename SubParams>
   kj::Promise<void> tailCall(Request<SubParams, DynamicStruct>&& tailRequest);
   void allowCancellation();
+  kj::Maybe<kj::TimePoint> getDeadline();
 
   StructSchema getParamsType() const { return paramType; }
   StructSchema getResultsType() const { return resultType; }
@@ -1661,6 +1727,15 @@ inline kj::Promise<void> CallContext<DynamicStruct, DynamicStruct>::tailCall(
 inline void CallContext<DynamicStruct, DynamicStruct>::allowCancellation() {
   hook->allowCancellation();
 }
+inline kj::Maybe<kj::TimePoint> CallContext<DynamicStruct, DynamicStruct>::getDeadline() {
+  return hook->getDeadline();
+}
+inline void Request<DynamicStruct, DynamicStruct>::setDeadline(kj::TimePoint deadline) {
+  hook->setDeadline(deadline);
+}
+inline void Request<DynamicStruct, DynamicStruct>::setTimeout(kj::Duration timeout) {
+  hook->setDeadline(kj::systemPreciseMonotonicClock().now() + timeout);
+}
 
 template <>
 inline DynamicCapability::Client Capability::Client::castAs<DynamicCapability>(
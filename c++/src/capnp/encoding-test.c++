@@ -21,6 +21,8 @@
 
 #include "capnp/test-import.capnp.h"
 #include "capnp/test-import2.capnp.h"
+#include "capnp/test-out-of-line.capnp-fwd.h"
+#include "capnp/test-out-of-line.capnp.h"
 #include "message.h"
 #include "kj/debug.h"
 #include "kj/compat/gtest.h"
@@ -2019,6 +2021,225 @@ KJ_TEST("list.setWithCaveats(i, list[i]) doesn't corrupt contents") {
   checkTestMessage(list[1]);
 }
 
+KJ_TEST("copying pointer-free struct lists") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<test::TestLists>();
+  auto list32 = root.initList32(100);
+  auto list64 = root.initList64(1000);
+  for (auto i: kj::indices(list32)) list32[i].setF(i * 3);
+  for (auto i: kj::indices(list64)) list64[i].setF(i * 12345678901ull);
+
+  auto check = [](test::TestLists::Reader reader) {
+    auto list32 = reader.getList32();
+    auto list64 = reader.getList64();
+    KJ_ASSERT(list32.size() == 100);
+    KJ_ASSERT(list64.size() == 1000);
+    for (auto i: kj::indices(list32)) KJ_EXPECT(list32[i].getF() == i * 3);
+    for (auto i: kj::indices(list64)) KJ_EXPECT(list64[i].getF() == i * 12345678901ull);
+  };
+
+  {
+    MallocMessageBuilder copy;
+    copy.setRoot(root.asReader());
+    check(copy.getRoot<test::TestLists>());
+  }
+
+  {
+    // Copies from an unchecked message take a different path.
+    auto words = kj::heapArray<word>(root.asReader().totalSize().wordCount + 1);
+    memset(words.begin(), 0, words.asBytes().size());
+    copyToUnchecked(root.asReader(), words);
+
+    MallocMessageBuilder copy;
+    copy.setRoot(readMessageUnchecked<test::TestLists>(words.begin()));
+    check(copy.getRoot<test::TestLists>());
+  }
+
+  {
+    // Canonicalization copies through the same path, after deciding whether to truncate.
+    auto canonical = canonicalize(root.asReader());
+    check(readMessageUnchecked<test::TestLists>(canonical.begin()));
+  }
+}
+
+KJ_TEST("bulk copies of primitive lists") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+
+  int32_t ints[] = {1, -2, 300000, -400000, 5};
+  double doubles[] = {1.5, -2.25, 1e300};
+  root.initInt32List(kj::size(ints)).setFrom(kj::arrayPtr(ints, kj::size(ints)));
+  root.initFloat64List(kj::size(doubles)).setFrom(kj::arrayPtr(doubles, kj::size(doubles)));
+  root.initBoolList(3).setFrom(kj::arr(true, false, true).asPtr());
+  root.initUInt16List(0).setFrom(nullptr);
+
+  auto reader = root.asReader();
+  checkList(reader.getInt32List(), {1, -2, 300000, -400000, 5});
+  checkList(reader.getFloat64List(), {1.5, -2.25, 1e300});
+  checkList(reader.getBoolList(), {true, false, true});
+
+  {
+    auto out = kj::heapArray<int32_t>(reader.getInt32List().size());
+    reader.getInt32List().copyTo(out);
+    KJ_EXPECT(out == kj::arrayPtr(ints, kj::size(ints)));
+  }
+  {
+    auto out = kj::heapArray<double>(reader.getFloat64List().size());
+    reader.getFloat64List().copyTo(out);
+    KJ_EXPECT(out == kj::arrayPtr(doubles, kj::size(doubles)));
+  }
+  {
+    auto out = kj::heapArray<bool>(3);
+    reader.getBoolList().copyTo(out);
+    KJ_EXPECT(out == kj::arr(true, false, true));
+    KJ_EXPECT(reader.getBoolList().asArrayPtr() == nullptr);
+  }
+  reader.getUInt16List().copyTo(nullptr);
+
+#if CAPNP_WIRE_VALUES_ARE_NATIVE
+  KJ_IF_MAYBE(array, reader.getInt32List().asArrayPtr()) {
+    KJ_EXPECT(*array == kj::arrayPtr(ints, kj::size(ints)));
+    // Points directly into the message.
+    auto segment = builder.getSegmentsForOutput()[0].asBytes();
+    auto bytes = array->asBytes();
+    KJ_EXPECT(bytes.begin() >= segment.begin() && bytes.end() <= segment.end());
+  } else {
+    KJ_FAIL_EXPECT("asArrayPtr() should succeed on this platform");
+  }
+#else
+  KJ_EXPECT(reader.getInt32List().asArrayPtr() == nullptr);
+#endif
+
+  {
+    // A struct list read as a primitive list has elements spaced further apart, so bulk copies
+    // must fall back to element-by-element.
+    auto any = builder.initRoot<test::TestAnyPointer>().getAnyPointerField();
+    auto structs = any.initAs<List<test::TestLists::Struct32>>(3);
+    structs[0].setF(12);
+    structs[1].setF(34);
+    structs[2].setF(56);
+
+    auto list = any.asReader().getAs<List<uint32_t>>();
+    KJ_EXPECT(list.asArrayPtr() == nullptr);
+    auto out = kj::heapArray<uint32_t>(3);
+    list.copyTo(out);
+    KJ_EXPECT(out == kj::arr(12u, 34u, 56u));
+
+    any.getAs<List<uint32_t>>().setFrom(kj::arr(7u, 8u, 9u).asPtr());
+    KJ_EXPECT(structs[0].getF() == 7);
+    KJ_EXPECT(structs[1].getF() == 8);
+    KJ_EXPECT(structs[2].getF() == 9);
+  }
+}
+
+template <typename T>
+void checkColumn(ColumnReader<T> column, std::initializer_list<kj::NoInfer<T>> expected) {
+  ASSERT_EQ(expected.size(), column.size());
+  uint i = 0;
+  for (T value: expected) {
+    EXPECT_EQ(value, column[i++]);
+  }
+}
+
+KJ_TEST("generated struct list columns") {
+  MallocMessageBuilder builder;
+  auto any = builder.initRoot<test::TestAnyPointer>().getAnyPointerField();
+  auto list = any.initAs<List<test::TestColumns>>(3);
+  list[0].setId(10);
+  list[0].setScore(0.25);
+  list[0].setKind(test::TestEnum::QUX);
+  list[1].setId(20);
+  list[1].setDelta(7);
+  list[2].setId(30);
+  list[2].setScore(-4);
+
+  test::TestColumns::Columns columns(list.asReader());
+  KJ_EXPECT(columns.size() == 3);
+
+  uint64_t total = 0;
+  for (auto id: columns.getId()) total += id;
+  KJ_EXPECT(total == 60);
+
+  checkColumn(columns.getScore(), {0.25, 1.5, -4.0});
+  checkColumn(columns.getKind(),
+      {test::TestEnum::QUX, test::TestEnum::BAR, test::TestEnum::BAR});
+  checkColumn(columns.getDelta(), {-3, 7, -3});
+
+  {
+    // A one-word primitive list read as a list of TestColumns: every element has an `id` taken
+    // from its low 32 bits, and fields past the first word read as their defaults.
+    auto wide = any.initAs<List<uint64_t>>(2);
+    wide.set(0, 0x0000000500000001ull);
+    wide.set(1, 0x0000000600000002ull);
+
+    test::TestColumns::Columns upgraded(any.asReader().getAs<List<test::TestColumns>>());
+    checkColumn(upgraded.getId(), {1u, 2u});
+    checkColumn(upgraded.getScore(), {1.5, 1.5});
+  }
+
+  {
+    test::TestColumns::Columns empty(List<test::TestColumns>::Reader{});
+    KJ_EXPECT(empty.size() == 0);
+    KJ_EXPECT(empty.getId().begin() == empty.getId().end());
+  }
+}
+
+KJ_TEST("generated accessors defined out of line") {
+  namespace ool = capnproto_test::capnp::test_out_of_line;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<ool::Record>();
+
+  // Defaults come from the schema, as with inline accessors.
+  KJ_EXPECT(!root.hasName());
+  KJ_EXPECT(root.asReader().getName() == "unnamed");
+  KJ_EXPECT(root.asReader().getTags().size() == 2);
+  KJ_EXPECT(root.asReader().getTags()[1] == "b");
+
+  root.setId(123);
+  root.setName("foo");
+  root.setTags({"x", "y", "z"});
+  root.initPayload(3)[2] = 7;
+  root.setColor(ool::Color::GREEN);
+  root.initChild().setName("child");
+  initTestMessage(root.initAllTypes());
+  root.initValues(2).set(1, -5);
+  root.getExtra().initItems(1)[0].setId(456);
+  root.getExtra().setColors({ool::Color::RED, ool::Color::GREEN});
+  root.getAny().setAs<Text>("any");
+  root.initAnyStructAs<test::TestAllTypes>().setInt32Field(789);
+  root.initBoxed().setValue("boxed");
+
+  {
+    auto reader = builder.getRoot<ool::Record>().asReader();
+    KJ_EXPECT(reader.getId() == 123);
+    KJ_EXPECT(reader.getName() == "foo");
+    KJ_EXPECT(reader.getTags()[2] == "z");
+    KJ_EXPECT(reader.getPayload()[2] == 7);
+    KJ_EXPECT(reader.getColor() == ool::Color::GREEN);
+    KJ_EXPECT(reader.getChild().getName() == "child");
+    KJ_EXPECT(!reader.getChild().hasChild());
+    checkTestMessage(reader.getAllTypes());
+    KJ_ASSERT(reader.isValues());
+    KJ_EXPECT(reader.getValues()[1] == -5);
+    KJ_EXPECT(reader.getExtra().getItems()[0].getId() == 456);
+    KJ_EXPECT(reader.getExtra().getColors()[1] == ool::Color::GREEN);
+    KJ_EXPECT(reader.getAny().getAs<Text>() == "any");
+    KJ_EXPECT(reader.getAnyStruct().as<test::TestAllTypes>().getInt32Field() == 789);
+    KJ_EXPECT(reader.getBoxed().getValue() == "boxed");
+  }
+
+  // Moving a subtree between fields through orphans.
+  auto orphan = root.disownChild();
+  KJ_EXPECT(!root.hasChild());
+  root.getExtra().getItems()[0].adoptChild(kj::mv(orphan));
+  KJ_EXPECT(root.asReader().getExtra().getItems()[0].getChild().getName() == "child");
+
+  root.setNote("note");
+  KJ_EXPECT(root.isNote());
+  KJ_EXPECT(root.asReader().getNote() == "note");
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -83,6 +83,10 @@ private:
 
 template <typename T>
 using WireValue = DirectWireValue<T>;
+
+#define CAPNP_WIRE_VALUES_ARE_NATIVE 1
+// Arrays of WireValue<T> have the same representation as arrays of T, so bulk copies can be done
+// with memcpy().
 // To prevent ODR problems when endian-test, endian-reverse-test, and endian-fallback-test are
 // linked together, we define each implementation with a different name and define an alias to the
 // one we want to use.
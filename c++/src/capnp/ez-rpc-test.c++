@@ -24,6 +24,7 @@
 #include "ez-rpc.h"
 #include "test-util.h"
 #include "kj/compat/gtest.h"
+#include <atomic>
 
 namespace capnp {
 namespace _ {
@@ -70,6 +71,44 @@ TEST(EzRpc, DeprecatedNames) {
       .getCallSequenceRequest().send().wait(server.getWaitScope()).getN());
 }
 
+TEST(EzRpc, MultiThreaded) {
+  constexpr uint THREADS = 4;
+  constexpr uint CLIENTS = 16;
+  int callCounts[THREADS] = {};
+  std::atomic<uint> workerCount(0);
+
+  {
+    EzRpcServer server([&]() -> Capability::Client {
+      return kj::heap<TestInterfaceImpl>(callCounts[workerCount++]);
+    }, "127.0.0.1", 0, THREADS);
+
+    uint port = server.getPort().wait(server.getWaitScope());
+    EXPECT_NE(0, port);
+
+    kj::Vector<kj::Own<EzRpcClient>> clients;
+    kj::Vector<RemotePromise<test::TestInterface::FooResults>> promises;
+    for (uint i = 0; i < CLIENTS; i++) {
+      clients.add(kj::heap<EzRpcClient>("127.0.0.1", port));
+      auto request = clients.back()->getMain<test::TestInterface>().fooRequest();
+      request.setI(123);
+      request.setJ(true);
+      promises.add(request.send());
+    }
+
+    for (auto& promise: promises) {
+      EXPECT_EQ("foo", promise.wait(server.getWaitScope()).getX());
+    }
+
+    EXPECT_ANY_THROW(server.exportCap("cap1", kj::heap<TestCallOrderImpl>()));
+  }
+
+  // The worker threads have been joined, so their counts are safe to read.
+  EXPECT_EQ(THREADS, workerCount);
+  int total = 0;
+  for (auto count: callCounts) total += count;
+  EXPECT_EQ(CLIENTS, total);
+}
+
 }  // namespace
 }  // namespace _
 }  // namespace capnp
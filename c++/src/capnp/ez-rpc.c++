@@ -250,8 +250,43 @@ struct EzRpcServer::Impl final: public SturdyRefRestorer<AnyPointer>,
           network(*this->stream, rpc::twoparty::Side::SERVER, readerOpts),
           rpcSystem(makeRpcServer(network, restorer)) {}
 #pragma GCC diagnostic pop
+
+    ServerContext(kj::Own<kj::AsyncIoStream>&& stream, Capability::Client bootstrapInterface,
+                  ReaderOptions readerOpts)
+        : stream(kj::mv(stream)),
+          network(*this->stream, rpc::twoparty::Side::SERVER, readerOpts),
+          rpcSystem(makeRpcServer(network, kj::mv(bootstrapInterface))) {}
+  };
+
+  class Worker final: public kj::TaskSet::ErrorHandler {
+    // One thread of a multi-threaded server. Lives on, and serves the connections accepted by,
+    // its own thread's event loop.
+
+  public:
+    Worker(Capability::Client mainInterface, ReaderOptions readerOpts)
+        : mainInterface(kj::mv(mainInterface)), readerOpts(readerOpts), tasks(*this) {}
+
+    kj::Promise<void> acceptLoop(kj::ConnectionReceiver& listener) {
+      return listener.accept().then([this, &listener](kj::Own<kj::AsyncIoStream>&& connection) {
+        auto server = kj::heap<ServerContext>(kj::mv(connection), mainInterface, readerOpts);
+        tasks.add(server->network.onDisconnect().attach(kj::mv(server)));
+        return acceptLoop(listener);
+      });
+    }
+
+    void taskFailed(kj::Exception&& exception) override {
+      KJ_LOG(ERROR, "EzRpcServer connection failed", exception);
+    }
+
+  private:
+    Capability::Client mainInterface;
+    ReaderOptions readerOpts;
+    kj::TaskSet tasks;
   };
 
+  kj::Maybe<kj::Own<kj::ShardedListener>> workers;
+  // Non-null if this is a multi-threaded server. Destroying it stops and joins the workers.
+
   Impl(Capability::Client mainInterface, kj::StringPtr bindAddress, uint defaultPort,
        ReaderOptions readerOpts)
       : mainInterface(kj::mv(mainInterface)),
@@ -288,6 +323,21 @@ struct EzRpcServer::Impl final: public SturdyRefRestorer<AnyPointer>,
                readerOpts);
   }
 
+  Impl(kj::ConstFunction<Capability::Client()> mainInterfaceFactory, kj::StringPtr bindAddress,
+       uint defaultPort, uint threadCount, ReaderOptions readerOpts)
+      : mainInterface(nullptr),
+        context(EzRpcContext::getThreadLocal()), portPromise(nullptr), tasks(*this) {
+    auto listener = kj::heap<kj::ShardedListener>(bindAddress, defaultPort, threadCount,
+        [factory = kj::mv(mainInterfaceFactory), readerOpts](
+            kj::AsyncIoContext& io, kj::ConnectionReceiver& receiver, uint shard) {
+      auto worker = kj::heap<Worker>(factory(), readerOpts);
+      auto promise = worker->acceptLoop(receiver);
+      return promise.attach(kj::mv(worker));
+    });
+    portPromise = kj::Promise<uint>(listener->getPort()).fork();
+    workers = kj::mv(listener);
+  }
+
   void acceptLoop(kj::Own<kj::ConnectionReceiver>&& listener, ReaderOptions readerOpts) {
     auto ptr = listener.get();
     tasks.add(ptr->accept().then(kj::mvCapture(kj::mv(listener),
@@ -335,6 +385,12 @@ EzRpcServer::EzRpcServer(Capability::Client mainInterface, int socketFd, uint po
                          ReaderOptions readerOpts)
     : impl(kj::heap<Impl>(kj::mv(mainInterface), socketFd, port, readerOpts)) {}
 
+EzRpcServer::EzRpcServer(kj::ConstFunction<Capability::Client()> mainInterfaceFactory,
+                         kj::StringPtr bindAddress, uint defaultPort, uint threadCount,
+                         ReaderOptions readerOpts)
+    : impl(kj::heap<Impl>(kj::mv(mainInterfaceFactory), bindAddress, defaultPort, threadCount,
+                          readerOpts)) {}
+
 EzRpcServer::EzRpcServer(kj::StringPtr bindAddress, uint defaultPort,
                          ReaderOptions readerOpts)
     : EzRpcServer(nullptr, bindAddress, defaultPort, readerOpts) {}
@@ -349,6 +405,8 @@ EzRpcServer::EzRpcServer(int socketFd, uint port, ReaderOptions readerOpts)
 EzRpcServer::~EzRpcServer() noexcept(false) {}
 
 void EzRpcServer::exportCap(kj::StringPtr name, Capability::Client cap) {
+  KJ_REQUIRE(impl->workers == nullptr,
+             "exportCap() is not supported by a multi-threaded EzRpcServer");
   Impl::ExportedCap entry(kj::heapString(name), cap);
   impl->exportMap[entry.name] = kj::mv(entry);
 }
@@ -23,6 +23,7 @@
 
 #include "rpc.h"
 #include "message.h"
+#include "kj/function.h"
 
 CAPNP_BEGIN_HEADER
 
@@ -193,6 +194,23 @@ public:
   // called).  `port` is returned by `getPort()` -- it serves no other purpose.
   // `readerOpts` acts as in the other two above constructors.
 
+  EzRpcServer(kj::ConstFunction<Capability::Client()> mainInterfaceFactory,
+              kj::StringPtr bindAddress, uint defaultPort, uint threadCount,
+              ReaderOptions readerOpts = ReaderOptions());
+  // Like the first constructor, but serves connections from `threadCount` worker threads, each
+  // running its own event loop, so that the server is not limited to a single core. Each worker
+  // listens on the same address (SO_REUSEPORT) and the kernel distributes incoming connections
+  // among them; see `kj::ShardedListener`.
+  //
+  // Capabilities belong to a single event loop, so rather than one main interface, this takes a
+  // factory that is called once on each worker thread to create that thread's main interface.
+  // The factory is called concurrently from all workers, so anything it shares between them
+  // must be thread-safe.
+  //
+  // Unlike the other constructors, this one does not return until the server is listening. The
+  // calling thread's event loop (`getWaitScope()` etc.) is not used to serve connections.
+  // `exportCap()` is not supported. Only available on systems supporting SO_REUSEPORT.
+
   explicit EzRpcServer(kj::StringPtr bindAddress, uint defaultPort = 0,
                        ReaderOptions readerOpts = ReaderOptions())
       CAPNP_DEPRECATED("Please specify a main interface for your server.");
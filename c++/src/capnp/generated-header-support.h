@@ -402,6 +402,11 @@ inline constexpr uint sizeInWords() {
 
 #endif  // CAPNP_LITE, else
 
+#define CAPNP_DECLARE_SCHEMA_INDEX(id) \
+    extern const ::capnp::_::RawSchemaIndex x_##id
+// Declares the index of all schemas defined by the file with the given ID.  Only defined when
+// !CAPNP_LITE.
+
 namespace capnp {
 namespace schemas {
 CAPNP_DECLARE_SCHEMA(995f9a3377c0b16e);
@@ -340,6 +340,56 @@ struct SegmentAnd {
   T value;
 };
 
+class CanonicalWordSink {
+  // Collects the words of a canonical message on their way to the caller's hash function. Runs
+  // of pointers and short data sections are batched; long data sections are passed straight
+  // through from the source message.
+
+public:
+  explicit CanonicalWordSink(kj::FunctionParam<void(kj::ArrayPtr<const word>)>& update)
+      : update(update) {}
+
+  uint64_t position() const { return flushed + used; }
+  // Number of words written so far, i.e. the offset of the next word in the canonical message.
+
+  byte* add() {
+    // Appends a zeroed word and returns it to be filled in.
+    if (used == BUFFER_WORDS) flush();
+    byte* result = reinterpret_cast<byte*>(buffer + used++);
+    memset(result, 0, sizeof(word));
+    return result;
+  }
+
+  void add(kj::ArrayPtr<const word> words) {
+    if (words.size() >= PASS_THROUGH_WORDS) {
+      flush();
+      update(words);
+      flushed += words.size();
+    } else {
+      if (used + words.size() > BUFFER_WORDS) flush();
+      memcpy(buffer + used, words.begin(), words.size() * sizeof(word));
+      used += words.size();
+    }
+  }
+
+  void flush() {
+    if (used > 0) {
+      update(kj::arrayPtr(buffer, used));
+      flushed += used;
+      used = 0;
+    }
+  }
+
+private:
+  static constexpr uint BUFFER_WORDS = 128;
+  static constexpr uint PASS_THROUGH_WORDS = 16;
+
+  kj::FunctionParam<void(kj::ArrayPtr<const word>)>& update;
+  word buffer[BUFFER_WORDS];
+  uint used = 0;
+  uint64_t flushed = 0;
+};
+
 }  // namespace
 
 struct WireHelpers {
@@ -765,8 +815,13 @@ struct WireHelpers {
   // -----------------------------------------------------------------
 
   static MessageSizeCounts totalSize(
-      SegmentReader* segment, const WirePointer* ref, int nestingLimit) {
+      SegmentReader* segment, const WirePointer* ref, int nestingLimit,
+      bool checkAmplification = false) {
     // Compute the total size of the object pointed to, not counting far pointer overhead.
+    //
+    // If `checkAmplification` is true, lists of zero-sized elements are also charged against the
+    // read limit, as readers would do, so that a successful traversal proves the whole message
+    // safe to read.
 
     MessageSizeCounts result = { ZERO * WORDS, 0 };
 
@@ -797,14 +852,20 @@ struct WireHelpers {
         const WirePointer* pointerSection =
             reinterpret_cast<const WirePointer*>(ptr + ref->structRef.dataSize.get());
         for (auto i: kj::zeroTo(ref->structRef.ptrCount.get())) {
-          result += totalSize(segment, pointerSection + i, nestingLimit);
+          result += totalSize(segment, pointerSection + i, nestingLimit, checkAmplification);
         }
         break;
       }
       case WirePointer::LIST: {
         switch (ref->listRef.elementSize()) {
           case ElementSize::VOID:
-            // Nothing.
+            if (checkAmplification) {
+              KJ_REQUIRE(amplifiedRead(segment,
+                             ref->listRef.elementCount() * (ONE * WORDS / ELEMENTS)),
+                         "Message contains amplified list pointer.") {
+                return result;
+              }
+            }
             break;
           case ElementSize::BIT:
           case ElementSize::BYTE:
@@ -833,7 +894,7 @@ struct WireHelpers {
 
             for (auto i: kj::zeroTo(count)) {
               result += totalSize(segment, reinterpret_cast<const WirePointer*>(ptr) + i,
-                                  nestingLimit);
+                                  nestingLimit, checkAmplification);
             }
             break;
           }
@@ -859,6 +920,14 @@ struct WireHelpers {
               return result;
             }
 
+            if (checkAmplification &&
+                elementTag->structRef.wordSize() / ELEMENTS * (ONE * ELEMENTS) == ZERO * WORDS) {
+              KJ_REQUIRE(amplifiedRead(segment, count * (ONE * WORDS / ELEMENTS)),
+                         "Message contains amplified list pointer.") {
+                return result;
+              }
+            }
+
             // We count the actual size rather than the claimed word count because that's what
             // we'll end up with if we make a copy.
             result.addWords(actualSize + POINTER_SIZE_IN_WORDS);
@@ -873,7 +942,7 @@ struct WireHelpers {
 
                 for (auto j KJ_UNUSED: kj::zeroTo(pointerCount)) {
                   result += totalSize(segment, reinterpret_cast<const WirePointer*>(pos),
-                                      nestingLimit);
+                                      nestingLimit, checkAmplification);
                   pos += POINTER_SIZE_IN_WORDS;
                 }
               }
@@ -900,6 +969,139 @@ struct WireHelpers {
     return result;
   }
 
+  // -----------------------------------------------------------------
+  // Reference objects in other messages
+
+  static KJ_ALWAYS_INLINE(void extendExtent(
+      const word* ptr, const word* ptrEnd, const word*& begin, const word*& end)) {
+    if (begin == nullptr || ptr < begin) begin = ptr;
+    if (end == nullptr || ptrEnd > end) end = ptrEnd;
+  }
+
+  static bool findExtent(SegmentReader* segment, const WirePointer* ref, int nestingLimit,
+                         const word*& begin, const word*& end) {
+    // Widen [begin, end) to cover the object `ref` points to and everything reachable from it.
+    // Returns false if any of that isn't in `segment` -- i.e. is reached through a far pointer --
+    // or is a capability, or if the nesting limit is exceeded or the object is out of bounds.
+
+    if (ref->isNull()) return true;
+    if (nestingLimit <= 0 || !ref->isPositional()) return false;
+    return findExtent(segment, ref, ref->target(segment), nestingLimit - 1, begin, end);
+  }
+
+  static bool findExtent(SegmentReader* segment, const WirePointer* tag, const word* ptr,
+                         int nestingLimit, const word*& begin, const word*& end) {
+    // Like the other overload, but splits the pointer into a tag and a target, so that objects
+    // not reached through a pointer can be checked.
+
+    switch (tag->kind()) {
+      case WirePointer::STRUCT: {
+        auto size = tag->structRef.wordSize();
+        if (!boundsCheck(segment, ptr, size)) return false;
+        extendExtent(ptr, ptr + size, begin, end);
+
+        const WirePointer* pointerSection =
+            reinterpret_cast<const WirePointer*>(ptr + tag->structRef.dataSize.get());
+        for (auto i: kj::zeroTo(tag->structRef.ptrCount.get())) {
+          if (!findExtent(segment, pointerSection + i, nestingLimit, begin, end)) return false;
+        }
+        return true;
+      }
+      case WirePointer::LIST:
+        switch (tag->listRef.elementSize()) {
+          case ElementSize::VOID:
+            if (!boundsCheck(segment, ptr, ZERO * WORDS)) return false;
+            extendExtent(ptr, ptr, begin, end);
+            return true;
+          case ElementSize::BIT:
+          case ElementSize::BYTE:
+          case ElementSize::TWO_BYTES:
+          case ElementSize::FOUR_BYTES:
+          case ElementSize::EIGHT_BYTES: {
+            auto totalWords = roundBitsUpToWords(
+                upgradeBound<uint64_t>(tag->listRef.elementCount()) *
+                dataBitsPerElement(tag->listRef.elementSize()));
+            if (!boundsCheck(segment, ptr, totalWords)) return false;
+            extendExtent(ptr, ptr + totalWords, begin, end);
+            return true;
+          }
+          case ElementSize::POINTER: {
+            auto count = tag->listRef.elementCount() * (POINTERS / ELEMENTS);
+            if (!boundsCheck(segment, ptr, count * WORDS_PER_POINTER)) return false;
+            extendExtent(ptr, ptr + count * WORDS_PER_POINTER, begin, end);
+
+            for (auto i: kj::zeroTo(count)) {
+              if (!findExtent(segment, reinterpret_cast<const WirePointer*>(ptr) + i,
+                              nestingLimit, begin, end)) {
+                return false;
+              }
+            }
+            return true;
+          }
+          case ElementSize::INLINE_COMPOSITE: {
+            auto wordCount = tag->listRef.inlineCompositeWordCount();
+            if (!boundsCheck(segment, ptr, wordCount + POINTER_SIZE_IN_WORDS)) return false;
+            extendExtent(ptr, ptr + wordCount + POINTER_SIZE_IN_WORDS, begin, end);
+
+            const WirePointer* elementTag = reinterpret_cast<const WirePointer*>(ptr);
+            auto count = elementTag->inlineCompositeListElementCount();
+            if (elementTag->kind() != WirePointer::STRUCT ||
+                elementTag->structRef.wordSize() / ELEMENTS * upgradeBound<uint64_t>(count) >
+                    wordCount) {
+              return false;
+            }
+
+            WordCount dataSize = elementTag->structRef.dataSize.get();
+            WirePointerCount pointerCount = elementTag->structRef.ptrCount.get();
+
+            if (pointerCount > ZERO * POINTERS) {
+              const word* pos = ptr + POINTER_SIZE_IN_WORDS;
+              for (auto i KJ_UNUSED: kj::zeroTo(count)) {
+                pos += dataSize;
+
+                for (auto j KJ_UNUSED: kj::zeroTo(pointerCount)) {
+                  if (!findExtent(segment, reinterpret_cast<const WirePointer*>(pos),
+                                  nestingLimit, begin, end)) {
+                    return false;
+                  }
+                  pos += POINTER_SIZE_IN_WORDS;
+                }
+              }
+            }
+            return true;
+          }
+        }
+        return false;
+      case WirePointer::FAR:
+      case WirePointer::OTHER:
+        return false;
+    }
+
+    return false;
+  }
+
+  static SegmentBuilder* referenceExternal(
+      BuilderArena* arena, SegmentReader* segment, const WirePointer* tag, const word* ptr,
+      int nestingLimit) {
+    // Add the part of `segment` spanned by the given object, and everything reachable from it, to
+    // `arena` as an external segment. Returns null if the object can't be referenced in place, in
+    // which case it should be copied instead.
+
+    if (segment == nullptr || segment->getArena() == arena) {
+      // Either a default value or an object already in this message.
+      return nullptr;
+    }
+
+    auto array = segment->getArray();
+    if (ptr < array.begin() || ptr >= array.end()) return nullptr;
+
+    const word* begin = nullptr;
+    const word* end = nullptr;
+    if (!findExtent(segment, tag, ptr, nestingLimit, begin, end)) return nullptr;
+
+    return arena->addExternalSegment(kj::arrayPtr(begin, end));
+  }
+
   // -----------------------------------------------------------------
   // Copy from an unchecked message.
 
@@ -996,6 +1198,12 @@ struct WireHelpers {
             KJ_ASSERT(srcTag->kind() == WirePointer::STRUCT,
                 "INLINE_COMPOSITE of lists is not yet supported.");
 
+            if (srcTag->structRef.ptrCount.get() == ZERO * POINTERS) {
+              // Pointer-free elements can be copied as one block.
+              copyMemory(dstElement, srcElement, src->listRef.inlineCompositeWordCount());
+              return dstPtr;
+            }
+
             for (auto i KJ_UNUSED: kj::zeroTo(srcTag->inlineCompositeListElementCount())) {
               copyStruct(segment, capTable, dstElement, srcElement,
                   srcTag->structRef.dataSize.get(), srcTag->structRef.ptrCount.get());
@@ -1903,6 +2111,12 @@ struct WireHelpers {
       word* dst = ptr + POINTER_SIZE_IN_WORDS;
 
       const word* src = reinterpret_cast<const word*>(value.ptr);
+      if (declPointerCount == ZERO * POINTERS && dataSize == declDataSize) {
+        // Nothing to relocate or truncate, so the elements can be copied as one block.
+        copyMemory(dst, src, totalSize);
+        return { segment, ptr };
+      }
+
       for (auto i KJ_UNUSED: kj::zeroTo(value.elementCount)) {
         copyMemory(dst, src, dataSize);
         dst += dataSize;
@@ -2085,6 +2299,412 @@ struct WireHelpers {
     KJ_UNREACHABLE;
   }
 
+  // -----------------------------------------------------------------
+  // Canonical hashing
+  //
+  // These produce the same words as a canonical copyPointer(), with the same validation, but
+  // hand them to a CanonicalWordSink as they are computed instead of allocating the copy. A
+  // pointer's offset depends on the canonical size of everything laid out ahead of its target,
+  // so each pointer section is written after a sizing pass over the objects it points to.
+
+  struct CanonicalObject {
+    // An object found by following a pointer, along with its size once truncated.
+
+    enum Kind { NONE, STRUCT, LIST };
+    Kind kind = NONE;
+    StructReader structValue;
+    ListReader listValue = ListReader(ElementSize::VOID);
+
+    uint dataBytes = 0;
+    // For STRUCT, the size of the truncated data section.
+
+    uint dataWords = 0;
+    uint ptrCount = 0;
+    // For STRUCT, and for each element of an INLINE_COMPOSITE LIST, the truncated section sizes.
+  };
+
+  static void measureCanonicalStruct(const StructReader& value, uint& dataBytes, uint& ptrCount) {
+    if (value.dataSize == ONE * BITS) {
+      // Handle the truncation case where it's a false in a 1-bit struct
+      dataBytes = value.getDataField<bool>(ZERO * ELEMENTS);
+    } else {
+      // StructReaders should not have bitwidths other than 1, but let's be safe
+      KJ_REQUIRE(value.dataSize % BITS_PER_BYTE == ZERO * BITS);
+
+      auto data = value.getDataSectionAsBlob();
+      auto end = data.end();
+      while (end > data.begin() && end[-1] == 0) --end;
+      dataBytes = end - data.begin();
+    }
+
+    const WirePointer* ptr = value.pointers + value.pointerCount;
+    while (ptr > value.pointers && ptr[-1].isNull()) --ptr;
+    ptrCount = ptr - value.pointers;
+  }
+
+  static CanonicalObject readCanonicalObject(
+      SegmentReader* segment, CapTableReader* capTable, const WirePointer* ref,
+      int nestingLimit, bool countRead) {
+    // Follows `ref`, checking it the way copyPointer() does. Sizing passes revisit the same
+    // objects, so unless `countRead` is set the words checked are given back to the read limiter.
+
+    CanonicalObject result;
+    if (ref->isNull()) return result;
+
+    const word* ptr;
+    KJ_IF_MAYBE(p, WireHelpers::followFars(ref, ref->target(segment), segment)) {
+      ptr = p;
+    } else {
+      return result;
+    }
+
+    switch (ref->kind()) {
+      case WirePointer::STRUCT: {
+        KJ_REQUIRE(nestingLimit > 0,
+              "Message is too deeply-nested or contains cycles.  See capnp::ReaderOptions.") {
+          return result;
+        }
+
+        KJ_REQUIRE(boundsCheck(segment, ptr, ref->structRef.wordSize()),
+                   "Message contained out-of-bounds struct pointer.") {
+          return result;
+        }
+        if (!countRead && segment != nullptr) segment->unread(ref->structRef.wordSize());
+
+        result.kind = CanonicalObject::STRUCT;
+        result.structValue = StructReader(segment, capTable, ptr,
+            reinterpret_cast<const WirePointer*>(ptr + ref->structRef.dataSize.get()),
+            ref->structRef.dataSize.get() * BITS_PER_WORD,
+            ref->structRef.ptrCount.get(),
+            nestingLimit - 1);
+        measureCanonicalStruct(result.structValue, result.dataBytes, result.ptrCount);
+        result.dataWords = (result.dataBytes + sizeof(word) - 1) / sizeof(word);
+        return result;
+      }
+
+      case WirePointer::LIST: {
+        ElementSize elementSize = ref->listRef.elementSize();
+
+        KJ_REQUIRE(nestingLimit > 0,
+              "Message is too deeply-nested or contains cycles.  See capnp::ReaderOptions.") {
+          return result;
+        }
+
+        if (elementSize == ElementSize::INLINE_COMPOSITE) {
+          auto wordCount = ref->listRef.inlineCompositeWordCount();
+          const WirePointer* tag = reinterpret_cast<const WirePointer*>(ptr);
+
+          KJ_REQUIRE(boundsCheck(segment, ptr, wordCount + POINTER_SIZE_IN_WORDS),
+                     "Message contains out-of-bounds list pointer.") {
+            return result;
+          }
+          if (!countRead && segment != nullptr) {
+            segment->unread(wordCount + POINTER_SIZE_IN_WORDS);
+          }
+
+          ptr += POINTER_SIZE_IN_WORDS;
+
+          KJ_REQUIRE(tag->kind() == WirePointer::STRUCT,
+                     "INLINE_COMPOSITE lists of non-STRUCT type are not supported.") {
+            return result;
+          }
+
+          auto elementCount = tag->inlineCompositeListElementCount();
+          auto wordsPerElement = tag->structRef.wordSize() / ELEMENTS;
+
+          KJ_REQUIRE(wordsPerElement * upgradeBound<uint64_t>(elementCount) <= wordCount,
+                     "INLINE_COMPOSITE list's elements overrun its word count.") {
+            return result;
+          }
+
+          if (countRead && wordsPerElement * (ONE * ELEMENTS) == ZERO * WORDS) {
+            // Watch out for lists of zero-sized structs, which can claim to be arbitrarily large
+            // without having sent actual data.
+            KJ_REQUIRE(amplifiedRead(segment, elementCount * (ONE * WORDS / ELEMENTS)),
+                       "Message contains amplified list pointer.") {
+              return result;
+            }
+          }
+
+          result.kind = CanonicalObject::LIST;
+          result.listValue = ListReader(segment, capTable, ptr,
+              elementCount, wordsPerElement * BITS_PER_WORD,
+              tag->structRef.dataSize.get() * BITS_PER_WORD,
+              tag->structRef.ptrCount.get(), ElementSize::INLINE_COMPOSITE,
+              nestingLimit - 1);
+
+          for (auto i: kj::zeroTo(elementCount)) {
+            uint dataBytes, ptrCount;
+            measureCanonicalStruct(result.listValue.getStructElement(i), dataBytes, ptrCount);
+            result.dataWords = kj::max(result.dataWords,
+                                       (dataBytes + sizeof(word) - 1) / sizeof(word));
+            result.ptrCount = kj::max(result.ptrCount, ptrCount);
+          }
+        } else {
+          auto dataSize = dataBitsPerElement(elementSize) * ELEMENTS;
+          auto pointerCount = pointersPerElement(elementSize) * ELEMENTS;
+          auto step = (dataSize + pointerCount * BITS_PER_POINTER) / ELEMENTS;
+          auto elementCount = ref->listRef.elementCount();
+          auto wordCount = roundBitsUpToWords(upgradeBound<uint64_t>(elementCount) * step);
+
+          KJ_REQUIRE(boundsCheck(segment, ptr, wordCount),
+                     "Message contains out-of-bounds list pointer.") {
+            return result;
+          }
+          if (!countRead && segment != nullptr) segment->unread(wordCount);
+
+          if (countRead && elementSize == ElementSize::VOID) {
+            // Watch out for lists of void, which can claim to be arbitrarily large without having
+            // sent actual data.
+            KJ_REQUIRE(amplifiedRead(segment, elementCount * (ONE * WORDS / ELEMENTS)),
+                       "Message contains amplified list pointer.") {
+              return result;
+            }
+          }
+
+          result.kind = CanonicalObject::LIST;
+          result.listValue = ListReader(segment, capTable, ptr, elementCount, step, dataSize,
+                                        pointerCount, elementSize, nestingLimit - 1);
+        }
+        return result;
+      }
+
+      case WirePointer::FAR:
+        KJ_FAIL_REQUIRE("Unexpected FAR pointer.") {
+          return result;
+        }
+
+      case WirePointer::OTHER:
+        KJ_REQUIRE(ref->isCapability(), "Unknown pointer type.") {
+          return result;
+        }
+        KJ_FAIL_REQUIRE("Cannot create a canonical message with a capability") {
+          return result;
+        }
+    }
+
+    KJ_UNREACHABLE;
+  }
+
+  static uint64_t canonicalSize(const CanonicalObject& object) {
+    // Returns the number of words `object` and everything it points to take up in canonical form.
+
+    switch (object.kind) {
+      case CanonicalObject::NONE:
+        return 0;
+
+      case CanonicalObject::STRUCT: {
+        auto& value = object.structValue;
+        uint64_t result = object.dataWords + object.ptrCount;
+        for (uint i = 0; i < object.ptrCount; i++) {
+          result += canonicalSize(readCanonicalObject(
+              value.segment, value.capTable, value.pointers + i, value.nestingLimit, false));
+        }
+        return result;
+      }
+
+      case CanonicalObject::LIST: {
+        auto& value = object.listValue;
+        uint64_t elementCount = unbound(value.elementCount / ELEMENTS);
+
+        switch (value.elementSize) {
+          case ElementSize::POINTER: {
+            uint64_t result = elementCount;
+            auto pointers = reinterpret_cast<const WirePointer*>(value.ptr);
+            for (uint64_t i = 0; i < elementCount; i++) {
+              result += canonicalSize(readCanonicalObject(
+                  value.segment, value.capTable, pointers + i, value.nestingLimit, false));
+            }
+            return result;
+          }
+
+          case ElementSize::INLINE_COMPOSITE: {
+            uint64_t result = unbound(POINTER_SIZE_IN_WORDS / WORDS) +
+                elementCount * (object.dataWords + object.ptrCount);
+            for (auto i: kj::zeroTo(value.elementCount)) {
+              auto element = value.getStructElement(i);
+              for (uint j = 0; j < object.ptrCount; j++) {
+                result += canonicalSize(readCanonicalObject(
+                    value.segment, value.capTable, element.pointers + j, value.nestingLimit,
+                    false));
+              }
+            }
+            return result;
+          }
+
+          default: {
+            uint64_t bits = unbound(upgradeBound<uint64_t>(value.elementCount) * value.step / BITS);
+            return (bits + 63) / 64;
+          }
+        }
+      }
+    }
+
+    KJ_UNREACHABLE;
+  }
+
+  static void writeCanonicalPointer(CanonicalWordSink& sink, const CanonicalObject& object,
+                                    uint64_t& nextTarget) {
+    // Writes a pointer to `object`, whose canonical form will be laid out starting at word
+    // `nextTarget`, then advances `nextTarget` past it.
+
+    WirePointer* ref = reinterpret_cast<WirePointer*>(sink.add());
+    uint32_t offset = nextTarget - sink.position();  // relative to the word after `ref`
+
+    switch (object.kind) {
+      case CanonicalObject::NONE:
+        return;
+
+      case CanonicalObject::STRUCT:
+        if (object.dataWords == 0 && object.ptrCount == 0) {
+          ref->setKindAndTargetForEmptyStruct();
+        } else {
+          ref->offsetAndKind.set((offset << 2) | WirePointer::STRUCT);
+        }
+        ref->structRef.set(assumeBits<STRUCT_DATA_WORD_COUNT_BITS>(object.dataWords) * WORDS,
+                           assumeBits<STRUCT_POINTER_COUNT_BITS>(object.ptrCount) * POINTERS);
+        break;
+
+      case CanonicalObject::LIST: {
+        auto& value = object.listValue;
+        ref->offsetAndKind.set((offset << 2) | WirePointer::LIST);
+        if (value.elementSize == ElementSize::INLINE_COMPOSITE) {
+          ref->listRef.setInlineComposite(assumeBits<SEGMENT_WORD_COUNT_BITS>(
+              unbound(value.elementCount / ELEMENTS) * (object.dataWords + object.ptrCount))
+              * WORDS);
+        } else {
+          ref->listRef.set(value.elementSize, value.elementCount);
+        }
+        break;
+      }
+    }
+
+    nextTarget += canonicalSize(object);
+  }
+
+  static void writeCanonicalPointers(CanonicalWordSink& sink, SegmentReader* segment,
+                                     CapTableReader* capTable, const WirePointer* pointers,
+                                     uint64_t count, int nestingLimit) {
+    // Writes a pointer section followed by the objects it points to.
+
+    uint64_t nextTarget = sink.position() + count;
+    for (uint64_t i = 0; i < count; i++) {
+      writeCanonicalPointer(sink,
+          readCanonicalObject(segment, capTable, pointers + i, nestingLimit, false), nextTarget);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+      writeCanonicalObject(sink,
+          readCanonicalObject(segment, capTable, pointers + i, nestingLimit, true));
+    }
+    KJ_DASSERT(sink.position() == nextTarget);
+  }
+
+  static void writeCanonicalBytes(CanonicalWordSink& sink, const byte* bytes, uint64_t size) {
+    // Writes `size` bytes, zero-padding the last word.
+    uint64_t wholeWords = size / sizeof(word);
+    sink.add(kj::arrayPtr(reinterpret_cast<const word*>(bytes), wholeWords));
+    if (size % sizeof(word) != 0) {
+      memcpy(sink.add(), bytes + wholeWords * sizeof(word), size % sizeof(word));
+    }
+  }
+
+  static void writeCanonicalObject(CanonicalWordSink& sink, const CanonicalObject& object) {
+    switch (object.kind) {
+      case CanonicalObject::NONE:
+        return;
+
+      case CanonicalObject::STRUCT: {
+        auto& value = object.structValue;
+        if (value.dataSize == ONE * BITS) {
+          if (object.dataBytes != 0) *sink.add() = 1;
+        } else {
+          writeCanonicalBytes(sink, reinterpret_cast<const byte*>(value.data), object.dataBytes);
+        }
+        writeCanonicalPointers(sink, value.segment, value.capTable, value.pointers,
+                               object.ptrCount, value.nestingLimit);
+        return;
+      }
+
+      case CanonicalObject::LIST: {
+        auto& value = object.listValue;
+        uint64_t elementCount = unbound(value.elementCount / ELEMENTS);
+
+        switch (value.elementSize) {
+          case ElementSize::POINTER:
+            writeCanonicalPointers(sink, value.segment, value.capTable,
+                                   reinterpret_cast<const WirePointer*>(value.ptr),
+                                   elementCount, value.nestingLimit);
+            return;
+
+          case ElementSize::INLINE_COMPOSITE: {
+            WirePointer* tag = reinterpret_cast<WirePointer*>(sink.add());
+            tag->setKindAndInlineCompositeListElementCount(WirePointer::STRUCT,
+                                                           value.elementCount);
+            tag->structRef.set(assumeBits<STRUCT_DATA_WORD_COUNT_BITS>(object.dataWords) * WORDS,
+                               assumeBits<STRUCT_POINTER_COUNT_BITS>(object.ptrCount) * POINTERS);
+
+            uint64_t nextTarget =
+                sink.position() + elementCount * (object.dataWords + object.ptrCount);
+            for (auto i: kj::zeroTo(value.elementCount)) {
+              auto element = value.getStructElement(i);
+              sink.add(kj::arrayPtr(reinterpret_cast<const word*>(element.data),
+                                    object.dataWords));
+              for (uint j = 0; j < object.ptrCount; j++) {
+                writeCanonicalPointer(sink, readCanonicalObject(
+                    value.segment, value.capTable, element.pointers + j, value.nestingLimit,
+                    false), nextTarget);
+              }
+            }
+            for (auto i: kj::zeroTo(value.elementCount)) {
+              auto element = value.getStructElement(i);
+              for (uint j = 0; j < object.ptrCount; j++) {
+                writeCanonicalObject(sink, readCanonicalObject(
+                    value.segment, value.capTable, element.pointers + j, value.nestingLimit,
+                    true));
+              }
+            }
+            KJ_DASSERT(sink.position() == nextTarget);
+            return;
+          }
+
+          default: {
+            // List of data. Bits past the last element are left zero.
+            uint64_t bits = unbound(upgradeBound<uint64_t>(value.elementCount) * value.step / BITS);
+            uint64_t wholeBytes = bits / 8;
+            uint leftoverBits = bits % 8;
+            if (leftoverBits == 0) {
+              writeCanonicalBytes(sink, value.ptr, wholeBytes);
+            } else {
+              writeCanonicalBytes(sink, value.ptr, wholeBytes - wholeBytes % sizeof(word));
+              byte* last = sink.add();
+              memcpy(last, value.ptr + wholeBytes - wholeBytes % sizeof(word),
+                     wholeBytes % sizeof(word));
+              last[wholeBytes % sizeof(word)] =
+                  value.ptr[wholeBytes] & ((1 << leftoverBits) - 1);
+            }
+            return;
+          }
+        }
+      }
+    }
+
+    KJ_UNREACHABLE;
+  }
+
+  static void writeCanonicalRoot(CanonicalWordSink& sink, const StructReader& value) {
+    CanonicalObject root;
+    root.kind = CanonicalObject::STRUCT;
+    root.structValue = value;
+    measureCanonicalStruct(value, root.dataBytes, root.ptrCount);
+    root.dataWords = (root.dataBytes + sizeof(word) - 1) / sizeof(word);
+
+    uint64_t nextTarget = unbound(POINTER_SIZE_IN_WORDS / WORDS);
+    writeCanonicalPointer(sink, root, nextTarget);
+    KJ_REQUIRE(nextTarget <= kj::maxValueForBits<SEGMENT_WORD_COUNT_BITS>(),
+               "Message is too large to canonicalize.");
+    writeCanonicalObject(sink, root);
+  }
+
   static void adopt(SegmentBuilder* segment, CapTableBuilder* capTable,
                     WirePointer* ref, OrphanBuilder&& value) {
     KJ_REQUIRE(value.segment == nullptr || value.segment->getArena() == segment->getArena(),
@@ -2731,6 +3351,12 @@ MessageSizeCounts PointerReader::targetSize() const {
                             : WireHelpers::totalSize(segment, pointer, nestingLimit);
 }
 
+void PointerReader::validateTarget() const {
+  if (pointer != nullptr) {
+    WireHelpers::totalSize(segment, pointer, nestingLimit, true);
+  }
+}
+
 PointerType PointerReader::getPointerType() const {
   if(pointer == nullptr || pointer->isNull()) {
     return PointerType::NULL_;
@@ -2973,6 +3599,12 @@ kj::Array<word> StructReader::canonicalize() {
   return trunc;
 }
 
+void StructReader::canonicalHash(kj::FunctionParam<void(kj::ArrayPtr<const word>)> update) {
+  CanonicalWordSink sink(update);
+  WireHelpers::writeCanonicalRoot(sink, *this);
+  sink.flush();
+}
+
 CapTableReader* StructReader::getCapTable() {
   return capTable;
 }
@@ -3150,6 +3782,25 @@ StructReader ListReader::getStructElement(ElementCount index) const {
       nestingLimit - 1);
 }
 
+const byte* ListReader::getDataColumn(uint offset, uint size, uint& stride) const {
+  KJ_DASSERT(size <= sizeof(zero.word));
+
+  KJ_REQUIRE(nestingLimit > 0,
+             "Message is too deeply-nested or contains cycles.  See capnp::ReaderOptions.") {
+    stride = 0;
+    return zero.word.bytes;
+  }
+
+  if (uint64_t(offset + size) * 8 > unbound(structDataSize / BITS)) {
+    stride = 0;
+    return zero.word.bytes;
+  }
+
+  KJ_DASSERT(unbound(step * ELEMENTS / BITS) % 8 == 0);
+  stride = unbound(step * ELEMENTS / BITS) / 8;
+  return ptr + offset;
+}
+
 MessageSizeCounts ListReader::totalSize() const {
   // TODO(cleanup): This is kind of a lot of logic duplicated from WireHelpers::totalSize(), but
   //   it's unclear how to share it effectively.
@@ -3522,6 +4173,63 @@ OrphanBuilder OrphanBuilder::concat(
   return result;
 }
 
+OrphanBuilder OrphanBuilder::referenceExternal(
+    BuilderArena* arena, CapTableBuilder* capTable, StructReader value) {
+  // Structs read as elements of lists of primitives don't have a word-sized data section, so they
+  // can't be referenced.
+  const word* location = reinterpret_cast<const word*>(value.data);
+  if (value.dataSize % BITS_PER_WORD == ZERO * BITS &&
+      location + value.dataSize / BITS_PER_WORD == reinterpret_cast<const word*>(value.pointers) &&
+      (value.dataSize > ZERO * BITS || value.pointerCount > ZERO * POINTERS)) {
+    OrphanBuilder result;
+    result.tagAsPtr()->setKindForOrphan(WirePointer::STRUCT);
+    result.tagAsPtr()->structRef.set(value.dataSize / BITS_PER_WORD, value.pointerCount);
+
+    KJ_IF_MAYBE(segment, WireHelpers::referenceExternal(
+        arena, value.segment, result.tagAsPtr(), location, value.nestingLimit)) {
+      result.segment = segment;
+      result.capTable = capTable;
+      // const_cast OK here because we will check whether the segment is writable when we try to
+      // get a builder.
+      result.location = const_cast<word*>(location);
+      return result;
+    }
+  }
+
+  return copy(arena, capTable, value);
+}
+
+OrphanBuilder OrphanBuilder::referenceExternal(
+    BuilderArena* arena, CapTableBuilder* capTable, ListReader value) {
+  if (value.ptr != nullptr) {
+    OrphanBuilder result;
+    result.tagAsPtr()->setKindForOrphan(WirePointer::LIST);
+
+    const word* location = reinterpret_cast<const word*>(value.ptr);
+    if (value.elementSize == ElementSize::INLINE_COMPOSITE) {
+      // Point at the list's tag, which precedes the elements.
+      location -= POINTER_SIZE_IN_WORDS;
+      result.tagAsPtr()->listRef.setInlineComposite(
+          assertMaxBits<LIST_ELEMENT_COUNT_BITS>(
+              WireHelpers::roundBitsUpToWords(
+                  upgradeBound<uint64_t>(value.elementCount) * value.step),
+              []() { KJ_FAIL_ASSERT("encountered impossibly long struct list ListReader"); }));
+    } else {
+      result.tagAsPtr()->listRef.set(value.elementSize, value.elementCount);
+    }
+
+    KJ_IF_MAYBE(segment, WireHelpers::referenceExternal(
+        arena, value.segment, result.tagAsPtr(), location, value.nestingLimit)) {
+      result.segment = segment;
+      result.capTable = capTable;
+      result.location = const_cast<word*>(location);
+      return result;
+    }
+  }
+
+  return copy(arena, capTable, value);
+}
+
 OrphanBuilder OrphanBuilder::referenceExternalData(BuilderArena* arena, Data::Reader data) {
   KJ_REQUIRE(reinterpret_cast<uintptr_t>(data.begin()) % sizeof(void*) == 0,
              "Cannot referenceExternalData() that is not aligned.");
@@ -30,6 +30,7 @@
 
 #include "kj/common.h"
 #include "kj/memory.h"
+#include "kj/function.h"
 #include "common.h"
 #include "blob.h"
 #include "endian.h"
@@ -424,6 +425,11 @@ public:
   static inline PointerReader getRootUnchecked(const word* location);
   // Get a PointerReader for an unchecked message.
 
+  void validateTarget() const;
+  // Walk the target object and everything to which it points, performing the checks that readers
+  // would perform along the way -- bounds, nesting, the traversal limit, and list amplification --
+  // and throw if any of them fails.
+
   MessageSizeCounts targetSize() const;
   // Return the total size of the target object and everything to which it points.  Does not count
   // far pointer overhead.  This is useful for deciding how much space is needed to copy the object
@@ -594,6 +600,9 @@ public:
   inline _::ListReader getPointerSectionAsList() const;
 
   kj::Array<word> canonicalize();
+  void canonicalHash(kj::FunctionParam<void(kj::ArrayPtr<const word>)> update);
+  // Passes the words of canonicalize()'s result to `update` in order, a run at a time, without
+  // allocating them.
 
   template <typename T>
   KJ_ALWAYS_INLINE(bool hasDataField(StructDataOffset offset) const);
@@ -669,6 +678,7 @@ private:
   friend class ListReader;
   friend class StructBuilder;
   friend struct WireHelpers;
+  friend class OrphanBuilder;
 };
 
 // -------------------------------------------------------------------
@@ -707,6 +717,12 @@ public:
   KJ_ALWAYS_INLINE(void setDataElement(ElementCount index, kj::NoInfer<T> value));
   // Set the element at the given index.
 
+  template <typename T>
+  KJ_ALWAYS_INLINE(WireValue<T>* getDataArray());
+  // If the elements are laid out back-to-back as values of type T, return a pointer to the first
+  // one, otherwise return null.  Data lists can be read as upgraded struct lists, in which case
+  // consecutive elements are further apart than sizeof(T).  Always null for bool and Void.
+
   KJ_ALWAYS_INLINE(PointerBuilder getPointerElement(ElementCount index));
 
   StructBuilder getStructElement(ElementCount index);
@@ -779,6 +795,17 @@ public:
   KJ_ALWAYS_INLINE(T getDataElement(ElementCount index) const);
   // Get the element of the given type at the given index.
 
+  template <typename T>
+  KJ_ALWAYS_INLINE(const WireValue<T>* getDataArray() const);
+  // Like ListBuilder::getDataArray().
+
+  const byte* getDataColumn(uint offset, uint size, uint& stride) const;
+  // Treating this as a list of structs, locate the `size`-byte data field at byte `offset` of
+  // each element.  Returns the field's location in the first element and sets `stride` to the
+  // distance in bytes between consecutive elements.  If the elements' data sections are too
+  // short to contain the field, it is zero everywhere, so instead returns a pointer to zeros and
+  // sets `stride` to zero.
+
   KJ_ALWAYS_INLINE(PointerReader getPointerElement(ElementCount index) const);
 
   StructReader getStructElement(ElementCount index) const;
@@ -872,6 +899,10 @@ public:
                               ElementSize expectedElementSize, StructSize expectedStructSize,
                               kj::ArrayPtr<const ListReader> lists);
 
+  static OrphanBuilder referenceExternal(BuilderArena* arena, CapTableBuilder* capTable,
+                                         StructReader value);
+  static OrphanBuilder referenceExternal(BuilderArena* arena, CapTableBuilder* capTable,
+                                         ListReader value);
   static OrphanBuilder referenceExternalData(BuilderArena* arena, Data::Reader data);
 
   OrphanBuilder& operator=(const OrphanBuilder& other) = delete;
@@ -1197,6 +1228,17 @@ inline void ListBuilder::setDataElement<bool>(ElementCount index, bool value) {
 template <>
 inline void ListBuilder::setDataElement<Void>(ElementCount index, Void value) {}
 
+template <typename T>
+inline WireValue<T>* ListBuilder::getDataArray() {
+  return unbound(step * ELEMENTS / BITS) == sizeof(T) * 8
+      ? reinterpret_cast<WireValue<T>*>(ptr) : nullptr;
+}
+
+template <>
+inline WireValue<bool>* ListBuilder::getDataArray<bool>() { return nullptr; }
+template <>
+inline WireValue<Void>* ListBuilder::getDataArray<Void>() { return nullptr; }
+
 inline PointerBuilder ListBuilder::getPointerElement(ElementCount index) {
   return PointerBuilder(segment, capTable, reinterpret_cast<WirePointer*>(ptr +
       upgradeBound<uint64_t>(index) * step / BITS_PER_BYTE));
@@ -1226,6 +1268,17 @@ inline Void ListReader::getDataElement<Void>(ElementCount index) const {
   return VOID;
 }
 
+template <typename T>
+inline const WireValue<T>* ListReader::getDataArray() const {
+  return unbound(step * ELEMENTS / BITS) == sizeof(T) * 8
+      ? reinterpret_cast<const WireValue<T>*>(ptr) : nullptr;
+}
+
+template <>
+inline const WireValue<bool>* ListReader::getDataArray<bool>() const { return nullptr; }
+template <>
+inline const WireValue<Void>* ListReader::getDataArray<Void>() const { return nullptr; }
+
 inline PointerReader ListReader::getPointerElement(ElementCount index) const {
   return PointerReader(segment, capTable, reinterpret_cast<const WirePointer*>(
       ptr + upgradeBound<uint64_t>(index) * step / BITS_PER_BYTE), nestingLimit);
@@ -124,6 +124,43 @@ struct List<T, Kind::PRIMITIVE> {
       return reader.totalSize().asPublic();
     }
 
+    kj::Maybe<kj::ArrayPtr<const T>> asArrayPtr() const {
+      // Returns the list content as an array pointing directly into the message, if the host's
+      // representation of T matches the wire encoding.  This is the case on little-endian
+      // machines, except when the list was written as a struct list and we are reading it as a
+      // primitive list.  Use copyTo() for a version that always works.
+
+#if CAPNP_WIRE_VALUES_ARE_NATIVE
+      auto array = reader.template getDataArray<T>();
+      if (array != nullptr) {
+        return kj::arrayPtr(reinterpret_cast<const T*>(array), size());
+      }
+#endif
+      return nullptr;
+    }
+
+    void copyTo(kj::ArrayPtr<T> out) const {
+      // Copy the whole list into `out`, which must have the same size as the list.  Much faster
+      // than copying element-by-element.
+
+      KJ_IREQUIRE(out.size() == size());
+      auto array = reader.template getDataArray<T>();
+      if (array == nullptr) {
+        for (uint i = 0; i < out.size(); i++) {
+          out[i] = reader.template getDataElement<T>(bounded(i) * ELEMENTS);
+        }
+      } else {
+#if CAPNP_WIRE_VALUES_ARE_NATIVE
+        if (out.size() > 0) memcpy(out.begin(), array, out.size() * sizeof(T));
+#else
+        // Tight loop which the compiler can turn into vectorized byte swaps.
+        for (uint i = 0; i < out.size(); i++) {
+          out[i] = array[i].get();
+        }
+#endif
+      }
+    }
+
   private:
     _::ListReader reader;
     template <typename U, Kind K>
@@ -161,6 +198,32 @@ struct List<T, Kind::PRIMITIVE> {
       builder.template setDataElement<T>(bounded(index) * ELEMENTS, value);
     }
 
+    void setFrom(kj::ArrayPtr<const T> values) {
+      // Overwrite the whole list with `values`, which must have the same size as the list.  Much
+      // faster than calling set() for each element.
+
+      KJ_IREQUIRE(values.size() == size());
+      auto array = builder.template getDataArray<T>();
+#if CAPNP_CANONICALIZE_NAN
+      // Floats must go through setDataElement() so that NaNs are canonicalized.
+      if (kj::isSameType<T, float>() || kj::isSameType<T, double>()) array = nullptr;
+#endif
+      if (array == nullptr) {
+        for (uint i = 0; i < values.size(); i++) {
+          builder.template setDataElement<T>(bounded(i) * ELEMENTS, values[i]);
+        }
+      } else {
+#if CAPNP_WIRE_VALUES_ARE_NATIVE
+        if (values.size() > 0) memcpy(array, values.begin(), values.size() * sizeof(T));
+#else
+        // Tight loop which the compiler can turn into vectorized byte swaps.
+        for (uint i = 0; i < values.size(); i++) {
+          array[i].set(values[i]);
+        }
+#endif
+      }
+    }
+
     typedef _::IndexingIterator<Builder, T> Iterator;
     inline Iterator begin() { return Iterator(this, 0); }
     inline Iterator end() { return Iterator(this, size()); }
@@ -197,6 +260,45 @@ private:
 template <typename T>
 struct List<T, Kind::ENUM>: public List<T, Kind::PRIMITIVE> {};
 
+template <typename T>
+class ColumnReader {
+  // One primitive field of every element of a List(Struct), as returned by the `Columns` class
+  // generated for structs annotated with `$Cxx.columns`.  The list's struct layout is checked
+  // once, when the column is created, so reading an element is a single strided load with no
+  // bounds check or default-value branch, which allows compilers to vectorize loops over it.
+
+public:
+  inline ColumnReader(): ptr(nullptr), stride(0), count(0), mask(0) {}
+
+  template <typename StructListReader>
+  inline ColumnReader(const StructListReader& list, StructDataOffset offset,
+                      _::Mask<T> mask = 0)
+      : ColumnReader(list.reader, offset, mask) {}
+  // Used by generated code.  `offset` and `mask` are as for StructReader::getDataField().
+
+  inline uint size() const { return count; }
+  inline T operator[](uint index) const {
+    KJ_IREQUIRE(index < count);
+    return _::unmask<T>(reinterpret_cast<const _::WireValue<_::Mask<T>>*>(
+        ptr + size_t(index) * stride)->get(), mask);
+  }
+
+  typedef _::IndexingIterator<const ColumnReader, T> Iterator;
+  inline Iterator begin() const { return Iterator(this, 0); }
+  inline Iterator end() const { return Iterator(this, size()); }
+
+private:
+  const byte* ptr;
+  uint stride;
+  uint count;
+  _::Mask<T> mask;
+
+  inline ColumnReader(const _::ListReader& list, StructDataOffset offset, _::Mask<T> mask)
+      : count(unbound(list.size() / ELEMENTS)), mask(mask) {
+    ptr = list.getDataColumn(unbound(offset / ELEMENTS) * sizeof(T), sizeof(T), stride);
+  }
+};
+
 template <typename T>
 struct List<T, Kind::STRUCT> {
   // List of structs.
@@ -231,6 +333,8 @@ struct List<T, Kind::STRUCT> {
     template <typename U, Kind K>
     friend struct List;
     friend class Orphanage;
+    template <typename U>
+    friend class ColumnReader;
     template <typename U, Kind K>
     friend struct ToDynamic_;
   };
@@ -377,6 +377,64 @@ KJ_TEST("call remote promise pointing into membrane that eventually resolves to
   }, "outside", "outside", "outside", "outbound");
 }
 
+class PassThroughPolicy final: public MembranePolicy, public kj::Refcounted {
+public:
+  kj::Maybe<Capability::Client> inboundCall(uint64_t interfaceId, uint16_t methodId,
+                                            Capability::Client target) override {
+    KJ_FAIL_ASSERT("inboundCall() shouldn't be called");
+  }
+
+  kj::Maybe<Capability::Client> outboundCall(uint64_t interfaceId, uint16_t methodId,
+                                             Capability::Client target) override {
+    KJ_FAIL_ASSERT("outboundCall() shouldn't be called");
+  }
+
+  bool interceptsCalls() override { return false; }
+
+  kj::Own<MembranePolicy> addRef() override {
+    return kj::addRef(*this);
+  }
+
+  Capability::Client importExternal(Capability::Client external) override {
+    ++imports;
+    return MembranePolicy::importExternal(kj::mv(external));
+  }
+
+  Capability::Client exportInternal(Capability::Client internal) override {
+    ++exports;
+    return MembranePolicy::exportInternal(kj::mv(internal));
+  }
+
+  uint imports = 0;
+  uint exports = 0;
+};
+
+KJ_TEST("membrane that doesn't intercept calls") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto policy = kj::refcounted<PassThroughPolicy>();
+  test::TestMembrane::Client membraned(membrane(kj::heap<TestMembraneImpl>(), policy->addRef()));
+
+  // Calls go straight through, but capabilities are still wrapped.
+  uint exports = policy->exports;
+  auto thing = membraned.makeThingRequest().send().wait(waitScope).getThing();
+  KJ_EXPECT(policy->exports > exports);
+  KJ_EXPECT(thing.interceptRequest().send().wait(waitScope).getText() == "inside");
+
+  auto req = membraned.callInterceptRequest();
+  req.setThing(kj::heap<ThingImpl>("outside"));
+  KJ_EXPECT(req.send().wait(waitScope).getText() == "outside");
+  KJ_EXPECT(policy->imports == 1);
+
+  // A wrapped capability passing back in is unwrapped rather than wrapped again.
+  auto loopback = membraned.loopbackRequest();
+  loopback.setThing(thing);
+  auto response = loopback.send().wait(waitScope).getThing()
+      .passThroughRequest().send().wait(waitScope);
+  KJ_EXPECT(response.getText() == "inside");
+  KJ_EXPECT(policy->imports == 1);
+}
+
 KJ_TEST("revoke membrane") {
   auto paf = kj::newPromiseAndFulfiller<void>();
 
@@ -235,6 +235,10 @@ public:
     return MEMBRANE_BRAND;
   }
 
+  void setDeadline(kj::TimePoint deadline) override {
+    inner->setDeadline(deadline);
+  }
+
 private:
   kj::Own<RequestHook> inner;
   kj::Own<MembranePolicy> policy;
@@ -311,6 +315,10 @@ public:
     return kj::addRef(*this);
   }
 
+  kj::Maybe<kj::TimePoint> getDeadline() override {
+    return inner->getDeadline();
+  }
+
 private:
   kj::Own<CallContextHook> inner;
   kj::Own<MembranePolicy> policy;
@@ -381,10 +389,7 @@ public:
       return r->get()->newCall(interfaceId, methodId, sizeHint);
     }
 
-    auto redirect = reverse
-        ? policy->outboundCall(interfaceId, methodId, Capability::Client(inner->addRef()))
-        : policy->inboundCall(interfaceId, methodId, Capability::Client(inner->addRef()));
-    KJ_IF_MAYBE(r, redirect) {
+    KJ_IF_MAYBE(r, getRedirect(interfaceId, methodId)) {
       if (policy->shouldResolveBeforeRedirecting()) {
         // The policy says that *if* this capability points into the membrane, then we want to
         // redirect the call. However, if this capability is a promise, then it could resolve to
@@ -411,10 +416,7 @@ public:
       return r->get()->call(interfaceId, methodId, kj::mv(context));
     }
 
-    auto redirect = reverse
-        ? policy->outboundCall(interfaceId, methodId, Capability::Client(inner->addRef()))
-        : policy->inboundCall(interfaceId, methodId, Capability::Client(inner->addRef()));
-    KJ_IF_MAYBE(r, redirect) {
+    KJ_IF_MAYBE(r, getRedirect(interfaceId, methodId)) {
       if (policy->shouldResolveBeforeRedirecting()) {
         // The policy says that *if* this capability points into the membrane, then we want to
         // redirect the call. However, if this capability is a promise, then it could resolve to
@@ -505,6 +507,17 @@ private:
   kj::Own<MembranePolicy> policy;
   bool reverse;
   kj::Maybe<kj::Own<ClientHook>> resolved;
+
+  kj::Maybe<Capability::Client> getRedirect(uint64_t interfaceId, uint16_t methodId) {
+    if (!policy->interceptsCalls()) {
+      return nullptr;
+    }
+
+    return reverse
+        ? policy->outboundCall(interfaceId, methodId, Capability::Client(inner->addRef()))
+        : policy->inboundCall(interfaceId, methodId, Capability::Client(inner->addRef()));
+  }
+
   kj::Promise<void> revocationTask = nullptr;
 };
 
@@ -132,6 +132,15 @@ public:
   //   better design here. Maybe we should more carefully distinguish between MembranePolicies
   //   which are reversible vs. those which are one-way?
 
+  virtual bool interceptsCalls() { return true; }
+  // If this returns false, the membrane assumes that inboundCall() and outboundCall() would always
+  // return null, and never calls them. Every call then passes straight through -- its
+  // capabilities are still wrapped, of course -- without querying the policy first.
+  //
+  // Membranes that only exist to wrap capabilities or to revoke them should override this to
+  // return false. Consulting the policy on every call is a significant part of the cost of a
+  // call through such a membrane.
+
   // ---------------------------------------------------------------------------
   // Control over importing and exporting.
   //
@@ -23,7 +23,9 @@
 #include "test-util.h"
 #include "kj/array.h"
 #include "kj/vector.h"
+#include "kj/arena.h"
 #include "kj/debug.h"
+#include "kj/thread.h"
 #include "kj/compat/gtest.h"
 
 namespace capnp {
@@ -48,6 +50,53 @@ TEST(Message, MallocBuilderWithFirstSegment) {
   EXPECT_EQ(16u, segment.size());
 }
 
+TEST(Message, PooledBuilder) {
+  MessageSegmentPool pool(2048, 1);
+
+  const word* firstSegment;
+  {
+    PooledMessageBuilder builder(pool);
+    initTestMessage(builder.getRoot<TestAllTypes>());
+    auto segs = builder.getSegmentsForOutput();
+    ASSERT_EQ(1, segs.size());
+    firstSegment = segs[0].begin();
+  }
+
+  {
+    // The segment is reused, and was zeroed in between.
+    PooledMessageBuilder builder(pool, 16);
+    auto segment = builder.allocateSegment(1);
+    EXPECT_EQ(firstSegment, segment.begin());
+    EXPECT_EQ(2048u, segment.size());
+    for (auto& w: segment.asBytes()) {
+      if (w != 0) {
+        KJ_FAIL_EXPECT("pooled segment was not zeroed");
+        break;
+      }
+    }
+
+    // Meanwhile, a second builder gets a fresh segment.
+    PooledMessageBuilder builder2(pool);
+    initTestMessage(builder2.getRoot<TestAllTypes>());
+    EXPECT_NE(firstSegment, builder2.getSegmentsForOutput()[0].begin());
+    checkTestMessage(builder2.getRoot<TestAllTypes>());
+  }
+
+  {
+    // Oversized first segments are allocated but not pooled.
+    PooledMessageBuilder builder(pool, 4096);
+    auto segment = builder.allocateSegment(1);
+    EXPECT_NE(firstSegment, segment.begin());
+    EXPECT_EQ(4096u, segment.size());
+  }
+
+  {
+    PooledMessageBuilder builder(pool);
+    initTestMessage(builder.getRoot<TestAllTypes>());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+  }
+}
+
 class TestInitMessageBuilder: public MessageBuilder {
 public:
   TestInitMessageBuilder(kj::ArrayPtr<SegmentInit> segments): MessageBuilder(segments) {}
@@ -176,6 +225,270 @@ KJ_TEST("clone()") {
   checkTestMessage(*copy);
 }
 
+KJ_TEST("validateAndTrust()") {
+  MallocMessageBuilder builder(4, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(builder.getRoot<TestAllTypes>());
+  auto segments = builder.getSegmentsForOutput();
+  KJ_ASSERT(segments.size() > 1);
+
+  // Enough to validate the message, but not to read it over and over.
+  ReaderOptions options;
+  options.traversalLimitInWords =
+      builder.getRoot<TestAllTypes>().asReader().totalSize().wordCount * 2;
+
+  auto readRepeatedly = [](MessageReader& reader) {
+    for (auto i KJ_UNUSED: kj::zeroTo(10)) {
+      checkTestMessage(reader.getRoot<TestAllTypes>());
+    }
+  };
+
+  {
+    SegmentArrayMessageReader reader(segments, options);
+    KJ_EXPECT_THROW_RECOVERABLE_MESSAGE("traversal limit", readRepeatedly(reader));
+  }
+
+  {
+    SegmentArrayMessageReader reader(segments, options);
+    reader.validateAndTrust();
+    readRepeatedly(reader);
+  }
+
+  {
+    // Validation itself is subject to the limit.
+    options.traversalLimitInWords = 16;
+    SegmentArrayMessageReader reader(segments, options);
+    KJ_EXPECT_THROW_RECOVERABLE_MESSAGE("traversal limit", reader.validateAndTrust());
+  }
+
+  {
+    SegmentArrayMessageReader reader(segments);
+    reader.trustWithoutValidation();
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+KJ_TEST("validateAndTrust() rejects malformed messages") {
+  {
+    AlignedData<2> data = {{
+      // Struct ref pointing past the end of the segment: offset = 1000, dataSize = 1
+      0xa0, 0x0f, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    }};
+
+    kj::ArrayPtr<const word> segments[1] = {kj::arrayPtr(data.words, 2)};
+    SegmentArrayMessageReader reader(segments);
+    KJ_EXPECT_THROW_RECOVERABLE_MESSAGE("out-of-bounds", reader.validateAndTrust());
+  }
+
+  {
+    AlignedData<1> data = {{
+      // List ref of VOID, elementCount = 2^29 - 1: costs nothing to send but a lot to iterate.
+      0x01, 0x00, 0x00, 0x00, 0xf8, 0xff, 0xff, 0xff
+    }};
+
+    kj::ArrayPtr<const word> segments[1] = {kj::arrayPtr(data.words, 1)};
+    SegmentArrayMessageReader reader(segments);
+    KJ_EXPECT_THROW_RECOVERABLE_MESSAGE("traversal limit", reader.validateAndTrust());
+  }
+}
+
+KJ_TEST("MallocMessageBuilder::compact()") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+  for (auto i: kj::zeroTo(100)) {
+    root.setTextField(kj::str("overwritten many times ", i));
+  }
+  root.disownStructField();
+  root.setTextField("foo");
+  root.initStructField().setInt32Field(123);
+
+  size_t compactSize = builder.compactSizeInWords();
+  KJ_EXPECT(compactSize < builder.sizeInWords());
+
+  builder.compact();
+  KJ_EXPECT(builder.sizeInWords() == compactSize);
+  KJ_EXPECT(builder.getSegmentsForOutput().size() == 1);
+  KJ_EXPECT(builder.compactSizeInWords() == compactSize);
+
+  root = builder.getRoot<TestAllTypes>();
+  KJ_EXPECT(root.asReader().getTextField() == "foo");
+  KJ_EXPECT(root.getStructField().getInt32Field() == 123);
+  KJ_EXPECT(root.getInt64Field() == -123456789012345ll);
+  KJ_EXPECT(root.getStructList().size() == 3);
+
+  // The builder remains usable.
+  root.setDataField(data("bar"));
+  KJ_EXPECT(root.asReader().getDataField() == data("bar"));
+
+  // Also with a caller-provided first segment, which the compacted message no longer uses.
+  word scratch[1024];
+  memset(scratch, 0, sizeof(scratch));
+  {
+    MallocMessageBuilder builder2(kj::arrayPtr(scratch, 1024));
+    builder2.setRoot(builder.getRoot<TestAllTypes>().asReader());
+    builder2.getRoot<TestAllTypes>().setTextField("baz");
+    builder2.compact();
+    KJ_EXPECT(builder2.getSegmentsForOutput()[0].begin() != scratch);
+    KJ_EXPECT(builder2.getRoot<TestAllTypes>().asReader().getTextField() == "baz");
+  }
+  for (auto& w: scratch) {
+    KJ_ASSERT(*reinterpret_cast<uint64_t*>(&w) == 0);
+  }
+}
+
+class CountingSegmentAllocator final: public SegmentAllocator {
+public:
+  kj::ArrayPtr<word> allocateSegment(uint minimumWords) override {
+    ++allocated;
+    // Return more than asked, which the builder should make use of.
+    return inner.allocateSegment(minimumWords + 16);
+  }
+  void freeSegment(kj::ArrayPtr<word> segment) override {
+    ++freed;
+    inner.freeSegment(segment);
+  }
+
+  HugePageSegmentAllocator inner;
+  uint allocated = 0;
+  uint freed = 0;
+};
+
+KJ_TEST("MallocMessageBuilder with SegmentAllocator") {
+  CountingSegmentAllocator allocator;
+  {
+    MallocMessageBuilder builder(allocator, 64, AllocationStrategy::FIXED_SIZE);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+
+    auto segments = builder.getSegmentsForOutput();
+    KJ_EXPECT(segments.size() > 1);
+    KJ_EXPECT(allocator.allocated == segments.size());
+    KJ_EXPECT(allocator.freed == 0);
+
+    builder.compact();
+    KJ_EXPECT(allocator.freed == segments.size());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+  }
+  KJ_EXPECT(allocator.freed == allocator.allocated);
+
+  kj::Arena arena;
+  ArenaSegmentAllocator arenaAllocator(arena);
+  for (auto i KJ_UNUSED: kj::zeroTo(3)) {
+    MallocMessageBuilder builder(arenaAllocator, 64);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+  }
+}
+
+KJ_TEST("HugePageSegmentAllocator") {
+  HugePageSegmentAllocator allocator;
+
+  {
+    // Small segments come from calloc().
+    MallocMessageBuilder builder(allocator);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+  }
+
+  {
+    MallocMessageBuilder builder(allocator, 300000);
+    auto data = builder.initRoot<TestAllTypes>().initDataField(3u << 20);
+    for (auto i: kj::indices(data)) data[i] = i * 7;
+
+    auto segments = builder.getSegmentsForOutput();
+    KJ_EXPECT(segments.size() == 1);
+    auto reader = builder.getRoot<TestAllTypes>().asReader().getDataField();
+    for (auto i: kj::indices(reader)) {
+      if (reader[i] != byte(i * 7)) {
+        KJ_FAIL_EXPECT("wrong data", i);
+        break;
+      }
+    }
+
+#if !_WIN32
+    // The segment was mapped directly, aligned to a huge page.
+    KJ_EXPECT(reinterpret_cast<uintptr_t>(segments[0].begin()) % (2u << 20) == 0);
+#endif
+  }
+}
+
+KJ_TEST("FirstSegmentSizer") {
+  FirstSegmentSizer sizer(1024);
+  KJ_EXPECT(sizer.suggest() == 1024);
+
+  // 19 in 20 messages are small; the rest are big.
+  for (auto i: kj::zeroTo(200)) {
+    sizer.record(i % 20 == 0 ? 100000 : 3000 + i);
+  }
+  uint suggestion = sizer.suggest();
+  KJ_EXPECT(suggestion >= 3200 && suggestion <= 3200 * 5 / 4, suggestion);
+
+  // Sizes it learned to fit do fit in one segment.
+  MallocMessageBuilder builder(suggestion);
+  builder.initRoot<TestAllTypes>().initDataField(3199 * sizeof(word) - 100);
+  KJ_EXPECT(builder.getSegmentsForOutput().size() == 1);
+
+  // Traffic changes; old sizes are forgotten.
+  for (auto i KJ_UNUSED: kj::zeroTo(5000)) {
+    sizer.record(50);
+  }
+  KJ_EXPECT(sizer.suggest() >= 50 && sizer.suggest() < 64, sizer.suggest());
+
+  for (auto i KJ_UNUSED: kj::zeroTo(5000)) {
+    sizer.record(1);
+  }
+  KJ_EXPECT(sizer.suggest() >= 16 && sizer.suggest() < 20, sizer.suggest());
+}
+
+KJ_TEST("threadSafeTraversalLimit") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.getRoot<TestAllTypes>());
+  auto segments = builder.getSegmentsForOutput();
+
+  ReaderOptions options;
+  options.threadSafeTraversalLimit = true;
+  options.traversalLimitInWords =
+      builder.getRoot<TestAllTypes>().asReader().totalSize().wordCount * 40;
+
+  auto readUntilLimit = [](MessageReader& reader) {
+    uint count = 0;
+    for (;;) {
+      KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() {
+        checkTestMessage(reader.getRoot<TestAllTypes>());
+      })) {
+        KJ_EXPECT(e->getDescription().startsWith("Exceeded message traversal limit"), *e);
+        return count;
+      }
+      ++count;
+    }
+  };
+
+  uint singleThreaded;
+  {
+    SegmentArrayMessageReader reader(segments, options);
+    singleThreaded = readUntilLimit(reader);
+  }
+  KJ_EXPECT(singleThreaded > 0);
+
+  uint counts[4];
+  {
+    SegmentArrayMessageReader reader(segments, options);
+    reader.getRoot<TestAllTypes>();
+
+    kj::Vector<kj::Own<kj::Thread>> threads;
+    for (auto& count: counts) {
+      threads.add(kj::heap<kj::Thread>([&]() { count = readUntilLimit(reader); }));
+    }
+  }
+
+  // No update to the counter was lost, so all threads together can't complete more reads than
+  // one thread alone.
+  uint total = 0;
+  for (auto count: counts) total += count;
+  KJ_EXPECT(total <= singleThreaded, total, singleThreaded);
+}
+
 #if !CAPNP_ALLOW_UNALIGNED
 KJ_TEST("disallow unaligned") {
   union {
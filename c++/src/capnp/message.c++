@@ -24,9 +24,14 @@
 #include "kj/debug.h"
 #include "arena.h"
 #include "orphan.h"
+#include "kj/arena.h"
 #include <stdlib.h>
 #include <errno.h>
 
+#if !_WIN32
+#include <sys/mman.h>
+#endif
+
 namespace capnp {
 
 namespace {
@@ -83,9 +88,44 @@ bool MessageReader::isCanonical() {
 }
 
 size_t MessageReader::sizeInWords() {
+  if (!allocatedArena) {
+    kj::ctor(*arena(), this);
+    allocatedArena = true;
+  }
   return arena()->sizeInWords();
 }
 
+namespace {
+
+class ValidationFailureDetector final: public kj::ExceptionCallback {
+  // Notes recoverable failures during validation, which may not throw if exceptions are disabled,
+  // so that we don't go on to trust a message that failed.
+
+public:
+  bool failed = false;
+
+  void onRecoverableException(kj::Exception&& exception) override {
+    failed = true;
+    next.onRecoverableException(kj::mv(exception));
+  }
+};
+
+}  // namespace
+
+void MessageReader::validateAndTrust() {
+  ValidationFailureDetector detector;
+  auto root = getRootInternal();
+  _::PointerHelpers<AnyPointer>::getInternalReader(root).validateTarget();
+  if (!detector.failed) {
+    arena()->setTrusted();
+  }
+}
+
+void MessageReader::trustWithoutValidation() {
+  getRootInternal();  // make sure the arena exists
+  arena()->setTrusted();
+}
+
 AnyPointer::Reader MessageReader::getRootInternal() {
   if (!allocatedArena) {
     static_assert(sizeof(_::ReaderArena) <= sizeof(arenaSpace),
@@ -187,6 +227,18 @@ size_t MessageBuilder::sizeInWords() {
   return arena()->sizeInWords();
 }
 
+size_t MessageBuilder::compactSizeInWords() {
+  // The root pointer, plus everything it reaches.
+  return unbound(getRootInternal().asReader().targetSize().wordCount / WORDS) + 1;
+}
+
+void MessageBuilder::discardArena() {
+  if (allocatedArena) {
+    kj::dtor(*arena());
+    allocatedArena = false;
+  }
+}
+
 kj::Own<_::CapTableBuilder> MessageBuilder::releaseBuiltinCapTable() {
   return arena()->releaseLocalCapTable();
 }
@@ -217,7 +269,7 @@ MallocMessageBuilder::MallocMessageBuilder(
 MallocMessageBuilder::MallocMessageBuilder(
     kj::ArrayPtr<word> firstSegment, AllocationStrategy allocationStrategy)
     : nextSize(firstSegment.size()), allocationStrategy(allocationStrategy),
-      ownFirstSegment(false), returnedFirstSegment(false), firstSegment(firstSegment.begin()) {
+      ownFirstSegment(false), returnedFirstSegment(false), firstSegment(firstSegment) {
   KJ_REQUIRE(firstSegment.size() > 0, "First segment size must be non-zero.");
 
   // Checking just the first word should catch most cases of failing to zero the segment.
@@ -225,26 +277,85 @@ MallocMessageBuilder::MallocMessageBuilder(
           "First segment must be zeroed.");
 }
 
+MallocMessageBuilder::MallocMessageBuilder(
+    SegmentAllocator& allocator, uint firstSegmentWords, AllocationStrategy allocationStrategy)
+    : MallocMessageBuilder(firstSegmentWords, allocationStrategy) {
+  this->allocator = &allocator;
+}
+
 MallocMessageBuilder::~MallocMessageBuilder() noexcept(false) {
+  releaseSegments();
+}
+
+kj::ArrayPtr<word> MallocMessageBuilder::allocateMemory(uint size) {
+  KJ_IF_MAYBE(a, allocator) {
+    auto result = a->allocateSegment(size);
+    KJ_ASSERT(result.size() >= size &&
+              bounded(result.size()) * WORDS <= MAX_SEGMENT_WORDS,
+              "SegmentAllocator returned a segment of the wrong size.", size, result.size());
+    return result;
+  }
+
+  void* result = calloc(size, sizeof(word));
+  if (result == nullptr) {
+    KJ_FAIL_SYSCALL("calloc(size, sizeof(word))", ENOMEM, size);
+  }
+  return kj::arrayPtr(reinterpret_cast<word*>(result), size);
+}
+
+void MallocMessageBuilder::freeMemory(kj::ArrayPtr<word> segment) {
+  KJ_IF_MAYBE(a, allocator) {
+    a->freeSegment(segment);
+  } else {
+    free(segment.begin());
+  }
+}
+
+void MallocMessageBuilder::releaseSegments() {
   if (returnedFirstSegment) {
     if (ownFirstSegment) {
-      free(firstSegment);
+      freeMemory(firstSegment);
     } else {
       // Must zero first segment.
       kj::ArrayPtr<const kj::ArrayPtr<const word>> segments = getSegmentsForOutput();
       if (segments.size() > 0) {
-        KJ_ASSERT(segments[0].begin() == firstSegment,
+        KJ_ASSERT(segments[0].begin() == firstSegment.begin(),
             "First segment in getSegmentsForOutput() is not the first segment allocated?");
-        memset(firstSegment, 0, segments[0].size() * sizeof(word));
+        memset(firstSegment.begin(), 0, segments[0].size() * sizeof(word));
       }
     }
 
-    for (void* ptr: moreSegments) {
-      free(ptr);
+    for (auto segment: moreSegments) {
+      freeMemory(segment);
     }
   }
 }
 
+void MallocMessageBuilder::compact() {
+  uint size = kj::min(compactSizeInWords(),
+                      size_t(kj::maxValueForBits<SEGMENT_WORD_COUNT_BITS>()));
+
+  // Copy the reachable graph aside (along with any capabilities), then start over and copy it
+  // back into a single segment of exactly the right size.
+  MallocMessageBuilder copy(size, AllocationStrategy::FIXED_SIZE);
+  copy.getRoot<AnyPointer>().set(getRoot<AnyPointer>().asReader());
+
+  releaseSegments();
+  discardArena();
+  moreSegments.clear();
+  ownFirstSegment = true;
+  returnedFirstSegment = false;
+  firstSegment = nullptr;
+
+  uint oldNextSize = nextSize;
+  nextSize = size;
+  getRoot<AnyPointer>().set(copy.getRoot<AnyPointer>().asReader());
+  if (allocationStrategy == AllocationStrategy::FIXED_SIZE) {
+    // Only the first segment should be sized to fit.
+    nextSize = oldNextSize;
+  }
+}
+
 kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
   KJ_REQUIRE(bounded(minimumSize) * WORDS <= MAX_SEGMENT_WORDS,
       "MallocMessageBuilder asked to allocate segment above maximum serializable size.");
@@ -252,7 +363,7 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
       "MallocMessageBuilder nextSize out of bounds.");
 
   if (!returnedFirstSegment && !ownFirstSegment) {
-    kj::ArrayPtr<word> result = kj::arrayPtr(reinterpret_cast<word*>(firstSegment), nextSize);
+    kj::ArrayPtr<word> result = firstSegment;
     if (result.size() >= minimumSize) {
       returnedFirstSegment = true;
       return result;
@@ -263,12 +374,8 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
     ownFirstSegment = true;
   }
 
-  uint size = kj::max(minimumSize, nextSize);
-
-  void* result = calloc(size, sizeof(word));
-  if (result == nullptr) {
-    KJ_FAIL_SYSCALL("calloc(size, sizeof(word))", ENOMEM, size);
-  }
+  kj::ArrayPtr<word> result = allocateMemory(kj::max(minimumSize, nextSize));
+  uint size = result.size();
 
   if (!returnedFirstSegment) {
     firstSegment = result;
@@ -286,11 +393,208 @@ kj::ArrayPtr<word> MallocMessageBuilder::allocateSegment(uint minimumSize) {
     }
   }
 
-  return kj::arrayPtr(reinterpret_cast<word*>(result), size);
+  return result;
 }
 
 // -------------------------------------------------------------------
 
+SegmentAllocator::~SegmentAllocator() noexcept(false) {}
+
+kj::ArrayPtr<word> ArenaSegmentAllocator::allocateSegment(uint minimumWords) {
+  // `word` can't be default-constructed in an array, so allocate the equivalent uint64_ts.
+  auto space = arena.allocateArray<uint64_t>(minimumWords);
+  memset(space.begin(), 0, space.size() * sizeof(uint64_t));
+  return kj::arrayPtr(reinterpret_cast<word*>(space.begin()), space.size());
+}
+
+void ArenaSegmentAllocator::freeSegment(kj::ArrayPtr<word> segment) {
+  // Freed along with the arena.
+}
+
+namespace {
+
+constexpr size_t HUGE_PAGE_BYTES = 2u << 20;
+
+}  // namespace
+
+kj::ArrayPtr<word> HugePageSegmentAllocator::allocateSegment(uint minimumWords) {
+#if !_WIN32
+  size_t bytes = size_t(minimumWords) * sizeof(word);
+  if (bytes >= HUGE_PAGE_BYTES) {
+    bytes = (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+    bytes = kj::min(bytes, size_t(unbound(MAX_SEGMENT_WORDS / WORDS)) * sizeof(word));
+
+#ifdef MAP_HUGETLB
+    if (explicitHugePages) {
+      void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (mapping != MAP_FAILED) {
+        return kj::arrayPtr(reinterpret_cast<word*>(mapping), bytes / sizeof(word));
+      }
+      // The reserved pool is probably empty or unconfigured; fall back to transparent pages.
+    }
+#endif
+
+    // Over-allocate so that we can trim the mapping to a huge page boundary; transparent huge
+    // pages can only back aligned regions.
+    size_t reserved = bytes + HUGE_PAGE_BYTES;
+    void* mapping = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      KJ_FAIL_SYSCALL("mmap(segment)", errno, reserved);
+    }
+
+    byte* begin = reinterpret_cast<byte*>(mapping);
+    byte* aligned = reinterpret_cast<byte*>(
+        (reinterpret_cast<uintptr_t>(begin) + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1));
+    if (aligned > begin) {
+      KJ_SYSCALL(munmap(begin, aligned - begin));
+    }
+    byte* end = aligned + bytes;
+    if (end < begin + reserved) {
+      KJ_SYSCALL(munmap(end, begin + reserved - end));
+    }
+
+#ifdef MADV_HUGEPAGE
+    // Only advice: if transparent huge pages are disabled, we simply get normal pages.
+    madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+
+    return kj::arrayPtr(reinterpret_cast<word*>(aligned), bytes / sizeof(word));
+  }
+#endif
+
+  void* result = calloc(minimumWords, sizeof(word));
+  if (result == nullptr) {
+    KJ_FAIL_SYSCALL("calloc(minimumWords, sizeof(word))", ENOMEM, minimumWords);
+  }
+  return kj::arrayPtr(reinterpret_cast<word*>(result), minimumWords);
+}
+
+void HugePageSegmentAllocator::freeSegment(kj::ArrayPtr<word> segment) {
+#if !_WIN32
+  if (segment.size() * sizeof(word) >= HUGE_PAGE_BYTES) {
+    KJ_SYSCALL(munmap(segment.begin(), segment.size() * sizeof(word)));
+    return;
+  }
+#endif
+  free(segment.begin());
+}
+
+// -------------------------------------------------------------------
+
+namespace {
+
+constexpr uint MIN_SUGGESTED_WORDS = 16;
+// Smaller first segments save nothing worth having.
+
+constexpr uint MIN_SAMPLES = 16;
+// Number of recorded sizes after which suggestions are based on them.
+
+constexpr uint DECAY_INTERVAL = 1024;
+// Once this many sizes have been counted, all counts are halved.
+
+}  // namespace
+
+FirstSegmentSizer::FirstSegmentSizer(uint initialWords, uint percentile)
+    : initialWords(initialWords), percentile(kj::min(percentile, 100u)),
+      suggestion(initialWords) {}
+
+void FirstSegmentSizer::record(size_t sizeInWords) {
+  uint words = kj::max(
+      kj::min(sizeInWords, size_t(unbound(MAX_SEGMENT_WORDS / WORDS))),
+      size_t(MIN_SUGGESTED_WORDS));
+
+  uint exponent = 0;
+  while ((words >> exponent) > 1) ++exponent;
+  uint bucket = exponent * 4 + ((words >> (exponent - 2)) & 3);
+  KJ_DASSERT(bucket < BUCKET_COUNT);
+  ++counts[bucket];
+
+  if (++total >= DECAY_INTERVAL) {
+    total = 0;
+    for (auto& count: counts) {
+      count /= 2;
+      total += count;
+    }
+  }
+
+  dirty = true;
+}
+
+uint FirstSegmentSizer::suggest() {
+  if (total < MIN_SAMPLES) return initialWords;
+
+  if (dirty) {
+    uint64_t target = uint64_t(total) * percentile;
+    uint64_t cumulative = 0;
+    for (auto bucket: kj::zeroTo(BUCKET_COUNT)) {
+      cumulative += counts[bucket];
+      if (cumulative * 100 >= target) {
+        // Use the largest size that falls in this bucket.
+        uint exponent = bucket / 4;
+        uint64_t upper = (uint64_t(5 + bucket % 4) << (exponent - 2)) - 1;
+        suggestion = kj::min(upper, uint64_t(unbound(MAX_SEGMENT_WORDS / WORDS)));
+        break;
+      }
+    }
+    dirty = false;
+  }
+
+  return suggestion;
+}
+
+// -------------------------------------------------------------------
+
+MessageSegmentPool::MessageSegmentPool(uint segmentWords, uint maxPooledSegments)
+    : segmentWords(segmentWords), maxPooledSegments(maxPooledSegments) {
+  KJ_REQUIRE(segmentWords > 0, "Segment size must be non-zero.");
+  KJ_REQUIRE(bounded(segmentWords) * WORDS <= MAX_SEGMENT_WORDS,
+      "MessageSegmentPool segment size above maximum serializable size.");
+}
+
+MessageSegmentPool::~MessageSegmentPool() noexcept(false) {
+  for (word* segment: segments) {
+    free(segment);
+  }
+}
+
+kj::ArrayPtr<word> MessageSegmentPool::allocateSegment(uint minimumWords) {
+  if (minimumWords <= segmentWords && !segments.empty()) {
+    word* result = segments.back();
+    segments.removeLast();
+    return kj::arrayPtr(result, segmentWords);
+  }
+
+  KJ_REQUIRE(bounded(minimumWords) * WORDS <= MAX_SEGMENT_WORDS,
+      "MessageSegmentPool asked to allocate segment above maximum serializable size.");
+
+  uint size = kj::max(minimumWords, segmentWords);
+  void* result = calloc(size, sizeof(word));
+  if (result == nullptr) {
+    KJ_FAIL_SYSCALL("calloc(size, sizeof(word))", ENOMEM, size);
+  }
+  return kj::arrayPtr(reinterpret_cast<word*>(result), size);
+}
+
+void MessageSegmentPool::releaseSegment(kj::ArrayPtr<word> segment) {
+  KJ_DASSERT(*reinterpret_cast<uint64_t*>(segment.begin()) == 0,
+             "Segment released to MessageSegmentPool was not zeroed.");
+
+  if (segment.size() == segmentWords && segments.size() < maxPooledSegments) {
+    segments.add(segment.begin());
+  } else {
+    free(segment.begin());
+  }
+}
+
+PooledMessageBuilder::PooledMessageBuilder(
+    MessageSegmentPool& pool, uint firstSegmentWords, AllocationStrategy allocationStrategy)
+    : PooledSegmentHolder(pool, firstSegmentWords),
+      MallocMessageBuilder(segment, allocationStrategy) {}
+
+PooledMessageBuilder::~PooledMessageBuilder() noexcept(false) {}
+
 FlatMessageBuilder::FlatMessageBuilder(kj::ArrayPtr<word> array): array(array), allocated(false) {}
 FlatMessageBuilder::~FlatMessageBuilder() noexcept(false) {}
 
@@ -30,6 +30,10 @@
 #include "layout.h"
 #include "any.h"
 
+namespace kj {
+  class Arena;
+}
+
 CAPNP_BEGIN_HEADER
 
 namespace capnp {
@@ -80,6 +84,18 @@ struct ReaderOptions {
   // overflow by sending a very-deeply-nested (or even cyclic) message, without the message even
   // being very large.  The default limit of 64 is probably low enough to prevent any chance of
   // stack overflow, yet high enough that it is never a problem in practice.
+
+  bool threadSafeTraversalLimit = false;
+  // Readers of one message may be used from several threads at once, but by default the traversal
+  // limit is then enforced only approximately: to keep single-threaded reads cheap, threads may
+  // overwrite each other's updates to the shared counter. Set this to true to have the counter
+  // updated atomically instead, so the limit holds exactly no matter how many threads are
+  // traversing the message, at the cost of contention on the counter. (For messages
+  // that are read from many threads, consider MessageReader::validateAndTrust(), which lets
+  // readers skip the counter altogether.)
+  //
+  // Either way, call getRoot() once before sharing the MessageReader with other threads, since
+  // the reader sets itself up lazily on first use.
 };
 
 class MessageReader {
@@ -124,13 +140,34 @@ public:
   size_t sizeInWords();
   // Add up the size of all segments.
 
+  void validateAndTrust();
+  // Check the entire message up-front, in one pass, then mark it trusted. Readers obtained from a
+  // trusted message skip the bounds checks and traversal-limit accounting they would otherwise do
+  // on every pointer they follow, which is a noticeable fraction of read time for
+  // pointer-heavy messages that are read more than once or read in full.
+  //
+  // Validation throws if the message is malformed, is nested more deeply than
+  // `ReaderOptions::nestingLimit`, or would exceed `ReaderOptions::traversalLimitInWords` if read
+  // in its entirety once. After a successful call, the traversal limit no longer applies, so the
+  // message can be traversed any number of times. Type checks (e.g. finding a list where a struct
+  // was expected) and the nesting limit are still enforced by readers.
+  //
+  // Call this before handing out any readers, and before sharing the MessageReader across
+  // threads.
+
+  void trustWithoutValidation();
+  // Like validateAndTrust() but without the validation pass. THIS IS INSECURE: reading a
+  // malformed trusted message may read out of bounds. Only use it for messages that this program
+  // produced itself, or that it has validated before (e.g. a message written to a local cache
+  // after validateAndTrust() succeeded, whose integrity is otherwise assured).
+
 private:
   ReaderOptions options;
 
 #if defined(__EMSCRIPTEN__)
-  static constexpr size_t arenaSpacePadding = 19;
+  static constexpr size_t arenaSpacePadding = 20;
 #else
-  static constexpr size_t arenaSpacePadding = 18;
+  static constexpr size_t arenaSpacePadding = 19;
 #endif
 
   // Space in which we can construct a ReaderArena.  We don't use ReaderArena directly here
@@ -240,6 +277,19 @@ public:
   size_t sizeInWords();
   // Add up the allocated space from all segments.
 
+  size_t compactSizeInWords();
+  // Compute the size the message would have if only the objects reachable from the root were
+  // kept, packed into a single segment: that is, the size of a copy made by `setRoot()`.  Space
+  // occupied by orphans, by values that have since been overwritten, and by far pointers is not
+  // counted.  Comparing this with `sizeInWords()` tells how much a compaction (e.g.
+  // `MallocMessageBuilder::compact()`) would reclaim.  This traverses the whole message.
+
+protected:
+  void discardArena();
+  // Forget the message entirely, so that the next access starts over with a fresh arena.  This
+  // invalidates all outstanding Builders and Orphans.  Does not release any segment memory; that
+  // is the subclass's job.
+
 private:
   alignas(8) void* arenaSpace[22];
   // Space in which we can construct a BuilderArena.  We don't use BuilderArena directly here
@@ -371,6 +421,65 @@ enum class AllocationStrategy: uint8_t {
 constexpr uint SUGGESTED_FIRST_SEGMENT_WORDS = 1024;
 constexpr AllocationStrategy SUGGESTED_ALLOCATION_STRATEGY = AllocationStrategy::GROW_HEURISTICALLY;
 
+class SegmentAllocator {
+  // Supplies the memory for a MallocMessageBuilder's segments, in place of calloc().  The builder
+  // still decides how large each segment should be, according to its AllocationStrategy.
+
+public:
+  virtual ~SegmentAllocator() noexcept(false);
+
+  virtual kj::ArrayPtr<word> allocateSegment(uint minimumWords) = 0;
+  // Returns a zeroed segment of at least `minimumWords` words.  If more is returned, the builder
+  // will use all of it.  `minimumWords` never exceeds the maximum segment size, and the result
+  // must not either.
+
+  virtual void freeSegment(kj::ArrayPtr<word> segment) = 0;
+  // Releases a segment previously returned by allocateSegment(), when the builder is done with it.
+};
+
+class ArenaSegmentAllocator final: public SegmentAllocator {
+  // Allocates segments from a kj::Arena, so that freeing them costs nothing: the memory is
+  // reclaimed all at once when the arena is destroyed or reset().  Good for batches of messages
+  // that are built and discarded together, e.g. with a per-request arena that is reset after each
+  // request so that its chunks are reused.  Not thread-safe; the arena must outlive all builders
+  // using it, and must not be reset while they are in use.
+
+public:
+  explicit ArenaSegmentAllocator(kj::Arena& arena): arena(arena) {}
+
+  kj::ArrayPtr<word> allocateSegment(uint minimumWords) override;
+  void freeSegment(kj::ArrayPtr<word> segment) override;
+
+private:
+  kj::Arena& arena;
+};
+
+class HugePageSegmentAllocator final: public SegmentAllocator {
+  // Allocates segments of 2 MiB and up directly with mmap(), rounded up to a multiple of 2 MiB and
+  // aligned, and asks the kernel to back them with huge pages.  This cuts the TLB misses and page
+  // faults incurred while building very large messages, and since fresh mappings are already
+  // zero, nothing needs to be zeroed in user space.  Smaller segments, which would waste most of a
+  // huge page, come from calloc() as usual.  Best combined with a large `firstSegmentWords`.
+  //
+  // Like any anonymous memory on Linux, the pages are placed on the NUMA node of the thread that
+  // first touches them, so a builder used from a pinned thread gets node-local segments.
+  //
+  // On systems without huge page support this behaves like calloc().  Thread-safe.
+
+public:
+  explicit HugePageSegmentAllocator(bool explicitHugePages = false)
+      : explicitHugePages(explicitHugePages) {}
+  // If `explicitHugePages` is true, first try to map pages from the kernel's reserved huge page
+  // pool (MAP_HUGETLB), which must have been configured by the administrator.  Otherwise, or if
+  // that fails, rely on transparent huge pages.
+
+  kj::ArrayPtr<word> allocateSegment(uint minimumWords) override;
+  void freeSegment(kj::ArrayPtr<word> segment) override;
+
+private:
+  bool explicitHugePages;
+};
+
 class MallocMessageBuilder: public MessageBuilder {
   // A simple MessageBuilder that uses malloc() (actually, calloc()) to allocate segments.  This
   // implementation should be reasonable for any case that doesn't require writing the message to
@@ -400,11 +509,27 @@ public:
   // firstSegment MUST be zero-initialized.  MallocMessageBuilder's destructor will write new zeros
   // over any space that was used so that it can be reused.
 
+  explicit MallocMessageBuilder(SegmentAllocator& allocator,
+      uint firstSegmentWords = SUGGESTED_FIRST_SEGMENT_WORDS,
+      AllocationStrategy allocationStrategy = SUGGESTED_ALLOCATION_STRATEGY);
+  // Obtains all segments from `allocator` instead of calloc(), and returns them to it when done.
+  // The allocator must outlive the builder.
+
   KJ_DISALLOW_COPY(MallocMessageBuilder);
   virtual ~MallocMessageBuilder() noexcept(false);
 
   virtual kj::ArrayPtr<word> allocateSegment(uint minimumSize) override;
 
+  void compact();
+  // Rewrite the message so that it contains only what is reachable from the root, in a single
+  // tightly-sized segment, and free all the old segments.  A builder that is mutated in place for
+  // a long time accumulates space used by orphans and overwritten values, which is never reused
+  // otherwise; see `compactSizeInWords()` for deciding when compacting is worthwhile.
+  //
+  // This copies the message twice, and invalidates all outstanding Builders and Orphans.  If the
+  // builder was constructed with a caller-provided first segment, that segment is zeroed and no
+  // longer used.
+
 private:
   uint nextSize;
   AllocationStrategy allocationStrategy;
@@ -412,8 +537,124 @@ private:
   bool ownFirstSegment;
   bool returnedFirstSegment;
 
-  void* firstSegment;
-  kj::Vector<void*> moreSegments;
+  kj::ArrayPtr<word> firstSegment;
+  kj::Vector<kj::ArrayPtr<word>> moreSegments;
+
+  SegmentAllocator* allocator = nullptr;
+  // Null means calloc() / free().
+
+  kj::ArrayPtr<word> allocateMemory(uint size);
+  void freeMemory(kj::ArrayPtr<word> segment);
+  void releaseSegments();
+};
+
+class FirstSegmentSizer {
+  // Learns what `firstSegmentWords` to use for messages that are built over and over for the same
+  // purpose -- e.g. at one call site, or of one root type -- so that most of them fit in a single
+  // segment without allocating, and zeroing, much more space than they need. Report the final size
+  // of each message with record(), and use suggest() when constructing the next builder:
+  //
+  //     static thread_local FirstSegmentSizer sizer;
+  //     MallocMessageBuilder builder(sizer.suggest());
+  //     ...build the message...
+  //     sizer.record(builder.sizeInWords());
+  //
+  // The suggestion is the requested percentile of recently recorded sizes, rounded up by at most a
+  // quarter. Old sizes are gradually forgotten, so the suggestion follows changes in traffic.
+  //
+  // A FirstSegmentSizer is not thread-safe.
+
+public:
+  explicit FirstSegmentSizer(uint initialWords = SUGGESTED_FIRST_SEGMENT_WORDS,
+                             uint percentile = 95);
+  // `initialWords` is suggested until enough sizes have been recorded to go by. `percentile` is
+  // the percentage of messages which should fit in the suggested size.
+
+  uint suggest();
+  // Returns the first segment size to use for the next message.
+
+  void record(size_t sizeInWords);
+  // Records the size a message ended up with, e.g. MessageBuilder::sizeInWords().
+
+private:
+  static constexpr uint BUCKET_COUNT = 30 * 4;
+  // Sizes are counted in buckets a quarter of a power of two wide, up to the maximum segment size.
+
+  uint initialWords;
+  uint percentile;
+  uint total = 0;
+  bool dirty = false;
+  uint suggestion;
+  uint counts[BUCKET_COUNT] = {};
+};
+
+class MessageSegmentPool {
+  // A cache of zeroed first segments for use with `PooledMessageBuilder`.
+  //
+  // Every `MallocMessageBuilder` calloc()s -- and thus zeroes -- a fresh first segment, which
+  // shows up in profiles when building many small messages in sequence, such as every call sent
+  // over an RPC connection. A pool lets these segments be reused: only the part of a segment that
+  // was actually used must be zeroed before it can be used again, which for small messages is a
+  // tiny fraction of the whole.
+  //
+  // A MessageSegmentPool is not thread-safe. It must outlive all builders that use it.
+
+public:
+  explicit MessageSegmentPool(uint segmentWords = SUGGESTED_FIRST_SEGMENT_WORDS,
+                              uint maxPooledSegments = 16);
+  // `segmentWords` is the size of each pooled segment. At most `maxPooledSegments` segments are
+  // retained when idle; any more are freed when released.
+
+  KJ_DISALLOW_COPY(MessageSegmentPool);
+  ~MessageSegmentPool() noexcept(false);
+
+  kj::ArrayPtr<word> allocateSegment(uint minimumWords);
+  // Returns a zeroed segment of at least `minimumWords` words, reusing a pooled segment if
+  // possible. If `minimumWords` is larger than the pool's segment size, a segment of exactly the
+  // requested size is allocated, and it will be freed rather than pooled when released.
+
+  void releaseSegment(kj::ArrayPtr<word> segment);
+  // Returns a segment previously obtained from allocateSegment(). The caller must have zeroed
+  // any part of it that was written.
+
+private:
+  uint segmentWords;
+  uint maxPooledSegments;
+  kj::Vector<word*> segments;
+};
+
+namespace _ {  // private
+
+class PooledSegmentHolder {
+  // Base class of PooledMessageBuilder which must be constructed before, and destroyed after,
+  // the MallocMessageBuilder that uses the segment.
+
+protected:
+  PooledSegmentHolder(MessageSegmentPool& pool, uint minimumWords)
+      : pool(pool), segment(pool.allocateSegment(minimumWords)) {}
+  ~PooledSegmentHolder() noexcept(false) { pool.releaseSegment(segment); }
+
+  MessageSegmentPool& pool;
+  kj::ArrayPtr<word> segment;
+};
+
+}  // namespace _ (private)
+
+class PooledMessageBuilder: private _::PooledSegmentHolder, public MallocMessageBuilder {
+  // A MallocMessageBuilder whose first segment comes from a MessageSegmentPool, and is returned
+  // to it (re-zeroed) when the builder is destroyed. Subsequent segments, if any, are allocated
+  // normally. In steady state, building a message that fits in the pool's segment size performs
+  // no calloc() and zeroes only the space the message used.
+
+public:
+  explicit PooledMessageBuilder(MessageSegmentPool& pool, uint firstSegmentWords = 0,
+      AllocationStrategy allocationStrategy = SUGGESTED_ALLOCATION_STRATEGY);
+  // `firstSegmentWords` has the same meaning as for MallocMessageBuilder, except that zero (the
+  // default) means "the pool's segment size". The first segment is never smaller than the pool's
+  // segment size, since a larger segment costs nothing extra once it is pooled.
+
+  KJ_DISALLOW_COPY(PooledMessageBuilder);
+  ~PooledMessageBuilder() noexcept(false);
 };
 
 class FlatMessageBuilder: public MessageBuilder {
@@ -553,6 +794,15 @@ kj::Array<word> canonicalize(T&& reader) {
     return _::PointerHelpers<FromReader<T>>::getInternalReader(reader).canonicalize();
 }
 
+template <typename T>
+void canonicalHash(T&& reader, kj::FunctionParam<void(kj::ArrayPtr<const word>)> update) {
+  // Feeds the canonical form of `reader` to `update` as a sequence of word runs, without
+  // allocating it. The runs concatenate to exactly what `canonicalize(reader)` returns, so passing
+  // each one to an incremental hash function yields the digest of the canonical message. Runs
+  // only remain valid for the duration of the call.
+  _::PointerHelpers<FromReader<T>>::getInternalReader(reader).canonicalHash(kj::mv(update));
+}
+
 }  // namespace capnp
 
 CAPNP_END_HEADER
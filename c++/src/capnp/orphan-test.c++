@@ -20,6 +20,7 @@
 // THE SOFTWARE.
 
 #include "message.h"
+#include "serialize.h"
 #include "kj/debug.h"
 #include "kj/compat/gtest.h"
 #include "test-util.h"
@@ -1026,6 +1027,104 @@ TEST(Orphans, ReferenceExternalData_NoZeroImmediateAbandon) {
   }
 }
 
+TEST(Orphans, ReferenceExternal) {
+  MallocMessageBuilder source;
+  initTestMessage(source.initRoot<TestAllTypes>());
+  auto sourceSegments = source.getSegmentsForOutput();
+  ASSERT_EQ(1, sourceSegments.size());
+  auto sourceWords = sourceSegments[0];
+  auto sourceCopy = kj::heapArray(sourceWords);
+
+  SegmentArrayMessageReader reader(sourceSegments);
+  auto in = reader.getRoot<TestAllTypes>();
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setInt32Field(123);
+  root.adoptStructField(builder.getOrphanage().referenceExternal(in));
+  root.adoptStructList(builder.getOrphanage().referenceExternal(in.getStructList()));
+  root.adoptInt32List(builder.getOrphanage().referenceExternal(in.getInt32List()));
+
+  // Each object's span of the source segment was added as a segment.
+  auto segments = builder.getSegmentsForOutput();
+  ASSERT_EQ(4, segments.size());
+  for (auto segment: segments.slice(1, segments.size())) {
+    EXPECT_TRUE(segment.begin() >= sourceWords.begin());
+    EXPECT_TRUE(segment.end() <= sourceWords.end());
+  }
+
+  // Referencing the same object again reuses its segment.
+  auto orphan = builder.getOrphanage().referenceExternal(in);
+  EXPECT_EQ(4, builder.getSegmentsForOutput().size());
+
+  // Can't get builders, since the data is read-only.
+  EXPECT_ANY_THROW(orphan.get());
+  EXPECT_ANY_THROW(root.getStructField());
+
+  // Can get readers.
+  checkTestMessage(orphan.getReader());
+  checkTestMessage(root.asReader().getStructField());
+
+  // The message reads back as expected once written out.
+  {
+    auto words = messageToFlatArray(builder);
+    FlatArrayMessageReader written(words);
+    auto check = written.getRoot<TestAllTypes>();
+    EXPECT_EQ(123, check.getInt32Field());
+    checkTestMessage(check.getStructField());
+    EXPECT_EQ(in.getStructList().size(), check.getStructList().size());
+    for (auto i: kj::indices(in.getStructList())) {
+      EXPECT_EQ(in.getStructList()[i].getTextField(), check.getStructList()[i].getTextField());
+    }
+    checkList(check.getInt32List(), {111111111, -111111111});
+  }
+
+  // Dropping references leaves the source untouched.
+  orphan = Orphan<TestAllTypes>();
+  root.setStructField(in);
+  root.disownStructList();
+  EXPECT_EQ(0, memcmp(sourceWords.begin(), sourceCopy.begin(), sourceWords.asBytes().size()));
+}
+
+TEST(Orphans, ReferenceExternalWholeMessage) {
+  MallocMessageBuilder source;
+  initTestMessage(source.initRoot<TestAllTypes>());
+  SegmentArrayMessageReader reader(source.getSegmentsForOutput());
+
+  MallocMessageBuilder builder;
+  builder.adoptRoot(builder.getOrphanage().referenceExternal(reader.getRoot<TestAllTypes>()));
+  EXPECT_EQ(2, builder.getSegmentsForOutput().size());
+  EXPECT_ANY_THROW(builder.getRoot<TestAllTypes>());
+
+  auto words = messageToFlatArray(builder);
+  FlatArrayMessageReader written(words);
+  checkTestMessage(written.getRoot<TestAllTypes>());
+}
+
+TEST(Orphans, ReferenceExternalFallsBackToCopy) {
+  // A message whose objects are spread over many segments, linked by far pointers.
+  MallocMessageBuilder source(1, AllocationStrategy::FIXED_SIZE);
+  initTestMessage(source.initRoot<TestAllTypes>());
+  ASSERT_TRUE(source.getSegmentsForOutput().size() > 1);
+  SegmentArrayMessageReader reader(source.getSegmentsForOutput());
+  auto in = reader.getRoot<TestAllTypes>();
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.adoptStructField(builder.getOrphanage().referenceExternal(in));
+
+  // Objects from this same message, and default values, are copied too.
+  root.adoptStructList(builder.getOrphanage().referenceExternal(
+      root.asReader().getStructField().getStructList()));
+  root.adoptInt32List(builder.getOrphanage().referenceExternal(
+      TestDefaults::Reader().getInt32List()));
+
+  EXPECT_EQ(1, builder.getSegmentsForOutput().size());
+  checkTestMessage(root.getStructField());
+  EXPECT_EQ(3, root.getStructList().size());
+  checkList(root.getInt32List(), {111111111, -111111111});
+}
+
 TEST(Orphans, TruncateData) {
   MallocMessageBuilder message;
   auto orphan = message.getOrphanage().newOrphan<Data>(17);
@@ -1747,6 +1846,68 @@ TEST(Orphans, ConcatenateStructListsUpgradeFromPrimitive) {
   EXPECT_FALSE(cat[3].hasOld2());
 }
 
+KJ_TEST("ListAppender") {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  auto orphanage = builder.getOrphanage();
+
+  {
+    // Primitive elements: the list stays at the end of the segment, so it grows in place
+    // and finish() hands back the spare capacity.
+    ListAppender<uint32_t> appender(orphanage, 1);
+    for (auto i: kj::zeroTo(1000u)) {
+      appender.add(i * 3);
+    }
+    KJ_EXPECT(appender.size() == 1000);
+    KJ_EXPECT(appender.capacity() == 1024);
+    KJ_EXPECT(appender[999] == 2997);
+
+    size_t sizeBefore = builder.sizeInWords();
+    root.adoptUInt32List(appender.finish());
+    KJ_EXPECT(builder.sizeInWords() == sizeBefore - 12);  // 24 spare elements, 2 per word
+    KJ_EXPECT(appender.size() == 0);
+
+    auto list = root.asReader().getUInt32List();
+    KJ_ASSERT(list.size() == 1000);
+    for (auto i: kj::indices(list)) KJ_EXPECT(list[i] == i * 3);
+  }
+
+  {
+    // Struct elements which point at other objects, so the list must sometimes move.
+    ListAppender<TestAllTypes> appender(orphanage);
+    for (auto i: kj::zeroTo(100)) {
+      auto element = appender.add();
+      element.setInt32Field(i);
+      element.setTextField(kj::str("row ", i));
+    }
+    root.adoptStructList(appender.finish());
+
+    auto list = root.asReader().getStructList();
+    KJ_ASSERT(list.size() == 100);
+    for (auto i: kj::indices(list)) {
+      KJ_EXPECT(list[i].getInt32Field() == i);
+      KJ_EXPECT(list[i].getTextField() == kj::str("row ", i));
+    }
+  }
+
+  {
+    ListAppender<Text> appender(orphanage, 0);
+    appender.add("foo");
+    appender.add(Text::Reader("bar"));
+    appender.add(kj::str("baz"));
+    root.adoptTextList(appender.finish());
+    checkList(root.asReader().getTextList(), {"foo", "bar", "baz"});
+  }
+
+  {
+    // Nothing added.
+    ListAppender<int64_t> appender(orphanage);
+    root.adoptInt64List(appender.finish());
+    KJ_EXPECT(root.asReader().hasInt64List());
+    KJ_EXPECT(root.asReader().getInt64List().size() == 0);
+  }
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -172,6 +172,27 @@ public:
   // into the message tree without copying it.  This is particularly useful when referencing very
   // large blobs, such as whole mmap'd files.
 
+  template <typename Reader>
+  Orphan<FromReader<Reader>> referenceExternal(Reader value) const;
+  // Like `newOrphanCopy()`, but given a struct or list read from another message, references it
+  // in place rather than copying it, e.g. so that a proxy can change a few fields of a message and
+  // forward the rest without copying:
+  //
+  //     MallocMessageBuilder out;
+  //     auto root = out.initRoot<Request>();
+  //     root.setId(newId);
+  //     root.adoptBody(out.getOrphanage().referenceExternal(in.getBody()));
+  //
+  // The part of the other message's segment that the object and its descendants span becomes a
+  // segment of this message, and is written out as is. The restrictions of
+  // `referenceExternalData()` apply: the other message's memory must stay valid and unchanged
+  // until the `MessageBuilder` is destroyed, and only Readers can be obtained for the object. Also
+  // beware that anything the other message has in between the object's parts is written out too.
+  //
+  // Objects that span several segments (through far pointers), or that contain capabilities, are
+  // copied instead, as are default values and objects already in this message. Checking for this
+  // takes a walk over the object's pointers, which also validates them, but no data is copied.
+
 private:
   _::BuilderArena* arena;
   _::CapTableBuilder* capTable;
@@ -190,6 +211,56 @@ private:
   friend struct _::OrphanageInternal;
 };
 
+template <typename T>
+class ListAppender {
+  // Builds a List(T) one element at a time, for when the final size isn't known up-front. The list
+  // is allocated as an orphan with spare capacity, which is doubled whenever it runs out. Growing
+  // happens in place when the list is the last object in its segment and the segment has room --
+  // typically the case when elements don't themselves contain pointers -- and otherwise moves the
+  // list (shallowly, like Orphan::truncate()). When done, call finish() to trim the spare capacity
+  // (reclaiming it if the list is still at the end of its segment) and adopt the result:
+  //
+  //     ListAppender<Row> rows(orphanage);
+  //     while (...) {
+  //       auto row = rows.add();
+  //       row.setFoo(...);
+  //     }
+  //     table.adoptRows(rows.finish());
+  //
+  // Adding an element may move the list, which invalidates builders for earlier elements (but
+  // not for the objects they point at).
+
+public:
+  explicit ListAppender(Orphanage orphanage, uint initialCapacity = 8);
+  KJ_DISALLOW_COPY(ListAppender);
+  ListAppender(ListAppender&&) = default;
+  ListAppender& operator=(ListAppender&&) = default;
+
+  inline uint size() const { return count; }
+  inline uint capacity() const { return list.size(); }
+
+  BuilderFor<T> add();
+  // Appends a default-valued element and returns it. Mostly useful for struct elements, whose
+  // builder lets you fill in the new element.
+
+  template <typename V>
+  void add(V&& value);
+  // Appends a copy of `value`, e.g. a primitive, a Text::Reader, or a list reader.
+
+  inline BuilderFor<T> operator[](uint index);
+  // Gets a previously added element.
+
+  Orphan<List<T>> finish();
+  // Trims the list to the number of elements added and releases it. The appender is left empty.
+
+private:
+  Orphan<List<T>> orphan;
+  typename List<T>::Builder list;
+  uint count = 0;
+
+  void reserveOne();
+};
+
 // =======================================================================================
 // Inline implementation details.
 
@@ -428,10 +499,58 @@ Orphanage::newOrphanConcat(kj::ArrayPtr<const T> lists) const {
           _::minStructSizeForElement<Element>(), raw));
 }
 
+template <typename Reader>
+inline Orphan<FromReader<Reader>> Orphanage::referenceExternal(Reader value) const {
+  return Orphan<FromReader<Reader>>(_::OrphanBuilder::referenceExternal(
+      arena, capTable, GetInnerReader<FromReader<Reader>>::apply(value)));
+}
+
 inline Orphan<Data> Orphanage::referenceExternalData(Data::Reader data) const {
   return Orphan<Data>(_::OrphanBuilder::referenceExternalData(arena, data));
 }
 
+template <typename T>
+ListAppender<T>::ListAppender(Orphanage orphanage, uint initialCapacity)
+    : orphan(orphanage.newOrphan<List<T>>(kj::max(initialCapacity, 1u))),
+      list(orphan.get()) {}
+
+template <typename T>
+inline void ListAppender<T>::reserveOne() {
+  if (KJ_UNLIKELY(count == list.size())) {
+    // Asking for more than the maximum list size makes truncate() throw.
+    constexpr uint MAX_SIZE = kj::maxValueForBits<LIST_ELEMENT_COUNT_BITS>();
+    orphan.truncate(count <= MAX_SIZE / 2 ? count * 2 : kj::max(MAX_SIZE, count + 1));
+    list = orphan.get();
+  }
+}
+
+template <typename T>
+inline BuilderFor<T> ListAppender<T>::add() {
+  reserveOne();
+  return list[count++];
+}
+
+template <typename T>
+template <typename V>
+inline void ListAppender<T>::add(V&& value) {
+  reserveOne();
+  list.set(count++, kj::fwd<V>(value));
+}
+
+template <typename T>
+inline BuilderFor<T> ListAppender<T>::operator[](uint index) {
+  KJ_IREQUIRE(index < count, "Out-of-bounds list access.");
+  return list[index];
+}
+
+template <typename T>
+Orphan<List<T>> ListAppender<T>::finish() {
+  orphan.truncate(count);
+  list = nullptr;
+  count = 0;
+  return kj::mv(orphan);
+}
+
 }  // namespace capnp
 
 CAPNP_END_HEADER
@@ -201,5 +201,21 @@ const ::capnp::_::RawSchema s_f622595091cafb67 = {
   0, 0, nullptr, nullptr, nullptr, { &s_f622595091cafb67, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_b8630836983feed7[] = {
+  nullptr,
+  &s_c8cb212fcd9f5691,
+  &s_b76848c18c40efbf,
+  nullptr,
+  &s_f622595091cafb67,
+  nullptr,
+  &s_f76fba59183073a5,
+  nullptr,
+};
+static const uint32_t xh_b8630836983feed7[] = {1, 2};
+const ::capnp::_::RawSchemaIndex x_b8630836983feed7 = {
+  xs_b8630836983feed7, xh_b8630836983feed7, 8, 2, 4
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
@@ -23,6 +23,7 @@ CAPNP_DECLARE_SCHEMA(c8cb212fcd9f5691);
 CAPNP_DECLARE_SCHEMA(f76fba59183073a5);
 CAPNP_DECLARE_SCHEMA(b76848c18c40efbf);
 CAPNP_DECLARE_SCHEMA(f622595091cafb67);
+CAPNP_DECLARE_SCHEMA_INDEX(b8630836983feed7);
 
 }  // namespace schemas
 }  // namespace capnp
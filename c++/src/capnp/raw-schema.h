@@ -228,6 +228,42 @@ struct RawSchema {
   // bound to `AnyPointer`.
 };
 
+struct RawSchemaIndex {
+  // The generated code defines a constant RawSchemaIndex for every compiled file, listing all
+  // RawSchemas defined by the file in a perfect hash table keyed by type ID.  Since the table is
+  // computed by the code generator, lookups take constant time and need no initialization.
+  //
+  // This is an internal structure which could change in the future.
+
+  const RawSchema* const* slots;
+  // Hash table of size `slotCount`.  Unused slots are null.
+
+  const uint32_t* seeds;
+  // Per-bucket hash seeds of size `bucketCount`, chosen by the code generator such that no two
+  // schemas in the file land in the same slot.
+
+  uint32_t slotCount;
+  uint32_t bucketCount;
+  // Sizes of the above tables.  Both are powers of two (or zero, for a file with no schemas).
+
+  uint32_t schemaCount;
+  // Number of non-null slots.
+
+  static inline uint32_t hash(uint64_t id, uint32_t seed) {
+    // Type IDs are already random, but files built by hand may have clustered IDs, so mix anyway.
+    return static_cast<uint32_t>(((id ^ seed) * 0x9e3779b97f4a7c15ull) >> 32);
+  }
+
+  inline const RawSchema* find(uint64_t id) const {
+    // Returns the schema with the given ID, or null if the file doesn't define it.
+
+    if (slotCount == 0) return nullptr;
+    uint32_t seed = seeds[hash(id, 0) & (bucketCount - 1)];
+    const RawSchema* result = slots[hash(id, seed) & (slotCount - 1)];
+    return result != nullptr && result->id == id ? result : nullptr;
+  }
+};
+
 inline bool RawBrandedSchema::isUnbound() const {
   // The unbound schema is the only one that has no scopes but is not the default schema.
   return scopeCount == 0 && this != &generic->defaultBrand;
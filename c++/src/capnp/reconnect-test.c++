@@ -216,6 +216,148 @@ KJ_TEST("lazyAutoReconnect() initialies lazily") {
   KJ_EXPECT(connectCount == 3);
 }
 
+struct LoadBalancingTestContext {
+  kj::EventLoop loop;
+  kj::WaitScope ws { loop };
+
+  TestInterfaceImpl* servers[3] = { nullptr, nullptr, nullptr };
+  uint connectCounts[3] = { 0, 0, 0 };
+  // Backend `i`'s servers have generations 10*i, 10*i + 1, ...
+
+  bool delayReconnects = false;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> pendingReconnect;
+
+  test::TestInterface::Client client = loadBalancedAutoReconnect(3,
+      [this](uint index) -> test::TestInterface::Client {
+    auto server = kj::heap<TestInterfaceImpl>(index * 10 + connectCounts[index]++);
+    servers[index] = server;
+    test::TestInterface::Client result(kj::mv(server));
+    if (delayReconnects && connectCounts[index] > 1) {
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      pendingReconnect = kj::mv(paf.fulfiller);
+      return paf.promise.then([result = kj::mv(result)]() mutable { return kj::mv(result); });
+    }
+    return result;
+  });
+
+  RemotePromise<test::TestInterface::FooResults> call(uint i) {
+    auto req = client.fooRequest();
+    req.setI(i);
+    return req.send();
+  }
+
+  kj::String callAndWait(uint i) {
+    return kj::str(call(i).wait(ws).getX());
+  }
+};
+
+KJ_TEST("loadBalancedAutoReconnect() spreads calls by outstanding requests") {
+  LoadBalancingTestContext context;
+  auto& ws = context.ws;
+  KJ_EXPECT(context.connectCounts[0] == 1);
+  KJ_EXPECT(context.connectCounts[1] == 1);
+  KJ_EXPECT(context.connectCounts[2] == 1);
+
+  // With every backend blocked, calls are spread evenly.
+  {
+    kj::Own<kj::PromiseFulfiller<void>> fulfillers[3];
+    for (auto i: kj::zeroTo(3)) {
+      fulfillers[i] = context.servers[i]->block();
+    }
+
+    kj::Vector<RemotePromise<test::TestInterface::FooResults>> promises;
+    for (auto i: kj::zeroTo(6)) {
+      promises.add(context.call(i));
+    }
+    for (auto& promise: promises) {
+      KJ_EXPECT(!promise.poll(ws));
+    }
+    for (auto& fulfiller: fulfillers) {
+      fulfiller->fulfill();
+    }
+
+    uint counts[3] = { 0, 0, 0 };
+    for (auto& promise: promises) {
+      auto x = promise.wait(ws).getX();
+      for (auto i: kj::zeroTo(3)) {
+        if (x.endsWith(kj::str(' ', i * 10))) ++counts[i];
+      }
+    }
+    KJ_EXPECT(counts[0] == 2);
+    KJ_EXPECT(counts[1] == 2);
+    KJ_EXPECT(counts[2] == 2);
+  }
+
+  // A backend that's stuck on a call gets no more of them.
+  auto fulfiller = context.servers[0]->block();
+  kj::Vector<RemotePromise<test::TestInterface::FooResults>> stuck;
+  for (auto i: kj::zeroTo(3)) {
+    stuck.add(context.call(i));
+  }
+  ws.poll();
+  for (auto i: kj::zeroTo(10)) {
+    auto x = context.callAndWait(i);
+    KJ_EXPECT(!x.endsWith(" 0"), x);
+  }
+  fulfiller->fulfill();
+  for (auto& promise: stuck) {
+    promise.wait(ws);
+  }
+}
+
+KJ_TEST("loadBalancedAutoReconnect() avoids a backend while it reconnects") {
+  LoadBalancingTestContext context;
+  auto& ws = context.ws;
+  context.delayReconnects = true;
+  ws.poll();
+
+  // Keep backends 0 and 2 busy, so that the next call goes to backend 1, which has gone away.
+  auto fulfiller0 = context.servers[0]->block();
+  auto fulfiller2 = context.servers[2]->block();
+  kj::Vector<RemotePromise<test::TestInterface::FooResults>> busy;
+  auto keepBusy = [&]() {
+    for (auto i = 0; busy.size() < 2; i++) {
+      KJ_ASSERT(i < 10);
+      auto promise = context.call(100);
+      if (promise.poll(ws)) {
+        auto x = promise.wait(ws).getX();
+        KJ_EXPECT(x.endsWith(" 10") || x.endsWith(" 11"), x);
+      } else {
+        busy.add(kj::mv(promise));
+      }
+    }
+  };
+  keepBusy();
+
+  context.servers[1]->setError(KJ_EXCEPTION(DISCONNECTED, "backend 1 restarting"));
+  KJ_EXPECT_THROW_RECOVERABLE_MESSAGE("backend 1 restarting", context.call(1).wait(ws));
+
+  // Backend 1 was reconnected right away, but until it has resolved, backends 0 and 2 are
+  // preferred even though they're busy.
+  KJ_EXPECT(context.connectCounts[1] == 2);
+  auto waiting = context.call(3);
+  KJ_EXPECT(!waiting.poll(ws));
+
+  KJ_ASSERT_NONNULL(context.pendingReconnect)->fulfill();
+  ws.poll();
+  fulfiller0->fulfill();
+  fulfiller2->fulfill();
+  for (auto& promise: busy) {
+    promise.wait(ws);
+  }
+  busy.clear();
+  auto x = waiting.wait(ws).getX();
+  KJ_EXPECT(x == "3 false 0" || x == "3 false 20", x);
+
+  // Now it's back.
+  fulfiller0 = context.servers[0]->block();
+  fulfiller2 = context.servers[2]->block();
+  keepBusy();
+  KJ_EXPECT(context.callAndWait(4) == "4 false 11");
+  fulfiller0->fulfill();
+  fulfiller2->fulfill();
+}
+
 }  // namespace
 }  // namespace _
 }  // namespace capnp
@@ -20,6 +20,7 @@
 // THE SOFTWARE.
 
 #include "reconnect.h"
+#include <kj/debug.h>
 
 namespace capnp {
 
@@ -123,12 +124,188 @@ private:
       return nullptr;
     }
 
+    void setDeadline(kj::TimePoint deadline) override {
+      inner->setDeadline(deadline);
+    }
+
   private:
     kj::Own<ReconnectHook> parent;
     kj::Own<RequestHook> inner;
   };
 };
 
+class LoadBalancingHook final: public ClientHook, public kj::Refcounted {
+public:
+  LoadBalancingHook(uint poolSize, kj::Function<Capability::Client(uint)> connectParam)
+      : connect(kj::mv(connectParam)),
+        backends(kj::heapArray<Backend>(poolSize)) {
+    KJ_REQUIRE(poolSize > 0, "pool must contain at least one backend");
+    for (auto i: kj::indices(backends)) {
+      reconnect(i);
+    }
+  }
+
+  Request<AnyPointer, AnyPointer> newCall(
+      uint64_t interfaceId, uint16_t methodId, kj::Maybe<MessageSize> sizeHint) override {
+    uint index = choose();
+    auto result = backends[index].current->newCall(interfaceId, methodId, sizeHint);
+    AnyPointer::Builder builder = result;
+    auto hook = kj::heap<RequestImpl>(kj::addRef(*this), index,
+                                      RequestHook::from(kj::mv(result)));
+    return { builder, kj::mv(hook) };
+  }
+
+  VoidPromiseAndPipeline call(uint64_t interfaceId, uint16_t methodId,
+                              kj::Own<CallContextHook>&& context) override {
+    uint index = choose();
+    auto result = backends[index].current->call(interfaceId, methodId, kj::mv(context));
+    wrap(result.promise, index);
+    return result;
+  }
+
+  kj::Maybe<ClientHook&> getResolved() override {
+    // Each call may go to a different backend, so there's nothing to resolve to.
+    return nullptr;
+  }
+
+  kj::Maybe<kj::Promise<kj::Own<ClientHook>>> whenMoreResolved() override {
+    return nullptr;
+  }
+
+  kj::Own<ClientHook> addRef() override {
+    return kj::addRef(*this);
+  }
+
+  const void* getBrand() override {
+    return nullptr;
+  }
+
+  kj::Maybe<int> getFd() override {
+    return nullptr;
+  }
+
+private:
+  enum class State {
+    READY,
+    WARMING,
+    // The capability hasn't resolved yet, e.g. because it's still connecting.
+
+    DOWN
+    // The capability failed to resolve. It's broken, and will be reconnected by the next choose().
+  };
+
+  struct Backend {
+    kj::Own<ClientHook> current;
+    State state = State::DOWN;
+    uint generation = 0;
+    uint outstanding = 0;
+    kj::Promise<void> warmTask = nullptr;
+  };
+
+  kj::Function<Capability::Client(uint)> connect;
+  kj::Array<Backend> backends;
+  uint nextIndex = 0;
+  // Where choose() starts looking, to spread calls among equally-loaded backends.
+
+  void reconnect(uint index) {
+    auto& backend = backends[index];
+    backend.generation++;
+    KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() {
+      backend.current = ClientHook::from(connect(index));
+    })) {
+      backend.current = newBrokenCap(kj::mv(*e));
+    }
+
+    backend.state = State::WARMING;
+    backend.warmTask = backend.current->whenResolved()
+        .then([this, index, generation = backend.generation]() {
+      auto& backend = backends[index];
+      if (backend.generation == generation) backend.state = State::READY;
+    }, [this, index, generation = backend.generation](kj::Exception&&) {
+      auto& backend = backends[index];
+      if (backend.generation == generation) backend.state = State::DOWN;
+    }).eagerlyEvaluate(nullptr);
+  }
+
+  uint choose() {
+    // Returns the index of the ready backend with the fewest outstanding calls, or of the warming
+    // one if none is ready.
+
+    kj::Maybe<uint> best;
+    for (auto offset: kj::indices(backends)) {
+      uint i = (nextIndex + offset) % backends.size();
+      auto& backend = backends[i];
+      if (backend.state == State::DOWN) {
+        reconnect(i);
+      }
+
+      KJ_IF_MAYBE(b, best) {
+        auto& bestBackend = backends[*b];
+        bool readier = backend.state == State::READY && bestBackend.state != State::READY;
+        bool asReady = backend.state == bestBackend.state;
+        if (readier || (asReady && backend.outstanding < bestBackend.outstanding)) {
+          best = i;
+        }
+      } else {
+        best = i;
+      }
+    }
+
+    nextIndex = (nextIndex + 1) % backends.size();
+    return KJ_ASSERT_NONNULL(best);
+  }
+
+  template <typename T>
+  void wrap(kj::Promise<T>& promise, uint index) {
+    auto& backend = backends[index];
+    ++backend.outstanding;
+    promise = promise.catch_(
+        [self = kj::addRef(*this), index, startGeneration = backend.generation]
+        (kj::Exception&& exception) mutable -> kj::Promise<T> {
+      if (exception.getType() == kj::Exception::Type::DISCONNECTED &&
+          self->backends[index].generation == startGeneration) {
+        self->reconnect(index);
+      }
+      return kj::mv(exception);
+    }).attach(kj::defer([self = kj::addRef(*this), index]() mutable {
+      --self->backends[index].outstanding;
+    })).eagerlyEvaluate(nullptr);
+    // Evaluating eagerly makes the count drop, and a disconnected backend get replaced, as soon as
+    // the call completes, even if the caller doesn't look at the result until later.
+  }
+
+  class RequestImpl final: public RequestHook {
+  public:
+    RequestImpl(kj::Own<LoadBalancingHook> parent, uint index, kj::Own<RequestHook> inner)
+        : parent(kj::mv(parent)), index(index), inner(kj::mv(inner)) {}
+
+    RemotePromise<AnyPointer> send() override {
+      auto result = inner->send();
+      parent->wrap(result, index);
+      return result;
+    }
+
+    kj::Promise<void> sendStreaming() override {
+      auto result = inner->sendStreaming();
+      parent->wrap(result, index);
+      return result;
+    }
+
+    const void* getBrand() override {
+      return nullptr;
+    }
+
+    void setDeadline(kj::TimePoint deadline) override {
+      inner->setDeadline(deadline);
+    }
+
+  private:
+    kj::Own<LoadBalancingHook> parent;
+    uint index;
+    kj::Own<RequestHook> inner;
+  };
+};
+
 }  // namespace
 
 Capability::Client autoReconnect(kj::Function<Capability::Client()> connect) {
@@ -138,4 +315,10 @@ Capability::Client autoReconnect(kj::Function<Capability::Client()> connect) {
 Capability::Client lazyAutoReconnect(kj::Function<Capability::Client()> connect) {
   return Capability::Client(kj::refcounted<ReconnectHook>(kj::mv(connect), true));
 }
+
+Capability::Client loadBalancedAutoReconnect(
+    uint poolSize, kj::Function<Capability::Client(uint)> connect) {
+  return Capability::Client(kj::refcounted<LoadBalancingHook>(poolSize, kj::mv(connect)));
+}
+
 }  // namespace capnp
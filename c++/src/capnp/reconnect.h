@@ -58,6 +58,28 @@ auto lazyAutoReconnect(ConnectFunc&& connect);
 // time the capability is used. Note that only the initial connection is lazy -- upon
 // disconnected errors this will still reconnect eagerly.
 
+template <typename ConnectFunc>
+auto loadBalancedAutoReconnect(uint poolSize, ConnectFunc&& connect);
+// Creates a capability that spreads calls over a pool of `poolSize` backend capabilities, each of
+// which reconstructs itself when it becomes disconnected, like autoReconnect().
+//
+// `connect(index)` is invoked with each index in [0, poolSize) to construct the pool's backends,
+// and invoked again with the same index whenever that backend is found to be disconnected. It
+// might, for example, connect to the index'th of several addresses serving the same service.
+//
+// Each call goes to the backend with the fewest calls outstanding, so a backend that is slow
+// quickly stops receiving new calls until it catches up. A disconnected backend is replaced
+// right away rather than on next use, and receives no calls until its replacement has resolved
+// (e.g. until the new connection's bootstrap returns) unless no other backend is available. If
+// the replacement fails to resolve, the next call made on the pool tries again.
+//
+// As with autoReconnect(), calls in-flight when their backend disconnects fail with DISCONNECTED,
+// and should be retried.
+//
+// Consecutive calls may be delivered to different backends, so calls on the returned capability
+// are NOT delivered in order (nor are streaming calls flow-controlled together). Use this only
+// for services whose backends are interchangeable and whose calls are independent of each other.
+
 // =======================================================================================
 // inline implementation details
 
@@ -75,6 +97,15 @@ auto lazyAutoReconnect(ConnectFunc&& connect) {
       .castAs<FromClient<kj::Decay<decltype(connect())>>>();
 }
 
+Capability::Client loadBalancedAutoReconnect(
+    uint poolSize, kj::Function<Capability::Client(uint)> connect);
+template <typename ConnectFunc>
+auto loadBalancedAutoReconnect(uint poolSize, ConnectFunc&& connect) {
+  return loadBalancedAutoReconnect(poolSize,
+      kj::Function<Capability::Client(uint)>(kj::fwd<ConnectFunc>(connect)))
+      .castAs<FromClient<kj::Decay<decltype(connect(0u))>>>();
+}
+
 }  // namespace capnp
 
 CAPNP_END_HEADER
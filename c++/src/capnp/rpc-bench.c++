@@ -0,0 +1,90 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "rpc-twoparty.h"
+#include "test-util.h"
+#include <kj/benchmark.h>
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+KJ_BENCHMARK("RpcSystem round trip over kj::newTwoWayPipe()") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  int callCount = 0;
+  TwoPartyClient client(*pipe.ends[0]);
+  TwoPartyClient server(*pipe.ends[1], kj::heap<TestInterfaceImpl>(callCount),
+                        rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap().castAs<test::TestInterface>();
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    kj::doNotOptimizeAway(req.send().wait(waitScope).getX().size());
+  }
+}
+
+KJ_BENCHMARK("RpcSystem 100 pipelined calls over kj::newTwoWayPipe()") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  int callCount = 0;
+  TwoPartyClient client(*pipe.ends[0]);
+  TwoPartyClient server(*pipe.ends[1], kj::heap<TestInterfaceImpl>(callCount),
+                        rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap().castAs<test::TestInterface>();
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    auto promises = kj::heapArrayBuilder<kj::Promise<void>>(100);
+    for (uint j = 0; j < 100; j++) {
+      auto req = cap.fooRequest();
+      req.setI(123);
+      req.setJ(true);
+      promises.add(req.send().ignoreResult());
+    }
+    kj::joinPromises(promises.finish()).wait(waitScope);
+  }
+}
+
+KJ_BENCHMARK("local capability call") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+
+  int callCount = 0;
+  test::TestInterface::Client cap = kj::heap<TestInterfaceImpl>(callCount);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    kj::doNotOptimizeAway(req.send().wait(waitScope).getX().size());
+  }
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
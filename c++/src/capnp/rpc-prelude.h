@@ -34,6 +34,8 @@ namespace capnp {
 class OutgoingRpcMessage;
 class IncomingRpcMessage;
 class RpcFlowController;
+struct RpcConnectionStats;
+class RpcCallLimiter;
 
 template <typename SturdyRefHostId>
 class RpcSystem;
@@ -59,6 +61,15 @@ public:
     virtual kj::Promise<void> shutdown() = 0;
     virtual AnyStruct::Reader baseGetPeerVatId() = 0;
     virtual kj::Own<RpcFlowController> newStream() = 0;
+
+    virtual bool baseCanIntroduceTo(Connection& other) = 0;
+    virtual void baseIntroduceTo(Connection& recipient, AnyPointer::Builder sendToRecipient,
+                                 AnyPointer::Builder sendToTarget) = 0;
+    virtual kj::Maybe<kj::Own<Connection>> baseConnectToIntroduced(
+        AnyPointer::Reader capId, AnyPointer::Builder provisionId) = 0;
+    virtual kj::Promise<void> baseProvide(AnyPointer::Reader recipientId,
+                                          Capability::Client cap) = 0;
+    virtual kj::Promise<Capability::Client> basePickUp(AnyPointer::Reader provisionId) = 0;
   };
   virtual kj::Maybe<kj::Own<Connection>> baseConnect(AnyStruct::Reader vatId) = 0;
   virtual kj::Promise<kj::Own<Connection>> baseAccept() = 0;
@@ -96,6 +107,8 @@ private:
   Capability::Client baseBootstrap(AnyStruct::Reader vatId);
   Capability::Client baseRestore(AnyStruct::Reader vatId, AnyPointer::Reader objectId);
   void baseSetFlowLimit(size_t words);
+  void baseSetCallLimit(size_t maxCalls, kj::Maybe<kj::Own<RpcCallLimiter>> sharedLimiter);
+  kj::Array<RpcConnectionStats> baseGetConnectionStats();
 
   template <typename>
   friend class capnp::RpcSystem;
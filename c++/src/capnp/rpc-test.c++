@@ -27,6 +27,7 @@
 #include "serialize.h"
 #include "kj/debug.h"
 #include "kj/string-tree.h"
+#include "kj/timer.h"
 #include "kj/compat/gtest.h"
 #include "capnp/rpc.capnp.h"
 #include <map>
@@ -188,6 +189,11 @@ public:
 
   RpcDumper dumper;
 
+  bool allowIntroductions = false;
+  // If true, connections can introduce vats to each other for three-party handoff.
+
+  uint64_t nextNonce = 0;
+
 private:
   std::map<kj::StringPtr, kj::Own<TestNetworkAdapter>> map;
 };
@@ -216,6 +222,18 @@ public:
     sendCallback = kj::mv(callback);
   }
 
+  void holdMessagesTo(kj::StringPtr peer) {
+    // Until releaseMessages() is called, messages sent to `peer` are queued rather than delivered,
+    // as if that link were very slow.
+    heldPeer = kj::heapString(peer);
+  }
+
+  void releaseMessages() {
+    heldPeer = nullptr;
+    for (auto& deliver: heldMessages) deliver();
+    heldMessages.clear();
+  }
+
   typedef TestNetworkAdapterBase::Connection Connection;
 
   class ConnectionImpl final
@@ -288,27 +306,45 @@ public:
         auto incomingMessage = kj::heap<IncomingRpcMessageImpl>(messageToFlatArray(message));
 
         auto connectionPtr = &connection;
-        connection.tasks->add(kj::evalLater(kj::mvCapture(incomingMessage,
-            [connectionPtr](kj::Own<IncomingRpcMessageImpl>&& message) {
-          KJ_IF_MAYBE(p, connectionPtr->partner) {
-            if (p->fulfillers.empty()) {
-              p->messages.push(kj::mv(message));
-            } else {
-              ++p->network.received;
-              p->fulfillers.front()->fulfill(
-                  kj::Own<IncomingRpcMessage>(kj::mv(message)));
-              p->fulfillers.pop();
+        auto deliver = [connectionPtr,incomingMessage = kj::mv(incomingMessage)]() mutable {
+          if (connectionPtr->networkException != nullptr) return;
+
+          connectionPtr->tasks->add(kj::evalLater(kj::mvCapture(incomingMessage,
+              [connectionPtr](kj::Own<IncomingRpcMessageImpl>&& message) {
+            KJ_IF_MAYBE(p, connectionPtr->partner) {
+              if (p->fulfillers.empty()) {
+                p->messages.push(kj::mv(message));
+              } else {
+                ++p->network.received;
+                p->fulfillers.front()->fulfill(
+                    kj::Own<IncomingRpcMessage>(kj::mv(message)));
+                p->fulfillers.pop();
+              }
             }
+          })));
+        };
+
+        KJ_IF_MAYBE(peer, connection.network.heldPeer) {
+          if (*peer == connection.getPeerName()) {
+            connection.network.heldMessages.add(kj::mv(deliver));
+            return;
           }
-        })));
+        }
+        deliver();
       }
 
       size_t sizeInWords() override {
         return message.sizeInWords();
       }
 
+      bool attach(kj::Own<void>&& owner) override {
+        attachments.add(kj::mv(owner));
+        return true;
+      }
+
     private:
       ConnectionImpl& connection;
+      kj::Vector<kj::Own<void>> attachments;
       MallocMessageBuilder message;
     };
 
@@ -320,6 +356,50 @@ public:
     kj::Own<OutgoingRpcMessage> newOutgoingMessage(uint firstSegmentWordSize) override {
       return kj::heap<OutgoingRpcMessageImpl>(*this, firstSegmentWordSize);
     }
+
+    kj::StringPtr getPeerName() {
+      return KJ_ASSERT_NONNULL(partner).network.self;
+    }
+
+    bool canIntroduceTo(Connection& other) override {
+      return network.network.allowIntroductions;
+    }
+
+    void introduceTo(Connection& recipient,
+                     test::TestThirdPartyCapId::Builder sendToRecipient,
+                     test::TestRecipientId::Builder sendToTarget) override {
+      uint64_t nonce = network.network.nextNonce++;
+      sendToRecipient.setHost(getPeerName());
+      sendToRecipient.setNonce(nonce);
+      sendToTarget.setRecipient(kj::downcast<ConnectionImpl>(recipient).getPeerName());
+      sendToTarget.setNonce(nonce);
+    }
+
+    kj::Maybe<kj::Own<Connection>> connectToIntroduced(
+        test::TestThirdPartyCapId::Reader capId,
+        test::TestProvisionId::Builder provisionId) override {
+      provisionId.setIntroducer(getPeerName());
+      provisionId.setNonce(capId.getNonce());
+
+      MallocMessageBuilder message;
+      auto hostId = message.initRoot<test::TestSturdyRefHostId>();
+      hostId.setHost(capId.getHost());
+      return network.connect(hostId);
+    }
+
+    kj::Promise<void> provide(test::TestRecipientId::Reader recipientId,
+                              Capability::Client cap) override {
+      // Our peer is the introducer.
+      return network.provide(
+          kj::str(getPeerName(), '/', recipientId.getRecipient(), '/', recipientId.getNonce()),
+          kj::mv(cap));
+    }
+
+    kj::Promise<Capability::Client> pickUp(test::TestProvisionId::Reader provisionId) override {
+      // Our peer is the recipient.
+      return network.pickUp(
+          kj::str(provisionId.getIntroducer(), '/', getPeerName(), '/', provisionId.getNonce()));
+    }
     kj::Promise<kj::Maybe<kj::Own<IncomingRpcMessage>>> receiveIncomingMessage() override {
       KJ_IF_MAYBE(e, networkException) {
         return kj::cp(*e);
@@ -416,11 +496,58 @@ private:
   uint sent = 0;
   uint received = 0;
 
+  struct Provision {
+    kj::Maybe<Capability::Client> cap;
+    kj::Own<kj::PromiseFulfiller<void>> provided;
+    // Set by provide() if it came first.
+
+    kj::Own<kj::PromiseFulfiller<Capability::Client>> pickedUp;
+    // Set by pickUp() if it came first.
+  };
+  std::map<kj::String, Provision> provisions;
+  // Capabilities provided for, or awaited by, introduced vats. Keyed by
+  // "introducer/recipient/nonce".
+
+  kj::Promise<void> provide(kj::String key, Capability::Client cap) {
+    auto iter = provisions.find(key);
+    if (iter != provisions.end()) {
+      iter->second.pickedUp->fulfill(kj::mv(cap));
+      provisions.erase(iter);
+      return kj::READY_NOW;
+    }
+
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    auto& provision = provisions[kj::heapString(key)];
+    provision.cap = kj::mv(cap);
+    provision.provided = kj::mv(paf.fulfiller);
+    return paf.promise.attach(kj::defer([this,key=kj::mv(key)]() {
+      // Canceled, or already picked up.
+      provisions.erase(key);
+    }));
+  }
+
+  kj::Promise<Capability::Client> pickUp(kj::String key) {
+    auto iter = provisions.find(key);
+    if (iter != provisions.end()) {
+      auto cap = KJ_ASSERT_NONNULL(kj::mv(iter->second.cap));
+      iter->second.provided->fulfill();
+      provisions.erase(iter);
+      return kj::mv(cap);
+    }
+
+    auto paf = kj::newPromiseAndFulfiller<Capability::Client>();
+    provisions[kj::mv(key)].pickedUp = kj::mv(paf.fulfiller);
+    return kj::mv(paf.promise);
+  }
+
   std::map<const TestNetworkAdapter*, kj::Own<ConnectionImpl>> connections;
   std::queue<kj::Own<kj::PromiseFulfiller<kj::Own<Connection>>>> fulfillerQueue;
   std::queue<kj::Own<Connection>> connectionQueue;
 
   kj::Function<bool(MessageBuilder& message)> sendCallback = [](MessageBuilder&) { return true; };
+
+  kj::Maybe<kj::String> heldPeer;
+  kj::Vector<kj::Function<void()>> heldMessages;
 };
 
 TestNetwork::~TestNetwork() noexcept(false) {}
@@ -530,6 +657,111 @@ TEST(Rpc, Basic) {
   EXPECT_TRUE(barFailed);
 }
 
+KJ_TEST("RpcSystem::getConnectionStats()") {
+  TestContext context;
+
+  KJ_EXPECT(context.rpcClient.getConnectionStats().size() == 0);
+
+  auto client = context.connect(test::TestSturdyRefObjectId::Tag::TEST_INTERFACE)
+      .castAs<test::TestInterface>();
+
+  auto request = client.fooRequest();
+  request.setI(123);
+  request.setJ(true);
+  auto promise = request.send();
+
+  // Let the restore and the call reach the server, but the server hasn't seen a Finish yet.
+  context.waitScope.poll();
+
+  {
+    auto stats = context.rpcClient.getConnectionStats();
+    KJ_ASSERT(stats.size() == 1);
+    KJ_EXPECT(stats[0].messagesSent[rpc::Message::CALL] == 1);
+    KJ_EXPECT(stats[0].messagesSent[rpc::Message::BOOTSTRAP] == 1);
+    KJ_EXPECT(stats[0].questions >= 1);
+  }
+
+  auto response = promise.wait(context.waitScope);
+  KJ_EXPECT(response.getX() == "foo");
+
+  {
+    auto stats = context.rpcServer.getConnectionStats();
+    KJ_ASSERT(stats.size() == 1);
+    KJ_EXPECT(stats[0].messagesReceived[rpc::Message::BOOTSTRAP] == 1);
+    KJ_EXPECT(stats[0].messagesReceived[rpc::Message::CALL] == 1);
+    KJ_EXPECT(stats[0].messagesSent[rpc::Message::RETURN] == 2);
+    KJ_EXPECT(stats[0].exports == 1);
+  }
+
+  {
+    auto stats = context.rpcClient.getConnectionStats();
+    KJ_ASSERT(stats.size() == 1);
+    KJ_EXPECT(stats[0].messagesReceived[rpc::Message::RETURN] == 2);
+    KJ_EXPECT(stats[0].imports == 1);
+  }
+}
+
+KJ_TEST("Finish and Release messages are coalesced into BulkRelease") {
+  TestContext context;
+
+  auto client = context.connect(test::TestSturdyRefObjectId::Tag::TEST_MORE_STUFF)
+      .castAs<test::TestMoreStuff>();
+
+  auto fetchHandles = [&](uint count) {
+    kj::Vector<test::TestHandle::Client> handles;
+    for (auto i KJ_UNUSED: kj::zeroTo(count)) {
+      handles.add(client.getHandleRequest().send().wait(context.waitScope).getHandle());
+    }
+    KJ_EXPECT(context.restorer.handleCount == count);
+    return handles;
+  };
+
+  auto sent = [&](rpc::Message::Which type) {
+    auto stats = context.rpcClient.getConnectionStats();
+    KJ_ASSERT(stats.size() == 1);
+    return stats[0].messagesSent[type];
+  };
+
+  // The first time several handles are dropped together, the client sends them individually and
+  // advertises BulkRelease; the server advertises back.
+  fetchHandles(10).clear();
+  context.waitScope.poll();
+  KJ_EXPECT(context.restorer.handleCount == 0);
+  KJ_EXPECT(sent(rpc::Message::RELEASE) == 10);
+  KJ_EXPECT(sent(rpc::Message::BULK_RELEASE) == 1);
+
+  // From then on, a turn's worth of releases goes out as one message.
+  fetchHandles(10).clear();
+  context.waitScope.poll();
+  KJ_EXPECT(context.restorer.handleCount == 0);
+  KJ_EXPECT(sent(rpc::Message::RELEASE) == 10);
+  KJ_EXPECT(sent(rpc::Message::BULK_RELEASE) == 2);
+
+  // Finishes too.
+  {
+    auto finishesBefore = sent(rpc::Message::FINISH);
+    kj::Vector<kj::Promise<void>> calls;
+    for (auto i KJ_UNUSED: kj::zeroTo(5)) {
+      calls.add(client.getCallSequenceRequest().send().ignoreResult());
+    }
+    kj::joinPromises(calls.releaseAsArray()).wait(context.waitScope);
+    context.waitScope.poll();
+    KJ_EXPECT(sent(rpc::Message::FINISH) == finishesBefore);
+    KJ_EXPECT(sent(rpc::Message::BULK_RELEASE) == 3);
+  }
+
+  // Releases are never reordered after later messages.
+  {
+    auto handles = fetchHandles(3);
+    handles.clear();
+    auto request = client.getHandleRequest();
+    auto promise = request.send();
+    KJ_EXPECT(sent(rpc::Message::BULK_RELEASE) == 4);
+    auto response = promise.wait(context.waitScope);
+    KJ_EXPECT(context.restorer.handleCount == 1);
+  }
+}
+
 TEST(Rpc, Pipelining) {
   TestContext context;
 
@@ -908,7 +1140,9 @@ TEST(Rpc, RetainAndRelease) {
       auto capCopy = client.getHeldRequest().send().wait(context.waitScope).getCap();
 
       {
-        // And call it, without any network communications.
+        // And call it, without any network communications. (First let the `Finish` for
+        // getHeld(), which is queued until the end of the turn, go out.)
+        context.waitScope.poll();
         uint oldSentCount = context.clientNetwork.getSentCount();
         auto request = capCopy.fooRequest();
         request.setI(123);
@@ -1288,6 +1522,54 @@ KJ_TEST("loopback bootstrap()") {
   KJ_EXPECT(callCount == 1);
 }
 
+class DeadlineRecordingImpl final: public test::TestInterface::Server {
+public:
+  uint callCount = 0;
+  kj::Maybe<kj::TimePoint> deadline;
+
+  kj::Promise<void> foo(FooContext context) override {
+    ++callCount;
+    deadline = context.getDeadline();
+    return kj::READY_NOW;
+  }
+};
+
+KJ_TEST("call deadlines are sent over RPC") {
+  auto server = kj::heap<DeadlineRecordingImpl>();
+  auto& serverRef = *server;
+
+  MallocMessageBuilder hostIdBuilder;
+  auto hostId = hostIdBuilder.getRoot<test::TestSturdyRefHostId>();
+  hostId.setHost("server");
+
+  TestContext context(test::TestInterface::Client(kj::mv(server)));
+  auto client = context.rpcServer.bootstrap(hostId).castAs<test::TestInterface>();
+
+  client.fooRequest().send().wait(context.waitScope);
+  KJ_EXPECT(serverRef.deadline == nullptr);
+
+  // The deadline goes over the wire as a relative timeout, so the server's idea of it is later
+  // than ours by however long the message took to arrive.
+  auto deadline = kj::systemPreciseMonotonicClock().now() + 1 * kj::HOURS;
+  auto request = client.fooRequest();
+  request.setDeadline(deadline);
+  request.send().wait(context.waitScope);
+  auto received = KJ_ASSERT_NONNULL(serverRef.deadline);
+  KJ_EXPECT(received >= deadline);
+  KJ_EXPECT(received < deadline + 1 * kj::MINUTES);
+
+  // A call sent after its deadline is shed by the server.
+  request = client.fooRequest();
+  request.setDeadline(kj::systemPreciseMonotonicClock().now() - 1 * kj::SECONDS);
+  auto promise = request.send();
+  KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() { promise.wait(context.waitScope); })) {
+    KJ_EXPECT(e->getType() == kj::Exception::Type::OVERLOADED);
+  } else {
+    KJ_FAIL_EXPECT("expected call to be shed");
+  }
+  KJ_EXPECT(serverRef.callCount == 2);
+}
+
 KJ_TEST("method throws exception") {
   TestContext context;
 
@@ -1542,6 +1824,222 @@ KJ_TEST("export the same promise twice") {
   KJ_EXPECT(callCount == 3);
 }
 
+struct ThreePartyContext {
+  // Alice hosts a TestInterface (unless given some other bootstrap capability), Bob's bootstrap
+  // capability is Alice's, and Carol gets it from Bob.
+
+  kj::EventLoop loop;
+  kj::WaitScope waitScope;
+  TestNetwork network;
+  int callCount = 0;
+  TestNetworkAdapter& aliceNetwork;
+  TestNetworkAdapter& bobNetwork;
+  TestNetworkAdapter& carolNetwork;
+  kj::Own<kj::PromiseFulfiller<Capability::Client>> bobBootstrapFulfiller;
+  RpcSystem<test::TestSturdyRefHostId> alice;
+  RpcSystem<test::TestSturdyRefHostId> bob;
+  RpcSystem<test::TestSturdyRefHostId> carol;
+
+  ThreePartyContext(bool allowIntroductions,
+                    kj::Maybe<Capability::Client> aliceBootstrap = nullptr)
+      : waitScope(loop),
+        aliceNetwork(network.add("alice")),
+        bobNetwork(network.add("bob")),
+        carolNetwork(network.add("carol")),
+        alice(makeRpcServer(aliceNetwork, kj::mv(aliceBootstrap)
+            .orDefault(kj::heap<TestInterfaceImpl>(callCount)))),
+        bob(makeRpcServer(bobNetwork, newBobBootstrap())),
+        carol(makeRpcClient(carolNetwork)) {
+    network.allowIntroductions = allowIntroductions;
+
+    // Bob needs to have Alice's capability in hand before handing it off.
+    auto aliceCap = bootstrap(bob, "alice");
+    aliceCap.whenResolved().wait(waitScope);
+    bobBootstrapFulfiller->fulfill(kj::mv(aliceCap));
+  }
+
+  Capability::Client newBobBootstrap() {
+    auto paf = kj::newPromiseAndFulfiller<Capability::Client>();
+    bobBootstrapFulfiller = kj::mv(paf.fulfiller);
+    return kj::mv(paf.promise);
+  }
+
+  test::TestInterface::Client bootstrap(RpcSystem<test::TestSturdyRefHostId>& system,
+                                        kj::StringPtr host) {
+    MallocMessageBuilder message;
+    auto hostId = message.initRoot<test::TestSturdyRefHostId>();
+    hostId.setHost(host);
+    return system.bootstrap(hostId).castAs<test::TestInterface>();
+  }
+};
+
+KJ_TEST("three-party handoff") {
+  ThreePartyContext context(true);
+  auto cap = context.bootstrap(context.carol, "bob");
+
+  // Resolve before calling; otherwise Carol keeps using the vine to keep the calls in order.
+  cap.whenResolved().wait(context.waitScope);
+
+  auto call = [&]() {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    KJ_EXPECT(req.send().wait(context.waitScope).getX() == "foo");
+  };
+
+  call();
+  KJ_EXPECT(context.callCount == 1);
+
+  // Carol now talks to Alice directly.
+  uint bobSent = context.bobNetwork.getSentCount();
+  call();
+  call();
+  KJ_EXPECT(context.callCount == 3);
+  KJ_EXPECT(context.bobNetwork.getSentCount() == bobSent);
+}
+
+KJ_TEST("three-party handoff falls back to the vine") {
+  ThreePartyContext context(false);
+  auto cap = context.bootstrap(context.carol, "bob");
+
+  auto call = [&]() {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    KJ_EXPECT(req.send().wait(context.waitScope).getX() == "foo");
+  };
+
+  call();
+  uint bobSent = context.bobNetwork.getSentCount();
+  call();
+  KJ_EXPECT(context.callCount == 2);
+  KJ_EXPECT(context.bobNetwork.getSentCount() > bobSent);
+}
+
+KJ_TEST("three-party handoff keeps calls made before the handoff in order") {
+  ThreePartyContext context(true, test::TestCallOrder::Client(kj::heap<TestCallOrderImpl>()));
+
+  // Bob's link to Alice is slow, so the calls he forwards take a while to get there.
+  context.bobNetwork.holdMessagesTo("alice");
+
+  // These go to Bob before Carol learns that the capability is Alice's.
+  auto cap = context.bootstrap(context.carol, "bob").castAs<test::TestCallOrder>();
+  auto call0 = getCallSequence(cap, 0);
+  auto call1 = getCallSequence(cap, 1);
+
+  // Let Carol receive Bob's answer, which hands the capability off to her.
+  context.waitScope.poll();
+
+  // Carol must keep going through Bob, or these could overtake the calls above.
+  uint bobSent = context.bobNetwork.getSentCount();
+  auto call2 = getCallSequence(cap, 2);
+  auto call3 = getCallSequence(cap, 3);
+  context.waitScope.poll();
+  context.bobNetwork.releaseMessages();
+
+  KJ_EXPECT(call0.wait(context.waitScope).getN() == 0);
+  KJ_EXPECT(call1.wait(context.waitScope).getN() == 1);
+  KJ_EXPECT(call2.wait(context.waitScope).getN() == 2);
+  KJ_EXPECT(call3.wait(context.waitScope).getN() == 3);
+  KJ_EXPECT(context.bobNetwork.getSentCount() > bobSent);
+}
+
+KJ_TEST("forwarded calls reference the params rather than copying them") {
+  ThreePartyContext context(false);
+  auto cap = context.bootstrap(context.carol, "bob");
+  cap.whenResolved().wait(context.waitScope);
+
+  size_t callSegments = 0;
+  context.bobNetwork.onSend([&](MessageBuilder& message) {
+    if (message.getRoot<rpc::Message>().isCall()) {
+      callSegments = message.getSegmentsForOutput().size();
+    }
+    return true;
+  });
+
+  auto req = cap.bazRequest();
+  initTestMessage(req.initS());
+  req.send().wait(context.waitScope);
+  KJ_EXPECT(context.callCount == 1);
+
+  // Bob's Call to Alice borrows the params from the Call he received, as a second segment.
+  KJ_EXPECT(callSegments == 2);
+}
+
+class SizedMessage final: public OutgoingRpcMessage {
+public:
+  SizedMessage(size_t bytes): words(bytes / sizeof(word)) {}
+
+  AnyPointer::Builder getBody() override { KJ_UNIMPLEMENTED("not needed"); }
+  void send() override {}
+  size_t sizeInWords() override { return words; }
+
+private:
+  size_t words;
+};
+
+size_t simulateStream(double bytesPerSecond, kj::Duration rtt, size_t messageSize) {
+  // Streams over a simulated link with the given bottleneck bandwidth and base round trip time
+  // for a while, and returns how many bytes were in flight when the adaptive controller applied
+  // backpressure at the end.
+
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  kj::TimerImpl clock(kj::origin<kj::TimePoint>());
+  auto controller = RpcFlowController::newAdaptiveWindowController(clock);
+
+  struct InFlight {
+    kj::TimePoint ackTime;
+    size_t size;
+    kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+  };
+  std::queue<InFlight> inFlight;
+  size_t inFlightBytes = 0;
+  kj::TimePoint linkFreeTime = clock.now();
+  auto transmitTime = int64_t(messageSize * 1e9 / bytesPerSecond) * kj::NANOSECONDS;
+
+  auto end = clock.now() + 20 * kj::SECONDS;
+  for (;;) {
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    linkFreeTime = kj::max(linkFreeTime, clock.now()) + transmitTime;
+    inFlight.push({ linkFreeTime + rtt, messageSize, kj::mv(paf.fulfiller) });
+    inFlightBytes += messageSize;
+    auto ready = controller->send(kj::heap<SizedMessage>(messageSize), kj::mv(paf.promise));
+
+    if (!ready.poll(waitScope)) {
+      if (clock.now() >= end) break;
+
+      // Deliver acks until the controller lets us continue.
+      do {
+        auto& next = inFlight.front();
+        clock.advanceTo(next.ackTime);
+        next.fulfiller->fulfill();
+        inFlightBytes -= next.size;
+        inFlight.pop();
+      } while (!ready.poll(waitScope));
+    }
+  }
+
+  return inFlightBytes;
+}
+
+KJ_TEST("adaptive flow controller fills a high bandwidth-delay link") {
+  // 100MB/s with a 50ms RTT: the bandwidth-delay product is 5MB, far beyond the default window.
+  size_t bdp = 5000000;
+  size_t inFlight = simulateStream(100e6, 50 * kj::MILLISECONDS, 65536);
+  KJ_EXPECT(inFlight > bdp, inFlight);
+  KJ_EXPECT(inFlight < bdp * 3, inFlight);
+}
+
+KJ_TEST("adaptive flow controller doesn't bloat a slow link") {
+  // 1MB/s with a 10ms RTT (plus 4ms to transmit each message): the bandwidth-delay product is
+  // 14kB, so the default window would keep about 50ms worth of data queued.
+  size_t bdp = 14000;
+  size_t inFlight = simulateStream(1e6, 10 * kj::MILLISECONDS, 4096);
+  KJ_EXPECT(inFlight < bdp * 3, inFlight);
+  KJ_EXPECT(inFlight < RpcFlowController::DEFAULT_WINDOW_SIZE, inFlight);
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -903,6 +903,372 @@ KJ_TEST("write error propagates to read error") {
   }
 }
 
+KJ_TEST("RPC over PackedMessageStream") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  // Pack every message, however small, once the sides have heard from each other.
+  PackedMessageStream clientStream(*pipe.ends[0], 0);
+  PackedMessageStream serverStream(*pipe.ends[1], 0);
+
+  TwoPartyVatNetwork clientNetwork(clientStream, rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(serverStream, rpc::twoparty::Side::SERVER);
+
+  int callCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestInterfaceImpl>(callCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestInterface>();
+  for (auto i: kj::zeroTo(3)) {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    auto resp = req.send().wait(waitScope);
+    KJ_EXPECT(resp.getX() == "foo");
+    KJ_EXPECT(callCount == i + 1);
+  }
+
+  KJ_EXPECT(clientStream.isPeerPacking());
+  KJ_EXPECT(serverStream.isPeerPacking());
+}
+
+class CountingMessageStream final: public MessageStream {
+  // Counts the writes made to the wrapped stream.
+public:
+  explicit CountingMessageStream(kj::AsyncIoStream& stream): inner(stream) {}
+
+  kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
+      kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
+      ReaderOptions options = ReaderOptions(), kj::ArrayPtr<word> scratchSpace = nullptr) override {
+    return inner.tryReadMessage(fdSpace, options, scratchSpace);
+  }
+  kj::Promise<void> writeMessage(
+      kj::ArrayPtr<const int> fds,
+      kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) override {
+    ++writes;
+    ++messages;
+    return inner.writeMessage(fds, segments);
+  }
+  kj::Promise<void> writeMessages(
+      kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> batch) override {
+    ++writes;
+    messages += batch.size();
+    return inner.writeMessages(batch);
+  }
+  kj::Maybe<int> getSendBufferSize() override { return nullptr; }
+  kj::Promise<void> end() override { return inner.end(); }
+
+  uint writes = 0;
+  uint messages = 0;
+
+private:
+  AsyncIoMessageStream inner;
+};
+
+kj::Promise<void> callFoo(test::TestInterface::Client& cap) {
+  auto req = cap.fooRequest();
+  req.setI(123);
+  req.setJ(true);
+  return req.send().then([](auto resp) {
+    KJ_EXPECT(resp.getX() == "foo");
+  });
+}
+
+KJ_TEST("messages sent in one turn are written together") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  CountingMessageStream clientStream(*pipe.ends[0]);
+  CountingMessageStream serverStream(*pipe.ends[1]);
+  TwoPartyVatNetwork clientNetwork(clientStream, rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(serverStream, rpc::twoparty::Side::SERVER);
+
+  int callCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestInterfaceImpl>(callCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestInterface>();
+  callFoo(cap).wait(waitScope);
+
+  uint writesBefore = clientStream.writes;
+  uint messagesBefore = clientStream.messages;
+  auto promises = kj::heapArrayBuilder<kj::Promise<void>>(10);
+  for (auto i KJ_UNUSED: kj::zeroTo(10)) {
+    promises.add(callFoo(cap));
+  }
+  kj::joinPromises(promises.finish()).wait(waitScope);
+
+  // All ten calls went out in one write, and their returns came back in one, too.
+  KJ_EXPECT(callCount == 11);
+  KJ_EXPECT(clientStream.messages - messagesBefore >= 10);
+  KJ_EXPECT(clientStream.writes - writesBefore <= 2, clientStream.writes - writesBefore);
+}
+
+KJ_TEST("cork delay holds writes") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  auto pipe = kj::newTwoWayPipe();
+
+  CountingMessageStream clientStream(*pipe.ends[0]);
+  CountingMessageStream serverStream(*pipe.ends[1]);
+  TwoPartyVatNetwork clientNetwork(clientStream, rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(serverStream, rpc::twoparty::Side::SERVER);
+
+  int callCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestInterfaceImpl>(callCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestInterface>();
+  callFoo(cap).wait(waitScope);
+  waitScope.poll();  // let the call's Finish go out
+
+  clientNetwork.setCorkDelay(timer, 1 * kj::MILLISECONDS);
+
+  // Calls made on separate turns wait for the deadline set by the first one.
+  uint writesBefore = clientStream.writes;
+  auto first = callFoo(cap);
+  waitScope.poll();
+  auto second = callFoo(cap);
+  waitScope.poll();
+  KJ_EXPECT(clientStream.writes == writesBefore);
+  KJ_EXPECT(clientNetwork.getCurrentQueueCount() > 0);
+
+  timer.advanceTo(timer.now() + 1 * kj::MILLISECONDS);
+  first.wait(waitScope);
+  second.wait(waitScope);
+  KJ_EXPECT(clientStream.writes == writesBefore + 1, clientStream.writes - writesBefore);
+  KJ_EXPECT(callCount == 3);
+
+  // Reaching the byte limit releases the write early.
+  clientNetwork.setCorkDelay(timer, 1 * kj::HOURS, 1);
+  writesBefore = clientStream.writes;
+  callFoo(cap).wait(waitScope);
+  KJ_EXPECT(clientStream.writes == writesBefore + 1);
+
+  // A zero delay turns corking off.
+  clientNetwork.setCorkDelay(timer, 0 * kj::SECONDS);
+  callFoo(cap).wait(waitScope);
+  KJ_EXPECT(callCount == 5);
+}
+
+KJ_TEST("expedited messages overtake queued bulk messages") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  TwoPartyVatNetwork network(*pipe.ends[0], rpc::twoparty::Side::CLIENT);
+  AsyncIoMessageStream peer(*pipe.ends[1]);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto connection = KJ_ASSERT_NONNULL(network.connect(vatId.getRoot<rpc::twoparty::VatId>()));
+
+  auto send = [&](uint32_t i, OutgoingRpcMessage::Priority priority, uint dataSize = 0) {
+    auto message = connection->newOutgoingMessage(dataSize / sizeof(word) + 64);
+    auto root = message->getBody().initAs<test::TestAllTypes>();
+    root.setUInt32Field(i);
+    root.initDataField(dataSize);
+    message->setPriority(priority);
+    message->send();
+  };
+  auto receive = [&]() {
+    return peer.readMessage().wait(waitScope)->getRoot<test::TestAllTypes>().getUInt32Field();
+  };
+
+  using Priority = OutgoingRpcMessage::Priority;
+
+  // Eight 20k stream messages, more than go in one write.
+  for (auto i: kj::range(1u, 9u)) {
+    send(i, Priority::BULK, 20000);
+  }
+  send(100, Priority::EXPEDITED);
+
+  KJ_EXPECT(receive() == 100);
+  KJ_EXPECT(receive() == 1);
+
+  // Sent while the first write is still in progress, so this waits for it -- but not for the
+  // stream messages that didn't fit.
+  send(400, Priority::EXPEDITED);
+  send(500, Priority::NORMAL);
+
+  kj::Vector<uint32_t> order;
+  for (auto i KJ_UNUSED: kj::zeroTo(9)) {
+    order.add(receive());
+  }
+  KJ_EXPECT(kj::strArray(order, ",") == "2,3,4,400,5,6,7,8,500", kj::strArray(order, ","));
+
+  // Nothing overtakes a NORMAL message.
+  send(9, Priority::BULK, 20000);
+  send(700, Priority::NORMAL);
+  send(800, Priority::EXPEDITED);
+  KJ_EXPECT(receive() == 9);
+  KJ_EXPECT(receive() == 700);
+  KJ_EXPECT(receive() == 800);
+}
+
+KJ_TEST("TwoPartyServer admission control") {
+  auto ioContext = kj::setupAsyncIo();
+  auto& waitScope = ioContext.waitScope;
+
+  int callCount = 0;
+  int handleCount = 0;
+  TwoPartyServer::Limits limits;
+  limits.maxConnections = 2;
+  limits.maxCallsPerConnection = 2;
+  limits.maxCalls = 3;
+  TwoPartyServer server(kj::heap<TestMoreStuffImpl>(callCount, handleCount), limits);
+
+  auto& network = ioContext.provider->getNetwork();
+  auto listener = network.parseAddress("127.0.0.1").wait(waitScope)->listen();
+  auto listenPromise = server.listen(*listener);
+  auto address = network.parseAddress("127.0.0.1", listener->getPort()).wait(waitScope);
+
+  struct Client {
+    kj::Own<kj::AsyncIoStream> connection;
+    TwoPartyClient client;
+    test::TestMoreStuff::Client cap;
+
+    Client(kj::Own<kj::AsyncIoStream> connectionParam)
+        : connection(kj::mv(connectionParam)), client(*connection),
+          cap(client.bootstrap().castAs<test::TestMoreStuff>()) {}
+  };
+
+  int dummy = 0;
+  auto neverReturn = [&](Client& client) {
+    auto req = client.cap.neverReturnRequest();
+    req.setCap(kj::heap<TestInterfaceImpl>(dummy));
+    return req.send();
+  };
+  auto getCallSequence = [&](Client& client) {
+    return client.cap.getCallSequenceRequest().send();
+  };
+
+  auto client1 = kj::heap<Client>(address->connect().wait(waitScope));
+  auto client2 = kj::heap<Client>(address->connect().wait(waitScope));
+
+  // Connection 1 may have two calls in progress. A third is rejected.
+  auto hang1 = neverReturn(*client1);
+  auto hang2 = neverReturn(*client1);
+  KJ_EXPECT_THROW(OVERLOADED, getCallSequence(*client1).wait(waitScope));
+
+  // Connection 2 gets the third and last call allowed in total.
+  auto hang3 = neverReturn(*client2);
+  KJ_EXPECT_THROW(OVERLOADED, getCallSequence(*client2).wait(waitScope));
+
+  auto load = server.getLoad();
+  KJ_EXPECT(load.connections == 2);
+  KJ_EXPECT(load.callsInFlight == 3);
+  KJ_EXPECT(load.callsRejected == 2);
+
+  // Canceling a call makes room for another.
+  { auto drop = kj::mv(hang3); }
+  getCallSequence(*client2).wait(waitScope);
+  KJ_EXPECT(server.getLoad().callsInFlight == 2);
+
+  // A third connection isn't served until one of the first two goes away.
+  auto client3 = kj::heap<Client>(address->connect().wait(waitScope));
+  auto promise = getCallSequence(*client3);
+  KJ_EXPECT(!promise.poll(waitScope));
+  KJ_EXPECT(server.getLoad().connections == 2);
+
+  client2 = nullptr;
+  promise.wait(waitScope);
+  KJ_EXPECT(server.getLoad().connections == 2);
+}
+
+KJ_TEST("memory budget pauses reads") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  TwoPartyVatNetwork clientNetwork(*pipe.ends[0], rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(*pipe.ends[1], rpc::twoparty::Side::SERVER);
+  auto budget = kj::refcounted<RpcMemoryBudget>();
+  serverNetwork.setMemoryBudget(kj::addRef(*budget));
+
+  int callCount = 0;
+  int handleCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestMoreStuffImpl>(callCount, handleCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestMoreStuff>();
+  cap.getCallSequenceRequest().send().wait(waitScope);
+  KJ_EXPECT(budget->getUsed() == 0);
+
+  // A call that never returns pins its params and results.
+  int dummy = 0;
+  auto req = cap.neverReturnRequest();
+  req.setCap(kj::heap<TestInterfaceImpl>(dummy));
+  auto hang = req.send();
+  cap.getCallSequenceRequest().send().wait(waitScope);
+  KJ_EXPECT(callCount == 3);
+  KJ_EXPECT(budget->getUsed() > 0);
+  KJ_EXPECT(budget->getPeak() >= budget->getUsed());
+
+  // Over the limit, the server stops reading. (A read it had already started may complete.)
+  budget->setLimit(1);
+  auto promise1 = cap.getCallSequenceRequest().send();
+  auto promise2 = cap.getCallSequenceRequest().send();
+  KJ_EXPECT(!promise2.poll(waitScope));
+  KJ_EXPECT(callCount < 5);
+
+  // Raising the limit resumes reading.
+  budget->setLimit(kj::maxValue);
+  promise1.wait(waitScope);
+  promise2.wait(waitScope);
+  KJ_EXPECT(callCount == 5);
+}
+
+KJ_TEST("memory budget can disconnect") {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope(loop);
+  auto pipe = kj::newTwoWayPipe();
+
+  TwoPartyVatNetwork clientNetwork(*pipe.ends[0], rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(*pipe.ends[1], rpc::twoparty::Side::SERVER);
+  auto parent = kj::refcounted<RpcMemoryBudget>();
+  serverNetwork.setMemoryBudget(kj::refcounted<RpcMemoryBudget>(kj::maxValue, kj::addRef(*parent)),
+                                TwoPartyVatNetwork::OverBudget::DISCONNECT);
+
+  int callCount = 0;
+  int handleCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestMoreStuffImpl>(callCount, handleCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestMoreStuff>();
+
+  int dummy = 0;
+  auto req = cap.neverReturnRequest();
+  req.setCap(kj::heap<TestInterfaceImpl>(dummy));
+  auto hang = req.send();
+  cap.getCallSequenceRequest().send().wait(waitScope);
+  KJ_EXPECT(parent->getUsed() > 0);
+
+  // The connection's own budget is within its limit, but its parent's isn't.
+  parent->setLimit(1);
+  auto promise1 = cap.getCallSequenceRequest().send();
+  auto promise2 = cap.getCallSequenceRequest().send();
+  KJ_EXPECT_THROW_MESSAGE("exceeded its memory budget", promise2.wait(waitScope));
+}
+
 }  // namespace
 }  // namespace _
 }  // namespace capnp
@@ -87,6 +87,8 @@ MessageStream& TwoPartyVatNetwork::getStream() {
   KJ_UNREACHABLE;
 }
 
+TwoPartyVatNetwork::~TwoPartyVatNetwork() noexcept(false) {}
+
 void TwoPartyVatNetwork::FulfillerDisposer::disposeImpl(void* pointer) const {
   if (--refcount == 0) {
     fulfiller->fulfill();
@@ -119,12 +121,57 @@ kj::Promise<kj::Own<TwoPartyVatNetworkBase::Connection>> TwoPartyVatNetwork::acc
   }
 }
 
+namespace {
+
+kj::Maybe<kj::Own<RpcMemoryBudget>> addRefBudget(kj::Maybe<kj::Own<RpcMemoryBudget>>& budget) {
+  KJ_IF_MAYBE(b, budget) {
+    return kj::addRef(**b);
+  } else {
+    return nullptr;
+  }
+}
+
+class BudgetedMessageBuilder final: public PooledMessageBuilder {
+  // A PooledMessageBuilder which charges its segments to a memory budget, if any, for as long as
+  // it exists.
+
+public:
+  BudgetedMessageBuilder(MessageSegmentPool& pool, uint firstSegmentWords,
+                         kj::Maybe<kj::Own<RpcMemoryBudget>> budget)
+      : PooledMessageBuilder(pool, firstSegmentWords), budget(kj::mv(budget)) {}
+
+  ~BudgetedMessageBuilder() noexcept(false) {
+    KJ_IF_MAYBE(b, budget) {
+      b->get()->release(charged);
+    }
+  }
+
+  kj::ArrayPtr<word> allocateSegment(uint minimumSize) override {
+    auto result = PooledMessageBuilder::allocateSegment(minimumSize);
+    KJ_IF_MAYBE(b, budget) {
+      size_t bytes = result.size() * sizeof(word);
+      b->get()->charge(bytes);
+      charged += bytes;
+    }
+    return result;
+  }
+
+private:
+  kj::Maybe<kj::Own<RpcMemoryBudget>> budget;
+  size_t charged = 0;
+};
+
+}  // namespace
+
 class TwoPartyVatNetwork::OutgoingMessageImpl final
     : public OutgoingRpcMessage, public kj::Refcounted {
 public:
   OutgoingMessageImpl(TwoPartyVatNetwork& network, uint firstSegmentWordSize)
       : network(network),
-        message(firstSegmentWordSize == 0 ? SUGGESTED_FIRST_SEGMENT_WORDS : firstSegmentWordSize) {}
+        learnSize(firstSegmentWordSize == 0),
+        message(network.segmentPool,
+                learnSize ? network.outgoingSizer.suggest() : firstSegmentWordSize,
+                addRefBudget(network.memoryBudget)) {}
 
   AnyPointer::Builder getBody() override {
     return message.getRoot<AnyPointer>();
@@ -136,6 +183,10 @@ public:
     }
   }
 
+  void setPriority(Priority priority) override {
+    this->priority = priority;
+  }
+
   void send() override {
     size_t size = 0;
     for (auto& segment: message.getSegmentsForOutput()) {
@@ -148,55 +199,210 @@ public:
       return;
     }
 
-    auto sendTime = network.clock.now();
-    if (network.currentQueueCount == 0) {
-      // Optimistically set sendTime when there's no messages in the queue. Without this, sending
-      // a message after a long delay could cause getOutgoingMessageWaitTime() to return excessively
-      // long wait times if it is called during the time period after send() is called,
-      // but before the write occurs, as we increment currentQueueCount synchronously, but
-      // asynchronously update currentOutgoingMessageSendTime.
-      network.currentOutgoingMessageSendTime = sendTime;
+    KJ_ASSERT(network.previousWrite != nullptr, "already shut down");
+    if (learnSize) {
+      network.outgoingSizer.record(size);
     }
-
-    network.currentQueueSize += size * sizeof(capnp::word);
-    ++network.currentQueueCount;
-    auto deferredSizeUpdate = kj::defer([&network = network, size]() mutable {
-      network.currentQueueSize -= size * sizeof(capnp::word);
-      --network.currentQueueCount;
-    });
-
-    network.previousWrite = KJ_ASSERT_NONNULL(network.previousWrite, "already shut down")
-        .then([this, sendTime]() {
-      return kj::evalNow([&]() {
-        network.currentOutgoingMessageSendTime = sendTime;
-        return network.getStream().writeMessage(fds, message);
-      }).catch_([this](kj::Exception&& e) {
-        // Since no one checks write failures, we need to propagate them into read failures,
-        // otherwise we might get stuck sending all messages into a black hole and wondering why
-        // the peer never replies.
-        network.readCancelReason = kj::cp(e);
-        if (!network.readCanceler.isEmpty()) {
-          network.readCanceler.cancel(kj::cp(e));
-        }
-        kj::throwRecoverableException(kj::mv(e));
-      });
-    }).attach(kj::addRef(*this), kj::mv(deferredSizeUpdate))
-      // Note that it's important that the eagerlyEvaluate() come *after* the attach() because
-      // otherwise the message (and any capabilities in it) will not be released until a new
-      // message is written! (Kenton once spent all afternoon tracking this down...)
-      .eagerlyEvaluate(nullptr);
+    sendTime = network.clock.now();
+    sizeInBytes = size * sizeof(capnp::word);
+    network.queueMessage(kj::addRef(*this));
   }
 
   size_t sizeInWords() override {
     return message.sizeInWords();
   }
 
+  bool attach(kj::Own<void>&& owner) override {
+    attachments.add(kj::mv(owner));
+    return true;
+  }
+
 private:
   TwoPartyVatNetwork& network;
-  MallocMessageBuilder message;
+  bool learnSize;
+  // Whether the sender gave no size hint, so that we chose the size using `outgoingSizer`.
+
+  kj::Vector<kj::Own<void>> attachments;
+  // Declared before `message` so that they're destroyed after it.
+
+  BudgetedMessageBuilder message;
   kj::Array<int> fds;
+  Priority priority = Priority::NORMAL;
+  kj::TimePoint sendTime = kj::origin<kj::TimePoint>();
+  size_t sizeInBytes = 0;
+
+  friend class TwoPartyVatNetwork;
 };
 
+void TwoPartyVatNetwork::queueMessage(kj::Own<OutgoingMessageImpl> message) {
+  if (readCancelReason != nullptr) {
+    // A previous write failed, so this one would never be written. Drop it now rather than
+    // holding on to it until the connection is destroyed.
+    return;
+  }
+
+  if (currentQueueCount == 0) {
+    // Optimistically set sendTime when there's no messages in the queue. Without this, sending
+    // a message after a long delay could cause getOutgoingMessageWaitTime() to return excessively
+    // long wait times if it is called during the time period after send() is called,
+    // but before the write occurs, as we increment currentQueueCount synchronously, but
+    // asynchronously update currentOutgoingMessageSendTime.
+    currentOutgoingMessageSendTime = message->sendTime;
+  }
+  currentQueueSize += message->sizeInBytes;
+  ++currentQueueCount;
+  queuedBytes += message->sizeInBytes;
+  if (message->priority == OutgoingRpcMessage::Priority::EXPEDITED && queuedOrderedCount == 0) {
+    expeditedMessages.add(kj::mv(message));
+  } else {
+    if (message->priority != OutgoingRpcMessage::Priority::BULK) ++queuedOrderedCount;
+    queuedMessages.add(kj::mv(message));
+  }
+
+  if (expeditedMessages.size() + queuedMessages.size() == 1) {
+    // This is the first message of a new batch; schedule its write.
+    KJ_IF_MAYBE(timer, corkTimer) {
+      corkDeadline = timer->now() + corkDelay;
+    }
+    previousWrite = KJ_ASSERT_NONNULL(previousWrite).then([this]() {
+      // Wait until the event loop runs out of other work, so that every message produced by
+      // this turn joins the batch.
+      return kj::evalLast([this]() { return waitForCork(); });
+    }).then([this]() {
+      return writeQueuedMessages();
+    }).eagerlyEvaluate(nullptr);
+  } else if (queuedBytes >= corkFlushBytes) {
+    KJ_IF_MAYBE(fulfiller, corkFulfiller) {
+      fulfiller->get()->fulfill();
+    }
+  }
+}
+
+kj::Promise<void> TwoPartyVatNetwork::waitForCork() {
+  KJ_IF_MAYBE(timer, corkTimer) {
+    if (queuedBytes < corkFlushBytes && timer->now() < corkDeadline) {
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      corkFulfiller = kj::mv(paf.fulfiller);
+      return timer->atTime(corkDeadline).exclusiveJoin(kj::mv(paf.promise))
+          .then([this]() { corkFulfiller = nullptr; });
+    }
+  }
+  return kj::READY_NOW;
+}
+
+static constexpr size_t BULK_WRITE_BYTES = 65536;
+// A write stops before a BULK message once it holds this many bytes, so that an EXPEDITED message
+// sent while a stream has a large backlog queued only waits for the write in progress.
+
+kj::Vector<kj::Own<TwoPartyVatNetwork::OutgoingMessageImpl>> TwoPartyVatNetwork::takeBatch() {
+  auto batch = kj::mv(expeditedMessages);
+  size_t batchSize = 0;
+  for (auto& message: batch) {
+    batchSize += message->sizeInBytes;
+  }
+
+  kj::Vector<kj::Own<OutgoingMessageImpl>> rest;
+  queuedOrderedCount = 0;
+  for (auto& message: queuedMessages) {
+    if (rest.size() == 0 && (message->priority != OutgoingRpcMessage::Priority::BULK ||
+                             batchSize < BULK_WRITE_BYTES)) {
+      batchSize += message->sizeInBytes;
+      batch.add(kj::mv(message));
+    } else {
+      if (message->priority != OutgoingRpcMessage::Priority::BULK) ++queuedOrderedCount;
+      rest.add(kj::mv(message));
+    }
+  }
+  queuedMessages = kj::mv(rest);
+  queuedBytes -= batchSize;
+
+  return batch;
+}
+
+kj::Promise<void> TwoPartyVatNetwork::writeQueuedMessages() {
+  auto batch = takeBatch();
+  bool leftBehind = queuedMessages.size() > 0;
+
+  size_t batchSize = 0;
+  for (auto& message: batch) {
+    batchSize += message->sizeInBytes;
+  }
+  auto deferredSizeUpdate = kj::defer([this, batchSize, count = batch.size()]() {
+    currentQueueSize -= batchSize;
+    currentQueueCount -= count;
+  });
+  currentOutgoingMessageSendTime = batch[0]->sendTime;
+
+  return kj::evalNow([&]() -> kj::Promise<void> {
+    bool hasFds = false;
+    for (auto& message: batch) {
+      if (message->fds.size() > 0) hasFds = true;
+    }
+
+    if (!hasFds) {
+      auto messages = kj::heapArray<kj::ArrayPtr<const kj::ArrayPtr<const word>>>(batch.size());
+      for (auto i: kj::indices(batch)) {
+        messages[i] = batch[i]->message.getSegmentsForOutput();
+      }
+      auto promise = getStream().writeMessages(messages);
+      return promise.attach(kj::mv(messages));
+    }
+
+    // writeMessages() can't carry FDs, so write messages one at a time.
+    kj::Promise<void> promise = kj::READY_NOW;
+    for (auto& message: batch) {
+      promise = promise.then([this, &message = *message]() {
+        return getStream().writeMessage(message.fds, message.message);
+      });
+    }
+    return promise;
+  }).catch_([this](kj::Exception&& e) {
+    // Since no one checks write failures, we need to propagate them into read failures,
+    // otherwise we might get stuck sending all messages into a black hole and wondering why
+    // the peer never replies.
+    readCancelReason = kj::cp(e);
+    if (!readCanceler.isEmpty()) {
+      readCanceler.cancel(kj::cp(e));
+    }
+
+    // Anything queued since won't be written either.
+    for (auto& message: queuedMessages) {
+      currentQueueSize -= message->sizeInBytes;
+      --currentQueueCount;
+    }
+    for (auto& message: expeditedMessages) {
+      currentQueueSize -= message->sizeInBytes;
+      --currentQueueCount;
+    }
+    queuedMessages.clear();
+    expeditedMessages.clear();
+    queuedBytes = 0;
+    queuedOrderedCount = 0;
+
+    kj::throwRecoverableException(kj::mv(e));
+  }).attach(kj::mv(batch), kj::mv(deferredSizeUpdate)).then([this, leftBehind]() -> kj::Promise<void> {
+    // The batch is attached to the write, not to `previousWrite`, so that the messages are
+    // released as soon as it completes rather than when the next message is written.
+
+    if (leftBehind) {
+      // takeBatch() left some BULK messages behind, so no one else has scheduled a write for
+      // them (or anything queued since). Let anything sent during this turn join them.
+      return kj::evalLast([this]() { return writeQueuedMessages(); });
+    }
+    return kj::READY_NOW;
+  });
+}
+
+void TwoPartyVatNetwork::setCorkDelay(kj::Timer& timer, kj::Duration delay, size_t flushBytes) {
+  if (delay > 0 * kj::SECONDS) {
+    corkTimer = timer;
+  } else {
+    corkTimer = nullptr;
+  }
+  corkDelay = delay;
+  corkFlushBytes = flushBytes;
+}
+
 kj::Duration TwoPartyVatNetwork::getOutgoingMessageWaitTime() {
   if (currentQueueCount > 0) {
     return clock.now() - currentOutgoingMessageSendTime;
@@ -216,6 +422,18 @@ public:
     KJ_DASSERT(this->fds.begin() == this->fdSpace.begin());
   }
 
+  ~IncomingMessageImpl() noexcept(false) {
+    KJ_IF_MAYBE(b, budget) {
+      b->get()->release(charged);
+    }
+  }
+
+  void chargeTo(kj::Own<RpcMemoryBudget> newBudget) {
+    charged = message->sizeInWords() * sizeof(word);
+    newBudget->charge(charged);
+    budget = kj::mv(newBudget);
+  }
+
   AnyPointer::Reader getBody() override {
     return message->getRoot<AnyPointer>();
   }
@@ -232,9 +450,24 @@ private:
   kj::Own<MessageReader> message;
   kj::Array<kj::AutoCloseFd> fdSpace;
   kj::ArrayPtr<kj::AutoCloseFd> fds;
+  kj::Maybe<kj::Own<RpcMemoryBudget>> budget;
+  size_t charged = 0;
 };
 
+void TwoPartyVatNetwork::enableAdaptiveFlowControl(
+    const kj::MonotonicClock& clock, size_t maxWindow) {
+  adaptiveFlowControl = AdaptiveFlowControl { clock, maxWindow };
+}
+
+void TwoPartyVatNetwork::setMemoryBudget(kj::Own<RpcMemoryBudget> budget, OverBudget policy) {
+  memoryBudget = kj::mv(budget);
+  overBudgetPolicy = policy;
+}
+
 kj::Own<RpcFlowController> TwoPartyVatNetwork::newStream() {
+  KJ_IF_MAYBE(adaptive, adaptiveFlowControl) {
+    return RpcFlowController::newAdaptiveWindowController(adaptive->clock, adaptive->maxWindow);
+  }
   return RpcFlowController::newVariableWindowController(*this);
 }
 
@@ -287,21 +520,36 @@ kj::Promise<kj::Maybe<kj::Own<IncomingRpcMessage>>> TwoPartyVatNetwork::receiveI
       return kj::cp(*e);
     }
 
+    KJ_IF_MAYBE(budget, memoryBudget) {
+      if (budget->get()->isOverLimit()) {
+        if (overBudgetPolicy == OverBudget::DISCONNECT) {
+          return KJ_EXCEPTION(OVERLOADED, "connection exceeded its memory budget");
+        }
+        return readCanceler.wrap(budget->get()->whenWithinLimit()).then([this]() {
+          return receiveIncomingMessage();
+        });
+      }
+    }
+
     kj::Array<kj::AutoCloseFd> fdSpace = nullptr;
     if(maxFdsPerMessage > 0) {
       fdSpace = kj::heapArray<kj::AutoCloseFd>(maxFdsPerMessage);
     }
     auto promise = readCanceler.wrap(getStream().tryReadMessage(fdSpace, receiveOptions));
-    return promise.then([fdSpace = kj::mv(fdSpace)]
+    return promise.then([this, fdSpace = kj::mv(fdSpace)]
                         (kj::Maybe<MessageReaderAndFds>&& messageAndFds) mutable
                       -> kj::Maybe<kj::Own<IncomingRpcMessage>> {
       KJ_IF_MAYBE(m, messageAndFds) {
+        kj::Own<IncomingMessageImpl> message;
         if (m->fds.size() > 0) {
-          return kj::Own<IncomingRpcMessage>(
-              kj::heap<IncomingMessageImpl>(kj::mv(*m), kj::mv(fdSpace)));
+          message = kj::heap<IncomingMessageImpl>(kj::mv(*m), kj::mv(fdSpace));
         } else {
-          return kj::Own<IncomingRpcMessage>(kj::heap<IncomingMessageImpl>(kj::mv(m->reader)));
+          message = kj::heap<IncomingMessageImpl>(kj::mv(m->reader));
         }
+        KJ_IF_MAYBE(budget, memoryBudget) {
+          message->chargeTo(kj::addRef(**budget));
+        }
+        return kj::Own<IncomingRpcMessage>(kj::mv(message));
       } else {
         return nullptr;
       }
@@ -319,31 +567,91 @@ kj::Promise<void> TwoPartyVatNetwork::shutdown() {
 
 // =======================================================================================
 
+class TwoPartyServer::Admission final: public kj::Refcounted {
+public:
+  explicit Admission(Limits limits)
+      : limits(limits), callLimiter(kj::refcounted<RpcCallLimiter>(limits.maxCalls)),
+        memoryBudget(kj::refcounted<RpcMemoryBudget>(limits.maxMemory)) {}
+
+  Limits limits;
+  kj::Own<RpcCallLimiter> callLimiter;
+  kj::Own<RpcMemoryBudget> memoryBudget;
+  uint connections = 0;
+
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> connectionSlotWaiters;
+  // listen() loops waiting for the connection count to drop below `limits.maxConnections`.
+
+  void connectionClosed() {
+    --connections;
+    for (auto& waiter: connectionSlotWaiters) {
+      waiter->fulfill();
+    }
+    connectionSlotWaiters.clear();
+  }
+};
+
 TwoPartyServer::TwoPartyServer(Capability::Client bootstrapInterface)
-    : bootstrapInterface(kj::mv(bootstrapInterface)), tasks(*this) {}
+    : TwoPartyServer(kj::mv(bootstrapInterface), Limits()) {}
+
+TwoPartyServer::TwoPartyServer(Capability::Client bootstrapInterface, Limits limits)
+    : bootstrapInterface(kj::mv(bootstrapInterface)),
+      admission(kj::refcounted<Admission>(limits)),
+      tasks(*this) {}
+
+TwoPartyServer::~TwoPartyServer() noexcept(false) {}
+
+TwoPartyServer::Load TwoPartyServer::getLoad() {
+  return {
+    admission->connections,
+    admission->callLimiter->getCallsInFlight(),
+    admission->callLimiter->getCallsRejected(),
+    admission->memoryBudget->getUsed()
+  };
+}
 
 struct TwoPartyServer::AcceptedConnection {
+  kj::Own<Admission> admission;
   kj::Own<kj::AsyncIoStream> connection;
   TwoPartyVatNetwork network;
   RpcSystem<rpc::twoparty::VatId> rpcSystem;
 
-  explicit AcceptedConnection(Capability::Client bootstrapInterface,
+  explicit AcceptedConnection(Admission& admission, Capability::Client bootstrapInterface,
                               kj::Own<kj::AsyncIoStream>&& connectionParam)
-      : connection(kj::mv(connectionParam)),
+      : admission(kj::addRef(admission)),
+        connection(kj::mv(connectionParam)),
         network(*connection, rpc::twoparty::Side::SERVER),
-        rpcSystem(makeRpcServer(network, kj::mv(bootstrapInterface))) {}
+        rpcSystem(makeRpcServer(network, kj::mv(bootstrapInterface))) {
+    init();
+  }
 
-  explicit AcceptedConnection(Capability::Client bootstrapInterface,
+  explicit AcceptedConnection(Admission& admission, Capability::Client bootstrapInterface,
                               kj::Own<kj::AsyncCapabilityStream>&& connectionParam,
                               uint maxFdsPerMessage)
-      : connection(kj::mv(connectionParam)),
+      : admission(kj::addRef(admission)),
+        connection(kj::mv(connectionParam)),
         network(kj::downcast<kj::AsyncCapabilityStream>(*connection),
                 maxFdsPerMessage, rpc::twoparty::Side::SERVER),
-        rpcSystem(makeRpcServer(network, kj::mv(bootstrapInterface))) {}
+        rpcSystem(makeRpcServer(network, kj::mv(bootstrapInterface))) {
+    init();
+  }
+
+  ~AcceptedConnection() noexcept(false) {
+    admission->connectionClosed();
+  }
+
+  void init() {
+    ++admission->connections;
+    auto& limits = admission->limits;
+    rpcSystem.setFlowLimit(limits.maxCallWordsPerConnection);
+    rpcSystem.setCallLimit(limits.maxCallsPerConnection, kj::addRef(*admission->callLimiter));
+    network.setMemoryBudget(kj::refcounted<RpcMemoryBudget>(
+        limits.maxMemoryPerConnection, kj::addRef(*admission->memoryBudget)));
+  }
 };
 
 void TwoPartyServer::accept(kj::Own<kj::AsyncIoStream>&& connection) {
-  auto connectionState = kj::heap<AcceptedConnection>(bootstrapInterface, kj::mv(connection));
+  auto connectionState = kj::heap<AcceptedConnection>(
+      *admission, bootstrapInterface, kj::mv(connection));
 
   // Run the connection until disconnect.
   auto promise = connectionState->network.onDisconnect();
@@ -353,7 +661,7 @@ void TwoPartyServer::accept(kj::Own<kj::AsyncIoStream>&& connection) {
 void TwoPartyServer::accept(
     kj::Own<kj::AsyncCapabilityStream>&& connection, uint maxFdsPerMessage) {
   auto connectionState = kj::heap<AcceptedConnection>(
-      bootstrapInterface, kj::mv(connection), maxFdsPerMessage);
+      *admission, bootstrapInterface, kj::mv(connection), maxFdsPerMessage);
 
   // Run the connection until disconnect.
   auto promise = connectionState->network.onDisconnect();
@@ -361,7 +669,7 @@ void TwoPartyServer::accept(
 }
 
 kj::Promise<void> TwoPartyServer::accept(kj::AsyncIoStream& connection) {
-  auto connectionState = kj::heap<AcceptedConnection>(bootstrapInterface,
+  auto connectionState = kj::heap<AcceptedConnection>(*admission, bootstrapInterface,
       kj::Own<kj::AsyncIoStream>(&connection, kj::NullDisposer::instance));
 
   // Run the connection until disconnect.
@@ -371,7 +679,7 @@ kj::Promise<void> TwoPartyServer::accept(kj::AsyncIoStream& connection) {
 
 kj::Promise<void> TwoPartyServer::accept(
     kj::AsyncCapabilityStream& connection, uint maxFdsPerMessage) {
-  auto connectionState = kj::heap<AcceptedConnection>(bootstrapInterface,
+  auto connectionState = kj::heap<AcceptedConnection>(*admission, bootstrapInterface,
       kj::Own<kj::AsyncCapabilityStream>(&connection, kj::NullDisposer::instance),
       maxFdsPerMessage);
 
@@ -380,9 +688,20 @@ kj::Promise<void> TwoPartyServer::accept(
   return promise.attach(kj::mv(connectionState));
 }
 
+kj::Promise<void> TwoPartyServer::waitForConnectionSlot() {
+  if (admission->connections < admission->limits.maxConnections) {
+    return kj::READY_NOW;
+  }
+
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  admission->connectionSlotWaiters.add(kj::mv(paf.fulfiller));
+  return paf.promise.then([this]() { return waitForConnectionSlot(); });
+}
+
 kj::Promise<void> TwoPartyServer::listen(kj::ConnectionReceiver& listener) {
-  return listener.accept()
-      .then([this,&listener](kj::Own<kj::AsyncIoStream>&& connection) mutable {
+  return waitForConnectionSlot().then([&listener]() {
+    return listener.accept();
+  }).then([this,&listener](kj::Own<kj::AsyncIoStream>&& connection) mutable {
     accept(kj::mv(connection));
     return listen(listener);
   });
@@ -390,8 +709,9 @@ kj::Promise<void> TwoPartyServer::listen(kj::ConnectionReceiver& listener) {
 
 kj::Promise<void> TwoPartyServer::listenCapStreamReceiver(
       kj::ConnectionReceiver& listener, uint maxFdsPerMessage) {
-  return listener.accept()
-      .then([this,&listener,maxFdsPerMessage](kj::Own<kj::AsyncIoStream>&& connection) mutable {
+  return waitForConnectionSlot().then([&listener]() {
+    return listener.accept();
+  }).then([this,&listener,maxFdsPerMessage](kj::Own<kj::AsyncIoStream>&& connection) mutable {
     accept(connection.downcast<kj::AsyncCapabilityStream>(), maxFdsPerMessage);
     return listenCapStreamReceiver(listener, maxFdsPerMessage);
   });
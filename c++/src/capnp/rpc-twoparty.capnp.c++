@@ -341,6 +341,30 @@ const ::capnp::_::RawSchema s_9d263a3630b7ebee = {
   0, 3, i_9d263a3630b7ebee, nullptr, nullptr, { &s_9d263a3630b7ebee, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_a184c7885cdaf2a1[] = {
+  &s_95b29059097fca83,
+  &s_89f389b6fd4082c1,
+  nullptr,
+  nullptr,
+  &s_d20b909fee733a8e,
+  nullptr,
+  nullptr,
+  &s_9d263a3630b7ebee,
+  &s_b88d09a9c5f39817,
+  nullptr,
+  nullptr,
+  &s_9fd69ebc87b9719c,
+  &s_b47f4979672cb59d,
+  nullptr,
+  nullptr,
+  nullptr,
+};
+static const uint32_t xh_a184c7885cdaf2a1[] = {2, 2, 1, 2};
+const ::capnp::_::RawSchemaIndex x_a184c7885cdaf2a1 = {
+  xs_a184c7885cdaf2a1, xh_a184c7885cdaf2a1, 16, 4, 7
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
@@ -28,6 +28,7 @@ CAPNP_DECLARE_SCHEMA(89f389b6fd4082c1);
 CAPNP_DECLARE_SCHEMA(b47f4979672cb59d);
 CAPNP_DECLARE_SCHEMA(95b29059097fca83);
 CAPNP_DECLARE_SCHEMA(9d263a3630b7ebee);
+CAPNP_DECLARE_SCHEMA_INDEX(a184c7885cdaf2a1);
 
 }  // namespace schemas
 }  // namespace capnp
@@ -79,6 +79,7 @@ public:
   // clock is used for calculating the oldest queued message age, which is a useful metric for
   // detecting queue overload
 
+  ~TwoPartyVatNetwork() noexcept(false);
   KJ_DISALLOW_COPY(TwoPartyVatNetwork);
 
   kj::Promise<void> onDisconnect() { return disconnectPromise.addBranch(); }
@@ -98,6 +99,47 @@ public:
   // Get how long the current outgoing message has been waiting to be sent on this connection.
   // Returns 0 if the queue is empty. This may be useful for backpressure.
 
+  static constexpr size_t DEFAULT_CORK_FLUSH_BYTES = 65536;
+
+  void setCorkDelay(kj::Timer& timer, kj::Duration delay,
+                    size_t flushBytes = DEFAULT_CORK_FLUSH_BYTES);
+  // Outgoing messages are always coalesced: everything sent during one turn of the event loop,
+  // plus anything sent while a previous write is still in progress, goes out in a single
+  // writeMessages() call. Setting a cork delay additionally holds each write for up to `delay`
+  // after its first message was sent, so that messages produced by later turns can join it,
+  // unless `flushBytes` worth of messages are queued first.
+  //
+  // On chatty connections this trades a little latency for fewer syscalls and TCP segments.
+  // The delay is subject to the timer's granularity. Pass a zero delay to turn corking back off.
+
+  void enableAdaptiveFlowControl(
+      const kj::MonotonicClock& clock = kj::systemPreciseMonotonicClock(),
+      size_t maxWindow = RpcFlowController::DEFAULT_MAX_ADAPTIVE_WINDOW);
+  // Make streams created after this call use RpcFlowController::newAdaptiveWindowController()
+  // instead of a window equal to the socket's send buffer size. The latter can't account for
+  // anything past the first hop, so it is far too small on links with a high bandwidth-delay
+  // product, and too big behind a slower proxied link. `clock` should be precise enough to
+  // measure the path's round trip time.
+
+  enum class OverBudget {
+    PAUSE_READS,
+    // Stop reading messages from the peer until the budget is back within its limit. The peer's
+    // writes then back up into the socket, and eventually into the peer itself.
+
+    DISCONNECT
+    // Fail the connection with an OVERLOADED exception.
+  };
+
+  void setMemoryBudget(kj::Own<RpcMemoryBudget> budget,
+                       OverBudget policy = OverBudget::PAUSE_READS);
+  // Charge the memory pinned by this connection to `budget`: outgoing messages, from the first
+  // segment allocated until they have been written, and incoming messages until the RpcSystem is
+  // done with them. Before reading each message, if the budget (or an ancestor) is over its limit,
+  // `policy` applies. Only messages created or received after this call are charged.
+  //
+  // As with `RpcSystem::setFlowLimit()`, pausing reads can deadlock if the calls pinning the
+  // memory can only complete once further messages from the same peer are read.
+
   // implements VatNetwork -----------------------------------------------------
 
   kj::Maybe<kj::Own<TwoPartyVatNetworkBase::Connection>> connect(
@@ -118,9 +160,30 @@ private:
   ReaderOptions receiveOptions;
   bool accepted = false;
 
+  MessageSegmentPool segmentPool { SUGGESTED_FIRST_SEGMENT_WORDS, 4 };
+  // First segments for outgoing messages are recycled through this pool, so that steady-state
+  // traffic doesn't need to allocate and zero a new segment per message. Only a few segments are
+  // retained since servers may have many idle connections. Declared before `previousWrite` so
+  // that it outlives any messages still queued for writing.
+
+  FirstSegmentSizer outgoingSizer;
+  // Picks the first segment size for outgoing messages whose sender gave no size hint, based on
+  // the sizes of such messages sent so far, so that they usually fit in one segment.
+
   bool solSndbufUnimplemented = false;
   // Whether stream.getsockopt(SO_SNDBUF) has been observed to throw UNIMPLEMENTED.
 
+  struct AdaptiveFlowControl {
+    const kj::MonotonicClock& clock;
+    size_t maxWindow;
+  };
+  kj::Maybe<AdaptiveFlowControl> adaptiveFlowControl;
+  // Set by enableAdaptiveFlowControl().
+
+  kj::Maybe<kj::Own<RpcMemoryBudget>> memoryBudget;
+  OverBudget overBudgetPolicy = OverBudget::PAUSE_READS;
+  // Set by setMemoryBudget().
+
   kj::Canceler readCanceler;
   kj::Maybe<kj::Exception> readCancelReason;
   // Used to propagate write errors into (permanent) read errors.
@@ -129,6 +192,26 @@ private:
   // Resolves when the previous write completes.  This effectively serves as the write queue.
   // Becomes null when shutdown() is called.
 
+  kj::Vector<kj::Own<OutgoingMessageImpl>> expeditedMessages;
+  kj::Vector<kj::Own<OutgoingMessageImpl>> queuedMessages;
+  size_t queuedBytes = 0;
+  size_t queuedOrderedCount = 0;
+  // Messages sent but not yet handed to the stream. They go out in the next write, which is
+  // scheduled after `previousWrite` when the first of them is queued, except that a write takes
+  // only a bounded amount of BULK messages; the rest wait for the write after it.
+  //
+  // EXPEDITED messages go in `expeditedMessages`, which is written first, as long as nothing but
+  // BULK messages is queued ahead of them. `queuedOrderedCount` counts the messages in
+  // `queuedMessages` that aren't BULK, and so can't be overtaken.
+
+  kj::Maybe<kj::Timer&> corkTimer;
+  kj::Duration corkDelay = 0 * kj::SECONDS;
+  size_t corkFlushBytes = DEFAULT_CORK_FLUSH_BYTES;
+  kj::TimePoint corkDeadline = kj::origin<kj::TimePoint>();
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> corkFulfiller;
+  // See setCorkDelay(). `corkFulfiller` is set while a write is being held, to release it early
+  // once `corkFlushBytes` is reached.
+
   kj::Own<kj::PromiseFulfiller<kj::Own<TwoPartyVatNetworkBase::Connection>>> acceptFulfiller;
   // Fulfiller for the promise returned by acceptConnectionAsRefHost() on the client side, or the
   // second call on the server side.  Never fulfilled, because there is only one connection.
@@ -165,6 +248,11 @@ private:
 
   MessageStream& getStream();
 
+  void queueMessage(kj::Own<OutgoingMessageImpl> message);
+  kj::Promise<void> waitForCork();
+  kj::Promise<void> writeQueuedMessages();
+  kj::Vector<kj::Own<OutgoingMessageImpl>> takeBatch();
+
   kj::Own<TwoPartyVatNetworkBase::Connection> asConnection();
   // Returns a pointer to this with the disposer set to disconnectFulfiller.
 
@@ -186,7 +274,50 @@ class TwoPartyServer: private kj::TaskSet::ErrorHandler {
   // socket and services them as two-party connections.
 
 public:
+  struct Limits {
+    // Admission control. Every limit defaults to unlimited.
+
+    uint maxConnections = kj::maxValue;
+    // While this many connections are open, listen() stops accepting new ones, leaving them in
+    // the listen socket's backlog. Connections passed to accept() directly are counted but never
+    // refused.
+
+    size_t maxCallsPerConnection = kj::maxValue;
+    size_t maxCalls = kj::maxValue;
+    // Incoming calls in progress at once on each connection and across all connections. Calls
+    // beyond these fail immediately with OVERLOADED. See `RpcSystem::setCallLimit()`.
+
+    size_t maxCallWordsPerConnection = kj::maxValue;
+    // Once incoming calls which haven't returned hold this many words of parameters on a
+    // connection, stop reading from it until some return. See `RpcSystem::setFlowLimit()`.
+
+    size_t maxMemoryPerConnection = kj::maxValue;
+    size_t maxMemory = kj::maxValue;
+    // Bytes of messages pinned by each connection and by all connections together. While a
+    // connection is over either limit, the server stops reading from it. See
+    // `TwoPartyVatNetwork::setMemoryBudget()`.
+  };
+
   explicit TwoPartyServer(Capability::Client bootstrapInterface);
+  TwoPartyServer(Capability::Client bootstrapInterface, Limits limits);
+  ~TwoPartyServer() noexcept(false);
+
+  struct Load {
+    uint connections;
+    // Connections currently open.
+
+    size_t callsInFlight;
+    // Incoming calls currently in progress, over all connections.
+
+    uint64_t callsRejected;
+    // Calls failed with OVERLOADED so far.
+
+    size_t memoryUsed;
+    // Bytes of messages pinned by all connections.
+  };
+
+  Load getLoad();
+  // Current load, e.g. for reporting to a load balancer's health check.
 
   void accept(kj::Own<kj::AsyncIoStream>&& connection);
   void accept(kj::Own<kj::AsyncCapabilityStream>&& connection, uint maxFdsPerMessage);
@@ -220,10 +351,18 @@ public:
 
 private:
   Capability::Client bootstrapInterface;
+
+  class Admission;
+  kj::Own<Admission> admission;
+  // Shared with the connections, which may outlive the server if accepted without taking
+  // ownership.
+
   kj::TaskSet tasks;
 
   struct AcceptedConnection;
 
+  kj::Promise<void> waitForConnectionSlot();
+
   void taskFailed(kj::Exception&& exception) override;
 };
 
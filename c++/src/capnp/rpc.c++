@@ -20,6 +20,7 @@
 // THE SOFTWARE.
 
 #include "rpc.h"
+#include "call-trace.h"
 #include "message.h"
 #include "kj/debug.h"
 #include "kj/vector.h"
@@ -193,6 +194,11 @@ public:
     return toRelease;
   }
 
+  size_t size() const {
+    // Number of entries currently in use.
+    return slots.size() - freeIds.size();
+  }
+
   T& next(Id& id) {
     if (freeIds.empty()) {
       id = slots.size();
@@ -275,6 +281,21 @@ private:
 
 // =======================================================================================
 
+class RpcConnectionState;
+
+class ConnectionRegistry {
+  // Lets an RpcConnectionState find the other connections belonging to the same RpcSystem, for
+  // three-party handoff. Implemented by RpcSystemBase::Impl.
+
+public:
+  virtual kj::Maybe<RpcConnectionState&> findByBrand(const void* brand) = 0;
+  // Find the connection whose capabilities have the given ClientHook brand, if it is one of ours.
+
+  virtual RpcConnectionState& getConnectionState(
+      kj::Own<VatNetworkBase::Connection>&& connection) = 0;
+  // Get (or start) the state for a connection returned by the network.
+};
+
 class RpcConnectionState final: public kj::TaskSet::ErrorHandler, public kj::Refcounted {
 public:
   struct DisconnectInfo {
@@ -286,11 +307,14 @@ public:
                      kj::Maybe<SturdyRefRestorerBase&> restorer,
                      kj::Own<VatNetworkBase::Connection>&& connectionParam,
                      kj::Own<kj::PromiseFulfiller<DisconnectInfo>>&& disconnectFulfiller,
-                     size_t flowLimit,
-                     kj::Maybe<kj::Function<kj::String(const kj::Exception&)>&> traceEncoder)
+                     size_t flowLimit, size_t callLimit,
+                     kj::Maybe<kj::Own<RpcCallLimiter>> callLimiter,
+                     kj::Maybe<kj::Function<kj::String(const kj::Exception&)>&> traceEncoder,
+                     ConnectionRegistry& registry)
       : bootstrapFactory(bootstrapFactory),
         restorer(restorer), disconnectFulfiller(kj::mv(disconnectFulfiller)), flowLimit(flowLimit),
-        traceEncoder(traceEncoder), tasks(*this) {
+        callLimit(callLimit), callLimiter(kj::mv(callLimiter)),
+        traceEncoder(traceEncoder), registry(registry), tasks(*this) {
     connection.init<Connected>(kj::mv(connectionParam));
     tasks.add(messageLoop());
   }
@@ -320,7 +344,7 @@ public:
       builder.setQuestionId(questionId);
       builder.getDeprecatedObjectId().set(objectId);
 
-      message->send();
+      sendMessage(*message);
     }
 
     auto pipeline = kj::refcounted<RpcPipeline>(*this, kj::mv(questionRef), kj::mv(paf.promise));
@@ -328,6 +352,62 @@ public:
     return pipeline->getPipelinedCap(kj::Array<const PipelineOp>(nullptr));
   }
 
+  kj::Own<ClientHook> pickUp(AnyPointer::Reader provisionId, kj::Own<ClientHook>&& vine) {
+    // Sends `Accept` to pick up a capability that was handed off to us by a third party, returning
+    // a promise for it. The returned client holds on to `vine` -- the introducer's proxy for the
+    // same capability -- so that the introducer doesn't cancel the provision before we got to pick
+    // it up, and so that a promise which already received calls can keep using the vine instead
+    // (see PromiseClient::resolve()).
+
+    if (connection.is<Disconnected>()) {
+      return kj::mv(vine);
+    }
+
+    QuestionId questionId;
+    auto& question = questions.next(questionId);
+
+    question.isAwaitingReturn = true;
+
+    auto paf = kj::newPromiseAndFulfiller<kj::Promise<kj::Own<RpcResponse>>>();
+
+    auto questionRef = kj::refcounted<QuestionRef>(*this, questionId, kj::mv(paf.fulfiller));
+    question.selfRef = *questionRef;
+
+    paf.promise = paf.promise.attach(kj::addRef(*questionRef));
+
+    {
+      auto message = connection.get<Connected>()->newOutgoingMessage(
+          provisionId.targetSize().wordCount + messageSizeHint<rpc::Accept>());
+
+      auto builder = message->getBody().initAs<rpc::Message>().initAccept();
+      builder.setQuestionId(questionId);
+      builder.getProvision().set(provisionId);
+      builder.setEmbargo(false);
+
+      sendMessage(*message);
+    }
+
+    auto pipeline = kj::refcounted<RpcPipeline>(*this, kj::mv(questionRef), kj::mv(paf.promise));
+
+    auto result = pipeline->getPipelinedCap(kj::Array<const PipelineOp>(nullptr));
+    kj::downcast<RpcClient>(*result).vine = kj::mv(vine);
+    return result;
+  }
+
+  kj::Maybe<ClientHook&> getVine(ClientHook& cap) {
+    // If `cap` is a capability that one of our connections picked up from a third party, returns
+    // the vine it was handed off with.
+
+    KJ_IF_MAYBE(r, registry) {
+      if (r->findByBrand(cap.getBrand()) != nullptr) {
+        return kj::downcast<RpcClient>(cap).vine.map([](kj::Own<ClientHook>& v) -> ClientHook& {
+          return *v;
+        });
+      }
+    }
+    return nullptr;
+  }
+
   void taskFailed(kj::Exception&& exception) override {
     disconnect(kj::mv(exception));
   }
@@ -337,6 +417,7 @@ public:
     // reference, so null it out before we return from here. We don't need it anymore once
     // disconnected anyway.
     KJ_DEFER(traceEncoder = nullptr);
+    KJ_DEFER(registry = nullptr);
 
     if (!connection.is<Connected>()) {
       // Already disconnected.
@@ -386,6 +467,10 @@ public:
         KJ_IF_MAYBE(context, answer.callContext) {
           context->requestCancel();
         }
+
+        KJ_IF_MAYBE(op, answer.provideOp) {
+          resolveOpsToRelease.add(kj::mv(*op));
+        }
       });
 
       exports.forEach([&](ExportId id, Export& exp) {
@@ -393,6 +478,9 @@ public:
         KJ_IF_MAYBE(op, exp.resolveOp) {
           resolveOpsToRelease.add(kj::mv(*op));
         }
+        for (auto& provision: exp.provisions) {
+          resolveOpsToRelease.add(kj::mv(provision));
+        }
         exp = Export();
       });
 
@@ -419,7 +507,7 @@ public:
       auto message = connection.get<Connected>()->newOutgoingMessage(
           messageSizeHint<void>() + exceptionSizeHint(exception));
       fromException(exception, message->getBody().getAs<rpc::Message>().initAbort());
-      message->send();
+      sendMessage(*message);
     });
 
     // Indicate disconnect.
@@ -449,6 +537,36 @@ public:
     maybeUnblockFlow();
   }
 
+  void setCallLimit(size_t maxCalls, kj::Maybe<kj::Own<RpcCallLimiter>> limiter) {
+    callLimit = maxCalls;
+    callLimiter = kj::mv(limiter);
+  }
+
+  RpcConnectionStats getStats() {
+    RpcConnectionStats result;
+    KJ_IF_MAYBE(c, connection.tryGet<Connected>()) {
+      result.peerVatId = (*c)->baseGetPeerVatId();
+    }
+
+    result.questions = questions.size();
+    result.exports = exports.size();
+    result.embargoes = embargoes.size();
+    answers.forEach([&](AnswerId, Answer& answer) {
+      if (answer.active) ++result.answers;
+    });
+    imports.forEach([&](ImportId, Import& import) {
+      if (import.importClient != nullptr) ++result.imports;
+    });
+
+    result.callWordsInFlight = callWordsInFlight;
+    result.callsInFlight = callsInFlight;
+    result.callsRejected = callsRejected;
+    result.streamBytesInFlight = streamBytesInFlight;
+    memcpy(result.messagesSent, messagesSent, sizeof(messagesSent));
+    memcpy(result.messagesReceived, messagesReceived, sizeof(messagesReceived));
+    return result;
+  }
+
 private:
   class RpcClient;
   class ImportClient;
@@ -526,6 +644,13 @@ private:
     kj::Array<ExportId> resultExports;
     // List of exports that were sent in the results.  If the finish has `releaseResultCaps` these
     // will need to be released.
+
+    kj::Maybe<kj::Promise<void>> provideOp;
+    // For a `Provide`, waits for the recipient to pick up the capability and then sends the
+    // `Return`. Dropped (canceling the provision) when the `Finish` is received.
+
+    bool provideReturned = false;
+    // True once `provideOp` has sent the `Return`.
   };
 
   struct Export {
@@ -538,6 +663,11 @@ private:
     // If this export is a promise (not a settled capability), the `resolveOp` represents the
     // ongoing operation to wait for that promise to resolve and then send a `Resolve` message.
 
+    kj::Vector<kj::Promise<void>> provisions;
+    // If this export is the vine for capabilities we've handed off to the peer (see
+    // `ThirdPartyCapDescriptor` in rpc.capnp), the `Provide` operations we sent to their hosts.
+    // Releasing the vine cancels them.
+
     inline bool operator==(decltype(nullptr)) const { return refcount == 0; }
     inline bool operator!=(decltype(nullptr)) const { return refcount != 0; }
   };
@@ -609,12 +739,51 @@ private:
   size_t flowLimit;
   size_t callWordsInFlight = 0;
 
+  size_t callLimit;
+  size_t callsInFlight = 0;
+  uint64_t callsRejected = 0;
+  kj::Maybe<kj::Own<RpcCallLimiter>> callLimiter;
+  // See RpcSystem::setCallLimit().
+
+  size_t streamBytesInFlight = 0;
+  // Bytes of streaming calls which we've sent but which haven't yet returned.
+
+  uint64_t messagesSent[RpcConnectionStats::MESSAGE_TYPE_COUNT] = {};
+  uint64_t messagesReceived[RpcConnectionStats::MESSAGE_TYPE_COUNT] = {};
+  // Counts of messages by type, indexed by rpc::Message::Which. See getStats().
+
+  enum class BulkReleaseSupport: uint8_t {
+    UNKNOWN,      // We haven't heard from the peer either way.
+    ADVERTISED,   // We've sent an empty `BulkRelease` and are waiting to hear back.
+    SUPPORTED,    // The peer has sent us a `BulkRelease`.
+    UNSUPPORTED   // The peer replied `Unimplemented` to our advertisement.
+  };
+  BulkReleaseSupport bulkReleaseSupport = BulkReleaseSupport::UNKNOWN;
+
+  struct PendingFinish {
+    QuestionId questionId;
+    bool releaseResultCaps;
+  };
+  struct PendingRelease {
+    ImportId importId;
+    uint32_t referenceCount;
+  };
+  kj::Vector<PendingFinish> pendingFinishes;
+  kj::Vector<PendingRelease> pendingReleases;
+  bool releaseFlushScheduled = false;
+  // `Finish` and `Release` messages queued by sendFinish() and sendRelease() during the current
+  // turn of the event loop. See flushReleases().
+
   kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> flowWaiter;
   // If non-null, we're currently blocking incoming messages waiting for callWordsInFlight to drop
   // below flowLimit. Fulfill this to un-block.
 
   kj::Maybe<kj::Function<kj::String(const kj::Exception&)>&> traceEncoder;
 
+  kj::Maybe<ConnectionRegistry&> registry;
+  // The RpcSystem's other connections. Null once disconnected, since the RpcSystem could be
+  // destroyed after that.
+
   kj::TaskSet tasks;
 
   // =====================================================================================
@@ -649,6 +818,14 @@ private:
     // that other client -- return a reference to the other client, transitively.  Otherwise,
     // return a new reference to *this.
 
+    virtual bool isSettledImport() { return false; }
+    // True if this client is a settled capability hosted by the peer, which therefore can be
+    // handed off to a third party.
+
+    kj::Maybe<kj::Own<ClientHook>> vine;
+    // If this client was handed off to us by a third party and picked up with `Accept`, the
+    // introducer's proxy for the same capability.
+
     virtual void adoptFlowController(kj::Own<RpcFlowController> flowController) {
       // Called when a PromiseClient resolves to another RpcClient. If streaming calls were
       // outstanding on the old client, we'd like to keep using the same FlowController on the new
@@ -698,18 +875,58 @@ private:
       return callNoIntercept(interfaceId, methodId, kj::mv(context));
     }
 
+    Request<AnyPointer, AnyPointer> forwardCall(uint64_t interfaceId, uint16_t methodId,
+                                                AnyPointer::Reader params,
+                                                CallContextHook& context) {
+      // Builds the request for a call being forwarded from `context`, and releases its params.
+      //
+      // If the params arrived in a message which the context can hand over (e.g. they came in on
+      // another RPC connection) and our VatNetwork can keep that message alive, the new Call
+      // references them where they are, so that only the Call header and cap table are written.
+      // Params containing capabilities are still copied, since their descriptors must be rewritten
+      // for this connection.
+
+      if (params.isStruct() && connectionState->connection.is<Connected>()) {
+        auto owner = context.releaseParamsMessage();
+        if (owner.get() != nullptr) {
+          auto request = kj::heap<RpcRequest>(
+              *connectionState, *connectionState->connection.get<Connected>(),
+              MessageSize { 0, 0 }, kj::addRef(*this));
+          auto callBuilder = request->getCall();
+          callBuilder.setInterfaceId(interfaceId);
+          callBuilder.setMethodId(methodId);
+
+          auto root = request->getRoot();
+          if (request->attach(kj::mv(owner))) {
+            root.adopt(Orphanage::getForMessageContaining(root)
+                .referenceExternal(params.getAs<AnyStruct>()));
+          } else {
+            // The network can't hold on to the incoming message, so copy after all. (This is
+            // before `owner` goes out of scope.)
+            root.set(params);
+          }
+          return Request<AnyPointer, AnyPointer>(root, kj::mv(request));
+        }
+      }
+
+      auto request = newCallNoIntercept(interfaceId, methodId, params.targetSize());
+      request.set(params);
+      context.releaseParams();
+      return request;
+    }
+
     VoidPromiseAndPipeline callNoIntercept(uint64_t interfaceId, uint16_t methodId,
                                            kj::Own<CallContextHook>&& context) {
-      // Implement call() by copying params and results messages.
+      // Implement call() by forwarding params and copying the results message.
 
       auto params = context->getParams();
-      auto request = newCallNoIntercept(interfaceId, methodId, params.targetSize());
+      auto request = forwardCall(interfaceId, methodId, params, *context);
 
-      request.set(params);
-      context->releaseParams();
-
-      // We can and should propagate cancellation.
+      // We can and should propagate cancellation, and the deadline.
       context->allowCancellation();
+      KJ_IF_MAYBE(d, context->getDeadline()) {
+        request.setDeadline(*d);
+      }
 
       return context->directTailCall(RequestHook::from(kj::mv(request)));
     }
@@ -748,12 +965,7 @@ private:
 
         // Send a message releasing our remote references.
         if (remoteRefcount > 0 && connectionState->connection.is<Connected>()) {
-          auto message = connectionState->connection.get<Connected>()->newOutgoingMessage(
-              messageSizeHint<rpc::Release>());
-          rpc::Release::Builder builder = message->getBody().initAs<rpc::Message>().initRelease();
-          builder.setId(importId);
-          builder.setReferenceCount(remoteRefcount);
-          message->send();
+          connectionState->sendRelease(importId, remoteRefcount);
         }
       });
     }
@@ -785,6 +997,10 @@ private:
       return kj::addRef(*this);
     }
 
+    bool isSettledImport() override {
+      return true;
+    }
+
     // implements ClientHook -----------------------------------------
 
     kj::Maybe<ClientHook&> getResolved() override {
@@ -1005,6 +1221,18 @@ private:
     kj::Promise<kj::Own<ClientHook>> resolve(kj::Own<ClientHook> replacement) {
       KJ_DASSERT(!isResolved());
 
+      if (receivedCall) {
+        KJ_IF_MAYBE(vine, connectionState->getVine(*replacement)) {
+          if (vine->getBrand() == connectionState.get()) {
+            // We resolved to a capability that the peer handed off to us, and which we picked up
+            // from its host. Calls we already made to the promise went through the peer, and may
+            // still be on their way to the host, so talking to the host directly could let later
+            // calls overtake them. Keep going through the peer, using the vine.
+            replacement = vine->addRef();
+          }
+        }
+      }
+
       const void* replacementBrand = replacement->getBrand();
       bool isSameConnection = replacementBrand == connectionState.get();
       if (isSameConnection) {
@@ -1057,6 +1285,11 @@ private:
           // work. But also, call ordering is completely irrelevant with these so there's no need
           // to disembargo anyway.
           resolutionType = BROKEN;
+        } else if (connectionState->getVine(*replacement) != nullptr) {
+          // The peer handed the capability off to us, and we now talk to its host directly. This
+          // isn't a reflection, so there's nothing to disembargo. (Had the promise received calls,
+          // we'd normally have switched to the vine above to keep them in order.)
+          resolutionType = REMOTE;
         } else {
           resolutionType = REFLECTED;
         }
@@ -1119,7 +1352,7 @@ private:
         replacement = newLocalPromiseClient(kj::mv(embargoPromise));
 
         // Send the `Disembargo`.
-        message->send();
+        connectionState->sendMessage(*message);
       }
 
       cap = replacement->addRef();
@@ -1129,8 +1362,12 @@ private:
   };
 
   kj::Maybe<ExportId> writeDescriptor(ClientHook& cap, rpc::CapDescriptor::Builder descriptor,
-                                      kj::Vector<int>& fds) {
+                                      kj::Vector<int>& fds, bool allowThirdParty = false) {
     // Write a descriptor for the given capability.
+    //
+    // If `allowThirdParty` is true and the capability is hosted by another vat that the network
+    // can introduce our peer to, a `thirdPartyHosted` descriptor is written so that the peer can
+    // connect to the host directly. Only do this for descriptors sent in payloads.
 
     // Find the innermost wrapped capability.
     ClientHook* inner = &cap;
@@ -1149,39 +1386,115 @@ private:
 
     if (inner->getBrand() == this) {
       return kj::downcast<RpcClient>(*inner).writeDescriptor(descriptor, fds);
+    }
+
+    if (allowThirdParty) {
+      KJ_IF_MAYBE(host, findThirdPartyHost(*inner)) {
+        // Ask the host to hold the capability for our peer, and give the peer the vine (our own
+        // export of the capability) to use until it has picked it up, or if it can't.
+        auto thirdParty = descriptor.initThirdPartyHosted();
+        auto provision = host->provideTo(kj::downcast<RpcClient>(*inner), *this,
+                                         thirdParty.getId());
+        ExportId vineId = exportCap(*inner);
+        thirdParty.setVineId(vineId);
+        KJ_ASSERT_NONNULL(exports.find(vineId)).provisions.add(kj::mv(provision));
+        return vineId;
+      }
+    }
+
+    ExportId exportId = exportCap(*inner);
+    if (KJ_ASSERT_NONNULL(exports.find(exportId)).resolveOp == nullptr) {
+      descriptor.setSenderHosted(exportId);
     } else {
-      auto iter = exportsByCap.find(inner);
-      if (iter != exportsByCap.end()) {
-        // We've already seen and exported this capability before.  Just up the refcount.
-        auto& exp = KJ_ASSERT_NONNULL(exports.find(iter->second));
-        ++exp.refcount;
-        if (exp.resolveOp == nullptr) {
-          descriptor.setSenderHosted(iter->second);
-        } else {
-          descriptor.setSenderPromise(iter->second);
-        }
-        return iter->second;
-      } else {
-        // This is the first time we've seen this capability.
-        ExportId exportId;
-        auto& exp = exports.next(exportId);
-        exportsByCap[inner] = exportId;
-        exp.refcount = 1;
-        exp.clientHook = inner->addRef();
-
-        KJ_IF_MAYBE(wrapped, inner->whenMoreResolved()) {
-          // This is a promise.  Arrange for the `Resolve` message to be sent later.
-          exp.resolveOp = resolveExportedPromise(exportId, kj::mv(*wrapped));
-          descriptor.setSenderPromise(exportId);
-        } else {
-          descriptor.setSenderHosted(exportId);
-        }
+      descriptor.setSenderPromise(exportId);
+    }
+    return exportId;
+  }
+
+  ExportId exportCap(ClientHook& inner) {
+    // Adds a reference to `inner` (which must be fully resolved as far as possible) to the export
+    // table, returning its ID.
 
-        return exportId;
+    auto iter = exportsByCap.find(&inner);
+    if (iter != exportsByCap.end()) {
+      // We've already seen and exported this capability before.  Just up the refcount.
+      auto& exp = KJ_ASSERT_NONNULL(exports.find(iter->second));
+      ++exp.refcount;
+      return iter->second;
+    } else {
+      // This is the first time we've seen this capability.
+      ExportId exportId;
+      auto& exp = exports.next(exportId);
+      exportsByCap[&inner] = exportId;
+      exp.refcount = 1;
+      exp.clientHook = inner.addRef();
+
+      KJ_IF_MAYBE(wrapped, inner.whenMoreResolved()) {
+        // This is a promise.  Arrange for the `Resolve` message to be sent later.
+        exp.resolveOp = resolveExportedPromise(exportId, kj::mv(*wrapped));
       }
+
+      return exportId;
     }
   }
 
+  kj::Maybe<RpcConnectionState&> findThirdPartyHost(ClientHook& inner) {
+    // If `inner` is a settled capability imported over another of our connections, and the
+    // network can introduce our peer to that connection's peer, returns that connection.
+
+    if (inner.getFd() != nullptr || !connection.is<Connected>()) {
+      // FDs can't be handed off.
+      return nullptr;
+    }
+
+    KJ_IF_MAYBE(r, registry) {
+      KJ_IF_MAYBE(host, r->findByBrand(inner.getBrand())) {
+        if (host->connection.is<Connected>() &&
+            kj::downcast<RpcClient>(inner).isSettledImport() &&
+            host->connection.get<Connected>()->baseCanIntroduceTo(
+                *connection.get<Connected>())) {
+          return *host;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  kj::Promise<void> provideTo(RpcClient& target, RpcConnectionState& recipient,
+                              AnyPointer::Builder thirdPartyCapId) {
+    // Sends `Provide` to our peer, which hosts `target`, asking it to hold the capability for
+    // `recipient`'s peer. Fills in the ID with which the recipient will pick it up. The returned
+    // promise completes when the `Provide` returns; dropping it first sends `Finish`, canceling the
+    // provision.
+
+    auto message = connection.get<Connected>()->newOutgoingMessage(
+        messageSizeHint<rpc::Provide>() + 32);
+    auto builder = message->getBody().initAs<rpc::Message>().initProvide();
+
+    KJ_IF_MAYBE(redirect, target.writeTarget(builder.initTarget())) {
+      // Settled imports always target our peer.
+      KJ_FAIL_ASSERT("settled import redirected its target");
+    }
+    connection.get<Connected>()->baseIntroduceTo(
+        *recipient.connection.get<Connected>(), thirdPartyCapId, builder.getRecipient());
+
+    QuestionId questionId;
+    auto& question = questions.next(questionId);
+    question.isAwaitingReturn = true;
+
+    auto paf = kj::newPromiseAndFulfiller<kj::Promise<kj::Own<RpcResponse>>>();
+    auto questionRef = kj::refcounted<QuestionRef>(*this, questionId, kj::mv(paf.fulfiller));
+    question.selfRef = *questionRef;
+
+    builder.setQuestionId(questionId);
+    sendMessage(*message);
+
+    return paf.promise.attach(kj::mv(questionRef))
+        .then([](kj::Own<RpcResponse>&&) {}, [](kj::Exception&&) {
+      // The provision failed. The recipient will find out when it tries to pick it up.
+    }).eagerlyEvaluate(nullptr);
+  }
+
   kj::Array<ExportId> writeDescriptors(kj::ArrayPtr<kj::Maybe<kj::Own<ClientHook>>> capTable,
                                        rpc::Payload::Builder payload, kj::Vector<int>& fds) {
     if (capTable.size() == 0) {
@@ -1190,10 +1503,10 @@ private:
     }
 
     auto capTableBuilder = payload.initCapTable(capTable.size());
-    kj::Vector<ExportId> exports(capTable.size());
+    kj::SmallVector<ExportId, 4> exports;
     for (uint i: kj::indices(capTable)) {
       KJ_IF_MAYBE(cap, capTable[i]) {
-        KJ_IF_MAYBE(exportId, writeDescriptor(**cap, capTableBuilder[i], fds)) {
+        KJ_IF_MAYBE(exportId, writeDescriptor(**cap, capTableBuilder[i], fds, true)) {
           exports.add(*exportId);
         }
       } else {
@@ -1296,7 +1609,7 @@ private:
       kj::Vector<int> fds;
       writeDescriptor(*exp.clientHook, resolve.initCap(), fds);
       message->setFds(fds.releaseAsArray());
-      message->send();
+      sendMessage(*message);
 
       return kj::READY_NOW;
     }, [this,exportId](kj::Exception&& exception) {
@@ -1306,7 +1619,7 @@ private:
       auto resolve = message->getBody().initAs<rpc::Message>().initResolve();
       resolve.setPromiseId(exportId);
       fromException(exception, resolve.initException());
-      message->send();
+      sendMessage(*message);
     }).eagerlyEvaluate([this](kj::Exception&& exception) {
       // Put the exception on the TaskSet which will cause the connection to be terminated.
       tasks.add(kj::mv(exception));
@@ -1505,9 +1818,11 @@ private:
         return newBrokenCap("invalid 'receiverAnswer'");
       }
 
-      case rpc::CapDescriptor::THIRD_PARTY_HOSTED:
-        // We don't support third-party caps, so use the vine instead.
-        return import(descriptor.getThirdPartyHosted().getVineId(), false, kj::mv(fd));
+      case rpc::CapDescriptor::THIRD_PARTY_HOSTED: {
+        auto thirdParty = descriptor.getThirdPartyHosted();
+        auto vine = import(thirdParty.getVineId(), false, kj::mv(fd));
+        return acceptThirdPartyCap(thirdParty.getId(), kj::mv(vine));
+      }
 
       default:
         KJ_FAIL_REQUIRE("unknown CapDescriptor type") { break; }
@@ -1515,6 +1830,28 @@ private:
     }
   }
 
+  kj::Own<ClientHook> acceptThirdPartyCap(AnyPointer::Reader thirdPartyCapId,
+                                          kj::Own<ClientHook>&& vine) {
+    // Connects to the host of a capability handed off to us and picks it up, or falls back to the
+    // vine if the network can't reach the host.
+
+    if (!connection.is<Connected>()) {
+      return kj::mv(vine);
+    }
+
+    KJ_IF_MAYBE(r, registry) {
+      MallocMessageBuilder provisionMessage(64);
+      auto provisionId = provisionMessage.getRoot<AnyPointer>();
+      KJ_IF_MAYBE(hostConnection, connection.get<Connected>()->baseConnectToIntroduced(
+          thirdPartyCapId, provisionId)) {
+        return r->getConnectionState(kj::mv(*hostConnection))
+            .pickUp(provisionId.asReader(), kj::mv(vine));
+      }
+    }
+
+    return kj::mv(vine);
+  }
+
   kj::Array<kj::Maybe<kj::Own<ClientHook>>> receiveCaps(List<rpc::CapDescriptor>::Reader capTable,
                                                         kj::ArrayPtr<kj::AutoCloseFd> fds) {
     auto result = kj::heapArrayBuilder<kj::Maybe<kj::Own<ClientHook>>>(capTable.size());
@@ -1548,24 +1885,20 @@ private:
       // Send the "Finish" message (if the connection is not already broken).
       if (connectionState->connection.is<Connected>() && !question.skipFinish) {
         KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() {
-          auto message = connectionState->connection.get<Connected>()->newOutgoingMessage(
-              messageSizeHint<rpc::Finish>());
-          auto builder = message->getBody().getAs<rpc::Message>().initFinish();
-          builder.setQuestionId(id);
           // If we're still awaiting a return, then this request is being canceled, and we're going
           // to ignore any capabilities in the return message, so set releaseResultCaps true. If we
           // already received the return, then we've already built local proxies for the caps and
           // will send Release messages when those are destroyed.
-          builder.setReleaseResultCaps(question.isAwaitingReturn);
-          message->send();
+          connectionState->sendFinish(id, question.isAwaitingReturn);
         })) {
           connectionState->disconnect(kj::mv(*e));
         }
       }
 
       // Check if the question has returned and, if so, remove it from the table.
-      // Remove question ID from the table.  Must do this *after* sending `Finish` to ensure that
-      // the ID is not re-allocated before the `Finish` message can be sent.
+      // Remove question ID from the table.  Must do this *after* queuing `Finish` to ensure that
+      // the ID is not re-allocated before the `Finish` message can be sent. (A queued `Finish`
+      // is always sent before the next message, which is the earliest the ID could be reused.)
       if (question.isAwaitingReturn) {
         // Still waiting for return, so just remove the QuestionRef pointer from the table.
         question.selfRef = nullptr;
@@ -1605,7 +1938,8 @@ private:
               firstSegmentSize(sizeHint, messageSizeHint<rpc::Call>() +
                   sizeInWords<rpc::Payload>() + MESSAGE_TARGET_SIZE_HINT))),
           callBuilder(message->getBody().getAs<rpc::Message>().initCall()),
-          paramsBuilder(capTable.imbue(callBuilder.getParams().getContent())) {}
+          paramsBuilder(capTable.imbue(callBuilder.getParams().getContent())),
+          deadline(_::currentDeadline()) {}
 
     inline AnyPointer::Builder getRoot() {
       return paramsBuilder;
@@ -1614,6 +1948,10 @@ private:
       return callBuilder;
     }
 
+    inline bool attach(kj::Own<void>&& owner) {
+      return message->attach(kj::mv(owner));
+    }
+
     RemotePromise<AnyPointer> send() override {
       if (!connectionState->connection.is<Connected>()) {
         // Connection is broken.
@@ -1630,10 +1968,29 @@ private:
         auto replacement = redirect->get()->newCall(
             callBuilder.getInterfaceId(), callBuilder.getMethodId(), paramsBuilder.targetSize());
         replacement.set(paramsBuilder);
+        KJ_IF_MAYBE(d, deadline) {
+          replacement.setDeadline(*d);
+        }
         return replacement.send();
       } else {
+        kj::Maybe<CallTracer::Span> span;
+        KJ_IF_MAYBE(tracer, CallTracer::getInstalled()) {
+          span = tracer->sample(callBuilder.getInterfaceId(), callBuilder.getMethodId());
+          KJ_IF_MAYBE(s, span) {
+            callBuilder.setTraceId(s->getTraceId());
+          }
+        }
+
         auto sendResult = sendInternal(false);
 
+        KJ_IF_MAYBE(s, span) {
+          // The fork below evaluates this eagerly, so the span is dropped as soon as the response
+          // (or error) arrives.
+          sendResult.promise = sendResult.promise.attach(kj::defer([s = kj::mv(*s)]() mutable {
+            s.record(&CallTracer::MethodStats::roundTrip);
+          }));
+        }
+
         auto forkedPromise = sendResult.promise.fork();
 
         // The pipeline must get notified of resolution before the app does to maintain ordering.
@@ -1665,12 +2022,19 @@ private:
         auto replacement = redirect->get()->newCall(
             callBuilder.getInterfaceId(), callBuilder.getMethodId(), paramsBuilder.targetSize());
         replacement.set(paramsBuilder);
+        KJ_IF_MAYBE(d, deadline) {
+          replacement.setDeadline(*d);
+        }
         return RequestHook::from(kj::mv(replacement))->sendStreaming();
       } else {
         return sendStreamingInternal(false);
       }
     }
 
+    void setDeadline(kj::TimePoint deadline) override {
+      this->deadline = deadline;
+    }
+
     struct TailInfo {
       QuestionId questionId;
       kj::Promise<void> promise;
@@ -1722,6 +2086,7 @@ private:
     BuilderCapabilityTable capTable;
     rpc::Call::Builder callBuilder;
     AnyPointer::Builder paramsBuilder;
+    kj::Maybe<kj::TimePoint> deadline;
 
     struct SendInternalResult {
       kj::Own<QuestionRef> questionRef;
@@ -1744,6 +2109,14 @@ private:
           capTable.getTable(), callBuilder.getParams(), fds);
       message->setFds(fds.releaseAsArray());
 
+      KJ_IF_MAYBE(d, deadline) {
+        // The receiver's clock isn't comparable with ours, so send the time remaining. If that's
+        // already zero, send the smallest non-zero timeout so that the receiver will shed the
+        // call.
+        auto remaining = (*d - kj::systemPreciseMonotonicClock().now()) / kj::NANOSECONDS;
+        callBuilder.setTimeout(kj::max(remaining, int64_t(1)));
+      }
+
       // Init the question table.  Do this after writing descriptors to avoid interference.
       QuestionId questionId;
       auto& question = connectionState->questions.next(questionId);
@@ -1773,7 +2146,7 @@ private:
       KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
         KJ_CONTEXT("sending RPC call",
            callBuilder.getInterfaceId(), callBuilder.getMethodId());
-        message->send();
+        connectionState->sendMessage(*message);
       })) {
         // We can't safely throw the exception from here since we've already modified the question
         // table state. We'll have to reject the promise instead.
@@ -1806,7 +2179,15 @@ private:
           flow = target->flowController.emplace(
               connectionState->connection.get<Connected>()->newStream());
         }
-        flowPromise = flow->send(kj::mv(message), setup.promise.ignoreResult());
+        size_t size = message->sizeInWords() * sizeof(word);
+        message->setPriority(OutgoingRpcMessage::Priority::BULK);
+        connectionState->noteSent(*message);
+        connectionState->streamBytesInFlight += size;
+        auto ack = setup.promise.ignoreResult()
+            .attach(kj::defer([connectionState = kj::addRef(*connectionState), size]() mutable {
+          connectionState->streamBytesInFlight -= size;
+        }));
+        flowPromise = flow->send(kj::mv(message), kj::mv(ack));
       })) {
         // We can't safely throw the exception from here since we've already modified the question
         // table state. We'll have to reject the promise instead.
@@ -2007,7 +2388,11 @@ private:
         }
       }
 
-      message->send();
+      // A Return can't refer to anything introduced by a streaming call we've sent. (Any embargo
+      // it triggers is lifted by a Disembargo that we'll send in order.) So there's no need for it
+      // to wait behind our streams.
+      message->setPriority(OutgoingRpcMessage::Priority::EXPEDITED);
+      connectionState.sendMessage(*message);
       if (capTable.size() == 0) {
         return nullptr;
       } else {
@@ -2052,12 +2437,15 @@ private:
                    kj::Array<kj::Maybe<kj::Own<ClientHook>>> capTableArray,
                    const AnyPointer::Reader& params,
                    bool redirectResults, kj::Own<kj::PromiseFulfiller<void>>&& cancelFulfiller,
-                   uint64_t interfaceId, uint16_t methodId)
+                   uint64_t interfaceId, uint16_t methodId, kj::Maybe<kj::TimePoint> deadline,
+                   kj::Maybe<kj::Own<RpcCallLimiter>> limiterSlot)
         : connectionState(kj::addRef(connectionState)),
           answerId(answerId),
           interfaceId(interfaceId),
           methodId(methodId),
+          deadline(deadline),
           requestSize(request->sizeInWords()),
+          limiterSlot(kj::mv(limiterSlot)),
           request(kj::mv(request)),
           paramsCapTable(kj::mv(capTableArray)),
           params(paramsCapTable.imbue(params)),
@@ -2065,6 +2453,7 @@ private:
           redirectResults(redirectResults),
           cancelFulfiller(kj::mv(cancelFulfiller)) {
       connectionState.callWordsInFlight += requestSize;
+      ++connectionState.callsInFlight;
     }
 
     ~RpcCallContext() noexcept(false) {
@@ -2092,7 +2481,7 @@ private:
               builder.setCanceled();
             }
 
-            message->send();
+            connectionState->sendMessage(*message);
           }
 
           cleanupAnswerTable(nullptr, shouldFreePipeline);
@@ -2158,7 +2547,8 @@ private:
           builder.setReleaseParamCaps(false);
           connectionState->fromException(exception, builder.initException());
 
-          message->send();
+          message->setPriority(OutgoingRpcMessage::Priority::EXPEDITED);
+          connectionState->sendMessage(*message);
         }
 
         // Do not allow releasing the pipeline because we want pipelined calls to propagate the
@@ -2178,7 +2568,7 @@ private:
         builder.setReleaseParamCaps(false);
         builder.setResultsSentElsewhere();
 
-        message->send();
+        connectionState->sendMessage(*message);
 
         cleanupAnswerTable(nullptr, false);
       }
@@ -2210,6 +2600,14 @@ private:
     void releaseParams() override {
       request = nullptr;
     }
+    kj::Own<void> releaseParamsMessage() override {
+      KJ_IF_MAYBE(r, request) {
+        kj::Own<void> result = kj::mv(*r);
+        request = nullptr;
+        return result;
+      }
+      return kj::Own<void>();
+    }
     AnyPointer::Builder getResults(kj::Maybe<MessageSize> sizeHint) override {
       KJ_IF_MAYBE(r, response) {
         return r->get()->getResultsBuilder();
@@ -2263,7 +2661,7 @@ private:
               builder.setReleaseParamCaps(false);
               builder.setTakeFromOtherQuestion(tailInfo->questionId);
 
-              message->send();
+              connectionState->sendMessage(*message);
             }
 
             // There are no caps in our return message, but of course the tail results could have
@@ -2305,6 +2703,9 @@ private:
     kj::Own<CallContextHook> addRef() override {
       return kj::addRef(*this);
     }
+    kj::Maybe<kj::TimePoint> getDeadline() override {
+      return deadline;
+    }
 
   private:
     kj::Own<RpcConnectionState> connectionState;
@@ -2314,9 +2715,13 @@ private:
     uint16_t methodId;
     // For debugging.
 
+    kj::Maybe<kj::TimePoint> deadline;
+
     // Request ---------------------------------------------
 
     size_t requestSize;  // for flow limit purposes
+    kj::Maybe<kj::Own<RpcCallLimiter>> limiterSlot;
+    // Set if this call was admitted by a shared RpcCallLimiter, which must be told when it's done.
     kj::Maybe<kj::Own<IncomingRpcMessage>> request;
     ReaderCapabilityTable paramsCapTable;
     AnyPointer::Reader params;
@@ -2383,6 +2788,11 @@ private:
 
       // Also, this is the right time to stop counting the call against the flow limit.
       connectionState->callWordsInFlight -= requestSize;
+      --connectionState->callsInFlight;
+      KJ_IF_MAYBE(l, limiterSlot) {
+        l->get()->release();
+        limiterSlot = nullptr;
+      }
       connectionState->maybeUnblockFlow();
     }
   };
@@ -2442,8 +2852,142 @@ private:
     });
   }
 
+  static void countMessage(uint64_t (&counts)[RpcConnectionStats::MESSAGE_TYPE_COUNT],
+                           rpc::Message::Which type) {
+    if (type < RpcConnectionStats::MESSAGE_TYPE_COUNT) {
+      ++counts[type];
+    }
+  }
+
+  void noteSent(OutgoingRpcMessage& message) {
+    if (pendingFinishes.size() > 0 || pendingReleases.size() > 0) {
+      // Queued `Finish`es and `Release`s must go out ahead of whatever we send next, e.g. so that
+      // a `Call` never reuses a question ID the peer hasn't seen finished yet.
+      flushReleases();
+    }
+    countMessage(messagesSent, message.getBody().getAs<rpc::Message>().which());
+  }
+
+  void sendFinish(QuestionId questionId, bool releaseResultCaps) {
+    // Sends a `Finish` for the given question. This may be deferred until the end of the current
+    // turn of the event loop to be combined with others into a `BulkRelease`.
+
+    if (bulkReleaseSupport == BulkReleaseSupport::UNSUPPORTED) {
+      sendFinishNow(questionId, releaseResultCaps);
+    } else {
+      pendingFinishes.add(PendingFinish { questionId, releaseResultCaps });
+      scheduleFlushReleases();
+    }
+  }
+
+  void sendRelease(ImportId importId, uint32_t referenceCount) {
+    // Like sendFinish(), but for `Release`.
+
+    if (bulkReleaseSupport == BulkReleaseSupport::UNSUPPORTED) {
+      sendReleaseNow(importId, referenceCount);
+    } else {
+      pendingReleases.add(PendingRelease { importId, referenceCount });
+      scheduleFlushReleases();
+    }
+  }
+
+  void scheduleFlushReleases() {
+    if (!releaseFlushScheduled) {
+      releaseFlushScheduled = true;
+      tasks.add(canceler.wrap(kj::evalLater([this]() {
+        releaseFlushScheduled = false;
+        flushReleases();
+      })));
+    }
+  }
+
+  void flushReleases() {
+    // Sends everything queued by sendFinish() and sendRelease(): as one `BulkRelease` if the peer
+    // supports it, otherwise as individual messages.
+
+    auto finishes = kj::mv(pendingFinishes);
+    auto releases = kj::mv(pendingReleases);
+    size_t count = finishes.size() + releases.size();
+    if (count == 0 || !connection.is<Connected>()) return;
+
+    if (count > 1) {
+      switch (bulkReleaseSupport) {
+        case BulkReleaseSupport::SUPPORTED: {
+          auto message = connection.get<Connected>()->newOutgoingMessage(
+              messageSizeHint<rpc::BulkRelease>() + 2 +
+              finishes.size() * sizeInWords<rpc::Finish>() +
+              releases.size() * sizeInWords<rpc::Release>());
+          auto bulk = message->getBody().initAs<rpc::Message>().initBulkRelease();
+          auto finishList = bulk.initFinishes(finishes.size());
+          for (auto i: kj::indices(finishes)) {
+            finishList[i].setQuestionId(finishes[i].questionId);
+            finishList[i].setReleaseResultCaps(finishes[i].releaseResultCaps);
+          }
+          auto releaseList = bulk.initReleases(releases.size());
+          for (auto i: kj::indices(releases)) {
+            releaseList[i].setId(releases[i].importId);
+            releaseList[i].setReferenceCount(releases[i].referenceCount);
+          }
+          sendMessage(*message);
+          return;
+        }
+
+        case BulkReleaseSupport::UNKNOWN:
+          // This peer would benefit from `BulkRelease`. Find out if it supports it.
+          advertiseBulkRelease();
+          bulkReleaseSupport = BulkReleaseSupport::ADVERTISED;
+          break;
+
+        case BulkReleaseSupport::ADVERTISED:
+        case BulkReleaseSupport::UNSUPPORTED:
+          break;
+      }
+    }
+
+    for (auto& finish: finishes) {
+      sendFinishNow(finish.questionId, finish.releaseResultCaps);
+    }
+    for (auto& release: releases) {
+      sendReleaseNow(release.importId, release.referenceCount);
+    }
+  }
+
+  void sendFinishNow(QuestionId questionId, bool releaseResultCaps) {
+    auto message = connection.get<Connected>()->newOutgoingMessage(
+        messageSizeHint<rpc::Finish>());
+    auto builder = message->getBody().initAs<rpc::Message>().initFinish();
+    builder.setQuestionId(questionId);
+    builder.setReleaseResultCaps(releaseResultCaps);
+    sendMessage(*message);
+  }
+
+  void sendReleaseNow(ImportId importId, uint32_t referenceCount) {
+    auto message = connection.get<Connected>()->newOutgoingMessage(
+        messageSizeHint<rpc::Release>());
+    auto builder = message->getBody().initAs<rpc::Message>().initRelease();
+    builder.setId(importId);
+    builder.setReferenceCount(referenceCount);
+    sendMessage(*message);
+  }
+
+  void advertiseBulkRelease() {
+    // An empty `BulkRelease` tells the peer we understand them. See rpc.capnp.
+    auto message = connection.get<Connected>()->newOutgoingMessage(
+        messageSizeHint<rpc::BulkRelease>());
+    message->getBody().initAs<rpc::Message>().initBulkRelease();
+    sendMessage(*message);
+  }
+
+  void sendMessage(OutgoingRpcMessage& message) {
+    // Sends a message, counting it for getStats(). All messages on this connection should be sent
+    // through here (or counted with noteSent(), if sent indirectly).
+    noteSent(message);
+    message.send();
+  }
+
   void handleMessage(kj::Own<IncomingRpcMessage> message) {
     auto reader = message->getBody().getAs<rpc::Message>();
+    countMessage(messagesReceived, reader.which());
 
     switch (reader.which()) {
       case rpc::Message::UNIMPLEMENTED:
@@ -2482,12 +3026,24 @@ private:
         handleDisembargo(reader.getDisembargo());
         break;
 
+      case rpc::Message::BULK_RELEASE:
+        handleBulkRelease(reader.getBulkRelease());
+        break;
+
+      case rpc::Message::PROVIDE:
+        handleProvide(reader.getProvide());
+        break;
+
+      case rpc::Message::ACCEPT:
+        handleAccept(kj::mv(message), reader.getAccept());
+        break;
+
       default: {
         if (connection.is<Connected>()) {
           auto message = connection.get<Connected>()->newOutgoingMessage(
               firstSegmentSize(reader.totalSize(), messageSizeHint<void>()));
           message->getBody().initAs<rpc::Message>().setUnimplemented(reader);
-          message->send();
+          sendMessage(*message);
         }
         break;
       }
@@ -2528,6 +3084,33 @@ private:
         break;
       }
 
+      case rpc::Message::BULK_RELEASE:
+        // The peer doesn't know `BulkRelease`. We only ever send it an empty one (to find this
+        // out), so there's nothing to redo.
+        bulkReleaseSupport = BulkReleaseSupport::UNSUPPORTED;
+        break;
+
+      case rpc::Message::PROVIDE:
+      case rpc::Message::ACCEPT: {
+        // The network thought the peer could take part in a three-party handoff, but it can't.
+        // Fail the question; the recipient will end up with a broken capability.
+        QuestionId questionId = message.isProvide()
+            ? message.getProvide().getQuestionId() : message.getAccept().getQuestionId();
+        KJ_IF_MAYBE(question, questions.find(questionId)) {
+          if (question->isAwaitingReturn) {
+            question->isAwaitingReturn = false;
+            question->skipFinish = true;
+            KJ_IF_MAYBE(questionRef, question->selfRef) {
+              questionRef->reject(KJ_EXCEPTION(UNIMPLEMENTED,
+                  "peer doesn't support three-party handoff"));
+            } else {
+              questions.erase(questionId, *question);
+            }
+          }
+        }
+        break;
+      }
+
       default:
         KJ_FAIL_ASSERT("Peer did not implement required RPC message type.", (uint)message.which());
         break;
@@ -2564,7 +3147,25 @@ private:
 
   void handleBootstrap(kj::Own<IncomingRpcMessage>&& message,
                        const rpc::Bootstrap::Reader& bootstrap) {
-    AnswerId answerId = bootstrap.getQuestionId();
+    answerWithCap(kj::mv(message), bootstrap.getQuestionId(),
+        [&](VatNetworkBase::Connection& conn) -> Capability::Client {
+      if (bootstrap.hasDeprecatedObjectId()) {
+        KJ_IF_MAYBE(r, restorer) {
+          return r->baseRestore(bootstrap.getDeprecatedObjectId());
+        } else {
+          KJ_FAIL_REQUIRE("This vat only supports a bootstrap interface, not the old "
+                          "Cap'n-Proto-0.4-style named exports.");
+        }
+      } else {
+        return bootstrapFactory.baseCreateFor(conn.baseGetPeerVatId());
+      }
+    });
+  }
+
+  void answerWithCap(kj::Own<IncomingRpcMessage>&& message, AnswerId answerId,
+                     kj::FunctionParam<Capability::Client(VatNetworkBase::Connection&)> getCap) {
+    // Answers a question whose result is a single capability, returned by `getCap()`, which runs
+    // before `message` is released. Used for `Bootstrap` and `Accept`.
 
     if (!connection.is<Connected>()) {
       // Disconnected; ignore.
@@ -2582,20 +3183,9 @@ private:
     kj::Array<ExportId> resultExports;
     KJ_DEFER(releaseExports(resultExports));  // in case something goes wrong
 
-    // Call the restorer and initialize the answer.
+    // Get the capability and initialize the answer.
     KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
-      Capability::Client cap = nullptr;
-
-      if (bootstrap.hasDeprecatedObjectId()) {
-        KJ_IF_MAYBE(r, restorer) {
-          cap = r->baseRestore(bootstrap.getDeprecatedObjectId());
-        } else {
-          KJ_FAIL_REQUIRE("This vat only supports a bootstrap interface, not the old "
-                          "Cap'n-Proto-0.4-style named exports.") { return; }
-        }
-      } else {
-        cap = bootstrapFactory.baseCreateFor(conn.baseGetPeerVatId());
-      }
+      Capability::Client cap = getCap(conn);
 
       BuilderCapabilityTable capTable;
       auto payload = ret.initResults();
@@ -2624,7 +3214,7 @@ private:
     answer.active = true;
     answer.pipeline = kj::Own<PipelineHook>(kj::refcounted<SingleCapPipeline>(kj::mv(capHook)));
 
-    response->send();
+    sendMessage(*response);
   }
 
   void handleCall(kj::Own<IncomingRpcMessage>&& message, const rpc::Call::Reader& call) {
@@ -2649,16 +3239,34 @@ private:
         KJ_FAIL_REQUIRE("Unsupported `Call.sendResultsTo`.") { return; }
     }
 
+    kj::Maybe<kj::Own<RpcCallLimiter>> limiterSlot;
+    if (callsInFlight >= callLimit) {
+      rejectCall(capability);
+    } else KJ_IF_MAYBE(l, callLimiter) {
+      if (l->get()->tryAdmit()) {
+        limiterSlot = kj::addRef(**l);
+      } else {
+        rejectCall(capability);
+      }
+    }
+
     auto payload = call.getParams();
     auto capTableArray = receiveCaps(payload.getCapTable(), message->getAttachedFds());
     auto cancelPaf = kj::newPromiseAndFulfiller<void>();
 
     AnswerId answerId = call.getQuestionId();
 
+    kj::Maybe<kj::TimePoint> deadline;
+    if (call.getTimeout() != 0) {
+      // Clamp absurdly long timeouts so the deadline can't overflow.
+      int64_t timeout = kj::min(call.getTimeout(), uint64_t(1) << 62);
+      deadline = kj::systemPreciseMonotonicClock().now() + timeout * kj::NANOSECONDS;
+    }
+
     auto context = kj::refcounted<RpcCallContext>(
         *this, answerId, kj::mv(message), kj::mv(capTableArray), payload.getContent(),
         redirectResults, kj::mv(cancelPaf.fulfiller),
-        call.getInterfaceId(), call.getMethodId());
+        call.getInterfaceId(), call.getMethodId(), deadline, kj::mv(limiterSlot));
 
     // No more using `call` after this point, as it now belongs to the context.
 
@@ -2673,9 +3281,18 @@ private:
       answer.callContext = *context;
     }
 
+    kj::Maybe<CallTracer::TraceScope> traceScope;
+    if (call.getTraceId() != 0) {
+      // The caller is tracing this call. If the target is a local object, it will pick up the
+      // trace ID when the call is delivered to it, just below.
+      traceScope.emplace(call.getTraceId());
+    }
+
     auto promiseAndPipeline = startCall(
         call.getInterfaceId(), call.getMethodId(), kj::mv(capability), context->addRef());
 
+    traceScope = nullptr;
+
     // Things may have changed -- in particular if startCall() immediately called
     // context->directTailCall().
 
@@ -2720,6 +3337,17 @@ private:
     }
   }
 
+  void rejectCall(kj::Own<ClientHook>& capability) {
+    // Over a call limit: deliver the call to a broken capability instead, so that it fails
+    // immediately, but otherwise goes through the usual answer bookkeeping.
+    ++callsRejected;
+    KJ_IF_MAYBE(l, callLimiter) {
+      l->get()->countRejected();
+    }
+    capability = newBrokenCap(
+        KJ_EXCEPTION(OVERLOADED, "too many calls in progress; try again later"));
+  }
+
   ClientHook::VoidPromiseAndPipeline startCall(
       uint64_t interfaceId, uint64_t methodId,
       kj::Own<ClientHook>&& capability, kj::Own<CallContextHook>&& context) {
@@ -2916,6 +3544,19 @@ private:
 
       pipelineToRelease = kj::mv(answer->pipeline);
 
+      if (answer->provideOp != nullptr && !answer->provideReturned &&
+          connection.is<Connected>()) {
+        // The introducer gave up on a `Provide` before the recipient picked up the capability.
+        // Erasing the answer below cancels the provision; let the introducer know.
+        auto message = connection.get<Connected>()->newOutgoingMessage(
+            messageSizeHint<rpc::Return>());
+        auto ret = message->getBody().initAs<rpc::Message>().initReturn();
+        ret.setAnswerId(finish.getQuestionId());
+        ret.setReleaseParamCaps(false);
+        ret.setCanceled();
+        sendMessage(*message);
+      }
+
       // If the call isn't actually done yet, cancel it.  Otherwise, we can go ahead and erase the
       // question from the table.
       KJ_IF_MAYBE(context, answer->callContext) {
@@ -2977,6 +3618,21 @@ private:
     releaseExport(release.getId(), release.getReferenceCount());
   }
 
+  void handleBulkRelease(const rpc::BulkRelease::Reader& bulk) {
+    if (bulkReleaseSupport == BulkReleaseSupport::UNKNOWN && connection.is<Connected>()) {
+      // The peer is advertising support. Let it know we support it too.
+      advertiseBulkRelease();
+    }
+    bulkReleaseSupport = BulkReleaseSupport::SUPPORTED;
+
+    for (auto finish: bulk.getFinishes()) {
+      handleFinish(finish);
+    }
+    for (auto release: bulk.getReleases()) {
+      handleRelease(release);
+    }
+  }
+
   void releaseExport(ExportId id, uint refcount) {
     KJ_IF_MAYBE(exp, exports.find(id)) {
       KJ_REQUIRE(refcount <= exp->refcount, "Tried to drop export's refcount below zero.") {
@@ -3061,7 +3717,7 @@ private:
 
           builder.getContext().setReceiverLoopback(embargoId);
 
-          message->send();
+          sendMessage(*message);
         }))));
 
         break;
@@ -3086,11 +3742,81 @@ private:
 
   // ---------------------------------------------------------------------------
   // Level 2
+
+  // ---------------------------------------------------------------------------
+  // Level 3
+
+  void handleProvide(const rpc::Provide::Reader& provide) {
+    AnswerId answerId = provide.getQuestionId();
+
+    if (!connection.is<Connected>()) {
+      // Disconnected; ignore.
+      return;
+    }
+
+    kj::Own<ClientHook> target;
+    KJ_IF_MAYBE(t, getMessageTarget(provide.getTarget())) {
+      target = kj::mv(*t);
+    } else {
+      // Exception already reported.
+      return;
+    }
+
+    auto& answer = answers[answerId];
+    KJ_REQUIRE(!answer.active, "questionId is already in use", answerId) {
+      return;
+    }
+    answer.active = true;
+
+    // Hold the capability until the recipient picks it up, then return. If the introducer sends
+    // `Finish` first, the provision is canceled.
+    answer.provideOp = connection.get<Connected>()->baseProvide(
+        provide.getRecipient(), Capability::Client(kj::mv(target)))
+        .then([this,answerId]() {
+      returnProvide(answerId, nullptr);
+    }, [this,answerId](kj::Exception&& exception) {
+      returnProvide(answerId, kj::mv(exception));
+    }).eagerlyEvaluate([this](kj::Exception&& exception) {
+      tasks.add(kj::mv(exception));
+    });
+  }
+
+  void returnProvide(AnswerId answerId, kj::Maybe<kj::Exception> exception) {
+    // The answer is still on the table, since erasing it would have canceled us.
+    auto& answer = KJ_ASSERT_NONNULL(answers.find(answerId));
+    answer.provideReturned = true;
+
+    if (!connection.is<Connected>()) {
+      return;
+    }
+
+    auto message = connection.get<Connected>()->newOutgoingMessage(
+        messageSizeHint<rpc::Return>() +
+        exception.map([](kj::Exception& e) { return exceptionSizeHint(e); }).orDefault(0));
+    auto ret = message->getBody().initAs<rpc::Message>().initReturn();
+    ret.setAnswerId(answerId);
+    ret.setReleaseParamCaps(false);
+    KJ_IF_MAYBE(e, exception) {
+      fromException(*e, ret.initException());
+    } else {
+      ret.initResults();
+    }
+    sendMessage(*message);
+  }
+
+  void handleAccept(kj::Own<IncomingRpcMessage>&& message, const rpc::Accept::Reader& accept) {
+    answerWithCap(kj::mv(message), accept.getQuestionId(),
+        [&](VatNetworkBase::Connection& conn) -> Capability::Client {
+      KJ_REQUIRE(!accept.getEmbargo(), "Embargoed 'Accept' is not supported.");
+      return conn.basePickUp(accept.getProvision());
+    });
+  }
 };
 
 }  // namespace
 
-class RpcSystemBase::Impl final: private BootstrapFactoryBase, private kj::TaskSet::ErrorHandler {
+class RpcSystemBase::Impl final: private BootstrapFactoryBase, private ConnectionRegistry,
+                                 private kj::TaskSet::ErrorHandler {
 public:
   Impl(VatNetworkBase& network, kj::Maybe<Capability::Client> bootstrapInterface)
       : network(network), bootstrapInterface(kj::mv(bootstrapInterface)),
@@ -3152,10 +3878,35 @@ public:
     }
   }
 
+  void setCallLimit(size_t maxCalls, kj::Maybe<kj::Own<RpcCallLimiter>> limiter) {
+    callLimit = maxCalls;
+    callLimiter = kj::mv(limiter);
+
+    for (auto& conn: connections) {
+      conn.second->setCallLimit(maxCalls, addRefLimiter());
+    }
+  }
+
+  kj::Maybe<kj::Own<RpcCallLimiter>> addRefLimiter() {
+    KJ_IF_MAYBE(l, callLimiter) {
+      return kj::addRef(**l);
+    } else {
+      return nullptr;
+    }
+  }
+
   void setTraceEncoder(kj::Function<kj::String(const kj::Exception&)> func) {
     traceEncoder = kj::mv(func);
   }
 
+  kj::Array<RpcConnectionStats> getConnectionStats() {
+    auto result = kj::heapArrayBuilder<RpcConnectionStats>(connections.size());
+    for (auto& conn: connections) {
+      result.add(conn.second->getStats());
+    }
+    return result.finish();
+  }
+
   kj::Promise<void> run() { return kj::mv(acceptLoopPromise); }
 
 private:
@@ -3164,6 +3915,8 @@ private:
   BootstrapFactoryBase& bootstrapFactory;
   kj::Maybe<SturdyRefRestorerBase&> restorer;
   size_t flowLimit = kj::maxValue;
+  size_t callLimit = kj::maxValue;
+  kj::Maybe<kj::Own<RpcCallLimiter>> callLimiter;
   kj::Maybe<kj::Function<kj::String(const kj::Exception&)>> traceEncoder;
   kj::Promise<void> acceptLoopPromise = nullptr;
   kj::TaskSet tasks;
@@ -3172,29 +3925,46 @@ private:
       ConnectionMap;
   ConnectionMap connections;
 
+  std::unordered_map<const void*, RpcConnectionState*> connectionsByBrand;
+  // The same connections, keyed by the brand of their capabilities (which is the address of the
+  // RpcConnectionState).
+
   kj::UnwindDetector unwindDetector;
 
-  RpcConnectionState& getConnectionState(kj::Own<VatNetworkBase::Connection>&& connection) {
+  RpcConnectionState& getConnectionState(
+      kj::Own<VatNetworkBase::Connection>&& connection) override {
     auto iter = connections.find(connection);
     if (iter == connections.end()) {
       VatNetworkBase::Connection* connectionPtr = connection;
       auto onDisconnect = kj::newPromiseAndFulfiller<RpcConnectionState::DisconnectInfo>();
+      auto newState = kj::refcounted<RpcConnectionState>(
+          bootstrapFactory, restorer, kj::mv(connection),
+          kj::mv(onDisconnect.fulfiller), flowLimit, callLimit, addRefLimiter(), traceEncoder,
+          static_cast<ConnectionRegistry&>(*this));
+      RpcConnectionState& result = *newState;
       tasks.add(onDisconnect.promise
-          .then([this,connectionPtr](RpcConnectionState::DisconnectInfo info) {
+          .then([this,connectionPtr,brand=&result](RpcConnectionState::DisconnectInfo info) {
+        connectionsByBrand.erase(brand);
         connections.erase(connectionPtr);
         tasks.add(kj::mv(info.shutdownPromise));
       }));
-      auto newState = kj::refcounted<RpcConnectionState>(
-          bootstrapFactory, restorer, kj::mv(connection),
-          kj::mv(onDisconnect.fulfiller), flowLimit, traceEncoder);
-      RpcConnectionState& result = *newState;
       connections.insert(std::make_pair(connectionPtr, kj::mv(newState)));
+      connectionsByBrand.insert(std::make_pair(&result, &result));
       return result;
     } else {
       return *iter->second;
     }
   }
 
+  kj::Maybe<RpcConnectionState&> findByBrand(const void* brand) override {
+    auto iter = connectionsByBrand.find(brand);
+    if (iter == connectionsByBrand.end()) {
+      return nullptr;
+    } else {
+      return *iter->second;
+    }
+  }
+
   kj::Promise<void> acceptLoop() {
     return network.baseAccept().then(
         [this](kj::Own<VatNetworkBase::Connection>&& connection) {
@@ -3245,6 +4015,15 @@ void RpcSystemBase::baseSetFlowLimit(size_t words) {
   return impl->setFlowLimit(words);
 }
 
+void RpcSystemBase::baseSetCallLimit(
+    size_t maxCalls, kj::Maybe<kj::Own<RpcCallLimiter>> sharedLimiter) {
+  return impl->setCallLimit(maxCalls, kj::mv(sharedLimiter));
+}
+
+kj::Array<RpcConnectionStats> RpcSystemBase::baseGetConnectionStats() {
+  return impl->getConnectionStats();
+}
+
 void RpcSystemBase::setTraceEncoder(kj::Function<kj::String(const kj::Exception&)> func) {
   impl->setTraceEncoder(kj::mv(func));
 }
@@ -3253,10 +4032,76 @@ kj::Promise<void> RpcSystemBase::run() {
   return impl->run();
 }
 
+kj::Exception handoffUnimplemented() {
+  return KJ_EXCEPTION(UNIMPLEMENTED, "this network doesn't support three-party handoff");
+}
+
 }  // namespace _ (private)
 
 // =======================================================================================
 
+RpcMemoryBudget::RpcMemoryBudget(size_t limit, kj::Maybe<kj::Own<RpcMemoryBudget>> parent)
+    : limit(limit), parent(kj::mv(parent)) {}
+
+void RpcMemoryBudget::setLimit(size_t newLimit) {
+  limit = newLimit;
+  if (used <= limit) {
+    for (auto& waiter: waiters) {
+      waiter->fulfill();
+    }
+    waiters.clear();
+  }
+}
+
+bool RpcMemoryBudget::isOverLimit() const {
+  if (used > limit) return true;
+  KJ_IF_MAYBE(p, parent) {
+    return p->get()->isOverLimit();
+  }
+  return false;
+}
+
+kj::Promise<void> RpcMemoryBudget::whenWithinLimit() {
+  if (used > limit) {
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    waiters.add(kj::mv(paf.fulfiller));
+    return paf.promise.then([this]() { return whenWithinLimit(); }).attach(kj::addRef(*this));
+  }
+  KJ_IF_MAYBE(p, parent) {
+    if (p->get()->isOverLimit()) {
+      // Once the ancestors are within their limits, this one may not be anymore.
+      return p->get()->whenWithinLimit().then([this]() { return whenWithinLimit(); })
+          .attach(kj::addRef(*this));
+    }
+  }
+  return kj::READY_NOW;
+}
+
+void RpcMemoryBudget::charge(size_t bytes) {
+  used += bytes;
+  peak = kj::max(peak, used);
+  KJ_IF_MAYBE(p, parent) {
+    p->get()->charge(bytes);
+  }
+}
+
+void RpcMemoryBudget::release(size_t bytes) {
+  KJ_IREQUIRE(bytes <= used);
+  bool wasOver = used > limit;
+  used -= bytes;
+  if (wasOver && used <= limit) {
+    for (auto& waiter: waiters) {
+      waiter->fulfill();
+    }
+    waiters.clear();
+  }
+  KJ_IF_MAYBE(p, parent) {
+    p->get()->release(bytes);
+  }
+}
+
+// =======================================================================================
+
 namespace {
 
 class WindowFlowController final: public RpcFlowController, private kj::TaskSet::ErrorHandler {
@@ -3387,6 +4232,174 @@ private:
   WindowFlowController inner;
 };
 
+class AdaptiveWindowFlowController final
+    : public RpcFlowController, public RpcFlowController::WindowGetter {
+  // Applies a window of about twice the stream's bandwidth-delay product, measured from the
+  // messages' acks. This is a simplified BBR: since the window is all we control, we don't pace
+  // or cycle the gain to probe for more bandwidth. We do drain the window periodically to
+  // re-measure the minimum RTT, since otherwise our own queue would inflate it.
+
+public:
+  AdaptiveWindowFlowController(const kj::MonotonicClock& clock, size_t maxWindow)
+      : clock(clock), maxWindow(maxWindow),
+        window(kj::min(DEFAULT_WINDOW_SIZE, maxWindow)),
+        deliveredTime(clock.now()), minRttTime(deliveredTime), probeEndTime(deliveredTime),
+        inner(*this) {}
+
+  kj::Promise<void> send(kj::Own<OutgoingRpcMessage> message, kj::Promise<void> ack) override {
+    size_t size = message->sizeInWords() * sizeof(capnp::word);
+    auto now = clock.now();
+
+    if (inFlight == 0) {
+      // Don't count the time we spent idle against the delivery rate.
+      deliveredTime = now;
+    }
+
+    Sample sample {
+      now, delivered, deliveredTime,
+      // If we're sending with room to spare in the window, we're limited by the application, so
+      // this message's delivery rate probably understates the bandwidth.
+      inFlight + size < window
+    };
+    inFlight += size;
+
+    return inner.send(kj::mv(message), ack.then([this,size,sample]() {
+      onAck(size, sample);
+    }));
+  }
+
+  kj::Promise<void> waitAllAcked() override {
+    return inner.waitAllAcked();
+  }
+
+  size_t getWindow() override { return window; }
+
+private:
+  const kj::MonotonicClock& clock;
+  size_t maxWindow;
+  size_t window;
+
+  size_t inFlight = 0;
+  uint64_t delivered = 0;
+  kj::TimePoint deliveredTime;
+  // Total bytes acked so far, and when the last ack arrived.
+
+  struct Sample {
+    kj::TimePoint sendTime;
+    uint64_t delivered;
+    kj::TimePoint deliveredTime;
+    bool appLimited;
+    // State as of when a message was sent.
+  };
+
+  kj::Duration minRtt = kj::maxValue;
+  kj::TimePoint minRttTime;
+  // The lowest RTT seen, and when. If it isn't seen again for MIN_RTT_LIFETIME, we probe for it
+  // by sending one message at a time for at least a couple of round trips and PROBE_RTT_TIME.
+
+  bool probingRtt = false;
+  kj::Duration probeMinRtt = kj::maxValue;
+  kj::TimePoint probeEndTime;
+  uint64_t probeEndRound = 0;
+  size_t priorWindow = 0;
+  // Restored when the probe ends.
+
+  static constexpr uint BANDWIDTH_ROUNDS = 10;
+  double bandwidthByRound[BANDWIDTH_ROUNDS] = {};
+  // Max delivery rate seen in each of the last few round trips, in bytes per nanosecond.
+
+  uint64_t round = 0;
+  uint64_t nextRoundDelivered = 0;
+  // A round trip ends when a message sent after it started is acked.
+
+  bool filledPipe = false;
+  double fullBandwidth = 0;
+  uint fullBandwidthRounds = 0;
+  // Startup ends once the bandwidth has stopped growing for a few rounds.
+
+  WindowFlowController inner;
+
+  static constexpr kj::Duration MIN_RTT_LIFETIME = 10 * kj::SECONDS;
+  static constexpr kj::Duration PROBE_RTT_TIME = 200 * kj::MILLISECONDS;
+  static constexpr size_t MIN_WINDOW = 16384;
+  static constexpr double WINDOW_GAIN = 2;
+
+  double maxBandwidth() {
+    double result = 0;
+    for (auto bw: bandwidthByRound) result = kj::max(result, bw);
+    return result;
+  }
+
+  void onAck(size_t size, const Sample& sample) {
+    auto now = clock.now();
+    inFlight -= size;
+    delivered += size;
+    deliveredTime = now;
+
+    bool roundStart = false;
+    if (sample.delivered >= nextRoundDelivered) {
+      nextRoundDelivered = delivered;
+      ++round;
+      bandwidthByRound[round % BANDWIDTH_ROUNDS] = 0;
+      roundStart = true;
+    }
+
+    auto rtt = now - sample.sendTime;
+    if (rtt <= minRtt) {
+      minRtt = rtt;
+      minRttTime = now;
+    }
+    if (probingRtt) {
+      probeMinRtt = kj::min(probeMinRtt, rtt);
+      if (now >= probeEndTime && round >= probeEndRound) {
+        minRtt = probeMinRtt;
+        minRttTime = now;
+        probingRtt = false;
+        window = priorWindow;
+      }
+    } else if (filledPipe && now - minRttTime > MIN_RTT_LIFETIME) {
+      probingRtt = true;
+      priorWindow = window;
+      probeMinRtt = kj::maxValue;
+      probeEndTime = now + PROBE_RTT_TIME;
+      probeEndRound = round + 2;
+    }
+
+    auto interval = now - sample.deliveredTime;
+    if (interval > 0 * kj::NANOSECONDS) {
+      double bandwidth = double(delivered - sample.delivered) / (interval / kj::NANOSECONDS);
+      if (!sample.appLimited || bandwidth > maxBandwidth()) {
+        auto& slot = bandwidthByRound[round % BANDWIDTH_ROUNDS];
+        slot = kj::max(slot, bandwidth);
+      }
+    }
+
+    if (!filledPipe && roundStart && !sample.appLimited) {
+      double bandwidth = maxBandwidth();
+      if (bandwidth >= fullBandwidth * 1.25) {
+        fullBandwidth = bandwidth;
+        fullBandwidthRounds = 0;
+      } else if (++fullBandwidthRounds >= 3) {
+        filledPipe = true;
+      }
+    }
+
+    // Like TCP slow start, grow the window by what was acked, which doubles it each round trip.
+    // Once the pipe is full, don't grow past the target.
+    size_t grown = kj::min(window + size, maxWindow);
+    if (probingRtt) {
+      // WindowFlowController always allows one message in flight.
+      window = 0;
+    } else if (filledPipe) {
+      double bdp = maxBandwidth() * (minRtt / kj::NANOSECONDS);
+      size_t target = kj::min(size_t(WINDOW_GAIN * bdp), maxWindow);
+      window = kj::max(kj::min(grown, target), kj::min(MIN_WINDOW, maxWindow));
+    } else {
+      window = grown;
+    }
+  }
+};
+
 }  // namespace
 
 kj::Own<RpcFlowController> RpcFlowController::newFixedWindowController(size_t windowSize) {
@@ -3395,5 +4408,9 @@ kj::Own<RpcFlowController> RpcFlowController::newFixedWindowController(size_t wi
 kj::Own<RpcFlowController> RpcFlowController::newVariableWindowController(WindowGetter& getter) {
   return kj::heap<WindowFlowController>(getter);
 }
+kj::Own<RpcFlowController> RpcFlowController::newAdaptiveWindowController(
+    const kj::MonotonicClock& clock, size_t maxWindow) {
+  return kj::heap<AdaptiveWindowFlowController>(clock, maxWindow);
+}
 
 }  // namespace capnp
@@ -5,122 +5,129 @@
 
 namespace capnp {
 namespace schemas {
-static const ::capnp::_::AlignedData<232> b_91b79f1f808db032 = {
+static const ::capnp::_::AlignedData<248> b_91b79f1f808db032 = {
   {   0,   0,   0,   0,   5,   0,   6,   0,
      50, 176, 141, 128,  31, 159, 183, 145,
      16,   0,   0,   0,   1,   0,   1,   0,
      80, 162,  82,  37,  27, 152,  18, 179,
-      1,   0,   7,   0,   0,   0,  14,   0,
+      1,   0,   7,   0,   0,   0,  15,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
      21,   0,   0,   0, 194,   0,   0,   0,
      29,   0,   0,   0,   7,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-     25,   0,   0,   0,  23,   3,   0,   0,
+     25,   0,   0,   0,  79,   3,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
      99,  97, 112, 110, 112,  47, 114, 112,
      99,  46,  99,  97, 112, 110, 112,  58,
      77, 101, 115, 115,  97, 103, 101,   0,
       0,   0,   0,   0,   1,   0,   1,   0,
-     56,   0,   0,   0,   3,   0,   4,   0,
+     60,   0,   0,   0,   3,   0,   4,   0,
       0,   0, 255, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    121,   1,   0,   0, 114,   0,   0,   0,
+    149,   1,   0,   0, 114,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    120,   1,   0,   0,   3,   0,   1,   0,
-    132,   1,   0,   0,   2,   0,   1,   0,
+    148,   1,   0,   0,   3,   0,   1,   0,
+    160,   1,   0,   0,   2,   0,   1,   0,
       1,   0, 254, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   1,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    129,   1,   0,   0,  50,   0,   0,   0,
+    157,   1,   0,   0,  50,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    124,   1,   0,   0,   3,   0,   1,   0,
-    136,   1,   0,   0,   2,   0,   1,   0,
+    152,   1,   0,   0,   3,   0,   1,   0,
+    164,   1,   0,   0,   2,   0,   1,   0,
       3,   0, 253, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   2,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    133,   1,   0,   0,  42,   0,   0,   0,
+    161,   1,   0,   0,  42,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    128,   1,   0,   0,   3,   0,   1,   0,
-    140,   1,   0,   0,   2,   0,   1,   0,
+    156,   1,   0,   0,   3,   0,   1,   0,
+    168,   1,   0,   0,   2,   0,   1,   0,
       4,   0, 252, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   3,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    137,   1,   0,   0,  58,   0,   0,   0,
+    165,   1,   0,   0,  58,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    132,   1,   0,   0,   3,   0,   1,   0,
-    144,   1,   0,   0,   2,   0,   1,   0,
+    160,   1,   0,   0,   3,   0,   1,   0,
+    172,   1,   0,   0,   2,   0,   1,   0,
       5,   0, 251, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   4,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    141,   1,   0,   0,  58,   0,   0,   0,
+    169,   1,   0,   0,  58,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    136,   1,   0,   0,   3,   0,   1,   0,
-    148,   1,   0,   0,   2,   0,   1,   0,
+    164,   1,   0,   0,   3,   0,   1,   0,
+    176,   1,   0,   0,   2,   0,   1,   0,
       6,   0, 250, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   5,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    145,   1,   0,   0,  66,   0,   0,   0,
+    173,   1,   0,   0,  66,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    140,   1,   0,   0,   3,   0,   1,   0,
-    152,   1,   0,   0,   2,   0,   1,   0,
+    168,   1,   0,   0,   3,   0,   1,   0,
+    180,   1,   0,   0,   2,   0,   1,   0,
       7,   0, 249, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   6,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    149,   1,   0,   0,  66,   0,   0,   0,
+    177,   1,   0,   0,  66,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    144,   1,   0,   0,   3,   0,   1,   0,
-    156,   1,   0,   0,   2,   0,   1,   0,
-      9,   0, 248, 255,   0,   0,   0,   0,
+    172,   1,   0,   0,   3,   0,   1,   0,
+    184,   1,   0,   0,   2,   0,   1,   0,
+     10,   0, 248, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   7,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    153,   1,   0,   0, 106,   0,   0,   0,
+    181,   1,   0,   0, 106,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    152,   1,   0,   0,   3,   0,   1,   0,
-    164,   1,   0,   0,   2,   0,   1,   0,
+    180,   1,   0,   0,   3,   0,   1,   0,
+    192,   1,   0,   0,   2,   0,   1,   0,
       2,   0, 247, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   8,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    161,   1,   0,   0,  82,   0,   0,   0,
+    189,   1,   0,   0,  82,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    160,   1,   0,   0,   3,   0,   1,   0,
-    172,   1,   0,   0,   2,   0,   1,   0,
-     10,   0, 246, 255,   0,   0,   0,   0,
+    188,   1,   0,   0,   3,   0,   1,   0,
+    200,   1,   0,   0,   2,   0,   1,   0,
+     11,   0, 246, 255,   0,   0,   0,   0,
       0,   0,   1,   0,   9,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    169,   1,   0,   0, 122,   0,   0,   0,
+    197,   1,   0,   0, 122,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    168,   1,   0,   0,   3,   0,   1,   0,
-    180,   1,   0,   0,   2,   0,   1,   0,
-     11,   0, 245, 255,   0,   0,   0,   0,
+    196,   1,   0,   0,   3,   0,   1,   0,
+    208,   1,   0,   0,   2,   0,   1,   0,
+     12,   0, 245, 255,   0,   0,   0,   0,
       0,   0,   1,   0,  10,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    177,   1,   0,   0,  66,   0,   0,   0,
+    205,   1,   0,   0,  66,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    172,   1,   0,   0,   3,   0,   1,   0,
-    184,   1,   0,   0,   2,   0,   1,   0,
-     12,   0, 244, 255,   0,   0,   0,   0,
+    200,   1,   0,   0,   3,   0,   1,   0,
+    212,   1,   0,   0,   2,   0,   1,   0,
+     13,   0, 244, 255,   0,   0,   0,   0,
       0,   0,   1,   0,  11,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    181,   1,   0,   0,  58,   0,   0,   0,
+    209,   1,   0,   0,  58,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    176,   1,   0,   0,   3,   0,   1,   0,
-    188,   1,   0,   0,   2,   0,   1,   0,
-     13,   0, 243, 255,   0,   0,   0,   0,
+    204,   1,   0,   0,   3,   0,   1,   0,
+    216,   1,   0,   0,   2,   0,   1,   0,
+     14,   0, 243, 255,   0,   0,   0,   0,
       0,   0,   1,   0,  12,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    185,   1,   0,   0,  42,   0,   0,   0,
+    213,   1,   0,   0,  42,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    180,   1,   0,   0,   3,   0,   1,   0,
-    192,   1,   0,   0,   2,   0,   1,   0,
+    208,   1,   0,   0,   3,   0,   1,   0,
+    220,   1,   0,   0,   2,   0,   1,   0,
       8,   0, 242, 255,   0,   0,   0,   0,
       0,   0,   1,   0,  13,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    189,   1,   0,   0,  90,   0,   0,   0,
+    217,   1,   0,   0,  90,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    188,   1,   0,   0,   3,   0,   1,   0,
-    200,   1,   0,   0,   2,   0,   1,   0,
+    216,   1,   0,   0,   3,   0,   1,   0,
+    228,   1,   0,   0,   2,   0,   1,   0,
+      9,   0, 241, 255,   0,   0,   0,   0,
+      0,   0,   1,   0,  14,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    225,   1,   0,   0,  98,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    224,   1,   0,   0,   3,   0,   1,   0,
+    236,   1,   0,   0,   2,   0,   1,   0,
     117, 110, 105, 109, 112, 108, 101, 109,
     101, 110, 116, 101, 100,   0,   0,   0,
      16,   0,   0,   0,   0,   0,   0,   0,
@@ -235,6 +242,15 @@ static const ::capnp::_::AlignedData<232> b_91b79f1f808db032 = {
      17,  55, 189,  15, 139,  54, 100, 249,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     98, 117, 108, 107,  82, 101, 108, 101,
+     97, 115, 101,   0,   0,   0,   0,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+     40, 113,   2, 234,  30, 165,  27, 219,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
      16,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0, }
@@ -251,15 +267,16 @@ static const ::capnp::_::RawSchema* const d_91b79f1f808db032[] = {
   &s_d37d2eb2c2f80e63,
   &s_d4c9b56290554016,
   &s_d625b7063acf691a,
+  &s_db1ba51eea027128,
   &s_e94ccf8031176ec4,
   &s_f964368b0fbd3711,
   &s_fbe1980490e001af,
 };
-static const uint16_t m_91b79f1f808db032[] = {1, 11, 8, 2, 13, 4, 12, 9, 7, 10, 6, 5, 3, 0};
-static const uint16_t i_91b79f1f808db032[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+static const uint16_t m_91b79f1f808db032[] = {1, 11, 8, 14, 2, 13, 4, 12, 9, 7, 10, 6, 5, 3, 0};
+static const uint16_t i_91b79f1f808db032[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14};
 const ::capnp::_::RawSchema s_91b79f1f808db032 = {
-  0x91b79f1f808db032, b_91b79f1f808db032.words, 232, d_91b79f1f808db032, m_91b79f1f808db032,
-  12, 14, i_91b79f1f808db032, nullptr, nullptr, { &s_91b79f1f808db032, nullptr, nullptr, 0, 0, nullptr }
+  0x91b79f1f808db032, b_91b79f1f808db032.words, 248, d_91b79f1f808db032, m_91b79f1f808db032,
+  13, 15, i_91b79f1f808db032, nullptr, nullptr, { &s_91b79f1f808db032, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
 static const ::capnp::_::AlignedData<51> b_e94ccf8031176ec4 = {
@@ -324,73 +341,87 @@ const ::capnp::_::RawSchema s_e94ccf8031176ec4 = {
   0, 2, i_e94ccf8031176ec4, nullptr, nullptr, { &s_e94ccf8031176ec4, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
-static const ::capnp::_::AlignedData<121> b_836a53ce789d4cd4 = {
+static const ::capnp::_::AlignedData<151> b_836a53ce789d4cd4 = {
   {   0,   0,   0,   0,   5,   0,   6,   0,
     212,  76, 157, 120, 206,  83, 106, 131,
-     16,   0,   0,   0,   1,   0,   3,   0,
+     16,   0,   0,   0,   1,   0,   5,   0,
      80, 162,  82,  37,  27, 152,  18, 179,
       3,   0,   7,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
      21,   0,   0,   0, 170,   0,   0,   0,
      29,   0,   0,   0,   7,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-     25,   0,   0,   0, 143,   1,   0,   0,
+     25,   0,   0,   0, 255,   1,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
      99,  97, 112, 110, 112,  47, 114, 112,
      99,  46,  99,  97, 112, 110, 112,  58,
      67,  97, 108, 108,   0,   0,   0,   0,
       0,   0,   0,   0,   1,   0,   1,   0,
-     28,   0,   0,   0,   3,   0,   4,   0,
+     36,   0,   0,   0,   3,   0,   4,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   1,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    181,   0,   0,   0,  90,   0,   0,   0,
+    237,   0,   0,   0,  90,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    180,   0,   0,   0,   3,   0,   1,   0,
-    192,   0,   0,   0,   2,   0,   1,   0,
+    236,   0,   0,   0,   3,   0,   1,   0,
+    248,   0,   0,   0,   2,   0,   1,   0,
       1,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   1,   0,   1,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    189,   0,   0,   0,  58,   0,   0,   0,
+    245,   0,   0,   0,  58,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    184,   0,   0,   0,   3,   0,   1,   0,
-    196,   0,   0,   0,   2,   0,   1,   0,
+    240,   0,   0,   0,   3,   0,   1,   0,
+    252,   0,   0,   0,   2,   0,   1,   0,
       2,   0,   0,   0,   1,   0,   0,   0,
       0,   0,   1,   0,   2,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    193,   0,   0,   0,  98,   0,   0,   0,
+    249,   0,   0,   0,  98,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    192,   0,   0,   0,   3,   0,   1,   0,
-    204,   0,   0,   0,   2,   0,   1,   0,
+    248,   0,   0,   0,   3,   0,   1,   0,
+      4,   1,   0,   0,   2,   0,   1,   0,
       3,   0,   0,   0,   2,   0,   0,   0,
       0,   0,   1,   0,   3,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    201,   0,   0,   0,  74,   0,   0,   0,
+      1,   1,   0,   0,  74,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    200,   0,   0,   0,   3,   0,   1,   0,
-    212,   0,   0,   0,   2,   0,   1,   0,
+      0,   1,   0,   0,   3,   0,   1,   0,
+     12,   1,   0,   0,   2,   0,   1,   0,
       5,   0,   0,   0,   1,   0,   0,   0,
       0,   0,   1,   0,   4,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    209,   0,   0,   0,  58,   0,   0,   0,
+      9,   1,   0,   0,  58,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    204,   0,   0,   0,   3,   0,   1,   0,
-    216,   0,   0,   0,   2,   0,   1,   0,
-      6,   0,   0,   0,   0,   0,   0,   0,
+      4,   1,   0,   0,   3,   0,   1,   0,
+     16,   1,   0,   0,   2,   0,   1,   0,
+      8,   0,   0,   0,   0,   0,   0,   0,
       1,   0,   0,   0,   0,   0,   0,   0,
     153,  95, 171,  26, 246, 176, 232, 218,
-    213,   0,   0,   0, 114,   0,   0,   0,
+     13,   1,   0,   0, 114,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
       4,   0,   0,   0, 128,   0,   0,   0,
       0,   0,   1,   0,   8,   0,   0,   0,
       1,   0,   0,   0,   0,   0,   0,   0,
-    193,   0,   0,   0, 194,   0,   0,   0,
+    249,   0,   0,   0, 194,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
-    196,   0,   0,   0,   3,   0,   1,   0,
-    208,   0,   0,   0,   2,   0,   1,   0,
+    252,   0,   0,   0,   3,   0,   1,   0,
+      8,   1,   0,   0,   2,   0,   1,   0,
+      6,   0,   0,   0,   3,   0,   0,   0,
+      0,   0,   1,   0,   9,   0,   0,   0,
+      1,   0,   0,   0,   0,   0,   0,   0,
+      5,   1,   0,   0,  66,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   1,   0,   0,   3,   0,   1,   0,
+     12,   1,   0,   0,   2,   0,   1,   0,
+      7,   0,   0,   0,   4,   0,   0,   0,
+      0,   0,   1,   0,  10,   0,   0,   0,
+      1,   0,   0,   0,   0,   0,   0,   0,
+      9,   1,   0,   0,  66,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      4,   1,   0,   0,   3,   0,   1,   0,
+     16,   1,   0,   0,   2,   0,   1,   0,
     113, 117, 101, 115, 116, 105, 111, 110,
      73, 100,   0,   0,   0,   0,   0,   0,
       8,   0,   0,   0,   0,   0,   0,   0,
@@ -445,6 +476,22 @@ static const ::capnp::_::AlignedData<121> b_836a53ce789d4cd4 = {
       0,   0,   0,   0,   0,   0,   0,   0,
       1,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    116, 114,  97,  99, 101,  73, 100,   0,
+      9,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      9,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    116, 105, 109, 101, 111, 117, 116,   0,
+      9,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      9,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
       0,   0,   0,   0,   0,   0,   0,   0, }
 };
 ::capnp::word const* const bp_836a53ce789d4cd4 = b_836a53ce789d4cd4.words;
@@ -454,17 +501,17 @@ static const ::capnp::_::RawSchema* const d_836a53ce789d4cd4[] = {
   &s_9a0e61223d96743b,
   &s_dae8b0f61aab5f99,
 };
-static const uint16_t m_836a53ce789d4cd4[] = {6, 2, 3, 4, 0, 5, 1};
-static const uint16_t i_836a53ce789d4cd4[] = {0, 1, 2, 3, 4, 5, 6};
+static const uint16_t m_836a53ce789d4cd4[] = {6, 2, 3, 4, 0, 5, 1, 8, 7};
+static const uint16_t i_836a53ce789d4cd4[] = {0, 1, 2, 3, 4, 5, 6, 7, 8};
 const ::capnp::_::RawSchema s_836a53ce789d4cd4 = {
-  0x836a53ce789d4cd4, b_836a53ce789d4cd4.words, 121, d_836a53ce789d4cd4, m_836a53ce789d4cd4,
-  3, 7, i_836a53ce789d4cd4, nullptr, nullptr, { &s_836a53ce789d4cd4, nullptr, nullptr, 0, 0, nullptr }
+  0x836a53ce789d4cd4, b_836a53ce789d4cd4.words, 151, d_836a53ce789d4cd4, m_836a53ce789d4cd4,
+  3, 9, i_836a53ce789d4cd4, nullptr, nullptr, { &s_836a53ce789d4cd4, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
 static const ::capnp::_::AlignedData<65> b_dae8b0f61aab5f99 = {
   {   0,   0,   0,   0,   5,   0,   6,   0,
     153,  95, 171,  26, 246, 176, 232, 218,
-     21,   0,   0,   0,   1,   0,   3,   0,
+     21,   0,   0,   0,   1,   0,   5,   0,
     212,  76, 157, 120, 206,  83, 106, 131,
       3,   0,   7,   0,   1,   0,   3,   0,
       3,   0,   0,   0,   0,   0,   0,   0,
@@ -1053,6 +1100,79 @@ const ::capnp::_::RawSchema s_d562b4df655bdd4d = {
   1, 4, i_d562b4df655bdd4d, nullptr, nullptr, { &s_d562b4df655bdd4d, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+static const ::capnp::_::AlignedData<58> b_db1ba51eea027128 = {
+  {   0,   0,   0,   0,   5,   0,   6,   0,
+     40, 113,   2, 234,  30, 165,  27, 219,
+     16,   0,   0,   0,   1,   0,   0,   0,
+     80, 162,  82,  37,  27, 152,  18, 179,
+      2,   0,   7,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     21,   0,   0,   0, 226,   0,   0,   0,
+     33,   0,   0,   0,   7,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     29,   0,   0,   0, 119,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     99,  97, 112, 110, 112,  47, 114, 112,
+     99,  46,  99,  97, 112, 110, 112,  58,
+     66, 117, 108, 107,  82, 101, 108, 101,
+     97, 115, 101,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   1,   0,   1,   0,
+      8,   0,   0,   0,   3,   0,   4,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   1,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     41,   0,   0,   0,  74,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     40,   0,   0,   0,   3,   0,   1,   0,
+     68,   0,   0,   0,   2,   0,   1,   0,
+      1,   0,   0,   0,   1,   0,   0,   0,
+      0,   0,   1,   0,   1,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     65,   0,   0,   0,  74,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     64,   0,   0,   0,   3,   0,   1,   0,
+     92,   0,   0,   0,   2,   0,   1,   0,
+    102, 105, 110, 105, 115, 104, 101, 115,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   3,   0,   1,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+     99,  14, 248, 194, 178,  46, 125, 211,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+    114, 101, 108, 101,  97, 115, 101, 115,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   3,   0,   1,   0,
+     16,   0,   0,   0,   0,   0,   0,   0,
+    151, 116, 208, 125,  13, 108,  26, 173,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+     14,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0, }
+};
+::capnp::word const* const bp_db1ba51eea027128 = b_db1ba51eea027128.words;
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const d_db1ba51eea027128[] = {
+  &s_ad1a6c0d7dd07497,
+  &s_d37d2eb2c2f80e63,
+};
+static const uint16_t m_db1ba51eea027128[] = {0, 1};
+static const uint16_t i_db1ba51eea027128[] = {0, 1};
+const ::capnp::_::RawSchema s_db1ba51eea027128 = {
+  0xdb1ba51eea027128, b_db1ba51eea027128.words, 58, d_db1ba51eea027128, m_db1ba51eea027128,
+  2, 2, i_db1ba51eea027128, nullptr, nullptr, { &s_db1ba51eea027128, nullptr, nullptr, 0, 0, nullptr }
+};
+#endif  // !CAPNP_LITE
 static const ::capnp::_::AlignedData<64> b_9c6a046bfbc1ac5a = {
   {   0,   0,   0,   0,   5,   0,   6,   0,
      90, 172, 193, 251, 107,   4, 106, 156,
@@ -1912,6 +2032,78 @@ const ::capnp::_::RawSchema s_b28c96e23f4cbd58 = {
 };
 #endif  // !CAPNP_LITE
 CAPNP_DEFINE_ENUM(Type_b28c96e23f4cbd58, b28c96e23f4cbd58);
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_b312981b2552a250[] = {
+  &s_f316944415569081,
+  nullptr,
+  &s_d37d2eb2c2f80e63,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_ad1a6c0d7dd07497,
+  &s_d800b1d6cd6f1ca0,
+  nullptr,
+  &s_9c6a046bfbc1ac5a,
+  &s_d4c9b56290554016,
+  nullptr,
+  &s_8523ddc40b86b8b0,
+  nullptr,
+  nullptr,
+  &s_91b79f1f808db032,
+  &s_db1ba51eea027128,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_f964368b0fbd3711,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_836a53ce789d4cd4,
+  nullptr,
+  &s_fbe1980490e001af,
+  &s_d562b4df655bdd4d,
+  &s_e94ccf8031176ec4,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_b28c96e23f4cbd58,
+  nullptr,
+  &s_dae8b0f61aab5f99,
+  &s_bbc29655fa89086e,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_d625b7063acf691a,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_9a0e61223d96743b,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_9e19b28d3db3573a,
+  nullptr,
+  nullptr,
+  &s_d37007fde1f0027d,
+  nullptr,
+  nullptr,
+  &s_95bc14545813fbc1,
+};
+static const uint32_t xh_b312981b2552a250[] = {1, 2, 1, 1, 1, 1, 0, 3, 1, 1, 4, 0, 1, 1, 0, 1};
+const ::capnp::_::RawSchemaIndex x_b312981b2552a250 = {
+  xs_b312981b2552a250, xh_b312981b2552a250, 64, 16, 22
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
@@ -2000,6 +2192,14 @@ constexpr ::capnp::Kind Disembargo::Context::_capnpPrivate::kind;
 constexpr ::capnp::_::RawSchema const* Disembargo::Context::_capnpPrivate::schema;
 #endif  // !CAPNP_LITE
 
+// BulkRelease
+constexpr uint16_t BulkRelease::_capnpPrivate::dataWordSize;
+constexpr uint16_t BulkRelease::_capnpPrivate::pointerCount;
+#if !CAPNP_LITE
+constexpr ::capnp::Kind BulkRelease::_capnpPrivate::kind;
+constexpr ::capnp::_::RawSchema const* BulkRelease::_capnpPrivate::schema;
+#endif  // !CAPNP_LITE
+
 // Provide
 constexpr uint16_t Provide::_capnpPrivate::dataWordSize;
 constexpr uint16_t Provide::_capnpPrivate::pointerCount;
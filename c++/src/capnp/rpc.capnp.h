@@ -26,6 +26,7 @@ CAPNP_DECLARE_SCHEMA(bbc29655fa89086e);
 CAPNP_DECLARE_SCHEMA(ad1a6c0d7dd07497);
 CAPNP_DECLARE_SCHEMA(f964368b0fbd3711);
 CAPNP_DECLARE_SCHEMA(d562b4df655bdd4d);
+CAPNP_DECLARE_SCHEMA(db1ba51eea027128);
 CAPNP_DECLARE_SCHEMA(9c6a046bfbc1ac5a);
 CAPNP_DECLARE_SCHEMA(d4c9b56290554016);
 CAPNP_DECLARE_SCHEMA(fbe1980490e001af);
@@ -44,6 +45,7 @@ enum class Type_b28c96e23f4cbd58: uint16_t {
   UNIMPLEMENTED,
 };
 CAPNP_DECLARE_ENUM(Type, b28c96e23f4cbd58);
+CAPNP_DECLARE_SCHEMA_INDEX(b312981b2552a250);
 
 }  // namespace schemas
 }  // namespace capnp
@@ -72,6 +74,7 @@ struct Message {
     ACCEPT,
     JOIN,
     DISEMBARGO,
+    BULK_RELEASE,
   };
 
   struct _capnpPrivate {
@@ -106,7 +109,7 @@ struct Call {
   struct SendResultsTo;
 
   struct _capnpPrivate {
-    CAPNP_DECLARE_STRUCT_HEADER(836a53ce789d4cd4, 3, 3)
+    CAPNP_DECLARE_STRUCT_HEADER(836a53ce789d4cd4, 5, 3)
     #if !CAPNP_LITE
     static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
     #endif  // !CAPNP_LITE
@@ -126,7 +129,7 @@ struct Call::SendResultsTo {
   };
 
   struct _capnpPrivate {
-    CAPNP_DECLARE_STRUCT_HEADER(dae8b0f61aab5f99, 3, 3)
+    CAPNP_DECLARE_STRUCT_HEADER(dae8b0f61aab5f99, 5, 3)
     #if !CAPNP_LITE
     static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
     #endif  // !CAPNP_LITE
@@ -242,6 +245,21 @@ struct Disembargo::Context {
   };
 };
 
+struct BulkRelease {
+  BulkRelease() = delete;
+
+  class Reader;
+  class Builder;
+  class Pipeline;
+
+  struct _capnpPrivate {
+    CAPNP_DECLARE_STRUCT_HEADER(db1ba51eea027128, 0, 2)
+    #if !CAPNP_LITE
+    static constexpr ::capnp::_::RawBrandedSchema const* brand() { return &schema->defaultBrand; }
+    #endif  // !CAPNP_LITE
+  };
+};
+
 struct Provide {
   Provide() = delete;
 
@@ -487,6 +505,10 @@ public:
   inline bool hasDisembargo() const;
   inline  ::capnp::rpc::Disembargo::Reader getDisembargo() const;
 
+  inline bool isBulkRelease() const;
+  inline bool hasBulkRelease() const;
+  inline  ::capnp::rpc::BulkRelease::Reader getBulkRelease() const;
+
 private:
   ::capnp::_::StructReader _reader;
   template <typename, ::capnp::Kind>
@@ -622,6 +644,14 @@ public:
   inline void adoptDisembargo(::capnp::Orphan< ::capnp::rpc::Disembargo>&& value);
   inline ::capnp::Orphan< ::capnp::rpc::Disembargo> disownDisembargo();
 
+  inline bool isBulkRelease();
+  inline bool hasBulkRelease();
+  inline  ::capnp::rpc::BulkRelease::Builder getBulkRelease();
+  inline void setBulkRelease( ::capnp::rpc::BulkRelease::Reader value);
+  inline  ::capnp::rpc::BulkRelease::Builder initBulkRelease();
+  inline void adoptBulkRelease(::capnp::Orphan< ::capnp::rpc::BulkRelease>&& value);
+  inline ::capnp::Orphan< ::capnp::rpc::BulkRelease> disownBulkRelease();
+
 private:
   ::capnp::_::StructBuilder _builder;
   template <typename, ::capnp::Kind>
@@ -764,6 +794,10 @@ public:
 
   inline bool getAllowThirdPartyTailCall() const;
 
+  inline  ::uint64_t getTraceId() const;
+
+  inline  ::uint64_t getTimeout() const;
+
 private:
   ::capnp::_::StructReader _reader;
   template <typename, ::capnp::Kind>
@@ -821,6 +855,12 @@ public:
   inline bool getAllowThirdPartyTailCall();
   inline void setAllowThirdPartyTailCall(bool value);
 
+  inline  ::uint64_t getTraceId();
+  inline void setTraceId( ::uint64_t value);
+
+  inline  ::uint64_t getTimeout();
+  inline void setTimeout( ::uint64_t value);
+
 private:
   ::capnp::_::StructBuilder _builder;
   template <typename, ::capnp::Kind>
@@ -1536,6 +1576,97 @@ private:
 };
 #endif  // !CAPNP_LITE
 
+class BulkRelease::Reader {
+public:
+  typedef BulkRelease Reads;
+
+  Reader() = default;
+  inline explicit Reader(::capnp::_::StructReader base): _reader(base) {}
+
+  inline ::capnp::MessageSize totalSize() const {
+    return _reader.totalSize().asPublic();
+  }
+
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const {
+    return ::capnp::_::structString(_reader, *_capnpPrivate::brand());
+  }
+#endif  // !CAPNP_LITE
+
+  inline bool hasFinishes() const;
+  inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Reader getFinishes() const;
+
+  inline bool hasReleases() const;
+  inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Reader getReleases() const;
+
+private:
+  ::capnp::_::StructReader _reader;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::List;
+  friend class ::capnp::MessageBuilder;
+  friend class ::capnp::Orphanage;
+};
+
+class BulkRelease::Builder {
+public:
+  typedef BulkRelease Builds;
+
+  Builder() = delete;  // Deleted to discourage incorrect usage.
+                       // You can explicitly initialize to nullptr instead.
+  inline Builder(decltype(nullptr)) {}
+  inline explicit Builder(::capnp::_::StructBuilder base): _builder(base) {}
+  inline operator Reader() const { return Reader(_builder.asReader()); }
+  inline Reader asReader() const { return *this; }
+
+  inline ::capnp::MessageSize totalSize() const { return asReader().totalSize(); }
+#if !CAPNP_LITE
+  inline ::kj::StringTree toString() const { return asReader().toString(); }
+#endif  // !CAPNP_LITE
+
+  inline bool hasFinishes();
+  inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Builder getFinishes();
+  inline void setFinishes( ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Reader value);
+  inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Builder initFinishes(unsigned int size);
+  inline void adoptFinishes(::capnp::Orphan< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>&& value);
+  inline ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>> disownFinishes();
+
+  inline bool hasReleases();
+  inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Builder getReleases();
+  inline void setReleases( ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Reader value);
+  inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Builder initReleases(unsigned int size);
+  inline void adoptReleases(::capnp::Orphan< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>&& value);
+  inline ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>> disownReleases();
+
+private:
+  ::capnp::_::StructBuilder _builder;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+  friend class ::capnp::Orphanage;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::_::PointerHelpers;
+};
+
+#if !CAPNP_LITE
+class BulkRelease::Pipeline {
+public:
+  typedef BulkRelease Pipelines;
+
+  inline Pipeline(decltype(nullptr)): _typeless(nullptr) {}
+  inline explicit Pipeline(::capnp::AnyPointer::Pipeline&& typeless)
+      : _typeless(kj::mv(typeless)) {}
+
+private:
+  ::capnp::AnyPointer::Pipeline _typeless;
+  friend class ::capnp::PipelineHook;
+  template <typename, ::capnp::Kind>
+  friend struct ::capnp::ToDynamic_;
+};
+#endif  // !CAPNP_LITE
+
 class Provide::Reader {
 public:
   typedef Provide Reads;
@@ -3217,6 +3348,60 @@ inline ::capnp::Orphan< ::capnp::rpc::Disembargo> Message::Builder::disownDisemb
       ::capnp::bounded<0>() * ::capnp::POINTERS));
 }
 
+inline bool Message::Reader::isBulkRelease() const {
+  return which() == Message::BULK_RELEASE;
+}
+inline bool Message::Builder::isBulkRelease() {
+  return which() == Message::BULK_RELEASE;
+}
+inline bool Message::Reader::hasBulkRelease() const {
+  if (which() != Message::BULK_RELEASE) return false;
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool Message::Builder::hasBulkRelease() {
+  if (which() != Message::BULK_RELEASE) return false;
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::rpc::BulkRelease::Reader Message::Reader::getBulkRelease() const {
+  KJ_IREQUIRE((which() == Message::BULK_RELEASE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::rpc::BulkRelease::Builder Message::Builder::getBulkRelease() {
+  KJ_IREQUIRE((which() == Message::BULK_RELEASE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void Message::Builder::setBulkRelease( ::capnp::rpc::BulkRelease::Reader value) {
+  _builder.setDataField<Message::Which>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, Message::BULK_RELEASE);
+  ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::rpc::BulkRelease::Builder Message::Builder::initBulkRelease() {
+  _builder.setDataField<Message::Which>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, Message::BULK_RELEASE);
+  return ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void Message::Builder::adoptBulkRelease(
+    ::capnp::Orphan< ::capnp::rpc::BulkRelease>&& value) {
+  _builder.setDataField<Message::Which>(
+      ::capnp::bounded<0>() * ::capnp::ELEMENTS, Message::BULK_RELEASE);
+  ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::rpc::BulkRelease> Message::Builder::disownBulkRelease() {
+  KJ_IREQUIRE((which() == Message::BULK_RELEASE),
+              "Must check which() before get()ing a union member.");
+  return ::capnp::_::PointerHelpers< ::capnp::rpc::BulkRelease>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
 inline  ::uint32_t Bootstrap::Reader::getQuestionId() const {
   return _reader.getDataField< ::uint32_t>(
       ::capnp::bounded<0>() * ::capnp::ELEMENTS);
@@ -3404,6 +3589,34 @@ inline void Call::Builder::setAllowThirdPartyTailCall(bool value) {
       ::capnp::bounded<128>() * ::capnp::ELEMENTS, value);
 }
 
+inline  ::uint64_t Call::Reader::getTraceId() const {
+  return _reader.getDataField< ::uint64_t>(
+      ::capnp::bounded<3>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint64_t Call::Builder::getTraceId() {
+  return _builder.getDataField< ::uint64_t>(
+      ::capnp::bounded<3>() * ::capnp::ELEMENTS);
+}
+inline void Call::Builder::setTraceId( ::uint64_t value) {
+  _builder.setDataField< ::uint64_t>(
+      ::capnp::bounded<3>() * ::capnp::ELEMENTS, value);
+}
+
+inline  ::uint64_t Call::Reader::getTimeout() const {
+  return _reader.getDataField< ::uint64_t>(
+      ::capnp::bounded<4>() * ::capnp::ELEMENTS);
+}
+
+inline  ::uint64_t Call::Builder::getTimeout() {
+  return _builder.getDataField< ::uint64_t>(
+      ::capnp::bounded<4>() * ::capnp::ELEMENTS);
+}
+inline void Call::Builder::setTimeout( ::uint64_t value) {
+  _builder.setDataField< ::uint64_t>(
+      ::capnp::bounded<4>() * ::capnp::ELEMENTS, value);
+}
+
 inline  ::capnp::rpc::Call::SendResultsTo::Which Call::SendResultsTo::Reader::which() const {
   return _reader.getDataField<Which>(
       ::capnp::bounded<3>() * ::capnp::ELEMENTS);
@@ -4117,6 +4330,74 @@ inline void Disembargo::Context::Builder::setProvide( ::uint32_t value) {
       ::capnp::bounded<0>() * ::capnp::ELEMENTS, value);
 }
 
+inline bool BulkRelease::Reader::hasFinishes() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline bool BulkRelease::Builder::hasFinishes() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Reader BulkRelease::Reader::getFinishes() const {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::get(_reader.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Builder BulkRelease::Builder::getFinishes() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::get(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+inline void BulkRelease::Builder::setFinishes( ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::set(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>::Builder BulkRelease::Builder::initFinishes(unsigned int size) {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::init(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), size);
+}
+inline void BulkRelease::Builder::adoptFinishes(
+    ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::adopt(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>> BulkRelease::Builder::disownFinishes() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Finish,  ::capnp::Kind::STRUCT>>::disown(_builder.getPointerField(
+      ::capnp::bounded<0>() * ::capnp::POINTERS));
+}
+
+inline bool BulkRelease::Reader::hasReleases() const {
+  return !_reader.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS).isNull();
+}
+inline bool BulkRelease::Builder::hasReleases() {
+  return !_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS).isNull();
+}
+inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Reader BulkRelease::Reader::getReleases() const {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::get(_reader.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Builder BulkRelease::Builder::getReleases() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::get(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+inline void BulkRelease::Builder::setReleases( ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Reader value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::set(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), value);
+}
+inline  ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>::Builder BulkRelease::Builder::initReleases(unsigned int size) {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::init(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), size);
+}
+inline void BulkRelease::Builder::adoptReleases(
+    ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>&& value) {
+  ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::adopt(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS), kj::mv(value));
+}
+inline ::capnp::Orphan< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>> BulkRelease::Builder::disownReleases() {
+  return ::capnp::_::PointerHelpers< ::capnp::List< ::capnp::rpc::Release,  ::capnp::Kind::STRUCT>>::disown(_builder.getPointerField(
+      ::capnp::bounded<1>() * ::capnp::POINTERS));
+}
+
 inline  ::uint32_t Provide::Reader::getQuestionId() const {
   return _reader.getDataField< ::uint32_t>(
       ::capnp::bounded<0>() * ::capnp::ELEMENTS);
@@ -23,6 +23,8 @@
 
 #include "capability.h"
 #include "rpc-prelude.h"
+#include "kj/time.h"
+#include "kj/vector.h"
 
 CAPNP_BEGIN_HEADER
 
@@ -55,6 +57,130 @@ private:
   Capability::Client baseCreateFor(AnyStruct::Reader clientId) override;
 };
 
+struct RpcConnectionStats {
+  // A snapshot of the state of one connection of an RpcSystem, as returned by
+  // `RpcSystem::getConnectionStats()`. The counters are maintained unconditionally, as plain
+  // integers updated by the connection's event loop, so collecting them costs nothing until they
+  // are read.
+
+  AnyStruct::Reader peerVatId;
+  // The peer's VatId, as returned by `VatNetwork::Connection::getPeerVatId()`. Cast with
+  // `.as<VatId>()`. Only valid until the connection is dropped, so don't hold on to it past the
+  // current turn of the event loop. Null if the connection has already failed.
+
+  size_t questions = 0;
+  // Entries in the question table: calls we've made whose `Finish` hasn't been sent yet.
+
+  size_t answers = 0;
+  // Entries in the answer table: calls from the peer which haven't been finished yet.
+
+  size_t imports = 0;
+  // Capabilities the peer has exported to us which we still hold.
+
+  size_t exports = 0;
+  // Capabilities we've exported to the peer which it hasn't released.
+
+  size_t embargoes = 0;
+  // Embargoes awaiting a loopback `Disembargo`.
+
+  size_t callWordsInFlight = 0;
+  // Words of incoming calls which haven't returned yet. This is the quantity limited by
+  // `RpcSystem::setFlowLimit()`.
+
+  size_t callsInFlight = 0;
+  // Incoming calls which haven't returned yet. This is the quantity limited by
+  // `RpcSystem::setCallLimit()`.
+
+  uint64_t callsRejected = 0;
+  // Incoming calls failed with OVERLOADED because a limit set by `setCallLimit()` was reached.
+
+  size_t streamBytesInFlight = 0;
+  // Bytes of outgoing streaming calls which have been sent but not yet acknowledged, i.e. the
+  // amount currently queued against `RpcFlowController` windows.
+
+  static constexpr uint MESSAGE_TYPE_COUNT = 16;
+  uint64_t messagesSent[MESSAGE_TYPE_COUNT] = {};
+  uint64_t messagesReceived[MESSAGE_TYPE_COUNT] = {};
+  // Total messages sent and received on this connection so far, indexed by `rpc::Message::Which`
+  // (e.g. `messagesSent[rpc::Message::CALL]`).
+};
+
+class RpcCallLimiter final: public kj::Refcounted {
+  // Caps the number of incoming calls in progress at once across every connection of every
+  // RpcSystem it is given to; see `RpcSystem::setCallLimit()`. Not thread-safe: all of those
+  // RpcSystems must run on the same event loop.
+
+public:
+  explicit RpcCallLimiter(size_t maxCalls): maxCalls(maxCalls) {}
+  KJ_DISALLOW_COPY(RpcCallLimiter);
+
+  size_t maxCalls;
+  // May be changed at any time. Lowering it doesn't affect calls already admitted.
+
+  size_t getCallsInFlight() const { return callsInFlight; }
+  // Calls admitted which haven't returned yet.
+
+  uint64_t getCallsRejected() const { return callsRejected; }
+  // Calls failed with OVERLOADED so far by any RpcSystem using this limiter, whether because of
+  // `maxCalls` or because of the RpcSystem's own per-connection limit.
+
+  bool tryAdmit() {
+    if (callsInFlight >= maxCalls) return false;
+    ++callsInFlight;
+    return true;
+  }
+  void release() { --callsInFlight; }
+  void countRejected() { ++callsRejected; }
+  // Used by the RpcSystem.
+
+private:
+  size_t callsInFlight = 0;
+  uint64_t callsRejected = 0;
+};
+
+class RpcMemoryBudget final: public kj::Refcounted {
+  // Accounts for the message memory pinned by RPC connections -- messages being built or waiting
+  // to be written, and received messages still in use -- against a limit, so that one peer can't
+  // drive the process out of memory. See `TwoPartyVatNetwork::setMemoryBudget()`.
+  //
+  // A budget may have a parent, which is charged for everything charged to its child. For example,
+  // a server can give each connection a budget of its own, all children of one server-wide budget.
+  // Not thread-safe: all connections using a budget must run on the same event loop.
+
+public:
+  explicit RpcMemoryBudget(size_t limit = kj::maxValue,
+                           kj::Maybe<kj::Own<RpcMemoryBudget>> parent = nullptr);
+  KJ_DISALLOW_COPY(RpcMemoryBudget);
+
+  size_t getLimit() const { return limit; }
+  void setLimit(size_t newLimit);
+
+  size_t getUsed() const { return used; }
+  // Bytes currently charged, including those charged to children.
+
+  size_t getPeak() const { return peak; }
+  // The most bytes ever charged at once.
+
+  bool isOverLimit() const;
+  // Whether this budget or any of its ancestors has more bytes charged than its limit allows.
+
+  kj::Promise<void> whenWithinLimit();
+  // Resolves once `isOverLimit()` is false.
+
+  void charge(size_t bytes);
+  void release(size_t bytes);
+  // Charging always succeeds, even beyond the limit; it's up to the user of the budget to stop
+  // taking on more work while it's over. Whatever charges a budget must hold a reference to it
+  // until it has released the bytes.
+
+private:
+  size_t limit;
+  size_t used = 0;
+  size_t peak = 0;
+  kj::Maybe<kj::Own<RpcMemoryBudget>> parent;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> waiters;
+};
+
 template <typename VatId>
 class RpcSystem: public _::RpcSystemBase {
   // Represents the RPC system, which is the portal to objects available on the network.
@@ -140,6 +266,23 @@ public:
   // main time this happens is when a grain is pushing a large file download and doesn't implement
   // proper cooperative flow control.
 
+  void setCallLimit(size_t maxCallsPerConnection,
+                    kj::Maybe<kj::Own<RpcCallLimiter>> sharedLimiter = nullptr);
+  // Limits the number of incoming calls which may be in progress at once on each connection, and,
+  // if `sharedLimiter` is given, in total across all connections sharing it. Unlike the flow
+  // limit, which stops reading from the connection, a call arriving over one of these limits is
+  // answered right away with an OVERLOADED exception without being delivered, so that an
+  // overloaded server sheds load cheaply and callers can retry elsewhere. Calls on promised
+  // answers of a rejected call fail with the same exception.
+  //
+  // The two are meant to be used together: the flow limit bounds the memory held by in-flight
+  // calls, while the call limit bounds the work queued behind them.
+
+  kj::Array<RpcConnectionStats> getConnectionStats();
+  // Returns a snapshot of live counters for every connection the RpcSystem currently has open.
+  // This walks the connection tables, so it's intended to be polled periodically (e.g. by a
+  // metrics exporter), not called on every message. Must be called on the RpcSystem's thread.
+
   // void setTraceEncoder(kj::Function<kj::String(const kj::Exception&)> func);
   //
   // (Inherited from _::RpcSystemBase)
@@ -263,6 +406,31 @@ public:
   // Set the list of file descriptors to send along with this message, if FD passing is supported.
   // An implementation may ignore this.
 
+  enum class Priority: uint8_t {
+    NORMAL,
+    // Must be delivered after every message sent before it.
+
+    BULK,
+    // A streaming call. These can be large and numerous, so a network that queues outgoing
+    // messages may want to write them in bounded chunks.
+
+    EXPEDITED
+    // Doesn't depend on any BULK message sent before it, so may be delivered ahead of those
+    // (but never ahead of NORMAL or other EXPEDITED messages sent before it).
+  };
+
+  virtual void setPriority(Priority priority) {}
+  // Hint for how this message may be scheduled relative to others. Call before send(). Messages
+  // are NORMAL by default, and an implementation may ignore this and deliver all messages in
+  // order.
+
+  virtual bool attach(kj::Own<void>&& owner) { return false; }
+  // Asks the message to keep `owner` alive until the message has been written out (or dropped), so
+  // that the body may reference memory `owner` owns rather than a copy of it, e.g. with
+  // `Orphanage::referenceExternal()`. Returns false, leaving `owner` untouched, if the
+  // implementation can't; the caller must then copy. An implementation that returns true should
+  // destroy `owner` only after its `MessageBuilder`.
+
   virtual void send() = 0;
   // Send the message, or at least put it in a queue to be sent later.  Note that the builder
   // returned by `getBody()` remains valid at least until the `OutgoingRpcMessage` is destroyed.
@@ -345,6 +513,21 @@ public:
 
   static constexpr size_t DEFAULT_WINDOW_SIZE = 65536;
   // The window size used by the default implementation of Connection::newStream().
+
+  static constexpr size_t DEFAULT_MAX_ADAPTIVE_WINDOW = 64u << 20;
+
+  static kj::Own<RpcFlowController> newAdaptiveWindowController(
+      const kj::MonotonicClock& clock, size_t maxWindow = DEFAULT_MAX_ADAPTIVE_WINDOW);
+  // Constructs a flow controller that chooses its own window by estimating the bandwidth-delay
+  // product of the stream's path, similar to TCP BBR: it measures the round trip time and delivery
+  // rate of each message from send to ack, and keeps about twice the measured bandwidth times the
+  // minimum round trip time in flight. Unlike a window derived from the first hop's socket, this
+  // follows the end-to-end path, so it neither starves long fat links nor bloats queues on slow
+  // ones. The window starts at DEFAULT_WINDOW_SIZE and grows exponentially until the measured
+  // bandwidth stops increasing, but never beyond `maxWindow`.
+  //
+  // Remember that acks are `Return`s, so the measured path includes the time the remote
+  // application takes to process each message; a slow consumer is seen as a slow link.
 };
 
 template <typename VatId, typename ProvisionId, typename RecipientId,
@@ -405,8 +588,8 @@ public:
     //   the `Connection` itself. However, it will not call `send()` any more after the
     //   `Connection` is destroyed.
     //
-    // TODO(perf): We should introduce a flow controller implementation that uses a clock to
-    //   measure RTT and bandwidth and dynamically update the window size, like BBR.
+    // Networks that have a clock can return RpcFlowController::newAdaptiveWindowController()
+    // instead, which sizes the window from the measured RTT and bandwidth.
 
     // Level 0 features ----------------------------------------------
 
@@ -437,8 +620,55 @@ public:
     // Waits until all outgoing messages have been sent, then shuts down the outgoing stream. The
     // returned promise resolves after shutdown is complete.
 
+    // Level 3 features ----------------------------------------------
+    //
+    // When this vat passes a capability hosted by one peer (the "host") to another (the
+    // "recipient"), the RPC system asks the network to introduce the two, so that the recipient
+    // picks the capability up from the host directly instead of calling through this vat. The
+    // defaults decline all introductions, in which case the recipient uses the proxy ("vine")
+    // this vat exports alongside, as in level 1.
+
+    virtual bool canIntroduceTo(Connection& other) { return false; }
+    // Returns true if introduceTo() may be called on this connection with `other`, another
+    // connection from the same network.
+
+    virtual void introduceTo(Connection& recipient,
+                             typename ThirdPartyCapId::Builder sendToRecipient,
+                             typename RecipientId::Builder sendToTarget);
+    // Introduces this connection's peer, which hosts a capability, to `recipient`'s peer.
+    // `sendToRecipient` will be sent to the recipient in a `CapDescriptor`, and should tell it how
+    // to reach the host. `sendToTarget` will be sent to the host in a `Provide` message, and should
+    // tell it whom to expect.
+
+    virtual kj::Maybe<kj::Own<Connection>> connectToIntroduced(
+        typename ThirdPartyCapId::Reader capId, typename ProvisionId::Builder provisionId)
+        { return nullptr; }
+    // Given a `ThirdPartyCapId` received from this connection's peer, connects to the host it
+    // identifies and fills in `provisionId`, which the RPC system will send to the host in an
+    // `Accept` message. Returns null to decline, in which case the vine is used instead.
+
+    virtual kj::Promise<void> provide(typename RecipientId::Reader recipientId,
+                                      Capability::Client cap);
+    // Called when this connection's peer sends `Provide`, offering `cap` to the vat identified by
+    // `recipientId`. The network holds on to `cap` until a matching pickUp() on the recipient's
+    // connection, and resolves the returned promise then. Canceling the promise withdraws the
+    // offer.
+
+    virtual kj::Promise<Capability::Client> pickUp(typename ProvisionId::Reader provisionId);
+    // Called when this connection's peer sends `Accept`. Resolves to the capability offered to
+    // this peer by the matching provide(), which may not have been called yet.
+
   private:
     AnyStruct::Reader baseGetPeerVatId() override;
+    bool baseCanIntroduceTo(_::VatNetworkBase::Connection& other) override;
+    void baseIntroduceTo(_::VatNetworkBase::Connection& recipient,
+                         AnyPointer::Builder sendToRecipient,
+                         AnyPointer::Builder sendToTarget) override;
+    kj::Maybe<kj::Own<_::VatNetworkBase::Connection>> baseConnectToIntroduced(
+        AnyPointer::Reader capId, AnyPointer::Builder provisionId) override;
+    kj::Promise<void> baseProvide(AnyPointer::Reader recipientId,
+                                  Capability::Client cap) override;
+    kj::Promise<Capability::Client> basePickUp(AnyPointer::Reader provisionId) override;
   };
 
   // Level 0 features ------------------------------------------------
@@ -471,6 +701,11 @@ private:
 // ***************************************************************************************
 // =======================================================================================
 
+namespace _ {  // private
+kj::Exception handoffUnimplemented();
+// The exception thrown by VatNetwork::Connection's default three-party handoff methods.
+}  // namespace _ (private)
+
 template <typename VatId>
 Capability::Client BootstrapFactory<VatId>::baseCreateFor(AnyStruct::Reader clientId) {
   return createFor(clientId.as<VatId>());
@@ -505,6 +740,75 @@ AnyStruct::Reader VatNetwork<
   return getPeerVatId();
 }
 
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+void VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::introduceTo(Connection& recipient,
+                            typename ThirdPartyCapId::Builder sendToRecipient,
+                            typename RecipientId::Builder sendToTarget) {
+  kj::throwFatalException(_::handoffUnimplemented());
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+kj::Promise<void> VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::provide(typename RecipientId::Reader recipientId, Capability::Client cap) {
+  return _::handoffUnimplemented();
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+kj::Promise<Capability::Client>
+    VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::pickUp(typename ProvisionId::Reader provisionId) {
+  return _::handoffUnimplemented();
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+bool VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::baseCanIntroduceTo(_::VatNetworkBase::Connection& other) {
+  return canIntroduceTo(kj::downcast<Connection>(other));
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+void VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::baseIntroduceTo(_::VatNetworkBase::Connection& recipient,
+                                AnyPointer::Builder sendToRecipient,
+                                AnyPointer::Builder sendToTarget) {
+  introduceTo(kj::downcast<Connection>(recipient),
+              sendToRecipient.initAs<ThirdPartyCapId>(), sendToTarget.initAs<RecipientId>());
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+kj::Maybe<kj::Own<_::VatNetworkBase::Connection>>
+    VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::baseConnectToIntroduced(AnyPointer::Reader capId,
+                                        AnyPointer::Builder provisionId) {
+  auto maybe = connectToIntroduced(capId.getAs<ThirdPartyCapId>(),
+                                   provisionId.initAs<ProvisionId>());
+  return maybe.map([](kj::Own<Connection>& conn) -> kj::Own<_::VatNetworkBase::Connection> {
+    return kj::mv(conn);
+  });
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+kj::Promise<void> VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::baseProvide(AnyPointer::Reader recipientId, Capability::Client cap) {
+  return provide(recipientId.getAs<RecipientId>(), kj::mv(cap));
+}
+
+template <typename SturdyRef, typename ProvisionId, typename RecipientId,
+          typename ThirdPartyCapId, typename JoinResult>
+kj::Promise<Capability::Client>
+    VatNetwork<SturdyRef, ProvisionId, RecipientId, ThirdPartyCapId, JoinResult>::
+    Connection::basePickUp(AnyPointer::Reader provisionId) {
+  return pickUp(provisionId.getAs<ProvisionId>());
+}
+
 template <typename SturdyRef>
 Capability::Client SturdyRefRestorer<SturdyRef>::baseRestore(AnyPointer::Reader ref) {
 #pragma GCC diagnostic push
@@ -554,6 +858,17 @@ inline void RpcSystem<VatId>::setFlowLimit(size_t words) {
   baseSetFlowLimit(words);
 }
 
+template <typename VatId>
+inline void RpcSystem<VatId>::setCallLimit(
+    size_t maxCallsPerConnection, kj::Maybe<kj::Own<RpcCallLimiter>> sharedLimiter) {
+  baseSetCallLimit(maxCallsPerConnection, kj::mv(sharedLimiter));
+}
+
+template <typename VatId>
+inline kj::Array<RpcConnectionStats> RpcSystem<VatId>::getConnectionStats() {
+  return baseGetConnectionStats();
+}
+
 template <typename VatId, typename ProvisionId, typename RecipientId,
           typename ThirdPartyCapId, typename JoinResult>
 RpcSystem<VatId> makeRpcServer(
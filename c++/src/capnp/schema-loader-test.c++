@@ -25,6 +25,7 @@
 #include "kj/compat/gtest.h"
 #include "test-util.h"
 #include "kj/debug.h"
+#include "kj/thread.h"
 
 namespace capnp {
 namespace _ {  // private
@@ -330,6 +331,42 @@ TEST(SchemaLoader, LazyLoadGetDependency) {
   EXPECT_EQ(dep, loader.get(typeId<TestAllTypes>()));
 }
 
+TEST(SchemaLoader, PlaceholderBecomesVisibleOnceLoaded) {
+  // A placeholder must not get stuck in the loader's lock-free lookup table.
+  SchemaLoader loader;
+  loader.load(Schema::from<TestDefaults>().getProto());
+  EXPECT_TRUE(loader.tryGet(typeId<TestAllTypes>()) == nullptr);
+  EXPECT_TRUE(loader.tryGet(typeId<TestAllTypes>()) == nullptr);
+
+  loader.load(Schema::from<TestAllTypes>().getProto());
+  EXPECT_EQ(Schema::from<TestAllTypes>().getProto().getDisplayName(),
+            KJ_ASSERT_NONNULL(loader.tryGet(typeId<TestAllTypes>())).getProto().getDisplayName());
+}
+
+TEST(SchemaLoader, ConcurrentGet) {
+  SchemaLoader loader;
+  loader.loadCompiledTypeAndDependencies<test::TestAllTypes>();
+  loader.loadCompiledTypeAndDependencies<test::TestGenerics<TestAllTypes, TestAllTypes>>();
+
+  auto expected = loader.getAllLoaded();
+  auto genericId = typeId<test::TestGenerics<>>();
+  auto unbound = loader.getUnbound(genericId);
+
+  {
+    kj::Vector<kj::Own<kj::Thread>> threads;
+    for (uint t = 0; t < 4; t++) {
+      threads.add(kj::heap<kj::Thread>([&]() {
+        for (uint i = 0; i < 100; i++) {
+          for (auto schema: expected) {
+            KJ_ASSERT(loader.get(schema.getProto().getId()) == schema);
+          }
+          KJ_ASSERT(loader.getUnbound(genericId) == unbound);
+        }
+      }));
+    }
+  }
+}
+
 TEST(SchemaLoader, Generics) {
   SchemaLoader loader;
 
@@ -400,6 +437,35 @@ TEST(SchemaLoader, LoadStreaming) {
   KJ_EXPECT(results.getShortDisplayName() == "StreamResult", results.getShortDisplayName());
 }
 
+TEST(SchemaLoader, CompiledFileIndex) {
+  auto& index = schemas::x_d508eebdc2dc42b8;  // test.capnp
+
+  EXPECT_EQ(&_::rawSchema<TestAllTypes>(), index.find(typeId<TestAllTypes>()));
+  EXPECT_EQ(&_::rawSchema<test::TestInterface>(), index.find(typeId<test::TestInterface>()));
+  EXPECT_EQ(&_::rawSchema<test::TestEnum>(), index.find(typeId<test::TestEnum>()));
+  EXPECT_TRUE(index.find(typeId<schema::Node>()) == nullptr);  // different file
+  EXPECT_TRUE(index.find(0) == nullptr);
+
+  uint count = 0;
+  for (auto schema: kj::arrayPtr(index.slots, index.slotCount)) {
+    if (schema != nullptr) {
+      EXPECT_EQ(schema, index.find(schema->id));
+      ++count;
+    }
+  }
+  EXPECT_EQ(index.schemaCount, count);
+
+  SchemaLoader loader;
+  loader.loadCompiledFile(index);
+  // All of the file's types, plus StreamResult from stream.capnp, which TestStreaming depends on.
+  EXPECT_EQ(index.schemaCount + 1, loader.getAllLoaded().size());
+  EXPECT_TRUE(loader.tryGet(0x995f9a3377c0b16eull) != nullptr);
+  EXPECT_EQ(Schema::from<TestAllTypes>().getProto().getDisplayName(),
+            loader.get(typeId<TestAllTypes>()).getProto().getDisplayName());
+  EXPECT_EQ(Schema::from<test::TestInterface>().getProto().getDisplayName(),
+            loader.get(typeId<test::TestInterface>()).getProto().getDisplayName());
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
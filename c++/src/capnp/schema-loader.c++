@@ -28,13 +28,10 @@
 #include "kj/arena.h"
 #include "kj/vector.h"
 #include <algorithm>
+#include <atomic>
 #include "kj/map.h"
 #include "capnp/stream.capnp.h"
 
-#if _MSC_VER && !defined(__clang__)
-#include <atomic>
-#endif
-
 namespace capnp {
 
 namespace {
@@ -206,6 +203,120 @@ private:
 
 // =======================================================================================
 
+namespace {
+
+template <typename T>
+class LockFreeTable {
+  // An insert-only hash table from non-zero 64-bit keys to pointers, which can be read without
+  // taking any lock. Writers are serialized by a mutex. When the table fills, a bigger one is
+  // built and published in its place; old tables are kept, since readers may still be probing
+  // them, until the whole table is destroyed.
+
+public:
+  LockFreeTable() = default;
+  KJ_DISALLOW_COPY(LockFreeTable);
+
+  const T* find(uint64_t key) const {
+    Slots* slots = current.load(std::memory_order_acquire);
+    if (slots == nullptr) return nullptr;
+
+    size_t mask = slots->size() - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+      auto& slot = (*slots)[i];
+      uint64_t slotKey = slot.key.load(std::memory_order_acquire);
+      if (slotKey == key) {
+        return slot.value.load(std::memory_order_relaxed);
+      } else if (slotKey == 0) {
+        return nullptr;
+      }
+    }
+  }
+
+  void insert(uint64_t key, const T* value) const {
+    if (key == 0) return;  // reserved for empty slots; such keys just always miss
+
+    auto lock = writer.lockExclusive();
+    if (find(key) != nullptr) return;
+
+    Slots* slots = current.load(std::memory_order_relaxed);
+    if (slots == nullptr || (lock->size + 1) * 2 > slots->size()) {
+      // Grow. Readers carry on using the old table until we publish the new one.
+      auto newSlots = kj::heap<Slots>(
+          kj::heapArray<Slot>(slots == nullptr ? 64 : slots->size() * 2));
+      for (auto& slot: *newSlots) {
+        slot.key.store(0, std::memory_order_relaxed);
+        slot.value.store(nullptr, std::memory_order_relaxed);
+      }
+      if (slots != nullptr) {
+        for (auto& slot: *slots) {
+          uint64_t slotKey = slot.key.load(std::memory_order_relaxed);
+          if (slotKey != 0) {
+            add(*newSlots, slotKey, slot.value.load(std::memory_order_relaxed));
+          }
+        }
+      }
+      slots = newSlots.get();
+      lock->tables.add(kj::mv(newSlots));
+      current.store(slots, std::memory_order_release);
+    }
+
+    add(*slots, key, value);
+    ++lock->size;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> key;
+    std::atomic<const T*> value;
+  };
+  typedef kj::Array<Slot> Slots;
+
+  struct Writer {
+    kj::Vector<kj::Own<Slots>> tables;
+    size_t size = 0;
+  };
+
+  mutable std::atomic<Slots*> current { nullptr };
+  kj::MutexGuarded<Writer> writer;
+
+  static inline size_t hash(uint64_t key) {
+    // Schema IDs are random, but pointers aren't, so mix the bits.
+    return (key * 0x9e3779b97f4a7c15ull) >> 32;
+  }
+
+  static void add(Slots& slots, uint64_t key, const T* value) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+      auto& slot = slots[i];
+      if (slot.key.load(std::memory_order_relaxed) == 0) {
+        // Readers match on the key, so it must become visible only after the value.
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.key.store(key, std::memory_order_release);
+        return;
+      }
+    }
+  }
+};
+
+}  // namespace
+
+class SchemaLoader::ReadCache {
+  // Lets the lookups that happen over and over again -- of a schema by ID, and of a schema's
+  // unbound brand -- skip the loader's lock once they have succeeded the first time. Only
+  // schemas that are fully loaded (not placeholders awaiting the lazy-load callback) are cached.
+  // A loaded RawSchema is never moved or freed, and never goes back to being a placeholder, so
+  // a cached entry never goes stale.
+
+public:
+  LockFreeTable<_::RawSchema> schemas;
+  // Keyed by ID.
+
+  LockFreeTable<_::RawBrandedSchema> unboundBrands;
+  // Keyed by address of the generic RawSchema.
+};
+
+// =======================================================================================
+
 inline static void verifyVoid(Void value) {}
 // Calls to this will break if the parameter type changes to non-void.  We use this to detect
 // when the code needs updating.
@@ -1962,9 +2073,9 @@ void SchemaLoader::BrandedInitializerImpl::init(const _::RawBrandedSchema* schem
 
 // =======================================================================================
 
-SchemaLoader::SchemaLoader(): impl(kj::heap<Impl>(*this)) {}
+SchemaLoader::SchemaLoader(): impl(kj::heap<Impl>(*this)), readCache(kj::heap<ReadCache>()) {}
 SchemaLoader::SchemaLoader(const LazyLoadCallback& callback)
-    : impl(kj::heap<Impl>(*this, callback)) {}
+    : impl(kj::heap<Impl>(*this, callback)), readCache(kj::heap<ReadCache>()) {}
 SchemaLoader::~SchemaLoader() noexcept(false) {}
 
 Schema SchemaLoader::get(uint64_t id, schema::Brand::Reader brand, Schema scope) const {
@@ -1977,35 +2088,49 @@ Schema SchemaLoader::get(uint64_t id, schema::Brand::Reader brand, Schema scope)
 
 kj::Maybe<Schema> SchemaLoader::tryGet(
     uint64_t id, schema::Brand::Reader brand, Schema scope) const {
-  auto getResult = impl.lockShared()->get()->tryGet(id);
-  if (getResult.schema == nullptr || getResult.schema->lazyInitializer != nullptr) {
-    // This schema couldn't be found or has yet to be lazily loaded. If we have a lazy loader
-    // callback, invoke it now to try to get it to load this schema.
-    KJ_IF_MAYBE(c, getResult.callback) {
-      c->load(*this, id);
-    }
-    getResult = impl.lockShared()->get()->tryGet(id);
-  }
-  if (getResult.schema != nullptr && getResult.schema->lazyInitializer == nullptr) {
-    if (brand.getScopes().size() > 0) {
-      auto brandedSchema = impl.lockExclusive()->get()->makeBranded(
-          getResult.schema, brand,
-          scope.raw->isUnbound()
-              ? kj::Maybe<kj::ArrayPtr<const _::RawBrandedSchema::Scope>>(nullptr)
-              : kj::arrayPtr(scope.raw->scopes, scope.raw->scopeCount));
-      brandedSchema->ensureInitialized();
-      return Schema(brandedSchema);
-    } else {
-      return Schema(&getResult.schema->defaultBrand);
+  const _::RawSchema* schema = readCache->schemas.find(id);
+  if (schema == nullptr) {
+    auto getResult = impl.lockShared()->get()->tryGet(id);
+    if (getResult.schema == nullptr || getResult.schema->lazyInitializer != nullptr) {
+      // This schema couldn't be found or has yet to be lazily loaded. If we have a lazy loader
+      // callback, invoke it now to try to get it to load this schema.
+      KJ_IF_MAYBE(c, getResult.callback) {
+        c->load(*this, id);
+      }
+      getResult = impl.lockShared()->get()->tryGet(id);
     }
+    if (getResult.schema == nullptr || getResult.schema->lazyInitializer != nullptr) {
+      return nullptr;
+    }
+
+    schema = getResult.schema;
+    readCache->schemas.insert(id, schema);
+  }
+
+  if (brand.getScopes().size() > 0) {
+    auto brandedSchema = impl.lockExclusive()->get()->makeBranded(
+        schema, brand,
+        scope.raw->isUnbound()
+            ? kj::Maybe<kj::ArrayPtr<const _::RawBrandedSchema::Scope>>(nullptr)
+            : kj::arrayPtr(scope.raw->scopes, scope.raw->scopeCount));
+    brandedSchema->ensureInitialized();
+    return Schema(brandedSchema);
   } else {
-    return nullptr;
+    return Schema(&schema->defaultBrand);
   }
 }
 
 Schema SchemaLoader::getUnbound(uint64_t id) const {
   auto schema = get(id);
-  return Schema(impl.lockExclusive()->get()->getUnbound(schema.raw->generic));
+  auto generic = schema.raw->generic;
+  auto key = reinterpret_cast<uintptr_t>(generic);
+
+  const _::RawBrandedSchema* unbound = readCache->unboundBrands.find(key);
+  if (unbound == nullptr) {
+    unbound = impl.lockExclusive()->get()->getUnbound(generic);
+    readCache->unboundBrands.insert(key, unbound);
+  }
+  return Schema(unbound);
 }
 
 Type SchemaLoader::getType(schema::Type::Reader proto, Schema scope) const {
@@ -2090,4 +2215,13 @@ void SchemaLoader::loadNative(const _::RawSchema* nativeSchema) {
   impl.lockExclusive()->get()->loadNative(nativeSchema);
 }
 
+void SchemaLoader::loadCompiledFile(const _::RawSchemaIndex& fileIndex) {
+  auto lock = impl.lockExclusive();
+  for (auto schema: kj::arrayPtr(fileIndex.slots, fileIndex.slotCount)) {
+    if (schema != nullptr) {
+      lock->get()->loadNative(schema);
+    }
+  }
+}
+
 }  // namespace capnp
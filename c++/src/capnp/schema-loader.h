@@ -144,6 +144,11 @@ public:
   // type using as<T>(), you must call this method before constructing the DynamicValue.  Otherwise,
   // as<T>() will throw an exception complaining about type mismatch.
 
+  void loadCompiledFile(const _::RawSchemaIndex& fileIndex);
+  // Load every compiled-in type declared by one .capnp file, along with their dependencies, under
+  // a single lock.  `fileIndex` is `capnp::schemas::x_<file ID in hex>`, declared in the file's
+  // generated header.
+
   kj::Array<Schema> getAllLoaded() const;
   // Get a complete list of all loaded schema nodes.  It is particularly useful to call this after
   // loadCompiledTypeAndDependencies<T>() in order to get a flat list of all of T's transitive
@@ -155,7 +160,10 @@ private:
   class Impl;
   class InitializerImpl;
   class BrandedInitializerImpl;
+  class ReadCache;
   kj::MutexGuarded<kj::Own<Impl>> impl;
+  kj::Own<ReadCache> readCache;
+  // Lock-free index of already-loaded schemas, consulted before taking `impl`'s lock.
 
   void loadNative(const _::RawSchema* nativeSchema);
 };
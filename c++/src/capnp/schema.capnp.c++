@@ -3551,6 +3551,142 @@ const ::capnp::_::RawSchema s_ae504193122357e5 = {
   0, 2, i_ae504193122357e5, nullptr, nullptr, { &s_ae504193122357e5, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_a93fc509624c72d9[] = {
+  &s_cfea0eb02e810062,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_d85d305b7d839963,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_a9962a9ed0a4d7f8,
+  &s_e82753cff0c2218f,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_ac3a6f60ef4cc6d3,
+  nullptr,
+  nullptr,
+  &s_bb90d5c287870be6,
+  &s_bfc546f6210ad7ce,
+  nullptr,
+  nullptr,
+  &s_e682ab4cf923a417,
+  nullptr,
+  nullptr,
+  &s_cafccddb68db1d11,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_8e3b5f79fe593656,
+  nullptr,
+  nullptr,
+  &s_c863cd16969ee7fc,
+  &s_d07378ede1f9cc60,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_9e0e78711a7f87a9,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_ce23dcd2d7b00c9b,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_9500cce23b334d80,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_b18aa5ac7a0d9420,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_9aad50a41f4af45f,
+  nullptr,
+  &s_ed8bca69f7fb0cbf,
+  nullptr,
+  nullptr,
+  &s_c2573fe8a23e49f1,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_97b14cbe7cfec712,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_c2ba9038898e1fa2,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_903455f06065422b,
+  &s_87e739250a60ea97,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_ec1619d4400a0290,
+  &s_9dd1f724f4614a85,
+  &s_debf55bbfa0fc242,
+  &s_9ea0b19b37fb4435,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  nullptr,
+  &s_abd73485a9636bc9,
+  &s_b54ab3364333f598,
+  nullptr,
+  &s_ae504193122357e5,
+  &s_f1c8950dab257542,
+  &s_c42305476bb4746f,
+  nullptr,
+  nullptr,
+  &s_d1958f7dba521926,
+  nullptr,
+  nullptr,
+  &s_baefc9120c56e274,
+  nullptr,
+  nullptr,
+  &s_f38e1de3041357ae,
+  nullptr,
+  &s_b9521bccf10fa3b1,
+  nullptr,
+  &s_978a7cebdc549a4d,
+  nullptr,
+};
+static const uint32_t xh_a93fc509624c72d9[] = {0, 5, 1, 0, 1, 0, 0, 1, 1, 0, 1, 4, 1, 2, 0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 0, 2, 2, 1, 1, 0, 1, 0};
+const ::capnp::_::RawSchemaIndex x_a93fc509624c72d9 = {
+  xs_a93fc509624c72d9, xh_a93fc509624c72d9, 128, 32, 37
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
@@ -64,6 +64,7 @@ CAPNP_DECLARE_SCHEMA(d85d305b7d839963);
 CAPNP_DECLARE_SCHEMA(bfc546f6210ad7ce);
 CAPNP_DECLARE_SCHEMA(cfea0eb02e810062);
 CAPNP_DECLARE_SCHEMA(ae504193122357e5);
+CAPNP_DECLARE_SCHEMA_INDEX(a93fc509624c72d9);
 
 }  // namespace schemas
 }  // namespace capnp
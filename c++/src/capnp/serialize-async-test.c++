@@ -29,6 +29,7 @@
 
 #include "serialize-async.h"
 #include "serialize.h"
+#include "serialize-packed.h"
 #include "kj/debug.h"
 #include "kj/thread.h"
 #include <stdlib.h>
@@ -382,6 +383,355 @@ TEST(SerializeAsyncTest, WriteMultipleMessagesAsync) {
   writeMessages(*output, msgs).wait(ioContext.waitScope);
 }
 
+class ReadCountingStream final: public kj::AsyncIoStream {
+public:
+  explicit ReadCountingStream(kj::AsyncIoStream& inner): inner(inner) {}
+
+  uint reads = 0;
+
+  kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    ++reads;
+    return inner.tryRead(buffer, minBytes, maxBytes);
+  }
+  kj::Promise<void> write(const void* buffer, size_t size) override {
+    return inner.write(buffer, size);
+  }
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
+    return inner.write(pieces);
+  }
+  kj::Promise<void> whenWriteDisconnected() override { return inner.whenWriteDisconnected(); }
+  void shutdownWrite() override { inner.shutdownWrite(); }
+
+private:
+  kj::AsyncIoStream& inner;
+};
+
+TEST(SerializeAsyncTest, AsyncIoMessageStreamReadsAhead) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  ReadCountingStream counter(*pipe.ends[1]);
+  AsyncIoMessageStream writerStream(*pipe.ends[0]);
+  AsyncIoMessageStream readerStream(counter);
+  MessageStream& writer = writerStream;
+  MessageStream& reader = readerStream;
+
+  // A batch of small messages is received with one read, and the readers stay valid as the
+  // stream moves on.
+  const uint count = 10;
+  auto smalls = kj::heapArray<MallocMessageBuilder>(count);
+  auto batch = kj::heapArray<MessageBuilder*>(count);
+  for (auto i: kj::indices(smalls)) {
+    smalls[i].getRoot<TestAllTypes>().setInt32Field(i);
+    batch[i] = &smalls[i];
+  }
+  auto promise = writer.writeMessages(batch);
+  kj::Vector<kj::Own<MessageReader>> readers;
+  for (uint i = 0; i < count; i++) {
+    readers.add(reader.readMessage().wait(ioContext.waitScope));
+  }
+  promise.wait(ioContext.waitScope);
+  EXPECT_EQ(1u, counter.reads);
+
+  // Messages bigger than the read buffer, mixed with messages straddling its end.
+  MallocMessageBuilder large;
+  for (auto element: large.getRoot<TestAllTypes>().initStructList(64)) {
+    initTestMessage(element);
+  }
+  ASSERT_GT(computeSerializedSizeInWords(large), AsyncIoMessageStream::READ_BUFFER_WORDS);
+  TestMessageBuilder medium(3);
+  for (auto element: medium.getRoot<TestAllTypes>().initStructList(1)) {
+    initTestMessage(element);
+  }
+  ASSERT_LT(computeSerializedSizeInWords(medium), AsyncIoMessageStream::READ_BUFFER_WORDS / 2);
+  MessageBuilder* mixed[] = {
+    &medium, &medium, &medium, &medium, &medium, &large, &smalls[3], &medium, &medium, &medium
+  };
+  promise = writer.writeMessages(kj::arrayPtr(mixed, kj::size(mixed)));
+  for (auto builder: mixed) {
+    auto message = reader.readMessage().wait(ioContext.waitScope);
+    auto root = message->getRoot<TestAllTypes>();
+    if (builder == &smalls[3]) {
+      EXPECT_EQ(3, root.getInt32Field());
+    } else {
+      auto list = root.getStructList();
+      EXPECT_EQ(builder == &large ? 64u : 1u, list.size());
+      for (auto element: list) {
+        checkTestMessage(element);
+      }
+    }
+  }
+  promise.wait(ioContext.waitScope);
+
+  for (auto i: kj::indices(readers)) {
+    EXPECT_EQ(i, readers[i]->getRoot<TestAllTypes>().getInt32Field());
+  }
+
+  writer.end().wait(ioContext.waitScope);
+  EXPECT_TRUE(reader.tryReadMessage().wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, AsyncIoMessageStreamRecyclesBuffers) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  kj::Own<MessageReader> survivor;
+  AsyncIoMessageStream writerStream(*pipe.ends[0]);
+  AsyncIoMessageStream readerStream(*pipe.ends[1]);
+  MessageStream& writer = writerStream;
+  MessageStream& reader = readerStream;
+
+  MallocMessageBuilder large;
+  for (auto element: large.getRoot<TestAllTypes>().initStructList(16)) {
+    initTestMessage(element);
+  }
+  ASSERT_GT(computeSerializedSizeInWords(large), AsyncIoMessageStream::READ_BUFFER_WORDS);
+
+  auto readLarge = [&]() {
+    auto promise = writer.writeMessage(large);
+    auto result = reader.readMessage().wait(ioContext.waitScope);
+    promise.wait(ioContext.waitScope);
+    EXPECT_EQ(16u, result->getRoot<TestAllTypes>().getStructList().size());
+    return result;
+  };
+
+  auto first = readLarge();
+  auto second = readLarge();
+  const word* firstSpace = first->getSegment(0).begin();
+  const word* secondSpace = second->getSegment(0).begin();
+  EXPECT_NE(firstSpace, secondSpace);
+
+  // Space freed by readers is reused for later messages.
+  first = nullptr;
+  second = nullptr;
+  auto third = readLarge();
+  auto fourth = readLarge();
+  EXPECT_EQ(secondSpace, third->getSegment(0).begin());
+  EXPECT_EQ(firstSpace, fourth->getSegment(0).begin());
+
+  // Readers may outlive the stream.
+  survivor = kj::mv(fourth);
+}
+
+TEST(SerializeAsyncTest, AsyncIoMessageStreamLargeMessageSplitUnaligned) {
+  // A message bigger than the read buffer, of which the first read returns a number of bytes that
+  // isn't a multiple of the word size, followed by a small message. The small message must still
+  // be parsed from a word-aligned position.
+
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  AsyncIoMessageStream readerStream(*pipe.ends[1]);
+  MessageStream& reader = readerStream;
+
+  MallocMessageBuilder large;
+  for (auto element: large.getRoot<TestAllTypes>().initStructList(64)) {
+    initTestMessage(element);
+  }
+  ASSERT_GT(computeSerializedSizeInWords(large), AsyncIoMessageStream::READ_BUFFER_WORDS);
+  MallocMessageBuilder small;
+  small.getRoot<TestAllTypes>().setInt32Field(123);
+
+  auto largeBytes = messageToFlatArray(large);
+  auto smallBytes = messageToFlatArray(small);
+  auto bytes = largeBytes.asBytes();
+  const size_t FIRST_CHUNK = 1001;
+
+  auto promise = pipe.ends[0]->write(bytes.begin(), FIRST_CHUNK)
+      .then([&]() {
+    return pipe.ends[0]->write(bytes.begin() + FIRST_CHUNK, bytes.size() - FIRST_CHUNK);
+  }).then([&]() {
+    return pipe.ends[0]->write(smallBytes.asBytes().begin(), smallBytes.asBytes().size());
+  }).eagerlyEvaluate(nullptr);
+
+  auto first = reader.readMessage().wait(ioContext.waitScope);
+  EXPECT_EQ(64u, first->getRoot<TestAllTypes>().getStructList().size());
+  auto second = reader.readMessage().wait(ioContext.waitScope);
+  EXPECT_EQ(123, second->getRoot<TestAllTypes>().getInt32Field());
+  promise.wait(ioContext.waitScope);
+}
+
+TEST(SerializeAsyncTest, AsyncIoMessageStreamPrematureEof) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  AsyncIoMessageStream readerStream(*pipe.ends[1]);
+  MessageStream& reader = readerStream;
+
+  MallocMessageBuilder builder;
+  builder.getRoot<TestAllTypes>().setInt32Field(123);
+  auto words = messageToFlatArray(builder);
+  auto promise = pipe.ends[0]->write(words.begin(), words.asBytes().size() - sizeof(word))
+      .then([&]() { pipe.ends[0]->shutdownWrite(); }).eagerlyEvaluate(nullptr);
+
+  EXPECT_ANY_THROW(reader.tryReadMessage().wait(ioContext.waitScope));
+  promise.wait(ioContext.waitScope);
+}
+
+TEST(SerializeAsyncTest, ChecksummedMessage) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newOneWayPipe();
+
+  TestMessageBuilder message(7);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  auto writePromise = writeChecksummedMessage(*pipe.out, message)
+      .then([&]() { return writeChecksummedMessage(*pipe.out, message); })
+      .then([&]() { pipe.out = nullptr; }).eagerlyEvaluate(nullptr);
+
+  auto first = readChecksummedMessage(*pipe.in).wait(ioContext.waitScope);
+  checkTestMessage(first->getRoot<TestAllTypes>());
+
+  word scratch[8192];
+  auto second = KJ_ASSERT_NONNULL(
+      tryReadChecksummedMessage(*pipe.in, ReaderOptions(), kj::arrayPtr(scratch, 8192))
+      .wait(ioContext.waitScope));
+  checkTestMessage(second->getRoot<TestAllTypes>());
+  EXPECT_EQ(scratch, second->getSegment(0).begin());
+
+  writePromise.wait(ioContext.waitScope);
+  EXPECT_TRUE(tryReadChecksummedMessage(*pipe.in).wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, ChecksummedMessageDetectsCorruption) {
+  auto ioContext = kj::setupAsyncIo();
+
+  TestMessageBuilder message(3);
+  initTestMessage(message.getRoot<TestAllTypes>());
+
+  // Same format as the synchronous version.
+  kj::VectorOutputStream output;
+  writeChecksummedMessage(output, message);
+  auto bytes = kj::heapArray<byte>(output.getArray());
+
+  auto readBytes = [&]() {
+    auto pipe = kj::newOneWayPipe();
+    auto writePromise = pipe.out->write(bytes.begin(), bytes.size())
+        .then([&]() { pipe.out = nullptr; }).eagerlyEvaluate(nullptr);
+    auto reader = readChecksummedMessage(*pipe.in).wait(ioContext.waitScope);
+    checkTestMessage(reader->getRoot<TestAllTypes>());
+  };
+
+  readBytes();
+
+  // Corrupt the table.
+  bytes[4] ^= 1;
+  EXPECT_ANY_THROW(readBytes());
+  bytes[4] ^= 1;
+
+  // Corrupt the data.
+  bytes[bytes.size() - 1] ^= 1;
+  EXPECT_ANY_THROW(readBytes());
+  bytes[bytes.size() - 1] ^= 1;
+
+  // Truncate the message.
+  bytes = kj::heapArray(bytes.slice(0, bytes.size() - sizeof(word)));
+  EXPECT_ANY_THROW(readBytes());
+}
+
+TEST(SerializeAsyncTest, PackedMessageStream) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  PackedMessageStream leftStream(*pipe.ends[0]);
+  PackedMessageStream rightStream(*pipe.ends[1]);
+  MessageStream& left = leftStream;
+  MessageStream& right = rightStream;
+
+  MallocMessageBuilder small;
+  small.getRoot<TestAllTypes>().setInt32Field(123);
+
+  TestMessageBuilder large(3);
+  for (auto element: large.getRoot<TestAllTypes>().initStructList(16)) {
+    initTestMessage(element);
+  }
+  ASSERT_GE(computeSerializedSizeInWords(large) * sizeof(word),
+            PackedMessageStream::DEFAULT_PACK_THRESHOLD);
+
+  // Neither side knows yet what the other accepts, so this goes out unpacked.
+  EXPECT_FALSE(leftStream.isPeerPacking());
+  auto promise = left.writeMessage(large);
+  {
+    auto reader = right.readMessage().wait(ioContext.waitScope);
+    auto list = reader->getRoot<TestAllTypes>().getStructList();
+    EXPECT_EQ(16u, list.size());
+    for (auto element: list) {
+      checkTestMessage(element);
+    }
+  }
+  promise.wait(ioContext.waitScope);
+
+  // Having seen the left side's announcement, the right side packs large messages.
+  EXPECT_TRUE(rightStream.isPeerPacking());
+  MessageBuilder* batch[] = { &large, &small, &large };
+  promise = right.writeMessages(kj::arrayPtr(batch, 3));
+  for (auto i: kj::zeroTo(3)) {
+    auto reader = left.readMessage().wait(ioContext.waitScope);
+    auto root = reader->getRoot<TestAllTypes>();
+    if (i == 1) {
+      EXPECT_EQ(123, root.getInt32Field());
+    } else {
+      EXPECT_EQ(16u, root.getStructList().size());
+      for (auto element: root.getStructList()) {
+        checkTestMessage(element);
+      }
+    }
+  }
+  promise.wait(ioContext.waitScope);
+  EXPECT_TRUE(leftStream.isPeerPacking());
+
+  left.end().wait(ioContext.waitScope);
+  EXPECT_TRUE(right.tryReadMessage().wait(ioContext.waitScope) == nullptr);
+}
+
+TEST(SerializeAsyncTest, PackedMessageStreamBytesOnWire) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  PackedMessageStream packedStream(*pipe.ends[0]);
+  MessageStream& stream = packedStream;
+
+  // Announce that we accept raw and packed frames, then stop sending.
+  _::WireValue<uint32_t> hello[2];
+  hello[0].set(0x6f6c6568);
+  hello[1].set(3);
+  auto announce = pipe.ends[1]->write(hello, sizeof(hello)).then([&]() {
+    pipe.ends[1]->shutdownWrite();
+  }).eagerlyEvaluate(nullptr);
+  EXPECT_TRUE(stream.tryReadMessage().wait(ioContext.waitScope) == nullptr);
+  announce.wait(ioContext.waitScope);
+  ASSERT_TRUE(packedStream.isPeerPacking());
+
+  MallocMessageBuilder large;
+  large.initRoot<TestAllTypes>().initInt64List(1024);
+  size_t rawSize = computeSerializedSizeInWords(large) * sizeof(word);
+
+  auto write = stream.writeMessage(large).then([&]() { return stream.end(); })
+      .eagerlyEvaluate(nullptr);
+  _::WireValue<uint32_t> headers[4];  // its own announcement, then the frame header
+  pipe.ends[1]->read(headers, sizeof(headers)).wait(ioContext.waitScope);
+  auto payload = pipe.ends[1]->readAllBytes().wait(ioContext.waitScope);
+  write.wait(ioContext.waitScope);
+
+  EXPECT_EQ(0x6f6c6568u, headers[0].get());
+  EXPECT_EQ(1u, headers[2].get());
+  EXPECT_EQ(payload.size(), headers[3].get());
+
+  // A list of 1024 zeros packs down to a handful of bytes.
+  EXPECT_LT(payload.size(), rawSize / 32);
+  kj::ArrayInputStream input(payload);
+  PackedMessageReader reader(input);
+  EXPECT_EQ(1024u, reader.getRoot<TestAllTypes>().getInt64List().size());
+}
+
+TEST(SerializeAsyncTest, PackedMessageStreamRequiresPackedPeer) {
+  auto ioContext = kj::setupAsyncIo();
+  auto pipe = kj::newTwoWayPipe();
+  PackedMessageStream packedStream(*pipe.ends[1]);
+  MessageStream& stream = packedStream;
+
+  MallocMessageBuilder message;
+  message.getRoot<TestAllTypes>().setInt32Field(123);
+  auto promise = writeMessage(*pipe.ends[0], message);
+
+  KJ_EXPECT_THROW_MESSAGE("is it using PackedMessageStream?",
+      stream.readMessage().wait(ioContext.waitScope));
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -31,8 +31,11 @@
 #endif
 
 #include "serialize-async.h"
+#include "serialize.h"
+#include "serialize-packed.h"
 #include "kj/debug.h"
 #include "kj/io.h"
+#include "kj/refcount.h"
 
 namespace capnp {
 
@@ -241,6 +244,73 @@ kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
   });
 }
 
+namespace {
+
+struct ChecksummedReadState {
+  _::ChecksummedSegmentTable table;
+  kj::Array<word> ownedSpace;
+  // Only if scratchSpace wasn't big enough.
+};
+
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadChecksummedMessageImpl(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  auto state = kj::heap<ChecksummedReadState>();
+  auto& table = state->table;
+  auto promise = input.tryRead(table.firstWord, sizeof(table.firstWord), sizeof(table.firstWord));
+  return promise.then([&input,&table](size_t n) -> kj::Promise<bool> {
+    if (n == 0) {
+      return false;
+    } else if (n < sizeof(table.firstWord)) {
+      // EOF in first word.
+      kj::throwRecoverableException(KJ_EXCEPTION(DISCONNECTED, "Premature EOF."));
+      return false;
+    }
+
+    auto rest = table.initRest();
+    return input.read(rest.begin(), rest.asBytes().size()).then([]() { return true; });
+  }).then([&input,options,scratchSpace,state = kj::mv(state)](bool success) mutable
+          -> kj::Promise<kj::Maybe<kj::Own<MessageReader>>> {
+    if (!success) {
+      return kj::Maybe<kj::Own<MessageReader>>(nullptr);
+    }
+
+    size_t totalWords = state->table.check(options);
+    if (scratchSpace.size() < totalWords) {
+      state->ownedSpace = kj::heapArray<word>(totalWords);
+      scratchSpace = state->ownedSpace;
+    }
+
+    auto promise = input.read(scratchSpace.begin(), totalWords * sizeof(word));
+    return promise.then([options,scratchSpace,state = kj::mv(state)]() mutable
+                        -> kj::Maybe<kj::Own<MessageReader>> {
+      auto segments = state->table.layOutSegments(scratchSpace);
+      state->table.checkSegments(segments);
+      auto reader = kj::heap<SegmentArrayMessageReader>(segments, options);
+      return kj::Own<MessageReader>(
+          reader.attach(kj::mv(segments), kj::mv(state->ownedSpace)));
+    });
+  });
+}
+
+}  // namespace
+
+kj::Promise<kj::Own<MessageReader>> readChecksummedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  return tryReadChecksummedMessageImpl(input, options, scratchSpace)
+      .then([](kj::Maybe<kj::Own<MessageReader>> maybeReader) -> kj::Own<MessageReader> {
+    KJ_IF_MAYBE(reader, maybeReader) {
+      return kj::mv(*reader);
+    } else {
+      kj::throwFatalException(KJ_EXCEPTION(DISCONNECTED, "Premature EOF."));
+    }
+  });
+}
+
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadChecksummedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  return tryReadChecksummedMessageImpl(input, options, scratchSpace);
+}
+
 // =======================================================================================
 
 namespace {
@@ -332,6 +402,23 @@ kj::Promise<void> writeMessagesImpl(
 
 }  // namespace
 
+kj::Promise<void> writeChecksummedMessage(kj::AsyncOutputStream& output,
+                                          kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  WriteArrays arrays;
+  arrays.table = kj::heapArray<_::WireValue<uint32_t>>(_::checksummedTableSize(segments.size()));
+  arrays.pieces = kj::heapArray<kj::ArrayPtr<const byte>>(segments.size() + 1);
+  _::fillChecksummedTable(segments, arrays.table);
+  arrays.pieces[0] = arrays.table.asBytes();
+  for (uint i = 0; i < segments.size(); i++) {
+    arrays.pieces[i + 1] = segments[i].asBytes();
+  }
+
+  auto promise = output.write(arrays.pieces);
+  return promise.attach(kj::mv(arrays));
+}
+
 kj::Promise<void> writeMessage(kj::AsyncOutputStream& output,
                                kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
   return writeMessageImpl(segments,
@@ -374,21 +461,197 @@ kj::Promise<void> MessageStream::writeMessages(kj::ArrayPtr<MessageBuilder*> bui
   return writeMessages(messages);
 }
 
-AsyncIoMessageStream::AsyncIoMessageStream(kj::AsyncIoStream& stream)
-  : stream(stream) {};
+class AsyncIoMessageStream::BufferPool final: public kj::Refcounted {
+  // Not thread-safe: buffers come back here when the last reader using them is destroyed, which
+  // therefore must happen on the stream's thread.
+
+public:
+  explicit BufferPool(size_t maxBytes): maxBytes(maxBytes) {}
+
+  kj::Array<word> get(size_t minWords) {
+    // Returns a buffer of at least `minWords`, from the pool if possible. Contents are undefined.
+
+    uint sizeClass = 0;
+    while ((READ_BUFFER_WORDS << sizeClass) < minWords) {
+      if ((READ_BUFFER_WORDS << sizeClass) >= MAX_POOLED_BUFFER_WORDS) {
+        // Too big to be pooled.
+        return kj::heapArray<word>(minWords);
+      }
+      ++sizeClass;
+    }
+
+    auto& freeList = freeLists[sizeClass];
+    if (freeList.empty()) {
+      return kj::heapArray<word>(READ_BUFFER_WORDS << sizeClass);
+    } else {
+      auto result = kj::mv(freeList.back());
+      freeList.removeLast();
+      pooledBytes -= result.asBytes().size();
+      return result;
+    }
+  }
+
+  void recycle(kj::Array<word> buffer) {
+    size_t size = buffer.size();
+    if (size < READ_BUFFER_WORDS || size > MAX_POOLED_BUFFER_WORDS || (size & (size - 1)) != 0 ||
+        pooledBytes + buffer.asBytes().size() > maxBytes) {
+      return;
+    }
+
+    uint sizeClass = 0;
+    while ((READ_BUFFER_WORDS << sizeClass) < size) ++sizeClass;
+    pooledBytes += buffer.asBytes().size();
+    freeLists[sizeClass].add(kj::mv(buffer));
+  }
+
+private:
+  size_t maxBytes;
+  size_t pooledBytes = 0;
+
+  static constexpr uint SIZE_CLASS_COUNT = 11;
+  static_assert(READ_BUFFER_WORDS << (SIZE_CLASS_COUNT - 1) == MAX_POOLED_BUFFER_WORDS,
+                "SIZE_CLASS_COUNT doesn't match MAX_POOLED_BUFFER_WORDS");
+  kj::Vector<kj::Array<word>> freeLists[SIZE_CLASS_COUNT];
+};
+
+class AsyncIoMessageStream::ReadBuffer final: public kj::Refcounted {
+  // Space that messages are read into. Readers of the messages hold references to it; the last
+  // reference returns the space to the pool.
+
+public:
+  ReadBuffer(BufferPool& pool, size_t minWords)
+      : pool(kj::addRef(pool)), words(pool.get(minWords)) {}
+  ~ReadBuffer() noexcept(false) {
+    pool->recycle(kj::mv(words));
+  }
+
+  kj::Own<BufferPool> pool;
+  kj::Array<word> words;
+
+  byte* bytes() { return words.asBytes().begin(); }
+};
+
+AsyncIoMessageStream::AsyncIoMessageStream(kj::AsyncIoStream& stream, size_t maxPooledBytes)
+  : stream(stream), pool(kj::refcounted<BufferPool>(maxPooledBytes)) {};
+AsyncIoMessageStream::~AsyncIoMessageStream() noexcept(false) {}
 
 kj::Promise<kj::Maybe<MessageReaderAndFds>> AsyncIoMessageStream::tryReadMessage(
     kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
     ReaderOptions options,
     kj::ArrayPtr<word> scratchSpace) {
-  return capnp::tryReadMessage(stream, options, scratchSpace)
-    .then([](kj::Maybe<kj::Own<MessageReader>> maybeReader) -> kj::Maybe<MessageReaderAndFds> {
-      KJ_IF_MAYBE(reader, maybeReader) {
-        return MessageReaderAndFds { kj::mv(*reader), nullptr };
-      } else {
-        return nullptr;
-      }
+  if (readBuffer.get() == nullptr) {
+    readBuffer = kj::refcounted<ReadBuffer>(*pool, READ_BUFFER_WORDS);
+  }
+
+  KJ_DASSERT(readPos % sizeof(word) == 0, "read position must stay word-aligned");
+  auto buffered = kj::arrayPtr(reinterpret_cast<const word*>(readBuffer->bytes() + readPos),
+                               (readEnd - readPos) / sizeof(word));
+  size_t totalWords = expectedSizeInWordsFromPrefix(buffered);
+
+  if (buffered.size() > 0) {
+    // Reject messages with too many segments for security reasons, before reading their table.
+    uint64_t segmentCount =
+        uint64_t(reinterpret_cast<const _::WireValue<uint32_t>*>(buffered.begin())->get()) + 1;
+    KJ_REQUIRE(segmentCount < 512, "Message has too many segments.") {
+      return kj::Maybe<MessageReaderAndFds>(nullptr);  // exception will be propagated
+    }
+  }
+
+  if (totalWords <= buffered.size()) {
+    // The whole message is here; parse it in place.
+    readPos += totalWords * sizeof(word);
+    kj::Own<MessageReader> reader = kj::heap<FlatArrayMessageReader>(
+        buffered.slice(0, totalWords), options);
+    return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds {
+      reader.attach(kj::addRef(*readBuffer)), nullptr
     });
+  }
+
+  if (totalWords > READ_BUFFER_WORDS) {
+    // The segment table (at most 257 words) fits in the buffer, so we must have all of it, and
+    // `totalWords` is exact.
+    return readLargeMessage(totalWords, options, scratchSpace);
+  }
+
+  size_t minBytes = totalWords * sizeof(word) - (readEnd - readPos);
+  makeRoomToRead(minBytes);
+  return stream.tryRead(readBuffer->bytes() + readEnd, minBytes,
+                        readBuffer->words.size() * sizeof(word) - readEnd)
+      .then([this,fdSpace,options,scratchSpace,minBytes](size_t n) mutable
+            -> kj::Promise<kj::Maybe<MessageReaderAndFds>> {
+    if (n < minBytes) {
+      if (n == 0 && readEnd == readPos) {
+        return kj::Maybe<MessageReaderAndFds>(nullptr);
+      }
+      return KJ_EXCEPTION(DISCONNECTED, "Premature EOF.");
+    }
+
+    readEnd += n;
+    return tryReadMessage(fdSpace, options, scratchSpace);
+  });
+}
+
+void AsyncIoMessageStream::makeRoomToRead(size_t minBytes) {
+  // Makes sure at least `minBytes` can be read into the buffer after the data already there, by
+  // moving that data to the start of the buffer if needed. Also does so when less than a quarter
+  // of the buffer is left, so that reads keep picking up many small messages at once.
+
+  size_t capacity = readBuffer->words.size() * sizeof(word);
+  size_t room = capacity - readEnd;
+  if (readPos == 0 || (room >= minBytes && room >= capacity / 4)) return;
+
+  size_t unparsed = readEnd - readPos;
+  if (readBuffer->isShared()) {
+    // Readers returned earlier still point into this buffer, so move to a new one.
+    auto newBuffer = kj::refcounted<ReadBuffer>(*pool, READ_BUFFER_WORDS);
+    memcpy(newBuffer->bytes(), readBuffer->bytes() + readPos, unparsed);
+    readBuffer = kj::mv(newBuffer);
+  } else {
+    memmove(readBuffer->bytes(), readBuffer->bytes() + readPos, unparsed);
+  }
+  readPos = 0;
+  readEnd = unparsed;
+}
+
+kj::Promise<kj::Maybe<MessageReaderAndFds>> AsyncIoMessageStream::readLargeMessage(
+    size_t totalWords, ReaderOptions options, kj::ArrayPtr<word> scratchSpace) {
+  // Don't accept a message which the receiver couldn't possibly traverse without hitting the
+  // traversal limit.  Without this check, a malicious client could transmit a very large segment
+  // size to make the receiver allocate excessive space and possibly crash.
+  auto table = reinterpret_cast<const _::WireValue<uint32_t>*>(readBuffer->bytes() + readPos);
+  size_t tableWords = (table[0].get() + 1) / 2 + 1;
+  KJ_REQUIRE(totalWords - tableWords <= options.traversalLimitInWords,
+             "Message is too large.  To increase the limit on the receiving end, see "
+             "capnp::ReaderOptions.") {
+    return kj::Maybe<MessageReaderAndFds>(nullptr);  // exception will be propagated
+  }
+
+  kj::Own<ReadBuffer> ownedSpace;
+  if (scratchSpace.size() < totalWords) {
+    ownedSpace = kj::refcounted<ReadBuffer>(*pool, totalWords);
+    scratchSpace = ownedSpace->words;
+  }
+  auto space = scratchSpace.slice(0, totalWords);
+
+  size_t buffered = readEnd - readPos;
+  memcpy(space.begin(), readBuffer->bytes() + readPos, buffered);
+
+  // The read buffer is now drained. Start over at its beginning: `buffered` need not be a whole
+  // number of words, and the next message must be parsed from a word-aligned position.
+  if (readBuffer->isShared()) {
+    // Readers returned earlier still point into this buffer, so move to a new one.
+    readBuffer = kj::refcounted<ReadBuffer>(*pool, READ_BUFFER_WORDS);
+  }
+  readPos = 0;
+  readEnd = 0;
+
+  auto promise = stream.read(space.asBytes().begin() + buffered,
+                             totalWords * sizeof(word) - buffered);
+  return promise.then([space,options,ownedSpace = kj::mv(ownedSpace)]() mutable
+                      -> kj::Maybe<MessageReaderAndFds> {
+    kj::Own<MessageReader> reader = kj::heap<FlatArrayMessageReader>(space, options);
+    return MessageReaderAndFds { reader.attach(kj::mv(ownedSpace)), nullptr };
+  });
 }
 
 kj::Promise<void> AsyncIoMessageStream::writeMessage(
@@ -463,6 +726,166 @@ kj::Promise<void> AsyncCapabilityMessageStream::end() {
   return kj::READY_NOW;
 }
 
+// -----------------------------------------------------------------------------
+// PackedMessageStream
+//
+// Every frame starts with a two-word header: a frame type, then a type-specific value.
+//
+// - HELLO: the value is a bitmask of the frame types the sender accepts. Always the first frame.
+// - RAW: the value is the message's size in bytes; the message follows in the standard format.
+// - PACKED: the value is the packed size in bytes; the standard format, packed, follows.
+
+namespace {
+
+enum PackedStreamFrame: uint32_t {
+  RAW_FRAME = 0,
+  PACKED_FRAME = 1,
+  HELLO_FRAME = 0x6f6c6568,  // "helo", to make mismatched peers easy to spot in a dump
+};
+
+constexpr uint32_t ACCEPTED_FRAMES = (1u << RAW_FRAME) | (1u << PACKED_FRAME);
+
+struct PackedStreamWriteState {
+  // Holds buffers that must remain valid until a write completes.
+
+  kj::Vector<kj::ArrayPtr<const byte>> pieces;
+  kj::Array<_::WireValue<uint32_t>> headers;
+  kj::Vector<kj::Array<_::WireValue<uint32_t>>> tables;
+  kj::Vector<kj::Own<kj::VectorOutputStream>> packed;
+};
+
+}  // namespace
+
+PackedMessageStream::PackedMessageStream(kj::AsyncIoStream& stream, size_t packThreshold)
+    : stream(stream), packThreshold(packThreshold) {}
+
+kj::Promise<kj::Maybe<MessageReaderAndFds>> PackedMessageStream::tryReadMessage(
+    kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
+    ReaderOptions options,
+    kj::ArrayPtr<word> scratchSpace) {
+  return stream.tryRead(readHeader, sizeof(readHeader), sizeof(readHeader))
+      .then([this,fdSpace,options,scratchSpace](size_t n) mutable
+            -> kj::Promise<kj::Maybe<MessageReaderAndFds>> {
+    if (n == 0) {
+      return kj::Maybe<MessageReaderAndFds>(nullptr);
+    } else if (n < sizeof(readHeader)) {
+      return KJ_EXCEPTION(DISCONNECTED, "Premature EOF.");
+    }
+
+    uint32_t type = readHeader[0].get();
+    uint32_t value = readHeader[1].get();
+
+    if (!receivedHello) {
+      KJ_REQUIRE(type == HELLO_FRAME,
+          "peer didn't announce its encodings; is it using PackedMessageStream?") {
+        return kj::Maybe<MessageReaderAndFds>(nullptr);  // exception will be propagated
+      }
+      receivedHello = true;
+      peerAcceptsPacked = value & (1u << PACKED_FRAME);
+      return tryReadMessage(fdSpace, options, scratchSpace);
+    }
+
+    switch (type) {
+      case RAW_FRAME:
+        return capnp::readMessage(stream, options, scratchSpace)
+            .then([](kj::Own<MessageReader>&& reader) -> kj::Maybe<MessageReaderAndFds> {
+          return MessageReaderAndFds { kj::mv(reader), nullptr };
+        });
+
+      case PACKED_FRAME: {
+        // We only pack messages when it makes them smaller, so the packed size is bounded by the
+        // same limit as the unpacked size.
+        KJ_REQUIRE(value / sizeof(word) <= options.traversalLimitInWords,
+                   "Message is too large.  To increase the limit on the receiving end, see "
+                   "capnp::ReaderOptions.") {
+          return kj::Maybe<MessageReaderAndFds>(nullptr);  // exception will be propagated
+        }
+
+        auto buffer = kj::heapArray<byte>(value);
+        auto promise = stream.read(buffer.begin(), buffer.size());
+        return promise.then([buffer = kj::mv(buffer),options,scratchSpace]() mutable
+                            -> kj::Maybe<MessageReaderAndFds> {
+          auto input = kj::heap<kj::ArrayInputStream>(buffer);
+          kj::Own<MessageReader> reader = kj::heap<PackedMessageReader>(
+              *input, options, scratchSpace);
+          // PackedMessageReader may read later segments lazily, so keep its input around.
+          return MessageReaderAndFds { reader.attach(kj::mv(input), kj::mv(buffer)), nullptr };
+        });
+      }
+
+    }
+
+    KJ_FAIL_REQUIRE("unknown PackedMessageStream frame type", type) {
+      return kj::Maybe<MessageReaderAndFds>(nullptr);  // exception will be propagated
+    }
+  });
+}
+
+kj::Promise<void> PackedMessageStream::writeMessage(
+    kj::ArrayPtr<const int> fds,
+    kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  return writeMessages(kj::arrayPtr(&segments, 1));
+}
+
+kj::Promise<void> PackedMessageStream::writeMessages(
+    kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> messages) {
+  KJ_REQUIRE(messages.size() > 0, "Tried to serialize zero messages.");
+
+  PackedStreamWriteState state;
+  state.headers = kj::heapArray<_::WireValue<uint32_t>>((messages.size() + 1) * 2);
+  auto headers = state.headers.begin();
+
+  auto addHeader = [&](uint32_t type, uint32_t value) {
+    headers[0].set(type);
+    headers[1].set(value);
+    state.pieces.add(kj::arrayPtr(headers, 2).asBytes());
+    headers += 2;
+  };
+
+  if (!sentHello) {
+    addHeader(HELLO_FRAME, ACCEPTED_FRAMES);
+    sentHello = true;
+  }
+
+  for (auto& segments: messages) {
+    KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+    size_t size = computeSerializedSizeInWords(segments) * sizeof(word);
+
+    if (peerAcceptsPacked && size >= packThreshold) {
+      auto output = kj::heap<kj::VectorOutputStream>(kj::max(size / 2, sizeof(word)));
+      writePackedMessage(*output, segments);
+      auto bytes = output->getArray();
+      if (bytes.size() < size) {
+        addHeader(PACKED_FRAME, bytes.size());
+        state.pieces.add(bytes);
+        state.packed.add(kj::mv(output));
+        continue;
+      }
+      // Packing didn't help (e.g. the message is mostly compressed or encrypted data); fall back
+      // to sending it as-is.
+    }
+
+    addHeader(RAW_FRAME, size);
+    auto table = kj::heapArray<_::WireValue<uint32_t>>(tableSizeForSegments(segments.size()));
+    auto pieces = kj::heapArray<kj::ArrayPtr<const byte>>(segments.size() + 1);
+    fillWriteArraysWithMessage(segments, table, pieces);
+    state.pieces.addAll(pieces);
+    state.tables.add(kj::mv(table));
+  }
+
+  auto promise = stream.write(state.pieces.asPtr());
+  return promise.attach(kj::mv(state));
+}
+
+kj::Maybe<int> PackedMessageStream::getSendBufferSize() {
+  return capnp::getSendBufferSize(stream);
+}
+
+kj::Promise<void> PackedMessageStream::end() {
+  stream.shutdownWrite();
+  return kj::READY_NOW;
+}
+
 kj::Promise<kj::Own<MessageReader>> MessageStream::readMessage(
     ReaderOptions options,
     kj::ArrayPtr<word> scratchSpace) {
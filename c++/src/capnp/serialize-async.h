@@ -100,8 +100,33 @@ public:
 
 class AsyncIoMessageStream final: public MessageStream {
   // A MessageStream that wraps an AsyncIoStream.
+  //
+  // Reads go through a receive buffer of READ_BUFFER_WORDS words, so a batch of small messages
+  // sent back to back costs a single read() rather than two or three per message. Messages which
+  // arrive whole in the buffer are parsed in place, and their readers share ownership of the
+  // buffer; only a message left incomplete at the end of the buffer is copied, to the start of a
+  // buffer which no reader still uses. Messages too big for the buffer are read into their own
+  // space, as with `readMessage()`.
+  //
+  // Once no reader uses a receive buffer any more, it goes back to a pool belonging to the stream
+  // and is reused, rather than freed. Buffers come in power-of-two size classes from
+  // READ_BUFFER_WORDS up to MAX_POOLED_BUFFER_WORDS; the pool keeps at most `maxPooledBytes` of
+  // them, and frees the rest. The pool outlives the stream as long as readers from it do.
+  //
+  // Neither the buffers' reference counts nor the pool are synchronized, so readers returned by
+  // tryReadMessage() must be destroyed on the thread that owns the stream. To hand a message to
+  // another thread, copy it (e.g. into a MallocMessageBuilder) first.
+  //
+  // Since the stream may read ahead of the message it returns, don't mix reads through the
+  // AsyncIoMessageStream with reads directly from the underlying stream.
 public:
-  explicit AsyncIoMessageStream(kj::AsyncIoStream& stream);
+  static constexpr size_t READ_BUFFER_WORDS = 1024;
+  static constexpr size_t MAX_POOLED_BUFFER_WORDS = 1u << 20;
+  static constexpr size_t DEFAULT_MAX_POOLED_BYTES = 1u << 20;
+
+  explicit AsyncIoMessageStream(kj::AsyncIoStream& stream,
+                                size_t maxPooledBytes = DEFAULT_MAX_POOLED_BYTES);
+  ~AsyncIoMessageStream() noexcept(false);
 
   // Implements MessageStream
   kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
@@ -117,6 +142,22 @@ public:
   kj::Promise<void> end() override;
 private:
   kj::AsyncIoStream& stream;
+
+  class BufferPool;
+  kj::Own<BufferPool> pool;
+
+  class ReadBuffer;
+  kj::Own<ReadBuffer> readBuffer;
+  // Allocated on first read.
+
+  size_t readPos = 0;
+  size_t readEnd = 0;
+  // Byte offsets in `readBuffer` of the data read from the stream but not yet returned. `readPos`
+  // is always at a message boundary, and so word-aligned.
+
+  void makeRoomToRead(size_t minBytes);
+  kj::Promise<kj::Maybe<MessageReaderAndFds>> readLargeMessage(
+      size_t totalWords, ReaderOptions options, kj::ArrayPtr<word> scratchSpace);
 };
 
 class AsyncCapabilityMessageStream final: public MessageStream {
@@ -139,6 +180,48 @@ private:
   kj::AsyncCapabilityStream& stream;
 };
 
+class PackedMessageStream final: public MessageStream {
+  // A MessageStream that wraps an AsyncIoStream and applies the packed encoding (see
+  // serialize-packed.h) to large messages, which typically shrinks them by half or more at little
+  // CPU cost. Useful on bandwidth-constrained links, e.g. by passing one to TwoPartyVatNetwork.
+  //
+  // Both ends of the stream must use PackedMessageStream; its framing is not compatible with
+  // AsyncIoMessageStream. Each side starts by announcing the encodings it accepts, and sends
+  // messages unencoded until it has seen the peer's announcement, so no round trip is spent
+  // negotiating. Messages smaller than `packThreshold` bytes are always sent unencoded, as are
+  // messages which packing would not make smaller.
+
+public:
+  static constexpr size_t DEFAULT_PACK_THRESHOLD = 1024;
+
+  explicit PackedMessageStream(kj::AsyncIoStream& stream,
+                               size_t packThreshold = DEFAULT_PACK_THRESHOLD);
+
+  // Implements MessageStream
+  kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
+      kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
+      ReaderOptions options = ReaderOptions(), kj::ArrayPtr<word> scratchSpace = nullptr) override;
+  kj::Promise<void> writeMessage(
+      kj::ArrayPtr<const int> fds,
+      kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) override;
+  kj::Promise<void> writeMessages(
+      kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> messages) override;
+  kj::Maybe<int> getSendBufferSize() override;
+  kj::Promise<void> end() override;
+
+  bool isPeerPacking() { return peerAcceptsPacked; }
+  // Whether the peer's announcement has arrived and says it accepts packed messages, i.e. whether
+  // large messages written now will be packed.
+
+private:
+  kj::AsyncIoStream& stream;
+  size_t packThreshold;
+  bool sentHello = false;
+  bool receivedHello = false;
+  bool peerAcceptsPacked = false;
+  _::WireValue<uint32_t> readHeader[2];
+};
+
 // -----------------------------------------------------------------------------
 // Stand-alone functions for reading & writing messages on AsyncInput/AsyncOutputStreams.
 //
@@ -196,6 +279,27 @@ kj::Promise<void> writeMessages(
     kj::AsyncOutputStream& output, kj::ArrayPtr<MessageBuilder*> builders)
     KJ_WARN_UNUSED_RESULT;
 
+// -----------------------------------------------------------------------------
+// Stand-alone functions for reading & writing checksummed messages (see serialize.h) on
+// AsyncInput/AsyncOutputStreams.
+
+kj::Promise<kj::Own<MessageReader>> readChecksummedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+
+kj::Promise<kj::Maybe<kj::Own<MessageReader>>> tryReadChecksummedMessage(
+    kj::AsyncInputStream& input, ReaderOptions options = ReaderOptions(),
+    kj::ArrayPtr<word> scratchSpace = nullptr);
+// Read a message written by writeChecksummedMessage(). The returned promise is rejected if any
+// checksum doesn't match. tryReadChecksummedMessage() returns null on EOF.
+
+kj::Promise<void> writeChecksummedMessage(kj::AsyncOutputStream& output,
+                                          kj::ArrayPtr<const kj::ArrayPtr<const word>> segments)
+    KJ_WARN_UNUSED_RESULT;
+
+kj::Promise<void> writeChecksummedMessage(kj::AsyncOutputStream& output, MessageBuilder& builder)
+    KJ_WARN_UNUSED_RESULT;
+
 // =======================================================================================
 // inline implementation details
 
@@ -206,6 +310,10 @@ inline kj::Promise<void> writeMessage(
     kj::AsyncCapabilityStream& output, kj::ArrayPtr<const int> fds, MessageBuilder& builder) {
   return writeMessage(output, fds, builder.getSegmentsForOutput());
 }
+inline kj::Promise<void> writeChecksummedMessage(
+    kj::AsyncOutputStream& output, MessageBuilder& builder) {
+  return writeChecksummedMessage(output, builder.getSegmentsForOutput());
+}
 
 inline kj::Promise<void> MessageStream::writeMessage(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
   return writeMessage(nullptr, segments);
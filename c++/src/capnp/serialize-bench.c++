@@ -0,0 +1,130 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "message.h"
+#include "serialize.h"
+#include "serialize-packed.h"
+#include "test-util.h"
+#include <kj/benchmark.h>
+#include <kj/io.h>
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+KJ_BENCHMARK("MallocMessageBuilder build TestAllTypes") {
+  for (uint64_t i = 0; i < iterations; i++) {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    kj::doNotOptimizeAway(builder.getSegmentsForOutput().size());
+  }
+}
+
+KJ_BENCHMARK("MallocMessageBuilder build small struct") {
+  for (uint64_t i = 0; i < iterations; i++) {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<TestAllTypes>();
+    root.setInt32Field(i);
+    root.setTextField("foo");
+    kj::doNotOptimizeAway(builder.getSegmentsForOutput().size());
+  }
+}
+
+uint64_t sumFields(TestAllTypes::Reader reader) {
+  // Touch a representative selection of fields, including pointers and lists.
+  uint64_t sum = reader.getUInt64Field() + reader.getInt32Field() + reader.getUInt8Field();
+  sum += reader.getTextField().size() + reader.getDataField().size();
+  sum += reader.getStructField().getUInt32Field();
+  for (auto s: reader.getStructList()) {
+    sum += s.getTextField().size();
+  }
+  for (auto n: reader.getInt64List()) {
+    sum += n;
+  }
+  for (auto t: reader.getTextList()) {
+    sum += t.size();
+  }
+  return sum;
+}
+
+KJ_BENCHMARK("FlatArrayMessageReader read TestAllTypes") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto words = messageToFlatArray(builder);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    FlatArrayMessageReader reader(words);
+    kj::doNotOptimizeAway(sumFields(reader.getRoot<TestAllTypes>()));
+  }
+}
+
+KJ_BENCHMARK("writeMessage / readMessage flat") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto buffer = kj::heapArray<kj::byte>(1 << 18);
+  word scratch[4096];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    kj::ArrayOutputStream output(buffer);
+    writeMessage(output, builder);
+
+    kj::ArrayInputStream input(output.getArray());
+    InputStreamMessageReader reader(input, ReaderOptions(), scratch);
+    kj::doNotOptimizeAway(sumFields(reader.getRoot<TestAllTypes>()));
+  }
+}
+
+KJ_BENCHMARK("writePackedMessage / readPackedMessage") {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto buffer = kj::heapArray<kj::byte>(1 << 18);
+  word scratch[4096];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    kj::ArrayOutputStream output(buffer);
+    writePackedMessage(output, builder);
+
+    kj::ArrayInputStream input(output.getArray());
+    PackedMessageReader reader(input, ReaderOptions(), scratch);
+    kj::doNotOptimizeAway(sumFields(reader.getRoot<TestAllTypes>()));
+  }
+}
+
+KJ_BENCHMARK("writePackedMessage 64KiB of mixed data") {
+  // Exercises the packing loop itself on a large, realistic-ish mix of zero and non-zero bytes.
+  MallocMessageBuilder builder;
+  auto data = builder.initRoot<TestAllTypes>().initUInt32List(16384);
+  for (uint i = 0; i < data.size(); i++) {
+    data.set(i, i % 3 == 0 ? 0 : i * 2654435761u >> (i % 24));
+  }
+  auto buffer = kj::heapArray<kj::byte>(1 << 18);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    kj::ArrayOutputStream output(buffer);
+    writePackedMessage(output, builder);
+    kj::doNotOptimizeAway(output.getArray().size());
+  }
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
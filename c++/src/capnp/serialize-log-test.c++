@@ -0,0 +1,113 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "serialize-log.h"
+#include <kj/test.h>
+#include "test-util.h"
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+KJ_TEST("MessageLogWriter / MessageLogReader") {
+  auto file = kj::newInMemoryFile(kj::nullClock());
+
+  {
+    auto appender = kj::newFileAppender(file->clone());
+    MessageLogWriter writer(*appender);
+
+    for (uint i = 0; i < 100; i++) {
+      MallocMessageBuilder builder;
+      auto root = builder.initRoot<TestAllTypes>();
+      if (i == 50) initTestMessage(root);
+      root.setUInt32Field(i);
+      KJ_EXPECT(writer.write(builder, i * 2) == i);
+    }
+
+    KJ_EXPECT_THROW_MESSAGE("non-decreasing", ({
+      MallocMessageBuilder builder;
+      builder.initRoot<TestAllTypes>();
+      writer.write(builder, 3);
+    }));
+
+    writer.finish();
+  }
+
+  MessageLogReader reader(*file);
+  KJ_ASSERT(reader.size() == 100);
+
+  KJ_EXPECT(reader.openMessage(7)->getRoot<TestAllTypes>().getUInt32Field() == 7);
+  {
+    auto message = reader.openMessage(50);
+    auto root = message->getRoot<TestAllTypes>();
+    KJ_EXPECT(root.getUInt32Field() == 50);
+    KJ_EXPECT(root.getTextField() == "foo");
+    KJ_EXPECT(root.getStructList().size() == 3);
+  }
+
+  KJ_EXPECT(reader.getKey(10) == 20);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(reader.find(20)) == 10);
+  KJ_EXPECT(reader.find(21) == nullptr);
+  KJ_EXPECT(reader.lowerBound(21) == 11);
+  KJ_EXPECT(reader.lowerBound(1000) == 100);
+
+  KJ_EXPECT_THROW_MESSAGE("out of range", reader.getMessage(100));
+
+  // The log is still a plain message stream, ending with one empty message (the index).
+  auto bytes = file->readAllBytes();
+  auto words = kj::arrayPtr(reinterpret_cast<const word*>(bytes.begin()),
+                            bytes.size() / sizeof(word));
+  uint count = 0;
+  while (words.size() > 0) {
+    FlatArrayMessageReader message(words);
+    if (count < 100) {
+      KJ_EXPECT(message.getRoot<TestAllTypes>().getUInt32Field() == count);
+    } else {
+      KJ_EXPECT(message.getRoot<AnyPointer>().isNull());
+    }
+    words = kj::arrayPtr(message.getEnd(), words.end());
+    ++count;
+  }
+  KJ_EXPECT(count == 101);
+}
+
+KJ_TEST("MessageLogReader rejects files without an index") {
+  auto file = kj::newInMemoryFile(kj::nullClock());
+
+  {
+    auto appender = kj::newFileAppender(file->clone());
+    MessageLogWriter writer(*appender);
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writer.write(builder);
+    // Don't finish().
+  }
+
+  KJ_EXPECT_THROW_MESSAGE("missing index", MessageLogReader reader(*file));
+
+  file->truncate(8);
+  KJ_EXPECT_THROW_MESSAGE("too small", MessageLogReader reader(*file));
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
@@ -0,0 +1,179 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "serialize-log.h"
+#include <kj/debug.h>
+
+namespace capnp {
+
+namespace {
+
+constexpr uint ENTRY_WORDS = 3;
+constexpr uint FOOTER_WORDS = 3;
+
+constexpr uint64_t LOG_MAGIC =
+    uint64_t('c') | uint64_t('a') << 8 | uint64_t('p') << 16 | uint64_t('n') << 24 |
+    uint64_t('p') << 32 | uint64_t('l') << 40 | uint64_t('o') << 48 | uint64_t('g') << 56;
+
+}  // namespace
+
+MessageLogWriter::MessageLogWriter(kj::AppendableFile& file)
+    : file(file), offset(file.stat().size) {
+  KJ_REQUIRE(offset % sizeof(word) == 0, "message log must start at a word boundary", offset);
+}
+
+MessageLogWriter::~MessageLogWriter() noexcept(false) {}
+
+size_t MessageLogWriter::write(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                               uint64_t key) {
+  KJ_REQUIRE(!finished, "message log already finished");
+  if (entries.size() > 0) {
+    KJ_REQUIRE(key >= entries.back().key, "message log keys must be non-decreasing",
+               key, entries.back().key);
+  }
+
+  uint64_t size = computeSerializedSizeInWords(segments);
+  writeMessage(file, segments);
+
+  size_t result = entries.size();
+  entries.add(Entry { offset, size, key });
+  offset += size * sizeof(word);
+  return result;
+}
+
+size_t MessageLogWriter::write(MessageBuilder& builder, uint64_t key) {
+  return write(builder.getSegmentsForOutput(), key);
+}
+
+size_t MessageLogWriter::write(MessageBuilder& builder) {
+  return write(builder.getSegmentsForOutput(), entries.size());
+}
+
+void MessageLogWriter::finish() {
+  KJ_REQUIRE(!finished, "message log already finished");
+  finished = true;
+
+  // One word of segment table, one null root pointer, then the entries and the footer.
+  size_t segmentWords = 1 + entries.size() * ENTRY_WORDS + FOOTER_WORDS;
+  KJ_REQUIRE(segmentWords <= uint32_t(kj::maxValue), "too many messages in log");
+
+  auto words = kj::heapArray<_::WireValue<uint64_t>>(1 + segmentWords);
+  auto table = reinterpret_cast<_::WireValue<uint32_t>*>(words.begin());
+  table[0].set(0);
+  table[1].set(segmentWords);
+
+  auto pos = words.begin() + 1;
+  (pos++)->set(0);
+  for (auto& entry: entries) {
+    (pos++)->set(entry.offset);
+    (pos++)->set(entry.size);
+    (pos++)->set(entry.key);
+  }
+  (pos++)->set(LOG_MAGIC);
+  (pos++)->set(entries.size());
+  (pos++)->set(offset);
+  KJ_ASSERT(pos == words.end());
+
+  file.write(words.begin(), words.asBytes().size());
+  offset += words.asBytes().size();
+}
+
+// =======================================================================================
+
+MessageLogReader::MessageLogReader(const kj::ReadableFile& file) {
+  uint64_t fileSize = file.stat().size;
+  KJ_REQUIRE(fileSize % sizeof(word) == 0 &&
+             fileSize >= (1 + 1 + FOOTER_WORDS) * sizeof(word),
+             "not a message log: too small");
+
+  _::WireValue<uint64_t> footer[FOOTER_WORDS];
+  file.read(fileSize - sizeof(footer), kj::arrayPtr(footer, FOOTER_WORDS).asBytes());
+
+  KJ_REQUIRE(footer[0].get() == LOG_MAGIC, "not a message log: missing index");
+
+  uint64_t entryCount = footer[1].get();
+  indexStart = footer[2].get();
+
+  // Check that the index message exactly fills the end of the file. Careful of overflow: the
+  // footer is untrusted.
+  uint64_t indexWords = fileSize / sizeof(word) - 1 - 1 - FOOTER_WORDS;
+  KJ_REQUIRE(entryCount <= indexWords / ENTRY_WORDS &&
+             indexStart == fileSize - (entryCount * ENTRY_WORDS + 1 + 1 + FOOTER_WORDS) *
+                           sizeof(word),
+             "message log index is corrupt");
+
+  count = entryCount;
+  mapping = file.mmap(0, fileSize);
+
+  auto words = reinterpret_cast<const _::WireValue<uint64_t>*>(mapping.begin());
+  index = kj::arrayPtr(words + indexStart / sizeof(word) + 2, count * ENTRY_WORDS);
+}
+
+MessageLogReader::~MessageLogReader() noexcept(false) {}
+
+uint64_t MessageLogReader::getKey(size_t i) const {
+  KJ_REQUIRE(i < count, "message log position out of range", i, count);
+  return index[i * ENTRY_WORDS + 2].get();
+}
+
+size_t MessageLogReader::lowerBound(uint64_t key) const {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index[mid * ENTRY_WORDS + 2].get() < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+kj::Maybe<size_t> MessageLogReader::find(uint64_t key) const {
+  size_t result = lowerBound(key);
+  if (result < count && index[result * ENTRY_WORDS + 2].get() == key) {
+    return result;
+  } else {
+    return nullptr;
+  }
+}
+
+kj::ArrayPtr<const word> MessageLogReader::getMessage(size_t i) const {
+  KJ_REQUIRE(i < count, "message log position out of range", i, count);
+
+  // Entries are validated lazily, so that opening a log doesn't have to touch the whole index.
+  uint64_t offset = index[i * ENTRY_WORDS].get();
+  uint64_t size = index[i * ENTRY_WORDS + 1].get();
+  KJ_REQUIRE(offset % sizeof(word) == 0 && offset <= indexStart &&
+             size <= (indexStart - offset) / sizeof(word),
+             "message log index entry is corrupt", i);
+
+  return kj::arrayPtr(reinterpret_cast<const word*>(mapping.begin() + offset), size);
+}
+
+kj::Own<FlatArrayMessageReader> MessageLogReader::openMessage(
+    size_t i, ReaderOptions options) const {
+  return kj::heap<FlatArrayMessageReader>(getMessage(i), options);
+}
+
+}  // namespace capnp
@@ -0,0 +1,133 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#include "serialize.h"
+#include <kj/filesystem.h>
+#include <kj/vector.h>
+
+CAPNP_BEGIN_HEADER
+
+namespace capnp {
+
+// =======================================================================================
+// Indexed message logs
+//
+// A message log is a file containing a sequence of messages in the standard serialization format
+// (exactly as written by writeMessage()), followed by an index. The index is itself framed as one
+// more single-segment message whose root pointer is null, so a log can still be read
+// sequentially by any stream reader, which will simply see one extra empty message at the end.
+//
+// The index segment contains, after the null root pointer, one entry per message:
+//
+//     offset: UInt64   # byte offset of the message within the file
+//     size:   UInt64   # size of the message, including its segment table, in words
+//     key:    UInt64   # user-provided key; must be non-decreasing
+//
+// and ends with a three-word footer:
+//
+//     magic:  UInt64   # "capnplog"
+//     count:  UInt64   # number of entries
+//     start:  UInt64   # byte offset of the index message within the file
+//
+// All values are little-endian. Since the footer is at a fixed position relative to the end of
+// the file, a reader can locate any message in O(1) by position or O(log n) by key, without
+// scanning.
+
+class MessageLogWriter {
+  // Appends messages to a log file, then writes the index when finish() is called.
+
+public:
+  explicit MessageLogWriter(kj::AppendableFile& file);
+  // Messages are appended after whatever the file already contains, whose size must be a multiple
+  // of the word size. The file should not be written by anyone else until finish() is called.
+
+  ~MessageLogWriter() noexcept(false);
+  KJ_DISALLOW_COPY(MessageLogWriter);
+
+  size_t write(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments, uint64_t key);
+  size_t write(MessageBuilder& builder, uint64_t key);
+  size_t write(MessageBuilder& builder);
+  // Append a message, returning its position in the log. Keys must be non-decreasing, so that
+  // readers can binary-search them. If no key is given, the message's position is used.
+
+  void finish();
+  // Write the index. No more messages can be written afterwards. If the writer is destroyed
+  // without calling finish(), the messages are still readable as a plain stream, but the file
+  // is not a valid indexed log.
+
+private:
+  struct Entry {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t key;
+  };
+
+  kj::AppendableFile& file;
+  uint64_t offset;
+  kj::Vector<Entry> entries;
+  bool finished = false;
+};
+
+class MessageLogReader {
+  // Provides random access to the messages in a log written by MessageLogWriter. The file is
+  // mapped once up front; only the footer is read eagerly, so opening is O(1) regardless of the
+  // size of the log.
+
+public:
+  explicit MessageLogReader(const kj::ReadableFile& file);
+  // The file must remain valid (and unmodified) until the reader is destroyed.
+
+  ~MessageLogReader() noexcept(false);
+  KJ_DISALLOW_COPY(MessageLogReader);
+
+  size_t size() const { return count; }
+  // Number of messages in the log.
+
+  uint64_t getKey(size_t index) const;
+  // Get the key of the given message.
+
+  kj::Maybe<size_t> find(uint64_t key) const;
+  // Binary-search for the first message with the given key.
+
+  size_t lowerBound(uint64_t key) const;
+  // Returns the position of the first message whose key is not less than `key`, or size() if
+  // there is none.
+
+  kj::ArrayPtr<const word> getMessage(size_t index) const;
+  // Get the flat words of the given message, suitable for passing to FlatArrayMessageReader.
+
+  kj::Own<FlatArrayMessageReader> openMessage(
+      size_t index, ReaderOptions options = ReaderOptions()) const;
+  // Convenience: construct a reader for the given message.
+
+private:
+  kj::Array<const byte> mapping;
+  kj::ArrayPtr<const _::WireValue<uint64_t>> index;
+  size_t count = 0;
+  uint64_t indexStart = 0;
+};
+
+}  // namespace capnp
+
+CAPNP_END_HEADER
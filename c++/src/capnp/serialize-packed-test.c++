@@ -219,6 +219,42 @@ TEST(Packed, SimplePacking) {
       {0xed,8,100,6,1,1,2, 0,2, 0xd4,1,2,3,1});
 }
 
+TEST(Packed, AllTags) {
+  // Exercise every possible tag byte, since the packing kernels handle each one with a
+  // precomputed table entry.
+
+  kj::Vector<byte> allUnpacked;
+  kj::Vector<byte> allPacked;
+
+  for (uint tag = 0; tag < 256; tag++) {
+    byte unpacked[8];
+    kj::Vector<byte> packed;
+    packed.add(tag);
+    for (uint i = 0; i < 8; i++) {
+      if (tag & (1u << i)) {
+        unpacked[i] = (i * 31 + tag) % 255 + 1;
+        packed.add(unpacked[i]);
+      } else {
+        unpacked[i] = 0;
+      }
+    }
+
+    if (tag == 0 || tag == 0xff) {
+      // Followed by a run length.
+      packed.add(0);
+    } else {
+      // Only words with tags other than 0x00 and 0xff can be concatenated without changing the
+      // encoding of their neighbors.
+      allUnpacked.addAll(kj::arrayPtr(unpacked, sizeof(unpacked)));
+      allPacked.addAll(packed);
+    }
+
+    expectPacksTo(kj::arrayPtr(unpacked, sizeof(unpacked)), packed);
+  }
+
+  expectPacksTo(allUnpacked, allPacked);
+}
+
 // =======================================================================================
 
 class TestMessageBuilder: public MallocMessageBuilder {
@@ -583,6 +619,98 @@ TEST(Packed, RoundTripHugeStringEvenSegmentCountLazy) {
   EXPECT_TRUE(reader.getRoot<TestAllTypes>().getTextField() == huge);
 }
 
+TEST(Packed, ParallelRoundTrip) {
+  kj::String huge = kj::heapString(5023);
+  memset(huge.begin(), 'x', 5023);
+
+  TestMessageBuilder builder(2);
+  builder.initRoot<TestAllTypes>().setTextField(huge);
+
+  TestPipe serial;
+  writePackedMessage(serial, builder);
+
+  // With chunks bigger than any segment, the output is exactly writePackedMessage()'s.
+  TestPipe oneChunk;
+  writePackedMessageParallel(oneChunk, builder, 4, 1u << 20);
+  EXPECT_TRUE(oneChunk.getData() == serial.getData());
+
+  for (uint threadCount: {1u, 4u}) {
+    TestPipe pipe;
+    writePackedMessageParallel(pipe, builder, threadCount, 7);
+
+    EXPECT_EQ(computeSerializedSizeInWords(builder), computeUnpackedSizeInWords(pipe.getArray()));
+
+    PackedMessageReader reader(pipe);
+    EXPECT_TRUE(reader.getRoot<TestAllTypes>().getTextField() == huge);
+  }
+}
+
+TEST(Packed, FramedRoundTrip) {
+  TestMessageBuilder builder(3);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  for (size_t chunkWords: {1u, 5u, 1u << 20}) {
+    TestPipe pipe;
+    writeFramedPackedMessage(pipe, builder, 3, chunkWords);
+
+    auto words = readFramedPackedMessage(pipe, 3);
+    EXPECT_TRUE(pipe.allRead());
+    EXPECT_EQ(computeSerializedSizeInWords(builder), words.size());
+
+    FlatArrayMessageReader reader(words);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(Packed, FramedErrors) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeFramedPackedMessage(pipe, builder, 2, 16);
+  const std::string original = pipe.getData();
+
+  auto expectReadFails = [&](std::string data, ReaderOptions options = ReaderOptions()) {
+    pipe.clear();
+    pipe.write(data.data(), data.size());
+    EXPECT_TRUE(kj::runCatchingExceptions([&]() {
+      readFramedPackedMessage(pipe, 2, options);
+    }) != nullptr);
+  };
+
+  auto setHeader = [&](uint index, uint32_t value) {
+    std::string data = original;
+    _::WireValue<uint32_t> wire;
+    wire.set(value);
+    memcpy(&data[index * sizeof(wire)], &wire, sizeof(wire));
+    return data;
+  };
+
+  auto headerValue = [&](uint index) {
+    _::WireValue<uint32_t> wire;
+    memcpy(&wire, &original[index * sizeof(wire)], sizeof(wire));
+    return wire.get();
+  };
+
+  // Reserved header field.
+  expectReadFails(setHeader(1, 1));
+
+  // Too big.
+  ReaderOptions small;
+  small.traversalLimitInWords = computeSerializedSizeInWords(builder) - 1;
+  expectReadFails(original, small);
+
+  // Unpacked sizes which disagree with the packed data.
+  expectReadFails(setHeader(3, headerValue(3) - 1));
+  expectReadFails(setHeader(3, headerValue(3) + 1));
+
+  // Packed data which runs past its chunk.
+  expectReadFails(setHeader(2, headerValue(2) + 1) + std::string(1, '\0'));
+
+  // Truncated.
+  expectReadFails(original.substr(0, original.size() - 1));
+}
+
 // TODO(test):  Test error cases.
 
 }  // namespace
@@ -22,16 +22,208 @@
 #include "serialize-packed.h"
 #include "kj/debug.h"
 #include "layout.h"
+#include <kj/thread.h>
+#include <algorithm>
 #include <vector>
 
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace capnp {
 
 namespace _ {  // private
 
-PackedInputStream::PackedInputStream(kj::BufferedInputStream& inner): inner(inner) {}
-PackedInputStream::~PackedInputStream() noexcept(false) {}
+namespace {
 
-size_t PackedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
+// Per-word kernels ==================================================================
+//
+// The packing algorithm works on one 8-byte word at a time. Each kernel below implements the
+// per-word steps; the surrounding logic (tags 0x00 and 0xff, buffer boundaries) is shared, see
+// unpackImpl() and packImpl(). All kernels produce byte-identical output.
+//
+//   uint pack(const uint8_t* in, uint8_t* out, uint& tag):
+//     Copies the non-zero bytes of the word at `in` to `out`, in order, sets `tag` (bit N set
+//     iff byte N is non-zero), and returns the number of bytes copied. May write up to 8 bytes
+//     to `out`.
+//
+//   uint unpack(uint tag, const uint8_t* in, uint8_t* out):
+//     The inverse: writes a full word to `out`, taking the next byte from `in` for each set bit
+//     of `tag` and zero for each clear bit. Returns the number of bytes consumed from `in`. May
+//     read up to 8 bytes from `in`.
+//
+//   uint countZeros(const uint8_t* in):
+//     Returns the number of zero bytes in the word at `in`.
+
+struct ScalarKernel {
+  static inline uint pack(const uint8_t* __restrict__ in, uint8_t* __restrict__ out,
+                          uint& tag) {
+    uint8_t* start = out;
+
+#define HANDLE_BYTE(n) \
+    uint8_t bit##n = in[n] != 0; \
+    *out = in[n]; \
+    out += bit##n; /* out only advances if the byte was non-zero */
+
+    HANDLE_BYTE(0);
+    HANDLE_BYTE(1);
+    HANDLE_BYTE(2);
+    HANDLE_BYTE(3);
+    HANDLE_BYTE(4);
+    HANDLE_BYTE(5);
+    HANDLE_BYTE(6);
+    HANDLE_BYTE(7);
+#undef HANDLE_BYTE
+
+    tag = (bit0 << 0) | (bit1 << 1) | (bit2 << 2) | (bit3 << 3)
+        | (bit4 << 4) | (bit5 << 5) | (bit6 << 6) | (bit7 << 7);
+    return out - start;
+  }
+
+  static inline uint unpack(uint tag, const uint8_t* __restrict__ in,
+                            uint8_t* __restrict__ out) {
+    const uint8_t* start = in;
+
+#define HANDLE_BYTE(n) \
+    { \
+       bool isNonzero = (tag & (1u << n)) != 0; \
+       *out++ = *in & (-(int8_t)isNonzero); \
+       in += isNonzero; \
+    }
+
+    HANDLE_BYTE(0);
+    HANDLE_BYTE(1);
+    HANDLE_BYTE(2);
+    HANDLE_BYTE(3);
+    HANDLE_BYTE(4);
+    HANDLE_BYTE(5);
+    HANDLE_BYTE(6);
+    HANDLE_BYTE(7);
+#undef HANDLE_BYTE
+
+    return in - start;
+  }
+
+  static inline uint countZeros(const uint8_t* in) {
+    uint c = in[0] == 0;
+    c += in[1] == 0;
+    c += in[2] == 0;
+    c += in[3] == 0;
+    c += in[4] == 0;
+    c += in[5] == 0;
+    c += in[6] == 0;
+    c += in[7] == 0;
+    return c;
+  }
+};
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CAPNP_PACKED_SSSE3 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define CAPNP_PACKED_NEON 1
+#endif
+
+#if CAPNP_PACKED_SSSE3 || CAPNP_PACKED_NEON
+// The SIMD kernels compact and expand bytes with a byte shuffle (PSHUFB / TBL), using a
+// precomputed shuffle control for each of the 256 possible tags. Out-of-range indices (high bit
+// set) produce zero bytes.
+
+struct ShuffleTables {
+  uint8_t pack[256][8];
+  // For each tag, the indices of the non-zero bytes, in order, then filler.
+
+  uint8_t unpack[256][8];
+  // For each tag, for each output byte, the index of the packed byte which goes there, or 0x80
+  // if the byte is zero.
+};
+
+constexpr ShuffleTables makeShuffleTables() {
+  ShuffleTables tables = {};
+  for (uint tag = 0; tag < 256; tag++) {
+    uint count = 0;
+    for (uint i = 0; i < 8; i++) {
+      if (tag & (1u << i)) {
+        tables.pack[tag][count] = i;
+        tables.unpack[tag][i] = count++;
+      } else {
+        tables.unpack[tag][i] = 0x80;
+      }
+    }
+    for (uint i = count; i < 8; i++) {
+      tables.pack[tag][i] = 0x80;
+    }
+  }
+  return tables;
+}
+
+constexpr ShuffleTables SHUFFLE_TABLES = makeShuffleTables();
+#endif
+
+#if CAPNP_PACKED_SSSE3
+#define CAPNP_SSSE3_TARGET __attribute__((target("ssse3,popcnt")))
+
+bool haveSsse3() {
+  static const bool result = __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt");
+  return result;
+}
+
+struct Ssse3Kernel {
+  CAPNP_SSSE3_TARGET static inline uint pack(const uint8_t* in, uint8_t* out, uint& tag) {
+    __m128i word = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    tag = ~_mm_movemask_epi8(_mm_cmpeq_epi8(word, _mm_setzero_si128())) & 0xffu;
+    __m128i shuffle = _mm_loadl_epi64(
+        reinterpret_cast<const __m128i*>(SHUFFLE_TABLES.pack[tag]));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(word, shuffle));
+    return kj::popCount(tag);
+  }
+
+  CAPNP_SSSE3_TARGET static inline uint unpack(uint tag, const uint8_t* in, uint8_t* out) {
+    __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    __m128i shuffle = _mm_loadl_epi64(
+        reinterpret_cast<const __m128i*>(SHUFFLE_TABLES.unpack[tag]));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(packed, shuffle));
+    return kj::popCount(tag);
+  }
+
+  CAPNP_SSSE3_TARGET static inline uint countZeros(const uint8_t* in) {
+    __m128i word = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in));
+    return kj::popCount(_mm_movemask_epi8(_mm_cmpeq_epi8(word, _mm_setzero_si128())) & 0xffu);
+  }
+};
+#endif  // CAPNP_PACKED_SSSE3
+
+#if CAPNP_PACKED_NEON
+struct NeonKernel {
+  static inline uint pack(const uint8_t* in, uint8_t* out, uint& tag) {
+    uint8x8_t word = vld1_u8(in);
+    tag = tagOf(word);
+    vst1_u8(out, vtbl1_u8(word, vld1_u8(SHUFFLE_TABLES.pack[tag])));
+    return kj::popCount(tag);
+  }
+
+  static inline uint unpack(uint tag, const uint8_t* in, uint8_t* out) {
+    vst1_u8(out, vtbl1_u8(vld1_u8(in), vld1_u8(SHUFFLE_TABLES.unpack[tag])));
+    return kj::popCount(tag);
+  }
+
+  static inline uint countZeros(const uint8_t* in) {
+    return 8 - kj::popCount(tagOf(vld1_u8(in)));
+  }
+
+private:
+  static inline uint tagOf(uint8x8_t word) {
+    static const uint8_t BITS[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    return vaddv_u8(vand_u8(vtst_u8(word, word), vld1_u8(BITS)));
+  }
+};
+#endif  // CAPNP_PACKED_NEON
+
+// Packing and unpacking loops =======================================================
+
+template <typename Kernel>
+size_t unpackImpl(kj::BufferedInputStream& inner, void* dst, size_t minBytes, size_t maxBytes) {
   if (maxBytes == 0) {
     return 0;
   }
@@ -99,23 +291,8 @@ size_t PackedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
       }
     } else {
       tag = *in++;
-
-#define HANDLE_BYTE(n) \
-      { \
-         bool isNonzero = (tag & (1u << n)) != 0; \
-         *out++ = *in & (-(int8_t)isNonzero); \
-         in += isNonzero; \
-      }
-
-      HANDLE_BYTE(0);
-      HANDLE_BYTE(1);
-      HANDLE_BYTE(2);
-      HANDLE_BYTE(3);
-      HANDLE_BYTE(4);
-      HANDLE_BYTE(5);
-      HANDLE_BYTE(6);
-      HANDLE_BYTE(7);
-#undef HANDLE_BYTE
+      in += Kernel::unpack(tag, in, out);
+      out += sizeof(word);
     }
 
     if (tag == 0) {
@@ -180,6 +357,169 @@ size_t PackedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
 #undef REFRESH_BUFFER
 }
 
+
+template <typename Kernel>
+void packImpl(kj::BufferedOutputStream& inner, const void* src, size_t size) {
+  kj::ArrayPtr<byte> buffer = inner.getWriteBuffer();
+  byte slowBuffer[20];
+
+  uint8_t* __restrict__ out = reinterpret_cast<uint8_t*>(buffer.begin());
+
+  const uint8_t* __restrict__ in = reinterpret_cast<const uint8_t*>(src);
+  const uint8_t* const inEnd = reinterpret_cast<const uint8_t*>(src) + size;
+
+  while (in < inEnd) {
+    if (reinterpret_cast<uint8_t*>(buffer.end()) - out < 10) {
+      // Oops, we're out of space.  We need at least 10 bytes for the fast path, since we don't
+      // bounds-check on every byte.
+
+      // Write what we have so far.
+      inner.write(buffer.begin(), out - reinterpret_cast<uint8_t*>(buffer.begin()));
+
+      // Use a slow buffer into which we'll encode 10 to 20 bytes.  This should get us past the
+      // output stream's buffer boundary.
+      buffer = kj::arrayPtr(slowBuffer, sizeof(slowBuffer));
+      out = reinterpret_cast<uint8_t*>(buffer.begin());
+    }
+
+    uint8_t* tagPos = out++;
+    uint tag;
+    out += Kernel::pack(in, out, tag);
+    *tagPos = tag;
+    in += sizeof(word);
+
+    if (tag == 0) {
+      // An all-zero word is followed by a count of consecutive zero words (not including the
+      // first one).
+
+      // We can check a whole word at a time. (Here is where we use the assumption that
+      // `src` is word-aligned.)
+      const uint64_t* inWord = reinterpret_cast<const uint64_t*>(in);
+
+      // The count must fit it 1 byte, so limit to 255 words.
+      const uint64_t* limit = reinterpret_cast<const uint64_t*>(inEnd);
+      if (limit - inWord > 255) {
+        limit = inWord + 255;
+      }
+
+      while (inWord < limit && *inWord == 0) {
+        ++inWord;
+      }
+
+      // Write the count.
+      *out++ = inWord - reinterpret_cast<const uint64_t*>(in);
+
+      // Advance input.
+      in = reinterpret_cast<const uint8_t*>(inWord);
+
+    } else if (tag == 0xffu) {
+      // An all-nonzero word is followed by a count of consecutive uncompressed words, followed
+      // by the uncompressed words themselves.
+
+      // Count the number of consecutive words in the input which have no more than a single
+      // zero-byte.  We look for at least two zeros because that's the point where our compression
+      // scheme becomes a net win.
+      // TODO(perf):  Maybe look for three zeros?  Compressing a two-zero word is a loss if the
+      //   following word has no zeros.
+      const uint8_t* runStart = in;
+
+      const uint8_t* limit = inEnd;
+      if ((size_t)(limit - in) > 255 * sizeof(word)) {
+        limit = in + 255 * sizeof(word);
+      }
+
+      while (in < limit) {
+        if (Kernel::countZeros(in) >= 2) {
+          // Stop before the word with multiple zeros, since we'll want to compress that one.
+          break;
+        }
+        in += sizeof(word);
+      }
+
+      // Write the count.
+      uint count = in - runStart;
+      *out++ = count / sizeof(word);
+
+      if (count <= reinterpret_cast<uint8_t*>(buffer.end()) - out) {
+        // There's enough space to memcpy.
+        memcpy(out, runStart, count);
+        out += count;
+      } else {
+        // Input overruns the output buffer.  We'll give it to the output stream in one chunk
+        // and let it decide what to do.
+        inner.write(buffer.begin(), reinterpret_cast<byte*>(out) - buffer.begin());
+        inner.write(runStart, in - runStart);
+        buffer = inner.getWriteBuffer();
+        out = reinterpret_cast<uint8_t*>(buffer.begin());
+      }
+    }
+  }
+
+  // Write whatever is left.
+  inner.write(buffer.begin(), reinterpret_cast<byte*>(out) - buffer.begin());
+}
+
+
+// Entry points ======================================================================
+//
+// Each instantiation is flattened into its entry point so that the kernel is inlined into the
+// loop and compiled for the kernel's target.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CAPNP_PACKED_FLATTEN __attribute__((flatten))
+#else
+#define CAPNP_PACKED_FLATTEN
+#endif
+
+CAPNP_PACKED_FLATTEN
+size_t unpackScalar(kj::BufferedInputStream& inner, void* dst, size_t minBytes, size_t maxBytes) {
+  return unpackImpl<ScalarKernel>(inner, dst, minBytes, maxBytes);
+}
+CAPNP_PACKED_FLATTEN
+void packScalar(kj::BufferedOutputStream& inner, const void* src, size_t size) {
+  packImpl<ScalarKernel>(inner, src, size);
+}
+
+#if CAPNP_PACKED_SSSE3
+CAPNP_SSSE3_TARGET CAPNP_PACKED_FLATTEN
+size_t unpackSsse3(kj::BufferedInputStream& inner, void* dst, size_t minBytes, size_t maxBytes) {
+  return unpackImpl<Ssse3Kernel>(inner, dst, minBytes, maxBytes);
+}
+CAPNP_SSSE3_TARGET CAPNP_PACKED_FLATTEN
+void packSsse3(kj::BufferedOutputStream& inner, const void* src, size_t size) {
+  packImpl<Ssse3Kernel>(inner, src, size);
+}
+#endif
+
+#if CAPNP_PACKED_NEON
+CAPNP_PACKED_FLATTEN
+size_t unpackNeon(kj::BufferedInputStream& inner, void* dst, size_t minBytes, size_t maxBytes) {
+  return unpackImpl<NeonKernel>(inner, dst, minBytes, maxBytes);
+}
+CAPNP_PACKED_FLATTEN
+void packNeon(kj::BufferedOutputStream& inner, const void* src, size_t size) {
+  packImpl<NeonKernel>(inner, src, size);
+}
+#endif
+
+}  // namespace
+
+PackedInputStream::PackedInputStream(kj::BufferedInputStream& inner): inner(inner) {}
+PackedInputStream::~PackedInputStream() noexcept(false) {}
+
+size_t PackedInputStream::tryRead(void* dst, size_t minBytes, size_t maxBytes) {
+#if CAPNP_PACKED_SSSE3
+  if (haveSsse3()) {
+    return unpackSsse3(inner, dst, minBytes, maxBytes);
+  }
+  return unpackScalar(inner, dst, minBytes, maxBytes);
+#elif CAPNP_PACKED_NEON
+  return unpackNeon(inner, dst, minBytes, maxBytes);
+#else
+  return unpackScalar(inner, dst, minBytes, maxBytes);
+#endif
+}
+
 void PackedInputStream::skip(size_t bytes) {
   // We can't just read into buffers because buffers must end on block boundaries.
 
@@ -303,129 +643,17 @@ PackedOutputStream::PackedOutputStream(kj::BufferedOutputStream& inner)
 PackedOutputStream::~PackedOutputStream() noexcept(false) {}
 
 void PackedOutputStream::write(const void* src, size_t size) {
-  kj::ArrayPtr<byte> buffer = inner.getWriteBuffer();
-  byte slowBuffer[20];
-
-  uint8_t* __restrict__ out = reinterpret_cast<uint8_t*>(buffer.begin());
-
-  const uint8_t* __restrict__ in = reinterpret_cast<const uint8_t*>(src);
-  const uint8_t* const inEnd = reinterpret_cast<const uint8_t*>(src) + size;
-
-  while (in < inEnd) {
-    if (reinterpret_cast<uint8_t*>(buffer.end()) - out < 10) {
-      // Oops, we're out of space.  We need at least 10 bytes for the fast path, since we don't
-      // bounds-check on every byte.
-
-      // Write what we have so far.
-      inner.write(buffer.begin(), out - reinterpret_cast<uint8_t*>(buffer.begin()));
-
-      // Use a slow buffer into which we'll encode 10 to 20 bytes.  This should get us past the
-      // output stream's buffer boundary.
-      buffer = kj::arrayPtr(slowBuffer, sizeof(slowBuffer));
-      out = reinterpret_cast<uint8_t*>(buffer.begin());
-    }
-
-    uint8_t* tagPos = out++;
-
-#define HANDLE_BYTE(n) \
-    uint8_t bit##n = *in != 0; \
-    *out = *in; \
-    out += bit##n; /* out only advances if the byte was non-zero */ \
-    ++in
-
-    HANDLE_BYTE(0);
-    HANDLE_BYTE(1);
-    HANDLE_BYTE(2);
-    HANDLE_BYTE(3);
-    HANDLE_BYTE(4);
-    HANDLE_BYTE(5);
-    HANDLE_BYTE(6);
-    HANDLE_BYTE(7);
-#undef HANDLE_BYTE
-
-    uint8_t tag = (bit0 << 0) | (bit1 << 1) | (bit2 << 2) | (bit3 << 3)
-                | (bit4 << 4) | (bit5 << 5) | (bit6 << 6) | (bit7 << 7);
-    *tagPos = tag;
-
-    if (tag == 0) {
-      // An all-zero word is followed by a count of consecutive zero words (not including the
-      // first one).
-
-      // We can check a whole word at a time. (Here is where we use the assumption that
-      // `src` is word-aligned.)
-      const uint64_t* inWord = reinterpret_cast<const uint64_t*>(in);
-
-      // The count must fit it 1 byte, so limit to 255 words.
-      const uint64_t* limit = reinterpret_cast<const uint64_t*>(inEnd);
-      if (limit - inWord > 255) {
-        limit = inWord + 255;
-      }
-
-      while (inWord < limit && *inWord == 0) {
-        ++inWord;
-      }
-
-      // Write the count.
-      *out++ = inWord - reinterpret_cast<const uint64_t*>(in);
-
-      // Advance input.
-      in = reinterpret_cast<const uint8_t*>(inWord);
-
-    } else if (tag == 0xffu) {
-      // An all-nonzero word is followed by a count of consecutive uncompressed words, followed
-      // by the uncompressed words themselves.
-
-      // Count the number of consecutive words in the input which have no more than a single
-      // zero-byte.  We look for at least two zeros because that's the point where our compression
-      // scheme becomes a net win.
-      // TODO(perf):  Maybe look for three zeros?  Compressing a two-zero word is a loss if the
-      //   following word has no zeros.
-      const uint8_t* runStart = in;
-
-      const uint8_t* limit = inEnd;
-      if ((size_t)(limit - in) > 255 * sizeof(word)) {
-        limit = in + 255 * sizeof(word);
-      }
-
-      while (in < limit) {
-        // Check eight input bytes for zeros.
-        uint c = *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-        c += *in++ == 0;
-
-        if (c >= 2) {
-          // Un-read the word with multiple zeros, since we'll want to compress that one.
-          in -= 8;
-          break;
-        }
-      }
-
-      // Write the count.
-      uint count = in - runStart;
-      *out++ = count / sizeof(word);
-
-      if (count <= reinterpret_cast<uint8_t*>(buffer.end()) - out) {
-        // There's enough space to memcpy.
-        memcpy(out, runStart, count);
-        out += count;
-      } else {
-        // Input overruns the output buffer.  We'll give it to the output stream in one chunk
-        // and let it decide what to do.
-        inner.write(buffer.begin(), reinterpret_cast<byte*>(out) - buffer.begin());
-        inner.write(runStart, in - runStart);
-        buffer = inner.getWriteBuffer();
-        out = reinterpret_cast<uint8_t*>(buffer.begin());
-      }
-    }
+#if CAPNP_PACKED_SSSE3
+  if (haveSsse3()) {
+    packSsse3(inner, src, size);
+  } else {
+    packScalar(inner, src, size);
   }
-
-  // Write whatever is left.
-  inner.write(buffer.begin(), reinterpret_cast<byte*>(out) - buffer.begin());
+#elif CAPNP_PACKED_NEON
+  packNeon(inner, src, size);
+#else
+  packScalar(inner, src, size);
+#endif
 }
 
 }  // namespace _ (private)
@@ -505,4 +733,213 @@ size_t computeUnpackedSizeInWords(kj::ArrayPtr<const byte> packedBytes) {
   return total;
 }
 
+// =======================================================================================
+// Parallel packing
+
+namespace {
+
+constexpr size_t MAX_PACKED_BYTES_PER_WORD = 10;
+// A word packs to at most a tag, its eight bytes, and a run count.
+
+class MessageChunks {
+  // The message as writeMessage() would write it, split into chunks of `chunkWords` words.
+
+public:
+  MessageChunks(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments, size_t chunkWords)
+      : table(kj::heapArray<_::WireValue<uint32_t>>((segments.size() + 2) & ~size_t(1))),
+        pieces(kj::heapArray<kj::ArrayPtr<const word>>(segments.size() + 1)),
+        starts(kj::heapArray<size_t>(segments.size() + 1)),
+        chunkWords(chunkWords) {
+    KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+    KJ_REQUIRE(chunkWords > 0 && chunkWords <= uint32_t(kj::maxValue) / MAX_PACKED_BYTES_PER_WORD,
+               "invalid chunk size", chunkWords);
+
+    table[0].set(segments.size() - 1);
+    for (uint i = 0; i < segments.size(); i++) {
+      table[i + 1].set(segments[i].size());
+    }
+    if (segments.size() % 2 == 0) {
+      table[segments.size() + 1].set(0);
+    }
+
+    pieces[0] = kj::arrayPtr(reinterpret_cast<const word*>(table.begin()), table.size() / 2);
+    for (uint i = 0; i < segments.size(); i++) {
+      pieces[i + 1] = segments[i];
+    }
+
+    for (uint i = 0; i < pieces.size(); i++) {
+      starts[i] = totalWords;
+      totalWords += pieces[i].size();
+    }
+  }
+
+  size_t size() const { return (totalWords + chunkWords - 1) / chunkWords; }
+
+  size_t wordsIn(size_t chunk) const {
+    return kj::min(chunkWords, totalWords - chunk * chunkWords);
+  }
+
+  void pack(size_t chunk, kj::BufferedOutputStream& output) const {
+    _::PackedOutputStream packedOutput(output);
+
+    size_t pos = chunk * chunkWords;
+    size_t end = pos + wordsIn(chunk);
+
+    // Find the last piece starting at or before `pos`. Packing each piece separately keeps runs
+    // within the table and segments, as PackedInputStream requires.
+    size_t i = std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin() - 1;
+    while (pos < end) {
+      auto piece = pieces[i++];
+      size_t offset = pos - starts[i - 1];
+      size_t count = kj::min(piece.size() - offset, end - pos);
+      if (count > 0) {
+        packedOutput.write(piece.begin() + offset, count * sizeof(word));
+        pos += count;
+      }
+    }
+  }
+
+private:
+  kj::Array<_::WireValue<uint32_t>> table;
+  kj::Array<kj::ArrayPtr<const word>> pieces;
+  kj::Array<size_t> starts;
+  size_t totalWords = 0;
+  size_t chunkWords;
+};
+
+template <typename Func>
+void runInParallel(size_t count, uint threadCount, Func&& func) {
+  // Calls `func(i)` for each `i` in [0, count), spread over the calling thread and up to
+  // `threadCount - 1` new ones. Rethrows the first exception once all are done.
+
+  threadCount = kj::max(1u, kj::min<size_t>(threadCount, count));
+
+  auto exceptions = kj::heapArrayBuilder<kj::Maybe<kj::Exception>>(threadCount);
+  for (uint t = 0; t < threadCount; t++) {
+    exceptions.add(nullptr);
+  }
+
+  auto work = [&](uint t) {
+    exceptions[t] = kj::runCatchingExceptions([&]() {
+      for (size_t i = t; i < count; i += threadCount) {
+        func(i);
+      }
+    });
+  };
+
+  {
+    auto threads = kj::heapArrayBuilder<kj::Own<kj::Thread>>(threadCount - 1);
+    for (uint t = 1; t < threadCount; t++) {
+      threads.add(kj::heap<kj::Thread>([&work, t]() { work(t); }));
+    }
+    work(0);
+  }
+
+  for (auto& exception: exceptions) {
+    KJ_IF_MAYBE(e, exception) {
+      kj::throwFatalException(kj::mv(*e));
+    }
+  }
+}
+
+kj::Array<kj::VectorOutputStream> packChunks(const MessageChunks& chunks, uint threadCount) {
+  auto packed = kj::heapArrayBuilder<kj::VectorOutputStream>(chunks.size());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    // Enough for typical data to pack without growing the buffer.
+    size_t bytes = chunks.wordsIn(i) * sizeof(word);
+    packed.add(bytes + bytes / 8 + 16);
+  }
+
+  runInParallel(chunks.size(), threadCount, [&](size_t i) {
+    chunks.pack(i, packed[i]);
+  });
+
+  return packed.finish();
+}
+
+}  // namespace
+
+void writePackedMessageParallel(kj::OutputStream& output,
+                                kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                                uint threadCount, size_t chunkWords) {
+  MessageChunks chunks(segments, chunkWords);
+  auto packed = packChunks(chunks, threadCount);
+
+  auto pieces = kj::heapArray<kj::ArrayPtr<const byte>>(packed.size());
+  for (size_t i = 0; i < packed.size(); i++) {
+    pieces[i] = packed[i].getArray();
+  }
+  output.write(pieces);
+}
+
+void writeFramedPackedMessage(kj::OutputStream& output,
+                              kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                              uint threadCount, size_t chunkWords) {
+  MessageChunks chunks(segments, chunkWords);
+  KJ_REQUIRE(chunks.size() <= uint32_t(kj::maxValue), "message has too many chunks", chunks.size());
+  auto packed = packChunks(chunks, threadCount);
+
+  auto header = kj::heapArray<_::WireValue<uint32_t>>(packed.size() * 2 + 2);
+  header[0].set(packed.size());
+  header[1].set(0);
+  for (size_t i = 0; i < packed.size(); i++) {
+    header[i * 2 + 2].set(packed[i].getArray().size());
+    header[i * 2 + 3].set(chunks.wordsIn(i));
+  }
+
+  auto pieces = kj::heapArray<kj::ArrayPtr<const byte>>(packed.size() + 1);
+  pieces[0] = header.asBytes();
+  for (size_t i = 0; i < packed.size(); i++) {
+    pieces[i + 1] = packed[i].getArray();
+  }
+  output.write(pieces);
+}
+
+kj::Array<word> readFramedPackedMessage(kj::InputStream& input, uint threadCount,
+                                        ReaderOptions options) {
+  _::WireValue<uint32_t> prefix[2];
+  input.read(prefix, sizeof(prefix));
+  KJ_REQUIRE(prefix[1].get() == 0, "unknown framed packed message format");
+
+  // Every chunk holds at least one word, so this bounds the header size too.
+  size_t chunkCount = prefix[0].get();
+  KJ_REQUIRE(chunkCount <= options.traversalLimitInWords,
+             "Message is too large.  To increase the limit on the receiving end, see "
+             "capnp::ReaderOptions.");
+
+  auto sizes = kj::heapArray<_::WireValue<uint32_t>>(chunkCount * 2);
+  input.read(sizes.begin(), sizes.asBytes().size());
+
+  auto byteOffsets = kj::heapArray<size_t>(chunkCount + 1);
+  auto wordOffsets = kj::heapArray<size_t>(chunkCount + 1);
+  byteOffsets[0] = 0;
+  wordOffsets[0] = 0;
+  for (size_t i = 0; i < chunkCount; i++) {
+    size_t bytes = sizes[i * 2].get();
+    size_t words = sizes[i * 2 + 1].get();
+    KJ_REQUIRE(words > 0 && bytes <= words * MAX_PACKED_BYTES_PER_WORD,
+               "invalid framed packed message");
+    wordOffsets[i + 1] = wordOffsets[i] + words;
+    byteOffsets[i + 1] = byteOffsets[i] + bytes;
+    KJ_REQUIRE(wordOffsets[i + 1] <= options.traversalLimitInWords,
+               "Message is too large.  To increase the limit on the receiving end, see "
+               "capnp::ReaderOptions.");
+  }
+
+  auto packed = kj::heapArray<byte>(byteOffsets[chunkCount]);
+  input.read(packed.begin(), packed.size());
+
+  auto result = kj::heapArray<word>(wordOffsets[chunkCount]);
+  runInParallel(chunkCount, threadCount, [&](size_t i) {
+    kj::ArrayInputStream chunkInput(packed.slice(byteOffsets[i], byteOffsets[i + 1]));
+    _::PackedInputStream unpacked(chunkInput);
+    unpacked.read(result.begin() + wordOffsets[i],
+                  (wordOffsets[i + 1] - wordOffsets[i]) * sizeof(word));
+    KJ_REQUIRE(chunkInput.tryGetReadBuffer().size() == 0,
+               "framed packed chunk is longer than its size");
+  });
+
+  return result;
+}
+
 }  // namespace capnp
@@ -108,6 +108,50 @@ size_t computeUnpackedSizeInWords(kj::ArrayPtr<const byte> packedBytes);
 // Computes the number of words to which the given packed bytes will unpack. Not intended for use
 // in performance-sensitive situations.
 
+// ---------------------------------------------------------------------------------------
+// Parallel packing
+//
+// For very large messages, packing on one thread becomes the bottleneck. The functions below split
+// the serialized message (segment table included) into chunks of `chunkWords` words and pack the
+// chunks independently on `threadCount` threads, the calling thread among them. No run of packed
+// data crosses a chunk boundary, so the chunks can simply be concatenated. Threads are started per
+// call, and the packed output is held in memory until all chunks are done, so these only pay off
+// for messages of many megabytes.
+
+constexpr size_t PARALLEL_PACKED_CHUNK_WORDS = 1u << 17;
+// Default chunk size: 1 MiB of unpacked data.
+
+void writePackedMessageParallel(kj::OutputStream& output, MessageBuilder& builder,
+                                uint threadCount,
+                                size_t chunkWords = PARALLEL_PACKED_CHUNK_WORDS);
+void writePackedMessageParallel(kj::OutputStream& output,
+                                kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                                uint threadCount,
+                                size_t chunkWords = PARALLEL_PACKED_CHUNK_WORDS);
+// Writes a message in the standard packed format, as `writePackedMessage()` does, so that it can
+// be read with `PackedMessageReader`. The output may differ slightly from `writePackedMessage()`'s
+// where runs were split at chunk boundaries.
+
+void writeFramedPackedMessage(kj::OutputStream& output, MessageBuilder& builder,
+                              uint threadCount,
+                              size_t chunkWords = PARALLEL_PACKED_CHUNK_WORDS);
+void writeFramedPackedMessage(kj::OutputStream& output,
+                              kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                              uint threadCount,
+                              size_t chunkWords = PARALLEL_PACKED_CHUNK_WORDS);
+// Writes a message in the framed packed format, which records the chunk boundaries so that
+// `readFramedPackedMessage()` can unpack in parallel too. The format is not compatible with
+// `PackedMessageReader`. It is a header of little-endian 32-bit values -- the chunk count, a zero,
+// then the packed size in bytes and unpacked size in words of each chunk -- followed by the
+// packed chunks.
+
+kj::Array<word> readFramedPackedMessage(kj::InputStream& input, uint threadCount,
+                                        ReaderOptions options = ReaderOptions());
+// Reads a message written by `writeFramedPackedMessage()`, unpacking its chunks on `threadCount`
+// threads. Returns the message in the unpacked standard format; read it with
+// `FlatArrayMessageReader`. The message size is checked against `options.traversalLimitInWords`
+// before anything is allocated.
+
 // =======================================================================================
 // inline stuff
 
@@ -123,6 +167,16 @@ inline void writePackedMessageToFd(int fd, MessageBuilder& builder) {
   writePackedMessageToFd(fd, builder.getSegmentsForOutput());
 }
 
+inline void writePackedMessageParallel(kj::OutputStream& output, MessageBuilder& builder,
+                                       uint threadCount, size_t chunkWords) {
+  writePackedMessageParallel(output, builder.getSegmentsForOutput(), threadCount, chunkWords);
+}
+
+inline void writeFramedPackedMessage(kj::OutputStream& output, MessageBuilder& builder,
+                                     uint threadCount, size_t chunkWords) {
+  writeFramedPackedMessage(output, builder.getSegmentsForOutput(), threadCount, chunkWords);
+}
+
 }  // namespace capnp
 
 CAPNP_END_HEADER
@@ -0,0 +1,261 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#if __linux__
+
+#include "serialize-shm.h"
+#include "rpc-twoparty.h"
+#include "test-util.h"
+#include <kj/debug.h>
+#include <kj/test.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace capnp {
+namespace _ {  // private
+namespace {
+
+struct ShmTestContext {
+  kj::AsyncIoContext io = kj::setupAsyncIo();
+  kj::CapabilityPipe pipe = io.provider->newCapabilityPipe();
+  kj::Own<SharedMemoryMessageStream> left;
+  kj::Own<SharedMemoryMessageStream> right;
+
+  explicit ShmTestContext(size_t ringSize = SharedMemoryMessageStream::DEFAULT_RING_SIZE) {
+    auto leftPromise = SharedMemoryMessageStream::create(*pipe.ends[0], ringSize);
+    auto rightPromise = SharedMemoryMessageStream::create(*pipe.ends[1], ringSize);
+    left = leftPromise.wait(io.waitScope);
+    right = rightPromise.wait(io.waitScope);
+  }
+
+  MessageStream& l() { return *left; }
+  MessageStream& r() { return *right; }
+  // The convenience overloads are hidden in SharedMemoryMessageStream itself.
+};
+
+void writeNumbered(kj::WaitScope& ws, MessageStream& stream, uint i, uint textSize = 0) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setUInt32Field(i);
+  if (textSize > 0) {
+    root.initTextField(textSize);
+  }
+  stream.writeMessage(builder).wait(ws);
+}
+
+KJ_TEST("SharedMemoryMessageStream round trip") {
+  ShmTestContext context;
+  auto& ws = context.io.waitScope;
+
+  {
+    MallocMessageBuilder builder(8, AllocationStrategy::FIXED_SIZE);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    context.l().writeMessage(builder).wait(ws);
+  }
+  {
+    auto reader = context.r().readMessage().wait(ws);
+    checkTestMessage(reader->getRoot<TestAllTypes>());
+  }
+
+  // And the other way, as a batch.
+  MallocMessageBuilder first, second;
+  first.initRoot<TestAllTypes>().setUInt32Field(1);
+  second.initRoot<TestAllTypes>().setUInt32Field(2);
+  MessageBuilder* builders[2] = { &first, &second };
+  context.r().writeMessages(kj::arrayPtr(builders, 2)).wait(ws);
+
+  KJ_EXPECT(context.l().readMessage().wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 1);
+  KJ_EXPECT(context.l().readMessage().wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 2);
+
+  KJ_EXPECT(context.left->getStats().ringMessages == 1);
+  KJ_EXPECT(context.right->getStats().ringMessages == 2);
+  KJ_EXPECT(context.left->getStats().socketMessages == 0);
+  KJ_EXPECT(context.right->getStats().socketMessages == 0);
+}
+
+KJ_TEST("SharedMemoryMessageStream wraps around the ring") {
+  ShmTestContext context(4096);
+  auto& ws = context.io.waitScope;
+
+  // Each message takes a few hundred bytes, so the ring wraps many times over.
+  for (auto i: kj::zeroTo(200u)) {
+    writeNumbered(ws, *context.left, i, 200 + i % 7 * 16);
+    auto reader = context.r().readMessage().wait(ws);
+    KJ_EXPECT(reader->getRoot<TestAllTypes>().getUInt32Field() == i);
+  }
+
+  KJ_EXPECT(context.left->getStats().ringMessages == 200);
+  KJ_EXPECT(context.left->getStats().socketMessages == 0);
+}
+
+KJ_TEST("SharedMemoryMessageStream falls back to the socket while the ring is full") {
+  ShmTestContext context(4096);
+  auto& ws = context.io.waitScope;
+
+  // Hold on to every message so that the ring can't be reused.
+  kj::Vector<kj::Own<MessageReader>> held;
+  for (auto i: kj::zeroTo(30u)) {
+    writeNumbered(ws, *context.left, i, 200);
+  }
+  for (auto i KJ_UNUSED: kj::zeroTo(30u)) {
+    held.add(context.r().readMessage().wait(ws));
+  }
+
+  for (auto i: kj::indices(held)) {
+    KJ_EXPECT(held[i]->getRoot<TestAllTypes>().getUInt32Field() == i);
+  }
+
+  auto stats = context.left->getStats();
+  KJ_EXPECT(stats.ringMessages > 0);
+  KJ_EXPECT(stats.socketMessages > 0);
+  KJ_EXPECT(stats.ringMessages + stats.socketMessages == 30);
+
+  // Once the messages are released, the ring is used again.
+  held.clear();
+  writeNumbered(ws, *context.left, 30);
+  KJ_EXPECT(context.r().readMessage().wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 30);
+  KJ_EXPECT(context.left->getStats().ringMessages == stats.ringMessages + 1);
+}
+
+KJ_TEST("SharedMemoryMessageStream sends big messages over the socket") {
+  ShmTestContext context(4096);
+  auto& ws = context.io.waitScope;
+
+  writeNumbered(ws, *context.left, 1);
+  writeNumbered(ws, *context.left, 2, 10000);
+  writeNumbered(ws, *context.left, 3);
+
+  for (auto i: kj::range(1u, 4u)) {
+    auto reader = context.r().readMessage().wait(ws);
+    KJ_EXPECT(reader->getRoot<TestAllTypes>().getUInt32Field() == i);
+  }
+  KJ_EXPECT(context.left->getStats().ringMessages == 2);
+  KJ_EXPECT(context.left->getStats().socketMessages == 1);
+}
+
+KJ_TEST("SharedMemoryMessageStream passes FDs") {
+  ShmTestContext context;
+  auto& ws = context.io.waitScope;
+
+  int pipeFds[2];
+  KJ_SYSCALL(::pipe(pipeFds));
+  kj::AutoCloseFd in(pipeFds[0]), out(pipeFds[1]);
+
+  writeNumbered(ws, *context.left, 1);
+  {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().setUInt32Field(2);
+    int fds[1] = { out.get() };
+    context.l().writeMessage(kj::arrayPtr(fds, 1), builder).wait(ws);
+  }
+  writeNumbered(ws, *context.left, 3);
+
+  kj::AutoCloseFd fdSpace[2];
+  auto first = context.r().readMessage(fdSpace).wait(ws);
+  KJ_EXPECT(first.reader->getRoot<TestAllTypes>().getUInt32Field() == 1);
+  KJ_EXPECT(first.fds.size() == 0);
+
+  auto second = context.r().readMessage(fdSpace).wait(ws);
+  KJ_EXPECT(second.reader->getRoot<TestAllTypes>().getUInt32Field() == 2);
+  KJ_ASSERT(second.fds.size() == 1);
+  KJ_SYSCALL(write(second.fds[0], "x", 1));
+  char c;
+  KJ_SYSCALL(read(in, &c, 1));
+  KJ_EXPECT(c == 'x');
+
+  auto third = context.r().readMessage(fdSpace).wait(ws);
+  KJ_EXPECT(third.reader->getRoot<TestAllTypes>().getUInt32Field() == 3);
+}
+
+KJ_TEST("SharedMemoryMessageStream wakes a waiting reader") {
+  ShmTestContext context;
+  auto& ws = context.io.waitScope;
+
+  auto readPromise = context.r().readMessage();
+  KJ_EXPECT(!readPromise.poll(ws));
+
+  writeNumbered(ws, *context.left, 5);
+  KJ_EXPECT(readPromise.wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 5);
+  KJ_EXPECT(context.left->getStats().wakeups == 1);
+
+  // A reader that isn't waiting doesn't need waking.
+  writeNumbered(ws, *context.left, 6);
+  KJ_EXPECT(context.r().readMessage().wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 6);
+  KJ_EXPECT(context.left->getStats().wakeups == 1);
+}
+
+KJ_TEST("SharedMemoryMessageStream EOF") {
+  ShmTestContext context;
+  auto& ws = context.io.waitScope;
+
+  writeNumbered(ws, *context.left, 1);
+  context.left->end().wait(ws);
+
+  KJ_EXPECT(context.r().readMessage().wait(ws)->getRoot<TestAllTypes>().getUInt32Field() == 1);
+  KJ_EXPECT(context.r().tryReadMessage().wait(ws) == nullptr);
+}
+
+KJ_TEST("SharedMemoryMessageStream rejects a peer that doesn't send a ring") {
+  auto io = kj::setupAsyncIo();
+  auto pipe = io.provider->newCapabilityPipe();
+
+  int pipeFds[2];
+  KJ_SYSCALL(::pipe(pipeFds));
+  kj::AutoCloseFd in(pipeFds[0]), out(pipeFds[1]);
+  auto sendPromise = pipe.ends[1]->sendFd(in);
+
+  KJ_EXPECT_THROW_MESSAGE("too small",
+      SharedMemoryMessageStream::create(*pipe.ends[0]).wait(io.waitScope));
+}
+
+KJ_TEST("RPC over SharedMemoryMessageStream") {
+  ShmTestContext context;
+  auto& ws = context.io.waitScope;
+
+  TwoPartyVatNetwork clientNetwork(*context.left, rpc::twoparty::Side::CLIENT);
+  TwoPartyVatNetwork serverNetwork(*context.right, rpc::twoparty::Side::SERVER);
+
+  int callCount = 0;
+  auto server = makeRpcServer(serverNetwork, kj::heap<TestInterfaceImpl>(callCount));
+  auto client = makeRpcClient(clientNetwork);
+
+  MallocMessageBuilder vatId(8);
+  vatId.initRoot<rpc::twoparty::VatId>().setSide(rpc::twoparty::Side::SERVER);
+  auto cap = client.bootstrap(vatId.getRoot<rpc::twoparty::VatId>())
+      .castAs<test::TestInterface>();
+  for (auto i: kj::zeroTo(3)) {
+    auto req = cap.fooRequest();
+    req.setI(123);
+    req.setJ(true);
+    auto resp = req.send().wait(ws);
+    KJ_EXPECT(resp.getX() == "foo");
+    KJ_EXPECT(callCount == i + 1);
+  }
+
+  KJ_EXPECT(context.left->getStats().socketMessages == 0);
+  KJ_EXPECT(context.right->getStats().socketMessages == 0);
+}
+
+}  // namespace
+}  // namespace _ (private)
+}  // namespace capnp
+
+#endif  // __linux__
@@ -0,0 +1,483 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#if __linux__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "serialize-shm.h"
+#include "serialize.h"
+#include <kj/debug.h>
+#include <deque>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace capnp {
+
+// -----------------------------------------------------------------------------
+// Ring layout
+//
+// Each ring is a memfd holding a RingHeader followed, at DATA_OFFSET, by `capacity` bytes of
+// records. `head` and `tail` are byte positions that only ever increase; a position's offset in
+// the data area is `pos & (capacity - 1)`. The writer advances `head` after filling in a record,
+// and the reader advances `tail` once every record before it has been released.
+//
+// A record is a RecordHeader followed by the message in the standard serialization format.
+// Records never straddle the end of the data area: if one wouldn't fit, the writer fills the
+// rest of the area with a WRAP_MARKER record and starts over at offset zero.
+//
+// Messages that don't go through the ring are sent on the socket as a SocketFrame header
+// followed by the message in the standard format. A header with no message is a doorbell,
+// waking a reader that set `readerWaiting` before blocking on the socket.
+
+namespace {
+
+constexpr uint64_t RING_MAGIC = 0x676e69726d687363ull;  // "cshmring"
+constexpr size_t DATA_OFFSET = 4096;
+constexpr size_t MIN_RING_SIZE = 4096;
+constexpr uint32_t WRAP_MARKER = 0xffffffffu;
+
+struct RingHeader {
+  uint64_t magic;
+  uint64_t capacity;
+
+  alignas(64) uint64_t head;
+  alignas(64) uint64_t tail;
+  // Kept on separate cache lines since each is written by a different process.
+
+  alignas(64) uint32_t readerWaiting;
+};
+
+static_assert(sizeof(RingHeader) <= DATA_OFFSET, "ring header doesn't fit before ring data");
+
+struct RecordHeader {
+  uint32_t sizeInWords;
+  uint32_t seq;
+};
+
+enum SocketFrameType: uint32_t {
+  DOORBELL_FRAME = 0,
+  MESSAGE_FRAME = 1,
+};
+
+const uint32_t DOORBELL[2] = { DOORBELL_FRAME, 0 };
+// Socket frame headers are in native byte order, since both ends are on the same host.
+
+void writeFlat(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments, word* out) {
+  // Like messageToFlatArray(), but writes into existing space, which must be
+  // computeSerializedSizeInWords(segments) words long.
+
+  auto table = reinterpret_cast<_::WireValue<uint32_t>*>(out);
+  table[0].set(segments.size() - 1);
+  for (uint i = 0; i < segments.size(); i++) {
+    table[i + 1].set(segments[i].size());
+  }
+  if (segments.size() % 2 == 0) {
+    // Set padding byte.
+    table[segments.size() + 1].set(0);
+  }
+
+  out += segments.size() / 2 + 1;
+  for (auto& segment: segments) {
+    memcpy(out, segment.begin(), segment.size() * sizeof(word));
+    out += segment.size();
+  }
+}
+
+kj::Array<word> makeMessageFrame(uint32_t seq,
+                                 kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  auto frame = kj::heapArray<word>(computeSerializedSizeInWords(segments) + 1);
+  auto header = reinterpret_cast<uint32_t*>(frame.begin());
+  header[0] = MESSAGE_FRAME;
+  header[1] = seq;
+  writeFlat(segments, frame.begin() + 1);
+  return frame;
+}
+
+}  // namespace
+
+class SharedMemoryMessageStream::Ring: public kj::Refcounted {
+  // One mapped ring, along with the state of whichever end of it this side is.
+
+public:
+  Ring(kj::AutoCloseFd fd, byte* mapping, size_t capacity)
+      : fd(kj::mv(fd)), header(*reinterpret_cast<RingHeader*>(mapping)),
+        data(mapping + DATA_OFFSET), capacity(capacity) {}
+  ~Ring() noexcept(false) {
+    KJ_SYSCALL(munmap(&header, DATA_OFFSET + capacity)) { break; }
+  }
+
+  static kj::Own<Ring> create(size_t size) {
+    size_t capacity = MIN_RING_SIZE;
+    while (capacity < size) capacity <<= 1;
+
+    int rawFd;
+    KJ_SYSCALL(rawFd = memfd_create("capnp-shm-ring", MFD_CLOEXEC));
+    kj::AutoCloseFd fd(rawFd);
+    KJ_SYSCALL(ftruncate(fd, DATA_OFFSET + capacity));
+
+    auto ring = map(kj::mv(fd), capacity);
+    ring->header.magic = RING_MAGIC;
+    ring->header.capacity = capacity;
+    ring->header.head = 0;
+    ring->header.tail = 0;
+    ring->header.readerWaiting = 0;
+    return ring;
+  }
+
+  static kj::Own<Ring> open(kj::AutoCloseFd fd) {
+    struct stat stats;
+    KJ_SYSCALL(fstat(fd, &stats));
+    KJ_REQUIRE(stats.st_size > off_t(DATA_OFFSET), "peer's shared-memory ring is too small");
+
+    uint64_t capacity = stats.st_size - DATA_OFFSET;
+    auto ring = map(kj::mv(fd), capacity);
+    KJ_REQUIRE(ring->header.magic == RING_MAGIC, "peer didn't send a shared-memory ring");
+    KJ_REQUIRE(ring->header.capacity == capacity &&
+               capacity >= MIN_RING_SIZE && (capacity & (capacity - 1)) == 0,
+               "peer's shared-memory ring has an invalid size", ring->header.capacity, capacity);
+    return ring;
+  }
+
+  kj::AutoCloseFd fd;
+  // Only needed until it has been sent to the peer.
+
+  RingHeader& header;
+  byte* data;
+  const uint64_t capacity;
+
+  uint64_t pos = 0;
+  // Writer: where the next record goes. Reader: where the next unread record is.
+
+  // Reader only: records that have been read, in order, and whether each has been released.
+  struct Outstanding {
+    uint64_t end;
+    bool released;
+  };
+  std::deque<Outstanding> outstanding;
+  uint64_t firstOutstanding = 0;
+
+  uint64_t consume(uint64_t size, bool released = false) {
+    // Marks `size` bytes at `pos` as read, returning an ID to pass to release().
+
+    pos += size;
+    outstanding.push_back({pos, released});
+    return firstOutstanding + outstanding.size() - 1;
+  }
+
+  void release(uint64_t id) {
+    outstanding[id - firstOutstanding].released = true;
+
+    uint64_t newTail = 0;
+    while (!outstanding.empty() && outstanding.front().released) {
+      newTail = outstanding.front().end;
+      outstanding.pop_front();
+      ++firstOutstanding;
+    }
+    if (newTail != 0) {
+      __atomic_store_n(&header.tail, newTail, __ATOMIC_RELEASE);
+    }
+  }
+
+private:
+  static kj::Own<Ring> map(kj::AutoCloseFd fd, uint64_t capacity) {
+    void* mapping = mmap(nullptr, DATA_OFFSET + capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0);
+    if (mapping == MAP_FAILED) {
+      KJ_FAIL_SYSCALL("mmap", errno);
+    }
+    return kj::refcounted<Ring>(kj::mv(fd), reinterpret_cast<byte*>(mapping), capacity);
+  }
+};
+
+struct SharedMemoryMessageStream::SocketMessage {
+  uint32_t seq;
+  kj::Own<MessageReader> reader;
+  kj::Array<kj::AutoCloseFd> fds;
+};
+
+kj::Promise<kj::Own<SharedMemoryMessageStream>> SharedMemoryMessageStream::create(
+    kj::AsyncCapabilityStream& stream, size_t ringSize) {
+  auto outRing = Ring::create(ringSize);
+
+  // Start receiving first, so that this works even if writes block until the peer reads.
+  auto received = stream.receiveFd();
+  auto sent = stream.sendFd(outRing->fd);
+  return sent.then([received = kj::mv(received)]() mutable {
+    return kj::mv(received);
+  }).then([&stream, outRing = kj::mv(outRing)](kj::AutoCloseFd fd) mutable {
+    outRing->fd = nullptr;
+    auto inRing = Ring::open(kj::mv(fd));
+    inRing->fd = nullptr;
+    return kj::Own<SharedMemoryMessageStream>(kj::heap<SharedMemoryMessageStream>(
+        stream, kj::mv(outRing), kj::mv(inRing)));
+  });
+}
+
+SharedMemoryMessageStream::SharedMemoryMessageStream(
+    kj::AsyncCapabilityStream& stream, kj::Own<Ring> outRing, kj::Own<Ring> inRing)
+    : stream(stream), outRing(kj::mv(outRing)), inRing(kj::mv(inRing)) {}
+
+SharedMemoryMessageStream::~SharedMemoryMessageStream() noexcept(false) {}
+
+kj::Maybe<kj::Own<MessageReader>> SharedMemoryMessageStream::tryReadFromRing(
+    ReaderOptions options) {
+  auto& ring = *inRing;
+  uint64_t mask = ring.capacity - 1;
+
+  for (;;) {
+    uint64_t head = __atomic_load_n(&ring.header.head, __ATOMIC_SEQ_CST);
+    if (head == ring.pos) return nullptr;
+    KJ_REQUIRE(head - ring.pos <= ring.capacity, "peer's shared-memory ring is corrupt") {
+      return nullptr;
+    }
+
+    uint64_t offset = ring.pos & mask;
+    RecordHeader record;
+    memcpy(&record, ring.data + offset, sizeof(record));
+
+    if (record.sizeInWords == WRAP_MARKER) {
+      ring.release(ring.consume(ring.capacity - offset, true));
+      continue;
+    }
+
+    uint64_t size = sizeof(RecordHeader) + uint64_t(record.sizeInWords) * sizeof(word);
+    KJ_REQUIRE(size <= ring.capacity - offset && size <= head - ring.pos,
+               "peer's shared-memory ring is corrupt") {
+      return nullptr;
+    }
+
+    if (record.seq != nextReadSeq) {
+      // The next message went over the socket.
+      return nullptr;
+    }
+    ++nextReadSeq;
+
+    auto releaser = kj::defer([ring = kj::addRef(ring), id = ring.consume(size)]() mutable {
+      ring->release(id);
+    });
+    auto words = kj::arrayPtr(reinterpret_cast<const word*>(ring.data + offset + sizeof(record)),
+                              record.sizeInWords);
+    return kj::Own<MessageReader>(
+        kj::heap<FlatArrayMessageReader>(words, options).attach(kj::mv(releaser)));
+  }
+}
+
+kj::Promise<kj::Maybe<MessageReaderAndFds>> SharedMemoryMessageStream::tryReadMessage(
+    kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
+    ReaderOptions options,
+    kj::ArrayPtr<word> scratchSpace) {
+  // `scratchSpace` is unused: ring messages are read in place, and socket messages may be read
+  // during an earlier call than the one that returns them.
+
+  KJ_IF_MAYBE(pending, pendingSocketMessage) {
+    if ((*pending)->seq == nextReadSeq) {
+      auto message = kj::mv(*pending);
+      pendingSocketMessage = nullptr;
+      ++nextReadSeq;
+
+      size_t fdCount = kj::min(fdSpace.size(), message->fds.size());
+      for (auto i: kj::zeroTo(fdCount)) {
+        fdSpace[i] = kj::mv(message->fds[i]);
+      }
+      return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds {
+        kj::mv(message->reader), fdSpace.slice(0, fdCount)
+      });
+    }
+  }
+
+  KJ_IF_MAYBE(reader, tryReadFromRing(options)) {
+    return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds { kj::mv(*reader), nullptr });
+  }
+
+  if (pendingSocketMessage != nullptr) {
+    // Every message sent before the pending one was published to the ring before the pending one
+    // was written to the socket, so we should have found the next message by now.
+    KJ_FAIL_REQUIRE("peer skipped a message sequence number") {
+      return kj::Maybe<MessageReaderAndFds>(nullptr);
+    }
+  }
+
+  if (receivedEof) {
+    return kj::Maybe<MessageReaderAndFds>(nullptr);
+  }
+
+  // Tell the writer we're about to block, then check once more in case it published something
+  // before it could have seen our flag.
+  __atomic_store_n(&inRing->header.readerWaiting, 1, __ATOMIC_SEQ_CST);
+  KJ_IF_MAYBE(reader, tryReadFromRing(options)) {
+    __atomic_store_n(&inRing->header.readerWaiting, 0, __ATOMIC_RELAXED);
+    return kj::Maybe<MessageReaderAndFds>(MessageReaderAndFds { kj::mv(*reader), nullptr });
+  }
+
+  auto fdBuffer = kj::heapArray<kj::AutoCloseFd>(fdSpace.size());
+  auto promise = stream.tryReadWithFds(readHeader, sizeof(readHeader), sizeof(readHeader),
+                                       fdBuffer.begin(), fdBuffer.size());
+  return promise.then([this,fdSpace,options,fdBuffer=kj::mv(fdBuffer)](
+      kj::AsyncCapabilityStream::ReadResult result) mutable
+      -> kj::Promise<kj::Maybe<MessageReaderAndFds>> {
+    if (result.byteCount == 0) {
+      receivedEof = true;
+      return tryReadMessage(fdSpace, options);
+    } else if (result.byteCount < sizeof(readHeader)) {
+      return KJ_EXCEPTION(DISCONNECTED, "Premature EOF.");
+    }
+
+    uint32_t type = readHeader[0];
+    uint32_t seq = readHeader[1];
+
+    if (type == DOORBELL_FRAME) {
+      return tryReadMessage(fdSpace, options);
+    }
+
+    KJ_REQUIRE(type == MESSAGE_FRAME, "unknown frame on shared-memory message stream", type) {
+      return kj::Maybe<MessageReaderAndFds>(nullptr);
+    }
+
+    auto fds = kj::heapArrayBuilder<kj::AutoCloseFd>(result.capCount);
+    for (auto i: kj::zeroTo(result.capCount)) {
+      fds.add(kj::mv(fdBuffer[i]));
+    }
+
+    return capnp::readMessage(stream, options)
+        .then([this,fdSpace,options,seq,fds=fds.finish()](kj::Own<MessageReader> reader) mutable {
+      pendingSocketMessage = kj::heap<SocketMessage>(
+          SocketMessage { seq, kj::mv(reader), kj::mv(fds) });
+      return tryReadMessage(fdSpace, options);
+    });
+  });
+}
+
+bool SharedMemoryMessageStream::tryWriteToRing(
+    uint32_t seq, kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  auto& ring = *outRing;
+  uint64_t mask = ring.capacity - 1;
+
+  size_t sizeInWords = computeSerializedSizeInWords(segments);
+  uint64_t size = sizeof(RecordHeader) + sizeInWords * sizeof(word);
+  if (size > ring.capacity / 2) {
+    // Big messages would crowd everything else out of the ring.
+    return false;
+  }
+
+  uint64_t offset = ring.pos & mask;
+  uint64_t padding = offset + size > ring.capacity ? ring.capacity - offset : 0;
+  uint64_t tail = __atomic_load_n(&ring.header.tail, __ATOMIC_ACQUIRE);
+  if (ring.pos + padding + size - tail > ring.capacity) {
+    // Full, or the reader is holding on to messages.
+    return false;
+  }
+
+  if (padding != 0) {
+    RecordHeader wrap = { WRAP_MARKER, 0 };
+    memcpy(ring.data + offset, &wrap, sizeof(wrap));
+    offset = 0;
+  }
+
+  RecordHeader record = { static_cast<uint32_t>(sizeInWords), seq };
+  memcpy(ring.data + offset, &record, sizeof(record));
+  writeFlat(segments, reinterpret_cast<word*>(ring.data + offset + sizeof(record)));
+
+  ring.pos += padding + size;
+  __atomic_store_n(&ring.header.head, ring.pos, __ATOMIC_SEQ_CST);
+  return true;
+}
+
+bool SharedMemoryMessageStream::peerNeedsWakeup() {
+  // Pairs with the store to `readerWaiting` in tryReadMessage(): either the reader sees our new
+  // `head`, or we see its flag.
+  if (__atomic_exchange_n(&outRing->header.readerWaiting, 0, __ATOMIC_SEQ_CST) != 0) {
+    ++stats.wakeups;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+kj::Promise<void> SharedMemoryMessageStream::writeMessage(
+    kj::ArrayPtr<const int> fds,
+    kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  uint32_t seq = nextWriteSeq++;
+
+  if (fds.size() == 0 && tryWriteToRing(seq, segments)) {
+    ++stats.ringMessages;
+    if (peerNeedsWakeup()) {
+      return stream.write(DOORBELL, sizeof(DOORBELL));
+    } else {
+      return kj::READY_NOW;
+    }
+  }
+
+  ++stats.socketMessages;
+  auto frame = makeMessageFrame(seq, segments);
+  auto bytes = frame.asBytes();
+  return stream.writeWithFds(bytes, nullptr, fds).attach(kj::mv(frame));
+}
+
+kj::Promise<void> SharedMemoryMessageStream::writeMessages(
+    kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> messages) {
+  kj::Vector<kj::Array<word>> frames;
+  bool wroteToRing = false;
+
+  for (auto& segments: messages) {
+    uint32_t seq = nextWriteSeq++;
+    if (tryWriteToRing(seq, segments)) {
+      ++stats.ringMessages;
+      wroteToRing = true;
+    } else {
+      ++stats.socketMessages;
+      frames.add(makeMessageFrame(seq, segments));
+    }
+  }
+
+  auto pieces = kj::heapArrayBuilder<kj::ArrayPtr<const byte>>(frames.size() + 1);
+  for (auto& frame: frames) {
+    pieces.add(frame.asBytes());
+  }
+  if (wroteToRing && peerNeedsWakeup()) {
+    pieces.add(kj::arrayPtr(DOORBELL, 2).asBytes());
+  }
+
+  if (pieces.size() == 0) {
+    return kj::READY_NOW;
+  }
+
+  auto piecesArray = pieces.finish();
+  auto promise = stream.write(piecesArray);
+  return promise.attach(kj::mv(frames), kj::mv(piecesArray));
+}
+
+kj::Maybe<int> SharedMemoryMessageStream::getSendBufferSize() {
+  return static_cast<int>(kj::min(outRing->capacity, uint64_t(kj::maxValue)));
+}
+
+kj::Promise<void> SharedMemoryMessageStream::end() {
+  stream.shutdownWrite();
+  return kj::READY_NOW;
+}
+
+}  // namespace capnp
+
+#endif  // __linux__
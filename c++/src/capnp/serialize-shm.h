@@ -0,0 +1,122 @@
+// Copyright (c) 2013-2014 Sandstorm Development Group, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "serialize-async.h"
+
+CAPNP_BEGIN_HEADER
+
+#if __linux__
+
+namespace capnp {
+
+class SharedMemoryMessageStream final: public MessageStream {
+  // A MessageStream between two processes on the same host which passes messages through a pair
+  // of shared-memory rings instead of through the kernel. Use it with TwoPartyVatNetwork in place
+  // of AsyncCapabilityMessageStream.
+  //
+  // Each side allocates the ring it writes to (a memfd) and sends it to the peer over a Unix
+  // socket, which afterwards is only used for:
+  // - Wakeups: a writer pokes the socket only if the reader has announced that it ran out of
+  //   messages and is about to wait, so a busy connection makes no syscalls at all.
+  // - Messages the ring can't take: those carrying FDs, those larger than half the ring, and any
+  //   sent while the ring is full. Order is preserved regardless of which path a message takes.
+  //
+  // Received messages are read in place: the MessageReader points directly into the shared
+  // memory, and its space in the ring is reclaimed when it is destroyed. Holding on to a message
+  // therefore holds up reuse of the ring (later messages overflow to the socket until it's
+  // released), so long-lived messages should be copied.
+  //
+  // The peer can modify shared memory at any time, including under a MessageReader that is in
+  // use. Messages are still bounds-checked, but only use this transport between processes that
+  // trust each other not to be malicious.
+  //
+  // Only available on Linux.
+
+public:
+  static constexpr size_t DEFAULT_RING_SIZE = 1 << 20;
+
+  static kj::Promise<kj::Own<SharedMemoryMessageStream>> create(
+      kj::AsyncCapabilityStream& stream, size_t ringSize = DEFAULT_RING_SIZE);
+  // Sets up a SharedMemoryMessageStream over `stream`, which must be a Unix socket (or other
+  // stream capable of passing FDs). The peer must call create() on its end as well. `ringSize`
+  // is the size in bytes of the ring this side writes to; it is rounded up to a power of two.
+  // `stream` must outlive the returned object.
+
+  class Ring;
+  SharedMemoryMessageStream(kj::AsyncCapabilityStream& stream,
+                            kj::Own<Ring> outRing, kj::Own<Ring> inRing);
+  // Use create(). (Ring is an implementation detail, declared public so the .c++ can use it.)
+
+  ~SharedMemoryMessageStream() noexcept(false);
+
+  // Implements MessageStream
+  kj::Promise<kj::Maybe<MessageReaderAndFds>> tryReadMessage(
+      kj::ArrayPtr<kj::AutoCloseFd> fdSpace,
+      ReaderOptions options = ReaderOptions(), kj::ArrayPtr<word> scratchSpace = nullptr) override;
+  kj::Promise<void> writeMessage(
+      kj::ArrayPtr<const int> fds,
+      kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) override;
+  kj::Promise<void> writeMessages(
+      kj::ArrayPtr<kj::ArrayPtr<const kj::ArrayPtr<const word>>> messages) override;
+  kj::Maybe<int> getSendBufferSize() override;
+  kj::Promise<void> end() override;
+
+  struct Stats {
+    uint64_t ringMessages = 0;
+    // Messages written to the ring.
+
+    uint64_t socketMessages = 0;
+    // Messages that had to be written to the socket instead.
+
+    uint64_t wakeups = 0;
+    // Wakeups sent to the peer.
+  };
+
+  Stats getStats() { return stats; }
+  // Counts for messages written through this stream, e.g. to check that the ring is big enough.
+
+private:
+  kj::AsyncCapabilityStream& stream;
+  kj::Own<Ring> outRing;
+  kj::Own<Ring> inRing;
+  uint32_t nextWriteSeq = 0;
+  uint32_t nextReadSeq = 0;
+  Stats stats;
+
+  struct SocketMessage;
+  kj::Maybe<kj::Own<SocketMessage>> pendingSocketMessage;
+  // A message read from the socket while ring messages that precede it were still unread.
+
+  bool receivedEof = false;
+  uint32_t readHeader[2];
+
+  kj::Maybe<kj::Own<MessageReader>> tryReadFromRing(ReaderOptions options);
+  bool tryWriteToRing(uint32_t seq, kj::ArrayPtr<const kj::ArrayPtr<const word>> segments);
+  bool peerNeedsWakeup();
+};
+
+}  // namespace capnp
+
+#endif  // __linux__
+
+CAPNP_END_HEADER
@@ -27,6 +27,9 @@
 #include "kj/debug.h"
 #include "kj/compat/gtest.h"
 #include "kj/miniposix.h"
+#if !CAPNP_LITE
+#include "kj/filesystem.h"
+#endif
 #include <string>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -438,6 +441,62 @@ TEST(Serialize, FileDescriptors) {
   }
 }
 
+#if !CAPNP_LITE
+TEST(Serialize, MmapFile) {
+#if _WIN32 || __ANDROID__
+  char filename[] = "capnproto-serialize-test-XXXXXX";
+#else
+  char filename[] = "/tmp/capnproto-serialize-test-XXXXXX";
+#endif
+  kj::AutoCloseFd tmpfile(mkstemp(filename));
+  ASSERT_GE(tmpfile.get(), 0);
+
+#if !_WIN32
+  EXPECT_EQ(0, unlink(filename));
+#endif
+
+  {
+    TestMessageBuilder builder(7);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writeMessageToFd(tmpfile.get(), builder);
+  }
+
+  {
+    TestMessageBuilder builder(1);
+    builder.initRoot<TestAllTypes>().setTextField("second message in file");
+    writeMessageToFd(tmpfile.get(), builder);
+  }
+
+  auto file = kj::newDiskReadableFile(kj::mv(tmpfile));
+
+  MmapMessageReader reader(*file);
+  EXPECT_EQ(7u, reader.getSegmentCount());
+  reader.prefetch(0);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+
+  MmapMessageReader reader2(*file, ReaderOptions(), reader.getEnd());
+  EXPECT_EQ(1u, reader2.getSegmentCount());
+  EXPECT_EQ("second message in file", reader2.getRoot<TestAllTypes>().getTextField());
+  EXPECT_EQ(file->stat().size, reader2.getEnd());
+}
+
+#if !KJ_NO_EXCEPTIONS
+TEST(Serialize, MmapFileTruncated) {
+  TestMessageBuilder builder(3);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  auto words = messageToFlatArray(builder);
+
+  auto file = kj::newInMemoryFile(kj::nullClock());
+  file->write(0, words.asBytes().slice(0, words.asBytes().size() - sizeof(word)));
+
+  EXPECT_ANY_THROW(MmapMessageReader reader(*file));
+
+  file->truncate(sizeof(word));
+  EXPECT_ANY_THROW(MmapMessageReader reader(*file));
+}
+#endif
+#endif  // !CAPNP_LITE
+
 TEST(Serialize, RejectTooManySegments) {
   kj::Array<word> data = kj::heapArray<word>(8192);
   WireValue<uint32_t>* table = reinterpret_cast<WireValue<uint32_t>*>(data.begin());
@@ -479,6 +538,83 @@ TEST(Serialize, RejectHugeMessage) {
 }
 #endif  // !__MINGW32__
 
+kj::Array<word> writeChecksummed(MessageBuilder& builder) {
+  kj::VectorOutputStream output;
+  writeChecksummedMessage(output, builder);
+  auto bytes = output.getArray();
+  KJ_ASSERT(bytes.size() % sizeof(word) == 0);
+  auto result = kj::heapArray<word>(bytes.size() / sizeof(word));
+  memcpy(result.begin(), bytes.begin(), bytes.size());
+  return result;
+}
+
+TEST(Serialize, ChecksummedMessage) {
+  for (uint segmentCount: {1, 7, 10}) {
+    TestMessageBuilder builder(segmentCount);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+
+    // The table is 2n+2 32-bit values, so always a whole number of words.
+    kj::Array<word> serialized = writeChecksummed(builder);
+    size_t dataWords = 0;
+    for (auto segment: builder.getSegmentsForOutput()) dataWords += segment.size();
+    EXPECT_EQ(segmentCount + 1 + dataWords, serialized.size());
+
+    TestInputStream stream(serialized.asPtr(), false);
+    ChecksummedMessageReader reader(stream);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(Serialize, ChecksummedMessageScratchSpace) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  kj::Array<word> serialized = writeChecksummed(builder);
+
+  word scratch[4096];
+  TestInputStream stream(serialized.asPtr(), false);
+  ChecksummedMessageReader reader(stream, ReaderOptions(), kj::ArrayPtr<word>(scratch, 4096));
+
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_EQ(scratch, reader.getSegment(0).begin());
+}
+
+TEST(Serialize, ChecksummedMessageDetectsCorruption) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  kj::Array<word> serialized = writeChecksummed(builder);
+  auto bytes = serialized.asBytes();
+
+  // Flipping a bit anywhere -- segment count, sizes, checksums or data -- is detected, before the
+  // message can be used.
+  for (size_t i = 0; i < bytes.size(); i += 13) {
+    bytes[i] ^= 0x10;
+    TestInputStream stream(serialized.asPtr(), false);
+    KJ_EXPECT(kj::runCatchingExceptions([&]() {
+      // Corrupt sizes may make the reader run past the end of the input, which also throws.
+      ChecksummedMessageReader reader(stream);
+    }) != nullptr, i);
+    bytes[i] ^= 0x10;
+  }
+
+  TestInputStream stream(serialized.asPtr(), false);
+  ChecksummedMessageReader reader(stream);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(Serialize, ChecksummedMessageRejectsHugeMessage) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  kj::Array<word> serialized = writeChecksummed(builder);
+
+  ReaderOptions options;
+  options.traversalLimitInWords = 2;
+  TestInputStream stream(serialized.asPtr(), false);
+  KJ_EXPECT_THROW_MESSAGE("Message is too large", ChecksummedMessageReader(stream, options));
+}
+
 // TODO(test):  Test error cases.
 
 }  // namespace
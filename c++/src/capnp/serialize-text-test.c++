@@ -142,6 +142,124 @@ KJ_TEST("TextCodec parse error") {
             exception.getDescription());
 }
 
+KJ_TEST("TextCodec literal syntax") {
+  kj::StringPtr message = R"(
+    # Leading comment.
+    ( voidField = void, boolField = true,
+      int8Field = -128, int16Field = 0x7fff, int32Field = -0x10, int64Field = 017,
+      uInt8Field = 255, uInt64Field = 18446744073709551615,
+      float32Field = -inf, float64Field = 1.5e3,
+      textField = "foo\tbar\x21\101" " baz",  # adjacent strings concatenate
+      dataField = 0x"01 23ab",
+      structField = (int32Field = (5), textField = "nested", int64List = [1, -2, 3,]),
+      enumField = garply,
+      float64List = [nan, inf, 3, -0.25],
+      textList = ["a", "b\n"],
+      dataList = ["abc", 0x"ff"],
+      structList = [(int8Field = 1), (), (enumField = bar)],
+      enumList = [foo, qux],
+    ))"_kj;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+
+  TextCodec codec;
+  codec.decode(message, root);
+
+  auto reader = root.asReader();
+  KJ_EXPECT(reader.getBoolField());
+  KJ_EXPECT(reader.getInt8Field() == -128);
+  KJ_EXPECT(reader.getInt16Field() == 0x7fff);
+  KJ_EXPECT(reader.getInt32Field() == -16);
+  KJ_EXPECT(reader.getInt64Field() == 15);
+  KJ_EXPECT(reader.getUInt8Field() == 255);
+  KJ_EXPECT(reader.getUInt64Field() == 18446744073709551615ull);
+  KJ_EXPECT(reader.getFloat32Field() == -kj::inf());
+  KJ_EXPECT(reader.getFloat64Field() == 1500);
+  KJ_EXPECT(reader.getTextField() == "foo\tbar!A baz");
+  KJ_EXPECT(reader.getDataField() == data("\x01\x23\xab"));
+  KJ_EXPECT(reader.getStructField().getInt32Field() == 5);
+  KJ_EXPECT(reader.getStructField().getTextField() == "nested");
+  KJ_EXPECT(reader.getStructField().getInt64List().size() == 3);
+  KJ_EXPECT(reader.getStructField().getInt64List()[1] == -2);
+  KJ_EXPECT(reader.getEnumField() == TestEnum::GARPLY);
+
+  auto floats = reader.getFloat64List();
+  KJ_ASSERT(floats.size() == 4);
+  KJ_EXPECT(kj::isNaN(floats[0]));
+  KJ_EXPECT(floats[1] == kj::inf());
+  KJ_EXPECT(floats[2] == 3);
+  KJ_EXPECT(floats[3] == -0.25);
+
+  KJ_ASSERT(reader.getTextList().size() == 2);
+  KJ_EXPECT(reader.getTextList()[1] == "b\n");
+  KJ_ASSERT(reader.getDataList().size() == 2);
+  KJ_EXPECT(reader.getDataList()[0] == data("abc"));
+  KJ_EXPECT(reader.getDataList()[1] == data("\xff"));
+
+  auto structs = reader.getStructList();
+  KJ_ASSERT(structs.size() == 3);
+  KJ_EXPECT(structs[0].getInt8Field() == 1);
+  KJ_EXPECT(structs[1].getInt8Field() == 0);
+  KJ_EXPECT(structs[2].getEnumField() == TestEnum::BAR);
+
+  KJ_ASSERT(reader.getEnumList().size() == 2);
+  KJ_EXPECT(reader.getEnumList()[1] == TestEnum::QUX);
+}
+
+KJ_TEST("TextCodec groups and standalone values") {
+  TextCodec codec;
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<capnproto_test::capnp::test::TestGroups>();
+    codec.decode("(groups = (bar = (corge = 3, grault = \"x\")))", root);
+    auto groups = root.asReader().getGroups();
+    KJ_ASSERT(groups.isBar());
+    KJ_EXPECT(groups.getBar().getCorge() == 3);
+    KJ_EXPECT(groups.getBar().getGrault() == "x");
+  }
+
+  {
+    MallocMessageBuilder builder;
+    auto orphan = codec.decode<List<List<int32_t>>>("[[1, 2], [], [3]]", builder.getOrphanage());
+    auto lists = orphan.getReader();
+    KJ_ASSERT(lists.size() == 3);
+    KJ_EXPECT(lists[0].size() == 2);
+    KJ_EXPECT(lists[0][1] == 2);
+    KJ_EXPECT(lists[1].size() == 0);
+    KJ_EXPECT(lists[2][0] == 3);
+  }
+}
+
+KJ_TEST("TextCodec decode errors") {
+  TextCodec codec;
+
+  auto expectError = [&](kj::StringPtr message, kj::StringPtr expected) {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<TestAllTypes>();
+    KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() { codec.decode(message, root); })) {
+      KJ_EXPECT(e->getDescription().endsWith(expected), e->getDescription(), expected);
+    } else {
+      KJ_FAIL_EXPECT("expected error", message);
+    }
+  };
+
+  expectError("(noSuchField = 1)", "1-12: Struct has no field named 'noSuchField'.");
+  expectError("(int32Field = \"foo\")", "14-19: Type mismatch; expected Int32.");
+  expectError("(uInt8Field = 256)", "14-17: Integer value out of range.");
+  expectError("(uInt8Field = -1)", "14-16: Integer value out of range.");
+  expectError("(int32Field = 1, 2)", "17-18: Missing field name.");
+  expectError("(int32List = [1,, 2])", "13-20: Parse error: Empty list item.");
+  expectError("(enumField = notAnEnumerant)", "External constants not allowed.");
+  expectError("(int32Field = foo.bar)", "External constants not allowed.");
+  expectError("(textField = embed \"file\")", "External embeds not allowed.");
+  expectError("(int32Field = 1", "Premature end of input.");
+  expectError("(int32Field = 1) 2", "Extra tokens in input.");
+  expectError("[1]", "Input does not contain a struct.");
+  expectError("", "Failed to read input.");
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace capnp
@@ -22,91 +22,754 @@
 #include "serialize-text.h"
 
 #include "kj/debug.h"
+#include <string.h>
 
 #include "pretty-print.h"
-#include "compiler/lexer.capnp.h"
-#include "compiler/lexer.h"
-#include "compiler/node-translator.h"
-#include "compiler/parser.h"
 
 namespace capnp {
 
 namespace {
 
-class ThrowingErrorReporter final: public capnp::compiler::ErrorReporter {
-  // Throws all errors as assertion failures.
-public:
-  ThrowingErrorReporter(kj::StringPtr input): input(input) {}
-
-  void addError(uint32_t startByte, uint32_t endByte, kj::StringPtr message) override {
-    // Note: Line and column numbers are usually 1-based.
-    uint line = 1;
-    uint32_t lineStart = 0;
-    for (auto i: kj::zeroTo(startByte)) {
-      if (input[i] == '\n') {
-        ++line;
-        lineStart = i;  // Omit +1 so that column is 1-based.
-      }
+kj::Exception makeInputError(kj::StringPtr input, uint32_t startByte, uint32_t endByte,
+                             kj::StringPtr message) {
+  // Note: Line and column numbers are usually 1-based.
+  uint line = 1;
+  uint32_t lineStart = 0;
+  for (auto i: kj::zeroTo(startByte)) {
+    if (input[i] == '\n') {
+      ++line;
+      lineStart = i;  // Omit +1 so that column is 1-based.
     }
+  }
+
+  return kj::Exception(
+    kj::Exception::Type::FAILED, "(capnp text input)", line,
+    kj::str(startByte - lineStart, "-", endByte - lineStart, ": ", message)
+  );
+}
+
+kj::String makeNodeName(Schema schema) {
+  schema::Node::Reader proto = schema.getProto();
+  return kj::str(proto.getDisplayName().slice(proto.getDisplayNamePrefixLength()));
+}
+
+kj::String makeTypeName(Type type) {
+  switch (type.which()) {
+    case schema::Type::VOID: return kj::str("Void");
+    case schema::Type::BOOL: return kj::str("Bool");
+    case schema::Type::INT8: return kj::str("Int8");
+    case schema::Type::INT16: return kj::str("Int16");
+    case schema::Type::INT32: return kj::str("Int32");
+    case schema::Type::INT64: return kj::str("Int64");
+    case schema::Type::UINT8: return kj::str("UInt8");
+    case schema::Type::UINT16: return kj::str("UInt16");
+    case schema::Type::UINT32: return kj::str("UInt32");
+    case schema::Type::UINT64: return kj::str("UInt64");
+    case schema::Type::FLOAT32: return kj::str("Float32");
+    case schema::Type::FLOAT64: return kj::str("Float64");
+    case schema::Type::TEXT: return kj::str("Text");
+    case schema::Type::DATA: return kj::str("Data");
+    case schema::Type::LIST:
+      return kj::str("List(", makeTypeName(type.asList().getElementType()), ")");
+    case schema::Type::ENUM: return makeNodeName(type.asEnum());
+    case schema::Type::STRUCT: return makeNodeName(type.asStruct());
+    case schema::Type::INTERFACE: return makeNodeName(type.asInterface());
+    case schema::Type::ANY_POINTER: return kj::str("AnyPointer");
+  }
+  KJ_UNREACHABLE;
+}
 
-    kj::throwRecoverableException(kj::Exception(
-      kj::Exception::Type::FAILED, "(capnp text input)", line,
-      kj::str(startByte - lineStart, "-", endByte - lineStart, ": ", message)
-    ));
+inline bool isWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+inline bool isDigit(char c) { return '0' <= c && c <= '9'; }
+inline bool isOctDigit(char c) { return '0' <= c && c <= '7'; }
+inline bool isHexDigit(char c) {
+  return isDigit(c) || ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F');
+}
+inline bool isNameStart(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+}
+inline bool isNameChar(char c) { return isNameStart(c) || isDigit(c); }
+inline bool isOperatorChar(char c) {
+  return c != '\0' && strchr("!$%&*+-./:<=>?@^|~", c) != nullptr;
+}
+inline uint parseDigit(char c) {
+  if (c < 'A') return c - '0';
+  if (c < 'a') return c - 'A' + 10;
+  return c - 'a' + 10;
+}
+
+class TextParser {
+  // Reads the text format in a single pass, writing each value straight into its place in the
+  // output message rather than building a token stream and expression tree first. Accepts the
+  // same syntax as the schema language's value expressions, except for references to constants
+  // and embedded files, which TextCodec doesn't allow anyway.
+  //
+  // Lists are sized by scanning ahead for their items before any element is parsed, so apart
+  // from the output itself memory use is bounded by the largest string or identifier.
+
+public:
+  explicit TextParser(kj::StringPtr input)
+      : input(input), pos(input.begin()), end(input.end()) {}
+
+  void parseRoot(DynamicStruct::Builder output) {
+    start();
+    KJ_REQUIRE(*pos == '(' && classifyParens(pos) == TUPLE, "Input does not contain a struct.") {
+      return;
+    }
+    ++pos;
+    fillStruct(output);
+    finish();
   }
 
-  bool hadErrors() override { return false; }
+  Orphan<DynamicValue> parseRoot(Type type, Orphanage orphanage) {
+    start();
+    Orphan<DynamicValue> result;
+    parseValue(type, RootTarget { orphanage, result });
+    finish();
+    return result;
+  }
 
 private:
   kj::StringPtr input;
-};
+  const char* pos;
+  const char* end;
+  // `*end` is always the input's NUL terminator, so looking one character ahead never needs a
+  // bounds check.
 
-class ExternalResolver final: public capnp::compiler::ValueTranslator::Resolver {
-  // Throws all external resolution requests as assertion failures.
-public:
-  kj::Maybe<capnp::DynamicValue::Reader>
-  resolveConstant(capnp::compiler::Expression::Reader name) override {
+  kj::Vector<char> scratch;
+  // Holds the decoded form of the current string literal or identifier.
+
+  // -------------------------------------------------------------------
+  // Output targets. parseValue() writes through one of these, so fields, list elements, and
+  // the root value can share one code path.
+
+  struct FieldTarget {
+    DynamicStruct::Builder builder;
+    StructSchema::Field field;
+
+    DynamicStruct::Builder initStruct(StructSchema) {
+      return builder.init(field).as<DynamicStruct>();
+    }
+    DynamicList::Builder initList(ListSchema, uint size) {
+      return builder.init(field, size).as<DynamicList>();
+    }
+    void set(const DynamicValue::Reader& value) { builder.set(field, value); }
+  };
+
+  struct ElementTarget {
+    DynamicList::Builder list;
+    uint index;
+
+    DynamicStruct::Builder initStruct(StructSchema) {
+      return list[index].as<DynamicStruct>();
+    }
+    DynamicList::Builder initList(ListSchema, uint size) {
+      return list.init(index, size).as<DynamicList>();
+    }
+    void set(const DynamicValue::Reader& value) { list.set(index, value); }
+  };
+
+  struct RootTarget {
+    Orphanage orphanage;
+    Orphan<DynamicValue>& result;
+
+    DynamicStruct::Builder initStruct(StructSchema schema) {
+      auto orphan = orphanage.newOrphan(schema);
+      auto builder = orphan.get();
+      result = kj::mv(orphan);
+      return builder;
+    }
+    DynamicList::Builder initList(ListSchema schema, uint size) {
+      auto orphan = orphanage.newOrphan(schema, size);
+      auto builder = orphan.get();
+      result = kj::mv(orphan);
+      return builder;
+    }
+    void set(const DynamicValue::Reader& value) { result = orphanage.newOrphanCopy(value); }
+  };
+
+  // -------------------------------------------------------------------
+  // Errors
+
+  KJ_NORETURN(void fail(const char* startPos, const char* endPos, kj::StringPtr message)) {
+    kj::throwFatalException(makeInputError(input, startPos - input.begin(),
+                                           endPos - input.begin(), message));
+  }
+
+  KJ_NORETURN(void parseError()) {
+    KJ_REQUIRE(pos < end, "Premature end of input.");
+    fail(pos, findItemEnd(pos), "Parse error.");
+  }
+
+  KJ_NORETURN(void typeMismatch(const char* startPos, const char* endPos, Type type)) {
+    fail(startPos, endPos, kj::str("Type mismatch; expected ", makeTypeName(type), "."));
+  }
+
+  KJ_NORETURN(void constantNotAllowed()) {
     KJ_FAIL_REQUIRE("External constants not allowed.");
   }
 
-  kj::Maybe<kj::Array<const capnp::byte>>
-  readEmbed(capnp::compiler::LocatedText::Reader filename) override {
-    KJ_FAIL_REQUIRE("External embeds not allowed.");
+  // -------------------------------------------------------------------
+  // Scanning
+
+  const char* skipSpace(const char* p) {
+    // Skips whitespace, comments, and byte order marks.
+    for (;;) {
+      if (isWhitespace(*p)) {
+        ++p;
+      } else if (*p == '#') {
+        while (p < end && *p != '\n') ++p;
+      } else if (p[0] == '\xef' && p[1] == '\xbb' && p[2] == '\xbf') {
+        p += 3;
+      } else {
+        return p;
+      }
+    }
   }
-};
+  void skipSpace() { pos = skipSpace(pos); }
+
+  const char* scanItem(const char* p, bool& hasContent) {
+    // Scans forward from `p` to the comma or closing bracket ending the current list item,
+    // skipping nested brackets, string literals, and comments. Returns `end` if the input runs
+    // out first. `hasContent` is set if the item is not blank.
 
-template <typename Function>
-void lexAndParseExpression(kj::StringPtr input, Function f) {
-  // Parses a single expression from the input and calls `f(expression)`.
+    uint depth = 0;
+    hasContent = false;
+    for (; p < end; ++p) {
+      switch (*p) {
+        case '(': case '[':
+          ++depth;
+          hasContent = true;
+          break;
+        case ')': case ']':
+          if (depth == 0) return p;
+          --depth;
+          break;
+        case ',':
+          if (depth == 0) return p;
+          break;
+        case '"':
+          hasContent = true;
+          for (++p; p < end && *p != '"' && *p != '\n'; ++p) {
+            if (*p == '\\' && p + 1 < end) ++p;
+          }
+          if (p == end) return end;
+          break;
+        case '#':
+          while (p < end && *p != '\n') ++p;
+          if (p == end) return end;
+          break;
+        default:
+          if (!isWhitespace(*p)) hasContent = true;
+          break;
+      }
+    }
+    return end;
+  }
 
-  ThrowingErrorReporter errorReporter(input);
+  const char* findItemEnd(const char* p) {
+    // Finds the end of the list item starting at `p`, for reporting the range of an error.
+    bool hasContent;
+    const char* itemEnd = scanItem(p, hasContent);
+    while (itemEnd > p && isWhitespace(itemEnd[-1])) --itemEnd;
+    return itemEnd;
+  }
 
-  capnp::MallocMessageBuilder tokenArena;
-  auto lexedTokens = tokenArena.initRoot<capnp::compiler::LexedTokens>();
-  capnp::compiler::lex(input, lexedTokens, errorReporter);
+  const char* findListEnd(const char* open) {
+    // Given the opening bracket of a list or tuple, finds the position just past its closing
+    // bracket.
+    const char* p = open + 1;
+    for (;;) {
+      bool hasContent;
+      p = scanItem(p, hasContent);
+      KJ_REQUIRE(p < end, "Premature end of input.");
+      if (*p++ != ',') return p;
+    }
+  }
 
-  capnp::compiler::CapnpParser parser(tokenArena.getOrphanage(), errorReporter);
-  auto tokens = lexedTokens.asReader().getTokens();
-  capnp::compiler::CapnpParser::ParserInput parserInput(tokens.begin(), tokens.end());
+  uint countItems() {
+    // Counts the items of the list whose opening bracket was just consumed.
+    uint count = 0;
+    const char* p = pos;
+    for (;;) {
+      bool hasContent;
+      p = scanItem(p, hasContent);
+      KJ_REQUIRE(p < end, "Premature end of input.");
+      count += hasContent;
+      if (*p++ != ',') return count;
+    }
+  }
 
-  if (parserInput.getPosition() != tokens.end()) {
-    KJ_IF_MAYBE(expression, parser.getParsers().expression(parserInput)) {
-      // The input is expected to contain a *single* message.
-      KJ_REQUIRE(parserInput.getPosition() == tokens.end(), "Extra tokens in input.");
+  bool startsAssignment(const char* p) {
+    // Does `p` begin with `name =`?
+    if (!isNameStart(*p)) return false;
+    do { ++p; } while (isNameChar(*p));
+    p = skipSpace(p);
+    return p[0] == '=' && !isOperatorChar(p[1]);
+  }
 
-      f(expression->getReader());
-    } else {
-      auto best = parserInput.getBest();
-      if (best == tokens.end()) {
-        KJ_FAIL_REQUIRE("Premature end of input.");
+  enum ParenKind {
+    TUPLE,
+    // A (possibly empty) list of field assignments.
+    SINGLE_VALUE
+    // A single value in parentheses, which is the same as the bare value.
+  };
+
+  ParenKind classifyParens(const char* open) {
+    const char* p = skipSpace(open + 1);
+    if (*p == ')' || startsAssignment(p)) return TUPLE;
+
+    bool hasContent;
+    p = scanItem(p, hasContent);
+    if (!hasContent) {
+      // An empty item; let parseItems() report it.
+      return TUPLE;
+    } else if (p < end && *p == ',') {
+      // A trailing comma doesn't make it a tuple.
+      p = skipSpace(p + 1);
+      if (*p != ')') return TUPLE;
+    }
+    return SINGLE_VALUE;
+  }
+
+  template <typename Func>
+  void parseItems(const char* open, char close, Func&& parseItem) {
+    // Parses the comma-separated items of a list or tuple whose opening bracket, at `open`, was
+    // just consumed. A trailing comma is allowed.
+
+    skipSpace();
+    if (*pos == close) {
+      ++pos;
+      return;
+    }
+
+    for (;;) {
+      if (*pos == ',' || *pos == close) {
+        fail(open, findListEnd(open), "Parse error: Empty list item.");
+      }
+      parseItem();
+      skipSpace();
+      if (*pos == ',') {
+        ++pos;
+        skipSpace();
+        if (*pos == close) {
+          ++pos;
+          return;
+        }
+      } else if (*pos == close) {
+        ++pos;
+        return;
       } else {
-        errorReporter.addErrorOn(*best, "Parse error");
+        parseError();
       }
     }
-  } else {
-    KJ_FAIL_REQUIRE("Failed to read input.");
   }
-}
+
+  kj::StringPtr consumeIdentifier() {
+    const char* start = pos;
+    do { ++pos; } while (isNameChar(*pos));
+    scratch.clear();
+    scratch.addAll(start, pos);
+    scratch.add('\0');
+    return kj::StringPtr(scratch.begin(), scratch.size() - 1);
+  }
+
+  // -------------------------------------------------------------------
+  // Values
+
+  void start() {
+    skipSpace();
+    KJ_REQUIRE(pos < end, "Failed to read input.");
+  }
+
+  void finish() {
+    skipSpace();
+    KJ_REQUIRE(pos == end, "Extra tokens in input.");
+  }
+
+  void fillStruct(DynamicStruct::Builder builder) {
+    // Parses the field assignments of a tuple whose opening parenthesis was just consumed.
+
+    StructSchema schema = builder.getSchema();
+    parseItems(pos - 1, ')', [&]() {
+      if (!startsAssignment(pos)) {
+        fail(pos, findItemEnd(pos), "Missing field name.");
+      }
+
+      const char* nameStart = pos;
+      kj::StringPtr name = consumeIdentifier();
+      const char* nameEnd = pos;
+      KJ_IF_MAYBE(field, schema.findFieldByName(name)) {
+        skipSpace();
+        ++pos;  // '='
+        skipSpace();
+
+        auto proto = field->getProto();
+        switch (proto.which()) {
+          case schema::Field::SLOT:
+            parseValue(field->getType(), FieldTarget { builder, *field });
+            break;
+
+          case schema::Field::GROUP:
+            if (*pos == '(' && classifyParens(pos) == TUPLE) {
+              ++pos;
+              fillStruct(builder.init(*field).as<DynamicStruct>());
+            } else {
+              fail(pos, findItemEnd(pos), "Type mismatch; expected group.");
+            }
+            break;
+        }
+      } else {
+        fail(nameStart, nameEnd, kj::str("Struct has no field named '", name, "'."));
+      }
+    });
+  }
+
+  template <typename Target>
+  void parseValue(Type type, Target&& target) {
+    if (type.isAnyPointer()) {
+      if (type.getBrandParameter() != nullptr || type.getImplicitParameter() != nullptr) {
+        fail(pos, findItemEnd(pos),
+            "Cannot interpret value because the type is a generic type parameter which is not "
+            "yet bound. We don't know what type to expect here.");
+      }
+    }
+
+    const char* start = pos;
+    switch (*pos) {
+      case '(':
+        if (classifyParens(pos) == TUPLE) {
+          if (!type.isStruct()) typeMismatch(start, findListEnd(start), type);
+          ++pos;
+          fillStruct(target.initStruct(type.asStruct()));
+        } else {
+          ++pos;
+          skipSpace();
+          parseValue(type, kj::fwd<Target>(target));
+          skipSpace();
+          if (*pos == ',') {
+            ++pos;
+            skipSpace();
+          }
+          if (*pos != ')') parseError();
+          ++pos;
+        }
+        break;
+
+      case '[': {
+        if (!type.isList()) typeMismatch(start, findListEnd(start), type);
+        ++pos;
+        auto listSchema = type.asList();
+        Type elementType = listSchema.getElementType();
+        uint count = countItems();
+        auto list = target.initList(listSchema, count);
+        uint i = 0;
+        parseItems(start, ']', [&]() {
+          if (i >= count) parseError();
+          parseValue(elementType, ElementTarget { list, i++ });
+        });
+        break;
+      }
+
+      case '"': {
+        consumeStrings();
+        if (type.isText()) {
+          target.set(Text::Reader(scratch.begin(), scratch.size() - 1));
+        } else if (type.isData()) {
+          target.set(Data::Reader(reinterpret_cast<const byte*>(scratch.begin()),
+                                  scratch.size() - 1));
+        } else {
+          typeMismatch(start, pos, type);
+        }
+        break;
+      }
+
+      case '-': {
+        if (isOperatorChar(pos[1])) parseError();
+        ++pos;
+        skipSpace();
+        if (isDigit(*pos)) {
+          auto value = consumeNumber();
+          if (value.getType() == DynamicValue::FLOAT) {
+            setPrimitive(type, -value.as<double>(), start, target);
+          } else {
+            uint64_t nValue = value.as<uint64_t>();
+            if (nValue > ((uint64_t)kj::maxValue >> 1) + 1) {
+              fail(start, pos, "Integer is too big to be negative.");
+            }
+            setPrimitive(type, kj::implicitCast<int64_t>(-nValue), start, target);
+          }
+        } else if (isNameStart(*pos) && consumeIdentifier() == "inf") {
+          setPrimitive(type, -kj::inf(), start, target);
+        } else {
+          parseError();
+        }
+        break;
+      }
+
+      case '.':
+        constantNotAllowed();
+
+      default:
+        if (pos[0] == '0' && pos[1] == 'x' && pos[2] == '"') {
+          consumeBinary();
+          if (!type.isData()) typeMismatch(start, pos, type);
+          target.set(Data::Reader(reinterpret_cast<const byte*>(scratch.begin()),
+                                  scratch.size()));
+        } else if (isDigit(*pos)) {
+          setPrimitive(type, consumeNumber(), start, target);
+        } else if (isNameStart(*pos)) {
+          kj::StringPtr name = consumeIdentifier();
+          if (name == "embed" && *skipSpace(pos) == '"') {
+            KJ_FAIL_REQUIRE("External embeds not allowed.");
+          }
+
+          if (type.isEnum()) {
+            KJ_IF_MAYBE(enumerant, type.asEnum().findEnumerantByName(name)) {
+              setPrimitive(type, DynamicEnum(*enumerant), start, target);
+            } else {
+              constantNotAllowed();
+            }
+          } else if (name == "void") {
+            setPrimitive(type, VOID, start, target);
+          } else if (name == "true") {
+            setPrimitive(type, true, start, target);
+          } else if (name == "false") {
+            setPrimitive(type, false, start, target);
+          } else if (name == "nan") {
+            setPrimitive(type, kj::nan(), start, target);
+          } else if (name == "inf") {
+            setPrimitive(type, kj::inf(), start, target);
+          } else {
+            constantNotAllowed();
+          }
+        } else {
+          parseError();
+        }
+        break;
+    }
+
+    // A member access or application would make this a reference to a constant.
+    const char* next = skipSpace(pos);
+    if (*next == '(' || (next[0] == '.' && isNameStart(next[1]))) {
+      constantNotAllowed();
+    }
+  }
+
+  template <typename Target>
+  void setPrimitive(Type type, DynamicValue::Reader value, const char* start, Target& target) {
+    // Checks that a literal can be assigned to `type` and then assigns it.
+
+    switch (value.getType()) {
+      case DynamicValue::VOID:
+        if (type.isVoid()) return target.set(value);
+        break;
+
+      case DynamicValue::BOOL:
+        if (type.isBool()) return target.set(value);
+        break;
+
+      case DynamicValue::INT: {
+        int64_t intValue = value.as<int64_t>();
+        if (intValue < 0) {
+          int64_t minValue = 1;
+          switch (type.which()) {
+            case schema::Type::INT8: minValue = (int8_t)kj::minValue; break;
+            case schema::Type::INT16: minValue = (int16_t)kj::minValue; break;
+            case schema::Type::INT32: minValue = (int32_t)kj::minValue; break;
+            case schema::Type::INT64: minValue = (int64_t)kj::minValue; break;
+            case schema::Type::UINT8: minValue = (uint8_t)kj::minValue; break;
+            case schema::Type::UINT16: minValue = (uint16_t)kj::minValue; break;
+            case schema::Type::UINT32: minValue = (uint32_t)kj::minValue; break;
+            case schema::Type::UINT64: minValue = (uint64_t)kj::minValue; break;
+
+            case schema::Type::FLOAT32:
+            case schema::Type::FLOAT64:
+              // Any integer is acceptable.
+              minValue = (int64_t)kj::minValue;
+              break;
+
+            default: break;
+          }
+          if (minValue == 1) break;
+
+          if (intValue < minValue) {
+            fail(start, pos, "Integer value out of range.");
+          }
+          return target.set(value);
+        }
+      } KJ_FALLTHROUGH;  // value is positive, so we can just go on to the uint case below.
+
+      case DynamicValue::UINT: {
+        uint64_t maxValue = 0;
+        switch (type.which()) {
+          case schema::Type::INT8: maxValue = (int8_t)kj::maxValue; break;
+          case schema::Type::INT16: maxValue = (int16_t)kj::maxValue; break;
+          case schema::Type::INT32: maxValue = (int32_t)kj::maxValue; break;
+          case schema::Type::INT64: maxValue = (int64_t)kj::maxValue; break;
+          case schema::Type::UINT8: maxValue = (uint8_t)kj::maxValue; break;
+          case schema::Type::UINT16: maxValue = (uint16_t)kj::maxValue; break;
+          case schema::Type::UINT32: maxValue = (uint32_t)kj::maxValue; break;
+          case schema::Type::UINT64: maxValue = (uint64_t)kj::maxValue; break;
+
+          case schema::Type::FLOAT32:
+          case schema::Type::FLOAT64:
+            // Any integer is acceptable.
+            maxValue = (uint64_t)kj::maxValue;
+            break;
+
+          default: break;
+        }
+        if (maxValue == 0) break;
+
+        if (value.as<uint64_t>() > maxValue) {
+          fail(start, pos, "Integer value out of range.");
+        }
+        return target.set(value);
+      }
+
+      case DynamicValue::FLOAT:
+        if (type.isFloat32() || type.isFloat64()) return target.set(value);
+        break;
+
+      case DynamicValue::ENUM:
+        if (type.isEnum()) return target.set(value);
+        break;
+
+      default:
+        KJ_UNREACHABLE;
+    }
+
+    typeMismatch(start, pos, type);
+  }
+
+  DynamicValue::Reader consumeNumber() {
+    // Consumes an unsigned integer or float literal, following the same rules as the schema
+    // lexer: an integer may not run directly into a letter, underscore, or dot, and is tried
+    // before a float.
+
+    const char* start = pos;
+    auto endsToken = [](char c) { return !isNameChar(c) && c != '.'; };
+
+    if (pos[0] == '0' && pos[1] == 'x' && isHexDigit(pos[2])) {
+      uint64_t value = 0;
+      for (pos += 2; isHexDigit(*pos); ++pos) value = value * 16 + parseDigit(*pos);
+      if (!endsToken(*pos)) parseError();
+      return value;
+    }
+
+    {
+      uint64_t value = 0;
+      const char* p = pos;
+      if (*p == '0') {
+        for (++p; isOctDigit(*p); ++p) value = value * 8 + parseDigit(*p);
+      } else {
+        for (; isDigit(*p); ++p) value = value * 10 + parseDigit(*p);
+      }
+      if (endsToken(*p)) {
+        pos = p;
+        return value;
+      }
+    }
+
+    while (isDigit(*pos)) ++pos;
+    if (*pos == '.') {
+      do { ++pos; } while (isDigit(*pos));
+    }
+    if (*pos == 'e' || *pos == 'E') {
+      ++pos;
+      if (*pos == '+' || *pos == '-') ++pos;
+      while (isDigit(*pos)) ++pos;
+    }
+    if (!endsToken(*pos)) {
+      pos = start;
+      parseError();
+    }
+
+    scratch.clear();
+    scratch.addAll(start, pos);
+    scratch.add('\0');
+    return kj::StringPtr(scratch.begin(), scratch.size() - 1).parseAs<double>();
+  }
+
+  void consumeStrings() {
+    // Consumes one or more adjacent string literals, leaving their concatenated contents in
+    // `scratch`, NUL-terminated.
+
+    scratch.clear();
+    do {
+      ++pos;  // '"'
+      for (;;) {
+        const char* run = pos;
+        while (pos < end && *pos != '"' && *pos != '\\' && *pos != '\n') ++pos;
+        scratch.addAll(run, pos);
+
+        if (pos == end || *pos == '\n') {
+          parseError();
+        } else if (*pos == '"') {
+          ++pos;
+          break;
+        } else {
+          scratch.add(consumeEscape());
+        }
+      }
+      skipSpace();
+    } while (*pos == '"');
+    scratch.add('\0');
+  }
+
+  char consumeEscape() {
+    const char* start = pos++;  // '\\'
+    char c = *pos++;
+    switch (c) {
+      case 'a': return '\a';
+      case 'b': return '\b';
+      case 'f': return '\f';
+      case 'n': return '\n';
+      case 'r': return '\r';
+      case 't': return '\t';
+      case 'v': return '\v';
+      case '\'': case '\"': case '\\': case '?': return c;
+      case 'x':
+        if (isHexDigit(pos[0]) && isHexDigit(pos[1])) {
+          char result = (parseDigit(pos[0]) << 4) | parseDigit(pos[1]);
+          pos += 2;
+          return result;
+        }
+        break;
+      default:
+        if (isOctDigit(c)) {
+          char result = c - '0';
+          for (uint i = 0; i < 2 && isOctDigit(*pos); i++) {
+            result = (result << 3) | (*pos++ - '0');
+          }
+          return result;
+        }
+        break;
+    }
+    pos = start;
+    parseError();
+  }
+
+  void consumeBinary() {
+    // Consumes a hex binary literal like `0x"0123 abcd"`, leaving its bytes in `scratch`.
+
+    scratch.clear();
+    pos += 3;  // '0x"'
+    for (;;) {
+      while (isWhitespace(*pos)) ++pos;
+      if (*pos == '"' && scratch.size() > 0) {
+        ++pos;
+        return;
+      }
+      if (!isHexDigit(pos[0]) || !isHexDigit(pos[1])) parseError();
+      scratch.add((parseDigit(pos[0]) << 4) | parseDigit(pos[1]));
+      pos += 2;
+    }
+  }
+};
 
 }  // namespace
 
@@ -130,34 +793,11 @@ kj::String TextCodec::encode(DynamicValue::Reader value) const {
 }
 
 void TextCodec::decode(kj::StringPtr input, DynamicStruct::Builder output) const {
-  lexAndParseExpression(input, [&](compiler::Expression::Reader expression) {
-    KJ_REQUIRE(expression.isTuple(), "Input does not contain a struct.") { return; }
-
-    ThrowingErrorReporter errorReporter(input);
-    ExternalResolver nullResolver;
-
-    Orphanage orphanage = Orphanage::getForMessageContaining(output);
-    compiler::ValueTranslator translator(nullResolver, errorReporter, orphanage);
-    translator.fillStructValue(output, expression.getTuple());
-  });
+  TextParser(input).parseRoot(output);
 }
 
 Orphan<DynamicValue> TextCodec::decode(kj::StringPtr input, Type type, Orphanage orphanage) const {
-  Orphan<DynamicValue> output;
-
-  lexAndParseExpression(input, [&](compiler::Expression::Reader expression) {
-    ThrowingErrorReporter errorReporter(input);
-    ExternalResolver nullResolver;
-
-    compiler::ValueTranslator translator(nullResolver, errorReporter, orphanage);
-    KJ_IF_MAYBE(value, translator.compileValue(expression, type)) {
-      output = *kj::mv(value);
-    } else {
-      // An error should have already been given to the errorReporter.
-    }
-  });
-
-  return output;
+  return TextParser(input).parseRoot(type, orphanage);
 }
 
 }  // namespace capnp
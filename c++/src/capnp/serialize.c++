@@ -22,10 +22,17 @@
 #include "serialize.h"
 #include "layout.h"
 #include "kj/debug.h"
+#include "kj/hash.h"
 #include <exception>
+#if !CAPNP_LITE
+#include "kj/filesystem.h"
+#endif
 #ifdef _WIN32
 #include <io.h>
 #include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 namespace capnp {
@@ -324,4 +331,235 @@ void readMessageCopyFromFd(int fd, MessageBuilder& target,
   readMessageCopy(stream, target, options, scratchSpace);
 }
 
+// =======================================================================================
+
+namespace _ {  // private
+
+kj::ArrayPtr<WireValue<uint32_t>> ChecksummedSegmentTable::initRest() {
+  // Reject messages with too many segments for security reasons. (A segment count of zero, which
+  // the first word would give as 0xffffffff, is just as invalid.)
+  KJ_REQUIRE(firstWord[0].get() < 511, "Message has too many segments.") {
+    firstWord[0].set(0);
+    break;
+  }
+
+  rest = kj::heapArray<WireValue<uint32_t>>(checksummedTableSize(segmentCount()) - 2);
+  return rest;
+}
+
+size_t ChecksummedSegmentTable::check(const ReaderOptions& options) {
+  uint32_t crc = kj::crc32c(kj::arrayPtr(firstWord, 2).asBytes());
+  crc = kj::crc32c(rest.slice(0, rest.size() - 1).asBytes(), crc);
+  KJ_REQUIRE(crc == rest.back().get(), "Message is corrupt: segment table checksum mismatch.") {
+    resetToEmpty();
+    return 0;
+  }
+
+  size_t totalWords = 0;
+  for (uint i = 0; i < segmentCount(); i++) {
+    totalWords += segmentSize(i);
+  }
+
+  // Don't accept a message which the receiver couldn't possibly traverse without hitting the
+  // traversal limit.  Without this check, a malicious client could transmit a very large segment
+  // size to make the receiver allocate excessive space and possibly crash.
+  KJ_REQUIRE(totalWords <= options.traversalLimitInWords,
+             "Message is too large.  To increase the limit on the receiving end, see "
+             "capnp::ReaderOptions.") {
+    resetToEmpty();
+    return 0;
+  }
+
+  return totalWords;
+}
+
+kj::Array<kj::ArrayPtr<const word>> ChecksummedSegmentTable::layOutSegments(
+    kj::ArrayPtr<const word> space) const {
+  auto segments = kj::heapArray<kj::ArrayPtr<const word>>(segmentCount());
+  size_t offset = 0;
+  for (uint i = 0; i < segments.size(); i++) {
+    uint size = segmentSize(i);
+    segments[i] = space.slice(offset, offset + size);
+    offset += size;
+  }
+  return segments;
+}
+
+void ChecksummedSegmentTable::checkSegments(
+    kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) const {
+  for (uint i = 0; i < segments.size(); i++) {
+    KJ_REQUIRE(kj::crc32c(segments[i].asBytes()) == rest[segmentCount() - 1 + i].get(),
+               "Message is corrupt: segment checksum mismatch.", i) {
+      break;
+    }
+  }
+}
+
+uint ChecksummedSegmentTable::segmentSize(uint i) const {
+  return i == 0 ? firstWord[1].get() : rest[i - 1].get();
+}
+
+void ChecksummedSegmentTable::resetToEmpty() {
+  // Recovers from a corrupt table by pretending the message is a single, empty segment. The
+  // checksum of nothing is zero, so this table is consistent.
+  firstWord[0].set(0);
+  firstWord[1].set(0);
+  rest = kj::heapArray<WireValue<uint32_t>>(2);
+  rest[0].set(0);
+  rest[1].set(0);
+}
+
+void fillChecksummedTable(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                          kj::ArrayPtr<WireValue<uint32_t>> table) {
+  KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+  KJ_ASSERT(table.size() == checksummedTableSize(segments.size()),
+            "incorrectly sized table during write");
+
+  table[0].set(segments.size() - 1);
+  for (uint i = 0; i < segments.size(); i++) {
+    table[i + 1].set(segments[i].size());
+    table[segments.size() + 1 + i].set(kj::crc32c(segments[i].asBytes()));
+  }
+  table.back().set(kj::crc32c(table.slice(0, table.size() - 1).asBytes()));
+}
+
+}  // namespace _ (private)
+
+ChecksummedMessageReader::ChecksummedMessageReader(
+    kj::InputStream& inputStream, ReaderOptions options, kj::ArrayPtr<word> scratchSpace)
+    : MessageReader(options) {
+  _::ChecksummedSegmentTable table;
+  inputStream.read(table.firstWord, sizeof(table.firstWord));
+  auto rest = table.initRest();
+  inputStream.read(rest.begin(), rest.asBytes().size());
+  size_t totalWords = table.check(options);
+
+  if (scratchSpace.size() < totalWords) {
+    ownedSpace = kj::heapArray<word>(totalWords);
+    scratchSpace = ownedSpace;
+  }
+
+  inputStream.read(scratchSpace.begin(), totalWords * sizeof(word));
+  segments = table.layOutSegments(scratchSpace);
+  table.checkSegments(segments);
+}
+
+ChecksummedMessageReader::~ChecksummedMessageReader() noexcept(false) {}
+
+kj::ArrayPtr<const word> ChecksummedMessageReader::getSegment(uint id) {
+  if (id < segments.size()) {
+    return segments[id];
+  } else {
+    return nullptr;
+  }
+}
+
+void writeChecksummedMessage(kj::OutputStream& output,
+                             kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) {
+  KJ_REQUIRE(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  KJ_STACK_ARRAY(_::WireValue<uint32_t>, table, _::checksummedTableSize(segments.size()), 16, 64);
+  _::fillChecksummedTable(segments, table);
+
+  KJ_STACK_ARRAY(kj::ArrayPtr<const byte>, pieces, segments.size() + 1, 4, 32);
+  pieces[0] = table.asBytes();
+
+  for (uint i = 0; i < segments.size(); i++) {
+    pieces[i + 1] = segments[i].asBytes();
+  }
+
+  output.write(pieces);
+}
+
+#if !CAPNP_LITE
+// =======================================================================================
+
+MmapMessageReader::MmapMessageReader(
+    const kj::ReadableFile& file, ReaderOptions options, uint64_t offset)
+    : MessageReader(options), file(file), end(offset) {
+  KJ_REQUIRE(offset % sizeof(word) == 0, "Message offset must be word-aligned.", offset) {
+    return;
+  }
+
+  uint64_t fileSize = file.stat().size;
+  KJ_REQUIRE(fileSize >= offset && fileSize - offset >= sizeof(word),
+             "Message ends prematurely in segment table.") {
+    return;
+  }
+  uint64_t available = fileSize - offset;
+
+  _::WireValue<uint32_t> firstWord[2];
+  file.read(offset, kj::arrayPtr(firstWord, 2).asBytes());
+
+  uint segmentCount = firstWord[0].get() + 1;
+  KJ_REQUIRE(segmentCount != 0, "Message has too many segments.") {
+    return;
+  }
+
+  uint64_t tableSize = (uint64_t(segmentCount) / 2u + 1u) * sizeof(word);
+  KJ_REQUIRE(available >= tableSize, "Message ends prematurely in segment table.") {
+    return;
+  }
+
+  // Sizes for all segments except the first, including padding if necessary.
+  auto moreSizes = kj::heapArray<_::WireValue<uint32_t>>(segmentCount & ~1);
+  if (segmentCount > 1) {
+    file.read(offset + sizeof(firstWord), moreSizes.asBytes());
+  }
+
+  auto newSegments = kj::heapArray<Segment>(segmentCount);
+  uint64_t pos = tableSize;
+  for (uint i = 0; i < segmentCount; i++) {
+    uint segmentSize = i == 0 ? firstWord[1].get() : moreSizes[i - 1].get();
+    uint64_t segmentBytes = uint64_t(segmentSize) * sizeof(word);
+
+    KJ_REQUIRE(available - pos >= segmentBytes, "Message ends prematurely.") {
+      return;
+    }
+
+    newSegments[i].offset = offset + pos;
+    newSegments[i].size = segmentSize;
+    pos += segmentBytes;
+  }
+
+  segments = kj::mv(newSegments);
+  end = offset + pos;
+}
+
+MmapMessageReader::~MmapMessageReader() noexcept(false) {}
+
+kj::ArrayPtr<const word> MmapMessageReader::getSegment(uint id) {
+  // ReaderArena only asks for each segment once, and asks for segments other than the first
+  // while holding its own lock, so no locking is needed here.
+
+  if (id >= segments.size()) {
+    return nullptr;
+  }
+
+  auto& segment = segments[id];
+  if (segment.mapping == nullptr && segment.size > 0) {
+    segment.mapping = file.mmap(segment.offset, uint64_t(segment.size) * sizeof(word));
+  }
+
+  return kj::arrayPtr(reinterpret_cast<const word*>(segment.mapping.begin()), segment.size);
+}
+
+void MmapMessageReader::prefetch(uint id) {
+#if !_WIN32
+  auto bytes = getSegment(id).asBytes();
+  if (bytes.size() == 0) return;
+
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t start = reinterpret_cast<uintptr_t>(bytes.begin()) & ~(pageSize - 1);
+  uintptr_t stop = reinterpret_cast<uintptr_t>(bytes.end());
+
+  // This is only a hint, so failure (e.g. because the file is in-memory and the "mapping" is
+  // really a heap buffer) is harmless and deliberately ignored.
+  (void)madvise(reinterpret_cast<void*>(start), stop - start, MADV_WILLNEED);
+#else
+  (void)id;
+#endif
+}
+#endif  // !CAPNP_LITE
+
 }  // namespace capnp
@@ -45,6 +45,8 @@
 
 CAPNP_BEGIN_HEADER
 
+namespace kj { class ReadableFile; }
+
 namespace capnp {
 
 class FlatArrayMessageReader: public MessageReader {
@@ -210,6 +212,144 @@ void writeMessageToFd(int fd, kj::ArrayPtr<const kj::ArrayPtr<const word>> segme
 // you catch this exception at the call site.  If throwing an exception is not acceptable, you
 // can implement your own OutputStream with arbitrary error handling and then use writeMessage().
 
+// =======================================================================================
+// Checksummed messages
+//
+// An alternative framing for messages stored in files or sent over links where corruption must be
+// detected, with a CRC-32C checksum (see kj::crc32c()) of each segment and of the segment table:
+//
+// * 32-bit little-endian segment count minus one (4 bytes).
+// * 32-bit little-endian size of each segment, in words (4*(segment count) bytes).
+// * 32-bit little-endian CRC-32C of each segment (4*(segment count) bytes).
+// * 32-bit little-endian CRC-32C of all of the above (4 bytes).
+// * Data from each segment, in order (8*sum(segment sizes) bytes).
+//
+// The table is always a whole number of words, so there's no padding. The format is not
+// compatible with the one above: a message written by writeChecksummedMessage() must be read by
+// ChecksummedMessageReader or readChecksummedMessage() (in serialize-async.h).
+//
+// Checksums are computed as the write is put together and verified as the message is read, with
+// the CPU's CRC32 instructions where available, so this costs much less than checksumming the
+// output of writeMessage() separately. The table's checksum is verified before segment sizes are
+// trusted for anything, so a corrupt size is reported as corruption rather than, say, causing a
+// huge allocation.
+
+class ChecksummedMessageReader: public MessageReader {
+  // A MessageReader that reads a message written by writeChecksummedMessage() from an abstract
+  // kj::InputStream. Unlike InputStreamMessageReader, the whole message is read by the
+  // constructor, which throws if any checksum doesn't match.
+
+public:
+  ChecksummedMessageReader(kj::InputStream& inputStream,
+                           ReaderOptions options = ReaderOptions(),
+                           kj::ArrayPtr<word> scratchSpace = nullptr);
+  ~ChecksummedMessageReader() noexcept(false);
+
+  // implements MessageReader ----------------------------------------
+  kj::ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  kj::Array<kj::ArrayPtr<const word>> segments;
+
+  kj::Array<word> ownedSpace;
+  // Only if scratchSpace wasn't big enough.
+};
+
+void writeChecksummedMessage(kj::OutputStream& output, MessageBuilder& builder);
+void writeChecksummedMessage(kj::OutputStream& output,
+                             kj::ArrayPtr<const kj::ArrayPtr<const word>> segments);
+// Write the message to the given output stream in the checksummed format.
+
+namespace _ {  // private
+
+class ChecksummedSegmentTable {
+  // The segment table of a checksummed message, as read by ChecksummedMessageReader and
+  // readChecksummedMessage(). Fill in `firstWord`, then the array returned by `initRest()`, then
+  // call `check()` before using the segment sizes.
+
+public:
+  WireValue<uint32_t> firstWord[2];
+
+  kj::ArrayPtr<WireValue<uint32_t>> initRest();
+  // Allocates the rest of the table, given the first word. Throws if there are too many segments.
+
+  size_t check(const ReaderOptions& options);
+  // Verifies the table's checksum, and that the message doesn't exceed the traversal limit.
+  // Returns the total size of the segments, in words. If an exception is thrown and recovered
+  // from, the table is replaced by that of an empty message.
+
+  kj::Array<kj::ArrayPtr<const word>> layOutSegments(kj::ArrayPtr<const word> space) const;
+  // Returns the segments as they lie one after another at the start of `space`.
+
+  void checkSegments(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments) const;
+  // Verifies the checksum of each segment, once read.
+
+private:
+  kj::Array<WireValue<uint32_t>> rest;
+
+  inline uint segmentCount() const { return firstWord[0].get() + 1; }
+  uint segmentSize(uint i) const;
+  void resetToEmpty();
+};
+
+inline size_t checksummedTableSize(size_t segmentCount) { return segmentCount * 2 + 2; }
+// Size of a checksummed message's segment table, in 32-bit values.
+
+void fillChecksummedTable(kj::ArrayPtr<const kj::ArrayPtr<const word>> segments,
+                          kj::ArrayPtr<WireValue<uint32_t>> table);
+// Fills in the segment table for writing a checksummed message, checksumming each segment.
+
+}  // namespace _ (private)
+
+#if !CAPNP_LITE
+// =======================================================================================
+// Reading directly from files.
+
+class MmapMessageReader: public MessageReader {
+  // A MessageReader that reads a message in place from a `kj::ReadableFile`, using mmap().
+  //
+  // The constructor reads and validates only the segment table; each segment is mapped the first
+  // time a traversal reaches it. Since mmap() itself is lazy, only the pages actually visited are
+  // ever read from disk, so even a multi-gigabyte message opens in microseconds.
+  //
+  // As with any mapping, the file must not be modified while the reader is in use.
+
+public:
+  MmapMessageReader(const kj::ReadableFile& file, ReaderOptions options = ReaderOptions(),
+                    uint64_t offset = 0);
+  // Reads the message starting at byte `offset` of `file`, which must be a multiple of the word
+  // size. The file must remain valid until the MessageReader is destroyed.
+
+  ~MmapMessageReader() noexcept(false);
+
+  kj::ArrayPtr<const word> getSegment(uint id) override;
+
+  void prefetch(uint id);
+  // Hint that the given segment will be read soon, so that the OS can start paging it in all at
+  // once (madvise(MADV_WILLNEED)) rather than faulting each page as the traversal reaches it. The
+  // root is always in segment 0, so `prefetch(0)` is appropriate before reading most of a
+  // message. Does nothing on platforms without such a hint. Not safe to call concurrently with
+  // a traversal of the message from another thread.
+
+  uint getSegmentCount() const { return segments.size(); }
+
+  uint64_t getEnd() const { return end; }
+  // Get the byte offset within the file just past the end of the message. Pass this as `offset`
+  // to read the next message when several have been written to the same file.
+
+private:
+  struct Segment {
+    uint64_t offset = 0;  // in bytes, within the file
+    uint size = 0;        // in words
+    kj::Array<const byte> mapping;  // null until first used
+  };
+
+  const kj::ReadableFile& file;
+  kj::Array<Segment> segments;
+  uint64_t end;
+};
+#endif  // !CAPNP_LITE
+
 // =======================================================================================
 // inline stuff
 
@@ -225,6 +365,10 @@ inline void writeMessage(kj::OutputStream& output, MessageBuilder& builder) {
   writeMessage(output, builder.getSegmentsForOutput());
 }
 
+inline void writeChecksummedMessage(kj::OutputStream& output, MessageBuilder& builder) {
+  writeChecksummedMessage(output, builder.getSegmentsForOutput());
+}
+
 inline void writeMessageToFd(int fd, MessageBuilder& builder) {
   writeMessageToFd(fd, builder.getSegmentsForOutput());
 }
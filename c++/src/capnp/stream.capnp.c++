@@ -31,6 +31,16 @@ const ::capnp::_::RawSchema s_995f9a3377c0b16e = {
   0, 0, nullptr, nullptr, nullptr, { &s_995f9a3377c0b16e, nullptr, nullptr, 0, 0, nullptr }
 };
 #endif  // !CAPNP_LITE
+#if !CAPNP_LITE
+static const ::capnp::_::RawSchema* const xs_86c366a91393f3f8[] = {
+  &s_995f9a3377c0b16e,
+  nullptr,
+};
+static const uint32_t xh_86c366a91393f3f8[] = {1};
+const ::capnp::_::RawSchemaIndex x_86c366a91393f3f8 = {
+  xs_86c366a91393f3f8, xh_86c366a91393f3f8, 2, 1, 1
+};
+#endif  // !CAPNP_LITE
 }  // namespace schemas
 }  // namespace capnp
 
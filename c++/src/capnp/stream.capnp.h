@@ -17,6 +17,7 @@ namespace capnp {
 namespace schemas {
 
 CAPNP_DECLARE_SCHEMA(995f9a3377c0b16e);
+CAPNP_DECLARE_SCHEMA_INDEX(86c366a91393f3f8);
 
 }  // namespace schemas
 }  // namespace capnp
@@ -304,5 +304,57 @@ TEST(Arena, Strings) {
   EXPECT_EQ(quux.end() + 1, corge.begin());
 }
 
+TEST(Arena, Reset) {
+  TestObject::count = 0;
+  TestObject::throwAt = -1;
+
+  Arena arena(64);
+
+  arena.allocate<TestObject>();
+  arena.allocateArray<uint64_t>(100);  // forces a second chunk
+  byte* first = arena.allocateArray<byte>(0).begin();
+  EXPECT_EQ(1, TestObject::count);
+
+  arena.reset();
+  EXPECT_EQ(0, TestObject::count);
+
+  // The largest chunk was kept, so allocation picks up at its start instead of hitting the heap.
+  byte* again = arena.allocateArray<byte>(1).begin();
+  EXPECT_TRUE(again < first);
+  EXPECT_EQ("foo", arena.copyString("foo"));
+
+  arena.allocate<TestObject>();
+  arena.reset(0);
+  EXPECT_EQ(0, TestObject::count);
+}
+
+TEST(Arena, ResetScratch) {
+  union {
+    byte scratch[256];
+    uint64_t align;
+  };
+  Arena arena(arrayPtr(scratch, sizeof(scratch)));
+
+  byte* first = arena.allocateArray<byte>(8).begin();
+  EXPECT_TRUE(first >= scratch && first < scratch + sizeof(scratch));
+  arena.allocateArray<byte>(1024);
+
+  arena.reset();
+  EXPECT_EQ(first, arena.allocateArray<byte>(8).begin());
+}
+
+TEST(Arena, ChunksRecycledAcrossArenas) {
+  byte* chunk;
+  {
+    Arena arena(5000);
+    chunk = arena.allocateArray<byte>(16).begin();
+  }
+
+  // A new arena on the same thread reuses the chunk the old one released.
+  Arena arena(5000);
+  byte* reused = arena.allocateArray<byte>(16).begin();
+  EXPECT_EQ(chunk, reused);
+}
+
 }  // namespace
 }  // namespace kj
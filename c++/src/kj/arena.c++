@@ -25,6 +25,113 @@
 
 namespace kj {
 
+namespace {
+
+class ChunkCache {
+  // Per-thread cache of chunks released by arenas, so that arenas which are created and destroyed
+  // over and over don't go to the heap each time.  Kept small: a handful of chunks, none huge,
+  // ordered from least to most recently released.
+
+public:
+  static constexpr uint SLOTS = 8;
+  static constexpr size_t MIN_CHUNK_SIZE = 256;
+  static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024;
+  // Tiny chunks only come from arenas with a tiny explicit size hint, which presumably want chunks
+  // of exactly that size.
+
+  void drain() {
+    // Frees all cached chunks. ChunkCache itself has no destructor, so that it stays usable for the
+    // whole of thread exit; ChunkCacheDrainer calls this instead.
+
+    for (auto i: kj::zeroTo(count)) {
+      operator delete(entries[i].chunk);
+    }
+    count = 0;
+  }
+
+  bool put(void* chunk, size_t size) {
+    if (size < MIN_CHUNK_SIZE || size > MAX_CHUNK_SIZE) return false;
+    if (count == SLOTS) {
+      // Evict the least-recently released chunk.
+      operator delete(entries[0].chunk);
+      remove(0);
+    }
+    entries[count++] = { chunk, size };
+    return true;
+  }
+
+  void* take(size_t minimumSize, size_t& size) {
+    // Best fit, preferring the most recently released chunk (likely still in CPU cache) among equal
+    // sizes. Chunks more than twice the requested size are skipped, so that the arena's chunk
+    // growth stays about the same as without the cache and big chunks stay available for arenas
+    // that need them.
+    uint best = count;
+    for (auto i: kj::zeroTo(count)) {
+      size_t s = entries[i].size;
+      if (s >= minimumSize && s <= minimumSize * 2 &&
+          (best == count || s <= entries[best].size)) {
+        best = i;
+      }
+    }
+    if (best == count) return nullptr;
+
+    void* result = entries[best].chunk;
+    size = entries[best].size;
+    remove(best);
+    return result;
+  }
+
+private:
+  struct Entry {
+    void* chunk;
+    size_t size;
+  };
+  Entry entries[SLOTS];
+  uint count = 0;
+
+  void remove(uint i) {
+    memmove(entries + i, entries + i + 1, (count - i - 1) * sizeof(Entry));
+    --count;
+  }
+};
+
+thread_local ChunkCache chunkCache;
+thread_local bool chunkCacheClosed = false;
+// Kept outside of ChunkCache: the compiler treats stores a destructor makes to its own object as
+// dead (see -flifetime-dse), so a flag set in ~ChunkCache() could never be observed.
+
+class ChunkCacheDrainer {
+  // Frees the cached chunks at thread exit. An Arena destroyed later during thread exit (e.g. by
+  // another thread_local's destructor) must not put chunks back into the drained cache, so this
+  // also marks the cache closed.
+
+public:
+  ~ChunkCacheDrainer() noexcept(false) {
+    chunkCache.drain();
+    chunkCacheClosed = true;
+  }
+
+  void ensureRegistered() {}
+  // Called before the cache first holds a chunk. Its only purpose is to odr-use the thread_local,
+  // which is what gets its destructor registered for this thread.
+};
+
+thread_local ChunkCacheDrainer chunkCacheDrainer;
+
+template <typename Chunk>
+void releaseChunk(Chunk* chunk) {
+  if (chunkCacheClosed) {
+    operator delete(chunk);
+    return;
+  }
+  chunkCacheDrainer.ensureRegistered();
+  if (!chunkCache.put(chunk, chunk->end - reinterpret_cast<byte*>(chunk))) {
+    operator delete(chunk);
+  }
+}
+
+}  // namespace
+
 Arena::Arena(size_t chunkSizeHint): nextChunkSize(kj::max(sizeof(ChunkHeader), chunkSizeHint)) {}
 
 Arena::Arena(ArrayPtr<byte> scratch)
@@ -38,6 +145,7 @@ Arena::Arena(ArrayPtr<byte> scratch)
     // Don't place the chunk in the chunk list because it's not ours to delete.  Just make it the
     // current chunk so that we'll allocate from it until it is empty.
     currentChunk = chunk;
+    scratchChunk = chunk;
   }
 }
 
@@ -49,21 +157,84 @@ Arena::~Arena() noexcept(false) {
   cleanup();
 }
 
-void Arena::cleanup() {
+void Arena::runDestructors() {
   while (objectList != nullptr) {
     void* ptr = objectList + 1;
     auto destructor = objectList->destructor;
     objectList = objectList->next;
     destructor(ptr);
   }
+}
+
+void Arena::cleanup() {
+  runDestructors();
 
   while (chunkList != nullptr) {
-    void* ptr = chunkList;
+    ChunkHeader* chunk = chunkList;
     chunkList = chunkList->next;
-    operator delete(ptr);
+    releaseChunk(chunk);
+  }
+  while (spareChunks != nullptr) {
+    ChunkHeader* chunk = spareChunks;
+    spareChunks = spareChunks->next;
+    releaseChunk(chunk);
+  }
+}
+
+void Arena::reset(uint chunksToKeep) {
+  runDestructors();
+
+  // `chunkList` is newest-first, and chunk sizes only grow, so the chunks that were in use come
+  // first, largest first, followed by any spares that went unused.
+  ChunkHeader* chunk = chunkList;
+  ChunkHeader* oldSpares = spareChunks;
+  chunkList = nullptr;
+  spareChunks = nullptr;
+  ChunkHeader** keptTail = &spareChunks;
+  uint kept = 0;
+
+  auto sort = [&](ChunkHeader* list) {
+    while (list != nullptr) {
+      ChunkHeader* next = list->next;
+      if (kept < chunksToKeep) {
+        list->pos = reinterpret_cast<byte*>(list + 1);
+        list->next = nullptr;
+        *keptTail = list;
+        keptTail = &list->next;
+        ++kept;
+      } else {
+        releaseChunk(list);
+      }
+      list = next;
+    }
+  };
+  sort(chunk);
+  sort(oldSpares);
+
+  currentChunk = scratchChunk;
+  if (scratchChunk != nullptr) {
+    scratchChunk->pos = reinterpret_cast<byte*>(scratchChunk + 1);
   }
 }
 
+auto Arena::takeSpareChunk(size_t minimumSize) -> ChunkHeader* {
+  for (ChunkHeader** prev = &spareChunks; *prev != nullptr; prev = &(*prev)->next) {
+    ChunkHeader* chunk = *prev;
+    if (chunk->end - reinterpret_cast<byte*>(chunk) >= minimumSize) {
+      *prev = chunk->next;
+      return chunk;
+    }
+  }
+
+  size_t size;
+  void* bytes = chunkCache.take(kj::max(minimumSize, nextChunkSize), size);
+  if (bytes == nullptr) return nullptr;
+
+  ChunkHeader* chunk = reinterpret_cast<ChunkHeader*>(bytes);
+  chunk->end = reinterpret_cast<byte*>(bytes) + size;
+  return chunk;
+}
+
 namespace {
 
 constexpr bool KJ_UNUSED isPowerOfTwo(size_t value) {
@@ -129,22 +300,29 @@ void* Arena::allocateBytesInternal(size_t amount, uint alignment) {
   // If the ChunkHeader size does not match the alignment, we'll need to pad it up.
   amount += alignTo(sizeof(ChunkHeader), alignment);
 
-  // Make sure we're going to allocate enough space.
-  while (nextChunkSize < amount) {
+  ChunkHeader* newChunk = takeSpareChunk(amount);
+  if (newChunk == nullptr) {
+    // Make sure we're going to allocate enough space.
+    while (nextChunkSize < amount) {
+      nextChunkSize *= 2;
+    }
+
+    // Allocate.
+    newChunk = reinterpret_cast<ChunkHeader*>(operator new(nextChunkSize));
+    newChunk->end = reinterpret_cast<byte*>(newChunk) + nextChunkSize;
     nextChunkSize *= 2;
+  } else {
+    // Grow from the recycled chunk's size just as if we had allocated it.
+    size_t size = newChunk->end - reinterpret_cast<byte*>(newChunk);
+    nextChunkSize = kj::max(nextChunkSize, size * 2);
   }
 
-  // Allocate.
-  byte* bytes = reinterpret_cast<byte*>(operator new(nextChunkSize));
-
   // Set up the ChunkHeader at the beginning of the allocation.
-  ChunkHeader* newChunk = reinterpret_cast<ChunkHeader*>(bytes);
+  byte* bytes = reinterpret_cast<byte*>(newChunk);
   newChunk->next = chunkList;
   newChunk->pos = bytes + amount;
-  newChunk->end = bytes + nextChunkSize;
   currentChunk = newChunk;
   chunkList = newChunk;
-  nextChunkSize *= 2;
 
   // Move past the ChunkHeader to find the position of the allocated object.
   return alignTo(bytes + sizeof(ChunkHeader), alignment);
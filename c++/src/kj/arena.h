@@ -79,6 +79,17 @@ public:
   StringPtr copyString(StringPtr content);
   // Make a copy of the given string inside the arena, and return a pointer to the copy.
 
+  void reset(uint chunksToKeep = 1);
+  // Run the destructors of everything allocated so far and make the arena empty again, as if it
+  // had just been constructed, so that it can be reused -- e.g. one arena per worker, reset after
+  // each request.  The `chunksToKeep` largest chunks are retained and allocated from before any
+  // new chunk is needed; the rest are released.  Any scratch space passed to the constructor is
+  // reused first.  Everything previously allocated from the arena is invalidated.
+  //
+  // Released chunks (here and in the destructor) of moderate size go to a small per-thread cache
+  // that any Arena on the same thread draws from before calling operator new, so short-lived
+  // arenas don't hit the heap on every use either.
+
 private:
   struct ChunkHeader {
     ChunkHeader* next;
@@ -96,10 +107,22 @@ private:
 
   ChunkHeader* currentChunk = nullptr;
 
+  ChunkHeader* spareChunks = nullptr;
+  // Chunks kept by reset() that haven't been needed again yet.
+
+  ChunkHeader* scratchChunk = nullptr;
+  // Header placed in the scratch space given to the constructor, if any.  Not ours to delete.
+
+  void runDestructors();
+  // Run all destructors, leaving `objectList` null.  If a destructor throws, the State is left in a
+  // consistent state, such that if this is called again, it will pick up where it left off.
+
   void cleanup();
-  // Run all destructors, leaving the above pointers null.  If a destructor throws, the State is
-  // left in a consistent state, such that if cleanup() is called again, it will pick up where
-  // it left off.
+  // Run all destructors and release all chunks, leaving the above pointers null.
+
+  ChunkHeader* takeSpareChunk(size_t minimumSize);
+  // Find a chunk of at least `minimumSize` bytes among this arena's spare chunks, or else in the
+  // thread's chunk cache.  Returns null if there is none.
 
   void* allocateBytes(size_t amount, uint alignment, bool hasDisposer);
   // Allocate the given number of bytes.  `hasDisposer` must be true if `setDisposer()` may be
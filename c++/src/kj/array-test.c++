@@ -21,6 +21,7 @@
 
 #include "array.h"
 #include "debug.h"
+#include "vector.h"
 #include <string>
 #include <list>
 #include "kj/compat/gtest.h"
@@ -515,5 +516,88 @@ TEST(Array, AttachFromArrayPtr) {
   KJ_EXPECT(destroyed1 == 3, destroyed1);
 }
 
+KJ_TEST("SmallVector") {
+  SmallVector<String, 2> vec;
+  KJ_EXPECT(vec.empty());
+  KJ_EXPECT(vec.capacity() == 2);
+
+  vec.add(kj::str("foo"));
+  vec.add(kj::str("bar"));
+  KJ_EXPECT(vec.isInline());
+  KJ_EXPECT(vec.asPtr() == kj::arr("foo"_kj, "bar"_kj).asPtr());
+
+  // Moving inline contents moves the elements.
+  auto moved = kj::mv(vec);
+  KJ_EXPECT(vec.empty());
+  KJ_EXPECT(vec.isInline());
+  KJ_EXPECT(moved.isInline());
+  KJ_EXPECT(kj::str(moved) == "foo, bar");
+
+  // Growing past the inline capacity moves to the heap.
+  moved.add(kj::str("baz"));
+  KJ_EXPECT(!moved.isInline());
+  KJ_EXPECT(moved.capacity() == 4);
+  KJ_EXPECT(kj::str(moved) == "foo, bar, baz");
+
+  // Moving heap contents just takes the heap array.
+  const String* heapBegin = moved.begin();
+  vec = kj::mv(moved);
+  KJ_EXPECT(vec.begin() == heapBegin);
+  KJ_EXPECT(moved.empty());
+  KJ_EXPECT(moved.isInline());
+
+  Array<String> array = vec.releaseAsArray();
+  KJ_EXPECT(array.size() == 3);
+  KJ_EXPECT(array[2] == "baz");
+  KJ_EXPECT(vec.empty());
+  KJ_EXPECT(vec.isInline());
+
+  // Releasing inline contents copies them to a right-sized heap array.
+  vec.add(kj::str("qux"));
+  array = vec.releaseAsArray();
+  KJ_EXPECT(array.size() == 1);
+  KJ_EXPECT(array[0] == "qux");
+  KJ_EXPECT(vec.releaseAsArray() == nullptr);
+
+  vec.resize(2);
+  KJ_EXPECT(vec[1] == nullptr);
+  vec.truncate(1);
+  vec.clear();
+  KJ_EXPECT(vec.empty());
+}
+
+KJ_TEST("SmallVector adopting an empty array") {
+  SmallVector<String, 2> vec(kj::Array<String>(nullptr));
+  KJ_EXPECT(vec.isInline());
+  for (auto i: kj::zeroTo(5)) {
+    vec.add(kj::str(i));
+  }
+  KJ_EXPECT(kj::strArray(vec, ",") == "0,1,2,3,4");
+}
+
+KJ_TEST("SmallVector destroys elements") {
+  uint destroyed = 0;
+  {
+    SmallVector<Own<int>, 2> vec;
+    for (auto i: kj::zeroTo(2)) {
+      vec.add(kj::heap<int>(i).attach(kj::defer([&]() { ++destroyed; })));
+    }
+    auto moved = kj::mv(vec);
+    KJ_EXPECT(destroyed == 0);
+  }
+  KJ_EXPECT(destroyed == 2);
+
+  {
+    SmallVector<Own<int>, 2> vec;
+    for (auto i: kj::zeroTo(5)) {
+      vec.add(kj::heap<int>(i).attach(kj::defer([&]() { ++destroyed; })));
+    }
+    KJ_EXPECT(destroyed == 2);
+    vec.removeLast();
+    KJ_EXPECT(destroyed == 3);
+  }
+  KJ_EXPECT(destroyed == 7);
+}
+
 }  // namespace
 }  // namespace kj
@@ -0,0 +1,84 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "benchmark.h"
+#include "async.h"
+
+namespace kj {
+namespace {
+
+KJ_BENCHMARK("Promise::then() chain of 16, then wait()") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    Promise<uint> promise = 0u;
+    for (uint j = 0; j < 16; j++) {
+      promise = promise.then([](uint n) { return n + 1; });
+    }
+    doNotOptimizeAway(promise.wait(waitScope));
+  }
+}
+
+KJ_BENCHMARK("evalLater() round trip") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    evalLater([]() {}).wait(waitScope);
+  }
+}
+
+KJ_BENCHMARK("newPromiseAndFulfiller() fulfill and wait") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    auto paf = newPromiseAndFulfiller<uint>();
+    paf.fulfiller->fulfill(123);
+    doNotOptimizeAway(paf.promise.wait(waitScope));
+  }
+}
+
+KJ_BENCHMARK("TaskSet add 100 tasks and drain") {
+  class ErrorHandlerImpl: public TaskSet::ErrorHandler {
+  public:
+    void taskFailed(Exception&& exception) override {
+      throwFatalException(kj::mv(exception));
+    }
+  };
+
+  EventLoop loop;
+  WaitScope waitScope(loop);
+  ErrorHandlerImpl errorHandler;
+  TaskSet tasks(errorHandler);
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    for (uint j = 0; j < 100; j++) {
+      tasks.add(evalLater([]() {}));
+    }
+    tasks.onEmpty().wait(waitScope);
+  }
+}
+
+}  // namespace
+}  // namespace kj
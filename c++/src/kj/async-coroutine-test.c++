@@ -501,6 +501,38 @@ KJ_TEST("HttpClient to capnproto.org with a coroutine") {
   promise.wait(io.waitScope);
 }
 
+kj::Promise<uint> bigFrameCoroutine(kj::Promise<void> promise) {
+  char buffer[4096];
+  for (auto& c: buffer) c = 'x';
+  co_await promise;
+  uint count = 0;
+  for (auto c: buffer) count += c == 'x';
+  co_return count;
+}
+
+KJ_TEST("Coroutine frames are recycled by the event loop") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  void* first = nullptr;
+  for (uint i = 0; i < 10; i++) {
+    auto paf = newPromiseAndFulfiller<void>();
+    auto promise = bigFrameCoroutine(kj::mv(paf.promise));
+
+    // The promise's node is the coroutine's promise object, which lives inside the frame, so if
+    // the frame is reused, so is the address.
+    void* node = &_::PromiseNode::from(promise);
+    if (first == nullptr) {
+      first = node;
+    } else {
+      KJ_EXPECT(node == first);
+    }
+
+    paf.fulfiller->fulfill();
+    KJ_EXPECT(promise.wait(waitScope) == 4096);
+  }
+}
+
 #endif  // KJ_HAS_COROUTINE
 
 }  // namespace
@@ -0,0 +1,257 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "async-file.h"
+#include "async-io.h"
+#include "mutex.h"
+#include "test.h"
+#include "thread.h"
+
+namespace kj {
+namespace {
+
+KJ_TEST("FileIoThreadPool basic reads and writes") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+  FileIoThreadPool pool(2);
+
+  auto syncFile = newInMemoryFile(nullClock());
+  auto file = pool.wrap(syncFile->clone());
+
+  // Issue a write and a sync without waiting in between; they must apply in order.
+  auto writePromise = file->write(0, "foobar"_kj.asBytes());
+  auto syncPromise = file->sync();
+  writePromise.wait(waitScope);
+  syncPromise.wait(waitScope);
+
+  KJ_EXPECT(file->stat().wait(waitScope).size == 6);
+  KJ_EXPECT(file->getSyncFile().readAllText() == "foobar");
+
+  byte buffer[16];
+  KJ_EXPECT(file->read(3, buffer).wait(waitScope) == 3);
+  KJ_EXPECT(kj::arrayPtr(buffer, 3) == "bar"_kj.asBytes());
+
+  file->zero(0, 3).wait(waitScope);
+  file->truncate(4).wait(waitScope);
+  auto content = file->getSyncFile().readAllBytes();
+  KJ_EXPECT(content.size() == 4);
+  KJ_EXPECT(content[0] == 0 && content[2] == 0 && content[3] == 'b');
+
+  // Read-only wrapper.
+  auto readOnly = pool.wrapReadable(syncFile->clone());
+  KJ_EXPECT(readOnly->read(3, buffer).wait(waitScope) == 1);
+  KJ_EXPECT(buffer[0] == 'b');
+}
+
+KJ_TEST("FileIoThreadPool propagates exceptions") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+  FileIoThreadPool pool(1);
+
+  auto file = pool.wrap(newInMemoryFile(nullClock()));
+  file->write(0, "foo"_kj.asBytes()).wait(waitScope);
+
+  // An in-memory file can't grow while it is mapped, so this throws on the worker thread.
+  auto mapping = file->getSyncWritableFile().mmapWritable(0, 3);
+  KJ_EXPECT_THROW_MESSAGE("memory mappings exist",
+      file->write(100, "bar"_kj.asBytes()).wait(waitScope));
+
+  // The worker is still usable afterwards.
+  mapping = nullptr;
+  file->write(100, "bar"_kj.asBytes()).wait(waitScope);
+  KJ_EXPECT(file->stat().wait(waitScope).size == 103);
+}
+
+KJ_TEST("AsyncReadableFile::pumpTo()") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+  FileIoThreadPool pool(1);
+
+  // Several chunks' worth of data, not a multiple of the chunk size.
+  auto data = heapArray<byte>(300000);
+  for (auto i: kj::indices(data)) data[i] = i * 7 + i / 251;
+
+  auto syncFile = newInMemoryFile(nullClock());
+  syncFile->writeAll(data);
+  auto file = pool.wrap(syncFile->clone());
+
+  {
+    auto pipe = newOneWayPipe();
+    auto readPromise = pipe.in->readAllBytes();
+    KJ_EXPECT(file->pumpTo(*pipe.out).wait(waitScope) == data.size());
+    pipe.out = nullptr;
+    KJ_EXPECT(readPromise.wait(waitScope) == data);
+  }
+
+  {
+    auto pipe = newOneWayPipe();
+    auto readPromise = pipe.in->readAllBytes();
+    KJ_EXPECT(file->pumpTo(*pipe.out, 1000, 100000).wait(waitScope) == 100000);
+    pipe.out = nullptr;
+    KJ_EXPECT(readPromise.wait(waitScope) == data.slice(1000, 101000));
+  }
+
+  {
+    // Past EOF.
+    auto pipe = newOneWayPipe();
+    auto readPromise = pipe.in->readAllBytes();
+    KJ_EXPECT(file->pumpTo(*pipe.out, data.size() - 10).wait(waitScope) == 10);
+    pipe.out = nullptr;
+    KJ_EXPECT(readPromise.wait(waitScope) == data.slice(data.size() - 10, data.size()));
+  }
+}
+
+class GatedAppendableFile final: public AppendableFile {
+  // Counts writes and syncs, and can hold syncs until released, so that tests can control how
+  // records get batched.
+
+public:
+  GatedAppendableFile(Own<const File> inner): inner(newFileAppender(kj::mv(inner))) {}
+
+  struct State {
+    uint writes = 0;
+    uint syncs = 0;
+    bool open = true;
+    bool fail = false;
+  };
+  MutexGuarded<State> state;
+
+  Metadata stat() const override { return inner->stat(); }
+  void sync() const override { datasync(); }
+  void datasync() const override {
+    auto lock = state.lockExclusive();
+    ++lock->syncs;
+    lock.wait([](const State& s) { return s.open; });
+    KJ_REQUIRE(!lock->fail, "simulated sync failure");
+  }
+  Own<const FsNode> cloneFsNode() const override { KJ_UNIMPLEMENTED("not needed"); }
+
+  void write(const void* buffer, size_t size) override {
+    ++state.lockExclusive()->writes;
+    inner->write(buffer, size);
+  }
+  void write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    ++state.lockExclusive()->writes;
+    inner->write(pieces);
+  }
+
+private:
+  Own<AppendableFile> inner;
+};
+
+Array<const byte> record(StringPtr text) {
+  return heapArray(text.asBytes());
+}
+
+KJ_TEST("GroupCommitAppender batches records queued during a commit") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  auto syncFile = newInMemoryFile(nullClock());
+  auto gated = heap<GatedAppendableFile>(syncFile->clone());
+  auto& file = *gated;
+  file.state.lockExclusive()->open = false;
+  GroupCommitAppender appender(kj::mv(gated));
+
+  // The first record is committed alone. The rest queue up while its sync is held.
+  auto promise1 = appender.append(record("foo"));
+  file.state.lockExclusive().wait([](auto& s) { return s.syncs == 1; });
+  auto promise2 = appender.append(record("bar"));
+  auto promise3 = appender.append(record("baz"));
+  auto promise4 = appender.append(record("qux"));
+  KJ_EXPECT(!promise1.poll(waitScope));
+
+  file.state.lockExclusive()->open = true;
+  promise1.wait(waitScope);
+  promise2.wait(waitScope);
+  promise3.wait(waitScope);
+  promise4.wait(waitScope);
+
+  KJ_EXPECT(syncFile->readAllText() == "foobarbazqux");
+  auto lock = file.state.lockShared();
+  KJ_EXPECT(lock->writes == 2);
+  KJ_EXPECT(lock->syncs == 2);
+  auto stats = appender.getStats();
+  KJ_EXPECT(stats.records == 4);
+  KJ_EXPECT(stats.commits == 2);
+}
+
+KJ_TEST("GroupCommitAppender fails the batch and later appends when a sync fails") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  auto gated = heap<GatedAppendableFile>(newInMemoryFile(nullClock()));
+  auto& file = *gated;
+  GroupCommitAppender appender(kj::mv(gated));
+
+  appender.append(record("foo")).wait(waitScope);
+
+  file.state.lockExclusive()->fail = true;
+  KJ_EXPECT_THROW_MESSAGE("simulated sync failure",
+      appender.append(record("bar")).wait(waitScope));
+  KJ_EXPECT_THROW_MESSAGE("simulated sync failure",
+      appender.append(record("baz")).wait(waitScope));
+  KJ_EXPECT(appender.getStats().records == 1);
+}
+
+KJ_TEST("GroupCommitAppender with appends from several threads") {
+  auto syncFile = newInMemoryFile(nullClock());
+  GroupCommitAppender appender(newFileAppender(syncFile->clone()));
+
+  constexpr uint THREADS = 4;
+  constexpr uint RECORDS = 100;
+  {
+    auto threads = heapArrayBuilder<Own<Thread>>(THREADS);
+    for (uint t: kj::zeroTo(THREADS)) {
+      threads.add(heap<Thread>([&appender, t]() {
+        EventLoop loop;
+        WaitScope waitScope(loop);
+        auto promises = heapArrayBuilder<Promise<void>>(RECORDS);
+        for (uint i: kj::zeroTo(RECORDS)) {
+          promises.add(appender.append(record(kj::str(t, ':', i, ';'))));
+        }
+        joinPromises(promises.finish()).wait(waitScope);
+      }));
+    }
+  }
+
+  KJ_EXPECT(appender.getStats().records == THREADS * RECORDS);
+
+  // Each thread's records are in order.
+  auto text = syncFile->readAllText();
+  StringPtr rest = text;
+  uint next[THREADS] = {0};
+  while (rest.size() > 0) {
+    size_t colon = KJ_ASSERT_NONNULL(rest.findFirst(':'));
+    size_t end = KJ_ASSERT_NONNULL(rest.findFirst(';'));
+    uint t = str(rest.slice(0, colon)).parseAs<uint>();
+    uint i = str(rest.slice(colon + 1, end)).parseAs<uint>();
+    KJ_ASSERT(t < THREADS);
+    KJ_EXPECT(i == next[t]++);
+    rest = rest.slice(end + 1);
+  }
+  for (uint t: kj::zeroTo(THREADS)) {
+    KJ_EXPECT(next[t] == RECORDS);
+  }
+}
+
+}  // namespace
+}  // namespace kj
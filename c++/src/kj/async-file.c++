@@ -0,0 +1,324 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "async-file.h"
+#include "async-io.h"
+#include "debug.h"
+#include "mutex.h"
+#include "thread.h"
+#include "vector.h"
+
+namespace kj {
+
+namespace {
+
+class AsyncFilePump {
+  // Copies a file to an AsyncOutputStream, reading the next chunk into one buffer while the
+  // previous chunk is written from the other.
+
+public:
+  AsyncFilePump(AsyncReadableFile& file, AsyncOutputStream& output,
+                uint64_t offset, uint64_t limit)
+      : file(file), output(output), offset(offset), limit(limit) {}
+
+  Promise<uint64_t> pump() {
+    return readChunk(0).then([this](size_t n) {
+      return pumpFrom(0, n);
+    });
+  }
+
+private:
+  static constexpr size_t CHUNK_SIZE = 65536;
+
+  AsyncReadableFile& file;
+  AsyncOutputStream& output;
+  uint64_t offset;
+  uint64_t limit;
+  uint64_t doneSoFar = 0;
+  byte buffers[2][CHUNK_SIZE];
+
+  Promise<size_t> readChunk(uint i) {
+    size_t n = kj::min(limit - doneSoFar, CHUNK_SIZE);
+    if (n == 0) return size_t(0);
+    return file.read(offset, arrayPtr(buffers[i], n));
+  }
+
+  Promise<uint64_t> pumpFrom(uint i, size_t n) {
+    // buffers[i] holds the next `n` bytes to write.
+
+    if (n == 0) return doneSoFar;  // EOF or limit reached
+    offset += n;
+    doneSoFar += n;
+
+    // Start the next read before writing, so that both run concurrently.
+    auto nextRead = readChunk(i ^ 1);
+    return output.write(buffers[i], n)
+        .then([this, i, nextRead = kj::mv(nextRead)]() mutable {
+      return nextRead.then([this, i](size_t nextN) {
+        return pumpFrom(i ^ 1, nextN);
+      });
+    });
+  }
+};
+
+}  // namespace
+
+AsyncReadableFile::~AsyncReadableFile() noexcept(false) {}
+
+Promise<uint64_t> AsyncReadableFile::pumpTo(
+    AsyncOutputStream& output, uint64_t offset, uint64_t amount) {
+  auto pump = heap<AsyncFilePump>(*this, output, offset, amount);
+  auto promise = pump->pump();
+  return promise.attach(kj::mv(pump));
+}
+
+// =======================================================================================
+
+class FileIoThreadPool::Worker {
+  // One background thread running an event loop, which does nothing but execute the blocking
+  // calls sent to it via its Executor.
+
+public:
+  Worker(): thread([this]() { run(); }) {
+    auto lock = executor.lockExclusive();
+    lock.wait([](const Maybe<const Executor&>& value) { return value != nullptr; });
+    exec = &KJ_ASSERT_NONNULL(*lock);
+  }
+
+  ~Worker() noexcept(false) {
+    // Ask the thread to exit. `thread`'s destructor then joins it.
+    exec->executeSync([this]() { KJ_ASSERT_NONNULL(shutdownFulfiller)->fulfill(); });
+  }
+
+  const Executor& getExecutor() { return *exec; }
+
+private:
+  MutexGuarded<Maybe<const Executor&>> executor;
+  const Executor* exec = nullptr;
+  Maybe<Own<PromiseFulfiller<void>>> shutdownFulfiller;  // only accessed by the worker thread
+  Thread thread;  // must be last, so that it is joined before the other members are destroyed
+
+  void run() {
+    EventLoop loop;
+    WaitScope waitScope(loop);
+
+    auto paf = newPromiseAndFulfiller<void>();
+    shutdownFulfiller = kj::mv(paf.fulfiller);
+    *executor.lockExclusive() = getCurrentThreadExecutor();
+
+    paf.promise.wait(waitScope);
+  }
+};
+
+class FileIoThreadPool::ReadableFileImpl final: public AsyncReadableFile {
+public:
+  ReadableFileImpl(const Executor& executor, Own<const ReadableFile> file)
+      : executor(executor), file(kj::mv(file)) {}
+
+  Promise<size_t> read(uint64_t offset, ArrayPtr<byte> buffer) override {
+    return executor.executeAsync([this, offset, buffer]() {
+      return file->read(offset, buffer);
+    });
+  }
+
+  Promise<FsNode::Metadata> stat() override {
+    return executor.executeAsync([this]() { return file->stat(); });
+  }
+
+  const ReadableFile& getSyncFile() override { return *file; }
+
+private:
+  const Executor& executor;
+  Own<const ReadableFile> file;
+};
+
+class FileIoThreadPool::FileImpl final: public AsyncFile {
+public:
+  FileImpl(const Executor& executor, Own<const File> file)
+      : executor(executor), file(kj::mv(file)) {}
+
+  Promise<size_t> read(uint64_t offset, ArrayPtr<byte> buffer) override {
+    return executor.executeAsync([this, offset, buffer]() {
+      return file->read(offset, buffer);
+    });
+  }
+
+  Promise<FsNode::Metadata> stat() override {
+    return executor.executeAsync([this]() { return file->stat(); });
+  }
+
+  Promise<void> write(uint64_t offset, ArrayPtr<const byte> data) override {
+    return executor.executeAsync([this, offset, data]() { file->write(offset, data); });
+  }
+
+  Promise<void> zero(uint64_t offset, uint64_t size) override {
+    return executor.executeAsync([this, offset, size]() { file->zero(offset, size); });
+  }
+
+  Promise<void> truncate(uint64_t size) override {
+    return executor.executeAsync([this, size]() { file->truncate(size); });
+  }
+
+  Promise<void> sync() override {
+    return executor.executeAsync([this]() { file->sync(); });
+  }
+
+  Promise<void> datasync() override {
+    return executor.executeAsync([this]() { file->datasync(); });
+  }
+
+  const ReadableFile& getSyncFile() override { return *file; }
+  const File& getSyncWritableFile() override { return *file; }
+
+private:
+  const Executor& executor;
+  Own<const File> file;
+};
+
+FileIoThreadPool::FileIoThreadPool(uint threadCount) {
+  KJ_REQUIRE(threadCount > 0, "FileIoThreadPool needs at least one thread");
+
+  auto builder = heapArrayBuilder<Own<Worker>>(threadCount);
+  for (uint i = 0; i < threadCount; i++) {
+    builder.add(heap<Worker>());
+  }
+  workers = builder.finish();
+}
+
+FileIoThreadPool::~FileIoThreadPool() noexcept(false) {}
+
+const Executor& FileIoThreadPool::chooseWorker() {
+  auto& worker = *workers[nextWorker];
+  nextWorker = (nextWorker + 1) % workers.size();
+  return worker.getExecutor();
+}
+
+Own<AsyncFile> FileIoThreadPool::wrap(Own<const File> file) {
+  return heap<FileImpl>(chooseWorker(), kj::mv(file));
+}
+
+Own<AsyncReadableFile> FileIoThreadPool::wrapReadable(Own<const ReadableFile> file) {
+  return heap<ReadableFileImpl>(chooseWorker(), kj::mv(file));
+}
+
+// =======================================================================================
+
+class GroupCommitAppender::Flusher {
+public:
+  Flusher(Own<AppendableFile> file)
+      : file(kj::mv(file)), thread([this]() { run(); }) {}
+
+  ~Flusher() noexcept(false) {
+    // Let the thread commit what's left and exit. `thread`'s destructor then joins it.
+    state.lockExclusive()->shuttingDown = true;
+  }
+
+  Promise<void> append(Array<const byte> record) const {
+    auto paf = newPromiseAndCrossThreadFulfiller<void>();
+
+    auto lock = state.lockExclusive();
+    KJ_IF_MAYBE(e, lock->error) {
+      return kj::cp(*e);
+    }
+    lock->queue.add(Pending { kj::mv(record), kj::mv(paf.fulfiller) });
+    return kj::mv(paf.promise);
+  }
+
+  Stats getStats() const {
+    return state.lockShared()->stats;
+  }
+
+private:
+  struct Pending {
+    Array<const byte> record;
+    Own<CrossThreadPromiseFulfiller<void>> fulfiller;
+  };
+
+  struct State {
+    Vector<Pending> queue;
+    Stats stats = { 0, 0 };
+    Maybe<Exception> error;
+    bool shuttingDown = false;
+  };
+
+  Own<AppendableFile> file;  // only accessed by the thread
+  MutexGuarded<State> state;
+  Thread thread;  // must be last, so that it is joined before the other members are destroyed
+
+  void run() {
+    for (;;) {
+      Vector<Pending> batch;
+      Maybe<Exception> error;
+      {
+        auto lock = state.lockExclusive();
+        lock.wait([](const State& s) { return !s.queue.empty() || s.shuttingDown; });
+        if (lock->queue.empty()) return;
+        batch = kj::mv(lock->queue);
+        KJ_IF_MAYBE(e, lock->error) {
+          error = kj::cp(*e);
+        }
+      }
+
+      if (error == nullptr) {
+        auto pieces = heapArray<ArrayPtr<const byte>>(batch.size());
+        for (auto i: kj::indices(batch)) {
+          pieces[i] = batch[i].record;
+        }
+
+        error = kj::runCatchingExceptions([&]() {
+          file->write(pieces);
+          file->datasync();
+        });
+
+        auto lock = state.lockExclusive();
+        KJ_IF_MAYBE(e, error) {
+          lock->error = kj::cp(*e);
+        } else {
+          lock->stats.records += batch.size();
+          ++lock->stats.commits;
+        }
+      }
+
+      for (auto& pending: batch) {
+        KJ_IF_MAYBE(e, error) {
+          pending.fulfiller->reject(kj::cp(*e));
+        } else {
+          pending.fulfiller->fulfill();
+        }
+      }
+    }
+  }
+};
+
+GroupCommitAppender::GroupCommitAppender(Own<AppendableFile> file)
+    : flusher(heap<Flusher>(kj::mv(file))) {}
+
+GroupCommitAppender::~GroupCommitAppender() noexcept(false) {}
+
+Promise<void> GroupCommitAppender::append(Array<const byte> record) const {
+  return flusher->append(kj::mv(record));
+}
+
+GroupCommitAppender::Stats GroupCommitAppender::getStats() const {
+  return flusher->getStats();
+}
+
+}  // namespace kj
@@ -0,0 +1,173 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "async.h"
+#include "filesystem.h"
+
+KJ_BEGIN_HEADER
+
+namespace kj {
+
+class AsyncOutputStream;
+
+// =======================================================================================
+// Asynchronous file I/O
+//
+// The interfaces in filesystem.h are synchronous: a read from a slow disk or a network
+// filesystem blocks the calling thread, and with it the thread's whole event loop. The classes
+// below provide promise-based equivalents of the most common per-file operations, so that an
+// event loop thread can serve files without stalling.
+//
+// Most operating systems do not offer a truly asynchronous API for regular files that works with
+// the event ports KJ uses (epoll, kqueue, and IOCP all treat regular files as always-ready or
+// require unusual open modes), so the only implementation currently provided performs the
+// blocking calls on a pool of background threads; see FileIoThreadPool. The interfaces do not
+// assume this, leaving room for a native backend (e.g. io_uring) in the future.
+
+class AsyncReadableFile {
+  // Asynchronous equivalent of the I/O methods of ReadableFile.
+  //
+  // In all methods that take a buffer, the buffer must remain valid until the returned promise
+  // resolves or is canceled. Canceling a promise blocks until any operation already in progress
+  // on the buffer has finished, so it is safe to free the buffer immediately afterwards.
+
+public:
+  virtual ~AsyncReadableFile() noexcept(false);
+
+  virtual Promise<size_t> read(uint64_t offset, ArrayPtr<byte> buffer) = 0;
+  // Fills `buffer` with data starting at `offset`. Resolves to the number of bytes actually
+  // read -- the only time this is less than `buffer.size()` is when EOF occurs mid-buffer.
+
+  virtual Promise<FsNode::Metadata> stat() = 0;
+  // Stat the file.
+
+  virtual Promise<uint64_t> pumpTo(AsyncOutputStream& output,
+                                   uint64_t offset = 0, uint64_t amount = kj::maxValue);
+  // Writes the file's content, starting at `offset`, to `output`, stopping at EOF or after
+  // `amount` bytes, whichever comes first. Resolves to the number of bytes written.
+  //
+  // The default implementation reads the next chunk of the file while the previous one is being
+  // written, so neither the disk nor the output sit idle.
+
+  virtual const ReadableFile& getSyncFile() = 0;
+  // Returns the underlying synchronous file, e.g. for mmap(). Note that calling its methods from
+  // the event loop thread blocks that thread, which is what this class exists to avoid.
+};
+
+class AsyncFile: public AsyncReadableFile {
+  // Asynchronous equivalent of the I/O methods of File.
+
+public:
+  virtual Promise<void> write(uint64_t offset, ArrayPtr<const byte> data) = 0;
+  // Write the given data starting at the given offset in the file.
+
+  virtual Promise<void> zero(uint64_t offset, uint64_t size) = 0;
+  // Like File::zero().
+
+  virtual Promise<void> truncate(uint64_t size) = 0;
+  // Like File::truncate().
+
+  virtual Promise<void> sync() = 0;
+  virtual Promise<void> datasync() = 0;
+  // Like FsNode::sync() and FsNode::datasync(): resolves once all previously-written data has
+  // been flushed to disk.
+
+  virtual const File& getSyncWritableFile() = 0;
+  // Like getSyncFile(), but returns the writable interface.
+};
+
+class FileIoThreadPool {
+  // Performs blocking file I/O on a fixed set of background threads, on behalf of the event loop
+  // thread that owns this object.
+  //
+  // Each file wrapped by the pool is assigned to one of the pool's threads, round-robin. All
+  // operations on the same file are therefore performed in the order in which they were issued,
+  // so e.g. a `sync()` issued after a `write()` always covers that write, even if the caller
+  // didn't wait for the write to complete first. Operations on different files run in parallel,
+  // up to the number of threads.
+  //
+  // The pool must outlive all files wrapped by it. Its destructor waits for in-progress
+  // operations to finish and then joins the threads.
+
+public:
+  explicit FileIoThreadPool(uint threadCount = 4);
+  KJ_DISALLOW_COPY(FileIoThreadPool);
+  ~FileIoThreadPool() noexcept(false);
+
+  Own<AsyncFile> wrap(Own<const File> file);
+  Own<AsyncReadableFile> wrapReadable(Own<const ReadableFile> file);
+  // Returns an asynchronous wrapper around `file`. The returned object may only be used from the
+  // thread that owns the pool.
+
+private:
+  class Worker;
+  class ReadableFileImpl;
+  class FileImpl;
+
+  Array<Own<Worker>> workers;
+  uint nextWorker = 0;
+
+  const Executor& chooseWorker();
+};
+
+class GroupCommitAppender {
+  // Appends records to a file durably, committing records appended at about the same time as a
+  // group: a background thread writes everything queued since its last commit with a single
+  // gathered write, then calls `datasync()` once for the whole batch. Compared to calling
+  // `datasync()` after each record, this lets throughput grow with the number of concurrent
+  // appends instead of being capped by the disk's flush latency.
+  //
+  // Records are appended in the order in which append() was called. append() may be called from
+  // any thread with an event loop.
+  //
+  // The destructor commits the records still queued and then joins the background thread.
+
+public:
+  explicit GroupCommitAppender(Own<AppendableFile> file);
+  KJ_DISALLOW_COPY(GroupCommitAppender);
+  ~GroupCommitAppender() noexcept(false);
+
+  Promise<void> append(Array<const byte> record) const;
+  // Queues `record` to be appended. Resolves, on the calling thread's event loop, once the record
+  // has been written and synced along with the rest of its batch. Canceling the promise does not
+  // take the record back.
+  //
+  // If a write or sync throws, the promises of the whole batch are rejected, and so is every
+  // later append(), since it's no longer known what made it to disk.
+
+  struct Stats {
+    uint64_t records;
+    uint64_t commits;
+    // Records appended, and the number of write-and-sync rounds it took to append them.
+  };
+
+  Stats getStats() const;
+
+private:
+  class Flusher;
+  Own<Flusher> flusher;
+};
+
+}  // namespace kj
+
+KJ_END_HEADER
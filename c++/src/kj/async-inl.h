@@ -261,6 +261,11 @@ public:
   // `tracePromise()` may be called from an async signal handler while `get()` is executing. It
   // must not allocate nor take locks.
 
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size) noexcept;
+  // All PromiseNodes (and coroutine frames, whose promise type is a PromiseNode) are allocated
+  // through the current thread's EventLoop's PromiseNodePool.
+
   template <typename T>
   static Own<PromiseNode> from(T&& promise) {
     // Given a Promise, extract the PromiseNode.
@@ -1003,6 +1008,8 @@ class FiberBase: public PromiseNode, private Event {
 public:
   explicit FiberBase(size_t stackSize, _::ExceptionOrValue& result, SourceLocation location);
   explicit FiberBase(const FiberPool& pool, _::ExceptionOrValue& result, SourceLocation location);
+  explicit FiberBase(const FiberPool& pool, size_t minStackSize, _::ExceptionOrValue& result,
+                     SourceLocation location);
   ~FiberBase() noexcept(false);
 
   void start() { armDepthFirst(); }
@@ -1045,6 +1052,9 @@ public:
       : FiberBase(stackSize, result, location), func(kj::fwd<Func>(func)) {}
   explicit Fiber(const FiberPool& pool, Func&& func, SourceLocation location)
       : FiberBase(pool, result, location), func(kj::fwd<Func>(func)) {}
+  explicit Fiber(const FiberPool& pool, size_t minStackSize, Func&& func,
+                 SourceLocation location)
+      : FiberBase(pool, minStackSize, result, location), func(kj::fwd<Func>(func)) {}
   ~Fiber() noexcept(false) { destroy(); }
 
   typedef FixVoid<decltype(kj::instance<Func&>()(kj::instance<WaitScope&>()))> ResultType;
@@ -1287,6 +1297,19 @@ inline PromiseForResult<Func, WaitScope&> FiberPool::startFiber(
   return _::maybeReduce(kj::mv(result), false);
 }
 
+template <typename Func>
+inline PromiseForResult<Func, WaitScope&> FiberPool::startFiber(
+    size_t minStackSize, Func&& func, SourceLocation location) const {
+  typedef _::FixVoid<_::ReturnType<Func, WaitScope&>> ResultT;
+
+  Own<_::FiberBase> intermediate = kj::heap<_::Fiber<Func>>(
+      *this, minStackSize, kj::fwd<Func>(func), location);
+  intermediate->start();
+  auto result = _::PromiseNode::to<_::ChainPromises<_::ReturnType<Func, WaitScope&>>>(
+      _::maybeChain(kj::mv(intermediate), implicitCast<ResultT*>(nullptr), location));
+  return _::maybeReduce(kj::mv(result), false);
+}
+
 template <typename T>
 template <typename ErrorFunc>
 void Promise<T>::detach(ErrorFunc&& errorHandler) {
@@ -1490,13 +1513,19 @@ private:
   // Membership in one of the linked lists in the target Executor's work list or cancel list. These
   // fields are protected by the target Executor's mutex.
 
+  XThreadEvent* nextPending = nullptr;
+  // Link in the target Executor's lock-free stack of newly-submitted async events. Written by the
+  // requesting thread before pushing, and read by whichever thread later drains the stack into
+  // the `start` list under the mutex.
+
   enum {
     UNUSED,
     // Object was never queued on another thread.
 
     QUEUED,
-    // Target thread has not yet dequeued the event from the state.start list. The requesting
-    // thread can cancel execution by removing the event from the list.
+    // Target thread has not yet dequeued the event from the state.start list (or from the
+    // lock-free pending stack that feeds it). The requesting thread can cancel execution by
+    // removing the event from the list, after draining the pending stack under the lock.
 
     EXECUTING,
     // Target thread has dequeued the event from state.start and moved it to state.executing. To
@@ -1800,6 +1829,71 @@ PromiseCrossThreadFulfillerPair<T> newPromiseAndCrossThreadFulfiller() {
   return { _::PromiseNode::to<_::ReducePromises<T>>(kj::mv(node)), kj::mv(fulfiller) };
 }
 
+// -------------------------------------------------------------------
+// WorkerPool
+
+namespace _ {  // private
+
+class WorkerPoolTask {
+public:
+  virtual ~WorkerPoolTask() noexcept(false) = default;
+
+  virtual void run(WaitScope& waitScope) = 0;
+  // Run the function on the current (pool) thread and deliver the result.
+
+  virtual void cancel(Exception&& exception) = 0;
+  // The task will never run; reject its promise.
+};
+
+template <typename Func, typename T>
+class WorkerPoolTaskImpl final: public WorkerPoolTask {
+public:
+  WorkerPoolTaskImpl(Func&& func, Own<CrossThreadPromiseFulfiller<T>> fulfiller)
+      : func(kj::fwd<Func>(func)), fulfiller(kj::mv(fulfiller)) {}
+
+  void run(WaitScope& waitScope) override {
+    if (!fulfiller->isWaiting()) {
+      // The caller no longer cares.
+      return;
+    }
+
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      deliver(*fulfiller, kj::evalLater(kj::mv(func)), waitScope);
+    })) {
+      fulfiller->reject(kj::mv(*exception));
+    }
+  }
+
+  void cancel(Exception&& exception) override {
+    fulfiller->reject(kj::mv(exception));
+  }
+
+private:
+  Decay<Func> func;
+  Own<CrossThreadPromiseFulfiller<T>> fulfiller;
+
+  template <typename U>
+  static void deliver(CrossThreadPromiseFulfiller<U>& fulfiller, Promise<U>&& promise,
+                      WaitScope& waitScope) {
+    fulfiller.fulfill(promise.wait(waitScope));
+  }
+  static void deliver(CrossThreadPromiseFulfiller<void>& fulfiller, Promise<void>&& promise,
+                      WaitScope& waitScope) {
+    promise.wait(waitScope);
+    fulfiller.fulfill();
+  }
+};
+
+}  // namespace _ (private)
+
+template <typename Func>
+PromiseForResult<Func, void> WorkerPool::run(Func&& func) const {
+  typedef _::UnwrapPromise<PromiseForResult<Func, void>> T;
+  auto paf = newPromiseAndCrossThreadFulfiller<T>();
+  submit(kj::heap<_::WorkerPoolTaskImpl<Func, T>>(kj::fwd<Func>(func), kj::mv(paf.fulfiller)));
+  return kj::mv(paf.promise);
+}
+
 }  // namespace kj
 
 #if KJ_HAS_COROUTINE
@@ -1864,6 +1958,11 @@ public:
   ~CoroutineBase() noexcept(false);
   KJ_DISALLOW_COPY(CoroutineBase);
 
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size) noexcept;
+  // Coroutine frames are allocated through the current EventLoop's PromiseNodePool, bucketed by
+  // size, so that a coroutine costs no more allocations than the equivalent .then() chain.
+
   auto initial_suspend() { return stdcoro::suspend_never(); }
   auto final_suspend() noexcept { return stdcoro::suspend_always(); }
   // These adjust the suspension behavior of coroutines immediately upon initiation, and immediately
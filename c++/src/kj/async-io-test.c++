@@ -31,6 +31,7 @@
 #include "debug.h"
 #include "io.h"
 #include "miniposix.h"
+#include "filesystem.h"
 #include "kj/compat/gtest.h"
 #include "kj/time.h"
 #include <sys/types.h>
@@ -437,6 +438,52 @@ TEST(AsyncIo, AddressParsing) {
   // connect to "localhost" in a different test, though.
 }
 
+#if !_WIN32
+KJ_TEST("DNS lookups are shared and cached") {
+  // As above, we can't say exactly what "localhost" resolves to, only that the answer is
+  // consistent.
+
+  auto ioContext = setupAsyncIo();
+  auto& w = ioContext.waitScope;
+  auto& network = ioContext.provider->getNetwork();
+
+  setDnsCacheTtl(60 * kj::SECONDS, 5 * kj::SECONDS);
+  KJ_DEFER(setDnsCacheTtl(0 * kj::SECONDS, 0 * kj::SECONDS));
+  clearDnsCache();
+
+  // Concurrent lookups.
+  auto promise1 = network.parseAddress("localhost", 1234);
+  auto promise2 = network.parseAddress("localhost", 1234);
+  auto expected = promise1.wait(w)->toString();
+  KJ_EXPECT(promise2.wait(w)->toString() == expected);
+
+  // Cached lookup.
+  KJ_EXPECT(network.parseAddress("localhost", 1234).wait(w)->toString() == expected);
+
+  // Different port is a different lookup.
+  KJ_EXPECT(network.parseAddress("localhost", 4321).wait(w)->toString() != expected);
+
+  // Lookup from another thread's Network.
+  kj::Thread([&]() {
+    auto ioContext = setupAsyncIo();
+    auto& network = ioContext.provider->getNetwork();
+    KJ_EXPECT(network.parseAddress("localhost", 1234).wait(ioContext.waitScope)->toString() ==
+              expected);
+  });
+
+  // Each Network still applies its own filter to cached results.
+  auto restricted = network.restrictPeers({"public"});
+  KJ_EXPECT_THROW_MESSAGE("restrictPeers",
+      restricted->parseAddress("localhost", 1234).wait(w)->connect().wait(w));
+
+  // Without caching, which is the default.
+  setDnsCacheTtl(0 * kj::SECONDS, 0 * kj::SECONDS);
+  clearDnsCache();
+  KJ_EXPECT(network.parseAddress("localhost", 1234).wait(w)->toString() == expected);
+  KJ_EXPECT(network.parseAddress("localhost", 1234).wait(w)->toString() == expected);
+}
+#endif
+
 TEST(AsyncIo, OneWayPipe) {
   auto ioContext = setupAsyncIo();
 
@@ -482,6 +529,50 @@ TEST(AsyncIo, TwoWayPipe) {
   EXPECT_EQ("bar", result2);
 }
 
+KJ_TEST("pumpFileTo()") {
+  auto ioContext = setupAsyncIo();
+
+  // Bigger than a socket buffer, so that the pump has to wait for the reader part way through.
+  auto data = heapArray<byte>(1 << 20);
+  for (auto i: kj::indices(data)) data[i] = i * 7 + i / 251;
+
+  auto diskFile = newDiskFilesystem()->getCurrent().createTemporary();
+  diskFile->writeAll(data);
+  auto memFile = newInMemoryFile(nullClock());
+  memFile->writeAll(data);
+
+  // The disk file can be sent with sendfile() (on Linux), the in-memory file can't.
+  for (const ReadableFile* file: {implicitCast<const ReadableFile*>(diskFile.get()),
+                                  implicitCast<const ReadableFile*>(memFile.get())}) {
+    {
+      auto pipe = ioContext.provider->newTwoWayPipe();
+      auto readPromise = pipe.ends[1]->readAllBytes();
+      KJ_EXPECT(pumpFileTo(*file, *pipe.ends[0]).wait(ioContext.waitScope) == data.size());
+      pipe.ends[0]->shutdownWrite();
+      KJ_EXPECT(readPromise.wait(ioContext.waitScope) == data);
+    }
+
+    {
+      auto pipe = ioContext.provider->newTwoWayPipe();
+      auto readPromise = pipe.ends[1]->readAllBytes();
+      KJ_EXPECT(pumpFileTo(*file, *pipe.ends[0], 12345, 300000)
+          .wait(ioContext.waitScope) == 300000);
+      pipe.ends[0]->shutdownWrite();
+      KJ_EXPECT(readPromise.wait(ioContext.waitScope) == data.slice(12345, 312345));
+    }
+
+    {
+      // Stops at EOF.
+      auto pipe = ioContext.provider->newTwoWayPipe();
+      auto readPromise = pipe.ends[1]->readAllBytes();
+      KJ_EXPECT(pumpFileTo(*file, *pipe.ends[0], data.size() - 100, 1000)
+          .wait(ioContext.waitScope) == 100);
+      pipe.ends[0]->shutdownWrite();
+      KJ_EXPECT(readPromise.wait(ioContext.waitScope) == data.slice(data.size() - 100, data.size()));
+    }
+  }
+}
+
 TEST(AsyncIo, InMemoryCapabilityPipe) {
   EventLoop loop;
   WaitScope waitScope(loop);
@@ -1053,6 +1144,162 @@ TEST(AsyncIo, Udp) {
   }
 }
 
+TEST(AsyncIo, UdpBatch) {
+  auto ioContext = setupAsyncIo();
+
+  auto addr = ioContext.provider->getNetwork().parseAddress("127.0.0.1").wait(ioContext.waitScope);
+
+  auto port1 = addr->bindDatagramPort();
+  auto port2 = addr->bindDatagramPort();
+
+  auto addr1 = ioContext.provider->getNetwork().parseAddress("127.0.0.1", port1->getPort())
+      .wait(ioContext.waitScope);
+  auto addr2 = ioContext.provider->getNetwork().parseAddress("127.0.0.1", port2->getPort())
+      .wait(ioContext.waitScope);
+
+  // A run of equal-sized datagrams ending in a short one (which can be sent with segmentation
+  // offload), followed by some odd sizes (which can't).
+  Vector<String> messages;
+  for (uint i = 0; i < 10; i++) {
+    messages.add(kj::str("message ", (char)('a' + i), " padding padding"));
+  }
+  messages.add(kj::str("short"));
+  messages.add(kj::str("x"));
+  messages.add(kj::str("yy"));
+  messages.add(kj::str("zzz"));
+
+  auto pieces = KJ_MAP(m, messages) -> ArrayPtr<const byte> { return m.asBytes(); };
+
+  auto expectMessages = [&](DatagramReceiver& receiver, NetworkAddress& expectedSource) {
+    for (auto& message: messages) {
+      receiver.receive().wait(ioContext.waitScope);
+      auto content = receiver.getContent();
+      EXPECT_EQ(message, kj::heapString(content.value.asChars()));
+      EXPECT_FALSE(content.isTruncated);
+      EXPECT_EQ(expectedSource.toString(), receiver.getSource().toString());
+      EXPECT_EQ(0, receiver.getAncillary().value.size());
+    }
+  };
+
+  {
+    // Receive several datagrams per syscall.
+    DatagramReceiver::Capacity capacity;
+    capacity.batch = 4;
+    auto receiver = port2->makeReceiver(capacity);
+
+    port1->sendBatch(pieces, *addr2).wait(ioContext.waitScope);
+    expectMessages(*receiver, *addr1);
+  }
+
+  {
+    // Same again, but let the kernel coalesce. Over loopback, a segmented send is typically
+    // delivered to a UDP_GRO socket as a single buffer, which the receiver must split.
+    DatagramReceiver::Capacity capacity;
+    capacity.content = 65536;
+    capacity.batch = 2;
+    capacity.coalesce = true;
+    auto receiver = port1->makeReceiver(capacity);
+
+    port2->sendBatch(pieces, *addr1).wait(ioContext.waitScope);
+    expectMessages(*receiver, *addr2);
+
+    // Plain sends still arrive one at a time.
+    EXPECT_EQ(3, port2->send("foo", 3, *addr1).wait(ioContext.waitScope));
+    receiver->receive().wait(ioContext.waitScope);
+    EXPECT_EQ("foo", kj::heapString(receiver->getContent().value.asChars()));
+  }
+
+  {
+    // A batch too large for one sendmmsg() or GSO run.
+    Vector<ArrayPtr<const byte>> many;
+    for (uint i = 0; i < 200; i++) {
+      many.add(messages[i % messages.size()].asBytes());
+    }
+
+    DatagramReceiver::Capacity capacity;
+    capacity.batch = 16;
+    auto receiver = port2->makeReceiver(capacity);
+
+    port1->sendBatch(many, *addr2).wait(ioContext.waitScope);
+    for (uint i = 0; i < many.size(); i++) {
+      receiver->receive().wait(ioContext.waitScope);
+      EXPECT_EQ(messages[i % messages.size()],
+                kj::heapString(receiver->getContent().value.asChars()));
+    }
+  }
+}
+
+#ifdef SO_REUSEPORT
+class ShardServer final: private TaskSet::ErrorHandler {
+  // Tells each client which shard accepted it.
+
+public:
+  ShardServer(ConnectionReceiver& receiver, uint shard): receiver(receiver), shard(shard) {}
+
+  Promise<void> run() {
+    return receiver.accept().then([this](Own<AsyncIoStream> stream) {
+      auto promise = stream->write(&shard, 1);
+      tasks.add(promise.attach(kj::mv(stream)));
+      return run();
+    });
+  }
+
+private:
+  ConnectionReceiver& receiver;
+  byte shard;
+  TaskSet tasks { *this };
+
+  void taskFailed(Exception&& exception) override {
+    KJ_LOG(ERROR, exception);
+  }
+};
+
+void testShardedListener(bool cpuAffinity) {
+  constexpr uint SHARDS = 3;
+  constexpr uint CONNECTIONS = 30;
+
+  kj::ShardedListener listener("127.0.0.1", 0, SHARDS,
+      [](AsyncIoContext& io, ConnectionReceiver& receiver, uint shard) {
+    auto server = kj::heap<ShardServer>(receiver, shard);
+    auto promise = server->run();
+    return promise.attach(kj::mv(server));
+  }, cpuAffinity);
+
+  ASSERT_NE(listener.getPort(), 0);
+
+  auto ioContext = setupAsyncIo();
+  auto addr = ioContext.provider->getNetwork().parseAddress("127.0.0.1", listener.getPort())
+      .wait(ioContext.waitScope);
+
+  for (uint i = 0; i < CONNECTIONS; i++) {
+    auto stream = addr->connect().wait(ioContext.waitScope);
+    byte b;
+    stream->read(&b, 1).wait(ioContext.waitScope);
+    KJ_EXPECT(b < SHARDS, b);
+  }
+}
+
+KJ_TEST("ShardedListener") {
+  testShardedListener(false);
+}
+
+#if __linux__
+KJ_TEST("ShardedListener with CPU affinity") {
+  testShardedListener(true);
+}
+#endif
+
+KJ_TEST("ShardedListener startup failure") {
+  // 192.0.2.1 is reserved for documentation, so it is not a local address and can't be bound.
+  KJ_EXPECT(kj::runCatchingExceptions([]() {
+    kj::ShardedListener("192.0.2.1", 0, 2,
+        [](AsyncIoContext&, ConnectionReceiver&, uint) -> Promise<void> {
+      return NEVER_DONE;
+    });
+  }) != nullptr);
+}
+#endif  // SO_REUSEPORT
+
 #endif  // !_WIN32
 
 #ifdef __linux__  // Abstract unix sockets are only supported on Linux
@@ -2923,6 +3170,63 @@ KJ_TEST("import socket FD that's already broken") {
   KJ_EXPECT(buffer == "foo"_kj);
 }
 
+#if __linux__
+KJ_TEST("ZEROCOPY_WRITES socket") {
+  auto io = setupAsyncIo();
+
+  int listenFd;
+  KJ_SYSCALL(listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  AutoCloseFd listenOwned(listenFd);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  KJ_SYSCALL(bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+  socklen_t addrLen = sizeof(addr);
+  KJ_SYSCALL(getsockname(listenFd, reinterpret_cast<struct sockaddr*>(&addr), &addrLen));
+  KJ_SYSCALL(listen(listenFd, 1));
+
+  int clientFd;
+  KJ_SYSCALL(clientFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  KJ_SYSCALL(connect(clientFd, reinterpret_cast<struct sockaddr*>(&addr), addrLen));
+  int serverFd;
+  KJ_SYSCALL(serverFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC));
+
+  auto client = io.lowLevelProvider->wrapSocketFd(clientFd,
+      LowLevelAsyncIoProvider::TAKE_OWNERSHIP | LowLevelAsyncIoProvider::ZEROCOPY_WRITES);
+  auto server = io.lowLevelProvider->wrapSocketFd(serverFd,
+      LowLevelAsyncIoProvider::TAKE_OWNERSHIP);
+
+  auto abortedPromise = client->whenWriteDisconnected();
+
+  // Large enough to use zero-copy sends, in several pieces. (On loopback, the kernel ends up
+  // copying anyway and tells us so, but we still go through the notification path.)
+  auto data = heapArray<byte>(1 << 20);
+  for (auto i: kj::indices(data)) data[i] = i * 7 + (i >> 12);
+  ArrayPtr<const byte> pieces[4];
+  for (auto i: kj::indices(pieces)) {
+    pieces[i] = data.slice(i * data.size() / 4, (i + 1) * data.size() / 4);
+  }
+
+  for (int round = 0; round < 3; round++) {
+    auto received = heapArray<byte>(data.size());
+    auto writePromise = client->write(pieces);
+    server->read(received.begin(), received.size()).wait(io.waitScope);
+    writePromise.wait(io.waitScope);
+    KJ_EXPECT(received.asPtr() == data.asPtr());
+  }
+
+  // Completion notifications must not look like a disconnect.
+  KJ_EXPECT(!abortedPromise.poll(io.waitScope));
+
+  // Reset the connection for real.
+  struct linger linger = { 1, 0 };
+  server->setsockopt(SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  server = nullptr;
+  abortedPromise.wait(io.waitScope);
+}
+#endif  // __linux__
+
 #endif  // !__CYGWIN__
 #endif  // !_WIN32
 
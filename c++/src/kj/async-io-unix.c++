@@ -32,7 +32,10 @@
 #include "debug.h"
 #include "thread.h"
 #include "io.h"
+#include "filesystem.h"
 #include "miniposix.h"
+#include "map.h"
+#include "mutex.h"
 #include <unistd.h>
 #include <sys/uio.h>
 #include <errno.h>
@@ -47,10 +50,21 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <set>
+#include <deque>
 #include <poll.h>
 #include <limits.h>
 #include <sys/ioctl.h>
 
+#if __linux__
+#include <sys/sendfile.h>
+#include <netinet/udp.h>
+#endif
+
+#if __linux__ && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define KJ_HAS_ZEROCOPY_SEND 1
+#endif
+
 #if !defined(SO_PEERCRED) && defined(LOCAL_PEERCRED)
 #include <sys/ucred.h>
 #endif
@@ -140,7 +154,15 @@ public:
   AsyncStreamFd(UnixEventPort& eventPort, int fd, uint flags)
       : OwnedFileDescriptor(fd, flags),
         eventPort(eventPort),
-        observer(eventPort, fd, UnixEventPort::FdObserver::OBSERVE_READ_WRITE) {}
+        observer(eventPort, fd, UnixEventPort::FdObserver::OBSERVE_READ_WRITE) {
+#if KJ_HAS_ZEROCOPY_SEND
+    if (flags & LowLevelAsyncIoProvider::ZEROCOPY_WRITES) {
+      // If this fails, the socket type doesn't support zero-copy sends; we'll just copy.
+      int one = 1;
+      zerocopyEnabled = ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) >= 0;
+    }
+#endif
+  }
   virtual ~AsyncStreamFd() noexcept(false) {}
 
   Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
@@ -170,6 +192,12 @@ public:
   }
 
   Promise<void> write(const void* buffer, size_t size) override {
+#if KJ_HAS_ZEROCOPY_SEND
+    if (zerocopyEnabled && size >= ZEROCOPY_MIN_BYTES) {
+      return writeInternal(arrayPtr(reinterpret_cast<const byte*>(buffer), size), nullptr, nullptr);
+    }
+#endif
+
     ssize_t n;
     KJ_NONBLOCKING_SYSCALL(n = ::write(fd, buffer, size)) {
       // Error.
@@ -296,6 +324,13 @@ public:
     }
   }
 
+  Maybe<Promise<uint64_t>> tryPumpFromFile(
+      const ReadableFile& file, uint64_t offset, uint64_t amount = kj::maxValue) override {
+    // sendfile() copies from the page cache straight into the socket (or pipe) buffer.
+    int fileFd = KJ_UNWRAP_OR_RETURN(file.getFd(), nullptr);
+    return sendfilePumpLoop(file, fileFd, offset, amount, 0);
+  }
+
 private:
   static constexpr size_t MAX_SPLICE_LEN = 1 << 20;
   // Maximum value we'll pass for the `len` argument of `splice()`. Linux does not like it when we
@@ -400,6 +435,38 @@ private:
     }
   }
 
+  Promise<uint64_t> sendfilePumpLoop(const ReadableFile& file, int fileFd,
+                                     uint64_t offset, uint64_t limit, uint64_t doneSoFar) {
+    while (doneSoFar < limit) {
+      off_t pos = offset + doneSoFar;
+      ssize_t n;
+      KJ_SYSCALL_HANDLE_ERRORS(n = sendfile(fd, fileFd, &pos,
+          kj::min(limit - doneSoFar, MAX_SPLICE_LEN))) {
+        case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+        case EWOULDBLOCK:
+#endif
+          // Socket buffer is full, wait.
+          return observer.whenBecomesWritable()
+              .then([this, &file, fileFd, offset, limit, doneSoFar]() {
+            return sendfilePumpLoop(file, fileFd, offset, limit, doneSoFar);
+          });
+        case EINVAL:
+        case ENOSYS:
+          // The file doesn't support sendfile() (e.g. some special filesystems), so copy it
+          // through userspace after all.
+          return unoptimizedPumpFileTo(file, *this, offset, limit, doneSoFar);
+        default:
+          KJ_FAIL_SYSCALL("sendfile()", error) { return doneSoFar; }
+      }
+
+      if (n == 0) break;  // EOF
+      doneSoFar += n;
+    }
+
+    return doneSoFar;
+  }
+
 public:
 #endif  // __linux__ && !__ANDROID__
 
@@ -407,6 +474,23 @@ public:
     KJ_IF_MAYBE(p, writeDisconnectedPromise) {
       return p->addBranch();
     } else {
+#if KJ_HAS_ZEROCOPY_SEND
+      if (zerocopyEnabled) {
+        // Zero-copy completion notifications also signal POLLERR, so we can't trust the observer
+        // directly. See watchErrors().
+        auto paf = newPromiseAndFulfiller<void>();
+        if (writeDisconnected) {
+          paf.fulfiller->fulfill();
+        } else {
+          disconnectFulfiller = kj::mv(paf.fulfiller);
+          startWatchingErrors();
+        }
+        auto fork = paf.promise.fork();
+        auto result = fork.addBranch();
+        writeDisconnectedPromise = kj::mv(fork);
+        return kj::mv(result);
+      }
+#endif
       auto fork = observer.whenWriteDisconnected().fork();
       auto result = fork.addBranch();
       writeDisconnectedPromise = kj::mv(fork);
@@ -452,6 +536,10 @@ public:
     return fd;
   }
 
+  kj::Maybe<int> getTransparentFd() const override {
+    return fd;
+  }
+
   void registerAncillaryMessageHandler(
       kj::Function<void(kj::ArrayPtr<AncillaryMessage>)> fn) override {
     ancillaryMsgCallback = kj::mv(fn);
@@ -486,6 +574,137 @@ private:
   Maybe<ForkedPromise<void>> writeDisconnectedPromise;
   Maybe<Function<void(ArrayPtr<AncillaryMessage>)>> ancillaryMsgCallback;
 
+#if KJ_HAS_ZEROCOPY_SEND
+  static constexpr size_t ZEROCOPY_MIN_BYTES = 16384;
+  // Zero-copy sends have a fixed cost (pinning pages and processing the completion notification)
+  // which, per the kernel's documentation, only pays off for writes of roughly 10KB or more.
+
+  bool zerocopyEnabled = false;
+
+  uint32_t zerocopySent = 0;
+  uint32_t zerocopyCompleted = 0;
+  // Number of successful sendmsg(MSG_ZEROCOPY) calls, and number the kernel has reported it is
+  // done with. (The kernel numbers them with a 32-bit counter, so these wrap the same way.)
+
+  bool writeDisconnected = false;
+  Maybe<Own<PromiseFulfiller<void>>> zerocopyFulfiller;
+  Maybe<Own<PromiseFulfiller<void>>> disconnectFulfiller;
+  Maybe<Promise<void>> errorWatcher;
+  // Completion notifications are delivered via the socket's error queue, which the kernel
+  // signals as POLLERR -- the same as a disconnect. So, once we need either, one loop
+  // (watchErrors()) owns the observer's whenWriteDisconnected() and dispatches to both.
+
+  ssize_t sendZerocopy(const struct msghdr& msg) {
+    ssize_t n = ::sendmsg(fd, &msg, MSG_ZEROCOPY);
+    if (n >= 0) {
+      ++zerocopySent;
+    } else if (errno == ENOBUFS) {
+      // We've hit the limit on memory the socket may pin (net.core.optmem_max). Copy instead.
+      n = ::sendmsg(fd, &msg, 0);
+    }
+    return n;
+  }
+
+  void readZerocopyNotifications() {
+    for (;;) {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      void* cmsgSpace[16];  // array of words to get the alignment right
+      msg.msg_control = cmsgSpace;
+      msg.msg_controllen = sizeof(cmsgSpace);
+
+      ssize_t n;
+      KJ_NONBLOCKING_SYSCALL(n = ::recvmsg(fd, &msg, MSG_ERRQUEUE)) {
+        return;
+      }
+      if (n < 0) return;  // error queue is empty
+
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+            !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+          continue;
+        }
+
+        struct sock_extended_err err;
+        memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+        if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+        // The notification covers the inclusive range of sends [ee_info, ee_data].
+        zerocopyCompleted += err.ee_data - err.ee_info + 1;
+
+        if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+          // The kernel ended up copying anyway, e.g. because the route is loopback or the
+          // device can't do scatter-gather. Further zero-copy sends would only add overhead.
+          zerocopyEnabled = false;
+        }
+      }
+    }
+  }
+
+  Promise<void> waitZerocopySends() {
+    // Called when a write has been fully handed to the kernel. Resolves when the kernel no
+    // longer references any buffer passed to a zero-copy send.
+
+    if (zerocopyCompleted != zerocopySent) {
+      readZerocopyNotifications();
+    }
+    if (zerocopyCompleted == zerocopySent || writeDisconnected) {
+      // Note that once the connection has failed, the remaining notifications may never
+      // arrive. It's safe to free the buffers anyway; the kernel holds its own references to
+      // the pages, we just can't promise what gets transmitted from them.
+      return READY_NOW;
+    }
+
+    auto paf = newPromiseAndFulfiller<void>();
+    zerocopyFulfiller = kj::mv(paf.fulfiller);
+    startWatchingErrors();
+    return paf.promise.then([this]() { return waitZerocopySends(); });
+  }
+
+  void startWatchingErrors() {
+    if (errorWatcher == nullptr) {
+      errorWatcher = watchErrors().eagerlyEvaluate([this](Exception&& e) {
+        KJ_IF_MAYBE(f, zerocopyFulfiller) {
+          f->get()->reject(kj::cp(e));
+        }
+        KJ_IF_MAYBE(f, disconnectFulfiller) {
+          f->get()->reject(kj::mv(e));
+        }
+      });
+    }
+  }
+
+  Promise<void> watchErrors() {
+    return observer.whenWriteDisconnected().then([this]() -> Promise<void> {
+      // Drain the error queue first, otherwise it would look like a disconnect. What remains
+      // might be genuine.
+      readZerocopyNotifications();
+
+      struct pollfd pollfd;
+      memset(&pollfd, 0, sizeof(pollfd));
+      pollfd.fd = fd;
+      KJ_SYSCALL(::poll(&pollfd, 1, 0));
+      writeDisconnected = (pollfd.revents & (POLLHUP | POLLERR)) != 0;
+
+      KJ_IF_MAYBE(f, zerocopyFulfiller) {
+        f->get()->fulfill();
+        zerocopyFulfiller = nullptr;
+      }
+
+      if (writeDisconnected) {
+        KJ_IF_MAYBE(f, disconnectFulfiller) {
+          f->get()->fulfill();
+          disconnectFulfiller = nullptr;
+        }
+        return READY_NOW;
+      }
+
+      return watchErrors();
+    });
+  }
+#endif  // KJ_HAS_ZEROCOPY_SEND
+
   Promise<ReadResult> tryReadInternal(void* buffer, size_t minBytes, size_t maxBytes,
                                       AutoCloseFd* fdBuffer, size_t maxFds,
                                       ReadResult alreadyRead) {
@@ -703,6 +922,19 @@ private:
     }
 
     ssize_t n;
+#if KJ_HAS_ZEROCOPY_SEND
+    if (fds.size() == 0 && zerocopyEnabled && iovTotal >= ZEROCOPY_MIN_BYTES) {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov.begin();
+      msg.msg_iovlen = iov.size();
+
+      KJ_NONBLOCKING_SYSCALL(n = sendZerocopy(msg), iovTotal, iov.size()) {
+        // Error.
+        goto error;
+      }
+    } else
+#endif
     if (fds.size() == 0) {
       KJ_NONBLOCKING_SYSCALL(n = ::writev(fd, iov.begin(), iov.size()), iovTotal, iov.size()) {
         // Error.
@@ -797,6 +1029,13 @@ private:
       } else if (morePieces.size() == 0) {
         // First piece was fully-consumed and there are no more pieces, so we're done.
         KJ_DASSERT(n == firstPiece.size(), n);
+#if KJ_HAS_ZEROCOPY_SEND
+        if (zerocopySent != zerocopyCompleted) {
+          // Some of the data went out via zero-copy sends, so the kernel may still be reading
+          // out of our caller's buffers.
+          return waitZerocopySends();
+        }
+#endif
         return READY_NOW;
       } else {
         // First piece was fully consumed, so move on to the next piece.
@@ -812,6 +1051,9 @@ private:
 #if __linux__ && !__ANDROID__
 constexpr size_t AsyncStreamFd::MAX_SPLICE_LEN;
 #endif  // __linux__ && !__ANDROID__
+#if KJ_HAS_ZEROCOPY_SEND
+constexpr size_t AsyncStreamFd::ZEROCOPY_MIN_BYTES;
+#endif
 
 // =======================================================================================
 
@@ -1127,92 +1369,189 @@ private:
     struct sockaddr_storage storage;
   } addr;
 
-  struct LookupParams;
-  class LookupReader;
+public:
+  class Resolver;
 };
 
-class SocketAddress::LookupReader {
-  // Reads SocketAddresses off of a pipe coming from another thread that is performing
-  // getaddrinfo.
+class SocketAddress::Resolver {
+  // Performs DNS lookups for all Networks in the process.
+  //
+  // getaddrinfo() is the only cross-platform DNS API, and it is blocking, so lookups run on a
+  // small pool of threads which, once started, live for the rest of the process. Concurrent
+  // lookups of the same name share one getaddrinfo() call, and if setDnsCacheTtl() has been
+  // called, results -- including failures -- are cached. getaddrinfo() doesn't tell us the
+  // records' TTLs, so the cache uses fixed ones.
+  //
+  // Results are cached before the Network's filter is applied, since the filter varies between
+  // Networks.
+  //
+  // Please do not implement a custom DNS resolver...
 
 public:
-  LookupReader(kj::Own<Thread>&& thread, kj::Own<AsyncInputStream>&& input,
-               _::NetworkFilter& filter)
-      : thread(kj::mv(thread)), input(kj::mv(input)), filter(filter) {}
-
-  ~LookupReader() {
-    if (thread) thread->detach();
-  }
-
-  Promise<Array<SocketAddress>> read() {
-    return input->tryRead(&current, sizeof(current), sizeof(current)).then(
-        [this](size_t n) -> Promise<Array<SocketAddress>> {
-      if (n < sizeof(current)) {
-        thread = nullptr;
-        // getaddrinfo()'s docs seem to say it will never return an empty list, but let's check
-        // anyway.
-        KJ_REQUIRE(addresses.size() > 0, "DNS lookup returned no permitted addresses.") { break; }
-        return addresses.releaseAsArray();
-      } else {
-        // getaddrinfo() can return multiple copies of the same address for several reasons.
-        // A major one is that we don't give it a socket type (SOCK_STREAM vs. SOCK_DGRAM), so
-        // it may return two copies of the same address, one for each type, unless it explicitly
-        // knows that the service name given is specific to one type.  But we can't tell it a type,
-        // because we don't actually know which one the user wants, and if we specify SOCK_STREAM
-        // while the user specified a UDP service name then they'll get a resolution error which
-        // is lame.  (At least, I think that's how it works.)
-        //
-        // So we instead resort to de-duping results.
-        if (alreadySeen.insert(current).second) {
-          if (current.parseAllowedBy(filter)) {
-            addresses.add(current);
+  static Resolver& instance() {
+    // Leaked on purpose: detached lookup threads may still refer to it during process exit.
+    static Resolver* resolver = new Resolver;
+    return *resolver;
+  }
+
+  Promise<Array<SocketAddress>> lookup(String host, String service, uint portHint) {
+    auto key = kj::str(host, '\n', service == nullptr ? "" : "service:", service, '\n', portHint);
+    auto now = systemCoarseMonotonicClock().now();
+
+    auto paf = newPromiseAndCrossThreadFulfiller<Array<SocketAddress>>();
+
+    {
+      auto lock = state.lockExclusive();
+      KJ_IF_MAYBE(entry, lock->entries.find(key)) {
+        if (entry->pending) {
+          entry->waiters.add(kj::mv(paf.fulfiller));
+          return kj::mv(paf.promise);
+        } else if (now < entry->expires) {
+          KJ_IF_MAYBE(addresses, entry->addresses) {
+            return heapArray<SocketAddress>(addresses->asPtr());
+          } else {
+            return kj::cp(KJ_ASSERT_NONNULL(entry->error));
           }
         }
-        return read();
+        // Expired; look it up again.
       }
-    });
+
+      if (lock->entries.size() >= MAX_ENTRIES) evictExpired(*lock, now);
+
+      auto& entry = lock->entries.upsert(kj::heapString(key), Entry(),
+          [](Entry& existing, Entry&& replacement) { existing = kj::mv(replacement); }).value;
+      entry.host = kj::mv(host);
+      entry.service = kj::mv(service);
+      entry.portHint = portHint;
+      entry.pending = true;
+      entry.waiters.add(kj::mv(paf.fulfiller));
+
+      lock->queue.push_back(kj::mv(key));
+      if (lock->idleThreads < lock->queue.size() && lock->threadCount < MAX_THREADS) {
+        ++lock->threadCount;
+        auto thread = heap<Thread>([this]() { threadMain(); });
+        thread->detach();
+      }
+    }
+
+    return kj::mv(paf.promise);
+  }
+
+  void setTtl(Duration ttl, Duration negativeTtl) {
+    auto lock = state.lockExclusive();
+    lock->ttl = ttl;
+    lock->negativeTtl = negativeTtl;
+  }
+
+  void clear() {
+    auto lock = state.lockExclusive();
+    evictExpired(*lock, kj::maxValue);
   }
 
 private:
-  kj::Own<Thread> thread;
-  kj::Own<AsyncInputStream> input;
-  _::NetworkFilter& filter;
-  SocketAddress current;
-  kj::Vector<SocketAddress> addresses;
-  std::set<SocketAddress> alreadySeen;
-};
+  static constexpr uint MAX_THREADS = 4;
+  static constexpr size_t MAX_ENTRIES = 4096;
 
-struct SocketAddress::LookupParams {
-  kj::String host;
-  kj::String service;
-};
+  struct Entry {
+    String host;
+    String service;
+    uint portHint = 0;
 
-Promise<Array<SocketAddress>> SocketAddress::lookupHost(
-    LowLevelAsyncIoProvider& lowLevel, kj::String host, kj::String service, uint portHint,
-    _::NetworkFilter& filter) {
-  // This shitty function spawns a thread to run getaddrinfo().  Unfortunately, getaddrinfo() is
-  // the only cross-platform DNS API and it is blocking.
-  //
-  // TODO(perf):  Use a thread pool?  Maybe kj::Thread should use a thread pool automatically?
-  //   Maybe use the various platform-specific asynchronous DNS libraries?  Please do not implement
-  //   a custom DNS resolver...
+    bool pending = false;
+    // A thread is currently looking this up, and will fulfill `waiters`.
 
-  int fds[2];
-#if __linux__ && !__BIONIC__
-  KJ_SYSCALL(pipe2(fds, O_NONBLOCK | O_CLOEXEC));
-#else
-  KJ_SYSCALL(pipe(fds));
-#endif
+    Vector<Own<CrossThreadPromiseFulfiller<Array<SocketAddress>>>> waiters;
+
+    Maybe<Array<SocketAddress>> addresses;
+    Maybe<Exception> error;
+    TimePoint expires = kj::origin<TimePoint>();
+    // When not pending, exactly one of `addresses` and `error` is set.
+  };
 
-  auto input = lowLevel.wrapInputFd(fds[0], NEW_FD_FLAGS);
+  struct State {
+    HashMap<String, Entry> entries;
+    std::deque<String> queue;  // keys of entries waiting for a thread
+    uint threadCount = 0;
+    uint idleThreads = 0;
+    Duration ttl = 0 * SECONDS;
+    Duration negativeTtl = 0 * SECONDS;
+    // Caching is opt-in; see setDnsCacheTtl().
+  };
 
-  int outFd = fds[1];
+  MutexGuarded<State> state;
 
-  LookupParams params = { kj::mv(host), kj::mv(service) };
+  static void evictExpired(State& state, TimePoint now) {
+    // Removes all settled entries that have expired as of `now`.
 
-  auto thread = heap<Thread>(kj::mvCapture(params, [outFd,portHint](LookupParams&& params) {
-    FdOutputStream output((AutoCloseFd(outFd)));
+    Vector<StringPtr> expired;
+    for (auto& entry: state.entries) {
+      if (!entry.value.pending && entry.value.expires <= now) expired.add(entry.key);
+    }
+    for (auto key: expired) {
+      state.entries.erase(key);
+    }
+  }
+
+  void threadMain() {
+    for (;;) {
+      String key;
+      String host;
+      String service;
+      uint portHint;
+
+      {
+        auto lock = state.lockExclusive();
+        ++lock->idleThreads;
+        lock.wait([](const State& state) { return !state.queue.empty(); });
+        --lock->idleThreads;
+
+        key = kj::mv(lock->queue.front());
+        lock->queue.pop_front();
+
+        auto& entry = KJ_ASSERT_NONNULL(lock->entries.find(key));
+        host = kj::heapString(entry.host);
+        service = entry.service == nullptr ? String() : kj::heapString(entry.service);
+        portHint = entry.portHint;
+      }
+
+      Maybe<Array<SocketAddress>> addresses;
+      Maybe<Exception> error = kj::runCatchingExceptions([&]() {
+        addresses = getAddrInfo(host, service, portHint);
+      });
+
+      Vector<Own<CrossThreadPromiseFulfiller<Array<SocketAddress>>>> waiters;
+
+      {
+        auto lock = state.lockExclusive();
+        auto& entry = KJ_ASSERT_NONNULL(lock->entries.find(key));
+        waiters = kj::mv(entry.waiters);
+        entry.pending = false;
+        Duration ttl = error == nullptr ? lock->ttl : lock->negativeTtl;
+        entry.expires = systemCoarseMonotonicClock().now() + ttl;
+
+        // Give each waiter its own copy, since they may belong to different threads.
+        KJ_IF_MAYBE(a, addresses) {
+          for (auto& waiter: waiters) {
+            waiter->fulfill(heapArray<SocketAddress>(a->asPtr()));
+          }
+        } else {
+          for (auto& waiter: waiters) {
+            waiter->reject(kj::cp(KJ_ASSERT_NONNULL(error)));
+          }
+        }
 
+        if (ttl > 0 * SECONDS) {
+          entry.addresses = kj::mv(addresses);
+          entry.error = kj::mv(error);
+        } else {
+          // Not cached, so don't let it take up space until the next eviction.
+          lock->entries.erase(key);
+        }
+      }
+    }
+  }
+
+  static Array<SocketAddress> getAddrInfo(StringPtr host, StringPtr service, uint portHint) {
     struct addrinfo hints;
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = 0;
@@ -1223,66 +1562,89 @@ Promise<Array<SocketAddress>> SocketAddress::lookupHost(
     hints.ai_next = nullptr;
     struct addrinfo* list;
     int status = getaddrinfo(
-        params.host == "*" ? nullptr : params.host.cStr(),
-        params.service == nullptr ? nullptr : params.service.cStr(),
+        host == "*" ? nullptr : host.cStr(),
+        service == nullptr ? nullptr : service.cStr(),
         &hints, &list);
-    if (status == 0) {
-      KJ_DEFER(freeaddrinfo(list));
-
-      struct addrinfo* cur = list;
-      while (cur != nullptr) {
-        if (params.service == nullptr) {
-          switch (cur->ai_addr->sa_family) {
-            case AF_INET:
-              ((struct sockaddr_in*)cur->ai_addr)->sin_port = htons(portHint);
-              break;
-            case AF_INET6:
-              ((struct sockaddr_in6*)cur->ai_addr)->sin6_port = htons(portHint);
-              break;
-            default:
-              break;
-          }
-        }
+    if (status == EAI_SYSTEM) {
+      KJ_FAIL_SYSCALL("getaddrinfo", errno, host, service);
+    } else if (status != 0) {
+      KJ_FAIL_REQUIRE("DNS lookup failed.", host, service, gai_strerror(status));
+    }
+    KJ_DEFER(freeaddrinfo(list));
 
-        SocketAddress addr;
-        if (params.host == "*") {
-          // Set up a wildcard SocketAddress.  Only use the port number returned by getaddrinfo().
-          addr.wildcard = true;
-          addr.addrlen = sizeof(addr.addr.inet6);
-          addr.addr.inet6.sin6_family = AF_INET6;
-          switch (cur->ai_addr->sa_family) {
-            case AF_INET:
-              addr.addr.inet6.sin6_port = ((struct sockaddr_in*)cur->ai_addr)->sin_port;
-              break;
-            case AF_INET6:
-              addr.addr.inet6.sin6_port = ((struct sockaddr_in6*)cur->ai_addr)->sin6_port;
-              break;
-            default:
-              addr.addr.inet6.sin6_port = portHint;
-              break;
-          }
-        } else {
-          addr.addrlen = cur->ai_addrlen;
-          memcpy(&addr.addr.generic, cur->ai_addr, cur->ai_addrlen);
+    kj::Vector<SocketAddress> addresses;
+    std::set<SocketAddress> alreadySeen;
+
+    for (struct addrinfo* cur = list; cur != nullptr; cur = cur->ai_next) {
+      if (service == nullptr) {
+        switch (cur->ai_addr->sa_family) {
+          case AF_INET:
+            ((struct sockaddr_in*)cur->ai_addr)->sin_port = htons(portHint);
+            break;
+          case AF_INET6:
+            ((struct sockaddr_in6*)cur->ai_addr)->sin6_port = htons(portHint);
+            break;
+          default:
+            break;
         }
-        KJ_ASSERT_CAN_MEMCPY(SocketAddress);
-        output.write(&addr, sizeof(addr));
-        cur = cur->ai_next;
       }
-    } else if (status == EAI_SYSTEM) {
-      KJ_FAIL_SYSCALL("getaddrinfo", errno, params.host, params.service) {
-        return;
+
+      SocketAddress addr;
+      if (host == "*") {
+        // Set up a wildcard SocketAddress.  Only use the port number returned by getaddrinfo().
+        addr.wildcard = true;
+        addr.addrlen = sizeof(addr.addr.inet6);
+        addr.addr.inet6.sin6_family = AF_INET6;
+        switch (cur->ai_addr->sa_family) {
+          case AF_INET:
+            addr.addr.inet6.sin6_port = ((struct sockaddr_in*)cur->ai_addr)->sin_port;
+            break;
+          case AF_INET6:
+            addr.addr.inet6.sin6_port = ((struct sockaddr_in6*)cur->ai_addr)->sin6_port;
+            break;
+          default:
+            addr.addr.inet6.sin6_port = portHint;
+            break;
+        }
+      } else {
+        addr.addrlen = cur->ai_addrlen;
+        memcpy(&addr.addr.generic, cur->ai_addr, cur->ai_addrlen);
       }
-    } else {
-      KJ_FAIL_REQUIRE("DNS lookup failed.",
-                      params.host, params.service, gai_strerror(status)) {
-        return;
+
+      // getaddrinfo() can return multiple copies of the same address for several reasons.
+      // A major one is that we don't give it a socket type (SOCK_STREAM vs. SOCK_DGRAM), so
+      // it may return two copies of the same address, one for each type, unless it explicitly
+      // knows that the service name given is specific to one type.  But we can't tell it a type,
+      // because we don't actually know which one the user wants, and if we specify SOCK_STREAM
+      // while the user specified a UDP service name then they'll get a resolution error which
+      // is lame.  (At least, I think that's how it works.)
+      //
+      // So we instead resort to de-duping results.
+      if (alreadySeen.insert(addr).second) {
+        addresses.add(addr);
       }
     }
-  }));
 
-  auto reader = heap<LookupReader>(kj::mv(thread), kj::mv(input), filter);
-  return reader->read().attach(kj::mv(reader));
+    return addresses.releaseAsArray();
+  }
+};
+
+Promise<Array<SocketAddress>> SocketAddress::lookupHost(
+    LowLevelAsyncIoProvider& lowLevel, kj::String host, kj::String service, uint portHint,
+    _::NetworkFilter& filter) {
+  return Resolver::instance().lookup(kj::mv(host), kj::mv(service), portHint)
+      .then([&filter](Array<SocketAddress> all) {
+    kj::Vector<SocketAddress> addresses(all.size());
+    for (auto& addr: all) {
+      if (addr.parseAllowedBy(filter)) {
+        addresses.add(addr);
+      }
+    }
+    // getaddrinfo()'s docs seem to say it will never return an empty list, but let's check
+    // anyway.
+    KJ_REQUIRE(addresses.size() > 0, "DNS lookup returned no permitted addresses.") { break; }
+    return addresses.releaseAsArray();
+  });
 }
 
 // =======================================================================================
@@ -1422,6 +1784,10 @@ public:
   Promise<size_t> send(const void* buffer, size_t size, NetworkAddress& destination) override;
   Promise<size_t> send(
       ArrayPtr<const ArrayPtr<const byte>> pieces, NetworkAddress& destination) override;
+#if __linux__
+  Promise<void> sendBatch(ArrayPtr<const ArrayPtr<const byte>> datagrams,
+                          NetworkAddress& destination) override;
+#endif
 
   class ReceiverImpl;
 
@@ -1445,6 +1811,12 @@ public:
   UnixEventPort& eventPort;
   LowLevelAsyncIoProvider::NetworkFilter& filter;
   UnixEventPort::FdObserver observer;
+
+#if __linux__
+private:
+  bool gsoAvailable = true;
+  // Cleared the first time the kernel or the network device tells us it can't do UDP_SEGMENT.
+#endif
 };
 
 class LowLevelAsyncIoProviderImpl final: public LowLevelAsyncIoProvider {
@@ -1544,6 +1916,18 @@ public:
   }
 
   Own<ConnectionReceiver> listen() override {
+    return listenImpl(false);
+  }
+
+  Own<ConnectionReceiver> listenShared() override {
+#ifdef SO_REUSEPORT
+    return listenImpl(true);
+#else
+    KJ_UNIMPLEMENTED("SO_REUSEPORT not supported on this platform");
+#endif
+  }
+
+  Own<ConnectionReceiver> listenImpl(bool shared) {
     auto makeReceiver = [&](SocketAddress& addr) {
       int fd = addr.socket(SOCK_STREAM);
 
@@ -1555,6 +1939,12 @@ public:
         int optval = 1;
         KJ_SYSCALL(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)));
 
+#ifdef SO_REUSEPORT
+        if (shared) {
+          KJ_SYSCALL(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)));
+        }
+#endif
+
         addr.bind(fd);
 
         // TODO(someday):  Let queue size be specified explicitly in string addresses.
@@ -1819,91 +2209,228 @@ Promise<size_t> DatagramPortImpl::send(
   }
 }
 
-class DatagramPortImpl::ReceiverImpl final: public DatagramReceiver {
-public:
-  explicit ReceiverImpl(DatagramPortImpl& port, Capacity capacity)
-      : port(port),
-        contentBuffer(heapArray<byte>(capacity.content)),
-        ancillaryBuffer(capacity.ancillary > 0 ? heapArray<byte>(capacity.ancillary)
-                                               : Array<byte>(nullptr)) {}
+#if __linux__
 
-  Promise<void> receive() override {
-    struct msghdr msg;
-    memset(&msg, 0, sizeof(msg));
+// Limits on a single UDP_SEGMENT send. The kernel accepts up to 64 segments on all versions that
+// support the option (newer ones accept 128), and the whole buffer must fit in one IP packet.
+static constexpr size_t MAX_GSO_SEGMENTS = 64;
+static constexpr size_t MAX_GSO_BYTES = 65507;
 
-    struct sockaddr_storage addr;
-    memset(&addr, 0, sizeof(addr));
-    msg.msg_name = &addr;
-    msg.msg_namelen = sizeof(addr);
+// Maximum number of datagrams to pass to one sendmmsg() call.
+static constexpr size_t MAX_SENDMMSG_BATCH = 64;
 
-    struct iovec iov;
-    iov.iov_base = contentBuffer.begin();
-    iov.iov_len = contentBuffer.size();
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = ancillaryBuffer.begin();
-    msg.msg_controllen = ancillaryBuffer.size();
+static size_t gsoRunLength(ArrayPtr<const ArrayPtr<const byte>> datagrams) {
+  // Returns how many datagrams at the start of `datagrams` can be sent as one UDP_SEGMENT
+  // buffer: they must all be the same size, except that the last may be shorter.
 
-    ssize_t n;
-    KJ_NONBLOCKING_SYSCALL(n = recvmsg(port.fd, &msg, 0));
+  size_t segmentSize = datagrams[0].size();
+  if (segmentSize == 0) return 1;
 
-    if (n < 0) {
-      // No data available. Wait.
-      return port.observer.whenBecomesReadable().then([this]() {
-        return receive();
-      });
-    } else {
-      if (!port.filter.shouldAllow(reinterpret_cast<const struct sockaddr*>(msg.msg_name),
-                                   msg.msg_namelen)) {
-        // Ignore message from disallowed source.
-        return receive();
+  size_t total = 0;
+  size_t i = 0;
+  while (i < datagrams.size() && i < MAX_GSO_SEGMENTS) {
+    size_t size = datagrams[i].size();
+    if (size == 0 || size > segmentSize || total + size > MAX_GSO_BYTES) break;
+    total += size;
+    ++i;
+    if (size < segmentSize) break;  // a short datagram can only end the run
+  }
+  return i;
+}
+
+Promise<void> DatagramPortImpl::sendBatch(
+    ArrayPtr<const ArrayPtr<const byte>> datagrams, NetworkAddress& destination) {
+  auto& addr = downcast<NetworkAddressImpl>(destination).chooseOneAddress();
+  void* name = const_cast<void*>(implicitCast<const void*>(addr.getRaw()));
+  socklen_t nameLength = addr.getRawSize();
+
+  // Number of datagrams at the front of `datagrams` that must not use GSO, because the kernel
+  // rejected them as a GSO run.
+  size_t noGsoCount = 0;
+
+  while (datagrams.size() > 0) {
+#ifdef UDP_SEGMENT
+    size_t run = gsoAvailable && noGsoCount == 0 ? gsoRunLength(datagrams) : 0;
+    if (run > 1) {
+      KJ_STACK_ARRAY(struct iovec, iov, run, 16, MAX_GSO_SEGMENTS);
+      for (size_t i: kj::indices(iov)) {
+        iov[i].iov_base = const_cast<byte*>(datagrams[i].begin());
+        iov[i].iov_len = datagrams[i].size();
       }
 
-      receivedSize = n;
-      contentTruncated = msg.msg_flags & MSG_TRUNC;
+      union {
+        struct cmsghdr align;
+        byte bytes[CMSG_SPACE(sizeof(uint16_t))];
+      } control;
+      memset(&control, 0, sizeof(control));
 
-      source.emplace(port.lowLevel, port.filter, msg.msg_name, msg.msg_namelen);
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_name = name;
+      msg.msg_namelen = nameLength;
+      msg.msg_iov = iov.begin();
+      msg.msg_iovlen = iov.size();
+      msg.msg_control = control.bytes;
+      msg.msg_controllen = sizeof(control.bytes);
 
-      ancillaryList.resize(0);
-      ancillaryTruncated = msg.msg_flags & MSG_CTRUNC;
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t segmentSize = datagrams[0].size();
+      memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
 
-      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
-           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-        // On some platforms (OSX), a cmsghdr's length may cross the end of the ancillary buffer
-        // when truncated. On other platforms (Linux) the length in cmsghdr will itself be
-        // truncated to fit within the buffer.
+      KJ_SYSCALL_HANDLE_ERRORS(sendmsg(fd, &msg, 0)) {
+        case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+        case EWOULDBLOCK:
+#endif
+          return observer.whenBecomesWritable().then([this, datagrams, &destination]() {
+            return sendBatch(datagrams, destination);
+          });
+        case EIO:
+        case ENOPROTOOPT:
+        case EOPNOTSUPP:
+          // The kernel or the outgoing device can't segment for us. Don't try again.
+          gsoAvailable = false;
+          continue;
+        case EINVAL:
+        case EMSGSIZE:
+          // This particular run can't be segmented, e.g. because the segments are larger than
+          // the path MTU allows. Send it the slow way.
+          noGsoCount = run;
+          continue;
+        default:
+          KJ_FAIL_SYSCALL("sendmsg(UDP_SEGMENT)", error) { return READY_NOW; }
+      }
 
-#if __APPLE__
-// On MacOS, `CMSG_SPACE(0)` triggers a bogus warning.
-#pragma GCC diagnostic ignored "-Wnull-pointer-arithmetic"
+      datagrams = datagrams.slice(run, datagrams.size());
+      continue;
+    }
 #endif
-        const byte* pos = reinterpret_cast<const byte*>(cmsg);
-        size_t available = ancillaryBuffer.end() - pos;
-        if (available < CMSG_SPACE(0)) {
-          // The buffer ends in the middle of the header. We can't use this message.
-          // (On Linux, this never happens, because the message is not included if there isn't
-          // space for a header. I'm not sure how other systems behave, though, so let's be safe.)
+
+    size_t count = kj::min(datagrams.size(), MAX_SENDMMSG_BATCH);
+    if (noGsoCount > 0) count = kj::min(count, noGsoCount);
+    KJ_STACK_ARRAY(struct mmsghdr, msgs, count, 16, MAX_SENDMMSG_BATCH);
+    KJ_STACK_ARRAY(struct iovec, iov, count, 16, MAX_SENDMMSG_BATCH);
+    memset(msgs.begin(), 0, msgs.size() * sizeof(msgs[0]));
+    for (size_t i: kj::indices(msgs)) {
+      iov[i].iov_base = const_cast<byte*>(datagrams[i].begin());
+      iov[i].iov_len = datagrams[i].size();
+      msgs[i].msg_hdr.msg_name = name;
+      msgs[i].msg_hdr.msg_namelen = nameLength;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n;
+    KJ_NONBLOCKING_SYSCALL(n = sendmmsg(fd, msgs.begin(), msgs.size(), 0));
+    if (n < 0) {
+      // Write buffer full.
+      return observer.whenBecomesWritable().then([this, datagrams, &destination]() {
+        return sendBatch(datagrams, destination);
+      });
+    }
+
+    datagrams = datagrams.slice(n, datagrams.size());
+    noGsoCount -= kj::min(noGsoCount, size_t(n));
+  }
+
+  return READY_NOW;
+}
+
+#endif  // __linux__
+
+class DatagramPortImpl::ReceiverImpl final: public DatagramReceiver {
+public:
+  explicit ReceiverImpl(DatagramPortImpl& port, Capacity capacity)
+      : port(port) {
+#if __linux__
+    size_t batch = kj::max(capacity.batch, size_t(1));
+#else
+    // No recvmmsg() here; receive one datagram at a time.
+    size_t batch = 1;
+#endif
+
+#if __linux__ && defined(UDP_GRO)
+    if (capacity.coalesce) {
+      int one = 1;
+      KJ_SYSCALL_HANDLE_ERRORS(::setsockopt(port.fd, SOL_UDP, UDP_GRO, &one, sizeof(one))) {
+        case ENOPROTOOPT:
+          // Kernel too old. The application will just get one datagram per buffer, which is
+          // what it sees anyway.
           break;
-        }
+        default:
+          KJ_FAIL_SYSCALL("setsockopt(UDP_GRO)", error);
+      } else {
+        // Make room for the segment size message, which we consume ourselves.
+        coalescing = true;
+        capacity.ancillary += CMSG_SPACE(sizeof(int));
+      }
+    }
+#endif
 
-        // OK, we know the cmsghdr is valid, at least.
+    slots = heapArray<Slot>(batch);
+    for (auto& slot: slots) {
+      slot.content = heapArray<byte>(capacity.content);
+      if (capacity.ancillary > 0) slot.ancillary = heapArray<byte>(capacity.ancillary);
+    }
+  }
 
-        // Find the start of the message payload.
-        const byte* begin = (const byte *)CMSG_DATA(cmsg);
+  Promise<void> receive() override {
+    if (nextDatagram()) return READY_NOW;
+
+    for (auto& slot: slots) slot.reset();
 
-        // Cap the message length to the available space.
-        const byte* end = pos + kj::min(available, cmsg->cmsg_len);
+    int n;
+#if __linux__
+    if (slots.size() > 1) {
+      KJ_STACK_ARRAY(struct mmsghdr, msgs, slots.size(), 16, 64);
+      for (size_t i: kj::indices(slots)) {
+        msgs[i].msg_hdr = slots[i].msg;
+        msgs[i].msg_len = 0;
+      }
 
-        ancillaryList.add(AncillaryMessage(
-            cmsg->cmsg_level, cmsg->cmsg_type, arrayPtr(begin, end)));
+      KJ_NONBLOCKING_SYSCALL(n = recvmmsg(port.fd, msgs.begin(), msgs.size(), 0, nullptr));
+
+      for (int i = 0; i < n; i++) {
+        slots[i].msg = msgs[i].msg_hdr;
+        slots[i].size = msgs[i].msg_len;
+      }
+    } else
+#endif
+    {
+      ssize_t size;
+      KJ_NONBLOCKING_SYSCALL(size = recvmsg(port.fd, &slots[0].msg, 0));
+      if (size < 0) {
+        n = -1;
+      } else {
+        n = 1;
+        slots[0].size = size;
       }
+    }
 
+    if (n < 0) {
+      // No data available. Wait.
+      return port.observer.whenBecomesReadable().then([this]() {
+        return receive();
+      });
+    }
+
+    slotCount = n;
+    currentSlot = 0;
+    slotOffset = nullptr;
+
+    if (nextDatagram()) {
       return READY_NOW;
+    } else {
+      // Every message came from a disallowed source.
+      return receive();
     }
   }
 
   MaybeTruncated<ArrayPtr<const byte>> getContent() override {
-    return { contentBuffer.slice(0, receivedSize), contentTruncated };
+    return { content, contentTruncated };
   }
 
   MaybeTruncated<ArrayPtr<const AncillaryMessage>> getAncillary() override {
@@ -1915,11 +2442,48 @@ public:
   }
 
 private:
+  struct Slot {
+    // Buffers for one message received by recvmsg() or one element of a recvmmsg() batch.
+
+    Array<byte> content;
+    Array<byte> ancillary;
+    struct sockaddr_storage addr;
+    struct iovec iov;
+    struct msghdr msg;
+    size_t size = 0;
+
+    void reset() {
+      memset(&addr, 0, sizeof(addr));
+      iov.iov_base = content.begin();
+      iov.iov_len = content.size();
+
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_name = &addr;
+      msg.msg_namelen = sizeof(addr);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = ancillary.begin();
+      msg.msg_controllen = ancillary.size();
+      size = 0;
+    }
+  };
+
   DatagramPortImpl& port;
-  Array<byte> contentBuffer;
-  Array<byte> ancillaryBuffer;
+  Array<Slot> slots;
+  bool coalescing = false;
+
+  size_t slotCount = 0;
+  size_t currentSlot = 0;
+  Maybe<size_t> slotOffset;
+  // Position in the most recent batch: the slot being handed out, and how far into its content
+  // we've gotten (null if it hasn't been looked at yet). With UDP_GRO one slot can hold many
+  // datagrams.
+
+  size_t segmentSize = 0;
+  // Size of each datagram in the current slot, if the kernel coalesced several into it, else 0.
+
+  ArrayPtr<const byte> content;
   Vector<AncillaryMessage> ancillaryList;
-  size_t receivedSize = 0;
   bool contentTruncated = false;
   bool ancillaryTruncated = false;
 
@@ -1934,6 +2498,99 @@ private:
   };
 
   kj::Maybe<StoredAddress> source;
+
+  bool nextDatagram() {
+    // Advances to the next datagram in the current batch, if any, and makes it current. Returns
+    // false if the batch is used up.
+
+    while (currentSlot < slotCount) {
+      auto& slot = slots[currentSlot];
+
+      size_t offset;
+      KJ_IF_MAYBE(o, slotOffset) {
+        offset = *o;
+      } else {
+        if (!port.filter.shouldAllow(reinterpret_cast<const struct sockaddr*>(slot.msg.msg_name),
+                                     slot.msg.msg_namelen)) {
+          // Ignore message from disallowed source.
+          ++currentSlot;
+          continue;
+        }
+        startSlot(slot);
+        offset = 0;
+      }
+
+      size_t end = segmentSize == 0 ? slot.size : kj::min(slot.size, offset + segmentSize);
+      content = slot.content.slice(offset, end);
+
+      if (end < slot.size) {
+        slotOffset = end;
+        contentTruncated = false;
+      } else {
+        // Last (or only) datagram in this slot. If the kernel cut off the buffer, this is the
+        // one that's missing data.
+        contentTruncated = slot.msg.msg_flags & MSG_TRUNC;
+        slotOffset = nullptr;
+        ++currentSlot;
+      }
+      return true;
+    }
+
+    return false;
+  }
+
+  void startSlot(Slot& slot) {
+    // Parses the address and ancillary data of a newly-received slot.
+
+    source.emplace(port.lowLevel, port.filter, slot.msg.msg_name, slot.msg.msg_namelen);
+
+    segmentSize = 0;
+    ancillaryList.resize(0);
+    ancillaryTruncated = slot.msg.msg_flags & MSG_CTRUNC;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&slot.msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&slot.msg, cmsg)) {
+      // On some platforms (OSX), a cmsghdr's length may cross the end of the ancillary buffer
+      // when truncated. On other platforms (Linux) the length in cmsghdr will itself be
+      // truncated to fit within the buffer.
+
+#if __APPLE__
+// On MacOS, `CMSG_SPACE(0)` triggers a bogus warning.
+#pragma GCC diagnostic ignored "-Wnull-pointer-arithmetic"
+#endif
+      const byte* pos = reinterpret_cast<const byte*>(cmsg);
+      size_t available = slot.ancillary.end() - pos;
+      if (available < CMSG_SPACE(0)) {
+        // The buffer ends in the middle of the header. We can't use this message.
+        // (On Linux, this never happens, because the message is not included if there isn't
+        // space for a header. I'm not sure how other systems behave, though, so let's be safe.)
+        break;
+      }
+
+      // OK, we know the cmsghdr is valid, at least.
+
+      // Find the start of the message payload.
+      const byte* begin = (const byte *)CMSG_DATA(cmsg);
+
+      // Cap the message length to the available space.
+      const byte* end = pos + kj::min(available, cmsg->cmsg_len);
+
+#if __linux__ && defined(UDP_GRO)
+      if (coalescing && cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO &&
+          size_t(end - begin) >= sizeof(int)) {
+        // The kernel coalesced several datagrams into this buffer; this says how to split them.
+        // It's our business, not the application's.
+        int size;
+        memcpy(&size, begin, sizeof(size));
+        if (size > 0) segmentSize = size;
+        continue;
+      }
+#endif
+
+      ancillaryList.add(AncillaryMessage(
+          cmsg->cmsg_level, cmsg->cmsg_type, arrayPtr(begin, end)));
+    }
+  }
 };
 
 Own<DatagramReceiver> DatagramPortImpl::makeReceiver(DatagramReceiver::Capacity capacity) {
@@ -2028,6 +2685,14 @@ Own<AsyncIoProvider> newAsyncIoProvider(LowLevelAsyncIoProvider& lowLevel) {
   return kj::heap<AsyncIoProviderImpl>(lowLevel);
 }
 
+void setDnsCacheTtl(Duration ttl, Duration negativeTtl) {
+  SocketAddress::Resolver::instance().setTtl(ttl, negativeTtl);
+}
+
+void clearDnsCache() {
+  SocketAddress::Resolver::instance().clear();
+}
+
 AsyncIoContext setupAsyncIo() {
   auto lowLevel = heap<LowLevelAsyncIoProviderImpl>();
   auto ioProvider = kj::heap<AsyncIoProviderImpl>(*lowLevel);
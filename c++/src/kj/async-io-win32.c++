@@ -22,6 +22,17 @@
 #if _WIN32
 // For Unix implementation, see async-io-unix.c++.
 
+#if KJ_USE_WIN32_RIO
+// Registered I/O is declared for Windows 8 and up. We still check for it at runtime, and fall back
+// to overlapped I/O without it.
+#ifndef WINVER
+#define WINVER 0x0602
+#endif
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0602
+#endif
+#endif
+
 // Request Vista-level APIs.
 #include "win32-api-version.h"
 
@@ -192,6 +203,36 @@ namespace {
 
 static constexpr uint NEW_FD_FLAGS = LowLevelAsyncIoProvider::TAKE_OWNERSHIP;
 
+#if KJ_USE_WIN32_RIO
+const RIO_EXTENSION_FUNCTION_TABLE* getRio() {
+  // Returns the Registered I/O functions, or null if the system doesn't support them (before
+  // Windows 8, or on Wine).
+
+  static const RIO_EXTENSION_FUNCTION_TABLE* result =
+      []() -> const RIO_EXTENSION_FUNCTION_TABLE* {
+    _::initWinsockOnce();
+
+    SOCKET probe = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0,
+                             WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO);
+    if (probe == INVALID_SOCKET) return nullptr;
+    KJ_DEFER(closesocket(probe));
+
+    static RIO_EXTENSION_FUNCTION_TABLE table;
+    memset(&table, 0, sizeof(table));
+    table.cbSize = sizeof(table);
+    GUID guid = WSAID_MULTIPLE_RIO;
+    DWORD n = 0;
+    if (WSAIoctl(probe, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid),
+                 &table, sizeof(table), &n, NULL, NULL) != 0) {
+      return nullptr;
+    }
+    return &table;
+  }();
+
+  return result;
+}
+#endif
+
 class OwnedFd {
 public:
   OwnedFd(SOCKET fd, uint flags): fd(fd), flags(flags) {
@@ -452,6 +493,417 @@ private:
   }
 };
 
+#if KJ_USE_WIN32_RIO
+// =======================================================================================
+// Registered I/O
+//
+// With Registered I/O, sockets send and receive out of buffers registered with the kernel ahead
+// of time, so the kernel doesn't have to pin and unpin the caller's memory on every operation,
+// and completions are reaped from a shared queue in batches rather than one IOCP event each.
+// Each event loop gets one RioQueue, holding a pool of registered buffers and a completion queue
+// that notifies the loop through its IOCP. Streams copy data between the caller's buffers and the
+// registered ones.
+
+class RioQueue final: private Win32IocpEventPort::CompletionHandler {
+public:
+  static constexpr uint SLOT_COUNT = 256;
+  static constexpr size_t SLOT_SIZE = 16384;
+  // The registered buffer pool is divided into slots, each lent to one request at a time.
+
+  static constexpr uint SEND_DEPTH = 8;
+  // Sends each stream may have outstanding.
+
+  struct Result {
+    LONG status;
+    ULONG bytes;
+  };
+
+  class Lease {
+    // A borrowed slot. The slot is returned once the lease is dropped and any request using it
+    // has completed.
+
+  public:
+    Lease(RioQueue& queue, uint index): queue(queue), index(index) {}
+    ~Lease() noexcept(false) { queue.release(index); }
+    KJ_DISALLOW_COPY(Lease);
+
+    ArrayPtr<byte> buffer() {
+      return arrayPtr(queue.buffers + index * SLOT_SIZE, SLOT_SIZE);
+    }
+
+  private:
+    RioQueue& queue;
+    uint index;
+    friend class RioQueue;
+  };
+
+  explicit RioQueue(Win32IocpEventPort& eventPort)
+      : eventPort(eventPort), rio(KJ_ASSERT_NONNULL(getRio())) {
+    memset(&overlapped, 0, sizeof(overlapped));
+
+    KJ_WIN32(buffers = reinterpret_cast<byte*>(VirtualAlloc(
+        NULL, SLOT_COUNT * SLOT_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)));
+    KJ_ON_SCOPE_FAILURE(VirtualFree(buffers, 0, MEM_RELEASE));
+
+    bufferId = rio.RIORegisterBuffer(reinterpret_cast<PCHAR>(buffers), SLOT_COUNT * SLOT_SIZE);
+    if (bufferId == RIO_INVALID_BUFFERID) {
+      KJ_FAIL_WIN32("RIORegisterBuffer()", WSAGetLastError());
+    }
+    KJ_ON_SCOPE_FAILURE(rio.RIODeregisterBuffer(bufferId));
+
+    RIO_NOTIFICATION_COMPLETION notification;
+    memset(&notification, 0, sizeof(notification));
+    notification.Type = RIO_IOCP_COMPLETION;
+    notification.Iocp.IocpHandle = eventPort.getIocpHandle();
+    notification.Iocp.CompletionKey = reinterpret_cast<PVOID>(
+        Win32IocpEventPort::completionKeyFor(*this));
+    notification.Iocp.Overlapped = &overlapped;
+
+    cq = rio.RIOCreateCompletionQueue(capacity, &notification);
+    if (cq == RIO_INVALID_CQ) {
+      KJ_FAIL_WIN32("RIOCreateCompletionQueue()", WSAGetLastError());
+    }
+    KJ_ON_SCOPE_FAILURE(rio.RIOCloseCompletionQueue(cq));
+
+    for (uint i = 0; i < SLOT_COUNT; i++) {
+      slots[i].nextFree = i + 1 < SLOT_COUNT ? i + 1 : NO_SLOT;
+    }
+    firstFree = 0;
+
+    notify();
+  }
+
+  ~RioQueue() noexcept(false) {
+    // Requests still in flight write to our buffers, and their completions would be delivered to
+    // us. The streams have closed their sockets by now, which aborts the requests, so wait for
+    // the completions to drain.
+    while (inFlight > 0) {
+      eventPort.wait();
+    }
+
+    rio.RIOCloseCompletionQueue(cq);
+    rio.RIODeregisterBuffer(bufferId);
+    KJ_WIN32(VirtualFree(buffers, 0, MEM_RELEASE)) { break; }
+  }
+
+  KJ_DISALLOW_COPY(RioQueue);
+
+  RIO_RQ newRequestQueue(SOCKET fd) {
+    // Creates the request queue for a socket, growing the completion queue to have room for its
+    // completions. Call releaseRequestQueue() when the socket is closed.
+
+    static constexpr uint ENTRIES_PER_QUEUE = 1 + SEND_DEPTH;
+
+    if (reserved + ENTRIES_PER_QUEUE > capacity) {
+      DWORD newCapacity = kj::max(capacity * 2, reserved + ENTRIES_PER_QUEUE);
+      if (!rio.RIOResizeCompletionQueue(cq, newCapacity)) {
+        KJ_FAIL_WIN32("RIOResizeCompletionQueue()", WSAGetLastError(), newCapacity);
+      }
+      capacity = newCapacity;
+    }
+
+    RIO_RQ rq = rio.RIOCreateRequestQueue(fd, 1, 1, SEND_DEPTH, 1, cq, cq, NULL);
+    if (rq == RIO_INVALID_RQ) {
+      KJ_FAIL_WIN32("RIOCreateRequestQueue()", WSAGetLastError());
+    }
+    reserved += ENTRIES_PER_QUEUE;
+    return rq;
+  }
+
+  void releaseRequestQueue() {
+    // Completions for the closed socket's aborted requests may still be queued, but the
+    // completion queue never shrinks, so there's still room for them.
+    reserved -= 1 + SEND_DEPTH;
+  }
+
+  Maybe<Own<Lease>> tryAcquire() {
+    if (firstFree == NO_SLOT) return nullptr;
+
+    uint index = firstFree;
+    firstFree = slots[index].nextFree;
+    slots[index].leased = true;
+    return heap<Lease>(*this, index);
+  }
+
+  Promise<void> whenSlotFree() {
+    auto paf = newPromiseAndFulfiller<void>();
+    slotWaiters.add(kj::mv(paf.fulfiller));
+    return kj::mv(paf.promise);
+  }
+
+  Promise<Result> receive(RIO_RQ rq, Lease& lease, size_t size) {
+    RIO_BUF buf = bufFor(lease, size);
+    if (!rio.RIOReceive(rq, &buf, 1, 0, contextFor(lease))) {
+      KJ_FAIL_WIN32("RIOReceive()", WSAGetLastError());
+    }
+    return started(lease);
+  }
+
+  Promise<Result> send(RIO_RQ rq, Lease& lease, size_t size) {
+    // The send is deferred until commitSends().
+
+    RIO_BUF buf = bufFor(lease, size);
+    if (!rio.RIOSend(rq, &buf, 1, RIO_MSG_DEFER, contextFor(lease))) {
+      KJ_FAIL_WIN32("RIOSend()", WSAGetLastError());
+    }
+    return started(lease);
+  }
+
+  void commitSends(RIO_RQ rq) {
+    if (!rio.RIOSend(rq, NULL, 0, RIO_MSG_COMMIT_ONLY, NULL)) {
+      KJ_FAIL_WIN32("RIOSend()", WSAGetLastError());
+    }
+  }
+
+private:
+  static constexpr uint NO_SLOT = kj::maxValue;
+
+  struct Slot {
+    bool leased = false;
+    Own<PromiseFulfiller<Result>> fulfiller;
+    // Non-null while a request using the slot is in flight.
+
+    uint nextFree = NO_SLOT;
+  };
+
+  Win32IocpEventPort& eventPort;
+  const RIO_EXTENSION_FUNCTION_TABLE& rio;
+
+  byte* buffers = nullptr;
+  RIO_BUFFERID bufferId = RIO_INVALID_BUFFERID;
+
+  RIO_CQ cq = RIO_INVALID_CQ;
+  DWORD capacity = 1024;
+  DWORD reserved = 0;
+  OVERLAPPED overlapped;
+
+  Slot slots[SLOT_COUNT];
+  uint firstFree = NO_SLOT;
+  uint inFlight = 0;
+  Vector<Own<PromiseFulfiller<void>>> slotWaiters;
+
+  RIO_BUF bufFor(Lease& lease, size_t size) {
+    KJ_REQUIRE(size <= SLOT_SIZE);
+    RIO_BUF buf;
+    buf.BufferId = bufferId;
+    buf.Offset = lease.index * SLOT_SIZE;
+    buf.Length = size;
+    return buf;
+  }
+
+  static PVOID contextFor(Lease& lease) {
+    return reinterpret_cast<PVOID>(static_cast<uintptr_t>(lease.index));
+  }
+
+  Promise<Result> started(Lease& lease) {
+    auto paf = newPromiseAndFulfiller<Result>();
+    slots[lease.index].fulfiller = kj::mv(paf.fulfiller);
+    ++inFlight;
+    return kj::mv(paf.promise);
+  }
+
+  void release(uint index) {
+    auto& slot = slots[index];
+    slot.leased = false;
+    if (slot.fulfiller.get() == nullptr) {
+      freeSlot(index);
+    }
+  }
+
+  void freeSlot(uint index) {
+    slots[index].nextFree = firstFree;
+    firstFree = index;
+
+    for (auto& waiter: slotWaiters) {
+      waiter->fulfill();
+    }
+    slotWaiters.clear();
+  }
+
+  void notify() {
+    // Arranges for the next completion to be delivered to complete() through the IOCP.
+    int error = rio.RIONotify(cq);
+    if (error != ERROR_SUCCESS) {
+      KJ_FAIL_WIN32("RIONotify()", error);
+    }
+  }
+
+  void complete(LPOVERLAPPED, Win32EventPort::IoResult) override {
+    RIORESULT results[64];
+    for (;;) {
+      ULONG count = rio.RIODequeueCompletion(cq, results, kj::size(results));
+      KJ_ASSERT(count != RIO_CORRUPT_CQ, "Registered I/O completion queue is corrupt");
+
+      for (auto& result: arrayPtr(results, count)) {
+        uint index = static_cast<uint>(result.RequestContext);
+        auto& slot = slots[index];
+        auto fulfiller = kj::mv(slot.fulfiller);
+        --inFlight;
+
+        fulfiller->fulfill(Result { result.Status, result.BytesTransferred });
+        if (!slot.leased) {
+          freeSlot(index);
+        }
+      }
+
+      if (count < kj::size(results)) break;
+    }
+
+    notify();
+  }
+};
+
+class RioStream final: public AsyncStreamFd {
+  // A TCP stream using Registered I/O. Connecting, shutdown, and socket options work as for
+  // any AsyncStreamFd.
+
+public:
+  RioStream(Win32EventPort& eventPort, RioQueue& queue, SOCKET fd, uint flags)
+      : AsyncStreamFd(eventPort, fd, flags), queue(queue) {}
+  ~RioStream() noexcept(false) {
+    if (rq != RIO_INVALID_RQ) {
+      queue.releaseRequestQueue();
+    }
+  }
+
+  Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    return tryReadInternal(reinterpret_cast<byte*>(buffer), minBytes, maxBytes, 0);
+  }
+
+  Promise<void> write(const void* buffer, size_t size) override {
+    return writeInternal(arrayPtr(reinterpret_cast<const byte*>(buffer), size), nullptr);
+  }
+
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    if (pieces.size() == 0) return READY_NOW;
+    return writeInternal(pieces[0], pieces.slice(1, pieces.size()));
+  }
+
+private:
+  RioQueue& queue;
+  RIO_RQ rq = RIO_INVALID_RQ;
+
+  RIO_RQ getRequestQueue() {
+    // Created on first use, since a socket being accepted or connected isn't ready for it yet.
+    if (rq == RIO_INVALID_RQ) {
+      rq = queue.newRequestQueue(fd);
+    }
+    return rq;
+  }
+
+  Promise<size_t> tryReadInternal(byte* buffer, size_t minBytes, size_t maxBytes,
+                                  size_t alreadyRead) {
+    // As in AsyncStreamFd::tryReadInternal(), `alreadyRead` bytes have already been received,
+    // and `buffer`, `minBytes`, and `maxBytes` adjusted for them.
+
+    Own<RioQueue::Lease> lease;
+    KJ_IF_MAYBE(l, queue.tryAcquire()) {
+      lease = kj::mv(*l);
+    } else {
+      return queue.whenSlotFree().then([this,buffer,minBytes,maxBytes,alreadyRead]() {
+        return tryReadInternal(buffer, minBytes, maxBytes, alreadyRead);
+      });
+    }
+
+    auto promise = queue.receive(getRequestQueue(), *lease,
+                                 kj::min(maxBytes, size_t(RioQueue::SLOT_SIZE)));
+    return promise.then([this,buffer,minBytes,maxBytes,alreadyRead,lease = kj::mv(lease)]
+                        (RioQueue::Result result) mutable -> Promise<size_t> {
+      if (result.status != 0) {
+        if (alreadyRead > 0) {
+          // Report what we already read.
+          return alreadyRead;
+        } else {
+          KJ_FAIL_WIN32("RIOReceive()", result.status) { break; }
+          return size_t(0);
+        }
+      }
+
+      if (result.bytes == 0) {
+        return alreadyRead;
+      }
+
+      memcpy(buffer, lease->buffer().begin(), result.bytes);
+      lease = nullptr;
+
+      alreadyRead += result.bytes;
+      if (result.bytes >= minBytes) {
+        // We can stop here.
+        return alreadyRead;
+      }
+
+      return tryReadInternal(buffer + result.bytes, minBytes - result.bytes,
+                             maxBytes - result.bytes, alreadyRead);
+    });
+  }
+
+  Promise<void> writeInternal(ArrayPtr<const byte> first,
+                              ArrayPtr<const ArrayPtr<const byte>> rest) {
+    // `first` and `rest` remain valid until the promise completes.
+    //
+    // Copies the data into as many as SEND_DEPTH registered buffers, sends them all at once, and
+    // continues with the remainder once those sends complete.
+
+    while (first.size() == 0 && rest.size() > 0) {
+      first = rest[0];
+      rest = rest.slice(1, rest.size());
+    }
+    if (first.size() == 0) {
+      return READY_NOW;
+    }
+
+    auto rq = getRequestQueue();
+    auto sends = heapArrayBuilder<Promise<void>>(RioQueue::SEND_DEPTH);
+
+    while (sends.size() < RioQueue::SEND_DEPTH && first.size() > 0) {
+      Own<RioQueue::Lease> lease;
+      KJ_IF_MAYBE(l, queue.tryAcquire()) {
+        lease = kj::mv(*l);
+      } else {
+        break;
+      }
+
+      auto out = lease->buffer();
+      size_t size = 0;
+      while (size < out.size() && first.size() > 0) {
+        size_t n = kj::min(first.size(), out.size() - size);
+        memcpy(out.begin() + size, first.begin(), n);
+        first = first.slice(n, first.size());
+        size += n;
+
+        while (first.size() == 0 && rest.size() > 0) {
+          first = rest[0];
+          rest = rest.slice(1, rest.size());
+        }
+      }
+
+      sends.add(queue.send(rq, *lease, size)
+          .then([size,lease = kj::mv(lease)](RioQueue::Result result) {
+        if (result.status != 0) {
+          KJ_FAIL_WIN32("RIOSend()", result.status) { break; }
+        } else {
+          KJ_ASSERT(result.bytes == size, "short RIOSend()", result.bytes, size) { break; }
+        }
+      }));
+    }
+
+    if (sends.size() == 0) {
+      // All slots are lent out.
+      return queue.whenSlotFree().then([this,first,rest]() {
+        return writeInternal(first, rest);
+      });
+    }
+
+    queue.commitSends(rq);
+
+    return joinPromises(sends.finish()).then([this,first,rest]() {
+      return writeInternal(first, rest);
+    });
+  }
+};
+
+#endif  // KJ_USE_WIN32_RIO
+
 // =======================================================================================
 
 class SocketAddress {
@@ -479,7 +931,14 @@ public:
   SOCKET socket(int type) const {
     bool isStream = type == SOCK_STREAM;
 
+#if KJ_USE_WIN32_RIO
+    SOCKET result = usesRegisteredIo(type)
+        ? WSASocket(addr.generic.sa_family, type, 0, NULL, 0,
+                    WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO)
+        : ::socket(addr.generic.sa_family, type, 0);
+#else
     SOCKET result = ::socket(addr.generic.sa_family, type, 0);
+#endif
 
     if (result == INVALID_SOCKET) {
       KJ_FAIL_WIN32("WSASocket()", WSAGetLastError()) { return INVALID_SOCKET; }
@@ -499,6 +958,17 @@ public:
     return result;
   }
 
+  uint wrapFlags(int type) const {
+    // Flags with which to wrap a socket returned by `socket(type)`.
+
+#if KJ_USE_WIN32_RIO
+    if (usesRegisteredIo(type)) {
+      return NEW_FD_FLAGS | LowLevelAsyncIoProvider::REGISTERED_IO;
+    }
+#endif
+    return NEW_FD_FLAGS;
+  }
+
   void bind(SOCKET sockfd) const {
     if (wildcard) {
       // Disable IPV6_V6ONLY because we want to handle both ipv4 and ipv6 on this socket.  (The
@@ -723,6 +1193,15 @@ private:
 
   struct LookupParams;
   class LookupReader;
+
+#if KJ_USE_WIN32_RIO
+  bool usesRegisteredIo(int type) const {
+    // Registered I/O only works with TCP and UDP; we only implement it for TCP.
+    return type == SOCK_STREAM &&
+        (addr.generic.sa_family == AF_INET || addr.generic.sa_family == AF_INET6) &&
+        getRio() != nullptr;
+  }
+#endif
 };
 
 class SocketAddress::LookupReader {
@@ -881,9 +1360,9 @@ Promise<Array<SocketAddress>> SocketAddress::lookupHost(
 
 class FdConnectionReceiver final: public ConnectionReceiver, public OwnedFd {
 public:
-  FdConnectionReceiver(Win32EventPort& eventPort, SOCKET fd,
+  FdConnectionReceiver(LowLevelAsyncIoProvider& lowLevel, Win32EventPort& eventPort, SOCKET fd,
                        LowLevelAsyncIoProvider::NetworkFilter& filter, uint flags)
-      : OwnedFd(fd, flags), eventPort(eventPort), filter(filter),
+      : OwnedFd(fd, flags), lowLevel(lowLevel), eventPort(eventPort), filter(filter),
         observer(eventPort.observeIo(reinterpret_cast<HANDLE>(fd))),
         address(SocketAddress::getLocalAddress(fd)) {
     // In order to accept asynchronously, we need the AcceptEx() function. Apparently, we have
@@ -901,7 +1380,7 @@ public:
   Promise<Own<AsyncIoStream>> accept() override {
     SOCKET newFd = address.socket(SOCK_STREAM);
     KJ_ASSERT(newFd != INVALID_SOCKET);
-    auto result = heap<AsyncStreamFd>(eventPort, newFd, NEW_FD_FLAGS);
+    auto result = lowLevel.wrapSocketFd(newFd, address.wrapFlags(SOCK_STREAM));
 
     auto scratch = heapArray<byte>(256);
     DWORD dummy;
@@ -961,6 +1440,7 @@ public:
   }
 
 public:
+  LowLevelAsyncIoProvider& lowLevel;
   Win32EventPort& eventPort;
   LowLevelAsyncIoProvider::NetworkFilter& filter;
   Own<Win32EventPort::IoObserver> observer;
@@ -984,11 +1464,11 @@ public:
     return heap<AsyncStreamFd>(eventPort, fd, flags);
   }
   Own<AsyncIoStream> wrapSocketFd(SOCKET fd, uint flags = 0) override {
-    return heap<AsyncStreamFd>(eventPort, fd, flags);
+    return newStream(fd, flags);
   }
   Promise<Own<AsyncIoStream>> wrapConnectingSocketFd(
       SOCKET fd, const struct sockaddr* addr, uint addrlen, uint flags = 0) override {
-    auto result = heap<AsyncStreamFd>(eventPort, fd, flags);
+    auto result = newStream(fd, flags);
 
     // ConnectEx requires that the socket be bound, for some reason. Bind to an arbitrary port.
     SocketAddress::getWildcardForFamily(addr->sa_family).bind(fd);
@@ -1000,7 +1480,7 @@ public:
   }
   Own<ConnectionReceiver> wrapListenSocketFd(
       SOCKET fd, NetworkFilter& filter, uint flags = 0) override {
-    return heap<FdConnectionReceiver>(eventPort, fd, filter, flags);
+    return heap<FdConnectionReceiver>(*this, eventPort, fd, filter, flags);
   }
 
   Timer& getTimer() override { return eventPort.getTimer(); }
@@ -1011,6 +1491,28 @@ private:
   Win32IocpEventPort eventPort;
   EventLoop eventLoop;
   WaitScope waitScope;
+
+#if KJ_USE_WIN32_RIO
+  Maybe<Own<RioQueue>> rioQueue;
+  // Created when the first Registered I/O stream is.
+#endif
+
+  Own<AsyncStreamFd> newStream(SOCKET fd, uint flags) {
+#if KJ_USE_WIN32_RIO
+    if ((flags & REGISTERED_IO) && getRio() != nullptr) {
+      RioQueue* queue;
+      KJ_IF_MAYBE(q, rioQueue) {
+        queue = q->get();
+      } else {
+        auto newQueue = heap<RioQueue>(eventPort);
+        queue = newQueue.get();
+        rioQueue = kj::mv(newQueue);
+      }
+      return heap<RioStream>(eventPort, *queue, fd, flags);
+    }
+#endif
+    return heap<AsyncStreamFd>(eventPort, fd, flags);
+  }
 };
 
 // =======================================================================================
@@ -1111,7 +1613,7 @@ private:
         return KJ_EXCEPTION(FAILED, "connect() blocked by restrictPeers()");
       } else {
         return lowLevel.wrapConnectingSocketFd(
-            fd, addrs[0].getRaw(), addrs[0].getRawSize(), NEW_FD_FLAGS);
+            fd, addrs[0].getRaw(), addrs[0].getRawSize(), addrs[0].wrapFlags(SOCK_STREAM));
       }
     }).then([](Own<AsyncIoStream>&& stream) -> Promise<Own<AsyncIoStream>> {
       // Success, pass along.
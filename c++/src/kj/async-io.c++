@@ -27,9 +27,11 @@
 #include "async-io.h"
 #include "async-io-internal.h"
 #include "debug.h"
+#include "filesystem.h"
 #include "vector.h"
 #include "io.h"
 #include "one-of.h"
+#include "mutex.h"
 #include <deque>
 
 #if _WIN32
@@ -49,6 +51,12 @@
 #include <unistd.h>
 #endif
 
+#if __linux__
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace kj {
 
 Promise<void> AsyncInputStream::read(void* buffer, size_t bytes) {
@@ -112,8 +120,53 @@ private:
   byte buffer[4096];
 };
 
+class ReadableFilePump {
+public:
+  ReadableFilePump(const ReadableFile& file, AsyncOutputStream& output,
+                uint64_t offset, uint64_t limit, uint64_t doneSoFar)
+      : file(file), output(output), offset(offset), limit(limit), doneSoFar(doneSoFar) {}
+
+  Promise<uint64_t> pump() {
+    uint64_t n = kj::min(limit - doneSoFar, buffer.size());
+    if (n == 0) return doneSoFar;
+
+    size_t amount = file.read(offset + doneSoFar, buffer.slice(0, n));
+    if (amount == 0) return doneSoFar;  // EOF
+    doneSoFar += amount;
+    return output.write(buffer.begin(), amount)
+        .then([this]() {
+      return pump();
+    });
+  }
+
+private:
+  const ReadableFile& file;
+  AsyncOutputStream& output;
+  uint64_t offset;
+  uint64_t limit;
+  uint64_t doneSoFar;
+  Array<byte> buffer = heapArray<byte>(65536);
+};
+
 }  // namespace
 
+Promise<uint64_t> pumpFileTo(const ReadableFile& file, AsyncOutputStream& output,
+                             uint64_t offset, uint64_t amount) {
+  KJ_IF_MAYBE(result, output.tryPumpFromFile(file, offset, amount)) {
+    return kj::mv(*result);
+  }
+
+  return unoptimizedPumpFileTo(file, output, offset, amount);
+}
+
+Promise<uint64_t> unoptimizedPumpFileTo(
+    const ReadableFile& file, AsyncOutputStream& output, uint64_t offset, uint64_t amount,
+    uint64_t completedSoFar) {
+  auto pump = heap<ReadableFilePump>(file, output, offset, amount, completedSoFar);
+  auto promise = pump->pump();
+  return promise.attach(kj::mv(pump));
+}
+
 Promise<uint64_t> unoptimizedPumpTo(
     AsyncInputStream& input, AsyncOutputStream& output, uint64_t amount,
     uint64_t completedSoFar) {
@@ -206,6 +259,11 @@ Maybe<Promise<uint64_t>> AsyncOutputStream::tryPumpFrom(
   return nullptr;
 }
 
+Maybe<Promise<uint64_t>> AsyncOutputStream::tryPumpFromFile(
+    const ReadableFile& file, uint64_t offset, uint64_t amount) {
+  return nullptr;
+}
+
 namespace {
 
 class AsyncPipe final: public AsyncCapabilityStream, public Refcounted {
@@ -2445,6 +2503,14 @@ public:
     }
   }
 
+  kj::Maybe<int> getTransparentFd() const override {
+    KJ_IF_MAYBE(s, stream) {
+      return s->get()->getTransparentFd();
+    } else {
+      return nullptr;
+    }
+  }
+
 private:
   kj::ForkedPromise<void> promise;
   kj::Maybe<kj::Own<AsyncIoStream>> stream;
@@ -2649,6 +2715,17 @@ void ConnectionReceiver::setsockopt(int level, int option, const void* value, ui
 void ConnectionReceiver::getsockname(struct sockaddr* addr, uint* length) {
   KJ_UNIMPLEMENTED("Not a socket.") { *length = 0; break; }
 }
+Promise<void> DatagramPort::sendBatch(ArrayPtr<const ArrayPtr<const byte>> datagrams,
+                                      NetworkAddress& destination) {
+  if (datagrams.size() == 0) return READY_NOW;
+
+  auto& first = datagrams[0];
+  return send(first.begin(), first.size(), destination)
+      .then([this, datagrams, &destination](size_t) {
+    return sendBatch(datagrams.slice(1, datagrams.size()), destination);
+  });
+}
+
 void DatagramPort::getsockopt(int level, int option, void* value, uint* length) {
   KJ_UNIMPLEMENTED("Not a socket.") { *length = 0; break; }
 }
@@ -2904,6 +2981,178 @@ Own<ConnectionReceiver> newAggregateConnectionReceiver(Array<Own<ConnectionRecei
 
 // =======================================================================================
 
+Own<ConnectionReceiver> NetworkAddress::listenShared() {
+  KJ_UNIMPLEMENTED("Shared listen sockets not implemented.");
+}
+
+class ShardedListener::Shard {
+  // One thread of a ShardedListener.
+
+public:
+  Shard(ShardedListener& parent, uint index, uint count,
+        StringPtr address, uint portHint, Maybe<Array<byte>> sockaddr)
+      : parent(parent), index(index), count(count), address(address), portHint(portHint),
+        sockaddr(kj::mv(sockaddr)),
+        thread([this]() { run(); }) {
+    auto lock = state.lockExclusive();
+    lock.wait([](const State& state) { return state.ready || state.error != nullptr; });
+    KJ_IF_MAYBE(e, lock->error) {
+      kj::throwFatalException(kj::mv(*e));
+    }
+    exec = &KJ_ASSERT_NONNULL(lock->executor);
+  }
+
+  ~Shard() noexcept(false) {
+    // If the constructor threw, the thread has already exited. Otherwise, ask it to exit.
+    // `thread`'s destructor then joins it.
+    if (exec != nullptr) {
+      exec->executeSync([this]() { KJ_ASSERT_NONNULL(shutdownFulfiller)->fulfill(); });
+    }
+  }
+
+  uint getPort() { return port; }
+  Array<byte> getSockaddr() { return KJ_ASSERT_NONNULL(kj::mv(localAddress)); }
+
+private:
+  struct State {
+    bool ready = false;
+    Maybe<const Executor&> executor;
+    Maybe<Exception> error;
+  };
+
+  ShardedListener& parent;
+  uint index;
+  uint count;
+  StringPtr address;
+  uint portHint;
+  Maybe<Array<byte>> sockaddr;
+  // Exact address to listen on, from the first shard. Null for the first shard itself.
+
+  uint port = 0;
+  Maybe<Array<byte>> localAddress;
+  // Set by the thread before it reports ready.
+
+  MutexGuarded<State> state;
+  const Executor* exec = nullptr;
+  Maybe<Own<PromiseFulfiller<void>>> shutdownFulfiller;  // only accessed by the shard's thread
+  Thread thread;  // must be last, so that it is joined before the other members are destroyed
+
+  void run() {
+    KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() {
+      auto io = setupAsyncIo();
+      auto& network = io.provider->getNetwork();
+
+      Own<NetworkAddress> addr;
+      KJ_IF_MAYBE(a, sockaddr) {
+        addr = network.getSockaddr(a->begin(), a->size());
+      } else {
+        addr = network.parseAddress(address, portHint).wait(io.waitScope);
+      }
+
+      auto receiver = addr->listenShared();
+
+      if (sockaddr == nullptr) {
+        // First shard: record where we ended up, so the others can join us.
+        struct sockaddr_storage ss;
+        uint len = sizeof(ss);
+        receiver->getsockname(reinterpret_cast<struct sockaddr*>(&ss), &len);
+        localAddress = heapArray<byte>(reinterpret_cast<const byte*>(&ss), len);
+      }
+      port = receiver->getPort();
+
+      if (parent.cpuAffinity) setCpuAffinity(*receiver);
+
+      auto paf = newPromiseAndFulfiller<void>();
+      shutdownFulfiller = kj::mv(paf.fulfiller);
+
+      {
+        auto lock = state.lockExclusive();
+        lock->executor = getCurrentThreadExecutor();
+        lock->ready = true;
+      }
+
+      // Keep the event loop (and with it, our Executor) alive until we're told to shut down,
+      // even if `serve` finishes early.
+      uint index = this->index;
+      parent.serve(io, *receiver, index)
+          .then([]() -> Promise<void> {
+        return NEVER_DONE;
+      }, [index](Exception&& e) -> Promise<void> {
+        KJ_LOG(ERROR, "ShardedListener shard failed; it will accept no more connections",
+               index, e);
+        return NEVER_DONE;
+      }).exclusiveJoin(kj::mv(paf.promise)).wait(io.waitScope);
+    })) {
+      auto lock = state.lockExclusive();
+      if (lock->ready) {
+        // Can't happen: nothing after `ready` is set throws. But don't let it vanish.
+        KJ_LOG(ERROR, "ShardedListener shard failed", *e);
+      } else {
+        lock->error = kj::mv(*e);
+      }
+    }
+  }
+
+  void setCpuAffinity(ConnectionReceiver& receiver) {
+#if __linux__ && defined(SO_ATTACH_REUSEPORT_CBPF)
+    if (index == 0) {
+      // Select socket number (CPU % count) within the reuseport group. Sockets are numbered in
+      // the order they joined the group, which is shard order since shards start one at a time.
+      // The program applies to the whole group, including sockets that join later.
+      struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, count },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+      };
+      struct sock_fprog prog;
+      prog.len = kj::size(code);
+      prog.filter = code;
+      receiver.setsockopt(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    }
+
+    // Pin to the CPUs whose connections the program above sends to us, out of those we're
+    // allowed to use.
+    cpu_set_t allowed;
+    KJ_SYSCALL(sched_getaffinity(0, sizeof(allowed), &allowed));
+    cpu_set_t mine;
+    CPU_ZERO(&mine);
+    for (uint cpu = index; cpu < CPU_SETSIZE; cpu += count) {
+      if (CPU_ISSET(cpu, &allowed)) CPU_SET(cpu, &mine);
+    }
+    if (CPU_COUNT(&mine) > 0) {
+      int error = pthread_setaffinity_np(pthread_self(), sizeof(mine), &mine);
+      if (error != 0) {
+        KJ_FAIL_SYSCALL("pthread_setaffinity_np", error);
+      }
+    }
+#else
+    (void)receiver;
+#endif
+  }
+};
+
+ShardedListener::ShardedListener(StringPtr address, uint portHint, uint threadCount,
+                                 ServeFunc serve, bool cpuAffinity)
+    : serve(kj::mv(serve)), cpuAffinity(cpuAffinity) {
+  KJ_REQUIRE(threadCount > 0, "ShardedListener needs at least one thread");
+
+  // Start the shards one at a time: the first decides the exact address (and port) and the rest
+  // join its group, and with `cpuAffinity` the group's socket order must match shard order.
+  auto builder = heapArrayBuilder<Own<Shard>>(threadCount);
+  builder.add(heap<Shard>(*this, 0, threadCount, address, portHint, nullptr));
+  auto sockaddr = builder[0]->getSockaddr();
+  port = builder[0]->getPort();
+  for (uint i = 1; i < threadCount; i++) {
+    builder.add(heap<Shard>(*this, i, threadCount, address, portHint,
+                            heapArray<byte>(sockaddr.asPtr())));
+  }
+  shards = builder.finish();
+}
+
+ShardedListener::~ShardedListener() noexcept(false) {}
+
+// =======================================================================================
+
 namespace _ {  // private
 
 #if !_WIN32
@@ -44,6 +44,7 @@ class NetworkAddress;
 class AsyncOutputStream;
 class AsyncIoStream;
 class AncillaryMessage;
+class ReadableFile;
 
 // =======================================================================================
 // Streaming I/O
@@ -121,6 +122,18 @@ public:
   //
   // The default implementation always returns null.
 
+  virtual Maybe<Promise<uint64_t>> tryPumpFromFile(
+      const ReadableFile& file, uint64_t offset, uint64_t amount = kj::maxValue);
+  // Like tryPumpFrom(), but pumps from `file`, starting at `offset` and continuing for `amount`
+  // bytes or until EOF. Implements pumpFileTo(); should only be called from within an
+  // implementation of pumpFileTo() or of another stream's tryPumpFromFile().
+  //
+  // Streams wrapping a file descriptor use this to transfer file content to the descriptor
+  // without copying it through userspace. Streams which wrap another stream without transforming
+  // the bytes (e.g. an HTTP body with a fixed Content-Length) can forward to the inner stream.
+  //
+  // The default implementation always returns null.
+
   virtual Promise<void> whenWriteDisconnected() = 0;
   // Returns a promise that resolves when the stream has become disconnected such that new write()s
   // will fail with a DISCONNECTED exception. This is particularly useful, for example, to cancel
@@ -166,6 +179,12 @@ public:
   virtual kj::Maybe<int> getFd() const { return nullptr; }
   // Get the underlying Unix file descriptor, if any. Returns nullptr if this object actually
   // isn't wrapping a file descriptor.
+
+  virtual kj::Maybe<int> getTransparentFd() const { return nullptr; }
+  // Like getFd(), but only returns a descriptor if reading and writing it directly is the same as
+  // reading and writing this stream, so that the caller may bypass the stream entirely. Streams
+  // which transform the data (e.g. TLS) must not forward this, even though they may forward
+  // getFd().
 };
 
 Promise<uint64_t> unoptimizedPumpTo(
@@ -182,6 +201,28 @@ Promise<uint64_t> unoptimizedPumpTo(
 // provided for convenience for cases where the caller has already done some pumping before they
 // give up. Otherwise, a `.then()` would need to be used to add the bytes to the final result.
 
+Promise<uint64_t> pumpFileTo(const ReadableFile& file, AsyncOutputStream& output,
+                             uint64_t offset = 0, uint64_t amount = kj::maxValue);
+// Writes the content of `file` to `output`, starting at `offset` and continuing for `amount`
+// bytes or until EOF, and returns the number of bytes written. `file` must remain valid until the
+// returned promise completes.
+//
+// If `output` supports it -- on Linux, any stream created by the AsyncIoProvider around a socket
+// or pipe -- the data is transferred with sendfile(), so it goes straight from the page cache to
+// the socket without being copied through userspace. Otherwise, the file is read into a buffer
+// which is then written to `output`.
+//
+// Either way, the file is read on the calling thread. That's fine for local files which are
+// likely to be in the page cache, but when serving from slow disks or network filesystems,
+// consider AsyncReadableFile::pumpTo() (see async-file.h) instead.
+
+Promise<uint64_t> unoptimizedPumpFileTo(
+    const ReadableFile& file, AsyncOutputStream& output, uint64_t offset, uint64_t amount,
+    uint64_t completedSoFar = 0);
+// Performs pumpFileTo() using read() and write(), without calling tryPumpFromFile(). This is the
+// equivalent of unoptimizedPumpTo(), for use by implementations of tryPumpFromFile() which find
+// they cannot optimize after all. Reading starts at `offset + completedSoFar`.
+
 class AsyncCapabilityStream: public AsyncIoStream {
   // An AsyncIoStream that also allows transmitting new stream objects and file descriptors
   // (capabilities, in the object-capability model sense), in addition to bytes.
@@ -536,6 +577,20 @@ public:
     size_t ancillary = 0;
     // How much space to allocate for ancillary messages. As with content, if the ancillary data
     // is larger than this, it will be truncated.
+
+    size_t batch = 1;
+    // How many datagrams to receive per system call, where the OS supports it (Linux's
+    // recvmmsg()). The receiver allocates `batch` sets of content and ancillary buffers, fills as
+    // many as are ready in one call, and then hands them out one per receive() without going
+    // back to the kernel. This substantially cuts per-packet overhead for high-rate receivers,
+    // at the cost of multiplying the memory used by the receiver.
+
+    bool coalesce = false;
+    // If true, and the OS supports it (Linux's UDP_GRO), lets the kernel coalesce consecutive
+    // same-sized datagrams from the same source into a single buffer, which the receiver then
+    // splits apart again, so the application still sees one datagram per receive(). `content`
+    // should be large enough to hold a coalesced run (up to 64KiB) or runs will be truncated.
+    // Note that this enables the option on the whole port, not just this receiver.
   };
 };
 
@@ -545,6 +600,17 @@ public:
   virtual Promise<size_t> send(ArrayPtr<const ArrayPtr<const byte>> pieces,
                                NetworkAddress& destination) = 0;
 
+  virtual Promise<void> sendBatch(ArrayPtr<const ArrayPtr<const byte>> datagrams,
+                                  NetworkAddress& destination);
+  // Sends each element of `datagrams` as a separate datagram to `destination`, in order. The
+  // datagrams must remain valid until the returned promise resolves.
+  //
+  // This is equivalent to calling send() for each, but lets the implementation hand the whole
+  // batch to the OS at once. On Linux, runs of equal-sized datagrams (the last of a run may be
+  // shorter) are sent with UDP segmentation offload (UDP_SEGMENT), where the kernel or network
+  // card splits one large buffer into datagrams; everything else is sent with sendmmsg(). The
+  // default implementation calls send() in a loop.
+
   virtual Own<DatagramReceiver> makeReceiver(
       DatagramReceiver::Capacity capacity = DatagramReceiver::Capacity()) = 0;
   // Create a new `Receiver` that can be used to receive datagrams. `capacity` specifies how much
@@ -585,6 +651,15 @@ public:
   //
   // The address must be local.
 
+  virtual Own<ConnectionReceiver> listenShared();
+  // Like listen(), but allows other sockets to listen on exactly the same address at the same
+  // time (SO_REUSEPORT), with the kernel distributing incoming connections among them. This is
+  // how one address is served from several threads, each accepting on its own event loop; see
+  // ShardedListener. Every socket in the group must be opened with listenShared() by the same
+  // user.
+  //
+  // The default implementation throws an "unimplemented" exception.
+
   virtual Own<DatagramPort> bindDatagramPort();
   // Open this address as a datagram (e.g. UDP) port.
   //
@@ -686,6 +761,22 @@ public:
   // rule that is more specific than the deny rule).
 };
 
+#if !_WIN32
+void setDnsCacheTtl(Duration ttl, Duration negativeTtl);
+// Enables caching of hostname lookups by the Networks provided by the OS (see
+// AsyncIoProvider::getNetwork()). All such Networks in the process share one cache. The OS
+// resolver doesn't report the records' actual TTLs, so fixed ones are used: `ttl` for successful
+// lookups and `negativeTtl` for failures. Changes apply to lookups completing afterwards.
+//
+// Caching is off by default (both TTLs zero), since a fixed TTL can keep returning an address
+// after DNS has failed over away from it; only enable it if your TTL is short compared to how
+// quickly you need to follow DNS changes. Concurrent lookups of the same name share one query
+// either way.
+
+void clearDnsCache();
+// Discards all cached lookup results, e.g. after a network change.
+#endif
+
 // =======================================================================================
 // I/O Provider
 
@@ -795,13 +886,33 @@ public:
     // On Linux, all system calls which yield new file descriptors have flags or variants which
     // set the close-on-exec flag immediately.  Unfortunately, other OS's do not.
 
-    ALREADY_NONBLOCK = 1 << 2
+    ALREADY_NONBLOCK = 1 << 2,
     // Indicates that the file descriptor is known already to be in non-blocking mode, so the flag
     // need not be set again.  Otherwise, all wrap*Fd() methods will enable non-blocking mode
     // automatically.
     //
     // On Linux, all system calls which yield new file descriptors have flags or variants which
     // enable non-blocking mode immediately.  Unfortunately, other OS's do not.
+
+    ZEROCOPY_WRITES = 1 << 3
+    // Only meaningful for wrapSocketFd() and wrapConnectingSocketFd(). On Linux, large writes
+    // will be sent with MSG_ZEROCOPY, so that the kernel transmits directly out of the caller's
+    // buffers instead of copying them. The promise returned by such a write resolves only once
+    // the kernel reports that it is done with the buffers, which can take up to a network round
+    // trip, so this is only a win for bulk transfers of large (multi-megabyte) messages. Small
+    // writes are still copied as usual.
+    //
+    // Ignored on platforms and socket types which don't support zero-copy sends (e.g. Unix
+    // domain sockets, on which the kernel would copy anyway).
+#else
+    REGISTERED_IO = 1 << 3
+    // Only meaningful for wrapSocketFd() and wrapConnectingSocketFd(), and only when KJ is built
+    // with KJ_USE_WIN32_RIO. The socket is a TCP socket created with WSA_FLAG_REGISTERED_IO, and
+    // its reads and writes should use Registered I/O (RIOReceive()/RIOSend() on buffers
+    // registered once per event loop) rather than an overlapped WSARecv()/WSASend() each.
+    //
+    // Sockets created by the Network returned by setupAsyncIo() use Registered I/O automatically
+    // when KJ is built this way and the system supports it.
 #endif
   };
 
@@ -942,6 +1053,63 @@ AsyncIoContext setupAsyncIo();
 //   note that this means that server processes which daemonize themselves at startup must wait
 //   until after daemonization to create an AsyncIoContext.
 
+class ShardedListener {
+  // Serves one listen address from several threads, each with its own event loop and its own
+  // listening socket (see NetworkAddress::listenShared()), so that both accepting connections and
+  // serving them scale across cores without handing sockets between threads.
+  //
+  // Each thread calls `serve` with its own AsyncIoContext and ConnectionReceiver, and then runs
+  // the returned promise until the ShardedListener is destroyed. Typically `serve` wraps the
+  // receiver in the thread's own server object, e.g.:
+  //
+  //     kj::ShardedListener listener("*", 8080, 4,
+  //         [&](kj::AsyncIoContext& io, kj::ConnectionReceiver& receiver, uint shard) {
+  //       auto server = kj::heap<kj::HttpServer>(io.provider->getTimer(), headerTable, service);
+  //       auto promise = server->listenHttp(receiver);
+  //       return promise.attach(kj::mv(server));
+  //     });
+  //
+  // `serve` is called concurrently from all threads, so any state it captures must be
+  // thread-safe. If the promise it returns rejects, the error is logged and that shard stops
+  // accepting connections; the others carry on.
+  //
+  // Only available on systems supporting SO_REUSEPORT. The address must resolve to exactly one
+  // socket address.
+
+public:
+  typedef ConstFunction<Promise<void>(AsyncIoContext& io, ConnectionReceiver& receiver,
+                                      uint shard)> ServeFunc;
+
+  ShardedListener(StringPtr address, uint portHint, uint threadCount, ServeFunc serve,
+                  bool cpuAffinity = false);
+  // Starts `threadCount` threads, and returns once every one of them is listening. Throws if any
+  // of them fails to start listening.
+  //
+  // `address` and `portHint` are as for Network::parseAddress(). If the port is zero, the first
+  // thread lets the OS choose one and the rest use the same.
+  //
+  // If `cpuAffinity` is true (Linux only; ignored elsewhere), each thread is pinned to a subset
+  // of CPUs, and a small BPF program (SO_ATTACH_REUSEPORT_CBPF) makes the kernel hand each new
+  // connection to the thread pinned to the CPU that processed its SYN packet. With receive-side
+  // scaling on the NIC, this keeps each connection's packets and its application processing on
+  // the same core. The benefit relies on interrupts for the NIC queues being spread across CPUs.
+
+  KJ_DISALLOW_COPY(ShardedListener);
+  ~ShardedListener() noexcept(false);
+  // Cancels the promises returned by `serve` and joins all threads.
+
+  uint getPort() const { return port; }
+  // Returns the port being listened on (useful if the OS chose it).
+
+private:
+  class Shard;
+
+  ServeFunc serve;
+  bool cpuAffinity;
+  uint port = 0;
+  Array<Own<Shard>> shards;
+};
+
 // =======================================================================================
 // Convenience adapters.
 
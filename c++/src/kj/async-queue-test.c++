@@ -23,6 +23,7 @@
 
 #include "kj/async-io.h"
 #include "kj/test.h"
+#include "kj/thread.h"
 #include "kj/vector.h"
 
 namespace kj {
@@ -147,5 +148,101 @@ KJ_TEST("ProducerConsumerQueue with rejectAll()") {
   }
 }
 
+KJ_TEST("BoundedQueue applies backpressure") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  BoundedQueue<Own<int>> queue(3);
+  KJ_EXPECT(queue.capacity() == 4);
+
+  for (int i: kj::zeroTo(4)) {
+    auto promise = queue.push(heap(i));
+    KJ_EXPECT(promise.poll(waitScope));
+    promise.wait(waitScope);
+  }
+
+  auto extra = queue.push(heap(4));
+  KJ_EXPECT(!extra.poll(waitScope));
+  auto value = heap(5);
+  KJ_EXPECT(!queue.tryPush(value));
+  KJ_EXPECT(value.get() != nullptr);
+
+  KJ_EXPECT(*KJ_ASSERT_NONNULL(queue.pop().wait(waitScope)) == 0);
+  KJ_EXPECT(extra.poll(waitScope));
+  extra.wait(waitScope);
+
+  auto batch = queue.popBatch(10).wait(waitScope);
+  KJ_ASSERT(batch.size() == 4);
+  for (auto i: kj::indices(batch)) {
+    KJ_EXPECT(*batch[i] == int(i) + 1);
+  }
+
+  // An empty queue makes consumers wait.
+  auto popped = queue.pop();
+  KJ_EXPECT(!popped.poll(waitScope));
+  KJ_EXPECT(queue.tryPush(value));
+  KJ_EXPECT(*KJ_ASSERT_NONNULL(popped.wait(waitScope)) == 5);
+
+  // Closing fails pushes, including waiting ones, but queued values can still be drained.
+  for (int i: kj::zeroTo(4)) {
+    queue.push(heap(i)).wait(waitScope);
+  }
+  auto blocked = queue.push(heap(4));
+  BoundedQueue<int> waitingConsumer(2);
+  auto drained = waitingConsumer.pop();
+
+  queue.close();
+  waitingConsumer.close();
+  KJ_EXPECT(queue.isClosed());
+  KJ_EXPECT_THROW(DISCONNECTED, blocked.wait(waitScope));
+  KJ_EXPECT_THROW(DISCONNECTED, queue.push(heap(6)).wait(waitScope));
+  KJ_EXPECT(drained.wait(waitScope) == nullptr);
+
+  KJ_EXPECT(queue.popBatch(3).wait(waitScope).size() == 3);
+  KJ_EXPECT(queue.pop().wait(waitScope) != nullptr);
+  KJ_EXPECT(queue.pop().wait(waitScope) == nullptr);
+  KJ_EXPECT(queue.popBatch(3).wait(waitScope).size() == 0);
+}
+
+KJ_TEST("BoundedQueue across threads") {
+  constexpr uint kProducerCount = 3;
+  constexpr uint kItemCount = 2000;
+
+  BoundedQueue<uint> queue(8);
+  Vector<Own<Thread>> producers;
+  for (uint p: kj::zeroTo(kProducerCount)) {
+    producers.add(heap<Thread>([&queue, p]() noexcept {
+      EventLoop loop;
+      WaitScope waitScope(loop);
+      for (uint i: kj::zeroTo(kItemCount)) {
+        queue.push(p * kItemCount + i).wait(waitScope);
+      }
+    }));
+  }
+
+  auto closer = heap<Thread>([&]() noexcept {
+    producers.clear();
+    queue.close();
+  });
+
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  uint next[kProducerCount] = { 0 };
+  uint total = 0;
+  for (;;) {
+    auto batch = queue.popBatch(5).wait(waitScope);
+    if (batch.size() == 0) break;
+    for (uint value: batch) {
+      // Each producer's values arrive in order.
+      uint p = value / kItemCount;
+      KJ_ASSERT(value % kItemCount == next[p]++, value);
+      ++total;
+    }
+  }
+
+  KJ_EXPECT(total == kProducerCount * kItemCount);
+}
+
 }  // namespace
 }  // namespace kj
@@ -26,7 +26,10 @@
 #include "debug.h"
 #include "list.h"
 #include "memory.h"
+#include "mutex.h"
+#include "vector.h"
 
+#include <atomic>
 #include <list>
 
 KJ_BEGIN_HEADER
@@ -151,6 +154,281 @@ private:
   WaiterQueue<T> waiters;
 };
 
+template <typename T>
+class BoundedQueue {
+  // BoundedQueue is an async FIFO queue holding at most `capacity` values, which any number of
+  // threads may push to and pop from. Unlike ProducerConsumerQueue, `push()` waits while the queue
+  // is full, so producers that get ahead are held to the pace of their consumers instead of
+  // buffering without limit -- e.g. between an I/O loop and worker loops reached via `Executor`.
+  //
+  // Values are kept in a lock-free ring; a lock is only taken by callers that have to wait, and by
+  // whoever wakes them. A waiting consumer is woken once, by the push that ends its wait, and
+  // further pushes don't signal it again until it waits once more. Consumers that keep up can use
+  // `popBatch()` to take everything that arrived in the meantime with one wakeup.
+  //
+  // `close()` ends the stream: pushes fail from then on, while consumers still get the values
+  // already queued, then null (or an empty batch) once it's drained.
+  //
+  // Like `Executor`, all methods are thread-safe, which is why they're `const`. The promises they
+  // return belong to the calling thread's event loop, as usual. The queue must outlive them.
+
+public:
+  explicit BoundedQueue(size_t capacity);
+  // `capacity` is rounded up to a power of two, and to at least 2.
+
+  KJ_DISALLOW_COPY(BoundedQueue);
+
+  size_t capacity() const { return cells.size(); }
+
+  bool tryPush(T& value) const;
+  // Moves `value` into the queue and returns true, unless the queue is full. Throws DISCONNECTED
+  // if the queue has been closed.
+
+  Promise<void> push(T value) const;
+  // Pushes `value`, waiting for room if the queue is full. Rejects with DISCONNECTED if the queue
+  // is, or becomes, closed before the value is pushed.
+
+  Maybe<T> tryPop() const;
+  // Pops a value, unless the queue is empty.
+
+  Promise<Maybe<T>> pop() const;
+  // Pops a value, waiting for one if the queue is empty. Resolves to null once the queue has been
+  // closed and drained.
+
+  Promise<Array<T>> popBatch(size_t maxCount) const;
+  // Pops up to `maxCount` values, waiting for at least one if the queue is empty. Resolves to an
+  // empty array once the queue has been closed and drained.
+
+  void close() const;
+  // Fails all current and future pushes. Values already queued can still be popped.
+
+  bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Maybe<T> value;
+  };
+
+  struct Waiters {
+    Vector<Own<CrossThreadPromiseFulfiller<void>>> consumers;
+    Vector<Own<CrossThreadPromiseFulfiller<void>>> producers;
+  };
+
+  // The ring is Dmitry Vyukov's bounded MPMC queue: each cell's sequence number says whether it's
+  // ready to be written (== position) or read (== position + 1) at a given position.
+  mutable Array<Cell> cells;
+  size_t mask;
+  alignas(64) mutable std::atomic<size_t> pushPos { 0 };
+  alignas(64) mutable std::atomic<size_t> popPos { 0 };
+
+  alignas(64) mutable std::atomic<bool> closed { false };
+  mutable std::atomic<uint> activePushes { 0 };
+  mutable std::atomic<uint> waitingConsumers { 0 };
+  mutable std::atomic<uint> waitingProducers { 0 };
+  MutexGuarded<Waiters> waiters;
+
+  static size_t roundCapacity(size_t capacity);
+
+  bool isDrained() const;
+
+  Promise<void> wait(Vector<Own<CrossThreadPromiseFulfiller<void>>> Waiters::*list,
+                     std::atomic<uint>& count) const;
+  void wake(Vector<Own<CrossThreadPromiseFulfiller<void>>> Waiters::*list,
+            std::atomic<uint>& count) const;
+  void wakeProducers() const;
+};
+
+// =======================================================================================
+// inline implementation details
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+    : cells(heapArray<Cell>(roundCapacity(capacity))), mask(cells.size() - 1) {
+  for (size_t i = 0; i < cells.size(); i++) {
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+size_t BoundedQueue<T>::roundCapacity(size_t capacity) {
+  size_t result = 2;
+  while (result < capacity) result <<= 1;
+  return result;
+}
+
+template <typename T>
+bool BoundedQueue<T>::tryPush(T& value) const {
+  // Counting pushes in progress lets consumers tell a closed queue that's drained from one with
+  // a push about to land.
+  activePushes.fetch_add(1);
+  KJ_DEFER(activePushes.fetch_sub(1));
+
+  if (closed.load()) {
+    kj::throwFatalException(KJ_EXCEPTION(DISCONNECTED, "BoundedQueue was closed"));
+  }
+
+  size_t pos = pushPos.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells[pos & mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+    if (diff == 0) {
+      if (pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = pushPos.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->value = kj::mv(value);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+
+  // Pairs with the fence in wait(): either we see the consumer waiting, or it sees our value.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waitingConsumers.load(std::memory_order_relaxed) > 0) {
+    wake(&Waiters::consumers, waitingConsumers);
+  }
+  return true;
+}
+
+template <typename T>
+Promise<void> BoundedQueue<T>::push(T value) const {
+  return evalNow([&]() -> Promise<void> {
+    if (tryPush(value)) return READY_NOW;
+
+    return wait(&Waiters::producers, waitingProducers)
+        .then([this, value = kj::mv(value)]() mutable {
+      return push(kj::mv(value));
+    });
+  });
+}
+
+template <typename T>
+Maybe<T> BoundedQueue<T>::tryPop() const {
+  size_t pos = popPos.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells[pos & mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+    if (diff == 0) {
+      if (popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      return nullptr;
+    } else {
+      pos = popPos.load(std::memory_order_relaxed);
+    }
+  }
+
+  Maybe<T> result = kj::mv(cell->value);
+  cell->value = nullptr;
+  cell->sequence.store(pos + mask + 1, std::memory_order_release);
+
+  wakeProducers();
+  return result;
+}
+
+template <typename T>
+Promise<Maybe<T>> BoundedQueue<T>::pop() const {
+  KJ_IF_MAYBE(value, tryPop()) {
+    return Maybe<T>(kj::mv(*value));
+  } else if (isDrained()) {
+    return Maybe<T>(nullptr);
+  }
+
+  return wait(&Waiters::consumers, waitingConsumers).then([this]() {
+    return pop();
+  });
+}
+
+template <typename T>
+Promise<Array<T>> BoundedQueue<T>::popBatch(size_t maxCount) const {
+  KJ_REQUIRE(maxCount > 0);
+
+  Vector<T> batch;
+  while (batch.size() < maxCount) {
+    KJ_IF_MAYBE(value, tryPop()) {
+      batch.add(kj::mv(*value));
+    } else {
+      break;
+    }
+  }
+
+  if (batch.size() > 0 || isDrained()) {
+    return batch.releaseAsArray();
+  }
+
+  return wait(&Waiters::consumers, waitingConsumers).then([this, maxCount]() {
+    return popBatch(maxCount);
+  });
+}
+
+template <typename T>
+void BoundedQueue<T>::close() const {
+  closed.store(true);
+  wake(&Waiters::consumers, waitingConsumers);
+  wake(&Waiters::producers, waitingProducers);
+}
+
+template <typename T>
+bool BoundedQueue<T>::isDrained() const {
+  if (!closed.load() || activePushes.load() > 0) return false;
+  return pushPos.load() == popPos.load();
+}
+
+template <typename T>
+Promise<void> BoundedQueue<T>::wait(
+    Vector<Own<CrossThreadPromiseFulfiller<void>>> Waiters::*list,
+    std::atomic<uint>& count) const {
+  auto paf = newPromiseAndCrossThreadFulfiller<void>();
+  {
+    auto lock = waiters.lockExclusive();
+    ((*lock).*list).add(kj::mv(paf.fulfiller));
+    count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // The push or pop we're waiting for may have happened between our failed attempt and the
+  // registration above, without seeing us. Check again, waking ourselves (and any others) if so.
+  // Spurious wakeups are harmless since the caller just retries.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  size_t pushed = pushPos.load();
+  size_t popped = popPos.load();
+  bool ready = list == &Waiters::consumers ? pushed != popped : pushed - popped < cells.size();
+  if (ready || closed.load()) {
+    wake(list, count);
+  }
+
+  return kj::mv(paf.promise);
+}
+
+template <typename T>
+void BoundedQueue<T>::wake(
+    Vector<Own<CrossThreadPromiseFulfiller<void>>> Waiters::*list,
+    std::atomic<uint>& count) const {
+  Vector<Own<CrossThreadPromiseFulfiller<void>>> toWake;
+  {
+    auto lock = waiters.lockExclusive();
+    toWake = kj::mv((*lock).*list);
+    count.store(0, std::memory_order_relaxed);
+  }
+
+  for (auto& fulfiller: toWake) {
+    fulfiller->fulfill();
+  }
+}
+
+template <typename T>
+void BoundedQueue<T>::wakeProducers() const {
+  // Pairs with the fence in wait(): either we see the producer waiting, or it sees the room.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waitingProducers.load(std::memory_order_relaxed) > 0) {
+    wake(&Waiters::producers, waitingProducers);
+  }
+}
+
 }  // namespace kj
 
 KJ_END_HEADER
@@ -24,6 +24,7 @@
 #include "kj/compat/gtest.h"
 #include "mutex.h"
 #include "thread.h"
+#include "timer.h"
 
 #if !KJ_USE_FIBERS
 #include <pthread.h>
@@ -1253,6 +1254,70 @@ KJ_TEST("fiber pool limit") {
   // likelihood that the new stack would be allocated in the same location.
 }
 
+KJ_TEST("fiber pool size classes") {
+  size_t sizes[] = { 65536, 1 << 20 };
+  FiberPool pool(kj::arrayPtr(sizes, kj::size(sizes)));
+
+  char* smallPtr = nullptr;
+  char* bigPtr = nullptr;
+
+  pool.runSynchronously([&]() {
+    char c;
+    smallPtr = &c;
+  });
+  pool.runSynchronously(256 * 1024, [&]() {
+    char c;
+    bigPtr = &c;
+  });
+  KJ_EXPECT(pool.getFreelistSize() == 2);
+
+  // Each size draws from its own freelist.
+  KJ_EXPECT(!onOurStack(smallPtr));
+  KJ_EXPECT(!onOurStack(bigPtr));
+  KJ_EXPECT(smallPtr - bigPtr >= 65536 || bigPtr - smallPtr >= 65536);
+  pool.runSynchronously(1 << 20, [&]() {
+    KJ_EXPECT(onOurStack(bigPtr));
+  });
+  pool.runSynchronously(1000, [&]() {
+    KJ_EXPECT(onOurStack(smallPtr));
+  });
+
+  KJ_EXPECT_THROW_MESSAGE("no stack in this FiberPool is big enough",
+      pool.runSynchronously(2 << 20, [&]() {}));
+
+  {
+    EventLoop loop;
+    WaitScope waitScope(loop);
+    auto promise = pool.startFiber(256 * 1024, [&](WaitScope&) {
+      KJ_EXPECT(onOurStack(bigPtr));
+      return 123;
+    });
+    KJ_EXPECT(promise.wait(waitScope) == 123);
+  }
+
+  KJ_EXPECT(pool.getFreelistSize() == 2);
+}
+
+KJ_TEST("fiber pool shared between threads") {
+  FiberPool pool(65536);
+  pool.setMaxFreelist(4);
+
+  {
+    kj::Vector<kj::Own<kj::Thread>> threads;
+    for (auto i KJ_UNUSED: kj::zeroTo(4)) {
+      threads.add(kj::heap<kj::Thread>([&]() {
+        for (auto j KJ_UNUSED: kj::zeroTo(100)) {
+          pool.runSynchronously([&]() {
+            KJ_EXPECT(pool.getFreelistSize() <= 4);
+          });
+        }
+      }));
+    }
+  }
+
+  KJ_EXPECT(pool.getFreelistSize() <= 4);
+}
+
 KJ_TEST("run event loop on freelisted stacks") {
   FiberPool pool(65536);
 
@@ -1429,5 +1494,200 @@ KJ_TEST("retryOnDisconnect") {
   }
 }
 
+KJ_TEST("PromiseNodes are recycled by the event loop") {
+  void* freed[2];
+  {
+    EventLoop loop;
+    WaitScope waitScope(loop);
+
+    auto makePromise = []() {
+      return Promise<int>(123).then([](int i) { return i + 1; });
+    };
+
+    for (auto& slot: freed) {
+      auto promise = makePromise();
+      slot = &_::PromiseNode::from(promise);
+    }
+
+    // The same chain shape reuses the blocks that were just freed instead of allocating new ones.
+    // (Depending on whether both nodes fall in the same size class, the two blocks may trade
+    // places on each iteration.)
+    for (uint i = 0; i < 10; i++) {
+      auto promise = makePromise();
+      void* node = &_::PromiseNode::from(promise);
+      KJ_EXPECT(node == freed[0] || node == freed[1]);
+      KJ_EXPECT(promise.wait(waitScope) == 124);
+    }
+
+    // Nodes freed outside of the loop's thread-scope go back to the heap; nodes created outside it
+    // can still be freed inside it.
+    auto promise = makePromise();
+    {
+      Promise<int> outside = nullptr;
+      Thread([&]() { outside = Promise<int>(321).then([](int i) { return i; }); });
+      KJ_EXPECT(outside.wait(waitScope) == 321);
+    }
+    KJ_EXPECT(promise.wait(waitScope) == 124);
+  }
+
+  // After the loop is gone, promises can still be created and destroyed.
+  auto promise = Promise<int>(123).then([](int i) { return i; });
+}
+
+KJ_TEST("TimerImpl timer wheel fires timers at the same times as the default TimerImpl") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  TimePoint start = origin<TimePoint>() + 12345 * SECONDS;
+  TimerImpl reference(start);
+  TimerImpl wheel(start);
+  wheel.useTimerWheel(MILLISECONDS);
+
+  // A spread of delays covering several wheel levels, including some that land mid-tick, some in
+  // the past, and one that's far out. Every third timer is canceled before it fires.
+  constexpr uint COUNT = 600;
+  kj::Vector<Promise<void>> promises;
+  Maybe<TimePoint> referenceFired[COUNT];
+  Maybe<TimePoint> wheelFired[COUNT];
+  uint32_t rand = 1234;
+  for (uint i: kj::zeroTo(COUNT)) {
+    rand = rand * 1103515245 + 12345;
+    Duration delay = int64_t(rand % 1000000) * (i % 4 == 0 ? MILLISECONDS : MICROSECONDS * 37);
+    if (i == 1) delay = -5 * SECONDS;
+    if (i == 2) delay = 400 * 24 * 3600 * SECONDS;
+
+    promises.add(reference.atTime(start + delay).then([&,i]() {
+      referenceFired[i] = reference.now();
+    }).eagerlyEvaluate(nullptr));
+    promises.add(wheel.atTime(start + delay).then([&,i]() {
+      wheelFired[i] = wheel.now();
+    }).eagerlyEvaluate(nullptr));
+  }
+  for (uint i = 0; i < COUNT; i += 3) {
+    promises[i * 2] = nullptr;
+    promises[i * 2 + 1] = nullptr;
+  }
+
+  TimePoint now = start;
+  for (uint step = 0; step < 2000; step++) {
+    // Advance like an event port would: never past the next reported event.
+    rand = rand * 1103515245 + 12345;
+    TimePoint next = now + int64_t(rand % 3000000) * MICROSECONDS;
+    KJ_IF_MAYBE(t, wheel.nextEvent()) {
+      KJ_IF_MAYBE(r, reference.nextEvent()) {
+        KJ_EXPECT(*t <= *r);
+        if (*t > now) next = kj::min(next, *t);
+      } else {
+        KJ_FAIL_EXPECT("wheel has events but reference doesn't");
+      }
+    }
+
+    now = next;
+    reference.advanceTo(now);
+    wheel.advanceTo(now);
+    loop.run();
+  }
+
+  // Jump far enough ahead to fire the far-out timer.
+  reference.advanceTo(start + 500 * 24 * 3600 * SECONDS);
+  wheel.advanceTo(start + 500 * 24 * 3600 * SECONDS);
+  loop.run();
+
+  for (uint i: kj::zeroTo(COUNT)) {
+    KJ_EXPECT((wheelFired[i] == nullptr) == (i % 3 == 0), i);
+    KJ_EXPECT(referenceFired[i] == wheelFired[i], i);
+  }
+  KJ_EXPECT(wheel.nextEvent() == nullptr);
+}
+
+KJ_TEST("EventLoopProfiler") {
+  class FakeClock final: public MonotonicClock {
+  public:
+    TimePoint time = origin<TimePoint>();
+    TimePoint now() const override { return time; }
+  };
+
+  class TestProfiler final: public EventLoopProfiler {
+  public:
+    using EventLoopProfiler::EventLoopProfiler;
+
+    uint slowCount = 0;
+    Duration slowDuration = 0 * NANOSECONDS;
+
+  protected:
+    void slowEvent(const Site& site, Duration duration, ArrayPtr<void* const> trace) override {
+      ++slowCount;
+      slowDuration = duration;
+      KJ_EXPECT(trace.size() > 0);
+      KJ_EXPECT(site.traceAddress == trace[0]);
+    }
+  };
+
+  EventLoop loop;
+  WaitScope waitScope(loop);
+
+  FakeClock clock;
+  TestProfiler profiler(10 * MILLISECONDS, clock);
+  loop.setProfiler(profiler);
+
+  // Evaluated eagerly so that the callbacks run in events of their own, rather than in wait().
+  uint count = 0;
+  auto promise1 = evalLater([&]() { ++count; }).eagerlyEvaluate(nullptr);
+  auto promise2 = evalLater([&]() {
+    clock.time += 50 * MILLISECONDS;
+    ++count;
+  }).eagerlyEvaluate(nullptr);
+  auto promise3 = evalLater([&]() { ++count; }).eagerlyEvaluate(nullptr);
+  promise1.wait(waitScope);
+  promise2.wait(waitScope);
+  promise3.wait(waitScope);
+  KJ_EXPECT(count == 3);
+
+  KJ_EXPECT(profiler.slowCount == 1);
+  KJ_EXPECT(profiler.slowDuration == 50 * MILLISECONDS);
+
+  auto& durations = profiler.getTurnDurations();
+  KJ_EXPECT(durations.getCount() >= 3);
+  KJ_EXPECT(durations.getPercentile(1.0) >= 50 * MILLISECONDS / NANOSECONDS);
+  KJ_EXPECT(durations.getPercentile(0.5) == 0);
+
+  // The first event ran while the other two were still queued.
+  KJ_EXPECT(profiler.getQueueDepths().getPercentile(1.0) >= 2);
+
+  auto sites = profiler.getSites();
+  KJ_ASSERT(sites.size() > 0);
+  KJ_EXPECT(sites[0].totalTime == 50 * MILLISECONDS);
+  KJ_EXPECT(sites[0].maxTime == 50 * MILLISECONDS);
+
+  profiler.reset();
+  KJ_EXPECT(profiler.getTurnDurations().getCount() == 0);
+  KJ_EXPECT(profiler.getSites().size() == 0);
+
+  // Once removed, the profiler hears nothing.
+  loop.setProfiler(nullptr);
+  evalLater([]() {}).wait(waitScope);
+  KJ_EXPECT(profiler.getTurnDurations().getCount() == 0);
+}
+
+KJ_TEST("EventLoopProfiler::Histogram") {
+  EventLoopProfiler::Histogram histogram;
+  KJ_EXPECT(histogram.getPercentile(0.5) == 0);
+
+  histogram.add(0);
+  histogram.add(1);
+  histogram.add(5);
+  histogram.add(1000);
+  KJ_EXPECT(histogram.getCount() == 4);
+  KJ_EXPECT(histogram.getBucket(0) == 1);
+  KJ_EXPECT(histogram.getBucket(1) == 1);
+  KJ_EXPECT(histogram.getBucket(3) == 1);
+  KJ_EXPECT(histogram.getBucket(10) == 1);
+
+  KJ_EXPECT(histogram.getPercentile(0.25) == 0);
+  KJ_EXPECT(histogram.getPercentile(0.5) == 1);
+  KJ_EXPECT(histogram.getPercentile(0.75) == 7);
+  KJ_EXPECT(histogram.getPercentile(1.0) == 1023);
+}
+
 }  // namespace
 }  // namespace kj
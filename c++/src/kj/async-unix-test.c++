@@ -626,6 +626,44 @@ TEST(AsyncUnixTest, SteadyTimers) {
   }
 }
 
+TEST(AsyncUnixTest, SteadyTimersWithWheel) {
+  captureSignals();
+  UnixEventPort port;
+  port.useTimerWheel();
+  EventLoop loop(port);
+  WaitScope waitScope(loop);
+
+  auto& timer = port.getTimer();
+
+  auto start = timer.now();
+  kj::Vector<TimePoint> expected;
+  kj::Vector<TimePoint> actual;
+
+  auto addTimer = [&](Duration delay) {
+    expected.add(max(start + delay, start));
+    timer.atTime(start + delay).then([&]() {
+      actual.add(timer.now());
+    }).detach([](Exception&& e) { ADD_FAILURE() << str(e).cStr(); });
+  };
+
+  addTimer(30 * MILLISECONDS);
+  addTimer(40 * MILLISECONDS);
+  addTimer(20350 * MICROSECONDS);
+  addTimer(30 * MILLISECONDS);
+  addTimer(-10 * MILLISECONDS);
+  addTimer(150 * MILLISECONDS);
+
+  std::sort(expected.begin(), expected.end());
+  timer.atTime(expected.back() + MILLISECONDS).wait(waitScope);
+
+  ASSERT_EQ(expected.size(), actual.size());
+  std::sort(actual.begin(), actual.end());
+  for (int i = 0; i < expected.size(); ++i) {
+    KJ_EXPECT(expected[i] <= actual[i], "Actual time for timer i is too early.",
+              i, ((expected[i] - actual[i]) / NANOSECONDS));
+  }
+}
+
 bool dummySignalHandlerCalled = false;
 void dummySignalHandler(int) {
   dummySignalHandlerCalled = true;
@@ -962,6 +1000,58 @@ KJ_TEST("UnixEventPort can receive multiple queued instances of an RT signal") {
 }
 #endif
 
+KJ_TEST("EventLoopWatchdog reports stalled event loops") {
+  struct Report {
+    bool captured;
+    size_t stackTraceSize;
+    size_t asyncTraceSize;
+  };
+
+  class TestWatchdog final: public EventLoopWatchdog {
+  public:
+    TestWatchdog(): EventLoopWatchdog(50 * MILLISECONDS) {}
+
+    MutexGuarded<Vector<Report>> reports;
+
+  protected:
+    void stalled(const Stall& stall) override {
+      KJ_EXPECT(stall.duration >= 50 * MILLISECONDS);
+      reports.lockExclusive()->add(Report {
+        stall.captured, stall.stackTrace.size(), stall.asyncTrace.size()
+      });
+    }
+  };
+
+  UnixEventPort port;
+  EventLoop loop(port);
+  WaitScope waitScope(loop);
+
+  TestWatchdog watchdog;
+  port.setWatchdog(watchdog);
+
+  // A loop sleeping in its port isn't stalled, however long it sleeps.
+  port.getTimer().afterDelay(200 * MILLISECONDS).wait(waitScope);
+  KJ_EXPECT(watchdog.getStallCount() == 0);
+
+  // A callback that blocks is, and gets reported once with its traces.
+  evalLater([&]() {
+    watchdog.reports.when([](const Vector<Report>& reports) { return !reports.empty(); },
+        [](const Vector<Report>&) {}, 10 * SECONDS);
+    usleep(100000);
+  }).eagerlyEvaluate(nullptr).wait(waitScope);
+
+  {
+    auto reports = watchdog.reports.lockExclusive();
+    KJ_ASSERT(reports->size() == 1);
+    KJ_EXPECT((*reports)[0].captured);
+    KJ_EXPECT((*reports)[0].stackTraceSize > 0);
+    KJ_EXPECT((*reports)[0].asyncTraceSize > 0);
+  }
+  KJ_EXPECT(watchdog.getStallCount() == 1);
+
+  port.setWatchdog(nullptr);
+}
+
 }  // namespace
 }  // namespace kj
 
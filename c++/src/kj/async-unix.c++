@@ -24,12 +24,15 @@
 #include "async-unix.h"
 #include "debug.h"
 #include "threadlocal.h"
+#include "mutex.h"
+#include "thread.h"
 #include <setjmp.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <limits>
 #include <pthread.h>
 #include <map>
+#include <atomic>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -37,6 +40,17 @@
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/eventfd.h>
+#if KJ_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#endif
+#elif KJ_USE_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <fcntl.h>
 #else
 #include <poll.h>
 #include <fcntl.h>
@@ -115,6 +129,9 @@ void registerSignalHandler(int signum) {
   KJ_SYSCALL(pthread_sigmask(SIG_BLOCK, &mask, nullptr));
 
 #if !KJ_USE_EPOLL  // on Linux we'll use signalfd
+  // With kqueue, the handler never runs because the signal stays blocked, but installing it
+  // ensures that signals whose default action is to be ignored (like SIGCHLD) are left pending
+  // rather than discarded.
   struct sigaction action;
   memset(&action, 0, sizeof(action));
   action.sa_sigaction = &signalHandler;
@@ -124,7 +141,7 @@ void registerSignalHandler(int signum) {
 #endif
 }
 
-#if !KJ_USE_EPOLL && !KJ_USE_PIPE_FOR_WAKEUP
+#if !KJ_USE_EPOLL && !KJ_USE_KQUEUE && !KJ_USE_PIPE_FOR_WAKEUP
 void registerReservedSignal() {
   registerSignalHandler(reservedSignal);
 }
@@ -308,7 +325,271 @@ void UnixEventPort::gotSignal(const siginfo_t& siginfo) {
   }
 }
 
+// =======================================================================================
+// Event loop watchdog
+
+namespace {
+
+struct WatchdogCapture {
+  // Filled in by the signal handler on the stalled thread.
+
+  std::atomic<bool> done { false };
+  void* stackSpace[32];
+  void* asyncSpace[32];
+  ArrayPtr<void* const> stackTrace;
+  ArrayPtr<void* const> asyncTrace;
+};
+
+}  // namespace
+
+struct EventLoopWatchdog::Impl {
+  Impl(EventLoopWatchdog& watchdog, Duration deadline, int signum);
+  ~Impl() noexcept(false);
+
+  struct Report {
+    Duration duration;
+    bool captured;
+    Array<void*> stackTrace;
+    Array<void*> asyncTrace;
+  };
+
+  struct State {
+    Vector<_::WatchdogHeartbeat*> heartbeats;
+    bool shuttingDown = false;
+  };
+
+  EventLoopWatchdog& watchdog;
+  Duration deadline;
+  int signum;
+  struct sigaction oldAction;
+
+  MutexGuarded<State> state;
+  std::atomic<uint> stallCount { 0 };
+  WatchdogCapture capture;
+
+  Own<Thread> thread;
+  // Declared last so that it's joined before anything else is torn down.
+
+  void run();
+  Report captureStall(_::WatchdogHeartbeat& heartbeat, Duration duration);
+};
+
+namespace _ {  // private
+
+class WatchdogHeartbeat {
+  // Published by a UnixEventPort to its watchdog.
+
+public:
+  explicit WatchdogHeartbeat(EventLoopWatchdog::Impl& watchdog)
+      : watchdog(watchdog), thread(pthread_self()), busySince(now()) {
+    watchdog.state.lockExclusive()->heartbeats.add(this);
+  }
+  ~WatchdogHeartbeat() noexcept(false) {
+    auto lock = watchdog.state.lockExclusive();
+    auto& heartbeats = lock->heartbeats;
+    for (auto i: kj::indices(heartbeats)) {
+      if (heartbeats[i] == this) {
+        heartbeats[i] = heartbeats.back();
+        heartbeats.removeLast();
+        break;
+      }
+    }
+  }
+  KJ_DISALLOW_COPY(WatchdogHeartbeat);
+
+  void idle() { busySince.store(0, std::memory_order_relaxed); }
+  void busy() { busySince.store(now(), std::memory_order_relaxed); }
+
+  static int64_t now() {
+    // A coarse clock is plenty for deadlines measured in (fractions of) seconds, and is cheap
+    // enough to read on every trip through the port.
+    return (systemCoarseMonotonicClock().now() - kj::origin<TimePoint>()) / NANOSECONDS;
+  }
+
+  EventLoopWatchdog::Impl& watchdog;
+  pthread_t thread;
+
+  std::atomic<int64_t> busySince;
+  // When the loop last left its port, in nanoseconds on the coarse monotonic clock, or zero while
+  // the loop is inside the port.
+
+  int64_t reported = 0;
+  // `busySince` as of the last stall reported, so each stall is reported once. Only accessed by
+  // the watchdog thread.
+};
+
+}  // namespace _
+
+class UnixEventPort::IdleScope {
+  // Marks the loop as inside its port for the duration of a wait() or poll(), and as busy again
+  // from the moment it leaves.
+
+public:
+  explicit IdleScope(UnixEventPort& port): heartbeat(port.heartbeat.get()) {
+    if (heartbeat != nullptr) heartbeat->idle();
+  }
+  ~IdleScope() noexcept(false) {
+    if (heartbeat != nullptr) heartbeat->busy();
+  }
+  KJ_DISALLOW_COPY(IdleScope);
+
+private:
+  _::WatchdogHeartbeat* heartbeat;
+};
+
+namespace {
+
+std::atomic<WatchdogCapture*> pendingWatchdogCapture { nullptr };
+std::atomic<bool> watchdogExists { false };
+
+void watchdogSignalHandler(int, siginfo_t*, void*) {
+  // Runs on the stalled thread, so it must stick to async-signal-safe work: it only records raw
+  // addresses, which the watchdog thread symbolizes later.
+  int savedErrno = errno;
+  auto capture = pendingWatchdogCapture.exchange(nullptr, std::memory_order_acquire);
+  if (capture != nullptr) {
+    capture->stackTrace = getStackTrace(capture->stackSpace, 1);
+    capture->asyncTrace = getAsyncTrace(capture->asyncSpace);
+    capture->done.store(true, std::memory_order_release);
+  }
+  errno = savedErrno;
+}
+
+}  // namespace
+
+EventLoopWatchdog::Impl::Impl(EventLoopWatchdog& watchdog, Duration deadline, int signum)
+    : watchdog(watchdog), deadline(deadline), signum(signum) {
+  KJ_REQUIRE(signum != reservedSignal, "the watchdog can't use UnixEventPort's reserved signal");
+  KJ_REQUIRE(!watchdogExists.exchange(true), "only one EventLoopWatchdog may exist at a time");
+  KJ_ON_SCOPE_FAILURE(watchdogExists.store(false));
+
+  // The first backtrace may load libraries, which isn't safe in a signal handler, so get it out of
+  // the way now.
+  void* space[4];
+  getStackTrace(space, 0);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &watchdogSignalHandler;
+  KJ_SYSCALL(sigemptyset(&action.sa_mask));
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  KJ_SYSCALL(sigaction(signum, &action, &oldAction));
+
+  thread = kj::heap<Thread>([this]() { run(); });
+}
+
+EventLoopWatchdog::Impl::~Impl() noexcept(false) {
+  {
+    auto lock = state.lockExclusive();
+    if (!lock->heartbeats.empty()) {
+      KJ_LOG(ERROR, "EventLoopWatchdog destroyed while UnixEventPorts still use it");
+    }
+    lock->shuttingDown = true;
+  }
+  thread = nullptr;
+
+  KJ_SYSCALL(sigaction(signum, &oldAction, nullptr)) { break; }
+  watchdogExists.store(false);
+}
+
+void EventLoopWatchdog::Impl::run() {
+  // Check four times per deadline, so a stall is caught within 1.25 deadlines.
+  Duration checkInterval = deadline / 4;
+
+  for (;;) {
+    Vector<Report> reports;
+
+    {
+      auto lock = state.lockExclusive();
+      lock.wait([](const State& state) { return state.shuttingDown; }, checkInterval);
+      if (lock->shuttingDown) return;
+
+      // We hold the lock while signaling so that no thread can unregister (and exit) in between.
+      int64_t now = _::WatchdogHeartbeat::now();
+      for (auto heartbeat: lock->heartbeats) {
+        int64_t since = heartbeat->busySince.load(std::memory_order_relaxed);
+        if (since == 0 || since == heartbeat->reported) continue;
+
+        Duration duration = (now - since) * NANOSECONDS;
+        if (duration < deadline) continue;
+
+        heartbeat->reported = since;
+        reports.add(captureStall(*heartbeat, duration));
+      }
+    }
+
+    for (auto& report: reports) {
+      stallCount.fetch_add(1, std::memory_order_relaxed);
+      watchdog.stalled({ report.duration, report.captured,
+                         report.stackTrace.asPtr(), report.asyncTrace.asPtr() });
+    }
+  }
+}
+
+EventLoopWatchdog::Impl::Report EventLoopWatchdog::Impl::captureStall(
+    _::WatchdogHeartbeat& heartbeat, Duration duration) {
+  capture.done.store(false, std::memory_order_relaxed);
+  capture.stackTrace = nullptr;
+  capture.asyncTrace = nullptr;
+  pendingWatchdogCapture.store(&capture, std::memory_order_release);
+
+  int error = pthread_kill(heartbeat.thread, signum);
+  if (error != 0) {
+    KJ_LOG(ERROR, "couldn't signal stalled thread", strerror(error));
+  } else {
+    // Give the handler a moment. If the thread has the signal blocked, it won't run at all.
+    auto giveUp = systemPreciseMonotonicClock().now() + 100 * MILLISECONDS;
+    while (!capture.done.load(std::memory_order_acquire) &&
+           systemPreciseMonotonicClock().now() < giveUp) {
+      usleep(1000);
+    }
+  }
+
+  if (pendingWatchdogCapture.exchange(nullptr) == nullptr) {
+    // The handler took the capture, so it's sure to finish soon if it hasn't already.
+    while (!capture.done.load(std::memory_order_acquire)) {
+      usleep(1000);
+    }
+  }
+
+  bool captured = capture.done.load(std::memory_order_acquire);
+  return {
+    duration, captured,
+    captured ? kj::heapArray(capture.stackTrace) : nullptr,
+    captured ? kj::heapArray(capture.asyncTrace) : nullptr
+  };
+}
+
+EventLoopWatchdog::EventLoopWatchdog(Duration deadline, int signum)
+    : impl(kj::heap<Impl>(*this, deadline, signum)) {}
+
+EventLoopWatchdog::~EventLoopWatchdog() noexcept(false) {}
+
+uint EventLoopWatchdog::getStallCount() const {
+  return impl->stallCount.load(std::memory_order_relaxed);
+}
+
+void EventLoopWatchdog::stalled(const Stall& stall) {
+  if (stall.captured) {
+    KJ_LOG(ERROR, "event loop stalled", stall.duration,
+        kj::str(stringifyStackTraceAddresses(stall.stackTrace),
+                stringifyStackTrace(stall.stackTrace)),
+        kj::str(stringifyStackTraceAddresses(stall.asyncTrace),
+                stringifyStackTrace(stall.asyncTrace)));
+  } else {
+    KJ_LOG(ERROR, "event loop stalled; couldn't capture its stack traces", stall.duration);
+  }
+}
+
+void UnixEventPort::setWatchdog(Maybe<EventLoopWatchdog&> watchdog) {
+  heartbeat = nullptr;
+  KJ_IF_MAYBE(w, watchdog) {
+    heartbeat = kj::heap<_::WatchdogHeartbeat>(*w->impl);
+  }
+}
+
 #if KJ_USE_EPOLL
+#if !KJ_USE_IO_URING
 // =======================================================================================
 // epoll FdObserver implementation
 
@@ -375,6 +656,8 @@ UnixEventPort::FdObserver::~FdObserver() noexcept(false) {
   KJ_SYSCALL(epoll_ctl(eventPort.epollFd, EPOLL_CTL_DEL, fd, nullptr)) { break; }
 }
 
+#endif  // !KJ_USE_IO_URING
+
 void UnixEventPort::FdObserver::fire(short events) {
   if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
     if (events & (EPOLLHUP | EPOLLRDHUP)) {
@@ -417,6 +700,9 @@ Promise<void> UnixEventPort::FdObserver::whenBecomesReadable() {
 
   auto paf = newPromiseAndFulfiller<void>();
   readFulfiller = kj::mv(paf.fulfiller);
+#if KJ_USE_IO_URING
+  arm(READ_OP, POLLIN | POLLRDHUP);
+#endif
   return kj::mv(paf.promise);
 }
 
@@ -425,6 +711,9 @@ Promise<void> UnixEventPort::FdObserver::whenBecomesWritable() {
 
   auto paf = newPromiseAndFulfiller<void>();
   writeFulfiller = kj::mv(paf.fulfiller);
+#if KJ_USE_IO_URING
+  arm(WRITE_OP, POLLOUT);
+#endif
   return kj::mv(paf.promise);
 }
 
@@ -434,16 +723,24 @@ Promise<void> UnixEventPort::FdObserver::whenUrgentDataAvailable() {
 
   auto paf = newPromiseAndFulfiller<void>();
   urgentFulfiller = kj::mv(paf.fulfiller);
+#if KJ_USE_IO_URING
+  arm(URGENT_OP, POLLPRI | POLLRDBAND);
+#endif
   return kj::mv(paf.promise);
 }
 
 Promise<void> UnixEventPort::FdObserver::whenWriteDisconnected() {
   auto paf = newPromiseAndFulfiller<void>();
   hupFulfiller = kj::mv(paf.fulfiller);
+#if KJ_USE_IO_URING
+  arm(HUP_OP, 0);
+#endif
   return kj::mv(paf.promise);
 }
 
+#if !KJ_USE_IO_URING
 bool UnixEventPort::wait() {
+  IdleScope idle(*this);
   return doEpollWait(
       timerImpl.timeoutToNextEvent(clock.now(), MILLISECONDS, int(maxValue))
           .map([](uint64_t t) -> int { return t; })
@@ -451,8 +748,10 @@ bool UnixEventPort::wait() {
 }
 
 bool UnixEventPort::poll() {
+  IdleScope idle(*this);
   return doEpollWait(0);
 }
+#endif
 
 void UnixEventPort::wake() const {
   uint64_t one = 1;
@@ -569,7 +868,7 @@ static siginfo_t toRegularSiginfo(const struct signalfd_siginfo& siginfo) {
   return result;
 }
 
-bool UnixEventPort::doEpollWait(int timeout) {
+void UnixEventPort::updateSignalFdMask() {
   sigset_t newMask;
   memset(&newMask, 0, sizeof(newMask));
   sigemptyset(&newMask);
@@ -591,6 +890,37 @@ bool UnixEventPort::doEpollWait(int timeout) {
     signalFdSigset = newMask;
     KJ_SYSCALL(signalfd(signalFd, &signalFdSigset, SFD_NONBLOCK | SFD_CLOEXEC));
   }
+}
+
+void UnixEventPort::readSignalFd() {
+  for (;;) {
+    struct signalfd_siginfo siginfo;
+    ssize_t n;
+    KJ_NONBLOCKING_SYSCALL(n = read(signalFd, &siginfo, sizeof(siginfo)));
+    if (n < 0) break;  // no more signals
+
+    KJ_ASSERT(n == sizeof(siginfo));
+
+    gotSignal(toRegularSiginfo(siginfo));
+
+#ifdef SIGRTMIN
+    if (siginfo.ssi_signo >= SIGRTMIN) {
+      // This is an RT signal. There could be multiple copies queued. We need to remove it from
+      // the signalfd's signal mask before we continue, to avoid accidentally reading and
+      // discarding the extra copies.
+      // TODO(perf): If high throughput of RT signals is desired then perhaps we should read
+      //   them all into userspace and queue them here. Maybe we even need a better interface
+      //   than onSignal() for receiving high-volume RT signals.
+      KJ_SYSCALL(sigdelset(&signalFdSigset, siginfo.ssi_signo));
+      KJ_SYSCALL(signalfd(signalFd, &signalFdSigset, SFD_NONBLOCK | SFD_CLOEXEC));
+    }
+#endif
+  }
+}
+
+#if !KJ_USE_IO_URING
+bool UnixEventPort::doEpollWait(int timeout) {
+  updateSignalFdMask();
 
   struct epoll_event events[16];
   int n = epoll_wait(epollFd, events, kj::size(events), timeout);
@@ -610,29 +940,7 @@ bool UnixEventPort::doEpollWait(int timeout) {
 
   for (int i = 0; i < n; i++) {
     if (events[i].data.u64 == 0) {
-      for (;;) {
-        struct signalfd_siginfo siginfo;
-        ssize_t n;
-        KJ_NONBLOCKING_SYSCALL(n = read(signalFd, &siginfo, sizeof(siginfo)));
-        if (n < 0) break;  // no more signals
-
-        KJ_ASSERT(n == sizeof(siginfo));
-
-        gotSignal(toRegularSiginfo(siginfo));
-
-#ifdef SIGRTMIN
-        if (siginfo.ssi_signo >= SIGRTMIN) {
-          // This is an RT signal. There could be multiple copies queued. We need to remove it from
-          // the signalfd's signal mask before we continue, to avoid accidentally reading and
-          // discarding the extra copies.
-          // TODO(perf): If high throughput of RT signals is desired then perhaps we should read
-          //   them all into userspace and queue them here. Maybe we even need a better interface
-          //   than onSignal() for receiving high-volume RT signals.
-          KJ_SYSCALL(sigdelset(&signalFdSigset, siginfo.ssi_signo));
-          KJ_SYSCALL(signalfd(signalFd, &signalFdSigset, SFD_NONBLOCK | SFD_CLOEXEC));
-        }
-#endif
-      }
+      readSignalFd();
     } else if (events[i].data.u64 == 1) {
       // Someone called wake() from another thread. Consume the event.
       uint64_t value;
@@ -652,8 +960,800 @@ bool UnixEventPort::doEpollWait(int timeout) {
 
   return woken;
 }
+#endif  // !KJ_USE_IO_URING
+
+#if KJ_USE_IO_URING
+// =======================================================================================
+// io_uring FdObserver implementation
+//
+// Instead of registering each FdObserver with an epoll set, we submit a one-shot
+// IORING_OP_POLL_ADD request whenever a promise is requested from the observer. Requests queued
+// during a turn of the event loop are submitted in the same io_uring_enter() call which waits for
+// events, so arming an observer costs no system call of its own.
+//
+// The signalfd and eventfd are watched the same way, re-armed every time they fire.
+
+namespace {
+
+constexpr uint64_t IO_URING_SIGNAL_FD = 0;
+constexpr uint64_t IO_URING_EVENT_FD = 1;
+constexpr uint64_t IO_URING_POLL_REMOVE = 2;
+// Special values of `user_data`. Any other value is a pointer to a PollOp.
+
+constexpr uint IO_URING_ENTRIES = 256;
+
+void* mapIoUringRegion(int fd, size_t size, off_t offset) {
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (ptr == MAP_FAILED) {
+    KJ_FAIL_SYSCALL("mmap(io_uring)", errno);
+  }
+  return ptr;
+}
+
+}  // namespace
+
+class UnixEventPort::IoUring {
+  // Minimal wrapper around the raw io_uring system calls and shared rings. We don't depend on
+  // liburing; we only need a handful of operations.
+
+public:
+  IoUring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int ret;
+    KJ_SYSCALL(ret = syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params));
+    fd = AutoCloseFd(ret);
+
+    KJ_REQUIRE(params.features & IORING_FEAT_EXT_ARG,
+        "KJ_USE_IO_URING requires Linux 5.11 or newer (missing IORING_FEAT_EXT_ARG)");
+    KJ_REQUIRE(params.features & IORING_FEAT_NODROP,
+        "KJ_USE_IO_URING requires Linux 5.5 or newer (missing IORING_FEAT_NODROP)");
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize = cqRingSize = kj::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mapIoUringRegion(fd, sqRingSize, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cqRing = sqRing;
+    } else {
+      cqRing = mapIoUringRegion(fd, cqRingSize, IORING_OFF_CQ_RING);
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = reinterpret_cast<struct io_uring_sqe*>(
+        mapIoUringRegion(fd, sqesSize, IORING_OFF_SQES));
+
+    byte* sq = reinterpret_cast<byte*>(sqRing);
+    sqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    sqFlags = reinterpret_cast<uint32_t*>(sq + params.sq_off.flags);
+    sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+
+    byte* cq = reinterpret_cast<byte*>(cqRing);
+    cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  ~IoUring() noexcept(false) {
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing) munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+  }
+
+  KJ_DISALLOW_COPY(IoUring);
+
+  void queuePoll(int pollFd, short events, uint64_t userData) {
+    auto& sqe = nextSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = pollFd;
+    sqe.poll_events = events;
+    sqe.user_data = userData;
+    publishSqe();
+  }
+
+  void queuePollRemove(uint64_t target) {
+    auto& sqe = nextSqe();
+    sqe.opcode = IORING_OP_POLL_REMOVE;
+    sqe.fd = -1;
+    sqe.addr = target;
+    sqe.user_data = IO_URING_POLL_REMOVE;
+    publishSqe();
+  }
+
+  bool hasPendingSubmissions() { return pendingSubmissions > 0; }
+
+  bool hasOverflow() {
+    return __atomic_load_n(sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;
+  }
+
+  void enter(uint minComplete, Maybe<uint64_t> timeoutNs, bool getEvents = true) {
+    // Submits all queued requests and, if `minComplete` is non-zero, waits until at least that
+    // many completions are available or the timeout expires. With `getEvents`, completions which
+    // overflowed the completion ring are also flushed back into it.
+
+    struct __kernel_timespec ts;
+    memset(&ts, 0, sizeof(ts));
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    KJ_IF_MAYBE(t, timeoutNs) {
+      ts.tv_sec = *t / 1000000000;
+      ts.tv_nsec = *t % 1000000000;
+      arg.ts = reinterpret_cast<uintptr_t>(&ts);
+    }
+
+    uint flags = IORING_ENTER_EXT_ARG;
+    if (getEvents) flags |= IORING_ENTER_GETEVENTS;
+
+    long n = syscall(__NR_io_uring_enter, fd.get(), pendingSubmissions, minComplete, flags,
+                     &arg, sizeof(arg));
+    if (n < 0) {
+      int error = errno;
+      switch (error) {
+        case EINTR:
+        case ETIME:
+        case EBUSY:
+          // Interrupted, timed out, or the completion queue is backed up. In all cases the
+          // caller will drain whatever completions are available and return to the event loop.
+          break;
+        default:
+          KJ_FAIL_SYSCALL("io_uring_enter()", error);
+      }
+    } else {
+      KJ_ASSERT(n <= pendingSubmissions);
+      pendingSubmissions -= n;
+    }
+  }
+
+  template <typename Func>
+  void drain(Func&& func) {
+    // Calls `func(userData, res)` for each available completion.
+
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      auto& cqe = cqes[head & cqMask];
+      uint64_t userData = cqe.user_data;
+      int32_t res = cqe.res;
+      ++head;
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      func(userData, res);
+      if (head == tail) tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    }
+  }
+
+private:
+  AutoCloseFd fd;
+  void* sqRing;
+  void* cqRing;
+  size_t sqRingSize;
+  size_t cqRingSize;
+  struct io_uring_sqe* sqes;
+  size_t sqesSize;
+
+  uint32_t* sqHead;
+  uint32_t* sqTail;
+  uint32_t* sqFlags;
+  uint32_t* sqArray;
+  uint32_t sqMask;
+  uint32_t sqEntries;
+
+  uint32_t* cqHead;
+  uint32_t* cqTail;
+  uint32_t cqMask;
+  struct io_uring_cqe* cqes;
+
+  uint pendingSubmissions = 0;
+  // Number of SQEs published to the submission ring but not yet passed to io_uring_enter().
+
+  struct io_uring_sqe& nextSqe() {
+    if (pendingSubmissions == sqEntries) {
+      // Submission queue is full; push it to the kernel without waiting. Without SQPOLL, the
+      // kernel consumes everything we submit before io_uring_enter() returns.
+      enter(0, nullptr, false);
+      KJ_ASSERT(pendingSubmissions < sqEntries);
+    }
+
+    uint32_t tail = *sqTail;
+    auto& sqe = sqes[tail & sqMask];
+    memset(&sqe, 0, sizeof(sqe));
+    return sqe;
+  }
+
+  void publishSqe() {
+    uint32_t tail = *sqTail;
+    sqArray[tail & sqMask] = tail & sqMask;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++pendingSubmissions;
+  }
+};
+
+struct UnixEventPort::PollOp {
+  FdObserver* observer;
+  // Null if the observer was destroyed while the request was in flight.
+
+  short events;
+  bool inFlight = false;
+
+  PollOp* nextFree = nullptr;
+};
+
+UnixEventPort::UnixEventPort()
+    : clock(systemPreciseMonotonicClock()),
+      timerImpl(clock.now()),
+      ring(kj::heap<IoUring>()),
+      signalFd(-1),
+      eventFd(-1) {
+  ignoreSigpipe();
+
+  int fd;
+
+  memset(&signalFdSigset, 0, sizeof(signalFdSigset));
+
+  KJ_SYSCALL(sigemptyset(&signalFdSigset));
+  KJ_SYSCALL(fd = signalfd(-1, &signalFdSigset, SFD_NONBLOCK | SFD_CLOEXEC));
+  signalFd = AutoCloseFd(fd);
+
+  KJ_SYSCALL(fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  eventFd = AutoCloseFd(fd);
+
+  ring->queuePoll(signalFd, POLLIN, IO_URING_SIGNAL_FD);
+  ring->queuePoll(eventFd, POLLIN, IO_URING_EVENT_FD);
+}
+
+UnixEventPort::~UnixEventPort() noexcept(false) {
+  if (childSet != nullptr) {
+    // We had claimed the exclusive right to call onChildExit(). Release that right.
+    threadClaimedChildExits = false;
+  }
+
+  // Closing the ring cancels all outstanding requests, after which the PollOps can be freed.
+  ring = nullptr;
+}
+
+UnixEventPort::PollOp& UnixEventPort::allocPollOp(FdObserver& observer, short events) {
+  PollOp* op = freePollOps;
+  if (op == nullptr) {
+    auto newOp = kj::heap<PollOp>();
+    op = newOp;
+    pollOps.add(kj::mv(newOp));
+  } else {
+    freePollOps = op->nextFree;
+    op->nextFree = nullptr;
+  }
+
+  op->observer = &observer;
+  op->events = events;
+  return *op;
+}
+
+void UnixEventPort::releasePollOp(PollOp& op) {
+  if (op.inFlight) {
+    // The completion will still arrive and refer to this op, so we can't reuse it yet. Ask the
+    // kernel to cancel the request; the op is freed when its completion is drained.
+    op.observer = nullptr;
+    ring->queuePollRemove(reinterpret_cast<uintptr_t>(&op));
+  } else {
+    op.observer = nullptr;
+    op.nextFree = freePollOps;
+    freePollOps = &op;
+  }
+}
+
+void UnixEventPort::armPoll(PollOp& op) {
+  KJ_IREQUIRE(op.observer != nullptr);
+  if (!op.inFlight) {
+    ring->queuePoll(op.observer->fd, op.events, reinterpret_cast<uintptr_t>(&op));
+    op.inFlight = true;
+  }
+}
+
+UnixEventPort::FdObserver::FdObserver(UnixEventPort& eventPort, int fd, uint flags)
+    : eventPort(eventPort), fd(fd), flags(flags) {}
+
+UnixEventPort::FdObserver::~FdObserver() noexcept(false) {
+  for (auto op: pollOps) {
+    if (op != nullptr) {
+      eventPort.releasePollOp(*op);
+    }
+  }
+}
+
+void UnixEventPort::FdObserver::arm(uint index, short events) {
+  // Note that POLLERR and POLLHUP are always reported, regardless of `events`. Also note that the
+  // poll event bits have the same values as the EPOLL* bits expected by fire().
+  //
+  // Urgent data requests also ask for POLLRDBAND: a poll request is only woken when the wakeup
+  // matches its mask, and TCP signals the arrival of out-of-band data with POLLRDBAND rather than
+  // POLLPRI. (epoll doesn't have this problem because it always also watches POLLIN.)
+
+  PollOp*& op = pollOps[index];
+  if (op == nullptr) {
+    op = &eventPort.allocPollOp(*this, events);
+  }
+  eventPort.armPoll(*op);
+}
+
+void UnixEventPort::FdObserver::rearm() {
+  // Re-submit poll requests for any promises which are still waiting. A completion for one kind
+  // of request may satisfy several promises, while the others' requests stay in flight; this is
+  // a no-op for those.
+
+  if (readFulfiller != nullptr) arm(READ_OP, POLLIN | POLLRDHUP);
+  if (writeFulfiller != nullptr) arm(WRITE_OP, POLLOUT);
+  if (urgentFulfiller != nullptr) arm(URGENT_OP, POLLPRI | POLLRDBAND);
+  if (hupFulfiller != nullptr) arm(HUP_OP, 0);
+}
+
+bool UnixEventPort::wait() {
+  IdleScope idle(*this);
+  return doIoUringWait(true,
+      timerImpl.timeoutToNextEvent(clock.now(), NANOSECONDS, kj::maxValue));
+}
+
+bool UnixEventPort::poll() {
+  IdleScope idle(*this);
+  return doIoUringWait(false, nullptr);
+}
+
+bool UnixEventPort::doIoUringWait(bool block, Maybe<uint64_t> timeoutNs) {
+  updateSignalFdMask();
+
+  if (block) {
+    ring->enter(1, timeoutNs);
+  } else if (ring->hasPendingSubmissions() || ring->hasOverflow()) {
+    // If nothing was queued and nothing overflowed, there's no need for a syscall; we can just
+    // look at the completion ring.
+    ring->enter(0, nullptr);
+  }
+
+  bool woken = false;
+
+  for (;;) {
+    ring->drain([&](uint64_t userData, int32_t res) {
+      if (userData == IO_URING_SIGNAL_FD) {
+        readSignalFd();
+        ring->queuePoll(signalFd, POLLIN, IO_URING_SIGNAL_FD);
+      } else if (userData == IO_URING_EVENT_FD) {
+        // Someone called wake() from another thread. Consume the event.
+        uint64_t value;
+        ssize_t n;
+        KJ_NONBLOCKING_SYSCALL(n = read(eventFd, &value, sizeof(value)));
+        KJ_ASSERT(n < 0 || n == sizeof(value));
+        ring->queuePoll(eventFd, POLLIN, IO_URING_EVENT_FD);
+
+        // We were woken. Need to return true.
+        woken = true;
+      } else if (userData == IO_URING_POLL_REMOVE) {
+        // Result of cancelling a request for a destroyed observer. Nothing to do; the cancelled
+        // request's own completion frees the op.
+      } else {
+        PollOp& op = *reinterpret_cast<PollOp*>(userData);
+        op.inFlight = false;
+        KJ_IF_MAYBE(observer, op.observer) {
+          // If the request failed outright, wake everyone up so that they discover the error by
+          // performing the actual I/O.
+          short events = res < 0 ? POLLERR : res;
+          if (events & POLLRDBAND) events |= POLLPRI;  // see FdObserver::arm()
+          observer->fire(events);
+          observer->rearm();
+        } else {
+          releasePollOp(op);
+        }
+      }
+    });
+
+    if (!ring->hasOverflow()) break;
+
+    // Completions overflowed the completion ring and were buffered by the kernel. Flush them
+    // into the ring and go around again.
+    ring->enter(0, nullptr);
+  }
+
+  timerImpl.advanceTo(clock.now());
+
+  return woken;
+}
+
+#endif  // KJ_USE_IO_URING
+
+#elif KJ_USE_KQUEUE
+// =======================================================================================
+// kqueue FdObserver implementation
+
+namespace {
+
+void setKevent(struct kevent& event, uintptr_t ident, short filter, uint flags,
+               uint fflags = 0, void* udata = nullptr) {
+  // `udata` is a `void*` on most systems, but an `intptr_t` on older NetBSD, hence the cast.
+  EV_SET(&event, ident, filter, flags, fflags, 0, reinterpret_cast<decltype(event.udata)>(udata));
+}
+
+void* getUdata(const struct kevent& event) {
+  return reinterpret_cast<void*>(event.udata);
+}
+
+}  // namespace
+
+UnixEventPort::UnixEventPort()
+    : clock(systemPreciseMonotonicClock()),
+      timerImpl(clock.now()) {
+  ignoreSigpipe();
+
+  int fd;
+  KJ_SYSCALL(fd = kqueue());
+  kqueueFd = AutoCloseFd(fd);
+  KJ_SYSCALL(fcntl(kqueueFd, F_SETFD, FD_CLOEXEC));
+
+  KJ_SYSCALL(sigemptyset(&kqueueSignals));
+
+  struct kevent event;
+#ifdef EVFILT_USER
+  setKevent(event, 0, EVFILT_USER, EV_ADD | EV_CLEAR);
+#else
+  // No EVFILT_USER on this system, so fall back to a pipe for cross-thread wakeups.
+  int fds[2];
+  KJ_SYSCALL(pipe(fds));
+  wakePipeIn = kj::AutoCloseFd(fds[0]);
+  wakePipeOut = kj::AutoCloseFd(fds[1]);
+  KJ_SYSCALL(fcntl(wakePipeIn, F_SETFD, FD_CLOEXEC));
+  KJ_SYSCALL(fcntl(wakePipeOut, F_SETFD, FD_CLOEXEC));
+  KJ_SYSCALL(fcntl(wakePipeIn, F_SETFL, O_NONBLOCK));
+  KJ_SYSCALL(fcntl(wakePipeOut, F_SETFL, O_NONBLOCK));
+  setKevent(event, wakePipeIn.get(), EVFILT_READ, EV_ADD | EV_CLEAR);
+#endif
+  KJ_SYSCALL(kevent(kqueueFd, &event, 1, nullptr, 0, nullptr));
+}
+
+UnixEventPort::~UnixEventPort() noexcept(false) {
+  if (childSet != nullptr) {
+    // We had claimed the exclusive right to call onChildExit(). Release that right.
+    threadClaimedChildExits = false;
+  }
+}
+
+UnixEventPort::FdObserver::FdObserver(UnixEventPort& eventPort, int fd, uint flags)
+    : eventPort(eventPort), fd(fd), flags(flags) {
+  struct kevent events[3];
+  int count = 0;
+
+  // EV_CLEAR makes each filter edge-triggered, like EPOLLET.
+  if (flags & OBSERVE_READ) {
+    setKevent(events[count++], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, this);
+  }
+  if (flags & OBSERVE_WRITE) {
+    setKevent(events[count++], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, this);
+    writeFilterRegistered = true;
+  }
+  if (flags & OBSERVE_URGENT) {
+#ifdef EVFILT_EXCEPT
+    setKevent(events[count++], fd, EVFILT_EXCEPT, EV_ADD | EV_CLEAR, NOTE_OOB, this);
+#else
+    KJ_UNIMPLEMENTED("OBSERVE_URGENT requires EVFILT_EXCEPT, which this system lacks");
+#endif
+  }
+
+  if (count > 0) {
+    KJ_SYSCALL(kevent(eventPort.kqueueFd, events, count, nullptr, 0, nullptr));
+  }
+}
+
+UnixEventPort::FdObserver::~FdObserver() noexcept(false) {
+  struct kevent events[3];
+  int count = 0;
+
+  if (flags & OBSERVE_READ) {
+    setKevent(events[count++], fd, EVFILT_READ, EV_DELETE);
+  }
+  if (writeFilterRegistered) {
+    setKevent(events[count++], fd, EVFILT_WRITE, EV_DELETE);
+  }
+#ifdef EVFILT_EXCEPT
+  if (flags & OBSERVE_URGENT) {
+    setKevent(events[count++], fd, EVFILT_EXCEPT, EV_DELETE);
+  }
+#endif
+
+  if (count > 0) {
+    KJ_SYSCALL(kevent(eventPort.kqueueFd, events, count, nullptr, 0, nullptr)) { break; }
+  }
+}
+
+void UnixEventPort::FdObserver::fire(const struct kevent& event) {
+  switch (event.filter) {
+    case EVFILT_READ:
+      // EV_EOF means the other end has shut down, though there may still be data left to read.
+      // Its absence tells us that we're not at the end.
+      atEnd = (event.flags & EV_EOF) != 0;
+
+      KJ_IF_MAYBE(f, readFulfiller) {
+        f->get()->fulfill();
+        readFulfiller = nullptr;
+      }
+      break;
+
+    case EVFILT_WRITE:
+      if (event.flags & EV_EOF) {
+        KJ_IF_MAYBE(f, hupFulfiller) {
+          f->get()->fulfill();
+          hupFulfiller = nullptr;
+        }
+      }
+
+      KJ_IF_MAYBE(f, writeFulfiller) {
+        f->get()->fulfill();
+        writeFulfiller = nullptr;
+      }
+      break;
+
+#ifdef EVFILT_EXCEPT
+    case EVFILT_EXCEPT:
+      KJ_IF_MAYBE(f, urgentFulfiller) {
+        f->get()->fulfill();
+        urgentFulfiller = nullptr;
+      }
+      break;
+#endif
+  }
+}
+
+Promise<void> UnixEventPort::FdObserver::whenBecomesReadable() {
+  KJ_REQUIRE(flags & OBSERVE_READ, "FdObserver was not set to observe reads.");
+
+  auto paf = newPromiseAndFulfiller<void>();
+  readFulfiller = kj::mv(paf.fulfiller);
+  return kj::mv(paf.promise);
+}
+
+Promise<void> UnixEventPort::FdObserver::whenBecomesWritable() {
+  KJ_REQUIRE(flags & OBSERVE_WRITE, "FdObserver was not set to observe writes.");
+
+  auto paf = newPromiseAndFulfiller<void>();
+  writeFulfiller = kj::mv(paf.fulfiller);
+  return kj::mv(paf.promise);
+}
+
+Promise<void> UnixEventPort::FdObserver::whenUrgentDataAvailable() {
+  KJ_REQUIRE(flags & OBSERVE_URGENT,
+      "FdObserver was not set to observe availability of urgent data.");
+
+  auto paf = newPromiseAndFulfiller<void>();
+  urgentFulfiller = kj::mv(paf.fulfiller);
+  return kj::mv(paf.promise);
+}
+
+Promise<void> UnixEventPort::FdObserver::whenWriteDisconnected() {
+  if (!writeFilterRegistered) {
+    // kqueue reports disconnects as EV_EOF on the write filter. If the fd is already disconnected
+    // then the first event will say so; otherwise the first event merely reports writability,
+    // which fire() ignores since nobody is waiting for it.
+    struct kevent event;
+    setKevent(event, fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, this);
+    KJ_SYSCALL(kevent(eventPort.kqueueFd, &event, 1, nullptr, 0, nullptr));
+    writeFilterRegistered = true;
+  }
+
+  auto paf = newPromiseAndFulfiller<void>();
+  hupFulfiller = kj::mv(paf.fulfiller);
+  return kj::mv(paf.promise);
+}
+
+bool UnixEventPort::wait() {
+  IdleScope idle(*this);
+  KJ_IF_MAYBE(t, timerImpl.timeoutToNextEvent(clock.now(), NANOSECONDS, kj::maxValue)) {
+    struct timespec timeout;
+    timeout.tv_sec = *t / 1000000000;
+    timeout.tv_nsec = *t % 1000000000;
+    return doKqueueWait(&timeout);
+  } else {
+    return doKqueueWait(nullptr);
+  }
+}
+
+bool UnixEventPort::poll() {
+  IdleScope idle(*this);
+  struct timespec timeout;
+  memset(&timeout, 0, sizeof(timeout));
+  return doKqueueWait(&timeout);
+}
+
+void UnixEventPort::wake() const {
+#ifdef EVFILT_USER
+  struct kevent event;
+  setKevent(event, 0, EVFILT_USER, 0, NOTE_TRIGGER);
+  KJ_SYSCALL(kevent(kqueueFd, &event, 1, nullptr, 0, nullptr));
+#else
+  // If this write() fails with EWOULDBLOCK, we don't care, because the target thread is already
+  // scheduled to wake up.
+  char c = 0;
+  KJ_NONBLOCKING_SYSCALL(write(wakePipeOut, &c, 1));
+#endif
+}
+
+bool UnixEventPort::getWantedSignals(sigset_t& wanted) {
+  // Computes the set of signals that someone is waiting for, making sure the kqueue reports each
+  // of them. Returns false if there are none.
+  //
+  // We never unregister signals. EVFILT_SIGNAL merely tells us that a signal was sent; since the
+  // signal is blocked, it remains pending until we consume it, and we only consume signals that
+  // someone is waiting for. So a stale registration costs at most a spurious wakeup.
+
+  sigemptyset(&wanted);
+  bool any = false;
+
+  auto add = [&](int signum) {
+    sigaddset(&wanted, signum);
+    any = true;
+    if (!sigismember(&kqueueSignals, signum)) {
+      struct kevent event;
+      setKevent(event, signum, EVFILT_SIGNAL, EV_ADD);
+      KJ_SYSCALL(kevent(kqueueFd, &event, 1, nullptr, 0, nullptr));
+      sigaddset(&kqueueSignals, signum);
+    }
+  };
+
+  for (auto ptr = signalHead; ptr != nullptr; ptr = ptr->next) {
+    add(ptr->signum);
+  }
+  if (childSet != nullptr) {
+    add(SIGCHLD);
+  }
+
+  return any;
+}
+
+void UnixEventPort::readPendingSignals(const sigset_t& wantedParam) {
+  // Consumes and dispatches any pending signals in `wanted`. Note that kqueue only tells us a
+  // signal was sent, not its siginfo, so we fetch that by consuming the (blocked, pending) signal.
+
+  sigset_t wanted = wantedParam;
+
+  for (;;) {
+    sigset_t pending;
+    KJ_SYSCALL(sigpending(&pending));
+
+    int signum = 0;
+    for (int i = 1; i < NSIG; i++) {
+      if (sigismember(&wanted, i) && sigismember(&pending, i)) {
+        signum = i;
+        break;
+      }
+    }
+    if (signum == 0) break;
+
+    sigset_t only;
+    sigemptyset(&only);
+    sigaddset(&only, signum);
+
+    siginfo_t siginfo;
+    memset(&siginfo, 0, sizeof(siginfo));
+#if __APPLE__
+    // macOS lacks sigtimedwait(), and its sigwait() only reports the signal number. But the signal
+    // is pending, so sigwait() won't block.
+    int error = sigwait(&only, &siginfo.si_signo);
+    if (error != 0) {
+      KJ_FAIL_SYSCALL("sigwait()", error);
+    }
+#else
+    struct timespec zero;
+    memset(&zero, 0, sizeof(zero));
+    int n = sigtimedwait(&only, &siginfo, &zero);
+    if (n < 0) {
+      int error = errno;
+      if (error == EAGAIN) {
+        // Someone else consumed it first.
+        sigdelset(&wanted, signum);
+        continue;
+      } else if (error == EINTR) {
+        continue;
+      }
+      KJ_FAIL_SYSCALL("sigtimedwait()", error);
+    }
+#endif
+
+    gotSignal(siginfo);
+
+#ifdef SIGRTMIN
+    if (signum >= SIGRTMIN) {
+      // This is an RT signal. There could be multiple copies queued, but we don't want to discard
+      // the extras if nobody is waiting for them anymore, so leave them for the next turn. (See
+      // the equivalent logic in the epoll implementation's readSignalFd().)
+      sigdelset(&wanted, signum);
+    }
+#endif
+  }
+}
+
+bool UnixEventPort::doKqueueWait(struct timespec* timeout) {
+  struct timespec zero;
+  memset(&zero, 0, sizeof(zero));
+
+  sigset_t wanted;
+  if (getWantedSignals(wanted)) {
+    // A signal which arrived before anyone was waiting for it will still be pending, but kqueue
+    // won't tell us about it again, so check for it now. If we find any, don't block.
+    //
+    // TODO(perf): This costs a sigpending() per turn, but only while signals are being awaited.
+    sigset_t pending;
+    KJ_SYSCALL(sigpending(&pending));
+    for (int i = 1; i < NSIG; i++) {
+      if (sigismember(&wanted, i) && sigismember(&pending, i)) {
+        readPendingSignals(wanted);
+        getWantedSignals(wanted);
+        timeout = &zero;
+        break;
+      }
+    }
+  }
+
+  struct kevent events[16];
+  int n = kevent(kqueueFd, nullptr, 0, events, kj::size(events), timeout);
+  if (n < 0) {
+    int error = errno;
+    if (error == EINTR) {
+      // We can't simply restart the kevent call because we need to recompute the timeout. Instead,
+      // we pretend kevent() returned zero events. This will cause the event loop to spin once,
+      // decide it has nothing to do, recompute timeouts, then return to waiting.
+      n = 0;
+    } else {
+      KJ_FAIL_SYSCALL("kevent()", error);
+    }
+  }
+
+  bool woken = false;
+  bool gotSignals = false;
+
+  for (int i = 0; i < n; i++) {
+    switch (events[i].filter) {
+#ifdef EVFILT_USER
+      case EVFILT_USER:
+        // Someone called wake() from another thread. EV_CLEAR already reset the trigger.
+        woken = true;
+        break;
+#endif
+
+      case EVFILT_SIGNAL:
+        gotSignals = true;
+        break;
+
+      default: {
+        FdObserver* observer = reinterpret_cast<FdObserver*>(getUdata(events[i]));
+#ifndef EVFILT_USER
+        if (observer == nullptr) {
+          // Our cross-thread wake pipe. Discard its contents.
+          woken = true;
+          char junk[256];
+          ssize_t n;
+          do {
+            KJ_NONBLOCKING_SYSCALL(n = read(wakePipeIn, junk, sizeof(junk)));
+          } while (n >= 256);
+          break;
+        }
+#endif
+        observer->fire(events[i]);
+        break;
+      }
+    }
+  }
+
+  if (gotSignals) {
+    // Some handlers may have been removed by events fired above, so rebuild the set.
+    getWantedSignals(wanted);
+    readPendingSignals(wanted);
+  }
+
+  timerImpl.advanceTo(clock.now());
+
+  return woken;
+}
 
-#else  // KJ_USE_EPOLL
+#else  // KJ_USE_EPOLL, KJ_USE_KQUEUE
 // =======================================================================================
 // Traditional poll() FdObserver implementation.
 
@@ -910,6 +2010,7 @@ private:
 };
 
 bool UnixEventPort::wait() {
+  IdleScope idle(*this);
   sigset_t newMask;
   sigemptyset(&newMask);
 
@@ -978,6 +2079,7 @@ bool UnixEventPort::wait() {
 }
 
 bool UnixEventPort::poll() {
+  IdleScope idle(*this);
   // volatile so that longjmp() doesn't clobber it.
   volatile bool woken = false;
 
@@ -1089,7 +2191,7 @@ void UnixEventPort::wake() const {
 #endif
 }
 
-#endif  // KJ_USE_EPOLL, else
+#endif  // KJ_USE_EPOLL, KJ_USE_KQUEUE, else
 
 }  // namespace kj
 
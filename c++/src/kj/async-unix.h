@@ -38,6 +38,23 @@ KJ_BEGIN_HEADER
 #define KJ_USE_EPOLL 1
 #endif
 
+#if KJ_USE_KQUEUE
+// The kqueue backend is opt-in (define KJ_USE_KQUEUE=1, or configure CMake with WITH_KQUEUE=ON)
+// for macOS and the BSDs, where it replaces poll(). It is not yet the default because it hasn't
+// seen much use there.
+#if KJ_USE_EPOLL
+#error "KJ_USE_KQUEUE and KJ_USE_EPOLL are mutually exclusive."
+#endif
+#endif
+
+#if KJ_USE_IO_URING
+// The io_uring backend is opt-in (requires Linux 5.11 or newer). It replaces epoll for watching
+// file descriptors, but otherwise shares the signalfd/eventfd machinery of the epoll backend.
+#if !KJ_USE_EPOLL
+#error "KJ_USE_IO_URING requires KJ_USE_EPOLL (it's only supported on Linux)."
+#endif
+#endif
+
 #if __CYGWIN__ && !defined(KJ_USE_PIPE_FOR_WAKEUP)
 // Cygwin has serious issues with the intersection of signals and threads, reported here:
 //     https://cygwin.com/ml/cygwin/2019-07/msg00052.html
@@ -46,13 +63,21 @@ KJ_BEGIN_HEADER
 #define KJ_USE_PIPE_FOR_WAKEUP 1
 #endif
 
+#if KJ_USE_KQUEUE
+struct kevent;
+#endif
+
 namespace kj {
 
+class EventLoopWatchdog;
+namespace _ { class WatchdogHeartbeat; }
+
 class UnixEventPort: public EventPort {
   // An EventPort implementation which can wait for events on file descriptors as well as signals.
   // This API only makes sense on Unix.
   //
-  // The implementation uses `poll()` or possibly a platform-specific API (e.g. epoll, kqueue).
+  // The implementation uses `poll()` or possibly a platform-specific API (e.g. epoll, kqueue,
+  // io_uring when built with KJ_USE_IO_URING).
   // To also wait on signals without race conditions, the implementation may block signals until
   // just before `poll()` while using a signal handler which `siglongjmp()`s back to just before
   // the signal was unblocked, or it may use a nicer platform-specific API like signalfd.
@@ -104,6 +129,11 @@ public:
 
   Timer& getTimer() { return timerImpl; }
 
+  void useTimerWheel(Duration resolution = 1 * MILLISECONDS) {
+    timerImpl.useTimerWheel(resolution);
+  }
+  // Track this port's timers in a timer wheel. See `TimerImpl::useTimerWheel()`.
+
   Promise<int> onChildExit(Maybe<pid_t>& pid);
   // When the given child process exits, resolves to its wait status, as returned by wait(2). You
   // will need to use the WIFEXITED() etc. macros to interpret the status code.
@@ -139,6 +169,11 @@ public:
   // This method may capture the `SIGCHLD` signal. You must not use `captureSignal(SIGCHLD)` nor
   // `onSignal(SIGCHLD)` in your own code if you use `captureChildExit()`.
 
+  void setWatchdog(Maybe<EventLoopWatchdog&> watchdog);
+  // Starts (or, given null, stops) publishing heartbeats from this port's thread to `watchdog`,
+  // which will report this thread if its event loop stalls. Must be called on this port's thread.
+  // The watchdog must outlive the port or be replaced first.
+
   // implements EventPort ------------------------------------------------------
   bool wait() override;
   bool poll() override;
@@ -156,10 +191,33 @@ private:
 
   void gotSignal(const siginfo_t& siginfo);
 
+  class IdleScope;
+  Own<_::WatchdogHeartbeat> heartbeat;
+  // Non-null while a watchdog is set.
+
   friend class TimerPromiseAdapter;
 
 #if KJ_USE_EPOLL
+#if KJ_USE_IO_URING
+  class IoUring;
+  struct PollOp;
+
+  Own<IoUring> ring;
+
+  Vector<Own<PollOp>> pollOps;
+  PollOp* freePollOps = nullptr;
+  // All PollOps ever allocated by this port, and the ones which are currently unused. A PollOp
+  // whose FdObserver is destroyed while a poll request is in flight stays alive until the
+  // kernel reports the request's completion, since the completion refers to it by address.
+
+  PollOp& allocPollOp(FdObserver& observer, short events);
+  void releasePollOp(PollOp& op);
+  void armPoll(PollOp& op);
+
+  bool doIoUringWait(bool block, Maybe<uint64_t> timeoutNs);
+#else
   AutoCloseFd epollFd;
+#endif
   AutoCloseFd signalFd;
   AutoCloseFd eventFd;   // Used for cross-thread wakeups.
 
@@ -167,7 +225,26 @@ private:
   // Signal mask as currently set on the signalFd. Tracked so we can detect whether or not it
   // needs updating.
 
+  void updateSignalFdMask();
+  void readSignalFd();
+
+#if !KJ_USE_IO_URING
   bool doEpollWait(int timeout);
+#endif
+
+#elif KJ_USE_KQUEUE
+  AutoCloseFd kqueueFd;
+
+  AutoCloseFd wakePipeIn;
+  AutoCloseFd wakePipeOut;
+  // Used for cross-thread wakeups only on systems which lack EVFILT_USER.
+
+  sigset_t kqueueSignals;
+  // Signals which have been registered with the kqueue, via EVFILT_SIGNAL.
+
+  bool getWantedSignals(sigset_t& wanted);
+  void readPendingSignals(const sigset_t& wanted);
+  bool doKqueueWait(struct timespec* timeout);
 
 #else
   class PollContext;
@@ -306,9 +383,26 @@ private:
 
   Maybe<bool> atEnd;
 
+#if KJ_USE_KQUEUE
+  bool writeFilterRegistered = false;
+  // Whether an EVFILT_WRITE filter has been registered. It is always registered with
+  // OBSERVE_WRITE, and otherwise only once whenWriteDisconnected() is called.
+
+  void fire(const struct kevent& event);
+#else
   void fire(short events);
+#endif
 
-#if !KJ_USE_EPOLL
+#if KJ_USE_IO_URING
+  enum { READ_OP, WRITE_OP, URGENT_OP, HUP_OP, OP_COUNT };
+  PollOp* pollOps[OP_COUNT] = {};
+  // One-shot poll requests, one per kind of promise, allocated on first use.
+
+  void arm(uint index, short events);
+  void rearm();
+#endif
+
+#if !KJ_USE_EPOLL && !KJ_USE_KQUEUE
   FdObserver* next;
   FdObserver** prev;
   // Linked list of observers which currently have a non-null readFulfiller or writeFulfiller.
@@ -320,6 +414,58 @@ private:
   friend class UnixEventPort;
 };
 
+class EventLoopWatchdog {
+  // Catches event loops which are stuck: blocked in a syscall, spinning in a loop, or otherwise
+  // failing to get back to their UnixEventPort. Each thread opts in with
+  // `UnixEventPort::setWatchdog()`, after which its port publishes a heartbeat whenever the loop
+  // comes back to wait or poll for I/O. A background thread checks the heartbeats; when a loop has
+  // been away for longer than the deadline, it signals the loop's thread, whose signal handler
+  // captures the thread's native stack trace and `getAsyncTrace()`, and then reports the stall
+  // through `stalled()`. This lets you diagnose a production stall without attaching a debugger.
+  //
+  // Note that a loop working through a long queue of short events without ever polling for I/O
+  // counts as stalled too, since its I/O is starved all the same.
+  //
+  // The watchdog installs a handler for `signum`, which must not be used for anything else (in
+  // particular, don't pass it to `UnixEventPort::captureSignal()`). A thread which blocks the
+  // signal is still reported, but without stack traces. Only one watchdog may exist at a time.
+
+public:
+  explicit EventLoopWatchdog(Duration deadline = 1 * SECONDS, int signum = SIGUSR2);
+  virtual ~EventLoopWatchdog() noexcept(false);
+  KJ_DISALLOW_COPY(EventLoopWatchdog);
+
+  struct Stall {
+    Duration duration;
+    // How long the loop had been away from its port when the stall was detected.
+
+    bool captured;
+    // Whether the thread's signal handler ran in time to capture the traces below. If not, both
+    // are empty.
+
+    ArrayPtr<void* const> stackTrace;
+    // The stalled thread's native stack trace at the time of the signal.
+
+    ArrayPtr<void* const> asyncTrace;
+    // The async trace of the event the loop was running, as from `getAsyncTrace()`. Empty if the
+    // thread wasn't running an event, e.g. if it was stuck in code outside the event loop.
+  };
+
+  uint getStallCount() const;
+  // Number of stalls reported so far. Each stall is reported once, however long it lasts.
+
+protected:
+  virtual void stalled(const Stall& stall);
+  // Called on the watchdog's thread for each stall. The default implementation logs an error.
+
+private:
+  struct Impl;
+  Own<Impl> impl;
+
+  friend class UnixEventPort;
+  friend class _::WatchdogHeartbeat;
+};
+
 }  // namespace kj
 
 KJ_END_HEADER
@@ -196,8 +196,13 @@ void Win32IocpEventPort::waitIocp(DWORD timeoutMs) {
         if (entry.lpOverlapped->Internal != STATUS_SUCCESS) {
           error = LsaNtStatusToWinError(entry.lpOverlapped->Internal);
         }
-        static_cast<IoPromiseAdapter*>(entry.lpOverlapped)
-            ->done(IoResult { error, entry.dwNumberOfBytesTransferred });
+        IoResult result { error, entry.dwNumberOfBytesTransferred };
+        if (entry.lpCompletionKey != 0) {
+          reinterpret_cast<CompletionHandler*>(entry.lpCompletionKey)
+              ->complete(entry.lpOverlapped, result);
+        } else {
+          static_cast<IoPromiseAdapter*>(entry.lpOverlapped)->done(result);
+        }
       }
     } else {
       // Call failed.
@@ -213,7 +218,7 @@ void Win32IocpEventPort::waitIocp(DWORD timeoutMs) {
     }
   } else {
     DWORD bytesTransferred;
-    ULONG_PTR completionKey;
+    ULONG_PTR completionKey = 0;
     LPOVERLAPPED overlapped = nullptr;
 
     BOOL success = GetQueuedCompletionStatus(
@@ -232,7 +237,12 @@ void Win32IocpEventPort::waitIocp(DWORD timeoutMs) {
       }
     } else {
       DWORD error = success ? ERROR_SUCCESS : GetLastError();
-      static_cast<IoPromiseAdapter*>(overlapped)->done(IoResult { error, bytesTransferred });
+      IoResult result { error, bytesTransferred };
+      if (completionKey != 0) {
+        reinterpret_cast<CompletionHandler*>(completionKey)->complete(overlapped, result);
+      } else {
+        static_cast<IoPromiseAdapter*>(overlapped)->done(result);
+      }
     }
   }
 }
@@ -202,6 +202,23 @@ public:
   Timer& getTimer() override { return timerImpl; }
   void allowApc() override { isAllowApc = true; }
 
+  // direct completions --------------------------------------------------------
+  //
+  // Some APIs post completions to an I/O completion port themselves, rather than completing an
+  // operation started on an observed handle -- notably Registered I/O completion queues. Pass them
+  // `getIocpHandle()` along with a key from `completionKeyFor()`. Each completion posted with that
+  // key is passed to the handler from inside wait() or poll().
+
+  class CompletionHandler {
+  public:
+    virtual void complete(LPOVERLAPPED overlapped, IoResult result) = 0;
+  };
+
+  HANDLE getIocpHandle() { return iocp; }
+  static ULONG_PTR completionKeyFor(CompletionHandler& handler) {
+    return reinterpret_cast<ULONG_PTR>(&handler);
+  }
+
 private:
   class IoPromiseAdapter;
   class IoOperationImpl;
@@ -1040,5 +1040,153 @@ KJ_TEST("cross-thread fulfiller multiple fulfills") {
   kj::Thread thread4(func);
 }
 
+KJ_TEST("bursts of asynchronous cross-thread events from many threads") {
+  // Exercises the lock-free submission path: several threads flood one executor at once, and
+  // each thread's events must still run exactly once and in the order that thread sent them.
+
+  constexpr uint SENDERS = 4;
+  constexpr uint PER_SENDER = 500;
+
+  MutexGuarded<kj::Maybe<const Executor&>> executor;
+  uint lastSeen[SENDERS] = {};  // accessed only from the receiving thread
+  uint total = 0;               // accessed only from the receiving thread
+  Own<PromiseFulfiller<void>> done;  // accessed only from the receiving thread
+
+  Thread thread([&]() noexcept {
+    KJ_XTHREAD_TEST_SETUP_LOOP;
+
+    auto paf = newPromiseAndFulfiller<void>();
+    done = kj::mv(paf.fulfiller);
+
+    *executor.lockExclusive() = getCurrentThreadExecutor();
+
+    paf.promise.wait(waitScope);
+  });
+
+  const Executor* exec;
+  {
+    auto lock = executor.lockExclusive();
+    lock.wait([&](kj::Maybe<const Executor&> value) { return value != nullptr; });
+    exec = &KJ_ASSERT_NONNULL(*lock);
+  }
+
+  {
+    auto senders = heapArrayBuilder<Own<Thread>>(SENDERS);
+    for (uint i = 0; i < SENDERS; i++) {
+      senders.add(heap<Thread>([&, i]() noexcept {
+        KJ_XTHREAD_TEST_SETUP_LOOP;
+
+        auto promises = heapArrayBuilder<Promise<void>>(PER_SENDER);
+        for (uint j = 1; j <= PER_SENDER; j++) {
+          promises.add(exec->executeAsync([&, i, j]() {
+            KJ_ASSERT(lastSeen[i] == j - 1, i, j, lastSeen[i]);
+            lastSeen[i] = j;
+            ++total;
+          }));
+        }
+        joinPromises(promises.finish()).wait(waitScope);
+      }));
+    }
+  }
+
+  KJ_EXPECT(exec->executeSync([&]() { return total; }) == SENDERS * PER_SENDER);
+
+  exec->executeSync([&]() { done->fulfill(); });
+}
+
+KJ_TEST("WorkerPool runs functions on pool threads") {
+  KJ_XTHREAD_TEST_SETUP_LOOP;
+
+  WorkerPool pool(4);
+  KJ_EXPECT(pool.getThreadCount() == 4);
+
+  const Executor* mainExecutor = &getCurrentThreadExecutor();
+
+  auto promises = heapArrayBuilder<Promise<uint>>(100);
+  for (uint i = 0; i < 100; i++) {
+    promises.add(pool.run([i, mainExecutor]() {
+      KJ_ASSERT(&getCurrentThreadExecutor() != mainExecutor);
+      return i * i;
+    }));
+  }
+
+  auto results = joinPromises(promises.finish()).wait(waitScope);
+  for (uint i = 0; i < 100; i++) {
+    KJ_EXPECT(results[i] == i * i);
+  }
+
+  // void functions, and functions returning promises.
+  bool ran = false;
+  pool.run([&ran]() { ran = true; }).wait(waitScope);
+  KJ_EXPECT(ran);
+
+  KJ_EXPECT(pool.run([]() { return evalLater([]() { return 123; }); }).wait(waitScope) == 123);
+}
+
+KJ_TEST("WorkerPool propagates exceptions") {
+  KJ_XTHREAD_TEST_SETUP_LOOP;
+
+  WorkerPool pool(2);
+
+  KJ_EXPECT_THROW_MESSAGE("oops", pool.run([]() -> int {
+    KJ_FAIL_ASSERT("oops");
+  }).wait(waitScope));
+}
+
+KJ_TEST("WorkerPool work submitted from a pool thread is stolen by idle threads") {
+  KJ_XTHREAD_TEST_SETUP_LOOP;
+
+  WorkerPool pool(4);
+
+  // The outer task submits subtasks onto its own thread's queue and then blocks that thread
+  // waiting for them, so they can only complete if other threads steal them.
+  auto threadsUsed = pool.run([&pool]() {
+    const Executor* outer = &getCurrentThreadExecutor();
+    auto promises = heapArrayBuilder<Promise<bool>>(16);
+    for (uint i = 0; i < 16; i++) {
+      promises.add(pool.run([outer]() {
+        return &getCurrentThreadExecutor() != outer;
+      }));
+    }
+    return joinPromises(promises.finish());
+  }).wait(waitScope);
+
+  for (bool stolen: threadsUsed) {
+    KJ_EXPECT(stolen);
+  }
+}
+
+KJ_TEST("WorkerPool destructor cancels queued functions") {
+  KJ_XTHREAD_TEST_SETUP_LOOP;
+
+  MutexGuarded<uint> state(0);
+  // 1 = the first function has started, 2 = it may return.
+  bool secondRan = false;
+
+  auto pool = kj::heap<WorkerPool>(1);
+
+  auto first = pool->run([&state]() {
+    *state.lockExclusive() = 1;
+    state.when([](uint s) { return s == 2; }, [](uint&) {});
+  });
+  state.when([](uint s) { return s == 1; }, [](uint&) {});
+
+  // The only thread is busy, so this stays queued.
+  auto second = pool->run([&secondRan]() { secondRan = true; });
+
+  Thread releaser([&state]() {
+    // Give the destructor time to start before the first function returns.
+    delay();
+    delay();
+    delay();
+    *state.lockExclusive() = 2;
+  });
+  pool = nullptr;
+
+  first.wait(waitScope);
+  KJ_EXPECT_THROW(DISCONNECTED, second.wait(waitScope));
+  KJ_EXPECT(!secondRan);
+}
+
 }  // namespace
 }  // namespace kj
@@ -47,7 +47,10 @@
 #include "one-of.h"
 #include "function.h"
 #include "list.h"
+#include "thread.h"
+#include "map.h"
 #include <deque>
+#include <algorithm>
 #include <atomic>
 
 #if _WIN32 || __CYGWIN__
@@ -447,6 +450,9 @@ public:
 
 private:
   size_t stackSize;
+  uint sizeClass = 0;
+  // Index of the FiberPool size class this stack belongs to, if it came from a pool.
+
   OneOf<FiberBase*, SynchronousFunc*> main;
 
   friend class FiberBase;
@@ -476,34 +482,64 @@ private:
 #define USE_CORE_LOCAL_FREELISTS 1
 #endif
 
-#if USE_CORE_LOCAL_FREELISTS
 static const size_t CACHE_LINE_SIZE = 64;
 // Most modern architectures have 64-byte cache lines.
-#endif
+
+namespace {
+
+uint nextFiberCacheIndex = 0;
+thread_local uint fiberCacheIndex = 0;
+
+uint getFiberCacheIndex() {
+  // Returns a small integer identifying the current thread, assigned the first time the thread
+  // touches any FiberPool. FiberPools use it to pick the thread's local freelist.
+
+  uint result = fiberCacheIndex;
+  if (result == 0) {
+    fiberCacheIndex = result = __atomic_add_fetch(&nextFiberCacheIndex, 1, __ATOMIC_RELAXED);
+  }
+  return result;
+}
+
+}  // namespace
 
 class FiberPool::Impl final: private Disposer {
 public:
-  Impl(size_t stackSize): stackSize(stackSize) {}
-  ~Impl() noexcept(false) {
-#if USE_CORE_LOCAL_FREELISTS
-    if (coreLocalFreelists != nullptr) {
-      KJ_DEFER(free(coreLocalFreelists));
+  Impl(ArrayPtr<const size_t> stackSizes)
+      : classes(kj::heapArray<SizeClass>(stackSizes.size())) {
+    KJ_REQUIRE(stackSizes.size() > 0, "FiberPool needs at least one stack size");
+
+    for (auto i: kj::indices(stackSizes)) {
+      if (i > 0) {
+        KJ_REQUIRE(stackSizes[i] > stackSizes[i - 1],
+                   "FiberPool stack sizes must be listed in increasing order", stackSizes);
+      }
+
+      auto& sizeClass = classes[i];
+      sizeClass.stackSize = stackSizes[i];
+      sizeClass.locals = newLocalFreelists(THREAD_LOCAL_FREELIST_COUNT);
+
+      // Initially, all nodes of the global freelist are on the empty stack.
+      for (uint j: kj::zeroTo(GLOBAL_FREELIST_CAPACITY - 1)) {
+        sizeClass.nodes[j].next = j + 2;
+      }
+      sizeClass.emptyHead = 1;
+    }
+  }
 
-      for (uint i: kj::zeroTo(nproc)) {
-        for (auto stack: coreLocalFreelists[i].stacks) {
+  ~Impl() noexcept(false) {
+    // Make sure we're not leaking anything from the local or global freelists.
+    for (auto& sizeClass: classes) {
+      for (auto& local: sizeClass.locals) {
+        for (auto stack: local.stacks) {
           if (stack != nullptr) {
             delete stack;
           }
         }
       }
-    }
-#endif
-
-    // Make sure we're not leaking anything from the global freelist either.
-    auto lock = freelist.lockExclusive();
-    auto dangling = kj::mv(*lock);
-    for (auto& stack: dangling) {
-      delete stack;
+      while (_::FiberStack* stack = popGlobal(sizeClass)) {
+        delete stack;
+      }
     }
   }
 
@@ -512,139 +548,278 @@ public:
   }
 
   size_t getFreelistSize() const {
-    return freelist.lockShared()->size();
+    size_t result = 0;
+    for (auto& sizeClass: classes) {
+      result += __atomic_load_n(&sizeClass.count, __ATOMIC_RELAXED);
+    }
+    return result;
   }
 
   void useCoreLocalFreelists() {
 #if USE_CORE_LOCAL_FREELISTS
-    if (coreLocalFreelists != nullptr) {
+    if (coreLocal) {
       // Ignore repeat call.
       return;
     }
 
-    int nproc_;
-    KJ_SYSCALL(nproc_ = sysconf(_SC_NPROCESSORS_CONF));
-    nproc = nproc_;
+    int nproc;
+    KJ_SYSCALL(nproc = sysconf(_SC_NPROCESSORS_CONF));
 
-    void* allocPtr;
-    size_t totalSize = nproc * sizeof(CoreLocalFreelist);
-    int error = posix_memalign(&allocPtr, CACHE_LINE_SIZE, totalSize);
-    if (error != 0) {
-      KJ_FAIL_SYSCALL("posix_memalign", error);
+    for (auto& sizeClass: classes) {
+      // Stacks already cached per-thread are simply dropped; this is expected to be called before
+      // the pool sees any real use.
+      for (auto& local: sizeClass.locals) {
+        for (auto stack: local.stacks) {
+          if (stack != nullptr) {
+            delete stack;
+            __atomic_sub_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
+          }
+        }
+      }
+      sizeClass.locals = newLocalFreelists(nproc);
     }
-    memset(allocPtr, 0, totalSize);
-    coreLocalFreelists = reinterpret_cast<CoreLocalFreelist*>(allocPtr);
+    coreLocal = true;
 #endif
   }
 
-  Own<_::FiberStack> takeStack() const {
+  uint findSizeClass(size_t minStackSize) const {
+    for (auto i: kj::indices(classes)) {
+      if (kj::max(classes[i].stackSize, 65536) >= minStackSize) {
+        return i;
+      }
+    }
+    KJ_FAIL_REQUIRE("no stack in this FiberPool is big enough", minStackSize,
+                    classes[classes.size() - 1].stackSize);
+  }
+
+  Own<_::FiberStack> takeStack(uint classIndex = 0) const {
     // Get a stack from the pool. The disposer on the returned Own pointer will return the stack
     // to the pool, provided that reset() has been called to indicate that the stack is not in
     // a weird state.
 
-#if USE_CORE_LOCAL_FREELISTS
-    KJ_IF_MAYBE(core, lookupCoreLocalFreelist()) {
-      for (auto& stackPtr: core->stacks) {
+    auto& sizeClass = classes[classIndex];
+
+    if (__atomic_load_n(&sizeClass.count, __ATOMIC_RELAXED) > 0) {
+      uint own = lookupLocalFreelist(sizeClass);
+      for (auto& stackPtr: sizeClass.locals[own].stacks) {
         _::FiberStack* result = __atomic_exchange_n(&stackPtr, nullptr, __ATOMIC_ACQUIRE);
         if (result != nullptr) {
           // Found a stack in this slot!
+          __atomic_sub_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
           return { result, *this };
         }
       }
-      // No stacks found, fall back to global freelist.
-    }
-#endif
 
-    {
-      auto lock = freelist.lockExclusive();
-      if (!lock->empty()) {
-        _::FiberStack* result = lock->back();
-        lock->pop_back();
+      // Nothing cached locally, fall back to the global freelist, and failing that, take a stack
+      // cached by some other thread rather than allocate a new one.
+      _::FiberStack* result = popGlobal(sizeClass);
+      if (result == nullptr) {
+        result = stealLocal(sizeClass, own);
+      }
+      if (result != nullptr) {
+        __atomic_sub_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
         return { result, *this };
       }
     }
 
-    _::FiberStack* result = new _::FiberStack(stackSize);
+    _::FiberStack* result = new _::FiberStack(sizeClass.stackSize);
+    result->sizeClass = classIndex;
     return { result, *this };
   }
 
 private:
-  size_t stackSize;
-  size_t maxFreelist = kj::maxValue;
-  MutexGuarded<std::deque<_::FiberStack*>> freelist;
+  static constexpr uint THREAD_LOCAL_FREELIST_COUNT = 16;
+  // Number of thread-local freelists per size class. Threads are assigned to them round-robin,
+  // so with more threads than this, some threads will share a freelist (which is still correct,
+  // just less effective).
 
-#if USE_CORE_LOCAL_FREELISTS
-  struct CoreLocalFreelist {
+  static constexpr uint GLOBAL_FREELIST_CAPACITY = 256;
+  // Maximum number of stacks per size class that can be held in the global freelist. Beyond
+  // this, returned stacks are deleted.
+
+  struct LocalFreelist {
     union {
       _::FiberStack* stacks[2];
-      // For now, we don't try to freelist more than 2 stacks per core. If you have three or more
-      // threads interleaved on a core, chances are you have bigger problems...
+      // For now, we don't try to freelist more than 2 stacks per thread (or core). If a thread
+      // needs more than that at once, the rest go to the global freelist.
 
       byte padToCacheLine[CACHE_LINE_SIZE];
-      // We don't want two core-local freelists to live in the same cache line, otherwise the
+      // We don't want two local freelists to live in the same cache line, otherwise the
       // cores will fight over ownership of that line.
     };
   };
 
-  uint nproc;
-  CoreLocalFreelist* coreLocalFreelists = nullptr;
+  struct GlobalNode {
+    _::FiberStack* stack;
+    uint next;
+    // One-based index of the next node in the same stack, or zero at the bottom.
+  };
 
-  kj::Maybe<CoreLocalFreelist&> lookupCoreLocalFreelist() const {
-    if (coreLocalFreelists == nullptr) {
-      return nullptr;
-    } else {
+  struct SizeClass {
+    size_t stackSize;
+
+    size_t count = 0;
+    // Number of stacks of this size, local or global, currently in the freelist. Because it is
+    // updated separately from the lists themselves, it may briefly be off by a few while threads
+    // race, which only affects when we decide to trim.
+
+    uint64_t fullHead = 0;
+    uint64_t emptyHead = 0;
+    // The global freelist is a pair of lock-free (Treiber) stacks over `nodes`: one of nodes
+    // holding stacks, one of unused nodes. Nodes are never freed, only moved between the two,
+    // so the only hazard is ABA, which we avoid by tagging each head with a counter in the upper
+    // 32 bits that changes on every update. The lower 32 bits are a one-based node index, zero
+    // meaning empty. (A tagged index lets us use an ordinary 64-bit CAS rather than requiring a
+    // double-width CAS on the pointer.)
+
+    GlobalNode nodes[GLOBAL_FREELIST_CAPACITY];
+
+    Array<LocalFreelist> locals;
+  };
+
+  size_t maxFreelist = kj::maxValue;
+  bool coreLocal = false;
+  mutable Array<SizeClass> classes;
+
+  static Array<LocalFreelist> newLocalFreelists(size_t count) {
+    auto result = kj::heapArray<LocalFreelist>(count);
+    memset(result.begin(), 0, result.size() * sizeof(LocalFreelist));
+    return result;
+  }
+
+  uint lookupLocalFreelist(const SizeClass& sizeClass) const {
+    // Returns the index in sizeClass.locals of the freelist belonging to the current thread (or
+    // core, if using core-local freelists).
+
+#if USE_CORE_LOCAL_FREELISTS
+    if (coreLocal) {
       int cpu = sched_getcpu();
-      if (cpu >= 0) {
+      if (cpu >= 0 && cpu < sizeClass.locals.size()) {
         // TODO(perf): Perhaps two hyperthreads on the same physical core should share a freelist?
         //   But I don't know how to find out if the system uses hyperthreading.
-        return coreLocalFreelists[cpu];
+        return cpu;
       } else {
         static bool logged = false;
         if (!logged) {
-          KJ_LOG(ERROR, "invalid cpu number from sched_getcpu()?", cpu, nproc);
+          KJ_LOG(ERROR, "invalid cpu number from sched_getcpu()?", cpu, sizeClass.locals.size());
           logged = true;
         }
-        return nullptr;
+        // Fall through and use a thread-based index instead.
       }
     }
-  }
 #endif
 
+    return getFiberCacheIndex() % sizeClass.locals.size();
+  }
+
+  static uint popNode(uint64_t& head, GlobalNode* nodes) {
+    uint64_t oldHead = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    for (;;) {
+      uint index = oldHead;
+      if (index == 0) return 0;
+      uint next = __atomic_load_n(&nodes[index - 1].next, __ATOMIC_RELAXED);
+      uint64_t newHead = ((oldHead >> 32) + 1) << 32 | next;
+      if (__atomic_compare_exchange_n(&head, &oldHead, newHead, true,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        return index;
+      }
+    }
+  }
+
+  static void pushNode(uint64_t& head, GlobalNode* nodes, uint index) {
+    uint64_t oldHead = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+      __atomic_store_n(&nodes[index - 1].next, static_cast<uint>(oldHead), __ATOMIC_RELAXED);
+      uint64_t newHead = ((oldHead >> 32) + 1) << 32 | index;
+      if (__atomic_compare_exchange_n(&head, &oldHead, newHead, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return;
+      }
+    }
+  }
+
+  static bool pushGlobal(SizeClass& sizeClass, _::FiberStack* stack) {
+    uint index = popNode(sizeClass.emptyHead, sizeClass.nodes);
+    if (index == 0) return false;
+    sizeClass.nodes[index - 1].stack = stack;
+    pushNode(sizeClass.fullHead, sizeClass.nodes, index);
+    return true;
+  }
+
+  static _::FiberStack* popGlobal(SizeClass& sizeClass) {
+    uint index = popNode(sizeClass.fullHead, sizeClass.nodes);
+    if (index == 0) return nullptr;
+    _::FiberStack* result = sizeClass.nodes[index - 1].stack;
+    pushNode(sizeClass.emptyHead, sizeClass.nodes, index);
+    return result;
+  }
+
+  static _::FiberStack* stealLocal(SizeClass& sizeClass, uint own) {
+    // Take a stack out of some local freelist, trying other threads' lists before our own, and
+    // older entries before newer ones.
+
+    size_t n = sizeClass.locals.size();
+    for (size_t i = 1; i <= n; i++) {
+      auto& local = sizeClass.locals[(own + i) % n];
+      for (size_t j = kj::size(local.stacks); j-- > 0;) {
+        _::FiberStack* result = __atomic_exchange_n(&local.stacks[j], nullptr, __ATOMIC_ACQUIRE);
+        if (result != nullptr) {
+          return result;
+        }
+      }
+    }
+    return nullptr;
+  }
+
   void disposeImpl(void* pointer) const {
     _::FiberStack* stack = reinterpret_cast<_::FiberStack*>(pointer);
-    KJ_DEFER(delete stack);
 
     // Verify that the stack was reset before returning, otherwise it might be in a weird state
     // where we don't want to reuse it.
-    if (stack->isReset()) {
-#if USE_CORE_LOCAL_FREELISTS
-      KJ_IF_MAYBE(core, lookupCoreLocalFreelist()) {
-        for (auto& stackPtr: core->stacks) {
-          stack = __atomic_exchange_n(&stackPtr, stack, __ATOMIC_RELEASE);
-          if (stack == nullptr) {
-            // Cool, we inserted the stack into an unused slot. We're done.
-            return;
-          }
-        }
-        // All slots were occupied, so we inserted the new stack in the front, pushed the rest back,
-        // and now `stack` refers to the stack that fell off the end of the core-local list. That
-        // needs to go into the global freelist.
+    if (!stack->isReset()) {
+      delete stack;
+      return;
+    }
+
+    auto& sizeClass = classes[stack->sizeClass];
+    __atomic_add_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
+
+    uint own = lookupLocalFreelist(sizeClass);
+    for (auto& stackPtr: sizeClass.locals[own].stacks) {
+      stack = __atomic_exchange_n(&stackPtr, stack, __ATOMIC_ACQ_REL);
+      if (stack == nullptr) {
+        // Cool, we inserted the stack into an unused slot.
+        break;
       }
-#endif
+    }
 
-      auto lock = freelist.lockExclusive();
-      lock->push_back(stack);
-      if (lock->size() > maxFreelist) {
-        stack = lock->front();
-        lock->pop_front();
-      } else {
-        stack = nullptr;
+    if (stack != nullptr) {
+      // All slots were occupied, so we inserted the new stack in the front, pushed the rest back,
+      // and now `stack` refers to the stack that fell off the end of the local list. That needs
+      // to go into the global freelist.
+      if (!pushGlobal(sizeClass, stack)) {
+        delete stack;
+        __atomic_sub_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
+      }
+    }
+
+    // Trim the freelist back down to size, preferring to drop stacks that we didn't just return.
+    while (__atomic_load_n(&sizeClass.count, __ATOMIC_RELAXED) > maxFreelist) {
+      _::FiberStack* victim = popGlobal(sizeClass);
+      if (victim == nullptr) {
+        victim = stealLocal(sizeClass, own);
+        if (victim == nullptr) break;
       }
+      delete victim;
+      __atomic_sub_fetch(&sizeClass.count, 1, __ATOMIC_RELAXED);
     }
   }
 };
 
-FiberPool::FiberPool(size_t stackSize) : impl(kj::heap<FiberPool::Impl>(stackSize)) {}
+FiberPool::FiberPool(size_t stackSize)
+    : impl(kj::heap<FiberPool::Impl>(kj::arrayPtr(&stackSize, 1))) {}
+FiberPool::FiberPool(ArrayPtr<const size_t> stackSizes)
+    : impl(kj::heap<FiberPool::Impl>(stackSizes)) {}
 FiberPool::~FiberPool() noexcept(false) {}
 
 void FiberPool::setMaxFreelist(size_t count) {
@@ -660,12 +835,16 @@ void FiberPool::useCoreLocalFreelists() {
 }
 
 void FiberPool::runSynchronously(kj::FunctionParam<void()> func) const {
+  runSynchronously(0, func);
+}
+
+void FiberPool::runSynchronously(size_t minStackSize, kj::FunctionParam<void()> func) const {
   ensureThreadCanRunFibers();
 
   _::FiberStack::SynchronousFunc syncFunc { func, nullptr };
 
   {
-    auto stack = impl->takeStack();
+    auto stack = impl->takeStack(impl->findSizeClass(minStackSize));
     stack->initialize(syncFunc);
     stack->switchToFiber();
     stack->reset();  // safe to reuse
@@ -766,6 +945,91 @@ struct Executor::Impl {
   kj::MutexGuarded<State> state;
   // After modifying state from another thread, the loop's port.wake() must be called.
 
+  mutable _::XThreadEvent* pendingStart = nullptr;
+  // Lock-free stack of events submitted with executeAsync() which have not yet been moved onto
+  // `state.start`. Any thread may push without taking the mutex; the stack is only ever drained
+  // as a whole, under the mutex, so there is no ABA hazard. Once the loop is destroyed this is
+  // set to `closedSentinel()` and pushes fail.
+
+  mutable bool wakePending = false;
+  // Set by the first submitter since the loop last drained `pendingStart`, which then takes
+  // responsibility for waking the loop. Later submitters in the same burst see it set and skip
+  // the wake() syscall. The loop thread clears it just before draining `pendingStart`.
+
+  static _::XThreadEvent* closedSentinel() {
+    return reinterpret_cast<_::XThreadEvent*>(uintptr_t(1));
+  }
+
+  bool pushPending(_::XThreadEvent& event) const {
+    // Returns false if the loop has already been destroyed.
+
+    auto head = __atomic_load_n(&pendingStart, __ATOMIC_RELAXED);
+    do {
+      if (head == closedSentinel()) return false;
+      event.nextPending = head;
+    } while (!__atomic_compare_exchange_n(&pendingStart, &head, &event, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return true;
+  }
+
+  bool hasPending() const {
+    auto head = __atomic_load_n(&pendingStart, __ATOMIC_ACQUIRE);
+    return head != nullptr && head != closedSentinel();
+  }
+
+  void takePending(State& s, _::XThreadEvent* replacement = nullptr) const {
+    // Moves everything on the pending stack onto `s.start`, in submission order. Must be called
+    // with the lock held.
+
+    auto head = __atomic_exchange_n(&pendingStart, replacement, __ATOMIC_SEQ_CST);
+    if (head == closedSentinel()) {
+      __atomic_store_n(&pendingStart, head, __ATOMIC_RELAXED);
+      return;
+    }
+
+    _::XThreadEvent* reversed = nullptr;
+    while (head != nullptr) {
+      auto next = head->nextPending;
+      head->nextPending = reversed;
+      reversed = head;
+      head = next;
+    }
+    while (reversed != nullptr) {
+      auto next = reversed->nextPending;
+      reversed->nextPending = nullptr;
+      s.start.add(*reversed);
+      reversed = next;
+    }
+  }
+
+  void receivePending(State& s) const {
+    // Called by the loop thread before dispatching. Clearing `wakePending` before draining
+    // ensures that anything pushed after the drain will be followed by a fresh wake().
+
+    __atomic_store_n(&wakePending, false, __ATOMIC_SEQ_CST);
+    takePending(s);
+  }
+
+  void wakeForPending() const {
+    {
+      auto lock = state.lockShared();
+      KJ_IF_MAYBE(l, lock->loop) {
+        KJ_IF_MAYBE(p, l->port) {
+          // We hold the lock so that the loop can't be destroyed out from under us.
+          p->wake();
+          return;
+        }
+      } else {
+        // Loop exited; it has already disconnected everything that was pushed.
+        return;
+      }
+    }
+
+    // Event loop will be waiting on executor.wait(), whose condition is re-checked when an
+    // exclusive lock is released.
+    state.lockExclusive();
+  }
+
   void processAsyncCancellations(Vector<_::XThreadEvent*>& eventsToCancelOutsideLock) {
     // After calling dispatchAll() or dispatchCancels() with the lock held, it may be that some
     // cancellations require dropping the lock before destroying the promiseNode. In that case
@@ -786,7 +1050,11 @@ struct Executor::Impl {
   }
 
   void disconnect() {
-    state.lockExclusive()->loop = nullptr;
+    {
+      auto lock = state.lockExclusive();
+      lock->loop = nullptr;
+      takePending(*lock, closedSentinel());
+    }
 
     // Now that `loop` is set null in `state`, other threads will no longer try to manipulate our
     // lists, so we can access them without a lock. That's convenient because a bunch of the things
@@ -869,6 +1137,11 @@ void XThreadEvent::ensureDoneOrCanceled() {
       return;
     }
 
+    if (state == QUEUED) {
+      // We might still be on the lock-free pending stack rather than the start list.
+      targetExecutor->impl->takePending(*lock);
+    }
+
     switch (state) {
       case UNUSED:
         // Nothing to do.
@@ -1251,6 +1524,20 @@ void Executor::send(_::XThreadEvent& event, bool sync) const {
     // Note that async requests will "just work" even if the target executor is our own thread's
     // executor. In theory we could detect this case to avoid some locking and signals but that
     // would be extra code complexity for probably little benefit.
+
+    // Async requests don't need to wait for anything, so they skip the mutex entirely: push onto
+    // the lock-free stack, and only wake the loop if nobody else in this burst already has.
+    event.state = _::XThreadEvent::QUEUED;
+    if (!impl->pushPending(event)) {
+      event.state = _::XThreadEvent::UNUSED;
+      event.setDisconnected();
+      return;
+    }
+
+    if (!__atomic_exchange_n(&impl->wakePending, true, __ATOMIC_SEQ_CST)) {
+      impl->wakeForPending();
+    }
+    return;
   }
 
   auto lock = impl->state.lockExclusive();
@@ -1262,6 +1549,9 @@ void Executor::send(_::XThreadEvent& event, bool sync) const {
     return;
   }
 
+  // Keep ordering with respect to async events this thread already submitted.
+  impl->takePending(*lock);
+
   event.state = _::XThreadEvent::QUEUED;
   lock->start.add(event);
 
@@ -1282,10 +1572,11 @@ void Executor::wait() {
 
   auto lock = impl->state.lockExclusive();
 
-  lock.wait([](const Impl::State& state) {
-    return state.isDispatchNeeded();
+  lock.wait([this](const Impl::State& state) {
+    return state.isDispatchNeeded() || impl->hasPending();
   });
 
+  impl->receivePending(*lock);
   lock->dispatchAll(eventsToCancelOutsideLock);
 }
 
@@ -1294,6 +1585,7 @@ bool Executor::poll() {
   KJ_DEFER(impl->processAsyncCancellations(eventsToCancelOutsideLock));
 
   auto lock = impl->state.lockExclusive();
+  impl->receivePending(*lock);
   if (lock->isDispatchNeeded()) {
     lock->dispatchAll(eventsToCancelOutsideLock);
     return true;
@@ -1314,6 +1606,196 @@ const Executor& getCurrentThreadExecutor() {
   return currentEventLoop().getExecutor();
 }
 
+// =======================================================================================
+// WorkerPool implementation.
+
+namespace {
+
+class WorkerPoolDeque {
+  // A growable ring buffer of tasks. The owning thread pushes and pops at the back; other
+  // threads steal from the front, taking the oldest work first. Not thread-safe by itself; each
+  // one is protected by a mutex, which is almost always uncontended since only an idle thread
+  // looks at another thread's deque.
+
+public:
+  bool empty() const { return count == 0; }
+
+  void pushBack(Own<_::WorkerPoolTask> task) {
+    if (count == slots.size()) grow();
+    slots[(head + count++) % slots.size()] = kj::mv(task);
+  }
+
+  Maybe<Own<_::WorkerPoolTask>> popBack() {
+    if (count == 0) return nullptr;
+    return kj::mv(slots[(head + --count) % slots.size()]);
+  }
+
+  Maybe<Own<_::WorkerPoolTask>> popFront() {
+    if (count == 0) return nullptr;
+    auto result = kj::mv(slots[head]);
+    head = (head + 1) % slots.size();
+    --count;
+    return kj::mv(result);
+  }
+
+private:
+  Array<Own<_::WorkerPoolTask>> slots;
+  size_t head = 0;
+  size_t count = 0;
+
+  void grow() {
+    auto newSlots = heapArray<Own<_::WorkerPoolTask>>(kj::max(slots.size() * 2, size_t(16)));
+    for (size_t i = 0; i < count; i++) {
+      newSlots[i] = kj::mv(slots[(head + i) % slots.size()]);
+    }
+    slots = kj::mv(newSlots);
+    head = 0;
+  }
+};
+
+struct WorkerPoolThread {
+  const void* pool;
+  uint index;
+  MutexGuarded<WorkerPoolDeque> queue;
+  Maybe<Own<Thread>> thread;
+};
+
+KJ_THREADLOCAL_PTR(WorkerPoolThread) threadLocalPoolThread = nullptr;
+
+}  // namespace
+
+struct WorkerPool::Impl {
+  Array<Own<WorkerPoolThread>> threads;
+
+  mutable std::atomic<uint> nextThread { 0 };
+  // Round-robin counter for work submitted from outside the pool.
+
+  mutable std::atomic<uint> sleepers { 0 };
+  // Number of threads which are about to sleep or sleeping. Submitters only touch `idle` when this
+  // is non-zero, so a busy pool never takes a shared lock.
+
+  std::atomic<bool> shutdown { false };
+  // Set by the destructor. Threads check it before taking each task, so that queued work which
+  // hasn't started is left for the destructor to cancel.
+
+  struct IdleState {
+    uint64_t generation = 0;
+    // Incremented to wake sleeping threads.
+  };
+  MutexGuarded<IdleState> idle;
+
+  Maybe<Own<_::WorkerPoolTask>> findWork(WorkerPoolThread& self) {
+    KJ_IF_MAYBE(task, self.queue.lockExclusive()->popBack()) {
+      return kj::mv(*task);
+    }
+    for (uint i = 1; i < threads.size(); i++) {
+      auto& victim = *threads[(self.index + i) % threads.size()];
+      KJ_IF_MAYBE(task, victim.queue.lockExclusive()->popFront()) {
+        return kj::mv(*task);
+      }
+    }
+    return nullptr;
+  }
+
+  void threadMain(WorkerPoolThread& self) {
+    threadLocalPoolThread = &self;
+    KJ_DEFER(threadLocalPoolThread = nullptr);
+
+    EventLoop loop;
+    WaitScope waitScope(loop);
+
+    for (;;) {
+      if (shutdown.load(std::memory_order_relaxed)) return;
+
+      KJ_IF_MAYBE(task, findWork(self)) {
+        (*task)->run(waitScope);
+        continue;
+      }
+
+      // Nothing to do. Announce that we're going to sleep, then check once more, so that a
+      // submitter either sees `sleepers` or we see its task.
+      uint64_t generation = idle.lockShared()->generation;
+      if (shutdown.load(std::memory_order_relaxed)) return;
+
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+      KJ_DEFER(sleepers.fetch_sub(1, std::memory_order_relaxed));
+
+      if (shutdown.load(std::memory_order_relaxed)) return;
+      KJ_IF_MAYBE(task, findWork(self)) {
+        (*task)->run(waitScope);
+        continue;
+      }
+
+      idle.when([generation](const IdleState& state) {
+        return state.generation != generation;
+      }, [](IdleState&) {});
+    }
+  }
+
+  void wake() const {
+    if (sleepers.load(std::memory_order_seq_cst) > 0) {
+      ++idle.lockExclusive()->generation;
+    }
+  }
+};
+
+WorkerPool::WorkerPool(uint threadCount): impl(kj::heap<Impl>()) {
+  KJ_REQUIRE(threadCount > 0, "WorkerPool needs at least one thread.");
+
+  auto builder = heapArrayBuilder<Own<WorkerPoolThread>>(threadCount);
+  for (uint i = 0; i < threadCount; i++) {
+    builder.add(kj::heap<WorkerPoolThread>());
+    builder.back()->pool = impl.get();
+    builder.back()->index = i;
+  }
+  impl->threads = builder.finish();
+
+  // Start threads only once the thread list is complete, since they steal from each other.
+  for (auto& thread: impl->threads) {
+    thread->thread = kj::heap<Thread>([this, &thread = *thread]() {
+      impl->threadMain(thread);
+    });
+  }
+}
+
+WorkerPool::~WorkerPool() noexcept(false) {
+  // The generation bump wakes sleeping threads. A thread which read the generation before the
+  // bump will find it changed; one which read it after will see `shutdown`.
+  impl->shutdown.store(true, std::memory_order_relaxed);
+  ++impl->idle.lockExclusive()->generation;
+
+  for (auto& thread: impl->threads) {
+    // Joins the thread.
+    thread->thread = nullptr;
+  }
+
+  for (auto& thread: impl->threads) {
+    auto lock = thread->queue.lockExclusive();
+    for (;;) {
+      KJ_IF_MAYBE(task, lock->popFront()) {
+        (*task)->cancel(KJ_EXCEPTION(DISCONNECTED, "WorkerPool was destroyed"));
+      } else {
+        break;
+      }
+    }
+  }
+}
+
+uint WorkerPool::getThreadCount() const {
+  return impl->threads.size();
+}
+
+void WorkerPool::submit(Own<_::WorkerPoolTask> task) const {
+  const WorkerPoolThread* target = threadLocalPoolThread;
+  if (target == nullptr || target->pool != impl.get()) {
+    uint i = impl->nextThread.fetch_add(1, std::memory_order_relaxed);
+    target = impl->threads[i % impl->threads.size()];
+  }
+
+  target->queue.lockExclusive()->pushBack(kj::mv(task));
+  impl->wake();
+}
+
 // =======================================================================================
 // Fiber implementation.
 
@@ -1528,6 +2010,14 @@ FiberBase::FiberBase(const FiberPool& pool, _::ExceptionOrValue& result, SourceL
   ensureThreadCanRunFibers();
 }
 
+FiberBase::FiberBase(const FiberPool& pool, size_t minStackSize, _::ExceptionOrValue& result,
+                     SourceLocation location)
+    : Event(location), state(WAITING), result(result) {
+  stack = pool.impl->takeStack(pool.impl->findSizeClass(minStackSize));
+  stack->initialize(*this);
+  ensureThreadCanRunFibers();
+}
+
 FiberBase::~FiberBase() noexcept(false) {}
 
 void FiberBase::destroy() {
@@ -1715,6 +2205,7 @@ bool EventLoop::turn() {
 
   if (event == nullptr) {
     // No events in the queue.
+    KJ_DASSERT(queueLength == 0, queueLength);
     return false;
   } else {
     head = event->next;
@@ -1732,6 +2223,7 @@ bool EventLoop::turn() {
 
     event->next = nullptr;
     event->prev = nullptr;
+    --queueLength;
 
     Maybe<Own<_::Event>> eventToDestroy;
     {
@@ -1739,7 +2231,19 @@ bool EventLoop::turn() {
       KJ_DEFER(event->firing = false);
       currentlyFiring = event;
       KJ_DEFER(currentlyFiring = nullptr);
-      eventToDestroy = event->fire();
+      KJ_IF_MAYBE(p, profiler) {
+        // Take the trace before firing, since firing may tear down the promise chain.
+        void* space[32];
+        _::TraceBuilder builder(space);
+        event->traceEvent(builder);
+        auto location = event->location;
+
+        auto start = p->clock.now();
+        eventToDestroy = event->fire();
+        p->record(location, builder.finish(), queueLength, p->clock.now() - start);
+      } else {
+        eventToDestroy = event->fire();
+      }
     }
 
     depthFirstInsertPoint = &head;
@@ -1842,6 +2346,116 @@ void WaitScope::cancelAllDetached() {
   }
 }
 
+static inline uint bitWidth(uint64_t value) {
+  // Number of bits needed to represent `value`, i.e. floor(log2(value)) + 1, or 0 for 0.
+  if (value == 0) return 0;
+#if _MSC_VER && !defined(__clang__)
+  unsigned long i;
+  if (value >> 32) {
+    _BitScanReverse(&i, uint32_t(value >> 32));
+    return i + 33;
+  } else {
+    _BitScanReverse(&i, uint32_t(value));
+    return i + 1;
+  }
+#else
+  return 64 - __builtin_clzll(value);
+#endif
+}
+
+void EventLoopProfiler::Histogram::add(uint64_t value) {
+  uint bucket = bitWidth(value);
+  ++buckets[bucket];
+  ++count;
+}
+
+uint64_t EventLoopProfiler::Histogram::getPercentile(double fraction) const {
+  if (count == 0) return 0;
+
+  uint64_t target = kj::max<uint64_t>(1, uint64_t(fraction * count + 0.5));
+  uint64_t seen = 0;
+  for (uint i = 0; i < BUCKET_COUNT; i++) {
+    seen += buckets[i];
+    if (seen >= target) {
+      return i == 0 ? 0 : i == 64 ? kj::maxValue : (uint64_t(1) << i) - 1;
+    }
+  }
+  return kj::maxValue;
+}
+
+struct EventLoopProfiler::SiteMap {
+  struct Key {
+    const char* fileName;
+    const char* function;
+    uint lineNumber;
+    uint columnNumber;
+    void* traceAddress;
+
+    inline bool operator==(const Key& other) const {
+      return fileName == other.fileName && function == other.function &&
+             lineNumber == other.lineNumber && columnNumber == other.columnNumber &&
+             traceAddress == other.traceAddress;
+    }
+    inline uint hashCode() const {
+      return kj::hashCode(static_cast<const void*>(fileName), static_cast<const void*>(function),
+                          lineNumber, columnNumber, traceAddress);
+    }
+  };
+
+  kj::HashMap<Key, Site> map;
+};
+
+EventLoopProfiler::EventLoopProfiler(Duration slowEventThreshold, const MonotonicClock& clock)
+    : slowEventThreshold(slowEventThreshold), clock(clock), sites(kj::heap<SiteMap>()) {}
+
+EventLoopProfiler::~EventLoopProfiler() noexcept(false) {}
+
+void EventLoopProfiler::record(SourceLocation location, ArrayPtr<void* const> trace,
+                               uint queueDepth, Duration duration) {
+  turnDurations.add(duration / NANOSECONDS);
+  queueDepths.add(queueDepth);
+
+  void* traceAddress = trace.size() == 0 ? nullptr : trace[0];
+  SiteMap::Key key {
+    location.fileName, location.function,
+    location.lineNumber, location.columnNumber, traceAddress
+  };
+  auto& site = sites->map.findOrCreate(key, [&]() -> decltype(sites->map)::Entry {
+    return { key, Site { location, traceAddress, 0, 0 * NANOSECONDS, 0 * NANOSECONDS } };
+  });
+  ++site.count;
+  site.totalTime += duration;
+  site.maxTime = kj::max(site.maxTime, duration);
+
+  if (duration > slowEventThreshold) {
+    slowEvent(site, duration, trace);
+  }
+}
+
+void EventLoopProfiler::slowEvent(
+    const Site& site, Duration duration, ArrayPtr<void* const> trace) {
+  KJ_LOG(WARNING, "event loop blocked by a slow event", duration, site.location,
+         kj::str(stringifyStackTraceAddresses(trace), stringifyStackTrace(trace)));
+}
+
+Array<EventLoopProfiler::Site> EventLoopProfiler::getSites() const {
+  auto result = kj::heapArrayBuilder<Site>(sites->map.size());
+  for (auto& entry: sites->map) {
+    result.add(entry.value);
+  }
+  auto array = result.finish();
+  std::sort(array.begin(), array.end(), [](const Site& a, const Site& b) {
+    return a.totalTime > b.totalTime;
+  });
+  return array;
+}
+
+void EventLoopProfiler::reset() {
+  turnDurations = Histogram();
+  queueDepths = Histogram();
+  sites->map.clear();
+}
+
 namespace _ {  // private
 
 #if !KJ_NO_EXCEPTIONS
@@ -2025,6 +2639,7 @@ void Event::armDepthFirst() {
   }
 
   if (prev == nullptr) {
+    ++loop.queueLength;
     next = *loop.depthFirstInsertPoint;
     prev = loop.depthFirstInsertPoint;
     *prev = this;
@@ -2056,6 +2671,7 @@ void Event::armBreadthFirst() {
   }
 
   if (prev == nullptr) {
+    ++loop.queueLength;
     next = *loop.breadthFirstInsertPoint;
     prev = loop.breadthFirstInsertPoint;
     *prev = this;
@@ -2084,6 +2700,7 @@ void Event::armLast() {
   }
 
   if (prev == nullptr) {
+    ++loop.queueLength;
     next = *loop.breadthFirstInsertPoint;
     prev = loop.breadthFirstInsertPoint;
     *prev = this;
@@ -2131,6 +2748,7 @@ void Event::disarm() {
 
     prev = nullptr;
     next = nullptr;
+    --loop.queueLength;
   }
 }
 
@@ -2176,6 +2794,112 @@ kj::String PromiseBase::trace() {
   return kj::str(builder);
 }
 
+PromiseNodePool::~PromiseNodePool() noexcept {
+  auto drain = [](FreeBlock* list) {
+    while (list != nullptr) {
+      auto next = list->next;
+      ::operator delete(list);
+      list = next;
+    }
+  };
+  for (auto list: lists) drain(list);
+  for (auto list: frameLists) drain(list);
+}
+
+PromiseNodePool* PromiseNodePool::current() {
+  EventLoop* loop = threadLocalEventLoop;
+  return loop == nullptr ? nullptr : &loop->nodePool;
+}
+
+void* PromiseNodePool::pop(FreeBlock*& list, uint& count, size_t blockSize) {
+  if (list != nullptr) {
+    FreeBlock* block = list;
+    list = block->next;
+    --count;
+    return block;
+  }
+
+  // Always allocate the full size class, so that the block can be recycled into any pool later.
+  return ::operator new(blockSize);
+}
+
+void PromiseNodePool::push(FreeBlock*& list, uint& count, uint maxCount, void* ptr) noexcept {
+  if (count < maxCount) {
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(ptr);
+    block->next = list;
+    list = block;
+    ++count;
+  } else {
+    ::operator delete(ptr);
+  }
+}
+
+void* PromiseNodePool::allocate(PromiseNodePool* pool, size_t size) {
+  size_t sizeClass = (size + GRANULE - 1) / GRANULE;
+  if (sizeClass == 0 || sizeClass > CLASS_COUNT) {
+    return ::operator new(size);
+  } else if (pool == nullptr) {
+    return ::operator new(sizeClass * GRANULE);
+  } else {
+    return pop(pool->lists[sizeClass - 1], pool->counts[sizeClass - 1], sizeClass * GRANULE);
+  }
+}
+
+void PromiseNodePool::free(PromiseNodePool* pool, void* ptr, size_t size) noexcept {
+  size_t sizeClass = (size + GRANULE - 1) / GRANULE;
+  if (pool == nullptr || sizeClass == 0 || sizeClass > CLASS_COUNT) {
+    ::operator delete(ptr);
+  } else {
+    push(pool->lists[sizeClass - 1], pool->counts[sizeClass - 1], MAX_FREE_PER_CLASS, ptr);
+  }
+}
+
+void* PromiseNodePool::allocateFrame(PromiseNodePool* pool, size_t size) {
+  size_t blockSize = GRANULE * CLASS_COUNT;
+  if (size <= blockSize) {
+    return allocate(pool, size);
+  }
+
+  for (uint i = 0; i < FRAME_CLASS_COUNT; i++) {
+    blockSize *= 2;
+    if (size <= blockSize) {
+      if (pool == nullptr) {
+        return ::operator new(blockSize);
+      } else {
+        return pop(pool->frameLists[i], pool->frameCounts[i], blockSize);
+      }
+    }
+  }
+
+  return ::operator new(size);
+}
+
+void PromiseNodePool::freeFrame(PromiseNodePool* pool, void* ptr, size_t size) noexcept {
+  size_t blockSize = GRANULE * CLASS_COUNT;
+  if (size <= blockSize) {
+    return free(pool, ptr, size);
+  }
+
+  if (pool != nullptr) {
+    for (uint i = 0; i < FRAME_CLASS_COUNT; i++) {
+      blockSize *= 2;
+      if (size <= blockSize) {
+        return push(pool->frameLists[i], pool->frameCounts[i], MAX_FREE_PER_FRAME_CLASS, ptr);
+      }
+    }
+  }
+
+  ::operator delete(ptr);
+}
+
+void* PromiseNode::operator new(size_t size) {
+  return PromiseNodePool::allocate(PromiseNodePool::current(), size);
+}
+
+void PromiseNode::operator delete(void* ptr, size_t size) noexcept {
+  PromiseNodePool::free(PromiseNodePool::current(), ptr, size);
+}
+
 void PromiseNode::setSelfPointer(Own<PromiseNode>* selfPtr) noexcept {}
 
 void PromiseNode::OnReadyEvent::init(Event* newEvent) {
@@ -2793,6 +3517,14 @@ CoroutineBase::~CoroutineBase() noexcept(false) {
   readMaybe(maybeDisposalResults)->destructorRan = true;
 }
 
+void* CoroutineBase::operator new(size_t size) {
+  return PromiseNodePool::allocateFrame(PromiseNodePool::current(), size);
+}
+
+void CoroutineBase::operator delete(void* ptr, size_t size) noexcept {
+  PromiseNodePool::freeFrame(PromiseNodePool::current(), ptr, size);
+}
+
 void CoroutineBase::unhandled_exception() {
   // Pretty self-explanatory, we propagate the exception to the promise which owns us, unless
   // we're being destroyed, in which case we propagate it back to our disposer. Note that all
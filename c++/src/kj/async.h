@@ -24,6 +24,7 @@
 #include "async-prelude.h"
 #include "exception.h"
 #include "refcount.h"
+#include "time.h"
 
 KJ_BEGIN_HEADER
 
@@ -43,6 +44,7 @@ KJ_BEGIN_HEADER
 namespace kj {
 
 class EventLoop;
+class EventLoopProfiler;
 class WaitScope;
 
 template <typename T>
@@ -448,15 +450,27 @@ class FiberPool final {
   // A freelist pool of fibers with a set stack size. This improves CPU usage with fibers at
   // the expense of memory usage. Fibers in this pool will always use the max amount of memory
   // used until the pool is destroyed.
+  //
+  // Each thread keeps a couple of recently-returned stacks in a thread-local freelist, so that a
+  // thread which repeatedly starts fibers reuses the same (cache-hot) stacks without touching any
+  // shared state. Stacks that don't fit there go to a lock-free global freelist, from which any
+  // thread may take them.
 
 public:
   explicit FiberPool(size_t stackSize);
+  explicit FiberPool(ArrayPtr<const size_t> stackSizes);
+  // Creates a pool that maintains separate freelists for several stack sizes, which must be
+  // listed in increasing order. startFiber() and runSynchronously() use the first (smallest) size
+  // unless a minimum stack size is specified, in which case they use the smallest size that is
+  // at least that large.
+
   ~FiberPool() noexcept(false);
   KJ_DISALLOW_COPY(FiberPool);
 
   void setMaxFreelist(size_t count);
   // Set the maximum number of stacks to add to the freelist. If the freelist is full, stacks will
-  // be deleted rather than returned to the freelist.
+  // be deleted rather than returned to the freelist. If the pool has multiple stack sizes, the
+  // limit applies to each size separately.
 
   void useCoreLocalFreelists();
   // EXPERIMENTAL: Call to tell FiberPool to try to use core-local stack freelists, which
@@ -473,7 +487,14 @@ public:
   // using `.then()`. This is often much easier to write and read, and may even be significantly
   // faster if it allows the use of stack allocation rather than heap allocation.
 
+  template <typename Func>
+  PromiseForResult<Func, WaitScope&> startFiber(
+      size_t minStackSize, Func&& func, SourceLocation location = {}) const KJ_WARN_UNUSED_RESULT;
+  // Like startFiber(func), but runs `func()` on the smallest stack in the pool that is at least
+  // `minStackSize` bytes. Throws if no stack size in the pool is large enough.
+
   void runSynchronously(kj::FunctionParam<void()> func) const;
+  void runSynchronously(size_t minStackSize, kj::FunctionParam<void()> func) const;
   // Use one of the stacks in the pool to synchronously execute func(), returning the result that
   // func() returns. This is not the usual use case for fibers, but can be a nice optimization
   // in programs that have many threads that mostly only need small stacks, but occasionally need
@@ -944,6 +965,56 @@ const Executor& getCurrentThreadExecutor();
 // Get the executor for the current thread's event loop. This reference can then be passed to other
 // threads.
 
+// =======================================================================================
+// Worker pool
+
+namespace _ { class WorkerPoolTask; }
+
+class WorkerPool {
+  // A fixed set of threads, each running its own EventLoop, which execute CPU-bound functions
+  // submitted from any thread. Each pool thread has its own run queue; a thread whose queue is
+  // empty steals work from the others, so load balances itself without any central queue.
+  //
+  // This is only for work that can move freely between threads. Promises and I/O objects remain
+  // tied to the thread that created them, as always, so I/O-bound work stays on its own thread's
+  // event loop; use `Executor` when work must run on one particular thread.
+
+public:
+  explicit WorkerPool(uint threadCount);
+  KJ_DISALLOW_COPY(WorkerPool);
+  ~WorkerPool() noexcept(false);
+  // The destructor waits for running functions to finish. Queued functions that haven't started
+  // are dropped and their promises rejected with DISCONNECTED.
+
+  uint getThreadCount() const;
+
+  template <typename Func>
+  PromiseForResult<Func, void> run(Func&& func) const;
+  // Queues `func()` to run on one of the pool's threads, and returns a promise for the result.
+  // As with `Executor::executeAsync()`, the promise belongs to the calling thread, which must have
+  // an EventLoop, and the result is transferred between threads.
+  //
+  // May be called from any thread, including the pool's own threads. Work submitted from
+  // outside the pool is spread round-robin across the threads. Work submitted from a pool thread
+  // goes onto that thread's own queue, where it is likely to find its data still in cache, and is
+  // taken by other threads only when they run out of work. No ordering between calls is
+  // guaranteed.
+  //
+  // Unlike executeAsync(), `func` is moved to, run on, and destroyed on the pool thread, so it
+  // must not capture anything that can't be moved between threads. If func() returns a promise,
+  // the pool thread waits for it before taking other work, so it should depend only on CPU-bound
+  // work. Note that a function waiting on other pool work occupies its thread while it waits.
+  //
+  // If the returned promise is destroyed before func() starts, func() is skipped. Once started,
+  // it runs to completion, and the result is discarded.
+
+private:
+  struct Impl;
+  Own<Impl> impl;
+
+  void submit(Own<_::WorkerPoolTask> task) const;
+};
+
 // =======================================================================================
 // The EventLoop class
 
@@ -999,6 +1070,59 @@ public:
   // The default implementation throws an UNIMPLEMENTED exception.
 };
 
+namespace _ {  // private
+
+class PromiseNodePool {
+  // Free lists of PromiseNode-sized blocks, by size class, owned by an EventLoop. Promise chains
+  // allocate and free several nodes per continuation, nearly always on the loop's own thread, so
+  // recycling the blocks keeps short chains from ever reaching malloc.
+  //
+  // Blocks carry no header: the size class is recomputed from the (sized) operator delete, so a
+  // node may be freed into any pool -- or directly to the heap when the thread has no loop --
+  // regardless of where it was allocated.
+
+public:
+  PromiseNodePool() = default;
+  ~PromiseNodePool() noexcept;
+  KJ_DISALLOW_COPY(PromiseNodePool);
+
+  static void* allocate(PromiseNodePool* pool, size_t size);
+  static void free(PromiseNodePool* pool, void* ptr, size_t size) noexcept;
+  // `pool` may be null, in which case the heap is used directly.
+
+  static PromiseNodePool* current();
+  // The pool of the thread's current EventLoop, or null if there is none.
+
+  static void* allocateFrame(PromiseNodePool* pool, size_t size);
+  static void freeFrame(PromiseNodePool* pool, void* ptr, size_t size) noexcept;
+  // Like allocate() and free(), but with additional power-of-two size classes for blocks larger
+  // than the node classes, up to 32KiB. Used for coroutine frames, which hold all of a
+  // coroutine's locals and so are usually much bigger than an ordinary node.
+
+private:
+  static constexpr size_t GRANULE = 16;
+  static constexpr size_t CLASS_COUNT = 32;      // up to 512 bytes
+  static constexpr uint MAX_FREE_PER_CLASS = 128;
+
+  static constexpr size_t FRAME_CLASS_COUNT = 6;  // 1KiB, 2KiB, ..., 32KiB
+  static constexpr uint MAX_FREE_PER_FRAME_CLASS = 16;
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  FreeBlock* lists[CLASS_COUNT] = {};
+  uint counts[CLASS_COUNT] = {};
+
+  FreeBlock* frameLists[FRAME_CLASS_COUNT] = {};
+  uint frameCounts[FRAME_CLASS_COUNT] = {};
+
+  static void* pop(FreeBlock*& list, uint& count, size_t blockSize);
+  static void push(FreeBlock*& list, uint& count, uint maxCount, void* ptr) noexcept;
+};
+
+}  // namespace _ (private)
+
 class EventLoop {
   // Represents a queue of events being executed in a loop.  Most code won't interact with
   // EventLoop directly, but instead use `Promise`s to interact with it indirectly.  See the
@@ -1057,7 +1181,14 @@ public:
   // Note that this is only needed for cross-thread scheduling. To schedule code to run later in
   // the current thread, use `kj::evalLater()`, which will be more efficient.
 
+  void setProfiler(kj::Maybe<EventLoopProfiler&> profiler) { this->profiler = profiler; }
+  // Install (or, with nullptr, remove) a profiler which is told about every event the loop runs.
+  // The profiler must outlive its installation.
+
 private:
+  _::PromiseNodePool nodePool;
+  // Declared first so that it is destroyed last, after anything else that may free nodes.
+
   kj::Maybe<EventPort&> port;
   // If null, this thread doesn't receive I/O events from the OS. It can potentially receive
   // events from other threads via the Executor.
@@ -1080,6 +1211,11 @@ private:
 
   _::Event* currentlyFiring = nullptr;
 
+  uint queueLength = 0;
+  // Number of events in the queue.
+
+  kj::Maybe<EventLoopProfiler&> profiler;
+
   bool turn();
   void setRunnable(bool runnable);
   void enterScope();
@@ -1093,6 +1229,7 @@ private:
                           WaitScope& waitScope, SourceLocation location);
   friend bool _::pollImpl(_::PromiseNode& node, WaitScope& waitScope, SourceLocation location);
   friend class _::Event;
+  friend class _::PromiseNodePool;
   friend class WaitScope;
   friend class Executor;
   friend class _::XThreadEvent;
@@ -1102,6 +1239,95 @@ private:
   friend ArrayPtr<void* const> getAsyncTrace(ArrayPtr<void*> space);
 };
 
+class EventLoopProfiler {
+  // Instrumentation for an EventLoop, installed with `EventLoop::setProfiler()`, for tracking down
+  // latency spikes caused by a callback that blocks the loop. While installed, it times every
+  // event the loop runs, attributes the time to the code that created the event, keeps histograms
+  // of event run times and queue depths, and reports any event that runs longer than a threshold
+  // along with its async trace (see `getAsyncTrace()`).
+  //
+  // Each turn of the loop runs exactly one event, so an event's run time is also the length of
+  // the turn. Profiling costs two clock reads and a walk of the event's promise chain per event,
+  // so install a profiler only while it's needed; when none is installed, the loop only checks
+  // for one.
+  //
+  // Not thread-safe: use it only from the thread of the loop it's installed in.
+
+public:
+  explicit EventLoopProfiler(Duration slowEventThreshold = 10 * MILLISECONDS,
+                             const MonotonicClock& clock = systemPreciseMonotonicClock());
+  virtual ~EventLoopProfiler() noexcept(false);
+  KJ_DISALLOW_COPY(EventLoopProfiler);
+
+  class Histogram {
+    // A histogram with power-of-two buckets: bucket 0 counts zeros, and bucket i > 0 counts values
+    // in [2^(i-1), 2^i).
+
+  public:
+    static constexpr uint BUCKET_COUNT = 65;
+
+    void add(uint64_t value);
+
+    uint64_t getCount() const { return count; }
+    uint64_t getBucket(uint i) const { return buckets[i]; }
+
+    uint64_t getPercentile(double fraction) const;
+    // Returns an upper bound on the given percentile (0 to 1) of the values added, namely the
+    // top of the bucket it falls in. Returns zero if nothing has been added.
+
+  private:
+    uint64_t buckets[BUCKET_COUNT] = {};
+    uint64_t count = 0;
+  };
+
+  const Histogram& getTurnDurations() const { return turnDurations; }
+  // Run time of each event, in nanoseconds.
+
+  const Histogram& getQueueDepths() const { return queueDepths; }
+  // The number of other events still waiting in the queue when each event was run.
+
+  struct Site {
+    // Events created at one place in the code.
+
+    SourceLocation location;
+    // Where the events were created, e.g. the `then()` call that scheduled a continuation. Only
+    // meaningful when the compiler supports source locations.
+
+    void* traceAddress;
+    // The first address of the events' async trace, i.e. the code that ran. Resolve with addr2line.
+
+    uint64_t count;
+    Duration totalTime;
+    Duration maxTime;
+  };
+
+  Array<Site> getSites() const;
+  // Returns every place events were created so far, the most expensive in total first.
+
+  void reset();
+  // Forget everything recorded so far.
+
+protected:
+  virtual void slowEvent(const Site& site, Duration duration, ArrayPtr<void* const> trace);
+  // Called after an event ran for longer than `slowEventThreshold`, with the event's async trace.
+  // The default implementation logs a warning.
+
+private:
+  Duration slowEventThreshold;
+  const MonotonicClock& clock;
+
+  Histogram turnDurations;
+  Histogram queueDepths;
+
+  struct SiteMap;
+  Own<SiteMap> sites;
+
+  void record(SourceLocation location, ArrayPtr<void* const> trace, uint queueDepth,
+              Duration duration);
+
+  friend class EventLoop;
+};
+
 class WaitScope {
   // Represents a scope in which asynchronous programming can occur.  A `WaitScope` should usually
   // be allocated on the stack and serves two purposes:
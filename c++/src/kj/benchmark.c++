@@ -0,0 +1,225 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "benchmark.h"
+#include "main.h"
+#include "io.h"
+#include "miniposix.h"
+#include "time.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace kj {
+
+namespace {
+
+BenchmarkCase* benchmarkCasesHead = nullptr;
+BenchmarkCase** benchmarkCasesTail = &benchmarkCasesHead;
+
+}  // namespace
+
+BenchmarkCase::BenchmarkCase(const char* file, uint line, const char* description)
+    : file(file), line(line), description(description), next(nullptr),
+      prev(benchmarkCasesTail), matchedFilter(false) {
+  *prev = this;
+  benchmarkCasesTail = &next;
+}
+
+BenchmarkCase::~BenchmarkCase() {
+  *prev = next;
+  if (next == nullptr) {
+    benchmarkCasesTail = prev;
+  } else {
+    next->prev = prev;
+  }
+}
+
+#if !(__GNUC__ || __clang__)
+namespace _ {  // private
+
+void doNotOptimizeAwayImpl(const void* ptr) {
+  // Defined out-of-line so that the compiler must assume the pointed-to value is observed.
+  static const void* volatile sink;
+  sink = ptr;
+}
+
+}  // namespace _ (private)
+#endif
+
+// =======================================================================================
+
+namespace {
+
+void writeJsonString(Vector<char>& out, StringPtr text) {
+  out.add('"');
+  for (char c: text) {
+    switch (c) {
+      case '"': out.addAll(StringPtr("\\\"")); break;
+      case '\\': out.addAll(StringPtr("\\\\")); break;
+      case '\n': out.addAll(StringPtr("\\n")); break;
+      default: out.add(c); break;
+    }
+  }
+  out.add('"');
+}
+
+}  // namespace
+
+class BenchmarkRunner {
+public:
+  explicit BenchmarkRunner(ProcessContext& context): context(context) {}
+
+  MainFunc getMain() {
+    return MainBuilder(context, "KJ Benchmark Runner (version not applicable)",
+        "Run all benchmarks that have been linked into the binary with this runner. Results are "
+        "written to standard output as one JSON object per line, with the fields \"name\", "
+        "\"file\", \"line\", \"iterations\", and \"nsPerIteration\".")
+        .addOptionWithArg({'f', "filter"}, KJ_BIND_METHOD(*this, setFilter), "<text>",
+            "Run only benchmarks whose file name or description contains <text>. You may specify "
+            "multiple filters; any benchmark matching at least one filter will run.")
+        .addOptionWithArg({'t', "min-time"}, KJ_BIND_METHOD(*this, setMinTime), "<ms>",
+            "Run each benchmark for at least <ms> milliseconds. Default: 500.")
+        .addOption({'l', "list"}, KJ_BIND_METHOD(*this, setList),
+            "List all benchmarks that would run, but don't run them.")
+        .callAfterParsing(KJ_BIND_METHOD(*this, run))
+        .build();
+  }
+
+  MainBuilder::Validity setFilter(StringPtr pattern) {
+    hasFilter = true;
+    for (BenchmarkCase* bench = benchmarkCasesHead; bench != nullptr; bench = bench->next) {
+      if (strstr(bench->file, pattern.cStr()) != nullptr ||
+          strstr(bench->description, pattern.cStr()) != nullptr) {
+        bench->matchedFilter = true;
+      }
+    }
+    return true;
+  }
+
+  MainBuilder::Validity setMinTime(StringPtr arg) {
+    char* end;
+    unsigned long ms = strtoul(arg.cStr(), &end, 10);
+    if (arg.size() == 0 || *end != '\0') {
+      return "expected a number of milliseconds";
+    }
+    minTime = ms * kj::MILLISECONDS;
+    return true;
+  }
+
+  MainBuilder::Validity setList() {
+    listOnly = true;
+    return true;
+  }
+
+  MainBuilder::Validity run() {
+    if (benchmarkCasesHead == nullptr) {
+      return "no benchmarks were declared";
+    }
+
+    // Find the common path prefix of all filenames, so we can strip it off.
+    ArrayPtr<const char> commonPrefix = StringPtr(benchmarkCasesHead->file);
+    for (BenchmarkCase* bench = benchmarkCasesHead; bench != nullptr; bench = bench->next) {
+      for (size_t i: kj::indices(commonPrefix)) {
+        if (bench->file[i] != commonPrefix[i]) {
+          commonPrefix = commonPrefix.slice(0, i);
+          break;
+        }
+      }
+    }
+    while (commonPrefix.size() > 0 && commonPrefix.back() != '/' && commonPrefix.back() != '\\') {
+      commonPrefix = commonPrefix.slice(0, commonPrefix.size() - 1);
+    }
+
+    uint failCount = 0;
+    for (BenchmarkCase* bench = benchmarkCasesHead; bench != nullptr; bench = bench->next) {
+      if (hasFilter && !bench->matchedFilter) continue;
+
+      Vector<char> line;
+      line.addAll(StringPtr("{\"name\":"));
+      writeJsonString(line, bench->description);
+      line.addAll(StringPtr(",\"file\":"));
+      writeJsonString(line, bench->file + commonPrefix.size());
+      line.addAll(kj::str(",\"line\":", bench->line));
+
+      if (!listOnly) {
+        uint64_t iterations = 0;
+        Duration elapsed = 0 * kj::NANOSECONDS;
+        KJ_IF_MAYBE(exception, runCatchingExceptions([&]() {
+          measure(*bench, iterations, elapsed);
+        })) {
+          context.error(kj::str(bench->file + commonPrefix.size(), ':', bench->line, ": ",
+                                bench->description, ": ", *exception));
+          ++failCount;
+          continue;
+        }
+
+        double nsPerIteration = double(elapsed / kj::NANOSECONDS) / double(iterations);
+        line.addAll(kj::str(",\"iterations\":", iterations,
+                            ",\"nsPerIteration\":", nsPerIteration));
+      }
+
+      line.addAll(StringPtr("}\n"));
+      FdOutputStream(STDOUT_FILENO).write(line.begin(), line.size());
+    }
+
+    if (failCount > 0) {
+      context.exitError(kj::str(failCount, " benchmark(s) failed"));
+    }
+    context.exit();
+
+    KJ_UNREACHABLE;
+  }
+
+private:
+  ProcessContext& context;
+  bool hasFilter = false;
+  bool listOnly = false;
+  Duration minTime = 500 * kj::MILLISECONDS;
+
+  void measure(BenchmarkCase& bench, uint64_t& iterations, Duration& elapsed) {
+    // Run with increasing iteration counts until a run takes at least `minTime`. The first run is
+    // a single iteration, which also serves to warm up caches and lazily-initialized state.
+
+    auto& clock = systemPreciseMonotonicClock();
+    iterations = 1;
+    for (;;) {
+      auto start = clock.now();
+      bench.run(iterations);
+      elapsed = clock.now() - start;
+
+      if (elapsed >= minTime || iterations >= 1'000'000'000'000ull) {
+        return;
+      }
+
+      // Aim 20% past the target, growing by at least 2x and at most 100x at each step.
+      uint64_t elapsedNs = kj::max(elapsed / kj::NANOSECONDS, 1);
+      double predicted = double(iterations) * double(minTime / kj::NANOSECONDS) * 1.2 /
+                         double(elapsedNs);
+      iterations = kj::min(kj::max(uint64_t(predicted), iterations * 2), iterations * 100);
+    }
+  }
+};
+
+}  // namespace kj
+
+KJ_MAIN(kj::BenchmarkRunner);
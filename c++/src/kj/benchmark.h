@@ -0,0 +1,99 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+// A minimal microbenchmark harness, in the spirit of kj/test.h. Declare benchmarks with
+// KJ_BENCHMARK() and link with `kj-benchmark`, which provides main(). Each benchmark body receives
+// an iteration count and must perform that many repetitions of the operation being measured;
+// the runner grows the count until the run takes long enough to time reliably.
+//
+//     KJ_BENCHMARK("String concatenation") {
+//       for (uint64_t i = 0; i < iterations; i++) {
+//         kj::doNotOptimizeAway(kj::str("foo", i, "bar"));
+//       }
+//     }
+//
+// Results are written to stdout as one JSON object per line, so that they can be collected and
+// compared across versions by scripts.
+
+#include "common.h"
+#include <stdint.h>
+
+KJ_BEGIN_HEADER
+
+namespace kj {
+
+class BenchmarkRunner;
+
+class BenchmarkCase {
+public:
+  BenchmarkCase(const char* file, uint line, const char* description);
+  ~BenchmarkCase();
+
+  virtual void run(uint64_t iterations) = 0;
+
+private:
+  const char* file;
+  uint line;
+  const char* description;
+  BenchmarkCase* next;
+  BenchmarkCase** prev;
+  bool matchedFilter;
+
+  friend class BenchmarkRunner;
+};
+
+#define KJ_BENCHMARK(description) \
+  /* Make sure the linker fails if benchmarks are not in anonymous namespaces. */ \
+  extern int KJ_CONCAT(YouMustWrapBenchmarksInAnonymousNamespace, __COUNTER__) KJ_UNUSED; \
+  class KJ_UNIQUE_NAME(BenchmarkCase): public ::kj::BenchmarkCase { \
+  public: \
+    KJ_UNIQUE_NAME(BenchmarkCase)(): ::kj::BenchmarkCase(__FILE__, __LINE__, description) {} \
+    void run(uint64_t iterations) override; \
+  } KJ_UNIQUE_NAME(benchmarkCase); \
+  void KJ_UNIQUE_NAME(BenchmarkCase)::run(uint64_t iterations)
+
+#if __GNUC__ || __clang__
+
+template <typename T>
+inline void doNotOptimizeAway(const T& value) {
+  // Prevents the compiler from discarding the computation of `value` as dead code.
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#else
+
+namespace _ {  // private
+void doNotOptimizeAwayImpl(const void* ptr);
+}  // namespace _ (private)
+
+template <typename T>
+inline void doNotOptimizeAway(const T& value) {
+  _::doNotOptimizeAwayImpl(&value);
+}
+
+#endif
+
+}  // namespace kj
+
+KJ_END_HEADER
@@ -0,0 +1,266 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#if KJ_HAS_BROTLI
+
+#include "brotli.h"
+#include "kj/debug.h"
+
+namespace kj {
+
+namespace _ {  // private
+
+BrotliDecoder::BrotliDecoder()
+    : state(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)) {
+  KJ_ASSERT(state != nullptr, "couldn't create brotli decoder");
+}
+
+BrotliDecoder::~BrotliDecoder() noexcept(false) {
+  BrotliDecoderDestroyInstance(state);
+}
+
+void BrotliDecoder::setInput(const void* in, size_t size) {
+  nextIn = reinterpret_cast<const byte*>(in);
+  availIn = size;
+}
+
+bool BrotliDecoder::hasMoreOutput() {
+  return BrotliDecoderHasMoreOutput(state);
+}
+
+size_t BrotliDecoder::decompress(byte* out, size_t size) {
+  if (atValidEndpoint && availIn > 0) {
+    // There's more data after the end of the stream. Assume start of new content.
+    BrotliDecoderDestroyInstance(state);
+    state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    KJ_ASSERT(state != nullptr, "couldn't create brotli decoder");
+  }
+
+  size_t availOut = size;
+  auto result = BrotliDecoderDecompressStream(state, &availIn, &nextIn, &availOut, &out, nullptr);
+  if (result == BROTLI_DECODER_RESULT_ERROR) {
+    KJ_FAIL_REQUIRE("brotli decompression failed",
+                    BrotliDecoderErrorString(BrotliDecoderGetErrorCode(state)));
+  }
+
+  atValidEndpoint = result == BROTLI_DECODER_RESULT_SUCCESS;
+  return size - availOut;
+}
+
+BrotliOutputContext::BrotliOutputContext(kj::Maybe<int> quality) {
+  KJ_IF_MAYBE(q, quality) {
+    KJ_REQUIRE(*q >= BROTLI_MIN_QUALITY && *q <= BROTLI_MAX_QUALITY, "invalid brotli quality", *q);
+    encoder = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    KJ_ASSERT(encoder != nullptr, "couldn't create brotli encoder");
+    KJ_ASSERT(BrotliEncoderSetParameter(encoder, BROTLI_PARAM_QUALITY, *q));
+  } else {
+    decoder = kj::heap<BrotliDecoder>();
+  }
+}
+
+BrotliOutputContext::~BrotliOutputContext() noexcept(false) {
+  if (encoder != nullptr) {
+    BrotliEncoderDestroyInstance(encoder);
+  }
+}
+
+void BrotliOutputContext::setInput(const void* in, size_t size) {
+  if (encoder == nullptr) {
+    decoder->setInput(in, size);
+  } else {
+    nextIn = reinterpret_cast<const byte*>(in);
+    availIn = size;
+  }
+}
+
+kj::Tuple<bool, kj::ArrayPtr<const byte>> BrotliOutputContext::pumpOnce(
+    BrotliEncoderOperation op) {
+  if (encoder == nullptr) {
+    // Decompressing, so there's nothing to flush: the decoder produces output as soon as it can.
+    size_t n = decoder->decompress(buffer, sizeof(buffer));
+    return kj::tuple(decoder->hasInput() || decoder->hasMoreOutput(), kj::arrayPtr(buffer, n));
+  }
+
+  if (BrotliEncoderIsFinished(encoder)) {
+    KJ_REQUIRE(availIn == 0, "brotli stream was already finished");
+    return kj::tuple(false, kj::ArrayPtr<const byte>());
+  }
+
+  byte* nextOut = buffer;
+  size_t availOut = sizeof(buffer);
+  KJ_REQUIRE(BrotliEncoderCompressStream(encoder, op, &availIn, &nextIn, &availOut, &nextOut,
+                                         nullptr),
+             "brotli compression failed");
+
+  // Keep pumping while there's input left to consume or output left to collect, and for a finish,
+  // until the stream is actually finished.
+  bool more = availIn > 0 || BrotliEncoderHasMoreOutput(encoder) ||
+      (op == BROTLI_OPERATION_FINISH && !BrotliEncoderIsFinished(encoder));
+  return kj::tuple(more, kj::arrayPtr(buffer, sizeof(buffer) - availOut));
+}
+
+}  // namespace _ (private)
+
+BrotliInputStream::BrotliInputStream(InputStream& inner)
+    : inner(inner) {}
+
+BrotliInputStream::~BrotliInputStream() noexcept(false) {}
+
+size_t BrotliInputStream::tryRead(void* out, size_t minBytes, size_t maxBytes) {
+  if (maxBytes == 0) return size_t(0);
+
+  return readImpl(reinterpret_cast<byte*>(out), minBytes, maxBytes, 0);
+}
+
+size_t BrotliInputStream::readImpl(
+    byte* out, size_t minBytes, size_t maxBytes, size_t alreadyRead) {
+  if (!decoder.hasInput() && !decoder.hasMoreOutput()) {
+    size_t amount = inner.tryRead(buffer, 1, sizeof(buffer));
+    if (amount == 0) {
+      if (!decoder.isAtValidEndpoint()) {
+        KJ_FAIL_REQUIRE("brotli compressed stream ended prematurely");
+      }
+      return alreadyRead;
+    } else {
+      decoder.setInput(buffer, amount);
+    }
+  }
+
+  size_t n = decoder.decompress(out, maxBytes);
+  if (n >= minBytes) {
+    return n + alreadyRead;
+  } else {
+    return readImpl(out + n, minBytes - n, maxBytes - n, alreadyRead + n);
+  }
+}
+
+// =======================================================================================
+
+BrotliOutputStream::BrotliOutputStream(OutputStream& inner, int quality)
+    : inner(inner), ctx(quality) {}
+
+BrotliOutputStream::BrotliOutputStream(OutputStream& inner, decltype(DECOMPRESS))
+    : inner(inner), ctx(nullptr) {}
+
+BrotliOutputStream::~BrotliOutputStream() noexcept(false) {
+  pump(BROTLI_OPERATION_FINISH);
+}
+
+void BrotliOutputStream::write(const void* in, size_t size) {
+  ctx.setInput(in, size);
+  pump(BROTLI_OPERATION_PROCESS);
+}
+
+void BrotliOutputStream::pump(BrotliEncoderOperation op) {
+  bool ok;
+  do {
+    auto result = ctx.pumpOnce(op);
+    ok = get<0>(result);
+    auto chunk = get<1>(result);
+    if (chunk.size() > 0) {
+      inner.write(chunk.begin(), chunk.size());
+    }
+  } while (ok);
+}
+
+// =======================================================================================
+
+BrotliAsyncInputStream::BrotliAsyncInputStream(AsyncInputStream& inner)
+    : inner(inner) {}
+
+BrotliAsyncInputStream::~BrotliAsyncInputStream() noexcept(false) {}
+
+Promise<size_t> BrotliAsyncInputStream::tryRead(void* out, size_t minBytes, size_t maxBytes) {
+  if (maxBytes == 0) return size_t(0);
+
+  return readImpl(reinterpret_cast<byte*>(out), minBytes, maxBytes, 0);
+}
+
+Promise<size_t> BrotliAsyncInputStream::readImpl(
+    byte* out, size_t minBytes, size_t maxBytes, size_t alreadyRead) {
+  if (!decoder.hasInput() && !decoder.hasMoreOutput()) {
+    return inner.tryRead(buffer, 1, sizeof(buffer))
+        .then([this,out,minBytes,maxBytes,alreadyRead](size_t amount) -> Promise<size_t> {
+      if (amount == 0) {
+        if (!decoder.isAtValidEndpoint()) {
+          return KJ_EXCEPTION(DISCONNECTED, "brotli compressed stream ended prematurely");
+        }
+        return alreadyRead;
+      } else {
+        decoder.setInput(buffer, amount);
+        return readImpl(out, minBytes, maxBytes, alreadyRead);
+      }
+    });
+  }
+
+  size_t n = decoder.decompress(out, maxBytes);
+  if (n >= minBytes) {
+    return n + alreadyRead;
+  } else {
+    return readImpl(out + n, minBytes - n, maxBytes - n, alreadyRead + n);
+  }
+}
+
+// =======================================================================================
+
+BrotliAsyncOutputStream::BrotliAsyncOutputStream(AsyncOutputStream& inner, int quality)
+    : inner(inner), ctx(quality) {}
+
+BrotliAsyncOutputStream::BrotliAsyncOutputStream(AsyncOutputStream& inner,
+                                                 decltype(DECOMPRESS))
+    : inner(inner), ctx(nullptr) {}
+
+Promise<void> BrotliAsyncOutputStream::write(const void* in, size_t size) {
+  ctx.setInput(in, size);
+  return pump(BROTLI_OPERATION_PROCESS);
+}
+
+Promise<void> BrotliAsyncOutputStream::write(ArrayPtr<const ArrayPtr<const byte>> pieces) {
+  if (pieces.size() == 0) return kj::READY_NOW;
+  return write(pieces[0].begin(), pieces[0].size())
+      .then([this,pieces]() {
+    return write(pieces.slice(1, pieces.size()));
+  });
+}
+
+kj::Promise<void> BrotliAsyncOutputStream::pump(BrotliEncoderOperation op) {
+  auto result = ctx.pumpOnce(op);
+  auto ok = get<0>(result);
+  auto chunk = get<1>(result);
+
+  if (chunk.size() == 0) {
+    if (ok) {
+      return pump(op);
+    } else {
+      return kj::READY_NOW;
+    }
+  } else {
+    auto promise = inner.write(chunk.begin(), chunk.size());
+    if (ok) {
+      promise = promise.then([this, op]() { return pump(op); });
+    }
+    return promise;
+  }
+}
+
+}  // namespace kj
+
+#endif  // KJ_HAS_BROTLI
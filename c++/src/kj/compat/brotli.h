@@ -0,0 +1,170 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "kj/io.h"
+#include "kj/async-io.h"
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+
+namespace kj {
+
+constexpr int DEFAULT_BROTLI_QUALITY = 6;
+// Brotli's own default quality, 11, compresses densely but very slowly, and suits content that is
+// compressed once and served many times. Quality 6 compresses about as fast as gzip's default
+// level, and still better.
+
+namespace _ {  // private
+
+class BrotliDecoder final {
+  // Owns a brotli decoder, and the input it's working through. Once a stream ends, further input
+  // is taken to start a new one, as with concatenated gzip streams.
+
+public:
+  BrotliDecoder();
+  ~BrotliDecoder() noexcept(false);
+  KJ_DISALLOW_COPY(BrotliDecoder);
+
+  void setInput(const void* in, size_t size);
+  inline bool hasInput() { return availIn > 0; }
+  bool hasMoreOutput();
+  inline bool isAtValidEndpoint() { return atValidEndpoint; }
+
+  size_t decompress(byte* out, size_t size);
+  // Decompresses as much of the input as fits in `out`, returning the number of bytes written.
+
+private:
+  BrotliDecoderState* state;
+  const byte* nextIn = nullptr;
+  size_t availIn = 0;
+  bool atValidEndpoint = false;
+};
+
+class BrotliOutputContext final {
+public:
+  BrotliOutputContext(kj::Maybe<int> quality);
+  ~BrotliOutputContext() noexcept(false);
+  KJ_DISALLOW_COPY(BrotliOutputContext);
+
+  void setInput(const void* in, size_t size);
+  kj::Tuple<bool, kj::ArrayPtr<const byte>> pumpOnce(BrotliEncoderOperation op);
+
+private:
+  BrotliEncoderState* encoder = nullptr;
+  kj::Own<BrotliDecoder> decoder;
+  // Exactly one of these is set, depending on whether we're compressing.
+
+  const byte* nextIn = nullptr;
+  size_t availIn = 0;
+  byte buffer[4096];
+};
+
+}  // namespace _ (private)
+
+class BrotliInputStream final: public InputStream {
+public:
+  BrotliInputStream(InputStream& inner);
+  ~BrotliInputStream() noexcept(false);
+  KJ_DISALLOW_COPY(BrotliInputStream);
+
+  size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+private:
+  InputStream& inner;
+  _::BrotliDecoder decoder;
+
+  byte buffer[4096];
+
+  size_t readImpl(byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead);
+};
+
+class BrotliOutputStream final: public OutputStream {
+public:
+  enum { DECOMPRESS };
+
+  BrotliOutputStream(OutputStream& inner, int quality = DEFAULT_BROTLI_QUALITY);
+  BrotliOutputStream(OutputStream& inner, decltype(DECOMPRESS));
+  ~BrotliOutputStream() noexcept(false);
+  KJ_DISALLOW_COPY(BrotliOutputStream);
+
+  void write(const void* buffer, size_t size) override;
+  using OutputStream::write;
+
+  inline void flush() {
+    pump(BROTLI_OPERATION_FLUSH);
+  }
+
+private:
+  OutputStream& inner;
+  _::BrotliOutputContext ctx;
+
+  void pump(BrotliEncoderOperation op);
+};
+
+class BrotliAsyncInputStream final: public AsyncInputStream {
+public:
+  BrotliAsyncInputStream(AsyncInputStream& inner);
+  ~BrotliAsyncInputStream() noexcept(false);
+  KJ_DISALLOW_COPY(BrotliAsyncInputStream);
+
+  Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+private:
+  AsyncInputStream& inner;
+  _::BrotliDecoder decoder;
+
+  byte buffer[4096];
+
+  Promise<size_t> readImpl(byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead);
+};
+
+class BrotliAsyncOutputStream final: public AsyncOutputStream {
+public:
+  enum { DECOMPRESS };
+
+  BrotliAsyncOutputStream(AsyncOutputStream& inner, int quality = DEFAULT_BROTLI_QUALITY);
+  BrotliAsyncOutputStream(AsyncOutputStream& inner, decltype(DECOMPRESS));
+  KJ_DISALLOW_COPY(BrotliAsyncOutputStream);
+
+  Promise<void> write(const void* buffer, size_t size) override;
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override;
+
+  Promise<void> whenWriteDisconnected() override { return inner.whenWriteDisconnected(); }
+
+  inline Promise<void> flush() {
+    return pump(BROTLI_OPERATION_FLUSH);
+  }
+  // Call if you need to flush a stream at an arbitrary data point.
+
+  Promise<void> end() {
+    return pump(BROTLI_OPERATION_FINISH);
+  }
+  // Must call to flush and finish the stream, since some data may be buffered.
+
+private:
+  AsyncOutputStream& inner;
+  _::BrotliOutputContext ctx;
+
+  kj::Promise<void> pump(BrotliEncoderOperation op);
+};
+
+}  // namespace kj
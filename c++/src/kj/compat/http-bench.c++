@@ -0,0 +1,108 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "http.h"
+#include "kj/benchmark.h"
+
+namespace kj {
+namespace {
+
+class HelloService final: public HttpService {
+public:
+  HelloService(HttpHeaderTable& table): table(table) {}
+
+  Promise<void> request(
+      HttpMethod method, StringPtr url, const HttpHeaders& headers,
+      AsyncInputStream& requestBody, Response& response) override {
+    HttpHeaders responseHeaders(table);
+    responseHeaders.set(HttpHeaderId::CONTENT_TYPE, "text/plain");
+    auto stream = response.send(200, "OK", responseHeaders, BODY.size());
+    auto promise = stream->write(BODY.begin(), BODY.size());
+    return promise.attach(kj::mv(stream));
+  }
+
+  static constexpr StringPtr BODY = "Hello, world!"_kj;
+
+private:
+  HttpHeaderTable& table;
+};
+
+constexpr StringPtr REQUEST =
+    "GET /foo/bar?baz=qux HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:68.0) Gecko/20100101 Firefox/68.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Cookie: session=0123456789abcdef; theme=dark\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"_kj;
+
+KJ_BENCHMARK("HttpServer parse request and respond over in-memory pipe") {
+  EventLoop loop;
+  WaitScope waitScope(loop);
+  TimerImpl timer(origin<TimePoint>());
+  auto pipe = newTwoWayPipe();
+
+  HttpHeaderTable table;
+  HelloService service(table);
+  HttpServer server(timer, table, service);
+  auto listenTask = server.listenHttp(kj::mv(pipe.ends[0]));
+
+  // The response has a fixed size, which we learn from the first response.
+  size_t responseSize = 0;
+  {
+    pipe.ends[1]->write(REQUEST.begin(), REQUEST.size()).wait(waitScope);
+    char buffer[4096];
+    while (responseSize < 4 ||
+           memcmp(buffer + responseSize - HelloService::BODY.size(),
+                  HelloService::BODY.begin(), HelloService::BODY.size()) != 0) {
+      responseSize += pipe.ends[1]->tryRead(buffer + responseSize, 1, sizeof(buffer) - responseSize)
+          .wait(waitScope);
+    }
+  }
+
+  auto responseBuffer = heapArray<char>(responseSize);
+  for (uint64_t i = 0; i < iterations; i++) {
+    pipe.ends[1]->write(REQUEST.begin(), REQUEST.size()).wait(waitScope);
+    pipe.ends[1]->read(responseBuffer.begin(), responseSize).wait(waitScope);
+  }
+
+  pipe.ends[1]->shutdownWrite();
+  listenTask.wait(waitScope);
+}
+
+KJ_BENCHMARK("HttpHeaders parse request") {
+  HttpHeaderTable table;
+  HttpHeaders headers(table);
+  auto buffer = heapArray<char>(REQUEST.size());
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    // tryParseRequest() parses in-place, so it needs a fresh copy each time.
+    memcpy(buffer.begin(), REQUEST.begin(), REQUEST.size());
+    headers.clear();
+    doNotOptimizeAway(headers.tryParseRequest(buffer));
+  }
+}
+
+}  // namespace
+}  // namespace kj
@@ -0,0 +1,312 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#if KJ_HAS_ZLIB
+
+#include "http-compression.h"
+#include "kj/debug.h"
+#include "kj/test.h"
+#include "kj/vector.h"
+#include <zlib.h>
+#include <utility>
+
+namespace kj {
+namespace {
+
+class CapturingStream final: public AsyncOutputStream {
+public:
+  CapturingStream(Vector<byte>& output, bool& ended): output(output), ended(ended) {}
+  ~CapturingStream() noexcept(false) { ended = true; }
+
+  Promise<void> write(const void* buffer, size_t size) override {
+    output.addAll(arrayPtr(reinterpret_cast<const byte*>(buffer), size));
+    return READY_NOW;
+  }
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    for (auto piece: pieces) output.addAll(piece);
+    return READY_NOW;
+  }
+  Promise<void> whenWriteDisconnected() override { return NEVER_DONE; }
+
+private:
+  Vector<byte>& output;
+  bool& ended;
+};
+
+class CapturingResponse final: public HttpService::Response {
+public:
+  CapturingResponse(const HttpHeaderTable& table): headers(table) {}
+
+  uint statusCode = 0;
+  HttpHeaders headers;
+  Maybe<uint64_t> expectedBodySize;
+  Vector<byte> body;
+  bool ended = false;
+
+  Own<AsyncOutputStream> send(uint statusCode, StringPtr statusText, const HttpHeaders& headers,
+                              Maybe<uint64_t> expectedBodySize) override {
+    this->statusCode = statusCode;
+    this->headers = headers.clone();
+    this->expectedBodySize = expectedBodySize;
+    return heap<CapturingStream>(body, ended);
+  }
+
+  Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) override {
+    KJ_UNIMPLEMENTED("no WebSockets here");
+  }
+};
+
+class TestService final: public HttpService {
+  // Sends `body` in `chunkSize` pieces with the given Content-Type and any other given headers.
+
+public:
+  TestService(const HttpHeaderTable& table): table(table) {}
+
+  StringPtr contentType = "text/plain";
+  String body;
+  size_t chunkSize = 1000;
+  bool sendLength = false;
+  uint statusCode = 200;
+  Vector<std::pair<HttpHeaderId, StringPtr>> extraHeaders;
+
+  Promise<void> request(HttpMethod method, StringPtr url, const HttpHeaders& requestHeaders,
+                        AsyncInputStream& requestBody, Response& response) override {
+    HttpHeaders headers(table);
+    headers.set(HttpHeaderId::CONTENT_TYPE, contentType);
+    for (auto& header: extraHeaders) headers.set(header.first, header.second);
+    Maybe<uint64_t> length;
+    if (sendLength) length = body.size();
+
+    auto stream = response.send(statusCode, "OK", headers, length);
+    return writeFrom(*stream, 0).attach(kj::mv(stream));
+  }
+
+private:
+  const HttpHeaderTable& table;
+
+  Promise<void> writeFrom(AsyncOutputStream& stream, size_t pos) {
+    if (pos >= body.size()) return READY_NOW;
+    size_t n = kj::min(chunkSize, body.size() - pos);
+    return stream.write(body.begin() + pos, n).then([this, &stream, pos, n]() {
+      return writeFrom(stream, pos + n);
+    });
+  }
+};
+
+String inflateAll(ArrayPtr<const byte> input) {
+  z_stream ctx = {};
+  KJ_ASSERT(inflateInit2(&ctx, 15 + 32) == Z_OK);  // + 32: detect gzip or zlib header
+  KJ_DEFER(inflateEnd(&ctx));
+
+  ctx.next_in = const_cast<byte*>(input.begin());
+  ctx.avail_in = input.size();
+
+  Vector<char> output;
+  byte buffer[4096];
+  int result;
+  do {
+    ctx.next_out = buffer;
+    ctx.avail_out = sizeof(buffer);
+    result = inflate(&ctx, Z_NO_FLUSH);
+    KJ_ASSERT(result == Z_OK || result == Z_STREAM_END, result);
+    output.addAll(arrayPtr(reinterpret_cast<char*>(buffer), sizeof(buffer) - ctx.avail_out));
+  } while (result != Z_STREAM_END);
+
+  KJ_EXPECT(ctx.avail_in == 0, "trailing garbage after compressed stream");
+  output.add('\0');
+  return String(output.releaseAsArray());
+}
+
+struct TestFixture {
+  TestFixture(HttpCompressionSettings settings = HttpCompressionSettings())
+      : builder(),
+        acceptEncoding(builder.add("Accept-Encoding")),
+        contentEncoding(builder.add("Content-Encoding")),
+        vary(builder.add("Vary")),
+        etag(builder.add("ETag")),
+        cacheControl(builder.add("Cache-Control")),
+        service(builder.getFutureTable()),
+        compressing(newCompressingHttpService(service, builder, settings)),
+        table(builder.build()) {
+    kj::Vector<kj::String> lines;
+    for (uint i = 0; i < 2000; i++) {
+      lines.add(kj::str("line ", i, " of a rather repetitive response body\n"));
+    }
+    service.body = kj::strArray(lines, "");
+  }
+
+  HttpHeaderTable::Builder builder;
+  HttpHeaderId acceptEncoding;
+  HttpHeaderId contentEncoding;
+  HttpHeaderId vary;
+  HttpHeaderId etag;
+  HttpHeaderId cacheControl;
+  TestService service;
+  Own<HttpService> compressing;
+  Own<HttpHeaderTable> table;
+
+  Own<CapturingResponse> request(Maybe<StringPtr> accept,
+                                 HttpMethod method = HttpMethod::GET) {
+    EventLoop loop;
+    WaitScope waitScope(loop);
+
+    HttpHeaders headers(*table);
+    KJ_IF_MAYBE(a, accept) headers.set(acceptEncoding, *a);
+
+    auto response = heap<CapturingResponse>(*table);
+    NullStream requestBody;
+    compressing->request(method, "/", headers, requestBody, *response).wait(waitScope);
+    KJ_EXPECT(response->ended);
+    return response;
+  }
+
+  class NullStream final: public AsyncInputStream {
+  public:
+    Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+      return size_t(0);
+    }
+  };
+};
+
+KJ_TEST("HTTP compression: gzip") {
+  TestFixture fixture;
+  auto response = fixture.request("gzip, deflate"_kj);
+
+  KJ_EXPECT(response->statusCode == 200);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.contentEncoding)) == "gzip");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.vary)) == "Accept-Encoding");
+  KJ_EXPECT(response->expectedBodySize == nullptr);
+  KJ_EXPECT(response->body.size() < fixture.service.body.size() / 4, response->body.size());
+  KJ_EXPECT(response->body.size() >= 2 && response->body[0] == 0x1f && response->body[1] == 0x8b);
+  KJ_EXPECT(inflateAll(response->body) == fixture.service.body);
+}
+
+KJ_TEST("HTTP compression: deflate and q-values") {
+  TestFixture fixture;
+
+  {
+    auto response = fixture.request("gzip;q=0.5, deflate"_kj);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.contentEncoding)) == "deflate");
+    KJ_EXPECT(inflateAll(response->body) == fixture.service.body);
+  }
+  {
+    auto response = fixture.request("*"_kj);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.contentEncoding)) == "gzip");
+    KJ_EXPECT(inflateAll(response->body) == fixture.service.body);
+  }
+  {
+    auto response = fixture.request("gzip;q=0, deflate;q=0"_kj);
+    KJ_EXPECT(response->headers.get(fixture.contentEncoding) == nullptr);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.vary)) == "Accept-Encoding");
+    KJ_EXPECT(response->body.asPtr().asChars() == fixture.service.body.asArray());
+  }
+  {
+    auto response = fixture.request(nullptr);
+    KJ_EXPECT(response->headers.get(fixture.contentEncoding) == nullptr);
+    KJ_EXPECT(response->body.asPtr().asChars() == fixture.service.body.asArray());
+  }
+}
+
+KJ_TEST("HTTP compression: ineligible responses pass through") {
+  TestFixture fixture;
+
+  auto expectUncompressed = [&](Maybe<StringPtr> accept, HttpMethod method = HttpMethod::GET) {
+    auto response = fixture.request(accept, method);
+    KJ_EXPECT(response->headers.get(fixture.contentEncoding) == nullptr);
+    KJ_EXPECT(response->body.asPtr().asChars() == fixture.service.body.asArray());
+    return response;
+  };
+
+  // Already-compressed media type.
+  fixture.service.contentType = "image/png";
+  expectUncompressed("gzip"_kj);
+
+  // Event streams must not be delayed.
+  fixture.service.contentType = "text/event-stream";
+  expectUncompressed("gzip"_kj);
+
+  // Small known-length bodies.
+  fixture.service.contentType = "application/json; charset=utf-8";
+  fixture.service.sendLength = true;
+  fixture.service.body = kj::str("{\"small\": true}");
+  {
+    auto response = expectUncompressed("gzip"_kj);
+    KJ_EXPECT(response->expectedBodySize.orDefault(0) == fixture.service.body.size());
+  }
+}
+
+KJ_TEST("HTTP compression: respects existing encoding and no-transform") {
+  TestFixture fixture;
+
+  fixture.service.extraHeaders.add(fixture.contentEncoding, "br");
+  {
+    auto response = fixture.request("gzip"_kj);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.contentEncoding)) == "br");
+    KJ_EXPECT(response->body.asPtr().asChars() == fixture.service.body.asArray());
+  }
+
+  fixture.service.extraHeaders.clear();
+  fixture.service.extraHeaders.add(fixture.cacheControl, "public, no-transform");
+  {
+    auto response = fixture.request("gzip"_kj);
+    KJ_EXPECT(response->headers.get(fixture.contentEncoding) == nullptr);
+    KJ_EXPECT(response->body.asPtr().asChars() == fixture.service.body.asArray());
+  }
+
+  // HEAD responses have no body to compress.
+  fixture.service.extraHeaders.clear();
+  {
+    auto response = fixture.request("gzip"_kj, HttpMethod::HEAD);
+    KJ_EXPECT(response->headers.get(fixture.contentEncoding) == nullptr);
+  }
+}
+
+KJ_TEST("HTTP compression: ETag is weakened and Vary extended") {
+  TestFixture fixture;
+  fixture.service.extraHeaders.add(fixture.etag, "\"abc\"");
+  fixture.service.extraHeaders.add(fixture.vary, "Origin");
+
+  auto response = fixture.request("gzip"_kj);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.etag)) == "W/\"abc\"");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.vary)) == "Origin, Accept-Encoding");
+  KJ_EXPECT(inflateAll(response->body) == fixture.service.body);
+}
+
+KJ_TEST("HTTP compression: small buffer and reused contexts") {
+  HttpCompressionSettings settings;
+  settings.bufferSize = 64;
+  settings.maxPooledCompressors = 1;
+  TestFixture fixture(settings);
+  fixture.service.chunkSize = 7;
+
+  // Several responses in a row exercise resetting a pooled context, for both encodings.
+  for (auto accept: { "gzip"_kj, "deflate"_kj, "gzip"_kj, "deflate"_kj }) {
+    auto response = fixture.request(accept);
+    KJ_EXPECT(KJ_ASSERT_NONNULL(response->headers.get(fixture.contentEncoding)) == accept);
+    KJ_EXPECT(inflateAll(response->body) == fixture.service.body);
+  }
+}
+
+}  // namespace
+}  // namespace kj
+
+#endif  // KJ_HAS_ZLIB
@@ -0,0 +1,537 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "http-compression.h"
+#include <kj/debug.h>
+#include <kj/vector.h>
+#include <stdlib.h>
+
+#if KJ_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace kj {
+
+namespace {
+
+#if KJ_HAS_ZLIB
+
+// =======================================================================================
+// Header parsing helpers
+
+bool equalsIgnoreCase(kj::ArrayPtr<const char> a, kj::StringPtr b) {
+  if (a.size() != b.size()) return false;
+  for (auto i: kj::indices(a)) {
+    char c = a[i];
+    if ('A' <= c && c <= 'Z') c += 'a' - 'A';
+    if (c != b[i]) return false;  // `b` is always lower-case
+  }
+  return true;
+}
+
+bool endsWithIgnoreCase(kj::ArrayPtr<const char> a, kj::StringPtr suffix) {
+  return a.size() >= suffix.size() &&
+      equalsIgnoreCase(a.slice(a.size() - suffix.size(), a.size()), suffix);
+}
+
+kj::ArrayPtr<const char> trim(kj::ArrayPtr<const char> s) {
+  while (s.size() > 0 && (s.front() == ' ' || s.front() == '\t')) s = s.slice(1, s.size());
+  while (s.size() > 0 && (s.back() == ' ' || s.back() == '\t')) s = s.slice(0, s.size() - 1);
+  return s;
+}
+
+template <typename Func>
+void forEachListItem(kj::StringPtr list, Func&& func) {
+  // Calls `func` with each trimmed, non-empty element of a comma-separated header value.
+
+  kj::ArrayPtr<const char> rest = list;
+  while (rest.size() > 0) {
+    size_t end = 0;
+    while (end < rest.size() && rest[end] != ',') ++end;
+    auto item = trim(rest.slice(0, end));
+    if (item.size() > 0) func(item);
+    rest = rest.slice(kj::min(end + 1, rest.size()), rest.size());
+  }
+}
+
+bool isCompressibleType(kj::StringPtr contentType) {
+  // Is the media type one that typically compresses well, and isn't compressed already?
+
+  kj::ArrayPtr<const char> type = contentType;
+  KJ_IF_MAYBE(semicolon, contentType.findFirst(';')) {
+    type = type.slice(0, *semicolon);
+  }
+  type = trim(type);
+
+  static constexpr kj::StringPtr EXACT[] = {
+    "application/json"_kj, "application/javascript"_kj, "application/x-javascript"_kj,
+    "application/ecmascript"_kj, "application/xml"_kj, "application/wasm"_kj,
+    "application/x-www-form-urlencoded"_kj, "image/svg+xml"_kj, "image/x-icon"_kj,
+    "image/bmp"_kj, "font/ttf"_kj, "font/otf"_kj,
+  };
+  for (auto candidate: EXACT) {
+    if (equalsIgnoreCase(type, candidate)) return true;
+  }
+
+  if (endsWithIgnoreCase(type, "+json") || endsWithIgnoreCase(type, "+xml")) return true;
+
+  if (type.size() > 5 && equalsIgnoreCase(type.slice(0, 5), "text/")) {
+    // Server-sent events must reach the client as soon as they're written, but a compressor
+    // holds data back until it has a worthwhile amount.
+    return !equalsIgnoreCase(type, "text/event-stream");
+  }
+
+  return false;
+}
+
+bool hasToken(kj::StringPtr list, kj::StringPtr token) {
+  bool found = false;
+  forEachListItem(list, [&](kj::ArrayPtr<const char> item) {
+    if (equalsIgnoreCase(item, token)) found = true;
+  });
+  return found;
+}
+
+// =======================================================================================
+// Compression
+
+enum class Encoding { GZIP, DEFLATE };
+static constexpr uint ENCODING_COUNT = 2;
+
+kj::StringPtr encodingName(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::GZIP: return "gzip";
+    case Encoding::DEFLATE: return "deflate";
+  }
+  KJ_UNREACHABLE;
+}
+
+kj::Maybe<Encoding> chooseEncoding(kj::StringPtr acceptEncoding) {
+  // Picks the encoding the client prefers, per its Accept-Encoding header, preferring gzip on a
+  // tie.
+
+  double qGzip = -1, qDeflate = -1, qWildcard = -1;
+
+  forEachListItem(acceptEncoding, [&](kj::ArrayPtr<const char> item) {
+    kj::ArrayPtr<const char> coding = item;
+    double q = 1;
+    for (auto i: kj::indices(item)) {
+      if (item[i] == ';') {
+        coding = trim(item.slice(0, i));
+        auto params = trim(item.slice(i + 1, item.size()));
+        if (params.size() >= 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+          auto value = kj::heapString(trim(params.slice(2, params.size())));
+          q = strtod(value.cStr(), nullptr);
+        }
+        break;
+      }
+    }
+
+    if (equalsIgnoreCase(coding, "gzip") || equalsIgnoreCase(coding, "x-gzip")) {
+      qGzip = q;
+    } else if (equalsIgnoreCase(coding, "deflate")) {
+      qDeflate = q;
+    } else if (equalsIgnoreCase(coding, "*")) {
+      qWildcard = q;
+    }
+  });
+
+  if (qGzip < 0) qGzip = qWildcard;
+  if (qDeflate < 0) qDeflate = qWildcard;
+
+  if (qGzip > 0 && qGzip >= qDeflate) {
+    return Encoding::GZIP;
+  } else if (qDeflate > 0) {
+    return Encoding::DEFLATE;
+  } else {
+    return nullptr;
+  }
+}
+
+class Compressor {
+  // A zlib deflate context. Reset and reused between responses; see CompressorPool.
+
+public:
+  Compressor(Encoding encoding, int level): encoding(encoding) {
+    int result = deflateInit2(&ctx, level, Z_DEFLATED,
+        encoding == Encoding::GZIP ? 15 + 16 : 15,  // + 16 asks for a gzip header and trailer
+        8, Z_DEFAULT_STRATEGY);
+    KJ_REQUIRE(result == Z_OK, "deflateInit2() failed", result);
+  }
+  ~Compressor() noexcept(false) {
+    deflateEnd(&ctx);
+  }
+  KJ_DISALLOW_COPY(Compressor);
+
+  Encoding getEncoding() { return encoding; }
+
+  void reset() {
+    KJ_ASSERT(deflateReset(&ctx) == Z_OK);
+  }
+
+  void setInput(kj::ArrayPtr<const byte> input) {
+    ctx.next_in = const_cast<byte*>(input.begin());
+    ctx.avail_in = input.size();
+  }
+
+  kj::ArrayPtr<const byte> deflateInto(kj::ArrayPtr<byte> output, int flush) {
+    // Compresses as much of the input as fits into `output`, and returns the part of `output`
+    // that was filled. If that's all of `output`, call again: there may be more.
+
+    ctx.next_out = output.begin();
+    ctx.avail_out = output.size();
+    int result = ::deflate(&ctx, flush);
+    if (result != Z_OK && result != Z_BUF_ERROR && result != Z_STREAM_END) {
+      KJ_FAIL_REQUIRE("deflate() failed", result, ctx.msg == nullptr ? "" : ctx.msg);
+    }
+    return output.slice(0, output.size() - ctx.avail_out);
+  }
+
+private:
+  Encoding encoding;
+  z_stream ctx = {};
+};
+
+class CompressorPool final: public kj::Disposer {
+  // Hands out Compressors, taking them back when the Own is dropped.
+
+public:
+  CompressorPool(int level, uint maxIdle): level(level), maxIdle(maxIdle) {}
+  ~CompressorPool() noexcept(false) {
+    for (auto& list: idle) {
+      for (auto compressor: list) delete compressor;
+    }
+  }
+  KJ_DISALLOW_COPY(CompressorPool);
+
+  kj::Own<Compressor> get(Encoding encoding) {
+    auto& list = idle[static_cast<uint>(encoding)];
+    Compressor* compressor;
+    if (list.empty()) {
+      compressor = new Compressor(encoding, level);
+    } else {
+      compressor = list.back();
+      list.removeLast();
+      compressor->reset();
+    }
+    return kj::Own<Compressor>(compressor, *this);
+  }
+
+private:
+  int level;
+  uint maxIdle;
+  mutable kj::Vector<Compressor*> idle[ENCODING_COUNT];
+
+  void disposeImpl(void* pointer) const override {
+    auto compressor = reinterpret_cast<Compressor*>(pointer);
+    auto& list = idle[static_cast<uint>(compressor->getEncoding())];
+    if (list.size() < maxIdle) {
+      // It gets reset when next handed out, so that a context abandoned mid-stream works too.
+      list.add(compressor);
+    } else {
+      delete compressor;
+    }
+  }
+};
+
+class CompressingResponse;
+
+class CompressingStream final: public kj::AsyncOutputStream {
+  // Response body stream which compresses everything written to it.
+  //
+  // The HTTP response body ends when the application drops its body stream, but compression
+  // must then still write out whatever zlib is holding, plus the trailer. Since a destructor
+  // can't wait, the final write is handed to the CompressingResponse, which makes the request's
+  // promise wait for it.
+
+public:
+  CompressingStream(kj::Own<kj::AsyncOutputStream> inner, kj::Own<Compressor> compressor,
+                    CompressingResponse& response, size_t bufferSize)
+      : inner(kj::mv(inner)), compressor(kj::mv(compressor)), response(response),
+        buffer(kj::heapArray<byte>(bufferSize)) {}
+
+  ~CompressingStream() noexcept(false);
+
+  void detachResponse() { response = nullptr; }
+
+  kj::Promise<void> write(const void* data, size_t size) override {
+    KJ_REQUIRE(!writeInProgress, "concurrent write()s not allowed");
+    writeInProgress = true;
+    compressor->setInput(kj::arrayPtr(reinterpret_cast<const byte*>(data), size));
+    return pump().then([this]() { writeInProgress = false; });
+  }
+
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
+    if (pieces.size() == 0) return kj::READY_NOW;
+    auto& first = pieces[0];
+    return write(first.begin(), first.size()).then([this, pieces]() {
+      return write(pieces.slice(1, pieces.size()));
+    });
+  }
+
+  kj::Promise<void> whenWriteDisconnected() override {
+    return inner->whenWriteDisconnected();
+  }
+
+private:
+  kj::Own<kj::AsyncOutputStream> inner;
+  kj::Own<Compressor> compressor;
+  kj::Maybe<CompressingResponse&> response;
+  // Null if the request finished before the application dropped this stream.
+  kj::Array<byte> buffer;
+  bool writeInProgress = false;
+
+  kj::Promise<void> pump() {
+    // Compresses the current input, writing out each bufferful as it fills.
+
+    auto output = compressor->deflateInto(buffer, Z_NO_FLUSH);
+    if (output.size() == 0) {
+      // zlib is holding everything so far; nothing to write yet.
+      return kj::READY_NOW;
+    }
+
+    auto promise = inner->write(output.begin(), output.size());
+    if (output.size() < buffer.size()) {
+      // The input is used up.
+      return promise;
+    }
+    return promise.then([this]() { return pump(); });
+  }
+
+  kj::Array<byte> finish() {
+    compressor->setInput(nullptr);
+    kj::Vector<byte> tail;
+    for (;;) {
+      auto output = compressor->deflateInto(buffer, Z_FINISH);
+      tail.addAll(output);
+      if (output.size() < buffer.size()) break;
+    }
+    return tail.releaseAsArray();
+  }
+};
+
+class CompressingResponse final: public HttpService::Response {
+public:
+  struct HeaderIds {
+    HttpHeaderId acceptEncoding;
+    HttpHeaderId contentEncoding;
+    HttpHeaderId vary;
+    HttpHeaderId cacheControl;
+    HttpHeaderId etag;
+  };
+
+  CompressingResponse(HttpService::Response& inner, const HeaderIds& ids,
+                      CompressorPool& pool, const HttpCompressionSettings& settings,
+                      HttpMethod method, const HttpHeaders& requestHeaders)
+      : inner(inner), ids(ids), pool(pool), settings(settings), method(method) {
+    KJ_IF_MAYBE(accept, requestHeaders.get(ids.acceptEncoding)) {
+      encoding = chooseEncoding(*accept);
+    }
+  }
+
+  kj::Own<kj::AsyncOutputStream> send(
+      uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+      kj::Maybe<uint64_t> expectedBodySize) override {
+    if (!isEligible(statusCode, headers)) {
+      return inner.send(statusCode, statusText, headers, expectedBodySize);
+    }
+
+    auto newHeaders = headers.cloneShallow();
+    KJ_IF_MAYBE(vary, headers.get(ids.vary)) {
+      if (!hasToken(*vary, "accept-encoding") && !hasToken(*vary, "*")) {
+        newHeaders.set(ids.vary, kj::str(*vary, ", Accept-Encoding"));
+      }
+    } else {
+      newHeaders.set(ids.vary, "Accept-Encoding");
+    }
+
+    bool bigEnough = true;
+    KJ_IF_MAYBE(size, expectedBodySize) {
+      bigEnough = *size >= settings.minimumSize;
+    }
+
+    KJ_IF_MAYBE(e, encoding) {
+      if (bigEnough) {
+        newHeaders.set(ids.contentEncoding, encodingName(*e));
+        KJ_IF_MAYBE(etag, headers.get(ids.etag)) {
+          if (!etag->startsWith("W/")) {
+            // The compressed bytes differ from the uncompressed ones, so the tag can no longer
+            // promise byte-for-byte equality.
+            newHeaders.set(ids.etag, kj::str("W/", *etag));
+          }
+        }
+
+        auto body = inner.send(statusCode, statusText, newHeaders, nullptr);
+        auto stream = kj::heap<CompressingStream>(
+            kj::mv(body), pool.get(*e), *this, settings.bufferSize);
+        activeStream = *stream;
+        return kj::mv(stream);
+      }
+    }
+
+    return inner.send(statusCode, statusText, newHeaders, expectedBodySize);
+  }
+
+  ~CompressingResponse() noexcept(false) {
+    KJ_IF_MAYBE(stream, activeStream) {
+      stream->detachResponse();
+    }
+  }
+
+  kj::Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) override {
+    return inner.acceptWebSocket(headers);
+  }
+
+  void streamDone(kj::Maybe<kj::Promise<void>> promise) {
+    activeStream = nullptr;
+    finalWrite = kj::mv(promise);
+  }
+
+  kj::Promise<void> whenDone() {
+    KJ_IF_MAYBE(p, finalWrite) {
+      auto result = kj::mv(*p);
+      finalWrite = nullptr;
+      return kj::mv(result);
+    } else {
+      return kj::READY_NOW;
+    }
+  }
+
+private:
+  HttpService::Response& inner;
+  const HeaderIds& ids;
+  CompressorPool& pool;
+  const HttpCompressionSettings& settings;
+  HttpMethod method;
+  kj::Maybe<Encoding> encoding;
+  kj::Maybe<CompressingStream&> activeStream;
+  kj::Maybe<kj::Promise<void>> finalWrite;
+
+  bool isEligible(uint statusCode, const HttpHeaders& headers) {
+    if (method == HttpMethod::HEAD) return false;
+    if (statusCode < 200 || statusCode == 204 || statusCode == 206 || statusCode == 304) {
+      return false;
+    }
+    if (headers.get(ids.contentEncoding) != nullptr) return false;
+    KJ_IF_MAYBE(cacheControl, headers.get(ids.cacheControl)) {
+      if (hasToken(*cacheControl, "no-transform")) return false;
+    }
+    KJ_IF_MAYBE(type, headers.get(HttpHeaderId::CONTENT_TYPE)) {
+      return isCompressibleType(*type);
+    } else {
+      return false;
+    }
+  }
+};
+
+CompressingStream::~CompressingStream() noexcept(false) {
+  KJ_IF_MAYBE(r, response) {
+    if (writeInProgress) {
+      // The application gave up mid-write. Leave the body incomplete; the server will notice.
+      r->streamDone(nullptr);
+      return;
+    }
+
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      auto tail = finish();
+      auto promise = inner->write(tail.begin(), tail.size());
+      r->streamDone(promise.attach(kj::mv(tail), kj::mv(inner), kj::mv(compressor)));
+    })) {
+      r->streamDone(nullptr);
+      KJ_LOG(ERROR, "failed to finish compressed response body", *exception);
+    }
+  }
+}
+
+class CompressingHttpService final: public HttpService {
+public:
+  CompressingHttpService(HttpService& inner, HttpHeaderTable::Builder& builder,
+                         HttpCompressionSettings settings)
+      : inner(inner),
+        ids {
+          builder.add("Accept-Encoding"),
+          builder.add("Content-Encoding"),
+          builder.add("Vary"),
+          builder.add("Cache-Control"),
+          builder.add("ETag"),
+        },
+        settings(settings),
+        pool(settings.level, settings.maxPooledCompressors) {}
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    auto wrapped = kj::heap<CompressingResponse>(response, ids, pool, settings, method, headers);
+    auto promise = inner.request(method, url, headers, requestBody, *wrapped);
+    return promise.then([&wrapped = *wrapped]() {
+      return wrapped.whenDone();
+    }).attach(kj::mv(wrapped));
+  }
+
+  kj::Promise<kj::Own<kj::AsyncIoStream>> connect(kj::StringPtr host) override {
+    return inner.connect(host);
+  }
+
+private:
+  HttpService& inner;
+  CompressingResponse::HeaderIds ids;
+  HttpCompressionSettings settings;
+  CompressorPool pool;
+};
+
+#else  // KJ_HAS_ZLIB
+
+class PassThroughHttpService final: public HttpService {
+  // Used when built without zlib.
+
+public:
+  PassThroughHttpService(HttpService& inner): inner(inner) {}
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    return inner.request(method, url, headers, requestBody, response);
+  }
+
+  kj::Promise<kj::Own<kj::AsyncIoStream>> connect(kj::StringPtr host) override {
+    return inner.connect(host);
+  }
+
+private:
+  HttpService& inner;
+};
+
+#endif  // KJ_HAS_ZLIB, else
+
+}  // namespace
+
+kj::Own<HttpService> newCompressingHttpService(
+    HttpService& inner, HttpHeaderTable::Builder& headerTableBuilder,
+    HttpCompressionSettings settings) {
+#if KJ_HAS_ZLIB
+  return kj::heap<CompressingHttpService>(inner, headerTableBuilder, settings);
+#else
+  return kj::heap<PassThroughHttpService>(inner);
+#endif
+}
+
+}  // namespace kj
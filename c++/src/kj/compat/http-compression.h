@@ -0,0 +1,76 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+// Transparent compression of HTTP responses.
+
+#include "http.h"
+
+KJ_BEGIN_HEADER
+
+namespace kj {
+
+struct HttpCompressionSettings {
+  int level = 6;
+  // zlib compression level, from 1 (fastest) to 9 (smallest output).
+
+  uint64_t minimumSize = 1024;
+  // Responses whose expected body size is known and smaller than this are sent uncompressed,
+  // since compression wouldn't save enough to be worth the CPU (or might even grow them).
+
+  size_t bufferSize = 16384;
+  // Size of the buffer compressed output is collected in before being written to the client.
+  // This is the most a response holds beyond zlib's own internal state, however large the body.
+
+  uint maxPooledCompressors = 16;
+  // Compression contexts are expensive to set up (deflateInit2() allocates ~256KiB), so finished
+  // ones are reset and reused for later responses. This bounds how many idle ones are kept.
+};
+
+kj::Own<HttpService> newCompressingHttpService(
+    HttpService& inner, HttpHeaderTable::Builder& headerTableBuilder,
+    HttpCompressionSettings settings = HttpCompressionSettings());
+// Returns an HttpService which forwards requests to `inner`, compressing response bodies with
+// gzip or deflate when the client's Accept-Encoding allows it. `headerTableBuilder` must be the
+// builder for the table used by the server's request headers and by `inner`'s response headers;
+// the wrapper registers the headers it needs.
+//
+// A response is compressed only if:
+// - It has a body: the request isn't HEAD and the status isn't 1xx, 204, 206 or 304.
+// - It has no Content-Encoding already, and no "Cache-Control: no-transform".
+// - Its Content-Type is textual (text/*, JSON, JavaScript, XML, SVG, WebAssembly, ...), so
+//   already-compressed formats such as images, video, and archives are passed through. Event
+//   streams are also passed through, since compression would delay events.
+// - Its expected size is unknown or at least `settings.minimumSize`.
+//
+// Compressed responses are sent with chunked encoding, Content-Encoding set, and any strong ETag
+// weakened. Responses whose Content-Type is eligible also get "Vary: Accept-Encoding", whether
+// or not this particular client accepted compression.
+//
+// Brotli and zstd are not offered, as KJ doesn't depend on those libraries. If KJ was built
+// without zlib, the returned service passes everything through unchanged.
+//
+// `inner` must outlive the returned service, which must outlive all requests made to it.
+
+}  // namespace kj
+
+KJ_END_HEADER
@@ -25,6 +25,7 @@
 #include "kj/debug.h"
 #include "kj/test.h"
 #include "kj/encoding.h"
+#include "kj/filesystem.h"
 #include <map>
 
 #if KJ_HTTP_TEST_USE_OS_PIPE
@@ -221,6 +222,15 @@ KJ_TEST("HttpHeaders::parseResponse") {
       "Foo-Bar: Baz\r\n"
       "other-Header: yep\r\n"
       "\r\n");
+
+  // Serializing into a caller-provided buffer gives the same bytes, and reuses the buffer when
+  // it's big enough.
+  kj::Array<char> buffer;
+  auto serialized = headers.serializeResponse(buffer, result.statusCode, result.statusText);
+  KJ_EXPECT(kj::str(serialized) == headers.serializeResponse(result.statusCode, result.statusText));
+  const char* bufferStart = buffer.begin();
+  headers.serializeResponse(buffer, 200, "OK");
+  KJ_EXPECT(buffer.begin() == bufferStart);
 }
 
 KJ_TEST("HttpHeaders parse invalid") {
@@ -296,6 +306,63 @@ KJ_TEST("HttpHeaders parse invalid") {
   }
 }
 
+KJ_TEST("HttpHeaders parse long tokens") {
+  // The parser scans URLs, header names, and header values in 16-byte chunks, so make sure
+  // delimiters are found at every offset within a chunk, and near the end of the buffer.
+  HttpHeaderTable::Builder builder;
+  auto longName = builder.add("X-A-Rather-Long-Header-Name|With~Odd-Tokens");
+  auto table = builder.build();
+
+  for (uint offset = 1; offset < 40; offset++) {
+    HttpHeaders headers(*table);
+    auto padding = kj::str(kj::repeat('x', offset));
+    auto text = kj::str(
+        "GET /", padding, " HTTP/1.1\r\n"
+        "X-A-RATHER-long-header-name|with~odd-tokens: ", padding, "\r\n"
+        "Long-Value: ", padding, "\r\n   continued\n"
+        "X-", padding, ": ", padding, "\r\n"
+        "\r\n");
+    auto result = headers.tryParseRequest(text.asArray()).get<HttpHeaders::Request>();
+
+    KJ_EXPECT(result.url == kj::str("/", padding));
+    KJ_EXPECT(KJ_ASSERT_NONNULL(headers.get(longName)) == padding);
+    KJ_EXPECT(headers.size() == 3);
+    headers.forEach([&](kj::StringPtr name, kj::StringPtr value) {
+      if (name == "Long-Value") {
+        KJ_EXPECT(value == kj::str(padding, "     continued"));
+      } else if (name.startsWith("X-") && name != "X-A-Rather-Long-Header-Name|With~Odd-Tokens") {
+        KJ_EXPECT(name == kj::str("X-", padding));
+        KJ_EXPECT(value == padding);
+      }
+    });
+  }
+
+  for (uint offset = 0; offset < 40; offset++) {
+    HttpHeaders headers(*table);
+    auto padding = kj::str(kj::repeat('x', offset));
+
+    // Separator late in a long header name.
+    {
+      auto text = kj::str(
+          "GET / HTTP/1.1\r\n"
+          "X-Some-Long-Header-", padding, "/Name: foo\r\n"
+          "\r\n");
+      headers.tryParseRequest(text.asArray()).get<HttpHeaders::ProtocolError>();
+    }
+
+    // Embedded NUL in a long header value.
+    {
+      auto text = kj::str(
+          "GET / HTTP/1.1\r\n"
+          "Some-Header: ", padding, "#", padding, "\r\n"
+          "Other-Header: foo\r\n"
+          "\r\n");
+      *strchr(text.begin(), '#') = '\0';
+      headers.tryParseRequest(text.asArray()).get<HttpHeaders::ProtocolError>();
+    }
+  }
+}
+
 KJ_TEST("HttpHeaders require valid HttpHeaderTable") {
   const auto ERROR_MESSAGE =
       "HttpHeaders object was constructed from HttpHeaderTable "
@@ -1193,6 +1260,49 @@ KJ_TEST("HttpClient chunked body pump from fixed length stream") {
                     "b\r\nfoo bar baz\r\n0\r\n\r\n", text);
 }
 
+KJ_TEST("HttpClient fixed-length body pumped from file") {
+  KJ_HTTP_TEST_SETUP_IO;
+
+  auto file = newDiskFilesystem()->getCurrent().createTemporary();
+  file->writeAll("foo bar baz");
+
+  {
+    auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+    auto serverPromise = pipe.ends[1]->readAllText();
+
+    {
+      HttpHeaderTable table;
+      auto client = newHttpClient(table, *pipe.ends[0]);
+
+      auto req = client->request(HttpMethod::POST, "/", HttpHeaders(table), uint64_t(7));
+      KJ_EXPECT(pumpFileTo(*file, *req.body, 4).wait(waitScope) == 7);
+    }
+
+    pipe.ends[0]->shutdownWrite();
+    auto text = serverPromise.wait(waitScope);
+    KJ_EXPECT(text == "POST / HTTP/1.1\r\nContent-Length: 7\r\n\r\nbar baz", text);
+  }
+
+  {
+    // Pumping more than the Content-Length allows is an error.
+    auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+    auto serverPromise = pipe.ends[1]->readAllText();
+
+    {
+      HttpHeaderTable table;
+      auto client = newHttpClient(table, *pipe.ends[0]);
+
+      auto req = client->request(HttpMethod::POST, "/", HttpHeaders(table), uint64_t(3));
+      KJ_EXPECT_THROW_MESSAGE("overwrote Content-Length", pumpFileTo(*file, *req.body));
+    }
+
+    // (The aborted request may or may not have gotten as far as sending headers.)
+    pipe.ends[0]->shutdownWrite();
+    auto text = serverPromise.wait(waitScope);
+    KJ_EXPECT(text.findFirst('f') == nullptr, text);
+  }
+}
+
 KJ_TEST("HttpServer requests") {
   HttpResponseTestCase RESPONSE = {
     "HTTP/1.1 200 OK\r\n"
@@ -1842,6 +1952,166 @@ KJ_TEST("WebSocket masked") {
   serverTask.wait(waitScope);
 }
 
+KJ_TEST("WebSocket masked payloads of many sizes") {
+  // Exercises every tail length of the vectorized masking loop.
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+  FakeEntropySource maskGenerator;
+
+  auto client = newWebSocket(kj::mv(pipe.ends[0]), maskGenerator);
+  auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr);
+
+  for (size_t size: { 0, 1, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 4099 }) {
+    auto data = kj::heapArray<byte>(size);
+    for (auto i: kj::indices(data)) data[i] = i * 7;
+
+    auto sendTask = client->send(data);
+    auto message = server->receive().wait(waitScope);
+    sendTask.wait(waitScope);
+
+    KJ_ASSERT(message.is<kj::Array<byte>>());
+    KJ_EXPECT(message.get<kj::Array<byte>>() == data, size);
+  }
+}
+
+#if KJ_HAS_ZLIB
+KJ_TEST("WebSocket compressed") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  auto client = kj::mv(pipe.ends[0]);
+  auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr, CompressionParameters());
+
+  // Examples from RFC 7692 section 7.2.3.
+  static const byte COMPRESSED_HELLO[] = { 0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+  static const byte COMPRESSED_HELLO_AGAIN[] = { 0xc1, 0x05, 0xf2, 0x00, 0x11, 0x00, 0x00 };
+  static const byte UNCOMPRESSED_HELLO[] = { 0x81, 0x05, 'H', 'e', 'l', 'l', 'o' };
+
+  auto clientTask = client->write(COMPRESSED_HELLO, sizeof(COMPRESSED_HELLO))
+      .then([&]() { return client->write(COMPRESSED_HELLO, sizeof(COMPRESSED_HELLO)); })
+      .then([&]() { return client->write(UNCOMPRESSED_HELLO, sizeof(UNCOMPRESSED_HELLO)); });
+
+  for (auto i KJ_UNUSED: kj::zeroTo(3)) {
+    auto message = server->receive().wait(waitScope);
+    KJ_ASSERT(message.is<kj::String>());
+    KJ_EXPECT(message.get<kj::String>() == "Hello");
+  }
+  clientTask.wait(waitScope);
+
+  // With context takeover, the second message refers back to the first.
+  auto serverTask = server->send(kj::StringPtr("Hello"))
+      .then([&]() { return server->send(kj::StringPtr("Hello")); });
+  expectRead(*client, COMPRESSED_HELLO).wait(waitScope);
+  expectRead(*client, COMPRESSED_HELLO_AGAIN).wait(waitScope);
+  serverTask.wait(waitScope);
+}
+
+KJ_TEST("WebSocket compressed without context takeover") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  CompressionParameters config;
+  config.outboundNoContextTakeover = true;
+
+  auto client = kj::mv(pipe.ends[0]);
+  auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr, config);
+
+  static const byte COMPRESSED_HELLO[] = { 0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+
+  auto serverTask = server->send(kj::StringPtr("Hello"))
+      .then([&]() { return server->send(kj::StringPtr("Hello")); });
+  expectRead(*client, COMPRESSED_HELLO).wait(waitScope);
+  expectRead(*client, COMPRESSED_HELLO).wait(waitScope);
+  serverTask.wait(waitScope);
+}
+
+KJ_TEST("WebSocket compressed round trip") {
+  KJ_HTTP_TEST_SETUP_IO;
+
+  auto mediumString = kj::strArray(kj::repeat(kj::StringPtr("123456789"), 30), "");
+  auto bigString = kj::strArray(kj::repeat(kj::StringPtr("123456789"), 10000), "");
+
+  for (bool noContextTakeover: { false, true }) {
+    auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+    FakeEntropySource maskGenerator;
+
+    CompressionParameters clientConfig;
+    clientConfig.outboundNoContextTakeover = noContextTakeover;
+    clientConfig.outboundMaxWindowBits = 10;
+    CompressionParameters serverConfig;
+    serverConfig.inboundNoContextTakeover = noContextTakeover;
+    serverConfig.inboundMaxWindowBits = 10;
+
+    auto client = newWebSocket(kj::mv(pipe.ends[0]), maskGenerator, clientConfig);
+    auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr, serverConfig);
+
+    auto clientTask = client->send(kj::StringPtr("hello"))
+        .then([&]() { return client->send(mediumString); })
+        .then([&]() { return client->send(bigString); })
+        .then([&]() { return client->send(bigString.asBytes()); })
+        .then([&]() { return client->close(1234, "bored"); });
+
+    {
+      auto message = server->receive().wait(waitScope);
+      KJ_ASSERT(message.is<kj::String>());
+      KJ_EXPECT(message.get<kj::String>() == "hello");
+    }
+    {
+      auto message = server->receive().wait(waitScope);
+      KJ_ASSERT(message.is<kj::String>());
+      KJ_EXPECT(message.get<kj::String>() == mediumString);
+    }
+    {
+      auto message = server->receive().wait(waitScope);
+      KJ_ASSERT(message.is<kj::String>());
+      KJ_EXPECT(message.get<kj::String>() == bigString);
+    }
+    {
+      auto message = server->receive().wait(waitScope);
+      KJ_ASSERT(message.is<kj::Array<byte>>());
+      KJ_EXPECT(message.get<kj::Array<byte>>() == bigString.asBytes());
+    }
+    {
+      auto message = server->receive().wait(waitScope);
+      KJ_ASSERT(message.is<WebSocket::Close>());
+      KJ_EXPECT(message.get<WebSocket::Close>().code == 1234);
+    }
+
+    // The repetitive payloads should have shrunk on the wire.
+    KJ_EXPECT(server->receivedByteCount() < 1000, server->receivedByteCount());
+
+    clientTask.wait(waitScope);
+  }
+}
+
+KJ_TEST("WebSocket compressed message too large") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  auto client = newWebSocket(kj::mv(pipe.ends[0]), nullptr, CompressionParameters());
+  auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr, CompressionParameters());
+
+  // Compresses to a few hundred bytes, but inflates past the limit.
+  auto bigString = kj::strArray(kj::repeat(kj::StringPtr("123456789"), 10000), "");
+  auto clientTask = client->send(bigString);
+
+  KJ_EXPECT_THROW_MESSAGE("WebSocket message is too large", server->receive(1000).wait(waitScope));
+}
+#endif  // KJ_HAS_ZLIB
+
+KJ_TEST("WebSocket RSV1 without compression") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  auto client = kj::mv(pipe.ends[0]);
+  auto server = newWebSocket(kj::mv(pipe.ends[1]), nullptr);
+
+  static const byte COMPRESSED_HELLO[] = { 0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+  auto clientTask = client->write(COMPRESSED_HELLO, sizeof(COMPRESSED_HELLO));
+
+  KJ_EXPECT_THROW_MESSAGE("compression was not negotiated", server->receive().wait(waitScope));
+}
+
 KJ_TEST("WebSocket unsolicited pong") {
   KJ_HTTP_TEST_SETUP_IO;
   auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
@@ -2386,6 +2656,247 @@ KJ_TEST("HttpServer WebSocket handshake") {
   listenTask.wait(waitScope);
 }
 
+#if KJ_HAS_ZLIB
+void testCompressedWebSocketClient(kj::WaitScope& waitScope, WebSocket& ws) {
+  // The client half of TestWebSocketService's conversation.
+  {
+    auto message = ws.receive().wait(waitScope);
+    KJ_ASSERT(message.is<kj::String>());
+    KJ_EXPECT(message.get<kj::String>() == "start-inline");
+  }
+
+  ws.send(kj::StringPtr("bar")).wait(waitScope);
+  {
+    auto message = ws.receive().wait(waitScope);
+    KJ_ASSERT(message.is<kj::String>());
+    KJ_EXPECT(message.get<kj::String>() == "reply:bar");
+  }
+
+  ws.close(0x1234, "qux").wait(waitScope);
+  {
+    auto message = ws.receive().wait(waitScope);
+    KJ_ASSERT(message.is<WebSocket::Close>());
+    KJ_EXPECT(message.get<WebSocket::Close>().code == 0x1235);
+    KJ_EXPECT(message.get<WebSocket::Close>().reason == "close-reply:qux");
+  }
+}
+
+KJ_TEST("HttpClient WebSocket compression handshake") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  auto request = kj::str("GET /websocket",
+      " HTTP/1.1\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Key: DCI4TgwiOE4MIjhODCI4Tg==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover; "
+          "client_max_window_bits=12; server_max_window_bits=10\r\n"
+      "\r\n");
+  static const char RESPONSE[] =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Accept: pShtIFKT0s8RYZvnWY/CrjQD8CM=\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover; "
+          "server_max_window_bits=10; client_max_window_bits=11\r\n"
+      "\r\n";
+
+  auto handshakeTask = expectRead(*pipe.ends[1], request)
+      .then([&]() { return writeA(*pipe.ends[1], asBytes(RESPONSE)); })
+      .eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+
+  HttpHeaderTable headerTable;
+  FakeEntropySource entropySource;
+  HttpClientSettings clientSettings;
+  clientSettings.entropySource = entropySource;
+  clientSettings.webSocketCompression = true;
+  clientSettings.webSocketCompressionParameters.outboundNoContextTakeover = true;
+  clientSettings.webSocketCompressionParameters.outboundMaxWindowBits = 12;
+  clientSettings.webSocketCompressionParameters.inboundMaxWindowBits = 10;
+
+  auto client = newHttpClient(headerTable, *pipe.ends[0], clientSettings);
+  auto response = client->openWebSocket("/websocket", HttpHeaders(headerTable)).wait(waitScope);
+  handshakeTask.wait(waitScope);
+
+  KJ_EXPECT(response.statusCode == 101);
+  KJ_ASSERT(response.webSocketOrBody.is<kj::Own<WebSocket>>());
+  auto ws = kj::mv(response.webSocketOrBody.get<kj::Own<WebSocket>>());
+
+  // Play the server's part with the parameters it agreed to.
+  CompressionParameters serverConfig;
+  serverConfig.inboundNoContextTakeover = true;
+  serverConfig.outboundMaxWindowBits = 10;
+  serverConfig.inboundMaxWindowBits = 11;
+  auto serverWs = newWebSocket(kj::mv(pipe.ends[1]), nullptr, serverConfig);
+
+  auto serverTask = serverWs->send(kj::StringPtr("start-inline"))
+      .then([&]() { return serverWs->receive(); })
+      .then([&](WebSocket::Message&& message) {
+    KJ_ASSERT(message.is<kj::String>());
+    return serverWs->send(kj::str("reply:", message.get<kj::String>()));
+  }).then([&]() { return serverWs->receive(); })
+      .then([&](WebSocket::Message&& message) {
+    KJ_ASSERT(message.is<WebSocket::Close>());
+    auto& close = message.get<WebSocket::Close>();
+    return serverWs->close(close.code + 1, kj::str("close-reply:", close.reason));
+  }).eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+
+  testCompressedWebSocketClient(waitScope, *ws);
+  serverTask.wait(waitScope);
+}
+
+KJ_TEST("HttpClient WebSocket compression rejected by server") {
+  // A server that ignores the offer gets an uncompressed WebSocket, per the existing handshake.
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  auto request = kj::str("GET /websocket",
+      " HTTP/1.1\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Key: DCI4TgwiOE4MIjhODCI4Tg==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+      "My-Header: foo\r\n"
+      "\r\n");
+
+  auto serverTask = expectRead(*pipe.ends[1], request)
+      .then([&]() { return writeA(*pipe.ends[1], asBytes(WEBSOCKET_RESPONSE_HANDSHAKE)); })
+      .then([&]() { return writeA(*pipe.ends[1], WEBSOCKET_FIRST_MESSAGE_INLINE); })
+      .then([&]() { return expectRead(*pipe.ends[1], WEBSOCKET_SEND_MESSAGE); })
+      .then([&]() { return writeA(*pipe.ends[1], WEBSOCKET_REPLY_MESSAGE); })
+      .then([&]() { return expectRead(*pipe.ends[1], WEBSOCKET_SEND_CLOSE); })
+      .then([&]() { return writeA(*pipe.ends[1], WEBSOCKET_REPLY_CLOSE); })
+      .eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+
+  HttpHeaderTable::Builder tableBuilder;
+  HttpHeaderId hMyHeader = tableBuilder.add("My-Header");
+  auto headerTable = tableBuilder.build();
+
+  FakeEntropySource entropySource;
+  HttpClientSettings clientSettings;
+  clientSettings.entropySource = entropySource;
+  clientSettings.webSocketCompression = true;
+
+  auto client = newHttpClient(*headerTable, *pipe.ends[0], clientSettings);
+
+  testWebSocketClient(waitScope, *headerTable, hMyHeader, *client);
+
+  serverTask.wait(waitScope);
+}
+
+KJ_TEST("HttpClient WebSocket compression invalid response") {
+  KJ_HTTP_TEST_SETUP_IO;
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  static const char RESPONSE[] =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Accept: pShtIFKT0s8RYZvnWY/CrjQD8CM=\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; bogus_param\r\n"
+      "\r\n";
+
+  auto readTask = pipe.ends[1]->readAllText().ignoreResult()
+      .eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+  auto writeTask = writeA(*pipe.ends[1], asBytes(RESPONSE))
+      .eagerlyEvaluate([](kj::Exception&& e) { KJ_LOG(ERROR, e); });
+
+  HttpHeaderTable headerTable;
+  FakeEntropySource entropySource;
+  HttpClientSettings clientSettings;
+  clientSettings.entropySource = entropySource;
+  clientSettings.webSocketCompression = true;
+
+  auto client = newHttpClient(headerTable, *pipe.ends[0], clientSettings);
+  KJ_EXPECT_THROW_MESSAGE("unexpected Sec-WebSocket-Extensions header",
+      client->openWebSocket("/websocket", HttpHeaders(headerTable)).wait(waitScope));
+}
+
+KJ_TEST("HttpServer WebSocket compression handshake") {
+  KJ_HTTP_TEST_SETUP_IO;
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  HttpHeaderTable::Builder tableBuilder;
+  HttpHeaderId hMyHeader = tableBuilder.add("My-Header");
+  auto headerTable = tableBuilder.build();
+  TestWebSocketService service(*headerTable, hMyHeader);
+
+  HttpServerSettings settings;
+  settings.webSocketCompression = true;
+  settings.webSocketCompressionParameters.inboundNoContextTakeover = true;
+  settings.webSocketCompressionParameters.inboundMaxWindowBits = 12;
+  HttpServer server(timer, *headerTable, service, settings);
+
+  auto listenTask = server.listenHttp(kj::mv(pipe.ends[0]));
+
+  // The first offer is unacceptable because of its unknown parameter, so the second is chosen.
+  auto request = kj::str("GET /websocket",
+      " HTTP/1.1\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Key: DCI4TgwiOE4MIjhODCI4Tg==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; bogus_param, "
+          "permessage-deflate; server_max_window_bits=10; client_max_window_bits\r\n"
+      "\r\n");
+  static const char RESPONSE[] =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: websocket\r\n"
+      "Sec-WebSocket-Accept: pShtIFKT0s8RYZvnWY/CrjQD8CM=\r\n"
+      "Sec-WebSocket-Extensions: permessage-deflate; client_no_context_takeover; "
+          "server_max_window_bits=10; client_max_window_bits=12\r\n"
+      "\r\n";
+  writeA(*pipe.ends[1], request.asBytes()).wait(waitScope);
+  expectRead(*pipe.ends[1], RESPONSE).wait(waitScope);
+
+  FakeEntropySource maskGenerator;
+  CompressionParameters clientConfig;
+  clientConfig.outboundNoContextTakeover = true;
+  clientConfig.outboundMaxWindowBits = 12;
+  clientConfig.inboundMaxWindowBits = 10;
+  auto ws = newWebSocket(kj::mv(pipe.ends[1]), maskGenerator, clientConfig);
+
+  testCompressedWebSocketClient(waitScope, *ws);
+
+  listenTask.wait(waitScope);
+}
+
+KJ_TEST("HttpServer WebSocket compression not offered") {
+  // With compression enabled on the server, a client that doesn't offer it sees no change.
+  KJ_HTTP_TEST_SETUP_IO;
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  HttpHeaderTable::Builder tableBuilder;
+  HttpHeaderId hMyHeader = tableBuilder.add("My-Header");
+  auto headerTable = tableBuilder.build();
+  TestWebSocketService service(*headerTable, hMyHeader);
+
+  HttpServerSettings settings;
+  settings.webSocketCompression = true;
+  HttpServer server(timer, *headerTable, service, settings);
+
+  auto listenTask = server.listenHttp(kj::mv(pipe.ends[0]));
+
+  auto request = kj::str("GET /websocket", WEBSOCKET_REQUEST_HANDSHAKE);
+  writeA(*pipe.ends[1], request.asBytes()).wait(waitScope);
+  expectRead(*pipe.ends[1], WEBSOCKET_RESPONSE_HANDSHAKE).wait(waitScope);
+
+  expectRead(*pipe.ends[1], WEBSOCKET_FIRST_MESSAGE_INLINE).wait(waitScope);
+  writeA(*pipe.ends[1], WEBSOCKET_SEND_MESSAGE).wait(waitScope);
+  expectRead(*pipe.ends[1], WEBSOCKET_REPLY_MESSAGE).wait(waitScope);
+  writeA(*pipe.ends[1], WEBSOCKET_SEND_CLOSE).wait(waitScope);
+  expectRead(*pipe.ends[1], WEBSOCKET_REPLY_CLOSE).wait(waitScope);
+
+  listenTask.wait(waitScope);
+}
+#endif  // KJ_HAS_ZLIB
+
 KJ_TEST("HttpServer WebSocket handshake error") {
   KJ_HTTP_TEST_SETUP_IO;
   kj::TimerImpl timer(kj::origin<kj::TimePoint>());
@@ -2955,6 +3466,118 @@ KJ_TEST("HttpFixedLengthEntityWriter correctly implements tryPumpFrom") {
       "Hello, World!", text);
 }
 
+class BufferResponseService final: public HttpService {
+  // HttpService that serves the same cached content to every request, using sendBuffer().
+public:
+  struct Cache: public kj::Refcounted {
+    kj::Array<const byte> content = kj::heapArray(kj::StringPtr("Hello, World!").asBytes());
+  };
+
+  kj::Own<Cache> cache = kj::refcounted<Cache>();
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    HttpHeaders responseHeaders(table);
+    return response.sendBuffer(200, "OK", responseHeaders,
+        cache->content.asPtr().attach(kj::addRef(*cache)));
+  }
+
+private:
+  HttpHeaderTable table;
+};
+
+class WriteRecorder final: public kj::AsyncIoStream {
+  // Passes everything through to `inner`, recording the pieces of each write.
+
+public:
+  WriteRecorder(kj::Own<kj::AsyncIoStream> inner): inner(kj::mv(inner)) {}
+
+  kj::Vector<kj::Array<kj::ArrayPtr<const byte>>> writes;
+
+  kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    return inner->tryRead(buffer, minBytes, maxBytes);
+  }
+  kj::Promise<void> write(const void* buffer, size_t size) override {
+    writes.add(kj::heapArray({ kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size) }));
+    return inner->write(buffer, size);
+  }
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
+    writes.add(kj::heapArray(pieces));
+    return inner->write(pieces);
+  }
+  kj::Promise<void> whenWriteDisconnected() override {
+    return inner->whenWriteDisconnected();
+  }
+  void shutdownWrite() override {
+    inner->shutdownWrite();
+  }
+
+private:
+  kj::Own<kj::AsyncIoStream> inner;
+};
+
+KJ_TEST("HttpServer sends a buffer's headers and body in one write") {
+  KJ_HTTP_TEST_SETUP_IO;
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  auto pipe = KJ_HTTP_TEST_CREATE_2PIPE;
+
+  HttpHeaderTable table;
+  BufferResponseService service;
+  HttpServer server(timer, table, service);
+
+  WriteRecorder recorder(kj::mv(pipe.ends[0]));
+  auto& writes = recorder.writes;
+  auto listenTask = server.listenHttpCleanDrain(recorder);
+
+  kj::StringPtr requests =
+      "GET / HTTP/1.1\r\n\r\n"
+      "GET / HTTP/1.1\r\n\r\n"
+      "HEAD / HTTP/1.1\r\n\r\n";
+  pipe.ends[1]->write(requests.begin(), requests.size()).wait(waitScope);
+  pipe.ends[1]->shutdownWrite();
+  auto textPromise = pipe.ends[1]->readAllText();
+  KJ_EXPECT(!listenTask.wait(waitScope));
+  recorder.shutdownWrite();
+  auto text = textPromise.wait(waitScope);
+
+  KJ_EXPECT(text ==
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 13\r\n"
+      "\r\n"
+      "Hello, World!"
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 13\r\n"
+      "\r\n"
+      "Hello, World!"
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 13\r\n"
+      "\r\n", text);
+
+  // Each GET response went out in a single write, whose body is the cached content itself.
+  KJ_ASSERT(writes.size() == 3);
+  for (auto i: kj::zeroTo(2)) {
+    KJ_ASSERT(writes[i].size() == 2);
+    KJ_EXPECT(writes[i][1].begin() == service.cache->content.begin());
+    KJ_EXPECT(writes[i][1].size() == 13);
+  }
+  KJ_EXPECT(service.cache->isShared() == false);
+}
+
+KJ_TEST("HttpService::Response::sendBuffer() default implementation") {
+  KJ_HTTP_TEST_SETUP_IO;
+
+  HttpHeaderTable table;
+  BufferResponseService service;
+  auto client = newHttpClient(service);
+
+  auto response = client->request(HttpMethod::GET, "/", HttpHeaders(table))
+      .response.wait(waitScope);
+  KJ_EXPECT(response.statusCode == 200);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response.body->tryGetLength()) == 13);
+  KJ_EXPECT(response.body->readAllText().wait(waitScope) == "Hello, World!");
+}
+
 class HangingHttpService final: public HttpService {
   // HttpService that hangs forever.
 public:
@@ -4142,6 +4765,124 @@ KJ_TEST("HttpClient disable connection reuse") {
   KJ_EXPECT(cumulative == 5);
 }
 
+KJ_TEST("HttpClient pipelining across connections") {
+  KJ_HTTP_TEST_SETUP_IO;
+  KJ_HTTP_TEST_SETUP_LOOPBACK_LISTENER_AND_ADDR;
+
+  kj::TimerImpl serverTimer(kj::origin<kj::TimePoint>());
+  kj::TimerImpl clientTimer(kj::origin<kj::TimePoint>());
+  HttpHeaderTable headerTable;
+
+  DummyService service(headerTable);
+  HttpServerSettings serverSettings;
+  HttpServer server(serverTimer, headerTable, service, serverSettings);
+  auto listenTask = server.listenHttp(*listener);
+
+  uint count = 0;
+  uint cumulative = 0;
+  CountingNetworkAddress countingAddr(*addr, count, cumulative);
+
+  HttpClientSettings clientSettings;
+  clientSettings.maxPipelinedRequests = 2;
+  auto client = newHttpClient(clientTimer, headerTable, countingAddr, clientSettings);
+
+  uint i = 0;
+  auto doRequest = [&](HttpMethod method = HttpMethod::GET) {
+    uint n = i++;
+    return client->request(method, kj::str("/", n), HttpHeaders(headerTable)).response
+        .then([](HttpClient::Response&& response) {
+      auto promise = response.body->readAllText();
+      return promise.attach(kj::mv(response.body));
+    }).then([n](kj::String body) {
+      KJ_EXPECT(body == kj::str("null:/", n));
+    });
+  };
+
+  // Up to two requests wait behind the first on the same connection; the fourth gets a new one.
+  auto promises = kj::heapArrayBuilder<kj::Promise<void>>(4);
+  for (auto j KJ_UNUSED: kj::zeroTo(4)) {
+    promises.add(doRequest());
+  }
+  kj::joinPromises(promises.finish()).wait(waitScope);
+  KJ_EXPECT(cumulative == 2);
+
+  // Idle connections are used before pipelining.
+  auto get1 = doRequest();
+  auto get2 = doRequest();
+  auto get3 = doRequest();
+  get1.wait(waitScope);
+  get2.wait(waitScope);
+  get3.wait(waitScope);
+  KJ_EXPECT(cumulative == 2);
+
+  // Only GET and HEAD requests are pipelined.
+  auto del1 = doRequest(HttpMethod::DELETE);
+  auto del2 = doRequest(HttpMethod::DELETE);
+  auto del3 = doRequest(HttpMethod::DELETE);
+  del1.wait(waitScope);
+  del2.wait(waitScope);
+  del3.wait(waitScope);
+  KJ_EXPECT(cumulative == 3);
+}
+
+kj::Promise<void> serveOneResponsePerConnection(kj::ConnectionReceiver& listener) {
+  // Accepts connections, and answers only the first request on each, then closes it.
+
+  return listener.accept().then([](kj::Own<kj::AsyncIoStream>&& connection) {
+    auto buffer = kj::heapArray<char>(4096);
+    auto promise = connection->tryRead(buffer.begin(), 1, buffer.size());
+    return promise.then([connection = kj::mv(connection)](size_t) mutable {
+      kj::StringPtr response =
+          "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok"_kj;
+      auto promise = connection->write(response.begin(), response.size());
+      return promise.attach(kj::mv(connection));
+    }).attach(kj::mv(buffer));
+  }).then([&listener]() {
+    return serveOneResponsePerConnection(listener);
+  });
+}
+
+KJ_TEST("HttpClient pipelining falls back when the server closes connections") {
+  KJ_HTTP_TEST_SETUP_IO;
+  KJ_HTTP_TEST_SETUP_LOOPBACK_LISTENER_AND_ADDR;
+
+  kj::TimerImpl clientTimer(kj::origin<kj::TimePoint>());
+  HttpHeaderTable headerTable;
+  auto serverTask = serveOneResponsePerConnection(*listener).eagerlyEvaluate(nullptr);
+
+  uint count = 0;
+  uint cumulative = 0;
+  CountingNetworkAddress countingAddr(*addr, count, cumulative);
+
+  HttpClientSettings clientSettings;
+  clientSettings.maxPipelinedRequests = 4;
+  auto client = newHttpClient(clientTimer, headerTable, countingAddr, clientSettings);
+
+  auto doRequest = [&]() {
+    return client->request(HttpMethod::GET, "/", HttpHeaders(headerTable)).response
+        .then([](HttpClient::Response&& response) {
+      auto promise = response.body->readAllText();
+      return promise.attach(kj::mv(response.body));
+    }).then([](kj::String body) {
+      KJ_EXPECT(body == "ok");
+    });
+  };
+
+  // The second request was pipelined, and so had to be retried on a second connection.
+  auto req1 = doRequest();
+  auto req2 = doRequest();
+  req1.wait(waitScope);
+  req2.wait(waitScope);
+  KJ_EXPECT(cumulative == 2);
+
+  // Pipelining is now off.
+  req1 = doRequest();
+  req2 = doRequest();
+  req1.wait(waitScope);
+  req2.wait(waitScope);
+  KJ_EXPECT(cumulative == 4);
+}
+
 KJ_TEST("HttpClient concurrency limiting") {
 #if KJ_HTTP_TEST_USE_OS_PIPE && !__linux__
   // On Windows and Mac, OS event delivery is not always immediate, and that seems to make this
@@ -26,10 +26,23 @@
 #include <unordered_map>
 #include <stdlib.h>
 #include "kj/encoding.h"
+#include "kj/filesystem.h"
 #include <deque>
 #include <queue>
 #include <map>
 
+#if KJ_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KJ_HTTP_PARSE_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KJ_HTTP_PARSE_NEON 1
+#endif
+
 namespace kj {
 
 // =======================================================================================
@@ -507,13 +520,19 @@ struct HeaderNameHash {
   }
 
   bool operator()(kj::StringPtr a, kj::StringPtr b) const {
-    // TODO(perf): I wonder if we can beat strcasecmp() by masking bit 0x20 from each byte. We'd
+    // Names of different lengths can't match, and in practice most clients send header names
+    // with the same capitalization as our table, so try an exact comparison before falling back
+    // to a case-insensitive one.
+    //
+    // TODO(perf): I wonder if we can beat strncasecmp() by masking bit 0x20 from each byte. We'd
     //   need to prohibit one of the technically-legal characters '^' or '~' from header names
     //   since they'd otherwise be ambiguous, but otherwise there is no ambiguity.
+    if (a.size() != b.size()) return false;
+    if (memcmp(a.begin(), b.begin(), a.size()) == 0) return true;
 #if _MSC_VER
-    return _stricmp(a.cStr(), b.cStr()) == 0;
+    return _strnicmp(a.begin(), b.begin(), a.size()) == 0;
 #else
-    return strcasecmp(a.cStr(), b.cStr()) == 0;
+    return strncasecmp(a.begin(), b.begin(), a.size()) == 0;
 #endif
   }
 };
@@ -728,6 +747,98 @@ void HttpHeaders::takeOwnership(HttpHeaders&& otherHeaders) {
 }
 
 // -----------------------------------------------------------------------------
+// Vectorized delimiter scanning
+//
+// The parsers below work byte-by-byte, but most of their time is spent walking over long runs of
+// uninteresting bytes (URLs, header values, header names) looking for a delimiter. Following
+// picohttpparser, we skip over those runs 16 bytes at a time using SSE4.2's PCMPESTRI (or plain
+// compares on NEON), stopping at the first byte that falls in any of a small set of byte ranges.
+// The byte-by-byte code then takes over from that point, so the vector code only needs to be
+// conservative: it may stop early, but must never skip a byte in the set.
+//
+// The vector code never reads at or beyond `end`, which the callers point at the NUL sentinel
+// written by trimHeaderEnding(). The remaining tail of fewer than 16 bytes is left to the scalar
+// code, which relies on the sentinel to stop.
+
+namespace {
+
+struct HttpByteRanges {
+  alignas(16) char bounds[16];
+  // Inclusive [low, high] pairs.
+
+  int size;
+  // Number of bytes of `bounds` in use (twice the number of ranges).
+};
+
+constexpr HttpByteRanges LINE_DELIMITERS = {
+  { '\0', '\0', '\n', '\n', '\r', '\r' }, 6
+};
+constexpr HttpByteRanges WORD_DELIMITERS = {
+  { '\0', '\0', '\t', '\n', '\r', '\r', ' ', ' ' }, 8
+};
+constexpr HttpByteRanges HEADER_NAME_DELIMITERS = {
+  // Superset of the bytes not in HTTP_HEADER_NAME_CHARS (control characters, space, DEL, and
+  // separators). PCMPESTRI takes at most eight ranges, so the tail of the table also catches
+  // '|' and '~', which are legal but rare; the scalar loop steps over them.
+  { '\0', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\x7f' }, 16
+};
+
+#if KJ_HTTP_PARSE_SSE42
+#define KJ_HTTP_PARSE_SSE42_TARGET __attribute__((target("sse4.2")))
+
+bool haveSse42() {
+  static const bool result = __builtin_cpu_supports("sse4.2");
+  return result;
+}
+
+KJ_HTTP_PARSE_SSE42_TARGET
+char* skipToRangesSse42(char* p, const char* end, const HttpByteRanges& ranges) {
+  __m128i bounds = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges.bounds));
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int i = _mm_cmpestri(bounds, ranges.size, chunk, 16,
+        _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (i != 16) return p + i;
+    p += 16;
+  }
+  return p;
+}
+#endif
+
+#if KJ_HTTP_PARSE_NEON
+char* skipToRangesNeon(char* p, const char* end, const HttpByteRanges& ranges) {
+  while (end - p >= 16) {
+    uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t hits = vdupq_n_u8(0);
+    for (int i = 0; i < ranges.size; i += 2) {
+      // Unsigned (c - low) <= (high - low) tests low <= c <= high in one comparison.
+      uint8_t low = ranges.bounds[i];
+      uint8_t width = static_cast<uint8_t>(ranges.bounds[i + 1]) - low;
+      hits = vorrq_u8(hits, vcleq_u8(vsubq_u8(chunk, vdupq_n_u8(low)), vdupq_n_u8(width)));
+    }
+
+    // Narrow each byte of the comparison result to a nibble, so the result fits in 64 bits.
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+    if (mask != 0) return p + (__builtin_ctzll(mask) >> 2);
+    p += 16;
+  }
+  return p;
+}
+#endif
+
+inline char* skipToRanges(char* p, const char* end, const HttpByteRanges& ranges) {
+  // Advance `p` over bytes that are definitely not in `ranges`. Returns a pointer to the first
+  // byte that is in `ranges`, or to some byte within 16 bytes of `end`.
+#if KJ_HTTP_PARSE_SSE42
+  if (haveSse42()) return skipToRangesSse42(p, end, ranges);
+#elif KJ_HTTP_PARSE_NEON
+  return skipToRangesNeon(p, end, ranges);
+#endif
+  return p;
+}
+
+}  // namespace
 
 static inline char* skipSpace(char* p) {
   for (;;) {
@@ -742,9 +853,9 @@ static inline char* skipSpace(char* p) {
   }
 }
 
-static kj::Maybe<kj::StringPtr> consumeWord(char*& ptr) {
+static kj::Maybe<kj::StringPtr> consumeWord(char*& ptr, const char* end) {
   char* start = skipSpace(ptr);
-  char* p = start;
+  char* p = skipToRanges(start, end, WORD_DELIMITERS);
 
   for (;;) {
     switch (*p) {
@@ -791,11 +902,13 @@ static kj::Maybe<uint> consumeNumber(char*& ptr) {
   }
 }
 
-static kj::StringPtr consumeLine(char*& ptr) {
+static kj::StringPtr consumeLine(char*& ptr, const char* end) {
   char* start = skipSpace(ptr);
   char* p = start;
 
   for (;;) {
+    p = skipToRanges(p, end, LINE_DELIMITERS);
+
     switch (*p) {
       case '\0':
         ptr = p;
@@ -844,12 +957,13 @@ static kj::StringPtr consumeLine(char*& ptr) {
   }
 }
 
-static kj::Maybe<kj::StringPtr> consumeHeaderName(char*& ptr) {
+static kj::Maybe<kj::StringPtr> consumeHeaderName(char*& ptr, const char* limit) {
   // Do NOT skip spaces before the header name. Leading spaces indicate a continuation line; they
   // should have been handled in consumeLine().
   char* p = ptr;
 
   char* start = p;
+  p = skipToRanges(p, limit, HEADER_NAME_DELIMITERS);
   while (HTTP_HEADER_NAME_CHARS.contains(*p)) ++p;
   char* end = p;
 
@@ -904,7 +1018,7 @@ HttpHeaders::RequestOrProtocolError HttpHeaders::tryParseRequest(kj::ArrayPtr<ch
         "Unrecognized request method.", content };
   }
 
-  KJ_IF_MAYBE(path, consumeWord(ptr)) {
+  KJ_IF_MAYBE(path, consumeWord(ptr, end)) {
     request.url = *path;
   } else {
     return ProtocolError { 400, "Bad Request",
@@ -912,7 +1026,7 @@ HttpHeaders::RequestOrProtocolError HttpHeaders::tryParseRequest(kj::ArrayPtr<ch
   }
 
   // Ignore rest of line. Don't care about "HTTP/1.1" or whatever.
-  consumeLine(ptr);
+  consumeLine(ptr, end);
 
   if (!parseHeaders(ptr, end)) {
     return ProtocolError { 400, "Bad Request",
@@ -933,7 +1047,7 @@ HttpHeaders::ResponseOrProtocolError HttpHeaders::tryParseResponse(kj::ArrayPtr<
 
   HttpHeaders::Response response;
 
-  KJ_IF_MAYBE(version, consumeWord(ptr)) {
+  KJ_IF_MAYBE(version, consumeWord(ptr, end)) {
     if (!version->startsWith("HTTP/")) {
       return ProtocolError { 502, "Bad Gateway",
           "Invalid response status line (invalid protocol).", content };
@@ -950,7 +1064,7 @@ HttpHeaders::ResponseOrProtocolError HttpHeaders::tryParseResponse(kj::ArrayPtr<
         "Invalid response status line (invalid status code).", content };
   }
 
-  response.statusText = consumeLine(ptr);
+  response.statusText = consumeLine(ptr, end);
 
   if (!parseHeaders(ptr, end)) {
     return ProtocolError { 502, "Bad Gateway",
@@ -970,8 +1084,8 @@ bool HttpHeaders::tryParse(kj::ArrayPtr<char> content) {
 
 bool HttpHeaders::parseHeaders(char* ptr, char* end) {
   while (*ptr != '\0') {
-    KJ_IF_MAYBE(name, consumeHeaderName(ptr)) {
-      kj::StringPtr line = consumeLine(ptr);
+    KJ_IF_MAYBE(name, consumeHeaderName(ptr, end)) {
+      kj::StringPtr line = consumeLine(ptr, end);
       addNoCheck(*name, line);
     } else {
       return false;
@@ -997,14 +1111,51 @@ kj::String HttpHeaders::serializeResponse(
   return serialize(kj::StringPtr("HTTP/1.1"), statusCodeStr, statusText, connectionHeaders);
 }
 
+kj::ArrayPtr<const char> HttpHeaders::serializeRequest(
+    kj::Array<char>& buffer, HttpMethod method, kj::StringPtr url,
+    kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
+  return serializeInto(buffer, kj::toCharSequence(method), url, kj::StringPtr("HTTP/1.1"),
+                       connectionHeaders);
+}
+
+kj::ArrayPtr<const char> HttpHeaders::serializeResponse(
+    kj::Array<char>& buffer, uint statusCode, kj::StringPtr statusText,
+    kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
+  auto statusCodeStr = kj::toCharSequence(statusCode);
+
+  return serializeInto(buffer, kj::StringPtr("HTTP/1.1"), statusCodeStr, statusText,
+                       connectionHeaders);
+}
+
 kj::String HttpHeaders::serialize(kj::ArrayPtr<const char> word1,
                                   kj::ArrayPtr<const char> word2,
                                   kj::ArrayPtr<const char> word3,
                                   kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
-  const kj::StringPtr space = " ";
-  const kj::StringPtr newline = "\r\n";
-  const kj::StringPtr colon = ": ";
+  String result = heapString(serializedSize(word1, word2, word3, connectionHeaders));
+  char* ptr = serializeTo(result.begin(), word1, word2, word3, connectionHeaders);
+  KJ_ASSERT(ptr == result.end());
+  return result;
+}
 
+kj::ArrayPtr<const char> HttpHeaders::serializeInto(
+    kj::Array<char>& buffer,
+    kj::ArrayPtr<const char> word1,
+    kj::ArrayPtr<const char> word2,
+    kj::ArrayPtr<const char> word3,
+    kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
+  size_t size = serializedSize(word1, word2, word3, connectionHeaders);
+  if (buffer.size() < size) {
+    buffer = kj::heapArray<char>(kj::max(size, buffer.size() * 2));
+  }
+  char* ptr = serializeTo(buffer.begin(), word1, word2, word3, connectionHeaders);
+  KJ_ASSERT(ptr == buffer.begin() + size);
+  return buffer.slice(0, size);
+}
+
+size_t HttpHeaders::serializedSize(kj::ArrayPtr<const char> word1,
+                                   kj::ArrayPtr<const char> word2,
+                                   kj::ArrayPtr<const char> word3,
+                                   kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
   size_t size = 2;  // final \r\n
   if (word1 != nullptr) {
     size += word1.size() + word2.size() + word3.size() + 4;
@@ -1019,9 +1170,17 @@ kj::String HttpHeaders::serialize(kj::ArrayPtr<const char> word1,
   for (auto& header: unindexedHeaders) {
     size += header.name.size() + header.value.size() + 4;
   }
+  return size;
+}
 
-  String result = heapString(size);
-  char* ptr = result.begin();
+char* HttpHeaders::serializeTo(char* ptr,
+                               kj::ArrayPtr<const char> word1,
+                               kj::ArrayPtr<const char> word2,
+                               kj::ArrayPtr<const char> word3,
+                               kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const {
+  const kj::StringPtr space = " ";
+  const kj::StringPtr newline = "\r\n";
+  const kj::StringPtr colon = ": ";
 
   if (word1 != nullptr) {
     ptr = kj::_::fill(ptr, word1, space, word2, space, word3, newline);
@@ -1035,10 +1194,7 @@ kj::String HttpHeaders::serialize(kj::ArrayPtr<const char> word1,
   for (auto& header: unindexedHeaders) {
     ptr = kj::_::fill(ptr, header.name, colon, header.value, newline);
   }
-  ptr = kj::_::fill(ptr, newline);
-
-  KJ_ASSERT(ptr == result.end());
-  return result;
+  return kj::_::fill(ptr, newline);
 }
 
 kj::String HttpHeaders::toString() const {
@@ -1097,6 +1253,12 @@ public:
     return !broken && pendingMessageCount == 0;
   }
 
+  bool canPipeline(uint maxPipelined) {
+    // Returns true if another message may be queued for reading behind those pending, keeping no
+    // more than `maxPipelined` messages waiting behind the one currently being read.
+    return !broken && pendingMessageCount <= maxPipelined;
+  }
+
   bool canSuspend() {
     // We are at a suspendable point if we've parsed the headers, but haven't consumed anything
     // beyond that.
@@ -1860,6 +2022,55 @@ public:
     queueWrite(kj::mv(content));
   }
 
+  kj::Array<char> takeHeaderBuffer() {
+    // Returns a buffer to serialize the next message's headers into (see
+    // HttpHeaders::serializeResponse()), and then pass to writeHeaders() below. Once the headers
+    // are written the buffer comes back here, so a connection normally reuses one buffer for all
+    // its messages. (If headers are written again before the previous write completes, the
+    // buffer is simply empty and the serializer allocates a new one.)
+    return kj::mv(spareHeaderBuffer);
+  }
+
+  void writeHeaders(kj::Array<char> buffer, kj::ArrayPtr<const char> content) {
+    // Like writeHeaders(String), but `content` lies within `buffer`, which came from
+    // takeHeaderBuffer().
+
+    KJ_REQUIRE(!writeInProgress, "concurrent write()s not allowed") { return; }
+    KJ_REQUIRE(!inBody, "previous HTTP message body incomplete; can't write more messages");
+    inBody = true;
+
+    writeQueue = writeQueue.then([this, buffer = kj::mv(buffer), content]() mutable {
+      return inner.write(content.begin(), content.size())
+          .then([this, buffer = kj::mv(buffer)]() mutable {
+        if (buffer.size() > spareHeaderBuffer.size()) {
+          spareHeaderBuffer = kj::mv(buffer);
+        }
+      });
+    });
+  }
+
+  void writeHeadersAndBody(kj::Array<char> buffer, kj::ArrayPtr<const char> content,
+                           kj::Array<const byte> body) {
+    // Writes a complete message: like writeHeaders(buffer, content) followed by writing `body` and
+    // calling finishBody(), but the headers and body go out in a single gather write, and `body`
+    // is held until then rather than copied.
+
+    KJ_REQUIRE(!writeInProgress, "concurrent write()s not allowed") { return; }
+    KJ_REQUIRE(!inBody, "previous HTTP message body incomplete; can't write more messages");
+
+    writeQueue = writeQueue.then(
+        [this, buffer = kj::mv(buffer), content, body = kj::mv(body)]() mutable {
+      auto pieces = kj::heapArray<kj::ArrayPtr<const byte>>({ content.asBytes(), body });
+      auto promise = inner.write(pieces);
+      return promise.attach(kj::mv(pieces), kj::mv(body))
+          .then([this, buffer = kj::mv(buffer)]() mutable {
+        if (buffer.size() > spareHeaderBuffer.size()) {
+          spareHeaderBuffer = kj::mv(buffer);
+        }
+      });
+    });
+  }
+
   void writeBodyData(kj::String content) {
     KJ_REQUIRE(!writeInProgress, "concurrent write()s not allowed") { return; }
     KJ_REQUIRE(inBody) { return; }
@@ -1913,6 +2124,22 @@ public:
     });
   }
 
+  Promise<uint64_t> pumpBodyFromFile(const ReadableFile& file, uint64_t offset, uint64_t amount) {
+    KJ_REQUIRE(!writeInProgress, "concurrent write()s not allowed") { return uint64_t(0); }
+    KJ_REQUIRE(inBody) { return uint64_t(0); }
+
+    writeInProgress = true;
+    auto fork = writeQueue.fork();
+    writeQueue = fork.addBranch();
+
+    return fork.addBranch().then([this,&file,offset,amount]() {
+      return pumpFileTo(file, inner, offset, amount);
+    }).then([this](uint64_t actual) {
+      writeInProgress = false;
+      return actual;
+    });
+  }
+
   void finishBody() {
     // Called when entire body was written.
 
@@ -1955,6 +2182,7 @@ public:
 
 private:
   AsyncOutputStream& inner;
+  kj::Array<char> spareHeaderBuffer;
   kj::Promise<void> writeQueue = kj::READY_NOW;
   bool inBody = false;
   bool broken = false;
@@ -2085,6 +2313,27 @@ public:
     return kj::mv(promise);
   }
 
+  Maybe<Promise<uint64_t>> tryPumpFromFile(
+      const ReadableFile& file, uint64_t offset, uint64_t amount) override {
+    if (amount > length) {
+      // As in tryPumpFrom(), pumping to EOF is fine as long as EOF comes soon enough. Unlike an
+      // arbitrary stream, a file knows its size up front.
+      uint64_t size = file.stat().size;
+      KJ_REQUIRE(size <= offset || size - offset <= length, "overwrote Content-Length");
+    }
+
+    amount = kj::min(amount, length);
+    if (amount == 0) return Promise<uint64_t>(uint64_t(0));
+    length -= amount;
+
+    return inner.pumpBodyFromFile(file, offset, amount).then([this,amount](uint64_t actual) {
+      // Adjust for bytes not written.
+      length += amount - actual;
+      if (length == 0) inner.finishBody();
+      return actual;
+    });
+  }
+
   Promise<void> whenWriteDisconnected() override {
     return inner.whenWriteDisconnected();
   }
@@ -2180,18 +2429,430 @@ private:
   HttpOutputStream& inner;
 };
 
+// =======================================================================================
+// WebSocket masking
+
+// Masking XORs each payload byte with one of four mask bytes, in rotation. Vector widths are
+// multiples of four, so a vector holding the mask repeated end-to-end lines up with the payload
+// at every vector-aligned offset and we can XOR whole vectors at a time.
+
+#if KJ_HTTP_PARSE_SSE42 && defined(__SSE2__)
+#define KJ_WEBSOCKET_MASK_X86 1
+#define KJ_WEBSOCKET_MASK_AVX2_TARGET __attribute__((target("avx2")))
+
+bool haveAvx2() {
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+
+KJ_WEBSOCKET_MASK_AVX2_TARGET
+size_t applyWebSocketMaskAvx2(const byte* in, byte* out, size_t size, const byte pattern[32]) {
+  __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern));
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(chunk, mask));
+  }
+  return i;
+}
+
+size_t applyWebSocketMaskSse2(const byte* in, byte* out, size_t size, const byte pattern[32]) {
+  __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(chunk, mask));
+  }
+  return i;
+}
+#elif KJ_HTTP_PARSE_NEON
+#define KJ_WEBSOCKET_MASK_NEON 1
+
+size_t applyWebSocketMaskNeon(const byte* in, byte* out, size_t size, const byte pattern[32]) {
+  uint8x16_t mask = vld1q_u8(pattern);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    vst1q_u8(out + i, veorq_u8(vld1q_u8(in + i), mask));
+  }
+  return i;
+}
+#endif
+
+void applyWebSocketMask(const byte* in, byte* out, size_t size, const byte maskBytes[4]) {
+  // Computes out[i] = in[i] ^ maskBytes[i % 4]. `in` and `out` may be the same buffer.
+
+  size_t i = 0;
+
+  if (size >= 32) {
+    byte pattern[32];
+    for (uint j = 0; j < sizeof(pattern); j++) pattern[j] = maskBytes[j % 4];
+
+#if KJ_WEBSOCKET_MASK_X86
+    i = haveAvx2() ? applyWebSocketMaskAvx2(in, out, size, pattern)
+                   : applyWebSocketMaskSse2(in, out, size, pattern);
+#elif KJ_WEBSOCKET_MASK_NEON
+    i = applyWebSocketMaskNeon(in, out, size, pattern);
+#else
+    uint64_t mask64;
+    memcpy(&mask64, pattern, sizeof(mask64));
+    for (; i + 8 <= size; i += 8) {
+      uint64_t word;
+      memcpy(&word, in + i, sizeof(word));
+      word ^= mask64;
+      memcpy(out + i, &word, sizeof(word));
+    }
+#endif
+  }
+
+  for (; i < size; i++) {
+    out[i] = in[i] ^ maskBytes[i % 4];
+  }
+}
+
+// =======================================================================================
+// WebSocket permessage-deflate extension (RFC 7692)
+
+#if KJ_HAS_ZLIB
+class ZlibContext {
+  // Compresses or decompresses whole WebSocket messages. Per RFC 7692, each message is raw
+  // DEFLATE data ending in a sync flush, with the flush's trailing 0x00 0x00 0xff 0xff removed.
+
+public:
+  enum Mode { COMPRESS, DECOMPRESS };
+
+  ZlibContext(Mode mode, size_t windowBits, bool noContextTakeover)
+      : mode(mode), noContextTakeover(noContextTakeover) {
+    int result;
+    if (mode == COMPRESS) {
+      // Negative windowBits asks for raw DEFLATE, without a zlib header.
+      result = deflateInit2(&ctx, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            -static_cast<int>(windowBits), 8, Z_DEFAULT_STRATEGY);
+    } else {
+      result = inflateInit2(&ctx, -static_cast<int>(windowBits));
+    }
+    if (result != Z_OK) fail(result);
+  }
+
+  ~ZlibContext() noexcept(false) {
+    mode == COMPRESS ? deflateEnd(&ctx) : inflateEnd(&ctx);
+  }
+
+  KJ_DISALLOW_COPY(ZlibContext);
+
+  kj::Array<byte> compress(kj::ArrayPtr<const byte> message) {
+    kj::Vector<byte> output(message.size() / 2 + 16);
+    pump(message, output, kj::maxValue);
+
+    // A sync flush always ends with an empty stored block, which the receiver re-creates.
+    KJ_ASSERT(output.size() >= 4);
+    output.resize(output.size() - 4);
+
+    if (noContextTakeover) deflateReset(&ctx);
+    return output.releaseAsArray();
+  }
+
+  kj::Array<byte> decompress(kj::ArrayPtr<const byte> message, size_t maxSize, bool addNul) {
+    static constexpr byte TRAILER[4] = { 0x00, 0x00, 0xff, 0xff };
+
+    kj::Vector<byte> output(message.size() * 2 + 16);
+    pump(message, output, maxSize);
+    if (!streamEnded) {
+      pump(TRAILER, output, maxSize);
+    }
+
+    if (addNul) {
+      KJ_REQUIRE(output.size() + 1 < maxSize, "WebSocket message is too large");
+      output.add(0);
+    }
+
+    if (noContextTakeover || streamEnded) {
+      // The peer may also end the DEFLATE stream (with BFINAL) rather than just flushing it, in
+      // which case the next message starts a new stream.
+      inflateReset(&ctx);
+      streamEnded = false;
+    }
+    return output.releaseAsArray();
+  }
+
+private:
+  Mode mode;
+  bool noContextTakeover;
+  bool streamEnded = false;
+  z_stream ctx = {};
+  byte buffer[4096];
+
+  void pump(kj::ArrayPtr<const byte> input, kj::Vector<byte>& output, size_t maxSize) {
+    ctx.next_in = const_cast<byte*>(input.begin());
+    ctx.avail_in = input.size();
+
+    for (;;) {
+      ctx.next_out = buffer;
+      ctx.avail_out = sizeof(buffer);
+
+      int result = mode == COMPRESS ? deflate(&ctx, Z_SYNC_FLUSH) : inflate(&ctx, Z_SYNC_FLUSH);
+      if (result == Z_STREAM_END) {
+        streamEnded = true;
+      } else if (result != Z_OK && result != Z_BUF_ERROR) {
+        // Z_BUF_ERROR just means no progress was possible, i.e. we're done.
+        fail(result);
+      }
+
+      size_t produced = sizeof(buffer) - ctx.avail_out;
+      KJ_REQUIRE(output.size() + produced < maxSize, "WebSocket message is too large");
+      output.addAll(buffer, buffer + produced);
+
+      // If zlib didn't fill the buffer, then it has consumed all the input and finished the flush.
+      if (ctx.avail_out != 0 || streamEnded) return;
+    }
+  }
+
+  [[noreturn]] void fail(int result) {
+    auto header = mode == COMPRESS ? "WebSocket compression failed"
+                                   : "WebSocket decompression failed";
+    if (ctx.msg == nullptr) {
+      KJ_FAIL_REQUIRE(header, result);
+    } else {
+      KJ_FAIL_REQUIRE(header, ctx.msg);
+    }
+  }
+};
+
+constexpr bool WEBSOCKET_COMPRESSION_SUPPORTED = true;
+#else
+class ZlibContext {
+public:
+  enum Mode { COMPRESS, DECOMPRESS };
+
+  ZlibContext(Mode mode, size_t windowBits, bool noContextTakeover) {
+    KJ_UNIMPLEMENTED("WebSocket compression requires KJ to be built with zlib");
+  }
+
+  kj::Array<byte> compress(kj::ArrayPtr<const byte> message) { KJ_UNREACHABLE; }
+  kj::Array<byte> decompress(kj::ArrayPtr<const byte> message, size_t maxSize, bool addNul) {
+    KJ_UNREACHABLE;
+  }
+};
+
+constexpr bool WEBSOCKET_COMPRESSION_SUPPORTED = false;
+#endif  // KJ_HAS_ZLIB
+
+struct DeflateExtensionParameters {
+  // Parameters of one permessage-deflate element of a Sec-WebSocket-Extensions header, from the
+  // point of view of the handshake (client vs. server) rather than of either end.
+
+  bool clientNoContextTakeover = false;
+  bool serverNoContextTakeover = false;
+
+  bool hasClientMaxWindowBits = false;
+  // client_max_window_bits may appear in an offer without a value, meaning "I support this
+  // parameter", in which case `clientMaxWindowBits` is null.
+
+  kj::Maybe<size_t> clientMaxWindowBits;
+  kj::Maybe<size_t> serverMaxWindowBits;
+};
+
+kj::ArrayPtr<const char> trimWhitespace(kj::ArrayPtr<const char> text) {
+  while (text.size() > 0 && (text.front() == ' ' || text.front() == '\t')) {
+    text = text.slice(1, text.size());
+  }
+  while (text.size() > 0 && (text.back() == ' ' || text.back() == '\t')) {
+    text = text.slice(0, text.size() - 1);
+  }
+  return text;
+}
+
+kj::SmallVector<kj::ArrayPtr<const char>, 8> splitAndTrim(
+    kj::ArrayPtr<const char> text, char delim) {
+  kj::SmallVector<kj::ArrayPtr<const char>, 8> result;
+  for (;;) {
+    const char* pos = reinterpret_cast<const char*>(memchr(text.begin(), delim, text.size()));
+    if (pos == nullptr) {
+      result.add(trimWhitespace(text));
+      return result;
+    }
+    result.add(trimWhitespace(kj::arrayPtr(text.begin(), pos)));
+    text = kj::arrayPtr(pos + 1, text.end());
+  }
+}
+
+kj::Maybe<size_t> tryParseWindowBits(kj::ArrayPtr<const char> value) {
+  // RFC 7692 section 7.1.2: a decimal integer from 8 to 15, with no leading zeros, optionally
+  // quoted.
+  if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+    value = value.slice(1, value.size() - 1);
+  }
+  if (value.size() == 1 && value[0] >= '8' && value[0] <= '9') {
+    return value[0] - '0';
+  } else if (value.size() == 2 && value[0] == '1' && value[1] >= '0' && value[1] <= '5') {
+    return 10 + (value[1] - '0');
+  } else {
+    return nullptr;
+  }
+}
+
+kj::Maybe<DeflateExtensionParameters> tryParseDeflateExtension(kj::ArrayPtr<const char> text) {
+  // Parses one element of a Sec-WebSocket-Extensions list. Returns null if it isn't
+  // permessage-deflate, or if it has unknown, duplicate, or malformed parameters.
+
+  auto parts = splitAndTrim(text, ';');
+  if (parts[0] != "permessage-deflate"_kj.asArray()) return nullptr;
+
+  DeflateExtensionParameters result;
+  bool seenServerMaxWindowBits = false;
+  for (auto part: parts.slice(1, parts.size())) {
+    kj::ArrayPtr<const char> name = part;
+    kj::Maybe<kj::ArrayPtr<const char>> value;
+    const char* eq = reinterpret_cast<const char*>(memchr(part.begin(), '=', part.size()));
+    if (eq != nullptr) {
+      name = trimWhitespace(kj::arrayPtr(part.begin(), eq));
+      value = trimWhitespace(kj::arrayPtr(eq + 1, part.end()));
+    }
+
+    if (name == "client_no_context_takeover"_kj.asArray()) {
+      if (value != nullptr || result.clientNoContextTakeover) return nullptr;
+      result.clientNoContextTakeover = true;
+    } else if (name == "server_no_context_takeover"_kj.asArray()) {
+      if (value != nullptr || result.serverNoContextTakeover) return nullptr;
+      result.serverNoContextTakeover = true;
+    } else if (name == "client_max_window_bits"_kj.asArray()) {
+      if (result.hasClientMaxWindowBits) return nullptr;
+      result.hasClientMaxWindowBits = true;
+      KJ_IF_MAYBE(v, value) {
+        KJ_IF_MAYBE(bits, tryParseWindowBits(*v)) {
+          result.clientMaxWindowBits = *bits;
+        } else {
+          return nullptr;
+        }
+      }
+    } else if (name == "server_max_window_bits"_kj.asArray()) {
+      if (seenServerMaxWindowBits) return nullptr;
+      seenServerMaxWindowBits = true;
+      KJ_IF_MAYBE(v, value) {
+        KJ_IF_MAYBE(bits, tryParseWindowBits(*v)) {
+          result.serverMaxWindowBits = *bits;
+        } else {
+          return nullptr;
+        }
+      } else {
+        // Unlike client_max_window_bits, this one requires a value.
+        return nullptr;
+      }
+    } else {
+      return nullptr;
+    }
+  }
+
+  return result;
+}
+
+kj::String generateDeflateOffer(const CompressionParameters& prefs) {
+  // Client side: generate the Sec-WebSocket-Extensions offer. We always include
+  // client_max_window_bits, to let the server shrink our window if it wants.
+  return kj::str("permessage-deflate",
+      prefs.outboundNoContextTakeover ? "; client_no_context_takeover" : "",
+      prefs.inboundNoContextTakeover ? "; server_no_context_takeover" : "",
+      "; client_max_window_bits",
+      prefs.outboundMaxWindowBits < 15 ? kj::str("=", prefs.outboundMaxWindowBits) : kj::String(),
+      prefs.inboundMaxWindowBits < 15
+          ? kj::str("; server_max_window_bits=", prefs.inboundMaxWindowBits) : kj::String());
+}
+
+kj::Maybe<CompressionParameters> tryAcceptDeflateResponse(
+    kj::StringPtr header, const CompressionParameters& prefs) {
+  // Client side: interpret the server's Sec-WebSocket-Extensions response to our offer. Returns
+  // null if the response is not something we could have asked for.
+
+  auto extensions = splitAndTrim(header, ',');
+  if (extensions.size() != 1) return nullptr;
+
+  KJ_IF_MAYBE(response, tryParseDeflateExtension(extensions[0])) {
+    CompressionParameters result;
+    result.outboundNoContextTakeover =
+        prefs.outboundNoContextTakeover || response->clientNoContextTakeover;
+    result.inboundNoContextTakeover = response->serverNoContextTakeover;
+    result.outboundMaxWindowBits =
+        kj::min(prefs.outboundMaxWindowBits, response->clientMaxWindowBits.orDefault(15));
+    result.inboundMaxWindowBits = response->serverMaxWindowBits.orDefault(15);
+    return result;
+  } else {
+    return nullptr;
+  }
+}
+
+kj::Maybe<kj::Tuple<kj::String, CompressionParameters>> tryNegotiateDeflate(
+    kj::StringPtr header, const CompressionParameters& prefs) {
+  // Server side: pick the first acceptable permessage-deflate offer from the client's
+  // Sec-WebSocket-Extensions header, and generate our response. Any valid offer is acceptable:
+  // whatever window size the client can handle, we can compress within it.
+
+  for (auto extension: splitAndTrim(header, ',')) {
+    KJ_IF_MAYBE(offer, tryParseDeflateExtension(extension)) {
+      CompressionParameters agreed;
+      agreed.outboundNoContextTakeover =
+          prefs.outboundNoContextTakeover || offer->serverNoContextTakeover;
+      agreed.inboundNoContextTakeover =
+          prefs.inboundNoContextTakeover || offer->clientNoContextTakeover;
+      agreed.outboundMaxWindowBits =
+          kj::min(prefs.outboundMaxWindowBits, offer->serverMaxWindowBits.orDefault(15));
+
+      // We may only constrain the client's window if it said it supports that.
+      kj::String clientWindowParam;
+      if (offer->hasClientMaxWindowBits) {
+        agreed.inboundMaxWindowBits =
+            kj::min(prefs.inboundMaxWindowBits, offer->clientMaxWindowBits.orDefault(15));
+        if (agreed.inboundMaxWindowBits < 15) {
+          clientWindowParam = kj::str("; client_max_window_bits=", agreed.inboundMaxWindowBits);
+        }
+      }
+
+      // The server_max_window_bits response parameter is only allowed if the client offered it.
+      kj::String serverWindowParam;
+      if (offer->serverMaxWindowBits != nullptr) {
+        serverWindowParam = kj::str("; server_max_window_bits=", agreed.outboundMaxWindowBits);
+      }
+
+      auto response = kj::str("permessage-deflate",
+          agreed.outboundNoContextTakeover ? "; server_no_context_takeover" : "",
+          agreed.inboundNoContextTakeover ? "; client_no_context_takeover" : "",
+          serverWindowParam, clientWindowParam);
+      return kj::tuple(kj::mv(response), kj::mv(agreed));
+    }
+  }
+
+  return nullptr;
+}
+
 // =======================================================================================
 
 class WebSocketImpl final: public WebSocket {
 public:
   WebSocketImpl(kj::Own<kj::AsyncIoStream> stream,
                 kj::Maybe<EntropySource&> maskKeyGenerator,
+                kj::Maybe<CompressionParameters> compressionConfig = nullptr,
                 kj::Array<byte> buffer = kj::heapArray<byte>(4096),
                 kj::ArrayPtr<byte> leftover = nullptr,
                 kj::Maybe<kj::Promise<void>> waitBeforeSend = nullptr)
       : stream(kj::mv(stream)), maskKeyGenerator(maskKeyGenerator),
         sendingPong(kj::mv(waitBeforeSend)),
-        recvBuffer(kj::mv(buffer)), recvData(leftover) {}
+        recvBuffer(kj::mv(buffer)), recvData(leftover) {
+    KJ_IF_MAYBE(config, compressionConfig) {
+      compressionEnabled = true;
+
+      // zlib can't produce raw DEFLATE with a 256-byte window. Since each message's RSV1 bit says
+      // whether it is compressed, we can still honor such a limit by not compressing at all.
+      size_t outboundBits = config->outboundMaxWindowBits;
+      KJ_REQUIRE(outboundBits >= 8 && outboundBits <= 15, "invalid WebSocket window size",
+                 outboundBits);
+      if (outboundBits > 8) {
+        compressor = kj::heap<ZlibContext>(ZlibContext::COMPRESS, outboundBits,
+                                           config->outboundNoContextTakeover);
+      }
+
+      // A decompressor with the largest window can decode anything, whatever the peer agreed to.
+      decompressor = kj::heap<ZlibContext>(ZlibContext::DECOMPRESS, 15,
+                                           config->inboundNoContextTakeover);
+    }
+  }
 
   kj::Promise<void> send(kj::ArrayPtr<const byte> message) override {
     return sendImpl(OPCODE_BINARY, message);
@@ -2290,10 +2951,21 @@ public:
 
     auto opcode = recvHeader.getOpcode();
     bool isData = opcode < OPCODE_FIRST_CONTROL;
+    bool isCompressed = recvHeader.hasRsv1();
+    if (isCompressed) {
+      // RSV1 marks a message compressed by permessage-deflate. It's only allowed on the first
+      // frame of a data message, and only if the extension was negotiated.
+      KJ_REQUIRE(compressionEnabled,
+          "WebSocket frame has RSV1 set, but compression was not negotiated");
+      KJ_REQUIRE(isData && opcode != OPCODE_CONTINUATION,
+          "WebSocket RSV1 may only be set on the first frame of a data message");
+    }
+
     if (opcode == OPCODE_CONTINUATION) {
       KJ_REQUIRE(!fragments.empty(), "unexpected continuation frame in WebSocket");
 
       opcode = fragmentOpcode;
+      isCompressed = fragmentCompressed;
     } else if (isData) {
       KJ_REQUIRE(fragments.empty(), "expected continuation frame in WebSocket");
     }
@@ -2303,8 +2975,9 @@ public:
     kj::Array<byte> message;           // space to allocate
     byte* payloadTarget;               // location into which to read payload (size is payloadLen)
     if (isFin) {
-      // Add space for NUL terminator when allocating text message.
-      size_t amountToAllocate = payloadLen + (opcode == OPCODE_TEXT && isFin);
+      // Add space for NUL terminator when allocating text message. (Decompression allocates
+      // its own buffer.)
+      size_t amountToAllocate = payloadLen + (opcode == OPCODE_TEXT && isFin && !isCompressed);
 
       if (isData && !fragments.empty()) {
         // Final frame of a fragmented message. Gather the fragments.
@@ -2321,6 +2994,7 @@ public:
 
         fragments.clear();
         fragmentOpcode = 0;
+        fragmentCompressed = false;
       } else {
         // Single-frame message.
         message = kj::heapArray<byte>(amountToAllocate);
@@ -2335,13 +3009,14 @@ public:
       if (fragments.empty()) {
         // This is the first fragment, so set the opcode.
         fragmentOpcode = opcode;
+        fragmentCompressed = isCompressed;
       }
     }
 
     Mask mask = recvHeader.getMask();
 
     auto handleMessage = kj::mvCapture(message,
-        [this,opcode,payloadTarget,payloadLen,mask,isFin,maxSize]
+        [this,opcode,payloadTarget,payloadLen,mask,isFin,isCompressed,maxSize]
         (kj::Array<byte>&& message) -> kj::Promise<Message> {
       if (!mask.isZero()) {
         mask.apply(kj::arrayPtr(payloadTarget, payloadLen));
@@ -2354,6 +3029,14 @@ public:
         return receive(newMax);
       }
 
+      if (isCompressed) {
+        // `maxSize` has been reduced by the sizes of earlier fragments. The limit applies to the
+        // decompressed message as a whole, so add them back.
+        size_t messageMaxSize = maxSize + (payloadTarget - message.begin());
+        message = KJ_ASSERT_NONNULL(decompressor)->decompress(
+            message, messageMaxSize, opcode == OPCODE_TEXT);
+      }
+
       switch (opcode) {
         case OPCODE_CONTINUATION:
           // Shouldn't get here; handled above.
@@ -2418,6 +3101,12 @@ public:
         return nullptr;
       }
 
+      if (compressionEnabled || optOther->compressionEnabled) {
+        // Compressed frames depend on each connection's own compression context, so they can't
+        // be forwarded as-is.
+        return nullptr;
+      }
+
       // Check same error conditions as with sendImpl().
       KJ_REQUIRE(!disconnected, "WebSocket can't send after disconnect()");
       KJ_REQUIRE(!currentlySending, "another message send is already in progress");
@@ -2456,7 +3145,11 @@ private:
     }
 
     void apply(kj::ArrayPtr<byte> bytes) const {
-      apply(bytes.begin(), bytes.size());
+      applyWebSocketMask(bytes.begin(), bytes.begin(), bytes.size(), maskBytes);
+    }
+
+    void applyTo(kj::ArrayPtr<const byte> input, byte* output) const {
+      applyWebSocketMask(input.begin(), output, input.size(), maskBytes);
     }
 
     void copyTo(byte* output) const {
@@ -2469,18 +3162,13 @@ private:
 
   private:
     byte maskBytes[4];
-
-    void apply(byte* __restrict__ bytes, size_t size) const {
-      for (size_t i = 0; i < size; i++) {
-        bytes[i] ^= maskBytes[i % 4];
-      }
-    }
   };
 
   class Header {
   public:
-    kj::ArrayPtr<const byte> compose(bool fin, byte opcode, uint64_t payloadLen, Mask mask) {
-      bytes[0] = (fin ? FIN_MASK : 0) | opcode;
+    kj::ArrayPtr<const byte> compose(bool fin, byte opcode, uint64_t payloadLen, Mask mask,
+                                     bool compressed = false) {
+      bytes[0] = (fin ? FIN_MASK : 0) | (compressed ? RSV1_MASK : 0) | opcode;
       bool hasMask = !mask.isZero();
 
       size_t fill;
@@ -2532,6 +3220,10 @@ private:
       return bytes[0] & RSV_MASK;
     }
 
+    bool hasRsv1() const {
+      return bytes[0] & RSV1_MASK;
+    }
+
     byte getOpcode() const {
       return bytes[0] & OPCODE_MASK;
     }
@@ -2594,6 +3286,7 @@ private:
 
     static constexpr byte FIN_MASK = 0x80;
     static constexpr byte RSV_MASK = 0x70;
+    static constexpr byte RSV1_MASK = 0x40;
     static constexpr byte OPCODE_MASK = 0x0f;
 
     static constexpr byte USE_MASK_MASK = 0x80;
@@ -2634,9 +3327,17 @@ private:
   // Perhaps it should be renamed to `blockSend` or `writeQueue`.
 
   uint fragmentOpcode = 0;
+  bool fragmentCompressed = false;
   kj::Vector<kj::Array<byte>> fragments;
   // If `fragments` is non-empty, we've already received some fragments of a message.
-  // `fragmentOpcode` is the original opcode.
+  // `fragmentOpcode` is the original opcode, and `fragmentCompressed` is whether the first
+  // fragment had RSV1 set.
+
+  bool compressionEnabled = false;
+  kj::Maybe<kj::Own<ZlibContext>> compressor;
+  kj::Maybe<kj::Own<ZlibContext>> decompressor;
+  // Set if permessage-deflate was negotiated. `compressor` may still be null if we've agreed to
+  // a window too small for zlib, in which case we send messages uncompressed.
 
   kj::Array<byte> recvBuffer;
   kj::ArrayPtr<byte> recvData;
@@ -2668,18 +3369,31 @@ private:
     Mask mask(maskKeyGenerator);
 
     kj::Array<byte> ownMessage;
+    bool compressed = false;
+    if (opcode < OPCODE_FIRST_CONTROL) {
+      KJ_IF_MAYBE(c, compressor) {
+        ownMessage = (*c)->compress(message);
+        message = ownMessage;
+        compressed = true;
+      }
+    }
+
     if (!mask.isZero()) {
-      // Sadness, we have to make a copy to apply the mask.
-      ownMessage = kj::heapArray(message);
-      mask.apply(ownMessage);
-      message = ownMessage;
+      if (ownMessage == nullptr) {
+        // Sadness, we have to make a copy to apply the mask.
+        ownMessage = kj::heapArray<byte>(message.size());
+        mask.applyTo(message, ownMessage.begin());
+        message = ownMessage;
+      } else {
+        mask.apply(ownMessage);
+      }
     }
 
-    sendParts[0] = sendHeader.compose(true, opcode, message.size(), mask);
+    sendParts[0] = sendHeader.compose(true, opcode, message.size(), mask, compressed);
     sendParts[1] = message;
 
     auto promise = stream->write(sendParts);
-    if (!mask.isZero()) {
+    if (ownMessage != nullptr) {
       promise = promise.attach(kj::mv(ownMessage));
     }
     return promise.then([this, size = sendParts[0].size() + sendParts[1].size()]() {
@@ -2772,10 +3486,11 @@ private:
 
 kj::Own<WebSocket> upgradeToWebSocket(
     kj::Own<kj::AsyncIoStream> stream, HttpInputStreamImpl& httpInput, HttpOutputStream& httpOutput,
-    kj::Maybe<EntropySource&> maskKeyGenerator) {
+    kj::Maybe<EntropySource&> maskKeyGenerator,
+    kj::Maybe<CompressionParameters> compressionConfig) {
   // Create a WebSocket upgraded from an HTTP stream.
   auto releasedBuffer = httpInput.releaseBuffer();
-  return kj::heap<WebSocketImpl>(kj::mv(stream), maskKeyGenerator,
+  return kj::heap<WebSocketImpl>(kj::mv(stream), maskKeyGenerator, kj::mv(compressionConfig),
                                  kj::mv(releasedBuffer.buffer), releasedBuffer.leftover,
                                  httpOutput.flush());
 }
@@ -2783,8 +3498,9 @@ kj::Own<WebSocket> upgradeToWebSocket(
 }  // namespace
 
 kj::Own<WebSocket> newWebSocket(kj::Own<kj::AsyncIoStream> stream,
-                                kj::Maybe<EntropySource&> maskKeyGenerator) {
-  return kj::heap<WebSocketImpl>(kj::mv(stream), maskKeyGenerator);
+                                kj::Maybe<EntropySource&> maskKeyGenerator,
+                                kj::Maybe<CompressionParameters> compressionConfig) {
+  return kj::heap<WebSocketImpl>(kj::mv(stream), maskKeyGenerator, kj::mv(compressionConfig));
 }
 
 static kj::Promise<void> pumpWebSocketLoop(WebSocket& from, WebSocket& to) {
@@ -3508,6 +4224,14 @@ public:
     return !upgraded && !closed && httpInput.canReuse() && httpOutput.canReuse();
   }
 
+  bool canPipeline(uint maxPipelined) {
+    // Returns true if we can send another request now, before the responses to earlier ones have
+    // been read, keeping no more than `maxPipelined` requests waiting behind the one whose
+    // response is being read.
+
+    return !upgraded && !closed && httpInput.canPipeline(maxPipelined) && httpOutput.canReuse();
+  }
+
   Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
                   kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
     KJ_REQUIRE(!upgraded,
@@ -3520,7 +4244,7 @@ public:
     closeWatcherTask = nullptr;
 
     kj::StringPtr connectionHeaders[HttpHeaders::CONNECTION_HEADERS_COUNT];
-    kj::String lengthStr;
+    kj::SmallString lengthStr;
 
     bool isGet = method == HttpMethod::GET || method == HttpMethod::HEAD;
     bool hasBody;
@@ -3530,7 +4254,7 @@ public:
         // GET with empty body; don't send any Content-Length.
         hasBody = false;
       } else {
-        lengthStr = kj::str(*s);
+        lengthStr = kj::smallStr(*s);
         connectionHeaders[HttpHeaders::BuiltinIndices::CONTENT_LENGTH] = lengthStr;
         hasBody = true;
       }
@@ -3549,7 +4273,9 @@ public:
       }
     }
 
-    httpOutput.writeHeaders(headers.serializeRequest(method, url, connectionHeaders));
+    auto headerBuffer = httpOutput.takeHeaderBuffer();
+    auto serialized = headers.serializeRequest(headerBuffer, method, url, connectionHeaders);
+    httpOutput.writeHeaders(kj::mv(headerBuffer), serialized);
 
     kj::Own<kj::AsyncOutputStream> bodyStream;
     if (!hasBody) {
@@ -3627,6 +4353,15 @@ public:
     connectionHeaders[HttpHeaders::BuiltinIndices::SEC_WEBSOCKET_VERSION] = "13";
     connectionHeaders[HttpHeaders::BuiltinIndices::SEC_WEBSOCKET_KEY] = keyBase64;
 
+    kj::Maybe<CompressionParameters> offeredCompression;
+    kj::String extensionsOffer;
+    if (WEBSOCKET_COMPRESSION_SUPPORTED && settings.webSocketCompression) {
+      auto& prefs = settings.webSocketCompressionParameters;
+      extensionsOffer = generateDeflateOffer(prefs);
+      connectionHeaders[HttpHeaders::BuiltinIndices::SEC_WEBSOCKET_EXTENSIONS] = extensionsOffer;
+      offeredCompression = prefs;
+    }
+
     httpOutput.writeHeaders(headers.serializeRequest(HttpMethod::GET, url, connectionHeaders));
 
     // No entity-body.
@@ -3635,7 +4370,7 @@ public:
     auto id = ++counter;
 
     return httpInput.readResponseHeaders()
-        .then([this,id,keyBase64 = kj::mv(keyBase64)](
+        .then([this,id,keyBase64 = kj::mv(keyBase64),offeredCompression](
             HttpHeaders::ResponseOrProtocolError&& responseOrProtocolError)
             -> HttpClient::WebSocketResponse {
       KJ_SWITCH_ONEOF(responseOrProtocolError) {
@@ -3677,11 +4412,28 @@ public:
               });
             }
 
+            kj::Maybe<CompressionParameters> compressionConfig;
+            KJ_IF_MAYBE(offer, offeredCompression) {
+              KJ_IF_MAYBE(extensions,
+                          responseHeaders.get(HttpHeaderId::SEC_WEBSOCKET_EXTENSIONS)) {
+                compressionConfig = tryAcceptDeflateResponse(*extensions, *offer);
+                if (compressionConfig == nullptr) {
+                  auto message = kj::str(
+                      "Server failed WebSocket handshake: unexpected Sec-WebSocket-Extensions "
+                      "header: '", *extensions, "'.");
+                  return settings.errorHandler.orDefault(*this).handleWebSocketProtocolError({
+                    502, "Bad Gateway", message, nullptr
+                  });
+                }
+              }
+            }
+
             return {
               response.statusCode,
               response.statusText,
               &httpInput.getHeaders(),
-              upgradeToWebSocket(kj::mv(ownStream), httpInput, httpOutput, settings.entropySource),
+              upgradeToWebSocket(kj::mv(ownStream), httpInput, httpOutput, settings.entropySource,
+                                 kj::mv(compressionConfig)),
             };
           } else {
             upgraded = false;
@@ -3834,7 +4586,19 @@ public:
 
   Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
                   kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    bool pipelinable = isPipelinable(method, headers, expectedBodySize);
+    if (pipelinable && availableClients.empty()) {
+      KJ_IF_MAYBE(tail, pipelineTail) {
+        if (tail->client->canPipeline(settings.maxPipelinedRequests)) {
+          return pipelinedRequest(kj::addRef(*tail), method, url, headers);
+        }
+      }
+    }
+
     auto refcounted = getClient();
+    if (pipelinable) {
+      pipelineTail = *refcounted;
+    }
     auto result = refcounted->client->request(method, url, headers, expectedBodySize);
     result.body = result.body.attach(kj::addRef(*refcounted));
     result.response = result.response.then(kj::mvCapture(refcounted,
@@ -3880,6 +4644,13 @@ private:
   bool timeoutsScheduled = false;
   kj::Promise<void> timeoutTask = nullptr;
 
+  struct RefcountedClient;
+  kj::Maybe<RefcountedClient&> pipelineTail;
+  // The connection most recently used for a request which could be pipelined, if it's still in
+  // use. Further such requests are pipelined onto it.
+
+  bool pipeliningFailed = false;
+
   struct AvailableClient {
     kj::Own<HttpClientImpl> client;
     kj::TimePoint expires;
@@ -3894,6 +4665,9 @@ private:
     }
     ~RefcountedClient() noexcept(false) {
       --parent.activeConnectionCount;
+      KJ_IF_MAYBE(tail, parent.pipelineTail) {
+        if (tail == this) parent.pipelineTail = nullptr;
+      }
       KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
         parent.returnClientToAvailable(kj::mv(client));
       })) {
@@ -3922,6 +4696,40 @@ private:
     }
   }
 
+  bool isPipelinable(HttpMethod method, const HttpHeaders& headers,
+                     kj::Maybe<uint64_t> expectedBodySize) {
+    // Only pipeline requests which are safe to retry, which is what we do if pipelining fails.
+    // (Like HttpClientImpl, treat a GET with a Transfer-Encoding header as having a body.)
+    if (settings.maxPipelinedRequests == 0 || pipeliningFailed) return false;
+    if (method != HttpMethod::GET && method != HttpMethod::HEAD) return false;
+    KJ_IF_MAYBE(s, expectedBodySize) {
+      return *s == 0;
+    } else {
+      return headers.get(HttpHeaderId::TRANSFER_ENCODING) == nullptr;
+    }
+  }
+
+  Request pipelinedRequest(kj::Own<RefcountedClient> refcounted, HttpMethod method,
+                           kj::StringPtr url, const HttpHeaders& headers) {
+    auto result = refcounted->client->request(method, url, headers);
+    result.body = result.body.attach(kj::addRef(*refcounted));
+    result.response = result.response.then(kj::mvCapture(refcounted,
+        [](kj::Own<RefcountedClient>&& refcounted, Response&& response) {
+      response.body = response.body.attach(kj::mv(refcounted));
+      return kj::mv(response);
+    })).catch_([this,method,url = kj::str(url),headers = headers.clone()](kj::Exception&&) mutable
+        -> kj::Promise<Response> {
+      // Perhaps the server closed the connection after an earlier response, or doesn't handle
+      // pipelining correctly. Since the request is idempotent and has no body, we can safely send
+      // it again, on a connection of its own, and we'll stop pipelining for good.
+      pipeliningFailed = true;
+      pipelineTail = nullptr;
+      auto retry = request(method, url, headers);
+      return kj::mv(retry.response);
+    });
+    return result;
+  }
+
   void returnClientToAvailable(kj::Own<HttpClientImpl> client) {
     // Only return the connection to the pool if it is reusable and if our settings indicate we
     // should reuse connections.
@@ -4834,6 +5642,15 @@ kj::Promise<void> HttpService::Response::sendError(
   return sendError(statusCode, statusText, HttpHeaders(headerTable));
 }
 
+kj::Promise<void> HttpService::Response::sendBuffer(
+    uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+    kj::Array<const byte> body) {
+  auto stream = send(statusCode, statusText, headers, body.size());
+  if (body.size() == 0) return kj::READY_NOW;
+  auto promise = stream->write(body.begin(), body.size());
+  return promise.attach(kj::mv(stream), kj::mv(body));
+}
+
 kj::Promise<kj::Own<kj::AsyncIoStream>> HttpService::connect(kj::StringPtr host) {
   KJ_UNIMPLEMENTED("CONNECT is not implemented by this HttpService");
 }
@@ -5181,11 +5998,59 @@ private:
   kj::Own<kj::AsyncOutputStream> send(
       uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
       kj::Maybe<uint64_t> expectedBodySize) override {
+    auto response = serializeResponse(statusCode, statusText, headers, expectedBodySize);
+    auto method = response.method;
+    httpOutput.writeHeaders(kj::mv(response.buffer), response.headers);
+
+    kj::Own<kj::AsyncOutputStream> bodyStream;
+    if (method == HttpMethod::HEAD) {
+      // Ignore entity-body.
+      httpOutput.finishBody();
+      return heap<HttpDiscardingEntityWriter>();
+    } else if (statusCode == 204 || statusCode == 205 || statusCode == 304) {
+      // No entity-body.
+      httpOutput.finishBody();
+      return heap<HttpNullEntityWriter>();
+    } else KJ_IF_MAYBE(s, expectedBodySize) {
+      return heap<HttpFixedLengthEntityWriter>(httpOutput, *s);
+    } else {
+      return heap<HttpChunkedEntityWriter>(httpOutput);
+    }
+  }
+
+  kj::Promise<void> sendBuffer(
+      uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+      kj::Array<const byte> body) override {
+    bool hasBody = statusCode != 204 && statusCode != 205 && statusCode != 304;
+    KJ_REQUIRE(hasBody || body.size() == 0, "HTTP message has no entity-body; can't write()");
+
+    auto response = serializeResponse(statusCode, statusText, headers, body.size());
+    if (response.method == HttpMethod::HEAD || !hasBody) {
+      // Ignore entity-body.
+      httpOutput.writeHeaders(kj::mv(response.buffer), response.headers);
+      httpOutput.finishBody();
+    } else {
+      httpOutput.writeHeadersAndBody(kj::mv(response.buffer), response.headers, kj::mv(body));
+    }
+    return httpOutput.flush();
+  }
+
+  struct SerializedResponse {
+    HttpMethod method;
+    kj::Array<char> buffer;
+    kj::ArrayPtr<const char> headers;
+  };
+
+  SerializedResponse serializeResponse(
+      uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+      kj::Maybe<uint64_t> expectedBodySize) {
+    // Begins the response to the current request, and serializes its status line and headers.
+
     auto method = KJ_REQUIRE_NONNULL(currentMethod, "already called send()");
     currentMethod = nullptr;
 
     kj::StringPtr connectionHeaders[HttpHeaders::CONNECTION_HEADERS_COUNT];
-    kj::String lengthStr;
+    kj::SmallString lengthStr;
 
     if (!closeAfterSend) {
       // Check if application wants us to close connections.
@@ -5220,7 +6085,7 @@ private:
       //   HEAD responses with non-null-body status codes. This is a hack that *only* makes sense
       //   for HEAD responses.
       if (method != HttpMethod::HEAD || *s > 0) {
-        lengthStr = kj::str(*s);
+        lengthStr = kj::smallStr(*s);
         connectionHeaders[HttpHeaders::BuiltinIndices::CONTENT_LENGTH] = lengthStr;
       }
     } else {
@@ -5238,23 +6103,10 @@ private:
       }
     }
 
-    httpOutput.writeHeaders(headers.serializeResponse(
-        statusCode, statusText, connectionHeadersArray));
-
-    kj::Own<kj::AsyncOutputStream> bodyStream;
-    if (method == HttpMethod::HEAD) {
-      // Ignore entity-body.
-      httpOutput.finishBody();
-      return heap<HttpDiscardingEntityWriter>();
-    } else if (statusCode == 204 || statusCode == 205 || statusCode == 304) {
-      // No entity-body.
-      httpOutput.finishBody();
-      return heap<HttpNullEntityWriter>();
-    } else KJ_IF_MAYBE(s, expectedBodySize) {
-      return heap<HttpFixedLengthEntityWriter>(httpOutput, *s);
-    } else {
-      return heap<HttpChunkedEntityWriter>(httpOutput);
-    }
+    auto headerBuffer = httpOutput.takeHeaderBuffer();
+    auto serialized = headers.serializeResponse(
+        headerBuffer, statusCode, statusText, connectionHeadersArray);
+    return { method, kj::mv(headerBuffer), serialized };
   }
 
   kj::Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) override {
@@ -5289,6 +6141,20 @@ private:
     connectionHeaders[HttpHeaders::BuiltinIndices::UPGRADE] = "websocket";
     connectionHeaders[HttpHeaders::BuiltinIndices::CONNECTION] = "Upgrade";
 
+    kj::Maybe<CompressionParameters> compressionConfig;
+    kj::String extensionsResponse;
+    if (WEBSOCKET_COMPRESSION_SUPPORTED && server.settings.webSocketCompression) {
+      KJ_IF_MAYBE(offer, requestHeaders.get(HttpHeaderId::SEC_WEBSOCKET_EXTENSIONS)) {
+        KJ_IF_MAYBE(agreed,
+                    tryNegotiateDeflate(*offer, server.settings.webSocketCompressionParameters)) {
+          extensionsResponse = kj::mv(kj::get<0>(*agreed));
+          compressionConfig = kj::mv(kj::get<1>(*agreed));
+          connectionHeaders[HttpHeaders::BuiltinIndices::SEC_WEBSOCKET_EXTENSIONS] =
+              extensionsResponse;
+        }
+      }
+    }
+
     httpOutput.writeHeaders(headers.serializeResponse(
         101, "Switching Protocols", connectionHeaders));
 
@@ -5300,7 +6166,7 @@ private:
     auto deferNoteClosed = kj::defer([this]() { webSocketClosed = true; });
     kj::Own<kj::AsyncIoStream> ownStream(&stream, kj::NullDisposer::instance);
     return upgradeToWebSocket(ownStream.attach(kj::mv(deferNoteClosed)),
-                              httpInput, httpOutput, nullptr);
+                              httpInput, httpOutput, nullptr, kj::mv(compressionConfig));
   }
 
   kj::Promise<bool> sendError(HttpHeaders::ProtocolError protocolError) {
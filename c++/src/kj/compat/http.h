@@ -234,6 +234,10 @@ public:
   kj::StringPtr idToString(HttpHeaderId id) const;
   // Get the canonical string name for the given ID.
 
+  HttpHeaderId idAt(uint index) const;
+  // Get the ID whose hashCode() is `index`, which must be less than idCount(). Together with
+  // idCount(), this allows enumerating every header in the table.
+
   bool isReady() const;
   // Returns true if this HttpHeaderTable either was default constructed or its Builder has
   // invoked `build()` and released it.
@@ -423,6 +427,16 @@ public:
   // headers values override any corresponding header value in the HttpHeaders object. The
   // CONNECTION_HEADERS_COUNT constants below can help you construct this `connectionHeaders` array.
 
+  kj::ArrayPtr<const char> serializeRequest(
+      kj::Array<char>& buffer, HttpMethod method, kj::StringPtr url,
+      kj::ArrayPtr<const kj::StringPtr> connectionHeaders = nullptr) const;
+  kj::ArrayPtr<const char> serializeResponse(
+      kj::Array<char>& buffer, uint statusCode, kj::StringPtr statusText,
+      kj::ArrayPtr<const kj::StringPtr> connectionHeaders = nullptr) const;
+  // Like the above, but serialize into `buffer`, replacing it with a larger one only if it is too
+  // small, and return the part of it that was filled. This lets a connection reuse one buffer
+  // for every message it sends. (The returned blob is not NUL-terminated.)
+
   enum class BuiltinIndicesEnum {
   #define HEADER_ID(id, name) id,
     KJ_HTTP_FOR_EACH_BUILTIN_HEADER(HEADER_ID)
@@ -452,7 +466,8 @@ private:
     kj::StringPtr name;
     kj::StringPtr value;
   };
-  kj::Vector<Header> unindexedHeaders;
+  kj::SmallVector<Header, 4> unindexedHeaders;
+  // Most messages only carry a few headers that aren't in the table, so keep those inline.
 
   kj::Vector<kj::Array<char>> ownedStrings;
 
@@ -464,6 +479,20 @@ private:
                        kj::ArrayPtr<const char> word2,
                        kj::ArrayPtr<const char> word3,
                        kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const;
+  size_t serializedSize(kj::ArrayPtr<const char> word1,
+                        kj::ArrayPtr<const char> word2,
+                        kj::ArrayPtr<const char> word3,
+                        kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const;
+  char* serializeTo(char* ptr,
+                    kj::ArrayPtr<const char> word1,
+                    kj::ArrayPtr<const char> word2,
+                    kj::ArrayPtr<const char> word3,
+                    kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const;
+  kj::ArrayPtr<const char> serializeInto(kj::Array<char>& buffer,
+                                         kj::ArrayPtr<const char> word1,
+                                         kj::ArrayPtr<const char> word2,
+                                         kj::ArrayPtr<const char> word3,
+                                         kj::ArrayPtr<const kj::StringPtr> connectionHeaders) const;
 
   bool parseHeaders(char* ptr, char* end);
 
@@ -534,6 +563,29 @@ public:
   virtual void generate(kj::ArrayPtr<byte> buffer) = 0;
 };
 
+struct CompressionParameters {
+  // Parameters of the WebSocket permessage-deflate extension (RFC 7692). "Outbound" refers to
+  // messages sent by this end of the WebSocket, "inbound" to messages received from the peer.
+  //
+  // When used as a preference in HttpClientSettings or HttpServerSettings, these are what we
+  // ask for during the handshake; the WebSocket then uses whatever the handshake agreed upon.
+
+  bool outboundNoContextTakeover = false;
+  // If true, the compressor is reset after each message we send, so that each message can be
+  // decompressed independently. This costs compression ratio but saves the peer from keeping a
+  // decompression window around between messages.
+
+  bool inboundNoContextTakeover = false;
+  // If true, ask the peer to reset its compressor after each message it sends. This lets us
+  // discard our decompression state between messages.
+
+  size_t outboundMaxWindowBits = 15;
+  size_t inboundMaxWindowBits = 15;
+  // Base-2 logarithm of the LZ77 window size, between 8 and 15 inclusive, used by our
+  // compressor and requested of the peer's compressor, respectively. 15 is the maximum, and
+  // means no limit. Smaller windows use less memory but compress less well.
+};
+
 class WebSocket {
   // Interface representincg an open WebSocket session.
   //
@@ -696,6 +748,18 @@ public:
     virtual kj::Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) = 0;
     // If headers.isWebSocket() is true then you can call acceptWebSocket() instead of send().
 
+    virtual kj::Promise<void> sendBuffer(
+        uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+        kj::Array<const byte> body);
+    // Sends a complete response whose body is `body`, instead of calling send() and writing the
+    // body to the returned stream. The returned promise resolves once the response is written.
+    //
+    // `body` is held, not copied, until it has been written, so content cached in memory can be
+    // served by passing a reference to it, e.g. a slice with a refcounted owner attached, or the
+    // result of `ReadableFile::mmap()`. HttpServer writes the headers and body together in a
+    // single gather write. The default implementation calls send() and writes `body` to the
+    // stream.
+
     kj::Promise<void> sendError(uint statusCode, kj::StringPtr statusText,
                                 const HttpHeaders& headers);
     kj::Promise<void> sendError(uint statusCode, kj::StringPtr statusText,
@@ -754,6 +818,16 @@ struct HttpClientSettings {
   // For clients which automatically create new connections, any connection idle for at least this
   // long will be closed. Set this to 0 to prevent connection reuse entirely.
 
+  uint maxPipelinedRequests = 0;
+  // For clients which automatically create new connections: when no idle connection is available,
+  // send up to this many GET or HEAD requests (without bodies) on a connection which is still
+  // waiting for the response to an earlier request, rather than opening a new connection. That is,
+  // HTTP/1.1 pipelining. Responses arrive in order, so a slow response delays those behind it.
+  //
+  // If a pipelined request fails before its response headers arrive -- say, because the server
+  // closed the connection after an earlier response -- it is retried on a connection of its own,
+  // and the client stops pipelining. 0, the default, disables pipelining.
+
   kj::Maybe<EntropySource&> entropySource = nullptr;
   // Must be provided in order to use `openWebSocket`. If you don't need WebSockets, this can be
   // omitted. The WebSocket protocol uses random values to avoid triggering flaws (including
@@ -766,6 +840,12 @@ struct HttpClientSettings {
   kj::Maybe<HttpClientErrorHandler&> errorHandler = nullptr;
   // Customize how protocol errors are handled by the HttpClient. If null, HttpClientErrorHandler's
   // default implementation will be used.
+
+  bool webSocketCompression = false;
+  CompressionParameters webSocketCompressionParameters;
+  // If `webSocketCompression` is true, `openWebSocket()` offers the permessage-deflate extension
+  // with the given preferences, and compresses messages if the server accepts. Requires KJ to be
+  // built with zlib; otherwise this is ignored and no compression is offered.
 };
 
 kj::Own<HttpClient> newHttpClient(kj::Timer& timer, const HttpHeaderTable& responseHeaderTable,
@@ -790,7 +870,8 @@ kj::Own<HttpClient> newHttpClient(kj::Timer& timer, const HttpHeaderTable& respo
 // Creates an HttpClient that always connects to the given address no matter what URL is requested.
 // The client will open and close connections as needed. It will attempt to reuse connections for
 // multiple requests but will not send a new request before the previous response on the same
-// connection has completed, as doing so can result in head-of-line blocking issues. The client may
+// connection has completed, as doing so can result in head-of-line blocking issues, unless
+// `settings.maxPipelinedRequests` says to. The client may
 // be used as a proxy client or a host client depending on whether the peer is operating as
 // a proxy. (Hint: This is the best kind of client to use when routing traffic through an HTTP
 // proxy. `addr` should be the address of the proxy, and the proxy itself will resolve remote hosts
@@ -834,7 +915,8 @@ kj::Own<HttpInputStream> newHttpInputStream(
 // continue reading from `input` in a reliable way.
 
 kj::Own<WebSocket> newWebSocket(kj::Own<kj::AsyncIoStream> stream,
-                                kj::Maybe<EntropySource&> maskEntropySource);
+                                kj::Maybe<EntropySource&> maskEntropySource,
+                                kj::Maybe<CompressionParameters> compressionConfig = nullptr);
 // Create a new WebSocket on top of the given stream. It is assumed that the HTTP -> WebSocket
 // upgrade handshake has already occurred (or is not needed), and messages can immediately be
 // sent and received on the stream. Normally applications would not call this directly.
@@ -846,6 +928,11 @@ kj::Own<WebSocket> newWebSocket(kj::Own<kj::AsyncIoStream> stream,
 // purpose of the mask is to prevent badly-written HTTP proxies from interpreting "things that look
 // like HTTP requests" in a message as being actual HTTP requests, which could result in cache
 // poisoning. See RFC6455 section 10.3.
+//
+// `compressionConfig`, if non-null, enables the permessage-deflate extension with the given
+// (already negotiated) parameters. Both ends must agree on them; normally they come from the
+// `Sec-WebSocket-Extensions` handshake performed by HttpClient and HttpServer. Text and binary
+// messages are then always sent compressed. Throws if KJ was built without zlib.
 
 struct WebSocketPipe {
   kj::Own<WebSocket> ends[2];
@@ -882,6 +969,13 @@ struct HttpServerSettings {
 
   kj::Maybe<HttpServerCallbacks&> callbacks = nullptr;
   // Additional optional callbacks used to control some server behavior.
+
+  bool webSocketCompression = false;
+  CompressionParameters webSocketCompressionParameters;
+  // If `webSocketCompression` is true, `acceptWebSocket()` accepts the permessage-deflate
+  // extension when the client offers it, settling on parameters compatible with both the offer
+  // and the given preferences. Requires KJ to be built with zlib; otherwise this is ignored and
+  // compression is never accepted.
 };
 
 class HttpServerErrorHandler {
@@ -1116,6 +1210,11 @@ inline kj::StringPtr HttpHeaderTable::idToString(HttpHeaderId id) const {
   return namesById[id.id];
 }
 
+inline HttpHeaderId HttpHeaderTable::idAt(uint index) const {
+  KJ_IREQUIRE(index < namesById.size());
+  return HttpHeaderId(this, index);
+}
+
 inline kj::Maybe<kj::StringPtr> HttpHeaders::get(HttpHeaderId id) const {
   id.requireFrom(*table);
   auto result = indexedHeaders[id.id];
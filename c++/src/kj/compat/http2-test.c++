@@ -0,0 +1,481 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "http2.h"
+#include "kj/debug.h"
+#include "kj/test.h"
+#include "kj/encoding.h"
+
+namespace kj {
+namespace {
+
+using _::HpackHeader;
+using _::HpackEncoder;
+using _::HpackDecoder;
+
+// -----------------------------------------------------------------------------
+// HPACK, checked against the examples in RFC 7541 Appendix C.
+
+kj::String decodeToString(HpackDecoder& decoder, kj::StringPtr hex) {
+  auto bytes = kj::decodeHex(hex);
+  KJ_ASSERT(!bytes.hadErrors);
+  auto headers = decoder.decode(bytes);
+  kj::Vector<kj::String> lines;
+  for (auto& header: headers) {
+    lines.add(kj::str(header.name, ": ", header.value));
+  }
+  return kj::strArray(lines, "\n");
+}
+
+KJ_TEST("HPACK decode requests without Huffman (RFC 7541 C.3)") {
+  HpackDecoder decoder;
+
+  KJ_EXPECT(decodeToString(decoder, "828684410f7777772e6578616d706c652e636f6d") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com");
+  KJ_EXPECT(decoder.getTableSize() == 57);
+
+  KJ_EXPECT(decodeToString(decoder, "828684be58086e6f2d6361636865") ==
+      ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+      "cache-control: no-cache");
+  KJ_EXPECT(decoder.getTableSize() == 110);
+
+  KJ_EXPECT(decodeToString(decoder,
+      "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565") ==
+      ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\n"
+      "custom-key: custom-value");
+  KJ_EXPECT(decoder.getTableSize() == 164);
+}
+
+static const kj::StringPtr RFC_C6_BLOCKS[] = {
+  "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863"
+  "c78f0b97c8e9ae82ae43d3"_kj,
+  "4883640effc1c0bf"_kj,
+  "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b3"
+  "35dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007"_kj,
+};
+
+KJ_TEST("HPACK decode responses with Huffman and eviction (RFC 7541 C.6)") {
+  HpackDecoder decoder(256);
+
+  KJ_EXPECT(decodeToString(decoder, RFC_C6_BLOCKS[0]) ==
+      ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com");
+  KJ_EXPECT(decoder.getTableSize() == 222);
+
+  KJ_EXPECT(decodeToString(decoder, RFC_C6_BLOCKS[1]) ==
+      ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\n"
+      "location: https://www.example.com");
+  KJ_EXPECT(decoder.getTableSize() == 222);
+
+  KJ_EXPECT(decodeToString(decoder, RFC_C6_BLOCKS[2]) ==
+      ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\n"
+      "location: https://www.example.com\ncontent-encoding: gzip\n"
+      "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1");
+  KJ_EXPECT(decoder.getTableSize() == 215);
+}
+
+KJ_TEST("HPACK encode requests (RFC 7541 C.4)") {
+  HpackEncoder encoder;
+
+  HpackHeader first[] = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(first)) ==
+      "828684418cf1e3c2e5f23a6ba0ab90f4ff");
+
+  HpackHeader second[] = {
+    {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+    {"cache-control", "no-cache"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(second)) == "828684be5886a8eb10649cbf");
+
+  HpackHeader third[] = {
+    {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+    {":authority", "www.example.com"}, {"custom-key", "custom-value"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(third)) ==
+      "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+  KJ_EXPECT(encoder.getTableSize() == 164);
+}
+
+KJ_TEST("HPACK encode responses (RFC 7541 C.6)") {
+  HpackEncoder encoder(256);
+
+  HpackHeader first[] = {
+    {":status", "302"}, {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(first)) == RFC_C6_BLOCKS[0]);
+
+  HpackHeader second[] = {
+    {":status", "307"}, {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(second)) == RFC_C6_BLOCKS[1]);
+
+  HpackHeader third[] = {
+    {":status", "200"}, {"cache-control", "private"},
+    {"date", "Mon, 21 Oct 2013 20:13:22 GMT"}, {"location", "https://www.example.com"},
+    {"content-encoding", "gzip"},
+    {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"},
+  };
+  KJ_EXPECT(kj::encodeHex(encoder.encode(third)) == RFC_C6_BLOCKS[2]);
+  KJ_EXPECT(encoder.getTableSize() == 215);
+}
+
+KJ_TEST("HPACK round trip with table size changes and sensitive headers") {
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+
+  HpackHeader headers[] = {
+    {"authorization", "Bearer secret"}, {"x-custom", "some value"},
+  };
+  auto block = encoder.encode(headers);
+  KJ_EXPECT(decodeToString(decoder, kj::encodeHex(block)) ==
+      "authorization: Bearer secret\nx-custom: some value");
+  // Only x-custom was indexed.
+  KJ_EXPECT(encoder.getTableSize() == 8 + 10 + 32);
+  KJ_EXPECT(decoder.getTableSize() == encoder.getTableSize());
+
+  // Shrinking the table evicts everything and is signaled at the start of the next block.
+  encoder.setMaxTableSize(0);
+  block = encoder.encode(headers);
+  KJ_EXPECT(block[0] == 0x20);
+  KJ_EXPECT(decodeToString(decoder, kj::encodeHex(block)) ==
+      "authorization: Bearer secret\nx-custom: some value");
+  KJ_EXPECT(decoder.getTableSize() == 0);
+}
+
+KJ_TEST("HPACK rejects malformed input") {
+  auto expectInvalid = [](kj::StringPtr hex) {
+    HpackDecoder decoder;
+    auto bytes = kj::decodeHex(hex);
+    KJ_EXPECT(kj::runCatchingExceptions([&]() { decoder.decode(bytes); }) != nullptr, hex);
+  };
+
+  expectInvalid("80");        // index 0
+  expectInvalid("c0");        // dynamic index with empty table
+  expectInvalid("4085");      // truncated string
+  expectInvalid("ff");        // truncated integer
+  expectInvalid("0081ff");    // Huffman padding longer than 7 bits
+  expectInvalid("00810e");    // Huffman padding not all ones
+  expectInvalid("003fe1");    // table size update larger than advertised
+  expectInvalid("823f");      // table size update after a header
+}
+
+KJ_TEST("HPACK enforces the header list size limit while decoding") {
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+
+  // One large header, which also lands in the dynamic table...
+  auto bigValue = kj::heapString(4000);
+  for (auto& c: bigValue) c = 'a';
+  HpackHeader big[] = {{"x-big", bigValue}};
+  auto first = encoder.encode(big);
+  size_t bigSize = 5 + 4000 + 32;
+  KJ_EXPECT(decoder.decode(first, bigSize).size() == 1);
+
+  // ...then a block made only of references to it, which would decode to about 4MB.
+  auto bomb = kj::heapArray<byte>(1000);
+  for (auto& b: bomb) b = 0xbe;  // indexed, dynamic table entry 62
+  KJ_EXPECT_THROW_MESSAGE("HPACK header list exceeds size limit",
+      decoder.decode(bomb, 65536));
+
+  // The limit is inclusive.
+  KJ_EXPECT(decoder.decode(bomb.slice(0, 2), bigSize * 2).size() == 2);
+  KJ_EXPECT_THROW_MESSAGE("HPACK header list exceeds size limit",
+      decoder.decode(bomb.slice(0, 2), bigSize * 2 - 1));
+}
+
+// -----------------------------------------------------------------------------
+// Client and server
+
+class EchoService final: public HttpService {
+  // Responds with the method, URL, `x-test` header, and request body.
+
+public:
+  EchoService(HttpHeaderTable& table, HttpHeaderId testHeader)
+      : table(table), testHeader(testHeader) {}
+
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    ++requestCount;
+    auto prefix = kj::str(method, " ", url, " ", headers.get(testHeader).orDefault("-"), " ",
+        headers.get(HttpHeaderId::HOST).orDefault("-"), " ");
+    return requestBody.readAllText().then([this, prefix = kj::mv(prefix), &response](
+        kj::String body) {
+      auto text = kj::str(prefix, body);
+      HttpHeaders responseHeaders(table);
+      responseHeaders.set(HttpHeaderId::CONTENT_TYPE, "text/plain");
+      responseHeaders.set(testHeader, "response");
+      auto stream = response.send(200, "OK", responseHeaders, text.size());
+      auto promise = stream->write(text.begin(), text.size());
+      return promise.attach(kj::mv(stream), kj::mv(text));
+    });
+  }
+
+  uint requestCount = 0;
+
+private:
+  HttpHeaderTable& table;
+  HttpHeaderId testHeader;
+};
+
+struct Http2TestFixture {
+  kj::EventLoop loop;
+  kj::WaitScope waitScope;
+  kj::TwoWayPipe pipe;
+  HttpHeaderTable::Builder builder;
+  HttpHeaderTable& table;
+  HttpHeaderId testHeader;
+  kj::Own<HttpHeaderTable> ownTable;
+  EchoService echo;
+  kj::Own<HttpClient> client;
+  kj::Promise<void> server = nullptr;
+
+  explicit Http2TestFixture(Http2Settings clientSettings = {},
+                            Http2Settings serverSettings = {},
+                            HttpService* service = nullptr)
+      : waitScope(loop), pipe(kj::newTwoWayPipe()),
+        table(builder.getFutureTable()), testHeader(builder.add("X-Test")),
+        echo(builder.getFutureTable(), testHeader) {
+    ownTable = builder.build();
+    server = serveHttp2(table, service == nullptr ? echo : *service, *pipe.ends[1],
+                        serverSettings).eagerlyEvaluate(nullptr);
+    client = newHttp2Client(table, *pipe.ends[0], clientSettings);
+  }
+
+  kj::String get(kj::StringPtr path, kj::StringPtr testValue = nullptr) {
+    HttpHeaders headers(table);
+    headers.set(HttpHeaderId::HOST, "example.com");
+    if (testValue != nullptr) headers.set(testHeader, testValue);
+    auto response = client->request(HttpMethod::GET, path, headers).response.wait(waitScope);
+    KJ_EXPECT(response.statusCode == 200);
+    KJ_EXPECT(response.statusText == "OK");
+    return response.body->readAllText().wait(waitScope);
+  }
+};
+
+KJ_TEST("HTTP/2 basic requests") {
+  Http2TestFixture fixture;
+
+  KJ_EXPECT(fixture.get("/foo", "bar") == "GET /foo bar example.com ");
+  KJ_EXPECT(fixture.get("/baz") == "GET /baz - example.com ");
+
+  // Absolute URLs supply :scheme and :authority.
+  HttpHeaders headers(fixture.table);
+  auto response = fixture.client->request(HttpMethod::GET, "http://other.example:8080/qux?x=1",
+                                          headers).response.wait(fixture.waitScope);
+  KJ_EXPECT(response.statusCode == 200);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response.headers->get(fixture.testHeader)) == "response");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(response.headers->get(HttpHeaderId::CONTENT_TYPE)) ==
+            "text/plain");
+  KJ_EXPECT(response.body->readAllText().wait(fixture.waitScope) ==
+            "GET /qux?x=1 - other.example:8080 ");
+
+  KJ_EXPECT(fixture.echo.requestCount == 3);
+}
+
+KJ_TEST("HTTP/2 request bodies") {
+  Http2TestFixture fixture;
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  {
+    auto req = fixture.client->request(HttpMethod::POST, "/fixed", headers, uint64_t(5));
+    req.body->write("hello", 5).wait(fixture.waitScope);
+    req.body = nullptr;
+    auto response = req.response.wait(fixture.waitScope);
+    KJ_EXPECT(response.body->readAllText().wait(fixture.waitScope) ==
+              "POST /fixed - example.com hello");
+  }
+
+  {
+    // Unknown length: END_STREAM is sent when the body stream is dropped.
+    auto req = fixture.client->request(HttpMethod::PUT, "/streamed", headers);
+    req.body->write("foo", 3).wait(fixture.waitScope);
+    req.body->write("bar", 3).wait(fixture.waitScope);
+    req.body = nullptr;
+    auto response = req.response.wait(fixture.waitScope);
+    KJ_EXPECT(response.body->readAllText().wait(fixture.waitScope) ==
+              "PUT /streamed - example.com foobar");
+  }
+}
+
+KJ_TEST("HTTP/2 multiplexes concurrent requests") {
+  Http2TestFixture fixture;
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  // Start several uploads at once and finish them in reverse order; each must get its own
+  // response even though they share one connection.
+  kj::Vector<HttpClient::Request> requests;
+  for (auto i: kj::zeroTo(5)) {
+    requests.add(fixture.client->request(HttpMethod::POST, kj::str("/", i), headers));
+    auto text = kj::str("body", i);
+    requests.back().body->write(text.begin(), text.size()).wait(fixture.waitScope);
+  }
+  for (auto i: kj::zeroTo(5)) {
+    requests[4 - i].body = nullptr;
+  }
+  for (auto i: kj::zeroTo(5)) {
+    auto response = requests[i].response.wait(fixture.waitScope);
+    KJ_EXPECT(response.body->readAllText().wait(fixture.waitScope) ==
+              kj::str("POST /", i, " - example.com body", i));
+  }
+}
+
+KJ_TEST("HTTP/2 flow control with bodies larger than the window") {
+  Http2Settings small;
+  small.initialWindowSize = 16384;
+  small.connectionWindowSize = 32768;
+  Http2TestFixture fixture(small, small);
+
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  auto big = kj::heapString(300000);
+  for (auto i: kj::indices(big)) big[i] = 'a' + i % 26;
+
+  auto req = fixture.client->request(HttpMethod::POST, "/big", headers, uint64_t(big.size()));
+  auto writePromise = req.body->write(big.begin(), big.size());
+  auto response = req.response.wait(fixture.waitScope);
+  writePromise.wait(fixture.waitScope);
+  auto text = response.body->readAllText().wait(fixture.waitScope);
+  KJ_EXPECT(text == kj::str("POST /big - example.com ", big));
+}
+
+KJ_TEST("HTTP/2 respects the server's concurrent stream limit") {
+  Http2Settings serverSettings;
+  serverSettings.maxConcurrentStreams = 1;
+  Http2TestFixture fixture({}, serverSettings);
+
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  // Let the client learn the server's settings.
+  KJ_EXPECT(fixture.get("/warmup") == "GET /warmup - example.com ");
+
+  // The second and third requests wait until the first completes. In particular, the second
+  // request's body write can't proceed until its stream has been opened.
+  auto first = fixture.client->request(HttpMethod::POST, "/1", headers);
+  auto second = fixture.client->request(HttpMethod::POST, "/2", headers);
+  auto third = fixture.client->request(HttpMethod::GET, "/3", headers);
+  auto secondWrite = second.body->write("two", 3);
+  KJ_EXPECT(!secondWrite.poll(fixture.waitScope));
+
+  first.body->write("one", 3).wait(fixture.waitScope);
+  first.body = nullptr;
+  secondWrite.wait(fixture.waitScope);
+  second.body = nullptr;
+
+  auto r1 = first.response.wait(fixture.waitScope);
+  KJ_EXPECT(r1.body->readAllText().wait(fixture.waitScope) == "POST /1 - example.com one");
+  auto r2 = second.response.wait(fixture.waitScope);
+  KJ_EXPECT(r2.body->readAllText().wait(fixture.waitScope) == "POST /2 - example.com two");
+  auto r3 = third.response.wait(fixture.waitScope);
+  KJ_EXPECT(r3.body->readAllText().wait(fixture.waitScope) == "GET /3 - example.com ");
+}
+
+class HangingService final: public HttpService {
+  // Never responds; records when its request is canceled.
+
+public:
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    ++started;
+    return kj::Promise<void>(kj::NEVER_DONE).attach(kj::defer([this]() { ++canceled; }));
+  }
+
+  uint started = 0;
+  uint canceled = 0;
+};
+
+KJ_TEST("HTTP/2 canceling a request resets the stream") {
+  HangingService service;
+  Http2TestFixture fixture({}, {}, &service);
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  {
+    auto req = fixture.client->request(HttpMethod::GET, "/", headers);
+    fixture.loop.run();
+    KJ_EXPECT(service.started == 1);
+    KJ_EXPECT(service.canceled == 0);
+  }
+
+  // Dropping the response promise sent RST_STREAM, which cancels the server's handler.
+  fixture.loop.run();
+  KJ_EXPECT(service.canceled == 1);
+}
+
+class ThrowingService final: public HttpService {
+public:
+  kj::Promise<void> request(
+      HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+      kj::AsyncInputStream& requestBody, Response& response) override {
+    if (url == "/silent") return kj::READY_NOW;
+    KJ_FAIL_REQUIRE("oops");
+  }
+};
+
+KJ_TEST("HTTP/2 server reports service errors") {
+  ThrowingService service;
+  Http2TestFixture fixture({}, {}, &service);
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+
+  {
+    auto response = fixture.client->request(HttpMethod::GET, "/throw", headers)
+        .response.wait(fixture.waitScope);
+    KJ_EXPECT(response.statusCode == 500);
+    KJ_EXPECT(response.statusText == "Internal Server Error");
+    auto text = response.body->readAllText().wait(fixture.waitScope);
+    KJ_EXPECT(text.startsWith("ERROR: The server threw an exception."), text);
+  }
+
+  {
+    auto response = fixture.client->request(HttpMethod::GET, "/silent", headers)
+        .response.wait(fixture.waitScope);
+    KJ_EXPECT(response.statusCode == 500);
+    KJ_EXPECT(response.body->readAllText().wait(fixture.waitScope) ==
+              "ERROR: The HttpService did not generate a response.");
+  }
+}
+
+KJ_TEST("HTTP/2 client sees server disconnect") {
+  Http2TestFixture fixture;
+  KJ_EXPECT(fixture.get("/") == "GET / - example.com ");
+
+  HttpHeaders headers(fixture.table);
+  headers.set(HttpHeaderId::HOST, "example.com");
+  fixture.server = nullptr;
+  fixture.pipe.ends[1] = nullptr;
+
+  auto req = fixture.client->request(HttpMethod::GET, "/", headers);
+  KJ_EXPECT_THROW(DISCONNECTED, req.response.wait(fixture.waitScope));
+}
+
+}  // namespace
+}  // namespace kj
@@ -0,0 +1,2328 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "http2.h"
+#include "url.h"
+#include <kj/debug.h>
+#include <kj/map.h>
+#include <string.h>
+#include <stdlib.h>
+#include <deque>
+
+namespace kj {
+
+namespace _ {  // private
+
+// =======================================================================================
+// HPACK (RFC 7541)
+
+namespace {
+
+struct HuffmanCode {
+  uint32_t code;
+  uint8_t bits;
+};
+
+constexpr HuffmanCode HUFFMAN_CODES[257] = {
+  // RFC 7541 Appendix B. Codes are right-aligned in `code`. Symbol 256 is EOS.
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+  { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+  { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+  { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+  { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+  { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+  { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+  { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+  { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+  { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+  { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+  { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+  { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+  { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+  { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+  { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+  { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+  { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+  { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+  { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+  { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+  { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+  { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+  { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+  { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+  { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+  { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+  { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+  { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+  { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+  { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+  { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+  { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+  { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+  { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+  { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+  { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+  { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+  { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+  { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+  { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+  { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+  { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+  { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+  { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+  { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+  { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+  { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+  { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+  { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+  { 0x3fffffff, 30 },
+};
+
+class HuffmanDecodeTree {
+  // Binary tree mapping Huffman codes back to symbols, built once from HUFFMAN_CODES. Each node
+  // holds two children; a child with the LEAF bit set is a symbol, otherwise it is the index of
+  // another node. Node 0 is the root; since the root is never anyone's child, 0 also serves as
+  // "no child".
+
+public:
+  static constexpr uint16_t LEAF = 0x8000;
+
+  HuffmanDecodeTree() {
+    memset(nodes, 0, sizeof(nodes));
+    uint16_t nodeCount = 1;
+    for (uint16_t symbol = 0; symbol < 257; symbol++) {
+      auto& code = HUFFMAN_CODES[symbol];
+      uint16_t node = 0;
+      for (int bit = code.bits - 1; bit > 0; bit--) {
+        uint16_t& child = nodes[node][(code.code >> bit) & 1];
+        if (child == 0) child = nodeCount++;
+        node = child;
+      }
+      nodes[node][code.code & 1] = LEAF | symbol;
+    }
+    KJ_ASSERT(nodeCount == 256);
+  }
+
+  inline uint16_t child(uint16_t node, uint bit) const { return nodes[node][bit]; }
+
+private:
+  uint16_t nodes[256][2];
+};
+
+const HuffmanDecodeTree& getHuffmanDecodeTree() {
+  static const HuffmanDecodeTree tree;
+  return tree;
+}
+
+size_t huffmanEncodedSize(kj::StringPtr text) {
+  uint64_t bits = 0;
+  for (byte c: text.asBytes()) bits += HUFFMAN_CODES[c].bits;
+  return (bits + 7) / 8;
+}
+
+void huffmanEncode(kj::Vector<byte>& out, kj::StringPtr text) {
+  uint64_t acc = 0;
+  uint accBits = 0;
+  for (byte c: text.asBytes()) {
+    auto& code = HUFFMAN_CODES[c];
+    acc = (acc << code.bits) | code.code;
+    accBits += code.bits;
+    while (accBits >= 8) {
+      accBits -= 8;
+      out.add(static_cast<byte>(acc >> accBits));
+    }
+  }
+  if (accBits > 0) {
+    // Pad with the most significant bits of EOS, i.e. all ones.
+    out.add(static_cast<byte>((acc << (8 - accBits)) | (0xff >> accBits)));
+  }
+}
+
+kj::String huffmanDecode(kj::ArrayPtr<const byte> input) {
+  auto& tree = getHuffmanDecodeTree();
+  kj::Vector<char> result(input.size() * 8 / 5 + 1);
+
+  uint16_t node = 0;
+  uint bitsSinceSymbol = 0;
+  bool allOnes = true;
+  for (byte b: input) {
+    for (int i = 7; i >= 0; i--) {
+      uint bit = (b >> i) & 1;
+      uint16_t next = tree.child(node, bit);
+      ++bitsSinceSymbol;
+      allOnes = allOnes && bit;
+      if (next & HuffmanDecodeTree::LEAF) {
+        uint16_t symbol = next & ~HuffmanDecodeTree::LEAF;
+        KJ_REQUIRE(symbol != 256, "HPACK string contains EOS symbol");
+        result.add(static_cast<char>(symbol));
+        node = 0;
+        bitsSinceSymbol = 0;
+        allOnes = true;
+      } else {
+        node = next;
+      }
+    }
+  }
+
+  // Any trailing partial code must be fewer than 8 bits of the EOS prefix (all ones).
+  KJ_REQUIRE(bitsSinceSymbol < 8 && allOnes, "invalid HPACK Huffman padding");
+
+  result.add('\0');
+  return kj::String(result.releaseAsArray());
+}
+
+const HpackHeader STATIC_TABLE[61] = {
+  // RFC 7541 Appendix A. Entries with the same name are adjacent, which encoding relies on.
+  { ":authority"_kj, ""_kj },
+  { ":method"_kj, "GET"_kj },
+  { ":method"_kj, "POST"_kj },
+  { ":path"_kj, "/"_kj },
+  { ":path"_kj, "/index.html"_kj },
+  { ":scheme"_kj, "http"_kj },
+  { ":scheme"_kj, "https"_kj },
+  { ":status"_kj, "200"_kj },
+  { ":status"_kj, "204"_kj },
+  { ":status"_kj, "206"_kj },
+  { ":status"_kj, "304"_kj },
+  { ":status"_kj, "400"_kj },
+  { ":status"_kj, "404"_kj },
+  { ":status"_kj, "500"_kj },
+  { "accept-charset"_kj, ""_kj },
+  { "accept-encoding"_kj, "gzip, deflate"_kj },
+  { "accept-language"_kj, ""_kj },
+  { "accept-ranges"_kj, ""_kj },
+  { "accept"_kj, ""_kj },
+  { "access-control-allow-origin"_kj, ""_kj },
+  { "age"_kj, ""_kj },
+  { "allow"_kj, ""_kj },
+  { "authorization"_kj, ""_kj },
+  { "cache-control"_kj, ""_kj },
+  { "content-disposition"_kj, ""_kj },
+  { "content-encoding"_kj, ""_kj },
+  { "content-language"_kj, ""_kj },
+  { "content-length"_kj, ""_kj },
+  { "content-location"_kj, ""_kj },
+  { "content-range"_kj, ""_kj },
+  { "content-type"_kj, ""_kj },
+  { "cookie"_kj, ""_kj },
+  { "date"_kj, ""_kj },
+  { "etag"_kj, ""_kj },
+  { "expect"_kj, ""_kj },
+  { "expires"_kj, ""_kj },
+  { "from"_kj, ""_kj },
+  { "host"_kj, ""_kj },
+  { "if-match"_kj, ""_kj },
+  { "if-modified-since"_kj, ""_kj },
+  { "if-none-match"_kj, ""_kj },
+  { "if-range"_kj, ""_kj },
+  { "if-unmodified-since"_kj, ""_kj },
+  { "last-modified"_kj, ""_kj },
+  { "link"_kj, ""_kj },
+  { "location"_kj, ""_kj },
+  { "max-forwards"_kj, ""_kj },
+  { "proxy-authenticate"_kj, ""_kj },
+  { "proxy-authorization"_kj, ""_kj },
+  { "range"_kj, ""_kj },
+  { "referer"_kj, ""_kj },
+  { "refresh"_kj, ""_kj },
+  { "retry-after"_kj, ""_kj },
+  { "server"_kj, ""_kj },
+  { "set-cookie"_kj, ""_kj },
+  { "strict-transport-security"_kj, ""_kj },
+  { "transfer-encoding"_kj, ""_kj },
+  { "user-agent"_kj, ""_kj },
+  { "vary"_kj, ""_kj },
+  { "via"_kj, ""_kj },
+  { "www-authenticate"_kj, ""_kj },
+};
+
+constexpr size_t ENTRY_OVERHEAD = 32;
+// Per RFC 7541 section 4.1, an entry's size is its name and value lengths plus 32.
+
+kj::Maybe<uint> findStaticName(kj::StringPtr name) {
+  // Returns the 1-based index of the first static table entry with the given name.
+
+  struct Index {
+    kj::HashMap<kj::StringPtr, uint> map;
+    Index() {
+      for (uint i = 1; i <= 61; i++) {
+        if (map.find(STATIC_TABLE[i - 1].name) == nullptr) map.insert(STATIC_TABLE[i - 1].name, i);
+      }
+    }
+  };
+  static const Index index;
+  KJ_IF_MAYBE(i, index.map.find(name)) {
+    return *i;
+  } else {
+    return nullptr;
+  }
+}
+
+void encodeInteger(kj::Vector<byte>& out, byte flags, uint prefixBits, uint64_t value) {
+  uint max = (1u << prefixBits) - 1;
+  if (value < max) {
+    out.add(flags | static_cast<byte>(value));
+    return;
+  }
+  out.add(flags | static_cast<byte>(max));
+  value -= max;
+  while (value >= 0x80) {
+    out.add(static_cast<byte>(value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out.add(static_cast<byte>(value));
+}
+
+void encodeString(kj::Vector<byte>& out, kj::StringPtr text) {
+  size_t huffmanSize = huffmanEncodedSize(text);
+  if (huffmanSize <= text.size()) {
+    encodeInteger(out, 0x80, 7, huffmanSize);
+    huffmanEncode(out, text);
+  } else {
+    encodeInteger(out, 0x00, 7, text.size());
+    out.addAll(text.asBytes());
+  }
+}
+
+class HpackReader {
+public:
+  explicit HpackReader(kj::ArrayPtr<const byte> input): pos(input.begin()), end(input.end()) {}
+
+  bool atEnd() const { return pos == end; }
+  byte peek() const { return *pos; }
+
+  uint64_t readInteger(uint prefixBits) {
+    KJ_REQUIRE(pos < end, "truncated HPACK integer");
+    uint max = (1u << prefixBits) - 1;
+    uint64_t value = *pos++ & max;
+    if (value < max) return value;
+
+    for (uint shift = 0;; shift += 7) {
+      KJ_REQUIRE(pos < end, "truncated HPACK integer");
+      KJ_REQUIRE(shift <= 28, "HPACK integer too large");
+      byte b = *pos++;
+      value += static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) return value;
+    }
+  }
+
+  kj::String readString() {
+    KJ_REQUIRE(pos < end, "truncated HPACK string");
+    bool huffman = *pos & 0x80;
+    uint64_t size = readInteger(7);
+    KJ_REQUIRE(size <= end - pos, "truncated HPACK string");
+    auto bytes = kj::arrayPtr(pos, size);
+    pos += size;
+    if (huffman) {
+      return huffmanDecode(bytes);
+    } else {
+      return kj::heapString(bytes.asChars());
+    }
+  }
+
+private:
+  const byte* pos;
+  const byte* end;
+};
+
+}  // namespace
+
+void HpackDynamicTable::add(kj::String name, kj::String value) {
+  bytes += name.size() + value.size() + ENTRY_OVERHEAD;
+  entries.add(Entry { kj::mv(name), kj::mv(value) });
+}
+
+void HpackDynamicTable::evictTo(size_t limit) {
+  while (bytes > limit) {
+    auto& entry = entries[head++];
+    bytes -= entry.name.size() + entry.value.size() + ENTRY_OVERHEAD;
+    entry.name = nullptr;
+    entry.value = nullptr;
+  }
+
+  // Compact once the evicted prefix dominates, so that the vector doesn't grow without bound.
+  if (head > 16 && head * 2 >= entries.size()) {
+    kj::Vector<Entry> compacted(entries.size() - head);
+    for (auto i: kj::range(head, entries.size())) {
+      compacted.add(kj::mv(entries[i]));
+    }
+    entries = kj::mv(compacted);
+    head = 0;
+  }
+}
+
+HpackEncoder::HpackEncoder(size_t maxTableSize): maxTableSize(maxTableSize) {}
+
+void HpackEncoder::setMaxTableSize(size_t size) {
+  if (size == maxTableSize && pendingSizeUpdate == nullptr) return;
+  maxTableSize = size;
+  pendingSizeUpdate = size;
+  minPendingSize = kj::min(minPendingSize, size);
+  table.evictTo(size);
+}
+
+kj::Array<byte> HpackEncoder::encode(kj::ArrayPtr<const HpackHeader> headers) {
+  kj::Vector<byte> out;
+
+  KJ_IF_MAYBE(size, pendingSizeUpdate) {
+    // If the size was lowered and raised again since the last block, the decoder must see the
+    // minimum first so that it evicts the same entries we did.
+    if (minPendingSize < *size) encodeInteger(out, 0x20, 5, minPendingSize);
+    encodeInteger(out, 0x20, 5, *size);
+    pendingSizeUpdate = nullptr;
+    minPendingSize = kj::maxValue;
+  }
+
+  for (auto& header: headers) {
+    // Credentials are never added to the table, and are marked so that intermediaries won't
+    // add them either, to avoid leaking them through compression side channels (CRIME).
+    bool sensitive = header.name == "authorization" || header.name == "proxy-authorization";
+
+    uint nameIndex = 0;
+    bool found = false;
+
+    KJ_IF_MAYBE(first, findStaticName(header.name)) {
+      nameIndex = *first;
+      if (!sensitive) {
+        for (uint i = *first; i <= 61 && STATIC_TABLE[i - 1].name == header.name; i++) {
+          if (STATIC_TABLE[i - 1].value == header.value) {
+            encodeInteger(out, 0x80, 7, i);
+            found = true;
+            break;
+          }
+        }
+      }
+    }
+    if (found) continue;
+
+    for (auto i: kj::zeroTo(table.size())) {
+      auto& entry = table[i];
+      if (entry.name == header.name) {
+        if (!sensitive && entry.value == header.value) {
+          encodeInteger(out, 0x80, 7, 62 + i);
+          found = true;
+          break;
+        }
+        if (nameIndex == 0) nameIndex = 62 + i;
+      }
+    }
+    if (found) continue;
+
+    size_t entrySize = header.name.size() + header.value.size() + ENTRY_OVERHEAD;
+    if (sensitive) {
+      encodeInteger(out, 0x10, 4, nameIndex);
+    } else if (entrySize > maxTableSize) {
+      encodeInteger(out, 0x00, 4, nameIndex);
+    } else {
+      encodeInteger(out, 0x40, 6, nameIndex);
+      table.evictTo(maxTableSize - entrySize);
+      table.add(kj::heapString(header.name), kj::heapString(header.value));
+    }
+    if (nameIndex == 0) encodeString(out, header.name);
+    encodeString(out, header.value);
+  }
+
+  return out.releaseAsArray();
+}
+
+HpackDecoder::HpackDecoder(size_t maxTableSize)
+    : tableLimit(maxTableSize), maxTableSize(maxTableSize) {}
+
+void HpackDecoder::setMaxTableSize(size_t size) {
+  maxTableSize = size;
+  if (tableLimit > size) {
+    tableLimit = size;
+    table.evictTo(size);
+  }
+}
+
+kj::Array<HpackDecoder::Header> HpackDecoder::decode(
+    kj::ArrayPtr<const byte> block, size_t maxListSize) {
+  HpackReader reader(block);
+  kj::Vector<Header> result;
+  size_t listSize = 0;
+
+  auto addHeader = [&](kj::String name, kj::String value) {
+    listSize += name.size() + value.size() + ENTRY_OVERHEAD;
+    KJ_REQUIRE(listSize <= maxListSize, "HPACK header list exceeds size limit", maxListSize);
+    result.add(Header { kj::mv(name), kj::mv(value) });
+  };
+
+  auto lookup = [&](uint64_t index) -> HpackHeader {
+    KJ_REQUIRE(index > 0, "HPACK index 0 is invalid");
+    if (index <= 61) return STATIC_TABLE[index - 1];
+    index -= 62;
+    KJ_REQUIRE(index < table.size(), "HPACK index out of range");
+    auto& entry = table[index];
+    return { entry.name, entry.value };
+  };
+
+  while (!reader.atEnd()) {
+    byte b = reader.peek();
+    if (b & 0x80) {
+      // Indexed header field.
+      auto entry = lookup(reader.readInteger(7));
+      addHeader(kj::heapString(entry.name), kj::heapString(entry.value));
+    } else if ((b & 0xe0) == 0x20) {
+      // Dynamic table size update. These may only appear at the start of a block.
+      KJ_REQUIRE(result.size() == 0, "HPACK table size update after header field");
+      uint64_t size = reader.readInteger(5);
+      KJ_REQUIRE(size <= maxTableSize, "HPACK table size update exceeds advertised limit");
+      tableLimit = size;
+      table.evictTo(size);
+    } else {
+      // Literal header field, with incremental indexing (01xxxxxx), without indexing (0000xxxx),
+      // or never indexed (0001xxxx).
+      bool index = (b & 0xc0) == 0x40;
+      uint64_t nameIndex = reader.readInteger(index ? 6 : 4);
+      kj::String name = nameIndex == 0 ? reader.readString()
+                                       : kj::heapString(lookup(nameIndex).name);
+      kj::String value = reader.readString();
+
+      if (index) {
+        size_t entrySize = name.size() + value.size() + ENTRY_OVERHEAD;
+        if (entrySize > tableLimit) {
+          // Per RFC 7541 section 4.4, an oversized entry empties the table.
+          table.evictTo(0);
+        } else {
+          table.evictTo(tableLimit - entrySize);
+          table.add(kj::heapString(name), kj::heapString(value));
+        }
+      }
+      addHeader(kj::mv(name), kj::mv(value));
+    }
+  }
+
+  return result.releaseAsArray();
+}
+
+}  // namespace _ (private)
+
+// =======================================================================================
+// HTTP/2 framing (RFC 7540)
+
+namespace {
+
+using _::HpackHeader;
+using _::HpackEncoder;
+using _::HpackDecoder;
+
+enum class FrameType: uint8_t {
+  DATA = 0x0,
+  HEADERS = 0x1,
+  PRIORITY = 0x2,
+  RST_STREAM = 0x3,
+  SETTINGS = 0x4,
+  PUSH_PROMISE = 0x5,
+  PING = 0x6,
+  GOAWAY = 0x7,
+  WINDOW_UPDATE = 0x8,
+  CONTINUATION = 0x9,
+};
+
+constexpr byte FLAG_END_STREAM = 0x01;
+constexpr byte FLAG_ACK = 0x01;
+constexpr byte FLAG_END_HEADERS = 0x04;
+constexpr byte FLAG_PADDED = 0x08;
+constexpr byte FLAG_PRIORITY = 0x20;
+
+enum class ErrorCode: uint32_t {
+  NO_ERROR = 0x0,
+  PROTOCOL_ERROR = 0x1,
+  INTERNAL_ERROR = 0x2,
+  FLOW_CONTROL_ERROR = 0x3,
+  SETTINGS_TIMEOUT = 0x4,
+  STREAM_CLOSED = 0x5,
+  FRAME_SIZE_ERROR = 0x6,
+  REFUSED_STREAM = 0x7,
+  CANCEL = 0x8,
+  COMPRESSION_ERROR = 0x9,
+  CONNECT_ERROR = 0xa,
+  ENHANCE_YOUR_CALM = 0xb,
+  INADEQUATE_SECURITY = 0xc,
+  HTTP_1_1_REQUIRED = 0xd,
+};
+
+enum class SettingId: uint16_t {
+  HEADER_TABLE_SIZE = 0x1,
+  ENABLE_PUSH = 0x2,
+  MAX_CONCURRENT_STREAMS = 0x3,
+  INITIAL_WINDOW_SIZE = 0x4,
+  MAX_FRAME_SIZE = 0x5,
+  MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+constexpr size_t FRAME_HEADER_SIZE = 9;
+constexpr int64_t DEFAULT_WINDOW_SIZE = 65535;
+constexpr int64_t MAX_WINDOW_SIZE = 0x7fffffff;
+constexpr uint32_t DEFAULT_MAX_FRAME_SIZE = 16384;
+constexpr uint32_t MAX_MAX_FRAME_SIZE = (1u << 24) - 1;
+constexpr size_t MAX_ENCODER_TABLE_SIZE = 4096;
+// We never let our HPACK encoder use more memory than this, whatever the peer allows.
+
+constexpr auto CONNECTION_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"_kj;
+
+inline uint32_t readBE32(const byte* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+inline void writeBE32(byte* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+kj::StringPtr reasonPhrase(uint statusCode) {
+  // HTTP/2 has no reason phrase on the wire, but HttpClient::Response promises a status text.
+  switch (statusCode) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return "";
+  }
+}
+
+bool isConnectionSpecificHeader(kj::StringPtr lowerName) {
+  // Headers that are meaningful only to an HTTP/1.1 hop and must not appear in HTTP/2
+  // (RFC 7540 section 8.1.2.2). `host` is replaced by the `:authority` pseudo-header.
+  return lowerName == "connection" || lowerName == "keep-alive" ||
+         lowerName == "proxy-connection" || lowerName == "transfer-encoding" ||
+         lowerName == "upgrade" || lowerName == "te" || lowerName == "host";
+}
+
+bool isValidLowerCaseHeaderName(kj::StringPtr name) {
+  if (name.size() == 0) return false;
+  for (char c: name) {
+    if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) continue;
+    switch (c) {
+      case '!': case '#': case '$': case '%': case '&': case '\'': case '*': case '+':
+      case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        continue;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+kj::String toLower(kj::StringPtr text) {
+  auto result = kj::heapString(text);
+  for (char& c: result) {
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+  }
+  return result;
+}
+
+bool hasUpperCase(kj::StringPtr text) {
+  for (char c: text) {
+    if (c >= 'A' && c <= 'Z') return true;
+  }
+  return false;
+}
+
+kj::Maybe<uint64_t> parseContentLength(const HttpHeaders& headers) {
+  KJ_IF_MAYBE(value, headers.get(HttpHeaderId::CONTENT_LENGTH)) {
+    char* end;
+    uint64_t result = strtoull(value->cStr(), &end, 10);
+    if (value->size() > 0 && *end == '\0') return result;
+  }
+  return nullptr;
+}
+
+struct ReceivedHeaders {
+  // A decoded header block, plus an HttpHeaders referencing its strings.
+
+  kj::Array<HpackDecoder::Header> fields;
+  HttpHeaders headers;
+
+  struct {
+    kj::Maybe<kj::StringPtr> method;
+    kj::Maybe<kj::StringPtr> scheme;
+    kj::Maybe<kj::StringPtr> authority;
+    kj::Maybe<kj::StringPtr> path;
+    kj::Maybe<kj::StringPtr> status;
+  } pseudo;
+
+  ReceivedHeaders(const HttpHeaderTable& table, kj::Array<HpackDecoder::Header> fields)
+      : fields(kj::mv(fields)), headers(table) {}
+
+  kj::Maybe<kj::StringPtr> parse(bool isRequest) {
+    // Validates the block and fills in `headers` and `pseudo`. Returns an error description if
+    // the block is malformed (RFC 7540 section 8.1.2), which is a stream error.
+
+    bool sawRegular = false;
+    for (auto& field: fields) {
+      if (field.name.startsWith(":")) {
+        if (sawRegular) return "pseudo-header after regular header"_kj;
+        kj::Maybe<kj::StringPtr>* slot;
+        if (isRequest) {
+          if (field.name == ":method") {
+            slot = &pseudo.method;
+          } else if (field.name == ":scheme") {
+            slot = &pseudo.scheme;
+          } else if (field.name == ":authority") {
+            slot = &pseudo.authority;
+          } else if (field.name == ":path") {
+            slot = &pseudo.path;
+          } else {
+            return "unknown request pseudo-header"_kj;
+          }
+        } else {
+          if (field.name == ":status") {
+            slot = &pseudo.status;
+          } else {
+            return "unknown response pseudo-header"_kj;
+          }
+        }
+        if (*slot != nullptr) return "duplicate pseudo-header"_kj;
+        *slot = field.value.asPtr();
+      } else {
+        sawRegular = true;
+        if (!isValidLowerCaseHeaderName(field.name)) return "invalid header name"_kj;
+        if (!HttpHeaders::isValidHeaderValue(field.value)) return "invalid header value"_kj;
+        if (field.name == "te") {
+          if (field.value != "trailers") return "invalid TE header"_kj;
+        } else if (field.name != "host" && isConnectionSpecificHeader(field.name)) {
+          return "connection-specific header in HTTP/2"_kj;
+        }
+        headers.add(field.name.asPtr(), field.value.asPtr());
+      }
+    }
+
+    if (isRequest) {
+      KJ_IF_MAYBE(m, pseudo.method) {
+        if (*m == "CONNECT") return nullptr;
+      } else {
+        return "missing :method"_kj;
+      }
+      if (pseudo.scheme == nullptr || pseudo.path == nullptr) {
+        return "missing :scheme or :path"_kj;
+      }
+    } else {
+      if (pseudo.status == nullptr) return "missing :status"_kj;
+    }
+    return nullptr;
+  }
+};
+
+class Http2Connection;
+
+class Http2Stream final: public kj::Refcounted {
+  // State of one HTTP/2 stream. Shared by the connection (while the stream is open) and by the
+  // request/response body objects handed to the application, which may outlive both the stream
+  // and the connection.
+
+public:
+  explicit Http2Stream(Http2Connection& conn, int64_t sendWindow, int64_t recvWindow);
+  ~Http2Stream() noexcept(false);
+
+  Http2Connection* conn;
+  // Null once the connection has been destroyed.
+
+  kj::ListLink<Http2Stream> link;
+
+  uint32_t id = 0;
+  // Zero until the stream is actually opened (a client stream may wait for the server's
+  // concurrency limit).
+
+  bool registered = false;        // present in the connection's stream map
+  bool localClosed = false;       // we sent END_STREAM or RST_STREAM
+  bool remoteClosed = false;      // peer sent END_STREAM or RST_STREAM, or we reset
+  bool endStreamReceived = false; // peer sent END_STREAM; body reads return EOF after the queue
+  bool canceled = false;          // reset before being opened
+  bool endPending = false;        // body finished before the stream was opened
+  bool writerActive = false;
+  kj::Maybe<kj::Exception> error;
+
+  // Receive side.
+  kj::Vector<kj::Array<byte>> recvQueue;
+  size_t recvQueueHead = 0;
+  size_t recvOffset = 0;
+  int64_t recvWindow;
+  size_t recvUnacked = 0;
+  bool bodyAbandoned = false;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> readWaiter;
+
+  // Send side.
+  int64_t sendWindow;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> openWaiter;
+
+  // Client side.
+  HttpMethod method = HttpMethod::GET;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<HttpClient::Response>>> responseFulfiller;
+  bool responseDelivered = false;
+
+  // Server side.
+  kj::Canceler canceler;
+
+  size_t takeData(byte* buffer, size_t maxBytes) {
+    size_t total = 0;
+    while (total < maxBytes && recvQueueHead < recvQueue.size()) {
+      auto& chunk = recvQueue[recvQueueHead];
+      size_t n = kj::min(chunk.size() - recvOffset, maxBytes - total);
+      memcpy(buffer + total, chunk.begin() + recvOffset, n);
+      total += n;
+      recvOffset += n;
+      if (recvOffset == chunk.size()) {
+        chunk = nullptr;
+        ++recvQueueHead;
+        recvOffset = 0;
+      }
+    }
+    if (recvQueueHead == recvQueue.size()) {
+      recvQueue.clear();
+      recvQueueHead = 0;
+    }
+    return total;
+  }
+
+  size_t discardData() {
+    size_t total = 0;
+    for (auto i: kj::range(recvQueueHead, recvQueue.size())) {
+      total += recvQueue[i].size();
+    }
+    total -= recvOffset;
+    recvQueue.clear();
+    recvQueueHead = 0;
+    recvOffset = 0;
+    return total;
+  }
+
+  bool hasData() const { return recvQueueHead < recvQueue.size(); }
+
+  void wakeReader() {
+    KJ_IF_MAYBE(f, readWaiter) {
+      f->get()->fulfill();
+      readWaiter = nullptr;
+    }
+  }
+
+  void fail(kj::Exception&& exception) {
+    KJ_IF_MAYBE(f, readWaiter) {
+      f->get()->reject(kj::cp(exception));
+      readWaiter = nullptr;
+    }
+    KJ_IF_MAYBE(f, openWaiter) {
+      f->get()->reject(kj::cp(exception));
+      openWaiter = nullptr;
+    }
+    KJ_IF_MAYBE(f, responseFulfiller) {
+      f->get()->reject(kj::cp(exception));
+      responseFulfiller = nullptr;
+    }
+    if (error == nullptr) error = kj::mv(exception);
+  }
+};
+
+class Http2InputStream final: public kj::AsyncInputStream {
+  // Body of a request (server side) or response (client side).
+
+public:
+  Http2InputStream(kj::Own<Http2Stream> stream, kj::Maybe<uint64_t> length)
+      : stream(kj::mv(stream)), remaining(length) {}
+  ~Http2InputStream() noexcept(false);
+
+  kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    return readImpl(reinterpret_cast<byte*>(buffer), minBytes, maxBytes, 0);
+  }
+
+  kj::Maybe<uint64_t> tryGetLength() override { return remaining; }
+
+private:
+  kj::Own<Http2Stream> stream;
+  kj::Maybe<uint64_t> remaining;
+
+  kj::Promise<size_t> readImpl(byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead);
+};
+
+class Http2OutputStream final: public kj::AsyncOutputStream {
+  // Body of a request (client side) or response (server side). Dropping it ends the stream.
+
+public:
+  Http2OutputStream(kj::Own<Http2Stream> stream, kj::Maybe<uint64_t> length)
+      : stream(kj::mv(stream)), remaining(length) {
+    this->stream->writerActive = true;
+  }
+  ~Http2OutputStream() noexcept(false);
+
+  kj::Promise<void> write(const void* buffer, size_t size) override;
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override;
+  kj::Promise<void> whenWriteDisconnected() override;
+
+private:
+  kj::Own<Http2Stream> stream;
+  kj::Maybe<uint64_t> remaining;
+  bool inWrite = false;
+  kj::UnwindDetector unwind;
+};
+
+class Http2NullOutputStream final: public kj::AsyncOutputStream {
+  // Body of a message that was sent with END_STREAM on its headers. For a HEAD response, writes
+  // are silently discarded, like HttpServer does for HTTP/1.1.
+
+public:
+  explicit Http2NullOutputStream(bool discard = false): discard(discard) {}
+
+  kj::Promise<void> write(const void* buffer, size_t size) override {
+    KJ_REQUIRE(discard || size == 0, "HTTP message has no body");
+    return kj::READY_NOW;
+  }
+  kj::Promise<void> write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) override {
+    for (auto& piece: pieces) KJ_REQUIRE(discard || piece.size() == 0, "HTTP message has no body");
+    return kj::READY_NOW;
+  }
+  kj::Promise<void> whenWriteDisconnected() override { return kj::NEVER_DONE; }
+
+private:
+  bool discard;
+};
+
+class Http2Connection final: private kj::TaskSet::ErrorHandler {
+  // One HTTP/2 connection, in either the client or the server role.
+
+public:
+  Http2Connection(kj::AsyncIoStream& stream, const HttpHeaderTable& table,
+                  Http2Settings settings, bool isClient)
+      : stream(stream), table(table), localSettings(settings), isClient(isClient),
+        encoder(4096), decoder(settings.headerTableSize),
+        connRecvWindow(DEFAULT_WINDOW_SIZE),
+        nextStreamId(isClient ? 1 : 2),
+        readBuffer(kj::heapArray<byte>(
+            kj::max<size_t>(FRAME_HEADER_SIZE + settings.maxFrameSize, 32768))),
+        tasks(*this) {
+    KJ_REQUIRE(settings.maxFrameSize >= DEFAULT_MAX_FRAME_SIZE &&
+               settings.maxFrameSize <= MAX_MAX_FRAME_SIZE,
+               "Http2Settings::maxFrameSize out of range", settings.maxFrameSize);
+    KJ_REQUIRE(settings.initialWindowSize <= MAX_WINDOW_SIZE &&
+               settings.connectionWindowSize <= MAX_WINDOW_SIZE,
+               "Http2Settings window size too large");
+
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    disconnectPromise = paf.promise.fork();
+    disconnectFulfiller = kj::mv(paf.fulfiller);
+    auto failurePaf = kj::newPromiseAndFulfiller<void>();
+    failurePromise = kj::mv(failurePaf.promise);
+    failureFulfiller = kj::mv(failurePaf.fulfiller);
+
+    if (isClient) sendBuffer.addAll(CONNECTION_PREFACE.asBytes());
+    sendSettings();
+  }
+
+  ~Http2Connection() noexcept(false) {
+    unwind.catchExceptionsIfUnwinding([&]() {
+      failAll(KJ_EXCEPTION(DISCONNECTED, "HTTP/2 connection destroyed"));
+    });
+    for (auto& s: streamList) {
+      s.conn = nullptr;
+      streamList.remove(s);
+    }
+  }
+
+  void startClient() {
+    tasks.add(readLoop().exclusiveJoin(kj::mv(failurePromise))
+        .then([this]() -> kj::Promise<void> {
+      failAll(KJ_EXCEPTION(DISCONNECTED, "HTTP/2 server closed connection"));
+      return kj::READY_NOW;
+    }, [this](kj::Exception&& e) {
+      return abortConnection(kj::mv(e));
+    }));
+  }
+
+  kj::Promise<void> serve(HttpService& svc) {
+    service = svc;
+    return fill(CONNECTION_PREFACE.size()).then([this](bool ok) -> kj::Promise<void> {
+      if (!ok) {
+        // Client connected and went away without saying anything.
+        return kj::READY_NOW;
+      }
+      if (kj::arrayPtr(readBuffer.begin() + readStart, CONNECTION_PREFACE.size()) !=
+          CONNECTION_PREFACE.asBytes()) {
+        protocolError(ErrorCode::PROTOCOL_ERROR, "invalid HTTP/2 connection preface");
+      }
+      readStart += CONNECTION_PREFACE.size();
+      return readLoop();
+    }).exclusiveJoin(kj::mv(failurePromise)).then([this]() -> kj::Promise<void> {
+      failAll(KJ_EXCEPTION(DISCONNECTED, "HTTP/2 client closed connection"));
+      return kj::READY_NOW;
+    }, [this](kj::Exception&& e) {
+      return abortConnection(kj::mv(e));
+    });
+  }
+
+  HttpClient::Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+                              kj::Maybe<uint64_t> expectedBodySize);
+
+  // ---------------------------------------------------------------------------
+  // Called by streams.
+
+  kj::Promise<void> writeData(Http2Stream& s, const byte* data, size_t size, bool endStream) {
+    // Sends body data, waiting for flow control credit as needed. If `endStream` is true, the
+    // last frame carries END_STREAM.
+
+    KJ_IF_MAYBE(e, s.error) {
+      return kj::cp(*e);
+    }
+    KJ_REQUIRE(!s.localClosed, "HTTP/2 stream already closed");
+
+    if (s.id == 0) {
+      // Not opened yet; the opener will wake us.
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      s.openWaiter = kj::mv(paf.fulfiller);
+      return paf.promise.then([this, &s, data, size, endStream]() {
+        return writeData(s, data, size, endStream);
+      });
+    }
+
+    while (size > 0) {
+      int64_t avail = kj::min(kj::min(s.sendWindow, connSendWindow), int64_t(peerMaxFrameSize));
+      if (avail <= 0) {
+        auto paf = kj::newPromiseAndFulfiller<void>();
+        windowWaiters.add(kj::mv(paf.fulfiller));
+        return paf.promise.then([this, &s, data, size, endStream]() {
+          return writeData(s, data, size, endStream);
+        });
+      }
+      size_t n = kj::min(size, size_t(avail));
+      byte flags = endStream && n == size ? FLAG_END_STREAM : 0;
+      queueFrame(FrameType::DATA, flags, s.id, kj::arrayPtr(data, n));
+      s.sendWindow -= n;
+      connSendWindow -= n;
+      data += n;
+      size -= n;
+    }
+
+    auto result = whenFlushed();
+    if (endStream) {
+      s.localClosed = true;
+      retireIfClosed(s);
+    }
+    return result;
+  }
+
+  void endStream(Http2Stream& s) {
+    if (s.error != nullptr || s.localClosed) return;
+    if (s.id == 0) {
+      s.endPending = true;
+      return;
+    }
+    queueFrame(FrameType::DATA, FLAG_END_STREAM, s.id, nullptr);
+    s.localClosed = true;
+    retireIfClosed(s);
+  }
+
+  void resetStream(Http2Stream& s, ErrorCode code, kj::StringPtr reason) {
+    if (s.localClosed && s.remoteClosed) return;
+    if (s.id == 0) {
+      s.canceled = true;
+    } else if (failure == nullptr) {
+      queueRstStream(s.id, code);
+    }
+    s.localClosed = true;
+    s.remoteClosed = true;
+    auto type = code == ErrorCode::CANCEL ? kj::Exception::Type::DISCONNECTED
+                                          : kj::Exception::Type::FAILED;
+    s.fail(kj::Exception(type, __FILE__, __LINE__,
+        kj::str("HTTP/2 stream reset (", static_cast<uint32_t>(code), "): ", reason)));
+    retireIfClosed(s);
+  }
+
+  void consumed(Http2Stream& s, size_t n) {
+    // Called when the application has read `n` bytes of body data; extends the receive windows.
+    if (failure != nullptr || n == 0) return;
+    creditConnection(n);
+    if (s.id != 0 && !s.remoteClosed) {
+      s.recvUnacked += n;
+      if (s.recvUnacked >= localSettings.initialWindowSize / 2) {
+        queueWindowUpdate(s.id, s.recvUnacked);
+        s.recvWindow += s.recvUnacked;
+        s.recvUnacked = 0;
+      }
+    }
+  }
+
+  void abandonBody(Http2Stream& s) {
+    // The application dropped the body input stream.
+    s.bodyAbandoned = true;
+    if (failure != nullptr) return;
+    creditConnection(s.discardData());
+    if (!s.remoteClosed) {
+      if (isClient) {
+        resetStream(s, ErrorCode::CANCEL, "response body canceled");
+      } else if (s.localClosed) {
+        // We've already responded; tell the client to stop uploading.
+        resetStream(s, ErrorCode::NO_ERROR, "request body not read");
+      }
+    }
+  }
+
+  void sendHeaders(Http2Stream& s, kj::ArrayPtr<const HpackHeader> fields, bool endStream) {
+    auto block = encoder.encode(fields);
+    auto remaining = block.asPtr();
+    bool first = true;
+    do {
+      auto chunk = remaining.slice(0, kj::min(remaining.size(), size_t(peerMaxFrameSize)));
+      remaining = remaining.slice(chunk.size(), remaining.size());
+      byte flags = remaining.size() == 0 ? FLAG_END_HEADERS : 0;
+      if (first && endStream) flags |= FLAG_END_STREAM;
+      queueFrame(first ? FrameType::HEADERS : FrameType::CONTINUATION, flags, s.id, chunk);
+      first = false;
+    } while (remaining.size() > 0);
+
+    if (endStream) {
+      s.localClosed = true;
+      retireIfClosed(s);
+    }
+  }
+
+  void addRegularHeaders(const HttpHeaders& headers, kj::Vector<HpackHeader>& fields,
+                         kj::Vector<kj::String>& owned, bool skipContentLength) {
+    // Appends the non-pseudo headers to `fields`, lower-casing names and dropping headers that
+    // are specific to HTTP/1.1 connections.
+
+    auto add = [&](kj::StringPtr name, kj::StringPtr value) {
+      if (isConnectionSpecificHeader(name)) return;
+      if (skipContentLength && name == "content-length") return;
+      fields.add(HpackHeader { name, value });
+    };
+    headers.forEach([&](HttpHeaderId id, kj::StringPtr value) {
+      add(lowerCaseName(id), value);
+    }, [&](kj::StringPtr name, kj::StringPtr value) {
+      if (hasUpperCase(name)) {
+        owned.add(toLower(name));
+        name = owned.back();
+      }
+      add(name, value);
+    });
+  }
+
+  kj::Promise<void> whenFlushed() {
+    KJ_IF_MAYBE(e, failure) {
+      return kj::cp(*e);
+    }
+    if (sendBuffer.size() == 0) {
+      if (!writing) return kj::READY_NOW;
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      inFlightWaiters.add(kj::mv(paf.fulfiller));
+      return kj::mv(paf.promise);
+    } else {
+      auto paf = kj::newPromiseAndFulfiller<void>();
+      pendingFlushWaiters.add(kj::mv(paf.fulfiller));
+      return kj::mv(paf.promise);
+    }
+  }
+
+  kj::Promise<void> whenDisconnected() { return disconnectPromise.addBranch(); }
+
+  kj::Maybe<kj::Exception>& getFailure() { return failure; }
+
+  const HttpHeaderTable& getHeaderTable() { return table; }
+
+  HttpServerErrorHandler& getErrorHandler() {
+    KJ_IF_MAYBE(h, localSettings.errorHandler) {
+      return *h;
+    } else {
+      return defaultErrorHandler;
+    }
+  }
+
+  kj::List<Http2Stream, &Http2Stream::link> streamList;
+  // Every live Http2Stream, so that they can be detached when the connection is destroyed.
+
+private:
+  kj::AsyncIoStream& stream;
+  const HttpHeaderTable& table;
+  Http2Settings localSettings;
+  bool isClient;
+  kj::Maybe<HttpService&> service;
+  HttpServerErrorHandler defaultErrorHandler;
+  kj::UnwindDetector unwind;
+
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+
+  // Peer settings.
+  uint32_t peerMaxConcurrentStreams = kj::maxValue;
+  int64_t peerInitialWindowSize = DEFAULT_WINDOW_SIZE;
+  uint32_t peerMaxFrameSize = DEFAULT_MAX_FRAME_SIZE;
+  bool localSettingsAcked = false;
+
+  // Flow control.
+  int64_t connSendWindow = DEFAULT_WINDOW_SIZE;
+  int64_t connRecvWindow;
+  size_t connRecvUnacked = 0;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> windowWaiters;
+
+  // Streams.
+  kj::HashMap<uint32_t, kj::Own<Http2Stream>> streams;
+  uint32_t nextStreamId;
+  uint32_t lastPeerStreamId = 0;
+  uint32_t activeLocalStreams = 0;
+  uint32_t activePeerStreams = 0;
+  bool goAwayReceived = false;
+  kj::HashMap<HttpHeaderId, kj::String> lowerCaseNames;
+
+  struct PendingOpen {
+    kj::Own<Http2Stream> stream;
+    kj::Array<kj::String> strings;
+    kj::Array<HpackHeader> fields;
+    bool endStream;
+  };
+  std::deque<PendingOpen> pendingOpens;
+  // Client requests waiting for the server's SETTINGS_MAX_CONCURRENT_STREAMS to allow them.
+
+  // Header block assembly.
+  kj::Vector<byte> headerBlock;
+  uint32_t headerStreamId = 0;
+  byte headerFlags = 0;
+  bool expectContinuation = false;
+
+  // Reading.
+  kj::Array<byte> readBuffer;
+  size_t readStart = 0;
+  size_t readEnd = 0;
+
+  // Writing.
+  kj::Vector<byte> sendBuffer;
+  bool flushScheduled = false;
+  bool writing = false;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> pendingFlushWaiters;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> inFlightWaiters;
+
+  // Failure.
+  ErrorCode goAwayCode = ErrorCode::INTERNAL_ERROR;
+  kj::Maybe<kj::Exception> failure;
+  kj::ForkedPromise<void> disconnectPromise = nullptr;
+  kj::Own<kj::PromiseFulfiller<void>> disconnectFulfiller;
+  kj::Promise<void> failurePromise = nullptr;
+  kj::Own<kj::PromiseFulfiller<void>> failureFulfiller;
+
+  kj::TaskSet tasks;
+  // Must be last so that tasks are canceled before anything they use is destroyed.
+
+  [[noreturn]] void protocolError(ErrorCode code, kj::StringPtr message) {
+    goAwayCode = code;
+    kj::throwFatalException(KJ_EXCEPTION(FAILED, "HTTP/2 protocol error", message));
+  }
+
+  void taskFailed(kj::Exception&& exception) override {
+    failAll(kj::mv(exception));
+  }
+
+  kj::Promise<void> abortConnection(kj::Exception&& exception) {
+    // The read loop failed. Tell the peer why (unless the transport itself is gone), then fail
+    // everything.
+    if (failure != nullptr || exception.getType() == kj::Exception::Type::DISCONNECTED) {
+      failAll(kj::cp(exception));
+      return kj::mv(exception);
+    }
+
+    byte payload[8];
+    writeBE32(payload, lastPeerStreamId);
+    writeBE32(payload + 4, static_cast<uint32_t>(goAwayCode));
+    queueFrame(FrameType::GOAWAY, 0, 0, payload);
+    auto flushed = whenFlushed();
+    return flushed.then([]() {}, [](kj::Exception&&) {})
+        .then([this, exception = kj::mv(exception)]() mutable -> kj::Promise<void> {
+      failAll(kj::cp(exception));
+      return kj::mv(exception);
+    });
+  }
+
+  void failAll(kj::Exception&& exception) {
+    if (failure != nullptr) return;
+    failure = kj::cp(exception);
+
+    kj::Vector<kj::Own<Http2Stream>> all;
+    for (auto& s: streamList) all.add(kj::addRef(s));
+    streams.clear();
+    pendingOpens.clear();
+
+    for (auto& s: all) {
+      s->registered = false;
+      s->localClosed = true;
+      s->remoteClosed = true;
+      s->fail(kj::cp(exception));
+      s->canceler.cancel(exception);
+    }
+
+    for (auto& f: windowWaiters) f->reject(kj::cp(exception));
+    windowWaiters.clear();
+    for (auto& f: pendingFlushWaiters) f->reject(kj::cp(exception));
+    pendingFlushWaiters.clear();
+    for (auto& f: inFlightWaiters) f->reject(kj::cp(exception));
+    inFlightWaiters.clear();
+
+    disconnectFulfiller->fulfill();
+    if (failureFulfiller->isWaiting()) failureFulfiller->reject(kj::mv(exception));
+  }
+
+  kj::StringPtr lowerCaseName(HttpHeaderId id) {
+    return lowerCaseNames.findOrCreate(id, [&]() {
+      return kj::HashMap<HttpHeaderId, kj::String>::Entry { id, toLower(id.toString()) };
+    });
+  }
+
+  int64_t initialRecvWindow() {
+    return localSettingsAcked ? localSettings.initialWindowSize : DEFAULT_WINDOW_SIZE;
+  }
+
+  bool isLocallyInitiated(uint32_t id) { return (id & 1) == (isClient ? 1 : 0); }
+
+  bool isIdle(uint32_t id) {
+    return isLocallyInitiated(id) ? id >= nextStreamId : id > lastPeerStreamId;
+  }
+
+  kj::Maybe<Http2Stream&> findStream(uint32_t id) {
+    KJ_IF_MAYBE(s, streams.find(id)) {
+      return **s;
+    } else {
+      return nullptr;
+    }
+  }
+
+  void retireIfClosed(Http2Stream& s) {
+    // Removes a fully-closed stream from the map. The caller must hold its own reference.
+    if (!s.registered || !s.localClosed || !s.remoteClosed) return;
+    s.registered = false;
+    bool local = isLocallyInitiated(s.id);
+    streams.erase(s.id);
+    if (local) {
+      --activeLocalStreams;
+      openPendingStreams();
+    } else {
+      --activePeerStreams;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // Writing
+
+  void queueFrame(FrameType type, byte flags, uint32_t streamId,
+                  kj::ArrayPtr<const byte> payload) {
+    if (failure != nullptr) return;
+    byte header[FRAME_HEADER_SIZE];
+    header[0] = payload.size() >> 16;
+    header[1] = payload.size() >> 8;
+    header[2] = payload.size();
+    header[3] = static_cast<byte>(type);
+    header[4] = flags;
+    writeBE32(header + 5, streamId);
+    sendBuffer.addAll(kj::arrayPtr(header, sizeof(header)));
+    sendBuffer.addAll(payload);
+    scheduleFlush();
+  }
+
+  void queueRstStream(uint32_t streamId, ErrorCode code) {
+    byte payload[4];
+    writeBE32(payload, static_cast<uint32_t>(code));
+    queueFrame(FrameType::RST_STREAM, 0, streamId, payload);
+  }
+
+  void queueWindowUpdate(uint32_t streamId, size_t increment) {
+    byte payload[4];
+    writeBE32(payload, increment);
+    queueFrame(FrameType::WINDOW_UPDATE, 0, streamId, payload);
+  }
+
+  void sendSettings() {
+    kj::Vector<byte> payload;
+    auto add = [&](SettingId id, uint32_t value) {
+      payload.add(static_cast<uint16_t>(id) >> 8);
+      payload.add(static_cast<uint16_t>(id));
+      byte buf[4];
+      writeBE32(buf, value);
+      payload.addAll(kj::arrayPtr(buf, 4));
+    };
+    if (localSettings.headerTableSize != 4096) {
+      add(SettingId::HEADER_TABLE_SIZE, localSettings.headerTableSize);
+    }
+    if (isClient) add(SettingId::ENABLE_PUSH, 0);
+    add(SettingId::MAX_CONCURRENT_STREAMS, localSettings.maxConcurrentStreams);
+    add(SettingId::INITIAL_WINDOW_SIZE, localSettings.initialWindowSize);
+    add(SettingId::MAX_FRAME_SIZE, localSettings.maxFrameSize);
+    add(SettingId::MAX_HEADER_LIST_SIZE, localSettings.maxHeaderListSize);
+    queueFrame(FrameType::SETTINGS, 0, 0, payload);
+
+    if (localSettings.connectionWindowSize > DEFAULT_WINDOW_SIZE) {
+      queueWindowUpdate(0, localSettings.connectionWindowSize - DEFAULT_WINDOW_SIZE);
+      connRecvWindow = localSettings.connectionWindowSize;
+    }
+  }
+
+  void creditConnection(size_t n) {
+    if (failure != nullptr) return;
+    connRecvUnacked += n;
+    if (connRecvUnacked >= kj::max<size_t>(localSettings.connectionWindowSize, 2) / 2) {
+      queueWindowUpdate(0, connRecvUnacked);
+      connRecvWindow += connRecvUnacked;
+      connRecvUnacked = 0;
+    }
+  }
+
+  void scheduleFlush() {
+    if (flushScheduled || writing) return;
+    flushScheduled = true;
+    // Wait until the end of the turn, so that frames queued together go out in one write.
+    tasks.add(kj::evalLater([this]() {
+      flushScheduled = false;
+      return flushLoop();
+    }));
+  }
+
+  kj::Promise<void> flushLoop() {
+    if (sendBuffer.size() == 0 || failure != nullptr) {
+      writing = false;
+      return kj::READY_NOW;
+    }
+    writing = true;
+    auto data = sendBuffer.releaseAsArray();
+    inFlightWaiters = kj::mv(pendingFlushWaiters);
+    pendingFlushWaiters = kj::Vector<kj::Own<kj::PromiseFulfiller<void>>>();
+    auto promise = stream.write(data.begin(), data.size());
+    return promise.then([this, data = kj::mv(data)]() {
+      for (auto& f: inFlightWaiters) f->fulfill();
+      inFlightWaiters.clear();
+      return flushLoop();
+    });
+  }
+
+  void wakeWindowWaiters() {
+    for (auto& f: windowWaiters) f->fulfill();
+    windowWaiters.clear();
+  }
+
+  // ---------------------------------------------------------------------------
+  // Opening client streams
+
+  bool canOpenStream() {
+    return pendingOpens.empty() && activeLocalStreams < peerMaxConcurrentStreams;
+  }
+
+  void openStream(Http2Stream& s, kj::ArrayPtr<const HpackHeader> fields, bool endStream) {
+    if (nextStreamId > MAX_WINDOW_SIZE) {
+      s.fail(KJ_EXCEPTION(DISCONNECTED, "HTTP/2 connection ran out of stream IDs"));
+      return;
+    }
+    s.id = nextStreamId;
+    nextStreamId += 2;
+    s.registered = true;
+    streams.insert(s.id, kj::addRef(s));
+    ++activeLocalStreams;
+    sendHeaders(s, fields, endStream);
+
+    KJ_IF_MAYBE(f, s.openWaiter) {
+      f->get()->fulfill();
+      s.openWaiter = nullptr;
+    }
+  }
+
+  void openPendingStreams() {
+    while (!pendingOpens.empty() && activeLocalStreams < peerMaxConcurrentStreams &&
+           failure == nullptr) {
+      auto pending = kj::mv(pendingOpens.front());
+      pendingOpens.pop_front();
+      if (pending.stream->canceled || pending.stream->error != nullptr) continue;
+      openStream(*pending.stream, pending.fields,
+                 pending.endStream || pending.stream->endPending);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+  // Reading
+
+  kj::Promise<bool> fill(size_t n) {
+    // Ensures at least `n` bytes are buffered starting at readStart. Returns false on EOF.
+    if (readEnd - readStart >= n) return true;
+    if (readStart + n > readBuffer.size()) {
+      memmove(readBuffer.begin(), readBuffer.begin() + readStart, readEnd - readStart);
+      readEnd -= readStart;
+      readStart = 0;
+    }
+    return stream.tryRead(readBuffer.begin() + readEnd, n - (readEnd - readStart),
+                          readBuffer.size() - readEnd)
+        .then([this, n](size_t amount) -> kj::Promise<bool> {
+      if (amount == 0) return false;
+      readEnd += amount;
+      return fill(n);
+    });
+  }
+
+  kj::Promise<void> readLoop() {
+    return fill(FRAME_HEADER_SIZE).then([this](bool ok) -> kj::Promise<void> {
+      if (!ok) {
+        if (readEnd != readStart) {
+          return KJ_EXCEPTION(DISCONNECTED, "HTTP/2 peer disconnected in the middle of a frame");
+        }
+        return kj::READY_NOW;
+      }
+
+      const byte* header = readBuffer.begin() + readStart;
+      uint32_t length = (uint32_t(header[0]) << 16) | (uint32_t(header[1]) << 8) | header[2];
+      if (length > localSettings.maxFrameSize) {
+        protocolError(ErrorCode::FRAME_SIZE_ERROR, "frame exceeds SETTINGS_MAX_FRAME_SIZE");
+      }
+
+      return fill(FRAME_HEADER_SIZE + length).then([this, length](bool ok) -> kj::Promise<void> {
+        if (!ok) {
+          return KJ_EXCEPTION(DISCONNECTED, "HTTP/2 peer disconnected in the middle of a frame");
+        }
+        const byte* header = readBuffer.begin() + readStart;
+        auto type = static_cast<FrameType>(header[3]);
+        byte flags = header[4];
+        uint32_t streamId = readBE32(header + 5) & 0x7fffffff;
+        auto payload = kj::arrayPtr(header + FRAME_HEADER_SIZE, length);
+        readStart += FRAME_HEADER_SIZE + length;
+
+        handleFrame(type, flags, streamId, payload);
+        return readLoop();
+      });
+    });
+  }
+
+  void handleFrame(FrameType type, byte flags, uint32_t streamId,
+                   kj::ArrayPtr<const byte> payload) {
+    if (expectContinuation && type != FrameType::CONTINUATION) {
+      protocolError(ErrorCode::PROTOCOL_ERROR, "expected CONTINUATION frame");
+    }
+
+    switch (type) {
+      case FrameType::DATA:
+        handleData(flags, streamId, payload);
+        break;
+      case FrameType::HEADERS:
+        handleHeaders(flags, streamId, payload);
+        break;
+      case FrameType::PRIORITY:
+        // Priorities are advisory; we don't implement them.
+        if (streamId == 0) protocolError(ErrorCode::PROTOCOL_ERROR, "PRIORITY on stream 0");
+        break;
+      case FrameType::RST_STREAM:
+        handleRstStream(streamId, payload);
+        break;
+      case FrameType::SETTINGS:
+        handleSettings(flags, streamId, payload);
+        break;
+      case FrameType::PUSH_PROMISE:
+        protocolError(ErrorCode::PROTOCOL_ERROR, "received PUSH_PROMISE, but push is disabled");
+      case FrameType::PING:
+        if (streamId != 0) protocolError(ErrorCode::PROTOCOL_ERROR, "PING on a stream");
+        if (payload.size() != 8) protocolError(ErrorCode::FRAME_SIZE_ERROR, "bad PING size");
+        if (!(flags & FLAG_ACK)) queueFrame(FrameType::PING, FLAG_ACK, 0, payload);
+        break;
+      case FrameType::GOAWAY:
+        handleGoAway(streamId, payload);
+        break;
+      case FrameType::WINDOW_UPDATE:
+        handleWindowUpdate(streamId, payload);
+        break;
+      case FrameType::CONTINUATION:
+        handleContinuation(flags, streamId, payload);
+        break;
+      default:
+        // Unknown frame types must be ignored.
+        break;
+    }
+  }
+
+  void handleData(byte flags, uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (streamId == 0) protocolError(ErrorCode::PROTOCOL_ERROR, "DATA on stream 0");
+
+    size_t flowSize = payload.size();
+    if (flags & FLAG_PADDED) {
+      if (payload.size() < 1 || payload[0] >= payload.size()) {
+        protocolError(ErrorCode::PROTOCOL_ERROR, "invalid DATA padding");
+      }
+      payload = payload.slice(1, payload.size() - payload[0]);
+    }
+
+    connRecvWindow -= flowSize;
+    if (connRecvWindow < 0) {
+      protocolError(ErrorCode::FLOW_CONTROL_ERROR, "peer exceeded connection flow control window");
+    }
+
+    KJ_IF_MAYBE(found, findStream(streamId)) {
+      auto ref = kj::addRef(*found);
+      auto& s = *ref;
+      if (s.remoteClosed) {
+        creditConnection(flowSize);
+        resetStream(s, ErrorCode::STREAM_CLOSED, "DATA after END_STREAM");
+        return;
+      }
+      if (isClient && !s.responseDelivered) {
+        creditConnection(flowSize);
+        resetStream(s, ErrorCode::PROTOCOL_ERROR, "DATA before response headers");
+        return;
+      }
+      s.recvWindow -= flowSize;
+      if (s.recvWindow < 0) {
+        creditConnection(flowSize);
+        resetStream(s, ErrorCode::FLOW_CONTROL_ERROR, "peer exceeded stream flow control window");
+        return;
+      }
+
+      // Padding is consumed immediately, as is data nobody will read.
+      consumed(s, flowSize - payload.size());
+      if (s.bodyAbandoned) {
+        consumed(s, payload.size());
+      } else if (payload.size() > 0) {
+        s.recvQueue.add(kj::heapArray(payload));
+      }
+
+      if (flags & FLAG_END_STREAM) {
+        s.endStreamReceived = true;
+        s.remoteClosed = true;
+      }
+      s.wakeReader();
+      retireIfClosed(s);
+    } else {
+      if (isIdle(streamId)) protocolError(ErrorCode::PROTOCOL_ERROR, "DATA on idle stream");
+      // The stream was recently closed (probably reset by us); ignore it.
+      creditConnection(flowSize);
+    }
+  }
+
+  void handleHeaders(byte flags, uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (streamId == 0) protocolError(ErrorCode::PROTOCOL_ERROR, "HEADERS on stream 0");
+
+    if (flags & FLAG_PADDED) {
+      if (payload.size() < 1 || payload[0] >= payload.size()) {
+        protocolError(ErrorCode::PROTOCOL_ERROR, "invalid HEADERS padding");
+      }
+      payload = payload.slice(1, payload.size() - payload[0]);
+    }
+    if (flags & FLAG_PRIORITY) {
+      if (payload.size() < 5) protocolError(ErrorCode::FRAME_SIZE_ERROR, "HEADERS too short");
+      payload = payload.slice(5, payload.size());
+    }
+
+    headerBlock.clear();
+    headerBlock.addAll(payload);
+    headerStreamId = streamId;
+    headerFlags = flags;
+    if (flags & FLAG_END_HEADERS) {
+      finishHeaderBlock();
+    } else {
+      expectContinuation = true;
+    }
+  }
+
+  void handleContinuation(byte flags, uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (!expectContinuation || streamId != headerStreamId) {
+      protocolError(ErrorCode::PROTOCOL_ERROR, "unexpected CONTINUATION frame");
+    }
+    headerBlock.addAll(payload);
+    if (headerBlock.size() > localSettings.maxHeaderListSize + 16384) {
+      // The compressed block is already larger than we'd accept decoded.
+      protocolError(ErrorCode::ENHANCE_YOUR_CALM, "header block too large");
+    }
+    if (flags & FLAG_END_HEADERS) {
+      expectContinuation = false;
+      finishHeaderBlock();
+    }
+  }
+
+  void finishHeaderBlock() {
+    kj::Array<HpackDecoder::Header> fields;
+    KJ_IF_MAYBE(e, kj::runCatchingExceptions([&]() {
+      fields = decoder.decode(headerBlock, localSettings.maxHeaderListSize);
+    })) {
+      protocolError(ErrorCode::COMPRESSION_ERROR, e->getDescription());
+    }
+
+    bool endStream = headerFlags & FLAG_END_STREAM;
+
+    if (isClient) {
+      handleResponseHeaders(headerStreamId, kj::mv(fields), endStream);
+    } else {
+      handleRequestHeaders(headerStreamId, kj::mv(fields), endStream);
+    }
+  }
+
+  void handleTrailers(Http2Stream& s, bool endStream) {
+    // We don't expose trailers to the application; they only end the stream.
+    if (!endStream) {
+      resetStream(s, ErrorCode::PROTOCOL_ERROR, "trailers without END_STREAM");
+      return;
+    }
+    s.endStreamReceived = true;
+    s.remoteClosed = true;
+    s.wakeReader();
+    retireIfClosed(s);
+  }
+
+  void handleResponseHeaders(uint32_t streamId, kj::Array<HpackDecoder::Header> fields,
+                             bool endStream) {
+    if (!isLocallyInitiated(streamId)) {
+      protocolError(ErrorCode::PROTOCOL_ERROR, "server opened a stream");
+    }
+
+    Http2Stream* found;
+    KJ_IF_MAYBE(f, findStream(streamId)) {
+      found = f;
+    } else {
+      if (isIdle(streamId)) protocolError(ErrorCode::PROTOCOL_ERROR, "HEADERS on idle stream");
+      return;
+    }
+    auto ref = kj::addRef(*found);
+    auto& s = *ref;
+
+    if (s.remoteClosed) {
+      resetStream(s, ErrorCode::STREAM_CLOSED, "HEADERS after END_STREAM");
+      return;
+    }
+    if (s.responseDelivered) {
+      handleTrailers(s, endStream);
+      return;
+    }
+
+    auto received = kj::heap<ReceivedHeaders>(table, kj::mv(fields));
+    KJ_IF_MAYBE(error, received->parse(false)) {
+      resetStream(s, ErrorCode::PROTOCOL_ERROR, *error);
+      return;
+    }
+
+    auto statusText = KJ_ASSERT_NONNULL(received->pseudo.status);
+    uint statusCode = 0;
+    if (statusText.size() == 3) {
+      for (char c: statusText) {
+        if (c < '0' || c > '9') {
+          statusCode = 0;
+          break;
+        }
+        statusCode = statusCode * 10 + (c - '0');
+      }
+    }
+    if (statusCode < 100) {
+      resetStream(s, ErrorCode::PROTOCOL_ERROR, "invalid :status");
+      return;
+    }
+    if (statusCode < 200) {
+      // Informational response; the real one follows.
+      if (endStream) resetStream(s, ErrorCode::PROTOCOL_ERROR, "1xx response with END_STREAM");
+      return;
+    }
+
+    if (endStream) {
+      s.endStreamReceived = true;
+      s.remoteClosed = true;
+    }
+
+    kj::Maybe<uint64_t> length;
+    if (endStream || s.method == HttpMethod::HEAD) {
+      length = uint64_t(0);
+    } else {
+      length = parseContentLength(received->headers);
+    }
+
+    auto& headers = received->headers;
+    auto body = kj::heap<Http2InputStream>(kj::addRef(s), length).attach(kj::mv(received));
+
+    s.responseDelivered = true;
+    KJ_IF_MAYBE(f, s.responseFulfiller) {
+      f->get()->fulfill(HttpClient::Response {
+        statusCode, reasonPhrase(statusCode), &headers, kj::mv(body)
+      });
+      s.responseFulfiller = nullptr;
+    }
+
+    retireIfClosed(s);
+  }
+
+  void handleRequestHeaders(uint32_t streamId, kj::Array<HpackDecoder::Header> fields,
+                            bool endStream);
+
+  void handleRstStream(uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (streamId == 0) protocolError(ErrorCode::PROTOCOL_ERROR, "RST_STREAM on stream 0");
+    if (payload.size() != 4) protocolError(ErrorCode::FRAME_SIZE_ERROR, "bad RST_STREAM size");
+    auto code = static_cast<ErrorCode>(readBE32(payload.begin()));
+
+    KJ_IF_MAYBE(found, findStream(streamId)) {
+      auto ref = kj::addRef(*found);
+      auto& s = *ref;
+      s.localClosed = true;
+      s.remoteClosed = true;
+      auto type = code == ErrorCode::CANCEL || code == ErrorCode::REFUSED_STREAM ||
+                  code == ErrorCode::NO_ERROR
+          ? kj::Exception::Type::DISCONNECTED : kj::Exception::Type::FAILED;
+      auto exception = kj::Exception(type, __FILE__, __LINE__,
+          kj::str("HTTP/2 stream reset by peer (", static_cast<uint32_t>(code), ")"));
+      s.fail(kj::cp(exception));
+      retireIfClosed(s);
+      s.canceler.cancel(exception);
+    } else {
+      if (isIdle(streamId)) protocolError(ErrorCode::PROTOCOL_ERROR, "RST_STREAM on idle stream");
+    }
+  }
+
+  void handleSettings(byte flags, uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (streamId != 0) protocolError(ErrorCode::PROTOCOL_ERROR, "SETTINGS on a stream");
+    if (flags & FLAG_ACK) {
+      if (payload.size() != 0) protocolError(ErrorCode::FRAME_SIZE_ERROR, "SETTINGS ACK with data");
+      if (!localSettingsAcked) {
+        // Until now the peer may have been sending with the default initial stream window.
+        localSettingsAcked = true;
+        int64_t delta = int64_t(localSettings.initialWindowSize) - DEFAULT_WINDOW_SIZE;
+        for (auto& entry: streams) entry.value->recvWindow += delta;
+      }
+      return;
+    }
+    if (payload.size() % 6 != 0) protocolError(ErrorCode::FRAME_SIZE_ERROR, "bad SETTINGS size");
+
+    for (size_t i = 0; i < payload.size(); i += 6) {
+      auto id = static_cast<SettingId>((uint16_t(payload[i]) << 8) | payload[i + 1]);
+      uint32_t value = readBE32(payload.begin() + i + 2);
+      switch (id) {
+        case SettingId::HEADER_TABLE_SIZE:
+          encoder.setMaxTableSize(kj::min(size_t(value), MAX_ENCODER_TABLE_SIZE));
+          break;
+        case SettingId::ENABLE_PUSH:
+          if (value > 1) protocolError(ErrorCode::PROTOCOL_ERROR, "invalid ENABLE_PUSH");
+          break;
+        case SettingId::MAX_CONCURRENT_STREAMS:
+          peerMaxConcurrentStreams = value;
+          break;
+        case SettingId::INITIAL_WINDOW_SIZE: {
+          if (value > MAX_WINDOW_SIZE) {
+            protocolError(ErrorCode::FLOW_CONTROL_ERROR, "invalid INITIAL_WINDOW_SIZE");
+          }
+          int64_t delta = int64_t(value) - peerInitialWindowSize;
+          peerInitialWindowSize = value;
+          for (auto& entry: streams) {
+            entry.value->sendWindow += delta;
+            if (entry.value->sendWindow > MAX_WINDOW_SIZE) {
+              protocolError(ErrorCode::FLOW_CONTROL_ERROR, "stream window overflow");
+            }
+          }
+          break;
+        }
+        case SettingId::MAX_FRAME_SIZE:
+          if (value < DEFAULT_MAX_FRAME_SIZE || value > MAX_MAX_FRAME_SIZE) {
+            protocolError(ErrorCode::PROTOCOL_ERROR, "invalid MAX_FRAME_SIZE");
+          }
+          peerMaxFrameSize = value;
+          break;
+        case SettingId::MAX_HEADER_LIST_SIZE:
+          // Advisory; we don't limit what we send.
+          break;
+        default:
+          // Unknown settings must be ignored.
+          break;
+      }
+    }
+
+    queueFrame(FrameType::SETTINGS, FLAG_ACK, 0, nullptr);
+    wakeWindowWaiters();
+    openPendingStreams();
+  }
+
+  void handleGoAway(uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (streamId != 0) protocolError(ErrorCode::PROTOCOL_ERROR, "GOAWAY on a stream");
+    if (payload.size() < 8) protocolError(ErrorCode::FRAME_SIZE_ERROR, "GOAWAY too short");
+    uint32_t lastStreamId = readBE32(payload.begin()) & 0x7fffffff;
+    goAwayReceived = true;
+
+    // Streams the peer never saw may be safely retried elsewhere.
+    auto exception = KJ_EXCEPTION(DISCONNECTED, "HTTP/2 peer sent GOAWAY before handling stream");
+    kj::Vector<kj::Own<Http2Stream>> refused;
+    for (auto& entry: streams) {
+      if (isLocallyInitiated(entry.key) && entry.key > lastStreamId) {
+        refused.add(kj::addRef(*entry.value));
+      }
+    }
+    for (auto& s: refused) {
+      s->localClosed = true;
+      s->remoteClosed = true;
+      s->fail(kj::cp(exception));
+      retireIfClosed(*s);
+    }
+    while (!pendingOpens.empty()) {
+      pendingOpens.front().stream->fail(kj::cp(exception));
+      pendingOpens.pop_front();
+    }
+  }
+
+  void handleWindowUpdate(uint32_t streamId, kj::ArrayPtr<const byte> payload) {
+    if (payload.size() != 4) protocolError(ErrorCode::FRAME_SIZE_ERROR, "bad WINDOW_UPDATE size");
+    uint32_t increment = readBE32(payload.begin()) & 0x7fffffff;
+
+    if (streamId == 0) {
+      if (increment == 0) protocolError(ErrorCode::PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+      connSendWindow += increment;
+      if (connSendWindow > MAX_WINDOW_SIZE) {
+        protocolError(ErrorCode::FLOW_CONTROL_ERROR, "connection window overflow");
+      }
+    } else KJ_IF_MAYBE(found, findStream(streamId)) {
+      auto ref = kj::addRef(*found);
+      if (increment == 0) {
+        resetStream(*ref, ErrorCode::PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+        return;
+      }
+      ref->sendWindow += increment;
+      if (ref->sendWindow > MAX_WINDOW_SIZE) {
+        resetStream(*ref, ErrorCode::FLOW_CONTROL_ERROR, "stream window overflow");
+        return;
+      }
+    } else {
+      if (isIdle(streamId)) {
+        protocolError(ErrorCode::PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream");
+      }
+      return;
+    }
+
+    wakeWindowWaiters();
+  }
+};
+
+Http2Stream::Http2Stream(Http2Connection& conn, int64_t sendWindow, int64_t recvWindow)
+    : conn(&conn), recvWindow(recvWindow), sendWindow(sendWindow) {
+  conn.streamList.add(*this);
+}
+
+Http2Stream::~Http2Stream() noexcept(false) {
+  KJ_IF_MAYBE(c, conn) {
+    c->streamList.remove(*this);
+  }
+}
+
+Http2InputStream::~Http2InputStream() noexcept(false) {
+  KJ_IF_MAYBE(c, stream->conn) {
+    c->abandonBody(*stream);
+  }
+}
+
+kj::Promise<size_t> Http2InputStream::readImpl(
+    byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead) {
+  auto& s = *stream;
+  size_t n = s.takeData(buffer + alreadyRead, maxBytes - alreadyRead);
+  if (n > 0) {
+    KJ_IF_MAYBE(r, remaining) {
+      *r -= kj::min(*r, n);
+    }
+    KJ_IF_MAYBE(c, s.conn) {
+      c->consumed(s, n);
+    }
+    alreadyRead += n;
+  }
+
+  if (alreadyRead >= minBytes || (s.endStreamReceived && !s.hasData())) {
+    return alreadyRead;
+  }
+  if (alreadyRead > 0 && s.error != nullptr) {
+    // Deliver what we have; the error will surface on the next read.
+    return alreadyRead;
+  }
+  KJ_IF_MAYBE(e, s.error) {
+    return kj::cp(*e);
+  }
+  if (s.conn == nullptr) {
+    return KJ_EXCEPTION(DISCONNECTED, "HTTP/2 connection destroyed");
+  }
+
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  s.readWaiter = kj::mv(paf.fulfiller);
+  return paf.promise.then([this, buffer, minBytes, maxBytes, alreadyRead]() {
+    return readImpl(buffer, minBytes, maxBytes, alreadyRead);
+  });
+}
+
+Http2OutputStream::~Http2OutputStream() noexcept(false) {
+  stream->writerActive = false;
+  KJ_IF_MAYBE(c, stream->conn) {
+    unwind.catchExceptionsIfUnwinding([&]() {
+      bool incomplete = false;
+      KJ_IF_MAYBE(r, remaining) {
+        incomplete = *r > 0;
+      }
+      if (unwind.isUnwinding() || inWrite || incomplete) {
+        c->resetStream(*stream, ErrorCode::CANCEL, "body stream dropped before completion");
+      } else {
+        c->endStream(*stream);
+      }
+    });
+  }
+}
+
+kj::Promise<void> Http2OutputStream::write(const void* buffer, size_t size) {
+  KJ_REQUIRE(!inWrite, "concurrent write()s not allowed") { return kj::READY_NOW; }
+  bool last = false;
+  KJ_IF_MAYBE(r, remaining) {
+    KJ_REQUIRE(size <= *r, "overwrote Content-Length");
+    *r -= size;
+    // With a known length we can end the stream with the last byte rather than waiting for the
+    // body stream to be dropped.
+    last = *r == 0;
+  }
+  if (size == 0) return kj::READY_NOW;
+
+  KJ_IF_MAYBE(c, stream->conn) {
+    inWrite = true;
+    return c->writeData(*stream, reinterpret_cast<const byte*>(buffer), size, last)
+        .then([this]() { inWrite = false; });
+  } else {
+    return KJ_EXCEPTION(DISCONNECTED, "HTTP/2 connection destroyed");
+  }
+}
+
+kj::Promise<void> Http2OutputStream::write(kj::ArrayPtr<const kj::ArrayPtr<const byte>> pieces) {
+  while (pieces.size() > 0 && pieces[0].size() == 0) pieces = pieces.slice(1, pieces.size());
+  if (pieces.size() == 0) return kj::READY_NOW;
+  auto first = pieces[0];
+  auto rest = pieces.slice(1, pieces.size());
+  return write(first.begin(), first.size()).then([this, rest]() { return write(rest); });
+}
+
+kj::Promise<void> Http2OutputStream::whenWriteDisconnected() {
+  KJ_IF_MAYBE(c, stream->conn) {
+    return c->whenDisconnected();
+  } else {
+    return kj::READY_NOW;
+  }
+}
+
+// =======================================================================================
+// Client
+
+HttpClient::Request Http2Connection::request(
+    HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+    kj::Maybe<uint64_t> expectedBodySize) {
+  KJ_IF_MAYBE(e, failure) {
+    kj::throwFatalException(kj::cp(*e));
+  }
+  if (goAwayReceived) {
+    kj::throwFatalException(KJ_EXCEPTION(DISCONNECTED, "HTTP/2 server sent GOAWAY"));
+  }
+
+  kj::Vector<HpackHeader> fields(headers.size() + 5);
+  kj::Vector<kj::String> owned;
+
+  kj::StringPtr scheme = "https";
+  kj::Maybe<kj::StringPtr> authority = headers.get(HttpHeaderId::HOST);
+  kj::StringPtr path = url;
+  if (url.startsWith("http://") || url.startsWith("https://")) {
+    auto parsed = Url::parse(url, Url::HTTP_PROXY_REQUEST);
+    owned.add(kj::mv(parsed.scheme));
+    scheme = owned.back();
+    owned.add(kj::mv(parsed.host));
+    authority = owned.back().asPtr();
+    owned.add(parsed.toString(Url::HTTP_REQUEST));
+    path = owned.back();
+  }
+
+  fields.add(HpackHeader { ":method"_kj, kj::toCharSequence(method) });
+  fields.add(HpackHeader { ":scheme"_kj, scheme });
+  KJ_IF_MAYBE(a, authority) {
+    fields.add(HpackHeader { ":authority"_kj, *a });
+  }
+  fields.add(HpackHeader { ":path"_kj, path });
+
+  // Same rules as the HTTP/1.1 client for deciding whether there's a body.
+  bool isGet = method == HttpMethod::GET || method == HttpMethod::HEAD;
+  bool hasBody;
+  KJ_IF_MAYBE(s, expectedBodySize) {
+    hasBody = *s > 0;
+    if (!(isGet && *s == 0)) {
+      owned.add(kj::str(*s));
+      fields.add(HpackHeader { "content-length"_kj, owned.back() });
+    }
+  } else {
+    hasBody = !isGet || headers.get(HttpHeaderId::TRANSFER_ENCODING) != nullptr;
+  }
+  addRegularHeaders(headers, fields, owned, true);
+
+  auto s = kj::refcounted<Http2Stream>(*this, peerInitialWindowSize, initialRecvWindow());
+  s->method = method;
+  auto paf = kj::newPromiseAndFulfiller<HttpClient::Response>();
+  s->responseFulfiller = kj::mv(paf.fulfiller);
+
+  if (canOpenStream()) {
+    openStream(*s, fields, !hasBody);
+  } else {
+    // Copy everything, since `url` and `headers` only live until we return.
+    auto strings = kj::heapArrayBuilder<kj::String>(fields.size() * 2);
+    auto copies = kj::heapArrayBuilder<HpackHeader>(fields.size());
+    for (auto& field: fields) {
+      strings.add(kj::heapString(field.name));
+      auto& name = strings.back();
+      strings.add(kj::heapString(field.value));
+      copies.add(HpackHeader { name, strings.back() });
+    }
+    pendingOpens.push_back(PendingOpen {
+      kj::addRef(*s), strings.finish(), copies.finish(), !hasBody
+    });
+  }
+
+  kj::Own<kj::AsyncOutputStream> body;
+  if (hasBody) {
+    body = kj::heap<Http2OutputStream>(kj::addRef(*s), expectedBodySize);
+  } else {
+    body = kj::heap<Http2NullOutputStream>();
+  }
+
+  auto response = paf.promise.attach(kj::defer([s = kj::mv(s)]() mutable {
+    // If the caller gives up on the response, cancel the stream.
+    if (!s->responseDelivered) {
+      KJ_IF_MAYBE(c, s->conn) {
+        c->resetStream(*s, ErrorCode::CANCEL, "response canceled");
+      }
+    }
+  }));
+
+  return { kj::mv(body), kj::mv(response) };
+}
+
+class Http2ClientImpl final: public HttpClient {
+public:
+  Http2ClientImpl(kj::AsyncIoStream& stream, const HttpHeaderTable& table,
+                  Http2Settings settings)
+      : connection(stream, table, settings, true) {
+    connection.startClient();
+  }
+
+  Request request(HttpMethod method, kj::StringPtr url, const HttpHeaders& headers,
+                  kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    return connection.request(method, url, headers, expectedBodySize);
+  }
+
+private:
+  Http2Connection connection;
+};
+
+// =======================================================================================
+// Server
+
+class Http2ServerRequest final: public HttpService::Response {
+  // One incoming request: owns everything passed to HttpService::request() and implements the
+  // Response callback.
+
+public:
+  Http2ServerRequest(Http2Connection& conn, kj::Own<Http2Stream> stream,
+                     kj::Own<ReceivedHeaders> received, HttpMethod method,
+                     kj::Maybe<uint64_t> bodyLength)
+      : conn(conn), stream(kj::mv(stream)), received(kj::mv(received)), method(method),
+        body(kj::addRef(*this->stream), bodyLength) {}
+
+  kj::Promise<void> run(HttpService& service) {
+    auto url = KJ_ASSERT_NONNULL(received->pseudo.path);
+    auto& errorHandler = conn.getErrorHandler();
+    return kj::evalNow([&]() {
+      return service.request(method, url, received->headers, body, *this);
+    }).then([this, &errorHandler]() -> kj::Promise<void> {
+      if (!responded) return errorHandler.handleNoResponse(*this);
+      return kj::READY_NOW;
+    }, [this, &errorHandler](kj::Exception&& e) -> kj::Promise<void> {
+      if (responded) {
+        return errorHandler.handleApplicationError(kj::mv(e), nullptr);
+      } else {
+        return errorHandler.handleApplicationError(kj::mv(e), *this);
+      }
+    }).then([this]() {
+      finish();
+    }, [this](kj::Exception&&) {
+      finish();
+    });
+  }
+
+  kj::Own<kj::AsyncOutputStream> send(
+      uint statusCode, kj::StringPtr statusText, const HttpHeaders& headers,
+      kj::Maybe<uint64_t> expectedBodySize = nullptr) override {
+    KJ_REQUIRE(!responded, "already called send() for this request");
+    KJ_IF_MAYBE(e, stream->error) {
+      kj::throwFatalException(kj::cp(*e));
+    }
+    responded = true;
+
+    kj::Vector<HpackHeader> fields(headers.size() + 2);
+    kj::Vector<kj::String> owned;
+    auto status = kj::str(statusCode);
+    fields.add(HpackHeader { ":status"_kj, status });
+
+    bool isHead = method == HttpMethod::HEAD;
+    bool noBody = isHead || statusCode == 204 || statusCode == 304;
+    KJ_IF_MAYBE(s, expectedBodySize) {
+      if (statusCode != 204 && statusCode != 304) {
+        owned.add(kj::str(*s));
+        fields.add(HpackHeader { "content-length"_kj, owned.back() });
+      }
+      if (*s == 0) noBody = true;
+    }
+    // For HEAD responses, the application may pass the Content-Length it would have sent.
+    conn.addRegularHeaders(headers, fields, owned, expectedBodySize != nullptr || !isHead);
+
+    conn.sendHeaders(*stream, fields, noBody);
+
+    if (noBody) {
+      return kj::heap<Http2NullOutputStream>(isHead);
+    } else {
+      return kj::heap<Http2OutputStream>(kj::addRef(*stream), expectedBodySize);
+    }
+  }
+
+  kj::Own<WebSocket> acceptWebSocket(const HttpHeaders& headers) override {
+    KJ_UNIMPLEMENTED("WebSockets over HTTP/2 are not supported");
+  }
+
+private:
+  Http2Connection& conn;
+  kj::Own<Http2Stream> stream;
+  kj::Own<ReceivedHeaders> received;
+  HttpMethod method;
+  Http2InputStream body;
+  bool responded = false;
+
+  void finish() {
+    // If the service returned without completing a response (e.g. it threw after sending
+    // headers), abort the stream so the client doesn't wait forever.
+    if (!stream->localClosed && !stream->writerActive) {
+      KJ_IF_MAYBE(c, stream->conn) {
+        c->resetStream(*stream, ErrorCode::INTERNAL_ERROR, "response not completed");
+      }
+    }
+  }
+};
+
+void Http2Connection::handleRequestHeaders(
+    uint32_t streamId, kj::Array<HpackDecoder::Header> fields, bool endStream) {
+  KJ_IF_MAYBE(found, findStream(streamId)) {
+    auto ref = kj::addRef(*found);
+    if (ref->remoteClosed) {
+      resetStream(*ref, ErrorCode::STREAM_CLOSED, "HEADERS after END_STREAM");
+    } else {
+      handleTrailers(*ref, endStream);
+    }
+    return;
+  }
+
+  if (isLocallyInitiated(streamId) || streamId <= lastPeerStreamId) {
+    protocolError(ErrorCode::PROTOCOL_ERROR, "invalid stream ID for new request");
+  }
+  lastPeerStreamId = streamId;
+
+  if (activePeerStreams >= localSettings.maxConcurrentStreams) {
+    queueRstStream(streamId, ErrorCode::REFUSED_STREAM);
+    return;
+  }
+
+  auto s = kj::refcounted<Http2Stream>(*this, peerInitialWindowSize, initialRecvWindow());
+  s->id = streamId;
+  s->registered = true;
+  streams.insert(streamId, kj::addRef(*s));
+  ++activePeerStreams;
+
+  if (endStream) {
+    s->endStreamReceived = true;
+    s->remoteClosed = true;
+  }
+
+  auto received = kj::heap<ReceivedHeaders>(table, kj::mv(fields));
+  KJ_IF_MAYBE(error, received->parse(true)) {
+    resetStream(*s, ErrorCode::PROTOCOL_ERROR, *error);
+    return;
+  }
+
+  auto methodName = KJ_ASSERT_NONNULL(received->pseudo.method);
+  HttpMethod method;
+  KJ_IF_MAYBE(m, tryParseHttpMethod(methodName)) {
+    method = *m;
+  } else {
+    if (methodName == "CONNECT") {
+      resetStream(*s, ErrorCode::CONNECT_ERROR, "CONNECT over HTTP/2 is not supported");
+    } else {
+      resetStream(*s, ErrorCode::PROTOCOL_ERROR, "unknown HTTP method");
+    }
+    return;
+  }
+
+  if (received->headers.get(HttpHeaderId::HOST) == nullptr) {
+    KJ_IF_MAYBE(a, received->pseudo.authority) {
+      received->headers.set(HttpHeaderId::HOST, *a);
+    }
+  }
+
+  kj::Maybe<uint64_t> length;
+  if (endStream) {
+    length = uint64_t(0);
+  } else {
+    length = parseContentLength(received->headers);
+  }
+
+  auto request = kj::heap<Http2ServerRequest>(*this, kj::addRef(*s), kj::mv(received),
+                                              method, length);
+  auto promise = request->run(KJ_ASSERT_NONNULL(service));
+  tasks.add(s->canceler.wrap(kj::mv(promise)).attach(kj::mv(request))
+      .catch_([](kj::Exception&&) {
+    // Canceled by RST_STREAM or connection failure; nothing more to do.
+  }));
+}
+
+}  // namespace
+
+kj::Own<HttpClient> newHttp2Client(const HttpHeaderTable& responseHeaderTable,
+                                   kj::AsyncIoStream& stream, Http2Settings settings) {
+  return kj::heap<Http2ClientImpl>(stream, responseHeaderTable, settings);
+}
+
+kj::Promise<void> serveHttp2(const HttpHeaderTable& requestHeaderTable, HttpService& service,
+                             kj::AsyncIoStream& stream, Http2Settings settings) {
+  auto connection = kj::heap<Http2Connection>(stream, requestHeaderTable, settings, false);
+  auto promise = connection->serve(service);
+  return promise.attach(kj::mv(connection));
+}
+
+}  // namespace kj
@@ -0,0 +1,196 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+// HTTP/2 (RFC 7540) support for the KJ HTTP library.
+//
+// This implements the HttpClient and HttpService interfaces from http.h on top of an HTTP/2
+// connection, so that applications written against those interfaces can speak HTTP/2 without
+// modification. A single connection multiplexes any number of concurrent requests, each on its
+// own stream with its own flow control window.
+//
+// HTTP/2 connections are normally established over TLS with the "h2" protocol negotiated via
+// ALPN: set `TlsContext::Options::alpnProtocols` to `{"h2", "http/1.1"}` (see tls.h), then check
+// `TlsPeerIdentity::getAlpnProtocol()` on the resulting AuthenticatedStream to decide whether to
+// use the functions below or the HTTP/1.1 implementation in http.h. Cleartext HTTP/2 with prior
+// knowledge is also supported, by simply passing an unencrypted stream.
+//
+// Not (yet) supported: server push (the client disables it), stream priorities (PRIORITY frames
+// are parsed and ignored), WebSockets over HTTP/2 (RFC 8441), and CONNECT.
+
+#include "http.h"
+
+KJ_BEGIN_HEADER
+
+namespace kj {
+
+struct Http2Settings {
+  // Local settings for an HTTP/2 connection. These are advertised to the peer in the initial
+  // SETTINGS frame.
+
+  uint32_t maxConcurrentStreams = 100;
+  // Maximum number of streams the peer may open to us at once. (For a client, this limits server
+  // push, which is disabled anyway, so it mainly matters to servers.)
+
+  uint32_t initialWindowSize = 65535;
+  // Per-stream receive window. This bounds how much body data the peer may send on one stream
+  // before the application reads it.
+
+  uint32_t connectionWindowSize = 1 << 20;
+  // Connection-wide receive window, shared by all streams. The HTTP/2 default is 65535; we raise
+  // it with a WINDOW_UPDATE at startup so that several streams can be in flight at once.
+
+  uint32_t maxFrameSize = 16384;
+  // Largest frame payload we are willing to receive. Must be between 2^14 and 2^24-1.
+
+  uint32_t headerTableSize = 4096;
+  // Size of the HPACK dynamic table the peer may use when compressing headers sent to us.
+
+  uint32_t maxHeaderListSize = 65536;
+  // Limit on the total decoded size of one header block (per RFC 7541, name + value + 32 per
+  // header). Blocks exceeding this cause the stream to be reset.
+
+  kj::Maybe<HttpServerErrorHandler&> errorHandler = nullptr;
+  // For servers: customizes the response sent when the service throws or fails to respond, as
+  // with HttpServerSettings::errorHandler. (handleClientProtocolError() is never called; malformed
+  // HTTP/2 requests are rejected with RST_STREAM instead.)
+};
+
+kj::Own<HttpClient> newHttp2Client(const HttpHeaderTable& responseHeaderTable,
+                                   kj::AsyncIoStream& stream,
+                                   Http2Settings settings = Http2Settings());
+// Creates an HttpClient that speaks HTTP/2 over the given pre-established connection. Requests
+// made on the client are multiplexed onto the connection as separate streams; there is no limit
+// on how many requests may be issued at once, but requests beyond the server's
+// SETTINGS_MAX_CONCURRENT_STREAMS will wait for earlier ones to complete before being sent.
+//
+// The `:authority` pseudo-header is taken from the request's `Host` header, or from the URL if
+// it is absolute. The `:scheme` is taken from an absolute URL, defaulting to "https".
+//
+// `openWebSocket()` and `connect()` are not supported over HTTP/2 and use the HttpClient
+// defaults.
+//
+// The stream must outlive the returned client.
+
+kj::Promise<void> serveHttp2(const HttpHeaderTable& requestHeaderTable, HttpService& service,
+                             kj::AsyncIoStream& stream,
+                             Http2Settings settings = Http2Settings());
+// Serves HTTP/2 on the given pre-established connection (typically accepted over TLS after ALPN
+// negotiated "h2"), dispatching each incoming stream to `service` concurrently. The returned
+// promise resolves when the client closes the connection (or after a GOAWAY once all streams
+// have completed), and rejects on protocol errors. Canceling it immediately aborts all in-flight
+// requests.
+//
+// The connection preface sent by the client is expected to be the first thing on the stream.
+//
+// `acceptWebSocket()` is not supported over HTTP/2; calling it throws.
+
+namespace _ {  // private, exposed for testing
+
+struct HpackHeader {
+  kj::StringPtr name;
+  kj::StringPtr value;
+};
+
+class HpackDynamicTable {
+  // The HPACK dynamic table: a FIFO of header fields whose total size (name + value + 32 per
+  // entry) is bounded. Entries are appended at the back and evicted from the front; index 0 is
+  // the newest entry.
+
+public:
+  struct Entry {
+    kj::String name;
+    kj::String value;
+  };
+
+  size_t size() const { return entries.size() - head; }
+  size_t byteSize() const { return bytes; }
+
+  const Entry& operator[](size_t i) const { return entries[entries.size() - 1 - i]; }
+
+  void add(kj::String name, kj::String value);
+  void evictTo(size_t limit);
+
+private:
+  kj::Vector<Entry> entries;
+  size_t head = 0;
+  size_t bytes = 0;
+};
+
+class HpackEncoder {
+  // HPACK (RFC 7541) header block encoder. Uses the static table, maintains the dynamic table,
+  // and Huffman-codes string literals when that makes them shorter.
+
+public:
+  explicit HpackEncoder(size_t maxTableSize = 4096);
+
+  void setMaxTableSize(size_t size);
+  // Called when the peer's SETTINGS_HEADER_TABLE_SIZE changes. A dynamic table size update will
+  // be emitted at the start of the next header block.
+
+  kj::Array<byte> encode(kj::ArrayPtr<const HpackHeader> headers);
+  // Encodes a complete header block. Names must already be lower-case.
+
+  size_t getTableSize() const { return table.byteSize(); }
+
+private:
+  HpackDynamicTable table;
+  size_t maxTableSize;
+  kj::Maybe<size_t> pendingSizeUpdate;
+  size_t minPendingSize = kj::maxValue;
+};
+
+class HpackDecoder {
+  // HPACK (RFC 7541) header block decoder. Throws on malformed input; the HTTP/2 connection
+  // treats that as a connection-level COMPRESSION_ERROR.
+
+public:
+  explicit HpackDecoder(size_t maxTableSize = 4096);
+
+  void setMaxTableSize(size_t size);
+  // Sets the limit we advertised in SETTINGS_HEADER_TABLE_SIZE. The peer's table size updates
+  // may not exceed this.
+
+  struct Header {
+    kj::String name;
+    kj::String value;
+  };
+
+  kj::Array<Header> decode(kj::ArrayPtr<const byte> block, size_t maxListSize = kj::maxValue);
+  // Decodes a complete header block. Throws as soon as the decoded header list's size (name +
+  // value + 32 per field, as for SETTINGS_MAX_HEADER_LIST_SIZE) exceeds `maxListSize`, so that a
+  // small block of references to large table entries can't make us allocate without bound. The
+  // dynamic table is then out of sync with the peer's, so the connection can't continue.
+
+  size_t getTableSize() const { return table.byteSize(); }
+
+private:
+  HpackDynamicTable table;
+  size_t tableLimit;    // current size, as set by the peer's size updates
+  size_t maxTableSize;  // limit we advertised
+};
+
+}  // namespace _ (private)
+
+}  // namespace kj
+
+KJ_END_HEADER
@@ -122,6 +122,27 @@ KJ_TEST("readiness IO: write while corked") {
   KJ_ASSERT(kj::StringPtr(buf) == "foobar");
 }
 
+KJ_TEST("readiness IO: flush while corked") {
+  auto io = setupAsyncIo();
+  auto pipe = io.provider->newOneWayPipe();
+
+  ReadyOutputStreamWrapper out(*pipe.out);
+  out.flush().wait(io.waitScope);  // nothing to flush
+
+  auto cork = out.cork();
+  KJ_ASSERT(KJ_ASSERT_NONNULL(out.write(kj::StringPtr("foo").asBytes())) == 3);
+
+  char buf[4];
+  auto readPromise = pipe.in->read(buf, 3);
+  KJ_ASSERT(!readPromise.poll(io.waitScope));
+
+  // flush() pushes the data out despite the cork.
+  out.flush().wait(io.waitScope);
+  readPromise.wait(io.waitScope);
+  buf[3] = '\0';
+  KJ_ASSERT(kj::StringPtr(buf) == "foo");
+}
+
 KJ_TEST("readiness IO: write many odd while corked") {
   auto io = setupAsyncIo();
   auto pipe = io.provider->newOneWayPipe();
@@ -217,6 +238,26 @@ KJ_TEST("readiness IO: read small") {
   }
 }
 
+KJ_TEST("readiness IO: exact reads") {
+  auto io = setupAsyncIo();
+  auto pipe = io.provider->newOneWayPipe();
+
+  ReadyInputStreamWrapper in(*pipe.in);
+  in.setExactReads(true);
+  pipe.out->write("foobar", 6).wait(io.waitScope);
+
+  char buf[6];
+  KJ_ASSERT(in.read(kj::arrayPtr(buf, 2).asBytes()) == nullptr);
+  KJ_ASSERT(in.hasBufferedInput());
+  in.whenReady().wait(io.waitScope);
+  KJ_ASSERT(KJ_ASSERT_NONNULL(in.read(kj::arrayPtr(buf, 2).asBytes())) == 2);
+
+  // Only the requested bytes were taken from the stream.
+  KJ_ASSERT(!in.hasBufferedInput());
+  KJ_ASSERT(pipe.in->read(buf + 2, 4, 4).wait(io.waitScope) == 4);
+  KJ_ASSERT(kj::heapString(buf, 6) == "foobar");
+}
+
 KJ_TEST("readiness IO: read many odd") {
   auto io = setupAsyncIo();
   auto pipe = io.provider->newOneWayPipe();
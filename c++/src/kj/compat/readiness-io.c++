@@ -42,8 +42,9 @@ kj::Maybe<size_t> ReadyInputStreamWrapper::read(kj::ArrayPtr<byte> dst) {
     // No data available. Try to read more.
     if (!isPumping) {
       isPumping = true;
+      size_t amount = exactReads ? kj::min(dst.size(), sizeof(buffer)) : sizeof(buffer);
       pumpTask = kj::evalNow([&]() {
-        return input.tryRead(buffer, 1, sizeof(buffer)).then([this](size_t n) {
+        return input.tryRead(buffer, 1, amount).then([this](size_t n) {
           if (n == 0) {
             eof = true;
           } else {
@@ -110,6 +111,17 @@ kj::Promise<void> ReadyOutputStreamWrapper::whenReady() {
   return pumpTask.addBranch();
 }
 
+kj::Promise<void> ReadyOutputStreamWrapper::flush() {
+  if (!isPumping) {
+    if (filled == 0) return kj::READY_NOW;
+    isPumping = true;
+    pumpTask = kj::evalNow([&]() {
+      return pump();
+    }).fork();
+  }
+  return pumpTask.addBranch();
+}
+
 ReadyOutputStreamWrapper::Cork ReadyOutputStreamWrapper::cork() {
   corked = true;
   return Cork(*this);
@@ -43,11 +43,22 @@ public:
   kj::Promise<void> whenReady();
   // Returns a promise that resolves when read() will return non-null.
 
+  void setExactReads(bool exact) { exactReads = exact; }
+  // If true, never read more bytes from the underlying stream than the read() call that
+  // triggered the read asked for. This costs more syscalls, but guarantees that nothing is
+  // buffered here which the caller hasn't consumed, so that the underlying stream can later be
+  // used directly. Default: false.
+
+  bool hasBufferedInput() const { return content.size() > 0 || isPumping; }
+  // Returns true if bytes have been read from the underlying stream but not yet consumed by
+  // read(), or if a read from the underlying stream is in progress.
+
 private:
   AsyncInputStream& input;
   kj::ForkedPromise<void> pumpTask = nullptr;
   bool isPumping = false;
   bool eof = false;
+  bool exactReads = false;
 
   kj::ArrayPtr<const byte> content = nullptr;  // Points to currently-valid part of `buffer`.
   byte buffer[8192];
@@ -71,6 +82,14 @@ public:
   kj::Promise<void> whenReady();
   // Returns a promise that resolves when write() will return non-null.
 
+  kj::Promise<void> flush();
+  // Returns a promise that resolves once every byte accepted by write() so far has been written
+  // to the underlying stream, ignoring any cork.
+
+  bool isIdle() const { return filled == 0 && !isPumping && !corked; }
+  // Returns true if nothing is buffered or being written, and the stream isn't corked, so that
+  // the caller could write to the underlying stream directly without reordering anything.
+
   class Cork;
   // An object that, when destructed, will uncork its parent stream.
 
@@ -41,6 +41,7 @@
 
 #include "kj/async-io.h"
 #include "kj/test.h"
+#include "kj/timer.h"
 
 namespace kj {
 namespace {
@@ -631,6 +632,68 @@ KJ_TEST("TLS full duplex") {
   writeDown.wait(test.io.waitScope);
 }
 
+KJ_TEST("TLS bulk transfer over fd and in-memory streams") {
+  // Sockets are read and written directly, and in-memory pipes through buffers. Either way, a
+  // transfer bigger than the socket buffers must come through intact in both directions.
+
+  TlsTest test;
+
+  auto run = [&](kj::TwoWayPipe pipe) {
+    ErrorNexus e;
+    auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com"));
+    auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+
+    auto client = clientPromise.wait(test.io.waitScope);
+    auto server = serverPromise.wait(test.io.waitScope);
+
+    auto sent = kj::heapArray<byte>(1 << 20);
+    for (auto i: kj::indices(sent)) sent[i] = i * 7 + (i >> 12);
+    auto received = kj::heapArray<byte>(sent.size());
+
+    auto writeUp = e.wrap(client->write(sent.begin(), sent.size()));
+    auto readDown = e.wrap(readN(*client, "bar", 10000));
+    auto writeDown = e.wrap(writeN(*server, "bar", 10000));
+    auto readUp = e.wrap(server->read(received.begin(), received.size()));
+
+    readUp.wait(test.io.waitScope);
+    readDown.wait(test.io.waitScope);
+    writeUp.wait(test.io.waitScope);
+    writeDown.wait(test.io.waitScope);
+    KJ_EXPECT(received == sent);
+  };
+
+  run(test.io.provider->newTwoWayPipe());
+  run(kj::newTwoWayPipe());
+}
+
+KJ_TEST("TLS inside TLS") {
+  // The inner connections forward getFd() from the socket, but the outer ones must not read and
+  // write that socket directly, or they'd skip the inner encryption.
+
+  TlsTest test;
+  ErrorNexus e;
+
+  auto pipe = test.io.provider->newTwoWayPipe();
+
+  auto innerClientPromise =
+      e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com"));
+  auto innerServerPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+  auto innerClient = innerClientPromise.wait(test.io.waitScope);
+  auto innerServer = innerServerPromise.wait(test.io.waitScope);
+
+  auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(innerClient), "example.com"));
+  auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(innerServer)));
+  auto client = clientPromise.wait(test.io.waitScope);
+  auto server = serverPromise.wait(test.io.waitScope);
+
+  test.testConnection(*client, *server);
+
+  auto writeDown = e.wrap(writeN(*server, "bar", 1000));
+  auto readDown = e.wrap(readN(*client, "bar", 1000));
+  writeDown.wait(test.io.waitScope);
+  readDown.wait(test.io.waitScope);
+}
+
 class TestSniCallback: public TlsSniCallback {
 public:
   kj::Maybe<TlsKeypair> getKey(kj::StringPtr hostname) override {
@@ -682,6 +745,248 @@ void expectInvalidCert(kj::StringPtr hostname, TlsCertificate cert, kj::StringPt
   KJ_EXPECT_THROW_MESSAGE(message, clientPromise.wait(test.io.waitScope));
 }
 
+KJ_TEST("TLS ALPN") {
+  auto negotiate = [](kj::ArrayPtr<const kj::StringPtr> clientProtos,
+                      kj::ArrayPtr<const kj::StringPtr> serverProtos)
+      -> kj::Maybe<kj::String> {
+    auto clientOpts = TlsTest::defaultClient();
+    clientOpts.alpnProtocols = clientProtos;
+    auto serverOpts = TlsTest::defaultServer();
+    serverOpts.alpnProtocols = serverProtos;
+    TlsTest test(kj::mv(clientOpts), kj::mv(serverOpts));
+    ErrorNexus e;
+
+    auto pipe = test.io.provider->newTwoWayPipe();
+
+    auto clientPromise = e.wrap(test.tlsClient.wrapClient(
+        kj::AuthenticatedStream { kj::mv(pipe.ends[0]), kj::LocalPeerIdentity::newInstance({}) },
+        "example.com"));
+    auto serverPromise = e.wrap(test.tlsServer.wrapServer(
+        kj::AuthenticatedStream { kj::mv(pipe.ends[1]), kj::LocalPeerIdentity::newInstance({}) }));
+
+    auto client = clientPromise.wait(test.io.waitScope);
+    auto server = serverPromise.wait(test.io.waitScope);
+
+    auto clientProto = client.peerIdentity.downcast<TlsPeerIdentity>()->getAlpnProtocol()
+        .map([](kj::StringPtr p) { return kj::str(p); });
+    auto serverProto = server.peerIdentity.downcast<TlsPeerIdentity>()->getAlpnProtocol()
+        .map([](kj::StringPtr p) { return kj::str(p); });
+    KJ_EXPECT(clientProto == serverProto);
+
+    test.testConnection(*client.stream, *server.stream);
+    return kj::mv(clientProto);
+  };
+
+  kj::StringPtr h2AndHttp11[] = {"h2"_kj, "http/1.1"_kj};
+  kj::StringPtr http11AndH2[] = {"http/1.1"_kj, "h2"_kj};
+  kj::StringPtr http11[] = {"http/1.1"_kj};
+  kj::StringPtr other[] = {"other"_kj};
+
+  // The server's preference wins.
+  KJ_EXPECT(KJ_ASSERT_NONNULL(negotiate(h2AndHttp11, http11AndH2)) == "http/1.1");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(negotiate(http11AndH2, h2AndHttp11)) == "h2");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(negotiate(h2AndHttp11, http11)) == "http/1.1");
+
+  // No overlap, or ALPN not configured on one side, means no protocol but a working connection.
+  KJ_EXPECT(negotiate(h2AndHttp11, other) == nullptr);
+  KJ_EXPECT(negotiate(nullptr, h2AndHttp11) == nullptr);
+  KJ_EXPECT(negotiate(h2AndHttp11, nullptr) == nullptr);
+}
+
+KJ_TEST("TLS kernel offload") {
+  // Whether or not the kernel can take over -- which depends on the OpenSSL build and the kernel
+  // the test runs on -- the connection must work the same. Over a socketpair, offload is never
+  // possible, so that exercises the fallback.
+
+  auto test = [](bool useTcp) {
+    auto clientOpts = TlsTest::defaultClient();
+    clientOpts.kernelTls = true;
+    auto serverOpts = TlsTest::defaultServer();
+    serverOpts.kernelTls = true;
+    TlsTest test(kj::mv(clientOpts), kj::mv(serverOpts));
+    ErrorNexus e;
+    auto& ws = test.io.waitScope;
+
+    kj::Promise<kj::Own<kj::AsyncIoStream>> clientPromise = nullptr;
+    kj::Promise<kj::Own<kj::AsyncIoStream>> serverPromise = nullptr;
+    kj::Own<kj::ConnectionReceiver> listener;
+    if (useTcp) {
+      auto& network = test.io.provider->getNetwork();
+      listener = network.parseAddress("127.0.0.1", 0).wait(ws)->listen();
+      auto addr = network.parseAddress("127.0.0.1", listener->getPort()).wait(ws);
+      clientPromise = addr->connect().attach(kj::mv(addr))
+          .then([&](kj::Own<kj::AsyncIoStream> stream) {
+        return test.tlsClient.wrapClient(kj::mv(stream), "example.com");
+      });
+      serverPromise = listener->accept().then([&](kj::Own<kj::AsyncIoStream> stream) {
+        return test.tlsServer.wrapServer(kj::mv(stream));
+      });
+    } else {
+      auto pipe = test.io.provider->newTwoWayPipe();
+      clientPromise = test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com");
+      serverPromise = test.tlsServer.wrapServer(kj::mv(pipe.ends[1]));
+    }
+
+    auto client = e.wrap(kj::mv(clientPromise)).wait(ws);
+    auto server = e.wrap(kj::mv(serverPromise)).wait(ws);
+
+    auto writeUp = writeN(*client, "foo", 10000);
+    auto readDown = readN(*client, "bar", 10000);
+    auto writeDown = writeN(*server, "bar", 10000);
+    auto readUp = readN(*server, "foo", 10000);
+
+    readUp.wait(ws);
+    readDown.wait(ws);
+    writeUp.wait(ws);
+    writeDown.wait(ws);
+  };
+
+  test(false);
+  test(true);
+}
+
+bool connectAndCheckResumption(kj::AsyncIoContext& io, TlsContext& client, TlsContext& server) {
+  // Connects `client` to `server`, exchanges data both ways, and returns whether the session was
+  // resumed. Reading on the client lets it receive TLS 1.3 session tickets, which only arrive
+  // after the handshake.
+
+  ErrorNexus e;
+  auto pipe = io.provider->newTwoWayPipe();
+
+  auto clientPromise = e.wrap(client.wrapClient(
+      kj::AuthenticatedStream { kj::mv(pipe.ends[0]), kj::LocalPeerIdentity::newInstance({}) },
+      "example.com"));
+  auto serverPromise = e.wrap(server.wrapServer(
+      kj::AuthenticatedStream { kj::mv(pipe.ends[1]), kj::LocalPeerIdentity::newInstance({}) }));
+
+  auto clientStream = clientPromise.wait(io.waitScope);
+  auto serverStream = serverPromise.wait(io.waitScope);
+
+  auto down = writeN(*serverStream.stream, "foo", 10);
+  readN(*clientStream.stream, "foo", 10).wait(io.waitScope);
+  down.wait(io.waitScope);
+  auto up = writeN(*clientStream.stream, "bar", 10);
+  readN(*serverStream.stream, "bar", 10).wait(io.waitScope);
+  up.wait(io.waitScope);
+
+  auto& clientId = kj::downcast<TlsPeerIdentity>(*clientStream.peerIdentity);
+  auto& serverId = kj::downcast<TlsPeerIdentity>(*serverStream.peerIdentity);
+  KJ_EXPECT(clientId.isSessionResumed() == serverId.isSessionResumed());
+
+  // The peer's certificate is still known after resumption.
+  KJ_EXPECT(clientId.hasCertificate());
+  return clientId.isSessionResumed();
+}
+
+KJ_TEST("TLS client session cache") {
+  auto clientOpts = TlsTest::defaultClient();
+  clientOpts.clientSessionCacheSize = 4;
+  TlsTest test(kj::mv(clientOpts));
+
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+
+  // Without a cache, every connection is a full handshake.
+  TlsContext uncachedClient(TlsTest::defaultClient());
+  KJ_EXPECT(!connectAndCheckResumption(test.io, uncachedClient, test.tlsServer));
+  KJ_EXPECT(!connectAndCheckResumption(test.io, uncachedClient, test.tlsServer));
+}
+
+KJ_TEST("TLS shared session ticket keys") {
+  auto clientOpts = TlsTest::defaultClient();
+  clientOpts.clientSessionCacheSize = 4;
+  TlsTest test(kj::mv(clientOpts));
+
+  byte keyBytes[2][TlsContext::SESSION_TICKET_KEY_SIZE];
+  for (auto i: kj::indices(keyBytes[0])) {
+    keyBytes[0][i] = i;
+    keyBytes[1][i] = i + 1;
+  }
+  kj::ArrayPtr<const byte> oldKey = keyBytes[0];
+  kj::ArrayPtr<const byte> newKey = keyBytes[1];
+
+  // Two servers sharing a key accept each other's tickets, like a cluster would.
+  TlsContext otherServer(TlsTest::defaultServer());
+  test.tlsServer.setSessionTicketKeys(kj::arrayPtr(&oldKey, 1));
+  otherServer.setSessionTicketKeys(kj::arrayPtr(&oldKey, 1));
+
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, otherServer));
+
+  // After rotation, tickets under the old key are still honored while it's listed.
+  kj::ArrayPtr<const byte> rotated[] = { newKey, oldKey };
+  otherServer.setSessionTicketKeys(rotated);
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, otherServer));
+
+  // Once it's dropped, the client falls back to a full handshake.
+  test.tlsServer.setSessionTicketKeys(kj::arrayPtr(&oldKey, 1));
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  otherServer.setSessionTicketKeys(kj::arrayPtr(&newKey, 1));
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, otherServer));
+
+  kj::ArrayPtr<const byte> shortKey = oldKey.slice(0, 48);
+  KJ_EXPECT_THROW_MESSAGE("wrong session ticket key size",
+      test.tlsServer.setSessionTicketKeys(kj::arrayPtr(&shortKey, 1)));
+}
+
+KJ_TEST("TLS session ticket key rotation") {
+  auto clientOpts = TlsTest::defaultClient();
+  clientOpts.clientSessionCacheSize = 4;
+  kj::TimerImpl timer(kj::origin<kj::TimePoint>());
+  auto serverOpts = TlsTest::defaultServer();
+  serverOpts.timer = timer;
+  serverOpts.sessionTicketKeyLifetime = 1 * kj::HOURS;
+  TlsTest test(kj::mv(clientOpts), kj::mv(serverOpts));
+
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+
+  // The key has been retired but is still accepted, and the client receives a ticket under the
+  // new key.
+  timer.advanceTo(timer.now() + 90 * kj::MINUTES);
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+
+  // Long enough for both the current key and the one before it to expire.
+  timer.advanceTo(timer.now() + 3 * kj::HOURS);
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+}
+
+KJ_TEST("TLS handshake pool") {
+  kj::WorkerPool pool(2);
+  auto clientOpts = TlsTest::defaultClient();
+  clientOpts.clientSessionCacheSize = 4;
+  clientOpts.handshakePool = pool;
+  auto serverOpts = TlsTest::defaultServer();
+  serverOpts.handshakePool = pool;
+  TlsTest test(kj::mv(clientOpts), kj::mv(serverOpts));
+
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+  KJ_EXPECT(connectAndCheckResumption(test.io, test.tlsClient, test.tlsServer));
+
+  // A server on the event loop talks to a client on the pool.
+  TlsContext plainServer(TlsTest::defaultServer());
+  KJ_EXPECT(!connectAndCheckResumption(test.io, test.tlsClient, plainServer));
+
+  // Handshakes fail as usual.
+  {
+    ErrorNexus e;
+    auto pipe = test.io.provider->newTwoWayPipe();
+    auto clientPromise = e.wrap(test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "wrong.com"));
+    auto serverPromise = e.wrap(test.tlsServer.wrapServer(kj::mv(pipe.ends[1])));
+    KJ_EXPECT_THROW_MESSAGE("not trusted", clientPromise.wait(test.io.waitScope));
+  }
+
+  // Connections can be dropped while a step is running on the pool.
+  for (auto i KJ_UNUSED: kj::zeroTo(20)) {
+    auto pipe = test.io.provider->newTwoWayPipe();
+    auto clientPromise = test.tlsClient.wrapClient(kj::mv(pipe.ends[0]), "example.com");
+    auto serverPromise = test.tlsServer.wrapServer(kj::mv(pipe.ends[1]));
+    clientPromise.poll(test.io.waitScope);
+    serverPromise.poll(test.io.waitScope);
+  }
+}
+
 KJ_TEST("TLS certificate validation") {
   expectInvalidCert("wrong.com", TlsCertificate(kj::str(VALID_CERT, INTERMEDIATE_CERT)),
                     "Hostname mismatch");
@@ -29,15 +29,48 @@
 #include <openssl/conf.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/tls1.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
 #include "kj/async-queue.h"
 #include "kj/debug.h"
+#include "kj/map.h"
+#include "kj/mutex.h"
 #include "kj/vector.h"
 
+#if __linux__ && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+// OpenSSL can hand its record keys to Linux's kernel TLS implementation.
+#define KJ_TLS_KERNEL_OFFLOAD 1
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef BIO_CTRL_SET_KTLS
+#define BIO_CTRL_SET_KTLS 72  // OpenSSL keeps this one out of its public headers.
+#endif
+#else
+#define KJ_TLS_KERNEL_OFFLOAD 0
+#endif
+
+#if !_WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #define BIO_set_init(x,v)          (x->init=v)
 #define BIO_get_data(x)            (x->ptr)
@@ -66,6 +99,11 @@ void throwOpensslError() {
   KJ_FAIL_ASSERT("OpenSSL error", message);
 }
 
+thread_local bool onHandshakePool = false;
+// True while this thread runs a handshake step on behalf of a TlsConnection whose context has a
+// `handshakePool`. Callbacks that OpenSSL invokes during the handshake check this to avoid
+// touching anything that belongs to the connection's event loop.
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L && !defined(OPENSSL_IS_BORINGSSL)
 // Older versions of OpenSSL don't define _up_ref() functions.
 
@@ -105,11 +143,14 @@ inline void ensureOpenSslInitialized() {
 // =======================================================================================
 // Implementation of kj::AsyncIoStream that applies TLS on top of some other AsyncIoStream.
 //
-// TODO(perf): OpenSSL's I/O abstraction layer, "BIO", is readiness-based, but AsyncIoStream is
-//   completion-based. This forces us to use an intermediate buffer which wastes memory and incurs
-//   redundant copies. We could improve the situation by creating a way to detect if the underlying
-//   AsyncIoStream is simply wrapping a file descriptor (or other readiness-based stream?) and use
-//   that directly if so.
+// OpenSSL's I/O abstraction layer, "BIO", is readiness-based, but AsyncIoStream is
+// completion-based, so in general we go through an intermediate buffer, which costs a copy in
+// each direction. When the underlying stream wraps a non-blocking file descriptor, the BIO
+// instead reads and writes the descriptor directly whenever the buffers are empty, falling back to
+// them only to wait for readiness. (With `TlsContext::Options::kernelTls`, the kernel takes over
+// after the handshake and this class drops out of the picture entirely, which is better still.)
+//
+// TODO(perf): Streams that aren't file descriptors still pay for the copies.
 
 class TlsConnection final: public kj::AsyncIoStream {
 public:
@@ -134,6 +175,16 @@ public:
     BIO_set_data(bio, this);
     BIO_set_init(bio, 1);
     SSL_set_bio(ssl, bio, bio);
+
+#if !_WIN32
+    KJ_IF_MAYBE(fd, stream.getTransparentFd()) {
+      int flags = fcntl(*fd, F_GETFL);
+      if (flags >= 0 && (flags & O_NONBLOCK)) {
+        directFd = *fd;
+        setDirectReads();
+      }
+    }
+#endif
   }
 
   kj::Promise<void> connect(kj::StringPtr expectedServerHostname) {
@@ -159,7 +210,8 @@ public:
     // https://letsencrypt.org/docs/dst-root-ca-x3-expiration-september-2021/
     X509_VERIFY_PARAM_set_flags(verify, X509_V_FLAG_TRUSTED_FIRST);
 
-    return sslCall([this]() { return SSL_connect(ssl); }).then([this](size_t) {
+    isClient = true;
+    return handshakeCall([this]() { return SSL_connect(ssl); }).then([this](size_t) {
       X509* cert = SSL_get_peer_certificate(ssl);
       KJ_REQUIRE(cert != nullptr, "TLS peer provided no certificate");
       X509_free(cert);
@@ -176,7 +228,7 @@ public:
     // We are the server. Set SSL options to prefer server's cipher choice.
     SSL_set_options(ssl, SSL_OP_CIPHER_SERVER_PREFERENCE);
 
-    auto acceptPromise = sslCall([this]() {
+    auto acceptPromise = handshakeCall([this]() {
       return SSL_accept(ssl);
     });
     return acceptPromise.then([](size_t ret) {
@@ -188,27 +240,120 @@ public:
   }
 
   kj::Own<TlsPeerIdentity> getIdentity(kj::Own<kj::PeerIdentity> inner) {
-    return kj::heap<TlsPeerIdentity>(SSL_get_peer_certificate(ssl), kj::mv(inner),
-                                     kj::Badge<TlsConnection>());
+    kj::Maybe<kj::String> alpn;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L || defined(OPENSSL_IS_BORINGSSL)
+    const unsigned char* proto = nullptr;
+    unsigned int protoLen = 0;
+    SSL_get0_alpn_selected(ssl, &proto, &protoLen);
+    if (proto != nullptr && protoLen > 0) {
+      alpn = kj::heapString(reinterpret_cast<const char*>(proto), protoLen);
+    }
+#endif
+    return kj::heap<TlsPeerIdentity>(SSL_get_peer_certificate(ssl), kj::mv(inner), kj::mv(alpn),
+                                     SSL_session_reused(ssl), kj::Badge<TlsConnection>());
   }
 
   ~TlsConnection() noexcept(false) {
+    KJ_IF_MAYBE(o, offload) {
+      // A pool thread may be using `ssl`. If it hasn't started, make sure it won't; if it has,
+      // wait for it to finish.
+      auto lock = o->get()->step.lockExclusive();
+      if (*lock == OffloadStep::QUEUED) *lock = OffloadStep::CANCELED;
+      lock.wait([](OffloadStep step) { return step != OffloadStep::RUNNING; });
+    }
     SSL_free(ssl);
   }
 
+  void setHandshakePool(const kj::WorkerPool& pool) {
+    // Run the CPU-heavy steps of the handshake on `pool`. See
+    // `TlsContext::Options::handshakePool`.
+    offload = kj::atomicRefcounted<OffloadState>(pool);
+  }
+
+  void resumeSession(SSL_SESSION* session) {
+    // Offer a cached session to the server. Takes ownership of the caller's reference.
+    KJ_DEFER(SSL_SESSION_free(session));
+    if (!SSL_set_session(ssl, session)) {
+      throwOpensslError();
+    }
+  }
+
+  void requestKernelTls() {
+    // Asks OpenSSL to offer us its record keys as it switches to them, so that offloadIfPossible()
+    // can install them in the kernel once the handshake is over.
+#if KJ_TLS_KERNEL_OFFLOAD
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+
+    // Anything we read from the socket past the end of the handshake would be lost when the
+    // kernel takes over, so until then, read no more than OpenSSL asks for.
+    readBuffer.setExactReads(true);
+    SSL_set_read_ahead(ssl, 0);
+    kernelTlsRequested = true;
+#endif
+  }
+
+  static kj::Promise<kj::Own<kj::AsyncIoStream>> offloadIfPossible(kj::Own<TlsConnection> conn) {
+    // Call after the handshake completes, if requestKernelTls() was called. If the kernel can take
+    // over both directions, returns the underlying stream with the kernel's TLS enabled on it,
+    // discarding the TlsConnection. If it can only take over transmission -- notably, OpenSSL 3.0
+    // only offers TLS 1.3 transmit keys -- returns the TlsConnection, which then writes through
+    // to the underlying stream but still decrypts reads itself. Otherwise returns the
+    // TlsConnection unchanged.
+
+#if KJ_TLS_KERNEL_OFFLOAD
+    if (conn->kernelTlsRequested) {
+      conn->readBuffer.setExactReads(false);
+      if (conn->directFd != nullptr) conn->setDirectReads();
+      if (conn->txKeys.size > 0 && conn->inner.getTransparentFd() != nullptr) {
+        // Everything OpenSSL wrote must reach the socket before the kernel starts encrypting.
+        auto& ref = *conn;
+        return ref.writeBuffer.flush().then([conn = kj::mv(conn)]() mutable
+            -> kj::Own<kj::AsyncIoStream> {
+          int fd = KJ_ASSERT_NONNULL(conn->inner.getTransparentFd());
+
+          // The "tls" ULP passes traffic through untouched until keys are installed, so if the
+          // kernel lacks it, or rejects the key (e.g. an unsupported cipher), we carry on in
+          // userspace.
+          if (::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 ||
+              !installKernelKey(fd, TLS_TX, conn->txKeys)) {
+            return kj::mv(conn);
+          }
+
+          if (conn->canOffloadReceive() && installKernelKey(fd, TLS_RX, conn->rxKeys)) {
+            return kj::mv(conn->ownInner);
+          }
+
+          conn->kernelTransmit = true;
+          return kj::mv(conn);
+        });
+      }
+    }
+#endif
+
+    return kj::Own<kj::AsyncIoStream>(kj::mv(conn));
+  }
+
   kj::Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
     return tryReadInternal(buffer, minBytes, maxBytes, 0);
   }
 
   Promise<void> write(const void* buffer, size_t size) override {
+    if (kernelTransmit) return inner.write(buffer, size);
     return writeInternal(kj::arrayPtr(reinterpret_cast<const byte*>(buffer), size), nullptr);
   }
 
   Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    if (kernelTransmit) return inner.write(pieces);
     auto cork = writeBuffer.cork();
     return writeInternal(pieces[0], pieces.slice(1, pieces.size())).attach(kj::mv(cork));
   }
 
+  Maybe<Promise<uint64_t>> tryPumpFrom(AsyncInputStream& input, uint64_t amount) override {
+    // With the kernel encrypting, the underlying stream may be able to splice() straight in.
+    if (kernelTransmit) return inner.tryPumpFrom(input, amount);
+    return nullptr;
+  }
+
   Promise<void> whenWriteDisconnected() override {
     return inner.whenWriteDisconnected();
   }
@@ -216,6 +361,13 @@ public:
   void shutdownWrite() override {
     KJ_REQUIRE(shutdownTask == nullptr, "already called shutdownWrite()");
 
+    if (kernelTransmit) {
+      // OpenSSL can no longer write, so we can't send close_notify.
+      shutdownTask = kj::Promise<void>(kj::READY_NOW);
+      inner.shutdownWrite();
+      return;
+    }
+
     // TODO(0.10): shutdownWrite() is problematic because it doesn't return a promise. It was
     //   designed to assume that it would only be called after all writes are finished and that
     //   there was no reason to block at that point, but SSL sessions don't fit this since they
@@ -262,6 +414,163 @@ private:
   ReadyInputStreamWrapper readBuffer;
   ReadyOutputStreamWrapper writeBuffer;
 
+  bool isClient = false;
+
+  bool kernelTransmit = false;
+  // True if the kernel encrypts what we write to `inner`, so writes bypass OpenSSL.
+
+  kj::Maybe<int> directFd;
+  // The non-blocking file descriptor underlying `inner`, if any, which the BIO reads and writes
+  // directly while `readBuffer` and `writeBuffer` are empty.
+
+  void setDirectReads() {
+    // With direct reads, `readBuffer` only serves to wait for the descriptor to become readable,
+    // so it should take no more than OpenSSL asked for. Letting OpenSSL read ahead instead fills
+    // its record buffer straight from the descriptor, a whole buffer per system call.
+    readBuffer.setExactReads(true);
+    SSL_set_read_ahead(ssl, 1);
+  }
+
+  enum class OffloadStep { IDLE, QUEUED, RUNNING, CANCELED };
+
+  struct OffloadState: public kj::AtomicRefcounted {
+    // Shared with the pool thread running a handshake step, which may outlive the connection.
+
+    explicit OffloadState(const kj::WorkerPool& pool): pool(pool), step(OffloadStep::IDLE) {}
+
+    const kj::WorkerPool& pool;
+    kj::MutexGuarded<OffloadStep> step;
+  };
+
+  kj::Maybe<kj::Own<OffloadState>> offload;
+  // Set by setHandshakePool().
+
+  bool offloaded = false;
+  // True while a pool thread owns `ssl`. The BIO then reads from `offloadIn` and writes to
+  // `offloadOut` instead of `readBuffer` and `writeBuffer`, which belong to the event loop.
+
+  kj::Vector<byte> offloadIn;
+  size_t offloadInPos = 0;
+  bool offloadEof = false;
+  kj::Vector<byte> offloadOut;
+
+#if KJ_TLS_KERNEL_OFFLOAD
+  bool kernelTlsRequested = false;
+
+  class RecordCounter {
+    // Counts the TLS records in a byte stream by following their 5-byte headers. Records written
+    // or read by OpenSSL after it offered a key advance that key's sequence number, which the
+    // kernel needs to know.
+
+  public:
+    void reset() { *this = RecordCounter(); }
+
+    void add(kj::ArrayPtr<const byte> bytes) {
+      while (bytes.size() > 0) {
+        if (bodyRemaining > 0) {
+          size_t n = kj::min(bodyRemaining, bytes.size());
+          bodyRemaining -= n;
+          bytes = bytes.slice(n, bytes.size());
+        } else {
+          header[headerPos++] = bytes[0];
+          bytes = bytes.slice(1, bytes.size());
+          if (headerPos == sizeof(header)) {
+            bodyRemaining = (size_t(header[3]) << 8) | header[4];
+            headerPos = 0;
+            ++count;
+          }
+        }
+      }
+    }
+
+    uint64_t getCount() const { return count; }
+
+  private:
+    uint64_t count = 0;
+    byte header[5];
+    uint headerPos = 0;
+    size_t bodyRemaining = 0;
+  };
+
+  struct KernelKeys {
+    // A `struct tls12_crypto_info_*` as offered by OpenSSL for one direction of the connection.
+    // Despite the name, the same structs are used for TLS 1.3.
+
+    union {
+      struct tls_crypto_info info;
+      byte bytes[64];
+    };
+    size_t size = 0;  // zero if no usable key has been offered
+    RecordCounter records;
+
+    ~KernelKeys() { OPENSSL_cleanse(bytes, sizeof(bytes)); }
+  };
+
+  KernelKeys txKeys;
+  KernelKeys rxKeys;
+
+  void offerKernelKeys(bool isTx, const void* cryptoInfo) {
+    // OpenSSL is switching keys for one direction and has asked our BIO to enable kernel
+    // encryption with them. We can't do so yet, since the handshake usually isn't finished, so we
+    // record them for later.
+
+    auto& keys = isTx ? txKeys : rxKeys;
+    keys.records.reset();
+
+    // OpenSSL's struct wraps the kernel's in a union followed by its own length field, whose
+    // offset varies with the OpenSSL build, so we work out the length from the cipher instead.
+    struct tls_crypto_info info;
+    memcpy(&info, cryptoInfo, sizeof(info));
+    switch (info.cipher_type) {
+      case TLS_CIPHER_AES_GCM_128: keys.size = sizeof(tls12_crypto_info_aes_gcm_128); break;
+#ifdef TLS_CIPHER_AES_GCM_256
+      case TLS_CIPHER_AES_GCM_256: keys.size = sizeof(tls12_crypto_info_aes_gcm_256); break;
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+      case TLS_CIPHER_AES_CCM_128: keys.size = sizeof(tls12_crypto_info_aes_ccm_128); break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+      case TLS_CIPHER_CHACHA20_POLY1305:
+        keys.size = sizeof(tls12_crypto_info_chacha20_poly1305);
+        break;
+#endif
+      default:
+        keys.size = 0;
+        return;
+    }
+    KJ_ASSERT(keys.size <= sizeof(keys.bytes));
+    memcpy(keys.bytes, cryptoInfo, keys.size);
+  }
+
+  bool canOffloadReceive() {
+    if (rxKeys.size == 0) return false;  // OpenSSL didn't offer a key
+    if (ownInner.get() == nullptr) return false;  // we can't hand over the stream
+    if (readBuffer.hasBufferedInput()) return false;  // would lose data
+
+    // A TLS 1.3 server sends session tickets after the handshake, which a plain read() from a
+    // kernel TLS socket can't receive.
+    if (isClient && SSL_version(ssl) != TLS1_2_VERSION) return false;
+
+    return true;
+  }
+
+  static bool installKernelKey(int fd, int direction, KernelKeys& keys) {
+    // Installs one direction's key in the kernel. Returns false if the kernel rejects it.
+
+    // The sequence number is the last field of every variant of the struct, big-endian.
+    byte* seq = keys.bytes + keys.size - 8;
+    uint64_t value = 0;
+    for (uint i = 0; i < 8; i++) value = (value << 8) | seq[i];
+    value += keys.records.getCount();
+    for (uint i = 8; i-- > 0;) {
+      seq[i] = value;
+      value >>= 8;
+    }
+
+    return ::setsockopt(fd, SOL_TLS, direction, keys.bytes, keys.size) == 0;
+  }
+#endif  // KJ_TLS_KERNEL_OFFLOAD
+
   kj::Promise<size_t> tryReadInternal(
       void* buffer, size_t minBytes, size_t maxBytes, size_t alreadyDone) {
     if (disconnected) return alreadyDone;
@@ -305,6 +614,125 @@ private:
     });
   }
 
+  template <typename Func>
+  kj::Promise<size_t> handshakeCall(Func&& func) {
+    // Runs a handshake function via sslCall(), or on the handshake pool if there is one. We don't
+    // offload when handing keys to the kernel, since offloading reads ahead of what OpenSSL asks
+    // for.
+
+#if KJ_TLS_KERNEL_OFFLOAD
+    if (kernelTlsRequested) return sslCall(kj::fwd<Func>(func));
+#endif
+    if (offload == nullptr) return sslCall(kj::fwd<Func>(func));
+    return offloadedSslCall(kj::fwd<Func>(func));
+  }
+
+  struct OffloadResult {
+    int result;
+    int error;
+  };
+
+  template <typename Func>
+  kj::Promise<size_t> offloadedSslCall(Func&& func) {
+    // Like sslCall(), but calls `func` on the handshake pool. The BIO works on `offloadIn` and
+    // `offloadOut` meanwhile; between steps, we move their contents to and from the event loop's
+    // buffers.
+
+    if (disconnected) return size_t(0);
+
+    auto& state = *KJ_ASSERT_NONNULL(offload);
+    *state.step.lockExclusive() = OffloadStep::QUEUED;
+    offloaded = true;
+
+    auto promise = state.pool.run(
+        [this, func, state = kj::atomicAddRef(state)]() mutable -> OffloadResult {
+      {
+        auto lock = state->step.lockExclusive();
+        if (*lock == OffloadStep::CANCELED) return { 0, SSL_ERROR_NONE };
+        *lock = OffloadStep::RUNNING;
+      }
+      KJ_DEFER(*state->step.lockExclusive() = OffloadStep::IDLE);
+      // (Once the step is IDLE, the connection may be destroyed, so we touch nothing after.)
+
+      onHandshakePool = true;
+      KJ_DEFER(onHandshakePool = false);
+
+      // OpenSSL's error queue is per-thread, so errors must be collected here.
+      ERR_clear_error();
+      int result = func();
+      int error = result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl, result);
+      if (error == SSL_ERROR_SSL) throwOpensslError();
+      return { result, error };
+    });
+
+    return promise.then([this, func = kj::fwd<Func>(func)](OffloadResult r) mutable {
+      offloaded = false;
+      if (offloadInPos == offloadIn.size()) {
+        offloadIn.clear();
+        offloadInPos = 0;
+      }
+      return flushOffloadOut(0).then([this, func = kj::mv(func), r]() mutable
+                                    -> kj::Promise<size_t> {
+        switch (r.error) {
+          case SSL_ERROR_NONE:
+            return size_t(r.result);
+          case SSL_ERROR_ZERO_RETURN:
+            disconnected = true;
+            return size_t(0);
+          case SSL_ERROR_WANT_READ:
+            return fillOffloadIn().then([this, func = kj::mv(func)]() mutable {
+              return offloadedSslCall(kj::mv(func));
+            });
+          case SSL_ERROR_WANT_WRITE:
+            // Can't happen, since `offloadOut` takes everything, but retrying is harmless.
+            return offloadedSslCall(kj::mv(func));
+          case SSL_ERROR_SYSCALL:
+            if (r.result == 0) {
+              disconnected = true;
+              return size_t(0);
+            } else {
+              return KJ_EXCEPTION(DISCONNECTED, "SSL unable to continue I/O");
+            }
+          default:
+            KJ_FAIL_ASSERT("unexpected SSL error code", r.error);
+        }
+      });
+    }, [this](kj::Exception&& e) -> kj::Promise<size_t> {
+      offloaded = false;
+      return kj::mv(e);
+    });
+  }
+
+  kj::Promise<void> flushOffloadOut(size_t pos) {
+    // Passes what OpenSSL wrote on the pool thread, from `pos` on, to the write buffer.
+
+    while (pos < offloadOut.size()) {
+      KJ_IF_MAYBE(n, writeBuffer.write(offloadOut.asPtr().slice(pos, offloadOut.size()))) {
+        pos += *n;
+      } else {
+        return writeBuffer.whenReady().then([this, pos]() { return flushOffloadOut(pos); });
+      }
+    }
+    offloadOut.clear();
+    return kj::READY_NOW;
+  }
+
+  kj::Promise<void> fillOffloadIn() {
+    // Reads more input for the next step on the pool thread.
+
+    byte buffer[4096];
+    KJ_IF_MAYBE(n, readBuffer.read(buffer)) {
+      if (*n == 0) {
+        offloadEof = true;
+      } else {
+        offloadIn.addAll(buffer, buffer + *n);
+      }
+      return kj::READY_NOW;
+    } else {
+      return readBuffer.whenReady().then([this]() { return fillOffloadIn(); });
+    }
+  }
+
   template <typename Func>
   kj::Promise<size_t> sslCall(Func&& func) {
     if (disconnected) return size_t(0);
@@ -345,8 +773,39 @@ private:
 
   static int bioRead(BIO* b, char* out, int outl) {
     BIO_clear_retry_flags(b);
-    KJ_IF_MAYBE(n, reinterpret_cast<TlsConnection*>(BIO_get_data(b))->readBuffer
-        .read(kj::arrayPtr(out, outl).asBytes())) {
+    auto& conn = *reinterpret_cast<TlsConnection*>(BIO_get_data(b));
+    if (conn.offloaded) {
+      size_t n = kj::min(size_t(outl), conn.offloadIn.size() - conn.offloadInPos);
+      if (n == 0) {
+        if (conn.offloadEof) return 0;
+        BIO_set_retry_read(b);
+        return -1;
+      }
+      memcpy(out, conn.offloadIn.begin() + conn.offloadInPos, n);
+      conn.offloadInPos += n;
+      return n;
+    }
+#if !_WIN32
+    KJ_IF_MAYBE(fd, conn.directFd) {
+      if (!conn.readBuffer.hasBufferedInput()) {
+        ssize_t n;
+        do {
+          n = ::read(*fd, out, outl);
+        } while (n < 0 && errno == EINTR);
+        if (n >= 0) {
+#if KJ_TLS_KERNEL_OFFLOAD
+          if (conn.kernelTlsRequested) conn.rxKeys.records.add(kj::arrayPtr(out, n).asBytes());
+#endif
+          return n;
+        }
+        // Not readable yet, or an error, which the buffered read will report.
+      }
+    }
+#endif
+    KJ_IF_MAYBE(n, conn.readBuffer.read(kj::arrayPtr(out, outl).asBytes())) {
+#if KJ_TLS_KERNEL_OFFLOAD
+      if (conn.kernelTlsRequested) conn.rxKeys.records.add(kj::arrayPtr(out, *n).asBytes());
+#endif
       return *n;
     } else {
       BIO_set_retry_read(b);
@@ -356,8 +815,37 @@ private:
 
   static int bioWrite(BIO* b, const char* in, int inl) {
     BIO_clear_retry_flags(b);
-    KJ_IF_MAYBE(n, reinterpret_cast<TlsConnection*>(BIO_get_data(b))->writeBuffer
-        .write(kj::arrayPtr(in, inl).asBytes())) {
+    auto& conn = *reinterpret_cast<TlsConnection*>(BIO_get_data(b));
+    if (conn.kernelTransmit) {
+      // OpenSSL wants to send something after the kernel took over, such as a key update. We
+      // can't let it, since its ciphertext would be encrypted again.
+      return -1;
+    }
+    if (conn.offloaded) {
+      conn.offloadOut.addAll(in, in + inl);
+      return inl;
+    }
+#if !_WIN32
+    KJ_IF_MAYBE(fd, conn.directFd) {
+      if (conn.writeBuffer.isIdle()) {
+        ssize_t n;
+        do {
+          n = ::write(*fd, in, inl);
+        } while (n < 0 && errno == EINTR);
+        if (n > 0) {
+#if KJ_TLS_KERNEL_OFFLOAD
+          if (conn.kernelTlsRequested) conn.txKeys.records.add(kj::arrayPtr(in, n).asBytes());
+#endif
+          return n;
+        }
+        // Not writable yet, or an error, which the buffered write will report.
+      }
+    }
+#endif
+    KJ_IF_MAYBE(n, conn.writeBuffer.write(kj::arrayPtr(in, inl).asBytes())) {
+#if KJ_TLS_KERNEL_OFFLOAD
+      if (conn.kernelTlsRequested) conn.txKeys.records.add(kj::arrayPtr(in, *n).asBytes());
+#endif
       return *n;
     } else {
       BIO_set_retry_write(b);
@@ -373,6 +861,16 @@ private:
       case BIO_CTRL_POP:
         // Informational?
         return 0;
+#if KJ_TLS_KERNEL_OFFLOAD
+      case BIO_CTRL_SET_KTLS:
+        // OpenSSL offers the keys it's switching to. Returning 0 tells it that the kernel didn't
+        // take them, so it keeps encrypting for now.
+        reinterpret_cast<TlsConnection*>(BIO_get_data(b))->offerKernelKeys(num != 0, ptr);
+        return 0;
+      case BIO_CTRL_GET_KTLS_SEND:
+      case BIO_CTRL_GET_KTLS_RECV:
+        return 0;
+#endif
       default:
         KJ_LOG(WARNING, "unimplemented bio_ctrl", cmd);
         return 0;
@@ -614,7 +1112,9 @@ TlsContext::Options::Options()
     : useSystemTrustStore(true),
       verifyClients(false),
       minVersion(TlsVersion::TLS_1_2),
-      cipherList("ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305") {}
+      cipherList("ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"),
+      kernelTls(false),
+      clientSessionCacheSize(0) {}
 // Cipher list is Mozilla's "intermediate" list, except with classic DH removed since we don't
 // currently support setting dhparams. See:
 //     https://mozilla.github.io/server-side-tls/ssl-config-generator/
@@ -629,6 +1129,274 @@ struct TlsContext::SniCallback {
   static int callback(SSL* ssl, int* ad, void* arg);
 };
 
+struct TlsContext::AlpnCallback {
+  // Same deal as SniCallback.
+
+  static int callback(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                      const unsigned char* in, unsigned int inlen, void* arg);
+};
+
+struct TlsContext::Sessions {
+  // Session resumption state: the client's cache of sessions by hostname, and the server's
+  // session ticket keys. The state is behind a mutex, since with a handshake pool, OpenSSL's
+  // callbacks run on the pool's threads.
+
+  Sessions(size_t clientCacheSize, kj::Maybe<kj::Timer&> timer,
+           kj::Maybe<kj::Duration> ticketKeyLifetime)
+      : clientCacheSize(clientCacheSize), timer(timer), state(ticketKeyLifetime) {}
+  KJ_DISALLOW_COPY(Sessions);
+
+  ~Sessions() noexcept(false) {
+    auto lock = state.lockExclusive();
+    for (auto& entry: lock->clientCache) {
+      SSL_SESSION_free(entry.value.session);
+    }
+    for (auto& key: lock->ticketKeys) {
+      OPENSSL_cleanse(key.bytes, sizeof(key.bytes));
+    }
+  }
+
+  static Sessions& from(SSL* ssl) {
+    return *reinterpret_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)))->sessions;
+  }
+
+  // ---------------------------------------------------------------------------
+  // client side
+
+  struct CachedSession {
+    SSL_SESSION* session;
+    uint64_t lastUsed;
+  };
+
+  size_t clientCacheSize;
+
+  void addClientSession(kj::StringPtr hostname, SSL_SESSION* session) {
+    // Takes ownership of `session`, replacing any earlier one for the same host.
+
+    auto lock = state.lockExclusive();
+    auto& clientCache = lock->clientCache;
+    auto& useCounter = lock->useCounter;
+    KJ_IF_MAYBE(entry, clientCache.find(hostname)) {
+      SSL_SESSION_free(entry->session);
+      entry->session = session;
+      entry->lastUsed = ++useCounter;
+      return;
+    }
+
+    if (clientCache.size() >= clientCacheSize) {
+      // Evict the least-recently-used host. The cache is small, so a scan is fine.
+      auto* oldest = clientCache.begin();
+      for (auto& entry: clientCache) {
+        if (entry.value.lastUsed < oldest->value.lastUsed) oldest = &entry;
+      }
+      SSL_SESSION_free(oldest->value.session);
+      clientCache.erase(*oldest);
+    }
+
+    clientCache.insert(kj::str(hostname), { session, ++useCounter });
+  }
+
+  kj::Maybe<SSL_SESSION*> getClientSession(kj::StringPtr hostname) {
+    // Returns a new reference to the session cached for `hostname`, if any.
+
+    auto lock = state.lockExclusive();
+    auto& clientCache = lock->clientCache;
+    auto& entry = KJ_UNWRAP_OR_RETURN(clientCache.findEntry(hostname), nullptr);
+    SSL_SESSION* session = entry.value.session;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    if (!SSL_SESSION_is_resumable(session)) {
+      SSL_SESSION_free(session);
+      clientCache.erase(entry);
+      return nullptr;
+    }
+
+    if (SSL_SESSION_get_protocol_version(session) == TLS1_3_VERSION) {
+      // TLS 1.3 tickets are meant to be used once, so that connections can't be linked. The
+      // resumed connection will receive new ones.
+      clientCache.erase(entry);
+      return session;
+    }
+#endif
+
+    entry.value.lastUsed = ++lock->useCounter;
+    SSL_SESSION_up_ref(session);
+    return session;
+  }
+
+  static int newSessionCallback(SSL* ssl, SSL_SESSION* session) {
+    // Called by OpenSSL when it has a session worth caching. Returning 1 means we took
+    // ownership of the reference; 0 means OpenSSL keeps it.
+
+    if (SSL_is_server(ssl)) return 0;
+    const char* hostname = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (hostname == nullptr) return 0;
+
+    auto& sessions = from(ssl);
+    if (sessions.clientCacheSize == 0) return 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_IS_BORINGSSL)
+    // OpenSSL marks the connection's current session non-resumable if the connection is freed
+    // without a close_notify, and with TLS 1.3 that's the very session we're handed here. Tickets
+    // stay valid however the connection ends, so cache a copy that it can't invalidate.
+    SSL_SESSION* copy = SSL_SESSION_dup(session);
+    if (copy != nullptr) sessions.addClientSession(hostname, copy);
+    return 0;
+#else
+    sessions.addClientSession(hostname, session);
+    return 1;
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+  // server side
+
+  struct TicketKey {
+    byte bytes[SESSION_TICKET_KEY_SIZE];
+    kj::TimePoint created = kj::origin<kj::TimePoint>();  // only for automatically-generated keys
+
+    static constexpr size_t NAME_SIZE = 16;
+    static constexpr size_t HMAC_KEY_SIZE = 32;
+    const byte* name() const { return bytes; }
+    const byte* hmacKey() const { return bytes + NAME_SIZE; }
+    const byte* aesKey() const { return bytes + NAME_SIZE + HMAC_KEY_SIZE; }
+  };
+
+  kj::Maybe<kj::Timer&> timer;
+
+  // ---------------------------------------------------------------------------
+  // mutable state
+
+  struct State {
+    explicit State(kj::Maybe<kj::Duration> ticketKeyLifetime)
+        : ticketKeyLifetime(ticketKeyLifetime) {}
+
+    kj::HashMap<kj::String, CachedSession> clientCache;
+    uint64_t useCounter = 0;
+
+    kj::Maybe<kj::Duration> ticketKeyLifetime;  // null once keys are set explicitly
+    kj::Vector<TicketKey> ticketKeys;  // ticketKeys[0] issues new tickets
+  };
+
+  kj::MutexGuarded<State> state;
+
+  void rotateTicketKeysIfDue() {
+    rotateTicketKeysIfDue(*state.lockExclusive());
+  }
+
+  void rotateTicketKeysIfDue(State& state) {
+    // Only call on the event loop's thread, since it reads the timer.
+
+    auto& ticketKeys = state.ticketKeys;
+    auto& lifetime = KJ_UNWRAP_OR_RETURN(state.ticketKeyLifetime);
+    auto now = KJ_ASSERT_NONNULL(timer).now();
+    if (ticketKeys.size() > 0 && now - ticketKeys[0].created < lifetime) return;
+
+    // The key being retired stays valid for decryption for one more lifetime, which is as long
+    // as it takes the new key to be retired in turn. Anything older goes.
+    kj::Vector<TicketKey> newKeys(2);
+    auto& key = newKeys.add();
+    if (RAND_bytes(key.bytes, sizeof(key.bytes)) != 1) {
+      throwOpensslError();
+    }
+    key.created = now;
+    if (ticketKeys.size() > 0 && now - ticketKeys[0].created < lifetime * 2) {
+      newKeys.add(ticketKeys[0]);
+    }
+    for (auto& old: ticketKeys) {
+      OPENSSL_cleanse(old.bytes, sizeof(old.bytes));
+    }
+    ticketKeys = kj::mv(newKeys);
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  typedef EVP_MAC_CTX TicketHmacCtx;
+
+  static void initTicketHmac(EVP_MAC_CTX* hctx, TicketKey& key) {
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<byte*>(key.hmacKey()),
+                                        TicketKey::HMAC_KEY_SIZE),
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+      OSSL_PARAM_construct_end()
+    };
+    if (!EVP_MAC_CTX_set_params(hctx, params)) {
+      throwOpensslError();
+    }
+  }
+#else
+  typedef HMAC_CTX TicketHmacCtx;
+
+  static void initTicketHmac(HMAC_CTX* hctx, TicketKey& key) {
+    if (!HMAC_Init_ex(hctx, key.hmacKey(), TicketKey::HMAC_KEY_SIZE, EVP_sha256(), nullptr)) {
+      throwOpensslError();
+    }
+  }
+#endif
+
+  static bool isTls13(SSL* ssl) {
+#ifdef TLS1_3_VERSION
+    return SSL_version(ssl) == TLS1_3_VERSION;
+#else
+    return false;
+#endif
+  }
+
+  static int ticketKeyCallback(SSL* ssl, unsigned char* keyName, unsigned char* iv,
+                               EVP_CIPHER_CTX* cctx, TicketHmacCtx* hctx, int encrypt) {
+    // Called by OpenSSL to encrypt a new session ticket or decrypt one presented by a client.
+    // Returns 1 on success, 2 if the ticket should be renewed, 0 if the ticket's key is unknown
+    // (forcing a full handshake), and -1 on error. TLS 1.3 tickets are always renewed, since
+    // OpenSSL otherwise sends no new tickets on resumption and clients use each ticket once.
+
+    int result = -1;
+    KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+      auto& sessions = from(ssl);
+      auto lock = sessions.state.lockExclusive();
+      if (!onHandshakePool) {
+        // On a pool thread, we can't read the timer. Keys were rotated before the handshake began.
+        sessions.rotateTicketKeysIfDue(*lock);
+      }
+      auto& ticketKeys = lock->ticketKeys;
+
+      if (encrypt) {
+        auto& key = ticketKeys[0];
+        memcpy(keyName, key.name(), TicketKey::NAME_SIZE);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+            !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aesKey(), iv)) {
+          throwOpensslError();
+        }
+        initTicketHmac(hctx, key);
+        result = 1;
+      } else {
+        result = 0;
+        for (auto i: kj::indices(ticketKeys)) {
+          auto& key = ticketKeys[i];
+          if (memcmp(keyName, key.name(), TicketKey::NAME_SIZE) == 0) {
+            initTicketHmac(hctx, key);
+            if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aesKey(), iv)) {
+              throwOpensslError();
+            }
+            result = i == 0 && !isTls13(ssl) ? 1 : 2;
+            break;
+          }
+        }
+      }
+    })) {
+      KJ_LOG(ERROR, "exception in TLS session ticket callback", *exception);
+      return -1;
+    }
+    return result;
+  }
+
+  static void installTicketKeyCallback(SSL_CTX* ctx) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &ticketKeyCallback);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, &ticketKeyCallback);
+#endif
+  }
+};
+
 TlsContext::TlsContext(Options options) {
   ensureOpenSslInitialized();
 
@@ -717,13 +1485,60 @@ TlsContext::TlsContext(Options options) {
     SSL_CTX_set_tlsext_servername_arg(ctx, sni);
   }
 
+  // honor options.alpnProtocols
+  if (options.alpnProtocols.size() > 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L || defined(OPENSSL_IS_BORINGSSL)
+    kj::Vector<byte> wire;
+    for (auto proto: options.alpnProtocols) {
+      KJ_REQUIRE(proto.size() > 0 && proto.size() < 256, "invalid ALPN protocol name", proto);
+      wire.add(proto.size());
+      wire.addAll(proto.asBytes());
+    }
+    alpnProtocols = wire.releaseAsArray();
+
+    // Used when acting as a client. Note that this function returns zero on success.
+    if (SSL_CTX_set_alpn_protos(ctx, alpnProtocols.begin(), alpnProtocols.size()) != 0) {
+      throwOpensslError();
+    }
+
+    // Used when acting as a server.
+    SSL_CTX_set_alpn_select_cb(ctx, &AlpnCallback::callback, this);
+#else
+    KJ_UNIMPLEMENTED("ALPN requires OpenSSL 1.0.2 or newer");
+#endif
+  }
+
   KJ_IF_MAYBE(timeout, options.acceptTimeout) {
     this->timer = KJ_REQUIRE_NONNULL(options.timer,
         "acceptTimeout option requires that a timer is also provided");
     this->acceptTimeout = *timeout;
   }
 
+  // honor session resumption options
+  SSL_CTX_set_app_data(ctx, this);
+  sessions = kj::heap<Sessions>(options.clientSessionCacheSize, options.timer,
+                                options.sessionTicketKeyLifetime);
+  if (options.clientSessionCacheSize > 0) {
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_BOTH);
+    SSL_CTX_sess_set_new_cb(ctx, &Sessions::newSessionCallback);
+  }
+  if (options.sessionTicketKeyLifetime != nullptr) {
+    KJ_REQUIRE(options.timer != nullptr,
+        "sessionTicketKeyLifetime option requires that a timer is also provided");
+    Sessions::installTicketKeyCallback(ctx);
+  }
+  if (options.verifyClients) {
+    // Servers that verify clients refuse to resume sessions (failing the whole handshake, not
+    // just the resumption) unless a session ID context is set.
+    static const unsigned char SESSION_ID_CONTEXT[] = "kj-tls-verified";
+    if (!SSL_CTX_set_session_id_context(ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1)) {
+      throwOpensslError();
+    }
+  }
+
   this->acceptErrorHandler = kj::mv(options.acceptErrorHandler);
+  this->kernelTls = options.kernelTls;
+  this->handshakePool = options.handshakePool;
 
   this->ctx = ctx;
 }
@@ -771,6 +1586,26 @@ int TlsContext::SniCallback::callback(SSL* ssl, int* ad, void* arg) {
   return SSL_TLSEXT_ERR_OK;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L || defined(OPENSSL_IS_BORINGSSL)
+int TlsContext::AlpnCallback::callback(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                                       const unsigned char* in, unsigned int inlen, void* arg) {
+  // The last parameter is actually type TlsContext*.
+
+  auto& protos = reinterpret_cast<TlsContext*>(arg)->alpnProtocols;
+
+  // SSL_select_next_proto() walks its first list in order, so passing our own list first gives
+  // our preference order precedence over the client's. It never writes through `out`; the
+  // non-const parameter is a historical quirk.
+  if (SSL_select_next_proto(const_cast<unsigned char**>(out), outlen,
+                            protos.begin(), protos.size(), in, inlen) == OPENSSL_NPN_NEGOTIATED) {
+    return SSL_TLSEXT_ERR_OK;
+  } else {
+    // No protocol in common. Proceed without ALPN rather than failing the handshake.
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+}
+#endif
+
 TlsContext::~TlsContext() noexcept(false) {
   SSL_CTX_free(reinterpret_cast<SSL_CTX*>(ctx));
 }
@@ -778,39 +1613,64 @@ TlsContext::~TlsContext() noexcept(false) {
 kj::Promise<kj::Own<kj::AsyncIoStream>> TlsContext::wrapClient(
     kj::Own<kj::AsyncIoStream> stream, kj::StringPtr expectedServerHostname) {
   auto conn = kj::heap<TlsConnection>(kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx));
+  if (kernelTls) conn->requestKernelTls();
+  KJ_IF_MAYBE(pool, handshakePool) {
+    conn->setHandshakePool(*pool);
+  }
+  KJ_IF_MAYBE(session, sessions->getClientSession(expectedServerHostname)) {
+    conn->resumeSession(*session);
+  }
   auto promise = conn->connect(expectedServerHostname);
-  return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn)
-      -> kj::Own<kj::AsyncIoStream> {
-    return kj::mv(conn);
+  return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn) {
+    return TlsConnection::offloadIfPossible(kj::mv(conn));
   }));
 }
 
 kj::Promise<kj::Own<kj::AsyncIoStream>> TlsContext::wrapServer(kj::Own<kj::AsyncIoStream> stream) {
   auto conn = kj::heap<TlsConnection>(kj::mv(stream), reinterpret_cast<SSL_CTX*>(ctx));
+  if (kernelTls) conn->requestKernelTls();
+  KJ_IF_MAYBE(pool, handshakePool) {
+    conn->setHandshakePool(*pool);
+    sessions->rotateTicketKeysIfDue();
+  }
   auto promise = conn->accept();
   KJ_IF_MAYBE(timeout, acceptTimeout) {
     promise = KJ_REQUIRE_NONNULL(timer).afterDelay(*timeout).then([]() -> kj::Promise<void> {
       return KJ_EXCEPTION(DISCONNECTED, "timed out waiting for client during TLS handshake");
     }).exclusiveJoin(kj::mv(promise));
   }
-  return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn)
-      -> kj::Own<kj::AsyncIoStream> {
-    return kj::mv(conn);
+  return promise.then(kj::mvCapture(conn, [](kj::Own<TlsConnection> conn) {
+    return TlsConnection::offloadIfPossible(kj::mv(conn));
   }));
 }
 
 kj::Promise<kj::AuthenticatedStream> TlsContext::wrapClient(
     kj::AuthenticatedStream stream, kj::StringPtr expectedServerHostname) {
   auto conn = kj::heap<TlsConnection>(kj::mv(stream.stream), reinterpret_cast<SSL_CTX*>(ctx));
+  if (kernelTls) conn->requestKernelTls();
+  KJ_IF_MAYBE(pool, handshakePool) {
+    conn->setHandshakePool(*pool);
+  }
+  KJ_IF_MAYBE(session, sessions->getClientSession(expectedServerHostname)) {
+    conn->resumeSession(*session);
+  }
   auto promise = conn->connect(expectedServerHostname);
   return promise.then([conn=kj::mv(conn),innerId=kj::mv(stream.peerIdentity)]() mutable {
     auto id = conn->getIdentity(kj::mv(innerId));
-    return kj::AuthenticatedStream { kj::mv(conn), kj::mv(id) };
+    return TlsConnection::offloadIfPossible(kj::mv(conn))
+        .then([id = kj::mv(id)](kj::Own<kj::AsyncIoStream> stream) mutable {
+      return kj::AuthenticatedStream { kj::mv(stream), kj::mv(id) };
+    });
   });
 }
 
 kj::Promise<kj::AuthenticatedStream> TlsContext::wrapServer(kj::AuthenticatedStream stream) {
   auto conn = kj::heap<TlsConnection>(kj::mv(stream.stream), reinterpret_cast<SSL_CTX*>(ctx));
+  if (kernelTls) conn->requestKernelTls();
+  KJ_IF_MAYBE(pool, handshakePool) {
+    conn->setHandshakePool(*pool);
+    sessions->rotateTicketKeysIfDue();
+  }
   auto promise = conn->accept();
   KJ_IF_MAYBE(timeout, acceptTimeout) {
     promise = KJ_REQUIRE_NONNULL(timer).afterDelay(*timeout).then([]() -> kj::Promise<void> {
@@ -819,7 +1679,10 @@ kj::Promise<kj::AuthenticatedStream> TlsContext::wrapServer(kj::AuthenticatedStr
   }
   return promise.then([conn=kj::mv(conn),innerId=kj::mv(stream.peerIdentity)]() mutable {
     auto id = conn->getIdentity(kj::mv(innerId));
-    return kj::AuthenticatedStream { kj::mv(conn), kj::mv(id) };
+    return TlsConnection::offloadIfPossible(kj::mv(conn))
+        .then([id = kj::mv(id)](kj::Own<kj::AsyncIoStream> stream) mutable {
+      return kj::AuthenticatedStream { kj::mv(stream), kj::mv(id) };
+    });
   });
 }
 
@@ -834,6 +1697,26 @@ kj::Own<kj::Network> TlsContext::wrapNetwork(kj::Network& network) {
   return kj::heap<TlsNetwork>(*this, network);
 }
 
+void TlsContext::setSessionTicketKeys(kj::ArrayPtr<const kj::ArrayPtr<const byte>> keys) {
+  KJ_REQUIRE(keys.size() > 0, "need at least one session ticket key");
+
+  kj::Vector<Sessions::TicketKey> newKeys(keys.size());
+  for (auto key: keys) {
+    KJ_REQUIRE(key.size() == SESSION_TICKET_KEY_SIZE, "wrong session ticket key size", key.size());
+    memcpy(newKeys.add().bytes, key.begin(), SESSION_TICKET_KEY_SIZE);
+  }
+
+  auto lock = sessions->state.lockExclusive();
+  if (lock->ticketKeys.size() == 0 && lock->ticketKeyLifetime == nullptr) {
+    Sessions::installTicketKeyCallback(reinterpret_cast<SSL_CTX*>(ctx));
+  }
+  for (auto& old: lock->ticketKeys) {
+    OPENSSL_cleanse(old.bytes, sizeof(old.bytes));
+  }
+  lock->ticketKeys = kj::mv(newKeys);
+  lock->ticketKeyLifetime = nullptr;
+}
+
 // =======================================================================================
 // class TlsPrivateKey
 
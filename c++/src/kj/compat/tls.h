@@ -109,6 +109,55 @@ public:
 
     kj::Maybe<TlsErrorHandler> acceptErrorHandler;
     // Error handler used for TLS accept errors.
+
+    kj::ArrayPtr<const kj::StringPtr> alpnProtocols;
+    // Application-layer protocols (ALPN, RFC 7301) to offer, in order of preference, e.g.
+    // `{"h2", "http/1.1"}`. As a client, these are offered to the server; as a server, the first
+    // protocol in this list that the client also offered is selected. If the peers have no
+    // protocol in common, the handshake still completes without one. Use
+    // `TlsPeerIdentity::getAlpnProtocol()` to find out what was chosen. Default: none.
+
+    bool kernelTls;
+    // If true, try to hand record encryption over to the operating system kernel (Linux kTLS)
+    // once the handshake completes. If the kernel takes over both directions, the stream returned
+    // by `wrapClient()` or `wrapServer()` is the original socket stream itself, reading and
+    // writing plaintext while the kernel encrypts and decrypts underneath, so fd-level
+    // optimizations like splice()-based pumps apply. If only transmission can be offloaded --
+    // OpenSSL 3.0 offers kernel receive keys for TLS 1.2 only, and a TLS 1.3 client must keep
+    // decrypting itself since servers send session tickets after the handshake -- writes and
+    // pumps into the stream go straight to the socket while reads still go through OpenSSL. If
+    // neither is possible -- the stream isn't a TCP socket, the kernel lacks the "tls" module,
+    // OpenSSL was built without kTLS, or the cipher isn't supported -- the connection silently
+    // stays in userspace.
+    //
+    // Caveats once offloaded: shutdownWrite() ends the TCP stream without sending close_notify,
+    // and renegotiation and key updates are not supported. With receive offloaded too, TLS alerts
+    // and other non-data records from the peer, including its close_notify, make reads fail.
+    // Default: false.
+
+    size_t clientSessionCacheSize;
+    // When acting as a client, remember TLS sessions for up to this many server hostnames, so that
+    // reconnecting to the same hostname resumes the session with an abbreviated handshake instead
+    // of repeating the full key exchange and certificate verification. Sessions are keyed by the
+    // `expectedServerHostname` passed to `wrapClient()`. Zero disables the cache. Default: 0.
+
+    kj::Maybe<kj::Duration> sessionTicketKeyLifetime;
+    // When acting as a server, generate a fresh random session ticket key each time this much time
+    // passes, retiring the previous one. Tickets issued under a retired key are still accepted, and
+    // replaced with new ones, for one more lifetime. `timer` is required if this is set. If null,
+    // OpenSSL's default applies: one random key for the life of the TlsContext. Either way the keys
+    // die with the process; see `setSessionTicketKeys()` to share keys among servers or across
+    // restarts.
+
+    kj::Maybe<const kj::WorkerPool&> handshakePool;
+    // If set, run the CPU-heavy steps of each handshake -- key exchange, signing, certificate
+    // verification -- on this pool's threads, so that a burst of new connections doesn't stall
+    // the other streams on the event loop. Reading and writing the handshake's records stays on
+    // the event loop; the connection returns to it once the handshake completes. The pool must
+    // outlive the TlsContext. Not used along with `kernelTls`.
+    //
+    // Note that `sniCallback` is then called on the pool's threads, so it must be thread-safe.
+    // Default: none.
   };
 
   TlsContext(Options options = Options());
@@ -146,13 +195,33 @@ public:
   // only accept addresses of the form "hostname" and "hostname:port" (it does not accept raw IP
   // addresses). It will automatically use SNI and verify certificates based on these hostnames.
 
+  static constexpr size_t SESSION_TICKET_KEY_SIZE = 80;
+
+  void setSessionTicketKeys(kj::ArrayPtr<const kj::ArrayPtr<const byte>> keys);
+  // Replace the keys used to encrypt session tickets when acting as a server. Each key is
+  // SESSION_TICKET_KEY_SIZE bytes from a cryptographically secure random source: a 16-byte name,
+  // a 32-byte HMAC-SHA256 key and a 32-byte AES-256 key, the same layout as nginx's
+  // `ssl_session_ticket_key` files. New tickets are issued under `keys[0]`. Tickets under any of the
+  // keys are accepted, and those under other keys are replaced with new ones. Call again to rotate.
+  //
+  // Giving every server in a cluster the same keys, e.g. from shared storage, lets clients resume
+  // their sessions against any server, including after a restart. Once this has been called,
+  // `Options::sessionTicketKeyLifetime` no longer applies.
+
 private:
   void* ctx;  // actually type SSL_CTX, but we don't want to #include the OpenSSL headers here
   kj::Maybe<kj::Timer&> timer;
   kj::Maybe<kj::Duration> acceptTimeout;
   kj::Maybe<TlsErrorHandler> acceptErrorHandler;
+  kj::Array<byte> alpnProtocols;  // in wire format: each name prefixed by its length byte
+  bool kernelTls = false;
+  kj::Maybe<const kj::WorkerPool&> handshakePool;
+
+  struct Sessions;
+  kj::Own<Sessions> sessions;  // session resumption state
 
   struct SniCallback;
+  struct AlpnCallback;
 };
 
 class TlsPrivateKey {
@@ -283,16 +352,29 @@ public:
   // Check if the certificate authenticates the given hostname, considering wildcards and SAN
   // extensions. If no certificate was provided, always returns false.
 
+  kj::Maybe<kj::StringPtr> getAlpnProtocol() { return alpnProtocol; }
+  // The application-layer protocol negotiated via ALPN (see `TlsContext::Options::alpnProtocols`),
+  // or null if none was negotiated.
+
+  bool isSessionResumed() { return sessionResumed; }
+  // Whether the handshake resumed an earlier session rather than performing a full key exchange.
+  // See `TlsContext::Options::clientSessionCacheSize` and `setSessionTicketKeys()`.
+
   // TODO(someday): Methods for other things. Match hostnames (i.e. evaluate wildcards and SAN)?
   //   Key fingerprint? Other certificate fields?
 
 private:
   void* cert;  // actually type X509*, but we don't want to #include the OpenSSL headers here.
   kj::Own<kj::PeerIdentity> inner;
+  kj::Maybe<kj::String> alpnProtocol;
+  bool sessionResumed;
 
 public:  // (not really public, only TlsConnection can call this)
-  TlsPeerIdentity(void* cert, kj::Own<kj::PeerIdentity> inner, kj::Badge<TlsConnection>)
-      : cert(cert), inner(kj::mv(inner)) {}
+  TlsPeerIdentity(void* cert, kj::Own<kj::PeerIdentity> inner,
+                  kj::Maybe<kj::String> alpnProtocol, bool sessionResumed,
+                  kj::Badge<TlsConnection>)
+      : cert(cert), inner(kj::mv(inner)), alpnProtocol(kj::mv(alpnProtocol)),
+        sessionResumed(sessionResumed) {}
 };
 
 } // namespace kj
@@ -0,0 +1,401 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#if KJ_HAS_ZSTD
+
+#include "zstd.h"
+#include "kj/test.h"
+#include "kj/debug.h"
+#include <stdlib.h>
+
+namespace kj {
+namespace {
+
+static const byte FOOBAR_ZSTD[] = {
+  0x28, 0xB5, 0x2F, 0xFD, 0x04, 0x58, 0x31, 0x00,
+  0x00, 0x66, 0x6F, 0x6F, 0x62, 0x61, 0x72, 0xF9,
+  0xAA, 0x85, 0x90,
+};
+
+class MockInputStream: public InputStream {
+public:
+  MockInputStream(kj::ArrayPtr<const byte> bytes, size_t blockSize)
+      : bytes(bytes), blockSize(blockSize) {}
+
+  size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    // Clamp max read to blockSize.
+    size_t n = kj::min(blockSize, maxBytes);
+
+    // Unless that's less than minBytes -- in which case, use minBytes.
+    n = kj::max(n, minBytes);
+
+    // But also don't read more data than we have.
+    n = kj::min(n, bytes.size());
+
+    memcpy(buffer, bytes.begin(), n);
+    bytes = bytes.slice(n, bytes.size());
+    return n;
+  }
+
+private:
+  kj::ArrayPtr<const byte> bytes;
+  size_t blockSize;
+};
+
+class MockAsyncInputStream: public AsyncInputStream {
+public:
+  MockAsyncInputStream(kj::ArrayPtr<const byte> bytes, size_t blockSize)
+      : bytes(bytes), blockSize(blockSize) {}
+
+  Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override {
+    // Clamp max read to blockSize.
+    size_t n = kj::min(blockSize, maxBytes);
+
+    // Unless that's less than minBytes -- in which case, use minBytes.
+    n = kj::max(n, minBytes);
+
+    // But also don't read more data than we have.
+    n = kj::min(n, bytes.size());
+
+    memcpy(buffer, bytes.begin(), n);
+    bytes = bytes.slice(n, bytes.size());
+    return n;
+  }
+
+private:
+  kj::ArrayPtr<const byte> bytes;
+  size_t blockSize;
+};
+
+class MockOutputStream: public OutputStream {
+public:
+  kj::Vector<byte> bytes;
+
+  kj::String decompress(ArrayPtr<const byte> dictionary = nullptr) {
+    MockInputStream rawInput(bytes, kj::maxValue);
+    ZstdInputStream zstd(rawInput, dictionary);
+    return zstd.readAllText();
+  }
+
+  void write(const void* buffer, size_t size) override {
+    bytes.addAll(arrayPtr(reinterpret_cast<const byte*>(buffer), size));
+  }
+  void write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    for (auto& piece: pieces) {
+      bytes.addAll(piece);
+    }
+  }
+};
+
+class MockAsyncOutputStream: public AsyncOutputStream {
+public:
+  kj::Vector<byte> bytes;
+
+  kj::String decompress(WaitScope& ws, ArrayPtr<const byte> dictionary = nullptr) {
+    MockAsyncInputStream rawInput(bytes, kj::maxValue);
+    ZstdAsyncInputStream zstd(rawInput, dictionary);
+    return zstd.readAllText().wait(ws);
+  }
+
+  Promise<void> write(const void* buffer, size_t size) override {
+    bytes.addAll(arrayPtr(reinterpret_cast<const byte*>(buffer), size));
+    return kj::READY_NOW;
+  }
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    for (auto& piece: pieces) {
+      bytes.addAll(piece);
+    }
+    return kj::READY_NOW;
+  }
+
+  Promise<void> whenWriteDisconnected() override { KJ_UNIMPLEMENTED("not used"); }
+};
+
+KJ_TEST("zstd decompression") {
+  // Normal read.
+  {
+    MockInputStream rawInput(FOOBAR_ZSTD, kj::maxValue);
+    ZstdInputStream zstd(rawInput);
+    KJ_EXPECT(zstd.readAllText() == "foobar");
+  }
+
+  // Force read one byte at a time.
+  {
+    MockInputStream rawInput(FOOBAR_ZSTD, 1);
+    ZstdInputStream zstd(rawInput);
+    KJ_EXPECT(zstd.readAllText() == "foobar");
+  }
+
+  // Read truncated input.
+  {
+    MockInputStream rawInput(kj::arrayPtr(FOOBAR_ZSTD, sizeof(FOOBAR_ZSTD) - 1), kj::maxValue);
+    ZstdInputStream zstd(rawInput);
+
+    KJ_EXPECT_THROW_MESSAGE("zstd compressed stream ended prematurely", zstd.readAllText());
+  }
+
+  // Read corrupt input.
+  {
+    MockInputStream rawInput(kj::StringPtr("not zstd at all").asBytes(), kj::maxValue);
+    ZstdInputStream zstd(rawInput);
+
+    KJ_EXPECT_THROW_MESSAGE("zstd decompression failed", zstd.readAllText());
+  }
+
+  // Read concatenated input.
+  {
+    Vector<byte> bytes;
+    bytes.addAll(ArrayPtr<const byte>(FOOBAR_ZSTD));
+    bytes.addAll(ArrayPtr<const byte>(FOOBAR_ZSTD));
+    MockInputStream rawInput(bytes, kj::maxValue);
+    ZstdInputStream zstd(rawInput);
+
+    KJ_EXPECT(zstd.readAllText() == "foobarfoobar");
+  }
+}
+
+KJ_TEST("async zstd decompression") {
+  auto io = setupAsyncIo();
+
+  // Normal read.
+  {
+    MockAsyncInputStream rawInput(FOOBAR_ZSTD, kj::maxValue);
+    ZstdAsyncInputStream zstd(rawInput);
+    KJ_EXPECT(zstd.readAllText().wait(io.waitScope) == "foobar");
+  }
+
+  // Force read one byte at a time.
+  {
+    MockAsyncInputStream rawInput(FOOBAR_ZSTD, 1);
+    ZstdAsyncInputStream zstd(rawInput);
+    KJ_EXPECT(zstd.readAllText().wait(io.waitScope) == "foobar");
+  }
+
+  // Read truncated input.
+  {
+    MockAsyncInputStream rawInput(kj::arrayPtr(FOOBAR_ZSTD, sizeof(FOOBAR_ZSTD) - 1),
+                                  kj::maxValue);
+    ZstdAsyncInputStream zstd(rawInput);
+
+    KJ_EXPECT_THROW_MESSAGE("zstd compressed stream ended prematurely",
+        zstd.readAllText().wait(io.waitScope));
+  }
+
+  // Read concatenated input.
+  {
+    Vector<byte> bytes;
+    bytes.addAll(ArrayPtr<const byte>(FOOBAR_ZSTD));
+    bytes.addAll(ArrayPtr<const byte>(FOOBAR_ZSTD));
+    MockAsyncInputStream rawInput(bytes, kj::maxValue);
+    ZstdAsyncInputStream zstd(rawInput);
+
+    KJ_EXPECT(zstd.readAllText().wait(io.waitScope) == "foobarfoobar");
+  }
+
+  // Decompress using an output stream.
+  {
+    MockAsyncOutputStream rawOutput;
+    ZstdAsyncOutputStream zstd(rawOutput, ZstdAsyncOutputStream::DECOMPRESS);
+
+    zstd.write(FOOBAR_ZSTD, 12).wait(io.waitScope);
+    zstd.write(FOOBAR_ZSTD + 12, sizeof(FOOBAR_ZSTD) - 12).wait(io.waitScope);
+    auto str = kj::heapString(rawOutput.bytes.asPtr().asChars());
+    KJ_EXPECT(str == "foobar", str);
+
+    zstd.end().wait(io.waitScope);
+  }
+}
+
+KJ_TEST("zstd compression") {
+  // Normal write.
+  {
+    MockOutputStream rawOutput;
+    {
+      ZstdOutputStream zstd(rawOutput);
+      zstd.write("foobar", 6);
+    }
+
+    KJ_EXPECT(rawOutput.decompress() == "foobar");
+  }
+
+  // Multi-part write.
+  {
+    MockOutputStream rawOutput;
+    {
+      ZstdOutputStream zstd(rawOutput);
+      zstd.write("foo", 3);
+      zstd.write("bar", 3);
+    }
+
+    KJ_EXPECT(rawOutput.decompress() == "foobar");
+  }
+
+  // Array-of-arrays write.
+  {
+    MockOutputStream rawOutput;
+
+    {
+      ZstdOutputStream zstd(rawOutput);
+
+      ArrayPtr<const byte> pieces[] = {
+        kj::StringPtr("foo").asBytes(),
+        kj::StringPtr("bar").asBytes(),
+      };
+      zstd.write(pieces);
+    }
+
+    KJ_EXPECT(rawOutput.decompress() == "foobar");
+  }
+}
+
+KJ_TEST("zstd dictionary") {
+  // A raw-content dictionary: any bytes that are likely to appear in the data.
+  auto dictionary = kj::StringPtr(
+      "{\"type\": \"event\", \"user\": \"alice\", \"action\": \"login\", \"ok\": true}").asBytes();
+  auto text = kj::StringPtr(
+      "{\"type\": \"event\", \"user\": \"bob\", \"action\": \"login\", \"ok\": false}");
+
+  MockOutputStream plain;
+  {
+    ZstdOutputStream zstd(plain);
+    zstd.write(text.begin(), text.size());
+  }
+
+  MockOutputStream withDictionary;
+  {
+    ZstdOutputStream zstd(withDictionary, ZSTD_CLEVEL_DEFAULT, dictionary);
+    zstd.write(text.begin(), text.size());
+  }
+
+  KJ_EXPECT(withDictionary.bytes.size() < plain.bytes.size(),
+            withDictionary.bytes.size(), plain.bytes.size());
+  KJ_EXPECT(withDictionary.decompress(dictionary) == text);
+  KJ_EXPECT_THROW_MESSAGE("zstd decompression failed", withDictionary.decompress());
+
+  // Decompress using an output stream.
+  MockOutputStream rawOutput;
+  {
+    ZstdOutputStream zstd(rawOutput, ZstdOutputStream::DECOMPRESS, dictionary);
+    zstd.write(withDictionary.bytes.begin(), withDictionary.bytes.size());
+  }
+  KJ_EXPECT(kj::heapString(rawOutput.bytes.asPtr().asChars()) == text);
+}
+
+KJ_TEST("zstd huge round trip") {
+  auto bytes = heapArray<byte>(65536);
+  for (auto& b: bytes) {
+    b = rand();
+  }
+
+  MockOutputStream rawOutput;
+  {
+    ZstdOutputStream zstdOut(rawOutput);
+    zstdOut.write(bytes.begin(), bytes.size());
+  }
+
+  MockInputStream rawInput(rawOutput.bytes, kj::maxValue);
+  ZstdInputStream zstdIn(rawInput);
+  auto decompressed = zstdIn.readAllBytes();
+
+  KJ_ASSERT(decompressed.size() == bytes.size());
+  KJ_ASSERT(memcmp(bytes.begin(), decompressed.begin(), bytes.size()) == 0);
+}
+
+KJ_TEST("async zstd compression") {
+  auto io = setupAsyncIo();
+
+  // Normal write.
+  {
+    MockAsyncOutputStream rawOutput;
+    ZstdAsyncOutputStream zstd(rawOutput);
+    zstd.write("foobar", 6).wait(io.waitScope);
+    zstd.end().wait(io.waitScope);
+
+    KJ_EXPECT(rawOutput.decompress(io.waitScope) == "foobar");
+  }
+
+  // Multi-part write.
+  {
+    MockAsyncOutputStream rawOutput;
+    ZstdAsyncOutputStream zstd(rawOutput);
+
+    zstd.write("foo", 3).wait(io.waitScope);
+    auto prevSize = rawOutput.bytes.size();
+
+    zstd.write("bar", 3).wait(io.waitScope);
+    auto curSize = rawOutput.bytes.size();
+    KJ_EXPECT(prevSize == curSize, prevSize, curSize);
+
+    zstd.flush().wait(io.waitScope);
+    curSize = rawOutput.bytes.size();
+    KJ_EXPECT(prevSize < curSize, prevSize, curSize);
+
+    zstd.end().wait(io.waitScope);
+
+    // Ending twice doesn't add an empty frame.
+    curSize = rawOutput.bytes.size();
+    zstd.end().wait(io.waitScope);
+    KJ_EXPECT(rawOutput.bytes.size() == curSize);
+
+    KJ_EXPECT(rawOutput.decompress(io.waitScope) == "foobar");
+  }
+
+  // Array-of-arrays write.
+  {
+    MockAsyncOutputStream rawOutput;
+    ZstdAsyncOutputStream zstd(rawOutput);
+
+    ArrayPtr<const byte> pieces[] = {
+      kj::StringPtr("foo").asBytes(),
+      kj::StringPtr("bar").asBytes(),
+    };
+    zstd.write(pieces).wait(io.waitScope);
+    zstd.end().wait(io.waitScope);
+
+    KJ_EXPECT(rawOutput.decompress(io.waitScope) == "foobar");
+  }
+}
+
+KJ_TEST("async zstd huge round trip") {
+  auto io = setupAsyncIo();
+
+  auto bytes = heapArray<byte>(65536);
+  for (auto& b: bytes) {
+    b = rand();
+  }
+
+  MockAsyncOutputStream rawOutput;
+  ZstdAsyncOutputStream zstdOut(rawOutput);
+  zstdOut.write(bytes.begin(), bytes.size()).wait(io.waitScope);
+  zstdOut.end().wait(io.waitScope);
+
+  MockAsyncInputStream rawInput(rawOutput.bytes, kj::maxValue);
+  ZstdAsyncInputStream zstdIn(rawInput);
+  auto decompressed = zstdIn.readAllBytes().wait(io.waitScope);
+
+  KJ_ASSERT(decompressed.size() == bytes.size());
+  KJ_ASSERT(memcmp(bytes.begin(), decompressed.begin(), bytes.size()) == 0);
+}
+
+}  // namespace
+}  // namespace kj
+
+#endif  // KJ_HAS_ZSTD
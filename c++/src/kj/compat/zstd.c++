@@ -0,0 +1,279 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#if KJ_HAS_ZSTD
+
+#include "zstd.h"
+#include "kj/debug.h"
+
+namespace kj {
+
+namespace {
+
+ZSTD_DCtx* newDecompressionContext(kj::ArrayPtr<const byte> dictionary) {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  KJ_ASSERT(dctx != nullptr, "couldn't create zstd decompression context");
+  if (dictionary.size() > 0) {
+    size_t result = ZSTD_DCtx_loadDictionary(dctx, dictionary.begin(), dictionary.size());
+    if (ZSTD_isError(result)) {
+      ZSTD_freeDCtx(dctx);
+      KJ_FAIL_REQUIRE("invalid zstd dictionary", ZSTD_getErrorName(result));
+    }
+  }
+  return dctx;
+}
+
+}  // namespace
+
+namespace _ {  // private
+
+ZstdOutputContext::ZstdOutputContext(kj::Maybe<int> compressionLevel,
+                                     kj::ArrayPtr<const byte> dictionary) {
+  KJ_IF_MAYBE(level, compressionLevel) {
+    cctx = ZSTD_createCCtx();
+    KJ_ASSERT(cctx != nullptr, "couldn't create zstd compression context");
+
+    size_t result = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, *level);
+    if (!ZSTD_isError(result) && dictionary.size() > 0) {
+      result = ZSTD_CCtx_loadDictionary(cctx, dictionary.begin(), dictionary.size());
+    }
+    if (ZSTD_isError(result)) {
+      ZSTD_freeCCtx(cctx);
+      KJ_FAIL_REQUIRE("couldn't set up zstd compression", ZSTD_getErrorName(result));
+    }
+  } else {
+    dctx = newDecompressionContext(dictionary);
+  }
+}
+
+ZstdOutputContext::~ZstdOutputContext() noexcept(false) {
+  if (cctx != nullptr) {
+    ZSTD_freeCCtx(cctx);
+  } else {
+    ZSTD_freeDCtx(dctx);
+  }
+}
+
+void ZstdOutputContext::setInput(const void* in, size_t size) {
+  input = { in, size, 0 };
+  if (size > 0) ended = false;
+}
+
+kj::Tuple<bool, kj::ArrayPtr<const byte>> ZstdOutputContext::pumpOnce(ZSTD_EndDirective mode) {
+  ZSTD_outBuffer output = { buffer, sizeof(buffer), 0 };
+
+  if (dctx != nullptr) {
+    // Decompressing, so there's nothing to flush: the decoder produces output as soon as it can.
+    size_t result = ZSTD_decompressStream(dctx, &output, &input);
+    if (ZSTD_isError(result)) {
+      KJ_FAIL_REQUIRE("zstd decompression failed", ZSTD_getErrorName(result));
+    }
+    return kj::tuple(input.pos < input.size || output.pos == output.size,
+                     kj::arrayPtr(buffer, output.pos));
+  }
+
+  if (ended) {
+    // Nothing was written since the last frame ended. Don't follow it with an empty one.
+    return kj::tuple(false, kj::ArrayPtr<const byte>());
+  }
+
+  size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+  if (ZSTD_isError(remaining)) {
+    KJ_FAIL_REQUIRE("zstd compression failed", ZSTD_getErrorName(remaining));
+  }
+
+  // When flushing or ending, `remaining` counts the bytes still to be flushed, and is only zero
+  // once all input is consumed.
+  bool more = mode == ZSTD_e_continue ? input.pos < input.size : remaining > 0;
+  if (mode == ZSTD_e_end && remaining == 0) ended = true;
+  return kj::tuple(more, kj::arrayPtr(buffer, output.pos));
+}
+
+}  // namespace _ (private)
+
+ZstdInputStream::ZstdInputStream(InputStream& inner, kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), dctx(newDecompressionContext(dictionary)) {}
+
+ZstdInputStream::~ZstdInputStream() noexcept(false) {
+  ZSTD_freeDCtx(dctx);
+}
+
+size_t ZstdInputStream::tryRead(void* out, size_t minBytes, size_t maxBytes) {
+  if (maxBytes == 0) return size_t(0);
+
+  return readImpl(reinterpret_cast<byte*>(out), minBytes, maxBytes, 0);
+}
+
+size_t ZstdInputStream::readImpl(
+    byte* out, size_t minBytes, size_t maxBytes, size_t alreadyRead) {
+  if (input.pos == input.size) {
+    size_t amount = inner.tryRead(buffer, 1, sizeof(buffer));
+    if (amount == 0) {
+      if (!atValidEndpoint) {
+        KJ_FAIL_REQUIRE("zstd compressed stream ended prematurely");
+      }
+      return alreadyRead;
+    } else {
+      input = { buffer, amount, 0 };
+    }
+  }
+
+  // Concatenated frames are decoded one after the other, like concatenated gzip streams.
+  ZSTD_outBuffer output = { out, maxBytes, 0 };
+  size_t result = ZSTD_decompressStream(dctx, &output, &input);
+  if (ZSTD_isError(result)) {
+    KJ_FAIL_REQUIRE("zstd decompression failed", ZSTD_getErrorName(result));
+  }
+  atValidEndpoint = result == 0;
+
+  size_t n = output.pos;
+  if (n >= minBytes) {
+    return n + alreadyRead;
+  } else {
+    return readImpl(out + n, minBytes - n, maxBytes - n, alreadyRead + n);
+  }
+}
+
+// =======================================================================================
+
+ZstdOutputStream::ZstdOutputStream(OutputStream& inner, int compressionLevel,
+                                   kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), ctx(compressionLevel, dictionary) {}
+
+ZstdOutputStream::ZstdOutputStream(OutputStream& inner, decltype(DECOMPRESS),
+                                   kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), ctx(nullptr, dictionary) {}
+
+ZstdOutputStream::~ZstdOutputStream() noexcept(false) {
+  pump(ZSTD_e_end);
+}
+
+void ZstdOutputStream::write(const void* in, size_t size) {
+  ctx.setInput(in, size);
+  pump(ZSTD_e_continue);
+}
+
+void ZstdOutputStream::pump(ZSTD_EndDirective mode) {
+  bool ok;
+  do {
+    auto result = ctx.pumpOnce(mode);
+    ok = get<0>(result);
+    auto chunk = get<1>(result);
+    if (chunk.size() > 0) {
+      inner.write(chunk.begin(), chunk.size());
+    }
+  } while (ok);
+}
+
+// =======================================================================================
+
+ZstdAsyncInputStream::ZstdAsyncInputStream(AsyncInputStream& inner,
+                                           kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), dctx(newDecompressionContext(dictionary)) {}
+
+ZstdAsyncInputStream::~ZstdAsyncInputStream() noexcept(false) {
+  ZSTD_freeDCtx(dctx);
+}
+
+Promise<size_t> ZstdAsyncInputStream::tryRead(void* out, size_t minBytes, size_t maxBytes) {
+  if (maxBytes == 0) return size_t(0);
+
+  return readImpl(reinterpret_cast<byte*>(out), minBytes, maxBytes, 0);
+}
+
+Promise<size_t> ZstdAsyncInputStream::readImpl(
+    byte* out, size_t minBytes, size_t maxBytes, size_t alreadyRead) {
+  if (input.pos == input.size) {
+    return inner.tryRead(buffer, 1, sizeof(buffer))
+        .then([this,out,minBytes,maxBytes,alreadyRead](size_t amount) -> Promise<size_t> {
+      if (amount == 0) {
+        if (!atValidEndpoint) {
+          return KJ_EXCEPTION(DISCONNECTED, "zstd compressed stream ended prematurely");
+        }
+        return alreadyRead;
+      } else {
+        input = { buffer, amount, 0 };
+        return readImpl(out, minBytes, maxBytes, alreadyRead);
+      }
+    });
+  }
+
+  ZSTD_outBuffer output = { out, maxBytes, 0 };
+  size_t result = ZSTD_decompressStream(dctx, &output, &input);
+  if (ZSTD_isError(result)) {
+    KJ_FAIL_REQUIRE("zstd decompression failed", ZSTD_getErrorName(result));
+  }
+  atValidEndpoint = result == 0;
+
+  size_t n = output.pos;
+  if (n >= minBytes) {
+    return n + alreadyRead;
+  } else {
+    return readImpl(out + n, minBytes - n, maxBytes - n, alreadyRead + n);
+  }
+}
+
+// =======================================================================================
+
+ZstdAsyncOutputStream::ZstdAsyncOutputStream(AsyncOutputStream& inner, int compressionLevel,
+                                             kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), ctx(compressionLevel, dictionary) {}
+
+ZstdAsyncOutputStream::ZstdAsyncOutputStream(AsyncOutputStream& inner, decltype(DECOMPRESS),
+                                             kj::ArrayPtr<const byte> dictionary)
+    : inner(inner), ctx(nullptr, dictionary) {}
+
+Promise<void> ZstdAsyncOutputStream::write(const void* in, size_t size) {
+  ctx.setInput(in, size);
+  return pump(ZSTD_e_continue);
+}
+
+Promise<void> ZstdAsyncOutputStream::write(ArrayPtr<const ArrayPtr<const byte>> pieces) {
+  if (pieces.size() == 0) return kj::READY_NOW;
+  return write(pieces[0].begin(), pieces[0].size())
+      .then([this,pieces]() {
+    return write(pieces.slice(1, pieces.size()));
+  });
+}
+
+kj::Promise<void> ZstdAsyncOutputStream::pump(ZSTD_EndDirective mode) {
+  auto result = ctx.pumpOnce(mode);
+  auto ok = get<0>(result);
+  auto chunk = get<1>(result);
+
+  if (chunk.size() == 0) {
+    if (ok) {
+      return pump(mode);
+    } else {
+      return kj::READY_NOW;
+    }
+  } else {
+    auto promise = inner.write(chunk.begin(), chunk.size());
+    if (ok) {
+      promise = promise.then([this, mode]() { return pump(mode); });
+    }
+    return promise;
+  }
+}
+
+}  // namespace kj
+
+#endif  // KJ_HAS_ZSTD
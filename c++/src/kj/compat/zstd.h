@@ -0,0 +1,155 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "kj/io.h"
+#include "kj/async-io.h"
+#include <zstd.h>
+
+namespace kj {
+
+// All of the streams below accept an optional dictionary, as produced by `zstd --train`. Data
+// compressed with a dictionary can only be decompressed with the same dictionary. For streams of
+// many small, similar messages, a dictionary improves the compression ratio a great deal. The
+// dictionary is copied, so it need not outlive the stream.
+
+namespace _ {  // private
+
+class ZstdOutputContext final {
+public:
+  ZstdOutputContext(kj::Maybe<int> compressionLevel, kj::ArrayPtr<const byte> dictionary);
+  ~ZstdOutputContext() noexcept(false);
+  KJ_DISALLOW_COPY(ZstdOutputContext);
+
+  void setInput(const void* in, size_t size);
+  kj::Tuple<bool, kj::ArrayPtr<const byte>> pumpOnce(ZSTD_EndDirective mode);
+
+private:
+  ZSTD_CCtx* cctx = nullptr;
+  ZSTD_DCtx* dctx = nullptr;
+  // Exactly one of these is set, depending on whether we're compressing.
+
+  ZSTD_inBuffer input = { nullptr, 0, 0 };
+  bool ended = false;
+  // Whether the last frame was ended with no input since.
+
+  byte buffer[4096];
+};
+
+}  // namespace _ (private)
+
+class ZstdInputStream final: public InputStream {
+public:
+  ZstdInputStream(InputStream& inner, kj::ArrayPtr<const byte> dictionary = nullptr);
+  ~ZstdInputStream() noexcept(false);
+  KJ_DISALLOW_COPY(ZstdInputStream);
+
+  size_t tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+private:
+  InputStream& inner;
+  ZSTD_DCtx* dctx;
+  ZSTD_inBuffer input = { nullptr, 0, 0 };
+  bool atValidEndpoint = false;
+
+  byte buffer[4096];
+
+  size_t readImpl(byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead);
+};
+
+class ZstdOutputStream final: public OutputStream {
+public:
+  enum { DECOMPRESS };
+
+  ZstdOutputStream(OutputStream& inner, int compressionLevel = ZSTD_CLEVEL_DEFAULT,
+                   kj::ArrayPtr<const byte> dictionary = nullptr);
+  ZstdOutputStream(OutputStream& inner, decltype(DECOMPRESS),
+                   kj::ArrayPtr<const byte> dictionary = nullptr);
+  ~ZstdOutputStream() noexcept(false);
+  KJ_DISALLOW_COPY(ZstdOutputStream);
+
+  void write(const void* buffer, size_t size) override;
+  using OutputStream::write;
+
+  inline void flush() {
+    pump(ZSTD_e_flush);
+  }
+
+private:
+  OutputStream& inner;
+  _::ZstdOutputContext ctx;
+
+  void pump(ZSTD_EndDirective mode);
+};
+
+class ZstdAsyncInputStream final: public AsyncInputStream {
+public:
+  ZstdAsyncInputStream(AsyncInputStream& inner, kj::ArrayPtr<const byte> dictionary = nullptr);
+  ~ZstdAsyncInputStream() noexcept(false);
+  KJ_DISALLOW_COPY(ZstdAsyncInputStream);
+
+  Promise<size_t> tryRead(void* buffer, size_t minBytes, size_t maxBytes) override;
+
+private:
+  AsyncInputStream& inner;
+  ZSTD_DCtx* dctx;
+  ZSTD_inBuffer input = { nullptr, 0, 0 };
+  bool atValidEndpoint = false;
+
+  byte buffer[4096];
+
+  Promise<size_t> readImpl(byte* buffer, size_t minBytes, size_t maxBytes, size_t alreadyRead);
+};
+
+class ZstdAsyncOutputStream final: public AsyncOutputStream {
+public:
+  enum { DECOMPRESS };
+
+  ZstdAsyncOutputStream(AsyncOutputStream& inner, int compressionLevel = ZSTD_CLEVEL_DEFAULT,
+                        kj::ArrayPtr<const byte> dictionary = nullptr);
+  ZstdAsyncOutputStream(AsyncOutputStream& inner, decltype(DECOMPRESS),
+                        kj::ArrayPtr<const byte> dictionary = nullptr);
+  KJ_DISALLOW_COPY(ZstdAsyncOutputStream);
+
+  Promise<void> write(const void* buffer, size_t size) override;
+  Promise<void> write(ArrayPtr<const ArrayPtr<const byte>> pieces) override;
+
+  Promise<void> whenWriteDisconnected() override { return inner.whenWriteDisconnected(); }
+
+  inline Promise<void> flush() {
+    return pump(ZSTD_e_flush);
+  }
+  // Call if you need to flush a stream at an arbitrary data point.
+
+  Promise<void> end() {
+    return pump(ZSTD_e_end);
+  }
+  // Must call to flush and finish the stream, since some data may be buffered.
+
+private:
+  AsyncOutputStream& inner;
+  _::ZstdOutputContext ctx;
+
+  kj::Promise<void> pump(ZSTD_EndDirective mode);
+};
+
+}  // namespace kj
@@ -192,6 +192,41 @@ KJ_TEST("invalid UTF-8 to UTF-32") {
   expectRes(encodeUtf32("\xff\xbf\x80\x80\x80\x80\x80\x80"), U"\ufffd", true);
 }
 
+KJ_TEST("UTF-8 validation") {
+  KJ_EXPECT(isValidUtf8(""_kj));
+  KJ_EXPECT(isValidUtf8("foo"_kj));
+  KJ_EXPECT(isValidUtf8("\xe2\x82\xac \xc3\xa9 \xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf"_kj));
+
+  KJ_EXPECT(!isValidUtf8("\x80"_kj));                  // stray continuation
+  KJ_EXPECT(!isValidUtf8("\xc3"_kj));                  // truncated
+  KJ_EXPECT(!isValidUtf8("\xe2\x82"_kj));              // truncated
+  KJ_EXPECT(!isValidUtf8("\xc0\x80"_kj));              // overlong
+  KJ_EXPECT(!isValidUtf8("\xe0\x80\x80"_kj));          // overlong
+  KJ_EXPECT(!isValidUtf8("\xf0\x80\x80\x80"_kj));      // overlong
+  KJ_EXPECT(!isValidUtf8("\xed\xa0\x80"_kj));          // surrogate
+  KJ_EXPECT(!isValidUtf8("\xf4\x90\x80\x80"_kj));      // past U+10FFFF
+  KJ_EXPECT(!isValidUtf8("\xf8\x88\x80\x80\x80"_kj));  // 5-byte
+
+  // Errors are found after long ASCII runs, at any offset.
+  for (size_t pos: {0, 7, 8, 31, 32, 33, 64, 100}) {
+    auto text = heapString(128);
+    memset(text.begin(), 'a', text.size());
+    KJ_EXPECT(isValidUtf8(text));
+    text[pos] = '\xff';
+    KJ_EXPECT(!isValidUtf8(text), pos);
+    KJ_EXPECT(encodeUtf16(text).hadErrors, pos);
+
+    text[pos] = '\xc3';
+    text[pos + 1] = '\xa9';
+    KJ_EXPECT(isValidUtf8(text), pos);
+    auto utf16 = encodeUtf16(text);
+    KJ_EXPECT(!utf16.hadErrors, pos);
+    KJ_EXPECT(utf16.size() == 127, pos);
+    KJ_EXPECT(utf16[pos] == 0xe9, pos);
+    KJ_EXPECT(utf16[pos + 1] == 'a', pos);
+  }
+}
+
 KJ_TEST("decode UTF-16 to UTF-8") {
   expectRes(decodeUtf16(u"foo"), u8"foo");
   expectRes(decodeUtf16(u"Здравствуйте"), u8"Здравствуйте");
@@ -282,6 +317,24 @@ KJ_TEST("hex encoding/decoding") {
   expectRes(decodeHex("1234xbf2"), bytes, true);
 }
 
+KJ_TEST("hex encoding of long inputs") {
+  auto bytes = heapArray<byte>(256);
+  for (auto i: kj::indices(bytes)) bytes[i] = i;
+
+  for (size_t size: {15, 16, 17, 33, 256}) {
+    auto encoded = encodeHex(bytes.slice(0, size));
+    KJ_ASSERT(encoded.size() == size * 2);
+    for (size_t i = 0; i < size; i++) {
+      KJ_EXPECT(encoded[i * 2] == "0123456789abcdef"[i / 16], size, i);
+      KJ_EXPECT(encoded[i * 2 + 1] == "0123456789abcdef"[i % 16], size, i);
+    }
+
+    auto decoded = decodeHex(encoded);
+    KJ_EXPECT(!decoded.hadErrors);
+    KJ_EXPECT(decoded == bytes.slice(0, size));
+  }
+}
+
 constexpr char RFC2396_FRAGMENT_SET_DIFF[] = "#$&+,/:;=?@[\\]^{|}";
 // These are the characters reserved in RFC 2396, but not in the fragment percent encode set.
 
@@ -486,6 +539,48 @@ KJ_TEST("base64 encoding/decoding") {
   }
 }
 
+KJ_TEST("base64 encoding/decoding of long inputs") {
+  // Long enough to exercise the vector kernels, with lengths that leave every possible tail.
+  auto bytes = heapArray<byte>(300);
+  for (auto i: kj::indices(bytes)) bytes[i] = i * 37 + 11;
+
+  for (size_t size: {47, 48, 49, 50, 95, 96, 97, 98, 161, 162, 163, 300}) {
+    auto input = bytes.slice(0, size);
+
+    // Compare against the encoding of each 3-byte group on its own.
+    auto encoded = encodeBase64(input);
+    for (size_t i = 0; i < size; i += 3) {
+      auto group = encodeBase64(input.slice(i, kj::min(i + 3, size)));
+      KJ_EXPECT(encoded.slice(i / 3 * 4, i / 3 * 4 + 4) == group, size, i);
+    }
+
+    auto decoded = decodeBase64(encoded);
+    KJ_EXPECT(!decoded.hadErrors, size);
+    KJ_EXPECT(decoded == input, size);
+
+    auto lines = encodeBase64(input, true);
+    KJ_EXPECT(lines.size() == encoded.size() + (encoded.size() + 71) / 72, size);
+    size_t firstLine = kj::min(72, encoded.size());
+    KJ_EXPECT(lines.slice(0, firstLine) == encoded.slice(0, firstLine), size);
+    auto decodedLines = decodeBase64(lines);
+    KJ_EXPECT(!decodedLines.hadErrors, size);
+    KJ_EXPECT(decodedLines == input, size);
+  }
+
+  // Errors and whitespace are still caught when they appear deep inside a long input.
+  auto encoded = encodeBase64(bytes);
+  for (size_t pos: {0, 15, 16, 31, 32, 63, 64, 200}) {
+    auto copy = heapString(encoded);
+    copy[pos] = '*';
+    KJ_EXPECT(decodeBase64(copy).hadErrors, pos);
+
+    auto spaced = str(encoded.slice(0, pos), ' ', encoded.slice(pos));
+    auto decoded = decodeBase64(spaced);
+    KJ_EXPECT(!decoded.hadErrors, pos);
+    KJ_EXPECT(decoded == bytes, pos);
+  }
+}
+
 KJ_TEST("base64 url encoding") {
   {
     // Handles empty.
@@ -22,9 +22,382 @@
 #include "encoding.h"
 #include "vector.h"
 #include "debug.h"
+#include <string.h>
+#include <stdint.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KJ_ENCODING_X86 1
+#define KJ_ENCODING_SSSE3_TARGET __attribute__((target("ssse3")))
+#define KJ_ENCODING_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KJ_ENCODING_NEON 1
+#endif
 
 namespace kj {
 
+// =======================================================================================
+// Vector kernels
+//
+// Each kernel below handles some prefix of its input and returns how much it consumed; the
+// caller finishes the rest with the portable code, which remains the reference implementation.
+// x86 kernels are chosen at runtime based on CPU support. NEON is part of the aarch64 baseline.
+
+namespace {
+
+const char BASE64_CHARS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#if KJ_ENCODING_X86
+bool haveSsse3() {
+  static const bool result = __builtin_cpu_supports("ssse3");
+  return result;
+}
+
+bool haveAvx2() {
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+
+KJ_ENCODING_AVX2_TARGET
+size_t asciiPrefixLengthAvx2(const byte* in, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    if (_mm256_movemask_epi8(chunk) != 0) break;
+  }
+  return i;
+}
+
+KJ_ENCODING_SSSE3_TARGET
+size_t encodeHexSsse3(const byte* in, size_t size, char* out) {
+  const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>("0123456789abcdef"));
+  const __m128i lowNibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(chunk, 4), lowNibble));
+    __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(chunk, lowNibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+// The base64 kernels follow Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions" (2018). Encoding spreads each 3-byte group across a 32-bit
+// lane, isolates the four 6-bit indices with multiplies, and maps indices to ASCII by adding an
+// offset chosen by range. Decoding classifies each character by its nibbles to validate it,
+// subtracts the matching offset, and packs the 6-bit values back together with multiply-adds.
+
+KJ_ENCODING_SSSE3_TARGET
+inline __m128i base64IndicesToAsciiSsse3(__m128i indices) {
+  const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  __m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  range = _mm_or_si128(range, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+KJ_ENCODING_SSSE3_TARGET
+size_t encodeBase64Ssse3(const byte* in, size_t size, char* out) {
+  // Consumes 12 bytes per iteration, but reads 16.
+  const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 12) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    chunk = _mm_shuffle_epi8(chunk, spread);
+    __m128i ac = _mm_mulhi_epu16(_mm_and_si128(chunk, _mm_set1_epi32(0x0fc0fc00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i bd = _mm_mullo_epi16(_mm_and_si128(chunk, _mm_set1_epi32(0x003f03f0)),
+                                 _mm_set1_epi32(0x01000010));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 3 * 4),
+                     base64IndicesToAsciiSsse3(_mm_or_si128(ac, bd)));
+  }
+  return i;
+}
+
+KJ_ENCODING_AVX2_TARGET
+size_t encodeBase64Avx2(const byte* in, size_t size, char* out) {
+  // Consumes 24 bytes per iteration, but reads 28.
+  const __m256i spread = _mm256_set_epi8(
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+      10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i offsets = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; i + 28 <= size; i += 24) {
+    __m256i chunk = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)), 1);
+    chunk = _mm256_shuffle_epi8(chunk, spread);
+    __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(chunk, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(chunk, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(ac, bd);
+
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range, _mm256_and_si256(isUpper, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i / 3 * 4),
+                        _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+  }
+  return i;
+}
+
+KJ_ENCODING_SSSE3_TARGET
+size_t decodeBase64Ssse3(const char* in, size_t size, byte* out, size_t outSize) {
+  // Consumes 16 characters and produces 12 bytes per iteration, but writes 16. Stops at the first
+  // block containing anything other than the 64 alphabet characters, including whitespace and
+  // padding.
+  const __m128i lutLo = _mm_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lutHi = _mm_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i lowNibble = _mm_set1_epi8(0x0f);
+  const __m128i gather = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  size_t i = 0, o = 0;
+  for (; i + 16 <= size && o + 16 <= outSize; i += 16, o += 12) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(chunk, 4), lowNibble);
+    __m128i lo = _mm_shuffle_epi8(lutLo, _mm_and_si128(chunk, lowNibble));
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) {
+      break;
+    }
+
+    __m128i isSlash = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('/'));
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(isSlash, hiNibbles));
+    __m128i values = _mm_add_epi8(chunk, roll);
+
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_shuffle_epi8(triples, gather));
+  }
+  return i;
+}
+
+KJ_ENCODING_AVX2_TARGET
+size_t decodeBase64Avx2(const char* in, size_t size, byte* out, size_t outSize) {
+  // Like decodeBase64Ssse3(), but consumes 32 characters and produces 24 bytes (writing 32) per
+  // iteration.
+  const __m256i lutLo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lutHi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lutRoll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+  const __m256i gather = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+  size_t i = 0, o = 0;
+  for (; i + 32 <= size && o + 32 <= outSize; i += 32, o += 24) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(chunk, 4), lowNibble);
+    __m256i lo = _mm256_shuffle_epi8(lutLo, _mm256_and_si256(chunk, lowNibble));
+    __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+
+    __m256i isSlash = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('/'));
+    __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNibbles));
+    __m256i values = _mm256_add_epi8(chunk, roll);
+
+    __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i triples = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    triples = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(triples, gather), compact);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), triples);
+  }
+  return i;
+}
+#endif  // KJ_ENCODING_X86
+
+#if KJ_ENCODING_NEON
+size_t asciiPrefixLengthNeon(const byte* in, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(in + i)) >= 0x80) break;
+  }
+  return i;
+}
+
+size_t encodeHexNeon(const byte* in, size_t size, char* out) {
+  const uint8x16_t digits = vld1q_u8(reinterpret_cast<const uint8_t*>("0123456789abcdef"));
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t chunk = vld1q_u8(in + i);
+    uint8x16x2_t pairs;
+    pairs.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(chunk, 4));
+    pairs.val[1] = vqtbl1q_u8(digits, vandq_u8(chunk, vdupq_n_u8(0x0f)));
+    vst2q_u8(reinterpret_cast<uint8_t*>(out + i * 2), pairs);
+  }
+  return i;
+}
+
+inline uint8x16x4_t loadTable64(const uint8_t* table) {
+  uint8x16x4_t result;
+  result.val[0] = vld1q_u8(table);
+  result.val[1] = vld1q_u8(table + 16);
+  result.val[2] = vld1q_u8(table + 32);
+  result.val[3] = vld1q_u8(table + 48);
+  return result;
+}
+
+size_t encodeBase64Neon(const byte* in, size_t size, char* out) {
+  // Consumes 48 bytes per iteration: the structured load splits them into three vectors holding
+  // the first, second, and third byte of each group.
+  const uint8x16x4_t table = loadTable64(reinterpret_cast<const uint8_t*>(BASE64_CHARS));
+  const uint8x16_t sixBits = vdupq_n_u8(0x3f);
+  size_t i = 0;
+  for (; i + 48 <= size; i += 48) {
+    uint8x16x3_t groups = vld3q_u8(in + i);
+    uint8x16x4_t indices;
+    indices.val[0] = vshrq_n_u8(groups.val[0], 2);
+    indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(groups.val[0], 4),
+                                       vshrq_n_u8(groups.val[1], 4)), sixBits);
+    indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(groups.val[1], 2),
+                                       vshrq_n_u8(groups.val[2], 6)), sixBits);
+    indices.val[3] = vandq_u8(groups.val[2], sixBits);
+
+    uint8x16x4_t chars;
+    for (uint j = 0; j < 4; j++) chars.val[j] = vqtbl4q_u8(table, indices.val[j]);
+    vst4q_u8(reinterpret_cast<uint8_t*>(out + i / 3 * 4), chars);
+  }
+  return i;
+}
+
+struct Base64DecodeTable {
+  uint8_t values[128];
+  // Maps each ASCII character to its 6-bit value, or 0xff if it isn't in the alphabet.
+};
+
+constexpr Base64DecodeTable makeBase64DecodeTable() {
+  Base64DecodeTable table = {};
+  for (uint i = 0; i < 128; i++) table.values[i] = 0xff;
+  for (uint i = 0; i < 64; i++) table.values[static_cast<uint8_t>(BASE64_CHARS[i])] = i;
+  return table;
+}
+
+constexpr Base64DecodeTable BASE64_DECODE_TABLE = makeBase64DecodeTable();
+
+size_t decodeBase64Neon(const char* in, size_t size, byte* out, size_t outSize) {
+  // Consumes 64 characters and produces 48 bytes per iteration. Stops at the first block
+  // containing anything other than the 64 alphabet characters.
+  const uint8x16x4_t tableLo = loadTable64(BASE64_DECODE_TABLE.values);
+  const uint8x16x4_t tableHi = loadTable64(BASE64_DECODE_TABLE.values + 64);
+  const uint8x16_t flip = vdupq_n_u8(0x40);
+  size_t i = 0, o = 0;
+  for (; i + 64 <= size && o + 48 <= outSize; i += 64, o += 48) {
+    uint8x16x4_t chars = vld4q_u8(reinterpret_cast<const uint8_t*>(in + i));
+    uint8x16x4_t values;
+    uint8x16_t allChars = vdupq_n_u8(0);
+    uint8x16_t allValues = vdupq_n_u8(0);
+    for (uint j = 0; j < 4; j++) {
+      // vqtbl4q_u8() handles characters below 64 and yields zero for the rest; vqtbx4q_u8() then
+      // overwrites the lanes for characters 64 to 127. Characters of 128 and up are caught by the
+      // check on `allChars`.
+      values.val[j] = vqtbx4q_u8(vqtbl4q_u8(tableLo, chars.val[j]),
+                                 tableHi, veorq_u8(chars.val[j], flip));
+      allChars = vorrq_u8(allChars, chars.val[j]);
+      allValues = vorrq_u8(allValues, values.val[j]);
+    }
+    if (vmaxvq_u8(allChars) >= 0x80 || vmaxvq_u8(allValues) >= 0x40) break;
+
+    uint8x16x3_t bytes;
+    bytes.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+    bytes.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+    bytes.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+    vst3q_u8(out + o, bytes);
+  }
+  return i;
+}
+#endif  // KJ_ENCODING_NEON
+
+size_t asciiPrefixLength(const byte* in, size_t size) {
+  // Returns the number of leading bytes of `in` that are ASCII.
+
+  size_t i = 0;
+#if KJ_ENCODING_X86
+  if (size >= 32 && haveAvx2()) i = asciiPrefixLengthAvx2(in, size);
+#elif KJ_ENCODING_NEON
+  i = asciiPrefixLengthNeon(in, size);
+#endif
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, in + i, sizeof(word));
+    if (word & 0x8080808080808080ull) break;
+  }
+  while (i < size && in[i] < 0x80) ++i;
+  return i;
+}
+
+char* encodeBase64Groups(const byte* in, size_t groupCount, char* out) {
+  // Encodes `groupCount` complete 3-byte groups, with no padding or line breaks. Returns the end
+  // of the output.
+
+  size_t size = groupCount * 3;
+  size_t i = 0;
+#if KJ_ENCODING_X86
+  if (haveAvx2()) {
+    i = encodeBase64Avx2(in, size, out);
+  } else if (haveSsse3()) {
+    i = encodeBase64Ssse3(in, size, out);
+  }
+#elif KJ_ENCODING_NEON
+  i = encodeBase64Neon(in, size, out);
+#endif
+  out += i / 3 * 4;
+  for (; i < size; i += 3) {
+    uint b0 = in[i], b1 = in[i + 1], b2 = in[i + 2];
+    *out++ = BASE64_CHARS[b0 >> 2];
+    *out++ = BASE64_CHARS[((b0 & 0x03) << 4) | (b1 >> 4)];
+    *out++ = BASE64_CHARS[((b1 & 0x0f) << 2) | (b2 >> 6)];
+    *out++ = BASE64_CHARS[b2 & 0x3f];
+  }
+  return out;
+}
+
+size_t decodeBase64Prefix(ArrayPtr<const char> input, ArrayPtr<byte> output) {
+  // Decodes a prefix of `input` consisting purely of alphabet characters, in multiples of four
+  // characters, so that the libb64 decoder can resume from a fresh state. Returns the number of
+  // characters consumed; the output length is 3/4 of that.
+
+  size_t i = 0;
+#if KJ_ENCODING_X86
+  if (haveAvx2()) {
+    i = decodeBase64Avx2(input.begin(), input.size(), output.begin(), output.size());
+  } else if (haveSsse3()) {
+    i = decodeBase64Ssse3(input.begin(), input.size(), output.begin(), output.size());
+  }
+#elif KJ_ENCODING_NEON
+  i = decodeBase64Neon(input.begin(), input.size(), output.begin(), output.size());
+#endif
+  return i;
+}
+
+}  // namespace
+
+
 namespace {
 
 #define GOTO_ERROR_IF(cond) if (KJ_UNLIKELY(cond)) goto error
@@ -47,12 +420,22 @@ EncodingResult<Array<T>> encodeUtf(ArrayPtr<const char> text, bool nulTerminate)
 
   size_t i = 0;
   while (i < text.size()) {
-    byte c = text[i++];
+    byte c = text[i];
     if (c < 0x80) {
-      // 0xxxxxxx -- ASCII
-      result.add(c);
+      // 0xxxxxxx -- ASCII. Widen the whole run at once.
+      size_t run = asciiPrefixLength(text.asBytes().begin() + i, text.size() - i);
+      size_t pos = result.size();
+      result.resize(pos + run);
+      T* out = result.begin() + pos;
+      for (size_t j = 0; j < run; j++) {
+        out[j] = static_cast<byte>(text[i + j]);
+      }
+      i += run;
       continue;
-    } else if (KJ_UNLIKELY(c < 0xc0)) {
+    }
+
+    ++i;
+    if (KJ_UNLIKELY(c < 0xc0)) {
       // 10xxxxxx -- malformed continuation byte
       goto error;
     } else if (c < 0xe0) {
@@ -148,6 +531,47 @@ EncodingResult<Array<char32_t>> encodeUtf32(ArrayPtr<const char> text, bool nulT
   return encodeUtf<char32_t>(text, nulTerminate);
 }
 
+bool isValidUtf8(ArrayPtr<const char> text) {
+  const byte* p = text.asBytes().begin();
+  const byte* end = text.asBytes().end();
+
+  while (p < end) {
+    p += asciiPrefixLength(p, end - p);
+    if (p == end) break;
+
+    byte c = *p++;
+    byte c2;
+    if (c < 0xc2) {
+      // Stray continuation byte, or an overlong 2-byte sequence.
+      return false;
+    } else if (c < 0xe0) {
+      // 110xxxxx -- 2-byte
+      if (p == end || (*p++ & 0xc0) != 0x80) return false;
+    } else if (c < 0xf0) {
+      // 1110xxxx -- 3-byte. Reject overlong sequences (E0 80..9F) and surrogates (ED A0..BF).
+      if (end - p < 2) return false;
+      c2 = *p++;
+      if ((c2 & 0xc0) != 0x80) return false;
+      if (c == 0xe0 && c2 < 0xa0) return false;
+      if (c == 0xed && c2 >= 0xa0) return false;
+      if ((*p++ & 0xc0) != 0x80) return false;
+    } else if (c < 0xf5) {
+      // 11110xxx -- 4-byte. Reject overlong sequences (F0 80..8F) and anything past U+10FFFF.
+      if (end - p < 3) return false;
+      c2 = *p++;
+      if ((c2 & 0xc0) != 0x80) return false;
+      if (c == 0xf0 && c2 < 0x90) return false;
+      if (c == 0xf4 && c2 >= 0x90) return false;
+      if ((*p++ & 0xc0) != 0x80) return false;
+      if ((*p++ & 0xc0) != 0x80) return false;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 EncodingResult<String> decodeUtf16(ArrayPtr<const char16_t> utf16) {
   Vector<char> result(utf16.size() + 1);
   bool hadErrors = false;
@@ -371,9 +795,21 @@ static Maybe<uint> tryFromOctDigit(char c) {
 }  // namespace
 
 String encodeHex(ArrayPtr<const byte> input) {
-  return strArray(KJ_MAP(b, input) {
-    return heapArray<char>({HEX_DIGITS[b/16], HEX_DIGITS[b%16]});
-  }, "");
+  auto result = heapString(input.size() * 2);
+  char* out = result.begin();
+
+  size_t i = 0;
+#if KJ_ENCODING_X86
+  if (haveSsse3()) i = encodeHexSsse3(input.begin(), input.size(), out);
+#elif KJ_ENCODING_NEON
+  i = encodeHexNeon(input.begin(), input.size(), out);
+#endif
+  for (; i < input.size(); i++) {
+    out[i * 2] = HEX_DIGITS[input[i] / 16];
+    out[i * 2 + 1] = HEX_DIGITS[input[i] % 16];
+  }
+
+  return result;
 }
 
 EncodingResult<Array<byte>> decodeHex(ArrayPtr<const char> text) {
@@ -829,10 +1265,29 @@ String encodeBase64(ArrayPtr<const byte> input, bool breakLines) {
   base64_encodestate s;
 
   /*---------- START ENCODING ----------*/
+  /* encode complete groups (and lines) in bulk, leaving only a partial group (or line) */
+  const byte* in = input.begin();
+  size_t remaining = input.size();
+  if (breakLines) {
+    const size_t bytesPerLine = CHARS_PER_LINE / 4 * 3;
+    while (remaining >= bytesPerLine) {
+      c = encodeBase64Groups(in, CHARS_PER_LINE / 4, c);
+      *c++ = '\n';
+      in += bytesPerLine;
+      remaining -= bytesPerLine;
+    }
+  } else {
+    size_t groupCount = remaining / 3;
+    c = encodeBase64Groups(in, groupCount, c);
+    in += groupCount * 3;
+    remaining -= groupCount * 3;
+  }
+  total = c - output.begin();
+
   /* initialise the encoder state */
   base64_init_encodestate(&s);
   /* gather data from the input and send it to the output */
-  cnt = base64_encode_block((const char *)input.begin(), input.size(), c, &s, breakLines);
+  cnt = base64_encode_block((const char *)in, remaining, c, &s, breakLines);
   c += cnt;
   total += cnt;
 
@@ -995,8 +1450,10 @@ EncodingResult<Array<byte>> decodeBase64(ArrayPtr<const char> input) {
 
   auto output = heapArray<byte>((input.size() * 6 + 7) / 8);
 
-  size_t n = base64_decode_block(input.begin(), input.size(),
-      reinterpret_cast<char*>(output.begin()), &state);
+  size_t consumed = decodeBase64Prefix(input, output);
+  size_t n = consumed / 4 * 3;
+  n += base64_decode_block(input.begin() + consumed, input.size() - consumed,
+      reinterpret_cast<char*>(output.begin() + n), &state);
 
   if (n < output.size()) {
     auto copy = heapArray<byte>(n);
@@ -104,6 +104,12 @@ EncodingResult<String> decodeUtf32(ArrayPtr<const char32_t> utf32);
 //   raised on subsequent legs unless all invalid sequences were replaced with U+FFFD (which, after
 //   all, is a valid code point).
 
+bool isValidUtf8(ArrayPtr<const char> text);
+// Returns true if `text` is well-formed UTF-8: no stray or missing continuation bytes, no overlong
+// sequences, no surrogate code points, and nothing past U+10FFFF. This is exactly the input for
+// which encodeUtf16() and encodeUtf32() would not set `hadErrors`, but it allocates nothing and is
+// much faster, particularly on mostly-ASCII text.
+
 EncodingResult<Array<wchar_t>> encodeWideString(
     ArrayPtr<const char> text, bool nulTerminate = false);
 EncodingResult<String> decodeWideString(ArrayPtr<const wchar_t> wide);
@@ -209,6 +209,45 @@ KJ_TEST("getStackTrace() returns correct line number, not line + 1") {
 }
 
 #if !KJ_NO_EXCEPTIONS
+KJ_TEST("stack trace capture can be disabled per exception type") {
+  KJ_EXPECT(isStackTraceCaptureEnabled(Exception::Type::OVERLOADED));
+  setStackTraceCaptureEnabled(Exception::Type::OVERLOADED, false);
+  KJ_DEFER(setStackTraceCaptureEnabled(Exception::Type::OVERLOADED, true));
+  KJ_EXPECT(!isStackTraceCaptureEnabled(Exception::Type::OVERLOADED));
+  KJ_EXPECT(isStackTraceCaptureEnabled(Exception::Type::FAILED));
+
+  KJ_IF_MAYBE(e, kj::runCatchingExceptions([]() {
+    throwFatalException(KJ_EXCEPTION(OVERLOADED, "too busy"));
+  })) {
+    KJ_EXPECT(e->getStackTrace().size() == 0);
+  } else {
+    KJ_FAIL_EXPECT("should have thrown");
+  }
+
+  void* space[1];
+  if (kj::getStackTrace(space, 0).size() > 0) {
+    // Other types are unaffected (when this platform supports stack traces at all).
+    KJ_IF_MAYBE(e, kj::runCatchingExceptions([]() {
+      throwFatalException(KJ_EXCEPTION(FAILED, "broken"));
+    })) {
+      KJ_EXPECT(e->getStackTrace().size() > 0);
+    } else {
+      KJ_FAIL_EXPECT("should have thrown");
+    }
+  }
+}
+
+KJ_TEST("extendTrace() leaves a full trace alone") {
+  auto e = KJ_EXCEPTION(FAILED, "foo");
+  void* fake[32];
+  for (auto i: kj::indices(fake)) fake[i] = reinterpret_cast<void*>(i + 1);
+  for (auto addr: fake) e.addTrace(addr);
+  KJ_ASSERT(e.getStackTrace().size() == kj::size(fake));
+
+  e.extendTrace(0);
+  KJ_EXPECT(e.getStackTrace() == kj::arrayPtr(fake, kj::size(fake)));
+}
+
 KJ_TEST("InFlightExceptionIterator works") {
   bool caught = false;
   try {
@@ -295,59 +295,117 @@ String stringifyStackTrace(ArrayPtr<void* const> trace) {
   // The environment manipulation is not thread-safe, so lock a mutex.  This could still be
   // problematic if another thread is manipulating the environment in unrelated code, but there's
   // not much we can do about that.  This is debug-only anyway and only an issue when LD_PRELOAD
-  // is in use.
+  // is in use. The mutex also protects the symbol cache below.
   static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
   pthread_mutex_lock(&mutex);
   KJ_DEFER(pthread_mutex_unlock(&mutex));
 
-  // Don't heapcheck / intercept syscalls.
-  const char* preload = getenv("LD_PRELOAD");
-  String oldPreload;
-  if (preload != nullptr) {
-    oldPreload = heapString(preload);
-    unsetenv("LD_PRELOAD");
+  // Spawning addr2line is by far the most expensive part of producing a trace, and the same few
+  // call sites tend to show up over and over, so remember what each address resolved to. The
+  // cache is direct-mapped, so a colliding address simply evicts the previous entry. It is
+  // deliberately leaked, since stack traces may be stringified during static destruction.
+  struct CachedSymbol {
+    void* addr = nullptr;
+    String line;
+  };
+  static constexpr size_t SYMBOL_CACHE_SIZE = 1024;
+  static CachedSymbol* const symbolCache = new CachedSymbol[SYMBOL_CACHE_SIZE];
+  auto cacheSlot = [](void* addr) -> CachedSymbol& {
+    uintptr_t key = reinterpret_cast<uintptr_t>(addr);
+    return symbolCache[((key >> 4) ^ (key >> 14)) % SYMBOL_CACHE_SIZE];
+  };
+
+  KJ_STACK_ARRAY(String, symbols, trace.size(), 32, 128);
+  KJ_STACK_ARRAY(size_t, misses, trace.size(), 32, 128);
+  size_t missCount = 0;
+  for (auto i: kj::indices(trace)) {
+    auto& slot = cacheSlot(trace[i]);
+    if (slot.addr == trace[i]) {
+      symbols[i] = heapString(slot.line);
+    } else {
+      misses[missCount++] = i;
+    }
   }
-  KJ_DEFER(if (oldPreload != nullptr) { setenv("LD_PRELOAD", oldPreload.cStr(), true); });
 
-  String lines[32];
-  FILE* p = nullptr;
-  auto strTrace = strArray(trace, " ");
+  if (missCount > 0) {
+    // Don't heapcheck / intercept syscalls.
+    const char* preload = getenv("LD_PRELOAD");
+    String oldPreload;
+    if (preload != nullptr) {
+      oldPreload = heapString(preload);
+      unsetenv("LD_PRELOAD");
+    }
+    KJ_DEFER(if (oldPreload != nullptr) { setenv("LD_PRELOAD", oldPreload.cStr(), true); });
+
+    FILE* p = nullptr;
+    auto strTrace = strArray(KJ_MAP(i, misses.slice(0, missCount)) { return trace[i]; }, " ");
 
 #if __linux__
-  if (access("/proc/self/exe", R_OK) < 0) {
-    // Apparently /proc is not available?
-    return nullptr;
-  }
+    if (access("/proc/self/exe", R_OK) < 0) {
+      // Apparently /proc is not available?
+      return nullptr;
+    }
 
-  // Obtain symbolic stack trace using addr2line.
-  // TODO(cleanup): Use fork() and exec() or maybe our own Subprocess API (once it exists), to
-  //   avoid depending on a shell.
-  p = popen(str("addr2line -e /proc/", getpid(), "/exe ", strTrace).cStr(), "r");
+    // Obtain symbolic stack trace using addr2line.
+    // TODO(cleanup): Use fork() and exec() or maybe our own Subprocess API (once it exists), to
+    //   avoid depending on a shell.
+    p = popen(str("addr2line -e /proc/", getpid(), "/exe ", strTrace).cStr(), "r");
 #elif __APPLE__
-  // The Mac OS X equivalent of addr2line is atos.
-  // (Internally, it uses the private CoreSymbolication.framework library.)
-  p = popen(str("xcrun atos -p ", getpid(), ' ', strTrace).cStr(), "r");
+    // The Mac OS X equivalent of addr2line is atos.
+    // (Internally, it uses the private CoreSymbolication.framework library.)
+    p = popen(str("xcrun atos -p ", getpid(), ' ', strTrace).cStr(), "r");
 #elif __CYGWIN__
-  wchar_t exeWinPath[MAX_PATH];
-  if (GetModuleFileNameW(nullptr, exeWinPath, sizeof(exeWinPath)) == 0) {
-    return nullptr;
-  }
-  char exePosixPath[MAX_PATH * 2];
-  if (cygwin_conv_path(CCP_WIN_W_TO_POSIX, exeWinPath, exePosixPath, sizeof(exePosixPath)) < 0) {
-    return nullptr;
-  }
-  p = popen(str("addr2line -e '", exePosixPath, "' ", strTrace).cStr(), "r");
+    wchar_t exeWinPath[MAX_PATH];
+    if (GetModuleFileNameW(nullptr, exeWinPath, sizeof(exeWinPath)) == 0) {
+      return nullptr;
+    }
+    char exePosixPath[MAX_PATH * 2];
+    if (cygwin_conv_path(CCP_WIN_W_TO_POSIX, exeWinPath, exePosixPath,
+                         sizeof(exePosixPath)) < 0) {
+      return nullptr;
+    }
+    p = popen(str("addr2line -e '", exePosixPath, "' ", strTrace).cStr(), "r");
 #endif
 
-  if (p == nullptr) {
-    return nullptr;
+    if (p == nullptr) {
+      return nullptr;
+    }
+
+    // Both addr2line and atos print exactly one line per address, in order.
+    char line[512];
+    size_t j = 0;
+    while (fgets(line, sizeof(line), p) != nullptr) {
+      size_t len = strlen(line);
+      bool complete = len > 0 && line[len-1] == '\n';
+      if (complete) line[len-1] = '\0';
+      if (j < missCount) {
+        size_t i = misses[j];
+        if (symbols[i] == nullptr) {
+          symbols[i] = heapString(line);
+        }
+        if (complete) {
+          auto& slot = cacheSlot(trace[i]);
+          slot.addr = trace[i];
+          slot.line = heapString(symbols[i]);
+          ++j;
+        }
+      }
+      // (If the line didn't fit in our buffer, the remainder is discarded by the next
+      // iteration(s), since `symbols[i]` is already set.)
+    }
+
+    pclose(p);
   }
 
-  char line[512];
+  String lines[32];
   size_t i = 0;
-  while (i < kj::size(lines) && fgets(line, sizeof(line), p) != nullptr) {
+  for (auto& symbol: symbols) {
+    if (i == kj::size(lines)) break;
+    if (symbol == nullptr) continue;
+
     // Don't include exception-handling infrastructure or promise infrastructure in stack trace.
     // addr2line output matches file names; atos output matches symbol names.
+    const char* line = symbol.cStr();
     if (strstr(line, "kj/common.c++") != nullptr ||
         strstr(line, "kj/exception.") != nullptr ||
         strstr(line, "kj/debug.") != nullptr ||
@@ -359,16 +417,9 @@ String stringifyStackTrace(ArrayPtr<void* const> trace) {
       continue;
     }
 
-    size_t len = strlen(line);
-    if (len > 0 && line[len-1] == '\n') line[len-1] = '\0';
     lines[i++] = str("\n    ", trimSourceFilename(line), ": returning here");
   }
 
-  // Skip remaining input.
-  while (fgets(line, sizeof(line), p) != nullptr) {}
-
-  pclose(p);
-
   return strArray(arrayPtr(lines, i), "");
 
 #else
@@ -435,6 +486,26 @@ StringPtr stringifyStackTraceAddresses(ArrayPtr<void* const> trace, ArrayPtr<cha
 #endif
 }
 
+namespace {
+
+uint stackTraceCaptureDisabled = 0;
+// Bit N is set if stack trace capture is disabled for Exception::Type N.
+
+}  // namespace
+
+void setStackTraceCaptureEnabled(Exception::Type type, bool enabled) {
+  uint bit = 1u << static_cast<uint>(type);
+  if (enabled) {
+    stackTraceCaptureDisabled &= ~bit;
+  } else {
+    stackTraceCaptureDisabled |= bit;
+  }
+}
+
+bool isStackTraceCaptureEnabled(Exception::Type type) {
+  return (stackTraceCaptureDisabled & (1u << static_cast<uint>(type))) == 0;
+}
+
 String getStackTrace() {
   void* space[32];
   auto trace = getStackTrace(space, 2);
@@ -805,13 +876,18 @@ void Exception::wrapContext(const char* file, int line, String&& description) {
 }
 
 void Exception::extendTrace(uint ignoreCount, uint limit) {
-  KJ_STACK_ARRAY(void*, newTraceSpace, kj::min(kj::size(trace), limit) + ignoreCount + 1,
+  // Unwind only as deep as we can record. In particular, an exception which is rethrown after
+  // already filling its trace doesn't need to unwind at all.
+  size_t room = kj::min(kj::size(trace) - traceCount, limit);
+  if (room == 0 || !isStackTraceCaptureEnabled(type)) return;
+
+  KJ_STACK_ARRAY(void*, newTraceSpace, room + ignoreCount + 1,
       sizeof(trace)/sizeof(trace[0]) + 8, 128);
 
   auto newTrace = kj::getStackTrace(newTraceSpace, ignoreCount + 1);
   if (newTrace.size() > ignoreCount + 2) {
     // Remove suffix that won't fit into our static-sized trace.
-    newTrace = newTrace.slice(0, kj::min(kj::size(trace) - traceCount, newTrace.size()));
+    newTrace = newTrace.slice(0, kj::min(room, newTrace.size()));
 
     // Copy the rest into our trace.
     memcpy(trace + traceCount, newTrace.begin(), newTrace.asBytes().size());
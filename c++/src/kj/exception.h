@@ -119,7 +119,9 @@ public:
   // Append the current stack trace to the exception's trace, ignoring the first `ignoreCount`
   // frames (see `getStackTrace()` for discussion of `ignoreCount`).
   //
-  // If `limit` is set, limit the number of frames added to the given number.
+  // If `limit` is set, limit the number of frames added to the given number. The stack is only
+  // unwound as far as there is room left in the trace, and not at all if the trace is already
+  // full or if capture is disabled for this exception's type (see setStackTraceCaptureEnabled()).
 
   KJ_NOINLINE void truncateCommonTrace();
   // Remove the part of the stack trace which the exception shares with the caller of this method.
@@ -385,6 +387,17 @@ StringPtr stringifyStackTraceAddresses(ArrayPtr<void* const> trace, ArrayPtr<cha
 String getStackTrace();
 // Get a stack trace right now and stringify it. Useful for debugging.
 
+void setStackTraceCaptureEnabled(Exception::Type type, bool enabled);
+bool isStackTraceCaptureEnabled(Exception::Type type);
+// Controls whether throwing an exception of the given type captures a stack trace. Unwinding the
+// stack is the most expensive part of constructing an exception, so a server which throws
+// expected exceptions (e.g. OVERLOADED) at a high rate may want to turn it off for those types.
+// Frames added by the async framework via addTrace() are still recorded. Capture is enabled for
+// all types by default.
+//
+// Like Debug::setLogLevel(), this is a process-wide setting that is not synchronized; set it at
+// startup.
+
 void printStackTraceOnCrash();
 // Registers signal handlers on common "crash" signals like SIGSEGV that will (attempt to) print
 // a stack trace. You should call this as early as possible on program startup. Programs using
@@ -537,6 +537,55 @@ KJ_TEST("DiskDirectory") {
   KJ_EXPECT(!dir->tryRemove(Path("corge")));
 }
 
+KJ_TEST("DiskDirectory listEntriesWithMetadata()") {
+  TempDir tempDir;
+  auto dir = tempDir.get();
+
+  KJ_EXPECT(dir->listEntriesWithMetadata() == nullptr);
+
+  dir->openFile(Path("foo"), WriteMode::CREATE)->writeAll("foobar");
+  dir->openSubdir(Path("bar"), WriteMode::CREATE);
+
+  // Enough entries that listing them takes several batches, and that parallel stat actually
+  // spreads the work over multiple threads.
+  constexpr uint FILE_COUNT = 6000;
+  for (uint i = 0; i < FILE_COUNT; i++) {
+    dir->openFile(Path(kj::str("file-with-a-fairly-long-name-", i)), WriteMode::CREATE)
+        ->writeAll(kj::str(i));
+  }
+
+  // Temporary files are hidden.
+  auto replacer = dir->replaceFile(Path("qux"), WriteMode::CREATE);
+  replacer->get().writeAll("not yet");
+
+  auto fooHash = dir->openFile(Path("foo"))->stat().hashCode;
+
+  for (uint parallelism: {1u, 4u}) {
+    auto list = dir->listEntriesWithMetadata(parallelism);
+    KJ_ASSERT(list.size() == FILE_COUNT + 2);
+
+    KJ_EXPECT(list[0].name == "bar");
+    KJ_EXPECT(list[0].metadata.type == FsNode::Type::DIRECTORY);
+
+    for (uint i = 1; i <= FILE_COUNT; i++) {
+      KJ_EXPECT(list[i].name.startsWith("file-with-a-fairly-long-name-"));
+      KJ_EXPECT(list[i].metadata.type == FsNode::Type::FILE);
+      KJ_EXPECT(list[i].metadata.size == list[i].name.size() - 29, list[i].name);
+      if (i > 1) {
+        KJ_EXPECT(list[i - 1].name < list[i].name);
+      }
+    }
+
+    auto& foo = list[FILE_COUNT + 1];
+    KJ_EXPECT(foo.name == "foo");
+    KJ_EXPECT(foo.metadata.type == FsNode::Type::FILE);
+    KJ_EXPECT(foo.metadata.size == 6);
+    KJ_EXPECT(foo.metadata.linkCount == 1);
+    KJ_EXPECT(foo.metadata.hashCode == fooHash);
+    KJ_EXPECT(foo.metadata.lastModified == dir->lstat(Path("foo")).lastModified);
+  }
+}
+
 #if !_WIN32  // Creating symlinks on Win32 requires admin privileges prior to Windows 10.
 KJ_TEST("DiskDirectory symlinks") {
   TempDir tempDir;
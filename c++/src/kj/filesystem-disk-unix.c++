@@ -39,12 +39,14 @@
 #include <stdlib.h>
 #include "vector.h"
 #include "miniposix.h"
+#include "thread.h"
 #include <algorithm>
 
 #if __linux__
 #include <syscall.h>
 #include <linux/fs.h>
 #include <sys/sendfile.h>
+#include <sys/sysmacros.h>
 #endif
 
 namespace kj {
@@ -148,6 +150,146 @@ static FsNode::Metadata statToMetadata(struct stat& stats) {
   };
 }
 
+#if __linux__ && defined(STATX_TYPE)
+static FsNode::Metadata statxToMetadata(struct statx& stats) {
+  // Same as statToMetadata(), including the hash, which is why we reconstruct st_dev.
+  uint64_t d = makedev(stats.stx_dev_major, stats.stx_dev_minor);
+  uint64_t hash = ((d << 32) | (d >> 32)) ^ stats.stx_ino;
+
+  struct timespec mtime;
+  mtime.tv_sec = stats.stx_mtime.tv_sec;
+  mtime.tv_nsec = stats.stx_mtime.tv_nsec;
+
+  return FsNode::Metadata {
+    modeToType(stats.stx_mode),
+    implicitCast<uint64_t>(stats.stx_size),
+    implicitCast<uint64_t>(stats.stx_blocks * 512u),
+    toKjDate(mtime),
+    implicitCast<uint>(stats.stx_nlink),
+    hash
+  };
+}
+#endif
+
+static Maybe<FsNode::Metadata> tryLstatAt(int dirFd, const char* path) {
+  // lstat() `path` relative to `dirFd`. Returns null if it doesn't exist.
+
+#if __linux__ && defined(STATX_TYPE)
+  {
+    // statx() lets us ask only for the fields that Metadata uses. Filesystems which have to go out
+    // of their way to produce the rest (notably network filesystems) can skip that work.
+    struct statx stats;
+    KJ_SYSCALL_HANDLE_ERRORS(statx(dirFd, path, AT_SYMLINK_NOFOLLOW,
+        STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_MTIME | STATX_NLINK | STATX_INO,
+        &stats)) {
+      case ENOENT:
+      case ENOTDIR:
+        return nullptr;
+      case ENOSYS:  // Syscall not supported by kernel.
+      case EPERM:   // Some container sandboxes block new syscalls with EPERM rather than ENOSYS.
+        goto statxNotAvailable;
+      default:
+        KJ_FAIL_SYSCALL("statx(fd, path)", error, path) { return nullptr; }
+    }
+    return statxToMetadata(stats);
+  }
+
+statxNotAvailable:
+#endif
+  struct stat stats;
+  KJ_SYSCALL_HANDLE_ERRORS(fstatat(dirFd, path, &stats, AT_SYMLINK_NOFOLLOW)) {
+    case ENOENT:
+    case ENOTDIR:
+      return nullptr;
+    default:
+      KJ_FAIL_SYSCALL("fstatat(fd, path)", error, path) { return nullptr; }
+  }
+  return statToMetadata(stats);
+}
+
+#if __linux__ && defined(SYS_getdents64)
+struct LinuxDirent64 {
+  // Layout of the records returned by getdents64(). Older glibc doesn't declare it.
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];  // actually variable-length, NUL-terminated
+};
+
+static constexpr size_t DIRENT_BUFFER_SIZE = 128 * 1024;
+// glibc's readdir() reads 32KiB of entries per getdents64() call. For directories with many
+// thousands of entries, a bigger buffer means proportionally fewer syscalls.
+#endif
+
+template <typename Func>
+static void forEachDirent(int fd, Func&& func) {
+  // Calls `func(StringPtr name, Maybe<FsNode::Type> type)` for each entry in the directory `fd`,
+  // except "." and "..". `type` is null if the filesystem doesn't report types in directory
+  // listings. Rewinds `fd` first.
+
+  KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
+
+#if __linux__ && defined(SYS_getdents64)
+  auto buffer = heapArray<byte>(DIRENT_BUFFER_SIZE);
+  for (;;) {
+    ssize_t n;
+    KJ_SYSCALL(n = syscall(SYS_getdents64, fd, buffer.begin(), buffer.size()));
+    if (n == 0) break;
+
+    for (ssize_t pos = 0; pos < n;) {
+      auto& entry = *reinterpret_cast<const LinuxDirent64*>(buffer.begin() + pos);
+      pos += entry.d_reclen;
+
+      kj::StringPtr name = entry.d_name;
+      if (name != "." && name != "..") {
+        if (entry.d_type == DT_UNKNOWN) {
+          func(name, Maybe<FsNode::Type>(nullptr));
+        } else {
+          func(name, Maybe<FsNode::Type>(modeToType(DTTOIF(entry.d_type))));
+        }
+      }
+    }
+  }
+#else
+  // Unfortunately, fdopendir() takes ownership of the file descriptor. Therefore we need to
+  // make a duplicate.
+  int duped;
+  KJ_SYSCALL(duped = dup(fd));
+  DIR* dir = fdopendir(duped);
+  if (dir == nullptr) {
+    close(duped);
+    KJ_FAIL_SYSCALL("fdopendir", errno);
+  }
+
+  KJ_DEFER(closedir(dir));
+
+  for (;;) {
+    errno = 0;
+    struct dirent* entry = readdir(dir);
+    if (entry == nullptr) {
+      int error = errno;
+      if (error == 0) {
+        break;
+      } else {
+        KJ_FAIL_SYSCALL("readdir", error);
+      }
+    }
+
+    kj::StringPtr name = entry->d_name;
+    if (name != "." && name != "..") {
+#ifdef DT_UNKNOWN    // d_type is not available on all platforms.
+      if (entry->d_type != DT_UNKNOWN) {
+        func(name, Maybe<FsNode::Type>(modeToType(DTTOIF(entry->d_type))));
+        continue;
+      }
+#endif
+      func(name, Maybe<FsNode::Type>(nullptr));
+    }
+  }
+#endif
+}
+
 static bool rmrf(int fd, StringPtr path);
 
 static void rmrfChildrenAndClose(int fd) {
@@ -659,55 +801,23 @@ public:
   template <typename Func>
   auto list(bool needTypes, Func&& func) const
       -> Array<Decay<decltype(func(instance<StringPtr>(), instance<FsNode::Type>()))>> {
-    // Seek to start of directory.
-    KJ_SYSCALL(lseek(fd, 0, SEEK_SET));
-
-    // Unfortunately, fdopendir() takes ownership of the file descriptor. Therefore we need to
-    // make a duplicate.
-    int duped;
-    KJ_SYSCALL(duped = dup(fd));
-    DIR* dir = fdopendir(duped);
-    if (dir == nullptr) {
-      close(duped);
-      KJ_FAIL_SYSCALL("fdopendir", errno);
-    }
-
-    KJ_DEFER(closedir(dir));
     typedef Decay<decltype(func(instance<StringPtr>(), instance<FsNode::Type>()))> Entry;
     kj::Vector<Entry> entries;
 
-    for (;;) {
-      errno = 0;
-      struct dirent* entry = readdir(dir);
-      if (entry == nullptr) {
-        int error = errno;
-        if (error == 0) {
-          break;
-        } else {
-          KJ_FAIL_SYSCALL("readdir", error);
-        }
-      }
+    forEachDirent(fd, [&](StringPtr name, Maybe<FsNode::Type> type) {
+      if (name.startsWith(HIDDEN_PREFIX)) return;
 
-      kj::StringPtr name = entry->d_name;
-      if (name != "." && name != ".." && !name.startsWith(HIDDEN_PREFIX)) {
-#ifdef DT_UNKNOWN    // d_type is not available on all platforms.
-        if (entry->d_type != DT_UNKNOWN) {
-          entries.add(func(name, modeToType(DTTOIF(entry->d_type))));
-        } else {
-#endif
-          if (needTypes) {
-            // Unknown type. Fall back to stat.
-            struct stat stats;
-            KJ_SYSCALL(fstatat(fd, name.cStr(), &stats, AT_SYMLINK_NOFOLLOW));
-            entries.add(func(name, modeToType(stats.st_mode)));
-          } else {
-            entries.add(func(name, FsNode::Type::OTHER));
-          }
-#ifdef DT_UNKNOWN
-        }
-#endif
+      KJ_IF_MAYBE(t, type) {
+        entries.add(func(name, *t));
+      } else if (needTypes) {
+        // Unknown type. Fall back to stat.
+        struct stat stats;
+        KJ_SYSCALL(fstatat(fd, name.cStr(), &stats, AT_SYMLINK_NOFOLLOW));
+        entries.add(func(name, modeToType(stats.st_mode)));
+      } else {
+        entries.add(func(name, FsNode::Type::OTHER));
       }
-    }
+    });
 
     auto result = entries.releaseAsArray();
     std::sort(result.begin(), result.end());
@@ -724,6 +834,42 @@ public:
     });
   }
 
+  Array<ReadableDirectory::EntryWithMetadata> listEntriesWithMetadata(uint parallelism) const {
+    auto names = listNames();
+    auto metadata = heapArray<Maybe<FsNode::Metadata>>(names.size());
+
+    // Spreading stats over threads only pays off if each thread gets a decent amount of work.
+    static constexpr size_t MIN_ENTRIES_PER_THREAD = 16;
+    size_t threadCount = kj::max(kj::min(size_t(parallelism),
+                                         names.size() / MIN_ENTRIES_PER_THREAD), size_t(1));
+
+    // Thread `t` handles entries t, t + threadCount, t + 2 * threadCount, etc. Interleaving keeps
+    // the threads evenly loaded even if some parts of the directory are slower to stat than
+    // others.
+    auto statEvery = [&](size_t first) {
+      for (size_t i = first; i < names.size(); i += threadCount) {
+        metadata[i] = tryLstatAt(fd, names[i].cStr());
+      }
+    };
+
+    {
+      auto threads = heapArrayBuilder<Own<Thread>>(threadCount - 1);
+      for (size_t t = 1; t < threadCount; t++) {
+        threads.add(heap<Thread>([&statEvery, t]() { statEvery(t); }));
+      }
+      statEvery(0);
+      // `threads` joins here.
+    }
+
+    kj::Vector<ReadableDirectory::EntryWithMetadata> entries(names.size());
+    for (auto i: kj::indices(names)) {
+      KJ_IF_MAYBE(meta, metadata[i]) {
+        entries.add(ReadableDirectory::EntryWithMetadata { kj::mv(names[i]), *meta });
+      }
+    }
+    return entries.releaseAsArray();
+  }
+
   bool exists(PathPtr path) const {
     KJ_SYSCALL_HANDLE_ERRORS(faccessat(fd, path.toString().cStr(), F_OK, 0)) {
       case ENOENT:
@@ -736,15 +882,7 @@ public:
   }
 
   Maybe<FsNode::Metadata> tryLstat(PathPtr path) const {
-    struct stat stats;
-    KJ_SYSCALL_HANDLE_ERRORS(fstatat(fd, path.toString().cStr(), &stats, AT_SYMLINK_NOFOLLOW)) {
-      case ENOENT:
-      case ENOTDIR:
-        return nullptr;
-      default:
-        KJ_FAIL_SYSCALL("faccessat(fd, path)", error, path) { return nullptr; }
-    }
-    return statToMetadata(stats);
+    return tryLstatAt(fd, path.toString().cStr());
   }
 
   Maybe<Own<const ReadableFile>> tryOpenFile(PathPtr path) const {
@@ -1580,6 +1718,9 @@ public:
 
   Array<String> listNames() const override { return DiskHandle::listNames(); }
   Array<Entry> listEntries() const override { return DiskHandle::listEntries(); }
+  Array<EntryWithMetadata> listEntriesWithMetadata(uint parallelism = 1) const override {
+    return DiskHandle::listEntriesWithMetadata(parallelism);
+  }
   bool exists(PathPtr path) const override { return DiskHandle::exists(path); }
   Maybe<FsNode::Metadata> tryLstat(PathPtr path) const override {
     return DiskHandle::tryLstat(path);
@@ -1601,6 +1742,9 @@ public:
 
   Array<String> listNames() const override { return DiskHandle::listNames(); }
   Array<Entry> listEntries() const override { return DiskHandle::listEntries(); }
+  Array<EntryWithMetadata> listEntriesWithMetadata(uint parallelism = 1) const override {
+    return DiskHandle::listEntriesWithMetadata(parallelism);
+  }
   bool exists(PathPtr path) const override { return DiskHandle::exists(path); }
   Maybe<FsNode::Metadata> tryLstat(PathPtr path) const override {
     return DiskHandle::tryLstat(path);
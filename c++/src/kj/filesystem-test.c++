@@ -439,6 +439,27 @@ KJ_TEST("File::copy()") {
   KJ_EXPECT(dest->readAllText().slice(321) == bigString);
 }
 
+KJ_TEST("InMemoryDirectory listEntriesWithMetadata()") {
+  TestClock clock;
+
+  auto dir = newInMemoryDirectory(clock);
+  KJ_EXPECT(dir->listEntriesWithMetadata() == nullptr);
+
+  dir->openFile(Path("foo"), WriteMode::CREATE)->writeAll("foobar");
+  dir->openSubdir(Path("bar"), WriteMode::CREATE);
+  dir->symlink(Path("baz"), "foo", WriteMode::CREATE);
+
+  auto list = dir->listEntriesWithMetadata();
+  KJ_ASSERT(list.size() == 3);
+  KJ_EXPECT(list[0].name == "bar");
+  KJ_EXPECT(list[0].metadata.type == FsNode::Type::DIRECTORY);
+  KJ_EXPECT(list[1].name == "baz");
+  KJ_EXPECT(list[1].metadata.type == FsNode::Type::SYMLINK);
+  KJ_EXPECT(list[2].name == "foo");
+  KJ_EXPECT(list[2].metadata.type == FsNode::Type::FILE);
+  KJ_EXPECT(list[2].metadata.size == 6);
+}
+
 KJ_TEST("InMemoryDirectory") {
   TestClock clock;
 
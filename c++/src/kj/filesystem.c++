@@ -535,6 +535,18 @@ size_t File::copy(uint64_t offset, const ReadableFile& from,
   return result;
 }
 
+Array<ReadableDirectory::EntryWithMetadata> ReadableDirectory::listEntriesWithMetadata(
+    uint parallelism) const {
+  auto names = listNames();
+  Vector<EntryWithMetadata> entries(names.size());
+  for (auto& name: names) {
+    KJ_IF_MAYBE(meta, tryLstat(Path(name))) {
+      entries.add(EntryWithMetadata { kj::mv(name), *meta });
+    }
+  }
+  return entries.releaseAsArray();
+}
+
 FsNode::Metadata ReadableDirectory::lstat(PathPtr path) const {
   KJ_IF_MAYBE(meta, tryLstat(path)) {
     return *meta;
@@ -547,6 +547,30 @@ public:
   // filesystems, this is just as fast as listNames(), but on others it may require stat()ing each
   // file.
 
+  struct EntryWithMetadata {
+    String name;
+    FsNode::Metadata metadata;
+
+    inline bool operator< (const EntryWithMetadata& other) const { return name <  other.name; }
+    inline bool operator> (const EntryWithMetadata& other) const { return name >  other.name; }
+    inline bool operator<=(const EntryWithMetadata& other) const { return name <= other.name; }
+    inline bool operator>=(const EntryWithMetadata& other) const { return name >= other.name; }
+    // Convenience comparison operators to sort entries by name.
+  };
+
+  virtual Array<EntryWithMetadata> listEntriesWithMetadata(uint parallelism = 1) const;
+  // List the contents of the directory along with the metadata of each entry, as if by calling
+  // tryLstat() on each name (so symlinks are not followed). Entries which disappear while the
+  // listing is in progress are omitted.
+  //
+  // The default implementation does exactly that. The disk implementation for Unix instead reads
+  // the directory in large batches and asks the kernel only for the fields Metadata needs, which
+  // is considerably faster for large directories.
+  //
+  // If `parallelism` is greater than 1, the implementation may stat up to that many entries
+  // concurrently using background threads. This helps on network filesystems, where each stat is
+  // a round trip to the server; on local filesystems it usually doesn't.
+
   virtual bool exists(PathPtr path) const = 0;
   // Does the specified path exist?
   //
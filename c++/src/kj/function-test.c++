@@ -124,6 +124,77 @@ TEST(ConstFunction, Method) {
   EXPECT_EQ(9 + 2 + 5, f(2, 9));
 }
 
+struct MoveCounter {
+  // Counts how many times it is moved, and how many live instances there are.
+
+  int& moves;
+  int& live;
+  void* padding = nullptr;
+
+  MoveCounter(int& moves, int& live): moves(moves), live(live) { ++live; }
+  MoveCounter(MoveCounter&& other) noexcept: moves(other.moves), live(other.live) {
+    ++moves;
+    ++live;
+  }
+  ~MoveCounter() { --live; }
+
+  int operator()() { return moves; }
+};
+
+struct BigMoveCounter: public MoveCounter {
+  void* morePadding[8] = {};
+  using MoveCounter::MoveCounter;
+};
+
+KJ_TEST("Function stores small callables inline") {
+  int moves = 0;
+  int live = 0;
+
+  {
+    Function<int()> f = MoveCounter(moves, live);
+    moves = 0;
+
+    // Moving the Function moves the callable along with it, since it is stored inline.
+    Function<int()> f2 = kj::mv(f);
+    KJ_EXPECT(moves == 1);
+    KJ_EXPECT(live == 1);
+    f = kj::mv(f2);
+    KJ_EXPECT(moves == 2);
+    KJ_EXPECT(live == 1);
+    KJ_EXPECT(f() == 2);
+
+    auto ref = f.reference();
+    KJ_EXPECT(ref() == 2);
+  }
+  KJ_EXPECT(live == 0);
+
+  {
+    Function<int()> f = BigMoveCounter(moves, live);
+    moves = 0;
+
+    // Too big, so it was allocated, and moving the Function just moves the pointer.
+    Function<int()> f2 = kj::mv(f);
+    KJ_EXPECT(moves == 0);
+    KJ_EXPECT(live == 1);
+    KJ_EXPECT(f2() == 0);
+
+    // Replacing an inline callable with an allocated one and vice versa.
+    f = MoveCounter(moves, live);
+    f2 = kj::mv(f);
+    KJ_EXPECT(live == 1);
+  }
+  KJ_EXPECT(live == 0);
+}
+
+KJ_TEST("Function with move-only captures") {
+  auto own = heap<int>(123);
+  const int* ptr = own.get();
+  ConstFunction<const int*()> f = [own = kj::mv(own)]() { return own.get(); };
+  ConstFunction<const int*()> f2 = kj::mv(f);
+  KJ_EXPECT(f2() == ptr);
+  KJ_EXPECT(*f2() == 123);
+}
+
 int testFunctionParam(FunctionParam<int(char, bool)> func, char c, bool b) {
   return func(c, b);
 }
@@ -39,7 +39,9 @@ class Function;
 // i.e. the return type is covariant and the parameters are contravariant.
 //
 // Unlike `std::function`, `kj::Function`s are movable but not copyable, just like `kj::Own`.  This
-// is to avoid unexpected heap allocation or slow atomic reference counting.
+// is to avoid unexpected heap allocation or slow atomic reference counting. Callables whose state
+// fits in three pointers -- such as most lambdas -- are stored inline in the Function without any
+// heap allocation at all, provided they can be moved without throwing.
 //
 // When a `Function` is constructed from an lvalue, it captures only a reference to the value.
 // When constructed from an rvalue, it invokes the value's move constructor.  So, for example:
@@ -96,11 +98,116 @@ class FunctionParam;
 // outlive the FunctionParam instance. This is true when FunctionParam is used as a parameter type,
 // but not if it is used as a local variable nor a class member variable.
 
+namespace _ {  // private
+
+class FunctionImplBase {
+public:
+  virtual ~FunctionImplBase() noexcept(false) {}
+
+  virtual FunctionImplBase* relocate(void* space) = 0;
+  // Only called on implementations stored inline. Move-constructs this implementation into `space`,
+  // destroys this one, and returns the new one.
+};
+
+template <bool isInline>
+struct FunctionRelocator {
+  template <typename Impl>
+  static FunctionImplBase* relocate(Impl& impl, void* space) {
+    Impl* result = reinterpret_cast<Impl*>(space);
+    ctor(*result, kj::mv(impl));
+    dtor(impl);
+    return result;
+  }
+};
+template <>
+struct FunctionRelocator<false> {
+  // Heap-allocated implementations are moved by pointer, and need not be movable at all.
+  template <typename Impl>
+  static FunctionImplBase* relocate(Impl&, void*) { return nullptr; }
+};
+
+template <typename Iface>
+class FunctionStorage {
+  // Owns the implementation of a Function or ConstFunction. Implementations holding up to three
+  // pointers' worth of state are stored inline, so that wrapping a typical lambda doesn't allocate.
+  // Since moving the Function then moves the implementation too, only implementations which can
+  // be moved without throwing are stored inline.
+
+public:
+  FunctionStorage() = default;
+  FunctionStorage(FunctionStorage&& other) noexcept { take(other); }
+  FunctionStorage& operator=(FunctionStorage&& other) {
+    if (&other != this) {
+      clear();
+      take(other);
+    }
+    return *this;
+  }
+  ~FunctionStorage() noexcept(false) { clear(); }
+  KJ_DISALLOW_COPY(FunctionStorage);
+
+  template <template <typename, bool> class Impl, typename F>
+  void init(F&& f) {
+    typedef Impl<F, true> InlineImpl;
+    constexpr bool fits = sizeof(InlineImpl) <= sizeof(space) &&
+        alignof(InlineImpl) <= alignof(void*) &&
+        noexcept(new (PlacementNew(), space) InlineImpl(instance<InlineImpl&&>()));
+    init<Impl<F, fits>>(kj::fwd<F>(f), Bool<fits>());
+  }
+
+  inline Iface& operator*() const { return *impl; }
+
+private:
+  template <bool b> struct Bool {};
+
+  Iface* impl = nullptr;
+  bool isInline = false;
+  alignas(void*) char space[4 * sizeof(void*)];
+  // Room for a vtable pointer plus three pointers.
+
+  template <typename Impl, typename F>
+  void init(F&& f, Bool<true>) {
+    ctor(*reinterpret_cast<Impl*>(space), kj::fwd<F>(f));
+    impl = reinterpret_cast<Impl*>(space);
+    isInline = true;
+  }
+  template <typename Impl, typename F>
+  void init(F&& f, Bool<false>) {
+    impl = new Impl(kj::fwd<F>(f));
+  }
+
+  void take(FunctionStorage& other) {
+    if (other.isInline) {
+      impl = static_cast<Iface*>(other.impl->relocate(space));
+      isInline = true;
+      other.isInline = false;
+    } else {
+      impl = other.impl;
+    }
+    other.impl = nullptr;
+  }
+
+  void clear() {
+    Iface* ptr = impl;
+    impl = nullptr;
+    if (ptr == nullptr) {
+      // empty
+    } else if (isInline) {
+      isInline = false;
+      ptr->~Iface();
+    } else {
+      delete ptr;
+    }
+  }
+};
+
+}  // namespace _ (private)
+
 template <typename Return, typename... Params>
 class Function<Return(Params...)> {
 public:
   template <typename F>
-  inline Function(F&& f): impl(heap<Impl<F>>(kj::fwd<F>(f))) {}
+  inline Function(F&& f) { impl.template init<Impl>(kj::fwd<F>(f)); }
   Function() = default;
 
   // Make sure people don't accidentally end up wrapping a reference when they meant to return
@@ -128,12 +235,12 @@ public:
   }
 
 private:
-  class Iface {
+  class Iface: public _::FunctionImplBase {
   public:
     virtual Return operator()(Params... params) = 0;
   };
 
-  template <typename F>
+  template <typename F, bool isInline>
   class Impl final: public Iface {
   public:
     explicit Impl(F&& f): f(kj::fwd<F>(f)) {}
@@ -142,18 +249,22 @@ private:
       return f(kj::fwd<Params>(params)...);
     }
 
+    _::FunctionImplBase* relocate(void* space) override {
+      return _::FunctionRelocator<isInline>::relocate(*this, space);
+    }
+
   private:
     F f;
   };
 
-  Own<Iface> impl;
+  _::FunctionStorage<Iface> impl;
 };
 
 template <typename Return, typename... Params>
 class ConstFunction<Return(Params...)> {
 public:
   template <typename F>
-  inline ConstFunction(F&& f): impl(heap<Impl<F>>(kj::fwd<F>(f))) {}
+  inline ConstFunction(F&& f) { impl.template init<Impl>(kj::fwd<F>(f)); }
   ConstFunction() = default;
 
   // Make sure people don't accidentally end up wrapping a reference when they meant to return
@@ -181,12 +292,12 @@ public:
   }
 
 private:
-  class Iface {
+  class Iface: public _::FunctionImplBase {
   public:
     virtual Return operator()(Params... params) const = 0;
   };
 
-  template <typename F>
+  template <typename F, bool isInline>
   class Impl final: public Iface {
   public:
     explicit Impl(F&& f): f(kj::fwd<F>(f)) {}
@@ -195,11 +306,15 @@ private:
       return f(kj::fwd<Params>(params)...);
     }
 
+    _::FunctionImplBase* relocate(void* space) override {
+      return _::FunctionRelocator<isInline>::relocate(*this, space);
+    }
+
   private:
     F f;
   };
 
-  Own<Iface> impl;
+  _::FunctionStorage<Iface> impl;
 };
 
 template <typename Return, typename... Params>
@@ -22,6 +22,7 @@
 #pragma once
 
 #include "string.h"
+#include <inttypes.h>
 
 KJ_BEGIN_HEADER
 
@@ -150,6 +151,31 @@ inline uint hashCode(T&&... values) {
 //
 // NOT SUITABLE FOR CRYPTOGRAPHY. This is for hash tables, not crypto.
 
+uint hashBytes(ArrayPtr<const byte> data, uint64_t seed);
+inline uint hashBytes(ArrayPtr<const char> data, uint64_t seed) {
+  return hashBytes(data.asBytes(), seed);
+}
+// Hashes raw bytes using the same function as hashCode(), mixing in `seed`. hashCode() on any
+// byte or char array is equivalent to hashBytes(data, 0).
+//
+// Tables keyed by strings that come from untrusted sources (e.g. HTTP header names or request
+// paths) can choose a random secret seed per process or per table, and hash with this function in
+// their callbacks' hashCode(), so that an attacker can't precompute keys which all collide.
+//
+// The algorithm is wyhash, which consumes 8 or 16 bytes per 64-bit multiply. Define
+// KJ_HASH_MURMUR2=1 when building KJ to use the older 32-bit murmur2 instead, e.g. on 32-bit
+// targets without a fast 64-bit multiply. Hash values are not stable across versions of KJ
+// either way.
+
+uint32_t crc32c(ArrayPtr<const byte> data, uint32_t crc = 0);
+// Computes the CRC-32C (Castagnoli) checksum of `data`, as used by iSCSI, ext4 and many storage
+// and network formats. Unlike hashBytes(), the result is stable: it's a checksum for detecting
+// corruption of data that is stored or sent elsewhere. To checksum data in several pieces, pass
+// each piece's result as `crc` for the next.
+//
+// Uses the SSE4.2 CRC32 instruction on x86 CPUs which have it (checked at runtime), and the ARMv8
+// CRC32 instructions when building for ARM targets which have them, falling back to a table.
+
 // =======================================================================================
 // inline implementation details
 
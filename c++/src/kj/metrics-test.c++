@@ -0,0 +1,140 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "metrics.h"
+#include "thread.h"
+#include "vector.h"
+#include "kj/test.h"
+
+namespace kj {
+namespace {
+
+KJ_TEST("Counter adds up across threads") {
+  Counter counter;
+  {
+    Vector<Own<Thread>> threads;
+    for (auto i KJ_UNUSED: kj::zeroTo(8)) {
+      threads.add(heap<Thread>([&]() {
+        for (auto j KJ_UNUSED: kj::zeroTo(10000)) counter.add();
+      }));
+    }
+  }
+  counter.add(5);
+  KJ_EXPECT(counter.get() == 80005);
+}
+
+KJ_TEST("Gauge") {
+  Gauge gauge;
+  gauge.add(10);
+  gauge.sub(3);
+  KJ_EXPECT(gauge.get() == 7);
+  gauge.set(-2);
+  KJ_EXPECT(gauge.get() == -2);
+}
+
+KJ_TEST("Histogram buckets") {
+  // Small values get a bucket each.
+  for (uint64_t v: kj::zeroTo(16)) {
+    KJ_EXPECT(Histogram::getBucketIndex(v) == v);
+    KJ_EXPECT(Histogram::getBucketMin(v) == v);
+    KJ_EXPECT(Histogram::getBucketMax(v) == v);
+  }
+
+  // Buckets tile the whole range, and each is at most 1/8 as wide as its smallest value.
+  KJ_EXPECT(Histogram::getBucketMin(0) == 0);
+  for (auto i: kj::range(1u, Histogram::BUCKET_COUNT)) {
+    uint64_t min = Histogram::getBucketMin(i);
+    uint64_t max = Histogram::getBucketMax(i);
+    KJ_EXPECT(min == Histogram::getBucketMax(i - 1) + 1, i);
+    KJ_EXPECT(max - min <= min / 8, i, min, max);
+    KJ_EXPECT(Histogram::getBucketIndex(min) == i, i);
+    KJ_EXPECT(Histogram::getBucketIndex(max) == i, i);
+  }
+  KJ_EXPECT(Histogram::getBucketMax(Histogram::BUCKET_COUNT - 1) == uint64_t(kj::maxValue));
+
+  KJ_EXPECT(Histogram::getBucketIndex(1000) == Histogram::getBucketIndex(1023));
+  KJ_EXPECT(Histogram::getBucketIndex(1000) != Histogram::getBucketIndex(1024));
+}
+
+KJ_TEST("Histogram percentiles") {
+  Histogram histogram;
+  KJ_EXPECT(histogram.getSnapshot().getPercentile(0.5) == 0);
+
+  {
+    Vector<Own<Thread>> threads;
+    for (auto t: kj::zeroTo(4)) {
+      threads.add(heap<Thread>([&histogram, t]() {
+        for (uint64_t v: kj::range(1, 251)) histogram.record(t * 250 + v);
+      }));
+    }
+  }
+
+  auto snapshot = histogram.getSnapshot();
+  KJ_EXPECT(snapshot.getCount() == 1000);
+  KJ_EXPECT(snapshot.getSum() == 500500);
+
+  // Percentiles are exact to within a bucket.
+  auto p50 = snapshot.getPercentile(0.5);
+  KJ_EXPECT(p50 >= 500 && p50 <= 500 + 500 / 8, p50);
+  auto p99 = snapshot.getPercentile(0.99);
+  KJ_EXPECT(p99 >= 990 && p99 <= 990 + 990 / 8, p99);
+  KJ_EXPECT(snapshot.getPercentile(1) == Histogram::getBucketMax(Histogram::getBucketIndex(1000)));
+}
+
+KJ_TEST("MetricRegistry shares metrics by name") {
+  MetricRegistry registry;
+  auto& counter = registry.counter("requests_total", "Requests.");
+  KJ_EXPECT(&registry.counter("requests_total", "Requests.") == &counter);
+  KJ_EXPECT(&registry.counter("errors_total", "Errors.") != &counter);
+
+  KJ_EXPECT_THROW_MESSAGE("another type", registry.gauge("requests_total", "Requests."));
+  KJ_EXPECT_THROW_MESSAGE("invalid metric name", registry.counter("bad name", ""));
+  KJ_EXPECT_THROW_MESSAGE("invalid metric name", registry.counter("9lives", ""));
+}
+
+KJ_TEST("MetricRegistry renders the Prometheus text format") {
+  MetricRegistry registry;
+  registry.counter("requests_total", "Requests served.").add(3);
+  registry.gauge("connections", "Open connections.\nOr \\ so.").set(-1);
+  auto& latency = registry.histogram("latency_ns", "Latency.");
+  latency.record(5);
+  latency.record(5);
+  latency.record(100);
+
+  KJ_EXPECT(registry.render() ==
+      "# HELP connections Open connections.\\nOr \\\\ so.\n"
+      "# TYPE connections gauge\n"
+      "connections -1\n"
+      "# HELP latency_ns Latency.\n"
+      "# TYPE latency_ns histogram\n"
+      "latency_ns_bucket{le=\"5\"} 2\n"
+      "latency_ns_bucket{le=\"103\"} 3\n"
+      "latency_ns_bucket{le=\"+Inf\"} 3\n"
+      "latency_ns_sum 110\n"
+      "latency_ns_count 3\n"
+      "# HELP requests_total Requests served.\n"
+      "# TYPE requests_total counter\n"
+      "requests_total 3\n", registry.render());
+}
+
+}  // namespace
+}  // namespace kj
@@ -0,0 +1,276 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "metrics.h"
+#include "debug.h"
+
+namespace kj {
+
+namespace _ {  // private
+
+uint metricShard() {
+  static std::atomic<uint> nextShard { 0 };
+  static thread_local uint threadShard = 0;
+
+  // 0 means "not yet assigned".
+  uint shard = threadShard;
+  if (KJ_UNLIKELY(shard == 0)) {
+    shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARD_COUNT + 1;
+    threadShard = shard;
+  }
+  return shard - 1;
+}
+
+}  // namespace _ (private)
+
+// =======================================================================================
+// Counter
+
+void Counter::add(uint64_t n) {
+  shards[_::metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Counter::get() const {
+  uint64_t total = 0;
+  for (auto& shard: shards) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+// =======================================================================================
+// Histogram
+
+struct Histogram::Shard {
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> buckets[BUCKET_COUNT];
+};
+
+Histogram::Histogram() {
+  for (auto& shard: shards) {
+    shard.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+Histogram::~Histogram() noexcept(false) {
+  for (auto& shard: shards) {
+    delete shard.load(std::memory_order_relaxed);
+  }
+}
+
+void Histogram::record(uint64_t value) {
+  auto& slot = shards[_::metricShard()];
+  Shard* shard = slot.load(std::memory_order_acquire);
+  if (KJ_UNLIKELY(shard == nullptr)) {
+    // First value recorded in this shard. Another thread assigned to it may be racing us, in which
+    // case whichever allocation is published first wins.
+    Shard* fresh = new Shard();
+    if (slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel)) {
+      shard = fresh;
+    } else {
+      delete fresh;
+    }
+  }
+
+  shard->sum.fetch_add(value, std::memory_order_relaxed);
+  shard->buckets[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint Histogram::getBucketIndex(uint64_t value) {
+  constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  if (value < SUB_BUCKETS) return value;
+
+  // For `value` in [2^e, 2^(e+1)), e >= SUB_BUCKET_BITS, the buckets are the
+  // 2^SUB_BUCKET_BITS equal parts of that range, following those of lower ranges.
+  uint e = 63 - __builtin_clzll(value);
+  uint subBucket = (value >> (e - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+  return ((e - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + subBucket;
+}
+
+uint64_t Histogram::getBucketMin(uint i) {
+  KJ_REQUIRE(i < BUCKET_COUNT, "histogram bucket out of range");
+  constexpr uint SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  if (i < SUB_BUCKETS) return i;
+
+  uint e = (i >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+  uint64_t mantissa = (i & (SUB_BUCKETS - 1)) + SUB_BUCKETS;
+  return mantissa << (e - SUB_BUCKET_BITS);
+}
+
+uint64_t Histogram::getBucketMax(uint i) {
+  KJ_REQUIRE(i < BUCKET_COUNT, "histogram bucket out of range");
+  return i == BUCKET_COUNT - 1 ? uint64_t(kj::maxValue) : getBucketMin(i + 1) - 1;
+}
+
+Histogram::Snapshot Histogram::getSnapshot() const {
+  Snapshot result;
+  result.buckets = heapArray<uint64_t>(BUCKET_COUNT);
+  memset(result.buckets.begin(), 0, result.buckets.asBytes().size());
+
+  for (auto& slot: shards) {
+    Shard* shard = slot.load(std::memory_order_acquire);
+    if (shard == nullptr) continue;
+
+    result.sum += shard->sum.load(std::memory_order_relaxed);
+    for (auto i: kj::zeroTo(BUCKET_COUNT)) {
+      uint64_t n = shard->buckets[i].load(std::memory_order_relaxed);
+      result.buckets[i] += n;
+      result.count += n;
+    }
+  }
+
+  return result;
+}
+
+uint64_t Histogram::Snapshot::getBucket(uint i) const {
+  KJ_REQUIRE(i < BUCKET_COUNT, "histogram bucket out of range");
+  return buckets[i];
+}
+
+uint64_t Histogram::Snapshot::getPercentile(double fraction) const {
+  if (count == 0) return 0;
+
+  // The first bucket at which the running count reaches `fraction` of the total.
+  double target = fraction * count;
+  uint64_t seen = 0;
+  for (auto i: kj::zeroTo(BUCKET_COUNT)) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= target) {
+      return getBucketMax(i);
+    }
+  }
+  return getBucketMax(BUCKET_COUNT - 1);
+}
+
+// =======================================================================================
+// MetricRegistry
+
+namespace {
+
+bool isValidMetricName(StringPtr name) {
+  if (name.size() == 0) return false;
+  for (auto i: kj::indices(name)) {
+    char c = name[i];
+    if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_' || c == ':') continue;
+    if (i > 0 && '0' <= c && c <= '9') continue;
+    return false;
+  }
+  return true;
+}
+
+String escapeHelp(StringPtr help) {
+  // The exposition format escapes backslashes and line feeds in HELP lines.
+  Vector<char> result(help.size() + 1);
+  for (char c: help) {
+    switch (c) {
+      case '\\': result.addAll(StringPtr("\\\\")); break;
+      case '\n': result.addAll(StringPtr("\\n")); break;
+      default: result.add(c); break;
+    }
+  }
+  result.add('\0');
+  return String(result.releaseAsArray());
+}
+
+template <typename T> StringPtr metricTypeName();
+template <> StringPtr metricTypeName<Counter>() { return "counter"; }
+template <> StringPtr metricTypeName<Gauge>() { return "gauge"; }
+template <> StringPtr metricTypeName<Histogram>() { return "histogram"; }
+
+}  // namespace
+
+MetricRegistry::MetricRegistry() {}
+MetricRegistry::~MetricRegistry() noexcept(false) {}
+
+template <typename T>
+T& MetricRegistry::findOrRegister(StringPtr name, StringPtr help) {
+  KJ_REQUIRE(isValidMetricName(name), "invalid metric name", name);
+
+  auto lock = metrics.lockExclusive();
+  auto& entry = lock->findOrCreate(name, [&]() -> TreeMap<String, Entry>::Entry {
+    return { heapString(name), Entry { heapString(help), heap<T>() } };
+  });
+
+  KJ_IF_MAYBE(metric, entry.metric.template tryGet<Own<T>>()) {
+    return **metric;
+  } else {
+    KJ_FAIL_REQUIRE("metric already registered with another type", name, metricTypeName<T>());
+  }
+}
+
+Counter& MetricRegistry::counter(StringPtr name, StringPtr help) {
+  return findOrRegister<Counter>(name, help);
+}
+
+Gauge& MetricRegistry::gauge(StringPtr name, StringPtr help) {
+  return findOrRegister<Gauge>(name, help);
+}
+
+Histogram& MetricRegistry::histogram(StringPtr name, StringPtr help) {
+  return findOrRegister<Histogram>(name, help);
+}
+
+String MetricRegistry::render() const {
+  Vector<String> lines;
+
+  auto lock = metrics.lockShared();
+  for (auto& entry: *lock) {
+    StringPtr name = entry.key;
+    auto& metric = entry.value.metric;
+
+    StringPtr type;
+    KJ_SWITCH_ONEOF(metric) {
+      KJ_CASE_ONEOF(counter, Own<Counter>) { type = metricTypeName<Counter>(); }
+      KJ_CASE_ONEOF(gauge, Own<Gauge>) { type = metricTypeName<Gauge>(); }
+      KJ_CASE_ONEOF(histogram, Own<Histogram>) { type = metricTypeName<Histogram>(); }
+    }
+
+    lines.add(str("# HELP ", name, ' ', escapeHelp(entry.value.help), '\n'));
+    lines.add(str("# TYPE ", name, ' ', type, '\n'));
+
+    KJ_SWITCH_ONEOF(metric) {
+      KJ_CASE_ONEOF(counter, Own<Counter>) {
+        lines.add(str(name, ' ', counter->get(), '\n'));
+      }
+      KJ_CASE_ONEOF(gauge, Own<Gauge>) {
+        lines.add(str(name, ' ', gauge->get(), '\n'));
+      }
+      KJ_CASE_ONEOF(histogram, Own<Histogram>) {
+        auto snapshot = histogram->getSnapshot();
+        uint64_t cumulative = 0;
+        for (auto i: kj::zeroTo(Histogram::BUCKET_COUNT)) {
+          uint64_t n = snapshot.getBucket(i);
+          if (n == 0) continue;
+          cumulative += n;
+          lines.add(str(name, "_bucket{le=\"", Histogram::getBucketMax(i), "\"} ", cumulative, '\n'));
+        }
+        lines.add(str(name, "_bucket{le=\"+Inf\"} ", snapshot.getCount(), '\n'));
+        lines.add(str(name, "_sum ", snapshot.getSum(), '\n'));
+        lines.add(str(name, "_count ", snapshot.getCount(), '\n'));
+      }
+    }
+  }
+
+  return strArray(lines, "");
+}
+
+}  // namespace kj
@@ -0,0 +1,206 @@
+// Copyright (c) 2020 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#pragma once
+
+#include "map.h"
+#include "mutex.h"
+#include "one-of.h"
+#include "string.h"
+#include <atomic>
+
+KJ_BEGIN_HEADER
+
+namespace kj {
+
+// =======================================================================================
+// Metrics
+//
+// Counters, gauges and histograms cheap enough to update on hot paths, meant to be shared by
+// instrumentation throughout a process (RPC, HTTP, the event loop, ...) and exported together.
+//
+// Recording never locks: counters and histograms are split into shards, each thread records into
+// the shard it's assigned to with relaxed atomic operations, and reads add the shards up. Reads are
+// not synchronized with writes, so a value read while other threads record may miss the handful
+// of updates made during the read.
+
+namespace _ {  // private
+
+static constexpr uint METRIC_SHARD_COUNT = 16;
+
+uint metricShard();
+// Index of the shard the calling thread records into. Threads are spread across shards
+// round-robin.
+
+}  // namespace _ (private)
+
+class Counter {
+  // A monotonically increasing count, e.g. of requests served.
+
+public:
+  Counter() = default;
+  KJ_DISALLOW_COPY(Counter);
+
+  void add(uint64_t n = 1);
+
+  uint64_t get() const;
+
+private:
+  struct Shard {
+    std::atomic<uint64_t> value { 0 };
+    byte padding[64 - sizeof(std::atomic<uint64_t>)];
+    // Each shard gets its own cache line so that threads recording into different shards don't
+    // bounce it.
+  };
+
+  Shard shards[_::METRIC_SHARD_COUNT];
+};
+
+class Gauge {
+  // A value which goes up and down, e.g. the number of open connections.
+  //
+  // Unlike a counter, a gauge is a single atomic, since `set()` can't be split across shards.
+
+public:
+  Gauge() = default;
+  KJ_DISALLOW_COPY(Gauge);
+
+  inline void set(int64_t newValue) { value.store(newValue, std::memory_order_relaxed); }
+  inline void add(int64_t delta) { value.fetch_add(delta, std::memory_order_relaxed); }
+  inline void sub(int64_t delta) { value.fetch_sub(delta, std::memory_order_relaxed); }
+
+  inline int64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> value { 0 };
+};
+
+class Histogram {
+  // A distribution of unsigned values, e.g. of latencies in nanoseconds, with log-linear buckets
+  // in the style of HdrHistogram: values below 2^(SUB_BUCKET_BITS + 1) get a bucket each, and
+  // every power-of-two range above that is split into 2^SUB_BUCKET_BITS equal buckets. So, a
+  // bucket's width is at most 1/2^SUB_BUCKET_BITS (12.5%) of the values it holds, over the whole
+  // range of uint64_t.
+  //
+  // A shard's buckets are allocated the first time a thread assigned to it records, so an idle
+  // histogram is small.
+
+public:
+  static constexpr uint SUB_BUCKET_BITS = 3;
+  static constexpr uint BUCKET_COUNT = (65 - SUB_BUCKET_BITS) << SUB_BUCKET_BITS;
+
+  Histogram();
+  ~Histogram() noexcept(false);
+  KJ_DISALLOW_COPY(Histogram);
+
+  void record(uint64_t value);
+
+  static uint getBucketIndex(uint64_t value);
+  static uint64_t getBucketMin(uint i);
+  static uint64_t getBucketMax(uint i);
+  // Index of the bucket holding `value`, and the smallest and largest value (inclusive) which
+  // bucket `i` holds.
+
+  class Snapshot {
+    // The counts of a histogram added up across its shards at one point in time.
+
+  public:
+    uint64_t getCount() const { return count; }
+    // Number of values recorded.
+
+    uint64_t getSum() const { return sum; }
+    // Sum of the values recorded, modulo 2^64.
+
+    uint64_t getBucket(uint i) const;
+    // Number of values recorded in bucket `i`.
+
+    uint64_t getPercentile(double fraction) const;
+    // Returns the largest value of the bucket which holds the given fraction of recorded values,
+    // e.g. `getPercentile(0.99)` for the p99. Returns zero if nothing has been recorded.
+
+  private:
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    Array<uint64_t> buckets;
+
+    friend class Histogram;
+  };
+
+  Snapshot getSnapshot() const;
+
+private:
+  struct Shard;
+
+  std::atomic<Shard*> shards[_::METRIC_SHARD_COUNT];
+};
+
+class MetricRegistry {
+  // A set of named metrics, which can be exported all at once in the Prometheus text format. Each
+  // component asks for its metrics by name, and components asking for the same name share the
+  // metric.
+  //
+  // Example:
+  //
+  //     MetricRegistry registry;
+  //     Counter& requests = registry.counter("http_requests_total", "HTTP requests received.");
+  //     Histogram& latency = registry.histogram("http_request_ns", "HTTP request latency.");
+  //
+  //     requests.add();
+  //     latency.record((timer.now() - start) / kj::NANOSECONDS);
+  //
+  //     String text = registry.render();  // e.g. to serve at /metrics
+  //
+  // The registry is thread-safe, and the metrics it returns stay valid until it is destroyed.
+
+public:
+  MetricRegistry();
+  ~MetricRegistry() noexcept(false);
+  KJ_DISALLOW_COPY(MetricRegistry);
+
+  Counter& counter(StringPtr name, StringPtr help);
+  Gauge& gauge(StringPtr name, StringPtr help);
+  Histogram& histogram(StringPtr name, StringPtr help);
+  // Returns the metric registered under `name`, registering a new one first if there is none.
+  // `name` must be a valid Prometheus metric name (matching `[a-zA-Z_:][a-zA-Z0-9_:]*`), and
+  // `help` describes the metric in the exported text. Throws if a metric of another kind is
+  // registered under `name`.
+
+  String render() const;
+  // Returns the current value of every metric, in order of name, in the Prometheus text
+  // exposition format (version 0.0.4). A histogram is exported with one `le` bucket for each of
+  // its non-empty buckets, plus the `+Inf` bucket.
+
+private:
+  struct Entry {
+    String help;
+    OneOf<Own<Counter>, Own<Gauge>, Own<Histogram>> metric;
+  };
+
+  MutexGuarded<TreeMap<String, Entry>> metrics;
+
+  template <typename T>
+  T& findOrRegister(StringPtr name, StringPtr help);
+};
+
+}  // namespace kj
+
+KJ_END_HEADER
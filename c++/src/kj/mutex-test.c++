@@ -31,6 +31,7 @@
 #include "mutex.h"
 #include "debug.h"
 #include "thread.h"
+#include "map.h"
 #include "kj/compat/gtest.h"
 #include <stdlib.h>
 
@@ -615,6 +616,114 @@ KJ_TEST("ExternalMutexGuarded<T> destroy without release") {
   }
 }
 
+KJ_TEST("ReadMostlyGuarded") {
+  ReadMostlyGuarded<uint> value(123);
+
+  {
+    auto reader = value.lockShared();
+    KJ_EXPECT(*reader == 123);
+
+    // Readers may nest.
+    auto reader2 = value.lockShared();
+    KJ_EXPECT(*reader2 == 123);
+  }
+
+  value.modify([](uint& v) { v += 5; });
+  KJ_EXPECT(*value.lockShared() == 128);
+  value.modify([](uint& v) { v *= 2; });
+  KJ_EXPECT(*value.lockShared() == 256);
+
+  // Both copies were updated.
+  value.modify([](uint&) {});
+  KJ_EXPECT(*value.lockShared() == 256);
+
+  auto reader = value.lockShared();
+  auto moved = kj::mv(reader);
+  KJ_EXPECT(reader.get() == nullptr);
+  KJ_EXPECT(*moved == 256);
+  moved.release();
+  value.modify([](uint& v) { ++v; });
+  KJ_EXPECT(*value.lockShared() == 257);
+}
+
+KJ_TEST("ReadMostlyGuarded<HashMap> with concurrent readers") {
+  static constexpr uint COUNT = 2000;
+  ReadMostlyGuarded<HashMap<uint, uint>> map;
+  volatile bool done = false;
+
+  auto reader = [&]() {
+    uint seen = 0;
+    while (!done || seen < COUNT) {
+      auto lock = map.lockShared();
+      seen = lock->size();
+      for (uint i: kj::zeroTo(seen)) {
+        // Entries are only ever added in order, so every key below size() must be present.
+        KJ_IF_MAYBE(v, lock->find(i)) {
+          KJ_ASSERT(*v == i * 2);
+        } else {
+          KJ_FAIL_ASSERT("missing entry", i, seen);
+        }
+      }
+    }
+  };
+
+  Thread thread1(reader);
+  Thread thread2(reader);
+
+  for (uint i: kj::zeroTo(COUNT)) {
+    map.modify([&](HashMap<uint, uint>& m) { m.insert(i, i * 2); });
+  }
+  done = true;
+}
+
+#if KJ_USE_FUTEX
+uint contentionCount = 0;
+bool contentionExclusive = false;
+Duration contentionWaitTime = 0 * NANOSECONDS;
+
+void recordContention(const MutexContention& contention) {
+  ++contentionCount;
+  contentionExclusive = contention.exclusive;
+  contentionWaitTime = contention.waitTime;
+}
+
+KJ_TEST("mutex contention callback") {
+  setMutexContentionCallback(&recordContention);
+  KJ_DEFER(setMutexContentionCallback(nullptr));
+
+  MutexGuarded<uint> value(0);
+
+  // Uncontended locks aren't reported.
+  *value.lockExclusive() = 1;
+  KJ_EXPECT(*value.lockShared() == 1);
+  KJ_EXPECT(contentionCount == 0);
+
+  {
+    auto lock = value.lockExclusive();
+    Thread thread([&]() {
+      *value.lockExclusive() = 2;
+    });
+    delay();
+    auto earlyRelease = kj::mv(lock);
+  }
+  KJ_EXPECT(contentionCount == 1);
+  KJ_EXPECT(contentionExclusive);
+  KJ_EXPECT(contentionWaitTime >= 5 * MILLISECONDS, contentionWaitTime);
+
+  {
+    auto lock = value.lockExclusive();
+    Thread thread([&]() {
+      KJ_EXPECT(*value.lockShared() == 3);
+    });
+    delay();
+    *lock = 3;
+    auto earlyRelease = kj::mv(lock);
+  }
+  KJ_EXPECT(contentionCount == 2);
+  KJ_EXPECT(!contentionExclusive);
+}
+#endif
+
 KJ_TEST("condvar wait with flapping predicate") {
   // This used to deadlock under some implementations due to a wait() checking its own predicate
   // as part of unlock()ing the mutex. Adding `waiterToSkip` fixed this (and also eliminated a
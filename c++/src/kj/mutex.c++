@@ -29,6 +29,11 @@
 #if !_WIN32 && !__CYGWIN__
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
+#endif
+
+#if _MSC_VER && !__clang__
+#include <atomic>
 #endif
 
 #if KJ_USE_FUTEX
@@ -105,6 +110,19 @@ static void setCurrentThreadIsWaitingFor(const BlockedOnReason* meta) {}
 static void setCurrentThreadIsNoLongerWaiting() {}
 #endif
 
+static MutexContentionCallback mutexContentionCallback = nullptr;
+
+void setMutexContentionCallback(MutexContentionCallback callback) {
+#if _MSC_VER && !__clang__
+  // MSVC lacks the GCC atomic builtins; see reinterpretAtomic() below.
+  std::atomic_store_explicit(
+      reinterpret_cast<std::atomic<MutexContentionCallback>*>(&mutexContentionCallback),
+      callback, std::memory_order_release);
+#else
+  __atomic_store_n(&mutexContentionCallback, callback, __ATOMIC_RELEASE);
+#endif
+}
+
 namespace _ {  // private
 
 #if KJ_USE_FUTEX
@@ -213,6 +231,97 @@ Mutex::~Mutex() {
   KJ_ASSERT(futex == 0, "Mutex destroyed while locked.") { break; }
 }
 
+#ifndef KJ_MUTEX_MAX_SPIN
+#define KJ_MUTEX_MAX_SPIN 100
+// Upper bound on how many iterations a contended lock() busy-waits before sleeping. Each iteration
+// executes one CPU pause/yield hint, so this is on the order of a few microseconds -- about the
+// cost of a context switch. Define as 0 to disable spinning.
+#endif
+
+namespace {
+
+inline void cpuRelax() {
+#if __x86_64__ || __i386__
+  __builtin_ia32_pause();
+#elif __aarch64__ || __arm__
+  asm volatile("yield");
+#endif
+}
+
+bool isMultiCore() {
+  // Spinning is pointless if the holder can't be running at the same time as us.
+  static const bool result = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+  return result;
+}
+
+class ContentionTimer {
+  // Measures a contended acquisition for the MutexContentionCallback, if one is registered.
+
+public:
+  template <typename Location>
+  ContentionTimer(MutexContentionCallback callback, Location heldAt)
+      : callback(callback), start(now()), heldAt(heldAt) {}
+
+  void report(const Mutex& mutex, bool exclusive, LockSourceLocationArg acquiredAt) {
+    callback(MutexContention { mutex, exclusive, now() - start, acquiredAt, heldAt });
+  }
+
+private:
+  MutexContentionCallback callback;
+  TimePoint start;
+  LockSourceLocation heldAt;
+};
+
+}  // namespace
+
+uint Mutex::spinLimit() const {
+  if (KJ_MUTEX_MAX_SPIN == 0 || !isMultiCore()) return 0;
+  uint estimate = __atomic_load_n(&spinEstimate, __ATOMIC_RELAXED);
+  return kj::min(estimate * 2 + 10, KJ_MUTEX_MAX_SPIN);
+}
+
+void Mutex::updateSpinEstimate(uint spins) {
+  // Move the estimate 1/8 of the way toward this sample, like glibc's adaptive mutexes.
+  int estimate = __atomic_load_n(&spinEstimate, __ATOMIC_RELAXED);
+  estimate += (static_cast<int>(spins) - estimate) / 8;
+  __atomic_store_n(&spinEstimate, static_cast<uint16_t>(estimate), __ATOMIC_RELAXED);
+}
+
+bool Mutex::spinForExclusive() {
+  // Returns true if the lock was acquired while spinning.
+
+  uint limit = spinLimit();
+  for (uint i = 0; i < limit; i++) {
+    cpuRelax();
+    uint state = __atomic_load_n(&futex, __ATOMIC_RELAXED);
+    if (state == 0 && __atomic_compare_exchange_n(&futex, &state, EXCLUSIVE_HELD, false,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      updateSpinEstimate(i);
+      return true;
+    }
+  }
+  if (limit > 0) updateSpinEstimate(limit);
+  return false;
+}
+
+uint Mutex::spinForShared() {
+  // The caller has already added itself to the reader count. Returns the last observed state; if
+  // it lacks EXCLUSIVE_HELD then the shared lock has been acquired.
+
+  uint limit = spinLimit();
+  uint state = __atomic_load_n(&futex, __ATOMIC_ACQUIRE);
+  for (uint i = 0; i < limit; i++) {
+    cpuRelax();
+    state = __atomic_load_n(&futex, __ATOMIC_ACQUIRE);
+    if ((state & EXCLUSIVE_HELD) == 0) {
+      updateSpinEstimate(i);
+      return state;
+    }
+  }
+  if (limit > 0) updateSpinEstimate(limit);
+  return state;
+}
+
 bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLocationArg location) {
   BlockedOnReason blockReason = BlockedOnMutexAcquisition{*this, location};
   KJ_DEFER(setCurrentThreadIsNoLongerWaiting());
@@ -223,6 +332,15 @@ bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLoc
     specp = s;
   }
 
+  Maybe<ContentionTimer> contention;
+  bool spun = false;
+  auto startContention = [&]() {
+    MutexContentionCallback callback = __atomic_load_n(&mutexContentionCallback, __ATOMIC_RELAXED);
+    if (callback != nullptr) {
+      contention = ContentionTimer(callback, holderLocation());
+    }
+  };
+
   switch (exclusivity) {
     case EXCLUSIVE:
       for (;;) {
@@ -234,6 +352,14 @@ bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLoc
           break;
         }
 
+        if (!spun) {
+          // First time seeing contention. Spin for a bit in the hope that the holder releases soon.
+          startContention();
+          spun = true;
+          if (spinForExclusive()) break;
+          continue;
+        }
+
         // The mutex is contended.  Set the exclusive-requested bit and wait.
         if ((state & EXCLUSIVE_REQUESTED) == 0) {
           if (!__atomic_compare_exchange_n(&futex, &state, state | EXCLUSIVE_REQUESTED, false,
@@ -261,6 +387,9 @@ bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLoc
 #if KJ_CONTENTION_WARNING_THRESHOLD
       printContendedReader = false;
 #endif
+      KJ_IF_MAYBE(c, contention) {
+        c->report(*this, true, location);
+      }
       break;
     case SHARED: {
 #if KJ_CONTENTION_WARNING_THRESHOLD
@@ -275,6 +404,13 @@ bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLoc
           break;
         }
 
+        if (!spun) {
+          startContention();
+          spun = true;
+          state = spinForShared();
+          continue;
+        }
+
 #if KJ_CONTENTION_WARNING_THRESHOLD
         if (contentionWaitStart == nullptr) {
           // We could have the exclusive mutex tell us how long it was holding the lock. That would
@@ -336,6 +472,9 @@ bool Mutex::lock(Exclusivity exclusivity, Maybe<Duration> timeout, LockSourceLoc
       // locker isn't really guaranteed to be the first one unlocked).
       acquiredShared(location);
 
+      KJ_IF_MAYBE(c, contention) {
+        c->report(*this, false, location);
+      }
       break;
     }
   }
@@ -1087,5 +1226,99 @@ void Once::reset() {
 
 #endif
 
+// =======================================================================================
+// ReadMostlyState
+
+namespace {
+
+#if _MSC_VER && !__clang__
+// See the comment in async.c++: MSVC lacks the GCC atomic builtins, but std::atomic matches them.
+template <typename T>
+std::atomic<T>* reinterpretAtomic(T* ptr) { return reinterpret_cast<std::atomic<T>*>(ptr); }
+inline uint atomicLoad(const uint* ptr) {
+  return std::atomic_load(reinterpretAtomic(const_cast<uint*>(ptr)));
+}
+inline void atomicStore(uint* ptr, uint value) {
+  std::atomic_store(reinterpretAtomic(ptr), value);
+}
+inline void atomicAdd(uint* ptr, int delta) {
+  std::atomic_fetch_add(reinterpretAtomic(ptr), static_cast<uint>(delta));
+}
+#else
+inline uint atomicLoad(const uint* ptr) { return __atomic_load_n(ptr, __ATOMIC_SEQ_CST); }
+inline void atomicStore(uint* ptr, uint value) { __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST); }
+inline void atomicAdd(uint* ptr, int delta) {
+  __atomic_fetch_add(ptr, static_cast<uint>(delta), __ATOMIC_SEQ_CST);
+}
+#endif
+
+uint nextReadStripe = 0;
+thread_local uint threadReadStripe = 0;
+
+inline uint readStripe() {
+  // Spread threads round-robin across the read indicator stripes. 0 means "not yet assigned".
+  uint stripe = threadReadStripe;
+  if (KJ_UNLIKELY(stripe == 0)) {
+#if _MSC_VER && !__clang__
+    stripe = std::atomic_fetch_add(reinterpretAtomic(&nextReadStripe), 1u) + 1;
+#else
+    stripe = __atomic_add_fetch(&nextReadStripe, 1, __ATOMIC_RELAXED);
+#endif
+    if (stripe == 0) stripe = 1;
+    threadReadStripe = stripe;
+  }
+  return stripe;
+}
+
+void yieldThread() {
+#if _WIN32 || __CYGWIN__
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+}  // namespace
+
+uint ReadMostlyState::beginRead(uint& copy) const noexcept {
+  uint stripe = readStripe() % STRIPES;
+  uint version = atomicLoad(&versionIndex);
+  atomicAdd(&readers[version][stripe].count, 1);
+  copy = atomicLoad(&active);
+  return version * STRIPES + stripe;
+}
+
+void ReadMostlyState::endRead(uint token) const noexcept {
+  atomicAdd(&readers[token / STRIPES][token % STRIPES].count, -1);
+}
+
+uint ReadMostlyState::writeCopy() const noexcept {
+  return atomicLoad(&active) ^ 1;
+}
+
+void ReadMostlyState::publish() noexcept {
+  atomicStore(&active, active ^ 1);
+
+  // New readers now see the new copy, but readers that loaded `active` earlier may still be using
+  // the old one. Flip the read indicator that new readers arrive on and wait for both to drain;
+  // waiting on the next indicator first guarantees that no reader which announced itself there
+  // before the previous flip is still around.
+  uint version = versionIndex;
+  waitForReaders(version ^ 1);
+  atomicStore(&versionIndex, version ^ 1);
+  waitForReaders(version);
+}
+
+void ReadMostlyState::waitForReaders(uint version) noexcept {
+  for (;;) {
+    uint total = 0;
+    for (auto& indicator: readers[version]) {
+      total += atomicLoad(&indicator.count);
+    }
+    if (total == 0) return;
+    yieldThread();
+  }
+}
+
 }  // namespace _ (private)
 }  // namespace kj
@@ -186,6 +186,11 @@ private:
   //   waiting for a read lock, otherwise it is the count of threads that currently hold a read
   //   lock.
 
+  uint16_t spinEstimate = 0;
+  // Running average of how many iterations recent contended lock() calls spun before acquiring the
+  // lock (or giving up and sleeping in the kernel). Decides how long the next one spins. Updated
+  // racily; it's only a heuristic. (Fits in what would otherwise be padding after `futex`.)
+
 #ifdef KJ_CONTENTION_WARNING_THRESHOLD
   bool printContendedReader = false;
 #endif
@@ -194,6 +199,14 @@ private:
   static constexpr uint EXCLUSIVE_REQUESTED = 1u << 30;
   static constexpr uint SHARED_COUNT_MASK = EXCLUSIVE_REQUESTED - 1;
 
+  uint spinLimit() const;
+  void updateSpinEstimate(uint spins);
+  bool spinForExclusive();
+  uint spinForShared();
+  // Adaptive spin-then-park: before sleeping on the futex, a contended lock() busy-waits for up to
+  // spinLimit() iterations in case the holder is about to release it, which is much cheaper than
+  // a context switch when critical sections are short.
+
 #elif _WIN32 || __CYGWIN__
   uintptr_t srwLock;  // Actually an SRWLOCK, but don't want to #include <windows.h> in header.
 
@@ -220,10 +233,15 @@ private:
     lockedExclusivelyByThread = 0;
     return tmp;
   }
+
+  KJ_DISABLE_TSAN SourceLocation holderLocation() const noexcept {
+    return lockAcquiredLocation;
+  }
 #else
   static constexpr void acquiredExclusive(uint, LockSourceLocationArg) {}
   static constexpr void acquiredShared(LockSourceLocationArg) {}
   static constexpr NoopSourceLocation releasingExclusive() { return NoopSourceLocation{}; }
+  static constexpr NoopSourceLocation holderLocation() { return NoopSourceLocation{}; }
 #endif
   struct Waiter {
     kj::Maybe<Waiter&> next;
@@ -320,6 +338,49 @@ private:
 #endif
 };
 
+class ReadMostlyState {
+  // Synchronization state backing `ReadMostlyGuarded<T>`, which keeps two copies of the guarded
+  // value and lets readers use whichever one is currently published ("left-right" concurrency
+  // control). Readers announce themselves on one of two striped read indicators; the writer, after
+  // publishing the other copy, flips which indicator new readers use and waits for both to drain
+  // before touching the now-unpublished copy. Readers never block and never write to memory shared
+  // with other readers on a different stripe.
+  //
+  // All methods except beginRead() / endRead() must be called with the writer mutex held.
+
+public:
+  ReadMostlyState() = default;
+  KJ_DISALLOW_COPY_AND_MOVE(ReadMostlyState);
+
+  uint beginRead(uint& copy) const noexcept;
+  // Registers a reader. Sets `copy` to the index (0 or 1) of the copy which the reader may use
+  // until it calls endRead() passing the returned token.
+
+  void endRead(uint token) const noexcept;
+
+  uint writeCopy() const noexcept;
+  // Index of the copy which no reader can currently observe.
+
+  void publish() noexcept;
+  // Makes writeCopy() the published copy, then waits until no reader is still using the previously
+  // published one. Afterwards writeCopy() returns the previously-published copy.
+
+private:
+  static constexpr uint STRIPES = 8;
+
+  struct Indicator {
+    uint count = 0;
+    byte padding[64 - sizeof(uint)];
+    // Each stripe gets its own cache line so that readers on different threads don't bounce it.
+  };
+
+  mutable Indicator readers[2][STRIPES];
+  uint versionIndex = 0;
+  uint active = 0;
+
+  void waitForReaders(uint version) noexcept;
+};
+
 }  // namespace _ (private)
 
 // =======================================================================================
@@ -628,6 +689,95 @@ private:
   class InitImpl;
 };
 
+template <typename T>
+class ReadMostlyGuarded {
+  // An object of type T, guarded for workloads where reads vastly outnumber writes, such as a
+  // kj::HashMap or kj::Table used as a shared lookup cache. Reads never take a lock and never
+  // block: they cost two atomic increments on a per-thread-striped counter. Writes are serialized
+  // by a mutex and must wait for in-flight readers of the old version to finish.
+  //
+  // This works by keeping two copies of T. A writer applies its modification to the copy readers
+  // can't see, publishes it, waits for readers of the other copy to drain, and then applies the
+  // same modification again to that copy. Consequently:
+  // - Memory use is doubled and each write does its work twice.
+  // - The function passed to `modify()` must make the same change given the same starting state,
+  //   since it is applied to both copies. It should not throw: if it does, the copy that was being
+  //   modified may be left out of sync with the published one.
+  // - A thread must not call `modify()` while it holds a `Reader`, or it will wait for itself
+  //   forever.
+  //
+  // Unlike MutexGuarded's shared locks, Readers may be taken recursively.
+
+public:
+  template <typename... Params>
+  explicit ReadMostlyGuarded(Params&&... params);
+  // Initializes both copies by passing the given parameters to T's constructor. The parameters
+  // are passed as lvalues, since they are used twice.
+
+  class Reader {
+  public:
+    KJ_DISALLOW_COPY(Reader);
+    inline Reader(): state(nullptr), token(0), ptr(nullptr) {}
+    inline Reader(Reader&& other): state(other.state), token(other.token), ptr(other.ptr) {
+      other.state = nullptr;
+      other.ptr = nullptr;
+    }
+    inline ~Reader() {
+      if (state != nullptr) state->endRead(token);
+    }
+
+    inline Reader& operator=(Reader&& other) {
+      if (state != nullptr) state->endRead(token);
+      state = other.state;
+      token = other.token;
+      ptr = other.ptr;
+      other.state = nullptr;
+      other.ptr = nullptr;
+      return *this;
+    }
+
+    inline void release() {
+      if (state != nullptr) {
+        state->endRead(token);
+        state = nullptr;
+        ptr = nullptr;
+      }
+    }
+
+    inline const T* operator->() const { return ptr; }
+    inline const T& operator*() const { return *ptr; }
+    inline const T* get() const { return ptr; }
+    inline operator const T*() const { return ptr; }
+
+  private:
+    const _::ReadMostlyState* state;
+    uint token;
+    const T* ptr;
+
+    inline Reader(const _::ReadMostlyState& state, uint token, const T& value)
+        : state(&state), token(token), ptr(&value) {}
+
+    friend class ReadMostlyGuarded;
+  };
+
+  Reader lockShared() const;
+  // Get read access to the current version of the object. The Reader will keep seeing the same
+  // version even if a modification is published concurrently; the writer waits for it.
+
+  template <typename Func>
+  void modify(Func&& func, LockSourceLocationArg location = {}) const;
+  // Calls `func(T&)` twice, once on each copy, while holding the writer lock. See the class
+  // comment for the constraints on `func`.
+
+  inline const T& getWithoutLock() const { return copies[0]; }
+  // Escape hatch for cases where some external factor guarantees that no writer is active.
+
+private:
+  mutable _::Mutex mutex;
+  mutable _::ReadMostlyState state;
+  mutable T copies[2];
+};
+
 // =======================================================================================
 // Inline implementation details
 
@@ -691,6 +841,29 @@ inline T& MutexGuarded<T>::getAlreadyLockedExclusive() const {
   return const_cast<T&>(value);
 }
 
+template <typename T>
+template <typename... Params>
+inline ReadMostlyGuarded<T>::ReadMostlyGuarded(Params&&... params)
+    : copies { T(params...), T(params...) } {}
+
+template <typename T>
+inline typename ReadMostlyGuarded<T>::Reader ReadMostlyGuarded<T>::lockShared() const {
+  uint copy;
+  uint token = state.beginRead(copy);
+  return Reader(state, token, copies[copy]);
+}
+
+template <typename T>
+template <typename Func>
+void ReadMostlyGuarded<T>::modify(Func&& func, LockSourceLocationArg location) const {
+  mutex.lock(_::Mutex::EXCLUSIVE, nullptr, location);
+  KJ_DEFER(mutex.unlock(_::Mutex::EXCLUSIVE));
+
+  func(copies[state.writeCopy()]);
+  state.publish();
+  func(copies[state.writeCopy()]);
+}
+
 template <typename T>
 template <typename Func>
 class Lazy<T>::InitImpl: public _::Once::Initializer {
@@ -726,6 +899,41 @@ inline const T& Lazy<T>::get(Func&& init, LockSourceLocationArg location) const
   return *value;
 }
 
+struct MutexContention {
+  // Describes one contended Mutex acquisition. See setMutexContentionCallback().
+
+  const _::Mutex& mutex;
+  // The mutex that was contended.
+
+  bool exclusive;
+  // Whether the contended acquisition was for an exclusive (vs. shared) lock.
+
+  Duration waitTime;
+  // How long the thread spun and/or slept before it got the lock.
+
+  LockSourceLocation acquiredAt;
+  // Where the contended lock was requested.
+
+  LockSourceLocation heldAt;
+  // Where the holder that we had to wait for acquired the lock, as of when we started waiting. Only
+  // available with KJ_SAVE_ACQUIRED_LOCK_INFO (otherwise this is a NoopSourceLocation). For a
+  // shared holder this is the location of any one of the readers.
+};
+
+using MutexContentionCallback = void (*)(const MutexContention& contention);
+
+void setMutexContentionCallback(MutexContentionCallback callback);
+// Registers a process-wide callback that is invoked, on the acquiring thread and with the lock
+// already held, every time a thread had to wait to lock a kj::Mutex (i.e. MutexGuarded or
+// ExternalMutexGuarded). Pass nullptr to unregister. This is meant for finding hot locks in
+// production, e.g. by aggregating wait times by `acquiredAt` into a histogram.
+//
+// When no callback is registered the cost is one relaxed load on the contended path only. The
+// callback must not lock the mutex it is told about, and should be fast since the lock is held
+// while it runs. Acquisitions that time out are not reported.
+//
+// Currently only reported by the futex-based implementation (Linux).
+
 #if KJ_TRACK_LOCK_BLOCKING
 struct BlockedOnMutexAcquisition {
   const _::Mutex& mutex;
@@ -373,6 +373,48 @@ TEST(CharParsers, DoubleQuotedString) {
   }
 }
 
+TEST(CharParsers, Guard) {
+  auto parser = oneOf(guard(anyOfChars("\""), doubleQuotedString),
+                      guard(nameStart, identifier));
+
+  {
+    StringPtr text = "\"hello\"";
+    Input input(text.begin(), text.end());
+    Maybe<String> result = parser(input);
+    KJ_IF_MAYBE(value, result) {
+      EXPECT_EQ("hello", *value);
+    } else {
+      ADD_FAILURE() << "Expected \"hello\", got null.";
+    }
+    EXPECT_TRUE(input.atEnd());
+  }
+
+  {
+    StringPtr text = "foo";
+    Input input(text.begin(), text.end());
+    Maybe<String> result = parser(input);
+    KJ_IF_MAYBE(value, result) {
+      EXPECT_EQ("foo", *value);
+    } else {
+      ADD_FAILURE() << "Expected \"foo\", got null.";
+    }
+    EXPECT_TRUE(input.atEnd());
+  }
+
+  {
+    StringPtr text = "123";
+    Input input(text.begin(), text.end());
+    EXPECT_TRUE(parser(input) == nullptr);
+    EXPECT_EQ(text.begin(), input.getBest());
+  }
+
+  {
+    StringPtr text = "";
+    Input input(text.begin(), text.end());
+    EXPECT_TRUE(parser(input) == nullptr);
+  }
+}
+
 TEST(CharParsers, SingleQuotedString) {
   constexpr auto parser = singleQuotedString;
 
@@ -172,6 +172,39 @@ constexpr inline CharGroup_ anyOfChars(const char* chars) {
 }
 #endif
 
+// -------------------------------------------------------------------
+// guard()
+// Output = same as SubParser.
+
+template <typename SubParser>
+class Guard_ {
+public:
+  explicit constexpr Guard_(CharGroup_ firstChars, SubParser&& subParser)
+      : firstChars(firstChars), subParser(kj::fwd<SubParser>(subParser)) {}
+
+  template <typename Input>
+  Maybe<OutputType<SubParser, Input>> operator()(Input& input) const {
+    if (input.atEnd() || !firstChars.contains(input.current())) return nullptr;
+    return subParser(input);
+  }
+
+private:
+  CharGroup_ firstChars;
+  SubParser subParser;
+};
+
+template <typename SubParser>
+constexpr Guard_<SubParser> guard(CharGroup_ firstChars, SubParser&& subParser) {
+  // Constructs a parser which fails immediately unless the next character is in `firstChars`,
+  // and otherwise behaves like `subParser`.  `subParser` must never match input that starts with
+  // any other character, including empty input.
+  //
+  // Use this on the alternatives of a oneOf() to dispatch on the first character: each
+  // alternative that can't match is rejected with a single bit test against its table, rather
+  // than by starting to parse and then backtracking.
+  return Guard_<SubParser>(firstChars, kj::fwd<SubParser>(subParser));
+}
+
 // =======================================================================================
 
 namespace _ {  // private
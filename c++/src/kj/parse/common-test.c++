@@ -391,6 +391,54 @@ TEST(CommonParsers, OneOfParser) {
   }
 }
 
+TEST(CommonParsers, MemoizeParser) {
+  StringPtr text = "aaay";
+  Memo<const char*, size_t> memo(text.begin(), text.end());
+
+  uint calls = 0;
+  auto as = transform(many(exactly('a')), [&](uint count) -> size_t {
+    ++calls;
+    return count;
+  });
+  auto memoized = memoize(memo, as);
+
+  // Both alternatives start with the same rule, so the second one would normally re-parse it.
+  auto parser = oneOf(sequence(memoized, exactly('x')), sequence(memoized, exactly('y')));
+
+  {
+    Input input(text.begin(), text.end());
+    Maybe<size_t> result = parser(input);
+    KJ_IF_MAYBE(n, result) {
+      EXPECT_EQ(3u, *n);
+    } else {
+      ADD_FAILURE() << "Expected 3, got null.";
+    }
+    EXPECT_TRUE(input.atEnd());
+    EXPECT_EQ(1u, calls);
+  }
+
+  {
+    // Parsing again replays from the memo, including how far the parser looked.
+    Input input(text.begin(), text.end());
+    EXPECT_TRUE(sequence(memoized, exactly('x'))(input) == nullptr);
+    EXPECT_EQ(text.begin() + 3, input.getBest());
+    EXPECT_EQ(1u, calls);
+  }
+
+  {
+    // Failures are remembered too.
+    uint bCalls = 0;
+    Memo<const char*, Tuple<>> bMemo(text.begin(), text.end());
+    auto b = memoize(bMemo, transform(exactly('b'), [&]() { ++bCalls; return Tuple<>(); }));
+    for (uint i = 0; i < 3; i++) {
+      Input input(text.begin(), text.end());
+      EXPECT_TRUE(b(input) == nullptr);
+      EXPECT_EQ(text.begin(), input.getPosition());
+    }
+    EXPECT_EQ(0u, bCalls);
+  }
+}
+
 TEST(CommonParsers, TransformParser) {
   StringPtr text = "foo";
 
@@ -95,6 +95,14 @@ public:
 
   Iterator getPosition() { return pos; }
 
+  void advanceTo(Iterator newPos, Iterator newBest) {
+    // Jump forward to `newPos`, as if we had parsed up to there and looked as far as `newBest`.
+    // Used by memoize() to replay a cached result.
+    KJ_IREQUIRE(pos <= newPos && newPos <= end);
+    pos = newPos;
+    best = kj::max(best, newBest);
+  }
+
 private:
   IteratorInput* parent;
   Iterator pos;
@@ -647,6 +655,79 @@ constexpr OneOf_<SubParsers...> oneOf(SubParsers&&... parsers) {
   return OneOf_<SubParsers...>(kj::fwd<SubParsers>(parsers)...);
 }
 
+// -------------------------------------------------------------------
+// memoize()
+// Output = same as SubParser, which must be copyable.
+
+template <typename Position, typename Output>
+class Memo {
+  // Remembers the results of one parser at each position of one input, for use with memoize().
+  // Construct one for each input you parse; it is sized to the input up front so that lookups are
+  // just an index.
+
+public:
+  Memo(Position begin, Position end)
+      : begin(begin), entries(heapArray<Maybe<Entry>>(end - begin + 1)) {}
+  KJ_DISALLOW_COPY(Memo);
+
+private:
+  struct Entry {
+    Maybe<Output> result;
+    Position end;
+    Position best;
+  };
+
+  Position begin;
+  Array<Maybe<Entry>> entries;
+
+  template <typename, typename, typename>
+  friend class Memoize_;
+};
+
+template <typename Position, typename Output, typename SubParser>
+class Memoize_ {
+public:
+  explicit constexpr Memoize_(Memo<Position, Output>& memo, SubParser&& subParser)
+      : memo(memo), subParser(kj::fwd<SubParser>(subParser)) {}
+
+  template <typename Input>
+  Maybe<Output> operator()(Input& input) const {
+    auto& slot = memo.entries[input.getPosition() - memo.begin];
+    KJ_IF_MAYBE(entry, slot) {
+      input.advanceTo(entry->end, entry->best);
+      return entry->result;
+    }
+
+    Input subInput(input);
+    Maybe<Output> result = subParser(subInput);
+    if (result != nullptr) {
+      subInput.advanceParent();
+    }
+
+    slot = typename Memo<Position, Output>::Entry {
+      result,
+      result == nullptr ? input.getPosition() : subInput.getPosition(),
+      subInput.getBest()
+    };
+    return result;
+  }
+
+private:
+  Memo<Position, Output>& memo;
+  SubParser subParser;
+};
+
+template <typename Position, typename Output, typename SubParser>
+constexpr Memoize_<Position, Output, SubParser> memoize(
+    Memo<Position, Output>& memo, SubParser&& subParser) {
+  // Constructs a parser which behaves like `subParser`, but runs it at most once per input
+  // position, returning a copy of the recorded result on later attempts.  Wrapping the rules
+  // which a grammar backtracks over in memoize() -- "packrat parsing" -- bounds the parse to
+  // linear time, at the cost of memory proportional to input size.  `memo` must outlive the
+  // parse and must only be used with one input.
+  return Memoize_<Position, Output, SubParser>(memo, kj::fwd<SubParser>(subParser));
+}
+
 // -------------------------------------------------------------------
 // transform()
 // Output = Result of applying transform functor to input value.  If input is a tuple, it is
@@ -43,6 +43,10 @@ TEST(String, Str) {
       str(hex((uint8_t)0xff), ' ', hex((uint16_t)0xffff), ' ', hex((uint32_t)0xffffffffu), ' ',
           hex((uint64_t)0xffffffffffffffffull)));
 
+  EXPECT_EQ("0 9 10 99 100 18446744073709551615 9223372036854775807",
+      str(0, ' ', 9, ' ', 10, ' ', 99, ' ', 100, ' ', 18446744073709551615ull, ' ',
+          9223372036854775807ll));
+
   char buf[3] = {'f', 'o', 'o'};
   ArrayPtr<char> a = buf;
   ArrayPtr<const char> ca = a;
@@ -266,6 +270,65 @@ KJ_TEST("String == String") {
   KJ_EXPECT_NOMAGIC(a != c);
 }
 
+KJ_TEST("SmallString") {
+  SmallString empty;
+  KJ_EXPECT(empty.isInline());
+  KJ_EXPECT(empty == "");
+  KJ_EXPECT(empty.cStr()[0] == '\0');
+
+  auto num = smallStr(12345, "/", 'x');
+  KJ_EXPECT(num.isInline());
+  KJ_EXPECT(num == "12345/x");
+  KJ_EXPECT(num.size() == 7);
+  KJ_EXPECT(strlen(num.cStr()) == 7);
+  KJ_EXPECT(str("[", num, "]") == "[12345/x]");
+
+  auto full = smallStr(kj::repeat('a', SmallString::MAX_INLINE_SIZE));
+  KJ_EXPECT(full.isInline());
+  KJ_EXPECT(full.size() == SmallString::MAX_INLINE_SIZE);
+
+  auto big = smallStr(kj::repeat('a', SmallString::MAX_INLINE_SIZE), "b");
+  KJ_EXPECT(!big.isInline());
+  KJ_EXPECT(big.size() == SmallString::MAX_INLINE_SIZE + 1);
+  KJ_EXPECT(big.asPtr().endsWith("ab"));
+
+  // Moving heap content keeps it where it is; moving inline content copies it.
+  const char* heapPtr = big.begin();
+  SmallString moved = kj::mv(big);
+  KJ_EXPECT(moved.begin() == heapPtr);
+  KJ_EXPECT(big == "");
+  moved = kj::mv(num);
+  KJ_EXPECT(moved == "12345/x");
+  KJ_EXPECT(moved.isInline());
+
+  KJ_EXPECT(SmallString("foo"_kj) == "foo");
+  KJ_EXPECT(SmallString(kj::str("foo")).toString() == "foo");
+}
+
+KJ_TEST("float stringification is shortest round-trip") {
+  KJ_EXPECT(str(0.1) == "0.1");
+  KJ_EXPECT(str(0.1 + 0.2) == "0.30000000000000004");
+  KJ_EXPECT(str(-0.0) == "-0");
+  KJ_EXPECT(str(123456789012345.0) == "123456789012345");
+  KJ_EXPECT(str(1e23) == "1e23");
+  KJ_EXPECT(str(1.7976931348623157e308) == "1.7976931348623157e308");
+  KJ_EXPECT(str(5e-324) == "5e-324");
+  KJ_EXPECT(str(0.0001) == "0.0001");
+#if !_WIN32
+  KJ_EXPECT(str(0.00001) == "1e-05");
+#endif
+  KJ_EXPECT(str(123456.7f) == "123456.7");
+  KJ_EXPECT(str(1.0f / 3) == "0.33333334");
+  KJ_EXPECT(str(3.4028235e38f) == "3.4028235e38");
+
+  // Needs nine digits, which FLT_DIG+2 doesn't provide.
+  KJ_EXPECT(str(119776504.0f) == "119776504");
+
+  for (double d: {1.0 / 3, 2.0 / 3, 1e-300 / 7, 12345.678e100, 9007199254740993.0}) {
+    KJ_EXPECT(str(d).parseAs<double>() == d, d);
+  }
+}
+
 KJ_TEST("float stringification and parsing is not locale-dependent") {
   // Remember the old locale, set it back when we're done.
   char* oldLocaleCstr = setlocale(LC_NUMERIC, nullptr);
@@ -54,6 +54,26 @@ TEST(StringTree, DelimitedArray) {
   EXPECT_EQ("foo, bar, baz, qux", StringTree(kj::mv(arr), ", ").flatten());
 }
 
+TEST(StringTree, Pieces) {
+  String foo = str("foo");
+  const char* fooPtr = foo.begin();
+  StringTree tree = strTree("<", kj::mv(foo), "bar", strTree(str("baz"), str("")), '>');
+  EXPECT_EQ("<foobarbaz>", tree.flatten());
+
+  auto pieces = tree.pieces();
+  ASSERT_EQ(5u, pieces.size());
+  EXPECT_EQ("<", kj::heapString(pieces[0].asChars()));
+  EXPECT_EQ("foo", kj::heapString(pieces[1].asChars()));
+  EXPECT_EQ("bar", kj::heapString(pieces[2].asChars()));
+  EXPECT_EQ("baz", kj::heapString(pieces[3].asChars()));
+  EXPECT_EQ(">", kj::heapString(pieces[4].asChars()));
+
+  // Branches are not copied.
+  EXPECT_EQ(reinterpret_cast<const byte*>(fooPtr), pieces[1].begin());
+
+  EXPECT_EQ(0u, StringTree().pieces().size());
+}
+
 }  // namespace
 }  // namespace _ (private)
 }  // namespace kj
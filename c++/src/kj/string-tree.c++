@@ -53,6 +53,15 @@ String StringTree::flatten() const {
   return result;
 }
 
+Array<ArrayPtr<const byte>> StringTree::pieces() const {
+  size_t count = 0;
+  visit([&count](ArrayPtr<const char>) { ++count; });
+
+  auto result = heapArrayBuilder<ArrayPtr<const byte>>(count);
+  visit([&result](ArrayPtr<const char> text) { result.add(text.asBytes()); });
+  return result.finish();
+}
+
 char* StringTree::flattenTo(char* __restrict__ target) const {
   visit([&target](ArrayPtr<const char> text) {
     memcpy(target, text.begin(), text.size());
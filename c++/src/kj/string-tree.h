@@ -65,6 +65,18 @@ public:
   // Copy the contents to the given character array.  Does not add a NUL terminator. Returns a
   // pointer just past the end of what was filled.
 
+  Array<ArrayPtr<const byte>> pieces() const;
+  // Return the contents as a list of byte arrays pointing into the tree, in order, suitable for
+  // passing to `OutputStream::write(pieces)` or `AsyncOutputStream::write(pieces)` so that the
+  // whole tree goes out in one gather-write without flattening.  The pieces are only valid while
+  // the tree is alive and unmodified, so for an async write, attach both:
+  //
+  //     auto pieces = tree.pieces();
+  //     return stream.write(pieces).attach(kj::mv(tree), kj::mv(pieces));
+  //
+  // There is one piece per contiguous run of text, i.e. text is only split where a String or
+  // StringTree was passed to strTree() by rvalue; empty runs are omitted.
+
 private:
   size_t size_;
   String text;
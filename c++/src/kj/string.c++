@@ -26,6 +26,8 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 namespace kj {
 
@@ -154,6 +156,31 @@ StringPtr Stringifier::operator*(bool b) const {
   return b ? StringPtr("true") : StringPtr("false");
 }
 
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+template <typename Unsigned>
+static uint countDecimalDigits(Unsigned u) {
+  uint n = 1;
+  for (;;) {
+    if (u < 10) return n;
+    if (u < 100) return n + 1;
+    if (u < 1000) return n + 2;
+    if (u < 10000) return n + 3;
+    u /= 10000u;
+    n += 4;
+  }
+}
+
 template <typename T, typename Unsigned>
 static CappedArray<char, sizeof(T) * 3 + 2> stringifyImpl(T i) {
   // We don't use sprintf() because it's not async-signal-safe (for strPreallocated()).
@@ -164,23 +191,27 @@ static CappedArray<char, sizeof(T) * 3 + 2> stringifyImpl(T i) {
   // unsigned first, then negate it, to avoid ubsan complaining.
   Unsigned u = i;
   if (negative) u = -u;
-  uint8_t reverse[sizeof(T) * 3 + 1];
-  uint8_t* p = reverse;
-  if (u == 0) {
-    *p++ = 0;
+
+  char* p = result.begin();
+  if (negative) *p++ = '-';
+  char* end = p + countDecimalDigits(u);
+
+  // Fill in from the end, two digits per division.
+  char* pos = end;
+  while (u >= 100) {
+    uint pair = static_cast<uint>(u % 100) * 2;
+    u /= 100;
+    *--pos = DIGIT_PAIRS[pair + 1];
+    *--pos = DIGIT_PAIRS[pair];
+  }
+  if (u >= 10) {
+    *--pos = DIGIT_PAIRS[u * 2 + 1];
+    *--pos = DIGIT_PAIRS[u * 2];
   } else {
-    while (u > 0) {
-      *p++ = u % 10;
-      u /= 10;
-    }
+    *--pos = '0' + u;
   }
 
-  char* p2 = result.begin();
-  if (negative) *p2++ = '-';
-  while (p > reverse) {
-    *p2++ = '0' + *--p;
-  }
-  result.setSize(p2 - result.begin());
+  result.setSize(end - result.begin());
   return result;
 }
 
@@ -360,6 +391,393 @@ void RemoveE0(char* buffer) {
 }
 #endif
 
+// ----------------------------------------------------------------------
+// Shortest round-trip formatting
+//
+// DoubleToBuffer() and FloatToBuffer() first try Florian Loitsch's Grisu3 ("Printing
+// Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010), which produces the
+// shortest digit string that parses back to the original value using only 64-bit integer
+// arithmetic. For roughly 0.5% of inputs Grisu3 can't prove its answer is shortest and correctly
+// rounded, in which case we fall back to the snprintf()-based code below.
+//
+// The digits are then laid out the way "%.*g" would lay them out, using the same precision the
+// fallback would have used, so any normal value with up to DBL_DIG (FLT_DIG) significant digits
+// prints exactly as snprintf() would have printed it. Values that need more digits are no longer
+// padded out to DBL_DIG+2 (FLT_DIG+2) digits, and subnormals may print with fewer digits.
+// ----------------------------------------------------------------------
+
+struct DiyFp {
+  // A floating-point value f * 2^e with a 64-bit significand and no implicit bit.
+
+  uint64_t f;
+  int e;
+};
+
+DiyFp multiply(DiyFp x, DiyFp y) {
+  // Returns x * y rounded to 64 bits of significand. Not normalized.
+
+  const uint64_t M32 = 0xffffffffu;
+  uint64_t a = x.f >> 32, b = x.f & M32;
+  uint64_t c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1u << 31);  // round to nearest
+  return { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+}
+
+DiyFp normalize(DiyFp x) {
+  // Shift x.f left until its top bit is set. x.f must be non-zero.
+
+  while ((x.f & 0xffc0000000000000ull) == 0) {
+    x.f <<= 10;
+    x.e -= 10;
+  }
+  while ((x.f & 0x8000000000000000ull) == 0) {
+    x.f <<= 1;
+    x.e -= 1;
+  }
+  return x;
+}
+
+struct CachedPower {
+  uint64_t significand;
+  int16_t binaryExponent;
+  int16_t decimalExponent;
+};
+
+const CachedPower CACHED_POWERS[] = {
+  // 10^k for k = -348, -340, ..., 340, rounded to 64-bit normalized significands.
+  { 0xfa8fd5a0081c0288ull, -1220, -348 },
+  { 0xbaaee17fa23ebf76ull, -1193, -340 },
+  { 0x8b16fb203055ac76ull, -1166, -332 },
+  { 0xcf42894a5dce35eaull, -1140, -324 },
+  { 0x9a6bb0aa55653b2dull, -1113, -316 },
+  { 0xe61acf033d1a45dfull, -1087, -308 },
+  { 0xab70fe17c79ac6caull, -1060, -300 },
+  { 0xff77b1fcbebcdc4full, -1034, -292 },
+  { 0xbe5691ef416bd60cull, -1007, -284 },
+  { 0x8dd01fad907ffc3cull, -980, -276 },
+  { 0xd3515c2831559a83ull, -954, -268 },
+  { 0x9d71ac8fada6c9b5ull, -927, -260 },
+  { 0xea9c227723ee8bcbull, -901, -252 },
+  { 0xaecc49914078536dull, -874, -244 },
+  { 0x823c12795db6ce57ull, -847, -236 },
+  { 0xc21094364dfb5637ull, -821, -228 },
+  { 0x9096ea6f3848984full, -794, -220 },
+  { 0xd77485cb25823ac7ull, -768, -212 },
+  { 0xa086cfcd97bf97f4ull, -741, -204 },
+  { 0xef340a98172aace5ull, -715, -196 },
+  { 0xb23867fb2a35b28eull, -688, -188 },
+  { 0x84c8d4dfd2c63f3bull, -661, -180 },
+  { 0xc5dd44271ad3cdbaull, -635, -172 },
+  { 0x936b9fcebb25c996ull, -608, -164 },
+  { 0xdbac6c247d62a584ull, -582, -156 },
+  { 0xa3ab66580d5fdaf6ull, -555, -148 },
+  { 0xf3e2f893dec3f126ull, -529, -140 },
+  { 0xb5b5ada8aaff80b8ull, -502, -132 },
+  { 0x87625f056c7c4a8bull, -475, -124 },
+  { 0xc9bcff6034c13053ull, -449, -116 },
+  { 0x964e858c91ba2655ull, -422, -108 },
+  { 0xdff9772470297ebdull, -396, -100 },
+  { 0xa6dfbd9fb8e5b88full, -369, -92 },
+  { 0xf8a95fcf88747d94ull, -343, -84 },
+  { 0xb94470938fa89bcfull, -316, -76 },
+  { 0x8a08f0f8bf0f156bull, -289, -68 },
+  { 0xcdb02555653131b6ull, -263, -60 },
+  { 0x993fe2c6d07b7facull, -236, -52 },
+  { 0xe45c10c42a2b3b06ull, -210, -44 },
+  { 0xaa242499697392d3ull, -183, -36 },
+  { 0xfd87b5f28300ca0eull, -157, -28 },
+  { 0xbce5086492111aebull, -130, -20 },
+  { 0x8cbccc096f5088ccull, -103, -12 },
+  { 0xd1b71758e219652cull, -77, -4 },
+  { 0x9c40000000000000ull, -50, 4 },
+  { 0xe8d4a51000000000ull, -24, 12 },
+  { 0xad78ebc5ac620000ull, 3, 20 },
+  { 0x813f3978f8940984ull, 30, 28 },
+  { 0xc097ce7bc90715b3ull, 56, 36 },
+  { 0x8f7e32ce7bea5c70ull, 83, 44 },
+  { 0xd5d238a4abe98068ull, 109, 52 },
+  { 0x9f4f2726179a2245ull, 136, 60 },
+  { 0xed63a231d4c4fb27ull, 162, 68 },
+  { 0xb0de65388cc8ada8ull, 189, 76 },
+  { 0x83c7088e1aab65dbull, 216, 84 },
+  { 0xc45d1df942711d9aull, 242, 92 },
+  { 0x924d692ca61be758ull, 269, 100 },
+  { 0xda01ee641a708deaull, 295, 108 },
+  { 0xa26da3999aef774aull, 322, 116 },
+  { 0xf209787bb47d6b85ull, 348, 124 },
+  { 0xb454e4a179dd1877ull, 375, 132 },
+  { 0x865b86925b9bc5c2ull, 402, 140 },
+  { 0xc83553c5c8965d3dull, 428, 148 },
+  { 0x952ab45cfa97a0b3ull, 455, 156 },
+  { 0xde469fbd99a05fe3ull, 481, 164 },
+  { 0xa59bc234db398c25ull, 508, 172 },
+  { 0xf6c69a72a3989f5cull, 534, 180 },
+  { 0xb7dcbf5354e9beceull, 561, 188 },
+  { 0x88fcf317f22241e2ull, 588, 196 },
+  { 0xcc20ce9bd35c78a5ull, 614, 204 },
+  { 0x98165af37b2153dfull, 641, 212 },
+  { 0xe2a0b5dc971f303aull, 667, 220 },
+  { 0xa8d9d1535ce3b396ull, 694, 228 },
+  { 0xfb9b7cd9a4a7443cull, 720, 236 },
+  { 0xbb764c4ca7a44410ull, 747, 244 },
+  { 0x8bab8eefb6409c1aull, 774, 252 },
+  { 0xd01fef10a657842cull, 800, 260 },
+  { 0x9b10a4e5e9913129ull, 827, 268 },
+  { 0xe7109bfba19c0c9dull, 853, 276 },
+  { 0xac2820d9623bf429ull, 880, 284 },
+  { 0x80444b5e7aa7cf85ull, 907, 292 },
+  { 0xbf21e44003acdd2dull, 933, 300 },
+  { 0x8e679c2f5e44ff8full, 960, 308 },
+  { 0xd433179d9c8cb841ull, 986, 316 },
+  { 0x9e19db92b4e31ba9ull, 1013, 324 },
+  { 0xeb96bf6ebadf77d9ull, 1039, 332 },
+  { 0xaf87023b9bf0ee6bull, 1066, 340 },
+};
+
+const int CACHED_POWERS_OFFSET = 348;        // -CACHED_POWERS[0].decimalExponent
+const int CACHED_POWERS_DECIMAL_STEP = 8;
+
+// Grisu wants the scaled value's binary exponent to land in this range so that the integral part
+// fits in 32 bits and digit generation can work on it directly.
+const int MIN_TARGET_EXPONENT = -60;
+const int MAX_TARGET_EXPONENT = -32;
+
+DiyFp cachedPowerForBinaryExponent(int minExponent, int& decimalExponent) {
+  // Returns the cached power of ten c such that minExponent <= c.e, and c.e is within
+  // MAX_TARGET_EXPONENT - MIN_TARGET_EXPONENT of it.
+
+  int k = static_cast<int>(ceil((minExponent + 63) * 0.30102999566398114));  // 1 / lg(10)
+  int index = (CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_DECIMAL_STEP + 1;
+  KJ_DASSERT(index >= 0 && size_t(index) < kj::size(CACHED_POWERS));
+  const CachedPower& power = CACHED_POWERS[index];
+  decimalExponent = power.decimalExponent;
+  return { power.significand, power.binaryExponent };
+}
+
+bool roundWeed(char* digits, int length, uint64_t distanceTooHighW, uint64_t unsafeInterval,
+               uint64_t rest, uint64_t tenKappa, uint64_t unit) {
+  // Nudges the last generated digit down as far as it can go while staying closer to the true
+  // value, then reports whether the result is provably the correctly-rounded shortest answer.
+
+  uint64_t smallDistance = distanceTooHighW - unit;
+  uint64_t bigDistance = distanceTooHighW + unit;
+
+  while (rest < smallDistance &&
+         unsafeInterval - rest >= tenKappa &&
+         (rest + tenKappa < smallDistance ||
+          smallDistance - rest >= rest + tenKappa - smallDistance)) {
+    --digits[length - 1];
+    rest += tenKappa;
+  }
+
+  if (rest < bigDistance &&
+      unsafeInterval - rest >= tenKappa &&
+      (rest + tenKappa < bigDistance ||
+       bigDistance - rest > rest + tenKappa - bigDistance)) {
+    return false;
+  }
+
+  return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+bool digitGen(DiyFp low, DiyFp w, DiyFp high, char* digits, int& length, int& kappa) {
+  // Generates the shortest digit string within (low, high), which have been scaled so that their
+  // binary exponent is in [MIN_TARGET_EXPONENT, MAX_TARGET_EXPONENT]. On return the value is
+  // approximately digits * 10^kappa.
+
+  KJ_DASSERT(low.e == w.e && w.e == high.e);
+  KJ_DASSERT(w.e >= MIN_TARGET_EXPONENT && w.e <= MAX_TARGET_EXPONENT);
+
+  // low, w, and high are each imprecise by up to one unit, so widen the interval by one unit on
+  // each side and later check that the answer is within the narrower safe interval.
+  uint64_t unit = 1;
+  DiyFp tooLow = { low.f - unit, low.e };
+  DiyFp tooHigh = { high.f + unit, high.e };
+  uint64_t unsafeInterval = tooHigh.f - tooLow.f;
+
+  int shift = -w.e;
+  uint64_t one = uint64_t(1) << shift;
+  uint32_t integrals = static_cast<uint32_t>(tooHigh.f >> shift);
+  uint64_t fractionals = tooHigh.f & (one - 1);
+
+  uint32_t divisor = 1000000000;
+  kappa = 10;
+  while (divisor > integrals) {
+    divisor /= 10;
+    --kappa;
+  }
+
+  length = 0;
+  while (kappa > 0) {
+    digits[length++] = '0' + integrals / divisor;
+    integrals %= divisor;
+    --kappa;
+    uint64_t rest = (static_cast<uint64_t>(integrals) << shift) + fractionals;
+    if (rest < unsafeInterval) {
+      return roundWeed(digits, length, tooHigh.f - w.f, unsafeInterval, rest,
+                       static_cast<uint64_t>(divisor) << shift, unit);
+    }
+    divisor /= 10;
+  }
+
+  for (;;) {
+    fractionals *= 10;
+    unit *= 10;
+    unsafeInterval *= 10;
+    digits[length++] = '0' + static_cast<int>(fractionals >> shift);
+    fractionals &= one - 1;
+    --kappa;
+    if (fractionals < unsafeInterval) {
+      return roundWeed(digits, length, (tooHigh.f - w.f) * unit, unsafeInterval, fractionals,
+                       one, unit);
+    }
+  }
+}
+
+bool grisu3(uint64_t f, int e, bool lowerBoundaryIsCloser,
+            char* digits, int& length, int& decimalExponent) {
+  // Finds the shortest digits such that digits * 10^decimalExponent is closer to f * 2^e than
+  // to any neighboring value. The neighbors are f +/- 1 ulp, except that when f is the smallest
+  // significand of its binade, the lower neighbor is only half as far away.
+
+  DiyFp w = normalize({ f, e });
+  DiyFp plus = normalize({ (f << 1) + 1, e - 1 });
+  DiyFp minus = lowerBoundaryIsCloser ? DiyFp { (f << 2) - 1, e - 2 }
+                                      : DiyFp { (f << 1) - 1, e - 1 };
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  int mk;
+  DiyFp tenMk = cachedPowerForBinaryExponent(MIN_TARGET_EXPONENT - (w.e + 64), mk);
+
+  int kappa;
+  bool result = digitGen(multiply(minus, tenMk), multiply(w, tenMk), multiply(plus, tenMk),
+                         digits, length, kappa);
+  decimalExponent = kappa - mk;
+  return result;
+}
+
+char* formatDigits(char* buffer, bool negative, const char* digits, int length,
+                   int decimalExponent, int precision) {
+  // Lays out digits * 10^decimalExponent as "%.<precision>g" would.
+
+  while (length > 1 && digits[length - 1] == '0') {
+    --length;
+    ++decimalExponent;
+  }
+
+  char* p = buffer;
+  if (negative) *p++ = '-';
+
+  int exponent = length + decimalExponent - 1;  // exponent of the leading digit
+  if (exponent < -4 || exponent >= precision) {
+    *p++ = digits[0];
+    if (length > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, length - 1);
+      p += length - 1;
+    }
+    *p++ = 'e';
+    if (exponent < 0) {
+      *p++ = '-';
+      exponent = -exponent;
+    }
+#if _WIN32
+    // The slow path's RemoveE0() strips all zero padding from exponents on Windows.
+    bool padExponent = false;
+#else
+    bool padExponent = true;  // "%g" always prints at least two exponent digits
+#endif
+    if (exponent >= 100) {
+      *p++ = '0' + exponent / 100;
+      exponent %= 100;
+      *p++ = '0' + exponent / 10;
+    } else if (exponent >= 10 || padExponent) {
+      *p++ = '0' + exponent / 10;
+    }
+    *p++ = '0' + exponent % 10;
+  } else if (exponent >= 0) {
+    if (length <= exponent + 1) {
+      memcpy(p, digits, length);
+      p += length;
+      memset(p, '0', exponent + 1 - length);
+      p += exponent + 1 - length;
+    } else {
+      memcpy(p, digits, exponent + 1);
+      p += exponent + 1;
+      *p++ = '.';
+      memcpy(p, digits + exponent + 1, length - exponent - 1);
+      p += length - exponent - 1;
+    }
+  } else {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -exponent - 1);
+    p += -exponent - 1;
+    memcpy(p, digits, length);
+    p += length;
+  }
+  *p = '\0';
+  return buffer;
+}
+
+bool FastDoubleToBuffer(double value, char* buffer) {
+  // Returns false if the caller must fall back to the slow path. `value` must be finite.
+
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bool negative = bits >> 63;
+  int biasedExponent = (bits >> 52) & 0x7ff;
+  uint64_t fraction = bits & ((uint64_t(1) << 52) - 1);
+
+  if (biasedExponent == 0 && fraction == 0) {
+    strcpy(buffer, negative ? "-0" : "0");
+    return true;
+  }
+
+  uint64_t f = biasedExponent == 0 ? fraction : fraction | (uint64_t(1) << 52);
+  int e = biasedExponent == 0 ? -1074 : biasedExponent - 1075;
+
+  char digits[18];
+  int length, decimalExponent;
+  if (!grisu3(f, e, fraction == 0 && biasedExponent > 1, digits, length, decimalExponent)) {
+    return false;
+  }
+
+  formatDigits(buffer, negative, digits, length, decimalExponent,
+               length <= DBL_DIG ? DBL_DIG : DBL_DIG + 2);
+  return true;
+}
+
+bool FastFloatToBuffer(float value, char* buffer) {
+  // Returns false if the caller must fall back to the slow path. `value` must be finite.
+
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bool negative = bits >> 31;
+  int biasedExponent = (bits >> 23) & 0xff;
+  uint32_t fraction = bits & ((uint32_t(1) << 23) - 1);
+
+  if (biasedExponent == 0 && fraction == 0) {
+    strcpy(buffer, negative ? "-0" : "0");
+    return true;
+  }
+
+  uint64_t f = biasedExponent == 0 ? fraction : fraction | (uint32_t(1) << 23);
+  int e = biasedExponent == 0 ? -149 : biasedExponent - 150;
+
+  char digits[18];
+  int length, decimalExponent;
+  if (!grisu3(f, e, fraction == 0 && biasedExponent > 1, digits, length, decimalExponent)) {
+    return false;
+  }
+
+  formatDigits(buffer, negative, digits, length, decimalExponent,
+               length <= FLT_DIG ? FLT_DIG : FLT_DIG + 2);
+  return true;
+}
+
 char* DoubleToBuffer(double value, char* buffer) {
   // DBL_DIG is 15 for IEEE-754 doubles, which are used on almost all
   // platforms these days.  Just in case some system exists where DBL_DIG
@@ -378,6 +796,10 @@ char* DoubleToBuffer(double value, char* buffer) {
     return buffer;
   }
 
+  if (FastDoubleToBuffer(value, buffer)) {
+    return buffer;
+  }
+
   int snprintf_result KJ_UNUSED =
     snprintf(buffer, kDoubleToBufferSize, "%.*g", DBL_DIG, value);
 
@@ -437,6 +859,10 @@ char* FloatToBuffer(float value, char* buffer) {
     return buffer;
   }
 
+  if (FastFloatToBuffer(value, buffer)) {
+    return buffer;
+  }
+
   int snprintf_result KJ_UNUSED =
     snprintf(buffer, kFloatToBufferSize, "%.*g", FLT_DIG, value);
 
@@ -451,6 +877,13 @@ char* FloatToBuffer(float value, char* buffer) {
 
     // Should never overflow; see above.
     KJ_DASSERT(snprintf_result2 > 0 && snprintf_result2 < kFloatToBufferSize);
+
+    if (!safe_strtof(buffer, &parsed_value) || parsed_value != value) {
+      // FLT_DIG+2 digits isn't quite always enough, but FLT_DIG+3 is.
+      int snprintf_result3 KJ_UNUSED =
+        snprintf(buffer, kFloatToBufferSize, "%.*g", FLT_DIG+3, value);
+      KJ_DASSERT(snprintf_result3 > 0 && snprintf_result3 < kFloatToBufferSize);
+    }
   }
 
   DelocalizeRadix(buffer);
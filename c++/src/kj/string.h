@@ -466,6 +466,103 @@ String str(Params&&... params) {
 inline String str(String&& s) { return mv(s); }
 // Overload to prevent redundant allocation.
 
+class SmallString {
+  // A string which keeps up to MAX_INLINE_SIZE characters inside the object, and only goes to the
+  // heap (as a String) when it's longer.  Use this rather than String for short strings built on
+  // hot paths -- a formatted number or a short header value -- that don't need to outlive the
+  // current scope or be transferred as a String.  Build one with smallStr(), which is like str().
+  //
+  // Converting to StringPtr is free.  Unlike with String, though, moving a SmallString invalidates
+  // any StringPtr into its content, since short content moves along with the object.  So don't use
+  // it for content which must be kept alive by attaching it to a promise or Own.
+
+public:
+  static constexpr size_t MAX_INLINE_SIZE = 23;
+
+  inline SmallString(): inlineSize(0) { space[0] = '\0'; }
+  inline explicit SmallString(StringPtr value) { init(value.begin(), value.size()); }
+  inline SmallString(String&& value): inlineSize(HEAP) { ctor(heap, kj::mv(value)); }
+  inline SmallString(SmallString&& other) { take(other); }
+  KJ_DISALLOW_COPY(SmallString);
+  inline ~SmallString() noexcept(false) { if (inlineSize == HEAP) dtor(heap); }
+
+  inline SmallString& operator=(SmallString&& other) {
+    if (this != &other) {
+      if (inlineSize == HEAP) dtor(heap);
+      take(other);
+    }
+    return *this;
+  }
+
+  inline bool isInline() const { return inlineSize != HEAP; }
+
+  inline operator StringPtr() const KJ_LIFETIMEBOUND { return asPtr(); }
+  inline StringPtr asPtr() const KJ_LIFETIMEBOUND {
+    return isInline() ? StringPtr(space, inlineSize) : heap.asPtr();
+  }
+  inline ArrayPtr<const char> asArray() const KJ_LIFETIMEBOUND { return asPtr().asArray(); }
+  inline ArrayPtr<const byte> asBytes() const KJ_LIFETIMEBOUND { return asArray().asBytes(); }
+
+  inline const char* cStr() const KJ_LIFETIMEBOUND { return isInline() ? space : heap.cStr(); }
+  inline size_t size() const { return isInline() ? inlineSize : heap.size(); }
+  inline const char* begin() const KJ_LIFETIMEBOUND { return cStr(); }
+  inline const char* end() const KJ_LIFETIMEBOUND { return cStr() + size(); }
+  inline char operator[](size_t index) const { return asPtr()[index]; }
+
+  inline bool operator==(const StringPtr& other) const { return asPtr() == other; }
+  inline bool operator!=(const StringPtr& other) const { return asPtr() != other; }
+
+  String toString() const { return heapString(asPtr()); }
+  // Copies to the heap.
+
+  template <typename... Params>
+  static SmallString concat(Params&&... params);
+  // Like _::concat() but produces a SmallString.  Used by smallStr().
+
+private:
+  static constexpr byte HEAP = 0xff;
+
+  union {
+    char space[MAX_INLINE_SIZE + 1];
+    String heap;
+  };
+  byte inlineSize;
+  // Size of the content in `space`, or HEAP if `heap` is active.
+
+  inline void init(const char* value, size_t size) {
+    if (size <= MAX_INLINE_SIZE) {
+      inlineSize = size;
+      memcpy(space, value, size);
+      space[size] = '\0';
+    } else {
+      inlineSize = HEAP;
+      ctor(heap, heapString(value, size));
+    }
+  }
+
+  inline void take(SmallString& other) {
+    inlineSize = other.inlineSize;
+    if (other.inlineSize == HEAP) {
+      ctor(heap, kj::mv(other.heap));
+      dtor(other.heap);
+      other.inlineSize = 0;
+      other.space[0] = '\0';
+    } else {
+      memcpy(space, other.space, other.inlineSize + 1);
+    }
+  }
+};
+
+inline StringPtr KJ_STRINGIFY(const SmallString& s) { return s; }
+
+template <typename... Params>
+SmallString smallStr(Params&&... params) {
+  // Like str(), but the result is a SmallString, which doesn't allocate if it's short.  Example:
+  //     auto lengthStr = smallStr(contentLength);
+
+  return SmallString::concat(toCharSequence(kj::fwd<Params>(params))...);
+}
+
 template <typename T>
 _::Delimited<T> delimited(T&& arr, kj::StringPtr delim);
 // Use to stringify an array.
@@ -630,6 +727,19 @@ inline String::String(char* value, size_t size, const ArrayDisposer& disposer)
   KJ_IREQUIRE(value[size] == '\0', "String must be NUL-terminated.");
 }
 
+template <typename... Params>
+SmallString SmallString::concat(Params&&... params) {
+  size_t size = _::sum({params.size()...});
+  if (size > MAX_INLINE_SIZE) {
+    return SmallString(_::concat(kj::fwd<Params>(params)...));
+  }
+
+  SmallString result;
+  result.inlineSize = size;
+  *_::fill(result.space, kj::fwd<Params>(params)...) = '\0';
+  return result;
+}
+
 inline String::String(Array<char> buffer): content(kj::mv(buffer)) {
   KJ_IREQUIRE(content.size() > 0 && content.back() == '\0', "String must be NUL-terminated.");
 }
@@ -0,0 +1,146 @@
+// Copyright (c) 2021 Cloudflare, Inc. and contributors
+// Licensed under the MIT License:
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "benchmark.h"
+#include "table.h"
+#include "string.h"
+#include "vector.h"
+#include "hash.h"
+
+namespace kj {
+namespace {
+
+class UintHasher {
+public:
+  uint keyForRow(uint i) const { return i; }
+
+  bool matches(uint a, uint b) const {
+    return a == b;
+  }
+  uint hashCode(uint i) const {
+    return i;
+  }
+};
+
+class UintCompare {
+public:
+  uint keyForRow(uint i) const { return i; }
+
+  bool isBefore(uint a, uint b) const {
+    return a < b;
+  }
+  bool matches(uint a, uint b) const {
+    return a == b;
+  }
+};
+
+class StringHasher {
+public:
+  StringPtr keyForRow(const String& s) const { return s; }
+
+  bool matches(const String& a, StringPtr b) const {
+    return a == b;
+  }
+  uint hashCode(StringPtr str) const {
+    return kj::hashCode(str);
+  }
+};
+
+constexpr uint TABLE_SIZE = 1000;
+
+uint scramble(uint i) {
+  // A cheap bijection on [0, 2^32) so that keys are inserted in a non-sequential order.
+  return i * 2654435761u;
+}
+
+KJ_BENCHMARK("Table<uint, HashIndex> insert 1000") {
+  for (uint64_t i = 0; i < iterations; i++) {
+    Table<uint, HashIndex<UintHasher>> table;
+    for (uint j = 0; j < TABLE_SIZE; j++) {
+      table.insert(scramble(j));
+    }
+    doNotOptimizeAway(table.size());
+  }
+}
+
+KJ_BENCHMARK("Table<uint, HashIndex> find") {
+  Table<uint, HashIndex<UintHasher>> table;
+  for (uint j = 0; j < TABLE_SIZE; j++) {
+    table.insert(scramble(j));
+  }
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    doNotOptimizeAway(table.find(scramble(i % (TABLE_SIZE * 2))));
+  }
+}
+
+KJ_BENCHMARK("Table<String, HashIndex> find") {
+  Table<String, HashIndex<StringHasher>> table;
+  Vector<String> keys;
+  for (uint j = 0; j < TABLE_SIZE; j++) {
+    keys.add(kj::str("key-", scramble(j)));
+    table.insert(kj::str(keys.back()));
+  }
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    doNotOptimizeAway(table.find(keys[i % TABLE_SIZE].asPtr()));
+  }
+}
+
+KJ_BENCHMARK("Table<uint, TreeIndex> insert 1000") {
+  for (uint64_t i = 0; i < iterations; i++) {
+    Table<uint, TreeIndex<UintCompare>> table;
+    for (uint j = 0; j < TABLE_SIZE; j++) {
+      table.insert(scramble(j));
+    }
+    doNotOptimizeAway(table.size());
+  }
+}
+
+KJ_BENCHMARK("Table<uint, TreeIndex> find") {
+  Table<uint, TreeIndex<UintCompare>> table;
+  for (uint j = 0; j < TABLE_SIZE; j++) {
+    table.insert(scramble(j));
+  }
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    doNotOptimizeAway(table.find(scramble(i % (TABLE_SIZE * 2))));
+  }
+}
+
+KJ_BENCHMARK("Table<uint, TreeIndex> ordered iteration of 1000") {
+  Table<uint, TreeIndex<UintCompare>> table;
+  for (uint j = 0; j < TABLE_SIZE; j++) {
+    table.insert(scramble(j));
+  }
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    uint sum = 0;
+    for (uint value: table.ordered<TreeIndex<UintCompare>>()) {
+      sum += value;
+    }
+    doNotOptimizeAway(sum);
+  }
+}
+
+}  // namespace
+}  // namespace kj
@@ -186,6 +186,52 @@ KJ_TEST("simple table") {
   }
 }
 
+KJ_TEST("hashBytes") {
+  // hashCode() of strings and byte arrays is the unseeded hashBytes().
+  KJ_EXPECT(kj::hashCode("foo"_kj) == hashBytes("foo"_kj, 0));
+  KJ_EXPECT(kj::hashCode("foo"_kj.asBytes()) == hashBytes("foo"_kj, 0));
+  KJ_EXPECT(hashBytes("foo"_kj, 0) != hashBytes("foo"_kj, 1));
+
+  // Every length up to a few blocks takes a different path through the function; check that each
+  // prefix of a long string, and each seed, gets a distinct hash.
+  auto text = kj::str(kj::repeat('x', 200));
+  std::set<uint> seen;
+  for (auto i: kj::zeroTo(text.size() + 1)) {
+    seen.insert(hashBytes(text.slice(0, i), 0));
+    seen.insert(hashBytes(text.slice(0, i), 12345));
+  }
+  KJ_EXPECT(seen.size() == (text.size() + 1) * 2);
+
+  // Flipping any single bit changes the hash.
+  auto bytes = kj::heapArray<byte>(64);
+  memset(bytes.begin(), 0, bytes.size());
+  uint base = hashBytes(bytes, 0);
+  for (auto i: kj::zeroTo(bytes.size() * 8)) {
+    bytes[i / 8] ^= 1 << (i % 8);
+    KJ_EXPECT(hashBytes(bytes, 0) != base, i);
+    bytes[i / 8] ^= 1 << (i % 8);
+  }
+}
+
+KJ_TEST("crc32c") {
+  KJ_EXPECT(crc32c(nullptr) == 0);
+  KJ_EXPECT(crc32c("123456789"_kj.asBytes()) == 0xe3069283);
+
+  byte zeros[32];
+  memset(zeros, 0, sizeof(zeros));
+  KJ_EXPECT(crc32c(zeros) == 0x8a9136aa);
+
+  // Checksumming in pieces gives the same result, whatever the alignment and length of each piece
+  // (and so whichever mix of wide and narrow steps the implementation takes).
+  auto text = kj::str(kj::repeat('x', 50), "the quick brown fox jumps over the lazy dog",
+                      kj::repeat('y', 50));
+  auto bytes = text.asBytes();
+  uint32_t whole = crc32c(bytes);
+  for (auto i: kj::zeroTo(bytes.size() + 1)) {
+    KJ_EXPECT(crc32c(bytes.slice(i, bytes.size()), crc32c(bytes.slice(0, i))) == whole, i);
+  }
+}
+
 class BadHasher {
   // String hash that always returns the same hash code. This should not affect correctness, only
   // performance.
@@ -295,6 +341,102 @@ KJ_TEST("HashIndex with many erasures doesn't keep growing") {
   KJ_ASSERT(index.capacity() < 10);
 }
 
+KJ_TEST("SwissHashIndex") {
+  Table<StringPtr, SwissHashIndex<StringHasher>> table;
+
+  KJ_EXPECT(table.insert("foo") == "foo");
+  KJ_EXPECT(table.insert("bar") == "bar");
+  KJ_EXPECT(table.size() == 2);
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(table.find("foo")) == "foo");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(table.find("bar")) == "bar");
+  KJ_EXPECT(table.find("baz") == nullptr);
+
+  KJ_EXPECT(table.eraseMatch("foo"));
+  KJ_EXPECT(table.find("foo") == nullptr);
+  KJ_EXPECT(KJ_ASSERT_NONNULL(table.find("bar")) == "bar");
+
+  KJ_EXPECT_THROW_MESSAGE("inserted row already exists in table", table.insert("bar"));
+
+  table.clear();
+  KJ_EXPECT(table.find("bar") == nullptr);
+  KJ_EXPECT(table.insert("bar") == "bar");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(table.find("bar")) == "bar");
+}
+
+KJ_TEST("SwissHashIndex when hash is always same") {
+  // Every row has the same tag and starts probing at the same group, so lookups have to go
+  // through several full groups, and through slots that are erased.
+  Table<StringPtr, SwissHashIndex<BadHasher>> table;
+
+  kj::Vector<String> strings;
+  for (uint i: kj::zeroTo(100)) {
+    strings.add(kj::str(i));
+  }
+  for (auto& str: strings) {
+    table.insert(str);
+  }
+
+  for (uint i: kj::zeroTo(100)) {
+    if (i % 3 == 0) {
+      KJ_EXPECT(table.eraseMatch(strings[i]));
+    }
+  }
+
+  for (uint i: kj::zeroTo(100)) {
+    if (i % 3 == 0) {
+      KJ_EXPECT(table.find(strings[i]) == nullptr);
+    } else {
+      KJ_EXPECT(KJ_ASSERT_NONNULL(table.find(strings[i])) == strings[i]);
+    }
+  }
+
+  KJ_EXPECT(table.insert(strings[0]) == "0");
+  KJ_EXPECT(KJ_ASSERT_NONNULL(table.find(strings[0])) == "0");
+  KJ_EXPECT_THROW_MESSAGE("inserted row already exists in table", table.insert(strings[1]));
+}
+
+KJ_TEST("SwissHashIndex with many erasures doesn't keep growing") {
+  SwissHashIndex<IntHasher> index;
+
+  kj::ArrayPtr<uint> rows = nullptr;
+
+  for (uint i: kj::zeroTo(1000000)) {
+    KJ_ASSERT(index.insert(rows, 0, i) == nullptr);
+    index.erase(rows, 0, i);
+  }
+
+  KJ_ASSERT(index.capacity() <= 16);
+}
+
+KJ_TEST("SwissHashIndex agrees with HashIndex") {
+  // Cross-check against HashIndex through a table indexed by both, with enough churn to rehash,
+  // fill groups, and move rows around on erasure.
+  Table<uint, HashIndex<IntHasher>, SwissHashIndex<IntHasher>> table;
+
+  for (uint i: kj::zeroTo(BIG_PRIME)) {
+    table.insert(i * 64);
+  }
+  for (uint i: kj::zeroTo(BIG_PRIME)) {
+    if (i % 3 != 0) {
+      table.erase(KJ_ASSERT_NONNULL(table.find<SwissHashIndex<IntHasher>>(i * 64)));
+    }
+  }
+  for (uint i: kj::zeroTo(BIG_PRIME / 2)) {
+    table.upsert(i * 64, [](uint&, uint&&) {});
+  }
+
+  for (uint i: kj::zeroTo(BIG_PRIME + 10)) {
+    auto expected = table.find<HashIndex<IntHasher>>(i * 64);
+    auto actual = table.find<SwissHashIndex<IntHasher>>(i * 64);
+    KJ_ASSERT((expected == nullptr) == (actual == nullptr), i);
+    KJ_IF_MAYBE(e, expected) {
+      KJ_ASSERT(e == &KJ_ASSERT_NONNULL(actual));
+    }
+    KJ_ASSERT(table.find<SwissHashIndex<IntHasher>>(i * 64 + 1) == nullptr);
+  }
+}
+
 struct SiPair {
   kj::StringPtr str;
   uint i;
@@ -445,6 +587,42 @@ KJ_TEST("benchmark: kj::Table<uint, HashIndex>") {
   }
 }
 
+KJ_TEST("benchmark: kj::Table<uint, SwissHashIndex>") {
+  constexpr uint SOME_PRIME = BIG_PRIME;
+  constexpr uint STEP[] = {1, 2, 4, 7, 43, 127};
+
+  for (auto step: STEP) {
+    KJ_CONTEXT(step);
+    Table<uint, SwissHashIndex<UintHasher>> table;
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      uint j = (i * step) % SOME_PRIME;
+      table.insert(j * 5 + 123);
+    }
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      uint value = KJ_ASSERT_NONNULL(table.find(i * 5 + 123));
+      KJ_ASSERT(value == i * 5 + 123);
+      KJ_ASSERT(table.find(i * 5 + 122) == nullptr);
+      KJ_ASSERT(table.find(i * 5 + 124) == nullptr);
+    }
+
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      if (i % 2 == 0 || i % 7 == 0) {
+        table.erase(KJ_ASSERT_NONNULL(table.find(i * 5 + 123)));
+      }
+    }
+
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      if (i % 2 == 0 || i % 7 == 0) {
+        // erased
+        KJ_ASSERT(table.find(i * 5 + 123) == nullptr);
+      } else {
+        uint value = KJ_ASSERT_NONNULL(table.find(i * 5 + 123));
+        KJ_ASSERT(value == i * 5 + 123);
+      }
+    }
+  }
+}
+
 KJ_TEST("benchmark: std::unordered_set<uint>") {
   constexpr uint SOME_PRIME = BIG_PRIME;
   constexpr uint STEP[] = {1, 2, 4, 7, 43, 127};
@@ -524,6 +702,45 @@ KJ_TEST("benchmark: kj::Table<StringPtr, HashIndex>") {
   }
 }
 
+KJ_TEST("benchmark: kj::Table<StringPtr, SwissHashIndex>") {
+  constexpr uint SOME_PRIME = BIG_PRIME;
+  constexpr uint STEP[] = {1, 2, 4, 7, 43, 127};
+
+  kj::Vector<String> strings(SOME_PRIME);
+  for (uint i: kj::zeroTo(SOME_PRIME)) {
+    strings.add(kj::str(i * 5 + 123));
+  }
+
+  for (auto step: STEP) {
+    KJ_CONTEXT(step);
+    Table<StringPtr, SwissHashIndex<StringHasher>> table;
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      uint j = (i * step) % SOME_PRIME;
+      table.insert(strings[j]);
+    }
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      StringPtr value = KJ_ASSERT_NONNULL(table.find(strings[i]));
+      KJ_ASSERT(value == strings[i]);
+    }
+
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      if (i % 2 == 0 || i % 7 == 0) {
+        table.erase(KJ_ASSERT_NONNULL(table.find(strings[i])));
+      }
+    }
+
+    for (uint i: kj::zeroTo(SOME_PRIME)) {
+      if (i % 2 == 0 || i % 7 == 0) {
+        // erased
+        KJ_ASSERT(table.find(strings[i]) == nullptr);
+      } else {
+        StringPtr value = KJ_ASSERT_NONNULL(table.find(strings[i]));
+        KJ_ASSERT(value == strings[i]);
+      }
+    }
+  }
+}
+
 struct StlStringHash {
   inline size_t operator()(StringPtr str) const {
     return kj::hashCode(str);
@@ -993,6 +1210,52 @@ KJ_TEST("TreeIndex clear() leaves tree in valid state") {
   }
 }
 
+KJ_TEST("TreeIndex bulk load") {
+  constexpr uint SIZES[] = {0, 1, 14, 15, 29, 113, MEDIUM_PRIME};
+  constexpr uint STEP[] = {1, 11, 43};  // coprime with SIZES, so rows are unique
+
+  for (auto size: SIZES) {
+    for (auto step: STEP) {
+      KJ_CONTEXT(size, step);
+
+      // With step 1 the rows are already sorted; otherwise they're scrambled.
+      Vector<uint> rows(size);
+      for (uint i: kj::zeroTo(size)) {
+        rows.add(((i * step) % size) * 5 + 123);
+      }
+
+      Table<uint, TreeIndex<UintCompare>> table;
+      table.insertAll(rows);
+      KJ_ASSERT(table.size() == size);
+      table.verify();
+
+      {
+        auto range = table.ordered();
+        auto iter = range.begin();
+        for (uint i: kj::zeroTo(size)) {
+          KJ_ASSERT(*iter++ == i * 5 + 123);
+          KJ_ASSERT(KJ_ASSERT_NONNULL(table.find(i * 5 + 123)) == i * 5 + 123);
+          KJ_ASSERT(table.find(i * 5 + 124) == nullptr);
+        }
+        KJ_ASSERT(iter == range.end());
+      }
+
+      // The tree is still valid under insertions and deletions.
+      for (uint i: kj::zeroTo(size)) {
+        table.insert(i * 5 + 124);
+        if (i % 3 == 0) {
+          table.erase(KJ_ASSERT_NONNULL(table.find(i * 5 + 123)));
+        }
+      }
+      table.verify();
+      for (uint i: kj::zeroTo(size)) {
+        KJ_ASSERT(table.find(i * 5 + 123) == nullptr || i % 3 != 0);
+        KJ_ASSERT(table.find(i * 5 + 124) != nullptr);
+      }
+    }
+  }
+}
+
 KJ_TEST("benchmark: kj::Table<uint, TreeIndex>") {
   constexpr uint SOME_PRIME = BIG_PRIME;
   constexpr uint STEP[] = {1, 2, 4, 7, 43, 127};
@@ -1405,6 +1668,24 @@ KJ_TEST("TreeIndex rollback on insertion failure") {
   }
 }
 
+KJ_TEST("TreeIndex bulk load stops at the first duplicate") {
+  Table<StringPtr, TreeIndex<StringCompare>, TreeIndex<StringLengthCompare>> table;
+
+  // "abc" and "xyz" don't match according to the first index, but do according to the second.
+  StringPtr rows[] = {"a"_kj, "abc"_kj, "ab"_kj, "xyz"_kj, "abcd"_kj};
+  KJ_EXPECT_THROW_MESSAGE("inserted row already exists in table", table.insertAll(rows));
+
+  // As with inserting one at a time, the rows before the duplicate are kept.
+  KJ_EXPECT(table.size() == 3);
+  table.verify();
+  KJ_EXPECT(table.find<0>("ab"_kj) != nullptr);
+  KJ_EXPECT(table.find<0>("xyz"_kj) == nullptr);
+  KJ_EXPECT(table.find<1>(size_t(4)) == nullptr);
+
+  table.insert("abcd"_kj);
+  KJ_EXPECT(table.size() == 4);
+}
+
 }  // namespace
 }  // namespace _
 }  // namespace kj
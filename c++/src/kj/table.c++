@@ -22,6 +22,7 @@
 #include "table.h"
 #include "debug.h"
 #include <stdlib.h>
+#include <algorithm>
 
 #if KJ_DEBUG_TABLE_IMPL
 #undef KJ_DASSERT
@@ -195,6 +196,48 @@ kj::Array<HashBucket> rehash(kj::ArrayPtr<const HashBucket> oldBuckets, size_t t
   return newBuckets;
 }
 
+size_t swissMaxLoad(size_t capacity) {
+  // A load factor of up to 7/8, as in Abseil. Lookups rely on there always being an empty slot.
+  return capacity - capacity / 8;
+}
+
+void swissRehash(kj::Array<byte>& ctrl, kj::Array<SwissSlot>& slots, size_t targetSize) {
+  KJ_REQUIRE(targetSize < (1 << 30), "hash table has reached maximum size");
+
+  size_t size = SwissGroup::SIZE;
+  while (swissMaxLoad(size) < targetSize) {
+    size *= 2;
+  }
+
+  if (size < slots.size()) {
+    size = slots.size();
+  }
+
+  auto newCtrl = kj::heapArray<byte>(size);
+  memset(newCtrl.begin(), SwissGroup::EMPTY, size);
+  auto newSlots = kj::heapArray<SwissSlot>(size);
+  size_t groupMask = size / SwissGroup::SIZE - 1;
+
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (ctrl[i] & 0x80) continue;  // empty or erased
+
+    SwissHash hash(slots[i].hash);
+    for (size_t g = hash.group(groupMask), step = 0;; g = (g + ++step) & groupMask) {
+      size_t base = g * SwissGroup::SIZE;
+      uint m = SwissGroup(newCtrl.begin() + base).matchEmpty();
+      if (m != 0) {
+        size_t j = base + lowestBit(m);
+        newCtrl[j] = hash.tag();
+        newSlots[j] = slots[i];
+        break;
+      }
+    }
+  }
+
+  ctrl = kj::mv(newCtrl);
+  slots = kj::mv(newSlots);
+}
+
 // =======================================================================================
 // BTree
 
@@ -682,6 +725,118 @@ void BTreeImpl::renumber(uint oldRow, uint newRow, const SearchKey& searchKey) {
   }
 }
 
+bool BTreeImpl::bulkLoad(size_t size, FunctionParam<bool(uint, uint)> isBefore) {
+  KJ_REQUIRE(size < (1u << 31), "b-tree has reached maximum size");
+
+  if (size == 0) {
+    clear();
+    return true;
+  }
+
+  auto order = heapArray<uint>(size);
+  for (auto i: kj::indices(order)) order[i] = i;
+
+  bool sorted = true;
+  for (uint i = 1; i < size; i++) {
+    if (!isBefore(i - 1, i)) {
+      sorted = false;
+      break;
+    }
+  }
+  if (!sorted) {
+    std::sort(order.begin(), order.end(), [&](uint i, uint j) { return isBefore(i, j); });
+    for (uint i = 1; i < size; i++) {
+      if (!isBefore(order[i - 1], order[i])) {
+        clear();
+        return false;
+      }
+    }
+  }
+
+  // Each level has as few nodes as can hold the level below, with the items spread evenly. So
+  // every node but the root is at least half full, as it must be: two nodes at a level would only
+  // be needed if the level below didn't fit in one.
+  uint leafCount = (size + Leaf::NROWS - 1) / Leaf::NROWS;
+  uint nodeCount = leafCount;
+  uint newHeight = 0;
+  for (uint n = leafCount; n > 1; n = (n + Parent::NCHILDREN - 1) / Parent::NCHILDREN) {
+    nodeCount += (n + Parent::NCHILDREN - 1) / Parent::NCHILDREN;
+    ++newHeight;
+  }
+
+  if (treeCapacity < nodeCount + newHeight + 2) {
+    // (Leave room for the allocations a subsequent insert() may need.)
+    growTree(nodeCount + newHeight + 2);
+  }
+  clear();
+
+  // The top node of the tree is the root, at position 0. The others are allocated in order after
+  // it, leaving the rest of the array as the freelist.
+  uint next = 1;
+
+  // Node positions and last rows of the level being built, and then of the level below it.
+  Vector<uint> nodes(leafCount);
+  Vector<uint> lastRows(leafCount);
+
+  uint rowPos = 0;
+  uint prevLeaf = 0;
+  for (uint i: kj::zeroTo(leafCount)) {
+    uint n = size / leafCount + (i < size % leafCount);
+    uint pos = leafCount == 1 ? 0 : next++;
+    Leaf& leaf = tree[pos].leaf;
+    for (uint j: kj::zeroTo(n)) {
+      leaf.rows[j] = order[rowPos++];
+    }
+
+    if (i == 0) {
+      beginLeaf = pos;
+    } else {
+      tree[prevLeaf].leaf.next = pos;
+      leaf.prev = prevLeaf;
+    }
+    prevLeaf = pos;
+
+    nodes.add(pos);
+    lastRows.add(order[rowPos - 1]);
+  }
+  endLeaf = prevLeaf;
+
+  Vector<uint> children;
+  Vector<uint> childLastRows;
+  while (nodes.size() > 1) {
+    children = kj::mv(nodes);
+    childLastRows = kj::mv(lastRows);
+
+    uint count = (children.size() + Parent::NCHILDREN - 1) / Parent::NCHILDREN;
+    nodes = Vector<uint>(count);
+    lastRows = Vector<uint>(count);
+
+    uint childPos = 0;
+    for (uint i: kj::zeroTo(count)) {
+      uint n = children.size() / count + (i < children.size() % count);
+      uint pos = count == 1 ? 0 : next++;
+      Parent& parent = tree[pos].parent;
+      for (uint j: kj::zeroTo(n)) {
+        parent.children[j] = children[childPos];
+        if (j + 1 < n) {
+          // The last child's last row is recorded further up, as this node's own last row.
+          parent.keys[j] = childLastRows[childPos];
+        }
+        ++childPos;
+      }
+
+      nodes.add(pos);
+      lastRows.add(childLastRows[childPos - 1]);
+    }
+  }
+
+  KJ_DASSERT(next == nodeCount);
+  height = newHeight;
+  freelistHead = next;
+  freelistSize = treeCapacity - next;
+  return true;
+}
+
 uint BTreeImpl::split(Parent& dst, uint dstPos, Parent& src, uint srcPos) {
   constexpr size_t mid = Parent::NKEYS / 2;
   uint pivot = *src.keys[mid];
@@ -25,6 +25,7 @@
 #include "tuple.h"
 #include "vector.h"
 #include "function.h"
+#include <inttypes.h>
 
 #if _MSC_VER
 // Need _ReadWriteBarrier
@@ -35,6 +36,14 @@
 #endif
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KJ_TABLE_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KJ_TABLE_NEON 1
+#endif
+
 #if KJ_DEBUG_TABLE_IMPL
 #include "debug.h"
 #define KJ_TABLE_IREQUIRE KJ_REQUIRE
@@ -137,6 +146,13 @@ class Table {
   //     Iterator begin() const;
   //     Iterator end() const;
   //     // Optional. Implements Table::ordered<Index>().
+  //
+  //     bool bulkLoad(kj::ArrayPtr<const Row> table);
+  //     // Optional. Called by Table::insertAll() on an empty table, once all the new rows are in
+  //     // place, to index every row of `table` in one go, e.g. by building a tree bottom-up. Returns
+  //     // false if some rows match each other, in which case the table clears the index and
+  //     // inserts the rows one at a time instead. Indexes without this method get their rows
+  //     // inserted one at a time.
   //   };
 
 public:
@@ -172,6 +188,10 @@ public:
   //
   // If an insertion throws (e.g. because it violates a uniqueness constraint of some index),
   // subsequent insertions do not occur, but previous insertions remain inserted.
+  //
+  // If the table is empty, indexes that support it (such as TreeIndex) are built in one pass
+  // over all the rows, which is much faster than inserting rows one at a time. This makes
+  // insertAll() the way to load a snapshot into a table.
 
   template <typename UpdateFunc>
   Row& upsert(Row&& row, UpdateFunc&& update);
@@ -309,6 +329,7 @@ private:
   void eraseImpl(size_t pos);
   template <typename Collection>
   size_t eraseAllImpl(Collection&& collection);
+  void indexAll();
 };
 
 template <typename Callbacks>
@@ -348,6 +369,21 @@ class HashIndex;
 // If your `Callbacks` type has dynamic state, you may pass its constructor parameters as the
 // constructor parameters to `HashIndex`.
 
+template <typename Callbacks>
+class SwissHashIndex;
+// A Table index based on a hash table, laid out like Abseil's "Swiss tables". Takes the same
+// `Callbacks` as `HashIndex`, and can be used in its place.
+//
+// Each slot has a one-byte control tag holding 7 bits of its row's hash code, and tags are kept
+// apart from the slots in groups of 16. A lookup compares the search key's tag against a whole
+// group at once (using SSE2 or NEON where available), so it usually reads one group of tags and
+// then the one slot that matches. In comparison, HashIndex reads a whole bucket per probe, and
+// probes more often as the table fills up. SwissHashIndex is a better choice for big tables that
+// see many lookups; for small tables there is little difference.
+//
+// Like HashIndex, this caches hash codes, only checks equality when hash codes are equal, and is
+// limited to tables of 2^30 rows or less.
+
 template <typename Callbacks>
 class TreeIndex;
 // A Table index based on a B-tree.
@@ -387,6 +423,21 @@ inline void tryReserveSize(Params&&...) {}
 // If `src` has a `.size()` method, call dst.reserve(dst.size() + src.size()).
 // Otherwise, do nothing.
 
+template <typename Index, typename Row>
+inline auto bulkLoadIndex(Index& index, kj::ArrayPtr<Row> table, int)
+    -> decltype(index.bulkLoad(table)) {
+  return index.bulkLoad(table);
+}
+template <typename Index, typename Row>
+inline bool bulkLoadIndex(Index& index, kj::ArrayPtr<Row> table, long) {
+  for (auto pos: kj::indices(table)) {
+    if (index.insert(table, pos, index.keyForRow(table[pos])) != nullptr) return false;
+  }
+  return true;
+}
+// Indexes all rows of `table` with `index.bulkLoad()` if the index has it, otherwise by inserting
+// them one at a time. Returns false if the index found a duplicate.
+
 template <typename Row>
 class TableMapping {
 public:
@@ -470,6 +521,11 @@ public:
     indexObj.move(table.rows.asPtr(), oldPos, newPos, indexObj.keyForRow(row));
     Impl<index + 1>::move(table, oldPos, newPos, row);
   }
+
+  static bool bulkLoad(Table<Row, Indexes...>& table) {
+    return _::bulkLoadIndex(get<index>(table.indexes), table.rows.asPtr(), 0) &&
+        Impl<index + 1>::bulkLoad(table);
+  }
 };
 
 template <typename Row, typename... Indexes>
@@ -483,6 +539,7 @@ public:
   }
   static void erase(Table<Row, Indexes...>& table, size_t pos, Row& row) {}
   static void move(Table<Row, Indexes...>& table, size_t oldPos, size_t newPos, Row& row) {}
+  static bool bulkLoad(Table<Row, Indexes...>& table) { return true; }
 };
 
 template <typename Row, typename... Indexes>
@@ -546,8 +603,15 @@ template <typename Row, typename... Indexes>
 template <typename Collection>
 void Table<Row, Indexes...>::insertAll(Collection&& collection) {
   _::tryReserveSize(*this, collection);
-  for (auto& row: collection) {
-    insert(kj::mv(row));
+  if (rows.size() == 0) {
+    for (auto& row: collection) {
+      rows.add(kj::mv(row));
+    }
+    indexAll();
+  } else {
+    for (auto& row: collection) {
+      insert(kj::mv(row));
+    }
   }
 }
 
@@ -555,8 +619,40 @@ template <typename Row, typename... Indexes>
 template <typename Collection>
 void Table<Row, Indexes...>::insertAll(Collection& collection) {
   _::tryReserveSize(*this, collection);
-  for (auto& row: collection) {
-    insert(row);
+  if (rows.size() == 0) {
+    for (auto& row: collection) {
+      rows.add(row);
+    }
+    indexAll();
+  } else {
+    for (auto& row: collection) {
+      insert(row);
+    }
+  }
+}
+
+template <typename Row, typename... Indexes>
+void Table<Row, Indexes...>::indexAll() {
+  // Indexes all the rows, none of which are indexed yet.
+
+  bool loaded;
+  {
+    bool threw = true;
+    KJ_DEFER(if (threw) clear());
+    loaded = Impl<>::bulkLoad(*this);
+    threw = false;
+  }
+  if (loaded) return;
+
+  // Some rows are duplicates. Start over inserting rows one at a time, so that we stop at the
+  // first duplicate as insert() would, keeping the rows before it.
+  Impl<>::clear(*this);
+  size_t pos = 0;
+  KJ_DEFER(rows.truncate(pos));
+  for (; pos < rows.size(); ++pos) {
+    if (Impl<>::insert(*this, pos, rows[pos], kj::maxValue) != nullptr) {
+      _::throwDuplicateTableRow();
+    }
   }
 }
 
@@ -1031,6 +1127,277 @@ private:
   }
 };
 
+// -----------------------------------------------------------------------------
+// Swiss hash table index
+
+namespace _ {  // private
+
+struct SwissSlot {
+  uint hash;
+  uint pos;
+};
+
+inline uint lowestBit(uint mask) {
+  // Index of the lowest set bit. Undefined for mask = 0.
+#if _MSC_VER && !defined(__clang__)
+  unsigned long i;
+  _BitScanForward(&i, mask);
+  return i;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+class SwissGroup {
+  // A group of control bytes of a SwissHashIndex, which are compared all at once. Matches are
+  // returned as a bitmask with bit `i` set for each matching control byte `i`.
+
+public:
+  static constexpr uint SIZE = 16;
+
+  static constexpr byte EMPTY = 0x80;
+  static constexpr byte ERASED = 0xfe;
+  // Control bytes of slots not holding a row. Those of full slots hold a 7-bit tag, so never
+  // have their top bit set.
+
+  explicit inline SwissGroup(const byte* ctrl)
+#if KJ_TABLE_SSE2
+      : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+#elif KJ_TABLE_NEON
+      : ctrl(vld1q_u8(ctrl)) {}
+#else
+      : ctrl(ctrl) {}
+#endif
+
+  inline uint match(byte tag) const {
+#if KJ_TABLE_SSE2
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#elif KJ_TABLE_NEON
+    return toMask(vceqq_u8(ctrl, vdupq_n_u8(tag)));
+#else
+    uint result = 0;
+    for (uint i = 0; i < SIZE; i++) {
+      result |= uint(ctrl[i] == tag) << i;
+    }
+    return result;
+#endif
+  }
+
+  inline uint matchEmpty() const { return match(EMPTY); }
+
+  inline uint matchAvailable() const {
+    // Matches slots which are empty or erased.
+#if KJ_TABLE_SSE2
+    return _mm_movemask_epi8(ctrl);
+#elif KJ_TABLE_NEON
+    return toMask(vcltzq_s8(vreinterpretq_s8_u8(ctrl)));
+#else
+    uint result = 0;
+    for (uint i = 0; i < SIZE; i++) {
+      result |= uint(ctrl[i] >> 7) << i;
+    }
+    return result;
+#endif
+  }
+
+private:
+#if KJ_TABLE_SSE2
+  __m128i ctrl;
+#elif KJ_TABLE_NEON
+  uint8x16_t ctrl;
+
+  static inline uint toMask(uint8x16_t matches) {
+    // NEON has no movemask, so weight each byte's lanes by its bit and add up each half.
+    static const uint8_t BITS[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(matches, vld1q_u8(BITS));
+    return vaddv_u8(vget_low_u8(bits)) | (uint(vaddv_u8(vget_high_u8(bits))) << 8);
+  }
+#else
+  const byte* ctrl;
+#endif
+};
+
+class SwissHash {
+  // Derives a row's tag and first probed group from its hash code. The hash code is scrambled
+  // first, so that sequential integer hash codes, which are common, don't all land in the same
+  // few groups.
+
+public:
+  explicit inline SwissHash(uint hash): mixed(uint64_t(hash) * 0x9e3779b97f4a7c15ull) {}
+
+  inline byte tag() const { return (mixed >> 30) & 0x7f; }
+  inline size_t group(size_t groupMask) const { return (mixed >> 37) & groupMask; }
+
+private:
+  uint64_t mixed;
+};
+
+size_t swissMaxLoad(size_t capacity);
+// The number of slots, full or erased, that a table of the given capacity may have before it must
+// be rehashed.
+
+void swissRehash(kj::Array<byte>& ctrl, kj::Array<SwissSlot>& slots, size_t targetSize);
+// Reallocates `ctrl` and `slots` with room for at least `targetSize` rows, dropping erased slots.
+// Never shrinks them.
+
+}  // namespace _ (private)
+
+template <typename Callbacks>
+class SwissHashIndex {
+public:
+  SwissHashIndex() = default;
+  template <typename... Params>
+  SwissHashIndex(Params&&... params): cb(kj::fwd<Params>(params)...) {}
+
+  size_t capacity() {
+    // This method is for testing.
+    return slots.size();
+  }
+
+  void reserve(size_t size) {
+    if (_::swissMaxLoad(slots.size()) < size) {
+      rehash(size);
+    }
+  }
+
+  void clear() {
+    erasedCount = 0;
+    memset(ctrl.begin(), _::SwissGroup::EMPTY, ctrl.size());
+  }
+
+  template <typename Row>
+  decltype(auto) keyForRow(Row&& row) const {
+    return cb.keyForRow(kj::fwd<Row>(row));
+  }
+
+  template <typename Row, typename... Params>
+  kj::Maybe<size_t> insert(kj::ArrayPtr<Row> table, size_t pos, Params&&... params) {
+    if (_::swissMaxLoad(slots.size()) < table.size() + 1 + erasedCount) {
+      // Double the size, or, if there are many erased slots, maybe just clean them up. Either way
+      // it will take O(table.size()) more insertions to get here again.
+      rehash((table.size() + 1) * 2);
+    }
+
+    uint hashCode = cb.hashCode(params...);
+    _::SwissHash hash(hashCode);
+    size_t groupMask = slots.size() / _::SwissGroup::SIZE - 1;
+    Maybe<size_t> available;
+    for (size_t g = hash.group(groupMask), step = 0;; g = (g + ++step) & groupMask) {
+      size_t base = g * _::SwissGroup::SIZE;
+      _::SwissGroup group(ctrl.begin() + base);
+      for (uint m = group.match(hash.tag()); m != 0; m &= m - 1) {
+        auto& slot = slots[base + _::lowestBit(m)];
+        if (slot.hash == hashCode && cb.matches(table[slot.pos], params...)) {
+          // duplicate row
+          return size_t(slot.pos);
+        }
+      }
+
+      if (available == nullptr) {
+        // We can fill in the first empty or erased slot we see. However, we have to keep
+        // searching until we see an empty slot to make sure there are no duplicates.
+        uint m = group.matchAvailable();
+        if (m != 0) available = base + _::lowestBit(m);
+      }
+
+      if (group.matchEmpty() != 0) break;
+    }
+
+    // The group we stopped at has an empty slot, so `available` has been set.
+    size_t i = kj::mv(available).orDefault(0);
+    if (ctrl[i] == _::SwissGroup::ERASED) --erasedCount;
+    ctrl[i] = hash.tag();
+    slots[i] = { hashCode, uint(pos) };
+    return nullptr;
+  }
+
+  template <typename Row, typename... Params>
+  void erase(kj::ArrayPtr<Row> table, size_t pos, Params&&... params) {
+    KJ_IF_MAYBE(i, findSlot(cb.hashCode(params...), pos)) {
+      // Lookups stop at the first group with an empty slot. If this group already has one, then
+      // no lookup goes past it, so this slot can become empty too. Otherwise, it must be marked
+      // erased so that lookups keep going.
+      size_t base = *i - *i % _::SwissGroup::SIZE;
+      if (_::SwissGroup(ctrl.begin() + base).matchEmpty() != 0) {
+        ctrl[*i] = _::SwissGroup::EMPTY;
+      } else {
+        ctrl[*i] = _::SwissGroup::ERASED;
+        ++erasedCount;
+      }
+    } else {
+      // can't find the slot, something is very wrong
+      _::logHashTableInconsistency();
+    }
+  }
+
+  template <typename Row, typename... Params>
+  void move(kj::ArrayPtr<Row> table, size_t oldPos, size_t newPos, Params&&... params) {
+    KJ_IF_MAYBE(i, findSlot(cb.hashCode(params...), oldPos)) {
+      slots[*i].pos = uint(newPos);
+    } else {
+      // can't find the slot, something is very wrong
+      _::logHashTableInconsistency();
+    }
+  }
+
+  template <typename Row, typename... Params>
+  Maybe<size_t> find(kj::ArrayPtr<Row> table, Params&&... params) const {
+    if (slots.size() == 0) return nullptr;
+
+    uint hashCode = cb.hashCode(params...);
+    _::SwissHash hash(hashCode);
+    size_t groupMask = slots.size() / _::SwissGroup::SIZE - 1;
+    for (size_t g = hash.group(groupMask), step = 0;; g = (g + ++step) & groupMask) {
+      size_t base = g * _::SwissGroup::SIZE;
+      _::SwissGroup group(ctrl.begin() + base);
+      for (uint m = group.match(hash.tag()); m != 0; m &= m - 1) {
+        auto& slot = slots[base + _::lowestBit(m)];
+        if (slot.hash == hashCode && cb.matches(table[slot.pos], params...)) {
+          // found
+          return size_t(slot.pos);
+        }
+      }
+
+      if (group.matchEmpty() != 0) {
+        // not found.
+        return nullptr;
+      }
+    }
+  }
+
+  // No begin() nor end() because hash tables are not usefully ordered.
+
+private:
+  Callbacks cb;
+  size_t erasedCount = 0;
+  Array<byte> ctrl;
+  Array<_::SwissSlot> slots;
+  // `ctrl` has one control byte per slot. The table has a power-of-two number of groups, probed
+  // in triangular order (g, g+1, g+3, g+6, ...), which visits every group.
+
+  Maybe<size_t> findSlot(uint hashCode, size_t pos) const {
+    if (slots.size() == 0) return nullptr;
+
+    _::SwissHash hash(hashCode);
+    size_t groupMask = slots.size() / _::SwissGroup::SIZE - 1;
+    for (size_t g = hash.group(groupMask), step = 0;; g = (g + ++step) & groupMask) {
+      size_t base = g * _::SwissGroup::SIZE;
+      _::SwissGroup group(ctrl.begin() + base);
+      for (uint m = group.match(hash.tag()); m != 0; m &= m - 1) {
+        size_t i = base + _::lowestBit(m);
+        if (slots[i].pos == pos) return i;
+      }
+
+      if (group.matchEmpty() != 0) return nullptr;
+    }
+  }
+
+  void rehash(size_t targetSize) {
+    _::swissRehash(ctrl, slots, targetSize);
+    erasedCount = 0;
+  }
+};
+
 // -----------------------------------------------------------------------------
 // BTree index
 
@@ -1114,6 +1481,12 @@ public:
   // Renumber the given row from oldRow to newRow. searchKey.isAfter() returns true for oldRow and
   // all rows after it. (It will not be called on newRow.)
 
+  bool bulkLoad(size_t size, FunctionParam<bool(uint, uint)> isBefore);
+  // Replace the tree's contents with rows 0 through size - 1, building it bottom-up from full
+  // nodes. isBefore(i, j) returns true if row i sorts before row j. Rows already in order are
+  // detected in one pass and not sorted again. Returns false, leaving the tree empty, if two rows
+  // are equal (neither sorts before the other).
+
   void verify(size_t size, FunctionParam<bool(uint, uint)>);
 
 private:
@@ -1508,6 +1881,13 @@ public:
     return impl.search(searchKey(table, params...));
   }
 
+  template <typename Row>
+  bool bulkLoad(kj::ArrayPtr<Row> table) {
+    return impl.bulkLoad(table.size(), [&](uint i, uint j) {
+      return cb.isBefore(table[i], cb.keyForRow(table[j]));
+    });
+  }
+
 private:
   Callbacks cb;
   _::BTreeImpl impl;
@@ -120,5 +120,62 @@ KJ_TEST("threads pick up exception callback initializer") {
   KJ_EXPECT(context.captured == "foobar", context.captured);
 }
 
+KJ_TEST("CpuSet") {
+  CpuSet set = { 1, 3, 64 };
+  KJ_EXPECT(set.size() == 3);
+  KJ_EXPECT(set.contains(3));
+  KJ_EXPECT(set.contains(64));
+  KJ_EXPECT(!set.contains(2));
+  KJ_EXPECT(!set.contains(CpuSet::MAX_CPUS));
+
+  KJ_EXPECT(KJ_ASSERT_NONNULL(CpuSet::parse("0-3,8,10-11\n")) ==
+            CpuSet({ 0, 1, 2, 3, 8, 10, 11 }));
+  KJ_EXPECT(KJ_ASSERT_NONNULL(CpuSet::parse("")).empty());
+  KJ_EXPECT(CpuSet::parse("3-1") == nullptr);
+  KJ_EXPECT(CpuSet::parse("1,,2") == nullptr);
+  KJ_EXPECT(CpuSet::parse("1-") == nullptr);
+  KJ_EXPECT(CpuSet::parse("99999") == nullptr);
+}
+
+#if __linux__
+KJ_TEST("Thread placement") {
+  auto allowed = CpuSet::forCurrentThread();
+  KJ_ASSERT(!allowed.empty());
+  uint cpu = 0;
+  while (!allowed.contains(cpu)) ++cpu;
+
+  CpuSet seen;
+  Thread::Placement placement;
+  placement.cpus = CpuSet { cpu };
+  Thread([&]() {
+    seen = CpuSet::forCurrentThread();
+  }, placement);
+  KJ_EXPECT(seen == CpuSet { cpu });
+
+  // Placing on a NUMA node pins to the node's CPUs, if the system tells us what they are.
+  KJ_IF_MAYBE(node, getCurrentNumaNode()) {
+    auto nodeCpus = CpuSet::forNumaNode(*node);
+    Thread::Placement nodePlacement;
+    nodePlacement.numaNode = *node;
+    Maybe<uint> seenNode;
+    Thread([&]() {
+      seen = CpuSet::forCurrentThread();
+      seenNode = getCurrentNumaNode();
+    }, nodePlacement);
+    if (!nodeCpus.empty()) {
+      KJ_EXPECT(seen == nodeCpus);
+      KJ_EXPECT(seenNode == *node);
+    }
+  }
+
+  // A placement that can't be applied is reported like any other failure in the thread.
+  bool ran = false;
+  Thread::Placement badPlacement;
+  badPlacement.cpus = CpuSet();
+  KJ_EXPECT_THROW_MESSAGE("empty CpuSet", Thread([&]() { ran = true; }, badPlacement));
+  KJ_EXPECT(!ran);
+}
+#endif
+
 }  // namespace
 }  // namespace kj
@@ -30,11 +30,162 @@
 #include <signal.h>
 #endif
 
+#if __linux__
+#include "io.h"
+#include <sched.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
 namespace kj {
 
+CpuSet::CpuSet(std::initializer_list<uint> cpus) {
+  for (uint cpu: cpus) add(cpu);
+}
+
+void CpuSet::add(uint cpu) {
+  KJ_REQUIRE(cpu < MAX_CPUS, "CPU number out of range", cpu);
+  words[cpu / 64] |= uint64_t(1) << (cpu % 64);
+}
+
+bool CpuSet::contains(uint cpu) const {
+  return cpu < MAX_CPUS && (words[cpu / 64] & (uint64_t(1) << (cpu % 64))) != 0;
+}
+
+uint CpuSet::size() const {
+  uint result = 0;
+  for (auto word: words) {
+    for (; word != 0; word &= word - 1) ++result;
+  }
+  return result;
+}
+
+bool CpuSet::operator==(const CpuSet& other) const {
+  for (auto i: kj::indices(words)) {
+    if (words[i] != other.words[i]) return false;
+  }
+  return true;
+}
+
+Maybe<CpuSet> CpuSet::parse(StringPtr list) {
+  CpuSet result;
+  const char* pos = list.begin();
+  const char* end = list.end();
+
+  // The kernel ends its lists with a newline.
+  while (end > pos && (end[-1] == '\n' || end[-1] == ' ')) --end;
+  if (pos == end) return result;
+
+  auto parseNumber = [&]() -> Maybe<uint> {
+    if (pos == end || *pos < '0' || *pos > '9') return nullptr;
+    uint n = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+      n = n * 10 + (*pos++ - '0');
+      if (n >= MAX_CPUS) return nullptr;
+    }
+    return n;
+  };
+
+  for (;;) {
+    uint first, last;
+    KJ_IF_MAYBE(n, parseNumber()) { first = last = *n; } else { return nullptr; }
+    if (pos < end && *pos == '-') {
+      ++pos;
+      KJ_IF_MAYBE(n, parseNumber()) { last = *n; } else { return nullptr; }
+      if (last < first) return nullptr;
+    }
+    for (uint cpu = first; cpu <= last; cpu++) result.add(cpu);
+
+    if (pos == end) return result;
+    if (*pos++ != ',') return nullptr;
+  }
+}
+
+#if __linux__
+
+CpuSet CpuSet::forNumaNode(uint node) {
+  int fd = open(kj::str("/sys/devices/system/node/node", node, "/cpulist").cStr(),
+                O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return CpuSet();
+  AutoCloseFd ownFd(fd);
+  return parse(FdInputStream(kj::mv(ownFd)).readAllText()).orDefault(CpuSet());
+}
+
+CpuSet CpuSet::forCurrentThread() {
+  cpu_set_t allowed;
+  KJ_SYSCALL(sched_getaffinity(0, sizeof(allowed), &allowed));
+  CpuSet result;
+  for (uint cpu = 0; cpu < CPU_SETSIZE && cpu < MAX_CPUS; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) result.add(cpu);
+  }
+  return result;
+}
+
+Maybe<uint> getCurrentNumaNode() {
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0) return nullptr;
+  return uint(node);
+}
+
+void Thread::place(const Placement& placement) {
+  CpuSet cpus;
+  KJ_IF_MAYBE(c, placement.cpus) {
+    cpus = *c;
+  } else KJ_IF_MAYBE(node, placement.numaNode) {
+    cpus = CpuSet::forNumaNode(*node);
+  }
+
+  if (!cpus.empty()) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (uint cpu = 0; cpu < CPU_SETSIZE && cpu < CpuSet::MAX_CPUS; cpu++) {
+      if (cpus.contains(cpu)) CPU_SET(cpu, &mask);
+    }
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    if (error != 0) {
+      KJ_FAIL_SYSCALL("pthread_setaffinity_np", error);
+    }
+  } else {
+    KJ_REQUIRE(placement.cpus == nullptr, "can't pin a thread to an empty CpuSet");
+  }
+
+  KJ_IF_MAYBE(node, placement.numaNode) {
+    constexpr int MPOL_PREFERRED = 1;  // from <linux/mempolicy.h>
+    constexpr uint BITS = sizeof(unsigned long) * 8;
+    unsigned long nodes[CpuSet::MAX_CPUS / BITS] = {};
+    KJ_REQUIRE(*node < CpuSet::MAX_CPUS, "NUMA node number out of range", *node);
+    nodes[*node / BITS] = 1ul << (*node % BITS);
+
+    // The kernel ignores the last bit of `maxnode`, hence the + 1.
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, sizeof(nodes) * 8 + 1) < 0) {
+      int error = errno;
+      // ENOSYS means the kernel was built without NUMA support, so all memory is local anyway.
+      if (error != ENOSYS) {
+        KJ_FAIL_SYSCALL("set_mempolicy", error, *node);
+      }
+    }
+  }
+}
+
+#else  // __linux__
+
+CpuSet CpuSet::forNumaNode(uint) { return CpuSet(); }
+CpuSet CpuSet::forCurrentThread() { return CpuSet(); }
+Maybe<uint> getCurrentNumaNode() { return nullptr; }
+void Thread::place(const Placement&) {}
+
+#endif  // __linux__, else
+
+Thread::Thread(Function<void()> func)
+    : Thread(kj::mv(func), Maybe<Placement>(nullptr)) {}
+Thread::Thread(Function<void()> func, Placement placement)
+    : Thread(kj::mv(func), Maybe<Placement>(kj::mv(placement))) {}
+
 #if _WIN32
 
-Thread::Thread(Function<void()> func): state(new ThreadState(kj::mv(func))) {
+Thread::Thread(Function<void()> func, Maybe<Placement>&& placement)
+    : state(new ThreadState(kj::mv(func), kj::mv(placement))) {
   threadHandle = CreateThread(nullptr, 0, &runThread, state, 0, nullptr);
   if (threadHandle == nullptr) {
     state->unref();
@@ -63,7 +214,8 @@ void Thread::detach() {
 
 #else  // _WIN32
 
-Thread::Thread(Function<void()> func): state(new ThreadState(kj::mv(func))) {
+Thread::Thread(Function<void()> func, Maybe<Placement>&& placement)
+    : state(new ThreadState(kj::mv(func), kj::mv(placement))) {
   static_assert(sizeof(threadId) >= sizeof(pthread_t),
                 "pthread_t is larger than a long long on your platform.  Please port.");
 
@@ -110,8 +262,9 @@ void Thread::detach() {
 
 #endif  // _WIN32, else
 
-Thread::ThreadState::ThreadState(Function<void()> func)
+Thread::ThreadState::ThreadState(Function<void()> func, Maybe<Placement> placement)
     : func(kj::mv(func)),
+      placement(kj::mv(placement)),
       initializer(getExceptionCallback().getThreadInitializer()),
       exception(nullptr),
       refcount(2) {}
@@ -146,6 +299,9 @@ void* Thread::runThread(void* ptr) {
 #endif
   ThreadState* state = reinterpret_cast<ThreadState*>(ptr);
   KJ_IF_MAYBE(exception, kj::runCatchingExceptions([&]() {
+    KJ_IF_MAYBE(placement, state->placement) {
+      place(*placement);
+    }
     state->initializer(kj::mv(state->func));
   })) {
     state->exception = kj::mv(*exception);
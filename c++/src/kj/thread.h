@@ -24,20 +24,81 @@
 #include "common.h"
 #include "function.h"
 #include "exception.h"
+#include <initializer_list>
+#include <stdint.h>
 
 KJ_BEGIN_HEADER
 
 namespace kj {
 
+class CpuSet {
+  // A set of logical CPU numbers, for pinning threads (see `Thread::Placement`).
+
+public:
+  static constexpr uint MAX_CPUS = 1024;
+
+  CpuSet() = default;
+  CpuSet(std::initializer_list<uint> cpus);
+
+  void add(uint cpu);
+  bool contains(uint cpu) const;
+  uint size() const;
+  bool empty() const { return size() == 0; }
+
+  bool operator==(const CpuSet& other) const;
+  bool operator!=(const CpuSet& other) const { return !(*this == other); }
+
+  static Maybe<CpuSet> parse(StringPtr list);
+  // Parses a list in the kernel's format, like "0-3,8,10-11". Returns null if it's malformed.
+
+  static CpuSet forNumaNode(uint node);
+  // The CPUs of the given NUMA node, or an empty set if that's unknown (including on non-Linux
+  // systems).
+
+  static CpuSet forCurrentThread();
+  // The CPUs the calling thread is allowed to run on, or an empty set on non-Linux systems.
+
+private:
+  uint64_t words[MAX_CPUS / 64] = {};
+};
+
+Maybe<uint> getCurrentNumaNode();
+// The NUMA node of the CPU the calling thread is running on right now, or null if unknown
+// (including on non-Linux systems). Unless the thread is pinned to the node, it may have moved by
+// the time you look at the result.
+
 class Thread {
   // A thread!  Pass a lambda to the constructor, and it runs in the thread.  The destructor joins
   // the thread.  If the function throws an exception, it is rethrown from the thread's destructor
   // (if not unwinding from another exception).
 
 public:
+  struct Placement {
+    // Where a thread runs, and where its memory comes from. Only implemented on Linux; ignored
+    // elsewhere.
+    //
+    // Pinning the threads that run event loops to one socket of a multi-socket machine keeps
+    // their `Executor` hops, and the memory those hops touch, from crossing sockets.
+
+    Maybe<CpuSet> cpus;
+    // Run only on these CPUs.
+
+    Maybe<uint> numaNode;
+    // Prefer this node's memory when the kernel supplies fresh pages to the process on this
+    // thread's behalf, which covers the message segments and arenas the thread allocates. Unless
+    // `cpus` is also given, also run only on the node's CPUs.
+  };
+
   explicit Thread(Function<void()> func);
+  Thread(Function<void()> func, Placement placement);
+  // Starts the thread with the given placement. If it can't be applied, the thread doesn't run
+  // `func`, and the error is rethrown from the destructor like any other exception in the thread.
   KJ_DISALLOW_COPY(Thread);
 
+  static void place(const Placement& placement);
+  // Applies `placement` to the calling thread, e.g. one that was started some other way before
+  // it goes on to run an event loop.
+
   ~Thread() noexcept(false);
 
 #if !_WIN32
@@ -49,10 +110,13 @@ public:
   // Don't join the thread in ~Thread().
 
 private:
+  Thread(Function<void()> func, Maybe<Placement>&& placement);
+
   struct ThreadState {
-    ThreadState(Function<void()> func);
+    ThreadState(Function<void()> func, Maybe<Placement> placement);
 
     Function<void()> func;
+    Maybe<Placement> placement;
     Function<void(Function<void()>)> initializer;
     kj::Maybe<kj::Exception> exception;
 
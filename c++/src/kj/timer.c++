@@ -22,6 +22,7 @@
 
 #include "timer.h"
 #include "debug.h"
+#include "list.h"
 #include <set>
 
 namespace kj {
@@ -30,44 +31,262 @@ kj::Exception Timer::makeTimeoutException() {
   return KJ_EXCEPTION(OVERLOADED, "operation timed out");
 }
 
-struct TimerImpl::Impl {
-  struct TimerBefore {
-    bool operator()(TimerPromiseAdapter* lhs, TimerPromiseAdapter* rhs) const;
-  };
-  using Timers = std::multiset<TimerPromiseAdapter*, TimerBefore>;
-  Timers timers;
-};
-
 class TimerImpl::TimerPromiseAdapter {
 public:
-  TimerPromiseAdapter(PromiseFulfiller<void>& fulfiller, TimerImpl::Impl& impl, TimePoint time)
-      : time(time), fulfiller(fulfiller), impl(impl) {
-    pos = impl.timers.insert(this);
-  }
+  TimerPromiseAdapter(PromiseFulfiller<void>& fulfiller, TimerImpl::Impl& impl, TimePoint time);
+  ~TimerPromiseAdapter();
 
-  ~TimerPromiseAdapter() {
-    if (pos != impl.timers.end()) {
-      impl.timers.erase(pos);
-    }
-  }
-
-  void fulfill() {
-    fulfiller.fulfill();
-    impl.timers.erase(pos);
-    pos = impl.timers.end();
-  }
+  void fulfill();
 
   const TimePoint time;
 
+  struct Before {
+    bool operator()(TimerPromiseAdapter* lhs, TimerPromiseAdapter* rhs) const {
+      return lhs->time < rhs->time;
+    }
+  };
+  using Timers = std::multiset<TimerPromiseAdapter*, Before>;
+
 private:
   PromiseFulfiller<void>& fulfiller;
   TimerImpl::Impl& impl;
-  Impl::Timers::const_iterator pos;
+
+  Timers::const_iterator pos;
+  // Position in Impl::timers, if the timer wheel is not in use. If the timer is not in the set,
+  // this is Impl::timers.end().
+
+  ListLink<TimerPromiseAdapter> link;
+  uint wheelLevel = 0;
+  uint wheelSlot = 0;
+  // Position in the timer wheel, if in use.
+
+  friend struct TimerImpl::Impl;
+};
+
+struct TimerImpl::Impl {
+  TimerPromiseAdapter::Timers timers;
+  // Timers ordered by time, used unless the wheel is enabled.
+
+  class Wheel {
+    // A hierarchical timer wheel, offering O(1) insertion and removal of timers. Time is divided
+    // into ticks of `resolution`; each level of the wheel has SLOTS slots, where a slot at level
+    // L covers SLOTS^L ticks. A timer is placed in the lowest level whose span reaches its tick,
+    // and as time advances past each slot boundary at a higher level, the slot's timers are
+    // redistributed ("cascaded") to lower levels. Most timers are canceled long before they
+    // cascade more than once, so the cost of maintaining them is essentially constant.
+    //
+    // Timers do not fire early: a timer in a level-0 slot is only fired once the current time has
+    // actually reached its exact deadline. However, timers that fall into the same tick are fired
+    // in the order that they were created, rather than strictly in time order.
+
+  public:
+    Wheel(TimePoint origin, Duration resolution): origin(origin), resolution(resolution) {
+      KJ_REQUIRE(resolution > 0 * NANOSECONDS, "timer wheel resolution must be positive");
+    }
+
+    ~Wheel() noexcept(false) {
+      // Unlink everything left so that ListLink doesn't complain. Any remaining adapters belong
+      // to promises that have outlived the timer, which is already a bug elsewhere.
+      for (auto& level: slots) {
+        for (auto& slot: level) {
+          for (auto& timer: slot) {
+            slot.remove(timer);
+          }
+        }
+      }
+    }
+
+    void insert(TimerPromiseAdapter& timer) {
+      uint64_t tick = kj::max(tickOf(timer.time), currentTick);
+
+      uint level = 0;
+      while (level < LEVELS - 1 &&
+             (tick >> (SLOT_BITS * level)) - (currentTick >> (SLOT_BITS * level)) >= SLOTS) {
+        ++level;
+      }
+
+      uint slot = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+      timer.wheelLevel = level;
+      timer.wheelSlot = slot;
+      slots[level][slot].add(timer);
+      occupied[level] |= uint64_t(1) << slot;
+    }
+
+    void remove(TimerPromiseAdapter& timer) {
+      auto& slot = slots[timer.wheelLevel][timer.wheelSlot];
+      slot.remove(timer);
+      if (slot.empty()) {
+        occupied[timer.wheelLevel] &= ~(uint64_t(1) << timer.wheelSlot);
+      }
+    }
+
+    Maybe<TimePoint> nextEvent() {
+      // Returns the exact time of the earliest timer in level 0, unless some higher-level slot
+      // is due to be cascaded before then, in which case returns the time of that cascade. That
+      // is never later than any timer in the slot, so the caller will at worst wake up, find
+      // nothing to fire, and ask again.
+
+      Maybe<TimePoint> result;
+      KJ_IF_MAYBE(d, nextOccupied(0, true)) {
+        for (auto& timer: slots[0][(currentTick + *d) & (SLOTS - 1)]) {
+          KJ_IF_MAYBE(r, result) {
+            if (timer.time < *r) *r = timer.time;
+          } else {
+            result = timer.time;
+          }
+        }
+      }
+
+      KJ_IF_MAYBE(tick, nextCascade()) {
+        TimePoint cascadeTime = timeOf(*tick);
+        KJ_IF_MAYBE(r, result) {
+          if (cascadeTime < *r) *r = cascadeTime;
+        } else {
+          result = cascadeTime;
+        }
+      }
+
+      return result;
+    }
+
+    void advanceTo(TimePoint time) {
+      uint64_t targetTick = tickOf(time);
+
+      for (;;) {
+        // Fire whatever is due in the current tick.
+        auto& slot = slots[0][currentTick & (SLOTS - 1)];
+        for (auto& timer: slot) {
+          if (timer.time <= time) {
+            timer.fulfill();
+          }
+        }
+
+        if (currentTick >= targetTick) break;
+
+        // Skip ahead to the next tick in which anything at all happens: either a level-0 slot
+        // holds timers, or a higher-level slot needs to be cascaded.
+        uint64_t nextTick = targetTick;
+        KJ_IF_MAYBE(d, nextOccupied(0, false)) {
+          nextTick = kj::min(nextTick, currentTick + *d);
+        }
+        KJ_IF_MAYBE(tick, nextCascade()) {
+          nextTick = kj::min(nextTick, *tick);
+        }
+        currentTick = nextTick;
+
+        // Cascade from the top down, so that timers moved out of a higher level can land in a
+        // lower-level slot that is itself about to be cascaded.
+        for (uint level = LEVELS - 1; level > 0; --level) {
+          uint64_t mask = (uint64_t(1) << (SLOT_BITS * level)) - 1;
+          if ((currentTick & mask) == 0) {
+            cascade(level, (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+          }
+        }
+      }
+    }
+
+  private:
+    static constexpr uint SLOT_BITS = 6;
+    static constexpr uint SLOTS = 1u << SLOT_BITS;
+    static constexpr uint LEVELS = (64 + SLOT_BITS - 1) / SLOT_BITS;
+    // Enough levels to cover every possible 64-bit tick count.
+
+    TimePoint origin;
+    Duration resolution;
+    uint64_t currentTick = 0;
+
+    uint64_t occupied[LEVELS] = {};
+    // Bitmap of non-empty slots at each level.
+
+    List<TimerPromiseAdapter, &TimerPromiseAdapter::link> slots[LEVELS][SLOTS];
+
+    uint64_t tickOf(TimePoint time) const {
+      return time <= origin ? 0 : (time - origin) / resolution;
+    }
+
+    TimePoint timeOf(uint64_t tick) const {
+      return origin + tick * resolution;
+    }
+
+    Maybe<uint> nextOccupied(uint level, bool includeCurrent) const {
+      // Finds the distance, in level-`level` slots, from the current slot to the next occupied
+      // one. The current slot counts as distance 0 if `includeCurrent`, or otherwise as distance
+      // SLOTS (a full rotation).
+
+      uint64_t bits = occupied[level];
+      if (bits == 0) return nullptr;
+
+      uint start = ((currentTick >> (SLOT_BITS * level)) + !includeCurrent) & (SLOTS - 1);
+      uint64_t rotated = start == 0 ? bits : (bits >> start) | (bits << (SLOTS - start));
+      return __builtin_ctzll(rotated) + !includeCurrent;
+    }
+
+    Maybe<uint64_t> nextCascade() const {
+      // Finds the earliest future tick at which some non-empty higher-level slot is cascaded.
+
+      Maybe<uint64_t> result;
+      for (uint level = 1; level < LEVELS; level++) {
+        KJ_IF_MAYBE(d, nextOccupied(level, false)) {
+          uint shift = SLOT_BITS * level;
+          uint64_t tick = ((currentTick >> shift) + *d) << shift;
+          KJ_IF_MAYBE(r, result) {
+            if (tick < *r) *r = tick;
+          } else {
+            result = tick;
+          }
+        }
+      }
+      return result;
+    }
+
+    void cascade(uint level, uint slotIndex) {
+      auto& slot = slots[level][slotIndex];
+      for (auto& timer: slot) {
+        slot.remove(timer);
+        insert(timer);
+      }
+      occupied[level] &= ~(uint64_t(1) << slotIndex);
+    }
+  };
+
+  Maybe<Own<Wheel>> wheel;
+
+  // Once the wheel is enabled, it holds all timers and `timers` stays empty, so each adapter's
+  // `pos` is only meaningful while `wheel` is null.
+
+  void add(TimerPromiseAdapter& timer) {
+    KJ_IF_MAYBE(w, wheel) {
+      w->get()->insert(timer);
+    } else {
+      timer.pos = timers.insert(&timer);
+    }
+  }
+
+  void remove(TimerPromiseAdapter& timer) {
+    KJ_IF_MAYBE(w, wheel) {
+      if (timer.link.isLinked()) {
+        w->get()->remove(timer);
+      }
+    } else if (timer.pos != timers.end()) {
+      timers.erase(timer.pos);
+      timer.pos = timers.end();
+    }
+  }
 };
 
-inline bool TimerImpl::Impl::TimerBefore::operator()(
-    TimerPromiseAdapter* lhs, TimerPromiseAdapter* rhs) const {
-  return lhs->time < rhs->time;
+TimerImpl::TimerPromiseAdapter::TimerPromiseAdapter(
+    PromiseFulfiller<void>& fulfiller, TimerImpl::Impl& impl, TimePoint time)
+    : time(time), fulfiller(fulfiller), impl(impl) {
+  impl.add(*this);
+}
+
+TimerImpl::TimerPromiseAdapter::~TimerPromiseAdapter() {
+  impl.remove(*this);
+}
+
+void TimerImpl::TimerPromiseAdapter::fulfill() {
+  fulfiller.fulfill();
+  impl.remove(*this);
 }
 
 Promise<void> TimerImpl::atTime(TimePoint time) {
@@ -83,7 +302,22 @@ TimerImpl::TimerImpl(TimePoint startTime)
 
 TimerImpl::~TimerImpl() noexcept(false) {}
 
+void TimerImpl::useTimerWheel(Duration resolution) {
+  if (impl->wheel != nullptr) return;
+
+  auto wheel = kj::heap<Impl::Wheel>(time, resolution);
+  for (auto timer: impl->timers) {
+    wheel->insert(*timer);
+  }
+  impl->timers.clear();
+  impl->wheel = kj::mv(wheel);
+}
+
 Maybe<TimePoint> TimerImpl::nextEvent() {
+  KJ_IF_MAYBE(w, impl->wheel) {
+    return w->get()->nextEvent();
+  }
+
   auto iter = impl->timers.begin();
   if (iter == impl->timers.end()) {
     return nullptr;
@@ -113,6 +347,12 @@ void TimerImpl::advanceTo(TimePoint newTime) {
   KJ_REQUIRE(newTime >= time, "can't advance backwards in time") { return; }
 
   time = newTime;
+
+  KJ_IF_MAYBE(w, impl->wheel) {
+    w->get()->advanceTo(time);
+    return;
+  }
+
   for (;;) {
     auto front = impl->timers.begin();
     if (front == impl->timers.end() || (*front)->time > time) {
@@ -108,6 +108,18 @@ public:
   void advanceTo(TimePoint newTime);
   // Set the time to `time` and fire any at() events that have been passed.
 
+  void useTimerWheel(Duration resolution = 1 * MILLISECONDS);
+  // Switch to tracking timers in a hierarchical timer wheel with the given tick resolution,
+  // rather than in a sorted tree. This makes creating and canceling a timer O(1) instead of
+  // O(log n), which matters for programs that keep very large numbers of timeouts pending, most of
+  // which are canceled before they fire (e.g. idle timeouts on many connections). Timers still
+  // fire no earlier than requested, but timers scheduled within the same tick fire in the order
+  // they were created rather than strictly in time order. Also, nextEvent() may report a time
+  // somewhat before the next timer actually fires, when the wheel needs to reorganize itself at
+  // that time.
+  //
+  // Any existing timers are moved into the wheel. Once enabled, the wheel cannot be disabled.
+
   // implements Timer ----------------------------------------------------------
   TimePoint now() const override;
   Promise<void> atTime(TimePoint time) override;
@@ -148,6 +148,167 @@ inline auto KJ_STRINGIFY(const Vector<T>& v) -> decltype(toCharSequence(v.asPtr(
   return toCharSequence(v.asPtr());
 }
 
+template <typename T, size_t inlineCapacity>
+class SmallVector {
+  // Like Vector<T>, but with space for `inlineCapacity` elements inside the object itself, so
+  // building a small array -- the common case on many hot paths -- doesn't touch the heap at all.
+  // Once more elements are added, the contents move to the heap and it behaves like Vector.
+  //
+  // Because the elements may live inline, moving a SmallVector moves each element (unless they're
+  // on the heap), and pointers into it are invalidated by moves as well as by growth.
+
+  static_assert(inlineCapacity > 0, "use Vector<T> if you don't want inline storage");
+
+public:
+  inline SmallVector(): builder(inlineBuilder()) {}
+  inline SmallVector(Array<T>&& array)
+      : builder(array == nullptr ? inlineBuilder() : ArrayBuilder<T>(kj::mv(array))) {}
+  // An empty array has no capacity to grow from, so it's replaced by the inline space.
+  inline SmallVector(SmallVector&& other): builder(inlineBuilder()) { take(other); }
+  KJ_DISALLOW_COPY(SmallVector);
+
+  inline SmallVector& operator=(SmallVector&& other) {
+    builder = inlineBuilder();
+    take(other);
+    return *this;
+  }
+
+  inline operator ArrayPtr<T>() KJ_LIFETIMEBOUND { return builder; }
+  inline operator ArrayPtr<const T>() const KJ_LIFETIMEBOUND { return builder; }
+  inline ArrayPtr<T> asPtr() KJ_LIFETIMEBOUND { return builder.asPtr(); }
+  inline ArrayPtr<const T> asPtr() const KJ_LIFETIMEBOUND { return builder.asPtr(); }
+
+  inline size_t size() const { return builder.size(); }
+  inline bool empty() const { return size() == 0; }
+  inline size_t capacity() const { return builder.capacity(); }
+  inline bool isInline() const { return builder.begin() == inlineSpace(); }
+  inline T& operator[](size_t index) KJ_LIFETIMEBOUND { return builder[index]; }
+  inline const T& operator[](size_t index) const KJ_LIFETIMEBOUND { return builder[index]; }
+
+  inline const T* begin() const KJ_LIFETIMEBOUND { return builder.begin(); }
+  inline const T* end() const KJ_LIFETIMEBOUND { return builder.end(); }
+  inline const T& front() const KJ_LIFETIMEBOUND { return builder.front(); }
+  inline const T& back() const KJ_LIFETIMEBOUND { return builder.back(); }
+  inline T* begin() KJ_LIFETIMEBOUND { return builder.begin(); }
+  inline T* end() KJ_LIFETIMEBOUND { return builder.end(); }
+  inline T& front() KJ_LIFETIMEBOUND { return builder.front(); }
+  inline T& back() KJ_LIFETIMEBOUND { return builder.back(); }
+
+  inline Array<T> releaseAsArray() {
+    // Inline contents have to be moved to the heap first; heap contents are handed over as-is if
+    // the capacity is fully used, like Vector.
+    if (isInline() || !builder.isFull()) {
+      if (empty()) {
+        builder.clear();
+        return nullptr;
+      }
+      setCapacity(size());
+    }
+    Array<T> result = builder.finish();
+    builder = inlineBuilder();
+    return result;
+  }
+
+  template <typename U>
+  inline bool operator==(const U& other) const { return asPtr() == other; }
+  template <typename U>
+  inline bool operator!=(const U& other) const { return asPtr() != other; }
+
+  inline ArrayPtr<T> slice(size_t start, size_t end) KJ_LIFETIMEBOUND {
+    return asPtr().slice(start, end);
+  }
+  inline ArrayPtr<const T> slice(size_t start, size_t end) const KJ_LIFETIMEBOUND {
+    return asPtr().slice(start, end);
+  }
+
+  template <typename... Params>
+  inline T& add(Params&&... params) KJ_LIFETIMEBOUND {
+    if (builder.isFull()) grow();
+    return builder.add(kj::fwd<Params>(params)...);
+  }
+
+  template <typename Iterator>
+  inline void addAll(Iterator begin, Iterator end) {
+    size_t needed = builder.size() + (end - begin);
+    if (needed > builder.capacity()) grow(needed);
+    builder.addAll(begin, end);
+  }
+
+  template <typename Container>
+  inline void addAll(Container&& container) {
+    addAll(container.begin(), container.end());
+  }
+
+  inline void removeLast() {
+    builder.removeLast();
+  }
+
+  inline void resize(size_t size) {
+    if (size > builder.capacity()) grow(size);
+    builder.resize(size);
+  }
+
+  inline void clear() {
+    builder.clear();
+  }
+
+  inline void truncate(size_t size) {
+    builder.truncate(size);
+  }
+
+  inline void reserve(size_t size) {
+    if (size > builder.capacity()) {
+      setCapacity(size);
+    }
+  }
+
+private:
+  union Space {
+    T items[inlineCapacity];
+    inline Space() {}
+    inline ~Space() {}
+  };
+  Space space;
+  // Must be declared before `builder`, which destroys the elements in it.
+
+  ArrayBuilder<T> builder;
+
+  inline T* inlineSpace() { return space.items; }
+  inline const T* inlineSpace() const { return space.items; }
+  inline ArrayBuilder<T> inlineBuilder() {
+    // The elements are destroyed, but the space not freed, when the builder is disposed.
+    return ArrayBuilder<T>(inlineSpace(), inlineCapacity, DestructorOnlyArrayDisposer::instance);
+  }
+
+  void take(SmallVector& other) {
+    if (other.isInline()) {
+      builder.addAll(kj::mv(other.builder));
+      other.clear();
+    } else {
+      builder = kj::mv(other.builder);
+      other.builder = other.inlineBuilder();
+    }
+  }
+
+  void grow(size_t minCapacity = 0) {
+    setCapacity(kj::max(minCapacity, capacity() * 2));
+  }
+  void setCapacity(size_t newSize) {
+    if (builder.size() > newSize) {
+      builder.truncate(newSize);
+    }
+    ArrayBuilder<T> newBuilder = heapArrayBuilder<T>(newSize);
+    newBuilder.addAll(kj::mv(builder));
+    builder = kj::mv(newBuilder);
+  }
+};
+
+template <typename T, size_t inlineCapacity>
+inline auto KJ_STRINGIFY(const SmallVector<T, inlineCapacity>& v)
+    -> decltype(toCharSequence(v.asPtr())) {
+  return toCharSequence(v.asPtr());
+}
+
 }  // namespace kj
 
 KJ_END_HEADER